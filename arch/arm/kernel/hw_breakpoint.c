@@ -627,7 +627,7 @@ int arch_validate_hwbkpt_settings(struct perf_event *bp)
 	 * single-step, but this only works for per-task breakpoints.
 	 */
 	if (!bp->overflow_handler && (arch_check_bp_in_kernelspace(bp) ||
-	    !core_has_mismatch_brps() || !bp->hw.bp_target)) {
+	    !core_has_mismatch_brps() || !bp->hw.target)) {
 		pr_warning("overflow handler required but none found\n");
 		ret = -EINVAL;
 	}
@@ -455,7 +455,8 @@ void update_vsyscall_tz(void)
 }
 
 void update_vsyscall(struct timespec *wall, struct timespec *wtm,
-			struct clocksource *c, u32 mult)
+		     struct timespec *raw, struct timespec *sleep,
+		     struct clocksource *c, u32 mult)
 {
 	write_seqcount_begin(&fsyscall_gtod_data.seq);
 
@@ -713,7 +713,8 @@ static cycle_t timebase_read(struct clocksource *cs)
 }
 
 void update_vsyscall(struct timespec *wall_time, struct timespec *wtm,
-			struct clocksource *clock, u32 mult)
+		     struct timespec *raw, struct timespec *sleep,
+		     struct clocksource *clock, u32 mult)
 {
 	u64 new_tb_to_xs, new_stamp_xsec;
 	u32 frac_sec;
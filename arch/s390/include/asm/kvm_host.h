@@ -149,6 +149,8 @@ struct kvm_vcpu_stat {
 	u32 diagnose_10;
 	u32 diagnose_44;
 	u32 diagnose_9c;
+	u32 halt_successful_poll;
+	u32 halt_attempted_poll;
 };
 
 struct kvm_s390_io_info {
@@ -220,7 +220,8 @@ struct clocksource * __init clocksource_default_clock(void)
 }
 
 void update_vsyscall(struct timespec *wall_time, struct timespec *wtm,
-			struct clocksource *clock, u32 mult)
+		     struct timespec *raw, struct timespec *sleep,
+		     struct clocksource *clock, u32 mult)
 {
 	if (clock != &clocksource_tod)
 		return;
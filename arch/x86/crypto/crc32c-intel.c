@@ -32,6 +32,7 @@
 
 #include <asm/cpufeature.h>
 #include <asm/cpu_device_id.h>
+#include <asm/i387.h>
 
 #define CHKSUM_BLOCK_SIZE	1
 #define CHKSUM_DIGEST_SIZE	4
@@ -80,6 +81,151 @@ static u32 __pure crc32c_intel_le_hw(u32 crc, unsigned char const *p, size_t len
 	return crc;
 }
 
+#ifdef CONFIG_X86_64
+/*
+ * The CRC32 instruction has a latency of three cycles but a throughput of
+ * one per cycle, so a single dependency chain runs it at a third of its
+ * speed.  For large buffers, crc32c_pcl() splits blocks into three lanes
+ * whose CRCs are computed in an interleaved loop and then combined with
+ * carry-less multiplications:
+ *
+ *	crc(A B C) = crc(A) * x^(2 * 8L) + crc(B) * x^(8L) + crc(C)
+ *
+ * for lanes of L bytes.  Multiplying a CRC by x^n is a PCLMULQDQ with the
+ * bit-reflected x^(n - 33) mod P followed by a CRC32 of the 64-bit result;
+ * the extra 33 make up for the 32-bit shift of the CRC32 instruction and
+ * the one bit of the reflected product.
+ */
+#define CRC32C_LANE_LARGE	1024
+#define CRC32C_LANE_SMALL	128
+
+/* Below this, saving the FPU state costs more than the lanes save */
+#define CRC32C_PCL_BREAKEVEN	512
+
+/* x^(2 * 8L - 33) and x^(8L - 33) mod P for the two lane sizes */
+static u64 crc32c_lane_consts[2][2];
+static bool crc32c_use_pcl __read_mostly;
+
+static inline u32 crc32c_u64(u32 crc, u64 v)
+{
+	unsigned long c = crc;
+
+	asm(".byte 0xf2, 0x48, 0xf, 0x38, 0xf1, 0xf1"	/* crc32q %rcx, %rsi */
+	    : "+S" (c) : "c" (v));
+	return c;
+}
+
+/*
+ * crc32q(0, clmul(a, ka) ^ clmul(b, kb)).  The kernel is built without
+ * SSE, so the XMM registers used here cannot be listed as clobbers; the
+ * caller owns them between kernel_fpu_begin() and kernel_fpu_end().
+ */
+static inline u32 crc32c_shift2(u32 a, u64 ka, u32 b, u64 kb)
+{
+	u64 t;
+
+	asm("movq %1, %%xmm0\n\t"
+	    "movq %2, %%xmm1\n\t"
+	    "movq %3, %%xmm2\n\t"
+	    "movq %4, %%xmm3\n\t"
+	    ".byte 0x66, 0x0f, 0x3a, 0x44, 0xc1, 0x00\n\t" /* pclmulqdq $0, %xmm1, %xmm0 */
+	    ".byte 0x66, 0x0f, 0x3a, 0x44, 0xd3, 0x00\n\t" /* pclmulqdq $0, %xmm3, %xmm2 */
+	    "pxor %%xmm2, %%xmm0\n\t"
+	    "movq %%xmm0, %0"
+	    : "=r" (t)
+	    : "r" ((u64)a), "r" (ka), "r" ((u64)b), "r" (kb));
+
+	return crc32c_u64(0, t);
+}
+
+static u32 crc32c_lanes(u32 crc, const u64 *p, unsigned int lane,
+			const u64 *k)
+{
+	const u64 *p1 = p + lane / 8, *p2 = p + 2 * lane / 8;
+	u32 crc1 = 0, crc2 = 0;
+	unsigned int i;
+
+	for (i = 0; i < lane / 8; i++) {
+		crc = crc32c_u64(crc, p[i]);
+		crc1 = crc32c_u64(crc1, p1[i]);
+		crc2 = crc32c_u64(crc2, p2[i]);
+	}
+
+	return crc32c_shift2(crc, k[0], crc1, k[1]) ^ crc2;
+}
+
+/* Must be called between kernel_fpu_begin() and kernel_fpu_end() */
+static u32 crc32c_pcl(u32 crc, const u8 *p, size_t len)
+{
+	while (len >= 3 * CRC32C_LANE_LARGE) {
+		crc = crc32c_lanes(crc, (const u64 *)p, CRC32C_LANE_LARGE,
+				   crc32c_lane_consts[0]);
+		p += 3 * CRC32C_LANE_LARGE;
+		len -= 3 * CRC32C_LANE_LARGE;
+	}
+
+	while (len >= 3 * CRC32C_LANE_SMALL) {
+		crc = crc32c_lanes(crc, (const u64 *)p, CRC32C_LANE_SMALL,
+				   crc32c_lane_consts[1]);
+		p += 3 * CRC32C_LANE_SMALL;
+		len -= 3 * CRC32C_LANE_SMALL;
+	}
+
+	return crc32c_intel_le_hw(crc, p, len);
+}
+
+/* Bit-reflected x^n mod P */
+static u64 __init crc32c_xpow(unsigned int n)
+{
+	u64 r = 1;
+	u32 k = 0;
+	int i;
+
+	while (n--) {
+		r <<= 1;
+		if (r & (1ULL << 32))
+			r ^= 0x11EDC6F41ULL;
+	}
+
+	for (i = 0; i < 32; i++)
+		if (r & (1ULL << i))
+			k |= 1U << (31 - i);
+
+	return k;
+}
+
+static void __init crc32c_pcl_init(void)
+{
+	if (!cpu_has_pclmulqdq)
+		return;
+
+	crc32c_lane_consts[0][0] = crc32c_xpow(2 * 8 * CRC32C_LANE_LARGE - 33);
+	crc32c_lane_consts[0][1] = crc32c_xpow(8 * CRC32C_LANE_LARGE - 33);
+	crc32c_lane_consts[1][0] = crc32c_xpow(2 * 8 * CRC32C_LANE_SMALL - 33);
+	crc32c_lane_consts[1][1] = crc32c_xpow(8 * CRC32C_LANE_SMALL - 33);
+	crc32c_use_pcl = true;
+}
+
+static u32 crc32c_intel_le(u32 crc, const u8 *p, size_t len)
+{
+	if (len >= CRC32C_PCL_BREAKEVEN && crc32c_use_pcl &&
+	    irq_fpu_usable()) {
+		kernel_fpu_begin();
+		crc = crc32c_pcl(crc, p, len);
+		kernel_fpu_end();
+		return crc;
+	}
+
+	return crc32c_intel_le_hw(crc, p, len);
+}
+#else
+static inline void crc32c_pcl_init(void)
+{
+}
+
+#define crc32c_intel_le crc32c_intel_le_hw
+#endif
+
 /*
  * Setting the seed allows arbitrary accumulators and flexible XOR policy
  * If your algorithm starts with ~0, then XOR with ~0 before you set
@@ -113,14 +259,14 @@ static int crc32c_intel_update(struct shash_desc *desc, const u8 *data,
 {
 	u32 *crcp = shash_desc_ctx(desc);
 
-	*crcp = crc32c_intel_le_hw(*crcp, data, len);
+	*crcp = crc32c_intel_le(*crcp, data, len);
 	return 0;
 }
 
 static int __crc32c_intel_finup(u32 *crcp, const u8 *data, unsigned int len,
 				u8 *out)
 {
-	*(__le32 *)out = ~cpu_to_le32(crc32c_intel_le_hw(*crcp, data, len));
+	*(__le32 *)out = ~cpu_to_le32(crc32c_intel_le(*crcp, data, len));
 	return 0;
 }
 
@@ -184,6 +330,7 @@ static int __init crc32c_intel_mod_init(void)
 {
 	if (!x86_match_cpu(crc32c_cpu_id))
 		return -ENODEV;
+	crc32c_pcl_init();
 	return crypto_register_shash(&alg);
 }
 
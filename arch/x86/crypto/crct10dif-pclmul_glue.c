@@ -0,0 +1,164 @@
+/*
+ * T10 DIF CRC16 calculation with PCLMULQDQ instructions.  This file
+ * contains glue code, the folding itself is in crct10dif-pcl-asm_64.S.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/crc-t10dif.h>
+#include <crypto/internal/hash.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <asm/i387.h>
+#include <asm/cpufeature.h>
+#include <asm/cpu_device_id.h>
+
+/* Below this, saving the FPU state costs more than folding saves */
+#define CRCT10DIF_PCL_BREAKEVEN	64
+
+asmlinkage void crc_t10dif_fold(u8 *out, const u8 *buf, unsigned long blocks,
+				const u64 *consts, u64 init);
+
+/* x^(128k) mod P and x^(128k + 64) mod P for k = 1..4 */
+static u64 crct10dif_fold_consts[8] __aligned(16);
+
+struct chksum_desc_ctx {
+	__u16 crc;
+};
+
+static u16 crc_t10dif_pcl(u16 crc, const u8 *buf, size_t len)
+{
+	unsigned long blocks = len / 16;
+	u8 rem[16];
+
+	if (len < CRCT10DIF_PCL_BREAKEVEN || !irq_fpu_usable())
+		return crc_t10dif_generic(crc, buf, len);
+
+	kernel_fpu_begin();
+	crc_t10dif_fold(rem, buf, blocks, crct10dif_fold_consts,
+			(u64)crc << 48);
+	kernel_fpu_end();
+
+	crc = crc_t10dif_generic(0, rem, sizeof(rem));
+	return crc_t10dif_generic(crc, buf + blocks * 16, len % 16);
+}
+
+static int chksum_init(struct shash_desc *desc)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = 0;
+
+	return 0;
+}
+
+static int chksum_update(struct shash_desc *desc, const u8 *data,
+			 unsigned int length)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = crc_t10dif_pcl(ctx->crc, data, length);
+	return 0;
+}
+
+static int chksum_final(struct shash_desc *desc, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	*(__u16 *)out = ctx->crc;
+	return 0;
+}
+
+static int __chksum_finup(__u16 *crcp, const u8 *data, unsigned int len,
+			u8 *out)
+{
+	*(__u16 *)out = crc_t10dif_pcl(*crcp, data, len);
+	return 0;
+}
+
+static int chksum_finup(struct shash_desc *desc, const u8 *data,
+			unsigned int len, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	return __chksum_finup(&ctx->crc, data, len, out);
+}
+
+static int chksum_digest(struct shash_desc *desc, const u8 *data,
+			 unsigned int length, u8 *out)
+{
+	struct chksum_desc_ctx *ctx = shash_desc_ctx(desc);
+
+	ctx->crc = 0;
+	return __chksum_finup(&ctx->crc, data, length, out);
+}
+
+static struct shash_alg alg = {
+	.digestsize		=	CRC_T10DIF_DIGEST_SIZE,
+	.init			=	chksum_init,
+	.update			=	chksum_update,
+	.final			=	chksum_final,
+	.finup			=	chksum_finup,
+	.digest			=	chksum_digest,
+	.descsize		=	sizeof(struct chksum_desc_ctx),
+	.base			=	{
+		.cra_name		=	"crct10dif",
+		.cra_driver_name	=	"crct10dif-pclmul",
+		.cra_priority		=	200,
+		.cra_blocksize		=	CRC_T10DIF_BLOCK_SIZE,
+		.cra_module		=	THIS_MODULE,
+	}
+};
+
+static const struct x86_cpu_id crct10dif_cpu_id[] = {
+	X86_FEATURE_MATCH(X86_FEATURE_PCLMULQDQ),
+	{}
+};
+MODULE_DEVICE_TABLE(x86cpu, crct10dif_cpu_id);
+
+static u64 __init crct10dif_xpow(unsigned int n)
+{
+	u32 r = 1;
+
+	while (n--) {
+		r <<= 1;
+		if (r & 0x10000)
+			r ^= 0x18bb7;
+	}
+
+	return r;
+}
+
+static int __init crct10dif_intel_mod_init(void)
+{
+	int k;
+
+	if (!x86_match_cpu(crct10dif_cpu_id) || !cpu_has_ssse3)
+		return -ENODEV;
+
+	for (k = 1; k <= 4; k++) {
+		crct10dif_fold_consts[2 * k - 2] = crct10dif_xpow(128 * k);
+		crct10dif_fold_consts[2 * k - 1] = crct10dif_xpow(128 * k + 64);
+	}
+
+	return crypto_register_shash(&alg);
+}
+
+static void __exit crct10dif_intel_mod_fini(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(crct10dif_intel_mod_init);
+module_exit(crct10dif_intel_mod_fini);
+
+MODULE_DESCRIPTION("T10 DIF CRC calculation accelerated with PCLMULQDQ.");
+MODULE_LICENSE("GPL");
+
+MODULE_ALIAS("crct10dif");
+MODULE_ALIAS("crct10dif-pclmul");
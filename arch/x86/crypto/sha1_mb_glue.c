@@ -0,0 +1,114 @@
+/*
+ * Cryptographic API.
+ *
+ * Glue code for the multi-buffer SHA1 assembler implementation using AVX2,
+ * hashing eight independent requests at once.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#define pr_fmt(fmt)	KBUILD_MODNAME ": " fmt
+
+#include <crypto/mb_hash.h>
+#include <crypto/sha.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include <asm/i387.h>
+#include <asm/xcr.h>
+#include <asm/xsave.h>
+
+#ifdef CONFIG_AS_AVX2
+
+asmlinkage void sha1_x8_avx2(u32 *digest, const u8 **data, unsigned int blocks);
+
+static const u32 sha1_mb_init_state[] = {
+	SHA1_H0, SHA1_H1, SHA1_H2, SHA1_H3, SHA1_H4,
+};
+
+static void sha1_mb_process(struct mb_hash_lanes *lanes, unsigned int blocks)
+{
+	kernel_fpu_begin();
+	sha1_x8_avx2(lanes->digest[0], lanes->data, blocks);
+	kernel_fpu_end();
+}
+
+static struct mb_hash_alg alg = {
+	.lanes		=	8,
+	.state_words	=	SHA1_DIGEST_SIZE / 4,
+	.init_state	=	sha1_mb_init_state,
+	.process	=	sha1_mb_process,
+	.ahash		=	{
+		.halg.digestsize =	SHA1_DIGEST_SIZE,
+		.halg.base	=	{
+			.cra_name	=	"sha1",
+			.cra_driver_name =	"sha1-mb",
+			/*
+			 * Below sha1-ssse3: batching only pays off for
+			 * users with many requests in flight, who ask for
+			 * it by driver name.
+			 */
+			.cra_priority	=	50,
+			.cra_blocksize	=	SHA1_BLOCK_SIZE,
+			.cra_module	=	THIS_MODULE,
+		}
+	}
+};
+
+static bool __init avx2_usable(void)
+{
+	u64 xcr0;
+
+	if (!boot_cpu_has(X86_FEATURE_AVX2) || !cpu_has_osxsave)
+		return false;
+
+	xcr0 = xgetbv(XCR_XFEATURE_ENABLED_MASK);
+	if ((xcr0 & (XSTATE_SSE | XSTATE_YMM)) != (XSTATE_SSE | XSTATE_YMM)) {
+		pr_info("AVX2 detected but unusable.\n");
+
+		return false;
+	}
+
+	return true;
+}
+
+static int __init sha1_mb_mod_init(void)
+{
+	if (!avx2_usable()) {
+		pr_info("AVX2 is not available/usable.\n");
+		return -ENODEV;
+	}
+
+	return mb_hash_register(&alg);
+}
+
+static void __exit sha1_mb_mod_fini(void)
+{
+	mb_hash_unregister(&alg);
+}
+
+#else
+
+static int __init sha1_mb_mod_init(void)
+{
+	pr_info("Assembler does not support AVX2.\n");
+	return -ENODEV;
+}
+
+static void __exit sha1_mb_mod_fini(void)
+{
+}
+
+#endif
+
+module_init(sha1_mb_mod_init);
+module_exit(sha1_mb_mod_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SHA1 Secure Hash Algorithm, AVX2 multi-buffer accelerated");
+
+MODULE_ALIAS("sha1");
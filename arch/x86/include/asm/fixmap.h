@@ -80,6 +80,8 @@ enum fixed_addresses {
 			    + ((VSYSCALL_END-VSYSCALL_START) >> PAGE_SHIFT) - 1,
 	VVAR_PAGE,
 	VSYSCALL_HPET,
+	VPERCPU_LAST_PAGE,
+	VPERCPU_FIRST_PAGE = VPERCPU_LAST_PAGE + VDSO_PERCPU_PAGES - 1,
 #endif
 	FIX_DBGP_BASE,
 	FIX_EARLYCON_MEM_BASE,
@@ -53,10 +53,15 @@ extern kprobe_opcode_t optprobe_template_val;
 extern kprobe_opcode_t optprobe_template_call;
 extern kprobe_opcode_t optprobe_template_end;
 #define MAX_OPTIMIZED_LENGTH (MAX_INSN_SIZE + RELATIVE_ADDR_SIZE)
+/*
+ * Short jumps are widened to rel32 when copied, by 4 bytes at most,
+ * and no more than 3 of them can start in the replaced bytes.
+ */
+#define MAX_OPTIMIZED_COPY_SIZE (MAX_OPTIMIZED_LENGTH + 3 * 4)
 #define MAX_OPTINSN_SIZE 				\
 	(((unsigned long)&optprobe_template_end -	\
 	  (unsigned long)&optprobe_template_entry) +	\
-	 MAX_OPTIMIZED_LENGTH + RELATIVEJUMP_SIZE)
+	 MAX_OPTIMIZED_COPY_SIZE + RELATIVEJUMP_SIZE)
 
 extern const int kretprobe_blacklist_size;
 
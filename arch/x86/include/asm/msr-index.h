@@ -67,6 +67,10 @@
 #define MSR_IA32_DS_AREA		0x00000600
 #define MSR_IA32_PERF_CAPABILITIES	0x00000345
 
+#define MSR_IA32_QM_EVTSEL		0x00000c8d
+#define MSR_IA32_QM_CTR			0x00000c8e
+#define MSR_IA32_PQR_ASSOC		0x00000c8f
+
 #define MSR_MTRRfix64K_00000		0x00000250
 #define MSR_MTRRfix16K_80000		0x00000258
 #define MSR_MTRRfix16K_A0000		0x00000259
@@ -12,6 +12,7 @@ struct vsyscall_gtod_data {
 		cycle_t	cycle_last;
 		cycle_t	mask;
 		u32	mult;
+		u32	raw_mult;	/* without NTP adjustment */
 		u32	shift;
 	} clock;
 
@@ -24,7 +25,18 @@ struct vsyscall_gtod_data {
 	struct timezone sys_tz;
 	struct timespec wall_time_coarse;
 	struct timespec monotonic_time_coarse;
+	struct timespec raw_time;
+	struct timespec boot_time;
 };
 extern struct vsyscall_gtod_data vsyscall_gtod_data;
 
+extern struct vdso_percpu_data vdso_percpu_data[];
+
+/* Called from __switch_to() on the CPU switching tasks. */
+static inline void vdso_percpu_switch(int cpu)
+{
+	if (cpu < VDSO_PERCPU_NR_CPUS)
+		vdso_percpu_data[cpu].seq++;
+}
+
 #endif /* _ASM_X86_VGTOD_H */
@@ -15,10 +15,29 @@ enum vsyscall_num {
 
 #ifdef __KERNEL__
 #include <linux/seqlock.h>
+#include <linux/cache.h>
 
 #define VGETCPU_RDTSCP	1
 #define VGETCPU_LSL	2
 
+/*
+ * Per-CPU data readable from the vDSO, one cacheline per CPU so that a
+ * CPU updating its own entry never bounces anyone else's. The entries
+ * live in fixmap pages just below the HPET page, at VPERCPU_ADDRESS.
+ * Only the first VDSO_PERCPU_NR_CPUS CPUs get one.
+ */
+struct vdso_percpu_data {
+	unsigned int	seq;	/* bumped on every context switch */
+} ____cacheline_aligned;
+
+#if NR_CPUS < 512
+#define VDSO_PERCPU_NR_CPUS	NR_CPUS
+#else
+#define VDSO_PERCPU_NR_CPUS	512
+#endif
+#define VDSO_PERCPU_PAGES	\
+	((VDSO_PERCPU_NR_CPUS * L1_CACHE_BYTES + PAGE_SIZE - 1) >> PAGE_SHIFT)
+
 /* kernel space (writeable) */
 extern int vgetcpu_mode;
 extern struct timezone sys_tz;
@@ -19,6 +19,9 @@
 /* Base address of vvars.  This is not ABI. */
 #define VVAR_ADDRESS (-10*1024*1024 - 4096)
 
+/* Base of the per-CPU vDSO data, below the HPET page.  Not ABI either. */
+#define VPERCPU_ADDRESS (VVAR_ADDRESS - (1 + VDSO_PERCPU_PAGES) * 4096)
+
 #if defined(__VVAR_KERNEL_LDS)
 
 /* The kernel linker script defines its own magic to put vvars in the
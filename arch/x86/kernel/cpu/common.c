@@ -941,6 +941,9 @@ void __init identify_boot_cpu(void)
 	enable_sep_cpu();
 #else
 	vgetcpu_set_mode();
+	/* Copies larger than the cache would only evict everything else */
+	if (boot_cpu_data.x86_cache_size > 0)
+		memcpy_nt_threshold = boot_cpu_data.x86_cache_size * 1024UL;
 #endif
 	if (boot_cpu_data.cpuid_level >= 2)
 		cpu_detect_tlb(&boot_cpu_data);
@@ -2073,6 +2073,18 @@ __init int intel_pmu_init(void)
 		pr_cont("SandyBridge events, ");
 		break;
 
+	case 60: /* Haswell */
+	case 63: /* Haswell-EP */
+	case 69: /* Haswell-ULT */
+	case 70: /* Haswell with eDRAM */
+		intel_pmu_lbr_init_hsw();
+
+		/* no model specific constraints yet */
+		x86_pmu.event_constraints = intel_gen_event_constraints;
+
+		pr_cont("Haswell events, ");
+		break;
+
 	default:
 		switch (x86_pmu.version) {
 		case 1:
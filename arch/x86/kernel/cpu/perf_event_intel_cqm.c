@@ -0,0 +1,450 @@
+/*
+ * Intel Cache QoS Monitoring and Memory Bandwidth Monitoring support.
+ *
+ * Every logical cpu tags the L3 lines it fills, and the memory traffic
+ * it generates, with the Resource Monitoring ID (RMID) programmed in
+ * its IA32_PQR_ASSOC MSR. Selecting an event and an RMID through
+ * IA32_QM_EVTSEL then makes IA32_QM_CTR return that RMID's L3 occupancy,
+ * or its total/local memory traffic, on the current package.
+ *
+ * All events with the same monitoring target (the same task, or the
+ * same cgroup/cpu pair) share one RMID. PQR_ASSOC is switched from
+ * pmu::add and pmu::del, so it follows the regular perf context and
+ * cgroup switches; only one RMID can be live on a cpu at a time.
+ */
+#include <linux/perf_event.h>
+#include <linux/hrtimer.h>
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+#include <asm/cpufeature.h>
+#include <asm/processor.h>
+#include <asm/msr.h>
+
+#define QOS_L3_OCCUP_EVENT_ID	0x01
+#define QOS_MBM_TOTAL_EVENT_ID	0x02
+#define QOS_MBM_LOCAL_EVENT_ID	0x03
+#define QOS_EVENT_MASK		0xff
+
+#define RMID_VAL_ERROR		(1ULL << 63)
+#define RMID_VAL_UNAVAIL	(1ULL << 62)
+
+/*
+ * The bandwidth counters are narrow (24 bits on the first parts) and
+ * count in cqm_upscale units; the hardware guarantees they do not wrap
+ * in less than a second, so poll them at that rate while active.
+ */
+#define MBM_POLL_NSEC		NSEC_PER_SEC
+
+static u32 cqm_max_rmid;
+static u32 cqm_upscale;
+static u32 cqm_events;		/* bitmask of supported event ids */
+static u64 cqm_mbm_mask;
+
+/*
+ * RMID 0 is what every cpu runs with when nothing is monitored, so it
+ * is never handed out. RMIDs are allocated round-robin: a freed RMID
+ * still owns the lines its previous user left in the cache until they
+ * are evicted, and reusing it last gives them the longest time to go.
+ */
+static unsigned long *cqm_rmid_bitmap;
+static u32 cqm_rmid_next;
+
+/* protects the RMID bitmap and the cache_groups list */
+static DEFINE_MUTEX(cache_mutex);
+static LIST_HEAD(cache_groups);
+
+struct intel_pqr_state {
+	u32	rmid;
+	int	cnt;
+};
+
+static DEFINE_PER_CPU(struct intel_pqr_state, pqr_state);
+
+static struct pmu intel_cqm_pmu;
+
+static u32 __get_rmid(void)
+{
+	u32 rmid;
+
+	rmid = find_next_zero_bit(cqm_rmid_bitmap, cqm_max_rmid + 1,
+				  cqm_rmid_next);
+	if (rmid > cqm_max_rmid)
+		rmid = find_next_zero_bit(cqm_rmid_bitmap, cqm_max_rmid + 1, 1);
+	if (rmid > cqm_max_rmid)
+		return 0;
+
+	__set_bit(rmid, cqm_rmid_bitmap);
+	cqm_rmid_next = rmid + 1;
+
+	return rmid;
+}
+
+static void __put_rmid(u32 rmid)
+{
+	__clear_bit(rmid, cqm_rmid_bitmap);
+}
+
+/*
+ * Read the raw counter of @evt for @rmid on this package. Must be called
+ * with interrupts disabled, EVTSEL/CTR is a shared register pair.
+ */
+static u64 __rmid_read(u32 rmid, u32 evt)
+{
+	u64 val;
+
+	wrmsr(MSR_IA32_QM_EVTSEL, evt, rmid);
+	rdmsrl(MSR_IA32_QM_CTR, val);
+
+	return val;
+}
+
+static bool is_mbm_event(struct perf_event *event)
+{
+	return event->attr.config != QOS_L3_OCCUP_EVENT_ID;
+}
+
+/*
+ * Events monitoring the same thing can share an RMID: the same task,
+ * or the same cpu (and cgroup, if any).
+ */
+static bool __match_event(struct perf_event *a, struct perf_event *b)
+{
+	if ((a->attach_state & PERF_ATTACH_TASK) !=
+	    (b->attach_state & PERF_ATTACH_TASK))
+		return false;
+
+	if (a->attach_state & PERF_ATTACH_TASK)
+		return a->hw.target == b->hw.target;
+
+	if (a->cpu != b->cpu)
+		return false;
+
+#ifdef CONFIG_CGROUP_PERF
+	return a->cgrp == b->cgrp;
+#else
+	return true;
+#endif
+}
+
+static void intel_cqm_event_update(struct perf_event *event)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	unsigned long flags;
+	u64 prev, now;
+
+	local_irq_save(flags);
+	now = __rmid_read(hwc->cqm_rmid, event->attr.config);
+	local_irq_restore(flags);
+
+	if (now & (RMID_VAL_ERROR | RMID_VAL_UNAVAIL))
+		return;
+
+	/* occupancy is a gauge, bandwidth a free running counter */
+	if (!is_mbm_event(event)) {
+		local64_set(&event->count, now * cqm_upscale);
+		return;
+	}
+
+	now &= cqm_mbm_mask;
+	prev = local64_xchg(&hwc->prev_count, now);
+	local64_add(((now - prev) & cqm_mbm_mask) * cqm_upscale,
+		    &event->count);
+}
+
+static enum hrtimer_restart intel_cqm_timer(struct hrtimer *hrtimer)
+{
+	struct perf_event *event;
+
+	event = container_of(hrtimer, struct perf_event, hw.cqm_timer);
+	if (event->state != PERF_EVENT_STATE_ACTIVE)
+		return HRTIMER_NORESTART;
+
+	intel_cqm_event_update(event);
+	hrtimer_forward_now(hrtimer, ns_to_ktime(MBM_POLL_NSEC));
+
+	return HRTIMER_RESTART;
+}
+
+static void intel_cqm_event_start(struct perf_event *event, int mode)
+{
+	struct hw_perf_event *hwc = &event->hw;
+	u64 val;
+
+	if (!(hwc->state & PERF_HES_STOPPED))
+		return;
+
+	hwc->state &= ~PERF_HES_STOPPED;
+
+	if (!is_mbm_event(event))
+		return;
+
+	/*
+	 * The bandwidth counter is per package; take a fresh snapshot on
+	 * every start so a task migrating between packages only
+	 * accumulates deltas of the package it ran on.
+	 */
+	val = __rmid_read(hwc->cqm_rmid, event->attr.config);
+	if (val & (RMID_VAL_ERROR | RMID_VAL_UNAVAIL))
+		val = 0;
+	local64_set(&hwc->prev_count, val & cqm_mbm_mask);
+
+	__hrtimer_start_range_ns(&hwc->cqm_timer, ns_to_ktime(MBM_POLL_NSEC),
+				 0, HRTIMER_MODE_REL_PINNED, 0);
+}
+
+static void intel_cqm_event_stop(struct perf_event *event, int mode)
+{
+	struct hw_perf_event *hwc = &event->hw;
+
+	if (hwc->state & PERF_HES_STOPPED)
+		return;
+
+	if (is_mbm_event(event))
+		hrtimer_cancel(&hwc->cqm_timer);
+
+	intel_cqm_event_update(event);
+	hwc->state |= PERF_HES_STOPPED;
+}
+
+static int intel_cqm_event_add(struct perf_event *event, int mode)
+{
+	struct intel_pqr_state *state = &__get_cpu_var(pqr_state);
+	u32 rmid = event->hw.cqm_rmid;
+
+	/* the cpu is already tagging for a different target */
+	if (state->cnt && state->rmid != rmid)
+		return -EBUSY;
+
+	if (!state->cnt++) {
+		state->rmid = rmid;
+		wrmsr(MSR_IA32_PQR_ASSOC, rmid, 0);
+	}
+
+	event->hw.state = PERF_HES_STOPPED;
+	if (mode & PERF_EF_START)
+		intel_cqm_event_start(event, mode);
+
+	return 0;
+}
+
+static void intel_cqm_event_del(struct perf_event *event, int mode)
+{
+	struct intel_pqr_state *state = &__get_cpu_var(pqr_state);
+
+	intel_cqm_event_stop(event, PERF_EF_UPDATE);
+
+	if (!--state->cnt) {
+		state->rmid = 0;
+		wrmsr(MSR_IA32_PQR_ASSOC, 0, 0);
+	}
+}
+
+static void intel_cqm_event_read(struct perf_event *event)
+{
+	if (event->hw.state & PERF_HES_STOPPED)
+		return;
+
+	intel_cqm_event_update(event);
+}
+
+static void intel_cqm_event_destroy(struct perf_event *event)
+{
+	struct perf_event *group_other = NULL;
+
+	mutex_lock(&cache_mutex);
+
+	/* hand the RMID over to the next event of the group, if any */
+	if (!list_empty(&event->hw.cqm_events_entry)) {
+		group_other = list_first_entry(&event->hw.cqm_events_entry,
+					       struct perf_event,
+					       hw.cqm_events_entry);
+		list_del(&event->hw.cqm_events_entry);
+	}
+
+	if (!list_empty(&event->hw.cqm_groups_entry)) {
+		if (group_other) {
+			list_replace(&event->hw.cqm_groups_entry,
+				     &group_other->hw.cqm_groups_entry);
+		} else {
+			__put_rmid(event->hw.cqm_rmid);
+			list_del(&event->hw.cqm_groups_entry);
+		}
+	}
+
+	mutex_unlock(&cache_mutex);
+}
+
+static int intel_cqm_event_init(struct perf_event *event)
+{
+	struct perf_event *iter, *group = NULL;
+	u64 cfg = event->attr.config;
+	int ret = 0;
+
+	if (event->attr.type != intel_cqm_pmu.type)
+		return -ENOENT;
+
+	if ((cfg & ~QOS_EVENT_MASK) || cfg >= 32 || !(cqm_events & (1U << cfg)))
+		return -EINVAL;
+
+	/* the hardware can neither filter nor interrupt */
+	if (event->attr.exclude_user || event->attr.exclude_kernel ||
+	    event->attr.exclude_hv || event->attr.exclude_idle ||
+	    event->attr.exclude_host || event->attr.exclude_guest ||
+	    is_sampling_event(event))
+		return -EINVAL;
+
+	INIT_LIST_HEAD(&event->hw.cqm_events_entry);
+	INIT_LIST_HEAD(&event->hw.cqm_groups_entry);
+	hrtimer_init(&event->hw.cqm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	event->hw.cqm_timer.function = intel_cqm_timer;
+
+	mutex_lock(&cache_mutex);
+
+	list_for_each_entry(iter, &cache_groups, hw.cqm_groups_entry) {
+		if (__match_event(iter, event)) {
+			group = iter;
+			break;
+		}
+	}
+
+	if (group) {
+		event->hw.cqm_rmid = group->hw.cqm_rmid;
+		list_add_tail(&event->hw.cqm_events_entry,
+			      &group->hw.cqm_events_entry);
+	} else {
+		event->hw.cqm_rmid = __get_rmid();
+		if (event->hw.cqm_rmid)
+			list_add_tail(&event->hw.cqm_groups_entry, &cache_groups);
+		else
+			ret = -EBUSY;
+	}
+
+	mutex_unlock(&cache_mutex);
+
+	if (!ret)
+		event->destroy = intel_cqm_event_destroy;
+
+	return ret;
+}
+
+#define CQM_EVENT_ATTR(_name, _id)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *page)	\
+{									\
+	return sprintf(page, "event=0x%02x\n", _id);			\
+}									\
+static struct device_attribute event_attr_##_name = __ATTR_RO(_name)
+
+CQM_EVENT_ATTR(llc_occupancy, QOS_L3_OCCUP_EVENT_ID);
+CQM_EVENT_ATTR(total_bytes, QOS_MBM_TOTAL_EVENT_ID);
+CQM_EVENT_ATTR(local_bytes, QOS_MBM_LOCAL_EVENT_ID);
+
+/* indexed by event id - 1 */
+static struct attribute *intel_cqm_events_attr[] = {
+	&event_attr_llc_occupancy.attr,
+	&event_attr_total_bytes.attr,
+	&event_attr_local_bytes.attr,
+	NULL,
+};
+
+static umode_t intel_cqm_events_visible(struct kobject *kobj,
+					struct attribute *attr, int i)
+{
+	return (cqm_events & (1U << (i + 1))) ? attr->mode : 0;
+}
+
+static struct attribute_group intel_cqm_events_group = {
+	.name		= "events",
+	.attrs		= intel_cqm_events_attr,
+	.is_visible	= intel_cqm_events_visible,
+};
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *intel_cqm_formats_attr[] = {
+	&format_attr_event.attr,
+	NULL,
+};
+
+static struct attribute_group intel_cqm_format_group = {
+	.name	= "format",
+	.attrs	= intel_cqm_formats_attr,
+};
+
+static const struct attribute_group *intel_cqm_attr_groups[] = {
+	&intel_cqm_events_group,
+	&intel_cqm_format_group,
+	NULL,
+};
+
+static struct pmu intel_cqm_pmu = {
+	.attr_groups	= intel_cqm_attr_groups,
+	.task_ctx_nr	= perf_sw_context,
+	.event_init	= intel_cqm_event_init,
+	.add		= intel_cqm_event_add,
+	.del		= intel_cqm_event_del,
+	.start		= intel_cqm_event_start,
+	.stop		= intel_cqm_event_stop,
+	.read		= intel_cqm_event_read,
+};
+
+static void intel_cqm_cpu_reset(void *info)
+{
+	struct intel_pqr_state *state = &__get_cpu_var(pqr_state);
+
+	state->rmid = 0;
+	state->cnt = 0;
+	wrmsr(MSR_IA32_PQR_ASSOC, 0, 0);
+}
+
+static int __init intel_cqm_init(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	int i, ret;
+
+	if (!boot_cpu_has(X86_FEATURE_CQM) || boot_cpu_data.cpuid_level < 0xf)
+		return -ENODEV;
+
+	/* leaf 0xf.0: EDX bit 1 is L3 monitoring */
+	cpuid_count(0xf, 0, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 1)))
+		return -ENODEV;
+
+	/*
+	 * leaf 0xf.1: EBX is the counter unit in bytes, ECX the highest
+	 * RMID, EDX the supported events (bit n is event id n + 1) and
+	 * EAX[7:0] the bandwidth counter width beyond 24 bits.
+	 */
+	cpuid_count(0xf, 1, &eax, &ebx, &ecx, &edx);
+	cqm_upscale = ebx;
+	cqm_max_rmid = ecx;
+	cqm_mbm_mask = (1ULL << (24 + (eax & 0xff))) - 1;
+	for (i = QOS_L3_OCCUP_EVENT_ID; i <= QOS_MBM_LOCAL_EVENT_ID; i++) {
+		if (edx & (1 << (i - 1)))
+			cqm_events |= 1U << i;
+	}
+
+	if (!cqm_max_rmid || !cqm_events)
+		return -ENODEV;
+
+	cqm_rmid_bitmap = kzalloc(BITS_TO_LONGS(cqm_max_rmid + 1) *
+				  sizeof(long), GFP_KERNEL);
+	if (!cqm_rmid_bitmap)
+		return -ENOMEM;
+	__set_bit(0, cqm_rmid_bitmap);
+	cqm_rmid_next = 1;
+
+	on_each_cpu(intel_cqm_cpu_reset, NULL, 1);
+
+	ret = perf_pmu_register(&intel_cqm_pmu, "intel_cqm", -1);
+	if (ret) {
+		kfree(cqm_rmid_bitmap);
+		return ret;
+	}
+
+	pr_info("Intel CQM monitoring enabled, %u RMIDs, events 0x%x\n",
+		cqm_max_rmid + 1, cqm_events);
+
+	return 0;
+}
+device_initcall(intel_cqm_init);
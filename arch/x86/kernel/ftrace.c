@@ -20,6 +20,7 @@
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/module.h>
+#include <linux/moduleloader.h>
 
 #include <trace/syscall.h>
 
@@ -206,14 +207,25 @@ static int
 ftrace_modify_code(unsigned long ip, unsigned const char *old_code,
 		   unsigned const char *new_code);
 
-int ftrace_update_ftrace_func(ftrace_func_t func)
+/*
+ * The call in ftrace_caller, or in a trampoline, that is being
+ * modified. Only one of them is updated at a time.
+ */
+static unsigned long ftrace_update_func;
+
+static int update_ftrace_func(unsigned long ip, unsigned long func)
 {
-	unsigned long ip = (unsigned long)(&ftrace_call);
 	unsigned char old[MCOUNT_INSN_SIZE], *new;
 	int ret;
 
-	memcpy(old, &ftrace_call, MCOUNT_INSN_SIZE);
-	new = ftrace_call_replace(ip, (unsigned long)func);
+	if (probe_kernel_read(old, (void *)ip, MCOUNT_INSN_SIZE))
+		return -EFAULT;
+
+	new = ftrace_call_replace(ip, func);
+	if (memcmp(old, new, MCOUNT_INSN_SIZE) == 0)
+		return 0;
+
+	ftrace_update_func = ip;
 
 	/* See comment above by declaration of modifying_ftrace_code */
 	atomic_inc(&modifying_ftrace_code);
@@ -222,9 +234,22 @@ int ftrace_update_ftrace_func(ftrace_func_t func)
 
 	atomic_dec(&modifying_ftrace_code);
 
+	ftrace_update_func = 0;
+
 	return ret;
 }
 
+int ftrace_update_ftrace_func(ftrace_func_t func)
+{
+	return update_ftrace_func((unsigned long)(&ftrace_call),
+				  (unsigned long)func);
+}
+
+static int is_ftrace_caller(unsigned long ip)
+{
+	return ip == ftrace_update_func;
+}
+
 /*
  * A breakpoint was added to the code address we are about to
  * modify, and this is the handle that will just skip over it.
@@ -234,10 +259,13 @@ int ftrace_update_ftrace_func(ftrace_func_t func)
  */
 int ftrace_int3_handler(struct pt_regs *regs)
 {
+	unsigned long ip;
+
 	if (WARN_ON_ONCE(!regs))
 		return 0;
 
-	if (!ftrace_location(regs->ip - 1))
+	ip = regs->ip - 1;
+	if (!ftrace_location(ip) && !is_ftrace_caller(ip))
 		return 0;
 
 	regs->ip += MCOUNT_INSN_SIZE - 1;
@@ -306,7 +334,7 @@ static int add_breakpoints(struct dyn_ftrace *rec, int enable)
 
 	ret = ftrace_test_record(rec, enable);
 
-	ftrace_addr = (unsigned long)FTRACE_ADDR;
+	ftrace_addr = ftrace_get_addr_curr(rec);
 
 	switch (ret) {
 	case FTRACE_UPDATE_IGNORE:
@@ -316,6 +344,8 @@ static int add_breakpoints(struct dyn_ftrace *rec, int enable)
 		/* converting nop to call */
 		return add_brk_on_nop(rec);
 
+	case FTRACE_UPDATE_MODIFY_CALL:
+		/* converting a call to another call */
 	case FTRACE_UPDATE_MAKE_NOP:
 		/* converting a call to a nop */
 		return add_brk_on_call(rec, ftrace_addr);
@@ -358,13 +388,19 @@ static int remove_breakpoint(struct dyn_ftrace *rec)
 		 * For extra paranoidism, we check if the breakpoint is on
 		 * a call that would actually jump to the ftrace_addr.
 		 * If not, don't touch the breakpoint, we make just create
-		 * a disaster.
+		 * a disaster. The record may be on its way to or from
+		 * a trampoline, so check both ends.
 		 */
-		ftrace_addr = (unsigned long)FTRACE_ADDR;
+		ftrace_addr = ftrace_get_addr_new(rec);
 		nop = ftrace_call_replace(ip, ftrace_addr);
 
-		if (memcmp(&ins[1], &nop[1], MCOUNT_INSN_SIZE - 1) != 0)
-			return -EINVAL;
+		if (memcmp(&ins[1], &nop[1], MCOUNT_INSN_SIZE - 1) != 0) {
+			ftrace_addr = ftrace_get_addr_curr(rec);
+			nop = ftrace_call_replace(ip, ftrace_addr);
+
+			if (memcmp(&ins[1], &nop[1], MCOUNT_INSN_SIZE - 1) != 0)
+				return -EINVAL;
+		}
 	}
 
 	return probe_kernel_write((void *)ip, &nop[0], 1);
@@ -405,12 +441,13 @@ static int add_update(struct dyn_ftrace *rec, int enable)
 
 	ret = ftrace_test_record(rec, enable);
 
-	ftrace_addr = (unsigned long)FTRACE_ADDR;
+	ftrace_addr = ftrace_get_addr_new(rec);
 
 	switch (ret) {
 	case FTRACE_UPDATE_IGNORE:
 		return 0;
 
+	case FTRACE_UPDATE_MODIFY_CALL:
 	case FTRACE_UPDATE_MAKE_CALL:
 		/* converting nop to call */
 		return add_update_call(rec, ftrace_addr);
@@ -453,14 +490,15 @@ static int finish_update(struct dyn_ftrace *rec, int enable)
 	unsigned long ftrace_addr;
 	int ret;
 
-	ret = ftrace_update_record(rec, enable);
+	ftrace_addr = ftrace_get_addr_new(rec);
 
-	ftrace_addr = (unsigned long)FTRACE_ADDR;
+	ret = ftrace_update_record(rec, enable);
 
 	switch (ret) {
 	case FTRACE_UPDATE_IGNORE:
 		return 0;
 
+	case FTRACE_UPDATE_MODIFY_CALL:
 	case FTRACE_UPDATE_MAKE_CALL:
 		/* converting nop to call */
 		return finish_update_call(rec, ftrace_addr);
@@ -586,6 +624,119 @@ void arch_ftrace_update_code(int command)
 	atomic_dec(&modifying_ftrace_code);
 }
 
+#ifdef CONFIG_X86_64
+/*
+ * A trampoline is a copy of ftrace_caller, from its start up to
+ * ftrace_caller_end, followed by a jump back to ftrace_epilogue
+ * for the function graph tracer and the return. Its call at the
+ * ftrace_call offset goes straight to ops->func.
+ *
+ * Only static ftrace_ops get one, so trampolines are never freed,
+ * and a trampoline is reused whenever its ops is registered again.
+ */
+extern void ftrace_caller_end(void);
+extern void ftrace_epilogue(void);
+
+static unsigned long calc_trampoline_call_offset(void)
+{
+	return (unsigned long)&ftrace_call - (unsigned long)ftrace_caller;
+}
+
+static unsigned long create_trampoline(struct ftrace_ops *ops)
+{
+	unsigned long start = (unsigned long)ftrace_caller;
+	unsigned long end = (unsigned long)ftrace_caller_end;
+	unsigned long size = end - start;
+	union ftrace_code_union jmp;
+	unsigned long ip;
+	void *trampoline;
+
+	trampoline = module_alloc(size + MCOUNT_INSN_SIZE);
+	if (!trampoline)
+		return 0;
+
+	if (probe_kernel_read(trampoline, (void *)start, size)) {
+		module_free(NULL, trampoline);
+		return 0;
+	}
+
+	/* jmp ftrace_epilogue, the jump offset is relative to the copy */
+	ip = (unsigned long)trampoline + size;
+	jmp.e8 = 0xe9;
+	jmp.offset = ftrace_calc_offset(ip + MCOUNT_INSN_SIZE,
+					(unsigned long)ftrace_epilogue);
+	memcpy((void *)ip, jmp.code, MCOUNT_INSN_SIZE);
+
+	/* Nothing calls into it yet, so the call can be set directly */
+	ip = (unsigned long)trampoline + calc_trampoline_call_offset();
+	memcpy((void *)ip, ftrace_call_replace(ip, (unsigned long)ops->func),
+	       MCOUNT_INSN_SIZE);
+
+	ops->trampoline_size = size + MCOUNT_INSN_SIZE;
+
+	return (unsigned long)trampoline;
+}
+
+void arch_ftrace_update_trampoline(struct ftrace_ops *ops)
+{
+	unsigned long ip;
+	int ret;
+
+	if (!ops->trampoline) {
+		/* On failure the records of ops just keep using ftrace_caller */
+		ops->trampoline = create_trampoline(ops);
+		return;
+	}
+
+	ip = ops->trampoline + calc_trampoline_call_offset();
+
+	ret = update_ftrace_func(ip, (unsigned long)ops->func);
+	WARN_ON(ret);
+}
+
+/*
+ * Only the call site knows which trampoline it calls: the ops that
+ * set it up may already have dropped the record from its hashes.
+ * Make sure the target really is a trampoline before trusting it.
+ */
+static int is_ftrace_trampoline(unsigned long addr)
+{
+	unsigned long size = calc_trampoline_call_offset();
+	unsigned char code[16];
+	unsigned long offset;
+	unsigned long len;
+
+	for (offset = 0; offset < size; offset += len) {
+		len = min(size - offset, sizeof(code));
+		if (probe_kernel_read(code, (void *)(addr + offset), len))
+			return 0;
+		if (memcmp(code, (void *)ftrace_caller + offset, len) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+unsigned long ftrace_get_addr_curr(struct dyn_ftrace *rec)
+{
+	unsigned char code[MCOUNT_INSN_SIZE];
+	unsigned long addr;
+
+	if (!(rec->flags & FTRACE_FL_TRAMP_EN))
+		return (unsigned long)FTRACE_ADDR;
+
+	/* The first byte may be a breakpoint, the offset is still intact */
+	if (probe_kernel_read(code, (void *)rec->ip, MCOUNT_INSN_SIZE))
+		return (unsigned long)FTRACE_ADDR;
+
+	addr = rec->ip + MCOUNT_INSN_SIZE + *(int *)&code[1];
+	if (!is_ftrace_trampoline(addr))
+		return (unsigned long)FTRACE_ADDR;
+
+	return addr;
+}
+#endif /* CONFIG_X86_64 */
+
 int __init ftrace_dyn_arch_init(void *data)
 {
 	/* The return code is retured via data */
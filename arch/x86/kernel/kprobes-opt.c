@@ -172,15 +172,95 @@ static void __kprobes optimized_callback(struct optimized_kprobe *op, struct pt_
 	local_irq_restore(flags);
 }
 
-static int __kprobes copy_optimized_instructions(u8 *dest, u8 *src)
+/*
+ * Relative jumps can run from the detour buffer too, once their
+ * displacement is recomputed for the copy. Short forms are widened to
+ * rel32, as the buffer is usually out of their reach. Calls are not
+ * copied: the callee could sleep and return into a freed buffer.
+ * Returns the size of the copy, 0 if @src is not a relative jump, or
+ * a negative error if it is one that cannot be relocated.
+ */
+static int __kprobes copy_relative_jump(u8 *dest, u8 *src, int *src_len)
 {
-	int len = 0, ret;
+	kprobe_opcode_t buf[MAX_INSN_SIZE];
+	struct insn insn;
+	unsigned long target;
+	u8 opcode[2];
+	int oplen;
+	long rel;
+
+	kernel_insn_init(&insn, (void *)recover_probed_instruction(buf, (unsigned long)src));
+	insn_get_length(&insn);
+
+	switch (insn.opcode.bytes[0]) {
+	case 0xe9:	/* near relative jump */
+		if (insn.length != 5)
+			return -EINVAL;
+		/* fall through */
+	case 0xeb:	/* short relative jump */
+		opcode[0] = RELATIVEJUMP_OPCODE;
+		oplen = 1;
+		break;
+	case 0x0f:
+		if ((insn.opcode.bytes[1] & 0xf0) != 0x80)	/* jcc near */
+			return 0;
+		if (insn.length != 6)
+			return -EINVAL;
+		opcode[0] = 0x0f;
+		opcode[1] = insn.opcode.bytes[1];
+		oplen = 2;
+		break;
+	default:
+		if ((insn.opcode.bytes[0] & 0xf0) != 0x70)	/* jcc short */
+			return 0;
+		opcode[0] = 0x0f;
+		opcode[1] = 0x80 | (insn.opcode.bytes[0] & 0x0f);
+		oplen = 2;
+		break;
+	}
+
+	/* Prefixed forms (e.g. 16bit operand size) are left alone */
+	if (insn.prefixes.nbytes)
+		return -EINVAL;
+
+	target = (unsigned long)src + insn.length + insn.immediate.value;
+	rel = (long)target - ((long)dest + oplen + RELATIVE_ADDR_SIZE);
+	if (rel != (long)(s32)rel)
+		return -ERANGE;
+
+	memcpy(dest, opcode, oplen);
+	*(s32 *)(dest + oplen) = (s32)rel;
+	*src_len = insn.length;
+
+	return oplen + RELATIVE_ADDR_SIZE;
+}
+
+/*
+ * Copy the instructions replaced by the jump into @dest. Returns the
+ * number of bytes they take at @src, the size of their copy is set
+ * in @copy_size.
+ */
+static int __kprobes copy_optimized_instructions(u8 *dest, u8 *src,
+						 int *copy_size)
+{
+	int len = 0, size = 0, ret, src_len;
 
 	while (len < RELATIVEJUMP_SIZE) {
-		ret = __copy_instruction(dest + len, src + len);
-		if (!ret || !can_boost(dest + len))
+		if (size + MAX_INSN_SIZE > MAX_OPTIMIZED_COPY_SIZE)
+			return -EINVAL;
+		ret = copy_relative_jump(dest + size, src + len, &src_len);
+		if (ret < 0)
+			return ret;
+		if (ret) {
+			len += src_len;
+			size += ret;
+			continue;
+		}
+		ret = __copy_instruction(dest + size, src + len);
+		if (!ret || !can_boost(dest + size))
 			return -EINVAL;
 		len += ret;
+		size += ret;
 	}
 	/* Check whether the address range is reserved */
 	if (ftrace_text_reserved(src, src + len - 1) ||
@@ -188,6 +268,8 @@ static int __kprobes copy_optimized_instructions(u8 *dest, u8 *src)
 	    jump_label_text_reserved(src, src + len - 1))
 		return -EBUSY;
 
+	*copy_size = size;
+
 	return len;
 }
 
@@ -324,7 +406,7 @@ void __kprobes arch_remove_optimized_kprobe(struct optimized_kprobe *op)
 int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 {
 	u8 *buf;
-	int ret;
+	int ret, size;
 	long rel;
 
 	if (!can_optimize((unsigned long)op->kp.addr))
@@ -345,7 +427,8 @@ int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 	buf = (u8 *)op->optinsn.insn;
 
 	/* Copy instructions into the out-of-line buffer */
-	ret = copy_optimized_instructions(buf + TMPL_END_IDX, op->kp.addr);
+	ret = copy_optimized_instructions(buf + TMPL_END_IDX, op->kp.addr,
+					  &size);
 	if (ret < 0) {
 		__arch_remove_optimized_kprobe(op, 0);
 		return ret;
@@ -362,12 +445,12 @@ int __kprobes arch_prepare_optimized_kprobe(struct optimized_kprobe *op)
 	synthesize_relcall(buf + TMPL_CALL_IDX, optimized_callback);
 
 	/* Set returning jmp instruction at the tail of out-of-line buffer */
-	synthesize_reljump(buf + TMPL_END_IDX + op->optinsn.size,
+	synthesize_reljump(buf + TMPL_END_IDX + size,
 			   (u8 *)op->kp.addr + op->optinsn.size);
 
 	flush_icache_range((unsigned long) buf,
 			   (unsigned long) buf + TMPL_END_IDX +
-			   op->optinsn.size + RELATIVEJUMP_SIZE);
+			   size + RELATIVEJUMP_SIZE);
 	return 0;
 }
 
@@ -399,6 +482,10 @@ static void __kprobes setup_optimize_kprobe(struct text_poke_param *tprm,
 /*
  * Replace breakpoints (int3) with relative jumps.
  * Caller must call with locking kprobe_mutex and text_mutex.
+ *
+ * The whole list is done here, MAX_OPTIMIZE_PROBES at a time, so
+ * that a large batch of new probes costs a single quiescence wait
+ * in the optimizer rather than one per MAX_OPTIMIZE_PROBES.
  */
 void __kprobes arch_optimize_kprobes(struct list_head *oplist)
 {
@@ -411,8 +498,10 @@ void __kprobes arch_optimize_kprobes(struct list_head *oplist)
 		setup_optimize_kprobe(&jump_poke_params[c],
 				      jump_poke_bufs[c].buf, op);
 		list_del_init(&op->list);
-		if (++c >= MAX_OPTIMIZE_PROBES)
-			break;
+		if (++c >= MAX_OPTIMIZE_PROBES) {
+			text_poke_smp_batch(jump_poke_params, c);
+			c = 0;
+		}
 	}
 
 	/*
@@ -420,7 +509,8 @@ void __kprobes arch_optimize_kprobes(struct list_head *oplist)
 	 * However, since kprobes itself also doesn't support NMI/MCE
 	 * code probing, it's not a problem.
 	 */
-	text_poke_smp_batch(jump_poke_params, c);
+	if (c)
+		text_poke_smp_batch(jump_poke_params, c);
 }
 
 static void __kprobes setup_unoptimize_kprobe(struct text_poke_param *tprm,
@@ -451,8 +541,10 @@ extern void arch_unoptimize_kprobes(struct list_head *oplist,
 		setup_unoptimize_kprobe(&jump_poke_params[c],
 					jump_poke_bufs[c].buf, op);
 		list_move(&op->list, done_list);
-		if (++c >= MAX_OPTIMIZE_PROBES)
-			break;
+		if (++c >= MAX_OPTIMIZE_PROBES) {
+			text_poke_smp_batch(jump_poke_params, c);
+			c = 0;
+		}
 	}
 
 	/*
@@ -460,7 +552,8 @@ extern void arch_unoptimize_kprobes(struct list_head *oplist,
 	 * However, since kprobes itself also doesn't support NMI/MCE
 	 * code probing, it's not a problem.
 	 */
-	text_poke_smp_batch(jump_poke_params, c);
+	if (c)
+		text_poke_smp_batch(jump_poke_params, c);
 }
 
 /* Replace a relative jump with a breakpoint (int3).  */
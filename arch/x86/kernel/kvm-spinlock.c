@@ -0,0 +1,247 @@
+/*
+ * Paravirtualized ticket spinlocks for KVM guests.
+ *
+ * Split out of kvm.c so it can be compiled in a FTRACE-compatible way.
+ *
+ * A vcpu waiting on a ticket lock spins for a while and then halts
+ * instead of burning its time slice while the holder may be preempted.
+ * The unlocker kicks the vcpu that owns the next ticket with
+ * KVM_HC_KICK_CPU, which makes it runnable again even though it halted
+ * with interrupts disabled.
+ *
+ * The lock word keeps the native ticket layout, so locks taken before
+ * the switch to these operations stay valid.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/kvm_para.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/init.h>
+
+#include <asm/paravirt.h>
+#include <asm/smp.h>
+
+/* Number of spins on a contended ticket before the vcpu halts */
+static unsigned int spin_threshold = 1 << 11;
+
+#ifdef CONFIG_KVM_DEBUG_FS
+static struct kvm_spinlock_stats {
+	u32 taken_slow;
+	u32 taken_slow_pickup;
+	u32 released_slow;
+	u32 released_slow_kicked;
+} spinlock_stats;
+
+#define ADD_STATS(elem, val)	(spinlock_stats.elem += (val))
+#else
+#define ADD_STATS(elem, val)	do { (void)(val); } while (0)
+#endif
+
+struct kvm_lock_waiting {
+	struct arch_spinlock *lock;
+	__ticket_t want;
+};
+
+/* cpus halted in kvm_lock_spinning(), and how many there are */
+static DEFINE_PER_CPU(struct kvm_lock_waiting, lock_waiting);
+static cpumask_t waiting_cpus;
+static atomic_t nr_waiting;
+
+/* Kick a cpu by its apicid.  Used to wake up a halted vcpu. */
+static void kvm_kick_cpu(int cpu)
+{
+	int apicid;
+	unsigned long flags = 0;
+
+	apicid = per_cpu(x86_cpu_to_apicid, cpu);
+	kvm_hypercall2(KVM_HC_KICK_CPU, flags, apicid);
+}
+
+static noinline void kvm_lock_spinning(struct arch_spinlock *lock,
+				       __ticket_t want, bool irq_enable)
+{
+	struct kvm_lock_waiting *w;
+	unsigned long flags;
+	int cpu;
+
+	/*
+	 * Make sure an interrupt handler can't upset things in a
+	 * partially setup state.
+	 */
+	local_irq_save(flags);
+
+	w = &__get_cpu_var(lock_waiting);
+	cpu = smp_processor_id();
+
+	/*
+	 * The "lock" pointer may only be set non-NULL while "want" is
+	 * correct, so clear it before updating the ticket.
+	 */
+	w->lock = NULL;
+	smp_wmb();
+	w->want = want;
+	smp_wmb();
+	w->lock = lock;
+
+	ADD_STATS(taken_slow, 1);
+
+	/*
+	 * Announce ourselves before looking at the lock again.  The
+	 * locked increment orders this against the unlocker, which
+	 * releases the lock before it checks nr_waiting.
+	 */
+	cpumask_set_cpu(cpu, &waiting_cpus);
+	atomic_inc(&nr_waiting);
+
+	/* check again make sure it didn't become free while
+	   we weren't looking */
+	if (ACCESS_ONCE(lock->tickets.head) == want) {
+		ADD_STATS(taken_slow_pickup, 1);
+		goto out;
+	}
+
+	/*
+	 * Halt until it's our turn and we are kicked.  A kick that
+	 * arrives before the halt leaves the vcpu runnable, so the halt
+	 * returns at once.  With interrupts allowed use a safe halt: an
+	 * interrupt handler that takes its own slow path overwrites our
+	 * lock_waiting entry, and returning to the spin loop afterwards
+	 * makes sure we do not sleep on a kick that went to it.
+	 */
+	if (irq_enable || !arch_irqs_disabled_flags(flags))
+		safe_halt();
+	else
+		halt();
+
+out:
+	atomic_dec(&nr_waiting);
+	cpumask_clear_cpu(cpu, &waiting_cpus);
+	w->lock = NULL;
+	local_irq_restore(flags);
+}
+
+static noinline void kvm_unlock_kick(struct arch_spinlock *lock,
+				     __ticket_t ticket)
+{
+	int cpu;
+
+	ADD_STATS(released_slow, 1);
+
+	for_each_cpu(cpu, &waiting_cpus) {
+		const struct kvm_lock_waiting *w = &per_cpu(lock_waiting, cpu);
+
+		if (ACCESS_ONCE(w->lock) == lock &&
+		    ACCESS_ONCE(w->want) == ticket) {
+			ADD_STATS(released_slow_kicked, 1);
+			kvm_kick_cpu(cpu);
+			break;
+		}
+	}
+}
+
+static inline void __kvm_spin_lock(struct arch_spinlock *lock, bool irq_enable)
+{
+	register struct __raw_tickets inc = { .tail = 1 };
+
+	inc = xadd(&lock->tickets, inc);
+
+	for (;;) {
+		unsigned int count = spin_threshold;
+
+		do {
+			if (ACCESS_ONCE(lock->tickets.head) == inc.tail)
+				goto out;
+			cpu_relax();
+		} while (--count);
+		kvm_lock_spinning(lock, inc.tail, irq_enable);
+	}
+out:
+	barrier();	/* make sure nothing creeps before the lock is taken */
+}
+
+static void kvm_spin_lock(struct arch_spinlock *lock)
+{
+	__kvm_spin_lock(lock, false);
+}
+
+static void kvm_spin_lock_flags(struct arch_spinlock *lock,
+				unsigned long flags)
+{
+	__kvm_spin_lock(lock, !arch_irqs_disabled_flags(flags));
+}
+
+static void kvm_spin_unlock(struct arch_spinlock *lock)
+{
+	/* the lock may be freed once released; only use its address after */
+	__ticket_t next = lock->tickets.head + 1;
+
+	__ticket_spin_unlock(lock);
+
+	/*
+	 * Order the release against the check for halted waiters; pairs
+	 * with the locked increment in kvm_lock_spinning().
+	 */
+	smp_mb();
+
+	if (unlikely(atomic_read(&nr_waiting)))
+		kvm_unlock_kick(lock, next);
+}
+
+/*
+ * Setup pv_lock_ops to exploit KVM_FEATURE_PV_UNHALT if present.
+ */
+void __init kvm_spinlock_init(void)
+{
+	if (!kvm_para_available())
+		return;
+	/* Does host kernel support KVM_FEATURE_PV_UNHALT? */
+	if (!kvm_para_has_feature(KVM_FEATURE_PV_UNHALT))
+		return;
+
+	pv_lock_ops.spin_is_locked = __ticket_spin_is_locked;
+	pv_lock_ops.spin_is_contended = __ticket_spin_is_contended;
+	pv_lock_ops.spin_lock = kvm_spin_lock;
+	pv_lock_ops.spin_lock_flags = kvm_spin_lock_flags;
+	pv_lock_ops.spin_trylock = __ticket_spin_trylock;
+	pv_lock_ops.spin_unlock = kvm_spin_unlock;
+
+	printk(KERN_INFO "KVM setup paravirtual spinlock\n");
+}
+
+#ifdef CONFIG_KVM_DEBUG_FS
+
+static struct dentry *d_spin_debug;
+
+static int __init kvm_spinlock_debugfs(void)
+{
+	if (!kvm_para_available() ||
+	    !kvm_para_has_feature(KVM_FEATURE_PV_UNHALT))
+		return 0;
+
+	d_spin_debug = debugfs_create_dir("kvm-spinlocks", NULL);
+	if (!d_spin_debug)
+		return -ENOMEM;
+
+	debugfs_create_u32("spin_threshold", 0644, d_spin_debug,
+			   &spin_threshold);
+	debugfs_create_u32("taken_slow", 0444, d_spin_debug,
+			   &spinlock_stats.taken_slow);
+	debugfs_create_u32("taken_slow_pickup", 0444, d_spin_debug,
+			   &spinlock_stats.taken_slow_pickup);
+	debugfs_create_u32("released_slow", 0444, d_spin_debug,
+			   &spinlock_stats.released_slow);
+	debugfs_create_u32("released_slow_kicked", 0444, d_spin_debug,
+			   &spinlock_stats.released_slow_kicked);
+
+	return 0;
+}
+fs_initcall(kvm_spinlock_debugfs);
+#endif	/* CONFIG_KVM_DEBUG_FS */
@@ -49,6 +49,7 @@
 #include <asm/syscalls.h>
 #include <asm/debugreg.h>
 #include <asm/switch_to.h>
+#include <asm/vgtod.h>
 
 asmlinkage extern void ret_from_fork(void);
 
@@ -277,6 +278,9 @@ __switch_to(struct task_struct *prev_p, struct task_struct *next_p)
 
 	fpu = switch_fpu_prepare(prev_p, next_p, cpu);
 
+	/* lets userspace notice it was preempted or migrated */
+	vdso_percpu_switch(cpu);
+
 	/*
 	 * Reload esp0, LDT and the page table pointer:
 	 */
@@ -56,6 +56,11 @@
 DEFINE_VVAR(int, vgetcpu_mode);
 DEFINE_VVAR(struct vsyscall_gtod_data, vsyscall_gtod_data);
 
+/* padded to whole pages, the tail is mapped to userspace too */
+struct vdso_percpu_data vdso_percpu_data[VDSO_PERCPU_PAGES * PAGE_SIZE /
+					 sizeof(struct vdso_percpu_data)]
+	__page_aligned_bss;
+
 static enum { EMULATE, NATIVE, NONE } vsyscall_mode = EMULATE;
 
 static int __init vsyscall_setup(char *str)
@@ -83,7 +88,8 @@ void update_vsyscall_tz(void)
 }
 
 void update_vsyscall(struct timespec *wall_time, struct timespec *wtm,
-			struct clocksource *clock, u32 mult)
+		     struct timespec *raw, struct timespec *sleep,
+		     struct clocksource *clock, u32 mult)
 {
 	struct timespec monotonic;
 
@@ -94,6 +100,7 @@ void update_vsyscall(struct timespec *wall_time, struct timespec *wtm,
 	vsyscall_gtod_data.clock.cycle_last	= clock->cycle_last;
 	vsyscall_gtod_data.clock.mask		= clock->mask;
 	vsyscall_gtod_data.clock.mult		= mult;
+	vsyscall_gtod_data.clock.raw_mult	= clock->mult;
 	vsyscall_gtod_data.clock.shift		= clock->shift;
 
 	vsyscall_gtod_data.wall_time_sec	= wall_time->tv_sec;
@@ -103,6 +110,9 @@ void update_vsyscall(struct timespec *wall_time, struct timespec *wtm,
 	vsyscall_gtod_data.monotonic_time_sec	= monotonic.tv_sec;
 	vsyscall_gtod_data.monotonic_time_nsec	= monotonic.tv_nsec;
 
+	vsyscall_gtod_data.raw_time		= *raw;
+	vsyscall_gtod_data.boot_time		= timespec_add(monotonic, *sleep);
+
 	vsyscall_gtod_data.wall_time_coarse	= __current_kernel_time();
 	vsyscall_gtod_data.monotonic_time_coarse =
 		timespec_add(vsyscall_gtod_data.wall_time_coarse, *wtm);
@@ -359,6 +369,7 @@ void __init map_vsyscall(void)
 	unsigned long physaddr_vsyscall = __pa_symbol(&__vsyscall_page);
 	extern char __vvar_page;
 	unsigned long physaddr_vvar_page = __pa_symbol(&__vvar_page);
+	int i;
 
 	__set_fixmap(VSYSCALL_FIRST_PAGE, physaddr_vsyscall,
 		     vsyscall_mode == NATIVE
@@ -370,6 +381,14 @@ void __init map_vsyscall(void)
 	__set_fixmap(VVAR_PAGE, physaddr_vvar_page, PAGE_KERNEL_VVAR);
 	BUILD_BUG_ON((unsigned long)__fix_to_virt(VVAR_PAGE) !=
 		     (unsigned long)VVAR_ADDRESS);
+
+	/* fixmap indices grow downwards, the array upwards */
+	for (i = 0; i < VDSO_PERCPU_PAGES; i++)
+		__set_fixmap(VPERCPU_FIRST_PAGE - i,
+			     __pa_symbol(vdso_percpu_data) + i * PAGE_SIZE,
+			     PAGE_KERNEL_VVAR);
+	BUILD_BUG_ON((unsigned long)__fix_to_virt(VPERCPU_FIRST_PAGE) !=
+		     (unsigned long)VPERCPU_ADDRESS);
 }
 
 static int __init vsyscall_init(void)
@@ -12,6 +12,11 @@ struct kvm_lapic {
 	struct kvm_timer lapic_timer;
 	u32 divide_count;
 	struct kvm_vcpu *vcpu;
+	/*
+	 * irr_pending and isr_count are hints; both stay set when the
+	 * hardware virtualizes interrupt delivery, because it updates IRR
+	 * and ISR behind our back.
+	 */
 	bool irr_pending;
 	/* Number of bits set in ISR. */
 	s16 isr_count;
@@ -20,7 +25,7 @@ struct kvm_lapic {
 	/**
 	 * APIC register page.  The layout matches the register layout seen by
 	 * the guest 1:1, because it is accessed by the vmx microcode.
-	 * Note: Only one register, the TPR, is used by the microcode.
+	 * Without APIC virtualization only the TPR is used by the microcode.
 	 */
 	void *regs;
 	gpa_t vapic_addr;
@@ -36,6 +41,9 @@ void kvm_lapic_reset(struct kvm_vcpu *vcpu);
 u64 kvm_lapic_get_cr8(struct kvm_vcpu *vcpu);
 void kvm_lapic_set_tpr(struct kvm_vcpu *vcpu, unsigned long cr8);
 void kvm_lapic_set_eoi(struct kvm_vcpu *vcpu);
+void kvm_apic_set_eoi_accelerated(struct kvm_vcpu *vcpu, int vector);
+void kvm_apic_write_nodecode(struct kvm_vcpu *vcpu, u32 offset);
+void kvm_apic_update_irr(struct kvm_vcpu *vcpu, u32 *pir);
 void kvm_lapic_set_base(struct kvm_vcpu *vcpu, u64 value);
 u64 kvm_lapic_get_base(struct kvm_vcpu *vcpu);
 void kvm_apic_set_version(struct kvm_vcpu *vcpu);
@@ -71,4 +79,9 @@ static inline bool kvm_hv_vapic_assist_page_enabled(struct kvm_vcpu *vcpu)
 }
 
 int kvm_lapic_enable_pv_eoi(struct kvm_vcpu *vcpu, u64 data);
+
+static inline bool kvm_apic_vid_enabled(struct kvm *kvm)
+{
+	return kvm_x86_ops->vm_has_apicv(kvm);
+}
 #endif
@@ -1181,6 +1181,74 @@ void kvm_mmu_write_protect_pt_masked(struct kvm *kvm,
 	}
 }
 
+/*
+ * Clearing the dirty bit of a writable spte makes the CPU log the next
+ * write to it (VMX PML).  The TLBs must be flushed afterwards, or a
+ * cached translation would let writes go unlogged.
+ */
+static bool spte_clear_dirty(u64 *sptep)
+{
+	u64 spte = *sptep;
+
+	if (!(spte & shadow_dirty_mask))
+		return false;
+
+	rmap_printk("spte_clear_dirty: spte %p %llx\n", sptep, *sptep);
+
+	mmu_spte_update(sptep, spte & ~shadow_dirty_mask);
+	return true;
+}
+
+static void spte_set_dirty(u64 *sptep)
+{
+	u64 spte = *sptep;
+
+	if (spte & shadow_dirty_mask)
+		return;
+
+	mmu_spte_update(sptep, spte | shadow_dirty_mask);
+}
+
+static bool __rmap_clear_dirty(struct kvm *kvm, unsigned long *rmapp)
+{
+	u64 *sptep;
+	struct rmap_iterator iter;
+	bool flush = false;
+
+	for (sptep = rmap_get_first(*rmapp, &iter); sptep;
+	     sptep = rmap_get_next(&iter)) {
+		BUG_ON(!(*sptep & PT_PRESENT_MASK));
+		flush |= spte_clear_dirty(sptep);
+	}
+
+	return flush;
+}
+
+/**
+ * kvm_mmu_clear_dirty_pt_masked - clear the dirty bit of selected PT level pages
+ * @kvm: kvm instance
+ * @slot: slot to clear the dirty bits in
+ * @gfn_offset: start of the BITS_PER_LONG pages we care about
+ * @mask: indicates which pages we should clear
+ *
+ * The counterpart of kvm_mmu_write_protect_pt_masked() when the CPU logs
+ * dirty pages itself.  The caller flushes the TLBs.
+ */
+void kvm_mmu_clear_dirty_pt_masked(struct kvm *kvm,
+				   struct kvm_memory_slot *slot,
+				   gfn_t gfn_offset, unsigned long mask)
+{
+	unsigned long *rmapp;
+
+	while (mask) {
+		rmapp = &slot->rmap[gfn_offset + __ffs(mask)];
+		__rmap_clear_dirty(kvm, rmapp);
+
+		/* clear the first set bit */
+		mask &= mask - 1;
+	}
+}
+
 static bool rmap_write_protect(struct kvm *kvm, u64 gfn)
 {
 	struct kvm_memory_slot *slot;
@@ -4070,6 +4138,64 @@ void kvm_mmu_slot_remove_write_access(struct kvm *kvm, int slot)
 	kvm_flush_remote_tlbs(kvm);
 }
 
+/*
+ * Start dirty logging by the CPU on a slot: 4K sptes stay writable but
+ * lose their dirty bit, so that the next write to them is logged.  Large
+ * sptes are still write-protected, so that they are split on the next
+ * write fault as mapping_level_dirty_bitmap() requires.
+ */
+void kvm_mmu_slot_clear_dirty(struct kvm *kvm, int slot)
+{
+	struct kvm_mmu_page *sp;
+	bool flush = false;
+
+	list_for_each_entry(sp, &kvm->arch.active_mmu_pages, link) {
+		int i;
+		u64 *pt;
+
+		if (!test_bit(slot, sp->slot_bitmap))
+			continue;
+
+		pt = sp->spt;
+		for (i = 0; i < PT64_ENT_PER_PAGE; ++i) {
+			if (!is_shadow_present_pte(pt[i]) ||
+			      !is_last_spte(pt[i], sp->role.level))
+				continue;
+
+			if (sp->role.level > PT_PAGE_TABLE_LEVEL)
+				spte_write_protect(kvm, &pt[i], &flush, false);
+			else
+				flush |= spte_clear_dirty(&pt[i]);
+		}
+	}
+	if (flush)
+		kvm_flush_remote_tlbs(kvm);
+}
+
+/* Stop dirty logging by the CPU: nothing it logs would be used any more */
+void kvm_mmu_slot_set_dirty(struct kvm *kvm, int slot)
+{
+	struct kvm_mmu_page *sp;
+
+	list_for_each_entry(sp, &kvm->arch.active_mmu_pages, link) {
+		int i;
+		u64 *pt;
+
+		if (!test_bit(slot, sp->slot_bitmap))
+			continue;
+
+		pt = sp->spt;
+		for (i = 0; i < PT64_ENT_PER_PAGE; ++i) {
+			if (!is_shadow_present_pte(pt[i]) ||
+			      !is_last_spte(pt[i], sp->role.level) ||
+			      !is_writable_pte(pt[i]))
+				continue;
+
+			spte_set_dirty(&pt[i]);
+		}
+	}
+}
+
 void kvm_mmu_zap_all(struct kvm *kvm)
 {
 	struct kvm_mmu_page *sp, *node;
@@ -4,6 +4,7 @@
 #include <asm/pgtable.h>
 #include <asm/tlb.h>
 #include <asm/fixmap.h>
+#include <asm/mtrr.h>
 
 #define PGALLOC_GFP GFP_KERNEL | __GFP_NOTRACK | __GFP_REPEAT | __GFP_ZERO
 
@@ -445,3 +446,83 @@ void native_set_fixmap(enum fixed_addresses idx, phys_addr_t phys,
 {
 	__native_set_fixmap(idx, pfn_pte(phys >> PAGE_SHIFT, flags));
 }
+
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+/**
+ * pmd_set_huge - map a 2MB (4MB without PAE) kernel range with a large page
+ * @pmd: pmd entry to set, none or freed with pmd_free_pte_page()
+ * @addr: physical address, aligned to PMD_SIZE
+ * @prot: protection of the mapping
+ *
+ * Refuses, so that the caller falls back to ptes, when MTRRs give the
+ * range anything but write-back: a large page covering MTRR ranges of
+ * different types gets an undefined memory type.
+ *
+ * Returns 1 on success and 0 on failure.
+ */
+int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot)
+{
+	u8 mtrr;
+
+	if (!cpu_has_pse)
+		return 0;
+
+	mtrr = mtrr_type_lookup(addr, addr + PMD_SIZE);
+	if (mtrr != MTRR_TYPE_WRBACK && mtrr != 0xFF)
+		return 0;
+
+	set_pte((pte_t *)pmd, pfn_pte((u64)addr >> PAGE_SHIFT,
+			__pgprot(pgprot_val(prot) | _PAGE_PSE)));
+
+	return 1;
+}
+
+/**
+ * pmd_clear_huge - clear a kernel pmd entry if it maps a large page
+ * @pmd: pmd entry to check
+ *
+ * Returns 1 if the entry was cleared, 0 if it is not a large page.
+ */
+int pmd_clear_huge(pmd_t *pmd)
+{
+	if (pmd_large(*pmd)) {
+		pmd_clear(pmd);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * pmd_free_pte_page - free the pte page a kernel pmd entry points to
+ * @pmd: pmd entry, whose ptes must all be clear
+ * @addr: virtual address the pmd entry maps
+ *
+ * A vmalloc range keeps its pte pages after it is unmapped.  Before a
+ * later user can map the range with a large page, the pte page has to
+ * go, and with it any paging-structure cache entries that point to it.
+ *
+ * Returns 1 if the entry is none afterwards, 0 otherwise.
+ */
+int pmd_free_pte_page(pmd_t *pmd, unsigned long addr)
+{
+	pte_t *pte;
+	int i;
+
+	if (pmd_none(*pmd))
+		return 1;
+	if (pmd_large(*pmd))
+		return 0;
+
+	pte = (pte_t *)pmd_page_vaddr(*pmd);
+	for (i = 0; i < PTRS_PER_PTE; i++)
+		if (!pte_none(pte[i]))
+			return 0;
+
+	pmd_clear(pmd);
+	flush_tlb_kernel_range(addr, addr + PMD_SIZE);
+	free_page((unsigned long)pte);
+
+	return 1;
+}
+#endif	/* CONFIG_HAVE_ARCH_HUGE_VMAP */
@@ -91,14 +91,15 @@ EXPORT_SYMBOL_GPL(leave_mm);
 
 /*
  * TLB flush funcation:
- * 1) Flush the tlb entries if the cpu uses the mm that's being flushed.
+ * 1) Flush the tlb entries if the cpu uses the mm that's being flushed,
+ *    or any mm if none is given.
  * 2) Leave the mm if we are in the lazy tlb mode.
  */
 static void flush_tlb_func(void *info)
 {
 	struct flush_tlb_info *f = info;
 
-	if (f->flush_mm != this_cpu_read(cpu_tlbstate.active_mm))
+	if (f->flush_mm && f->flush_mm != this_cpu_read(cpu_tlbstate.active_mm))
 		return;
 
 	if (this_cpu_read(cpu_tlbstate.state) == TLBSTATE_OK) {
@@ -141,6 +142,23 @@ void native_flush_tlb_others(const struct cpumask *cpumask,
 	smp_call_function_many(cpumask, flush_tlb_func, &info, 1);
 }
 
+/*
+ * Flush the TLBs of all cpus in @cpumask, whatever mm they are running.
+ * Reclaim uses this for a batch of pages unmapped from several mms.
+ */
+void arch_tlbbatch_flush(const struct cpumask *cpumask)
+{
+	int cpu = get_cpu();
+
+	if (cpumask_test_cpu(cpu, cpumask))
+		local_flush_tlb();
+
+	if (cpumask_any_but(cpumask, cpu) < nr_cpu_ids)
+		flush_tlb_others(cpumask, NULL, 0UL, TLB_FLUSH_ALL);
+
+	put_cpu();
+}
+
 void flush_tlb_current_task(void)
 {
 	struct mm_struct *mm = current->mm;
@@ -80,9 +80,8 @@ notrace static long vdso_fallback_gtod(struct timeval *tv, struct timezone *tz)
 }
 
 
-notrace static inline long vgetns(void)
+notrace static inline long vgetcycles(void)
 {
-	long v;
 	cycles_t cycles;
 	if (gtod->clock.vclock_mode == VCLOCK_TSC)
 		cycles = vread_tsc();
@@ -90,8 +89,17 @@ notrace static inline long vgetns(void)
 		cycles = vread_hpet();
 	else
 		return 0;
-	v = (cycles - gtod->clock.cycle_last) & gtod->clock.mask;
-	return (v * gtod->clock.mult) >> gtod->clock.shift;
+	return (cycles - gtod->clock.cycle_last) & gtod->clock.mask;
+}
+
+notrace static inline long vgetns(void)
+{
+	return (vgetcycles() * gtod->clock.mult) >> gtod->clock.shift;
+}
+
+notrace static inline long vgetns_raw(void)
+{
+	return (vgetcycles() * gtod->clock.raw_mult) >> gtod->clock.shift;
 }
 
 /* Code size doesn't matter (vdso is 4k anyway) and this is faster. */
@@ -129,6 +137,40 @@ notrace static int do_monotonic(struct timespec *ts)
 	return mode;
 }
 
+notrace static int do_monotonic_raw(struct timespec *ts)
+{
+	unsigned long seq, ns;
+	int mode;
+
+	do {
+		seq = read_seqcount_begin(&gtod->seq);
+		mode = gtod->clock.vclock_mode;
+		ts->tv_sec = gtod->raw_time.tv_sec;
+		ts->tv_nsec = gtod->raw_time.tv_nsec;
+		ns = vgetns_raw();
+	} while (unlikely(read_seqcount_retry(&gtod->seq, seq)));
+	timespec_add_ns(ts, ns);
+
+	return mode;
+}
+
+notrace static int do_boottime(struct timespec *ts)
+{
+	unsigned long seq, ns;
+	int mode;
+
+	do {
+		seq = read_seqcount_begin(&gtod->seq);
+		mode = gtod->clock.vclock_mode;
+		ts->tv_sec = gtod->boot_time.tv_sec;
+		ts->tv_nsec = gtod->boot_time.tv_nsec;
+		ns = vgetns();
+	} while (unlikely(read_seqcount_retry(&gtod->seq, seq)));
+	timespec_add_ns(ts, ns);
+
+	return mode;
+}
+
 notrace static int do_realtime_coarse(struct timespec *ts)
 {
 	unsigned long seq;
@@ -163,6 +205,12 @@ notrace int __vdso_clock_gettime(clockid_t clock, struct timespec *ts)
 	case CLOCK_MONOTONIC:
 		ret = do_monotonic(ts);
 		break;
+	case CLOCK_MONOTONIC_RAW:
+		ret = do_monotonic_raw(ts);
+		break;
+	case CLOCK_BOOTTIME:
+		ret = do_boottime(ts);
+		break;
 	case CLOCK_REALTIME_COARSE:
 		return do_realtime_coarse(ts);
 	case CLOCK_MONOTONIC_COARSE:
@@ -12,8 +12,8 @@
 #include <asm/vsyscall.h>
 #include <asm/vgtod.h>
 
-notrace long
-__vdso_getcpu(unsigned *cpu, unsigned *node, struct getcpu_cache *unused)
+/* returns cpu | node << 12 */
+notrace static inline unsigned int vgetcpu_node(void)
 {
 	unsigned int p;
 
@@ -24,6 +24,14 @@ __vdso_getcpu(unsigned *cpu, unsigned *node, struct getcpu_cache *unused)
 		/* Load per CPU data from GDT */
 		asm("lsl %1,%0" : "=r" (p) : "r" (__PER_CPU_SEG));
 	}
+	return p;
+}
+
+notrace long
+__vdso_getcpu(unsigned *cpu, unsigned *node, struct getcpu_cache *unused)
+{
+	unsigned int p = vgetcpu_node();
+
 	if (cpu)
 		*cpu = p & 0xfff;
 	if (node)
@@ -33,3 +41,26 @@ __vdso_getcpu(unsigned *cpu, unsigned *node, struct getcpu_cache *unused)
 
 long getcpu(unsigned *cpu, unsigned *node, struct getcpu_cache *tcache)
 	__attribute__((weak, alias("__vdso_getcpu")));
+
+/*
+ * Return the current CPU and its context switch count. The count changes
+ * whenever a task is switched in on that CPU, so a caller that reads the
+ * same (cpu, seq) pair before and after a sequence of operations on its
+ * per-CPU data knows it was neither preempted nor migrated in between,
+ * and otherwise restarts. Nothing aborts the sequence itself: the final
+ * commit must still be a single instruction or an atomic operation.
+ *
+ * Returns -ENOSYS on CPUs that have no per-CPU vDSO data.
+ */
+notrace long __vdso_getcpu_seq(unsigned *cpu, unsigned *seq)
+{
+	const struct vdso_percpu_data *pcpu = (void *)VPERCPU_ADDRESS;
+	unsigned int p = vgetcpu_node() & 0xfff;
+
+	if (p >= VDSO_PERCPU_NR_CPUS)
+		return -ENOSYS;
+
+	*cpu = p;
+	*seq = ACCESS_ONCE(pcpu[p].seq);
+	return 0;
+}
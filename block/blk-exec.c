@@ -5,6 +5,7 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 
 #include "blk.h"
 
@@ -58,6 +59,17 @@ void blk_execute_rq_nowait(struct request_queue *q, struct gendisk *bd_disk,
 	rq->rq_disk = bd_disk;
 	rq->end_io = done;
 
+	if (q->mq_ops) {
+		if (unlikely(blk_queue_dead(q))) {
+			rq->errors = -ENXIO;
+			if (rq->end_io)
+				rq->end_io(rq, rq->errors);
+			return;
+		}
+		blk_mq_insert_request(q, rq, at_head, true);
+		return;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	if (unlikely(blk_queue_dead(q))) {
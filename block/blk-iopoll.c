@@ -11,6 +11,8 @@
 #include <linux/cpu.h>
 #include <linux/blk-iopoll.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
 
 #include "blk.h"
 
@@ -189,6 +191,86 @@ void blk_iopoll_init(struct blk_iopoll *iop, int weight, blk_iopoll_fn *poll_fn)
 }
 EXPORT_SYMBOL(blk_iopoll_init);
 
+/*
+ * Sleep for part of the expected wait before we start spinning, the
+ * caller's task state is left alone so a completion arriving in the
+ * meantime wakes us early.
+ */
+static void blk_poll_sleep(struct request_queue *q)
+{
+	struct hrtimer_sleeper hs;
+	u64 nsecs;
+
+	if (q->poll_delay > 0)
+		nsecs = (u64)q->poll_delay * NSEC_PER_USEC;
+	else
+		nsecs = q->poll_nsec / 2;
+	if (!nsecs)
+		return;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_init_sleeper(&hs, current);
+	hrtimer_start(&hs.timer, ns_to_ktime(nsecs), HRTIMER_MODE_REL);
+	if (hs.task)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+}
+
+/**
+ * blk_poll - Spin on a queue waiting for a synchronous completion
+ * @q:       The queue the I/O was submitted to
+ * @start:   Start of the wait, must be 0 on the first call for each wait
+ *
+ * Description:
+ *     The caller has set its task state to sleep and arranged to be woken
+ *     by the completion, just as it would before io_schedule().  Instead of
+ *     sleeping straight away, reap completions through the driver's
+ *     ->poll_fn until a wakeup sets us running, the spin budget runs out or
+ *     someone else needs the CPU.
+ *
+ *     With a non-negative io_poll_delay the first call sleeps for part of
+ *     the wait and returns, the caller then rechecks its condition and
+ *     calls in again to spin.
+ *
+ *     Returns true if the caller should recheck its wait condition, false
+ *     if it should go to sleep as usual.
+ **/
+bool blk_poll(struct request_queue *q, u64 *start)
+{
+	u64 now, end;
+
+	if (!q->poll_fn || !blk_queue_poll(q))
+		return false;
+
+	if (!*start) {
+		*start = local_clock();
+		if (q->poll_delay >= 0) {
+			blk_poll_sleep(q);
+			return true;
+		}
+	}
+
+	now = local_clock();
+	end = now + (u64)q->poll_budget * NSEC_PER_USEC;
+	while (!need_resched() && now < end) {
+		q->poll_fn(q);
+		if (current->state == TASK_RUNNING) {
+			q->poll_nsec = (q->poll_nsec * 7 + local_clock() -
+					*start) / 8;
+			q->poll_hits++;
+			return true;
+		}
+		cpu_relax();
+		now = local_clock();
+	}
+
+	q->poll_misses++;
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 static int __cpuinit blk_iopoll_cpu_notify(struct notifier_block *self,
 					  unsigned long action, void *hcpu)
 {
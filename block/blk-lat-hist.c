@@ -0,0 +1,133 @@
+/*
+ * Per-queue request latency histograms
+ *
+ * Completed requests are sorted into log2 buckets of microseconds, per
+ * data direction, separately for the time spent queued in the block
+ * layer and the time spent at the device.  The counters are per-cpu and
+ * only summed when read, so they can stay enabled on busy systems.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+
+#include "blk.h"
+
+enum {
+	BLK_LAT_QUEUE,		/* allocation to issue */
+	BLK_LAT_DEVICE,		/* issue to completion */
+	BLK_LAT_NR_TYPES,
+};
+
+struct blk_lat_hist {
+	unsigned long	count[2][BLK_LAT_NR_TYPES][BLK_LAT_HIST_BUCKETS];
+};
+
+/*
+ * Bucket 0 is below 1us, bucket n covers [2^(n-1), 2^n) us, the last one
+ * takes everything above.
+ */
+static unsigned int blk_lat_bucket(u64 nsecs)
+{
+	u64 usecs = div_u64(nsecs, NSEC_PER_USEC);
+
+	if (!usecs)
+		return 0;
+	return min_t(unsigned int, ilog2(usecs) + 1, BLK_LAT_HIST_BUCKETS - 1);
+}
+
+void blk_lat_hist_account(struct request *rq)
+{
+	struct blk_lat_hist __percpu *hist = rq->q->lat_hist;
+	u64 start = rq_start_time_ns(rq);
+	u64 issue = rq_io_start_time_ns(rq);
+	const int rw = rq_data_dir(rq);
+	u64 now;
+
+	if (!hist || !issue || (rq->cmd_flags & REQ_FLUSH_SEQ))
+		return;
+
+	preempt_disable();
+	now = sched_clock();
+	if (time_after64(issue, start))
+		__this_cpu_inc(hist->count[rw][BLK_LAT_QUEUE]
+				[blk_lat_bucket(issue - start)]);
+	if (time_after64(now, issue))
+		__this_cpu_inc(hist->count[rw][BLK_LAT_DEVICE]
+				[blk_lat_bucket(now - issue)]);
+	preempt_enable();
+}
+
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page)
+{
+	ssize_t len;
+	int i;
+
+	if (!q->lat_hist)
+		return -ENODEV;
+
+	len = sprintf(page, "usecs read_queue read_device "
+		      "write_queue write_device\n");
+	for (i = 0; i < BLK_LAT_HIST_BUCKETS; i++) {
+		unsigned long sum[2][BLK_LAT_NR_TYPES] = { { 0 } };
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			struct blk_lat_hist *h = per_cpu_ptr(q->lat_hist, cpu);
+
+			sum[READ][BLK_LAT_QUEUE] +=
+				h->count[READ][BLK_LAT_QUEUE][i];
+			sum[READ][BLK_LAT_DEVICE] +=
+				h->count[READ][BLK_LAT_DEVICE][i];
+			sum[WRITE][BLK_LAT_QUEUE] +=
+				h->count[WRITE][BLK_LAT_QUEUE][i];
+			sum[WRITE][BLK_LAT_DEVICE] +=
+				h->count[WRITE][BLK_LAT_DEVICE][i];
+		}
+
+		len += scnprintf(page + len, PAGE_SIZE - len,
+				 "%lu %lu %lu %lu %lu\n",
+				 i ? 1UL << (i - 1) : 0UL,
+				 sum[READ][BLK_LAT_QUEUE],
+				 sum[READ][BLK_LAT_DEVICE],
+				 sum[WRITE][BLK_LAT_QUEUE],
+				 sum[WRITE][BLK_LAT_DEVICE]);
+	}
+
+	return len;
+}
+
+/*
+ * Writing 0 clears the histograms.  Updates racing with this on other
+ * CPUs may survive it.
+ */
+ssize_t blk_lat_hist_store(struct request_queue *q, const char *page,
+			   size_t count)
+{
+	unsigned long val;
+	int cpu;
+
+	if (!q->lat_hist)
+		return -ENODEV;
+	if (kstrtoul(page, 10, &val) || val)
+		return -EINVAL;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(q->lat_hist, cpu), 0,
+		       sizeof(struct blk_lat_hist));
+
+	return count;
+}
+
+int blk_lat_hist_init(struct request_queue *q)
+{
+	q->lat_hist = alloc_percpu(struct blk_lat_hist);
+	return q->lat_hist ? 0 : -ENOMEM;
+}
+
+void blk_lat_hist_exit(struct request_queue *q)
+{
+	free_percpu(q->lat_hist);
+	q->lat_hist = NULL;
+}
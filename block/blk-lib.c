@@ -13,6 +13,7 @@ struct bio_batch {
 	atomic_t		done;
 	unsigned long		flags;
 	struct completion	*wait;
+	void			(*end_io)(struct bio_batch *);
 };
 
 static void bio_batch_end_io(struct bio *bio, int err)
@@ -21,33 +22,28 @@ static void bio_batch_end_io(struct bio *bio, int err)
 
 	if (err && (err != -EOPNOTSUPP))
 		clear_bit(BIO_UPTODATE, &bb->flags);
-	if (atomic_dec_and_test(&bb->done))
-		complete(bb->wait);
+	if (atomic_dec_and_test(&bb->done)) {
+		if (bb->end_io)
+			bb->end_io(bb);
+		else
+			complete(bb->wait);
+	}
 	bio_put(bio);
 }
 
-/**
- * blkdev_issue_discard - queue a discard
- * @bdev:	blockdev to issue discard for
- * @sector:	start sector
- * @nr_sects:	number of sectors to discard
- * @gfp_mask:	memory allocation flags (for bio_alloc)
- * @flags:	BLKDEV_IFL_* flags to control behaviour
- *
- * Description:
- *    Issue a discard request for the sectors in question.
+/*
+ * Split a discard into bios the queue can take and submit them, each one
+ * holding a reference on @bb.
  */
-int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
-		sector_t nr_sects, gfp_t gfp_mask, unsigned long flags)
+static int __blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, unsigned long flags,
+		struct bio_batch *bb)
 {
-	DECLARE_COMPLETION_ONSTACK(wait);
 	struct request_queue *q = bdev_get_queue(bdev);
 	int type = REQ_WRITE | REQ_DISCARD;
 	unsigned int max_discard_sectors;
 	unsigned int granularity, alignment, mask;
-	struct bio_batch bb;
 	struct bio *bio;
-	int ret = 0;
 
 	if (!q)
 		return -ENXIO;
@@ -77,19 +73,13 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		type |= REQ_SECURE;
 	}
 
-	atomic_set(&bb.done, 1);
-	bb.flags = 1 << BIO_UPTODATE;
-	bb.wait = &wait;
-
 	while (nr_sects) {
 		unsigned int req_sects;
 		sector_t end_sect;
 
 		bio = bio_alloc(gfp_mask, 1);
-		if (!bio) {
-			ret = -ENOMEM;
-			break;
-		}
+		if (!bio)
+			return -ENOMEM;
 
 		req_sects = min_t(sector_t, nr_sects, max_discard_sectors);
 
@@ -108,16 +98,45 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 		bio->bi_sector = sector;
 		bio->bi_end_io = bio_batch_end_io;
 		bio->bi_bdev = bdev;
-		bio->bi_private = &bb;
+		bio->bi_private = bb;
 
 		bio->bi_size = req_sects << 9;
 		nr_sects -= req_sects;
 		sector = end_sect;
 
-		atomic_inc(&bb.done);
+		atomic_inc(&bb->done);
 		submit_bio(type, bio);
 	}
 
+	return 0;
+}
+
+/**
+ * blkdev_issue_discard - queue a discard
+ * @bdev:	blockdev to issue discard for
+ * @sector:	start sector
+ * @nr_sects:	number of sectors to discard
+ * @gfp_mask:	memory allocation flags (for bio_alloc)
+ * @flags:	BLKDEV_IFL_* flags to control behaviour
+ *
+ * Description:
+ *    Issue a discard request for the sectors in question.
+ */
+int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, unsigned long flags)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	struct bio_batch bb;
+	int ret;
+
+	atomic_set(&bb.done, 1);
+	bb.flags = 1 << BIO_UPTODATE;
+	bb.wait = &wait;
+	bb.end_io = NULL;
+
+	ret = __blkdev_issue_discard(bdev, sector, nr_sects, gfp_mask, flags,
+				     &bb);
+
 	/* Wait for bios in-flight */
 	if (!atomic_dec_and_test(&bb.done))
 		wait_for_completion(&wait);
@@ -129,6 +148,371 @@ int blkdev_issue_discard(struct block_device *bdev, sector_t sector,
 }
 EXPORT_SYMBOL(blkdev_issue_discard);
 
+/*
+ * Asynchronous discards
+ *
+ * Ranges handed to blkdev_queue_discard() are kept sorted by device and
+ * start sector.  A kblockd work item takes runs of adjacent ranges off
+ * the front, issues each run as one discard and, once that completes,
+ * calls back the owners of all ranges in the run from process context.
+ * With a rate set in the queue's discard_rate_mb attribute, the worker
+ * issues no more than that per second and leaves the rest for later.
+ */
+#define BLK_DISCARD_BATCH_DELAY	msecs_to_jiffies(10)
+#define BLK_DISCARD_INTERVAL	(HZ / 10)
+
+struct blk_discard_range {
+	struct list_head	list;
+	struct block_device	*bdev;
+	sector_t		sector;
+	sector_t		nr_sects;
+	blk_discard_end_fn	*end_fn;
+	void			*data;
+};
+
+struct blk_discard_batch {
+	struct bio_batch	bb;
+	struct list_head	ranges;
+	struct list_head	list;		/* on blk_discard_queue.done */
+	struct blk_discard_queue *dq;
+	int			error;
+};
+
+struct blk_discard_queue {
+	spinlock_t		lock;
+	struct list_head	pending;	/* sorted, not issued yet */
+	struct list_head	done;		/* batches to call back */
+	unsigned int		nr_ranges;	/* queued and not called back */
+	wait_queue_head_t	wait;
+	atomic_t		flushing;
+
+	struct request_queue	*q;
+	struct delayed_work	issue_work;
+	struct work_struct	end_work;
+
+	unsigned int		rate;		/* MB/s, 0 is no limit */
+	long			credit;		/* sectors */
+	unsigned long		last_refill;
+};
+
+static void blk_discard_batch_end_io(struct bio_batch *bb)
+{
+	struct blk_discard_batch *batch =
+		container_of(bb, struct blk_discard_batch, bb);
+	struct blk_discard_queue *dq = batch->dq;
+	unsigned long flags;
+
+	if (!batch->error && !test_bit(BIO_UPTODATE, &bb->flags))
+		batch->error = -EIO;
+
+	spin_lock_irqsave(&dq->lock, flags);
+	list_add_tail(&batch->list, &dq->done);
+	spin_unlock_irqrestore(&dq->lock, flags);
+
+	kblockd_schedule_work(dq->q, &dq->end_work);
+}
+
+static void blk_discard_end_work(struct work_struct *work)
+{
+	struct blk_discard_queue *dq =
+		container_of(work, struct blk_discard_queue, end_work);
+	LIST_HEAD(done);
+
+	spin_lock_irq(&dq->lock);
+	list_splice_init(&dq->done, &done);
+	spin_unlock_irq(&dq->lock);
+
+	while (!list_empty(&done)) {
+		struct blk_discard_batch *batch;
+		unsigned int nr = 0;
+
+		batch = list_first_entry(&done, struct blk_discard_batch, list);
+		list_del(&batch->list);
+
+		while (!list_empty(&batch->ranges)) {
+			struct blk_discard_range *range;
+
+			range = list_first_entry(&batch->ranges,
+						 struct blk_discard_range, list);
+			list_del(&range->list);
+			range->end_fn(range->data, batch->error);
+			kfree(range);
+			nr++;
+		}
+		kfree(batch);
+
+		spin_lock_irq(&dq->lock);
+		dq->nr_ranges -= nr;
+		if (!dq->nr_ranges)
+			wake_up_all(&dq->wait);
+		spin_unlock_irq(&dq->lock);
+	}
+}
+
+/*
+ * Take the first pending range and every range that directly follows it
+ * on the same device.  Called with the lock held.
+ */
+static void blk_discard_next_batch(struct blk_discard_queue *dq,
+				   struct blk_discard_batch *batch,
+				   sector_t *sector, sector_t *nr_sects)
+{
+	struct blk_discard_range *first, *range, *next;
+	sector_t end;
+
+	first = list_first_entry(&dq->pending, struct blk_discard_range, list);
+	end = first->sector + first->nr_sects;
+
+	range = first;
+	list_for_each_entry_continue(range, &dq->pending, list) {
+		if (range->bdev != first->bdev || range->sector > end)
+			break;
+		end = max(end, range->sector + range->nr_sects);
+	}
+
+	list_for_each_entry_safe_from(first, next, &dq->pending, list) {
+		if (first == range)
+			break;
+		list_move_tail(&first->list, &batch->ranges);
+	}
+
+	range = list_first_entry(&batch->ranges, struct blk_discard_range,
+				 list);
+	*sector = range->sector;
+	*nr_sects = end - range->sector;
+}
+
+static void blk_discard_issue_work(struct work_struct *work)
+{
+	struct blk_discard_queue *dq =
+		container_of(work, struct blk_discard_queue, issue_work.work);
+	spin_lock_irq(&dq->lock);
+	if (dq->rate) {
+		unsigned long now = jiffies;
+		long max_credit;
+
+		max_credit = dq->rate * (1048576 >> 9) / 10;
+		dq->credit += div_u64((u64)dq->rate * (1048576 >> 9) *
+				      (now - dq->last_refill), HZ);
+		dq->credit = min(dq->credit, max_credit);
+		dq->last_refill = now;
+	}
+
+	while (!list_empty(&dq->pending)) {
+		struct blk_discard_batch *batch;
+		struct block_device *bdev;
+		sector_t sector, nr_sects;
+		int ret;
+
+		if (dq->rate && dq->credit <= 0 && !atomic_read(&dq->flushing))
+			break;
+		spin_unlock_irq(&dq->lock);
+
+		batch = kzalloc(sizeof(*batch), GFP_NOIO);
+		spin_lock_irq(&dq->lock);
+		if (!batch)
+			break;
+		if (list_empty(&dq->pending)) {
+			kfree(batch);
+			break;
+		}
+
+		INIT_LIST_HEAD(&batch->ranges);
+		batch->dq = dq;
+		blk_discard_next_batch(dq, batch, &sector, &nr_sects);
+		dq->credit -= min_t(sector_t, nr_sects, LONG_MAX);
+		spin_unlock_irq(&dq->lock);
+
+		bdev = list_first_entry(&batch->ranges,
+					struct blk_discard_range, list)->bdev;
+		atomic_set(&batch->bb.done, 1);
+		batch->bb.flags = 1 << BIO_UPTODATE;
+		batch->bb.end_io = blk_discard_batch_end_io;
+
+		ret = __blkdev_issue_discard(bdev, sector, nr_sects, GFP_NOIO,
+					     0, &batch->bb);
+		batch->error = ret;
+		if (atomic_dec_and_test(&batch->bb.done))
+			blk_discard_batch_end_io(&batch->bb);
+
+		spin_lock_irq(&dq->lock);
+	}
+
+	if (!list_empty(&dq->pending))
+		kblockd_schedule_delayed_work(dq->q, &dq->issue_work,
+					      BLK_DISCARD_INTERVAL);
+	spin_unlock_irq(&dq->lock);
+}
+
+/**
+ * blkdev_queue_discard - discard a range asynchronously
+ * @bdev:	blockdev to issue discard for
+ * @sector:	start sector
+ * @nr_sects:	number of sectors to discard
+ * @gfp_mask:	memory allocation flags
+ * @end_fn:	called from process context once the discard is done
+ * @data:	passed to @end_fn
+ *
+ * Description:
+ *    Queue a discard for the sectors in question and return.  The range
+ *    may be merged with adjacent ones and is issued at the rate set for
+ *    the queue.  @end_fn receives 0 or the error of the discard of the
+ *    merged range; it is only called if this returns 0.
+ */
+int blkdev_queue_discard(struct block_device *bdev, sector_t sector,
+		sector_t nr_sects, gfp_t gfp_mask, blk_discard_end_fn *end_fn,
+		void *data)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+	struct blk_discard_queue *dq;
+	struct blk_discard_range *range, *pos;
+	unsigned long flags;
+
+	if (!q)
+		return -ENXIO;
+
+	if (!blk_queue_discard(q))
+		return -EOPNOTSUPP;
+
+	if (blk_queue_dead(q))
+		return -ENODEV;
+
+	range = kmalloc(sizeof(*range), gfp_mask);
+	if (!range)
+		return -ENOMEM;
+
+	range->bdev = bdev;
+	range->sector = sector;
+	range->nr_sects = nr_sects;
+	range->end_fn = end_fn;
+	range->data = data;
+
+	dq = q->discard_queue;
+	spin_lock_irqsave(&dq->lock, flags);
+	/* ranges mostly come in ascending order, search from the end */
+	list_for_each_entry_reverse(pos, &dq->pending, list) {
+		if (pos->bdev < bdev ||
+		    (pos->bdev == bdev && pos->sector <= sector))
+			break;
+	}
+	list_add(&range->list, &pos->list);
+	dq->nr_ranges++;
+	spin_unlock_irqrestore(&dq->lock, flags);
+
+	/* give the caller a moment to queue the ranges that follow */
+	kblockd_schedule_delayed_work(q, &dq->issue_work,
+				      BLK_DISCARD_BATCH_DELAY);
+	return 0;
+}
+EXPORT_SYMBOL(blkdev_queue_discard);
+
+static void blk_discard_queue_flush(struct blk_discard_queue *dq)
+{
+	atomic_inc(&dq->flushing);
+	cancel_delayed_work(&dq->issue_work);
+	kblockd_schedule_delayed_work(dq->q, &dq->issue_work, 0);
+	wait_event(dq->wait, !ACCESS_ONCE(dq->nr_ranges));
+	atomic_dec(&dq->flushing);
+}
+
+/**
+ * blkdev_flush_discards - wait for queued discards
+ * @bdev:	blockdev whose queue to flush
+ *
+ * Description:
+ *    Issue everything queued by blkdev_queue_discard() on the queue of
+ *    @bdev without regard to the rate limit, and wait until all of the
+ *    completion callbacks have run.
+ */
+void blkdev_flush_discards(struct block_device *bdev)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+
+	if (q)
+		blk_discard_queue_flush(q->discard_queue);
+}
+EXPORT_SYMBOL(blkdev_flush_discards);
+
+ssize_t blk_discard_rate_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%u\n", q->discard_queue->rate);
+}
+
+ssize_t blk_discard_rate_store(struct request_queue *q, const char *page,
+			       size_t count)
+{
+	struct blk_discard_queue *dq = q->discard_queue;
+	unsigned int rate;
+
+	if (kstrtouint(page, 10, &rate))
+		return -EINVAL;
+
+	spin_lock_irq(&dq->lock);
+	if (!dq->rate) {
+		dq->credit = 0;
+		dq->last_refill = jiffies;
+	}
+	dq->rate = rate;
+	spin_unlock_irq(&dq->lock);
+
+	return count;
+}
+
+int blk_discard_queue_init(struct request_queue *q)
+{
+	struct blk_discard_queue *dq;
+
+	dq = kzalloc_node(sizeof(*dq), GFP_KERNEL, q->node);
+	if (!dq)
+		return -ENOMEM;
+
+	spin_lock_init(&dq->lock);
+	INIT_LIST_HEAD(&dq->pending);
+	INIT_LIST_HEAD(&dq->done);
+	init_waitqueue_head(&dq->wait);
+	atomic_set(&dq->flushing, 0);
+	dq->q = q;
+	INIT_DELAYED_WORK(&dq->issue_work, blk_discard_issue_work);
+	INIT_WORK(&dq->end_work, blk_discard_end_work);
+	dq->last_refill = jiffies;
+
+	q->discard_queue = dq;
+	return 0;
+}
+
+/*
+ * Called from blk_cleanup_queue() once the queue is dead: what is still
+ * queued is issued, and fails, so that the owners get their ranges back.
+ */
+void blk_discard_queue_drain(struct request_queue *q)
+{
+	if (q->discard_queue)
+		blk_discard_queue_flush(q->discard_queue);
+}
+
+void blk_discard_queue_exit(struct request_queue *q)
+{
+	struct blk_discard_queue *dq = q->discard_queue;
+	struct blk_discard_range *range, *next;
+
+	if (!dq)
+		return;
+
+	cancel_delayed_work_sync(&dq->issue_work);
+	cancel_work_sync(&dq->end_work);
+
+	/* call back what raced with blk_discard_queue_drain() */
+	blk_discard_end_work(&dq->end_work);
+	list_for_each_entry_safe(range, next, &dq->pending, list) {
+		list_del(&range->list);
+		range->end_fn(range->data, -ENODEV);
+		kfree(range);
+	}
+
+	kfree(dq);
+	q->discard_queue = NULL;
+}
+
 /**
  * blkdev_issue_zeroout - generate number of zero filed write bios
  * @bdev:	blockdev to issue
@@ -152,6 +536,7 @@ int blkdev_issue_zeroout(struct block_device *bdev, sector_t sector,
 	atomic_set(&bb.done, 1);
 	bb.flags = 1 << BIO_UPTODATE;
 	bb.wait = &wait;
+	bb.end_io = NULL;
 
 	ret = 0;
 	while (nr_sects != 0) {
@@ -0,0 +1,64 @@
+/*
+ * Tag allocation for the multiqueue block layer
+ *
+ * Every hardware queue has its own tag space, handed out by the generic
+ * percpu_tags allocator.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu_tags.h>
+#include <linux/blk-mq.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+struct blk_mq_tags {
+	struct percpu_tags	pool;
+};
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	tag space of the hardware queue
+ * @gfp:	allocation mask, sleeps waiting for a free tag if %__GFP_WAIT
+ *
+ * Returns a tag in [0, nr_tags) or %BLK_MQ_TAG_FAIL.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp)
+{
+	int tag = percpu_tags_alloc(&tags->pool, gfp);
+
+	return tag < 0 ? BLK_MQ_TAG_FAIL : tag;
+}
+
+/**
+ * blk_mq_put_tag - release a tag
+ * @tags:	tag space the tag was allocated from
+ * @tag:	tag to free
+ */
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	percpu_tags_free(&tags->pool, tag);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	if (percpu_tags_init(&tags->pool, nr_tags, GFP_KERNEL, node)) {
+		kfree(tags);
+		return NULL;
+	}
+
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	percpu_tags_destroy(&tags->pool);
+	kfree(tags);
+}
@@ -0,0 +1,1153 @@
+/*
+ * Block multiqueue core code
+ *
+ * Requests are staged in per-cpu software queues and dispatched to the
+ * hardware queues the driver registered, without ever taking the
+ * request_queue lock on the submission or completion path.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/backing-dev.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/list_sort.h>
+#include <linux/cpu.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/writeback.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * This assumes per-cpu software queueing queues. They could be per-node
+ * as well, for instance. For now this is hardcoded as-is. Note that we don't
+ * care about preemption, since we know the ctx's are persistent. This does
+ * mean that we can't rely on ctx always matching the currently running CPU.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+/*
+ * Pin the queue while a request is allocated from it.  Fails once
+ * blk_cleanup_queue() has started tearing the queue down.
+ */
+static bool blk_mq_queue_enter(struct request_queue *q)
+{
+	return percpu_ref_tryget_live(&q->mq_usage_counter);
+}
+
+static void blk_mq_queue_exit(struct request_queue *q)
+{
+	percpu_ref_put(&q->mq_usage_counter);
+}
+
+/*
+ * blk_drain_queue() polls for the count to reach zero, there is nothing
+ * to do here.
+ */
+static void blk_mq_usage_counter_release(struct percpu_ref *ref)
+{
+}
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+static bool blk_mq_should_merge(struct blk_mq_hw_ctx *hctx)
+{
+	return (hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+		!blk_queue_nomerges(hctx->queue);
+}
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+struct request *blk_mq_tag_to_rq(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	return hctx->rqs[tag];
+}
+EXPORT_SYMBOL(blk_mq_tag_to_rq);
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      gfp_t gfp)
+{
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, gfp);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+
+	return hctx->rqs[tag];
+}
+
+static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
+			       struct request *rq, unsigned int rw_flags)
+{
+	int tag = rq->tag;
+
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
+}
+
+/*
+ * Allocate a request mapped to the software queue of the current CPU.
+ * If the hardware queue is out of tags and @gfp allows it, kick the
+ * queue so that in-flight requests get going and wait for a tag.
+ */
+static struct request *blk_mq_alloc_request_pinned(struct request_queue *q,
+						   int rw, gfp_t gfp)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	rq = __blk_mq_alloc_request(hctx, gfp & ~__GFP_WAIT);
+	blk_mq_put_ctx(ctx);
+
+	if (!rq && (gfp & __GFP_WAIT)) {
+		blk_mq_run_hw_queue(hctx, false);
+		rq = __blk_mq_alloc_request(hctx, gfp);
+	}
+
+	if (rq)
+		blk_mq_rq_ctx_init(q, ctx, rq, rw);
+
+	return rq;
+}
+
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct request *rq;
+
+	if (unlikely(!blk_mq_queue_enter(q)))
+		return NULL;
+
+	rq = blk_mq_alloc_request_pinned(q, rw, gfp);
+	if (!rq)
+		blk_mq_queue_exit(q);
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+
+	ctx->rq_completed[rq_is_sync(rq)]++;
+
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+	blk_mq_put_tag(hctx->tags, rq->tag);
+	blk_mq_queue_exit(q);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void __blk_mq_end_io(struct request *rq, int error)
+{
+	/*
+	 * Requests are always completed in one go, so this ends every bio
+	 * attached to @rq and accounts the transferred sectors.
+	 */
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	if (unlikely(laptop_mode) && rq->cmd_type == REQ_TYPE_FS)
+		laptop_io_completion(&rq->q->backing_dev_info);
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+
+static void blk_mq_end_io_remote(void *data)
+{
+	struct request *rq = data;
+
+	__blk_mq_end_io(rq, rq->errors);
+}
+
+static void __blk_mq_complete_request(struct request *rq, int error)
+{
+	rq->errors = error;
+	rq->csd.func = blk_mq_end_io_remote;
+	rq->csd.info = rq;
+
+	if (!blk_steer_completion(rq->q, rq->mq_ctx->cpu, &rq->csd))
+		__blk_mq_end_io(rq, error);
+}
+
+/**
+ * blk_mq_end_io - end I/O on a multiqueue request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *     Ends all I/O on @rq.  Bios are completed on the CPU that submitted
+ *     the request if the queue asks for same-CPU completion.  Completions
+ *     that race with the timeout handler are ignored.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_mark_rq_complete(rq))
+		return;
+
+	__blk_mq_complete_request(rq, error);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_issue(q, rq);
+
+	if (!rq->timeout)
+		rq->timeout = q->rq_timeout;
+	rq->deadline = jiffies + rq->timeout;
+
+	set_io_start_time_ns(rq);
+
+	blk_clear_rq_complete(rq);
+	set_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+
+	if (q->mq_ops->timeout && !timer_pending(&q->timeout))
+		mod_timer(&q->timeout, round_jiffies_up(rq->deadline));
+}
+
+static void blk_mq_rq_timed_out(struct request *rq)
+{
+	enum blk_eh_timer_return ret;
+
+	ret = rq->q->mq_ops->timeout(rq);
+	switch (ret) {
+	case BLK_EH_HANDLED:
+		__blk_mq_complete_request(rq, rq->errors);
+		break;
+	case BLK_EH_RESET_TIMER:
+		rq->deadline = jiffies + rq->timeout;
+		blk_clear_rq_complete(rq);
+		break;
+	case BLK_EH_NOT_HANDLED:
+		break;
+	default:
+		printk(KERN_ERR "block: bad eh return: %d\n", ret);
+		break;
+	}
+}
+
+/*
+ * There is no timeout list for multiqueue requests; the timer walks the
+ * request map of every hardware queue and looks at the started ones.
+ */
+static void blk_mq_rq_timer(unsigned long data)
+{
+	struct request_queue *q = (struct request_queue *) data;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long next = 0;
+	int i, next_set = 0;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		unsigned int tag;
+
+		for (tag = 0; tag < hctx->queue_depth; tag++) {
+			struct request *rq = hctx->rqs[tag];
+
+			if (!test_bit(REQ_ATOM_STARTED, &rq->atomic_flags))
+				continue;
+
+			if (time_after_eq(jiffies, rq->deadline)) {
+				/*
+				 * Check if we raced with end io completion
+				 */
+				if (blk_mark_rq_complete(rq))
+					continue;
+				blk_mq_rq_timed_out(rq);
+				if (test_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags))
+					continue;
+			}
+
+			if (!next_set || time_after(next, rq->deadline)) {
+				next = rq->deadline;
+				next_set = 1;
+			}
+		}
+	}
+
+	if (next_set)
+		mod_timer(&q->timeout, round_jiffies_up(next));
+}
+
+/*
+ * Attempt to merge @bio with one of the most recently queued requests of
+ * the software queue.  Called with ctx->lock held.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = 8;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		int el_ret;
+
+		if (!checked--)
+			break;
+
+		if (!blk_rq_merge_ok(rq, bio))
+			continue;
+
+		el_ret = blk_try_merge(rq, bio);
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			if (bio_attempt_back_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			if (bio_attempt_front_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Run this hardware queue, pulling any software queues mapped to it in.
+ * Note that this function currently has various problems around ordering
+ * of IO. In particular, we'd like FIFO behaviour on handling existing
+ * items on the hctx->dispatch list. Ignore that for now.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, queued;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * Touch any software queue that has pending entries.  The pending
+	 * bit is cleared before the lock is taken, so anything inserted
+	 * after the splice marks the queue pending again.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * and dispatch them first.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * Now process all the entries, sending them to the driver.
+	 */
+	queued = 0;
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * The driver is out of resources. Put the request
+			 * back and leave the rest for the next run, which
+			 * the driver triggers by restarting the queue.
+			 */
+			clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		default:
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			rq->errors = -EIO;
+			blk_mq_end_io(rq, rq->errors);
+			break;
+		}
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY)
+			break;
+	}
+
+	hctx->queued += queued;
+
+	/*
+	 * Any items that need requeuing? Stuff them into hctx->dispatch,
+	 * that is where we will continue on next queue run.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware queue
+ * @hctx:	hardware queue to run
+ * @async:	defer the run to kblockd
+ *
+ * Description:
+ *     Synchronous runs only happen on a CPU mapped to @hctx, anything
+ *     else is punted to kblockd on one of the mapped CPUs.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	int cpu;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	cpu = get_cpu();
+	if (!async && cpumask_test_cpu(cpu, hctx->cpumask)) {
+		put_cpu();
+		__blk_mq_run_hw_queue(hctx);
+		return;
+	}
+	put_cpu();
+
+	cpu = cpumask_first_and(hctx->cpumask, cpu_online_mask);
+	if (cpu < nr_cpu_ids)
+		kblockd_schedule_work_on(cpu, &hctx->run_work);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx) ||
+		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/*
+ * Restarting a queue is typically done from the completion interrupt of
+ * the driver, so the run itself always happens from kblockd.
+ */
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	blk_mq_run_hw_queue(hctx, true);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_stop_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		blk_mq_start_hw_queue(hctx);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/*
+ * Called with ctx->lock held.
+ */
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+}
+
+void blk_mq_insert_request(struct request_queue *q, struct request *rq,
+			   bool at_head, bool run_queue)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, at_head);
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, false);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+static void blk_mq_insert_requests(struct request_queue *q,
+				   struct blk_mq_ctx *ctx,
+				   struct list_head *list,
+				   int depth,
+				   bool from_schedule)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	trace_block_unplug(q, depth, !from_schedule);
+
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	/*
+	 * preemption doesn't flush plug list, so it's possible ctx->cpu is
+	 * offline now
+	 */
+	spin_lock(&ctx->lock);
+	while (!list_empty(list)) {
+		struct request *rq;
+
+		rq = list_first_entry(list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		__blk_mq_insert_request(hctx, rq, false);
+	}
+	spin_unlock(&ctx->lock);
+
+	blk_mq_run_hw_queue(hctx, from_schedule);
+}
+
+static int plug_ctx_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	return !(rqa->mq_ctx < rqb->mq_ctx ||
+		 (rqa->mq_ctx == rqb->mq_ctx &&
+		  blk_rq_pos(rqa) < blk_rq_pos(rqb)));
+}
+
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	struct blk_mq_ctx *this_ctx;
+	struct request_queue *this_q;
+	struct request *rq;
+	LIST_HEAD(list);
+	LIST_HEAD(ctx_list);
+	unsigned int depth;
+
+	list_splice_init(&plug->mq_list, &list);
+
+	list_sort(NULL, &list, plug_ctx_cmp);
+
+	this_q = NULL;
+	this_ctx = NULL;
+	depth = 0;
+
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+		BUG_ON(!rq->q);
+		if (rq->mq_ctx != this_ctx) {
+			if (this_ctx) {
+				blk_mq_insert_requests(this_q, this_ctx,
+							&ctx_list, depth,
+							from_schedule);
+			}
+
+			this_ctx = rq->mq_ctx;
+			this_q = rq->q;
+			depth = 0;
+		}
+
+		depth++;
+		list_add_tail(&rq->queuelist, &ctx_list);
+	}
+
+	/*
+	 * If 'this_ctx' is set, we know we have entries to complete
+	 * on 'ctx_list'. Do those.
+	 */
+	if (this_ctx) {
+		blk_mq_insert_requests(this_q, this_ctx, &ctx_list, depth,
+				       from_schedule);
+	}
+}
+
+static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	const int is_sync = rw_is_sync(bio->bi_rw);
+	int rw = bio_data_dir(bio);
+	unsigned int rw_flags, request_count = 0;
+	struct blk_plug *plug;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	/* the request this bio ends up in takes over the reference */
+	if (unlikely(!blk_mq_queue_enter(q))) {
+		bio_endio(bio, -ENODEV);
+		return;
+	}
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if (blk_mq_should_merge(hctx)) {
+		if (blk_attempt_plug_merge(q, bio, &request_count)) {
+			blk_mq_put_ctx(ctx);
+			blk_mq_queue_exit(q);
+			return;
+		}
+
+		spin_lock(&ctx->lock);
+		if (blk_mq_attempt_merge(q, ctx, bio)) {
+			spin_unlock(&ctx->lock);
+			blk_mq_put_ctx(ctx);
+			blk_mq_queue_exit(q);
+			return;
+		}
+		spin_unlock(&ctx->lock);
+	}
+
+	rw_flags = rw;
+	if (is_sync)
+		rw_flags |= REQ_SYNC;
+
+	trace_block_getrq(q, bio, rw);
+	rq = __blk_mq_alloc_request(hctx, GFP_ATOMIC);
+	blk_mq_put_ctx(ctx);
+
+	if (unlikely(!rq)) {
+		/*
+		 * Out of tags.  Get the queue going so that tags are
+		 * returned, then sleep until one is free.  Any plugged
+		 * requests are flushed when we schedule.
+		 */
+		trace_block_sleeprq(q, bio, rw);
+		blk_mq_run_hw_queue(hctx, false);
+		rq = __blk_mq_alloc_request(hctx, GFP_NOIO);
+	}
+
+	blk_mq_rq_ctx_init(q, ctx, rq, rw_flags);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	/*
+	 * A task plug holds requests in plug->mq_list until it is flushed,
+	 * they go straight to their software queue then.
+	 */
+	plug = current->plug;
+	if (plug) {
+		if (list_empty(&plug->mq_list))
+			trace_block_plug(q);
+		else if (request_count >= BLK_MAX_REQUEST_COUNT) {
+			blk_flush_plug_list(plug, false);
+			trace_block_plug(q);
+		}
+		list_add_tail(&rq->queuelist, &plug->mq_list);
+		return;
+	}
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, false);
+	spin_unlock(&ctx->lock);
+
+	blk_mq_run_hw_queue(hctx, !is_sync);
+}
+
+/**
+ * blk_mq_kill_queue - stop allocating requests from a dying queue
+ * @q:	multiqueue request queue
+ *
+ * Description:
+ *     Called by blk_cleanup_queue() once @q is marked dead.  New bios
+ *     and request allocations fail with -ENODEV from here on, and the
+ *     usage counter switches to counting down the requests in flight.
+ */
+void blk_mq_kill_queue(struct request_queue *q)
+{
+	percpu_ref_kill(&q->mq_usage_counter);
+}
+
+/**
+ * blk_mq_drain_queue - kick and check hardware queues for outstanding requests
+ * @q:	multiqueue request queue
+ *
+ * Description:
+ *     Schedules a run of every hardware queue with pending work and
+ *     returns %true while any request is still allocated or any bio is
+ *     still being mapped to one.  Used by blk_drain_queue() after
+ *     blk_mq_kill_queue(), may be called with the queue lock held.
+ */
+bool blk_mq_drain_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (blk_mq_hctx_has_pending(hctx))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+
+	return !percpu_ref_is_zero(&q->mq_usage_counter);
+}
+
+static size_t order_to_size(unsigned int order)
+{
+	size_t ret = PAGE_SIZE;
+
+	while (order--)
+		ret *= 2;
+
+	return ret;
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	struct page *page;
+
+	while (!list_empty(&hctx->page_list)) {
+		page = list_first_entry(&hctx->page_list, struct page, lru);
+		list_del_init(&page->lru);
+		__free_pages(page, page_private(page));
+	}
+
+	kfree(hctx->rqs);
+	hctx->rqs = NULL;
+}
+
+/*
+ * Requests and the driver payload behind them are allocated up front, in
+ * chunks of up to 64KB so that a deep queue doesn't need a huge
+ * contiguous allocation.
+ */
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      unsigned int cmd_size, int node)
+{
+	const unsigned int max_order = 4;
+	unsigned int i, j, entries_per_page;
+	size_t rq_size, left;
+
+	hctx->rqs = kmalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	rq_size = round_up(sizeof(struct request) + cmd_size,
+			   cache_line_size());
+	left = rq_size * hctx->queue_depth;
+
+	for (i = 0; i < hctx->queue_depth;) {
+		int this_order = max_order;
+		struct page *page;
+		int to_do;
+		void *p;
+
+		while (left < order_to_size(this_order - 1) && this_order)
+			this_order--;
+
+		do {
+			page = alloc_pages_node(node, GFP_KERNEL | __GFP_NOWARN,
+						this_order);
+			if (page)
+				break;
+			if (!this_order--)
+				break;
+			if (order_to_size(this_order) < rq_size)
+				break;
+		} while (1);
+
+		if (!page)
+			goto fail;
+
+		set_page_private(page, this_order);
+		list_add_tail(&page->lru, &hctx->page_list);
+
+		p = page_address(page);
+		entries_per_page = order_to_size(this_order) / rq_size;
+		to_do = min(entries_per_page, hctx->queue_depth - i);
+		left -= to_do * rq_size;
+		for (j = 0; j < to_do; j++) {
+			hctx->rqs[i] = p;
+			blk_rq_init(hctx->queue, hctx->rqs[i]);
+			hctx->rqs[i]->tag = i;
+			p += rq_size;
+			i++;
+		}
+	}
+
+	return 0;
+
+fail:
+	pr_warn("%s: failed to allocate requests\n", __func__);
+	blk_mq_free_rq_map(hctx);
+	return -ENOMEM;
+}
+
+static void blk_mq_free_hctx_resources(struct blk_mq_hw_ctx *hctx)
+{
+	blk_mq_free_rq_map(hctx);
+	if (hctx->tags)
+		blk_mq_free_tags(hctx->tags);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i, j;
+
+	/*
+	 * Initialize hardware queues
+	 */
+	queue_for_each_hw_ctx(q, hctx, i) {
+		int node = reg->numa_node;
+
+		INIT_WORK(&hctx->run_work, blk_mq_work_fn);
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_LIST_HEAD(&hctx->page_list);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->numa_node = node;
+		hctx->flags = reg->flags;
+		hctx->queue_depth = reg->queue_depth;
+
+		hctx->ctxs = kmalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		if (!hctx->ctxs)
+			break;
+
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, node);
+		if (!hctx->ctx_map)
+			break;
+
+		hctx->tags = blk_mq_init_tags(hctx->queue_depth, node);
+		if (!hctx->tags)
+			break;
+
+		if (blk_mq_init_rq_map(hctx, reg->cmd_size, node))
+			break;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			break;
+	}
+
+	if (i == q->nr_hw_queues)
+		return 0;
+
+	/*
+	 * Init failed
+	 */
+	queue_for_each_hw_ctx(q, hctx, j) {
+		if (j > i)
+			break;
+
+		if (j < i && reg->ops->exit_hctx)
+			reg->ops->exit_hctx(hctx, j);
+
+		blk_mq_free_hctx_resources(hctx);
+	}
+
+	return -ENOMEM;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *__ctx = __blk_mq_get_ctx(q, i);
+
+		memset(__ctx, 0, sizeof(*__ctx));
+		__ctx->cpu = i;
+		spin_lock_init(&__ctx->lock);
+		INIT_LIST_HEAD(&__ctx->rq_list);
+		__ctx->queue = q;
+	}
+}
+
+static void blk_mq_map_swqueue(struct request_queue *q, map_queue_fn *map)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cpumask_clear(hctx->cpumask);
+		hctx->nr_ctx = 0;
+	}
+
+	/*
+	 * Map software to hardware queues.  Offline CPUs are mapped as
+	 * well, their queues are simply never used until they come up.
+	 */
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+		hctx = map(q, i);
+		cpumask_set_cpu(i, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - allocate a multiqueue request queue
+ * @reg:	description of the hardware queues
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Description:
+ *     Drivers with more than one submission queue, or just a desire to
+ *     bypass the request_fn path and its queue lock, use this instead of
+ *     blk_init_queue().  Requests are preallocated per hardware queue
+ *     with @reg->cmd_size bytes of driver payload behind each one, see
+ *     blk_mq_rq_to_pdu().  Each request is passed to ->queue_rq() with
+ *     its tag in rq->tag and must be completed with blk_mq_end_io().
+ *
+ *     No flush sequencing is done for multiqueue queues.  Drivers that
+ *     set up blk_queue_flush() see REQ_FLUSH and REQ_FUA on requests
+ *     just like bio based drivers see them on bios.
+ *
+ *     Function returns a pointer to the initialized request queue, or
+ *     %NULL if it didn't succeed.
+ *
+ * Note:
+ *     blk_mq_init_queue() must be paired with a blk_cleanup_queue() call
+ *     when the block device is deactivated.
+ **/
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx **hctxs;
+	struct blk_mq_ctx *ctx;
+	struct request_queue *q;
+	int i;
+
+	if (!reg->nr_hw_queues ||
+	    !reg->ops->queue_rq || !reg->ops->map_queue)
+		return NULL;
+
+	if (!reg->queue_depth)
+		reg->queue_depth = BLK_MQ_MAX_DEPTH;
+	else if (reg->queue_depth > BLK_MQ_MAX_DEPTH) {
+		pr_err("blk-mq: queuedepth too large (%u)\n", reg->queue_depth);
+		reg->queue_depth = BLK_MQ_MAX_DEPTH;
+	}
+
+	ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!ctx)
+		return NULL;
+
+	hctxs = kzalloc_node(reg->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
+			     reg->numa_node);
+	if (!hctxs)
+		goto err_percpu;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctxs[i] = kzalloc_node(sizeof(struct blk_mq_hw_ctx),
+					GFP_KERNEL, reg->numa_node);
+		if (!hctxs[i])
+			goto err_hctxs;
+
+		if (!zalloc_cpumask_var(&hctxs[i]->cpumask, GFP_KERNEL))
+			goto err_hctxs;
+	}
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		goto err_hctxs;
+
+	q->mq_map = blk_mq_make_queue_map(reg);
+	if (!q->mq_map)
+		goto err_map;
+
+	if (percpu_ref_init(&q->mq_usage_counter, blk_mq_usage_counter_release))
+		goto err_ref;
+
+	setup_timer(&q->timeout, blk_mq_rq_timer, (unsigned long) q);
+	blk_queue_rq_timeout(q, reg->timeout ? reg->timeout : 30 * HZ);
+
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_ctx = ctx;
+	q->queue_hw_ctx = hctxs;
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+
+	/*
+	 * This also sets hw/phys segments, boundary and size
+	 */
+	blk_queue_make_request(q, blk_mq_make_request);
+
+	blk_mq_init_cpu_queues(q);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_hw;
+
+	blk_mq_map_swqueue(q, reg->ops->map_queue);
+
+	q->mq_ops = reg->ops;
+
+	/* all done, end the initial bypass */
+	blk_queue_bypass_end(q);
+	return q;
+
+err_hw:
+	percpu_ref_exit(&q->mq_usage_counter);
+err_ref:
+	kfree(q->mq_map);
+err_map:
+	q->queue_ctx = NULL;
+	q->queue_hw_ctx = NULL;
+	q->nr_hw_queues = 0;
+	blk_cleanup_queue(q);
+err_hctxs:
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		if (!hctxs[i])
+			break;
+		free_cpumask_var(hctxs[i]->cpumask);
+		kfree(hctxs[i]);
+	}
+	kfree(hctxs);
+err_percpu:
+	free_percpu(ctx);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_release_queue() once the last reference is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_work_sync(&hctx->run_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+		blk_mq_free_hctx_resources(hctx);
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+	}
+
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+	percpu_ref_exit(&q->mq_usage_counter);
+
+	q->queue_hw_ctx = NULL;
+	q->queue_ctx = NULL;
+	q->mq_map = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+void blk_mq_free_queue(struct request_queue *q);
+void blk_mq_kill_queue(struct request_queue *q);
+bool blk_mq_drain_queue(struct request_queue *q);
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule);
+
+/*
+ * Tag allocation
+ */
+#define BLK_MQ_TAG_FAIL		((unsigned int) -1)
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+
+/*
+ * CPU -> queue mappings
+ */
+unsigned int *blk_mq_make_queue_map(struct blk_mq_reg *reg);
+
+#endif
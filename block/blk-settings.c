@@ -81,6 +81,20 @@ void blk_queue_softirq_done(struct request_queue *q, softirq_done_fn *fn)
 }
 EXPORT_SYMBOL(blk_queue_softirq_done);
 
+/**
+ * blk_queue_poll_fn - set the polled completion handler for a queue
+ * @q:  queue
+ * @fn: reaps completions for the calling CPU, returns the number found
+ *
+ * Setting a handler lets the administrator enable polled completion of
+ * synchronous direct I/O through the queue's io_poll attribute.
+ */
+void blk_queue_poll_fn(struct request_queue *q, poll_q_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll_fn);
+
 void blk_queue_rq_timeout(struct request_queue *q, unsigned int timeout)
 {
 	q->rq_timeout = timeout;
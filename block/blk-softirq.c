@@ -14,6 +14,19 @@
 
 static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
 
+/*
+ * A completion for I/O issued on @ccpu may run on @cpu if it is the same
+ * CPU or, unless the queue forces the exact CPU, shares a cache with it.
+ */
+static bool blk_complete_locally(struct request_queue *q, int cpu, int ccpu)
+{
+	if (cpu == ccpu)
+		return true;
+	if (test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags))
+		return false;
+	return cpus_share_cache(cpu, ccpu);
+}
+
 /*
  * Softirq action handler - move entries to local list and loop over them
  * while passing them to the queue registered handler.
@@ -71,12 +84,58 @@ static int raise_blk_irq(int cpu, struct request *rq)
 
 	return 1;
 }
+
+/**
+ * blk_steer_completion - run a completion on the CPU that issued the I/O
+ * @q:		queue the I/O was issued to
+ * @submit_cpu:	CPU that issued the I/O
+ * @csd:	completion to run, with ->func and ->info set up
+ *
+ * Description:
+ *     For drivers that complete bios or requests without going through
+ *     blk_complete_request().  Uses the same rules as the softirq
+ *     completion path: nothing is steered unless @q has
+ *     %QUEUE_FLAG_SAME_COMP set, and a CPU sharing a cache with
+ *     @submit_cpu completes locally unless %QUEUE_FLAG_SAME_FORCE is set.
+ *     @csd->func is called from IPI context on @submit_cpu.
+ *
+ * Return:
+ *     %true if the completion was sent to @submit_cpu, %false if the
+ *     caller should complete locally.
+ **/
+bool blk_steer_completion(struct request_queue *q, int submit_cpu,
+			  struct call_single_data *csd)
+{
+	bool steered = false;
+	int cpu;
+
+	if (submit_cpu < 0 || !test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
+		return false;
+
+	cpu = get_cpu();
+	if (!blk_complete_locally(q, cpu, submit_cpu) &&
+	    cpu_online(submit_cpu)) {
+		csd->flags = 0;
+		__smp_call_function_single(submit_cpu, csd, 0);
+		steered = true;
+	}
+	put_cpu();
+
+	return steered;
+}
 #else /* CONFIG_SMP && CONFIG_USE_GENERIC_SMP_HELPERS */
 static int raise_blk_irq(int cpu, struct request *rq)
 {
 	return 1;
 }
+
+bool blk_steer_completion(struct request_queue *q, int submit_cpu,
+			  struct call_single_data *csd)
+{
+	return false;
+}
 #endif
+EXPORT_SYMBOL(blk_steer_completion);
 
 static int __cpuinit blk_cpu_notify(struct notifier_block *self,
 				    unsigned long action, void *hcpu)
@@ -107,7 +166,6 @@ void __blk_complete_request(struct request *req)
 	int ccpu, cpu;
 	struct request_queue *q = req->q;
 	unsigned long flags;
-	bool shared = false;
 
 	BUG_ON(!q->softirq_done_fn);
 
@@ -117,11 +175,9 @@ void __blk_complete_request(struct request *req)
 	/*
 	 * Select completion CPU
 	 */
-	if (req->cpu != -1) {
+	if (req->cpu != -1)
 		ccpu = req->cpu;
-		if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags))
-			shared = cpus_share_cache(cpu, ccpu);
-	} else
+	else
 		ccpu = cpu;
 
 	/*
@@ -132,7 +188,7 @@ void __blk_complete_request(struct request *req)
 	 * support multiple interrupts, so current CPU is unique actually. This
 	 * avoids IPI sending from current CPU to the first CPU of a group.
 	 */
-	if (ccpu == cpu || shared) {
+	if (blk_complete_locally(q, cpu, ccpu)) {
 		struct list_head *list;
 do_local:
 		list = &__get_cpu_var(blk_cpu_done);
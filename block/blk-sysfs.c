@@ -6,10 +6,12 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/blktrace_api.h>
 
 #include "blk.h"
 #include "blk-cgroup.h"
+#include "blk-mq.h"
 
 struct queue_sysfs_entry {
 	struct attribute attr;
@@ -280,6 +282,73 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_poll(q), page);
+}
+
+static ssize_t queue_poll_store(struct request_queue *q, const char *page,
+				size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+
+	if (!q->poll_fn)
+		return -EINVAL;
+
+	ret = queue_var_store(&val, page, count);
+	spin_lock_irq(q->queue_lock);
+	if (val)
+		queue_flag_set(QUEUE_FLAG_POLL, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_POLL, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_poll_delay_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%d\n", q->poll_delay);
+}
+
+static ssize_t queue_poll_delay_store(struct request_queue *q,
+				      const char *page, size_t count)
+{
+	long val;
+
+	if (kstrtol(page, 10, &val) || val < -1 || val > INT_MAX)
+		return -EINVAL;
+
+	q->poll_delay = val;
+	return count;
+}
+
+static ssize_t queue_poll_budget_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->poll_budget, page);
+}
+
+static ssize_t queue_poll_budget_store(struct request_queue *q,
+				       const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	q->poll_budget = min_t(unsigned long, val, USEC_PER_SEC);
+	return ret;
+}
+
+static ssize_t queue_poll_hits_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->poll_hits, page);
+}
+
+static ssize_t queue_poll_misses_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->poll_misses, page);
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -394,6 +463,57 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_lat_hist_entry = {
+	.attr = {.name = "latency_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_lat_hist_show,
+	.store = blk_lat_hist_store,
+};
+
+static struct queue_sysfs_entry queue_discard_rate_entry = {
+	.attr = {.name = "discard_rate_mb", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_discard_rate_show,
+	.store = blk_discard_rate_store,
+};
+
+static struct queue_sysfs_entry queue_wb_lat_entry = {
+	.attr = {.name = "wb_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_wbt_lat_show,
+	.store = blk_wbt_lat_store,
+};
+
+static struct queue_sysfs_entry queue_wb_depth_entry = {
+	.attr = {.name = "wb_depth", .mode = S_IRUGO },
+	.show = blk_wbt_depth_show,
+};
+
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+static struct queue_sysfs_entry queue_poll_delay_entry = {
+	.attr = {.name = "io_poll_delay", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_delay_show,
+	.store = queue_poll_delay_store,
+};
+
+static struct queue_sysfs_entry queue_poll_budget_entry = {
+	.attr = {.name = "io_poll_budget", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_budget_show,
+	.store = queue_poll_budget_store,
+};
+
+static struct queue_sysfs_entry queue_poll_hits_entry = {
+	.attr = {.name = "io_poll_hits", .mode = S_IRUGO },
+	.show = queue_poll_hits_show,
+};
+
+static struct queue_sysfs_entry queue_poll_misses_entry = {
+	.attr = {.name = "io_poll_misses", .mode = S_IRUGO },
+	.show = queue_poll_misses_show,
+};
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -411,11 +531,20 @@ static struct attribute *default_attrs[] = {
 	&queue_discard_granularity_entry.attr,
 	&queue_discard_max_entry.attr,
 	&queue_discard_zeroes_data_entry.attr,
+	&queue_discard_rate_entry.attr,
 	&queue_nonrot_entry.attr,
 	&queue_nomerges_entry.attr,
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_poll_entry.attr,
+	&queue_poll_delay_entry.attr,
+	&queue_poll_budget_entry.attr,
+	&queue_poll_hits_entry.attr,
+	&queue_poll_misses_entry.attr,
+	&queue_lat_hist_entry.attr,
+	&queue_wb_lat_entry.attr,
+	&queue_wb_depth_entry.attr,
 	NULL,
 };
 
@@ -499,6 +628,13 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
+	blk_lat_hist_exit(q);
+	blk_discard_queue_exit(q);
+	blk_wbt_exit(q);
+
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
@@ -39,14 +39,12 @@ static int __blk_free_tags(struct blk_queue_tag *bqt)
 
 	retval = atomic_dec_and_test(&bqt->refcnt);
 	if (retval) {
-		BUG_ON(find_first_bit(bqt->tag_map, bqt->max_depth) <
-							bqt->max_depth);
+		BUG_ON(percpu_tags_nr_busy(&bqt->tag_pool));
 
 		kfree(bqt->tag_index);
 		bqt->tag_index = NULL;
 
-		kfree(bqt->tag_map);
-		bqt->tag_map = NULL;
+		percpu_tags_destroy(&bqt->tag_pool);
 
 		kfree(bqt);
 	}
@@ -108,8 +106,7 @@ static int
 init_tag_map(struct request_queue *q, struct blk_queue_tag *tags, int depth)
 {
 	struct request **tag_index;
-	unsigned long *tag_map;
-	int nr_ulongs;
+	int node = q ? q->node : NUMA_NO_NODE;
 
 	if (q && depth > q->nr_requests * 2) {
 		depth = q->nr_requests * 2;
@@ -121,15 +118,12 @@ init_tag_map(struct request_queue *q, struct blk_queue_tag *tags, int depth)
 	if (!tag_index)
 		goto fail;
 
-	nr_ulongs = ALIGN(depth, BITS_PER_LONG) / BITS_PER_LONG;
-	tag_map = kzalloc(nr_ulongs * sizeof(unsigned long), GFP_ATOMIC);
-	if (!tag_map)
+	if (percpu_tags_init(&tags->tag_pool, depth, GFP_ATOMIC, node))
 		goto fail;
 
 	tags->real_max_depth = depth;
 	tags->max_depth = depth;
 	tags->tag_index = tag_index;
-	tags->tag_map = tag_map;
 
 	return 0;
 fail:
@@ -221,8 +215,8 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 {
 	struct blk_queue_tag *bqt = q->queue_tags;
 	struct request **tag_index;
-	unsigned long *tag_map;
-	int max_depth, nr_ulongs;
+	struct percpu_tags tag_pool;
+	int max_depth, i;
 
 	if (!bqt)
 		return -ENXIO;
@@ -235,6 +229,7 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	 */
 	if (new_depth <= bqt->real_max_depth) {
 		bqt->max_depth = new_depth;
+		percpu_tags_resize(&bqt->tag_pool, new_depth);
 		return 0;
 	}
 
@@ -249,18 +244,26 @@ int blk_queue_resize_tags(struct request_queue *q, int new_depth)
 	 * save the old state info, so we can copy it back
 	 */
 	tag_index = bqt->tag_index;
-	tag_map = bqt->tag_map;
+	tag_pool = bqt->tag_pool;
 	max_depth = bqt->real_max_depth;
 
-	if (init_tag_map(q, bqt, new_depth))
+	if (init_tag_map(q, bqt, new_depth)) {
+		bqt->tag_index = tag_index;
+		bqt->tag_pool = tag_pool;
 		return -ENOMEM;
+	}
 
+	/*
+	 * The queue lock keeps tag_index in sync with the busy tags of an
+	 * unshared map, carry those over into the new pool.
+	 */
 	memcpy(bqt->tag_index, tag_index, max_depth * sizeof(struct request *));
-	nr_ulongs = ALIGN(max_depth, BITS_PER_LONG) / BITS_PER_LONG;
-	memcpy(bqt->tag_map, tag_map, nr_ulongs * sizeof(unsigned long));
+	for (i = 0; i < max_depth; i++)
+		if (tag_index[i])
+			percpu_tags_claim(&bqt->tag_pool, i);
 
 	kfree(tag_index);
-	kfree(tag_map);
+	percpu_tags_destroy(&tag_pool);
 	return 0;
 }
 EXPORT_SYMBOL(blk_queue_resize_tags);
@@ -290,22 +293,19 @@ void blk_queue_end_tag(struct request_queue *q, struct request *rq)
 	rq->cmd_flags &= ~REQ_QUEUED;
 	rq->tag = -1;
 
-	if (unlikely(bqt->tag_index[tag] == NULL))
-		printk(KERN_ERR "%s: tag %d is missing\n",
-		       __func__, tag);
-
-	bqt->tag_index[tag] = NULL;
-
-	if (unlikely(!test_bit(tag, bqt->tag_map))) {
+	if (unlikely(bqt->tag_index[tag] == NULL)) {
 		printk(KERN_ERR "%s: attempt to clear non-busy tag (%d)\n",
 		       __func__, tag);
 		return;
 	}
+
+	bqt->tag_index[tag] = NULL;
+
 	/*
-	 * The tag_map bit acts as a lock for tag_index[bit], so we need
-	 * unlock memory barrier semantics.
+	 * Owning the tag acts as a lock for tag_index[tag], the pool
+	 * provides the unlock memory barrier semantics on free.
 	 */
-	clear_bit_unlock(tag, bqt->tag_map);
+	percpu_tags_free(&bqt->tag_pool, tag);
 }
 EXPORT_SYMBOL(blk_queue_end_tag);
 
@@ -357,16 +357,13 @@ int blk_queue_start_tag(struct request_queue *q, struct request *rq)
 			return 1;
 	}
 
-	do {
-		tag = find_first_zero_bit(bqt->tag_map, max_depth);
-		if (tag >= max_depth)
-			return 1;
-
-	} while (test_and_set_bit_lock(tag, bqt->tag_map));
 	/*
-	 * We need lock ordering semantics given by test_and_set_bit_lock.
-	 * See blk_queue_end_tag for details.
+	 * The pool hands out tags with lock ordering semantics, see
+	 * blk_queue_end_tag for details.
 	 */
+	tag = percpu_tags_alloc(&bqt->tag_pool, GFP_ATOMIC);
+	if (tag < 0)
+		return 1;
 
 	rq->cmd_flags |= REQ_QUEUED;
 	rq->tag = tag;
@@ -1202,6 +1202,32 @@ out:
 	return throttled;
 }
 
+/**
+ * blk_throtl_dirty_ratelimit - write limit of %current's blkcg
+ * @q: the request_queue
+ *
+ * Returns the write bandwidth limit of %current's blkcg on @q in pages per
+ * second, or 0 if there is none.  balance_dirty_pages() keeps the task from
+ * dirtying pages faster than writeback of them will be allowed to go.
+ */
+unsigned long blk_throtl_dirty_ratelimit(struct request_queue *q)
+{
+	struct throtl_data *td = q->td;
+	struct throtl_grp *tg;
+	unsigned long ratelimit = 0;
+
+	if (!td)
+		return 0;
+
+	rcu_read_lock();
+	tg = throtl_lookup_tg(td, task_blkcg(current));
+	if (tg && tg->bps[WRITE] != -1)
+		ratelimit = max_t(u64, tg->bps[WRITE] >> PAGE_SHIFT, 1);
+	rcu_read_unlock();
+
+	return ratelimit;
+}
+
 /**
  * blk_throtl_drain - drain throttled bios
  * @q: request_queue to drain throttled bios for
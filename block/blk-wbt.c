@@ -0,0 +1,227 @@
+/*
+ * Writeback throttling
+ *
+ * Background writeback can take every request a queue has, and reads
+ * that come in behind it then wait for all of those writes first.  The
+ * number of background writes in flight is therefore limited, and the
+ * limit follows the read latency seen at completion: it is halved after
+ * every window in which even the fastest read missed the target, and
+ * doubled again after a window in which reads made it or none were
+ * issued, up to three quarters of nr_requests.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+
+#include "blk.h"
+
+#define BLK_WBT_WINDOW		(HZ / 10)
+#define BLK_WBT_MIN_SAMPLES	3
+
+/* read latency targets, usecs */
+#define BLK_WBT_LAT_NONROT	2000
+#define BLK_WBT_LAT_ROT		75000
+
+/*
+ * Everything in here is protected by the queue lock.
+ */
+struct blk_wbt {
+	unsigned int		inflight;	/* throttled writes allocated */
+	wait_queue_head_t	wait;
+
+	unsigned int		scale_step;	/* limit is max depth >> step */
+	int			lat_target;	/* usecs, 0 off, -1 default */
+
+	/*
+	 * current window
+	 */
+	unsigned long		window_start;
+	unsigned int		nr_reads;
+	u64			min_lat;	/* nsecs */
+};
+
+static unsigned int blk_wbt_lat_target(struct request_queue *q)
+{
+	int target = q->wbt->lat_target;
+
+	if (target >= 0)
+		return target;
+	return blk_queue_nonrot(q) ? BLK_WBT_LAT_NONROT : BLK_WBT_LAT_ROT;
+}
+
+static unsigned int blk_wbt_limit(struct request_queue *q)
+{
+	unsigned int depth = max(q->nr_requests * 3 / 4, 1UL);
+
+	return max(depth >> q->wbt->scale_step, 1U);
+}
+
+static void blk_wbt_reset_window(struct blk_wbt *wbt)
+{
+	wbt->window_start = jiffies;
+	wbt->nr_reads = 0;
+	wbt->min_lat = ULLONG_MAX;
+}
+
+/*
+ * Close the current window if it is over and move the limit.  Looking at
+ * the minimum rather than an average keeps a few reads that were slow for
+ * their own reasons from throttling writeback.
+ */
+static void blk_wbt_check_window(struct request_queue *q)
+{
+	struct blk_wbt *wbt = q->wbt;
+
+	if (!time_after(jiffies, wbt->window_start + BLK_WBT_WINDOW))
+		return;
+
+	if (!wbt->nr_reads ||
+	    wbt->min_lat <= (u64)blk_wbt_lat_target(q) * NSEC_PER_USEC) {
+		if (wbt->scale_step) {
+			wbt->scale_step--;
+			wake_up_all(&wbt->wait);
+		}
+	} else if (wbt->nr_reads >= BLK_WBT_MIN_SAMPLES) {
+		if (blk_wbt_limit(q) > 1)
+			wbt->scale_step++;
+	}
+
+	blk_wbt_reset_window(wbt);
+}
+
+static bool blk_wbt_should_throttle(struct request_queue *q, struct bio *bio)
+{
+	if (!q->wbt || !blk_wbt_lat_target(q))
+		return false;
+	if (bio_data_dir(bio) != WRITE ||
+	    (bio->bi_rw & (REQ_SYNC | REQ_FLUSH | REQ_FUA | REQ_DISCARD)))
+		return false;
+	/* don't slow down reclaim */
+	return !current_is_kswapd();
+}
+
+/**
+ * blk_wbt_wait - wait until a background write may allocate a request
+ * @q:		request queue
+ * @bio:	bio about to get a request
+ *
+ * Called with the queue lock held, which is dropped while sleeping.
+ * Returns true if the request has to be marked %REQ_WB_THROTTLED, and
+ * blk_wbt_done() must be called if no request is allocated after all.
+ */
+bool blk_wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	struct blk_wbt *wbt = q->wbt;
+	DEFINE_WAIT(wait);
+
+	if (!blk_wbt_should_throttle(q, bio))
+		return false;
+
+	blk_wbt_check_window(q);
+	while (wbt->inflight >= blk_wbt_limit(q)) {
+		prepare_to_wait_exclusive(&wbt->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		spin_unlock_irq(q->queue_lock);
+		io_schedule();
+		spin_lock_irq(q->queue_lock);
+		finish_wait(&wbt->wait, &wait);
+		blk_wbt_check_window(q);
+	}
+
+	wbt->inflight++;
+	return true;
+}
+
+/**
+ * blk_wbt_done - a throttled write went away
+ * @q:		request queue
+ *
+ * Called with the queue lock held.
+ */
+void blk_wbt_done(struct request_queue *q)
+{
+	struct blk_wbt *wbt = q->wbt;
+
+	wbt->inflight--;
+	if (waitqueue_active(&wbt->wait) && wbt->inflight < blk_wbt_limit(q))
+		wake_up(&wbt->wait);
+}
+
+/*
+ * Called with the queue lock held for every completed request.
+ */
+void blk_wbt_account(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_wbt *wbt = q->wbt;
+	u64 issue, now;
+
+	if (!wbt || rq->cmd_type != REQ_TYPE_FS || rq_data_dir(rq) != READ)
+		return;
+
+	issue = rq_io_start_time_ns(rq);
+	now = sched_clock();
+	if (issue && time_after64(now, issue)) {
+		wbt->nr_reads++;
+		wbt->min_lat = min(wbt->min_lat, now - issue);
+	}
+
+	blk_wbt_check_window(q);
+}
+
+ssize_t blk_wbt_lat_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%u\n", blk_wbt_lat_target(q));
+}
+
+/*
+ * Writing -1 goes back to the default for the type of device, 0 turns
+ * throttling off.
+ */
+ssize_t blk_wbt_lat_store(struct request_queue *q, const char *page,
+			  size_t count)
+{
+	struct blk_wbt *wbt = q->wbt;
+	int val;
+
+	if (kstrtoint(page, 10, &val) || val < -1)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	wbt->lat_target = val;
+	wbt->scale_step = 0;
+	blk_wbt_reset_window(wbt);
+	wake_up_all(&wbt->wait);
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
+ssize_t blk_wbt_depth_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%u\n", blk_wbt_limit(q));
+}
+
+int blk_wbt_init(struct request_queue *q)
+{
+	struct blk_wbt *wbt;
+
+	wbt = kzalloc_node(sizeof(*wbt), GFP_KERNEL, q->node);
+	if (!wbt)
+		return -ENOMEM;
+
+	init_waitqueue_head(&wbt->wait);
+	wbt->lat_target = -1;
+	blk_wbt_reset_window(wbt);
+
+	q->wbt = wbt;
+	return 0;
+}
+
+void blk_wbt_exit(struct request_queue *q)
+{
+	kfree(q->wbt);
+	q->wbt = NULL;
+}
@@ -9,6 +9,9 @@
 /* Number of requests a "batching" process may submit */
 #define BLK_BATCH_REQ	32
 
+/* Default time a task may spin in blk_poll() before going to sleep */
+#define BLK_POLL_BUDGET_USECS	100
+
 extern struct kmem_cache *blk_requestq_cachep;
 extern struct kobj_type blk_queue_ktype;
 extern struct ida blk_queue_ida;
@@ -32,6 +35,46 @@ void blk_dequeue_request(struct request *rq);
 void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
 			    unsigned int nr_bytes, unsigned int bidi_bytes);
+void drive_stat_acct(struct request *rq, int new_io);
+void blk_account_io_done(struct request *req);
+bool bio_attempt_front_merge(struct request_queue *q, struct request *req,
+			     struct bio *bio);
+bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+			    struct bio *bio);
+bool blk_attempt_plug_merge(struct request_queue *q, struct bio *bio,
+			    unsigned int *request_count);
+
+/*
+ * Latency histograms
+ */
+#define BLK_LAT_HIST_BUCKETS	24
+
+int blk_lat_hist_init(struct request_queue *q);
+void blk_lat_hist_exit(struct request_queue *q);
+void blk_lat_hist_account(struct request *rq);
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page);
+ssize_t blk_lat_hist_store(struct request_queue *q, const char *page,
+			   size_t count);
+
+int blk_discard_queue_init(struct request_queue *q);
+void blk_discard_queue_drain(struct request_queue *q);
+void blk_discard_queue_exit(struct request_queue *q);
+ssize_t blk_discard_rate_show(struct request_queue *q, char *page);
+ssize_t blk_discard_rate_store(struct request_queue *q, const char *page,
+			       size_t count);
+
+/*
+ * Writeback throttling
+ */
+int blk_wbt_init(struct request_queue *q);
+void blk_wbt_exit(struct request_queue *q);
+bool blk_wbt_wait(struct request_queue *q, struct bio *bio);
+void blk_wbt_done(struct request_queue *q);
+void blk_wbt_account(struct request *rq);
+ssize_t blk_wbt_lat_show(struct request_queue *q, char *page);
+ssize_t blk_wbt_lat_store(struct request_queue *q, const char *page,
+			  size_t count);
+ssize_t blk_wbt_depth_show(struct request_queue *q, char *page);
 
 void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
@@ -42,6 +85,7 @@ void blk_add_timer(struct request *);
  */
 enum rq_atomic_flags {
 	REQ_ATOM_COMPLETE = 0,
+	REQ_ATOM_STARTED,
 };
 
 /*
@@ -0,0 +1,317 @@
+/*
+ *  Latency target i/o scheduler.
+ *
+ *  Reads and writes are queued in separate FIFOs and dispatched in turn.
+ *  The number of writes (including discards) at the device is limited,
+ *  and that limit follows the observed read latency: it is halved after
+ *  every window in which more than one percent of the reads took longer
+ *  than the target, and grown again after windows in which none did.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+
+/*
+ * See Documentation/block/latency-iosched.txt
+ */
+static const int target_latency = 2000;	/* read latency target, usecs */
+static const int max_write_depth = 32;	/* writes at the device, at most */
+static const int window = HZ / 10;	/* how often the write depth adapts */
+
+enum {
+	LAT_READ,
+	LAT_WRITE,		/* writes and discards */
+	LAT_NR_CLASSES,
+};
+
+struct latency_data {
+	struct list_head fifo_list[LAT_NR_CLASSES];
+	int next_class;			/* class to try first on dispatch */
+	int in_flight[LAT_NR_CLASSES];	/* activated, not yet completed */
+
+	/*
+	 * current window
+	 */
+	unsigned long window_start;
+	unsigned int nr_reads;
+	unsigned int nr_slow_reads;
+
+	int write_depth;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int target_latency;
+	int max_write_depth;
+	int window;
+};
+
+static inline int latency_class(struct request *rq)
+{
+	return rq_data_dir(rq) == READ ? LAT_READ : LAT_WRITE;
+}
+
+static void
+latency_merged_requests(struct request_queue *q, struct request *rq,
+			struct request *next)
+{
+	list_del_init(&next->queuelist);
+}
+
+static int latency_dispatch_requests(struct request_queue *q, int force)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	int i;
+
+	for (i = 0; i < LAT_NR_CLASSES; i++) {
+		int class = (ld->next_class + i) % LAT_NR_CLASSES;
+		struct request *rq;
+
+		if (list_empty(&ld->fifo_list[class]))
+			continue;
+		if (class == LAT_WRITE && !force &&
+		    ld->in_flight[LAT_WRITE] >= ld->write_depth)
+			continue;
+
+		rq = list_entry(ld->fifo_list[class].next, struct request,
+				queuelist);
+		list_del_init(&rq->queuelist);
+		elv_dispatch_sort(q, rq);
+
+		ld->next_class = (class + 1) % LAT_NR_CLASSES;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void latency_add_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	list_add_tail(&rq->queuelist, &ld->fifo_list[latency_class(rq)]);
+}
+
+static struct request *
+latency_former_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	if (rq->queuelist.prev == &ld->fifo_list[latency_class(rq)])
+		return NULL;
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+latency_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	if (rq->queuelist.next == &ld->fifo_list[latency_class(rq)])
+		return NULL;
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void latency_activate_request(struct request_queue *q,
+				     struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	ld->in_flight[latency_class(rq)]++;
+}
+
+static void latency_deactivate_request(struct request_queue *q,
+				       struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+
+	ld->in_flight[latency_class(rq)]--;
+}
+
+/*
+ * Close the current window and move the write depth: back off hard when
+ * reads missed the target, probe upwards when they all made it.
+ */
+static void latency_update_depth(struct latency_data *ld)
+{
+	if (ld->nr_slow_reads * 100 > ld->nr_reads)
+		ld->write_depth = max(ld->write_depth / 2, 1);
+	else if (!ld->nr_slow_reads)
+		ld->write_depth = min(ld->write_depth +
+				      max(ld->write_depth / 4, 1),
+				      ld->max_write_depth);
+
+	ld->window_start = jiffies;
+	ld->nr_reads = 0;
+	ld->nr_slow_reads = 0;
+}
+
+static void latency_completed_request(struct request_queue *q,
+				      struct request *rq)
+{
+	struct latency_data *ld = q->elevator->elevator_data;
+	int class = latency_class(rq);
+
+	ld->in_flight[class]--;
+
+	if (class == LAT_READ) {
+		u64 issue = rq_io_start_time_ns(rq);
+		u64 now = sched_clock();
+
+		ld->nr_reads++;
+		if (time_after64(now, issue) &&
+		    now - issue > (u64)ld->target_latency * NSEC_PER_USEC)
+			ld->nr_slow_reads++;
+	}
+
+	if (time_after(jiffies, ld->window_start + ld->window))
+		latency_update_depth(ld);
+
+	/*
+	 * Writes held back by the depth limit may be all that is left, the
+	 * driver won't come back for them on its own.
+	 */
+	if (!list_empty(&ld->fifo_list[LAT_WRITE]) &&
+	    ld->in_flight[LAT_WRITE] < ld->write_depth)
+		blk_run_queue_async(q);
+}
+
+static void latency_exit_queue(struct elevator_queue *e)
+{
+	struct latency_data *ld = e->elevator_data;
+
+	BUG_ON(!list_empty(&ld->fifo_list[LAT_READ]));
+	BUG_ON(!list_empty(&ld->fifo_list[LAT_WRITE]));
+
+	kfree(ld);
+}
+
+/*
+ * initialize elevator private data (latency_data).
+ */
+static int latency_init_queue(struct request_queue *q)
+{
+	struct latency_data *ld;
+
+	ld = kmalloc_node(sizeof(*ld), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!ld)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&ld->fifo_list[LAT_READ]);
+	INIT_LIST_HEAD(&ld->fifo_list[LAT_WRITE]);
+	ld->target_latency = target_latency;
+	ld->max_write_depth = max_write_depth;
+	ld->write_depth = max_write_depth;
+	ld->window = window;
+	ld->window_start = jiffies;
+
+	q->elevator->elevator_data = ld;
+	return 0;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+latency_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+latency_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct latency_data *ld = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return latency_var_show(__data, (page));			\
+}
+SHOW_FUNCTION(latency_target_latency_show, ld->target_latency, 0);
+SHOW_FUNCTION(latency_max_write_depth_show, ld->max_write_depth, 0);
+SHOW_FUNCTION(latency_window_show, ld->window, 1);
+SHOW_FUNCTION(latency_write_depth_show, ld->write_depth, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct latency_data *ld = e->elevator_data;			\
+	int __data;							\
+	int ret = latency_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(latency_target_latency_store, &ld->target_latency, 1, INT_MAX, 0);
+STORE_FUNCTION(latency_max_write_depth_store, &ld->max_write_depth, 1, INT_MAX, 0);
+STORE_FUNCTION(latency_window_store, &ld->window, 1, INT_MAX, 1);
+#undef STORE_FUNCTION
+
+#define LAT_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, latency_##name##_show, \
+				      latency_##name##_store)
+
+static struct elv_fs_entry latency_attrs[] = {
+	LAT_ATTR(target_latency),
+	LAT_ATTR(max_write_depth),
+	LAT_ATTR(window),
+	__ATTR(write_depth, S_IRUGO, latency_write_depth_show, NULL),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_latency = {
+	.ops = {
+		.elevator_merge_req_fn =	latency_merged_requests,
+		.elevator_dispatch_fn =		latency_dispatch_requests,
+		.elevator_add_req_fn =		latency_add_request,
+		.elevator_activate_req_fn =	latency_activate_request,
+		.elevator_deactivate_req_fn =	latency_deactivate_request,
+		.elevator_completed_req_fn =	latency_completed_request,
+		.elevator_former_req_fn =	latency_former_request,
+		.elevator_latter_req_fn =	latency_latter_request,
+		.elevator_init_fn =		latency_init_queue,
+		.elevator_exit_fn =		latency_exit_queue,
+	},
+
+	.elevator_attrs = latency_attrs,
+	.elevator_name = "latency",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init latency_init(void)
+{
+	return elv_register(&iosched_latency);
+}
+
+static void __exit latency_exit(void)
+{
+	elv_unregister(&iosched_latency);
+}
+
+module_init(latency_init);
+module_exit(latency_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Latency target IO scheduler");
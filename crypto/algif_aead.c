@@ -0,0 +1,743 @@
+/*
+ * algif_aead: User-space interface for AEAD algorithms
+ *
+ * This file provides the user-space API for AEAD ciphers.
+ *
+ * A message is built up with sendmsg/sendpage until MSG_MORE is cleared:
+ * the associated data followed by the plaintext when encrypting, or by
+ * the ciphertext and the tag when decrypting.  The operation, the IV
+ * and the length of the associated data are passed as control messages
+ * with the first chunk.  A single recvmsg (or AIO read) then returns
+ * the ciphertext and tag, or the plaintext, into one user buffer.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <crypto/aead.h>
+#include <crypto/scatterwalk.h>
+#include <crypto/if_alg.h>
+#include <linux/aio.h>
+#include <linux/delay.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/net.h>
+#include <net/sock.h>
+
+struct aead_sg_list {
+	unsigned int cur;
+	struct scatterlist sg[ALG_MAX_PAGES];
+};
+
+struct aead_ctx {
+	struct aead_sg_list tsgl;
+	struct crypto_aead *aead;
+
+	void *iv;
+
+	struct af_alg_completion completion;
+
+	unsigned long used;
+	unsigned int assoclen;
+
+	bool more;
+	bool merge;
+	bool enc;
+
+	/* AIO requests submitted but not yet completed */
+	atomic_t inflight;
+};
+
+/*
+ * One operation in flight.  The TX pages are handed over from the socket
+ * on submission, so that the next message can be queued while the
+ * cipher is still busy with this one.
+ */
+struct aead_async_req {
+	struct kiocb *iocb;
+	struct sock *sk;
+
+	struct af_alg_sgl rsgl;
+	bool mapped;
+
+	struct page *pages[ALG_MAX_PAGES];
+	unsigned int npages;
+
+	struct scatterlist assoc[ALG_MAX_PAGES];
+	struct scatterlist src[ALG_MAX_PAGES];
+
+	int outlen;
+	u8 *iv;
+
+	struct aead_request req;
+};
+
+static inline int aead_sndbuf(struct sock *sk)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+
+	return max_t(int, max_t(int, sk->sk_sndbuf & PAGE_MASK, PAGE_SIZE) -
+			  ctx->used, 0);
+}
+
+static inline bool aead_writable(struct sock *sk)
+{
+	return PAGE_SIZE <= aead_sndbuf(sk);
+}
+
+static inline bool aead_sufficient_data(struct aead_ctx *ctx)
+{
+	return ctx->used && !ctx->more;
+}
+
+static void aead_put_sgl(struct sock *sk)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	struct aead_sg_list *sgl = &ctx->tsgl;
+	unsigned int i;
+
+	for (i = 0; i < sgl->cur; i++) {
+		if (!sg_page(sgl->sg + i))
+			continue;
+
+		put_page(sg_page(sgl->sg + i));
+		sg_assign_page(sgl->sg + i, NULL);
+	}
+
+	sg_init_table(sgl->sg, ALG_MAX_PAGES);
+	sgl->cur = 0;
+	ctx->used = 0;
+	ctx->more = 0;
+	ctx->merge = 0;
+}
+
+static int aead_wait_for_wmem(struct sock *sk, unsigned flags)
+{
+	long timeout;
+	DEFINE_WAIT(wait);
+	int err = -ERESTARTSYS;
+
+	if (flags & MSG_DONTWAIT)
+		return -EAGAIN;
+
+	set_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
+
+	for (;;) {
+		if (signal_pending(current))
+			break;
+		prepare_to_wait(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
+		timeout = MAX_SCHEDULE_TIMEOUT;
+		if (sk_wait_event(sk, &timeout, aead_writable(sk))) {
+			err = 0;
+			break;
+		}
+	}
+	finish_wait(sk_sleep(sk), &wait);
+
+	return err;
+}
+
+static void aead_wmem_wakeup(struct sock *sk)
+{
+	struct socket_wq *wq;
+
+	if (!aead_writable(sk))
+		return;
+
+	rcu_read_lock();
+	wq = rcu_dereference(sk->sk_wq);
+	if (wq_has_sleeper(wq))
+		wake_up_interruptible_sync_poll(&wq->wait, POLLIN |
+							   POLLRDNORM |
+							   POLLRDBAND);
+	sk_wake_async(sk, SOCK_WAKE_WAITD, POLL_IN);
+	rcu_read_unlock();
+}
+
+static int aead_wait_for_data(struct sock *sk, unsigned flags)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	long timeout;
+	DEFINE_WAIT(wait);
+	int err = -ERESTARTSYS;
+
+	if (flags & MSG_DONTWAIT)
+		return -EAGAIN;
+
+	set_bit(SOCK_ASYNC_WAITDATA, &sk->sk_socket->flags);
+
+	for (;;) {
+		if (signal_pending(current))
+			break;
+		prepare_to_wait(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
+		timeout = MAX_SCHEDULE_TIMEOUT;
+		if (sk_wait_event(sk, &timeout, aead_sufficient_data(ctx))) {
+			err = 0;
+			break;
+		}
+	}
+	finish_wait(sk_sleep(sk), &wait);
+
+	clear_bit(SOCK_ASYNC_WAITDATA, &sk->sk_socket->flags);
+
+	return err;
+}
+
+static void aead_data_wakeup(struct sock *sk)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	struct socket_wq *wq;
+
+	if (!aead_sufficient_data(ctx))
+		return;
+
+	rcu_read_lock();
+	wq = rcu_dereference(sk->sk_wq);
+	if (wq_has_sleeper(wq))
+		wake_up_interruptible_sync_poll(&wq->wait, POLLOUT |
+							   POLLRDNORM |
+							   POLLRDBAND);
+	sk_wake_async(sk, SOCK_WAKE_SPACE, POLL_OUT);
+	rcu_read_unlock();
+}
+
+static int aead_sendmsg(struct kiocb *unused, struct socket *sock,
+			struct msghdr *msg, size_t size)
+{
+	struct sock *sk = sock->sk;
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	unsigned ivsize = crypto_aead_ivsize(ctx->aead);
+	struct aead_sg_list *sgl = &ctx->tsgl;
+	struct af_alg_control con = {};
+	long copied = 0;
+	bool enc = 0;
+	int err;
+	int i;
+
+	if (msg->msg_controllen) {
+		err = af_alg_cmsg_send(msg, &con);
+		if (err)
+			return err;
+
+		switch (con.op) {
+		case ALG_OP_ENCRYPT:
+			enc = 1;
+			break;
+		case ALG_OP_DECRYPT:
+			enc = 0;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		if (con.iv && con.iv->ivlen != ivsize)
+			return -EINVAL;
+	}
+
+	err = -EINVAL;
+
+	lock_sock(sk);
+	if (!ctx->more && ctx->used)
+		goto unlock;
+
+	if (!ctx->used) {
+		ctx->enc = enc;
+		ctx->assoclen = con.aead_assoclen;
+		if (con.iv)
+			memcpy(ctx->iv, con.iv->iv, ivsize);
+	}
+
+	while (size) {
+		struct scatterlist *sg;
+		unsigned long len = size;
+		int plen;
+
+		if (ctx->merge) {
+			sg = sgl->sg + sgl->cur - 1;
+			len = min_t(unsigned long, len,
+				    PAGE_SIZE - sg->offset - sg->length);
+
+			err = memcpy_fromiovec(page_address(sg_page(sg)) +
+					       sg->offset + sg->length,
+					       msg->msg_iov, len);
+			if (err)
+				goto unlock;
+
+			sg->length += len;
+			ctx->merge = (sg->offset + sg->length) &
+				     (PAGE_SIZE - 1);
+
+			ctx->used += len;
+			copied += len;
+			size -= len;
+			continue;
+		}
+
+		if (!aead_writable(sk)) {
+			err = aead_wait_for_wmem(sk, msg->msg_flags);
+			if (err)
+				goto unlock;
+		}
+
+		len = min_t(unsigned long, len, aead_sndbuf(sk));
+
+		/* A message is limited to what one scatterlist can hold */
+		err = -EMSGSIZE;
+		if (sgl->cur >= ALG_MAX_PAGES)
+			goto unlock;
+
+		sg = sgl->sg;
+		do {
+			i = sgl->cur;
+			plen = min_t(int, len, PAGE_SIZE);
+
+			sg_assign_page(sg + i, alloc_page(GFP_KERNEL));
+			err = -ENOMEM;
+			if (!sg_page(sg + i))
+				goto unlock;
+
+			err = memcpy_fromiovec(page_address(sg_page(sg + i)),
+					       msg->msg_iov, plen);
+			if (err) {
+				__free_page(sg_page(sg + i));
+				sg_assign_page(sg + i, NULL);
+				goto unlock;
+			}
+
+			sg[i].offset = 0;
+			sg[i].length = plen;
+			len -= plen;
+			ctx->used += plen;
+			copied += plen;
+			size -= plen;
+			sgl->cur++;
+		} while (len && sgl->cur < ALG_MAX_PAGES);
+
+		ctx->merge = plen & (PAGE_SIZE - 1);
+	}
+
+	err = 0;
+
+	ctx->more = msg->msg_flags & MSG_MORE;
+
+unlock:
+	aead_data_wakeup(sk);
+	release_sock(sk);
+
+	return copied ?: err;
+}
+
+static ssize_t aead_sendpage(struct socket *sock, struct page *page,
+			     int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	struct aead_sg_list *sgl = &ctx->tsgl;
+	int err = -EINVAL;
+
+	lock_sock(sk);
+	if (!ctx->more && ctx->used)
+		goto unlock;
+
+	if (!size)
+		goto done;
+
+	if (!aead_writable(sk)) {
+		err = aead_wait_for_wmem(sk, flags);
+		if (err)
+			goto unlock;
+	}
+
+	err = -EMSGSIZE;
+	if (sgl->cur >= ALG_MAX_PAGES)
+		goto unlock;
+
+	ctx->merge = 0;
+
+	get_page(page);
+	sg_set_page(sgl->sg + sgl->cur, page, size, offset);
+	sgl->cur++;
+	ctx->used += size;
+
+	err = 0;
+
+done:
+	ctx->more = flags & MSG_MORE;
+
+unlock:
+	aead_data_wakeup(sk);
+	release_sock(sk);
+
+	return err ?: size;
+}
+
+/*
+ * Hand the TX pages over to @areq and describe the first @assoclen bytes
+ * in areq->assoc and the rest in areq->src.  An entry straddling the
+ * boundary appears in both lists.
+ */
+static void aead_take_sgl(struct sock *sk, struct aead_async_req *areq,
+			  unsigned int assoclen)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	struct aead_sg_list *sgl = &ctx->tsgl;
+	unsigned int nassoc = 0;
+	unsigned int nsrc = 0;
+	unsigned int i;
+
+	sg_init_table(areq->assoc, ALG_MAX_PAGES);
+	sg_init_table(areq->src, ALG_MAX_PAGES);
+
+	for (i = 0; i < sgl->cur; i++) {
+		struct scatterlist *sg = sgl->sg + i;
+		unsigned int offset = sg->offset;
+		unsigned int len = sg->length;
+
+		areq->pages[i] = sg_page(sg);
+
+		if (assoclen) {
+			unsigned int alen = min(len, assoclen);
+
+			sg_set_page(areq->assoc + nassoc++, sg_page(sg), alen,
+				    offset);
+			assoclen -= alen;
+			offset += alen;
+			len -= alen;
+		}
+
+		if (len)
+			sg_set_page(areq->src + nsrc++, sg_page(sg), len,
+				    offset);
+
+		sg_assign_page(sg, NULL);
+	}
+
+	areq->npages = sgl->cur;
+
+	if (nassoc)
+		sg_mark_end(areq->assoc + nassoc - 1);
+	if (nsrc)
+		sg_mark_end(areq->src + nsrc - 1);
+
+	aead_put_sgl(sk);
+}
+
+static void aead_free_async_req(struct aead_async_req *areq)
+{
+	struct sock *sk = areq->sk;
+	struct crypto_aead *tfm = crypto_aead_reqtfm(&areq->req);
+	unsigned int i;
+
+	if (areq->mapped)
+		af_alg_free_sg(&areq->rsgl);
+
+	for (i = 0; i < areq->npages; i++)
+		put_page(areq->pages[i]);
+
+	sock_kfree_s(sk, areq, sizeof(*areq) + crypto_aead_reqsize(tfm) +
+			       crypto_aead_ivsize(tfm));
+}
+
+static void aead_async_cb(struct crypto_async_request *req, int err)
+{
+	struct aead_async_req *areq = req->data;
+	struct aead_ctx *ctx = alg_sk(areq->sk)->private;
+	struct kiocb *iocb = areq->iocb;
+	int outlen = areq->outlen;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	aead_free_async_req(areq);
+	aio_complete(iocb, err ?: outlen, 0);
+
+	/* Last, the socket may be destroyed as soon as this drops to zero */
+	atomic_dec(&ctx->inflight);
+}
+
+static int aead_recvmsg(struct kiocb *iocb, struct socket *sock,
+			struct msghdr *msg, size_t ignored, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	struct crypto_aead *tfm = ctx->aead;
+	unsigned int reqsize = crypto_aead_reqsize(tfm);
+	unsigned int ivsize = crypto_aead_ivsize(tfm);
+	unsigned int as = crypto_aead_authsize(tfm);
+	bool async = !is_sync_kiocb(iocb);
+	struct aead_async_req *areq;
+	struct scatterlist *dst;
+	struct iovec *iov = msg->msg_iov;
+	unsigned int assoclen;
+	unsigned int cryptlen;
+	int outlen;
+	int mapped;
+	int err;
+
+	lock_sock(sk);
+
+	if (!aead_sufficient_data(ctx)) {
+		err = aead_wait_for_data(sk, flags);
+		if (err)
+			goto unlock;
+	}
+
+	/*
+	 * A malformed message cannot be processed at all, drop it so that
+	 * the socket can be reused.
+	 */
+	err = -EINVAL;
+	assoclen = ctx->assoclen;
+	if (ctx->used < assoclen) {
+		aead_put_sgl(sk);
+		goto unlock;
+	}
+
+	cryptlen = ctx->used - assoclen;
+	if (!ctx->enc && cryptlen < as) {
+		aead_put_sgl(sk);
+		goto unlock;
+	}
+
+	outlen = ctx->enc ? cryptlen + as : cryptlen - as;
+
+	/* The whole result must fit into the first iovec segment */
+	if (outlen && (!msg->msg_iovlen || iov->iov_len < outlen))
+		goto unlock;
+
+	err = -ENOMEM;
+	areq = sock_kmalloc(sk, sizeof(*areq) + reqsize + ivsize, GFP_KERNEL);
+	if (!areq)
+		goto unlock;
+
+	areq->iocb = iocb;
+	areq->sk = sk;
+	areq->mapped = false;
+	areq->npages = 0;
+	areq->outlen = outlen;
+	areq->iv = (u8 *)aead_request_ctx(&areq->req) + reqsize;
+
+	if (outlen) {
+		mapped = af_alg_make_sg(&areq->rsgl, iov->iov_base, outlen, 1);
+		err = mapped;
+		if (err < 0)
+			goto free;
+
+		areq->mapped = true;
+
+		err = -EMSGSIZE;
+		if (mapped < outlen)
+			goto free;
+	}
+
+	aead_take_sgl(sk, areq, assoclen);
+	memcpy(areq->iv, ctx->iv, ivsize);
+
+	/*
+	 * Without any output, as when only checking the tag of an empty
+	 * message, the source doubles as the destination: nothing is
+	 * written to it.
+	 */
+	dst = outlen ? areq->rsgl.sg : areq->src;
+
+	aead_request_set_tfm(&areq->req, tfm);
+	if (async)
+		aead_request_set_callback(&areq->req,
+					  CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  aead_async_cb, areq);
+	else
+		aead_request_set_callback(&areq->req,
+					  CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  af_alg_complete, &ctx->completion);
+	aead_request_set_assoc(&areq->req,
+			       assoclen ? areq->assoc : areq->src, assoclen);
+	aead_request_set_crypt(&areq->req, areq->src, dst, cryptlen,
+			       areq->iv);
+
+	if (async) {
+		atomic_inc(&ctx->inflight);
+		err = ctx->enc ? crypto_aead_encrypt(&areq->req) :
+				 crypto_aead_decrypt(&areq->req);
+		if (err == -EINPROGRESS || err == -EBUSY) {
+			err = -EIOCBQUEUED;
+			goto unlock;
+		}
+
+		/* Completed synchronously, the caller completes the iocb */
+		aead_free_async_req(areq);
+		atomic_dec(&ctx->inflight);
+	} else {
+		err = af_alg_wait_for_completion(
+			ctx->enc ? crypto_aead_encrypt(&areq->req) :
+				   crypto_aead_decrypt(&areq->req),
+			&ctx->completion);
+		aead_free_async_req(areq);
+	}
+
+	if (!err)
+		err = outlen;
+	goto unlock;
+
+free:
+	if (areq->mapped)
+		af_alg_free_sg(&areq->rsgl);
+	sock_kfree_s(sk, areq, sizeof(*areq) + reqsize + ivsize);
+unlock:
+	aead_wmem_wakeup(sk);
+	release_sock(sk);
+
+	return err;
+}
+
+static unsigned int aead_poll(struct file *file, struct socket *sock,
+			      poll_table *wait)
+{
+	struct sock *sk = sock->sk;
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+	unsigned int mask;
+
+	sock_poll_wait(file, sk_sleep(sk), wait);
+	mask = 0;
+
+	if (aead_sufficient_data(ctx))
+		mask |= POLLIN | POLLRDNORM;
+
+	if (aead_writable(sk))
+		mask |= POLLOUT | POLLWRNORM | POLLWRBAND;
+
+	return mask;
+}
+
+static struct proto_ops algif_aead_ops = {
+	.family		=	PF_ALG,
+
+	.connect	=	sock_no_connect,
+	.socketpair	=	sock_no_socketpair,
+	.getname	=	sock_no_getname,
+	.ioctl		=	sock_no_ioctl,
+	.listen		=	sock_no_listen,
+	.shutdown	=	sock_no_shutdown,
+	.getsockopt	=	sock_no_getsockopt,
+	.mmap		=	sock_no_mmap,
+	.bind		=	sock_no_bind,
+	.accept		=	sock_no_accept,
+	.setsockopt	=	sock_no_setsockopt,
+
+	.release	=	af_alg_release,
+	.sendmsg	=	aead_sendmsg,
+	.sendpage	=	aead_sendpage,
+	.recvmsg	=	aead_recvmsg,
+	.poll		=	aead_poll,
+};
+
+static void *aead_bind(const char *name, u32 type, u32 mask)
+{
+	return crypto_alloc_aead(name, type, mask);
+}
+
+static void aead_release(void *private)
+{
+	crypto_free_aead(private);
+}
+
+static int aead_setkey(void *private, const u8 *key, unsigned int keylen)
+{
+	return crypto_aead_setkey(private, key, keylen);
+}
+
+static int aead_setauthsize(void *private, unsigned int authsize)
+{
+	return crypto_aead_setauthsize(private, authsize);
+}
+
+static void aead_sock_destruct(struct sock *sk)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct aead_ctx *ctx = ask->private;
+
+	/* Outstanding AIO requests still use the tfm and the socket */
+	while (atomic_read(&ctx->inflight))
+		msleep(100);
+
+	aead_put_sgl(sk);
+	sock_kfree_s(sk, ctx->iv, crypto_aead_ivsize(ctx->aead));
+	sock_kfree_s(sk, ctx, sizeof(*ctx));
+	af_alg_release_parent(sk);
+}
+
+static int aead_accept_parent(void *private, struct sock *sk)
+{
+	struct aead_ctx *ctx;
+	struct alg_sock *ask = alg_sk(sk);
+	unsigned int ivsize = crypto_aead_ivsize(private);
+
+	ctx = sock_kmalloc(sk, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->iv = sock_kmalloc(sk, ivsize, GFP_KERNEL);
+	if (!ctx->iv) {
+		sock_kfree_s(sk, ctx, sizeof(*ctx));
+		return -ENOMEM;
+	}
+
+	memset(ctx->iv, 0, ivsize);
+
+	sg_init_table(ctx->tsgl.sg, ALG_MAX_PAGES);
+	ctx->tsgl.cur = 0;
+	ctx->aead = private;
+	ctx->used = 0;
+	ctx->assoclen = 0;
+	ctx->more = 0;
+	ctx->merge = 0;
+	ctx->enc = 0;
+	atomic_set(&ctx->inflight, 0);
+	af_alg_init_completion(&ctx->completion);
+
+	ask->private = ctx;
+
+	sk->sk_destruct = aead_sock_destruct;
+
+	return 0;
+}
+
+static const struct af_alg_type algif_type_aead = {
+	.bind		=	aead_bind,
+	.release	=	aead_release,
+	.setkey		=	aead_setkey,
+	.setauthsize	=	aead_setauthsize,
+	.accept		=	aead_accept_parent,
+	.ops		=	&algif_aead_ops,
+	.name		=	"aead",
+	.owner		=	THIS_MODULE
+};
+
+static int __init algif_aead_init(void)
+{
+	return af_alg_register_type(&algif_type_aead);
+}
+
+static void __exit algif_aead_exit(void)
+{
+	int err = af_alg_unregister_type(&algif_type_aead);
+	BUG_ON(err);
+}
+
+module_init(algif_aead_init);
+module_exit(algif_aead_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("AEAD kernel crypto API user space interface");
@@ -15,6 +15,8 @@
 #include <crypto/scatterwalk.h>
 #include <crypto/skcipher.h>
 #include <crypto/if_alg.h>
+#include <linux/aio.h>
+#include <linux/delay.h>
 #include <linux/init.h>
 #include <linux/list.h>
 #include <linux/kernel.h>
@@ -46,6 +48,29 @@ struct skcipher_ctx {
 	bool merge;
 	bool enc;
 
+	/* AIO requests submitted but not yet completed */
+	atomic_t inflight;
+
+	struct ablkcipher_request req;
+};
+
+/*
+ * An AIO read in flight.  It owns the pinned destination pages and a
+ * private copy of the source scatterlist, so that the socket can accept
+ * and process further data while the cipher is still busy.
+ */
+struct skcipher_async_req {
+	struct kiocb *iocb;
+	struct sock *sk;
+
+	struct af_alg_sgl rsgl;
+
+	struct scatterlist *tsg;
+	unsigned int tsg_nents;
+
+	int len;
+	u8 *iv;
+
 	struct ablkcipher_request req;
 };
 
@@ -415,7 +440,185 @@ unlock:
 	return err ?: size;
 }
 
-static int skcipher_recvmsg(struct kiocb *unused, struct socket *sock,
+/*
+ * Take references on the pages backing the first @len bytes of the TX
+ * scatterlist and describe them in @dst, or only count the entries
+ * needed if @dst is NULL.
+ */
+static int skcipher_clone_sgl(struct sock *sk, struct scatterlist *dst,
+			      unsigned int len)
+{
+	struct alg_sock *ask = alg_sk(sk);
+	struct skcipher_ctx *ctx = ask->private;
+	struct skcipher_sg_list *sgl;
+	struct scatterlist *sg;
+	int nents = 0;
+	int i;
+
+	list_for_each_entry(sgl, &ctx->tsgl, list) {
+		sg = sgl->sg;
+
+		for (i = 0; i < sgl->cur && len; i++) {
+			unsigned int plen = min_t(unsigned int, len,
+						  sg[i].length);
+
+			if (!sg_page(sg + i) || !plen)
+				continue;
+
+			if (dst) {
+				get_page(sg_page(sg + i));
+				sg_set_page(dst + nents, sg_page(sg + i), plen,
+					    sg[i].offset);
+			}
+
+			len -= plen;
+			nents++;
+		}
+	}
+
+	return nents;
+}
+
+static void skcipher_free_async_req(struct skcipher_async_req *sreq)
+{
+	struct sock *sk = sreq->sk;
+	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(&sreq->req);
+	unsigned int i;
+
+	af_alg_free_sg(&sreq->rsgl);
+
+	if (sreq->tsg) {
+		for (i = 0; i < sreq->tsg_nents; i++)
+			put_page(sg_page(sreq->tsg + i));
+		sock_kfree_s(sk, sreq->tsg,
+			     sreq->tsg_nents * sizeof(*sreq->tsg));
+	}
+
+	sock_kfree_s(sk, sreq, sizeof(*sreq) +
+			       crypto_ablkcipher_reqsize(tfm) +
+			       crypto_ablkcipher_ivsize(tfm));
+}
+
+static void skcipher_async_cb(struct crypto_async_request *req, int err)
+{
+	struct skcipher_async_req *sreq = req->data;
+	struct skcipher_ctx *ctx = alg_sk(sreq->sk)->private;
+	struct kiocb *iocb = sreq->iocb;
+	int len = sreq->len;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	skcipher_free_async_req(sreq);
+	aio_complete(iocb, err ?: len, 0);
+
+	/* Last, the socket may be destroyed as soon as this drops to zero */
+	atomic_dec(&ctx->inflight);
+}
+
+/*
+ * AIO read: submit one request for as much data as is queued and fits
+ * the first iovec segment, and complete the iocb from the cipher's
+ * completion callback.  Every request starts from the IV current at
+ * submission time; the IV is not chained between requests in flight.
+ */
+static int skcipher_recvmsg_async(struct kiocb *iocb, struct socket *sock,
+				  struct msghdr *msg, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct alg_sock *ask = alg_sk(sk);
+	struct skcipher_ctx *ctx = ask->private;
+	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(&ctx->req);
+	unsigned int reqsize = crypto_ablkcipher_reqsize(tfm);
+	unsigned int ivsize = crypto_ablkcipher_ivsize(tfm);
+	unsigned bs = crypto_ablkcipher_blocksize(tfm);
+	struct skcipher_async_req *sreq;
+	struct iovec *iov = msg->msg_iov;
+	int nents;
+	int used;
+	int err;
+
+	if (!msg->msg_iovlen || !iov->iov_len)
+		return 0;
+
+	lock_sock(sk);
+
+	if (!ctx->used) {
+		err = skcipher_wait_for_data(sk, flags);
+		if (err)
+			goto unlock;
+	}
+
+	err = -ENOMEM;
+	sreq = sock_kmalloc(sk, sizeof(*sreq) + reqsize + ivsize, GFP_KERNEL);
+	if (!sreq)
+		goto unlock;
+
+	sreq->iocb = iocb;
+	sreq->sk = sk;
+	sreq->tsg = NULL;
+	sreq->iv = (u8 *)ablkcipher_request_ctx(&sreq->req) + reqsize;
+
+	used = min_t(unsigned long, ctx->used, iov->iov_len);
+	used = af_alg_make_sg(&sreq->rsgl, iov->iov_base, used, 1);
+	err = used;
+	if (err < 0)
+		goto free_req;
+
+	if (ctx->more || used < ctx->used)
+		used -= used % bs;
+
+	err = -EINVAL;
+	if (!used)
+		goto free;
+
+	nents = skcipher_clone_sgl(sk, NULL, used);
+
+	err = -ENOMEM;
+	sreq->tsg = sock_kmalloc(sk, nents * sizeof(*sreq->tsg), GFP_KERNEL);
+	if (!sreq->tsg)
+		goto free;
+
+	sg_init_table(sreq->tsg, nents);
+	sreq->tsg_nents = skcipher_clone_sgl(sk, sreq->tsg, used);
+	sreq->len = used;
+	memcpy(sreq->iv, ctx->iv, ivsize);
+
+	ablkcipher_request_set_tfm(&sreq->req, tfm);
+	ablkcipher_request_set_callback(&sreq->req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+					skcipher_async_cb, sreq);
+	ablkcipher_request_set_crypt(&sreq->req, sreq->tsg, sreq->rsgl.sg,
+				     used, sreq->iv);
+
+	skcipher_pull_sgl(sk, used);
+
+	atomic_inc(&ctx->inflight);
+	err = ctx->enc ? crypto_ablkcipher_encrypt(&sreq->req) :
+			 crypto_ablkcipher_decrypt(&sreq->req);
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		err = -EIOCBQUEUED;
+		goto unlock;
+	}
+
+	/* Completed synchronously, the caller completes the iocb */
+	skcipher_free_async_req(sreq);
+	atomic_dec(&ctx->inflight);
+	if (!err)
+		err = used;
+	goto unlock;
+
+free:
+	af_alg_free_sg(&sreq->rsgl);
+free_req:
+	sock_kfree_s(sk, sreq, sizeof(*sreq) + reqsize + ivsize);
+unlock:
+	skcipher_wmem_wakeup(sk);
+	release_sock(sk);
+
+	return err;
+}
+
+static int skcipher_recvmsg(struct kiocb *iocb, struct socket *sock,
 			    struct msghdr *msg, size_t ignored, int flags)
 {
 	struct sock *sk = sock->sk;
@@ -431,6 +634,9 @@ static int skcipher_recvmsg(struct kiocb *unused, struct socket *sock,
 	int used;
 	long copied = 0;
 
+	if (!is_sync_kiocb(iocb))
+		return skcipher_recvmsg_async(iocb, sock, msg, flags);
+
 	lock_sock(sk);
 	for (iov = msg->msg_iov, iovlen = msg->msg_iovlen; iovlen > 0;
 	     iovlen--, iov++) {
@@ -562,6 +768,10 @@ static void skcipher_sock_destruct(struct sock *sk)
 	struct skcipher_ctx *ctx = ask->private;
 	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(&ctx->req);
 
+	/* Outstanding AIO requests still use the tfm and the socket */
+	while (atomic_read(&ctx->inflight))
+		msleep(100);
+
 	skcipher_free_sgl(sk);
 	sock_kfree_s(sk, ctx->iv, crypto_ablkcipher_ivsize(tfm));
 	sock_kfree_s(sk, ctx, ctx->len);
@@ -593,6 +803,7 @@ static int skcipher_accept_parent(void *private, struct sock *sk)
 	ctx->more = 0;
 	ctx->merge = 0;
 	ctx->enc = 0;
+	atomic_set(&ctx->inflight, 0);
 	af_alg_init_completion(&ctx->completion);
 
 	ask->private = ctx;
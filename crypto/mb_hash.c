@@ -0,0 +1,489 @@
+/*
+ * Multi-buffer hashing
+ *
+ * Requests are queued on the submitting CPU and handed to the lanes
+ * of the SIMD implementation by a per-cpu worker.  The lanes are run
+ * once all of them are busy, or when the flush timer expires so that
+ * a lone request is not held back for long.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <crypto/algapi.h>
+#include <crypto/crypto_wq.h>
+#include <crypto/mb_hash.h>
+#include <crypto/scatterwalk.h>
+#include <linux/bitops.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/scatterlist.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <asm/unaligned.h>
+
+#define MB_HASH_MAX_CPU_QLEN	100
+#define MB_HASH_FLUSH_US	1000
+
+struct mb_hash_mgr {
+	struct mb_hash_lanes lanes;
+	struct ahash_request *req[MB_HASH_MAX_LANES];
+	unsigned int blocks[MB_HASH_MAX_LANES];
+	unsigned long busy;		/* Lanes with a job */
+	struct mutex lock;		/* Serialises use of the lanes */
+
+	spinlock_t queue_lock;
+	struct crypto_queue queue;
+
+	struct work_struct work;
+	struct delayed_work flush;
+	struct mb_hash_alg *alg;
+	int cpu;
+};
+
+struct mb_hash_req_ctx {
+	u32 state[MB_HASH_MAX_WORDS];
+	u64 count;			/* Bytes hashed, for the padding */
+	unsigned int buflen;
+	u8 buf[2 * MB_HASH_BLOCK_SIZE];
+
+	/* What is left of the current update */
+	struct scatterlist *sg;
+	unsigned int offset;
+	unsigned int nbytes;
+	struct page *page;		/* kmapped for the running job */
+	bool final;
+	bool out;
+
+	const u8 *job_data;
+	unsigned int job_blocks;
+};
+
+struct mb_hash_export {
+	u32 state[MB_HASH_MAX_WORDS];
+	u64 count;
+	unsigned int buflen;
+	u8 buf[MB_HASH_BLOCK_SIZE];
+};
+
+static struct mb_hash_alg *mb_hash_alg(struct crypto_ahash *tfm)
+{
+	struct ahash_alg *alg = __crypto_ahash_alg(crypto_ahash_tfm(tfm)->__crt_alg);
+
+	return container_of(alg, struct mb_hash_alg, ahash);
+}
+
+static const u8 *mb_hash_map(struct mb_hash_req_ctx *rctx, unsigned int *len)
+{
+	unsigned int offset = rctx->sg->offset + rctx->offset;
+
+	rctx->page = nth_page(sg_page(rctx->sg), offset >> PAGE_SHIFT);
+	offset = offset_in_page(offset);
+
+	*len = min3(rctx->nbytes, rctx->sg->length - rctx->offset,
+		    (unsigned int)PAGE_SIZE - offset);
+
+	return (u8 *)kmap(rctx->page) + offset;
+}
+
+static void mb_hash_unmap(struct mb_hash_req_ctx *rctx)
+{
+	if (rctx->page) {
+		kunmap(rctx->page);
+		rctx->page = NULL;
+	}
+}
+
+static void mb_hash_advance(struct mb_hash_req_ctx *rctx, unsigned int n)
+{
+	rctx->offset += n;
+	rctx->nbytes -= n;
+	rctx->count += n;
+
+	while (rctx->nbytes && rctx->offset == rctx->sg->length) {
+		rctx->sg = scatterwalk_sg_next(rctx->sg);
+		rctx->offset = 0;
+	}
+}
+
+static void mb_hash_pad(struct mb_hash_req_ctx *rctx)
+{
+	unsigned int len = rctx->buflen;
+	unsigned int padlen = len < MB_HASH_BLOCK_SIZE - 8 ?
+			      MB_HASH_BLOCK_SIZE : 2 * MB_HASH_BLOCK_SIZE;
+
+	rctx->buf[len++] = 0x80;
+	memset(rctx->buf + len, 0, padlen - 8 - len);
+	put_unaligned_be64(rctx->count << 3, rctx->buf + padlen - 8);
+
+	rctx->buflen = 0;
+	rctx->job_data = rctx->buf;
+	rctx->job_blocks = padlen / MB_HASH_BLOCK_SIZE;
+}
+
+/*
+ * Set up the next job of a request: whole blocks are hashed in place,
+ * anything else goes through the request's buffer.  Returns false once
+ * the request has nothing more to hash.
+ */
+static bool mb_hash_next_job(struct mb_hash_req_ctx *rctx)
+{
+	const u8 *data;
+	unsigned int len, n;
+
+	mb_hash_unmap(rctx);
+
+	while (rctx->nbytes) {
+		data = mb_hash_map(rctx, &len);
+
+		if (rctx->buflen || len < MB_HASH_BLOCK_SIZE) {
+			n = min(len, MB_HASH_BLOCK_SIZE - rctx->buflen);
+			memcpy(rctx->buf + rctx->buflen, data, n);
+			mb_hash_unmap(rctx);
+			rctx->buflen += n;
+			mb_hash_advance(rctx, n);
+
+			if (rctx->buflen < MB_HASH_BLOCK_SIZE)
+				continue;
+
+			rctx->buflen = 0;
+			rctx->job_data = rctx->buf;
+			rctx->job_blocks = 1;
+			return true;
+		}
+
+		/* The page stays mapped until the job is done */
+		n = round_down(len, MB_HASH_BLOCK_SIZE);
+		rctx->job_data = data;
+		rctx->job_blocks = n / MB_HASH_BLOCK_SIZE;
+		mb_hash_advance(rctx, n);
+		return true;
+	}
+
+	if (rctx->final) {
+		rctx->final = false;
+		mb_hash_pad(rctx);
+		return true;
+	}
+
+	return false;
+}
+
+static void mb_hash_complete(struct ahash_request *req)
+{
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+	unsigned int words = crypto_ahash_digestsize(crypto_ahash_reqtfm(req)) / 4;
+	unsigned int i;
+
+	if (rctx->out) {
+		for (i = 0; i < words; i++)
+			put_unaligned_be32(rctx->state[i], req->result + 4 * i);
+	}
+
+	local_bh_disable();
+	req->base.complete(&req->base, 0);
+	local_bh_enable();
+}
+
+static void mb_hash_start_lane(struct mb_hash_mgr *mgr, unsigned int lane,
+			       struct ahash_request *req)
+{
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+	unsigned int i;
+
+	for (i = 0; i < mgr->alg->state_words; i++)
+		mgr->lanes.digest[i][lane] = rctx->state[i];
+
+	mgr->req[lane] = req;
+	mgr->lanes.data[lane] = rctx->job_data;
+	mgr->blocks[lane] = rctx->job_blocks;
+	__set_bit(lane, &mgr->busy);
+}
+
+/*
+ * The job in @lane is done.  Either give the lane the request's next
+ * job, the state stays where it is, or complete the request.
+ */
+static void mb_hash_retire_lane(struct mb_hash_mgr *mgr, unsigned int lane)
+{
+	struct ahash_request *req = mgr->req[lane];
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+	unsigned int i;
+
+	for (i = 0; i < mgr->alg->state_words; i++)
+		rctx->state[i] = mgr->lanes.digest[i][lane];
+
+	if (mb_hash_next_job(rctx)) {
+		mgr->lanes.data[lane] = rctx->job_data;
+		mgr->blocks[lane] = rctx->job_blocks;
+		return;
+	}
+
+	__clear_bit(lane, &mgr->busy);
+	mgr->req[lane] = NULL;
+	mb_hash_complete(req);
+}
+
+static void mb_hash_fill_lanes(struct mb_hash_mgr *mgr)
+{
+	unsigned long all = (1UL << mgr->alg->lanes) - 1;
+	struct crypto_async_request *async, *backlog;
+	struct ahash_request *req;
+
+	while (mgr->busy != all) {
+		spin_lock_bh(&mgr->queue_lock);
+		backlog = crypto_get_backlog(&mgr->queue);
+		async = crypto_dequeue_request(&mgr->queue);
+		spin_unlock_bh(&mgr->queue_lock);
+
+		if (!async)
+			break;
+
+		if (backlog) {
+			local_bh_disable();
+			backlog->complete(backlog, -EINPROGRESS);
+			local_bh_enable();
+		}
+
+		req = ahash_request_cast(async);
+		if (mb_hash_next_job(ahash_request_ctx(req)))
+			mb_hash_start_lane(mgr, ffz(mgr->busy), req);
+		else
+			mb_hash_complete(req);
+	}
+}
+
+/* Run the lanes until the shortest job is done. */
+static void mb_hash_run_lanes(struct mb_hash_mgr *mgr)
+{
+	struct mb_hash_alg *alg = mgr->alg;
+	unsigned int lane, first = __ffs(mgr->busy);
+	unsigned int blocks = UINT_MAX;
+
+	for (lane = 0; lane < alg->lanes; lane++) {
+		if (test_bit(lane, &mgr->busy))
+			blocks = min(blocks, mgr->blocks[lane]);
+		else
+			mgr->lanes.data[lane] = mgr->lanes.data[first];
+	}
+
+	alg->process(&mgr->lanes, blocks);
+
+	for_each_set_bit(lane, &mgr->busy, alg->lanes) {
+		mgr->lanes.data[lane] += blocks * MB_HASH_BLOCK_SIZE;
+		mgr->blocks[lane] -= blocks;
+		if (!mgr->blocks[lane])
+			mb_hash_retire_lane(mgr, lane);
+	}
+}
+
+/*
+ * Keep the lanes going while all of them have work.  Unless we are
+ * flushing, stop once some lane is idle and leave the rest to the
+ * flush timer, hoping that more requests turn up in the meantime.
+ */
+static void mb_hash_process(struct mb_hash_mgr *mgr, bool flush)
+{
+	unsigned long all = (1UL << mgr->alg->lanes) - 1;
+
+	mutex_lock(&mgr->lock);
+	for (;;) {
+		mb_hash_fill_lanes(mgr);
+		if (!mgr->busy)
+			break;
+
+		if (mgr->busy != all && !flush) {
+			queue_delayed_work_on(mgr->cpu, kcrypto_wq, &mgr->flush,
+					      usecs_to_jiffies(MB_HASH_FLUSH_US));
+			break;
+		}
+
+		mb_hash_run_lanes(mgr);
+		cond_resched();
+	}
+	mutex_unlock(&mgr->lock);
+}
+
+static void mb_hash_worker(struct work_struct *work)
+{
+	mb_hash_process(container_of(work, struct mb_hash_mgr, work), false);
+}
+
+static void mb_hash_flush_worker(struct work_struct *work)
+{
+	mb_hash_process(container_of(to_delayed_work(work),
+				     struct mb_hash_mgr, flush), true);
+}
+
+static int mb_hash_enqueue(struct ahash_request *req)
+{
+	struct mb_hash_alg *alg = mb_hash_alg(crypto_ahash_reqtfm(req));
+	struct mb_hash_mgr *mgr;
+	int cpu, err;
+
+	cpu = get_cpu();
+	mgr = per_cpu_ptr(alg->mgr, cpu);
+	spin_lock_bh(&mgr->queue_lock);
+	err = crypto_enqueue_request(&mgr->queue, &req->base);
+	spin_unlock_bh(&mgr->queue_lock);
+	queue_work_on(cpu, kcrypto_wq, &mgr->work);
+	put_cpu();
+
+	return err;
+}
+
+static int mb_hash_init(struct ahash_request *req)
+{
+	struct mb_hash_alg *alg = mb_hash_alg(crypto_ahash_reqtfm(req));
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+
+	memcpy(rctx->state, alg->init_state,
+	       alg->state_words * sizeof(rctx->state[0]));
+	rctx->count = 0;
+	rctx->buflen = 0;
+	rctx->page = NULL;
+
+	return 0;
+}
+
+static int mb_hash_queue(struct ahash_request *req, unsigned int nbytes,
+			 bool final)
+{
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+
+	rctx->sg = req->src;
+	rctx->offset = 0;
+	rctx->nbytes = nbytes;
+	rctx->final = final;
+	rctx->out = final;
+
+	return mb_hash_enqueue(req);
+}
+
+static int mb_hash_update(struct ahash_request *req)
+{
+	return mb_hash_queue(req, req->nbytes, false);
+}
+
+static int mb_hash_final(struct ahash_request *req)
+{
+	return mb_hash_queue(req, 0, true);
+}
+
+static int mb_hash_finup(struct ahash_request *req)
+{
+	return mb_hash_queue(req, req->nbytes, true);
+}
+
+static int mb_hash_digest(struct ahash_request *req)
+{
+	return mb_hash_init(req) ?: mb_hash_finup(req);
+}
+
+static int mb_hash_export(struct ahash_request *req, void *out)
+{
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+	struct mb_hash_export *state = out;
+
+	memcpy(state->state, rctx->state, sizeof(state->state));
+	state->count = rctx->count;
+	state->buflen = rctx->buflen;
+	memcpy(state->buf, rctx->buf, sizeof(state->buf));
+
+	return 0;
+}
+
+static int mb_hash_import(struct ahash_request *req, const void *in)
+{
+	struct mb_hash_req_ctx *rctx = ahash_request_ctx(req);
+	const struct mb_hash_export *state = in;
+
+	memcpy(rctx->state, state->state, sizeof(rctx->state));
+	rctx->count = state->count;
+	rctx->buflen = state->buflen;
+	memcpy(rctx->buf, state->buf, sizeof(state->buf));
+	rctx->page = NULL;
+
+	return 0;
+}
+
+static int mb_hash_init_tfm(struct crypto_tfm *tfm)
+{
+	crypto_ahash_set_reqsize(__crypto_ahash_cast(tfm),
+				 sizeof(struct mb_hash_req_ctx));
+
+	return 0;
+}
+
+int mb_hash_register(struct mb_hash_alg *alg)
+{
+	struct ahash_alg *ahash = &alg->ahash;
+	struct mb_hash_mgr *mgr;
+	int cpu, err;
+
+	if (!alg->lanes || alg->lanes > MB_HASH_MAX_LANES ||
+	    alg->state_words > MB_HASH_MAX_WORDS ||
+	    ahash->halg.digestsize > alg->state_words * 4)
+		return -EINVAL;
+
+	alg->mgr = alloc_percpu(struct mb_hash_mgr);
+	if (!alg->mgr)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		mgr = per_cpu_ptr(alg->mgr, cpu);
+		mutex_init(&mgr->lock);
+		spin_lock_init(&mgr->queue_lock);
+		crypto_init_queue(&mgr->queue, MB_HASH_MAX_CPU_QLEN);
+		INIT_WORK(&mgr->work, mb_hash_worker);
+		INIT_DELAYED_WORK(&mgr->flush, mb_hash_flush_worker);
+		mgr->alg = alg;
+		mgr->cpu = cpu;
+	}
+
+	ahash->init = mb_hash_init;
+	ahash->update = mb_hash_update;
+	ahash->final = mb_hash_final;
+	ahash->finup = mb_hash_finup;
+	ahash->digest = mb_hash_digest;
+	ahash->export = mb_hash_export;
+	ahash->import = mb_hash_import;
+	ahash->halg.statesize = sizeof(struct mb_hash_export);
+	ahash->halg.base.cra_flags = CRYPTO_ALG_TYPE_AHASH | CRYPTO_ALG_ASYNC;
+	ahash->halg.base.cra_ctxsize = 0;
+	ahash->halg.base.cra_init = mb_hash_init_tfm;
+
+	err = crypto_register_ahash(ahash);
+	if (err)
+		free_percpu(alg->mgr);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(mb_hash_register);
+
+void mb_hash_unregister(struct mb_hash_alg *alg)
+{
+	struct mb_hash_mgr *mgr;
+	int cpu;
+
+	crypto_unregister_ahash(&alg->ahash);
+
+	for_each_possible_cpu(cpu) {
+		mgr = per_cpu_ptr(alg->mgr, cpu);
+		cancel_work_sync(&mgr->work);
+		cancel_delayed_work_sync(&mgr->flush);
+		BUG_ON(mgr->queue.qlen || mgr->busy);
+	}
+	free_percpu(alg->mgr);
+}
+EXPORT_SYMBOL_GPL(mb_hash_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Multi-buffer hash helpers");
@@ -16247,6 +16247,42 @@ static struct pcomp_testvec zlib_decomp_tv_template[] = {
 	},
 };
 
+/*
+ * LZ4 test vectors (null-terminated strings).
+ */
+#define LZ4_COMP_TEST_VECTORS 1
+#define LZ4_DECOMP_TEST_VECTORS 1
+
+static struct comp_testvec lz4_comp_tv_template[] = {
+	{
+		.inlen	= 70,
+		.outlen	= 45,
+		.input	= "Join us now and share the software "
+			"Join us now and share the software ",
+		.output	= "\xf0\x10\x4a\x6f\x69\x6e\x20\x75"
+			"\x73\x20\x6e\x6f\x77\x20\x61\x6e"
+			"\x64\x20\x73\x68\x61\x72\x65\x20"
+			"\x74\x68\x65\x20\x73\x6f\x66\x74"
+			"\x77\x0d\x00\x0f\x23\x00\x0b\x50"
+			"\x77\x61\x72\x65\x20",
+	},
+};
+
+static struct comp_testvec lz4_decomp_tv_template[] = {
+	{
+		.inlen	= 45,
+		.outlen	= 70,
+		.input	= "\xf0\x10\x4a\x6f\x69\x6e\x20\x75"
+			"\x73\x20\x6e\x6f\x77\x20\x61\x6e"
+			"\x64\x20\x73\x68\x61\x72\x65\x20"
+			"\x74\x68\x65\x20\x73\x6f\x66\x74"
+			"\x77\x0d\x00\x0f\x23\x00\x0b\x50"
+			"\x77\x61\x72\x65\x20",
+		.output	= "Join us now and share the software "
+			"Join us now and share the software ",
+	},
+};
+
 /*
  * LZO test vectors (null-terminated strings).
  */
@@ -16379,6 +16415,35 @@ static struct hash_testvec michael_mic_tv_template[] = {
 	}
 };
 
+/*
+ * CRC T10 DIF test vectors
+ */
+#define CRCT10DIF_TEST_VECTORS	3
+
+static struct hash_testvec crct10dif_tv_template[] = {
+	{
+		.plaintext = "abc",
+		.psize  = 3,
+		.digest = "\x3b\x44",
+	}, {
+		.plaintext = "1234567890123456789012345678901234567890"
+			     "123456789012345678901234567890123456789",
+		.psize	= 79,
+		.digest	= "\x70\x4b",
+		.np	= 2,
+		.tap	= { 63, 16 },
+	}, {
+		.plaintext = "abcddcbaabcddcbaabcddcbaabcddcbaabcddcba"
+			     "ddcbaabcddcbaabcddcbaabcddcbaabcddcbaabc"
+			     "abcddcbaabcddcbaabcddcbaabcddcbaabcddcba"
+			     "ddcbaabcddcbaabcddcbaabcddcbaabcddcbaabc"
+			     "abcddcbaabcddcbaabcddcbaabcddcbaabcddcba"
+			     "ddcbaabcddcbaabcddcbaabcddcbaabcddcbaabc",
+		.psize	= 240,
+		.digest	= "\x78\xbb",
+	}
+};
+
 /*
  * CRC32C test vectors
  */
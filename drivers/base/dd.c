@@ -259,6 +259,14 @@ EXPORT_SYMBOL_GPL(device_bind_driver);
 static atomic_t probe_count = ATOMIC_INIT(0);
 static DECLARE_WAIT_QUEUE_HEAD(probe_waitqueue);
 
+/* Probes of drivers asking for PROBE_PREFER_ASYNCHRONOUS run here. */
+static ASYNC_DOMAIN(driver_probe_domain);
+
+static bool driver_allows_async_probing(struct device_driver *drv)
+{
+	return drv->probe_type == PROBE_PREFER_ASYNCHRONOUS;
+}
+
 static int really_probe(struct device *dev, struct device_driver *drv)
 {
 	int ret = 0;
@@ -321,6 +329,25 @@ done:
 	return ret;
 }
 
+/*
+ * With initcall_debug, report how long each probe took, the way
+ * do_one_initcall() does for initcalls.
+ */
+static int really_probe_debug(struct device *dev, struct device_driver *drv)
+{
+	ktime_t calltime, delta, rettime;
+	int ret;
+
+	calltime = ktime_get();
+	ret = really_probe(dev, drv);
+	rettime = ktime_get();
+	delta = ktime_sub(rettime, calltime);
+	printk(KERN_DEBUG "probe of %s with driver %s returned %d after %lld usecs\n",
+	       dev_name(dev), drv->name, ret,
+	       (unsigned long long)ktime_to_ns(delta) >> 10);
+	return ret;
+}
+
 /**
  * driver_probe_done
  * Determine if the probe sequence is finished or not.
@@ -342,6 +369,9 @@ int driver_probe_done(void)
  */
 void wait_for_device_probe(void)
 {
+	/* wait for asynchronous probes to be started and finished */
+	async_synchronize_full_domain(&driver_probe_domain);
+
 	/* wait for the known devices to complete their probing */
 	wait_event(probe_waitqueue, atomic_read(&probe_count) == 0);
 	async_synchronize_full();
@@ -370,7 +400,10 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 		 drv->bus->name, __func__, dev_name(dev), drv->name);
 
 	pm_runtime_barrier(dev);
-	ret = really_probe(dev, drv);
+	if (initcall_debug)
+		ret = really_probe_debug(dev, drv);
+	else
+		ret = really_probe(dev, drv);
 	pm_runtime_idle(dev);
 
 	return ret;
@@ -427,6 +460,82 @@ out_unlock:
 }
 EXPORT_SYMBOL_GPL(device_attach);
 
+struct device_attach_check {
+	struct device *dev;
+	bool async;
+};
+
+static int __device_attach_check(struct device_driver *drv, void *data)
+{
+	struct device_attach_check *check = data;
+
+	if (!driver_match_device(drv, check->dev))
+		return 0;
+
+	/* the first matching driver decides, as it is tried first */
+	check->async = driver_allows_async_probing(drv);
+	return 1;
+}
+
+static void __device_attach_async_helper(void *data, async_cookie_t cookie)
+{
+	struct device *dev = data;
+
+	if (dev->parent)	/* Needed for USB */
+		device_lock(dev->parent);
+	WARN_ON(device_attach(dev) < 0);
+	if (dev->parent)
+		device_unlock(dev->parent);
+
+	put_device(dev);
+}
+
+/**
+ * device_initial_probe - attach a newly added device to a driver
+ * @dev: device.
+ *
+ * As device_attach(), except that if the first driver matching @dev
+ * prefers asynchronous probing, the whole attach is done from the
+ * async thread pool instead.
+ */
+void device_initial_probe(struct device *dev)
+{
+	struct device_attach_check check = { .dev = dev };
+
+	if (!dev->driver)
+		bus_for_each_drv(dev->bus, NULL, &check, __device_attach_check);
+
+	if (check.async) {
+		pr_debug("bus: '%s': probing device %s asynchronously\n",
+			 dev->bus->name, dev_name(dev));
+		get_device(dev);
+		async_schedule_domain(__device_attach_async_helper, dev,
+				      &driver_probe_domain);
+		return;
+	}
+
+	WARN_ON(device_attach(dev) < 0);
+}
+
+static void __driver_attach_async_helper(void *data, async_cookie_t cookie)
+{
+	struct device *dev = data;
+	struct device_driver *drv;
+
+	if (dev->parent)	/* Needed for USB */
+		device_lock(dev->parent);
+	device_lock(dev);
+	drv = dev->p->async_driver;
+	dev->p->async_driver = NULL;
+	if (drv && !dev->driver)
+		driver_probe_device(drv, dev);
+	device_unlock(dev);
+	if (dev->parent)
+		device_unlock(dev->parent);
+
+	put_device(dev);
+}
+
 static int __driver_attach(struct device *dev, void *data)
 {
 	struct device_driver *drv = data;
@@ -444,6 +553,23 @@ static int __driver_attach(struct device *dev, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	if (driver_allows_async_probing(drv)) {
+		/*
+		 * Probe each device from its own async call, so that a
+		 * slow device does not hold up the others.  A device with
+		 * a probe already pending keeps the driver it had.
+		 */
+		device_lock(dev);
+		if (!dev->driver && !dev->p->async_driver) {
+			get_device(dev);
+			dev->p->async_driver = drv;
+			async_schedule_domain(__driver_attach_async_helper, dev,
+					      &driver_probe_domain);
+		}
+		device_unlock(dev);
+		return 0;
+	}
+
 	if (dev->parent)	/* Needed for USB */
 		device_lock(dev->parent);
 	device_lock(dev);
@@ -537,6 +663,10 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	/* don't let asynchronous probes bind devices behind our back */
+	if (driver_allows_async_probing(drv))
+		async_synchronize_full_domain(&driver_probe_domain);
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
@@ -73,6 +73,7 @@
 #include <linux/highmem.h>
 #include <linux/kthread.h>
 #include <linux/splice.h>
+#include <linux/aio.h>
 #include <linux/sysfs.h>
 #include <linux/miscdevice.h>
 #include <linux/falloc.h>
@@ -403,7 +404,129 @@ lo_receive(struct loop_device *lo, struct bio *bio, int bsize, loff_t pos)
 	return 0;
 }
 
-static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
+/*
+ * Direct mode
+ *
+ * With LO_FLAGS_DIRECT_IO set, bios bypass the loop thread: they are
+ * queued on lo_dio_list and served by LOOP_DIO_WORKERS work items on a
+ * per device workqueue, so that several of them are in flight at once.
+ * A worker hands the pages of a bio to ->aio_read and ->aio_write of
+ * lo_dio_file, a private O_DIRECT open of the backing file, instead of
+ * copying them through the page cache.  The filesystem maps, allocates
+ * and locks the file range in ->direct_IO as for any other O_DIRECT
+ * caller, and falls back to buffered I/O where it has to.  The pages go
+ * in as a kernel iovec, which direct-io.c takes them from without
+ * get_user_pages() because the kiocb is marked kiocbSetKernelPages().
+ *
+ * A bio that is not aligned to the logical block size of the backing
+ * filesystem's device still goes through the page cache; O_DIRECT keeps
+ * the two coherent.
+ */
+#define LOOP_DIO_SEGS	16
+
+static unsigned int loop_dio_align(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+
+	return bdev_logical_block_size(inode->i_sb->s_bdev) - 1;
+}
+
+static bool lo_dio_aligned(struct loop_device *lo, struct bio *bio, loff_t pos)
+{
+	unsigned int mask = loop_dio_align(lo);
+	struct bio_vec *bvec;
+	int i;
+
+	if (pos & mask)
+		return false;
+	bio_for_each_segment(bvec, bio, i)
+		if ((bvec->bv_offset | bvec->bv_len) & mask)
+			return false;
+	return true;
+}
+
+/*
+ * Read or write @nr_segs bio segments at @pos in one O_DIRECT call.  The
+ * part of a read beyond the end of the file is zeroed.
+ */
+static int lo_rw_segs(struct file *file, int rw, struct bio_vec *bvec,
+		      unsigned long nr_segs, loff_t pos)
+{
+	struct iovec iov[LOOP_DIO_SEGS];
+	struct kiocb kiocb;
+	mm_segment_t old_fs;
+	size_t len = 0;
+	ssize_t ret;
+	unsigned long i;
+
+	for (i = 0; i < nr_segs; i++) {
+		iov[i].iov_base = kmap(bvec[i].bv_page) + bvec[i].bv_offset;
+		iov[i].iov_len = bvec[i].bv_len;
+		len += bvec[i].bv_len;
+	}
+
+	init_sync_kiocb(&kiocb, file);
+	kiocbSetKernelPages(&kiocb);
+	kiocb.ki_pos = pos;
+	kiocb.ki_left = len;
+	kiocb.ki_nbytes = len;
+
+	old_fs = get_fs();
+	set_fs(get_ds());
+	if (rw == WRITE)
+		ret = file->f_op->aio_write(&kiocb, iov, nr_segs, pos);
+	else
+		ret = file->f_op->aio_read(&kiocb, iov, nr_segs, pos);
+	set_fs(old_fs);
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&kiocb);
+
+	if (rw == READ && ret >= 0 && ret < len) {
+		size_t done = ret;
+
+		for (i = 0; i < nr_segs; i++) {
+			if (done < iov[i].iov_len)
+				memset(iov[i].iov_base + done, 0,
+				       iov[i].iov_len - done);
+			done -= min(done, iov[i].iov_len);
+		}
+		ret = len;
+	}
+
+	for (i = 0; i < nr_segs; i++)
+		kunmap(bvec[i].bv_page);
+
+	if (ret < 0)
+		return ret;
+	return ret == len ? 0 : -EIO;
+}
+
+/*
+ * Only so many pages are kmapped at a time, a bio is done in batches of
+ * LOOP_DIO_SEGS segments.
+ */
+static int lo_rw_direct(struct loop_device *lo, struct bio *bio, loff_t pos)
+{
+	unsigned short idx = bio->bi_idx;
+	int ret = 0;
+
+	while (idx < bio->bi_vcnt) {
+		unsigned long nr, i;
+
+		nr = min_t(unsigned long, bio->bi_vcnt - idx, LOOP_DIO_SEGS);
+		ret = lo_rw_segs(lo->lo_dio_file, bio_data_dir(bio),
+				 bio_iovec_idx(bio, idx), nr, pos);
+		if (ret)
+			break;
+		for (i = 0; i < nr; i++)
+			pos += bio_iovec_idx(bio, idx + i)->bv_len;
+		idx += nr;
+	}
+	return ret;
+}
+
+static int do_bio_filebacked(struct loop_device *lo, struct bio *bio,
+			     bool direct)
 {
 	loff_t pos;
 	int ret;
@@ -444,14 +567,19 @@ static int do_bio_filebacked(struct loop_device *lo, struct bio *bio)
 			goto out;
 		}
 
-		ret = lo_send(lo, bio, pos);
+		if (direct && lo_dio_aligned(lo, bio, pos))
+			ret = lo_rw_direct(lo, bio, pos);
+		else
+			ret = lo_send(lo, bio, pos);
 
 		if ((bio->bi_rw & REQ_FUA) && !ret) {
 			ret = vfs_fsync(file, 0);
 			if (unlikely(ret && ret != -EINVAL))
 				ret = -EIO;
 		}
-	} else
+	} else if (direct && lo_dio_aligned(lo, bio, pos))
+		ret = lo_rw_direct(lo, bio, pos);
+	else
 		ret = lo_receive(lo, bio, lo->lo_blocksize, pos);
 
 out:
@@ -489,8 +617,17 @@ static void loop_make_request(struct request_queue *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
-	loop_add_bio(lo, old_bio);
-	wake_up(&lo->lo_event);
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		struct loop_dio_worker *w;
+
+		/* a worker that is running already picks it up, or runs again */
+		bio_list_add(&lo->lo_dio_list, old_bio);
+		w = &lo->lo_dio_workers[lo->lo_dio_next++ % LOOP_DIO_WORKERS];
+		queue_work(lo->lo_dio_wq, &w->work);
+	} else {
+		loop_add_bio(lo, old_bio);
+		wake_up(&lo->lo_event);
+	}
 	spin_unlock_irq(&lo->lo_lock);
 	return;
 
@@ -512,7 +649,7 @@ static inline void loop_handle_bio(struct loop_device *lo, struct bio *bio)
 		do_loop_switch(lo, bio->bi_private);
 		bio_put(bio);
 	} else {
-		int ret = do_bio_filebacked(lo, bio);
+		int ret = do_bio_filebacked(lo, bio, false);
 		bio_endio(bio, ret);
 	}
 }
@@ -555,6 +692,28 @@ static int loop_thread(void *data)
 	return 0;
 }
 
+/*
+ * Direct mode counterpart of loop_thread: each worker serves bios off
+ * lo_dio_list until it is empty.
+ */
+static void loop_dio_work(struct work_struct *work)
+{
+	struct loop_dio_worker *w;
+	struct loop_device *lo;
+	struct bio *bio;
+
+	w = container_of(work, struct loop_dio_worker, work);
+	lo = w->lo;
+	for (;;) {
+		spin_lock_irq(&lo->lo_lock);
+		bio = bio_list_pop(&lo->lo_dio_list);
+		spin_unlock_irq(&lo->lo_lock);
+		if (!bio)
+			break;
+		bio_endio(bio, do_bio_filebacked(lo, bio, true));
+	}
+}
+
 /*
  * loop_switch performs the hard work of switching a backing store.
  * First it needs to flush existing IO, it does this by sending a magic
@@ -636,6 +795,11 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
 
+	/* and not be in direct mode, which is set up for the old file */
+	error = -EBUSY;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
+
 	error = -EBADF;
 	file = fget(arg);
 	if (!file)
@@ -743,11 +907,19 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -755,6 +927,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -804,6 +977,85 @@ static void loop_config_discard(struct loop_device *lo)
 	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
 }
 
+static int loop_set_direct_io(struct loop_device *lo)
+{
+	struct file *file = lo->lo_backing_file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct workqueue_struct *wq;
+	struct file *dio_file;
+	int i;
+
+	if (!S_ISREG(inode->i_mode) || !inode->i_sb->s_bdev ||
+	    !mapping->a_ops->direct_IO ||
+	    !file->f_op->aio_read || !file->f_op->aio_write)
+		return -EOPNOTSUPP;
+	if (lo->transfer != transfer_none ||
+	    (lo->lo_offset & loop_dio_align(lo)))
+		return -EINVAL;
+
+	/* The backing file may be shared, it is not switched to O_DIRECT */
+	dio_file = dentry_open(&file->f_path,
+			       file->f_flags | O_DIRECT | O_LARGEFILE,
+			       file->f_cred);
+	if (IS_ERR(dio_file))
+		return PTR_ERR(dio_file);
+
+	wq = alloc_workqueue("kloopd%d", WQ_MEM_RECLAIM | WQ_UNBOUND,
+			     LOOP_DIO_WORKERS, lo->lo_number);
+	if (!wq) {
+		fput(dio_file);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < LOOP_DIO_WORKERS; i++) {
+		INIT_WORK(&lo->lo_dio_workers[i].work, loop_dio_work);
+		lo->lo_dio_workers[i].lo = lo;
+	}
+	lo->lo_dio_file = dio_file;
+	lo->lo_dio_wq = wq;
+
+	blk_queue_logical_block_size(lo->lo_queue, loop_dio_align(lo) + 1);
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+	return 0;
+}
+
+/*
+ * New bios go to the loop thread once the flag is clear.  Those already
+ * on lo_dio_list are served before destroy_workqueue() returns, as each
+ * one was followed by a queue_work().
+ */
+static void loop_clear_direct_io(struct loop_device *lo)
+{
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+
+	destroy_workqueue(lo->lo_dio_wq);
+	lo->lo_dio_wq = NULL;
+	fput(lo->lo_dio_file);
+	lo->lo_dio_file = NULL;
+
+	blk_queue_logical_block_size(lo->lo_queue, 512);
+}
+
+static int loop_set_dio(struct loop_device *lo, unsigned long arg)
+{
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+
+	if (arg)
+		return loop_set_direct_io(lo);
+
+	loop_clear_direct_io(lo);
+	return 0;
+}
+
 static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 		       struct block_device *bdev, unsigned int arg)
 {
@@ -877,6 +1129,7 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 	mapping_set_gfp_mask(mapping, lo->old_gfp_mask & ~(__GFP_IO|__GFP_FS));
 
 	bio_list_init(&lo->lo_bio_list);
+	bio_list_init(&lo->lo_dio_list);
 
 	/*
 	 * set queue make_request_fn, and add limits based on lower level
@@ -988,6 +1241,9 @@ static int loop_clr_fd(struct loop_device *lo)
 
 	kthread_stop(lo->lo_thread);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		loop_clear_direct_io(lo);
+
 	spin_lock_irq(&lo->lo_lock);
 	lo->lo_backing_file = NULL;
 	spin_unlock_irq(&lo->lo_lock);
@@ -1048,6 +1304,10 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type || info->lo_encrypt_key_size ||
+	     (info->lo_offset & loop_dio_align(lo))))
+		return -EINVAL;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1316,6 +1576,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_dio(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1470,6 +1735,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
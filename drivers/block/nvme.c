@@ -117,6 +117,7 @@ struct nvme_queue {
 	u16 sq_tail;
 	u16 cq_head;
 	u16 cq_phase;
+	cpumask_var_t cpu_mask;	/* CPUs submitting to this queue */
 	unsigned long cmdid_data[];
 };
 
@@ -303,6 +304,9 @@ struct nvme_iod {
 	int offset;		/* Of PRP list */
 	int nents;		/* Used in scatterlist */
 	int length;		/* Of data, in bytes */
+	int cpu;		/* Submitting CPU, -1 if unknown */
+	int status;		/* Passed to bio_endio() on remote completion */
+	struct call_single_data csd;
 	dma_addr_t first_dma;
 	struct scatterlist sg[0];
 };
@@ -334,12 +338,13 @@ nvme_alloc_iod(unsigned nseg, unsigned nbytes, gfp_t gfp)
 		iod->offset = offsetof(struct nvme_iod, sg[nseg]);
 		iod->npages = -1;
 		iod->length = nbytes;
+		iod->cpu = -1;
 	}
 
 	return iod;
 }
 
-static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
+static void nvme_free_prps(struct nvme_dev *dev, struct nvme_iod *iod)
 {
 	const int last_prp = PAGE_SIZE / 8 - 1;
 	int i;
@@ -354,6 +359,12 @@ static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
 		dma_pool_free(dev->prp_page_pool, prp_list, prp_dma);
 		prp_dma = next_prp_dma;
 	}
+	iod->npages = -1;
+}
+
+static void nvme_free_iod(struct nvme_dev *dev, struct nvme_iod *iod)
+{
+	nvme_free_prps(dev, iod);
 	kfree(iod);
 }
 
@@ -367,6 +378,39 @@ static void requeue_bio(struct nvme_dev *dev, struct bio *bio)
 	wake_up_process(nvme_thread);
 }
 
+static void nvme_end_bio_remote(void *data)
+{
+	struct nvme_iod *iod = data;
+	struct bio *bio = iod->private;
+	int status = iod->status;
+
+	kfree(iod);
+	bio_endio(bio, status);
+}
+
+/*
+ * The interrupt for a queue may be delivered to any of the CPUs sharing
+ * it.  Finish the bio on the CPU that submitted it, where the pages and
+ * the waiting task are cache hot, unless rq_affinity says otherwise.
+ */
+static void nvme_end_bio(struct nvme_dev *dev, struct nvme_iod *iod,
+							int status)
+{
+	struct bio *bio = iod->private;
+
+	nvme_free_prps(dev, iod);
+
+	iod->status = status;
+	iod->csd.func = nvme_end_bio_remote;
+	iod->csd.info = iod;
+	if (blk_steer_completion(bdev_get_queue(bio->bi_bdev), iod->cpu,
+								&iod->csd))
+		return;
+
+	kfree(iod);
+	bio_endio(bio, status);
+}
+
 static void bio_completion(struct nvme_dev *dev, void *ctx,
 						struct nvme_completion *cqe)
 {
@@ -376,13 +420,13 @@ static void bio_completion(struct nvme_dev *dev, void *ctx,
 
 	dma_unmap_sg(&dev->pci_dev->dev, iod->sg, iod->nents,
 			bio_data_dir(bio) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
-	nvme_free_iod(dev, iod);
 	if (status) {
-		bio_endio(bio, -EIO);
+		nvme_end_bio(dev, iod, -EIO);
 	} else if (bio->bi_vcnt > bio->bi_idx) {
+		nvme_free_iod(dev, iod);
 		requeue_bio(dev, bio);
 	} else {
-		bio_endio(bio, 0);
+		nvme_end_bio(dev, iod, 0);
 	}
 }
 
@@ -556,6 +600,7 @@ static int nvme_submit_bio_queue(struct nvme_queue *nvmeq, struct nvme_ns *ns,
 	if (!iod)
 		goto nomem;
 	iod->private = bio;
+	iod->cpu = smp_processor_id();
 
 	result = -EBUSY;
 	cmdid = alloc_cmdid(nvmeq, iod, bio_completion, NVME_IO_TIMEOUT);
@@ -682,6 +727,23 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	return result;
 }
 
+/*
+ * Reap completions on this CPU's queue for a task waiting in blk_poll().
+ */
+static int nvme_poll(struct request_queue *q)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_queue *nvmeq = get_nvmeq(ns->dev);
+	irqreturn_t result;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	result = nvme_process_cq(nvmeq);
+	spin_unlock_irq(&nvmeq->q_lock);
+	put_nvmeq(nvmeq);
+
+	return result == IRQ_HANDLED;
+}
+
 static irqreturn_t nvme_irq_check(int irq, void *data)
 {
 	struct nvme_queue *nvmeq = data;
@@ -880,6 +942,7 @@ static void nvme_free_queue(struct nvme_dev *dev, int qid)
 				(void *)nvmeq->cqes, nvmeq->cq_dma_addr);
 	dma_free_coherent(nvmeq->q_dmadev, SQ_SIZE(nvmeq->q_depth),
 					nvmeq->sq_cmds, nvmeq->sq_dma_addr);
+	free_cpumask_var(nvmeq->cpu_mask);
 	kfree(nvmeq);
 }
 
@@ -892,10 +955,13 @@ static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev, int qid,
 	if (!nvmeq)
 		return NULL;
 
+	if (!zalloc_cpumask_var(&nvmeq->cpu_mask, GFP_KERNEL))
+		goto free_nvmeq;
+
 	nvmeq->cqes = dma_alloc_coherent(dmadev, CQ_SIZE(depth),
 					&nvmeq->cq_dma_addr, GFP_KERNEL);
 	if (!nvmeq->cqes)
-		goto free_nvmeq;
+		goto free_mask;
 	memset((void *)nvmeq->cqes, 0, CQ_SIZE(depth));
 
 	nvmeq->sq_cmds = dma_alloc_coherent(dmadev, SQ_SIZE(depth),
@@ -920,6 +986,8 @@ static struct nvme_queue *nvme_alloc_queue(struct nvme_dev *dev, int qid,
  free_cqdma:
 	dma_free_coherent(dmadev, CQ_SIZE(nvmeq->q_depth), (void *)nvmeq->cqes,
 							nvmeq->cq_dma_addr);
+ free_mask:
+	free_cpumask_var(nvmeq->cpu_mask);
  free_nvmeq:
 	kfree(nvmeq);
 	return NULL;
@@ -969,6 +1037,7 @@ static __devinit struct nvme_queue *nvme_create_queue(struct nvme_dev *dev,
 				(void *)nvmeq->cqes, nvmeq->cq_dma_addr);
 	dma_free_coherent(nvmeq->q_dmadev, SQ_SIZE(nvmeq->q_depth),
 					nvmeq->sq_cmds, nvmeq->sq_dma_addr);
+	free_cpumask_var(nvmeq->cpu_mask);
 	kfree(nvmeq);
 	return ERR_PTR(result);
 }
@@ -1329,6 +1398,9 @@ static struct nvme_ns *nvme_alloc_ns(struct nvme_dev *dev, int nsid,
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, ns->queue);
 /*	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, ns->queue); */
 	blk_queue_make_request(ns->queue, nvme_make_request);
+	blk_queue_poll_fn(ns->queue, nvme_poll);
+	/* one writeback worker per I/O queue, capped by bdi_register() */
+	ns->queue->backing_dev_info.nr_wb = dev->queue_count - 1;
 	ns->dev = dev;
 	ns->queue->queuedata = ns;
 
@@ -1383,7 +1455,7 @@ static int set_queue_count(struct nvme_dev *dev, int count)
 
 static int __devinit nvme_setup_io_queues(struct nvme_dev *dev)
 {
-	int result, cpu, i, nr_io_queues, db_bar_size;
+	int result, i, nr_io_queues, db_bar_size;
 
 	nr_io_queues = num_online_cpus();
 	result = set_queue_count(dev, nr_io_queues);
@@ -1423,12 +1495,6 @@ static int __devinit nvme_setup_io_queues(struct nvme_dev *dev)
 	result = queue_request_irq(dev, dev->queues[0], "nvme admin");
 	/* XXX: handle failure here */
 
-	cpu = cpumask_first(cpu_online_mask);
-	for (i = 0; i < nr_io_queues; i++) {
-		irq_set_affinity_hint(dev->entry[i].vector, get_cpu_mask(cpu));
-		cpu = cpumask_next(cpu, cpu_online_mask);
-	}
-
 	for (i = 0; i < nr_io_queues; i++) {
 		dev->queues[i + 1] = nvme_create_queue(dev, i + 1,
 							NVME_Q_DEPTH, i);
@@ -1442,6 +1508,18 @@ static int __devinit nvme_setup_io_queues(struct nvme_dev *dev)
 		dev->queues[i + 1] = dev->queues[target + 1];
 	}
 
+	/*
+	 * Point each queue's interrupt at the CPUs that submit to it, so
+	 * that completions mostly arrive where the I/O was issued.
+	 */
+	for (i = 0; i < num_possible_cpus(); i++)
+		cpumask_set_cpu(i, dev->queues[i + 1]->cpu_mask);
+	for (i = 1; i < dev->queue_count; i++) {
+		struct nvme_queue *nvmeq = dev->queues[i];
+		irq_set_affinity_hint(dev->entry[nvmeq->cq_vector].vector,
+							nvmeq->cpu_mask);
+	}
+
 	return 0;
 }
 
@@ -1453,6 +1531,29 @@ static void nvme_free_queues(struct nvme_dev *dev)
 		nvme_free_queue(dev, i);
 }
 
+/*
+ * One line per possible CPU: the CPU, the queue it submits to and the
+ * interrupt that queue completes on.
+ */
+static ssize_t nvme_show_queue_map(struct device *d,
+				struct device_attribute *attr, char *buf)
+{
+	struct nvme_dev *dev = pci_get_drvdata(to_pci_dev(d));
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < num_possible_cpus(); i++) {
+		struct nvme_queue *nvmeq = dev->queues[i + 1];
+		if (!nvmeq)
+			break;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %d %d\n", i,
+				nvmeq->cq_vector + 1,
+				dev->entry[nvmeq->cq_vector].vector);
+	}
+	return len;
+}
+static DEVICE_ATTR(queue_map, S_IRUGO, nvme_show_queue_map, NULL);
+
 static int __devinit nvme_dev_add(struct nvme_dev *dev)
 {
 	int res, nn, i;
@@ -1502,6 +1603,9 @@ static int __devinit nvme_dev_add(struct nvme_dev *dev)
 	list_for_each_entry(ns, &dev->namespaces, list)
 		add_disk(ns->disk);
 
+	if (device_create_file(&dev->pci_dev->dev, &dev_attr_queue_map))
+		dev_warn(&dev->pci_dev->dev, "failed to create queue_map\n");
+
 	goto out;
 
  out_free:
@@ -1523,6 +1627,8 @@ static int nvme_dev_remove(struct nvme_dev *dev)
 	list_del(&dev->node);
 	spin_unlock(&dev_list_lock);
 
+	device_remove_file(&dev->pci_dev->dev, &dev_attr_queue_map);
+
 	/* TODO: wait all I/O finished or cancel them */
 
 	list_for_each_entry_safe(ns, next, &dev->namespaces, list) {
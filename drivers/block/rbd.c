@@ -38,6 +38,8 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/workqueue.h>
 
 #include "rbd_types.h"
 
@@ -71,6 +73,9 @@
 
 #define RBD_NOTIFY_TIMEOUT_DEFAULT 10
 
+/* blk-mq tags per device, i.e. block requests in flight */
+#define RBD_QUEUE_DEPTH		128
+
 /*
  * block device image metadata (in-memory version)
  */
@@ -105,22 +110,13 @@ struct rbd_client {
 };
 
 /*
- * a request completion status
+ * a block layer request, split into one osd request per object it
+ * touches.  Lives in the blk-mq driver payload behind the request.
  */
-struct rbd_req_status {
-	int done;
-	int rc;
-	u64 bytes;
-};
-
-/*
- * a collection of requests
- */
-struct rbd_req_coll {
-	int			total;
-	int			num_done;
-	struct kref		kref;
-	struct rbd_req_status	status[0];
+struct rbd_img_request {
+	struct work_struct	work;
+	atomic_t		pending;	/* osd requests not yet done */
+	int			result;		/* first error seen */
 };
 
 /*
@@ -131,8 +127,18 @@ struct rbd_request {
 	struct bio		*bio;		/* cloned bio */
 	struct page		**pages;	/* list of used pages */
 	u64			len;
-	int			coll_index;
-	struct rbd_req_coll	*coll;
+	ktime_t			start;		/* when sent to the osd */
+	struct rbd_img_request	*img_req;
+};
+
+/*
+ * osd request counters, indexed by data direction
+ */
+struct rbd_osd_stats {
+	atomic64_t		reqs[2];
+	atomic64_t		bytes[2];
+	atomic64_t		usecs[2];	/* summed latency */
+	atomic64_t		errors[2];
 };
 
 struct rbd_snap {
@@ -157,7 +163,7 @@ struct rbd_device {
 
 	char			name[DEV_NAME_LEN]; /* blkdev name, e.g. rbd3 */
 
-	spinlock_t		lock;		/* queue lock */
+	struct rbd_osd_stats	stats;
 
 	struct rbd_image_header	header;
 	char			*image_name;
@@ -190,6 +196,8 @@ struct rbd_device {
 
 static DEFINE_MUTEX(ctl_mutex);	  /* Serialize open/close/setup/teardown */
 
+static struct workqueue_struct *rbd_wq;	/* issues block requests */
+
 static LIST_HEAD(rbd_dev_list);    /* devices */
 static DEFINE_SPINLOCK(rbd_dev_list_lock);
 
@@ -468,18 +476,6 @@ static void rbd_put_client(struct rbd_device *rbd_dev)
 	rbd_dev->rbd_client = NULL;
 }
 
-/*
- * Destroy requests collection
- */
-static void rbd_coll_release(struct kref *kref)
-{
-	struct rbd_req_coll *coll =
-		container_of(kref, struct rbd_req_coll, kref);
-
-	dout("rbd_coll_release %p\n", coll);
-	kfree(coll);
-}
-
 static bool rbd_dev_ondisk_valid(struct rbd_image_header_ondisk *ondisk)
 {
 	return !memcmp(&ondisk->text,
@@ -659,14 +655,6 @@ static u64 rbd_get_segment(struct rbd_image_header *header,
 	return len;
 }
 
-static int rbd_get_num_segments(struct rbd_image_header *header,
-				u64 ofs, u64 len)
-{
-	u64 start_seg = ofs >> header->obj_order;
-	u64 end_seg = (ofs + len - 1) >> header->obj_order;
-	return end_seg - start_seg + 1;
-}
-
 /*
  * returns the size of an object in the image
  */
@@ -821,48 +809,28 @@ static void rbd_destroy_ops(struct ceph_osd_req_op *ops)
 	kfree(ops);
 }
 
-static void rbd_coll_end_req_index(struct request *rq,
-				   struct rbd_req_coll *coll,
-				   int index,
-				   int ret, u64 len)
+/*
+ * Drop one of the outstanding osd requests of a block request.  The
+ * block request is completed as a whole once all of them are done,
+ * with the first error any of them returned.
+ */
+static void rbd_img_end_req(struct request *rq,
+			    struct rbd_img_request *img_req, int ret)
 {
-	struct request_queue *q;
-	int min, max, i;
-
-	dout("rbd_coll_end_req_index %p index %d ret %d len %llu\n",
-	     coll, index, ret, (unsigned long long) len);
+	dout("rbd_img_end_req %p ret %d\n", img_req, ret);
 
 	if (!rq)
 		return;
 
-	if (!coll) {
-		blk_end_request(rq, ret, len);
-		return;
-	}
-
-	q = rq->q;
-
-	spin_lock_irq(q->queue_lock);
-	coll->status[index].done = 1;
-	coll->status[index].rc = ret;
-	coll->status[index].bytes = len;
-	max = min = coll->num_done;
-	while (max < coll->total && coll->status[max].done)
-		max++;
-
-	for (i = min; i<max; i++) {
-		__blk_end_request(rq, coll->status[i].rc,
-				  coll->status[i].bytes);
-		coll->num_done++;
-		kref_put(&coll->kref, rbd_coll_release);
-	}
-	spin_unlock_irq(q->queue_lock);
+	if (ret < 0)
+		cmpxchg(&img_req->result, 0, ret);
+	if (atomic_dec_and_test(&img_req->pending))
+		blk_mq_end_io(rq, img_req->result);
 }
 
-static void rbd_coll_end_req(struct rbd_request *req,
-			     int ret, u64 len)
+static void rbd_obj_end_req(struct rbd_request *req, int ret)
 {
-	rbd_coll_end_req_index(req->rq, req->coll, req->coll_index, ret, len);
+	rbd_img_end_req(req->rq, req->img_req, ret);
 }
 
 /*
@@ -878,8 +846,7 @@ static int rbd_do_request(struct request *rq,
 			  int num_pages,
 			  int flags,
 			  struct ceph_osd_req_op *ops,
-			  struct rbd_req_coll *coll,
-			  int coll_index,
+			  struct rbd_img_request *img_req,
 			  void (*rbd_cb)(struct ceph_osd_request *req,
 					 struct ceph_msg *msg),
 			  struct ceph_osd_request **linger_req,
@@ -896,16 +863,12 @@ static int rbd_do_request(struct request *rq,
 
 	req_data = kzalloc(sizeof(*req_data), GFP_NOIO);
 	if (!req_data) {
-		if (coll)
-			rbd_coll_end_req_index(rq, coll, coll_index,
-					       -ENOMEM, len);
+		if (img_req)
+			rbd_img_end_req(rq, img_req, -ENOMEM);
 		return -ENOMEM;
 	}
 
-	if (coll) {
-		req_data->coll = coll;
-		req_data->coll_index = coll_index;
-	}
+	req_data->img_req = img_req;
 
 	dout("rbd_do_request object_name=%s ofs=%llu len=%llu\n", object_name,
 		(unsigned long long) ofs, (unsigned long long) len);
@@ -953,6 +916,7 @@ static int rbd_do_request(struct request *rq,
 		*linger_req = req;
 	}
 
+	req_data->start = ktime_get();
 	ret = ceph_osdc_start_request(osdc, req, false);
 	if (ret < 0)
 		goto done_err;
@@ -972,11 +936,26 @@ done_err:
 	bio_chain_put(req_data->bio);
 	ceph_osdc_put_request(req);
 done_pages:
-	rbd_coll_end_req(req_data, ret, len);
+	rbd_obj_end_req(req_data, ret);
 	kfree(req_data);
 	return ret;
 }
 
+static void rbd_account_osd_req(struct rbd_device *rbd_dev,
+				struct rbd_request *req_data,
+				int write, int rc, u64 bytes)
+{
+	struct rbd_osd_stats *stats = &rbd_dev->stats;
+
+	atomic64_inc(&stats->reqs[write]);
+	atomic64_add(ktime_us_delta(ktime_get(), req_data->start),
+		     &stats->usecs[write]);
+	if (rc < 0)
+		atomic64_inc(&stats->errors[write]);
+	else
+		atomic64_add(bytes, &stats->bytes[write]);
+}
+
 /*
  * Ceph osd op callback
  */
@@ -1008,7 +987,9 @@ static void rbd_req_cb(struct ceph_osd_request *req, struct ceph_msg *msg)
 		bytes = req_data->len;
 	}
 
-	rbd_coll_end_req(req_data, rc, bytes);
+	rbd_account_osd_req(req_data->rq->q->queuedata, req_data,
+			    !read_op, rc, bytes);
+	rbd_obj_end_req(req_data, rc);
 
 	if (req_data->bio)
 		bio_chain_put(req_data->bio);
@@ -1052,7 +1033,7 @@ static int rbd_req_sync_op(struct rbd_device *rbd_dev,
 			  pages, num_pages,
 			  flags,
 			  ops,
-			  NULL, 0,
+			  NULL,
 			  NULL,
 			  linger_req, ver);
 	if (ret < 0)
@@ -1076,8 +1057,7 @@ static int rbd_do_op(struct request *rq,
 		     int opcode, int flags,
 		     u64 ofs, u64 len,
 		     struct bio *bio,
-		     struct rbd_req_coll *coll,
-		     int coll_index)
+		     struct rbd_img_request *img_req)
 {
 	char *seg_name;
 	u64 seg_ofs;
@@ -1086,9 +1066,10 @@ static int rbd_do_op(struct request *rq,
 	struct ceph_osd_req_op *ops;
 	u32 payload_len;
 
+	ret = -ENOMEM;
 	seg_name = kmalloc(RBD_MAX_SEG_NAME_LEN + 1, GFP_NOIO);
 	if (!seg_name)
-		return -ENOMEM;
+		goto err;
 
 	seg_len = rbd_get_segment(&rbd_dev->header,
 				  rbd_dev->header.object_prefix,
@@ -1100,7 +1081,7 @@ static int rbd_do_op(struct request *rq,
 	ret = -ENOMEM;
 	ops = rbd_create_rw_ops(1, opcode, payload_len);
 	if (!ops)
-		goto done;
+		goto err_name;
 
 	/* we've taken care of segment sizes earlier when we
 	   cloned the bios. We should never have a segment
@@ -1113,13 +1094,20 @@ static int rbd_do_op(struct request *rq,
 			     NULL, 0,
 			     flags,
 			     ops,
-			     coll, coll_index,
+			     img_req,
 			     rbd_req_cb, 0, NULL);
 
 	rbd_destroy_ops(ops);
-done:
 	kfree(seg_name);
 	return ret;
+
+	/* rbd_do_request() ends the request itself once it got this far */
+err_name:
+	kfree(seg_name);
+err:
+	bio_chain_put(bio);
+	rbd_img_end_req(rq, img_req, ret);
+	return ret;
 }
 
 /*
@@ -1130,13 +1118,12 @@ static int rbd_req_write(struct request *rq,
 			 struct ceph_snap_context *snapc,
 			 u64 ofs, u64 len,
 			 struct bio *bio,
-			 struct rbd_req_coll *coll,
-			 int coll_index)
+			 struct rbd_img_request *img_req)
 {
 	return rbd_do_op(rq, rbd_dev, snapc, CEPH_NOSNAP,
 			 CEPH_OSD_OP_WRITE,
 			 CEPH_OSD_FLAG_WRITE | CEPH_OSD_FLAG_ONDISK,
-			 ofs, len, bio, coll, coll_index);
+			 ofs, len, bio, img_req);
 }
 
 /*
@@ -1147,14 +1134,13 @@ static int rbd_req_read(struct request *rq,
 			 u64 snapid,
 			 u64 ofs, u64 len,
 			 struct bio *bio,
-			 struct rbd_req_coll *coll,
-			 int coll_index)
+			 struct rbd_img_request *img_req)
 {
 	return rbd_do_op(rq, rbd_dev, NULL,
 			 snapid,
 			 CEPH_OSD_OP_READ,
 			 CEPH_OSD_FLAG_READ,
-			 ofs, len, bio, coll, coll_index);
+			 ofs, len, bio, img_req);
 }
 
 /*
@@ -1206,7 +1192,7 @@ static int rbd_req_sync_notify_ack(struct rbd_device *rbd_dev,
 			  NULL, 0,
 			  CEPH_OSD_FLAG_READ,
 			  ops,
-			  NULL, 0,
+			  NULL,
 			  rbd_simple_req_cb, 0, NULL);
 
 	rbd_destroy_ops(ops);
@@ -1413,140 +1399,126 @@ static int rbd_req_sync_exec(struct rbd_device *rbd_dev,
 	return ret;
 }
 
-static struct rbd_req_coll *rbd_alloc_coll(int num_reqs)
-{
-	struct rbd_req_coll *coll =
-			kzalloc(sizeof(struct rbd_req_coll) +
-			        sizeof(struct rbd_req_status) * num_reqs,
-				GFP_ATOMIC);
-
-	if (!coll)
-		return NULL;
-	coll->total = num_reqs;
-	kref_init(&coll->kref);
-	return coll;
-}
-
 /*
- * block device queue callback
+ * Issue the osd requests for a block request.  Runs from rbd_wq rather
+ * than ->queue_rq() because it takes header_rwsem and allocates memory.
  */
-static void rbd_rq_fn(struct request_queue *q)
-{
-	struct rbd_device *rbd_dev = q->queuedata;
-	struct request *rq;
+static void rbd_queue_workfn(struct work_struct *work)
+{
+	struct rbd_img_request *img_req =
+		container_of(work, struct rbd_img_request, work);
+	struct request *rq = blk_mq_rq_from_pdu(img_req);
+	struct rbd_device *rbd_dev = rq->q->queuedata;
+	struct bio *bio;
+	struct bio *rq_bio = rq->bio, *next_bio = NULL;
 	struct bio_pair *bp = NULL;
+	bool do_write = (rq_data_dir(rq) == WRITE);
+	unsigned int size = blk_rq_bytes(rq);
+	u64 ofs = blk_rq_pos(rq) * SECTOR_SIZE;
+	u64 op_size = 0;
+	struct ceph_snap_context *snapc;
+	int result;
 
-	while ((rq = blk_fetch_request(q))) {
-		struct bio *bio;
-		struct bio *rq_bio, *next_bio = NULL;
-		bool do_write;
-		unsigned int size;
-		u64 op_size = 0;
-		u64 ofs;
-		int num_segs, cur_seg = 0;
-		struct rbd_req_coll *coll;
-		struct ceph_snap_context *snapc;
-
-		/* peek at request from block layer */
-		if (!rq)
-			break;
+	/* filter out block requests we don't understand */
+	if (rq->cmd_type != REQ_TYPE_FS || !size) {
+		result = 0;
+		goto end_rq;
+	}
 
-		dout("fetched request\n");
+	if (do_write && rbd_dev->read_only) {
+		result = -EROFS;
+		goto end_rq;
+	}
 
-		/* filter out block requests we don't understand */
-		if ((rq->cmd_type != REQ_TYPE_FS)) {
-			__blk_end_request_all(rq, 0);
-			continue;
-		}
+	down_read(&rbd_dev->header_rwsem);
+
+	if (rbd_dev->snap_id != CEPH_NOSNAP && !rbd_dev->snap_exists) {
+		up_read(&rbd_dev->header_rwsem);
+		dout("request for non-existent snapshot");
+		result = -ENXIO;
+		goto end_rq;
+	}
 
-		/* deduce our operation (read, write) */
-		do_write = (rq_data_dir(rq) == WRITE);
+	snapc = ceph_get_snap_context(rbd_dev->header.snapc);
 
-		size = blk_rq_bytes(rq);
-		ofs = blk_rq_pos(rq) * SECTOR_SIZE;
-		rq_bio = rq->bio;
-		if (do_write && rbd_dev->read_only) {
-			__blk_end_request_all(rq, -EROFS);
-			continue;
-		}
+	up_read(&rbd_dev->header_rwsem);
 
-		spin_unlock_irq(q->queue_lock);
+	dout("%s 0x%x bytes at 0x%llx\n",
+	     do_write ? "write" : "read",
+	     size, (unsigned long long) ofs);
 
-		down_read(&rbd_dev->header_rwsem);
+	/* the submitter holds a count until every osd request is sent */
+	img_req->result = 0;
+	atomic_set(&img_req->pending, 1);
 
-		if (rbd_dev->snap_id != CEPH_NOSNAP && !rbd_dev->snap_exists) {
-			up_read(&rbd_dev->header_rwsem);
-			dout("request for non-existent snapshot");
-			spin_lock_irq(q->queue_lock);
-			__blk_end_request_all(rq, -ENXIO);
-			continue;
+	do {
+		/* a bio clone to be passed down to OSD req */
+		dout("rq->bio->bi_vcnt=%hu\n", rq->bio->bi_vcnt);
+		op_size = rbd_get_segment(&rbd_dev->header,
+					  rbd_dev->header.object_prefix,
+					  ofs, size,
+					  NULL, NULL);
+		atomic_inc(&img_req->pending);
+		bio = bio_chain_clone(&rq_bio, &next_bio, &bp,
+				      op_size, GFP_NOIO);
+		if (!bio) {
+			rbd_img_end_req(rq, img_req, -ENOMEM);
+			goto next_seg;
 		}
 
-		snapc = ceph_get_snap_context(rbd_dev->header.snapc);
+		/* init OSD command: write or read */
+		if (do_write)
+			rbd_req_write(rq, rbd_dev,
+				      snapc,
+				      ofs,
+				      op_size, bio,
+				      img_req);
+		else
+			rbd_req_read(rq, rbd_dev,
+				     rbd_dev->snap_id,
+				     ofs,
+				     op_size, bio,
+				     img_req);
 
-		up_read(&rbd_dev->header_rwsem);
+next_seg:
+		size -= op_size;
+		ofs += op_size;
 
-		dout("%s 0x%x bytes at 0x%llx\n",
-		     do_write ? "write" : "read",
-		     size, (unsigned long long) blk_rq_pos(rq) * SECTOR_SIZE);
+		rq_bio = next_bio;
+	} while (size > 0);
 
-		num_segs = rbd_get_num_segments(&rbd_dev->header, ofs, size);
-		coll = rbd_alloc_coll(num_segs);
-		if (!coll) {
-			spin_lock_irq(q->queue_lock);
-			__blk_end_request_all(rq, -ENOMEM);
-			ceph_put_snap_context(snapc);
-			continue;
-		}
-
-		do {
-			/* a bio clone to be passed down to OSD req */
-			dout("rq->bio->bi_vcnt=%hu\n", rq->bio->bi_vcnt);
-			op_size = rbd_get_segment(&rbd_dev->header,
-						  rbd_dev->header.object_prefix,
-						  ofs, size,
-						  NULL, NULL);
-			kref_get(&coll->kref);
-			bio = bio_chain_clone(&rq_bio, &next_bio, &bp,
-					      op_size, GFP_ATOMIC);
-			if (!bio) {
-				rbd_coll_end_req_index(rq, coll, cur_seg,
-						       -ENOMEM, op_size);
-				goto next_seg;
-			}
+	if (bp)
+		bio_pair_release(bp);
 
+	ceph_put_snap_context(snapc);
 
-			/* init OSD command: write or read */
-			if (do_write)
-				rbd_req_write(rq, rbd_dev,
-					      snapc,
-					      ofs,
-					      op_size, bio,
-					      coll, cur_seg);
-			else
-				rbd_req_read(rq, rbd_dev,
-					     rbd_dev->snap_id,
-					     ofs,
-					     op_size, bio,
-					     coll, cur_seg);
+	rbd_img_end_req(rq, img_req, 0);
+	return;
 
-next_seg:
-			size -= op_size;
-			ofs += op_size;
+end_rq:
+	blk_mq_end_io(rq, result);
+}
 
-			cur_seg++;
-			rq_bio = next_bio;
-		} while (size > 0);
-		kref_put(&coll->kref, rbd_coll_release);
+/*
+ * blk-mq queue callback.  Requests reach us from per-cpu software
+ * queues without any queue lock, already merged with their neighbours;
+ * hand them off to the workqueue, which may sleep.
+ */
+static int rbd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct rbd_img_request *img_req = blk_mq_rq_to_pdu(rq);
 
-		if (bp)
-			bio_pair_release(bp);
-		spin_lock_irq(q->queue_lock);
+	INIT_WORK(&img_req->work, rbd_queue_workfn);
+	queue_work(rbd_wq, &img_req->work);
 
-		ceph_put_snap_context(snapc);
-	}
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
+static struct blk_mq_ops rbd_mq_ops = {
+	.queue_rq	= rbd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
 /*
  * a queue callback. Makes sure that we don't create a bio that spans across
  * multiple osd objects. One exception would be with a single page bios,
@@ -1764,6 +1736,7 @@ static int rbd_init_disk(struct rbd_device *rbd_dev)
 {
 	struct gendisk *disk;
 	struct request_queue *q;
+	struct blk_mq_reg reg;
 	int rc;
 	u64 segment_size;
 	u64 total_size = 0;
@@ -1796,8 +1769,16 @@ static int rbd_init_disk(struct rbd_device *rbd_dev)
 	disk->private_data = rbd_dev;
 
 	/* init rq */
+	memset(&reg, 0, sizeof(reg));
+	reg.ops = &rbd_mq_ops;
+	reg.nr_hw_queues = 1;
+	reg.queue_depth = RBD_QUEUE_DEPTH;
+	reg.cmd_size = sizeof(struct rbd_img_request);
+	reg.numa_node = NUMA_NO_NODE;
+	reg.flags = BLK_MQ_F_SHOULD_MERGE;
+
 	rc = -ENOMEM;
-	q = blk_init_queue(rbd_rq_fn, &rbd_dev->lock);
+	q = blk_mq_init_queue(&reg, rbd_dev);
 	if (!q)
 		goto out_disk;
 
@@ -1905,6 +1886,27 @@ static ssize_t rbd_snap_show(struct device *dev,
 	return sprintf(buf, "%s\n", rbd_dev->snap_name);
 }
 
+/*
+ * osd request counters, reads then writes: requests, bytes, summed
+ * latency in microseconds, errors
+ */
+static ssize_t rbd_osd_stats_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct rbd_device *rbd_dev = dev_to_rbd_dev(dev);
+	struct rbd_osd_stats *stats = &rbd_dev->stats;
+
+	return sprintf(buf, "%llu %llu %llu %llu %llu %llu %llu %llu\n",
+		(unsigned long long) atomic64_read(&stats->reqs[READ]),
+		(unsigned long long) atomic64_read(&stats->bytes[READ]),
+		(unsigned long long) atomic64_read(&stats->usecs[READ]),
+		(unsigned long long) atomic64_read(&stats->errors[READ]),
+		(unsigned long long) atomic64_read(&stats->reqs[WRITE]),
+		(unsigned long long) atomic64_read(&stats->bytes[WRITE]),
+		(unsigned long long) atomic64_read(&stats->usecs[WRITE]),
+		(unsigned long long) atomic64_read(&stats->errors[WRITE]));
+}
+
 static ssize_t rbd_image_refresh(struct device *dev,
 				 struct device_attribute *attr,
 				 const char *buf,
@@ -1926,6 +1928,7 @@ static DEVICE_ATTR(pool_id, S_IRUGO, rbd_pool_id_show, NULL);
 static DEVICE_ATTR(name, S_IRUGO, rbd_name_show, NULL);
 static DEVICE_ATTR(refresh, S_IWUSR, NULL, rbd_image_refresh);
 static DEVICE_ATTR(current_snap, S_IRUGO, rbd_snap_show, NULL);
+static DEVICE_ATTR(osd_stats, S_IRUGO, rbd_osd_stats_show, NULL);
 static DEVICE_ATTR(create_snap, S_IWUSR, NULL, rbd_snap_add);
 
 static struct attribute *rbd_attrs[] = {
@@ -1936,6 +1939,7 @@ static struct attribute *rbd_attrs[] = {
 	&dev_attr_pool_id.attr,
 	&dev_attr_name.attr,
 	&dev_attr_current_snap.attr,
+	&dev_attr_osd_stats.attr,
 	&dev_attr_refresh.attr,
 	&dev_attr_create_snap.attr,
 	NULL
@@ -2462,7 +2466,6 @@ static ssize_t rbd_add(struct bus_type *bus,
 		goto err_nomem;
 
 	/* static rbd_device initialization */
-	spin_lock_init(&rbd_dev->lock);
 	INIT_LIST_HEAD(&rbd_dev->node);
 	INIT_LIST_HEAD(&rbd_dev->snaps);
 	init_rwsem(&rbd_dev->header_rwsem);
@@ -2702,9 +2705,16 @@ int __init rbd_init(void)
 {
 	int rc;
 
+	/* may be needed to make progress on writeback */
+	rbd_wq = alloc_workqueue(RBD_DRV_NAME, WQ_MEM_RECLAIM, 0);
+	if (!rbd_wq)
+		return -ENOMEM;
+
 	rc = rbd_sysfs_init();
-	if (rc)
+	if (rc) {
+		destroy_workqueue(rbd_wq);
 		return rc;
+	}
 	pr_info("loaded " RBD_DRV_NAME_LONG "\n");
 	return 0;
 }
@@ -2712,6 +2722,7 @@ int __init rbd_init(void)
 void __exit rbd_exit(void)
 {
 	rbd_sysfs_cleanup();
+	destroy_workqueue(rbd_wq);
 }
 
 module_init(rbd_init);
@@ -252,6 +252,7 @@
 #include <linux/spinlock.h>
 #include <linux/percpu.h>
 #include <linux/cryptohash.h>
+#include <linux/syscalls.h>
 #include <linux/fips.h>
 #include <linux/ptrace.h>
 #include <linux/kmemcheck.h>
@@ -265,6 +266,8 @@
 #include <asm/irq.h>
 #include <asm/irq_regs.h>
 #include <asm/io.h>
+#include <asm/unaligned.h>
+#include <crypto/chacha20.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/random.h>
@@ -396,6 +399,7 @@ static struct poolinfo {
  * Static global variables
  */
 static DECLARE_WAIT_QUEUE_HEAD(random_read_wait);
+static DECLARE_WAIT_QUEUE_HEAD(crng_init_wait);
 static DECLARE_WAIT_QUEUE_HEAD(random_write_wait);
 static struct fasync_struct *fasync;
 
@@ -584,6 +588,8 @@ static void fast_mix(struct fast_pool *f, const void *in, int nbytes)
 	f->rotate = input_rotate;
 }
 
+static void crng_force_reseed(void);
+
 /*
  * Credit (or debit) the entropy store with n bits of entropy
  */
@@ -609,8 +615,14 @@ retry:
 
 	if (!r->initialized && nbits > 0) {
 		r->entropy_total += nbits;
-		if (r->entropy_total > 128)
+		if (r->entropy_total > 128) {
 			r->initialized = 1;
+			if (r == &input_pool) {
+				/* Reseed what was seeded from too little */
+				crng_force_reseed();
+				wake_up_interruptible(&crng_init_wait);
+			}
+		}
 	}
 
 	trace_credit_entropy_bits(r->name, nbits, entropy_count,
@@ -1024,6 +1036,133 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
 	return ret;
 }
 
+/*********************************************************************
+ *
+ * CRNG for /dev/urandom and getrandom()
+ *
+ * Bulk readers of /dev/urandom used to go through extract_buf() and
+ * the nonblocking pool lock for every 10 bytes.  Instead each CPU runs
+ * its own ChaCha20 key stream, keyed from the nonblocking pool and
+ * rekeyed every CRNG_RESEED_INTERVAL or when entropy is written to the
+ * pools.  After every read the key is overwritten with fresh key
+ * stream, so that the output already returned cannot be recovered
+ * from the state.
+ *
+ *********************************************************************/
+
+#define CRNG_RESEED_INTERVAL	(300 * HZ)
+
+struct crng_state {
+	__u32 state[16];
+	unsigned long init_time;
+	int generation;
+};
+
+static DEFINE_PER_CPU(struct crng_state, crng_state);
+static atomic_t crng_generation = ATOMIC_INIT(0);
+
+static void crng_force_reseed(void)
+{
+	atomic_inc(&crng_generation);
+}
+
+static void crng_reseed(struct crng_state *crng)
+{
+	union {
+		__u32 key[8 + 4];
+		unsigned long l[LONGS(sizeof(__u32) * (8 + 4))];
+	} buf;
+	int i;
+
+	extract_entropy(&nonblocking_pool, &buf, sizeof(buf), 0, 0);
+	for (i = 0; i < ARRAY_SIZE(buf.l); i++) {
+		unsigned long v;
+
+		if (!arch_get_random_long(&v))
+			break;
+		buf.l[i] ^= v;
+	}
+
+	/* "expand 32-byte k" */
+	crng->state[0] = 0x61707865;
+	crng->state[1] = 0x3320646e;
+	crng->state[2] = 0x79622d32;
+	crng->state[3] = 0x6b206574;
+	for (i = 0; i < 8; i++)
+		crng->state[4 + i] ^= buf.key[i];
+	for (i = 0; i < 4; i++)
+		crng->state[12 + i] = buf.key[8 + i];
+
+	crng->init_time = jiffies;
+	crng->generation = atomic_read(&crng_generation);
+	memset(&buf, 0, sizeof(buf));
+}
+
+/* Called with preemption disabled */
+static void crng_block(struct crng_state *crng, __u8 *out)
+{
+	if (!crng->init_time ||
+	    crng->generation != atomic_read(&crng_generation) ||
+	    time_after(jiffies, crng->init_time + CRNG_RESEED_INTERVAL))
+		crng_reseed(crng);
+
+	chacha20_block(crng->state, out);
+	if (crng->state[12] == 0)
+		crng->state[13]++;
+}
+
+static void crng_backtrack_protect(void)
+{
+	struct crng_state *crng;
+	__u8 tmp[CHACHA20_BLOCK_SIZE];
+	int i;
+
+	crng = &get_cpu_var(crng_state);
+	crng_block(crng, tmp);
+	for (i = 0; i < 8; i++)
+		crng->state[4 + i] ^= get_unaligned_le32(tmp + i * 4);
+	put_cpu_var(crng_state);
+
+	memset(tmp, 0, sizeof(tmp));
+}
+
+static ssize_t extract_crng_user(void __user *buf, size_t nbytes)
+{
+	ssize_t ret = 0, i;
+	__u8 tmp[CHACHA20_BLOCK_SIZE];
+
+	while (nbytes) {
+		if (need_resched()) {
+			if (signal_pending(current)) {
+				if (ret == 0)
+					ret = -ERESTARTSYS;
+				break;
+			}
+			schedule();
+		}
+
+		crng_block(&get_cpu_var(crng_state), tmp);
+		put_cpu_var(crng_state);
+
+		i = min_t(size_t, nbytes, CHACHA20_BLOCK_SIZE);
+		if (copy_to_user(buf, tmp, i)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		nbytes -= i;
+		buf += i;
+		ret += i;
+	}
+
+	crng_backtrack_protect();
+
+	/* Wipe data just returned from memory */
+	memset(tmp, 0, sizeof(tmp));
+
+	return ret;
+}
+
 /*
  * This function is the exported kernel interface.  It returns some
  * number of good random numbers, suitable for key generation, seeding
@@ -1130,7 +1269,7 @@ void rand_initialize_disk(struct gendisk *disk)
 #endif
 
 static ssize_t
-random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
+_random_read(int nonblock, char __user *buf, size_t nbytes)
 {
 	ssize_t n, retval = 0, count = 0;
 
@@ -1150,7 +1289,7 @@ random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 			  n*8, (nbytes-n)*8);
 
 		if (n == 0) {
-			if (file->f_flags & O_NONBLOCK) {
+			if (nonblock) {
 				retval = -EAGAIN;
 				break;
 			}
@@ -1185,10 +1324,16 @@ random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 	return (count ? count : retval);
 }
 
+static ssize_t
+random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
+{
+	return _random_read(file->f_flags & O_NONBLOCK, buf, nbytes);
+}
+
 static ssize_t
 urandom_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+	return extract_crng_user(buf, nbytes);
 }
 
 static unsigned int
@@ -1240,6 +1385,8 @@ static ssize_t random_write(struct file *file, const char __user *buffer,
 	if (ret)
 		return ret;
 
+	crng_force_reseed();
+
 	return (ssize_t)count;
 }
 
@@ -1276,6 +1423,7 @@ static long random_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 		if (retval < 0)
 			return retval;
 		credit_entropy_bits(&input_pool, ent_count);
+		crng_force_reseed();
 		return 0;
 	case RNDZAPENTCNT:
 	case RNDCLEARPOOL:
@@ -1311,6 +1459,32 @@ const struct file_operations urandom_fops = {
 	.llseek = noop_llseek,
 };
 
+/*
+ * getrandom() reads like /dev/urandom without needing a file descriptor,
+ * but unlike it waits until the input pool has been seeded once.
+ */
+SYSCALL_DEFINE3(getrandom, char __user *, buf, size_t, count,
+		unsigned int, flags)
+{
+	if (flags & ~(GRND_NONBLOCK|GRND_RANDOM))
+		return -EINVAL;
+
+	if (count > INT_MAX)
+		count = INT_MAX;
+
+	if (flags & GRND_RANDOM)
+		return _random_read(flags & GRND_NONBLOCK, buf, count);
+
+	if (!input_pool.initialized) {
+		if (flags & GRND_NONBLOCK)
+			return -EAGAIN;
+		wait_event_interruptible(crng_init_wait, input_pool.initialized);
+		if (signal_pending(current))
+			return -ERESTARTSYS;
+	}
+	return extract_crng_user(buf, count);
+}
+
 /***************************************************************
  * Random UUID interface
  *
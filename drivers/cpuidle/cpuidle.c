@@ -91,6 +91,47 @@ int cpuidle_play_dead(void)
 	return -ENODEV;
 }
 
+/*
+ * Judge the governor's choice against the residency we actually got: the
+ * state was too deep if a shallower usable one exists and we woke before
+ * the target residency of the entered state, and too shallow if a deeper
+ * usable state's target residency still fits the measured idle time.
+ */
+static void cpuidle_update_accuracy(struct cpuidle_device *dev,
+				    struct cpuidle_driver *drv, int index)
+{
+	struct cpuidle_state *target = &drv->states[index];
+	int residency = dev->last_residency;
+	int i;
+
+	if (!(target->flags & CPUIDLE_FLAG_TIME_VALID))
+		return;
+
+	/* the exit latency is part of the residency but not of the idle time */
+	if (residency > (int)target->exit_latency)
+		residency -= target->exit_latency;
+
+	if (residency < (int)target->target_residency) {
+		for (i = index - 1; i >= CPUIDLE_DRIVER_STATE_START; i--) {
+			if (drv->states[i].disabled ||
+			    dev->states_usage[i].disable)
+				continue;
+			dev->states_usage[index].above++;
+			break;
+		}
+		return;
+	}
+
+	for (i = index + 1; i < drv->state_count; i++) {
+		if (drv->states[i].disabled || dev->states_usage[i].disable)
+			continue;
+		if (residency < (int)drv->states[i].target_residency)
+			break;
+		dev->states_usage[index].below++;
+		break;
+	}
+}
+
 /**
  * cpuidle_enter_state - enter the state and update stats
  * @dev: cpuidle device for this cpu
@@ -112,6 +153,7 @@ int cpuidle_enter_state(struct cpuidle_device *dev, struct cpuidle_driver *drv,
 		dev->states_usage[entered_state].time +=
 				(unsigned long long)dev->last_residency;
 		dev->states_usage[entered_state].usage++;
+		cpuidle_update_accuracy(dev, drv, entered_state);
 	} else {
 		dev->last_residency = 0;
 	}
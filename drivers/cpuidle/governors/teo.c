@@ -0,0 +1,255 @@
+/*
+ * teo.c - the timer events oriented idle governor
+ *
+ * This code is licenced under the GPL version 2 as described
+ * in the COPYING file that acompanies the Linux Kernel.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuidle.h>
+#include <linux/pm_qos.h>
+#include <linux/ktime.h>
+#include <linux/tick.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/module.h>
+
+/*
+ * Concepts and ideas behind the teo governor
+ *
+ * The next timer event is the only wakeup that is known in advance, so it
+ * is an upper bound for the idle duration: the deepest state whose target
+ * residency fits before it (the "sleep length") is the starting candidate.
+ * Everything else that wakes the CPU (device interrupts, IPIs) can only be
+ * learnt from history.
+ *
+ * The target residencies of the idle states split the time axis into bins,
+ * bin i covering [target_residency(i), target_residency(i + 1)). After each
+ * wakeup one of two per-bin counters is bumped:
+ *
+ *  hits       - the CPU stayed idle into the bin of the sleep length, so
+ *               the timer was the wakeup source; counted in that bin.
+ *  intercepts - the CPU was woken up earlier than that; counted in the bin
+ *               of the measured idle duration.
+ *
+ * All counters decay by 1/2^DECAY_SHIFT on every update, so they describe
+ * the recent past only. To select a state, the hits in the sleep length bin
+ * and the intercepts in the bins up to it are taken as the distribution of
+ * idle durations to expect. The governor then picks the deepest state for
+ * which less than 1/CONFIDENCE of that mass lies below its target residency,
+ * i.e. the deepest state that is likely to pay off.
+ *
+ * While the CPU has tasks waiting for I/O, or softirqs (network receive in
+ * particular) are pending, the wakeup is expected to come soon and the
+ * governor stays in the shallowest usable state regardless of history.
+ *
+ * How good the choices were can be checked in the "above" and "below"
+ * counters of every state in sysfs.
+ */
+
+#define PULSE		1024
+#define DECAY_SHIFT	3
+#define CONFIDENCE	4
+
+struct teo_bin {
+	unsigned int	hits;
+	unsigned int	intercepts;
+};
+
+struct teo_cpu {
+	int		last_state_idx;
+	int		needs_update;
+	unsigned int	sleep_length_us;
+	struct teo_bin	bins[CPUIDLE_STATE_MAX];
+};
+
+static DEFINE_PER_CPU(struct teo_cpu, teo_cpus);
+
+/* the bin an idle duration falls into, disabled states included */
+static int teo_bin_index(struct cpuidle_driver *drv, unsigned int duration_us)
+{
+	int i;
+
+	for (i = 1; i < drv->state_count; i++)
+		if (drv->states[i].target_residency > duration_us)
+			break;
+
+	return i - 1;
+}
+
+/**
+ * teo_update - account the last idle period
+ * @drv: cpuidle driver containing state data
+ * @dev: the CPU
+ */
+static void teo_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = &__get_cpu_var(teo_cpus);
+	struct cpuidle_state *target = &drv->states[cpu_data->last_state_idx];
+	unsigned int measured_us;
+	int i, idx_timer, idx_measured;
+
+	if (target->flags & CPUIDLE_FLAG_TIME_VALID) {
+		measured_us = cpuidle_get_last_residency(dev);
+		/* the wakeup event happened before the exit latency */
+		if (measured_us > target->exit_latency)
+			measured_us -= target->exit_latency;
+	} else {
+		/* no way to tell, assume the timer woke us up */
+		measured_us = cpu_data->sleep_length_us;
+	}
+
+	for (i = 0; i < drv->state_count; i++) {
+		struct teo_bin *bin = &cpu_data->bins[i];
+
+		bin->hits -= bin->hits >> DECAY_SHIFT;
+		bin->intercepts -= bin->intercepts >> DECAY_SHIFT;
+	}
+
+	idx_timer = teo_bin_index(drv, cpu_data->sleep_length_us);
+	idx_measured = teo_bin_index(drv, measured_us);
+
+	if (idx_measured >= idx_timer)
+		cpu_data->bins[idx_timer].hits += PULSE;
+	else
+		cpu_data->bins[idx_measured].intercepts += PULSE;
+}
+
+/**
+ * teo_select - selects the next idle state to enter
+ * @drv: cpuidle driver containing state data
+ * @dev: the CPU
+ */
+static int teo_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = &__get_cpu_var(teo_cpus);
+	int latency_req = pm_qos_request(PM_QOS_CPU_DMA_LATENCY);
+	unsigned int below[CPUIDLE_STATE_MAX];
+	unsigned int total;
+	int i, idx_timer, first = -1, idx = -1;
+
+	if (cpu_data->needs_update) {
+		teo_update(drv, dev);
+		cpu_data->needs_update = 0;
+	}
+
+	cpu_data->last_state_idx = 0;
+	cpu_data->sleep_length_us = ktime_to_us(tick_nohz_get_sleep_length());
+
+	/* Special case when user has set very strict latency requirement */
+	if (unlikely(latency_req == 0))
+		return 0;
+
+	/* the deepest usable state that fits before the next timer */
+	for (i = CPUIDLE_DRIVER_STATE_START; i < drv->state_count; i++) {
+		struct cpuidle_state *s = &drv->states[i];
+
+		if (s->disabled || dev->states_usage[i].disable)
+			continue;
+		if (s->exit_latency > latency_req)
+			break;
+		if (first < 0)
+			first = i;
+		if (s->target_residency > cpu_data->sleep_length_us)
+			break;
+		idx = i;
+	}
+
+	/*
+	 * Like menu, don't poll unless the timer is happening really soon;
+	 * nothing can be deeper than the shallowest state either.
+	 */
+	if (idx < 0)
+		idx = cpu_data->sleep_length_us > 5 && first >= 0 ? first : 0;
+	if (first < 0 || idx <= first)
+		goto out;
+
+	/* a wakeup is imminent, don't pay for a deep exit */
+	if (nr_iowait_cpu(dev->cpu) || local_softirq_pending()) {
+		idx = first;
+		goto out;
+	}
+
+	idx_timer = teo_bin_index(drv, cpu_data->sleep_length_us);
+
+	/* below[i]: intercepts shorter than the target residency of state i */
+	total = 0;
+	for (i = 0; i <= idx_timer; i++) {
+		below[i] = total;
+		total += cpu_data->bins[i].intercepts;
+	}
+	total += cpu_data->bins[idx_timer].hits;
+
+	/* step down until the chance of waking up too early is small */
+	for (; idx > first; idx--) {
+		if (drv->states[idx].disabled || dev->states_usage[idx].disable)
+			continue;
+		if (below[idx] * CONFIDENCE <= total)
+			break;
+	}
+
+out:
+	cpu_data->last_state_idx = idx;
+	return idx;
+}
+
+/**
+ * teo_reflect - records that data structures need update
+ * @dev: the CPU
+ * @index: the index of actual entered state
+ *
+ * NOTE: it's important to be fast here because this operation will add to
+ *       the overall exit latency.
+ */
+static void teo_reflect(struct cpuidle_device *dev, int index)
+{
+	struct teo_cpu *cpu_data = &__get_cpu_var(teo_cpus);
+
+	cpu_data->last_state_idx = index;
+	if (index >= 0)
+		cpu_data->needs_update = 1;
+}
+
+/**
+ * teo_enable_device - scans a CPU's states and does setup
+ * @drv: cpuidle driver
+ * @dev: the CPU
+ */
+static int teo_enable_device(struct cpuidle_driver *drv,
+			     struct cpuidle_device *dev)
+{
+	struct teo_cpu *cpu_data = &per_cpu(teo_cpus, dev->cpu);
+
+	memset(cpu_data, 0, sizeof(struct teo_cpu));
+
+	return 0;
+}
+
+static struct cpuidle_governor teo_governor = {
+	.name =		"teo",
+	.rating =	19,
+	.enable =	teo_enable_device,
+	.select =	teo_select,
+	.reflect =	teo_reflect,
+	.owner =	THIS_MODULE,
+};
+
+/**
+ * init_teo - initializes the governor
+ */
+static int __init init_teo(void)
+{
+	return cpuidle_register_governor(&teo_governor);
+}
+
+/**
+ * exit_teo - exits the governor
+ */
+static void __exit exit_teo(void)
+{
+	cpuidle_unregister_governor(&teo_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_teo);
+module_exit(exit_teo);
@@ -21,9 +21,12 @@
  * Memory management policy:
  *	Limit the number of buffers to DM_BUFIO_MEMORY_PERCENT of main memory
  *	or DM_BUFIO_VMALLOC_PERCENT of vmalloc memory (whichever is lower).
- *	Always allocate at least DM_BUFIO_MIN_BUFFERS buffers.
+ *	Always allocate at least DM_BUFIO_MIN_BUFFERS buffers, or the
+ *	client's minimum_buffers if that is larger.
  *	Start background writeback when there are DM_BUFIO_WRITEBACK_PERCENT
- *	dirty buffers.
+ *	dirty buffers (tunable with the writeback_percent parameter).
+ *	The shrinker only frees clean buffers; dirty buffers are written
+ *	asynchronously and freed on a later pass.
  */
 #define DM_BUFIO_MIN_BUFFERS		8
 
@@ -104,6 +107,14 @@ struct dm_bufio_client {
 	struct list_head reserved_buffers;
 	unsigned need_reserved_buffers;
 
+	unsigned minimum_buffers;
+
+	/*
+	 * Lookup statistics, protected by the client lock.
+	 */
+	unsigned long hits;
+	unsigned long misses;
+
 	struct hlist_head *cache_hash;
 	wait_queue_head_t free_buffer_wait;
 
@@ -221,6 +232,12 @@ static DEFINE_SPINLOCK(param_spinlock);
  */
 static unsigned dm_bufio_max_age = DM_BUFIO_DEFAULT_AGE_SECS;
 
+/*
+ * Percentage of a client's buffers that may be dirty before writeback
+ * starts
+ */
+static unsigned dm_bufio_writeback_percent = DM_BUFIO_WRITEBACK_PERCENT;
+
 static unsigned long dm_bufio_peak_allocated;
 static unsigned long dm_bufio_allocated_kmem_cache;
 static unsigned long dm_bufio_allocated_get_free_pages;
@@ -640,6 +657,31 @@ static void __make_buffer_clean(struct dm_buffer *b)
 	wait_on_bit(&b->state, B_WRITING, do_io_schedule, TASK_UNINTERRUPTIBLE);
 }
 
+/*
+ * Start writing all dirty buffers.  If no_wait is set, stop at the first
+ * buffer that is already being written rather than waiting for it.
+ */
+static void __write_dirty_buffers_async(struct dm_bufio_client *c, int no_wait)
+{
+	struct dm_buffer *b, *tmp;
+
+	list_for_each_entry_safe_reverse(b, tmp, &c->lru[LIST_DIRTY], lru_list) {
+		BUG_ON(test_bit(B_READING, &b->state));
+
+		if (!test_bit(B_DIRTY, &b->state) &&
+		    !test_bit(B_WRITING, &b->state)) {
+			__relink_lru(b, LIST_CLEAN);
+			continue;
+		}
+
+		if (no_wait && test_bit(B_WRITING, &b->state))
+			return;
+
+		__write_dirty_buffer(b);
+		dm_bufio_cond_resched();
+	}
+}
+
 /*
  * Find some buffer that is not held by anybody, clean it, unlink it and
  * return it.
@@ -660,6 +702,15 @@ static struct dm_buffer *__get_unclaimed_buffer(struct dm_bufio_client *c)
 		dm_bufio_cond_resched();
 	}
 
+	/*
+	 * Everything clean is in use.  Rather than writing dirty buffers
+	 * out one at a time as they are evicted, start writing all of
+	 * them now so that the following evictions find their writes
+	 * already complete.
+	 */
+	if (c->n_buffers[LIST_DIRTY])
+		__write_dirty_buffers_async(c, 1);
+
 	list_for_each_entry_reverse(b, &c->lru[LIST_DIRTY], lru_list) {
 		BUG_ON(test_bit(B_READING, &b->state));
 
@@ -783,27 +834,6 @@ static void __free_buffer_wake(struct dm_buffer *b)
 	wake_up(&c->free_buffer_wait);
 }
 
-static void __write_dirty_buffers_async(struct dm_bufio_client *c, int no_wait)
-{
-	struct dm_buffer *b, *tmp;
-
-	list_for_each_entry_safe_reverse(b, tmp, &c->lru[LIST_DIRTY], lru_list) {
-		BUG_ON(test_bit(B_READING, &b->state));
-
-		if (!test_bit(B_DIRTY, &b->state) &&
-		    !test_bit(B_WRITING, &b->state)) {
-			__relink_lru(b, LIST_CLEAN);
-			continue;
-		}
-
-		if (no_wait && test_bit(B_WRITING, &b->state))
-			return;
-
-		__write_dirty_buffer(b);
-		dm_bufio_cond_resched();
-	}
-}
-
 /*
  * Get writeback threshold and buffer limit for a given client.
  */
@@ -812,6 +842,7 @@ static void __get_memory_limit(struct dm_bufio_client *c,
 			       unsigned long *limit_buffers)
 {
 	unsigned long buffers;
+	unsigned writeback_percent;
 
 	if (dm_bufio_cache_size != dm_bufio_cache_size_latch) {
 		mutex_lock(&dm_bufio_clients_lock);
@@ -822,11 +853,15 @@ static void __get_memory_limit(struct dm_bufio_client *c,
 	buffers = dm_bufio_cache_size_per_client >>
 		  (c->sectors_per_block_bits + SECTOR_SHIFT);
 
-	if (buffers < DM_BUFIO_MIN_BUFFERS)
-		buffers = DM_BUFIO_MIN_BUFFERS;
+	if (buffers < c->minimum_buffers)
+		buffers = c->minimum_buffers;
+
+	writeback_percent = *(volatile unsigned *)&dm_bufio_writeback_percent;
+	if (unlikely(writeback_percent > 100))
+		writeback_percent = 100;
 
 	*limit_buffers = buffers;
-	*threshold_buffers = buffers * DM_BUFIO_WRITEBACK_PERCENT / 100;
+	*threshold_buffers = buffers * writeback_percent / 100;
 }
 
 /*
@@ -886,8 +921,14 @@ static struct dm_buffer *__bufio_new(struct dm_bufio_client *c, sector_t block,
 	*need_submit = 0;
 
 	b = __find(c, block);
-	if (b)
+	if (b) {
+		if (nf != NF_PREFETCH)
+			c->hits++;
 		goto found_buffer;
+	}
+
+	if (nf != NF_PREFETCH && nf != NF_FRESH)
+		c->misses++;
 
 	if (nf == NF_GET)
 		return NULL;
@@ -1324,6 +1365,24 @@ struct dm_bufio_client *dm_bufio_get_client(struct dm_buffer *b)
 }
 EXPORT_SYMBOL_GPL(dm_bufio_get_client);
 
+void dm_bufio_set_minimum_buffers(struct dm_bufio_client *c, unsigned n)
+{
+	dm_bufio_lock(c);
+	c->minimum_buffers = max_t(unsigned, n, DM_BUFIO_MIN_BUFFERS);
+	dm_bufio_unlock(c);
+}
+EXPORT_SYMBOL_GPL(dm_bufio_set_minimum_buffers);
+
+void dm_bufio_get_stats(struct dm_bufio_client *c,
+			unsigned long *hits, unsigned long *misses)
+{
+	dm_bufio_lock(c);
+	*hits = c->hits;
+	*misses = c->misses;
+	dm_bufio_unlock(c);
+}
+EXPORT_SYMBOL_GPL(dm_bufio_get_stats);
+
 static void drop_buffers(struct dm_bufio_client *c)
 {
 	struct dm_buffer *b;
@@ -1381,6 +1440,11 @@ static int __cleanup_old_buffer(struct dm_buffer *b, gfp_t gfp,
 	return 0;
 }
 
+/*
+ * The shrinker never waits for I/O: it frees idle clean buffers, and if
+ * that isn't enough and the caller allows I/O, it starts writing the
+ * dirty buffers so that they can be freed on a later pass.
+ */
 static void __scan(struct dm_bufio_client *c, unsigned long nr_to_scan,
 		   struct shrink_control *sc)
 {
@@ -1389,11 +1453,13 @@ static void __scan(struct dm_bufio_client *c, unsigned long nr_to_scan,
 
 	for (l = 0; l < LIST_SIZE; l++) {
 		list_for_each_entry_safe_reverse(b, tmp, &c->lru[l], lru_list)
-			if (!__cleanup_old_buffer(b, sc->gfp_mask, 0) &&
-			    !--nr_to_scan)
+			if (!__cleanup_old_buffer(b, 0, 0) && !--nr_to_scan)
 				return;
 		dm_bufio_cond_resched();
 	}
+
+	if ((sc->gfp_mask & __GFP_IO) && c->n_buffers[LIST_DIRTY])
+		__write_dirty_buffers_async(c, 1);
 }
 
 static int shrink(struct shrinker *shrinker, struct shrink_control *sc)
@@ -1470,6 +1536,10 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 	INIT_LIST_HEAD(&c->reserved_buffers);
 	c->need_reserved_buffers = reserved_buffers;
 
+	c->minimum_buffers = DM_BUFIO_MIN_BUFFERS;
+	c->hits = 0;
+	c->misses = 0;
+
 	init_waitqueue_head(&c->free_buffer_wait);
 	c->async_write_error = 0;
 
@@ -1735,6 +1805,9 @@ MODULE_PARM_DESC(max_cache_size_bytes, "Size of metadata cache");
 module_param_named(max_age_seconds, dm_bufio_max_age, uint, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(max_age_seconds, "Max age of a buffer in seconds");
 
+module_param_named(writeback_percent, dm_bufio_writeback_percent, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(writeback_percent, "Percentage of a client's cache that may be dirty before writeback starts");
+
 module_param_named(peak_allocated_bytes, dm_bufio_peak_allocated, ulong, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(peak_allocated_bytes, "Tracks the maximum allocated memory");
 
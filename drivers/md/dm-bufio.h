@@ -115,6 +115,19 @@ void *dm_bufio_get_block_data(struct dm_buffer *b);
 void *dm_bufio_get_aux_data(struct dm_buffer *b);
 struct dm_bufio_client *dm_bufio_get_client(struct dm_buffer *b);
 
+/*
+ * Keep at least n buffers cached for this client, whatever its share of
+ * the global cache size.
+ */
+void dm_bufio_set_minimum_buffers(struct dm_bufio_client *c, unsigned n);
+
+/*
+ * Number of dm_bufio_read/dm_bufio_get lookups that found the block
+ * cached (hits) and that didn't (misses).  Prefetches are not counted.
+ */
+void dm_bufio_get_stats(struct dm_bufio_client *c,
+			unsigned long *hits, unsigned long *misses);
+
 /*----------------------------------------------------------------*/
 
 #endif
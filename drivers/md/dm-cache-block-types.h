@@ -0,0 +1,23 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_BLOCK_TYPES_H
+#define DM_CACHE_BLOCK_TYPES_H
+
+#include "persistent-data/dm-block-manager.h"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The cache target deals in two kinds of block: blocks of the origin
+ * device (oblocks) and blocks of the fast cache device (cblocks).  Both
+ * are in units of the cache's block size.  The number of cblocks is
+ * limited to 32 bits, which keeps the in-core structures small.
+ */
+typedef dm_block_t dm_oblock_t;
+typedef uint32_t dm_cblock_t;
+
+/*----------------------------------------------------------------*/
+
+#endif /* DM_CACHE_BLOCK_TYPES_H */
@@ -0,0 +1,1003 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-policy.h"
+#include "dm.h"
+
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Large, sequential ios are probably better left on the origin device since
+ * spindles tend to have good sequential bandwidth.
+ *
+ * The io_tracker tries to spot when the io is in one of these sequential
+ * modes.
+ *
+ * The two thresholds to switch between random and sequential io mode are
+ * defaulting as follows and can be adjusted via the constructor and message
+ * interfaces.
+ */
+#define RANDOM_THRESHOLD_DEFAULT 4
+#define SEQUENTIAL_THRESHOLD_DEFAULT 512
+
+enum io_pattern {
+	PATTERN_SEQUENTIAL,
+	PATTERN_RANDOM
+};
+
+struct io_tracker {
+	enum io_pattern pattern;
+
+	unsigned nr_seq_samples;
+	unsigned nr_rand_samples;
+	unsigned thresholds[2];
+
+	sector_t next_start_sector;
+};
+
+static void iot_init(struct io_tracker *t,
+		     int sequential_threshold, int random_threshold)
+{
+	t->pattern = PATTERN_RANDOM;
+	t->nr_seq_samples = 0;
+	t->nr_rand_samples = 0;
+	t->next_start_sector = 0;
+	t->thresholds[PATTERN_RANDOM] = random_threshold;
+	t->thresholds[PATTERN_SEQUENTIAL] = sequential_threshold;
+}
+
+static enum io_pattern iot_pattern(struct io_tracker *t)
+{
+	return t->pattern;
+}
+
+static void iot_update_stats(struct io_tracker *t, struct bio *bio)
+{
+	if (bio->bi_sector == t->next_start_sector)
+		t->nr_seq_samples++;
+	else {
+		/*
+		 * Just one non-sequential IO is enough to reset the
+		 * counters.
+		 */
+		if (t->nr_seq_samples) {
+			t->nr_seq_samples = 0;
+			t->nr_rand_samples = 0;
+		}
+
+		t->nr_rand_samples++;
+	}
+
+	t->next_start_sector = bio->bi_sector + bio_sectors(bio);
+}
+
+static void iot_check_for_pattern_switch(struct io_tracker *t)
+{
+	switch (t->pattern) {
+	case PATTERN_SEQUENTIAL:
+		if (t->nr_rand_samples >= t->thresholds[PATTERN_RANDOM]) {
+			t->pattern = PATTERN_RANDOM;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+
+	case PATTERN_RANDOM:
+		if (t->nr_seq_samples >= t->thresholds[PATTERN_SEQUENTIAL]) {
+			t->pattern = PATTERN_SEQUENTIAL;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+	}
+}
+
+static void iot_examine_bio(struct io_tracker *t, struct bio *bio)
+{
+	iot_update_stats(t, bio);
+	iot_check_for_pattern_switch(t);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * This queue is divided up into different levels.  Allowing us to push
+ * entries to the back of any of the levels.  Think of it as a partially
+ * sorted queue.
+ */
+#define NR_QUEUE_LEVELS 16u
+
+struct queue {
+	struct list_head qs[NR_QUEUE_LEVELS];
+};
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		INIT_LIST_HEAD(q->qs + i);
+}
+
+/*
+ * Insert an entry to the back of the given level.
+ */
+static void queue_push(struct queue *q, unsigned level, struct list_head *elt)
+{
+	list_add_tail(elt, q->qs + level);
+}
+
+static void queue_remove(struct list_head *elt)
+{
+	list_del(elt);
+}
+
+/*
+ * Gives us the oldest entry of the lowest popoulated level.
+ */
+static struct list_head *queue_peek(struct queue *q)
+{
+	unsigned level;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		if (!list_empty(q->qs + level))
+			return q->qs[level].next;
+
+	return NULL;
+}
+
+static struct list_head *queue_pop(struct queue *q)
+{
+	struct list_head *r = queue_peek(q);
+
+	if (r)
+		list_del(r);
+
+	return r;
+}
+
+/*
+ * Moves every entry of the queue onto @result, lowest level first, so
+ * that the relative order of the entries is preserved.
+ */
+static void queue_drain(struct queue *q, struct list_head *result)
+{
+	unsigned level;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		list_splice_tail_init(q->qs + level, result);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Describes a cache entry.  Used in both the cache and the pre_cache.
+ */
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;	/* valid iff in_cache */
+	unsigned hit_count;
+	bool in_cache:1;
+	bool dirty:1;
+};
+
+#define READ_PROMOTE_ADJUSTMENT_DEFAULT 4
+#define WRITE_PROMOTE_ADJUSTMENT_DEFAULT 8
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	/* protects everything */
+	struct mutex lock;
+
+	struct io_tracker tracker;
+
+	/*
+	 * We maintain three queues of entries.  The cache proper,
+	 * consisting of a clean and dirty queue, contains the currently
+	 * active mappings.  Whereas the pre_cache tracks blocks that are
+	 * being hit frequently and potential candidates for promotion to
+	 * the cache.
+	 *
+	 * Entries are placed on a level according to the log2 of their hit
+	 * count, so the oldest entry of the lowest level is the coldest.
+	 */
+	struct queue pre_cache;
+	struct queue cache_clean;
+	struct queue cache_dirty;
+
+	/*
+	 * Keeps track of time, incremented by the core.  Once a cache's
+	 * worth of lookups has been made every hit count is halved, so old
+	 * hits count for less than recent ones.
+	 */
+	unsigned tick;
+
+	/*
+	 * The pre_cache and cache share a fixed pool of entries, twice the
+	 * size of the cache, allocated up front so that map never has to.
+	 */
+	unsigned nr_entries;
+	struct entry *entries;
+	struct list_head free;
+
+	/*
+	 * Cache blocks may be unallocated.  We store this info in a
+	 * bitset.
+	 */
+	dm_cblock_t cache_size;
+	unsigned long *allocation_bitset;
+	unsigned nr_cblocks_allocated;
+	unsigned find_free_last_word;
+
+	/*
+	 * A block is promoted once its hit count reaches the lowest hit
+	 * count in the cache, plus an adjustment that makes writes, which
+	 * will have to be written back eventually, harder to promote.
+	 */
+	unsigned read_promote_adjustment;
+	unsigned write_promote_adjustment;
+
+	/*
+	 * The hash table allows us to quickly find an entry by origin
+	 * block.
+	 */
+	unsigned hash_bits;
+	struct hlist_head *table;
+};
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Entries come from the preallocated pool; once that has run dry the
+ * coldest pre_cache entry is recycled.
+ */
+static struct entry *alloc_entry(struct mq_policy *mq)
+{
+	struct entry *e;
+
+	if (list_empty(&mq->free))
+		return NULL;
+
+	e = list_first_entry(&mq->free, struct entry, list);
+	list_del_init(&e->list);
+	INIT_HLIST_NODE(&e->hlist);
+
+	return e;
+}
+
+static void free_entry(struct mq_policy *mq, struct entry *e)
+{
+	list_add(&e->list, &mq->free);
+}
+
+/*----------------------------------------------------------------*/
+
+static void hash_insert(struct mq_policy *mq, struct entry *e)
+{
+	unsigned h = hash_64(e->oblock, mq->hash_bits);
+
+	hlist_add_head(&e->hlist, mq->table + h);
+}
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	unsigned h = hash_64(oblock, mq->hash_bits);
+	struct hlist_head *bucket = mq->table + h;
+	struct hlist_node *tmp;
+	struct entry *e;
+
+	hlist_for_each_entry(e, tmp, bucket, hlist)
+		if (e->oblock == oblock) {
+			hlist_del(&e->hlist);
+			hlist_add_head(&e->hlist, bucket);
+			return e;
+		}
+
+	return NULL;
+}
+
+static void hash_remove(struct entry *e)
+{
+	hlist_del(&e->hlist);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool any_free_cblocks(struct mq_policy *mq)
+{
+	return mq->nr_cblocks_allocated < mq->cache_size;
+}
+
+static int alloc_cblock(struct mq_policy *mq, dm_cblock_t *result)
+{
+	unsigned nr_words = BITS_TO_LONGS(mq->cache_size);
+	unsigned w, i;
+
+	if (!any_free_cblocks(mq))
+		return -ENOSPC;
+
+	/*
+	 * Start looking from where the last search left off, so we don't
+	 * keep rescanning a full prefix of the bitset.
+	 */
+	for (w = 0; w < nr_words; w++) {
+		unsigned word = (mq->find_free_last_word + w) % nr_words;
+
+		if (mq->allocation_bitset[word] == ~0UL)
+			continue;
+
+		i = find_next_zero_bit(mq->allocation_bitset, mq->cache_size,
+				       word * BITS_PER_LONG);
+		if (i >= mq->cache_size ||
+		    i >= (word + 1) * BITS_PER_LONG)
+			continue;
+
+		set_bit(i, mq->allocation_bitset);
+		mq->nr_cblocks_allocated++;
+		mq->find_free_last_word = word;
+		*result = i;
+		return 0;
+	}
+
+	return -ENOSPC;
+}
+
+static void free_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	BUG_ON(cblock >= mq->cache_size);
+	BUG_ON(!test_bit(cblock, mq->allocation_bitset));
+
+	clear_bit(cblock, mq->allocation_bitset);
+	mq->nr_cblocks_allocated--;
+}
+
+/*----------------------------------------------------------------*/
+
+static unsigned queue_level(struct entry *e)
+{
+	return min((unsigned) ilog2(e->hit_count + 1), NR_QUEUE_LEVELS - 1u);
+}
+
+static struct queue *entry_queue(struct mq_policy *mq, struct entry *e)
+{
+	if (!e->in_cache)
+		return &mq->pre_cache;
+
+	return e->dirty ? &mq->cache_dirty : &mq->cache_clean;
+}
+
+/*
+ * Inserts the entry into the hash table and the back of the appropriate
+ * queue level.
+ */
+static void push(struct mq_policy *mq, struct entry *e)
+{
+	hash_insert(mq, e);
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+/*
+ * Removes an entry from the hash table and its queue.
+ */
+static void del(struct mq_policy *mq, struct entry *e)
+{
+	queue_remove(&e->list);
+	hash_remove(e);
+}
+
+/*
+ * Moves an entry to the back of its (possibly new) queue level.
+ */
+static void requeue(struct mq_policy *mq, struct entry *e)
+{
+	queue_remove(&e->list);
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+/*
+ * Halves the hit counts of every entry in @q, preserving the order of
+ * the entries within each level.
+ */
+static void age_queue(struct queue *q)
+{
+	struct entry *e, *tmp;
+	struct list_head all;
+
+	INIT_LIST_HEAD(&all);
+	queue_drain(q, &all);
+
+	list_for_each_entry_safe(e, tmp, &all, list) {
+		list_del(&e->list);
+		e->hit_count >>= 1;
+		queue_push(q, queue_level(e), &e->list);
+	}
+}
+
+static void tick(struct mq_policy *mq)
+{
+	if (++mq->tick < mq->cache_size)
+		return;
+
+	mq->tick = 0;
+	age_queue(&mq->pre_cache);
+	age_queue(&mq->cache_clean);
+	age_queue(&mq->cache_dirty);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * The hit count of the coldest cached block, or zero if there's still
+ * room in the cache.
+ */
+static unsigned promote_threshold(struct mq_policy *mq)
+{
+	struct list_head *l;
+
+	if (any_free_cblocks(mq))
+		return 0;
+
+	l = queue_peek(&mq->cache_clean);
+	if (!l)
+		l = queue_peek(&mq->cache_dirty);
+
+	return l ? list_entry(l, struct entry, list)->hit_count : 0;
+}
+
+static bool should_promote(struct mq_policy *mq, struct entry *e, int data_dir)
+{
+	unsigned adjustment = data_dir == READ ?
+		mq->read_promote_adjustment : mq->write_promote_adjustment;
+
+	return e->hit_count + 1 >= promote_threshold(mq) + adjustment;
+}
+
+/*
+ * Finds a pre_cache entry for @oblock, recycling the coldest one if the
+ * pool is exhausted.
+ */
+static struct entry *pre_cache_entry(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e = alloc_entry(mq);
+
+	if (!e) {
+		struct list_head *l = queue_pop(&mq->pre_cache);
+
+		if (!l)
+			return NULL;
+
+		e = list_entry(l, struct entry, list);
+		hash_remove(e);
+	}
+
+	e->oblock = oblock;
+	e->hit_count = 0;
+	e->in_cache = false;
+	e->dirty = false;
+	push(mq, e);
+
+	return e;
+}
+
+/*
+ * Picks the coldest block in the cache to make way for a promotion.
+ * Clean blocks are preferred since they don't need writing back.
+ */
+static struct entry *pop_victim(struct mq_policy *mq)
+{
+	struct list_head *l = queue_pop(&mq->cache_clean);
+
+	if (!l)
+		l = queue_pop(&mq->cache_dirty);
+
+	if (!l)
+		return NULL;
+
+	return list_entry(l, struct entry, list);
+}
+
+static int promote(struct mq_policy *mq, struct entry *e,
+		   struct policy_result *result)
+{
+	struct entry *victim;
+	dm_cblock_t cblock;
+
+	if (!alloc_cblock(mq, &cblock)) {
+		del(mq, e);
+		e->in_cache = true;
+		e->dirty = false;
+		e->cblock = cblock;
+		push(mq, e);
+
+		result->op = POLICY_NEW;
+		result->cblock = cblock;
+		return 0;
+	}
+
+	victim = pop_victim(mq);
+	if (!victim)
+		return -ENOSPC;
+
+	/*
+	 * The victim goes back to the pre_cache with its hit count intact,
+	 * so it can win its place back if it's still being used.
+	 */
+	hash_remove(victim);
+	victim->in_cache = false;
+	victim->dirty = false;
+	push(mq, victim);
+
+	del(mq, e);
+	e->in_cache = true;
+	e->dirty = false;
+	e->cblock = victim->cblock;
+	push(mq, e);
+
+	result->op = POLICY_REPLACE;
+	result->old_oblock = victim->oblock;
+	result->cblock = e->cblock;
+
+	return 0;
+}
+
+static int map(struct mq_policy *mq, dm_oblock_t oblock, bool can_migrate,
+	       int data_dir, struct policy_result *result)
+{
+	bool sequential = iot_pattern(&mq->tracker) == PATTERN_SEQUENTIAL;
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (e && e->in_cache) {
+		if (!sequential) {
+			e->hit_count++;
+			requeue(mq, e);
+		}
+
+		result->op = POLICY_HIT;
+		result->cblock = e->cblock;
+		return 0;
+	}
+
+	/*
+	 * Sequential io is left on the origin, and doesn't warm up the
+	 * pre_cache either.
+	 */
+	if (sequential) {
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	if (!e) {
+		e = pre_cache_entry(mq, oblock);
+		if (!e) {
+			result->op = POLICY_MISS;
+			return 0;
+		}
+	}
+
+	if (!should_promote(mq, e, data_dir)) {
+		e->hit_count++;
+		requeue(mq, e);
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	/*
+	 * Leave the hit count alone, so the core gets the same answer
+	 * when it retries from a context that can migrate.
+	 */
+	if (!can_migrate)
+		return -EWOULDBLOCK;
+
+	e->hit_count++;
+	if (promote(mq, e, result)) {
+		requeue(mq, e);
+		result->op = POLICY_MISS;
+	}
+
+	return 0;
+}
+
+/*----------------------------------------------------------------
+ * Public interface, via the policy struct.  See dm-cache-policy.h for a
+ * description of these.
+ *--------------------------------------------------------------*/
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	vfree(mq->table);
+	vfree(mq->allocation_bitset);
+	vfree(mq->entries);
+	kfree(mq);
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_block, bool can_migrate, struct bio *bio,
+		  struct policy_result *result)
+{
+	int r;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	if (can_block)
+		mutex_lock(&mq->lock);
+	else if (!mutex_trylock(&mq->lock))
+		return -EWOULDBLOCK;
+
+	iot_examine_bio(&mq->tracker, bio);
+	r = map(mq, oblock, can_migrate, bio_data_dir(bio), result);
+	if (!r)
+		tick(mq);
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static int mq_lookup(struct dm_cache_policy *p, dm_oblock_t oblock,
+		     dm_cblock_t *cblock)
+{
+	int r;
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	if (!mutex_trylock(&mq->lock))
+		return -EWOULDBLOCK;
+
+	e = hash_lookup(mq, oblock);
+	if (e && e->in_cache) {
+		*cblock = e->cblock;
+		r = 0;
+	} else
+		r = -ENOENT;
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static void __mq_set_dirty(struct mq_policy *mq, dm_oblock_t oblock, bool dirty)
+{
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (!e || !e->in_cache || e->dirty == dirty)
+		return;
+
+	e->dirty = dirty;
+	requeue(mq, e);
+}
+
+static void mq_set_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_dirty(mq, oblock, true);
+	mutex_unlock(&mq->lock);
+}
+
+static void mq_clear_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_dirty(mq, oblock, false);
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p,
+			   dm_oblock_t oblock, dm_cblock_t cblock,
+			   bool dirty)
+{
+	int r = 0;
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	if (cblock >= mq->cache_size ||
+	    test_bit(cblock, mq->allocation_bitset) ||
+	    hash_lookup(mq, oblock)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	e = alloc_entry(mq);
+	if (!e) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	set_bit(cblock, mq->allocation_bitset);
+	mq->nr_cblocks_allocated++;
+
+	e->oblock = oblock;
+	e->cblock = cblock;
+	e->hit_count = 1;
+	e->in_cache = true;
+	e->dirty = dirty;
+	push(mq, e);
+
+out:
+	mutex_unlock(&mq->lock);
+	return r;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	e = hash_lookup(mq, oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	del(mq, e);
+	free_cblock(mq, e->cblock);
+	e->in_cache = false;
+	e->dirty = false;
+	push(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+static void mq_force_mapping(struct dm_cache_policy *p,
+			     dm_oblock_t current_oblock, dm_oblock_t new_oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	/*
+	 * A pre_cache entry for the new block may exist; it must go
+	 * before the cached entry is rehashed under the same block.
+	 */
+	e = hash_lookup(mq, new_oblock);
+	if (e) {
+		BUG_ON(e->in_cache);
+		del(mq, e);
+		free_entry(mq, e);
+	}
+
+	e = hash_lookup(mq, current_oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	del(mq, e);
+	e->oblock = new_oblock;
+	e->dirty = false;
+	push(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_writeback_work(struct dm_cache_policy *p,
+			     dm_oblock_t *oblock, dm_cblock_t *cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct list_head *l;
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	l = queue_pop(&mq->cache_dirty);
+	if (!l) {
+		mutex_unlock(&mq->lock);
+		return -ENODATA;
+	}
+
+	e = list_entry(l, struct entry, list);
+	e->dirty = false;
+	queue_push(&mq->cache_clean, queue_level(e), &e->list);
+
+	*oblock = e->oblock;
+	*cblock = e->cblock;
+
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	dm_cblock_t r;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	r = mq->nr_cblocks_allocated;
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static int mq_set_config_value(struct dm_cache_policy *p,
+			       const char *key, const char *value)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	unsigned *field;
+	unsigned long tmp;
+
+	if (!strcasecmp(key, "random_threshold"))
+		field = mq->tracker.thresholds + PATTERN_RANDOM;
+
+	else if (!strcasecmp(key, "sequential_threshold"))
+		field = mq->tracker.thresholds + PATTERN_SEQUENTIAL;
+
+	else if (!strcasecmp(key, "read_promote_adjustment"))
+		field = &mq->read_promote_adjustment;
+
+	else if (!strcasecmp(key, "write_promote_adjustment"))
+		field = &mq->write_promote_adjustment;
+
+	else
+		return -EINVAL;
+
+	if (kstrtoul(value, 10, &tmp) || tmp > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&mq->lock);
+	*field = tmp;
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+static int mq_emit_config_values(struct dm_cache_policy *p, char *result,
+				 unsigned maxlen)
+{
+	ssize_t sz = 0;
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	DMEMIT("8 random_threshold %u sequential_threshold %u "
+	       "read_promote_adjustment %u write_promote_adjustment %u",
+	       mq->tracker.thresholds[PATTERN_RANDOM],
+	       mq->tracker.thresholds[PATTERN_SEQUENTIAL],
+	       mq->read_promote_adjustment,
+	       mq->write_promote_adjustment);
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+/* Init the policy plugin interface function pointers. */
+static void init_policy_functions(struct mq_policy *mq)
+{
+	mq->policy.destroy = mq_destroy;
+	mq->policy.map = mq_map;
+	mq->policy.lookup = mq_lookup;
+	mq->policy.set_dirty = mq_set_dirty;
+	mq->policy.clear_dirty = mq_clear_dirty;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.force_mapping = mq_force_mapping;
+	mq->policy.writeback_work = mq_writeback_work;
+	mq->policy.residency = mq_residency;
+	mq->policy.emit_config_values = mq_emit_config_values;
+	mq->policy.set_config_value = mq_set_config_value;
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 sector_t origin_size,
+					 sector_t cache_block_size)
+{
+	unsigned i, nr_buckets;
+	struct mq_policy *mq;
+
+	if (!cache_size ||
+	    cache_size > (ULONG_MAX / sizeof(struct entry)) / 2)
+		return NULL;
+
+	mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+	if (!mq)
+		return NULL;
+
+	init_policy_functions(mq);
+	iot_init(&mq->tracker, SEQUENTIAL_THRESHOLD_DEFAULT, RANDOM_THRESHOLD_DEFAULT);
+	mutex_init(&mq->lock);
+
+	mq->cache_size = cache_size;
+	mq->read_promote_adjustment = READ_PROMOTE_ADJUSTMENT_DEFAULT;
+	mq->write_promote_adjustment = WRITE_PROMOTE_ADJUSTMENT_DEFAULT;
+
+	queue_init(&mq->pre_cache);
+	queue_init(&mq->cache_clean);
+	queue_init(&mq->cache_dirty);
+
+	mq->nr_entries = 2 * cache_size;
+	mq->entries = vzalloc(sizeof(*mq->entries) * mq->nr_entries);
+	if (!mq->entries)
+		goto bad_entries;
+
+	INIT_LIST_HEAD(&mq->free);
+	for (i = 0; i < mq->nr_entries; i++)
+		list_add_tail(&mq->entries[i].list, &mq->free);
+
+	mq->allocation_bitset = vzalloc(BITS_TO_LONGS(cache_size) * sizeof(long));
+	if (!mq->allocation_bitset)
+		goto bad_bitset;
+
+	nr_buckets = 16;
+	while (nr_buckets < cache_size / 2 && nr_buckets < (1u << 30))
+		nr_buckets <<= 1;
+	mq->hash_bits = ffs(nr_buckets) - 1;
+
+	mq->table = vzalloc(sizeof(*mq->table) * nr_buckets);
+	if (!mq->table)
+		goto bad_table;
+
+	return &mq->policy;
+
+bad_table:
+	vfree(mq->allocation_bitset);
+bad_bitset:
+	vfree(mq->entries);
+bad_entries:
+	kfree(mq);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static struct dm_cache_policy_type default_policy_type = {
+	.name = "default",
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static int __init mq_init(void)
+{
+	int r;
+
+	r = dm_cache_policy_register(&mq_policy_type);
+	if (r) {
+		DMERR("register failed %d", r);
+		return r;
+	}
+
+	r = dm_cache_policy_register(&default_policy_type);
+	if (r) {
+		DMERR("register failed (as default) %d", r);
+		dm_cache_policy_unregister(&mq_policy_type);
+		return r;
+	}
+
+	return 0;
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&default_policy_type);
+	dm_cache_policy_unregister(&mq_policy_type);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("mq cache policy");
+
+MODULE_ALIAS("dm-cache-default");
@@ -0,0 +1,1939 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#include "dm.h"
+#include "dm-bio-prison.h"
+#include "dm-bio-record.h"
+#include "dm-cache-metadata.h"
+#include "dm-cache-policy-internal.h"
+
+#include <linux/blkdev.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/init.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * Tunable constants
+ */
+#define ENDIO_HOOK_POOL_SIZE 1024
+#define MIGRATION_POOL_SIZE 128
+#define WRITETHROUGH_POOL_SIZE 16
+#define PRISON_CELLS 1024
+#define WRITEBACK_PERIOD HZ
+
+/*
+ * The block size of the cache device must be between 32KB and 1GB, and
+ * a multiple of 32KB.
+ */
+#define DATA_DEV_BLOCK_SIZE_MIN_SECTORS (32 * 1024 >> SECTOR_SHIFT)
+#define DATA_DEV_BLOCK_SIZE_MAX_SECTORS (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*
+ * By default we let a megabyte's worth of blocks be in flight between
+ * the cache and origin at any one time.
+ */
+#define MIGRATION_THRESHOLD_DEFAULT (1024 * 1024 >> SECTOR_SHIFT)
+
+/*
+ * How does the cache move blocks about?
+ * =====================================
+ *
+ * The policy decides which origin blocks deserve a place on the faster
+ * cache device; the core target does the copying and keeps the on-disk
+ * mappings in step.  Moving a block is called a migration:
+ *
+ * i) plug io further to the origin block(s) concerned (bio prison).
+ *
+ * ii) quiesce any io already in flight to the cache (deferred set), so a
+ * cache block isn't overwritten under a read.
+ *
+ * iii) if a block is being demoted and it's dirty, copy it back to the
+ * origin and flush the origin.
+ *
+ * iv) remove the old mapping and commit, so that after a crash the
+ * metadata never claims a cache block holds data it no longer does.
+ *
+ * v) copy the promoted block from the origin and insert, then commit,
+ * its mapping.
+ *
+ * vi) unplug io, including the bio that triggered the promotion, which
+ * is then remapped to the cache.
+ *
+ * Dirty blocks are also cleaned in the background by copying them back
+ * to the origin while the migration bandwidth allows.
+ *
+ * Writes to the cache never touch the metadata.  Instead the dirty
+ * state of each block is only written out when the cache is suspended,
+ * along with a flag saying that happened.  If that flag is missing when
+ * the cache is next loaded, every cached block is assumed to be dirty.
+ */
+
+/*----------------------------------------------------------------*/
+
+enum cache_io_mode {
+	/*
+	 * Data is written to cached blocks only.  These blocks are marked
+	 * dirty.  If you lose the cache device you will lose data.
+	 */
+	CM_WRITEBACK,
+
+	/*
+	 * Data is written to both cache and origin.  Blocks are never
+	 * dirty.
+	 */
+	CM_WRITETHROUGH
+};
+
+struct cache_features {
+	enum cache_io_mode io_mode;
+};
+
+struct cache_stats {
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t demotion;
+	atomic_t promotion;
+};
+
+struct cache {
+	struct dm_target *ti;
+	struct dm_target_callbacks callbacks;
+
+	struct dm_cache_metadata *cmd;
+
+	/*
+	 * Metadata is written to this device.
+	 */
+	struct dm_dev *metadata_dev;
+
+	/*
+	 * The slower of the two data devices.  Typically a spindle.
+	 */
+	struct dm_dev *origin_dev;
+
+	/*
+	 * The faster of the two data devices.  Typically an SSD.
+	 */
+	struct dm_dev *cache_dev;
+
+	/*
+	 * Size of the origin device in _complete_ blocks.  A partial block
+	 * at the end of the origin is never cached.
+	 */
+	dm_oblock_t origin_blocks;
+
+	/*
+	 * Size of the cache device in blocks.
+	 */
+	dm_cblock_t cache_size;
+
+	/*
+	 * Fields for converting from sectors to blocks.
+	 */
+	sector_t sectors_per_block;
+	int sectors_per_block_shift;
+
+	struct cache_features features;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_writethrough_bios;
+	struct list_head quiesced_migrations;
+	struct list_head completed_migrations;
+	struct list_head need_commit_migrations;
+	sector_t migration_threshold;
+	atomic_t nr_migrations;
+	wait_queue_head_t migration_wait;
+	bool quiescing:1;
+	bool loaded_mappings:1;
+
+	/*
+	 * The dirty state of every cache block, and the dirty state last
+	 * written to the metadata.
+	 */
+	unsigned long *dirty_bitset;
+	unsigned long *metadata_dirty_bitset;
+	atomic_t nr_dirty;
+
+	struct dm_kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	struct dm_bio_prison *prison;
+	struct dm_deferred_set *all_io_ds;
+
+	mempool_t *endio_hook_pool;
+	mempool_t *migration_pool;
+	mempool_t *writethrough_pool;
+	struct dm_cache_migration *next_migration;
+
+	struct dm_cache_policy *policy;
+
+	struct cache_stats stats;
+};
+
+struct dm_cache_endio_hook {
+	struct cache *cache;
+	struct dm_deferred_entry *all_io_entry;
+	struct dm_cache_writethrough *writethrough;
+};
+
+/*
+ * A writethrough write is sent to the origin first, then reissued to the
+ * cache once that has completed.
+ */
+struct dm_cache_writethrough {
+	bio_end_io_t *saved_bi_end_io;
+	dm_cblock_t cblock;
+	struct dm_bio_details bio_details;
+};
+
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+
+	dm_oblock_t old_oblock;
+	dm_oblock_t new_oblock;
+	dm_cblock_t cblock;
+
+	bool err:1;
+	bool writeback:1;
+	bool demote:1;
+	bool promote:1;
+	bool wrote_origin:1;
+
+	struct dm_bio_prison_cell *old_ocell;
+	struct dm_bio_prison_cell *new_ocell;
+};
+
+static struct kmem_cache *_endio_hook_cache;
+static struct kmem_cache *_migration_cache;
+static struct kmem_cache *_writethrough_cache;
+
+/*----------------------------------------------------------------*/
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+static bool writethrough_mode(struct cache_features *f)
+{
+	return f->io_mode == CM_WRITETHROUGH;
+}
+
+static bool is_quiescing(struct cache *cache)
+{
+	bool r;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	r = cache->quiescing;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	return r;
+}
+
+static void set_quiescing(struct cache *cache, bool quiescing)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->quiescing = quiescing;
+	spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+/*----------------------------------------------------------------*/
+
+static bool is_dirty(struct cache *cache, dm_cblock_t b)
+{
+	return test_bit(b, cache->dirty_bitset);
+}
+
+static void set_dirty(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	if (!test_and_set_bit(cblock, cache->dirty_bitset)) {
+		atomic_inc(&cache->nr_dirty);
+		policy_set_dirty(cache->policy, oblock);
+	}
+}
+
+/*
+ * The policy has already been told, either because it handed out the
+ * block for writeback or because the block is no longer cached.
+ */
+static void clear_dirty(struct cache *cache, dm_cblock_t cblock)
+{
+	if (test_and_clear_bit(cblock, cache->dirty_bitset))
+		atomic_dec(&cache->nr_dirty);
+}
+
+/*----------------------------------------------------------------*/
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	sector_t block_nr = bio->bi_sector;
+
+	if (cache->sectors_per_block_shift < 0)
+		(void) sector_div(block_nr, cache->sectors_per_block);
+	else
+		block_nr >>= cache->sectors_per_block_shift;
+
+	return block_nr;
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t bi_sector = bio->bi_sector;
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	if (cache->sectors_per_block_shift < 0)
+		bio->bi_sector = ((sector_t) cblock * cache->sectors_per_block) +
+				 sector_div(bi_sector, cache->sectors_per_block);
+	else
+		bio->bi_sector = ((sector_t) cblock << cache->sectors_per_block_shift) |
+				 (bi_sector & (cache->sectors_per_block - 1));
+}
+
+static void remap_to_cache_dirty(struct cache *cache, struct bio *bio,
+				 dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	remap_to_cache(cache, bio, cblock);
+	if (bio_data_dir(bio) == WRITE)
+		set_dirty(cache, oblock, cblock);
+}
+
+static void build_key(dm_oblock_t oblock, struct dm_cell_key *key)
+{
+	key->virtual = 0;
+	key->dev = 0;
+	key->block = oblock;
+}
+
+/*----------------------------------------------------------------*/
+
+static void inc_hit_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_hit : &cache->stats.write_hit);
+}
+
+static void inc_miss_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_miss : &cache->stats.write_miss);
+}
+
+static void load_stats(struct cache *cache)
+{
+	struct dm_cache_statistics stats;
+
+	dm_cache_metadata_get_stats(cache->cmd, &stats);
+	atomic_set(&cache->stats.read_hit, stats.read_hits);
+	atomic_set(&cache->stats.read_miss, stats.read_misses);
+	atomic_set(&cache->stats.write_hit, stats.write_hits);
+	atomic_set(&cache->stats.write_miss, stats.write_misses);
+}
+
+static void save_stats(struct cache *cache)
+{
+	struct dm_cache_statistics stats;
+
+	stats.read_hits = atomic_read(&cache->stats.read_hit);
+	stats.read_misses = atomic_read(&cache->stats.read_miss);
+	stats.write_hits = atomic_read(&cache->stats.write_hit);
+	stats.write_misses = atomic_read(&cache->stats.write_miss);
+
+	dm_cache_metadata_set_stats(cache->cmd, &stats);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * This sends the bios in the cell back to the deferred_bios list.  The
+ * holder is only included if @holder is set; cells locked on behalf of
+ * background work have no holder.
+ */
+static void cell_defer(struct cache *cache, struct dm_bio_prison_cell *cell,
+		       bool holder)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	if (holder)
+		dm_cell_release(cell, &bios);
+	else
+		dm_cell_release_no_holder(cell, &bios);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&cache->deferred_bios, &bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------
+ * Writethrough
+ *--------------------------------------------------------------*/
+static void writethrough_endio(struct bio *bio, int err)
+{
+	unsigned long flags;
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+	struct dm_cache_writethrough *wt = h->writethrough;
+	struct cache *cache = h->cache;
+
+	bio->bi_end_io = wt->saved_bi_end_io;
+
+	if (err) {
+		bio_endio(bio, err);
+		return;
+	}
+
+	dm_bio_restore(&wt->bio_details, bio);
+	remap_to_cache(cache, bio, wt->cblock);
+
+	/*
+	 * We can't issue this bio directly, since we're in interrupt
+	 * context.  So it gets put on a bio list for processing by the
+	 * worker thread.
+	 */
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_writethrough_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*
+ * Writes go to the origin first, then to the cache from the endio
+ * function, so the cache never holds data the origin doesn't.
+ */
+static void remap_to_origin_then_cache(struct cache *cache, struct bio *bio,
+				       dm_cblock_t cblock)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+	struct dm_cache_writethrough *wt;
+
+	wt = mempool_alloc(cache->writethrough_pool, GFP_NOIO);
+	wt->cblock = cblock;
+	wt->saved_bi_end_io = bio->bi_end_io;
+	dm_bio_record(&wt->bio_details, bio);
+	h->writethrough = wt;
+
+	bio->bi_end_io = writethrough_endio;
+	remap_to_origin(cache, bio);
+}
+
+static bool is_writethrough_io(struct cache *cache, struct bio *bio)
+{
+	return writethrough_mode(&cache->features) &&
+		bio_data_dir(bio) == WRITE;
+}
+
+/*
+ * A hit is remapped to the cache.  Every bio sent to the cache is
+ * entered in the all_io deferred set, so migrations can wait for it.
+ */
+static void remap_hit(struct cache *cache, struct bio *bio,
+		      dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	inc_hit_counter(cache, bio);
+	h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+
+	if (is_writethrough_io(cache, bio))
+		remap_to_origin_then_cache(cache, bio, cblock);
+	else
+		remap_to_cache_dirty(cache, bio, oblock, cblock);
+}
+
+/*----------------------------------------------------------------
+ * Migration processing
+ *
+ * Migration covers moving data from the origin device to the cache, or
+ * vice versa.
+ *--------------------------------------------------------------*/
+static int ensure_next_migration(struct cache *cache)
+{
+	if (cache->next_migration)
+		return 0;
+
+	cache->next_migration = mempool_alloc(cache->migration_pool, GFP_ATOMIC);
+
+	return cache->next_migration ? 0 : -ENOMEM;
+}
+
+static struct dm_cache_migration *get_next_migration(struct cache *cache)
+{
+	struct dm_cache_migration *mg = cache->next_migration;
+
+	BUG_ON(!mg);
+	cache->next_migration = NULL;
+
+	memset(mg, 0, sizeof(*mg));
+	INIT_LIST_HEAD(&mg->list);
+	mg->cache = cache;
+	atomic_inc(&cache->nr_migrations);
+
+	return mg;
+}
+
+static void cleanup_migration(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	mempool_free(mg, cache->migration_pool);
+	if (atomic_dec_and_test(&cache->nr_migrations))
+		wake_up(&cache->migration_wait);
+}
+
+/*
+ * Is there room to start another migration without eating into the
+ * bandwidth left for io?
+ */
+static bool spare_migration_bandwidth(struct cache *cache)
+{
+	sector_t current_volume = (atomic_read(&cache->nr_migrations) + 1) *
+		cache->sectors_per_block;
+
+	return current_volume < cache->migration_threshold;
+}
+
+static void __queue_migration(struct dm_cache_migration *mg,
+			      struct list_head *head)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, head);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct dm_cache_migration *mg = context;
+
+	if (read_err || write_err)
+		mg->err = true;
+
+	__queue_migration(mg, &mg->cache->completed_migrations);
+}
+
+static void issue_copy(struct dm_cache_migration *mg)
+{
+	int r;
+	struct dm_io_region o_region, c_region;
+	struct cache *cache = mg->cache;
+	bool to_origin = mg->writeback || mg->demote;
+
+	/*
+	 * A clean block being demoted has nothing to copy.
+	 */
+	if (mg->demote && !is_dirty(cache, mg->cblock)) {
+		__queue_migration(mg, &cache->completed_migrations);
+		return;
+	}
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.sector = (to_origin ? mg->old_oblock : mg->new_oblock) *
+		cache->sectors_per_block;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t) mg->cblock * cache->sectors_per_block;
+	c_region.count = cache->sectors_per_block;
+
+	if (to_origin) {
+		mg->wrote_origin = true;
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region,
+				   0, copy_complete, mg);
+	} else
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region,
+				   0, copy_complete, mg);
+
+	if (r < 0) {
+		DMERR_LIMIT("issuing migration failed");
+		copy_complete(1, 1, mg);
+	}
+}
+
+/*
+ * Migrations start once all io previously sent to the cache has
+ * completed.
+ */
+static void quiesce_migration(struct dm_cache_migration *mg)
+{
+	if (!dm_deferred_set_add_work(mg->cache->all_io_ds, &mg->list))
+		__queue_migration(mg, &mg->cache->quiesced_migrations);
+}
+
+static void promote(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock,
+		    struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->promote = true;
+	mg->new_oblock = oblock;
+	mg->cblock = cblock;
+	mg->new_ocell = cell;
+
+	quiesce_migration(mg);
+}
+
+static void writeback(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock,
+		      struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->writeback = true;
+	mg->old_oblock = oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = cell;
+
+	quiesce_migration(mg);
+}
+
+static void demote_then_promote(struct cache *cache, dm_oblock_t old_oblock,
+				dm_oblock_t new_oblock, dm_cblock_t cblock,
+				struct dm_bio_prison_cell *old_ocell,
+				struct dm_bio_prison_cell *new_ocell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->demote = true;
+	mg->promote = true;
+	mg->old_oblock = old_oblock;
+	mg->new_oblock = new_oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = old_ocell;
+	mg->new_ocell = new_ocell;
+
+	quiesce_migration(mg);
+}
+
+/*
+ * Puts the policy back the way it was before it handed out a promotion
+ * that couldn't be completed.
+ */
+static void revert_policy(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->demote) {
+		policy_force_mapping(cache->policy, mg->new_oblock, mg->old_oblock);
+		if (is_dirty(cache, mg->cblock))
+			policy_set_dirty(cache->policy, mg->old_oblock);
+	} else
+		policy_remove_mapping(cache->policy, mg->new_oblock);
+}
+
+static void migration_failure(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		DMWARN_LIMIT("writeback failed; couldn't copy block");
+		policy_set_dirty(cache->policy, mg->old_oblock);
+		cell_defer(cache, mg->old_ocell, false);
+
+	} else {
+		DMWARN_LIMIT("%s failed; couldn't copy block",
+			     mg->demote ? "demotion" : "promotion");
+		revert_policy(mg);
+		if (mg->demote)
+			cell_defer(cache, mg->old_ocell, false);
+		dm_cell_error(mg->new_ocell);
+	}
+
+	cleanup_migration(mg);
+}
+
+static void migration_success_pre_commit(struct dm_cache_migration *mg)
+{
+	int r;
+	struct cache *cache = mg->cache;
+
+	if (mg->writeback) {
+		clear_dirty(cache, mg->cblock);
+		cell_defer(cache, mg->old_ocell, false);
+		cleanup_migration(mg);
+		return;
+	}
+
+	if (mg->demote) {
+		r = dm_cache_remove_mapping(cache->cmd, mg->cblock);
+		if (!r)
+			clear_bit(mg->cblock, cache->metadata_dirty_bitset);
+	} else
+		r = dm_cache_insert_mapping(cache->cmd, mg->cblock,
+					    mg->new_oblock, false);
+
+	if (r) {
+		DMWARN_LIMIT("%s failed; couldn't update on disk metadata",
+			     mg->demote ? "demotion" : "promotion");
+		mg->err = true;
+		migration_failure(mg);
+		return;
+	}
+
+	list_add_tail(&mg->list, &cache->need_commit_migrations);
+}
+
+static void migration_success_post_commit(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->demote) {
+		/*
+		 * The cache block is free on disk now, so it's safe to
+		 * overwrite it.
+		 */
+		clear_dirty(cache, mg->cblock);
+		cell_defer(cache, mg->old_ocell, false);
+		mg->demote = false;
+		mg->wrote_origin = false;
+
+		if (mg->promote) {
+			issue_copy(mg);
+			return;
+		}
+	} else
+		cell_defer(cache, mg->new_ocell, true);
+
+	cleanup_migration(mg);
+}
+
+static void complete_migration(struct dm_cache_migration *mg)
+{
+	if (mg->err)
+		migration_failure(mg);
+	else
+		migration_success_pre_commit(mg);
+}
+
+static void process_migrations(struct cache *cache, struct list_head *head,
+			       void (*fn)(struct dm_cache_migration *))
+{
+	unsigned long flags;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	INIT_LIST_HEAD(&list);
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(head, &list);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		list_del_init(&mg->list);
+		fn(mg);
+	}
+}
+
+/*
+ * Commits the metadata changes made by the completed migrations, then
+ * lets them continue.  Demoted blocks that were copied back must be on
+ * stable storage before the metadata forgets about the cached copy.
+ */
+static void commit_migrations(struct cache *cache)
+{
+	int r;
+	bool flush_origin = false;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	if (list_empty(&cache->need_commit_migrations))
+		return;
+
+	INIT_LIST_HEAD(&list);
+	list_splice_init(&cache->need_commit_migrations, &list);
+
+	list_for_each_entry(mg, &list, list)
+		if (mg->wrote_origin)
+			flush_origin = true;
+
+	r = flush_origin ?
+		blkdev_issue_flush(cache->origin_dev->bdev, GFP_NOIO, NULL) : 0;
+	if (!r)
+		r = dm_cache_commit(cache->cmd, false);
+	if (r)
+		DMERR_LIMIT("commit failed, error = %d", r);
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		list_del_init(&mg->list);
+		if (r) {
+			mg->err = true;
+			migration_failure(mg);
+		} else
+			migration_success_post_commit(mg);
+	}
+}
+
+/*----------------------------------------------------------------
+ * bio processing
+ *--------------------------------------------------------------*/
+static void process_bio(struct cache *cache, struct bio *bio)
+{
+	int r;
+	bool release_cell = true;
+	dm_oblock_t block = get_bio_block(cache, bio);
+	struct dm_bio_prison_cell *old_ocell, *new_ocell;
+	struct dm_cell_key key;
+	struct policy_result lookup_result;
+	bool can_migrate = !is_quiescing(cache) &&
+		spare_migration_bandwidth(cache);
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	build_key(block, &key);
+	if (dm_bio_detain(cache->prison, &key, bio, &new_ocell) > 0)
+		return;
+
+	r = policy_map(cache->policy, block, true, can_migrate, bio, &lookup_result);
+	if (r == -EWOULDBLOCK)
+		/* migration has been denied */
+		lookup_result.op = POLICY_MISS;
+
+	else if (r) {
+		DMERR_LIMIT("Unexpected return from cache replacement policy: %d", r);
+		bio_io_error(bio);
+		cell_defer(cache, new_ocell, false);
+		return;
+	}
+
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+		remap_hit(cache, bio, block, lookup_result.cblock);
+		generic_make_request(bio);
+		break;
+
+	case POLICY_MISS:
+		inc_miss_counter(cache, bio);
+		remap_to_origin(cache, bio);
+		generic_make_request(bio);
+		break;
+
+	case POLICY_NEW:
+		atomic_inc(&cache->stats.promotion);
+		promote(cache, block, lookup_result.cblock, new_ocell);
+		release_cell = false;
+		break;
+
+	case POLICY_REPLACE:
+		build_key(lookup_result.old_oblock, &key);
+		if (dm_bio_detain(cache->prison, &key, NULL, &old_ocell) > 0) {
+			/*
+			 * We have to be careful to avoid lock inversion of
+			 * the cells.  So we back off, and treat this io as a
+			 * miss.
+			 */
+			policy_force_mapping(cache->policy, block,
+					     lookup_result.old_oblock);
+			if (is_dirty(cache, lookup_result.cblock))
+				policy_set_dirty(cache->policy,
+						 lookup_result.old_oblock);
+
+			inc_miss_counter(cache, bio);
+			remap_to_origin(cache, bio);
+			generic_make_request(bio);
+			break;
+		}
+
+		atomic_inc(&cache->stats.demotion);
+		atomic_inc(&cache->stats.promotion);
+		demote_then_promote(cache, lookup_result.old_oblock, block,
+				    lookup_result.cblock, old_ocell, new_ocell);
+		release_cell = false;
+		break;
+
+	default:
+		DMERR_LIMIT("%s: erroring bio, unknown policy op: %u", __func__,
+			    (unsigned) lookup_result.op);
+		bio_io_error(bio);
+	}
+
+	if (release_cell)
+		cell_defer(cache, new_ocell, false);
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_bios);
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		/*
+		 * If we've got no free migration structs, and processing
+		 * this bio might require one, we pause until there are some
+		 * prepared migrations to process.
+		 */
+		if (ensure_next_migration(cache)) {
+			spin_lock_irqsave(&cache->lock, flags);
+			bio_list_merge(&cache->deferred_bios, &bios);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			break;
+		}
+
+		process_bio(cache, bio);
+	}
+}
+
+static void process_deferred_writethrough_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_writethrough_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+/*
+ * Copies dirty blocks back to the origin while there's spare migration
+ * bandwidth.
+ */
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	struct dm_cell_key key;
+	struct dm_bio_prison_cell *old_ocell;
+
+	while (spare_migration_bandwidth(cache)) {
+		if (ensure_next_migration(cache))
+			break;
+
+		if (policy_writeback_work(cache->policy, &oblock, &cblock))
+			break;
+
+		if (!is_dirty(cache, cblock))
+			continue;
+
+		build_key(oblock, &key);
+		if (dm_bio_detain(cache->prison, &key, NULL, &old_ocell) > 0) {
+			/*
+			 * The block is busy; try again later.
+			 */
+			policy_set_dirty(cache->policy, oblock);
+			break;
+		}
+
+		writeback(cache, oblock, cblock, old_ocell);
+	}
+}
+
+/*----------------------------------------------------------------
+ * Main worker loop
+ *--------------------------------------------------------------*/
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_deferred_bios(cache);
+	process_migrations(cache, &cache->quiesced_migrations, issue_copy);
+	process_migrations(cache, &cache->completed_migrations, complete_migration);
+	commit_migrations(cache);
+
+	if (!is_quiescing(cache))
+		writeback_some_dirty_blocks(cache);
+
+	process_deferred_writethrough_bios(cache);
+}
+
+/*
+ * We want to clean dirty blocks in the background, even when there's no
+ * io to wake the worker.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache, waker);
+
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, WRITEBACK_PERIOD);
+}
+
+/*----------------------------------------------------------------*/
+
+static int is_congested(struct dm_dev *dev, int bdi_bits)
+{
+	struct request_queue *q = bdev_get_queue(dev->bdev);
+	return bdi_congested(&q->backing_dev_info, bdi_bits);
+}
+
+static int cache_is_congested(struct dm_target_callbacks *cb, int bdi_bits)
+{
+	struct cache *cache = container_of(cb, struct cache, callbacks);
+
+	return is_congested(cache->origin_dev, bdi_bits) ||
+		is_congested(cache->cache_dev, bdi_bits);
+}
+
+/*----------------------------------------------------------------
+ * Target methods
+ *--------------------------------------------------------------*/
+static void destroy(struct cache *cache)
+{
+	if (cache->next_migration)
+		mempool_free(cache->next_migration, cache->migration_pool);
+
+	if (cache->writethrough_pool)
+		mempool_destroy(cache->writethrough_pool);
+
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+
+	if (cache->endio_hook_pool)
+		mempool_destroy(cache->endio_hook_pool);
+
+	if (cache->all_io_ds)
+		dm_deferred_set_destroy(cache->all_io_ds);
+
+	if (cache->prison)
+		dm_bio_prison_destroy(cache->prison);
+
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+
+	vfree(cache->metadata_dirty_bitset);
+	vfree(cache->dirty_bitset);
+
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+
+	if (cache->cmd)
+		dm_cache_metadata_close(cache->cmd);
+
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+
+	kfree(cache);
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	destroy(ti->private);
+}
+
+static int parse_features(struct dm_arg_set *as, struct cache_features *cf,
+			  struct dm_target *ti)
+{
+	int r = 0;
+	unsigned argc;
+	const char *arg;
+
+	static struct dm_arg _args[] = {
+		{0, 1, "Invalid number of cache feature arguments"},
+	};
+
+	r = dm_read_arg_group(_args, as, &argc, &ti->error);
+	if (r)
+		return -EINVAL;
+
+	while (argc && !r) {
+		arg = dm_shift_arg(as);
+		argc--;
+
+		if (!strcasecmp(arg, "writeback"))
+			cf->io_mode = CM_WRITEBACK;
+
+		else if (!strcasecmp(arg, "writethrough"))
+			cf->io_mode = CM_WRITETHROUGH;
+
+		else {
+			ti->error = "Unrecognised cache feature requested";
+			r = -EINVAL;
+		}
+	}
+
+	return r;
+}
+
+static int set_config_value(struct cache *cache, const char *key,
+			    const char *value)
+{
+	unsigned long tmp;
+
+	if (!strcasecmp(key, "migration_threshold")) {
+		if (kstrtoul(value, 10, &tmp))
+			return -EINVAL;
+
+		cache->migration_threshold = tmp;
+		return 0;
+	}
+
+	return policy_set_config_value(cache->policy, key, value);
+}
+
+static int parse_policy_args(struct dm_arg_set *as, struct cache *cache,
+			     struct dm_target *ti)
+{
+	int r;
+	unsigned argc;
+	const char *key, *value;
+
+	static struct dm_arg _args[] = {
+		{0, 1024, "Invalid number of policy arguments"},
+	};
+
+	r = dm_read_arg_group(_args, as, &argc, &ti->error);
+	if (r)
+		return -EINVAL;
+
+	if (argc & 1) {
+		ti->error = "Policy arguments must be key value pairs";
+		return -EINVAL;
+	}
+
+	while (argc) {
+		key = dm_shift_arg(as);
+		value = dm_shift_arg(as);
+		argc -= 2;
+
+		if (set_config_value(cache, key, value)) {
+			ti->error = "Error setting cache policy argument";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a cache device mapping.
+ *
+ * cache <metadata dev> <cache dev> <origin dev> <block size>
+ *       <#feature args> [<feature arg>]*
+ *       <policy> <#policy args> [<policy arg>]*
+ *
+ * metadata dev    : fast device holding the persistent metadata
+ * cache dev	   : fast device holding cached data blocks
+ * origin dev	   : slow device holding original data blocks
+ * block size	   : cache unit size in sectors
+ *
+ * #feature args   : number of feature arguments passed
+ * feature args    : writethrough.  (The default is writeback.)
+ *
+ * policy	   : the replacement policy to use
+ * #policy args    : an even number of policy arguments corresponding
+ *		     to key/value pairs passed to the policy
+ * policy args	   : key/value pairs passed to the policy
+ *		     E.g. 'sequential_threshold 1024'
+ *		     See cache-policies.txt for details.
+ *
+ * Optional feature arguments are:
+ *   writethrough  : write through caching that prohibits cache block
+ *		     content from being different from origin block content.
+ *		     Without this argument, the default behaviour is to write
+ *		     back cache block contents later for performance reasons,
+ *		     so they may differ from the corresponding origin blocks.
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	struct cache *cache;
+	struct dm_arg_set as;
+	unsigned long block_size;
+	sector_t origin_blocks, cache_blocks;
+	const char *policy_name;
+	char b[BDEVNAME_SIZE];
+
+	if (argc < 7) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Error allocating memory for cache";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	ti->private = cache;
+	as.argc = argc;
+	as.argv = argv;
+
+	r = dm_get_device(ti, dm_shift_arg(&as), FMODE_READ | FMODE_WRITE,
+			  &cache->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad;
+	}
+
+	if (get_dev_size(cache->metadata_dev) > DM_CACHE_METADATA_MAX_SECTORS_WARNING)
+		DMWARN("Metadata device %s is larger than %u sectors: excess space will not be used.",
+		       bdevname(cache->metadata_dev->bdev, b),
+		       DM_CACHE_METADATA_MAX_SECTORS);
+
+	r = dm_get_device(ti, dm_shift_arg(&as), FMODE_READ | FMODE_WRITE,
+			  &cache->cache_dev);
+	if (r) {
+		ti->error = "Error opening cache device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, dm_shift_arg(&as), FMODE_READ | FMODE_WRITE,
+			  &cache->origin_dev);
+	if (r) {
+		ti->error = "Error opening origin device";
+		goto bad;
+	}
+
+	r = -EINVAL;
+	if (kstrtoul(dm_shift_arg(&as), 10, &block_size) ||
+	    block_size < DATA_DEV_BLOCK_SIZE_MIN_SECTORS ||
+	    block_size > DATA_DEV_BLOCK_SIZE_MAX_SECTORS ||
+	    block_size & (DATA_DEV_BLOCK_SIZE_MIN_SECTORS - 1)) {
+		ti->error = "Invalid data block size";
+		goto bad;
+	}
+
+	cache->sectors_per_block = block_size;
+	if (block_size & (block_size - 1))
+		cache->sectors_per_block_shift = -1;
+	else
+		cache->sectors_per_block_shift = __ffs(block_size);
+
+	origin_blocks = ti->len;
+	(void) sector_div(origin_blocks, block_size);
+	cache->origin_blocks = origin_blocks;
+
+	cache_blocks = get_dev_size(cache->cache_dev);
+	(void) sector_div(cache_blocks, block_size);
+	if (!cache_blocks || cache_blocks > UINT_MAX) {
+		ti->error = "Invalid cache device size";
+		goto bad;
+	}
+	cache->cache_size = cache_blocks;
+
+	cache->features.io_mode = CM_WRITEBACK;
+	r = parse_features(&as, &cache->features, ti);
+	if (r)
+		goto bad;
+
+	if (!as.argc) {
+		ti->error = "No cache policy given";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	policy_name = dm_shift_arg(&as);
+	cache->policy = dm_cache_policy_create(policy_name, cache->cache_size,
+					       ti->len, block_size);
+	if (!cache->policy) {
+		ti->error = "Error creating cache's policy";
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	cache->migration_threshold = MIGRATION_THRESHOLD_DEFAULT;
+	r = parse_policy_args(&as, cache, ti);
+	if (r)
+		goto bad;
+
+	if (as.argc) {
+		ti->error = "Too many arguments";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	r = dm_set_target_max_io_len(ti, cache->sectors_per_block);
+	if (r)
+		goto bad;
+
+	ti->num_flush_requests = 2;
+	ti->discard_zeroes_data_unsupported = true;
+
+	cache->cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+					    block_size, true);
+	if (IS_ERR(cache->cmd)) {
+		ti->error = "Error creating metadata object";
+		r = PTR_ERR(cache->cmd);
+		cache->cmd = NULL;
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	cache->dirty_bitset = vzalloc(BITS_TO_LONGS(cache->cache_size) * sizeof(long));
+	if (!cache->dirty_bitset) {
+		ti->error = "Couldn't allocate dirty bitset";
+		goto bad;
+	}
+
+	cache->metadata_dirty_bitset = vzalloc(BITS_TO_LONGS(cache->cache_size) * sizeof(long));
+	if (!cache->metadata_dirty_bitset) {
+		ti->error = "Couldn't allocate metadata dirty bitset";
+		goto bad;
+	}
+
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	INIT_LIST_HEAD(&cache->quiesced_migrations);
+	INIT_LIST_HEAD(&cache->completed_migrations);
+	INIT_LIST_HEAD(&cache->need_commit_migrations);
+	atomic_set(&cache->nr_migrations, 0);
+	init_waitqueue_head(&cache->migration_wait);
+	atomic_set(&cache->nr_dirty, 0);
+
+	cache->copier = dm_kcopyd_client_create();
+	if (IS_ERR(cache->copier)) {
+		ti->error = "Couldn't create kcopyd client";
+		r = PTR_ERR(cache->copier);
+		cache->copier = NULL;
+		goto bad;
+	}
+
+	cache->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	if (!cache->wq) {
+		ti->error = "Couldn't create workqueue for metadata object";
+		goto bad;
+	}
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+
+	cache->prison = dm_bio_prison_create(PRISON_CELLS);
+	if (!cache->prison) {
+		ti->error = "Couldn't create bio prison";
+		goto bad;
+	}
+
+	cache->all_io_ds = dm_deferred_set_create();
+	if (!cache->all_io_ds) {
+		ti->error = "Couldn't create all_io deferred set";
+		goto bad;
+	}
+
+	cache->endio_hook_pool = mempool_create_slab_pool(ENDIO_HOOK_POOL_SIZE,
+							  _endio_hook_cache);
+	if (!cache->endio_hook_pool) {
+		ti->error = "Error creating cache's endio_hook mempool";
+		goto bad;
+	}
+
+	cache->migration_pool = mempool_create_slab_pool(MIGRATION_POOL_SIZE,
+							 _migration_cache);
+	if (!cache->migration_pool) {
+		ti->error = "Error creating cache's migration mempool";
+		goto bad;
+	}
+
+	cache->writethrough_pool = mempool_create_slab_pool(WRITETHROUGH_POOL_SIZE,
+							    _writethrough_cache);
+	if (!cache->writethrough_pool) {
+		ti->error = "Error creating cache's writethrough mempool";
+		goto bad;
+	}
+
+	cache->callbacks.congested_fn = cache_is_congested;
+	dm_table_add_target_callbacks(ti->table, &cache->callbacks);
+
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static struct dm_cache_endio_hook *hook_bio(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = mempool_alloc(cache->endio_hook_pool, GFP_NOIO);
+
+	h->cache = cache;
+	h->all_io_entry = NULL;
+	h->writethrough = NULL;
+
+	return h;
+}
+
+/*
+ * Non-blocking fast path.  Anything that might need a migration is
+ * handed to the worker.
+ */
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	int r;
+	struct cache *cache = ti->private;
+	dm_oblock_t block;
+	struct dm_cell_key key;
+	struct dm_bio_prison_cell *cell;
+	struct policy_result lookup_result;
+
+	map_context->ptr = hook_bio(cache, bio);
+
+	/*
+	 * Flushes carry no data, so they don't need to wait for any
+	 * metadata: mappings are committed before io is sent to them.
+	 */
+	if (bio->bi_rw & REQ_FLUSH) {
+		BUG_ON(bio->bi_size);
+		if (!map_context->target_request_nr)
+			remap_to_origin(cache, bio);
+		else
+			bio->bi_bdev = cache->cache_dev->bdev;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+	block = get_bio_block(cache, bio);
+
+	if (unlikely(block >= cache->origin_blocks)) {
+		/*
+		 * This can only occur if the io goes to a partial block at
+		 * the end of the origin device.  We don't cache these.
+		 * Just remap to the origin and carry on.
+		 */
+		remap_to_origin(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	build_key(block, &key);
+	if (dm_bio_detain(cache->prison, &key, bio, &cell) > 0)
+		return DM_MAPIO_SUBMITTED;
+
+	r = policy_map(cache->policy, block, false, false, bio, &lookup_result);
+	if (r == -EWOULDBLOCK) {
+		cell_defer(cache, cell, true);
+		return DM_MAPIO_SUBMITTED;
+
+	} else if (r) {
+		DMERR_LIMIT("Unexpected return from cache replacement policy: %d", r);
+		bio_io_error(bio);
+		cell_defer(cache, cell, false);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	r = DM_MAPIO_REMAPPED;
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+		remap_hit(cache, bio, block, lookup_result.cblock);
+		break;
+
+	case POLICY_MISS:
+		inc_miss_counter(cache, bio);
+		remap_to_origin(cache, bio);
+		break;
+
+	default:
+		DMERR_LIMIT("%s: erroring bio: unknown policy op: %u", __func__,
+			    (unsigned) lookup_result.op);
+		bio_io_error(bio);
+		r = DM_MAPIO_SUBMITTED;
+	}
+
+	cell_defer(cache, cell, false);
+
+	return r;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	unsigned long flags;
+	struct cache *cache = ti->private;
+	struct dm_cache_endio_hook *h = map_context->ptr;
+	struct dm_cache_migration *mg, *tmp;
+	struct list_head work;
+
+	if (h->all_io_entry) {
+		INIT_LIST_HEAD(&work);
+		dm_deferred_entry_dec(h->all_io_entry, &work);
+
+		if (!list_empty(&work)) {
+			spin_lock_irqsave(&cache->lock, flags);
+			list_for_each_entry_safe(mg, tmp, &work, list)
+				list_move_tail(&mg->list, &cache->quiesced_migrations);
+			spin_unlock_irqrestore(&cache->lock, flags);
+
+			wake_worker(cache);
+		}
+	}
+
+	if (h->writethrough)
+		mempool_free(h->writethrough, cache->writethrough_pool);
+
+	mempool_free(h, cache->endio_hook_pool);
+
+	return 0;
+}
+
+/*
+ * Writes the dirty bits that have changed since they were last written,
+ * stats, and a clean shutdown flag.
+ */
+static int write_dirty_bitset(struct cache *cache)
+{
+	int r;
+	dm_cblock_t i;
+	bool dirty;
+
+	for (i = 0; i < cache->cache_size; i++) {
+		dirty = is_dirty(cache, i);
+		if (dirty == !!test_bit(i, cache->metadata_dirty_bitset))
+			continue;
+
+		r = dm_cache_set_dirty(cache->cmd, i, dirty);
+		if (r)
+			return r;
+
+		if (dirty)
+			set_bit(i, cache->metadata_dirty_bitset);
+		else
+			clear_bit(i, cache->metadata_dirty_bitset);
+	}
+
+	return 0;
+}
+
+static bool sync_metadata(struct cache *cache)
+{
+	int r1, r2, r3;
+
+	r1 = write_dirty_bitset(cache);
+	if (r1)
+		DMERR("could not write dirty bitset");
+
+	save_stats(cache);
+
+	/*
+	 * Blocks cleaned by writeback are only clean once the origin has
+	 * them on stable storage.
+	 */
+	r2 = blkdev_issue_flush(cache->origin_dev->bdev, GFP_NOIO, NULL);
+	if (r2)
+		DMERR("could not flush origin device");
+
+	r3 = dm_cache_commit(cache->cmd, !r1 && !r2);
+	if (r3)
+		DMERR("could not commit metadata for accurate status");
+
+	return !r1 && !r2 && !r3;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	set_quiescing(cache, true);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cancel_delayed_work(&cache->waker);
+	flush_workqueue(cache->wq);
+	wait_event(cache->migration_wait, !atomic_read(&cache->nr_migrations));
+	flush_workqueue(cache->wq);
+
+	(void) sync_metadata(cache);
+}
+
+struct load_mapping_context {
+	struct cache *cache;
+	bool clean_shutdown;
+	unsigned long *invalid;
+};
+
+static int load_mapping(void *context, dm_oblock_t oblock, dm_cblock_t cblock,
+			bool dirty)
+{
+	int r;
+	struct load_mapping_context *lmc = context;
+	struct cache *cache = lmc->cache;
+	bool recorded_dirty = dirty;
+
+	if (cblock >= cache->cache_size) {
+		DMERR("cache block %u is beyond the end of the cache device",
+		      (unsigned) cblock);
+		return -EINVAL;
+	}
+
+	dirty = dirty || !lmc->clean_shutdown;
+
+	if (oblock >= cache->origin_blocks) {
+		/*
+		 * The origin has shrunk.  Clean blocks beyond its end can
+		 * simply be dropped, but dirty data would be lost.
+		 */
+		if (dirty) {
+			DMERR("dirty origin block %llu is beyond the end of the origin device",
+			      (unsigned long long) oblock);
+			return -EINVAL;
+		}
+
+		set_bit(cblock, lmc->invalid);
+		return 0;
+	}
+
+	r = policy_load_mapping(cache->policy, oblock, cblock, dirty);
+	if (r)
+		return r;
+
+	if (recorded_dirty)
+		set_bit(cblock, cache->metadata_dirty_bitset);
+
+	if (dirty) {
+		set_bit(cblock, cache->dirty_bitset);
+		atomic_inc(&cache->nr_dirty);
+	}
+
+	return 0;
+}
+
+static int load_mappings(struct cache *cache)
+{
+	int r;
+	dm_cblock_t i;
+	struct load_mapping_context lmc;
+
+	lmc.cache = cache;
+	lmc.clean_shutdown = dm_cache_clean_shutdown(cache->cmd);
+	lmc.invalid = vzalloc(BITS_TO_LONGS(cache->cache_size) * sizeof(long));
+	if (!lmc.invalid)
+		return -ENOMEM;
+
+	if (!lmc.clean_shutdown)
+		DMWARN("cache wasn't shut down cleanly; treating every cached block as dirty");
+
+	r = dm_cache_load_mappings(cache->cmd, load_mapping, &lmc);
+	if (r) {
+		DMERR("could not load cache mappings");
+		goto out;
+	}
+
+	for (i = 0; i < cache->cache_size; i++) {
+		if (!test_bit(i, lmc.invalid))
+			continue;
+
+		r = dm_cache_remove_mapping(cache->cmd, i);
+		if (r) {
+			DMERR("could not remove cache mapping beyond the end of the origin");
+			goto out;
+		}
+	}
+
+	load_stats(cache);
+out:
+	vfree(lmc.invalid);
+	return r;
+}
+
+static int cache_preresume(struct dm_target *ti)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	if (!cache->loaded_mappings) {
+		r = load_mappings(cache);
+		if (r)
+			return r;
+
+		cache->loaded_mappings = true;
+	}
+
+	/*
+	 * The cache device may have changed size since the metadata was
+	 * written.  Shrinking is only a problem if the blocks lost were in
+	 * use, which load_mappings() has already checked.
+	 */
+	if (dm_cache_size(cache->cmd) != cache->cache_size) {
+		r = dm_cache_resize(cache->cmd, cache->cache_size);
+		if (r) {
+			DMERR("could not resize cache metadata");
+			return r;
+		}
+	}
+
+	/*
+	 * Clear the clean shutdown flag; from here until the next suspend
+	 * the recorded dirty bits can't be trusted.
+	 */
+	r = dm_cache_commit(cache->cmd, false);
+	if (r)
+		DMERR("could not commit metadata");
+
+	return r;
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	set_quiescing(cache, false);
+	do_waker(&cache->waker.work);
+}
+
+/*
+ * Status format:
+ *
+ * <#used metadata blocks>/<#total metadata blocks>
+ * <#read hits> <#read misses> <#write hits> <#write misses>
+ * <#demotions> <#promotions> <#blocks in cache> <#dirty>
+ * <#features> <features>*
+ * <#core args> <core args>
+ * <policy name> <#policy args> <policy args>*
+ */
+static int cache_status(struct dm_target *ti, status_type_t type,
+			unsigned status_flags, char *result, unsigned maxlen)
+{
+	int r = 0;
+	ssize_t sz = 0;
+	dm_block_t nr_free_blocks_metadata = 0;
+	dm_block_t nr_blocks_metadata = 0;
+	char buf[BDEVNAME_SIZE];
+	struct cache *cache = ti->private;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_cache_get_free_metadata_block_count(cache->cmd,
+							   &nr_free_blocks_metadata);
+		if (r) {
+			DMERR("could not get metadata free block count");
+			goto err;
+		}
+
+		r = dm_cache_get_metadata_dev_size(cache->cmd, &nr_blocks_metadata);
+		if (r) {
+			DMERR("could not get metadata device size");
+			goto err;
+		}
+
+		DMEMIT("%llu/%llu %u %u %u %u %u %u %llu %u ",
+		       (unsigned long long)(nr_blocks_metadata - nr_free_blocks_metadata),
+		       (unsigned long long)nr_blocks_metadata,
+		       (unsigned) atomic_read(&cache->stats.read_hit),
+		       (unsigned) atomic_read(&cache->stats.read_miss),
+		       (unsigned) atomic_read(&cache->stats.write_hit),
+		       (unsigned) atomic_read(&cache->stats.write_miss),
+		       (unsigned) atomic_read(&cache->stats.demotion),
+		       (unsigned) atomic_read(&cache->stats.promotion),
+		       (unsigned long long) policy_residency(cache->policy),
+		       (unsigned) atomic_read(&cache->nr_dirty));
+
+		DMEMIT("1 %s ", writethrough_mode(&cache->features) ?
+		       "writethrough" : "writeback");
+
+		DMEMIT("2 migration_threshold %llu ",
+		       (unsigned long long) cache->migration_threshold);
+
+		DMEMIT("%s ", dm_cache_policy_get_name(cache->policy));
+		r = policy_emit_config_values(cache->policy, result + sz, maxlen - sz);
+		if (r)
+			DMERR("policy_emit_config_values returned %d", r);
+
+		break;
+
+	case STATUSTYPE_TABLE:
+		format_dev_t(buf, cache->metadata_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->cache_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->origin_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		DMEMIT("%llu ", (unsigned long long) cache->sectors_per_block);
+
+		if (writethrough_mode(&cache->features))
+			DMEMIT("1 writethrough ");
+		else
+			DMEMIT("0 ");
+
+		DMEMIT("%s ", dm_cache_policy_get_name(cache->policy));
+		r = policy_emit_config_values(cache->policy, result + sz, maxlen - sz);
+		if (r)
+			DMERR("policy_emit_config_values returned %d", r);
+
+		break;
+	}
+
+	return 0;
+
+err:
+	DMEMIT("Error");
+	return 0;
+}
+
+/*
+ * Supports <key> <value>.
+ *
+ * The key migration_threshold is supported by the cache target core.
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache *cache = ti->private;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	return set_config_value(cache, argv[0], argv[1]);
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	int r = 0;
+	struct cache *cache = ti->private;
+
+	r = fn(ti, cache->cache_dev, 0, get_dev_size(cache->cache_dev), data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+/*
+ * We assume I/O is going to the origin (which is the volume
+ * more likely to have restrictions e.g. by being striped).
+ * (Looking up the exact location of the data would be expensive
+ * and could always be out of date by the time the bio is submitted.)
+ */
+static int cache_bvec_merge(struct dm_target *ti,
+			    struct bvec_merge_data *bvm,
+			    struct bio_vec *biovec, int max_size)
+{
+	struct cache *cache = ti->private;
+	struct request_queue *q = bdev_get_queue(cache->origin_dev->bdev);
+
+	if (!q->merge_bvec_fn)
+		return max_size;
+
+	bvm->bi_bdev = cache->origin_dev->bdev;
+	return min(max_size, q->merge_bvec_fn(q, bvm, biovec));
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, 0);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.presuspend = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.message = cache_message,
+	.iterate_devices = cache_iterate_devices,
+	.merge = cache_bvec_merge,
+	.io_hints = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target registration failed: %d", r);
+		return r;
+	}
+
+	r = -ENOMEM;
+
+	_endio_hook_cache = KMEM_CACHE(dm_cache_endio_hook, 0);
+	if (!_endio_hook_cache)
+		goto bad_endio_hook_cache;
+
+	_migration_cache = KMEM_CACHE(dm_cache_migration, 0);
+	if (!_migration_cache)
+		goto bad_migration_cache;
+
+	_writethrough_cache = KMEM_CACHE(dm_cache_writethrough, 0);
+	if (!_writethrough_cache)
+		goto bad_writethrough_cache;
+
+	return 0;
+
+bad_writethrough_cache:
+	kmem_cache_destroy(_migration_cache);
+bad_migration_cache:
+	kmem_cache_destroy(_endio_hook_cache);
+bad_endio_hook_cache:
+	dm_unregister_target(&cache_target);
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+
+	kmem_cache_destroy(_writethrough_cache);
+	kmem_cache_destroy(_migration_cache);
+	kmem_cache_destroy(_endio_hook_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
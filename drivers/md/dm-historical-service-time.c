@@ -0,0 +1,357 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Historical service time path selector - choose the path that is
+ * expected to complete the incoming I/O first, judged by how quickly
+ * it has been completing I/O recently.
+ */
+
+#include "dm.h"
+#include "dm-path-selector.h"
+
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+
+#define DM_MSG_PREFIX	"multipath historical-service-time"
+#define HST_MIN_IO	1
+#define HST_WEIGHT_DEFAULT	90	/* % of the old estimate kept per sample */
+#define HST_WEIGHT_MAX	99
+#define HST_STALE_NS	NSEC_PER_SEC
+#define HST_VERSION	"0.1.0"
+
+struct selector {
+	struct list_head valid_paths;
+	struct list_head failed_paths;
+	unsigned weight;
+	spinlock_t lock;	/* protects the estimates of all paths */
+};
+
+struct path_info {
+	struct list_head list;
+	struct dm_path *path;
+	unsigned repeat_count;
+
+	atomic_t in_flight;		/* Number of in-flight I/Os */
+	atomic_t in_flight_size;	/* Total size of in-flight I/Os */
+
+	u64 service_time;	/* Weighted average completion time, ns */
+	u64 last_completion;	/* ktime of the last sample, ns */
+};
+
+static struct selector *alloc_selector(void)
+{
+	struct selector *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (s) {
+		INIT_LIST_HEAD(&s->valid_paths);
+		INIT_LIST_HEAD(&s->failed_paths);
+		s->weight = HST_WEIGHT_DEFAULT;
+		spin_lock_init(&s->lock);
+	}
+
+	return s;
+}
+
+static int hst_create(struct path_selector *ps, unsigned argc, char **argv)
+{
+	struct selector *s;
+	unsigned weight = HST_WEIGHT_DEFAULT;
+	char dummy;
+
+	/*
+	 * Arguments: [<weight>]
+	 * 	<weight>: The percentage of the previous service time
+	 * 		  estimate that is kept when a new completion
+	 * 		  time is folded in.  Valid range 0-<HST_WEIGHT_MAX>.
+	 */
+	if (argc > 1)
+		return -EINVAL;
+
+	if (argc && (sscanf(argv[0], "%u%c", &weight, &dummy) != 1 ||
+		     weight > HST_WEIGHT_MAX))
+		return -EINVAL;
+
+	s = alloc_selector();
+	if (!s)
+		return -ENOMEM;
+
+	s->weight = weight;
+	ps->context = s;
+	return 0;
+}
+
+static void free_paths(struct list_head *paths)
+{
+	struct path_info *pi, *next;
+
+	list_for_each_entry_safe(pi, next, paths, list) {
+		list_del(&pi->list);
+		kfree(pi);
+	}
+}
+
+static void hst_destroy(struct path_selector *ps)
+{
+	struct selector *s = ps->context;
+
+	free_paths(&s->valid_paths);
+	free_paths(&s->failed_paths);
+	kfree(s);
+	ps->context = NULL;
+}
+
+static int hst_status(struct path_selector *ps, struct dm_path *path,
+		      status_type_t type, char *result, unsigned maxlen)
+{
+	struct selector *s = ps->context;
+	unsigned sz = 0;
+	struct path_info *pi;
+	unsigned long flags;
+	u64 service_time;
+
+	if (!path) {
+		if (type == STATUSTYPE_TABLE)
+			DMEMIT("1 %u ", s->weight);
+		else
+			DMEMIT("0 ");
+	} else {
+		pi = path->pscontext;
+
+		switch (type) {
+		case STATUSTYPE_INFO:
+			spin_lock_irqsave(&s->lock, flags);
+			service_time = pi->service_time;
+			spin_unlock_irqrestore(&s->lock, flags);
+
+			DMEMIT("%d %d %llu ", atomic_read(&pi->in_flight),
+			       atomic_read(&pi->in_flight_size),
+			       (unsigned long long)div_u64(service_time,
+							   NSEC_PER_USEC));
+			break;
+		case STATUSTYPE_TABLE:
+			DMEMIT("%u ", pi->repeat_count);
+			break;
+		}
+	}
+
+	return sz;
+}
+
+static int hst_add_path(struct path_selector *ps, struct dm_path *path,
+			int argc, char **argv, char **error)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi;
+	unsigned repeat_count = HST_MIN_IO;
+	unsigned long flags;
+	char dummy;
+
+	/*
+	 * Arguments: [<repeat_count>]
+	 * 	<repeat_count>: The number of I/Os before switching path.
+	 * 			If not given, default (HST_MIN_IO) is used.
+	 */
+	if (argc > 1) {
+		*error = "historical-service-time ps: incorrect number of arguments";
+		return -EINVAL;
+	}
+
+	if (argc && (sscanf(argv[0], "%u%c", &repeat_count, &dummy) != 1)) {
+		*error = "historical-service-time ps: invalid repeat count";
+		return -EINVAL;
+	}
+
+	/* allocate the path */
+	pi = kmalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi) {
+		*error = "historical-service-time ps: Error allocating path context";
+		return -ENOMEM;
+	}
+
+	pi->path = path;
+	pi->repeat_count = repeat_count;
+	atomic_set(&pi->in_flight, 0);
+	atomic_set(&pi->in_flight_size, 0);
+	pi->service_time = 0;
+	pi->last_completion = 0;
+
+	path->pscontext = pi;
+
+	spin_lock_irqsave(&s->lock, flags);
+	list_add_tail(&pi->list, &s->valid_paths);
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return 0;
+}
+
+static void hst_fail_path(struct path_selector *ps, struct dm_path *path)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = path->pscontext;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	list_move(&pi->list, &s->failed_paths);
+	spin_unlock_irqrestore(&s->lock, flags);
+}
+
+static int hst_reinstate_path(struct path_selector *ps, struct dm_path *path)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = path->pscontext;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	/*
+	 * Whatever was measured before the failure says little about
+	 * the path now, so start again from scratch.
+	 */
+	pi->service_time = 0;
+	list_move_tail(&pi->list, &s->valid_paths);
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return 0;
+}
+
+/*
+ * Predicted time, in ns, for the path to complete an I/O submitted now.
+ *
+ * The incoming I/O has to wait for everything already queued on the
+ * path, so the estimate is the historical completion time scaled by
+ * the queue depth it will see.
+ *
+ * An idle path with no history, or whose last completion is old,
+ * predicts 0 so that it gets probed rather than being starved by an
+ * old, pessimistic estimate.  Only one probe is sent to a path without
+ * history until it has completed.
+ */
+static u64 hst_predict(struct path_info *pi, u64 now)
+{
+	unsigned in_flight = atomic_read(&pi->in_flight);
+
+	if (!in_flight && (!pi->service_time ||
+			   now - pi->last_completion > HST_STALE_NS))
+		return 0;
+
+	if (!pi->service_time)
+		return (u64)-1;
+
+	return pi->service_time * (in_flight + 1);
+}
+
+static struct dm_path *hst_select_path(struct path_selector *ps,
+				       unsigned *repeat_count, size_t nr_bytes)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = NULL, *best = NULL;
+	u64 now = ktime_to_ns(ktime_get());
+	u64 time, best_time = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+
+	if (list_empty(&s->valid_paths))
+		goto out;
+
+	/* Change preferred (first in list) path to evenly balance. */
+	list_move_tail(s->valid_paths.next, &s->valid_paths);
+
+	list_for_each_entry(pi, &s->valid_paths, list) {
+		time = hst_predict(pi, now);
+
+		/* On a tie, prefer the path with less data outstanding. */
+		if (!best || time < best_time ||
+		    (time == best_time &&
+		     atomic_read(&pi->in_flight_size) <
+		     atomic_read(&best->in_flight_size))) {
+			best = pi;
+			best_time = time;
+		}
+	}
+
+	*repeat_count = best->repeat_count;
+
+out:
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	return best ? best->path : NULL;
+}
+
+static int hst_start_io(struct path_selector *ps, struct dm_path *path,
+			size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+
+	atomic_inc(&pi->in_flight);
+	atomic_add(nr_bytes, &pi->in_flight_size);
+
+	return 0;
+}
+
+static int hst_end_io(struct path_selector *ps, struct dm_path *path,
+		      size_t nr_bytes, ktime_t start_time)
+{
+	struct selector *s = ps->context;
+	struct path_info *pi = path->pscontext;
+	ktime_t now = ktime_get();
+	u64 sample = ktime_to_ns(ktime_sub(now, start_time));
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (!pi->service_time)
+		pi->service_time = sample;
+	else
+		pi->service_time = div_u64(pi->service_time * s->weight +
+					   sample * (100 - s->weight), 100);
+	pi->last_completion = ktime_to_ns(now);
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	atomic_sub(nr_bytes, &pi->in_flight_size);
+	atomic_dec(&pi->in_flight);
+
+	return 0;
+}
+
+static struct path_selector_type hst_ps = {
+	.name		= "historical-service-time",
+	.module		= THIS_MODULE,
+	.table_args	= 1,
+	.info_args	= 3,
+	.create		= hst_create,
+	.destroy	= hst_destroy,
+	.status		= hst_status,
+	.add_path	= hst_add_path,
+	.fail_path	= hst_fail_path,
+	.reinstate_path	= hst_reinstate_path,
+	.select_path	= hst_select_path,
+	.start_io	= hst_start_io,
+	.end_io		= hst_end_io,
+};
+
+static int __init dm_hst_init(void)
+{
+	int r = dm_register_path_selector(&hst_ps);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	DMINFO("version " HST_VERSION " loaded");
+
+	return r;
+}
+
+static void __exit dm_hst_exit(void)
+{
+	int r = dm_unregister_path_selector(&hst_ps);
+
+	if (r < 0)
+		DMERR("unregister failed %d", r);
+}
+
+module_init(dm_hst_init);
+module_exit(dm_hst_exit);
+
+MODULE_DESCRIPTION(DM_NAME " completion latency oriented path selector");
+MODULE_LICENSE("GPL");
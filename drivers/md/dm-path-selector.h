@@ -13,6 +13,7 @@
 #define	DM_PATH_SELECTOR_H
 
 #include <linux/device-mapper.h>
+#include <linux/ktime.h>
 
 #include "dm-mpath.h"
 
@@ -76,10 +77,14 @@ struct path_selector_type {
 	int (*status) (struct path_selector *ps, struct dm_path *path,
 		       status_type_t type, char *result, unsigned int maxlen);
 
+	/*
+	 * start_time is when the I/O was dispatched to the path, so
+	 * selectors can measure how long it took to complete.
+	 */
 	int (*start_io) (struct path_selector *ps, struct dm_path *path,
 			 size_t nr_bytes);
 	int (*end_io) (struct path_selector *ps, struct dm_path *path,
-		       size_t nr_bytes);
+		       size_t nr_bytes, ktime_t start_time);
 };
 
 /* Register a path selector */
@@ -208,7 +208,7 @@ static int ql_start_io(struct path_selector *ps, struct dm_path *path,
 }
 
 static int ql_end_io(struct path_selector *ps, struct dm_path *path,
-		     size_t nr_bytes)
+		     size_t nr_bytes, ktime_t start_time)
 {
 	struct path_info *pi = path->pscontext;
 
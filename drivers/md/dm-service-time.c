@@ -290,7 +290,7 @@ static int st_start_io(struct path_selector *ps, struct dm_path *path,
 }
 
 static int st_end_io(struct path_selector *ps, struct dm_path *path,
-		     size_t nr_bytes)
+		     size_t nr_bytes, ktime_t start_time)
 {
 	struct path_info *pi = path->pscontext;
 
@@ -11,6 +11,7 @@
 #include "persistent-data/dm-transaction-manager.h"
 
 #include <linux/list.h>
+#include <linux/module.h>
 #include <linux/device-mapper.h>
 #include <linux/workqueue.h>
 
@@ -77,7 +78,7 @@
 #define THIN_SUPERBLOCK_MAGIC 27022010
 #define THIN_SUPERBLOCK_LOCATION 0
 #define THIN_VERSION 1
-#define THIN_METADATA_CACHE_SIZE 64
+#define THIN_METADATA_CACHE_SIZE 1024
 #define SECTOR_TO_BLOCK_SHIFT 3
 
 /*
@@ -89,6 +90,14 @@
 /* This should be plenty */
 #define SPACE_MAP_ROOT_SIZE 128
 
+/*
+ * Minimum number of metadata blocks each pool keeps in core.  Read when
+ * the pool metadata is opened.
+ */
+static unsigned metadata_cache_blocks = THIN_METADATA_CACHE_SIZE;
+module_param(metadata_cache_blocks, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(metadata_cache_blocks, "Minimum number of metadata blocks cached per pool");
+
 /*
  * Little endian on-disk superblock and device details.
  */
@@ -652,7 +661,7 @@ static int __create_persistent_data_objects(struct dm_pool_metadata *pmd, bool f
 	int r;
 
 	pmd->bm = dm_block_manager_create(pmd->bdev, THIN_METADATA_BLOCK_SIZE,
-					  THIN_METADATA_CACHE_SIZE,
+					  metadata_cache_blocks,
 					  THIN_MAX_CONCURRENT_LOCKS);
 	if (IS_ERR(pmd->bm)) {
 		DMERR("could not create block manager");
@@ -1579,6 +1588,12 @@ int dm_pool_get_metadata_dev_size(struct dm_pool_metadata *pmd,
 	return r;
 }
 
+void dm_pool_get_metadata_cache_stats(struct dm_pool_metadata *pmd,
+				      unsigned long *hits, unsigned long *misses)
+{
+	dm_bm_get_cache_stats(pmd->bm, hits, misses);
+}
+
 int dm_pool_get_data_block_size(struct dm_pool_metadata *pmd, sector_t *result)
 {
 	down_read(&pmd->root_lock);
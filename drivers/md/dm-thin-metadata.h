@@ -176,6 +176,13 @@ int dm_pool_get_free_metadata_block_count(struct dm_pool_metadata *pmd,
 int dm_pool_get_metadata_dev_size(struct dm_pool_metadata *pmd,
 				  dm_block_t *result);
 
+/*
+ * Lookups in the metadata block cache that did and didn't find the
+ * block in core.
+ */
+void dm_pool_get_metadata_cache_stats(struct dm_pool_metadata *pmd,
+				      unsigned long *hits, unsigned long *misses);
+
 int dm_pool_get_data_block_size(struct dm_pool_metadata *pmd, sector_t *result);
 
 int dm_pool_get_data_dev_size(struct dm_pool_metadata *pmd, dm_block_t *result);
@@ -1623,6 +1623,7 @@ static int super_1_validate(struct mddev *mddev, struct md_rdev *rdev)
 	clear_bit(Faulty, &rdev->flags);
 	clear_bit(In_sync, &rdev->flags);
 	clear_bit(WriteMostly, &rdev->flags);
+	clear_bit(Journal, &rdev->flags);
 
 	if (mddev->raid_disks == 0) {
 		mddev->major_version = 1;
@@ -1651,6 +1652,9 @@ static int super_1_validate(struct mddev *mddev, struct md_rdev *rdev)
 
 		mddev->max_disks =  (4096-256)/2;
 
+		mddev->has_journal = !!(le32_to_cpu(sb->feature_map) &
+					MD_FEATURE_JOURNAL);
+
 		if ((le32_to_cpu(sb->feature_map) & MD_FEATURE_BITMAP_OFFSET) &&
 		    mddev->bitmap_info.file == NULL) {
 			mddev->bitmap_info.offset =
@@ -1723,6 +1727,16 @@ static int super_1_validate(struct mddev *mddev, struct md_rdev *rdev)
 		case 0xfffe: /* faulty */
 			set_bit(Faulty, &rdev->flags);
 			break;
+		case 0xfffd: /* journal */
+			if (!(le32_to_cpu(sb->feature_map) & MD_FEATURE_JOURNAL)) {
+				/* journal device without journal feature */
+				printk(KERN_WARNING
+				       "md: journal device provided without journal feature, ignoring the device\n");
+				return -EINVAL;
+			}
+			set_bit(Journal, &rdev->flags);
+			rdev->journal_tail = le64_to_cpu(sb->journal_tail);
+			break;
 		default:
 			if ((le32_to_cpu(sb->feature_map) &
 			     MD_FEATURE_RECOVERY_OFFSET))
@@ -1747,6 +1761,7 @@ static void super_1_sync(struct mddev *mddev, struct md_rdev *rdev)
 	struct mdp_superblock_1 *sb;
 	struct md_rdev *rdev2;
 	int max_dev, i;
+	int journal = 0;
 	/* make rdev->sb match mddev and rdev data. */
 
 	sb = page_address(rdev->sb_page);
@@ -1756,9 +1771,17 @@ static void super_1_sync(struct mddev *mddev, struct md_rdev *rdev)
 	sb->recovery_offset = cpu_to_le64(0);
 	memset(sb->pad3, 0, sizeof(sb->pad3));
 
+	rdev_for_each(rdev2, mddev)
+		if (test_bit(Journal, &rdev2->flags) &&
+		    !test_bit(Faulty, &rdev2->flags))
+			journal = 1;
+
 	sb->utime = cpu_to_le64((__u64)mddev->utime);
 	sb->events = cpu_to_le64(mddev->events);
-	if (mddev->in_sync)
+	if (mddev->in_sync || journal)
+		/* A working journal is replayed after a crash, so an
+		 * active array does not need a resync either.
+		 */
 		sb->resync_offset = cpu_to_le64(mddev->recovery_cp);
 	else
 		sb->resync_offset = cpu_to_le64(0);
@@ -1793,6 +1816,10 @@ static void super_1_sync(struct mddev *mddev, struct md_rdev *rdev)
 	if (test_bit(Replacement, &rdev->flags))
 		sb->feature_map |=
 			cpu_to_le32(MD_FEATURE_REPLACEMENT);
+	if (test_bit(Journal, &rdev->flags))
+		sb->journal_tail = cpu_to_le64(rdev->journal_tail);
+	if (journal)
+		sb->feature_map |= cpu_to_le32(MD_FEATURE_JOURNAL);
 
 	if (mddev->reshape_position != MaxSector) {
 		sb->feature_map |= cpu_to_le32(MD_FEATURE_RESHAPE_ACTIVE);
@@ -1869,6 +1896,8 @@ retry:
 		i = rdev2->desc_nr;
 		if (test_bit(Faulty, &rdev2->flags))
 			sb->dev_roles[i] = cpu_to_le16(0xfffe);
+		else if (test_bit(Journal, &rdev2->flags))
+			sb->dev_roles[i] = cpu_to_le16(0xfffd);
 		else if (test_bit(In_sync, &rdev2->flags))
 			sb->dev_roles[i] = cpu_to_le16(rdev2->raid_disk);
 		else if (rdev2->raid_disk >= 0)
@@ -2624,8 +2653,11 @@ state_show(struct md_rdev *rdev, char *page)
 		len += sprintf(page+len, "%sblocked", sep);
 		sep = ",";
 	}
-	if (!test_bit(Faulty, &rdev->flags) &&
-	    !test_bit(In_sync, &rdev->flags)) {
+	if (test_bit(Journal, &rdev->flags)) {
+		len += sprintf(page+len, "%sjournal", sep);
+		sep = ",";
+	} else if (!test_bit(Faulty, &rdev->flags) &&
+		   !test_bit(In_sync, &rdev->flags)) {
 		len += sprintf(page+len, "%sspare", sep);
 		sep = ",";
 	}
@@ -2667,7 +2699,8 @@ state_store(struct md_rdev *rdev, const char *buf, size_t len)
 		else
 			err = -EBUSY;
 	} else if (cmd_match(buf, "remove")) {
-		if (rdev->raid_disk >= 0)
+		if (rdev->raid_disk >= 0 ||
+		    (test_bit(Journal, &rdev->flags) && rdev->mddev->pers))
 			err = -EBUSY;
 		else {
 			struct mddev *mddev = rdev->mddev;
@@ -2789,6 +2822,8 @@ slot_store(struct md_rdev *rdev, const char *buf, size_t len)
 	char *e;
 	int err;
 	int slot = simple_strtoul(buf, &e, 10);
+	if (test_bit(Journal, &rdev->flags))
+		return -EBUSY;
 	if (strncmp(buf, "none", 4)==0)
 		slot = -1;
 	else if (e==buf || (*e && *e!= '\n'))
@@ -3493,6 +3528,13 @@ level_store(struct mddev *mddev, const char *buf, size_t len)
 	    mddev->sysfs_active)
 		return -EBUSY;
 
+	rdev_for_each(rdev, mddev)
+		if (test_bit(Journal, &rdev->flags)) {
+			printk(KERN_WARNING "md: %s: cannot change the level of an array with a journal\n",
+			       mdname(mddev));
+			return -EINVAL;
+		}
+
 	if (!mddev->pers->quiesce) {
 		printk(KERN_WARNING "md: %s: %s does not support online personality change\n",
 		       mdname(mddev), mddev->pers->name);
@@ -5037,6 +5079,17 @@ int md_run(struct mddev *mddev)
 		return -EINVAL;
 	}
 
+	rdev_for_each(rdev, mddev)
+		if (test_bit(Journal, &rdev->flags) &&
+		    (pers->level < 4 || pers->level > 6)) {
+			printk(KERN_WARNING
+			       "md: %s: only raid4/5/6 can use a journal device\n",
+			       mdname(mddev));
+			mddev->pers = NULL;
+			module_put(pers->owner);
+			return -EINVAL;
+		}
+
 	if (pers->sync_request) {
 		/* Warn if this is a potentially silly
 		 * configuration.
@@ -5231,6 +5284,7 @@ static void md_clean(struct mddev *mddev)
 	mddev->level = LEVEL_NONE;
 	mddev->clevel[0] = 0;
 	mddev->flags = 0;
+	mddev->has_journal = 0;
 	mddev->ro = 0;
 	mddev->metadata_type[0] = 0;
 	mddev->chunk_sectors = 0;
@@ -5657,6 +5711,8 @@ static int get_disk_info(struct mddev * mddev, void __user * arg)
 		}
 		if (test_bit(WriteMostly, &rdev->flags))
 			info.state |= (1<<MD_DISK_WRITEMOSTLY);
+		if (test_bit(Journal, &rdev->flags))
+			info.state |= (1<<MD_DISK_JOURNAL);
 	} else {
 		info.major = info.minor = 0;
 		info.raid_disk = -1;
@@ -5752,6 +5808,16 @@ static int add_new_disk(struct mddev * mddev, mdu_disk_info_t *info)
 			export_rdev(rdev);
 			return -EINVAL;
 		}
+		if (test_bit(Journal, &rdev->flags)) {
+			/* The journal is only picked up when the array
+			 * is started.
+			 */
+			printk(KERN_WARNING
+			       "md: %s: cannot add a journal to an active array\n",
+			       mdname(mddev));
+			export_rdev(rdev);
+			return -EBUSY;
+		}
 
 		if (test_bit(In_sync, &rdev->flags))
 			rdev->saved_raid_disk = rdev->raid_disk;
@@ -5851,6 +5917,9 @@ static int hot_remove_disk(struct mddev * mddev, dev_t dev)
 
 	if (rdev->raid_disk >= 0)
 		goto busy;
+	/* the personality keeps using the journal until it stops */
+	if (test_bit(Journal, &rdev->flags))
+		goto busy;
 
 	kick_rdev_from_array(rdev);
 	md_update_sb(mddev, 1);
@@ -6980,7 +7049,9 @@ static int md_seq_show(struct seq_file *seq, void *v)
 				seq_printf(seq, "(F)");
 				continue;
 			}
-			if (rdev->raid_disk < 0)
+			if (test_bit(Journal, &rdev->flags))
+				seq_printf(seq, "(J)"); /* journal */
+			else if (rdev->raid_disk < 0)
 				seq_printf(seq, "(S)"); /* spare */
 			if (test_bit(Replacement, &rdev->flags))
 				seq_printf(seq, "(R)");
@@ -7607,7 +7678,8 @@ static int remove_and_add_spares(struct mddev *mddev)
 		    !test_bit(Faulty, &rdev->flags))
 			spares++;
 		if (rdev->raid_disk < 0
-		    && !test_bit(Faulty, &rdev->flags)) {
+		    && !test_bit(Faulty, &rdev->flags)
+		    && !test_bit(Journal, &rdev->flags)) {
 			rdev->recovery_offset = 0;
 			if (mddev->pers->
 			    hot_add_disk(mddev, rdev) == 0) {
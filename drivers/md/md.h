@@ -85,10 +85,16 @@ struct md_rdev {
 					 * array and could again if we did a partial
 					 * resync from the bitmap
 					 */
-	sector_t	recovery_offset;/* If this device has been partially
-					 * recovered, this is where we were
-					 * up to.
-					 */
+	union {
+		sector_t	recovery_offset;/* If this device has been partially
+						 * recovered, this is where we were
+						 * up to.
+						 */
+		sector_t	journal_tail;	/* If this device is a journal device,
+						 * this is where recovery of the
+						 * journal starts.
+						 */
+	};
 
 	atomic_t	nr_pending;	/* number of pending requests.
 					 * only maintained for arrays that
@@ -167,6 +173,10 @@ enum flag_bits {
 				 * a want_replacement device with same
 				 * raid_disk number.
 				 */
+	Journal,		/* This device is used as the write
+				 * journal of a raid4/5/6 array.  It
+				 * never has a raid_disk.
+				 */
 };
 
 #define BB_LEN_MASK	(0x00000000000001FFULL)
@@ -353,6 +363,12 @@ struct mddev {
 							     * member device
 							     * has a
 							     * merge_bvec_fn */
+	int				has_journal;	/* the superblock records
+							 * a write journal, so the
+							 * resync offset is only
+							 * trustworthy if the
+							 * journal is present.
+							 */
 
 	atomic_t			recovery_active; /* blocks scheduled, but not written */
 	wait_queue_head_t		recovery_wait;
@@ -576,6 +592,35 @@ do {									\
 	__wait_event_lock_irq(wq, condition, lock, cmd);		\
 } while (0)
 
+/*
+ * Like wait_event_lock_irq(), but for callers holding more than one
+ * lock: cmd1 drops them before sleeping and cmd2 takes them again.
+ */
+#define __wait_event_cmd(wq, condition, cmd1, cmd2)			\
+do {									\
+	wait_queue_t __wait;						\
+	init_waitqueue_entry(&__wait, current);				\
+									\
+	add_wait_queue(&wq, &__wait);					\
+	for (;;) {							\
+		set_current_state(TASK_UNINTERRUPTIBLE);		\
+		if (condition)						\
+			break;						\
+		cmd1;							\
+		schedule();						\
+		cmd2;							\
+	}								\
+	current->state = TASK_RUNNING;					\
+	remove_wait_queue(&wq, &__wait);				\
+} while (0)
+
+#define wait_event_cmd(wq, condition, cmd1, cmd2)			\
+do {									\
+	if (condition)							\
+		break;							\
+	__wait_event_cmd(wq, condition, cmd1, cmd2);			\
+} while (0)
+
 static inline void safe_put_page(struct page *p)
 {
 	if (p) put_page(p);
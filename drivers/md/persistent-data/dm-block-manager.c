@@ -391,6 +391,8 @@ struct dm_block_manager *dm_block_manager_create(struct block_device *bdev,
 		goto bad;
 	}
 
+	dm_bufio_set_minimum_buffers(bm->bufio, cache_size);
+
 	bm->read_only = false;
 
 	return bm;
@@ -418,6 +420,19 @@ dm_block_t dm_bm_nr_blocks(struct dm_block_manager *bm)
 	return dm_bufio_get_device_size(bm->bufio);
 }
 
+void dm_bm_prefetch(struct dm_block_manager *bm, dm_block_t b)
+{
+	dm_bufio_prefetch(bm->bufio, b, 1);
+}
+EXPORT_SYMBOL_GPL(dm_bm_prefetch);
+
+void dm_bm_get_cache_stats(struct dm_block_manager *bm,
+			   unsigned long *hits, unsigned long *misses)
+{
+	dm_bufio_get_stats(bm->bufio, hits, misses);
+}
+EXPORT_SYMBOL_GPL(dm_bm_get_cache_stats);
+
 static int dm_bm_validate_buffer(struct dm_block_manager *bm,
 				 struct dm_buffer *buf,
 				 struct buffer_aux *aux,
@@ -523,8 +538,15 @@ int dm_bm_read_try_lock(struct dm_block_manager *bm,
 	p = dm_bufio_get(bm->bufio, b, (struct dm_buffer **) result);
 	if (unlikely(IS_ERR(p)))
 		return PTR_ERR(p);
-	if (unlikely(!p))
+	if (unlikely(!p)) {
+		/*
+		 * Start reading the block now so it is likely to be
+		 * in core by the time the caller retries from a context
+		 * that can block.
+		 */
+		dm_bufio_prefetch(bm->bufio, b, 1);
 		return -EWOULDBLOCK;
+	}
 
 	aux = dm_bufio_get_aux_data(to_buffer(*result));
 	r = bl_down_read_nonblock(&aux->lock);
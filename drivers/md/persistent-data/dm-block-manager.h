@@ -27,6 +27,9 @@ void *dm_block_data(struct dm_block *b);
  * @name should be a unique identifier for the block manager, no longer
  * than 32 chars.
  *
+ * @cache_size is the minimum number of blocks kept in core for this
+ * block manager, regardless of its share of the dm-bufio cache.
+ *
  * @max_held_per_thread should be the maximum number of locks, read or
  * write, that an individual thread holds at any one time.
  */
@@ -39,6 +42,19 @@ void dm_block_manager_destroy(struct dm_block_manager *bm);
 unsigned dm_bm_block_size(struct dm_block_manager *bm);
 dm_block_t dm_bm_nr_blocks(struct dm_block_manager *bm);
 
+/*
+ * Start reading a block asynchronously so that a later lock is less
+ * likely to block.
+ */
+void dm_bm_prefetch(struct dm_block_manager *bm, dm_block_t b);
+
+/*
+ * Counts of block lookups that were satisfied from the cache (hits)
+ * and that had to go to disk (misses).
+ */
+void dm_bm_get_cache_stats(struct dm_block_manager *bm,
+			   unsigned long *hits, unsigned long *misses);
+
 /*----------------------------------------------------------------*/
 
 /*
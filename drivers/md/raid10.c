@@ -739,6 +739,10 @@ static struct md_rdev *read_balance(struct r10conf *conf,
 	int do_balance;
 	int best_slot;
 	struct geom *geo = &conf->geo;
+	int has_nonrot_disk;
+	int best_pending_slot;
+	struct md_rdev *best_pending_rdev;
+	unsigned int min_pending;
 
 	raid10_find_phys(conf, r10_bio);
 	rcu_read_lock();
@@ -749,6 +753,10 @@ retry:
 	best_dist = MaxSector;
 	best_good_sectors = 0;
 	do_balance = 1;
+	has_nonrot_disk = 0;
+	best_pending_slot = -1;
+	best_pending_rdev = NULL;
+	min_pending = UINT_MAX;
 	/*
 	 * Check if we can balance. We can balance on the whole
 	 * device if no resync is going on (recovery is ok), or below
@@ -815,6 +823,26 @@ retry:
 		if (!do_balance)
 			break;
 
+		/*
+		 * On non-rotational devices seek distance means nothing, so
+		 * balance by the number of requests outstanding on each
+		 * device instead.  A sequential stream stays on the device
+		 * it started on so that it can still be merged there.
+		 */
+		if (blk_queue_nonrot(bdev_get_queue(rdev->bdev))) {
+			unsigned int pending = atomic_read(&rdev->nr_pending);
+
+			has_nonrot_disk = 1;
+			if (conf->mirrors[disk].next_seq_sect ==
+			    r10_bio->devs[slot].addr)
+				break;
+			if (pending < min_pending) {
+				min_pending = pending;
+				best_pending_slot = slot;
+				best_pending_rdev = rdev;
+			}
+		}
+
 		/* This optimisation is debatable, and completely destroys
 		 * sequential read speed for 'far copies' arrays.  So only
 		 * keep it for 'near' arrays, and review those later.
@@ -835,8 +863,17 @@ retry:
 		}
 	}
 	if (slot >= conf->copies) {
-		slot = best_slot;
-		rdev = best_rdev;
+		/*
+		 * If any device is non-rotational, prefer the least busy
+		 * of those; otherwise take the closest.
+		 */
+		if (has_nonrot_disk && best_pending_slot >= 0) {
+			slot = best_pending_slot;
+			rdev = best_pending_rdev;
+		} else {
+			slot = best_slot;
+			rdev = best_rdev;
+		}
 	}
 
 	if (slot >= 0) {
@@ -849,6 +886,8 @@ retry:
 			goto retry;
 		}
 		r10_bio->read_slot = slot;
+		conf->mirrors[r10_bio->devs[slot].devnum].next_seq_sect =
+			r10_bio->devs[slot].addr + best_good_sectors;
 	} else
 		rdev = NULL;
 	rcu_read_unlock();
@@ -4,6 +4,10 @@
 struct raid10_info {
 	struct md_rdev	*rdev, *replacement;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* where the last read sent
+					 * here ended, to keep
+					 * sequential reads together
+					 */
 	int		recovery_disabled;	/* matches
 						 * mddev->recovery_disabled
 						 * when we shouldn't try
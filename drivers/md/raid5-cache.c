@@ -0,0 +1,869 @@
+/*
+ * raid5-cache.c : write journal for RAID-4/5/6
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ */
+
+/*
+ * A stripe that updates its parity is exposed to the "write hole": if
+ * the machine stops after some of the blocks have reached the member
+ * devices but not all, the parity no longer matches the data, and a
+ * later reconstruction of a failed device silently returns garbage.
+ * Without a journal the array is resynced after every unclean shutdown
+ * to close that window.
+ *
+ * With a journal, ops_run_io() hands such a stripe to r5l_write_stripe()
+ * first.  Every block that is about to be written, data and parity
+ * alike, is appended to the journal device together with a meta block
+ * describing where it belongs.  Stripes are batched into io_units, one
+ * meta block each.  Once the journal has completed the io_units in
+ * order and a cache flush has made them stable, the stripes are handed
+ * back to the state machine and go to the member devices as usual.
+ * After a crash the journal is replayed from its tail, so each stripe
+ * is either completely old or completely new, and no resync is needed.
+ *
+ * The journal is a ring.  When enough io_units have been fully written
+ * to the array, the reclaim thread moves the tail past them by updating
+ * 'journal_tail' in the superblock.  The superblock write flushes the
+ * member devices first, so everything before the new tail is stable on
+ * the array by then.
+ */
+
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/crc32.h>
+#include <linux/random.h>
+#include <linux/raid/md_p.h>
+#include "md.h"
+#include "raid5.h"
+
+/* the journal is written in 4K blocks */
+#define BLOCK_SECTORS (8)
+
+/* the most blocks a single io_unit can take: its meta block and payloads */
+#define R5L_MAX_IO_BLOCKS (1 + (PAGE_SIZE - sizeof(struct r5l_meta_block)) / \
+			   sizeof(struct r5l_payload))
+
+/*
+ * Reclaim runs once this much of the journal is held by stripes that are
+ * already on the array: a quarter of the journal, but no more than 10G.
+ */
+#define RECLAIM_MAX_FREE_SPACE (10 * 1024 * 1024 * 2) /* sector */
+#define RECLAIM_MAX_FREE_SPACE_SHIFT (2)
+
+struct r5l_log {
+	struct md_rdev *rdev;
+
+	u32 uuid_checksum;		/* seed for all checksums */
+
+	sector_t device_size;		/* journal size, in sectors */
+	sector_t max_free_space;	/* reclaim once this much is done */
+
+	sector_t last_checkpoint;	/* log tail, where recovery starts */
+
+	sector_t log_start;		/* log head, where new data goes */
+	u64 seq;			/* seq of the next meta block */
+
+	struct mutex io_mutex;		/* protects the log head */
+	struct r5l_io_unit *current_io;	/* io_unit accepting new stripes */
+
+	spinlock_t io_list_lock;
+	struct list_head running_ios;	/* io_units being written to the log */
+	struct list_head io_end_ios;	/* written, waiting for a flush */
+	struct list_head flushing_ios;	/* covered by the running flush */
+	struct list_head finished_ios;	/* stable in the log, stripes are
+					 * on their way to the array
+					 */
+	struct bio flush_bio;
+
+	struct md_thread *reclaim_thread;
+
+	/* stripes that found the journal full, retried after reclaim */
+	struct list_head no_space_stripes;
+	spinlock_t no_space_stripes_lock;
+};
+
+/*
+ * One meta block and the blocks it describes, written to the journal in
+ * one go.
+ */
+struct r5l_io_unit {
+	struct r5l_log *log;
+
+	struct page *meta_page;		/* holds the meta block */
+	int meta_offset;		/* used bytes in meta_page */
+
+	struct bio_list bios;		/* full bios, not submitted yet */
+	struct bio *current_bio;	/* bio accepting new blocks */
+	atomic_t pending_io;		/* bios not completed yet */
+
+	atomic_t pending_stripe;	/* stripes not on the array yet */
+	u64 seq;			/* seq of the meta block */
+	sector_t log_start;		/* where the io_unit starts */
+	sector_t log_end;		/* where the io_unit ends */
+	struct list_head log_sibling;	/* on one of the log's io lists */
+	struct list_head stripe_list;	/* stripes in the io_unit */
+
+	int state;
+};
+
+/* io_unit states, in the order they are passed through */
+enum r5l_io_unit_state {
+	IO_UNIT_RUNNING = 0,	/* accepting new stripes */
+	IO_UNIT_IO_START = 1,	/* being written to the journal */
+	IO_UNIT_IO_END = 2,	/* written to the journal */
+	IO_UNIT_STRIPE_END = 3,	/* all its stripes are on the array */
+};
+
+static sector_t r5l_ring_add(struct r5l_log *log, sector_t start, sector_t inc)
+{
+	start += inc;
+	if (start >= log->device_size)
+		start = start - log->device_size;
+	return start;
+}
+
+static sector_t r5l_ring_distance(struct r5l_log *log, sector_t start,
+				  sector_t end)
+{
+	if (end >= start)
+		return end - start;
+	else
+		return end + log->device_size - start;
+}
+
+static bool r5l_has_free_space(struct r5l_log *log, sector_t size)
+{
+	sector_t used_size;
+
+	spin_lock_irq(&log->io_list_lock);
+	used_size = r5l_ring_distance(log, log->last_checkpoint,
+				      log->log_start);
+	spin_unlock_irq(&log->io_list_lock);
+
+	/* the head must never catch up with the tail */
+	return log->device_size > used_size + size;
+}
+
+static void r5l_free_io_unit(struct r5l_io_unit *io)
+{
+	__free_page(io->meta_page);
+	kfree(io);
+}
+
+static void r5l_log_io_done(struct r5l_io_unit *io)
+{
+	struct r5l_log *log = io->log;
+	struct r5l_io_unit *next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&log->io_list_lock, flags);
+	io->state = IO_UNIT_IO_END;
+	/*
+	 * A stripe may only go to the array once every io_unit before
+	 * its own is stable too, or recovery would stop short of it.
+	 */
+	list_for_each_entry_safe(io, next, &log->running_ios, log_sibling) {
+		if (io->state < IO_UNIT_IO_END)
+			break;
+		list_move_tail(&io->log_sibling, &log->io_end_ios);
+	}
+	spin_unlock_irqrestore(&log->io_list_lock, flags);
+
+	/* raid5d issues the flush */
+	md_wakeup_thread(log->rdev->mddev->thread);
+}
+
+static void r5l_log_endio(struct bio *bio, int error)
+{
+	struct r5l_io_unit *io = bio->bi_private;
+	struct r5l_log *log = io->log;
+
+	if (error)
+		md_error(log->rdev->mddev, log->rdev);
+
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&io->pending_io))
+		r5l_log_io_done(io);
+}
+
+static struct bio *r5l_bio_alloc(struct r5l_log *log, struct r5l_io_unit *io)
+{
+	struct bio *bio = bio_alloc_mddev(GFP_NOIO, BIO_MAX_PAGES,
+					  log->rdev->mddev);
+
+	bio->bi_bdev = log->rdev->bdev;
+	bio->bi_sector = log->rdev->data_offset + log->log_start;
+	bio->bi_end_io = r5l_log_endio;
+	bio->bi_private = io;
+	return bio;
+}
+
+static void r5l_submit_current_io(struct r5l_log *log)
+{
+	struct r5l_io_unit *io = log->current_io;
+	struct r5l_meta_block *block;
+	struct bio *bio;
+	u32 crc;
+
+	if (!io)
+		return;
+
+	block = page_address(io->meta_page);
+	block->meta_size = cpu_to_le32(io->meta_offset);
+	crc = crc32_le(log->uuid_checksum, (void *)block, PAGE_SIZE);
+	block->checksum = cpu_to_le32(crc);
+
+	log->current_io = NULL;
+	spin_lock_irq(&log->io_list_lock);
+	io->state = IO_UNIT_IO_START;
+	spin_unlock_irq(&log->io_list_lock);
+
+	bio_list_add(&io->bios, io->current_bio);
+	io->current_bio = NULL;
+
+	atomic_set(&io->pending_io, 1);
+	while ((bio = bio_list_pop(&io->bios))) {
+		atomic_inc(&io->pending_io);
+		submit_bio(WRITE, bio);
+	}
+	if (atomic_dec_and_test(&io->pending_io))
+		r5l_log_io_done(io);
+}
+
+static struct r5l_io_unit *r5l_new_meta(struct r5l_log *log)
+{
+	struct r5l_io_unit *io;
+	struct r5l_meta_block *block;
+
+	io = kzalloc(sizeof(*io), GFP_NOIO | __GFP_NOFAIL);
+	io->log = log;
+	INIT_LIST_HEAD(&io->log_sibling);
+	INIT_LIST_HEAD(&io->stripe_list);
+	bio_list_init(&io->bios);
+	io->state = IO_UNIT_RUNNING;
+
+	io->meta_page = alloc_page(GFP_NOIO | __GFP_NOFAIL | __GFP_ZERO);
+	block = page_address(io->meta_page);
+	block->magic = cpu_to_le32(R5LOG_MAGIC);
+	block->version = R5LOG_VERSION;
+	block->seq = cpu_to_le64(log->seq);
+	block->position = cpu_to_le64(log->log_start);
+
+	io->log_start = log->log_start;
+	io->meta_offset = sizeof(struct r5l_meta_block);
+	io->seq = log->seq++;
+
+	io->current_bio = r5l_bio_alloc(log, io);
+	bio_add_page(io->current_bio, io->meta_page, PAGE_SIZE, 0);
+
+	log->log_start = r5l_ring_add(log, log->log_start, BLOCK_SECTORS);
+	io->log_end = log->log_start;
+
+	spin_lock_irq(&log->io_list_lock);
+	list_add_tail(&io->log_sibling, &log->running_ios);
+	spin_unlock_irq(&log->io_list_lock);
+
+	return io;
+}
+
+static void r5l_get_meta(struct r5l_log *log, unsigned int payload_size)
+{
+	if (log->current_io &&
+	    log->current_io->meta_offset + payload_size > PAGE_SIZE)
+		r5l_submit_current_io(log);
+
+	if (!log->current_io)
+		log->current_io = r5l_new_meta(log);
+}
+
+static void r5l_append_payload_meta(struct r5l_io_unit *io, u16 type,
+				    int disk, sector_t location, u32 checksum)
+{
+	struct r5l_payload *payload;
+
+	payload = page_address(io->meta_page) + io->meta_offset;
+	payload->type = cpu_to_le16(type);
+	payload->disk = cpu_to_le16(disk);
+	payload->checksum = cpu_to_le32(checksum);
+	payload->location = cpu_to_le64(location);
+	io->meta_offset += sizeof(struct r5l_payload);
+}
+
+static void r5l_append_payload_page(struct r5l_log *log, struct page *page)
+{
+	struct r5l_io_unit *io = log->current_io;
+
+	/* a bio cannot wrap around the end of the journal */
+	if (log->log_start == 0 ||
+	    !bio_add_page(io->current_bio, page, PAGE_SIZE, 0)) {
+		bio_list_add(&io->bios, io->current_bio);
+		io->current_bio = r5l_bio_alloc(log, io);
+		bio_add_page(io->current_bio, page, PAGE_SIZE, 0);
+	}
+
+	log->log_start = r5l_ring_add(log, log->log_start, BLOCK_SECTORS);
+	io->log_end = log->log_start;
+}
+
+static void r5l_log_stripe(struct r5l_log *log, struct stripe_head *sh,
+			   int write_disks)
+{
+	struct r5l_io_unit *io;
+	int i;
+
+	r5l_get_meta(log, write_disks * sizeof(struct r5l_payload));
+	io = log->current_io;
+
+	for (i = 0; i < sh->disks; i++) {
+		if (!test_bit(R5_Wantwrite, &sh->dev[i].flags))
+			continue;
+		r5l_append_payload_meta(io,
+					(i == sh->pd_idx || i == sh->qd_idx) ?
+					R5LOG_PAYLOAD_PARITY :
+					R5LOG_PAYLOAD_DATA,
+					i, sh->sector, sh->dev[i].log_checksum);
+		r5l_append_payload_page(log, sh->dev[i].page);
+	}
+
+	list_add_tail(&sh->log_list, &io->stripe_list);
+	atomic_inc(&io->pending_stripe);
+	sh->log_io = io;
+}
+
+static void r5l_wake_reclaim(struct r5l_log *log)
+{
+	md_wakeup_thread(log->reclaim_thread);
+}
+
+/*
+ * Called from ops_run_io().  Returns 0 if the journal has taken the
+ * stripe, which then must not be written to the array until the
+ * journal hands it back with STRIPE_HANDLE set.  Returns -EAGAIN if the
+ * stripe is to be written to the array right away.
+ */
+int r5l_write_stripe(struct r5l_log *log, struct stripe_head *sh)
+{
+	int write_disks = 0;
+	int reserve;
+	void *addr;
+	int i;
+
+	if (!log)
+		return -EAGAIN;
+
+	if (sh->log_io) {
+		/* journalled already; go on once it is stable */
+		if (test_bit(STRIPE_LOG_TRAPPED, &sh->state))
+			return 0;
+		return -EAGAIN;
+	}
+
+	/*
+	 * Only a stripe that rewrites its parity can open a write hole.
+	 * Resync writes are recomputed from the data if interrupted.
+	 */
+	if (!test_bit(R5_Wantwrite, &sh->dev[sh->pd_idx].flags) ||
+	    test_bit(STRIPE_SYNCING, &sh->state) ||
+	    test_bit(Faulty, &log->rdev->flags))
+		return -EAGAIN;
+
+	for (i = 0; i < sh->disks; i++) {
+		if (!test_bit(R5_Wantwrite, &sh->dev[i].flags))
+			continue;
+		write_disks++;
+		addr = kmap_atomic(sh->dev[i].page);
+		sh->dev[i].log_checksum = crc32_le(log->uuid_checksum,
+						   addr, PAGE_SIZE);
+		kunmap_atomic(addr);
+	}
+
+	/* a stripe has to fit in a single meta block */
+	if (sizeof(struct r5l_meta_block) +
+	    write_disks * sizeof(struct r5l_payload) > PAGE_SIZE)
+		return -EAGAIN;
+
+	set_bit(STRIPE_LOG_TRAPPED, &sh->state);
+	/* dropped once the journal is done with the stripe */
+	atomic_inc(&sh->count);
+
+	mutex_lock(&log->io_mutex);
+	/* room for a new meta block and the stripe */
+	reserve = (1 + write_disks) * BLOCK_SECTORS;
+	if (r5l_has_free_space(log, reserve))
+		r5l_log_stripe(log, sh, write_disks);
+	else {
+		spin_lock(&log->no_space_stripes_lock);
+		list_add_tail(&sh->log_list, &log->no_space_stripes);
+		spin_unlock(&log->no_space_stripes_lock);
+
+		/* whatever is queued has to complete before space frees up */
+		r5l_submit_current_io(log);
+		r5l_wake_reclaim(log);
+	}
+	mutex_unlock(&log->io_mutex);
+
+	return 0;
+}
+
+/* Sends the batch of stripes collected so far to the journal. */
+void r5l_write_stripe_run(struct r5l_log *log)
+{
+	if (!log)
+		return;
+	mutex_lock(&log->io_mutex);
+	r5l_submit_current_io(log);
+	mutex_unlock(&log->io_mutex);
+}
+
+static void r5l_log_flush_endio(struct bio *bio, int error)
+{
+	struct r5l_log *log = container_of(bio, struct r5l_log, flush_bio);
+	struct r5l_io_unit *io;
+	struct stripe_head *sh;
+	unsigned long flags;
+
+	if (error)
+		md_error(log->rdev->mddev, log->rdev);
+
+	spin_lock_irqsave(&log->io_list_lock, flags);
+	list_for_each_entry(io, &log->flushing_ios, log_sibling) {
+		while (!list_empty(&io->stripe_list)) {
+			sh = list_first_entry(&io->stripe_list,
+					      struct stripe_head, log_list);
+			list_del_init(&sh->log_list);
+			clear_bit(STRIPE_LOG_TRAPPED, &sh->state);
+			set_bit(STRIPE_HANDLE, &sh->state);
+			raid5_release_stripe(sh);
+		}
+	}
+	list_splice_tail_init(&log->flushing_ios, &log->finished_ios);
+	spin_unlock_irqrestore(&log->io_list_lock, flags);
+
+	/* there may be more io_units waiting for a flush */
+	md_wakeup_thread(log->rdev->mddev->thread);
+}
+
+/*
+ * Called by raid5d.  Makes the io_units written to the journal so far
+ * stable with a cache flush, after which their stripes are released to
+ * the array.  Only one flush is in flight at a time; io_units completing
+ * meanwhile wait for the next one.
+ */
+void r5l_flush_stripe_to_raid(struct r5l_log *log)
+{
+	if (!log)
+		return;
+
+	spin_lock_irq(&log->io_list_lock);
+	if (!list_empty(&log->flushing_ios) ||
+	    list_empty(&log->io_end_ios)) {
+		spin_unlock_irq(&log->io_list_lock);
+		return;
+	}
+	list_splice_tail_init(&log->io_end_ios, &log->flushing_ios);
+	spin_unlock_irq(&log->io_list_lock);
+
+	bio_init(&log->flush_bio);
+	log->flush_bio.bi_bdev = log->rdev->bdev;
+	log->flush_bio.bi_end_io = r5l_log_flush_endio;
+	submit_bio(WRITE_FLUSH, &log->flush_bio);
+}
+
+/* io_list_lock is held */
+static struct r5l_io_unit *r5l_last_reclaimable(struct r5l_log *log)
+{
+	struct r5l_io_unit *io, *last = NULL;
+
+	list_for_each_entry(io, &log->finished_ios, log_sibling) {
+		if (io->state < IO_UNIT_STRIPE_END)
+			break;
+		last = io;
+	}
+	return last;
+}
+
+static void __r5l_stripe_write_finished(struct r5l_io_unit *io)
+{
+	struct r5l_log *log = io->log;
+	struct r5l_io_unit *last;
+	unsigned long flags;
+	bool wake = false;
+
+	spin_lock_irqsave(&log->io_list_lock, flags);
+	io->state = IO_UNIT_STRIPE_END;
+	/* only the oldest io_unit finishing can make space reclaimable */
+	if (io == list_first_entry(&log->finished_ios, struct r5l_io_unit,
+				   log_sibling)) {
+		last = r5l_last_reclaimable(log);
+		wake = r5l_ring_distance(log, log->last_checkpoint,
+					 last->log_start) > log->max_free_space;
+	}
+	spin_unlock_irqrestore(&log->io_list_lock, flags);
+
+	spin_lock_irqsave(&log->no_space_stripes_lock, flags);
+	if (!list_empty(&log->no_space_stripes))
+		wake = true;
+	spin_unlock_irqrestore(&log->no_space_stripes_lock, flags);
+
+	if (wake)
+		r5l_wake_reclaim(log);
+}
+
+/*
+ * Called once all blocks of a journalled stripe have been written to
+ * the array.
+ */
+void r5l_stripe_write_finished(struct stripe_head *sh)
+{
+	struct r5l_io_unit *io = sh->log_io;
+
+	if (!io)
+		return;
+	sh->log_io = NULL;
+
+	if (atomic_dec_and_test(&io->pending_stripe))
+		__r5l_stripe_write_finished(io);
+}
+
+static void r5l_run_no_space_stripes(struct r5l_log *log)
+{
+	struct stripe_head *sh;
+
+	spin_lock(&log->no_space_stripes_lock);
+	while (!list_empty(&log->no_space_stripes)) {
+		sh = list_first_entry(&log->no_space_stripes,
+				      struct stripe_head, log_list);
+		list_del_init(&sh->log_list);
+		clear_bit(STRIPE_LOG_TRAPPED, &sh->state);
+		set_bit(STRIPE_HANDLE, &sh->state);
+		raid5_release_stripe(sh);
+	}
+	spin_unlock(&log->no_space_stripes_lock);
+}
+
+static void r5l_do_reclaim(struct r5l_log *log)
+{
+	struct mddev *mddev = log->rdev->mddev;
+	struct r5l_io_unit *io, *last;
+	sector_t next_checkpoint;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&log->io_list_lock);
+	last = r5l_last_reclaimable(log);
+	if (!last) {
+		spin_unlock_irq(&log->io_list_lock);
+		return;
+	}
+	/*
+	 * The tail has to point at a meta block that is known to be
+	 * valid, so it moves to the newest io_unit reclaimed rather than
+	 * past it.  Replaying that one again is harmless.
+	 */
+	next_checkpoint = last->log_start;
+	list_cut_position(&list, &log->finished_ios, &last->log_sibling);
+	spin_unlock_irq(&log->io_list_lock);
+
+	if (next_checkpoint != log->last_checkpoint) {
+		/*
+		 * md_update_sb() flushes each member device before it
+		 * writes the superblock, so the stripes behind the new
+		 * tail are stable once it is recorded.  Until then the
+		 * space must not be reused.
+		 */
+		log->rdev->journal_tail = next_checkpoint;
+		spin_lock_irq(&mddev->write_lock);
+		set_bit(MD_CHANGE_DEVS, &mddev->flags);
+		set_bit(MD_CHANGE_PENDING, &mddev->flags);
+		spin_unlock_irq(&mddev->write_lock);
+		md_wakeup_thread(mddev->thread);
+		wait_event(mddev->sb_wait,
+			   !test_bit(MD_CHANGE_PENDING, &mddev->flags) ||
+			   kthread_should_stop());
+
+		if (!test_bit(MD_CHANGE_PENDING, &mddev->flags)) {
+			spin_lock_irq(&log->io_list_lock);
+			log->last_checkpoint = next_checkpoint;
+			spin_unlock_irq(&log->io_list_lock);
+		}
+	}
+
+	while (!list_empty(&list)) {
+		io = list_first_entry(&list, struct r5l_io_unit, log_sibling);
+		list_del(&io->log_sibling);
+		r5l_free_io_unit(io);
+	}
+
+	r5l_run_no_space_stripes(log);
+}
+
+static void r5l_reclaim_thread(struct mddev *mddev)
+{
+	struct r5conf *conf = mddev->private;
+	struct r5l_log *log = conf->log;
+
+	if (!log)
+		return;
+	r5l_do_reclaim(log);
+}
+
+/*
+ * Reads the meta block at @pos.  Returns the number of payloads it
+ * describes, or a negative error if it is not a valid continuation of
+ * the log: unless @first, its seq has to be *@seq.
+ */
+static int r5l_read_meta_block(struct r5l_log *log, struct page *page,
+			       sector_t pos, u64 *seq, bool first)
+{
+	struct r5l_meta_block *mb;
+	u32 stored_crc, crc, meta_size;
+
+	if (!sync_page_io(log->rdev, pos, PAGE_SIZE, page, READ, false))
+		return -EIO;
+
+	mb = page_address(page);
+	stored_crc = le32_to_cpu(mb->checksum);
+	mb->checksum = 0;
+	crc = crc32_le(log->uuid_checksum, (void *)mb, PAGE_SIZE);
+	if (le32_to_cpu(mb->magic) != R5LOG_MAGIC ||
+	    mb->version != R5LOG_VERSION ||
+	    stored_crc != crc ||
+	    le64_to_cpu(mb->position) != pos ||
+	    (!first && le64_to_cpu(mb->seq) != *seq))
+		return -EINVAL;
+
+	meta_size = le32_to_cpu(mb->meta_size);
+	if (meta_size < sizeof(struct r5l_meta_block) ||
+	    meta_size > PAGE_SIZE ||
+	    (meta_size - sizeof(struct r5l_meta_block)) %
+	    sizeof(struct r5l_payload))
+		return -EINVAL;
+
+	*seq = le64_to_cpu(mb->seq);
+	return (meta_size - sizeof(struct r5l_meta_block)) /
+		sizeof(struct r5l_payload);
+}
+
+/* Checks that every block of an io_unit made it to the journal. */
+static bool r5l_payloads_valid(struct r5l_log *log, struct r5conf *conf,
+			       struct r5l_meta_block *mb, sector_t pos,
+			       int count, struct page *page)
+{
+	struct r5l_payload *payload;
+	void *addr;
+	u32 crc;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		payload = &mb->payloads[i];
+		if (le16_to_cpu(payload->disk) >= conf->raid_disks ||
+		    le64_to_cpu(payload->location) + BLOCK_SECTORS >
+		    conf->mddev->dev_sectors)
+			return false;
+
+		pos = r5l_ring_add(log, pos, BLOCK_SECTORS);
+		if (!sync_page_io(log->rdev, pos, PAGE_SIZE, page, READ, false))
+			return false;
+		addr = kmap_atomic(page);
+		crc = crc32_le(log->uuid_checksum, addr, PAGE_SIZE);
+		kunmap_atomic(addr);
+		if (crc != le32_to_cpu(payload->checksum))
+			return false;
+	}
+	return true;
+}
+
+static void r5l_replay_block(struct r5conf *conf, struct md_rdev *rdev,
+			     sector_t location, struct page *page)
+{
+	if (!rdev || test_bit(Faulty, &rdev->flags))
+		return;
+	if (!sync_page_io(rdev, location, PAGE_SIZE, page, WRITE, false))
+		md_error(conf->mddev, rdev);
+}
+
+static void r5l_replay_payloads(struct r5l_log *log, struct r5conf *conf,
+				struct r5l_meta_block *mb, sector_t pos,
+				int count, struct page *page)
+{
+	struct r5l_payload *payload;
+	struct disk_info *disk;
+	sector_t location;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		payload = &mb->payloads[i];
+		disk = conf->disks + le16_to_cpu(payload->disk);
+		location = le64_to_cpu(payload->location);
+
+		pos = r5l_ring_add(log, pos, BLOCK_SECTORS);
+		if (!sync_page_io(log->rdev, pos, PAGE_SIZE, page, READ, false))
+			continue;
+		r5l_replay_block(conf, disk->rdev, location, page);
+		r5l_replay_block(conf, disk->replacement, location, page);
+	}
+}
+
+/*
+ * Replays the journal from its tail and starts a new log where the
+ * valid part ends.  The new log starts with an empty meta block of a
+ * random sequence number, so nothing left over from before the crash
+ * can pass for a continuation of it.
+ */
+static int r5l_recovery_log(struct r5l_log *log, struct r5conf *conf)
+{
+	struct mddev *mddev = conf->mddev;
+	struct page *meta_page, *page;
+	struct r5l_meta_block *mb;
+	sector_t pos = log->rdev->journal_tail;
+	bool first = true;
+	int replayed = 0;
+	u64 seq = 0;
+	int count, i;
+	int ret = -ENOMEM;
+
+	meta_page = alloc_page(GFP_KERNEL);
+	page = alloc_page(GFP_KERNEL);
+	if (!meta_page || !page)
+		goto out;
+
+	if (pos >= log->device_size || (pos & (BLOCK_SECTORS - 1)))
+		pos = 0;
+
+	while ((count = r5l_read_meta_block(log, meta_page, pos,
+					    &seq, first)) >= 0) {
+		mb = page_address(meta_page);
+		if (!r5l_payloads_valid(log, conf, mb, pos, count, page))
+			break;
+		r5l_replay_payloads(log, conf, mb, pos, count, page);
+		pos = r5l_ring_add(log, pos, BLOCK_SECTORS * (1 + count));
+		seq++;
+		first = false;
+		replayed += count;
+	}
+
+	if (replayed) {
+		printk(KERN_INFO "md/raid:%s: replayed %d blocks from journal\n",
+		       mdname(mddev), replayed);
+		/* the replayed stripes must be stable before the log moves */
+		for (i = 0; i < conf->raid_disks; i++) {
+			struct md_rdev *rdev = conf->disks[i].rdev;
+			struct md_rdev *rrdev = conf->disks[i].replacement;
+
+			if (rdev && !test_bit(Faulty, &rdev->flags))
+				blkdev_issue_flush(rdev->bdev, GFP_KERNEL, NULL);
+			if (rrdev && !test_bit(Faulty, &rrdev->flags))
+				blkdev_issue_flush(rrdev->bdev, GFP_KERNEL, NULL);
+		}
+	}
+
+	get_random_bytes(&log->seq, sizeof(log->seq));
+	memset(page_address(meta_page), 0, PAGE_SIZE);
+	mb = page_address(meta_page);
+	mb->magic = cpu_to_le32(R5LOG_MAGIC);
+	mb->version = R5LOG_VERSION;
+	mb->meta_size = cpu_to_le32(sizeof(struct r5l_meta_block));
+	mb->seq = cpu_to_le64(log->seq);
+	mb->position = cpu_to_le64(pos);
+	mb->checksum = cpu_to_le32(crc32_le(log->uuid_checksum,
+					    (void *)mb, PAGE_SIZE));
+	if (!sync_page_io(log->rdev, pos, PAGE_SIZE, meta_page,
+			  WRITE_FUA, false)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	log->last_checkpoint = pos;
+	log->seq++;
+	log->log_start = r5l_ring_add(log, pos, BLOCK_SECTORS);
+
+	if (log->rdev->journal_tail != pos) {
+		/* recorded by md_run() before the array goes live */
+		log->rdev->journal_tail = pos;
+		set_bit(MD_CHANGE_DEVS, &mddev->flags);
+	}
+	ret = 0;
+out:
+	if (meta_page)
+		__free_page(meta_page);
+	if (page)
+		__free_page(page);
+	return ret;
+}
+
+int r5l_init_log(struct r5conf *conf, struct md_rdev *rdev)
+{
+	struct r5l_log *log;
+	char b[BDEVNAME_SIZE];
+
+	if (PAGE_SIZE != 4096) {
+		printk(KERN_ERR "md/raid:%s: the journal needs 4K pages\n",
+		       mdname(conf->mddev));
+		return -EINVAL;
+	}
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+
+	log->rdev = rdev;
+	log->uuid_checksum = crc32_le(~0, conf->mddev->uuid,
+				      sizeof(conf->mddev->uuid));
+	log->device_size = round_down(rdev->sectors, BLOCK_SECTORS);
+	log->max_free_space = min_t(sector_t,
+				    log->device_size >> RECLAIM_MAX_FREE_SPACE_SHIFT,
+				    RECLAIM_MAX_FREE_SPACE);
+	if (log->device_size < 4 * R5L_MAX_IO_BLOCKS * BLOCK_SECTORS) {
+		printk(KERN_ERR "md/raid:%s: journal device %s is too small\n",
+		       mdname(conf->mddev), bdevname(rdev->bdev, b));
+		goto out;
+	}
+
+	mutex_init(&log->io_mutex);
+	spin_lock_init(&log->io_list_lock);
+	INIT_LIST_HEAD(&log->running_ios);
+	INIT_LIST_HEAD(&log->io_end_ios);
+	INIT_LIST_HEAD(&log->flushing_ios);
+	INIT_LIST_HEAD(&log->finished_ios);
+	INIT_LIST_HEAD(&log->no_space_stripes);
+	spin_lock_init(&log->no_space_stripes_lock);
+
+	if (r5l_recovery_log(log, conf)) {
+		printk(KERN_ERR "md/raid:%s: failed to recover journal %s\n",
+		       mdname(conf->mddev), bdevname(rdev->bdev, b));
+		goto out;
+	}
+
+	log->reclaim_thread = md_register_thread(r5l_reclaim_thread,
+						 conf->mddev, "reclaim");
+	if (!log->reclaim_thread)
+		goto out;
+
+	conf->log = log;
+	return 0;
+out:
+	kfree(log);
+	return -EINVAL;
+}
+
+void r5l_exit_log(struct r5l_log *log)
+{
+	struct r5l_io_unit *io, *next;
+
+	if (!log)
+		return;
+
+	md_unregister_thread(&log->reclaim_thread);
+	/* the array is idle, so whatever is left is on the array already */
+	list_for_each_entry_safe(io, next, &log->finished_ios, log_sibling) {
+		list_del(&io->log_sibling);
+		r5l_free_io_unit(io);
+	}
+	kfree(log);
+}
@@ -92,8 +92,15 @@
  * not hashed must be on the inactive_list, and will normally be at
  * the front.  All stripes start life this way.
  *
- * The inactive_list, handle_list and hash bucket lists are all protected by the
- * device_lock.
+ * The handle_list is protected by the device_lock.  The stripe cache is
+ * split into NR_STRIPE_HASH_LOCKS parts by sector: each part has its
+ * own inactive_list and its share of the hash buckets, protected by its
+ * own hash_lock, so that looking up or allocating stripes in different
+ * parts does not contend.  A hash_lock is always taken before the
+ * device_lock.  Releasing a stripe happens under the device_lock, so
+ * stripes that become inactive are first collected on a private
+ * temp_inactive_list and moved to the inactive_list once the
+ * device_lock has been dropped.
  *  - stripes have a reference counter. If count==0, they are on a list.
  *  - If a stripe might need handling, STRIPE_HANDLE is set.
  *  - When refcount reaches zero, then if STRIPE_HANDLE it is put on
@@ -117,7 +124,7 @@
  *		(lockdev check-buffers unlockdev) ..
  *		change-state ..
  *		record io/ops needed clearSTRIPE_ACTIVE schedule io/ops
- *  release an active stripe (release_stripe())
+ *  release an active stripe (raid5_release_stripe())
  *     lockdev if (!--cnt) { if  STRIPE_HANDLE, add to handle_list else add to inactive-list } unlockdev
  *
  * The refcount counts each thread that have activated the stripe,
@@ -125,6 +132,12 @@
  * on a cached buffer, and plus one if the stripe is undergoing stripe
  * operations.
  *
+ * If the array has a write journal, ops_run_io() first sends the blocks
+ * of a stripe that is updating its parity to the journal (raid5-cache.c).
+ * The stripe stays STRIPE_LOG_TRAPPED, and handle_stripe() leaves it
+ * alone, until that write is stable; only then do the same blocks go to
+ * the member devices.
+ *
  * The stripe operations are:
  * -copying data between the stripe cache and user application buffers
  * -computing blocks to save a disk access, or to recover a missing block
@@ -200,6 +213,9 @@ struct stripe_head {
 	struct r5conf		*raid_conf;
 	short			generation;	/* increments with every
 						 * reshape */
+	int			hash_lock_index;
+	int			cpu;		/* cpu that last activated it */
+	struct r5worker_group	*group;		/* handle_list it is on */
 	sector_t		sector;		/* sector of this row */
 	short			pd_idx;		/* parity disk index */
 	short			qd_idx;		/* 'Q' disk index for raid6 */
@@ -211,6 +227,9 @@ struct stripe_head {
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
 	spinlock_t		stripe_lock;
+	struct r5l_io_unit	*log_io;	/* journal write it is part of */
+	struct list_head	log_list;	/* on the io_unit, or waiting
+						 * for journal space */
 	/**
 	 * struct stripe_operations
 	 * @target - STRIPE_OP_COMPUTE_BLK target
@@ -236,6 +255,7 @@ struct stripe_head {
 		struct bio	*toread, *read, *towrite, *written;
 		sector_t	sector;			/* sector of this page */
 		unsigned long	flags;
+		u32		log_checksum;		/* of page, for the journal */
 	} dev[1]; /* allocated with extra space depending of RAID geometry */
 };
 
@@ -322,6 +342,7 @@ enum {
 	STRIPE_COMPUTE_RUN,
 	STRIPE_OPS_REQ_PENDING,
 	STRIPE_ON_UNPLUG_LIST,
+	STRIPE_LOG_TRAPPED,	/* held until its journal write is stable */
 };
 
 /*
@@ -364,8 +385,39 @@ struct disk_info {
 	struct md_rdev	*rdev, *replacement;
 };
 
+/* NOTE NR_STRIPE_HASH_LOCKS must remain below 64.
+ * This is because we sometimes take all the spinlocks
+ * and creating that much locking depth can cause
+ * problems.
+ */
+#define NR_STRIPE_HASH_LOCKS 8
+#define STRIPE_HASH_LOCKS_MASK (NR_STRIPE_HASH_LOCKS - 1)
+
+/*
+ * Stripe handling can be spread over worker threads in addition to
+ * raid5d.  There is one group of workers per NUMA node; a stripe is
+ * queued on the group of the cpu that last activated it.
+ */
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	bool			working;
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct r5conf		*conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+};
+
+#define ANY_GROUP NUMA_NO_NODE
+
 struct r5conf {
 	struct hlist_head	*stripe_hashtbl;
+	/* only protect corresponding hash list and inactive_list */
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
 	struct mddev		*mddev;
 	int			chunk_sectors;
 	int			level, algorithm;
@@ -445,7 +497,10 @@ struct r5conf {
 	 * Free stripes pool
 	 */
 	atomic_t		active_stripes;
-	struct list_head	inactive_list;
+	struct list_head	inactive_list[NR_STRIPE_HASH_LOCKS];
+	atomic_t		empty_inactive_list_nr;
+	/* stripes released by raid5d, not yet on an inactive_list */
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
 	wait_queue_head_t	wait_for_stripe;
 	wait_queue_head_t	wait_for_overlap;
 	int			inactive_blocked;	/* release of inactive stripes blocked,
@@ -459,6 +514,10 @@ struct r5conf {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct md_thread	*thread;
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+	int			worker_cnt_per_group;
+	struct r5l_log		*log;		/* write journal, if any */
 };
 
 /*
@@ -526,4 +585,12 @@ static inline int algorithm_is_DDF(int layout)
 extern int md_raid5_congested(struct mddev *mddev, int bits);
 extern void md_raid5_kick_device(struct r5conf *conf);
 extern int raid5_set_cache_size(struct mddev *mddev, int size);
+extern void raid5_release_stripe(struct stripe_head *sh);
+
+extern int r5l_init_log(struct r5conf *conf, struct md_rdev *rdev);
+extern void r5l_exit_log(struct r5l_log *log);
+extern int r5l_write_stripe(struct r5l_log *log, struct stripe_head *sh);
+extern void r5l_write_stripe_run(struct r5l_log *log);
+extern void r5l_flush_stripe_to_raid(struct r5l_log *log);
+extern void r5l_stripe_write_finished(struct stripe_head *sh);
 #endif
@@ -4950,11 +4950,17 @@ static void e1000_tx_queue(struct e1000_ring *tx_ring, int tx_flags, int count)
 	wmb();
 
 	tx_ring->next_to_use = i;
+}
+
+/* Let the hardware know about the descriptors queued so far */
+static void e1000_tx_kick(struct e1000_ring *tx_ring)
+{
+	struct e1000_adapter *adapter = tx_ring->adapter;
 
 	if (adapter->flags2 & FLAG2_PCIM2PCI_ARBITER_WA)
-		e1000e_update_tdt_wa(tx_ring, i);
+		e1000e_update_tdt_wa(tx_ring, tx_ring->next_to_use);
 	else
-		writel(i, tx_ring->tail);
+		writel(tx_ring->next_to_use, tx_ring->tail);
 
 	/*
 	 * we need this if more than one processor can write to our tail
@@ -5151,10 +5157,18 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 				    (MAX_SKB_FRAGS *
 				     DIV_ROUND_UP(PAGE_SIZE,
 						  adapter->tx_fifo_limit) + 2));
+
+		/* the last packet of a batch rings the doorbell */
+		if (!skb->xmit_more ||
+		    netif_xmit_stopped(netdev_get_tx_queue(netdev, 0)))
+			e1000_tx_kick(tx_ring);
 	} else {
 		dev_kfree_skb_any(skb);
 		tx_ring->buffer_info[first].time_stamp = 0;
 		tx_ring->next_to_use = first;
+
+		/* flush packets deferred by xmit_more before this one */
+		e1000_tx_kick(tx_ring);
 	}
 
 	return NETDEV_TX_OK;
@@ -35,11 +35,13 @@
 #include <linux/interrupt.h>
 #include <linux/ip.h>
 #include <linux/tcp.h>
+#include <linux/udp.h>
 #include <linux/sctp.h>
 #include <linux/pkt_sched.h>
 #include <linux/ipv6.h>
 #include <linux/slab.h>
 #include <net/checksum.h>
+#include <net/ip.h>
 #include <net/ip6_checksum.h>
 #include <linux/ethtool.h>
 #include <linux/if.h>
@@ -1411,7 +1413,9 @@ static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
 {
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 
-	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
+	if (ixgbe_qv_busy_polling(q_vector))
+		netif_receive_skb(skb);
+	else if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
 		napi_gro_receive(&q_vector->napi, skb);
 	else
 		netif_rx(skb);
@@ -1633,6 +1637,72 @@ static void ixgbe_add_rx_frag(struct ixgbe_ring *rx_ring,
 	skb->truesize += ixgbe_rx_bufsz(rx_ring);
 }
 
+/**
+ * ixgbe_rx_filter_drop - run the early receive filter on a raw buffer
+ * @rx_ring: rx descriptor ring the buffer belongs to
+ * @rx_buffer: first buffer of the frame, no skb attached yet
+ * @rx_desc: descriptor containing length of buffer written by hardware
+ * @data: start of the frame in the buffer
+ *
+ * Runs the netdev rx filter on single buffer frames before any skb is
+ * allocated for them.  A dropped frame leaves its half page untouched, so
+ * the buffer is handed straight back to the ring.
+ *
+ * Returns true if the frame was dropped and next_to_clean advanced
+ **/
+static bool ixgbe_rx_filter_drop(struct ixgbe_ring *rx_ring,
+				 struct ixgbe_rx_buffer *rx_buffer,
+				 union ixgbe_adv_rx_desc *rx_desc,
+				 void *data)
+{
+	unsigned int size = le16_to_cpu(rx_desc->wb.upper.length);
+	struct ixgbe_rx_buffer *new_buff;
+	u16 nta = rx_ring->next_to_alloc;
+	u32 ntc;
+
+	if (likely(!rcu_access_pointer(rx_ring->netdev->rx_filter)))
+		return false;
+
+	/* RSC and jumbo frames spanning several buffers take the slow path */
+	if (!ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP))
+		return false;
+
+	dma_sync_single_range_for_cpu(rx_ring->dev, rx_buffer->dma,
+				      rx_buffer->page_offset, size,
+				      DMA_FROM_DEVICE);
+
+	if (!netdev_rx_filter_drop(rx_ring->netdev, data, size))
+		return false;
+
+	/* give the same half page back to the hardware */
+	new_buff = &rx_ring->rx_buffer_info[nta];
+	nta++;
+	rx_ring->next_to_alloc = (nta < rx_ring->count) ? nta : 0;
+
+	new_buff->page = rx_buffer->page;
+	new_buff->dma = rx_buffer->dma;
+	new_buff->page_offset = rx_buffer->page_offset;
+
+	dma_sync_single_range_for_device(rx_ring->dev, new_buff->dma,
+					 new_buff->page_offset,
+					 ixgbe_rx_bufsz(rx_ring),
+					 DMA_FROM_DEVICE);
+
+	rx_buffer->dma = 0;
+	rx_buffer->page = NULL;
+
+	/* fetch, update, and store next to clean */
+	ntc = rx_ring->next_to_clean + 1;
+	ntc = (ntc < rx_ring->count) ? ntc : 0;
+	rx_ring->next_to_clean = ntc;
+
+	prefetch(IXGBE_RX_DESC(rx_ring, ntc));
+
+	rx_ring->rx_stats.filter_drops++;
+
+	return true;
+}
+
 /**
  * ixgbe_clean_rx_irq - Clean completed descriptors from Rx ring - bounce buf
  * @q_vector: structure containing interrupt and ring information
@@ -1644,11 +1714,11 @@ static void ixgbe_add_rx_frag(struct ixgbe_ring *rx_ring,
  * expensive overhead for IOMMU access this provides a means of avoiding
  * it by maintaining the mapping of the page to the syste.
  *
- * Returns true if all work is completed without reaching budget
+ * Returns amount of work completed
  **/
-static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
+static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			       struct ixgbe_ring *rx_ring,
-			       int budget)
+			       const int budget)
 {
 	unsigned int total_rx_bytes = 0, total_rx_packets = 0;
 #ifdef IXGBE_FCOE
@@ -1657,7 +1727,7 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
 
-	do {
+	while (likely(total_rx_packets < budget)) {
 		struct ixgbe_rx_buffer *rx_buffer;
 		union ixgbe_adv_rx_desc *rx_desc;
 		struct sk_buff *skb;
@@ -1699,6 +1769,15 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			prefetch(page_addr + L1_CACHE_BYTES);
 #endif
 
+			if (ixgbe_rx_filter_drop(rx_ring, rx_buffer, rx_desc,
+						 page_addr)) {
+				total_rx_bytes += le16_to_cpu(
+						rx_desc->wb.upper.length);
+				total_rx_packets++;
+				cleaned_count++;
+				continue;
+			}
+
 			/* allocate a skb to store the frags */
 			skb = netdev_alloc_skb_ip_align(rx_ring->netdev,
 							IXGBE_RX_HDR_SIZE);
@@ -1782,11 +1861,9 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 		}
 
 #endif /* IXGBE_FCOE */
+		skb_mark_napi_id(skb, &q_vector->napi);
 		ixgbe_rx_skb(q_vector, skb);
-
-		/* update budget accounting */
-		budget--;
-	} while (likely(budget));
+	}
 
 #ifdef IXGBE_FCOE
 	/* include DDPed FCoE data */
@@ -1813,8 +1890,36 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	if (cleaned_count)
 		ixgbe_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return !!budget;
+	return total_rx_packets;
+}
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called with local_bh_disable()d */
+static int ixgbe_low_latency_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+			container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	struct ixgbe_ring  *ring;
+	int found = 0;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		found = ixgbe_clean_rx_irq(q_vector, ring, 4);
+		if (found)
+			break;
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
 }
+#endif	/* CONFIG_NET_RX_BUSY_POLL */
 
 /**
  * ixgbe_configure_msix - Configure MSI-X hardware
@@ -2368,6 +2473,10 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	ixgbe_for_each_ring(ring, q_vector->tx)
 		clean_complete &= !!ixgbe_clean_tx_irq(q_vector, ring);
 
+	/* a socket is busy polling this vector, let it have the rx rings */
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	/* attempt to distribute budget to each queue fairly, but don't allow
 	 * the budget to go below 1 because we'll exit polling */
 	if (q_vector->rx.count > 1)
@@ -2376,9 +2485,10 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 		per_ring_budget = budget;
 
 	ixgbe_for_each_ring(ring, q_vector->rx)
-		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
-						     per_ring_budget);
+		clean_complete &= (ixgbe_clean_rx_irq(q_vector, ring,
+				   per_ring_budget) < per_ring_budget);
 
+	ixgbe_qv_unlock_napi(q_vector);
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
 		return budget;
@@ -3571,16 +3681,21 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
+		ixgbe_qv_init_lock(adapter->q_vector[q_idx]);
 		napi_enable(&adapter->q_vector[q_idx]->napi);
+	}
 }
 
 static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 {
 	int q_idx;
 
-	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++)
+	for (q_idx = 0; q_idx < adapter->num_q_vectors; q_idx++) {
 		napi_disable(&adapter->q_vector[q_idx]->napi);
+		while (!ixgbe_qv_lock_napi(adapter->q_vector[q_idx]))
+			usleep_range(1000, 20000);
+	}
 }
 
 #ifdef CONFIG_IXGBE_DCB
@@ -5076,7 +5191,7 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 	u32 i, missed_rx = 0, mpc, bprc, lxon, lxoff, xon_off_tot;
 	u64 non_eop_descs = 0, restart_queue = 0, tx_busy = 0;
 	u64 alloc_rx_page_failed = 0, alloc_rx_buff_failed = 0;
-	u64 bytes = 0, packets = 0, hw_csum_rx_error = 0;
+	u64 bytes = 0, packets = 0, hw_csum_rx_error = 0, filter_drops = 0;
 
 	if (test_bit(__IXGBE_DOWN, &adapter->state) ||
 	    test_bit(__IXGBE_RESETTING, &adapter->state))
@@ -5099,6 +5214,7 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 		alloc_rx_page_failed += rx_ring->rx_stats.alloc_rx_page_failed;
 		alloc_rx_buff_failed += rx_ring->rx_stats.alloc_rx_buff_failed;
 		hw_csum_rx_error += rx_ring->rx_stats.csum_err;
+		filter_drops += rx_ring->rx_stats.filter_drops;
 		bytes += rx_ring->stats.bytes;
 		packets += rx_ring->stats.packets;
 	}
@@ -5106,6 +5222,7 @@ void ixgbe_update_stats(struct ixgbe_adapter *adapter)
 	adapter->alloc_rx_page_failed = alloc_rx_page_failed;
 	adapter->alloc_rx_buff_failed = alloc_rx_buff_failed;
 	adapter->hw_csum_rx_error = hw_csum_rx_error;
+	adapter->rx_filter_drops = filter_drops;
 	netdev->stats.rx_bytes = bytes;
 	netdev->stats.rx_packets = packets;
 
@@ -5999,6 +6116,32 @@ static void ixgbe_tx_olinfo_status(union ixgbe_adv_tx_desc *tx_desc,
 #define IXGBE_TXD_CMD (IXGBE_TXD_CMD_EOP | \
 		       IXGBE_TXD_CMD_RS)
 
+static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	/* Herbert's original patch had:
+	 *  smp_mb__after_netif_stop_queue();
+	 * but since that doesn't exist yet, just open code it. */
+	smp_mb();
+
+	/* We need to check again in a case another CPU has just
+	 * made room available. */
+	if (likely(ixgbe_desc_unused(tx_ring) < size))
+		return -EBUSY;
+
+	/* A reprieve! - use start_queue because it doesn't call schedule */
+	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
+	++tx_ring->tx_stats.restart_queue;
+	return 0;
+}
+
+static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
+{
+	if (likely(ixgbe_desc_unused(tx_ring) >= size))
+		return 0;
+	return __ixgbe_maybe_stop_tx(tx_ring, size);
+}
+
 static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 			 struct ixgbe_tx_buffer *first,
 			 const u8 hdr_len)
@@ -6124,8 +6267,14 @@ static void ixgbe_tx_map(struct ixgbe_ring *tx_ring,
 
 	tx_ring->next_to_use = i;
 
-	/* notify HW of packet */
-	writel(i, tx_ring->tail);
+	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
+
+	/*
+	 * notify HW of packet, unless the stack has more packets for this
+	 * ring in the current batch, the last one rings the doorbell
+	 */
+	if (!first->skb->xmit_more || netif_xmit_stopped(txring_txq(tx_ring)))
+		writel(i, tx_ring->tail);
 
 	return;
 dma_error:
@@ -6143,6 +6292,9 @@ dma_error:
 	}
 
 	tx_ring->next_to_use = i;
+
+	/* flush packets deferred by xmit_more before this one */
+	writel(i, tx_ring->tail);
 }
 
 static void ixgbe_atr(struct ixgbe_ring *ring,
@@ -6156,7 +6308,9 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 		struct iphdr *ipv4;
 		struct ipv6hdr *ipv6;
 	} hdr;
-	struct tcphdr *th;
+	__be16 sport, dport;
+	u8 l4_proto;
+	bool sample_now = false;
 	__be16 vlan_id;
 
 	/* if ring doesn't have a interrupt vector, cannot perform ATR */
@@ -6172,21 +6326,44 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 	/* snag network header to get L4 type and address */
 	hdr.network = skb_network_header(first->skb);
 
-	/* Currently only IPv4/IPv6 with TCP is supported */
-	if ((first->protocol != __constant_htons(ETH_P_IPV6) ||
-	     hdr.ipv6->nexthdr != IPPROTO_TCP) &&
-	    (first->protocol != __constant_htons(ETH_P_IP) ||
-	     hdr.ipv4->protocol != IPPROTO_TCP))
+	/* Currently only IPv4/IPv6 with TCP or UDP is supported */
+	if (first->protocol == __constant_htons(ETH_P_IP)) {
+		/* only the first fragment carries the ports */
+		if (ip_is_fragment(hdr.ipv4))
+			return;
+		l4_proto = hdr.ipv4->protocol;
+	} else if (first->protocol == __constant_htons(ETH_P_IPV6)) {
+		l4_proto = hdr.ipv6->nexthdr;
+	} else {
 		return;
+	}
 
-	th = tcp_hdr(first->skb);
+	switch (l4_proto) {
+	case IPPROTO_TCP: {
+		struct tcphdr *th = tcp_hdr(first->skb);
+
+		/* skip this packet since it is invalid or the socket is closing */
+		if (!th || th->fin)
+			return;
+		sport = th->source;
+		dport = th->dest;
+		/* sample on all syn packets */
+		sample_now = th->syn;
+		break;
+	}
+	case IPPROTO_UDP: {
+		struct udphdr *uh = udp_hdr(first->skb);
 
-	/* skip this packet since it is invalid or the socket is closing */
-	if (!th || th->fin)
+		sport = uh->source;
+		dport = uh->dest;
+		break;
+	}
+	default:
 		return;
+	}
 
-	/* sample on all syn packets or once every atr sample count */
-	if (!th->syn && (ring->atr_count < ring->atr_sample_rate))
+	/* or once every atr sample count */
+	if (!sample_now && (ring->atr_count < ring->atr_sample_rate))
 		return;
 
 	/* reset sample count */
@@ -6208,16 +6385,20 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 	 * and write the value to source port portion of compressed dword
 	 */
 	if (first->tx_flags & (IXGBE_TX_FLAGS_SW_VLAN | IXGBE_TX_FLAGS_HW_VLAN))
-		common.port.src ^= th->dest ^ __constant_htons(ETH_P_8021Q);
+		common.port.src ^= dport ^ __constant_htons(ETH_P_8021Q);
 	else
-		common.port.src ^= th->dest ^ first->protocol;
-	common.port.dst ^= th->source;
+		common.port.src ^= dport ^ first->protocol;
+	common.port.dst ^= sport;
 
 	if (first->protocol == __constant_htons(ETH_P_IP)) {
-		input.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_TCPV4;
+		input.formatted.flow_type = l4_proto == IPPROTO_TCP ?
+					    IXGBE_ATR_FLOW_TYPE_TCPV4 :
+					    IXGBE_ATR_FLOW_TYPE_UDPV4;
 		common.ip ^= hdr.ipv4->saddr ^ hdr.ipv4->daddr;
 	} else {
-		input.formatted.flow_type = IXGBE_ATR_FLOW_TYPE_TCPV6;
+		input.formatted.flow_type = l4_proto == IPPROTO_TCP ?
+					    IXGBE_ATR_FLOW_TYPE_TCPV6 :
+					    IXGBE_ATR_FLOW_TYPE_UDPV6;
 		common.ip ^= hdr.ipv6->saddr.s6_addr32[0] ^
 			     hdr.ipv6->saddr.s6_addr32[1] ^
 			     hdr.ipv6->saddr.s6_addr32[2] ^
@@ -6233,32 +6414,6 @@ static void ixgbe_atr(struct ixgbe_ring *ring,
 					      input, common, ring->queue_index);
 }
 
-static int __ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	netif_stop_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	/* Herbert's original patch had:
-	 *  smp_mb__after_netif_stop_queue();
-	 * but since that doesn't exist yet, just open code it. */
-	smp_mb();
-
-	/* We need to check again in a case another CPU has just
-	 * made room available. */
-	if (likely(ixgbe_desc_unused(tx_ring) < size))
-		return -EBUSY;
-
-	/* A reprieve! - use start_queue because it doesn't call schedule */
-	netif_start_subqueue(tx_ring->netdev, tx_ring->queue_index);
-	++tx_ring->tx_stats.restart_queue;
-	return 0;
-}
-
-static inline int ixgbe_maybe_stop_tx(struct ixgbe_ring *tx_ring, u16 size)
-{
-	if (likely(ixgbe_desc_unused(tx_ring) >= size))
-		return 0;
-	return __ixgbe_maybe_stop_tx(tx_ring, size);
-}
-
 static u16 ixgbe_select_queue(struct net_device *dev, struct sk_buff *skb)
 {
 	struct ixgbe_adapter *adapter = netdev_priv(dev);
@@ -6415,11 +6570,12 @@ xmit_fcoe:
 #endif /* IXGBE_FCOE */
 	ixgbe_tx_map(tx_ring, first, hdr_len);
 
-	ixgbe_maybe_stop_tx(tx_ring, DESC_NEEDED);
-
 	return NETDEV_TX_OK;
 
 out_drop:
+	/* flush packets deferred by xmit_more before this one */
+	writel(tx_ring->next_to_use, tx_ring->tail);
+
 	dev_kfree_skb_any(first->skb);
 	first->skb = NULL;
 
@@ -6954,6 +7110,9 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= ixgbe_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= ixgbe_low_latency_recv,
+#endif
 #ifdef IXGBE_FCOE
 	.ndo_fcoe_ddp_setup = ixgbe_fcoe_ddp_get,
 	.ndo_fcoe_ddp_target = ixgbe_fcoe_ddp_target,
@@ -7256,6 +7415,7 @@ static int __devinit ixgbe_probe(struct pci_dev *pdev,
 
 	netdev->priv_flags |= IFF_UNICAST_FLT;
 	netdev->priv_flags |= IFF_SUPP_NOFCS;
+	netdev->priv_flags |= IFF_RX_FILTER;
 
 #ifdef CONFIG_IXGBE_DCB
 	netdev->dcbnl_ops = &dcbnl_ops;
@@ -32,6 +32,7 @@
  */
 
 #include <linux/mlx4/cq.h>
+#include <linux/delay.h>
 #include <linux/mlx4/qp.h>
 #include <linux/mlx4/cmd.h>
 
@@ -133,6 +134,8 @@ int mlx4_en_activate_cq(struct mlx4_en_priv *priv, struct mlx4_en_cq *cq,
 
 	if (!cq->is_tx) {
 		netif_napi_add(cq->dev, &cq->napi, mlx4_en_poll_rx_cq, 64);
+		napi_hash_add(&cq->napi);
+		mlx4_en_cq_init_lock(cq);
 		napi_enable(&cq->napi);
 	}
 
@@ -156,6 +159,15 @@ void mlx4_en_deactivate_cq(struct mlx4_en_priv *priv, struct mlx4_en_cq *cq)
 {
 	if (!cq->is_tx) {
 		napi_disable(&cq->napi);
+		/* wait for a busy polling socket to release the cq */
+		local_bh_disable();
+		while (!mlx4_en_cq_lock_napi(cq)) {
+			local_bh_enable();
+			usleep_range(1000, 2000);
+			local_bh_disable();
+		}
+		local_bh_enable();
+		napi_hash_del(&cq->napi);
 		netif_napi_del(&cq->napi);
 	}
 
@@ -44,6 +44,7 @@ struct macvtap_queue {
 	struct macvlan_dev __rcu *vlan;
 	struct file *file;
 	unsigned int flags;
+	u16 queue_index;
 };
 
 static struct proto macvtap_proto = {
@@ -116,6 +117,7 @@ static int macvtap_set_queue(struct net_device *dev, struct file *file,
 
 	err = 0;
 	index = get_slot(vlan, NULL);
+	q->queue_index = index;
 	rcu_assign_pointer(q->vlan, vlan);
 	rcu_assign_pointer(vlan->taps[index], q);
 	sock_hold(&q->sk);
@@ -163,7 +165,9 @@ static void macvtap_put_queue(struct macvtap_queue *q)
 /*
  * Select a queue based on the rxq of the device on which this packet
  * arrived. If the incoming device is not mq, calculate a flow hash
- * to select a queue. If all fails, find the first available queue.
+ * to select a queue: the queue the flow was last sent on if we know
+ * it, otherwise one picked by the hash. If all fails, find the first
+ * available queue.
  * Cache vlan->numvtaps since it can become zero during the execution
  * of this function.
  */
@@ -181,6 +185,19 @@ static struct macvtap_queue *macvtap_get_queue(struct net_device *dev,
 	/* Check if we can use flow to select a queue */
 	rxq = skb_get_rxhash(skb);
 	if (rxq) {
+		u8 flow = ACCESS_ONCE(vlan->tap_flows[rxq &
+					(MACVTAP_FLOW_ENTRIES - 1)]);
+
+		/*
+		 * The hash is the same in both directions, so this is the
+		 * queue the guest sent the flow on.
+		 */
+		if (flow) {
+			tap = rcu_dereference(vlan->taps[flow - 1]);
+			if (tap)
+				goto out;
+		}
+
 		tap = rcu_dereference(vlan->taps[rxq % numvtaps]);
 		if (tap)
 			goto out;
@@ -644,6 +661,29 @@ static int macvtap_skb_to_vnet_hdr(const struct sk_buff *skb,
 
 
 /* Get packet from user space buffer */
+/*
+ * Remember the queue a multiqueue guest sent this flow on, so that
+ * macvtap_get_queue() steers the replies to the same queue pair and
+ * thus to the guest cpu handling the flow.
+ */
+static void macvtap_record_flow(struct macvlan_dev *vlan,
+				struct macvtap_queue *q, struct sk_buff *skb)
+{
+	u32 rxhash;
+	u8 *flow;
+
+	if (vlan->numvtaps < 2)
+		return;
+
+	rxhash = skb_get_rxhash(skb);
+	if (!rxhash)
+		return;
+
+	flow = &vlan->tap_flows[rxhash & (MACVTAP_FLOW_ENTRIES - 1)];
+	if (*flow != q->queue_index + 1)
+		*flow = q->queue_index + 1;
+}
+
 static ssize_t macvtap_get_user(struct macvtap_queue *q, struct msghdr *m,
 				const struct iovec *iv, unsigned long total_len,
 				size_t count, int noblock)
@@ -743,9 +783,10 @@ static ssize_t macvtap_get_user(struct macvtap_queue *q, struct msghdr *m,
 		skb_shinfo(skb)->destructor_arg = m->msg_control;
 		skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
 	}
-	if (vlan)
+	if (vlan) {
+		macvtap_record_flow(vlan, q, skb);
 		macvlan_start_xmit(skb, vlan->dev);
-	else
+	} else
 		kfree_skb(skb);
 	rcu_read_unlock_bh();
 
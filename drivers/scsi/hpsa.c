@@ -50,6 +50,7 @@
 #include <linux/atomic.h>
 #include <linux/kthread.h>
 #include <linux/jiffies.h>
+#include <linux/percpu_tags.h>
 #include "hpsa_cmd.h"
 #include "hpsa.h"
 
@@ -2649,8 +2650,8 @@ static int hpsa_eh_abort_handler(struct scsi_cmnd *sc)
 
 /*
  * For operations that cannot sleep, a command block is allocated at init,
- * and managed by cmd_alloc() and cmd_free() using a simple bitmap to track
- * which ones are free or in use.  Lock must be held when calling this.
+ * and managed by cmd_alloc() and cmd_free() using a tag pool to track
+ * which ones are free or in use.  No lock is needed to call these.
  * cmd_free() is the complement.
  */
 static struct CommandList *cmd_alloc(struct ctlr_info *h)
@@ -2659,20 +2660,10 @@ static struct CommandList *cmd_alloc(struct ctlr_info *h)
 	int i;
 	union u64bit temp64;
 	dma_addr_t cmd_dma_handle, err_dma_handle;
-	unsigned long flags;
 
-	spin_lock_irqsave(&h->lock, flags);
-	do {
-		i = find_first_zero_bit(h->cmd_pool_bits, h->nr_cmds);
-		if (i == h->nr_cmds) {
-			spin_unlock_irqrestore(&h->lock, flags);
-			return NULL;
-		}
-	} while (test_and_set_bit
-		 (i & (BITS_PER_LONG - 1),
-		  h->cmd_pool_bits + (i / BITS_PER_LONG)) != 0);
-	h->nr_allocs++;
-	spin_unlock_irqrestore(&h->lock, flags);
+	i = percpu_tags_alloc(&h->cmd_pool_tags, GFP_ATOMIC);
+	if (i < 0)
+		return NULL;
 
 	c = h->cmd_pool + i;
 	memset(c, 0, sizeof(*c));
@@ -2736,15 +2727,7 @@ static struct CommandList *cmd_special_alloc(struct ctlr_info *h)
 
 static void cmd_free(struct ctlr_info *h, struct CommandList *c)
 {
-	int i;
-	unsigned long flags;
-
-	i = c - h->cmd_pool;
-	spin_lock_irqsave(&h->lock, flags);
-	clear_bit(i & (BITS_PER_LONG - 1),
-		  h->cmd_pool_bits + (i / BITS_PER_LONG));
-	h->nr_frees++;
-	spin_unlock_irqrestore(&h->lock, flags);
+	percpu_tags_free(&h->cmd_pool_tags, c - h->cmd_pool);
 }
 
 static void cmd_special_free(struct ctlr_info *h, struct CommandList *c)
@@ -4408,16 +4391,17 @@ static __devinit int hpsa_init_reset_devices(struct pci_dev *pdev)
 
 static __devinit int hpsa_allocate_cmd_pool(struct ctlr_info *h)
 {
-	h->cmd_pool_bits = kzalloc(
-		DIV_ROUND_UP(h->nr_cmds, BITS_PER_LONG) *
-		sizeof(unsigned long), GFP_KERNEL);
+	int rc;
+
+	rc = percpu_tags_init(&h->cmd_pool_tags, h->nr_cmds, GFP_KERNEL,
+			      dev_to_node(&h->pdev->dev));
 	h->cmd_pool = pci_alloc_consistent(h->pdev,
 		    h->nr_cmds * sizeof(*h->cmd_pool),
 		    &(h->cmd_pool_dhandle));
 	h->errinfo_pool = pci_alloc_consistent(h->pdev,
 		    h->nr_cmds * sizeof(*h->errinfo_pool),
 		    &(h->errinfo_pool_dhandle));
-	if ((h->cmd_pool_bits == NULL)
+	if (rc
 	    || (h->cmd_pool == NULL)
 	    || (h->errinfo_pool == NULL)) {
 		dev_err(&h->pdev->dev, "out of memory in %s", __func__);
@@ -4428,7 +4412,7 @@ static __devinit int hpsa_allocate_cmd_pool(struct ctlr_info *h)
 
 static void hpsa_free_cmd_pool(struct ctlr_info *h)
 {
-	kfree(h->cmd_pool_bits);
+	percpu_tags_destroy(&h->cmd_pool_tags);
 	if (h->cmd_pool)
 		pci_free_consistent(h->pdev,
 			    h->nr_cmds * sizeof(struct CommandList),
@@ -4923,7 +4907,7 @@ static void __devexit hpsa_remove_one(struct pci_dev *pdev)
 		h->errinfo_pool, h->errinfo_pool_dhandle);
 	pci_free_consistent(h->pdev, h->reply_pool_size,
 		h->reply_pool, h->reply_pool_dhandle);
-	kfree(h->cmd_pool_bits);
+	percpu_tags_destroy(&h->cmd_pool_tags);
 	kfree(h->blockFetchTable);
 	kfree(h->hba_inquiry_data);
 	pci_disable_device(pdev);
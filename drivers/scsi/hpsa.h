@@ -97,9 +97,7 @@ struct ctlr_info {
 	dma_addr_t		cmd_pool_dhandle;
 	struct ErrorInfo 	*errinfo_pool;
 	dma_addr_t		errinfo_pool_dhandle;
-	unsigned long  		*cmd_pool_bits;
-	int			nr_allocs;
-	int			nr_frees;
+	struct percpu_tags	cmd_pool_tags;
 	int			scan_finished;
 	spinlock_t		scan_lock;
 	wait_queue_head_t	scan_wait_queue;
@@ -0,0 +1,720 @@
+/*
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ *
+ * virtio-blk server in host kernel.
+ *
+ * Requests are taken off the virtqueue by the vhost worker, the guest
+ * buffers are pinned and handed to the block layer as bios against the
+ * backend block device.  Completions are collected from bio end_io and
+ * finished by the worker, which writes the status byte and signals the
+ * guest through the call eventfd (normally an irqfd).  No request ever
+ * goes through userspace.
+ */
+
+#include <linux/compat.h>
+#include <linux/eventfd.h>
+#include <linux/vhost.h>
+#include <linux/virtio_net.h> /* vhost.h currently depends on this */
+#include <linux/virtio_blk.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/rcupdate.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+
+#include "vhost.c"
+#include "vhost.h"
+
+enum {
+	VHOST_BLK_VQ_REQ = 0,
+	VHOST_BLK_VQ_MAX = 1,
+};
+
+enum {
+	VHOST_BLK_FEATURES = (1ULL << VIRTIO_F_NOTIFY_ON_EMPTY) |
+			     (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
+			     (1ULL << VIRTIO_RING_F_EVENT_IDX) |
+			     (1ULL << VIRTIO_RING_F_PACKED) |
+			     (1ULL << VHOST_F_LOG_ALL),
+};
+
+struct vhost_blk {
+	struct vhost_dev dev;
+	struct vhost_virtqueue vqs[VHOST_BLK_VQ_MAX];
+
+	/* Requests whose bios have all completed, waiting for the worker */
+	spinlock_t done_lock;
+	struct list_head done_list;
+	struct vhost_work done_work;
+
+	/* Requests submitted and not yet returned to the guest */
+	atomic_t inflight;
+	wait_queue_head_t inflight_wait;
+};
+
+struct vhost_blk_req {
+	struct list_head list;
+	struct vhost_blk *blk;
+	u16 head;
+	/* bios still in flight, plus one while we are submitting */
+	atomic_t bio_nr;
+	int error;
+	/* bytes written into guest memory, status byte included */
+	int len;
+	bool write;
+	u8 __user *status;
+	struct page **pages;
+	int nr_pages;
+	/* with VHOST_F_LOG_ALL, the guest memory the request writes to */
+	unsigned int log_num;
+	struct vhost_log log[0];
+};
+
+static void vhost_blk_req_done(struct vhost_blk_req *req)
+{
+	struct vhost_blk *blk = req->blk;
+	unsigned long flags;
+
+	spin_lock_irqsave(&blk->done_lock, flags);
+	list_add_tail(&req->list, &blk->done_list);
+	spin_unlock_irqrestore(&blk->done_lock, flags);
+
+	vhost_work_queue(&blk->dev, &blk->done_work);
+}
+
+static void vhost_blk_req_put(struct vhost_blk_req *req)
+{
+	if (atomic_dec_and_test(&req->bio_nr))
+		vhost_blk_req_done(req);
+}
+
+/* Called from interrupt context */
+static void vhost_blk_bio_end_io(struct bio *bio, int err)
+{
+	struct vhost_blk_req *req = bio->bi_private;
+
+	if (err)
+		req->error = err;
+	bio_put(bio);
+	vhost_blk_req_put(req);
+}
+
+static void vhost_blk_req_unpin(struct vhost_blk_req *req)
+{
+	int i;
+
+	for (i = 0; i < req->nr_pages; i++) {
+		/* the device wrote to the guest's pages on a read */
+		if (!req->write)
+			set_page_dirty_lock(req->pages[i]);
+		put_page(req->pages[i]);
+	}
+	kfree(req->pages);
+	req->pages = NULL;
+	req->nr_pages = 0;
+}
+
+/*
+ * Pin the guest pages behind the data iovecs.  Each segment has to be
+ * sector aligned, which is what a virtio-blk driver hands us anyway.
+ */
+static int vhost_blk_req_pin(struct vhost_blk_req *req,
+			     struct iovec *iov, int iov_nr)
+{
+	unsigned long addr, len;
+	int i, n, nr_pages = 0;
+	int ret;
+
+	for (i = 0; i < iov_nr; i++) {
+		addr = (unsigned long)iov[i].iov_base;
+		len = iov[i].iov_len;
+		if (!len || ((addr | len) & 511))
+			return -EINVAL;
+		nr_pages += (PAGE_ALIGN(addr + len) - (addr & PAGE_MASK)) >>
+			    PAGE_SHIFT;
+	}
+
+	req->pages = kmalloc(nr_pages * sizeof(*req->pages), GFP_KERNEL);
+	if (!req->pages)
+		return -ENOMEM;
+
+	for (i = 0; i < iov_nr; i++) {
+		addr = (unsigned long)iov[i].iov_base;
+		len = iov[i].iov_len;
+		n = (PAGE_ALIGN(addr + len) - (addr & PAGE_MASK)) >> PAGE_SHIFT;
+		ret = get_user_pages_fast(addr, n, !req->write,
+					  req->pages + req->nr_pages);
+		if (ret > 0)
+			req->nr_pages += ret;
+		if (ret != n) {
+			vhost_blk_req_unpin(req);
+			return ret < 0 ? ret : -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+static struct bio *vhost_blk_bio_alloc(struct vhost_blk_req *req,
+				       struct block_device *bdev,
+				       sector_t sector, int nr_pages)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_KERNEL, min(nr_pages, BIO_MAX_PAGES));
+	if (!bio)
+		return NULL;
+
+	bio->bi_sector = sector;
+	bio->bi_bdev = bdev;
+	bio->bi_private = req;
+	bio->bi_end_io = vhost_blk_bio_end_io;
+	return bio;
+}
+
+static void vhost_blk_bio_submit(struct vhost_blk_req *req, struct bio *bio)
+{
+	atomic_inc(&req->bio_nr);
+	submit_bio(req->write ? WRITE : READ, bio);
+}
+
+/*
+ * Build bios for the pinned pages and submit them.  A new bio is started
+ * whenever the current one cannot take the next page.
+ */
+static int vhost_blk_req_submit_rw(struct vhost_blk_req *req,
+				   struct block_device *bdev, sector_t sector,
+				   struct iovec *iov, int iov_nr)
+{
+	struct bio *bio = NULL;
+	int i, page = 0;
+	int ret;
+
+	ret = vhost_blk_req_pin(req, iov, iov_nr);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < iov_nr; i++) {
+		unsigned long addr = (unsigned long)iov[i].iov_base;
+		unsigned long len = iov[i].iov_len;
+
+		while (len) {
+			unsigned int off = addr & ~PAGE_MASK;
+			unsigned int size = min_t(unsigned long, len,
+						  PAGE_SIZE - off);
+
+			if (!bio) {
+				bio = vhost_blk_bio_alloc(req, bdev, sector,
+						req->nr_pages - page);
+				if (!bio)
+					goto enomem;
+			}
+
+			if (bio_add_page(bio, req->pages[page], size, off) !=
+			    size) {
+				if (!bio->bi_vcnt) {
+					bio_put(bio);
+					goto eio;
+				}
+				vhost_blk_bio_submit(req, bio);
+				bio = NULL;
+				continue;
+			}
+
+			sector += size >> 9;
+			addr += size;
+			len -= size;
+			if (!(addr & ~PAGE_MASK) || !len)
+				page++;
+		}
+		if (!req->write)
+			req->len += iov[i].iov_len;
+	}
+
+	if (bio)
+		vhost_blk_bio_submit(req, bio);
+	return 0;
+
+enomem:
+	ret = -ENOMEM;
+	goto fail;
+eio:
+	ret = -EIO;
+fail:
+	/* Bios already submitted still hold their pages, fail the rest */
+	if (atomic_read(&req->bio_nr) > 1) {
+		req->error = ret;
+		return 0;
+	}
+	vhost_blk_req_unpin(req);
+	return ret;
+}
+
+static int vhost_blk_req_submit_flush(struct vhost_blk_req *req,
+				      struct block_device *bdev)
+{
+	struct bio *bio;
+
+	bio = vhost_blk_bio_alloc(req, bdev, 0, 0);
+	if (!bio)
+		return -ENOMEM;
+
+	atomic_inc(&req->bio_nr);
+	submit_bio(WRITE_FLUSH, bio);
+	return 0;
+}
+
+/*
+ * Start one request.  Returns a negative error if the descriptor chain
+ * is malformed, in which case the request is not used.
+ */
+static int vhost_blk_req_submit(struct vhost_blk *blk,
+				struct block_device *bdev,
+				struct vhost_virtqueue *vq, int head,
+				unsigned out, unsigned in,
+				struct vhost_log *log, unsigned int log_num)
+{
+	struct virtio_blk_outhdr hdr;
+	struct vhost_blk_req *req;
+	struct iovec *iov;
+	int iov_nr;
+	int ret;
+
+	/* header first, status byte last, data in between */
+	if (unlikely(out < 1 || in < 1 ||
+		     vq->iov[0].iov_len != sizeof(hdr) ||
+		     vq->iov[out + in - 1].iov_len != 1)) {
+		vq_err(vq, "Unexpected descriptor format for blk: "
+		       "out %d, in %d\n", out, in);
+		return -EINVAL;
+	}
+
+	if (unlikely(copy_from_user(&hdr, vq->iov[0].iov_base,
+				    sizeof(hdr)))) {
+		vq_err(vq, "Faulted on virtio_blk_outhdr\n");
+		return -EFAULT;
+	}
+
+	req = kzalloc(sizeof(*req) + log_num * sizeof(*log), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	if (log_num)
+		memcpy(req->log, log, log_num * sizeof(*log));
+	req->log_num = log_num;
+	req->blk = blk;
+	req->head = head;
+	req->status = vq->iov[out + in - 1].iov_base;
+	req->len = 1;
+	atomic_set(&req->bio_nr, 1);
+	atomic_inc(&blk->inflight);
+
+	switch (hdr.type & ~VIRTIO_BLK_T_BARRIER) {
+	case VIRTIO_BLK_T_IN:
+		iov = &vq->iov[out];
+		iov_nr = in - 1;
+		ret = vhost_blk_req_submit_rw(req, bdev, hdr.sector,
+					      iov, iov_nr);
+		break;
+	case VIRTIO_BLK_T_OUT:
+		req->write = true;
+		iov = &vq->iov[1];
+		iov_nr = out - 1;
+		ret = vhost_blk_req_submit_rw(req, bdev, hdr.sector,
+					      iov, iov_nr);
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		req->write = true;
+		ret = vhost_blk_req_submit_flush(req, bdev);
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+
+	if (ret)
+		req->error = ret;
+	/* drop the submission reference; may complete the request now */
+	vhost_blk_req_put(req);
+	return 0;
+}
+
+/*
+ * The backend is only replaced with vq->mutex held, and the requests
+ * already submitted against the old one are drained before it is put.
+ */
+static void handle_blk(struct vhost_blk *blk)
+{
+	struct vhost_virtqueue *vq = &blk->vqs[VHOST_BLK_VQ_REQ];
+	struct vhost_log *vq_log;
+	struct block_device *bdev;
+	struct file *file;
+	unsigned out, in, log_num;
+	int head;
+
+	mutex_lock(&vq->mutex);
+	file = rcu_dereference_protected(vq->private_data,
+					 lockdep_is_held(&vq->mutex));
+	if (!file)
+		goto out;
+	bdev = I_BDEV(file->f_mapping->host);
+
+	vq_log = unlikely(vhost_has_feature(&blk->dev, VHOST_F_LOG_ALL)) ?
+		vq->log : NULL;
+	vhost_disable_notify(&blk->dev, vq);
+
+	for (;;) {
+		head = vhost_get_vq_desc(&blk->dev, vq, vq->iov,
+					 ARRAY_SIZE(vq->iov),
+					 &out, &in, vq_log, &log_num);
+		/* On error, stop handling until the next kick. */
+		if (unlikely(head < 0))
+			break;
+		/* Nothing new?  Wait for eventfd to tell us they refilled. */
+		if (head == vq->num) {
+			if (unlikely(vhost_enable_notify(&blk->dev, vq))) {
+				vhost_disable_notify(&blk->dev, vq);
+				continue;
+			}
+			break;
+		}
+		if (vhost_blk_req_submit(blk, bdev, vq, head, out, in,
+					 vq_log, vq_log ? log_num : 0) < 0) {
+			vhost_discard_vq_desc(vq, 1);
+			break;
+		}
+	}
+out:
+	mutex_unlock(&vq->mutex);
+}
+
+static void handle_blk_kick(struct vhost_work *work)
+{
+	struct vhost_virtqueue *vq = container_of(work, struct vhost_virtqueue,
+						  poll.work);
+	struct vhost_blk *blk = container_of(vq->dev, struct vhost_blk, dev);
+
+	handle_blk(blk);
+}
+
+/*
+ * Log every byte of guest memory the request may have written to, data
+ * and status, even if it failed part way.
+ */
+static void vhost_blk_req_log(struct vhost_virtqueue *vq,
+			      struct vhost_blk_req *req)
+{
+	u64 len = 0;
+	unsigned int i;
+
+	for (i = 0; i < req->log_num; i++)
+		len += req->log[i].len;
+	if (len)
+		vhost_log_write(vq, req->log, req->log_num, len);
+}
+
+/*
+ * Return completed requests to the guest.  Runs in the worker, which has
+ * the owner's mm, so the status byte can be written with put_user().  The
+ * guest is signalled once per batch.
+ */
+static void handle_blk_done(struct vhost_work *work)
+{
+	struct vhost_blk *blk = container_of(work, struct vhost_blk,
+					     done_work);
+	struct vhost_virtqueue *vq = &blk->vqs[VHOST_BLK_VQ_REQ];
+	struct vhost_blk_req *req, *tmp;
+	LIST_HEAD(done);
+	int nr = 0;
+	u8 status;
+
+	spin_lock_irq(&blk->done_lock);
+	list_splice_init(&blk->done_list, &done);
+	spin_unlock_irq(&blk->done_lock);
+
+	mutex_lock(&vq->mutex);
+	list_for_each_entry_safe(req, tmp, &done, list) {
+		if (req->error == -EOPNOTSUPP)
+			status = VIRTIO_BLK_S_UNSUPP;
+		else if (req->error)
+			status = VIRTIO_BLK_S_IOERR;
+		else
+			status = VIRTIO_BLK_S_OK;
+
+		if (req->pages)
+			vhost_blk_req_unpin(req);
+
+		if (unlikely(put_user(status, req->status)))
+			vq_err(vq, "Faulted on writing status\n");
+		if (unlikely(req->log_num))
+			vhost_blk_req_log(vq, req);
+		vhost_add_used(vq, req->head, status == VIRTIO_BLK_S_OK ?
+			       req->len : 1);
+		kfree(req);
+		nr++;
+	}
+	if (nr)
+		vhost_signal(&blk->dev, vq);
+	mutex_unlock(&vq->mutex);
+
+	if (nr && atomic_sub_and_test(nr, &blk->inflight))
+		wake_up(&blk->inflight_wait);
+}
+
+static int vhost_blk_open(struct inode *inode, struct file *f)
+{
+	struct vhost_blk *blk = kmalloc(sizeof *blk, GFP_KERNEL);
+	struct vhost_dev *dev;
+	int r;
+
+	if (!blk)
+		return -ENOMEM;
+
+	dev = &blk->dev;
+	blk->vqs[VHOST_BLK_VQ_REQ].handle_kick = handle_blk_kick;
+	r = vhost_dev_init(dev, blk->vqs, VHOST_BLK_VQ_MAX);
+	if (r < 0) {
+		kfree(blk);
+		return r;
+	}
+
+	spin_lock_init(&blk->done_lock);
+	INIT_LIST_HEAD(&blk->done_list);
+	vhost_work_init(&blk->done_work, handle_blk_done);
+	atomic_set(&blk->inflight, 0);
+	init_waitqueue_head(&blk->inflight_wait);
+
+	f->private_data = blk;
+
+	return 0;
+}
+
+/*
+ * Wait for the requests already handed to the block layer and return
+ * them to the guest.  The worker must still be running.
+ */
+static void vhost_blk_drain(struct vhost_blk *blk)
+{
+	vhost_poll_flush(&blk->vqs[VHOST_BLK_VQ_REQ].poll);
+	wait_event(blk->inflight_wait, !atomic_read(&blk->inflight));
+	vhost_work_flush(&blk->dev, &blk->done_work);
+}
+
+static struct file *vhost_blk_stop(struct vhost_blk *blk)
+{
+	struct vhost_virtqueue *vq = &blk->vqs[VHOST_BLK_VQ_REQ];
+	struct file *file;
+
+	mutex_lock(&vq->mutex);
+	file = rcu_dereference_protected(vq->private_data,
+					 lockdep_is_held(&vq->mutex));
+	rcu_assign_pointer(vq->private_data, NULL);
+	mutex_unlock(&vq->mutex);
+
+	vhost_blk_drain(blk);
+	return file;
+}
+
+static int vhost_blk_release(struct inode *inode, struct file *f)
+{
+	struct vhost_blk *blk = f->private_data;
+	struct file *file;
+
+	file = vhost_blk_stop(blk);
+	vhost_dev_cleanup(&blk->dev, false);
+	if (file)
+		fput(file);
+	kfree(blk);
+	return 0;
+}
+
+static struct file *vhost_blk_get_backend(int fd)
+{
+	struct file *file;
+
+	/* special case to disable backend */
+	if (fd == -1)
+		return NULL;
+
+	file = fget(fd);
+	if (!file)
+		return ERR_PTR(-EBADF);
+
+	if (!S_ISBLK(file->f_mapping->host->i_mode)) {
+		fput(file);
+		return ERR_PTR(-ENOTBLK);
+	}
+	return file;
+}
+
+static long vhost_blk_set_backend(struct vhost_blk *blk, unsigned index,
+				  int fd)
+{
+	struct file *file, *oldfile;
+	struct vhost_virtqueue *vq;
+	int r;
+
+	mutex_lock(&blk->dev.mutex);
+	r = vhost_dev_check_owner(&blk->dev);
+	if (r)
+		goto err;
+
+	if (index >= VHOST_BLK_VQ_MAX) {
+		r = -ENOBUFS;
+		goto err;
+	}
+	vq = &blk->vqs[index];
+	mutex_lock(&vq->mutex);
+
+	/* Verify that ring has been setup correctly. */
+	if (!vhost_vq_access_ok(vq)) {
+		r = -EFAULT;
+		goto err_vq;
+	}
+	file = vhost_blk_get_backend(fd);
+	if (IS_ERR(file)) {
+		r = PTR_ERR(file);
+		goto err_vq;
+	}
+
+	oldfile = rcu_dereference_protected(vq->private_data,
+					    lockdep_is_held(&vq->mutex));
+	if (file != oldfile) {
+		rcu_assign_pointer(vq->private_data, file);
+		r = vhost_init_used(vq);
+		if (r)
+			goto err_vq;
+	}
+
+	mutex_unlock(&vq->mutex);
+
+	if (oldfile) {
+		vhost_blk_drain(blk);
+		fput(oldfile);
+	}
+
+	mutex_unlock(&blk->dev.mutex);
+	return 0;
+
+err_vq:
+	mutex_unlock(&vq->mutex);
+err:
+	mutex_unlock(&blk->dev.mutex);
+	return r;
+}
+
+static long vhost_blk_reset_owner(struct vhost_blk *blk)
+{
+	struct file *file = NULL;
+	long err;
+
+	mutex_lock(&blk->dev.mutex);
+	err = vhost_dev_check_owner(&blk->dev);
+	if (err)
+		goto done;
+	file = vhost_blk_stop(blk);
+	err = vhost_dev_reset_owner(&blk->dev);
+done:
+	mutex_unlock(&blk->dev.mutex);
+	if (file)
+		fput(file);
+	return err;
+}
+
+static int vhost_blk_set_features(struct vhost_blk *blk, u64 features)
+{
+	mutex_lock(&blk->dev.mutex);
+	if ((features & (1 << VHOST_F_LOG_ALL)) &&
+	    !vhost_log_access_ok(&blk->dev)) {
+		mutex_unlock(&blk->dev.mutex);
+		return -EFAULT;
+	}
+	blk->dev.acked_features = features;
+	smp_wmb();
+	vhost_poll_flush(&blk->vqs[VHOST_BLK_VQ_REQ].poll);
+	mutex_unlock(&blk->dev.mutex);
+	return 0;
+}
+
+static long vhost_blk_ioctl(struct file *f, unsigned int ioctl,
+			    unsigned long arg)
+{
+	struct vhost_blk *blk = f->private_data;
+	void __user *argp = (void __user *)arg;
+	u64 __user *featurep = argp;
+	struct vhost_vring_file backend;
+	u64 features;
+	int r;
+
+	switch (ioctl) {
+	case VHOST_BLK_SET_BACKEND:
+		if (copy_from_user(&backend, argp, sizeof backend))
+			return -EFAULT;
+		return vhost_blk_set_backend(blk, backend.index, backend.fd);
+	case VHOST_GET_FEATURES:
+		features = VHOST_BLK_FEATURES;
+		if (copy_to_user(featurep, &features, sizeof features))
+			return -EFAULT;
+		return 0;
+	case VHOST_SET_FEATURES:
+		if (copy_from_user(&features, featurep, sizeof features))
+			return -EFAULT;
+		if (features & ~VHOST_BLK_FEATURES)
+			return -EOPNOTSUPP;
+		return vhost_blk_set_features(blk, features);
+	case VHOST_RESET_OWNER:
+		return vhost_blk_reset_owner(blk);
+	default:
+		mutex_lock(&blk->dev.mutex);
+		r = vhost_dev_ioctl(&blk->dev, ioctl, arg);
+		vhost_poll_flush(&blk->vqs[VHOST_BLK_VQ_REQ].poll);
+		mutex_unlock(&blk->dev.mutex);
+		return r;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+static long vhost_blk_compat_ioctl(struct file *f, unsigned int ioctl,
+				   unsigned long arg)
+{
+	return vhost_blk_ioctl(f, ioctl, (unsigned long)compat_ptr(arg));
+}
+#endif
+
+static const struct file_operations vhost_blk_fops = {
+	.owner          = THIS_MODULE,
+	.release        = vhost_blk_release,
+	.unlocked_ioctl = vhost_blk_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl   = vhost_blk_compat_ioctl,
+#endif
+	.open           = vhost_blk_open,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice vhost_blk_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "vhost-blk",
+	.fops = &vhost_blk_fops,
+};
+
+static int vhost_blk_init(void)
+{
+	return misc_register(&vhost_blk_misc);
+}
+module_init(vhost_blk_init);
+
+static void vhost_blk_exit(void)
+{
+	misc_deregister(&vhost_blk_misc);
+}
+module_exit(vhost_blk_exit);
+
+MODULE_VERSION("0.0.1");
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("Host kernel accelerator for virtio blk");
@@ -42,6 +42,12 @@ static unsigned vhost_zcopy_mask __read_mostly;
 #define vhost_used_event(vq) ((u16 __user *)&vq->avail->ring[vq->num])
 #define vhost_avail_event(vq) ((u16 __user *)&vq->used->ring[vq->num])
 
+#define vhost_packed_desc(vq) ((struct vring_packed_desc __user *)(vq)->desc)
+#define vhost_driver_event(vq) \
+	((struct vring_packed_desc_event __user *)(vq)->avail)
+#define vhost_device_event(vq) \
+	((struct vring_packed_desc_event __user *)(vq)->used)
+
 static void vhost_poll_func(struct file *file, wait_queue_head_t *wqh,
 			    poll_table *pt)
 {
@@ -170,6 +176,9 @@ static void vhost_vq_reset(struct vhost_dev *dev,
 	vq->used_flags = 0;
 	vq->log_used = false;
 	vq->log_addr = -1ull;
+	vq->avail_wrap_counter = true;
+	vq->used_wrap_counter = true;
+	vq->packed_npopped = 0;
 	vq->vhost_hlen = 0;
 	vq->sock_hlen = 0;
 	vq->private_data = NULL;
@@ -244,6 +253,10 @@ static void vhost_vq_free_iovecs(struct vhost_virtqueue *vq)
 	vq->heads = NULL;
 	kfree(vq->ubuf_info);
 	vq->ubuf_info = NULL;
+	kfree(vq->packed_popped);
+	vq->packed_popped = NULL;
+	kfree(vq->packed_num);
+	vq->packed_num = NULL;
 }
 
 void vhost_enable_zcopy(int vq)
@@ -264,13 +277,16 @@ static long vhost_dev_alloc_iovecs(struct vhost_dev *dev)
 					  GFP_KERNEL);
 		dev->vqs[i].heads = kmalloc(sizeof *dev->vqs[i].heads *
 					    UIO_MAXIOV, GFP_KERNEL);
+		dev->vqs[i].packed_popped =
+			kmalloc(sizeof *dev->vqs[i].packed_popped *
+				UIO_MAXIOV, GFP_KERNEL);
 		zcopy = vhost_zcopy_mask & (0x1 << i);
 		if (zcopy)
 			dev->vqs[i].ubuf_info =
 				kmalloc(sizeof *dev->vqs[i].ubuf_info *
 					UIO_MAXIOV, GFP_KERNEL);
 		if (!dev->vqs[i].indirect || !dev->vqs[i].log ||
-			!dev->vqs[i].heads ||
+			!dev->vqs[i].heads || !dev->vqs[i].packed_popped ||
 			(zcopy && !dev->vqs[i].ubuf_info))
 			goto err_nomem;
 	}
@@ -311,6 +327,8 @@ long vhost_dev_init(struct vhost_dev *dev,
 		dev->vqs[i].indirect = NULL;
 		dev->vqs[i].heads = NULL;
 		dev->vqs[i].ubuf_info = NULL;
+		dev->vqs[i].packed_popped = NULL;
+		dev->vqs[i].packed_num = NULL;
 		dev->vqs[i].dev = dev;
 		mutex_init(&dev->vqs[i].mutex);
 		vhost_vq_reset(dev, dev->vqs + i);
@@ -556,6 +574,19 @@ static int vq_access_ok(struct vhost_dev *d, unsigned int num,
 			struct vring_used __user *used)
 {
 	size_t s = vhost_has_feature(d, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+
+	/* Packed: the whole descriptor ring is written back, and the event
+	 * areas sit where the avail and used rings would.  The wrap counter
+	 * takes the top bit of 16 bit offsets, so the ring is at most 2^15. */
+	if (vhost_has_feature(d, VIRTIO_RING_F_PACKED))
+		return num <= 0x8000 &&
+		       access_ok(VERIFY_WRITE, desc,
+				 num * sizeof(struct vring_packed_desc)) &&
+		       access_ok(VERIFY_READ, avail,
+				 sizeof(struct vring_packed_desc_event)) &&
+		       access_ok(VERIFY_WRITE, used,
+				 sizeof(struct vring_packed_desc_event));
+
 	return access_ok(VERIFY_READ, desc, num * sizeof *desc) &&
 	       access_ok(VERIFY_READ, avail,
 			 sizeof *avail + num * sizeof *avail->ring + s) &&
@@ -581,20 +612,24 @@ static int vq_log_access_ok(struct vhost_dev *d, struct vhost_virtqueue *vq,
 {
 	struct vhost_memory *mp;
 	size_t s = vhost_has_feature(d, VIRTIO_RING_F_EVENT_IDX) ? 2 : 0;
+	size_t sz = sizeof *vq->used + vq->num * sizeof *vq->used->ring + s;
+
+	if (vhost_has_feature(d, VIRTIO_RING_F_PACKED))
+		sz = vq->num * sizeof(struct vring_packed_desc);
 
 	mp = rcu_dereference_protected(vq->dev->memory,
 				       lockdep_is_held(&vq->mutex));
 	return vq_memory_access_ok(log_base, mp,
 			    vhost_has_feature(vq->dev, VHOST_F_LOG_ALL)) &&
-		(!vq->log_used || log_access_ok(log_base, vq->log_addr,
-					sizeof *vq->used +
-					vq->num * sizeof *vq->used->ring + s));
+		(!vq->log_used || log_access_ok(log_base, vq->log_addr, sz));
 }
 
 /* Can we start vq? */
 /* Caller should have vq mutex and device mutex */
 int vhost_vq_access_ok(struct vhost_virtqueue *vq)
 {
+	if (vhost_vq_packed(vq) && !vq->packed_num)
+		return 0;
 	return vq_access_ok(vq->dev, vq->num, vq->desc, vq->avail, vq->used) &&
 		vq_log_access_ok(vq->dev, vq, vq->log_base);
 }
@@ -644,6 +679,8 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 	struct vhost_vring_state s;
 	struct vhost_vring_file f;
 	struct vhost_vring_addr a;
+	size_t log_size;
+	u16 *packed_num;
 	u32 idx;
 	long r;
 
@@ -673,6 +710,15 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EINVAL;
 			break;
 		}
+		/* Bookkeeping for the packed ring, whose buffer ids index
+		 * into it; cheap enough to keep whatever the layout. */
+		packed_num = kmalloc(s.num * sizeof *packed_num, GFP_KERNEL);
+		if (!packed_num) {
+			r = -ENOMEM;
+			break;
+		}
+		kfree(vq->packed_num);
+		vq->packed_num = packed_num;
 		vq->num = s.num;
 		break;
 	case VHOST_SET_VRING_BASE:
@@ -690,13 +736,19 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EINVAL;
 			break;
 		}
-		vq->last_avail_idx = s.num;
+		if (vhost_vq_packed(vq)) {
+			vq->last_avail_idx = s.num & 0x7fff;
+			vq->avail_wrap_counter = s.num >> 15;
+		} else
+			vq->last_avail_idx = s.num;
 		/* Forget the cached index value. */
 		vq->avail_idx = vq->last_avail_idx;
 		break;
 	case VHOST_GET_VRING_BASE:
 		s.index = idx;
 		s.num = vq->last_avail_idx;
+		if (vhost_vq_packed(vq))
+			s.num |= vq->avail_wrap_counter << 15;
 		if (copy_to_user(argp, &s, sizeof s))
 			r = -EFAULT;
 		break;
@@ -717,11 +769,29 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 			r = -EFAULT;
 			break;
 		}
-		if ((a.avail_user_addr & (sizeof *vq->avail->ring - 1)) ||
-		    (a.used_user_addr & (sizeof *vq->used->ring - 1)) ||
-		    (a.log_guest_addr & (sizeof *vq->used->ring - 1))) {
-			r = -EINVAL;
-			break;
+		if (vhost_has_feature(d, VIRTIO_RING_F_PACKED)) {
+			if ((a.desc_user_addr &
+			     (sizeof(struct vring_packed_desc) - 1)) ||
+			    (a.avail_user_addr &
+			     (sizeof(struct vring_packed_desc_event) - 1)) ||
+			    (a.used_user_addr &
+			     (sizeof(struct vring_packed_desc_event) - 1)) ||
+			    (a.log_guest_addr &
+			     (sizeof(struct vring_packed_desc) - 1))) {
+				r = -EINVAL;
+				break;
+			}
+			log_size = vq->num * sizeof(struct vring_packed_desc);
+		} else {
+			if ((a.avail_user_addr &
+			     (sizeof *vq->avail->ring - 1)) ||
+			    (a.used_user_addr & (sizeof *vq->used->ring - 1)) ||
+			    (a.log_guest_addr & (sizeof *vq->used->ring - 1))) {
+				r = -EINVAL;
+				break;
+			}
+			log_size = sizeof *vq->used +
+				   vq->num * sizeof *vq->used->ring;
 		}
 
 		/* We only verify access here if backend is configured.
@@ -739,8 +809,7 @@ static long vhost_set_vring(struct vhost_dev *d, int ioctl, void __user *argp)
 			/* Also validate log access for used ring if enabled. */
 			if ((a.flags & (0x1 << VHOST_VRING_F_LOG)) &&
 			    !log_access_ok(vq->log_base, a.log_guest_addr,
-					   sizeof *vq->used +
-					   vq->num * sizeof *vq->used->ring)) {
+					   log_size)) {
 				r = -EINVAL;
 				break;
 			}
@@ -1038,12 +1107,30 @@ static int vhost_update_avail_event(struct vhost_virtqueue *vq, u16 avail_event)
 	return 0;
 }
 
+static int vhost_update_device_event(struct vhost_virtqueue *vq, u16 flags)
+{
+	return __put_user(flags, &vhost_device_event(vq)->flags);
+}
+
 int vhost_init_used(struct vhost_virtqueue *vq)
 {
 	int r;
 	if (!vq->private_data)
 		return 0;
 
+	/* Everything before last_avail_idx has been used: the used side
+	 * starts out where the avail side is. */
+	if (vhost_vq_packed(vq)) {
+		vq->last_used_idx = vq->last_avail_idx;
+		vq->used_wrap_counter = vq->avail_wrap_counter;
+		vq->packed_npopped = 0;
+		vq->signalled_used_valid = false;
+		return vhost_update_device_event(vq,
+				vq->used_flags & VRING_USED_F_NO_NOTIFY ?
+				VRING_PACKED_EVENT_FLAG_DISABLE :
+				VRING_PACKED_EVENT_FLAG_ENABLE);
+	}
+
 	r = vhost_update_used_flags(vq);
 	if (r)
 		return r;
@@ -1197,6 +1284,190 @@ static int get_indirect(struct vhost_dev *dev, struct vhost_virtqueue *vq,
 	return 0;
 }
 
+/* Add one packed descriptor, direct or from an indirect table, to the iovec. */
+static int packed_desc_to_iov(struct vhost_dev *dev, struct vhost_virtqueue *vq,
+			      struct vring_packed_desc *desc,
+			      struct iovec iov[], unsigned int iov_size,
+			      unsigned int *out_num, unsigned int *in_num,
+			      struct vhost_log *log, unsigned int *log_num)
+{
+	unsigned iov_count = *in_num + *out_num;
+	int ret;
+
+	ret = translate_desc(dev, desc->addr, desc->len, iov + iov_count,
+			     iov_size - iov_count);
+	if (unlikely(ret < 0)) {
+		vq_err(vq, "Translation failure %d in packed descriptor\n",
+		       ret);
+		return ret;
+	}
+	if (desc->flags & VRING_DESC_F_WRITE) {
+		/* If this is an input descriptor,
+		 * increment that count. */
+		*in_num += ret;
+		if (unlikely(log)) {
+			log[*log_num].addr = desc->addr;
+			log[*log_num].len = desc->len;
+			++*log_num;
+		}
+	} else {
+		/* If it's an output descriptor, they're all supposed
+		 * to come before any input descriptors. */
+		if (unlikely(*in_num)) {
+			vq_err(vq, "Packed descriptor has out after in\n");
+			return -EINVAL;
+		}
+		*out_num += ret;
+	}
+	return 0;
+}
+
+/* Entries of a packed indirect table are consecutive; there is no chaining. */
+static int get_indirect_packed(struct vhost_dev *dev,
+			       struct vhost_virtqueue *vq,
+			       struct iovec iov[], unsigned int iov_size,
+			       unsigned int *out_num, unsigned int *in_num,
+			       struct vhost_log *log, unsigned int *log_num,
+			       struct vring_packed_desc *indirect)
+{
+	struct vring_packed_desc desc;
+	unsigned int i, count;
+	int ret;
+
+	if (unlikely(!indirect->len || indirect->len % sizeof desc)) {
+		vq_err(vq, "Invalid length in indirect descriptor: "
+		       "len 0x%x not multiple of 0x%zx\n",
+		       indirect->len, sizeof desc);
+		return -EINVAL;
+	}
+
+	ret = translate_desc(dev, indirect->addr, indirect->len, vq->indirect,
+			     UIO_MAXIOV);
+	if (unlikely(ret < 0)) {
+		vq_err(vq, "Translation failure %d in indirect.\n", ret);
+		return ret;
+	}
+
+	/* We will use the result as an address to read from, so most
+	 * architectures only need a compiler barrier here. */
+	read_barrier_depends();
+
+	count = indirect->len / sizeof desc;
+	for (i = 0; i < count; i++) {
+		if (unlikely(memcpy_fromiovec((unsigned char *)&desc,
+					      vq->indirect, sizeof desc))) {
+			vq_err(vq, "Failed indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)indirect->addr + i * sizeof desc);
+			return -EINVAL;
+		}
+		if (unlikely(desc.flags & VRING_DESC_F_INDIRECT)) {
+			vq_err(vq, "Nested indirect descriptor: idx %d, %zx\n",
+			       i, (size_t)indirect->addr + i * sizeof desc);
+			return -EINVAL;
+		}
+		ret = packed_desc_to_iov(dev, vq, &desc, iov, iov_size,
+					 out_num, in_num, log, log_num);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+	return 0;
+}
+
+/* Is the descriptor at @idx available in the lap given by @wrap_counter?
+ * Returns 1 if so, 0 if not and -EFAULT if it can't be read. */
+static int vhost_packed_desc_avail(struct vhost_virtqueue *vq, u16 idx,
+				   bool wrap_counter)
+{
+	u16 flags;
+
+	if (unlikely(__get_user(flags, &vhost_packed_desc(vq)[idx].flags))) {
+		vq_err(vq, "Failed to read descriptor flags at %p\n",
+		       &vhost_packed_desc(vq)[idx].flags);
+		return -EFAULT;
+	}
+	return !!(flags & VRING_PACKED_DESC_F_AVAIL) == wrap_counter &&
+	       !!(flags & VRING_PACKED_DESC_F_USED) != wrap_counter;
+}
+
+static int vhost_get_vq_desc_packed(struct vhost_dev *dev,
+				    struct vhost_virtqueue *vq,
+				    struct iovec iov[], unsigned int iov_size,
+				    unsigned int *out_num, unsigned int *in_num,
+				    struct vhost_log *log,
+				    unsigned int *log_num)
+{
+	struct vring_packed_desc desc;
+	unsigned int i = vq->last_avail_idx, found = 0;
+	bool wrap_counter = vq->avail_wrap_counter;
+	int ret;
+
+	ret = vhost_packed_desc_avail(vq, i, wrap_counter);
+	if (unlikely(ret < 0))
+		return ret;
+	/* If there's nothing new since last we looked, return invalid. */
+	if (!ret)
+		return vq->num;
+
+	/* The guest sets the head's flags last, so once it is available the
+	 * rest of the chain is too.  Read it only after the flags. */
+	smp_rmb();
+
+	/* When we start there are none of either input nor output. */
+	*out_num = *in_num = 0;
+	if (unlikely(log))
+		*log_num = 0;
+
+	do {
+		if (unlikely(++found > vq->num)) {
+			vq_err(vq, "Loop detected: last one at %u "
+			       "vq size %u head %u\n",
+			       i, vq->num, vq->last_avail_idx);
+			return -EINVAL;
+		}
+		ret = __copy_from_user(&desc, vhost_packed_desc(vq) + i,
+				       sizeof desc);
+		if (unlikely(ret)) {
+			vq_err(vq, "Failed to get descriptor: idx %d addr %p\n",
+			       i, vhost_packed_desc(vq) + i);
+			return -EFAULT;
+		}
+		if (desc.flags & VRING_DESC_F_INDIRECT)
+			ret = get_indirect_packed(dev, vq, iov, iov_size,
+						  out_num, in_num,
+						  log, log_num, &desc);
+		else
+			ret = packed_desc_to_iov(dev, vq, &desc, iov, iov_size,
+						 out_num, in_num,
+						 log, log_num);
+		if (unlikely(ret < 0)) {
+			vq_err(vq, "Failure detected at packed idx %d\n", i);
+			return ret;
+		}
+		if (++i >= vq->num) {
+			i = 0;
+			wrap_counter ^= 1;
+		}
+	} while (desc.flags & VRING_DESC_F_NEXT);
+
+	/* The id of the last descriptor names the buffer. */
+	if (unlikely(desc.id >= vq->num)) {
+		vq_err(vq, "Guest says buffer id %u > %u is available",
+		       desc.id, vq->num);
+		return -EINVAL;
+	}
+
+	/* On success, move past the chain. */
+	vq->last_avail_idx = i;
+	vq->avail_wrap_counter = wrap_counter;
+	vq->packed_num[desc.id] = found;
+	vq->packed_popped[vq->packed_npopped++ % UIO_MAXIOV] = found;
+
+	/* Assume notifications from guest are disabled at this point,
+	 * if they aren't we would need to update the device event. */
+	BUG_ON(!(vq->used_flags & VRING_USED_F_NO_NOTIFY));
+	return desc.id;
+}
+
 /* This looks in the virtqueue and for the first available buffer, and converts
  * it to an iovec for convenient access.  Since descriptors consist of some
  * number of output then some number of input descriptors, it's actually two
@@ -1215,6 +1486,10 @@ int vhost_get_vq_desc(struct vhost_dev *dev, struct vhost_virtqueue *vq,
 	u16 last_avail_idx;
 	int ret;
 
+	if (vhost_vq_packed(vq))
+		return vhost_get_vq_desc_packed(dev, vq, iov, iov_size,
+						out_num, in_num, log, log_num);
+
 	/* Check it isn't doing very strange things with descriptor numbers. */
 	last_avail_idx = vq->last_avail_idx;
 	if (unlikely(__get_user(vq->avail_idx, &vq->avail->idx))) {
@@ -1330,7 +1605,96 @@ int vhost_get_vq_desc(struct vhost_dev *dev, struct vhost_virtqueue *vq,
 /* Reverse the effect of vhost_get_vq_desc. Useful for error handling. */
 void vhost_discard_vq_desc(struct vhost_virtqueue *vq, int n)
 {
-	vq->last_avail_idx -= n;
+	unsigned int entries = 0;
+
+	if (!vhost_vq_packed(vq)) {
+		vq->last_avail_idx -= n;
+		return;
+	}
+
+	while (n--)
+		entries += vq->packed_popped[--vq->packed_npopped % UIO_MAXIOV];
+	if (entries > vq->last_avail_idx) {
+		vq->last_avail_idx += vq->num - entries;
+		vq->avail_wrap_counter ^= 1;
+	} else
+		vq->last_avail_idx -= entries;
+}
+
+/* Packed version of vhost_add_used_n.  Each buffer is written back at the
+ * next used position, which then skips the ring entries the buffer took.
+ * The ids and lengths of the whole batch go out first and the flags of the
+ * first entry last, so the guest picks up the batch in one go. */
+static int vhost_add_used_n_packed(struct vhost_virtqueue *vq,
+				   struct vring_used_elem *heads,
+				   unsigned count)
+{
+	struct vring_packed_desc __user *desc;
+	u16 idx, old, first_flags, flags;
+	bool wrap_counter;
+	unsigned i, n = 0;
+
+	idx = old = vq->last_used_idx;
+	wrap_counter = vq->used_wrap_counter;
+	for (i = 0; i < count; ++i) {
+		if (unlikely(heads[i].id >= vq->num)) {
+			vq_err(vq, "Used id %u out of range\n", heads[i].id);
+			return -EINVAL;
+		}
+		desc = vhost_packed_desc(vq) + idx;
+		if (__put_user(heads[i].id, &desc->id) ||
+		    __put_user(heads[i].len, &desc->len)) {
+			vq_err(vq, "Failed to write used");
+			return -EFAULT;
+		}
+		idx += vq->packed_num[heads[i].id];
+		n += vq->packed_num[heads[i].id];
+		if (idx >= vq->num)
+			idx -= vq->num;
+	}
+
+	/* Make sure buffers are written before we flag them. */
+	smp_wmb();
+
+	first_flags = wrap_counter ? VRING_PACKED_DESC_F_AVAIL |
+				     VRING_PACKED_DESC_F_USED : 0;
+	for (idx = old, i = 0; i < count; ++i) {
+		flags = wrap_counter ? VRING_PACKED_DESC_F_AVAIL |
+				       VRING_PACKED_DESC_F_USED : 0;
+		if (i && __put_user(flags, &vhost_packed_desc(vq)[idx].flags)) {
+			vq_err(vq, "Failed to write used flags");
+			return -EFAULT;
+		}
+		if (unlikely(vq->log_used)) {
+			/* Make sure data is seen before log. */
+			smp_wmb();
+			log_write(vq->log_base, vq->log_addr +
+				  idx * sizeof(struct vring_packed_desc),
+				  sizeof(struct vring_packed_desc));
+		}
+		idx += vq->packed_num[heads[i].id];
+		if (idx >= vq->num) {
+			idx -= vq->num;
+			wrap_counter ^= 1;
+		}
+	}
+	if (count > 1)
+		smp_wmb();
+	if (__put_user(first_flags, &vhost_packed_desc(vq)[old].flags)) {
+		vq_err(vq, "Failed to write used flags");
+		return -EFAULT;
+	}
+	if (unlikely(vq->log_used) && vq->log_ctx)
+		eventfd_signal(vq->log_ctx, 1);
+
+	vq->last_used_idx = idx;
+	vq->used_wrap_counter = wrap_counter;
+	/* Same as for the split ring: if we went all the way round past the
+	 * index we last signalled on, forget it. */
+	if (unlikely((u16)(vq->signalled_used - old - 1 + vq->num) % vq->num
+		     < n))
+		vq->signalled_used_valid = false;
+	return 0;
 }
 
 /* After we've used one of their buffers, we tell them about it.  We'll then
@@ -1339,6 +1703,12 @@ int vhost_add_used(struct vhost_virtqueue *vq, unsigned int head, int len)
 {
 	struct vring_used_elem __user *used;
 
+	if (vhost_vq_packed(vq)) {
+		struct vring_used_elem elem = { .id = head, .len = len };
+
+		return vhost_add_used_n_packed(vq, &elem, 1);
+	}
+
 	/* The virtqueue contains a ring of used buffers.  Get a pointer to the
 	 * next entry in that used ring. */
 	used = &vq->used->ring[vq->last_used_idx % vq->num];
@@ -1422,6 +1792,9 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 {
 	int start, n, r;
 
+	if (vhost_vq_packed(vq))
+		return vhost_add_used_n_packed(vq, heads, count);
+
 	start = vq->last_used_idx % vq->num;
 	n = vq->num - start;
 	if (n < count) {
@@ -1450,6 +1823,48 @@ int vhost_add_used_n(struct vhost_virtqueue *vq, struct vring_used_elem *heads,
 	return r;
 }
 
+static bool vhost_notify_packed(struct vhost_dev *dev,
+				struct vhost_virtqueue *vq)
+{
+	__u16 old, new, off_wrap, flags, event;
+	bool v;
+
+	if (vhost_has_feature(dev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
+	    unlikely(vhost_packed_desc_avail(vq, vq->last_avail_idx,
+					     vq->avail_wrap_counter) == 0))
+		return true;
+
+	if (__get_user(flags, &vhost_driver_event(vq)->flags)) {
+		vq_err(vq, "Failed to get driver event flags");
+		return true;
+	}
+	if (flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		return false;
+	if (flags == VRING_PACKED_EVENT_FLAG_ENABLE ||
+	    !vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX))
+		return true;
+
+	old = vq->signalled_used;
+	v = vq->signalled_used_valid;
+	new = vq->signalled_used = vq->last_used_idx;
+	vq->signalled_used_valid = true;
+
+	if (unlikely(!v))
+		return true;
+
+	/* The guest writes the offset before it switches to DESC. */
+	smp_rmb();
+	if (__get_user(off_wrap, &vhost_driver_event(vq)->off_wrap)) {
+		vq_err(vq, "Failed to get driver event offset");
+		return true;
+	}
+	event = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->used_wrap_counter)
+		event -= vq->num;
+	return vring_need_event(event, new, old);
+}
+
 static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
 	__u16 old, new, event;
@@ -1459,6 +1874,9 @@ static bool vhost_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	 * interrupts. */
 	smp_mb();
 
+	if (vhost_vq_packed(vq))
+		return vhost_notify_packed(dev, vq);
+
 	if (vhost_has_feature(dev, VIRTIO_F_NOTIFY_ON_EMPTY) &&
 	    unlikely(vq->avail_idx == vq->last_avail_idx))
 		return true;
@@ -1512,6 +1930,37 @@ void vhost_add_used_and_signal_n(struct vhost_dev *dev,
 	vhost_signal(dev, vq);
 }
 
+static bool vhost_enable_notify_packed(struct vhost_dev *dev,
+				       struct vhost_virtqueue *vq)
+{
+	u16 off_wrap, flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+	int r;
+
+	if (vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
+		off_wrap = vq->last_avail_idx |
+			   vq->avail_wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR;
+		if (__put_user(off_wrap, &vhost_device_event(vq)->off_wrap)) {
+			vq_err(vq, "Failed to update device event offset at %p\n",
+			       &vhost_device_event(vq)->off_wrap);
+			return false;
+		}
+		/* The offset must be valid by the time the guest sees DESC. */
+		smp_wmb();
+		flags = VRING_PACKED_EVENT_FLAG_DESC;
+	}
+	r = vhost_update_device_event(vq, flags);
+	if (r) {
+		vq_err(vq, "Failed to enable notification at %p: %d\n",
+		       &vhost_device_event(vq)->flags, r);
+		return false;
+	}
+	/* They could have slipped one in as we were doing that: make
+	 * sure it's written, then check again. */
+	smp_mb();
+	return vhost_packed_desc_avail(vq, vq->last_avail_idx,
+				       vq->avail_wrap_counter) > 0;
+}
+
 /* OK, now we need to know about added descriptors. */
 bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 {
@@ -1521,6 +1970,8 @@ bool vhost_enable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (!(vq->used_flags & VRING_USED_F_NO_NOTIFY))
 		return false;
 	vq->used_flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_packed(vq))
+		return vhost_enable_notify_packed(dev, vq);
 	if (!vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r) {
@@ -1557,6 +2008,14 @@ void vhost_disable_notify(struct vhost_dev *dev, struct vhost_virtqueue *vq)
 	if (vq->used_flags & VRING_USED_F_NO_NOTIFY)
 		return;
 	vq->used_flags |= VRING_USED_F_NO_NOTIFY;
+	if (vhost_vq_packed(vq)) {
+		r = vhost_update_device_event(vq,
+					      VRING_PACKED_EVENT_FLAG_DISABLE);
+		if (r)
+			vq_err(vq, "Failed to disable notification at %p: %d\n",
+			       &vhost_device_event(vq)->flags, r);
+		return;
+	}
 	if (!vhost_has_feature(dev, VIRTIO_RING_F_EVENT_IDX)) {
 		r = vhost_update_used_flags(vq);
 		if (r)
@@ -1600,7 +2059,7 @@ void vhost_ubuf_put_and_wait(struct vhost_ubuf_ref *ubufs)
 	kfree(ubufs);
 }
 
-void vhost_zerocopy_callback(struct ubuf_info *ubuf)
+void vhost_zerocopy_callback(struct ubuf_info *ubuf, bool success)
 {
 	struct vhost_ubuf_ref *ubufs = ubuf->ctx;
 	struct vhost_virtqueue *vq = ubufs->vq;
@@ -114,6 +114,19 @@ struct vhost_virtqueue {
 	bool log_used;
 	u64 log_addr;
 
+	/* With VIRTIO_RING_F_PACKED, desc points to the packed descriptor
+	 * ring, avail to the driver event area and used to the device event
+	 * area; the indexes above are ring offsets and these are the wrap
+	 * counters that go with them. */
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	/* Number of ring entries each buffer id took. */
+	u16 *packed_num;
+	/* Ring entries taken by the last buffers handed out, for
+	 * vhost_discard_vq_desc. */
+	u16 *packed_popped;
+	unsigned int packed_npopped;
+
 	struct iovec iov[UIO_MAXIOV];
 	/* hdr is used to store the virtio header.
 	 * Since each iovec has >= 1 byte length, we never need more than
@@ -191,7 +204,7 @@ bool vhost_enable_notify(struct vhost_dev *, struct vhost_virtqueue *);
 
 int vhost_log_write(struct vhost_virtqueue *vq, struct vhost_log *log,
 		    unsigned int log_num, u64 len);
-void vhost_zerocopy_callback(struct ubuf_info *);
+void vhost_zerocopy_callback(struct ubuf_info *, bool);
 int vhost_zerocopy_signal_used(struct vhost_virtqueue *vq);
 
 #define vq_err(vq, fmt, ...) do {                                  \
@@ -204,6 +217,7 @@ enum {
 	VHOST_FEATURES = (1ULL << VIRTIO_F_NOTIFY_ON_EMPTY) |
 			 (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
 			 (1ULL << VIRTIO_RING_F_EVENT_IDX) |
+			 (1ULL << VIRTIO_RING_F_PACKED) |
 			 (1ULL << VHOST_F_LOG_ALL),
 	VHOST_NET_FEATURES = VHOST_FEATURES |
 			 (1ULL << VHOST_NET_F_VIRTIO_NET_HDR) |
@@ -217,7 +231,12 @@ static inline int vhost_has_feature(struct vhost_dev *dev, int bit)
 	/* TODO: check that we are running from vhost_worker or dev mutex is
 	 * held? */
 	acked_features = rcu_dereference_index_check(dev->acked_features, 1);
-	return acked_features & (1 << bit);
+	return !!(acked_features & (1U << bit));
+}
+
+static inline bool vhost_vq_packed(struct vhost_virtqueue *vq)
+{
+	return vhost_has_feature(vq->dev, VIRTIO_RING_F_PACKED);
 }
 
 void vhost_enable_zcopy(int vq);
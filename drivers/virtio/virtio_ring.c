@@ -74,6 +74,17 @@
 #define END_USE(vq)
 #endif
 
+/* Per buffer id bookkeeping for the packed ring. */
+struct vring_packed_state
+{
+	/* Descriptors the buffer occupies in the ring. */
+	u16 num;
+	/* Next free buffer id. */
+	u16 next;
+	/* Indirect table, if any. */
+	struct vring_packed_desc *indir_desc;
+};
+
 struct vring_virtqueue
 {
 	struct virtqueue vq;
@@ -81,6 +92,9 @@ struct vring_virtqueue
 	/* Actual memory layout for this queue */
 	struct vring vring;
 
+	/* Layout when the packed ring was negotiated */
+	struct vring_packed vring_packed;
+
 	/* Can we use weak barriers? */
 	bool weak_barriers;
 
@@ -93,6 +107,9 @@ struct vring_virtqueue
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* Ring uses the packed layout */
+	bool packed;
+
 	/* Number of free buffers */
 	unsigned int num_free;
 	/* Head of free buffer list. */
@@ -103,6 +120,16 @@ struct vring_virtqueue
 	/* Last used index we've seen. */
 	u16 last_used_idx;
 
+	/* Packed ring: next descriptor to make available, the wrap counters
+	 * for both sides, the AVAIL/USED flag bits for the current lap and the
+	 * last value written to the driver event flags. */
+	u16 next_avail_idx;
+	u16 avail_used_flags;
+	u16 event_flags_shadow;
+	bool avail_wrap_counter;
+	bool used_wrap_counter;
+	struct vring_packed_state *packed_state;
+
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	void (*notify)(struct virtqueue *vq);
 
@@ -121,6 +148,20 @@ struct vring_virtqueue
 
 #define to_vvq(_vq) container_of(_vq, struct vring_virtqueue, vq)
 
+/*
+ * virtqueue_enable_cb_delayed() asks for the callback once three
+ * quarters of the @bufs outstanding buffers are used.  That suppresses
+ * most of the interrupts of a busy queue, while the quarter still
+ * outstanding keeps the device busy until the callback has run and the
+ * driver has refilled.  Split and packed rings use the same value, so
+ * tools/virtio (virtio_test --delayed-interrupt, with and without
+ * --packed) compares the layouts and not the thresholds.
+ */
+static inline u16 vring_delayed_cb_bufs(u16 bufs)
+{
+	return bufs * 3 / 4;
+}
+
 /* Set up an indirect table of descriptors and add it to the queue. */
 static int vring_add_indirect(struct vring_virtqueue *vq,
 			      struct scatterlist sg[],
@@ -171,6 +212,114 @@ static int vring_add_indirect(struct vring_virtqueue *vq,
 	return head;
 }
 
+static inline void vring_packed_advance(struct vring_virtqueue *vq,
+					unsigned int *i)
+{
+	if (++*i >= vq->vring_packed.num) {
+		*i = 0;
+		vq->avail_wrap_counter ^= 1;
+		vq->avail_used_flags ^= VRING_PACKED_DESC_F_AVAIL |
+					VRING_PACKED_DESC_F_USED;
+	}
+}
+
+/* Packed ring version of virtqueue_add_buf.  A chain takes consecutive
+ * ring entries; the head's flags are written last since they are what hands
+ * the whole chain over to the other side. */
+static int virtqueue_add_buf_packed(struct vring_virtqueue *vq,
+				    struct scatterlist sg[],
+				    unsigned int out,
+				    unsigned int in,
+				    void *data,
+				    gfp_t gfp)
+{
+	struct vring_packed_desc *desc = vq->vring_packed.desc;
+	struct vring_packed_desc *indir = NULL;
+	struct scatterlist *s;
+	unsigned int i, n, head, total = out + in, descs;
+	u16 id, flags, uninitialized_var(head_flags);
+
+	START_USE(vq);
+
+	BUG_ON(data == NULL);
+	BUG_ON(total == 0);
+
+	/* If the host supports indirect descriptor tables, and we have multiple
+	 * buffers, then go indirect.  Entries in a packed indirect table are
+	 * consecutive, so there is nothing to chain. */
+	if (vq->indirect && total > 1 && vq->num_free) {
+		indir = kmalloc(total * sizeof(*indir), gfp);
+		for (n = 0, s = sg; indir && n < total; n++, s++) {
+			indir[n].addr = sg_phys(s);
+			indir[n].len = s->length;
+			indir[n].id = 0;
+			indir[n].flags = n < out ? 0 : VRING_DESC_F_WRITE;
+		}
+	}
+
+	descs = indir ? 1 : total;
+	BUG_ON(descs > vq->vring_packed.num);
+
+	if (vq->num_free < descs) {
+		pr_debug("Can't add buf len %i - avail = %i\n",
+			 descs, vq->num_free);
+		kfree(indir);
+		if (out)
+			vq->notify(&vq->vq);
+		END_USE(vq);
+		return -ENOSPC;
+	}
+
+	/* There are never more buffers than descriptors, so an id is free. */
+	id = vq->free_head;
+	vq->free_head = vq->packed_state[id].next;
+	vq->num_free -= descs;
+
+	head = i = vq->next_avail_idx;
+	if (indir) {
+		desc[i].addr = virt_to_phys(indir);
+		desc[i].len = total * sizeof(*indir);
+		desc[i].id = id;
+		head_flags = VRING_DESC_F_INDIRECT | vq->avail_used_flags;
+		vring_packed_advance(vq, &i);
+	} else {
+		for (n = 0; n < total; n++) {
+			flags = n < out ? 0 : VRING_DESC_F_WRITE;
+			if (n + 1 < total)
+				flags |= VRING_DESC_F_NEXT;
+			desc[i].addr = sg_phys(sg);
+			desc[i].len = sg->length;
+			desc[i].id = id;
+			if (n == 0)
+				head_flags = flags | vq->avail_used_flags;
+			else
+				desc[i].flags = flags | vq->avail_used_flags;
+			vring_packed_advance(vq, &i);
+			sg++;
+		}
+	}
+	vq->next_avail_idx = i;
+
+	vq->packed_state[id].num = descs;
+	vq->packed_state[id].indir_desc = indir;
+	vq->data[id] = data;
+
+	/* The rest of the chain must be visible before the head is. */
+	virtio_wmb(vq);
+	desc[head].flags = head_flags;
+	vq->num_added += descs;
+
+	/* This is very unlikely, but theoretically possible.  Kick
+	 * just in case. */
+	if (unlikely(vq->num_added >= (1 << 16) - vq->vring_packed.num))
+		virtqueue_kick(&vq->vq);
+
+	pr_debug("Added buffer id %i to %p\n", id, vq);
+	END_USE(vq);
+
+	return vq->num_free;
+}
+
 /**
  * virtqueue_add_buf - expose buffer to other end
  * @vq: the struct virtqueue we're talking about.
@@ -199,6 +348,9 @@ int virtqueue_add_buf(struct virtqueue *_vq,
 	unsigned int i, avail, uninitialized_var(prev);
 	int head;
 
+	if (vq->packed)
+		return virtqueue_add_buf_packed(vq, sg, out, in, data, gfp);
+
 	START_USE(vq);
 
 	BUG_ON(data == NULL);
@@ -290,6 +442,48 @@ add_head:
 }
 EXPORT_SYMBOL_GPL(virtqueue_add_buf);
 
+static bool virtqueue_kick_prepare_packed(struct vring_virtqueue *vq)
+{
+	struct vring_packed_desc_event *device = vq->vring_packed.device;
+	u16 new, old, off_wrap, flags, event_idx;
+	bool needs_kick;
+
+	START_USE(vq);
+	/* We need to expose the new descriptors before checking the
+	 * device event. */
+	virtio_mb(vq);
+
+	old = vq->next_avail_idx - vq->num_added;
+	new = vq->next_avail_idx;
+	vq->num_added = 0;
+
+#ifdef DEBUG
+	if (vq->last_add_time_valid) {
+		WARN_ON(ktime_to_ms(ktime_sub(ktime_get(),
+					      vq->last_add_time)) > 100);
+	}
+	vq->last_add_time_valid = false;
+#endif
+
+	flags = device->flags;
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC) {
+		needs_kick = flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+		goto out;
+	}
+
+	/* The host writes the offset before it switches to DESC. */
+	virtio_rmb(vq);
+	off_wrap = device->off_wrap;
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+	    vq->avail_wrap_counter)
+		event_idx -= vq->vring_packed.num;
+	needs_kick = vring_need_event(event_idx, new, old);
+out:
+	END_USE(vq);
+	return needs_kick;
+}
+
 /**
  * virtqueue_kick_prepare - first half of split virtqueue_kick call.
  * @vq: the struct virtqueue
@@ -307,6 +501,9 @@ bool virtqueue_kick_prepare(struct virtqueue *_vq)
 	u16 new, old;
 	bool needs_kick;
 
+	if (vq->packed)
+		return virtqueue_kick_prepare_packed(vq);
+
 	START_USE(vq);
 	/* We need to expose available array entries before checking avail
 	 * event. */
@@ -397,6 +594,110 @@ static inline bool more_used(const struct vring_virtqueue *vq)
 	return vq->last_used_idx != vq->vring.used->idx;
 }
 
+static void detach_buf_packed(struct vring_virtqueue *vq, unsigned int id)
+{
+	struct vring_packed_state *state = &vq->packed_state[id];
+
+	vq->data[id] = NULL;
+	vq->num_free += state->num;
+
+	kfree(state->indir_desc);
+	state->indir_desc = NULL;
+
+	state->next = vq->free_head;
+	vq->free_head = id;
+}
+
+/* A descriptor has been used once the host set both AVAIL and USED to the
+ * wrap counter of the lap we expect. */
+static inline bool is_used_desc_packed(const struct vring_virtqueue *vq,
+				       u16 idx, bool used_wrap_counter)
+{
+	u16 flags = vq->vring_packed.desc[idx].flags;
+	bool avail = !!(flags & VRING_PACKED_DESC_F_AVAIL);
+	bool used = !!(flags & VRING_PACKED_DESC_F_USED);
+
+	return avail == used && used == used_wrap_counter;
+}
+
+static inline bool more_used_packed(const struct vring_virtqueue *vq)
+{
+	return is_used_desc_packed(vq, vq->last_used_idx,
+				   vq->used_wrap_counter);
+}
+
+static inline u16 packed_event_off_wrap(u16 idx, bool wrap_counter)
+{
+	return idx | (wrap_counter << VRING_PACKED_EVENT_F_WRAP_CTR);
+}
+
+static void *virtqueue_get_buf_packed(struct vring_virtqueue *vq,
+				      unsigned int *len)
+{
+	struct vring_packed_desc *desc = vq->vring_packed.desc;
+	unsigned int id;
+	u16 last_used;
+	void *ret;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return NULL;
+	}
+
+	if (!more_used_packed(vq)) {
+		pr_debug("No more buffers in queue\n");
+		END_USE(vq);
+		return NULL;
+	}
+
+	/* Only read the descriptor after the host has exposed it. */
+	virtio_rmb(vq);
+
+	last_used = vq->last_used_idx;
+	id = desc[last_used].id;
+	*len = desc[last_used].len;
+
+	if (unlikely(id >= vq->vring_packed.num)) {
+		BAD_RING(vq, "id %u out of range\n", id);
+		return NULL;
+	}
+	if (unlikely(!vq->data[id])) {
+		BAD_RING(vq, "id %u is not a head!\n", id);
+		return NULL;
+	}
+
+	/* The host writes a single used descriptor for the whole chain, and
+	 * the next one follows the slots the chain occupied. */
+	vq->last_used_idx += vq->packed_state[id].num;
+	if (vq->last_used_idx >= vq->vring_packed.num) {
+		vq->last_used_idx -= vq->vring_packed.num;
+		vq->used_wrap_counter ^= 1;
+	}
+
+	/* detach_buf_packed clears data, so grab it now. */
+	ret = vq->data[id];
+	detach_buf_packed(vq, id);
+
+	/* If we expect an interrupt for the next entry, tell host
+	 * by writing event index and flush out the write before
+	 * the read in the next get_buf call. */
+	if (vq->event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC) {
+		vq->vring_packed.driver->off_wrap =
+			packed_event_off_wrap(vq->last_used_idx,
+					      vq->used_wrap_counter);
+		virtio_mb(vq);
+	}
+
+#ifdef DEBUG
+	vq->last_add_time_valid = false;
+#endif
+
+	END_USE(vq);
+	return ret;
+}
+
 /**
  * virtqueue_get_buf - get the next used buffer
  * @vq: the struct virtqueue we're talking about.
@@ -420,6 +721,9 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	unsigned int i;
 	u16 last_used;
 
+	if (vq->packed)
+		return virtqueue_get_buf_packed(vq, len);
+
 	START_USE(vq);
 
 	if (unlikely(vq->broken)) {
@@ -483,10 +787,76 @@ void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed) {
+		if (vq->event_flags_shadow != VRING_PACKED_EVENT_FLAG_DISABLE) {
+			vq->event_flags_shadow = VRING_PACKED_EVENT_FLAG_DISABLE;
+			vq->vring_packed.driver->flags = vq->event_flags_shadow;
+		}
+		return;
+	}
+
 	vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
 }
 EXPORT_SYMBOL_GPL(virtqueue_disable_cb);
 
+/* Point the driver event at @idx, if event indexes are in use, and turn
+ * callbacks back on. */
+static void vring_packed_enable_event(struct vring_virtqueue *vq,
+				      u16 idx, bool wrap_counter)
+{
+	if (vq->event) {
+		vq->vring_packed.driver->off_wrap =
+			packed_event_off_wrap(idx, wrap_counter);
+		/* The offset must be valid by the time the host sees DESC. */
+		virtio_wmb(vq);
+	}
+
+	if (vq->event_flags_shadow == VRING_PACKED_EVENT_FLAG_DISABLE) {
+		vq->event_flags_shadow = vq->event ?
+					 VRING_PACKED_EVENT_FLAG_DESC :
+					 VRING_PACKED_EVENT_FLAG_ENABLE;
+		vq->vring_packed.driver->flags = vq->event_flags_shadow;
+	}
+}
+
+static bool virtqueue_enable_cb_packed(struct vring_virtqueue *vq)
+{
+	bool ret;
+
+	START_USE(vq);
+
+	vring_packed_enable_event(vq, vq->last_used_idx,
+				  vq->used_wrap_counter);
+	virtio_mb(vq);
+	ret = !more_used_packed(vq);
+
+	END_USE(vq);
+	return ret;
+}
+
+static bool virtqueue_enable_cb_delayed_packed(struct vring_virtqueue *vq)
+{
+	u16 bufs, used_idx;
+	bool wrap_counter, ret;
+
+	START_USE(vq);
+
+	bufs = vring_delayed_cb_bufs(vq->vring_packed.num - vq->num_free);
+	used_idx = vq->last_used_idx + bufs;
+	wrap_counter = vq->used_wrap_counter;
+	if (used_idx >= vq->vring_packed.num) {
+		used_idx -= vq->vring_packed.num;
+		wrap_counter ^= 1;
+	}
+
+	vring_packed_enable_event(vq, used_idx, wrap_counter);
+	virtio_mb(vq);
+	ret = !is_used_desc_packed(vq, used_idx, wrap_counter);
+
+	END_USE(vq);
+	return ret;
+}
+
 /**
  * virtqueue_enable_cb - restart callbacks after disable_cb.
  * @vq: the struct virtqueue we're talking about.
@@ -502,6 +872,9 @@ bool virtqueue_enable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
+	if (vq->packed)
+		return virtqueue_enable_cb_packed(vq);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -540,6 +913,9 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 bufs;
 
+	if (vq->packed)
+		return virtqueue_enable_cb_delayed_packed(vq);
+
 	START_USE(vq);
 
 	/* We optimistically turn back on interrupts, then check if there was
@@ -548,8 +924,7 @@ bool virtqueue_enable_cb_delayed(struct virtqueue *_vq)
 	 * either clear the flags bit or point the event index at the next
 	 * entry. Always do both to keep code simple. */
 	vq->vring.avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
-	/* TODO: tune this threshold */
-	bufs = (u16)(vq->vring.avail->idx - vq->last_used_idx) * 3 / 4;
+	bufs = vring_delayed_cb_bufs(vq->vring.avail->idx - vq->last_used_idx);
 	vring_used_event(&vq->vring) = vq->last_used_idx + bufs;
 	virtio_mb(vq);
 	if (unlikely((u16)(vq->vring.used->idx - vq->last_used_idx) > bufs)) {
@@ -578,6 +953,20 @@ void *virtqueue_detach_unused_buf(struct virtqueue *_vq)
 
 	START_USE(vq);
 
+	if (vq->packed) {
+		for (i = 0; i < vq->vring_packed.num; i++) {
+			if (!vq->data[i])
+				continue;
+			buf = vq->data[i];
+			detach_buf_packed(vq, i);
+			END_USE(vq);
+			return buf;
+		}
+		BUG_ON(vq->num_free != vq->vring_packed.num);
+		END_USE(vq);
+		return NULL;
+	}
+
 	for (i = 0; i < vq->vring.num; i++) {
 		if (!vq->data[i])
 			continue;
@@ -600,7 +989,7 @@ irqreturn_t vring_interrupt(int irq, void *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
-	if (!more_used(vq)) {
+	if (!(vq->packed ? more_used_packed(vq) : more_used(vq))) {
 		pr_debug("virtqueue interrupt with no work for %p\n", vq);
 		return IRQ_NONE;
 	}
@@ -616,7 +1005,8 @@ irqreturn_t vring_interrupt(int irq, void *_vq)
 }
 EXPORT_SYMBOL_GPL(vring_interrupt);
 
-struct virtqueue *vring_new_virtqueue(unsigned int num,
+struct virtqueue *vring_new_virtqueue(unsigned int index,
+				      unsigned int num,
 				      unsigned int vring_align,
 				      struct virtio_device *vdev,
 				      bool weak_barriers,
@@ -627,6 +1017,8 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 {
 	struct vring_virtqueue *vq;
 	unsigned int i;
+	bool packed = virtio_has_feature(vdev, VIRTIO_RING_F_PACKED);
+	size_t size;
 
 	/* We assume num is a power of 2. */
 	if (num & (num - 1)) {
@@ -634,14 +1026,23 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 		return NULL;
 	}
 
-	vq = kmalloc(sizeof(*vq) + sizeof(void *)*num, GFP_KERNEL);
+	/* The packed ring keeps its per-id state right after the tokens. */
+	size = sizeof(*vq) + sizeof(void *)*num;
+	if (packed)
+		size += sizeof(struct vring_packed_state) * num;
+	vq = kmalloc(size, GFP_KERNEL);
 	if (!vq)
 		return NULL;
 
-	vring_init(&vq->vring, num, pages, vring_align);
+	vq->packed = packed;
+	if (packed)
+		vring_packed_init(&vq->vring_packed, num, pages, vring_align);
+	else
+		vring_init(&vq->vring, num, pages, vring_align);
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
+	vq->vq.index = index;
 	vq->notify = notify;
 	vq->weak_barriers = weak_barriers;
 	vq->broken = false;
@@ -656,6 +1057,35 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
 
+	if (packed) {
+		struct vring_packed_state *state = (void *)&vq->data[num];
+
+		vq->packed_state = state;
+		vq->next_avail_idx = 0;
+		vq->avail_wrap_counter = 1;
+		vq->used_wrap_counter = 1;
+		vq->avail_used_flags = VRING_PACKED_DESC_F_AVAIL;
+		memset(vq->vring_packed.desc, 0,
+		       num * sizeof(*vq->vring_packed.desc));
+
+		/* No callback?  Tell other side not to bother us. */
+		vq->event_flags_shadow = callback ?
+					 VRING_PACKED_EVENT_FLAG_ENABLE :
+					 VRING_PACKED_EVENT_FLAG_DISABLE;
+		vq->vring_packed.driver->off_wrap = 0;
+		vq->vring_packed.driver->flags = vq->event_flags_shadow;
+
+		/* Put every buffer id in the free list. */
+		vq->num_free = num;
+		vq->free_head = 0;
+		for (i = 0; i < num; i++) {
+			state[i].next = i + 1;
+			state[i].indir_desc = NULL;
+			vq->data[i] = NULL;
+		}
+		return &vq->vq;
+	}
+
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback)
 		vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
@@ -691,6 +1121,8 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_RING_F_EVENT_IDX:
 			break;
+		case VIRTIO_RING_F_PACKED:
+			break;
 		default:
 			/* We don't understand this bit. */
 			clear_bit(i, vdev->features);
@@ -711,7 +1143,7 @@ unsigned int virtqueue_get_vring_size(struct virtqueue *_vq)
 
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
-	return vq->vring.num;
+	return vq->packed ? vq->vring_packed.num : vq->vring.num;
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_vring_size);
 
@@ -194,12 +194,14 @@ static void ctx_rcu_free(struct rcu_head *head)
 	kmem_cache_free(kioctx_cachep, ctx);
 }
 
-/* __put_ioctx
- *	Called when the last user of an aio context has gone away,
- *	and the struct needs to be freed.
+/* free_ioctx
+ *	Called from a work item when the last user of an aio context has
+ *	gone away, and the struct needs to be freed.  The ring has been
+ *	unmapped by then.
  */
-static void __put_ioctx(struct kioctx *ctx)
+static void free_ioctx(struct work_struct *work)
 {
+	struct kioctx *ctx = container_of(work, struct kioctx, free_work);
 	unsigned nr_events = ctx->max_reqs;
 	BUG_ON(ctx->reqs_active);
 
@@ -213,20 +215,25 @@ static void __put_ioctx(struct kioctx *ctx)
 		aio_nr -= nr_events;
 		spin_unlock(&aio_nr_lock);
 	}
-	pr_debug("__put_ioctx: freeing %p\n", ctx);
+	percpu_ref_exit(&ctx->users);
+	pr_debug("free_ioctx: freeing %p\n", ctx);
 	call_rcu(&ctx->rcu_head, ctx_rcu_free);
 }
 
-static inline int try_get_ioctx(struct kioctx *kioctx)
+/*
+ * The last put can happen from the RCU callback of percpu_ref_kill(),
+ * so leave the freeing, which sleeps, to a work item.
+ */
+static void free_ioctx_ref(struct percpu_ref *ref)
 {
-	return atomic_inc_not_zero(&kioctx->users);
+	struct kioctx *ctx = container_of(ref, struct kioctx, users);
+
+	schedule_work(&ctx->free_work);
 }
 
 static inline void put_ioctx(struct kioctx *kioctx)
 {
-	BUG_ON(atomic_read(&kioctx->users) <= 0);
-	if (unlikely(atomic_dec_and_test(&kioctx->users)))
-		__put_ioctx(kioctx);
+	percpu_ref_put(&kioctx->users);
 }
 
 /* ioctx_alloc
@@ -256,7 +263,11 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	mm = ctx->mm = current->mm;
 	atomic_inc(&mm->mm_count);
 
-	atomic_set(&ctx->users, 2);
+	/* one reference for the mm's list, one for the caller */
+	if (percpu_ref_init(&ctx->users, free_ioctx_ref))
+		goto out_freectx;
+	percpu_ref_get(&ctx->users);
+
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
@@ -264,9 +275,10 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
+	INIT_WORK(&ctx->free_work, free_ioctx);
 
 	if (aio_setup_ring(ctx) < 0)
-		goto out_freectx;
+		goto out_freeref;
 
 	/* limit the number of system wide aios */
 	spin_lock(&aio_nr_lock);
@@ -290,6 +302,8 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 out_cleanup:
 	err = -EAGAIN;
 	aio_free_ring(ctx);
+out_freeref:
+	percpu_ref_exit(&ctx->users);
 out_freectx:
 	mmdrop(mm);
 	kmem_cache_free(kioctx_cachep, ctx);
@@ -376,11 +390,6 @@ void exit_aio(struct mm_struct *mm)
 
 		kill_ctx(ctx);
 
-		if (1 != atomic_read(&ctx->users))
-			printk(KERN_DEBUG
-				"exit_aio:ioctx still alive: %d %d %d\n",
-				atomic_read(&ctx->users), ctx->dead,
-				ctx->reqs_active);
 		/*
 		 * We don't need to bother with munmap() here -
 		 * exit_mmap(mm) is coming and it'll unmap everything.
@@ -392,7 +401,7 @@ void exit_aio(struct mm_struct *mm)
 		 * all other callers have ctx->mm == current->mm.
 		 */
 		ctx->ring_info.mmap_size = 0;
-		put_ioctx(ctx);
+		percpu_ref_kill(&ctx->users);
 	}
 }
 
@@ -595,11 +604,12 @@ static struct kioctx *lookup_ioctx(unsigned long ctx_id)
 	hlist_for_each_entry_rcu(ctx, n, &mm->ioctx_list, list) {
 		/*
 		 * RCU protects us against accessing freed memory but
-		 * we have to be careful not to get a reference when the
-		 * reference count already dropped to 0 (ctx->dead test
-		 * is unreliable because of races).
+		 * we have to be careful not to get a reference once the
+		 * context is being destroyed (ctx->dead test is unreliable
+		 * because of races).
 		 */
-		if (ctx->user_id == ctx_id && !ctx->dead && try_get_ioctx(ctx)){
+		if (ctx->user_id == ctx_id &&
+		    percpu_ref_tryget_live(&ctx->users)) {
 			ret = ctx;
 			break;
 		}
@@ -1203,10 +1213,21 @@ static void io_destroy(struct kioctx *ioctx)
 
 	dprintk("aio_release(%p)\n", ioctx);
 	if (likely(!was_dead))
-		put_ioctx(ioctx);	/* twice for the list */
+		percpu_ref_kill(&ioctx->users);	/* the list's reference */
 
 	kill_ctx(ioctx);
 
+	/*
+	 * The last reference may go away in any context, unmap the ring
+	 * while we are still in the owner's mm.  Anybody still using the
+	 * context goes through ->ring_pages, not the user mapping.
+	 */
+	if (likely(!was_dead) && ioctx->ring_info.mmap_size) {
+		vm_munmap(ioctx->ring_info.mmap_base,
+			  ioctx->ring_info.mmap_size);
+		ioctx->ring_info.mmap_size = 0;
+	}
+
 	/*
 	 * Wake up any waiters.  The setting of ctx->dead must be seen
 	 * by other CPUs at this point.  Right now, we rely on the
@@ -32,6 +32,7 @@
 #include <linux/elf.h>
 #include <linux/utsname.h>
 #include <linux/coredump.h>
+#include <linux/hash.h>
 #include <asm/uaccess.h>
 #include <asm/param.h>
 #include <asm/page.h>
@@ -314,15 +315,66 @@ create_elf_tables(struct linux_binprm *bprm, struct elfhdr *exec,
 	return 0;
 }
 
+static inline int make_prot(u32 p_flags)
+{
+	int prot = 0;
+
+	if (p_flags & PF_R)
+		prot |= PROT_READ;
+	if (p_flags & PF_W)
+		prot |= PROT_WRITE;
+	if (p_flags & PF_X)
+		prot |= PROT_EXEC;
+	return prot;
+}
+
+static inline unsigned long elf_map_size(struct elf_phdr *eppnt)
+{
+	return ELF_PAGEALIGN(eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr));
+}
+
+/*
+ * All PT_LOAD segments of an image are mapped under a single hold of
+ * mmap_sem.  The LSMs are asked about each of them beforehand, since
+ * security_mmap_file() may not be called with mmap_sem held.
+ */
+static int elf_check_mmap(struct file *filep, struct elf_phdr *phdata,
+			  int nr, int type)
+{
+	int i, retval;
+
+	for (i = 0; i < nr; i++, phdata++) {
+		if (phdata->p_type != PT_LOAD || !elf_map_size(phdata))
+			continue;
+		retval = security_mmap_file(filep, make_prot(phdata->p_flags),
+					    type);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
+/* vm_mmap() for callers holding mmap_sem, see elf_check_mmap() */
+static unsigned long elf_do_mmap(struct file *filep, unsigned long addr,
+		unsigned long len, int prot, int type, unsigned long off)
+{
+	if (unlikely(off + PAGE_ALIGN(len) < off))
+		return -EINVAL;
+	if (unlikely(off & ~PAGE_MASK))
+		return -EINVAL;
+
+	return do_mmap_pgoff(filep, addr, len, prot, type, off >> PAGE_SHIFT);
+}
+
+/* Called with mmap_sem held for writing. */
 static unsigned long elf_map(struct file *filep, unsigned long addr,
 		struct elf_phdr *eppnt, int prot, int type,
 		unsigned long total_size)
 {
 	unsigned long map_addr;
-	unsigned long size = eppnt->p_filesz + ELF_PAGEOFFSET(eppnt->p_vaddr);
+	unsigned long size = elf_map_size(eppnt);
 	unsigned long off = eppnt->p_offset - ELF_PAGEOFFSET(eppnt->p_vaddr);
 	addr = ELF_PAGESTART(addr);
-	size = ELF_PAGEALIGN(size);
 
 	/* mmap() will return -EINVAL if given a zero size, but a
 	 * segment with zero filesize is perfectly valid */
@@ -339,11 +391,11 @@ static unsigned long elf_map(struct file *filep, unsigned long addr,
 	*/
 	if (total_size) {
 		total_size = ELF_PAGEALIGN(total_size);
-		map_addr = vm_mmap(filep, addr, total_size, prot, type, off);
+		map_addr = elf_do_mmap(filep, addr, total_size, prot, type, off);
 		if (!BAD_ADDR(map_addr))
-			vm_munmap(map_addr+size, total_size-size);
+			do_munmap(current->mm, map_addr+size, total_size-size);
 	} else
-		map_addr = vm_mmap(filep, addr, size, prot, type, off);
+		map_addr = elf_do_mmap(filep, addr, size, prot, type, off);
 
 	return(map_addr);
 }
@@ -367,6 +419,132 @@ static unsigned long total_mapping_size(struct elf_phdr *cmds, int nr)
 }
 
 
+/*
+ * Program headers of recently executed images, so that launching the same
+ * few binaries and their interpreter over and over does not read and copy
+ * them out of the page cache each time.  Only files on filesystems that
+ * maintain i_version are cached, and a copy is used only while i_version,
+ * size and mtime are those the headers were read with.
+ */
+#define ELF_PHDR_CACHE_SIZE	64
+
+struct elf_phdr_cache_entry {
+	struct super_block *sb;
+	unsigned long ino;
+	u32 generation;
+	u64 version;
+	loff_t isize;
+	struct timespec mtime;
+	loff_t phoff;
+	unsigned int size;
+	struct elf_phdr *phdata;
+};
+
+static struct elf_phdr_cache_entry elf_phdr_cache[ELF_PHDR_CACHE_SIZE];
+static DEFINE_SPINLOCK(elf_phdr_cache_lock);
+
+static struct elf_phdr_cache_entry *elf_phdr_cache_slot(struct inode *inode)
+{
+	unsigned long hash = hash_ptr(inode->i_sb, 8) ^ inode->i_ino;
+
+	return &elf_phdr_cache[hash_long(hash, ilog2(ELF_PHDR_CACHE_SIZE))];
+}
+
+static bool elf_phdr_cache_match(struct elf_phdr_cache_entry *ce,
+				 struct inode *inode, loff_t phoff,
+				 unsigned int size)
+{
+	return ce->phdata && ce->sb == inode->i_sb &&
+		ce->ino == inode->i_ino &&
+		ce->generation == inode->i_generation &&
+		ce->version == inode->i_version &&
+		ce->isize == i_size_read(inode) &&
+		timespec_equal(&ce->mtime, &inode->i_mtime) &&
+		ce->phoff == phoff && ce->size == size;
+}
+
+static bool elf_phdr_cache_lookup(struct inode *inode, loff_t phoff,
+				  unsigned int size, struct elf_phdr *phdata)
+{
+	struct elf_phdr_cache_entry *ce = elf_phdr_cache_slot(inode);
+	bool hit;
+
+	spin_lock(&elf_phdr_cache_lock);
+	hit = elf_phdr_cache_match(ce, inode, phoff, size);
+	if (hit)
+		memcpy(phdata, ce->phdata, size);
+	spin_unlock(&elf_phdr_cache_lock);
+	return hit;
+}
+
+/*
+ * i_version was sampled before the headers were read, so a write racing
+ * with the read leaves an entry that will never match.
+ */
+static void elf_phdr_cache_insert(struct inode *inode, u64 version,
+				  loff_t phoff, unsigned int size,
+				  struct elf_phdr *phdata)
+{
+	struct elf_phdr_cache_entry *ce = elf_phdr_cache_slot(inode);
+	struct elf_phdr *copy, *old;
+
+	copy = kmemdup(phdata, size, GFP_KERNEL);
+	if (!copy)
+		return;
+
+	spin_lock(&elf_phdr_cache_lock);
+	old = ce->phdata;
+	ce->sb = inode->i_sb;
+	ce->ino = inode->i_ino;
+	ce->generation = inode->i_generation;
+	ce->version = version;
+	ce->isize = i_size_read(inode);
+	ce->mtime = inode->i_mtime;
+	ce->phoff = phoff;
+	ce->size = size;
+	ce->phdata = copy;
+	spin_unlock(&elf_phdr_cache_lock);
+
+	kfree(old);
+}
+
+/*
+ * Read the program headers of elf_file into a new buffer, which the
+ * caller frees.  The header counts have been checked by the caller.
+ */
+static int load_elf_phdrs(struct elfhdr *elf_ex, struct file *elf_file,
+			  struct elf_phdr **phdata)
+{
+	struct inode *inode = elf_file->f_path.dentry->d_inode;
+	unsigned int size = elf_ex->e_phnum * sizeof(struct elf_phdr);
+	struct elf_phdr *elf_phdata;
+	bool cached = IS_I_VERSION(inode);
+	u64 version = inode->i_version;
+	int retval;
+
+	elf_phdata = kmalloc(size, GFP_KERNEL);
+	if (!elf_phdata)
+		return -ENOMEM;
+
+	if (cached && elf_phdr_cache_lookup(inode, elf_ex->e_phoff, size,
+					    elf_phdata))
+		goto out;
+
+	retval = kernel_read(elf_file, elf_ex->e_phoff,
+			     (char *)elf_phdata, size);
+	if (retval != size) {
+		kfree(elf_phdata);
+		return retval < 0 ? retval : -EIO;
+	}
+
+	if (cached)
+		elf_phdr_cache_insert(inode, version, elf_ex->e_phoff, size,
+				      elf_phdata);
+out:
+	*phdata = elf_phdata;
+	return 0;
+}
+
 /* This is much more generalized than the library routine read function,
    so we keep this separate.  Technically the library read function
    is only provided so that we can read a.out libraries that have
@@ -408,17 +586,10 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 	size = sizeof(struct elf_phdr) * interp_elf_ex->e_phnum;
 	if (size > ELF_MIN_ALIGN)
 		goto out;
-	elf_phdata = kmalloc(size, GFP_KERNEL);
-	if (!elf_phdata)
+	retval = load_elf_phdrs(interp_elf_ex, interpreter, &elf_phdata);
+	if (retval) {
+		error = retval;
 		goto out;
-
-	retval = kernel_read(interpreter, interp_elf_ex->e_phoff,
-			     (char *)elf_phdata, size);
-	error = -EIO;
-	if (retval != size) {
-		if (retval < 0)
-			error = retval;	
-		goto out_close;
 	}
 
 	total_size = total_mapping_size(elf_phdata, interp_elf_ex->e_phnum);
@@ -427,20 +598,20 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 		goto out_close;
 	}
 
+	error = elf_check_mmap(interpreter, elf_phdata, interp_elf_ex->e_phnum,
+			       MAP_PRIVATE | MAP_DENYWRITE);
+	if (error)
+		goto out_close;
+
+	down_write(&current->mm->mmap_sem);
 	eppnt = elf_phdata;
 	for (i = 0; i < interp_elf_ex->e_phnum; i++, eppnt++) {
 		if (eppnt->p_type == PT_LOAD) {
 			int elf_type = MAP_PRIVATE | MAP_DENYWRITE;
-			int elf_prot = 0;
+			int elf_prot = make_prot(eppnt->p_flags);
 			unsigned long vaddr = 0;
 			unsigned long k, map_addr;
 
-			if (eppnt->p_flags & PF_R)
-		    		elf_prot = PROT_READ;
-			if (eppnt->p_flags & PF_W)
-				elf_prot |= PROT_WRITE;
-			if (eppnt->p_flags & PF_X)
-				elf_prot |= PROT_EXEC;
 			vaddr = eppnt->p_vaddr;
 			if (interp_elf_ex->e_type == ET_EXEC || load_addr_set)
 				elf_type |= MAP_FIXED;
@@ -453,8 +624,10 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 			if (!*interp_map_addr)
 				*interp_map_addr = map_addr;
 			error = map_addr;
-			if (BAD_ADDR(map_addr))
+			if (BAD_ADDR(map_addr)) {
+				up_write(&current->mm->mmap_sem);
 				goto out_close;
+			}
 
 			if (!load_addr_set &&
 			    interp_elf_ex->e_type == ET_DYN) {
@@ -473,6 +646,7 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 			    eppnt->p_memsz > TASK_SIZE ||
 			    TASK_SIZE - eppnt->p_memsz < k) {
 				error = -ENOMEM;
+				up_write(&current->mm->mmap_sem);
 				goto out_close;
 			}
 
@@ -493,6 +667,7 @@ static unsigned long load_elf_interp(struct elfhdr *interp_elf_ex,
 				last_bss = k;
 		}
 	}
+	up_write(&current->mm->mmap_sem);
 
 	if (last_bss > elf_bss) {
 		/*
@@ -561,7 +736,6 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 	struct elf_phdr *elf_ppnt, *elf_phdata;
 	unsigned long elf_bss, elf_brk;
 	int retval, i;
-	unsigned int size;
 	unsigned long elf_entry;
 	unsigned long interp_load_addr = 0;
 	unsigned long start_code, end_code, start_data, end_data;
@@ -600,20 +774,10 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 	if (loc->elf_ex.e_phnum < 1 ||
 	 	loc->elf_ex.e_phnum > 65536U / sizeof(struct elf_phdr))
 		goto out;
-	size = loc->elf_ex.e_phnum * sizeof(struct elf_phdr);
-	retval = -ENOMEM;
-	elf_phdata = kmalloc(size, GFP_KERNEL);
-	if (!elf_phdata)
+	retval = load_elf_phdrs(&loc->elf_ex, bprm->file, &elf_phdata);
+	if (retval)
 		goto out;
 
-	retval = kernel_read(bprm->file, loc->elf_ex.e_phoff,
-			     (char *)elf_phdata, size);
-	if (retval != size) {
-		if (retval >= 0)
-			retval = -EIO;
-		goto out_free_ph;
-	}
-
 	elf_ppnt = elf_phdata;
 	elf_bss = 0;
 	elf_brk = 0;
@@ -733,11 +897,19 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 	
 	current->mm->start_stack = bprm->p;
 
+	retval = elf_check_mmap(bprm->file, elf_phdata, loc->elf_ex.e_phnum,
+				MAP_PRIVATE | MAP_DENYWRITE | MAP_EXECUTABLE);
+	if (retval) {
+		send_sig(SIGKILL, current, 0);
+		goto out_free_dentry;
+	}
+
 	/* Now we do a little grungy work by mmapping the ELF image into
 	   the correct location in memory. */
+	down_write(&current->mm->mmap_sem);
 	for(i = 0, elf_ppnt = elf_phdata;
 	    i < loc->elf_ex.e_phnum; i++, elf_ppnt++) {
-		int elf_prot = 0, elf_flags;
+		int elf_prot = make_prot(elf_ppnt->p_flags), elf_flags;
 		unsigned long k, vaddr;
 
 		if (elf_ppnt->p_type != PT_LOAD)
@@ -749,6 +921,7 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 			/* There was a PT_LOAD segment with p_memsz > p_filesz
 			   before this one. Map anonymous pages, if needed,
 			   and clear the area.  */
+			up_write(&current->mm->mmap_sem);
 			retval = set_brk(elf_bss + load_bias,
 					 elf_brk + load_bias);
 			if (retval) {
@@ -769,15 +942,9 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 					 */
 				}
 			}
+			down_write(&current->mm->mmap_sem);
 		}
 
-		if (elf_ppnt->p_flags & PF_R)
-			elf_prot |= PROT_READ;
-		if (elf_ppnt->p_flags & PF_W)
-			elf_prot |= PROT_WRITE;
-		if (elf_ppnt->p_flags & PF_X)
-			elf_prot |= PROT_EXEC;
-
 		elf_flags = MAP_PRIVATE | MAP_DENYWRITE | MAP_EXECUTABLE;
 
 		vaddr = elf_ppnt->p_vaddr;
@@ -807,6 +974,7 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 		error = elf_map(bprm->file, load_bias + vaddr, elf_ppnt,
 				elf_prot, elf_flags, 0);
 		if (BAD_ADDR(error)) {
+			up_write(&current->mm->mmap_sem);
 			send_sig(SIGKILL, current, 0);
 			retval = IS_ERR((void *)error) ?
 				PTR_ERR((void*)error) : -EINVAL;
@@ -838,6 +1006,7 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 		    elf_ppnt->p_memsz > TASK_SIZE ||
 		    TASK_SIZE - elf_ppnt->p_memsz < k) {
 			/* set_brk can never work. Avoid overflows. */
+			up_write(&current->mm->mmap_sem);
 			send_sig(SIGKILL, current, 0);
 			retval = -EINVAL;
 			goto out_free_dentry;
@@ -855,6 +1024,7 @@ static int load_elf_binary(struct linux_binprm *bprm, struct pt_regs *regs)
 		if (k > elf_brk)
 			elf_brk = k;
 	}
+	up_write(&current->mm->mmap_sem);
 
 	loc->elf_ex.e_entry += load_bias;
 	elf_bss += load_bias;
@@ -27,6 +27,8 @@
 #include <linux/mempool.h>
 #include <linux/workqueue.h>
 #include <linux/cgroup.h>
+#include <linux/cpu.h>
+#include <linux/percpu.h>
 #include <scsi/sg.h>		/* for struct sg_iovec */
 
 #include <trace/events/block.h>
@@ -56,6 +58,85 @@ static struct biovec_slab bvec_slabs[BIOVEC_NR_POOLS] __read_mostly = {
  */
 struct bio_set *fs_bio_set;
 
+/*
+ * Each CPU keeps a few freed fs_bio_set bios around for reuse, so the
+ * common alloc/complete/free cycle skips the mempool and slab entirely.
+ * Bios are freed on the CPU that completed them, which with completion
+ * steering is the CPU that submitted them.
+ */
+#define BIO_CACHE_MAX		64
+
+struct bio_cache {
+	struct bio		*free_list;	/* linked through bi_next */
+	unsigned int		nr;
+};
+
+static DEFINE_PER_CPU(struct bio_cache, bio_cache);
+
+static struct bio *bio_cache_get(void)
+{
+	struct bio_cache *cache;
+	unsigned long flags;
+	struct bio *bio;
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(bio_cache);
+	bio = cache->free_list;
+	if (bio) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+	}
+	local_irq_restore(flags);
+
+	return bio;
+}
+
+static bool bio_cache_put(struct bio *bio)
+{
+	mempool_t *pool = fs_bio_set->bio_pool;
+	struct bio_cache *cache;
+	unsigned long flags;
+	bool cached = false;
+
+	/* the mempool reserve comes first, it guarantees forward progress */
+	if (pool->curr_nr < pool->min_nr)
+		return false;
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(bio_cache);
+	if (cache->nr < BIO_CACHE_MAX) {
+		bio->bi_next = cache->free_list;
+		cache->free_list = bio;
+		cache->nr++;
+		cached = true;
+	}
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+static int __cpuinit bio_cache_cpu_notify(struct notifier_block *self,
+					  unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN) {
+		struct bio_cache *cache = &per_cpu(bio_cache, (long)hcpu);
+
+		while (cache->free_list) {
+			struct bio *bio = cache->free_list;
+
+			cache->free_list = bio->bi_next;
+			mempool_free(bio, fs_bio_set->bio_pool);
+		}
+		cache->nr = 0;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata bio_cache_cpu_notifier = {
+	.notifier_call	= bio_cache_cpu_notify,
+};
+
 /*
  * Our slab pool management
  */
@@ -250,6 +331,9 @@ void bio_free(struct bio *bio, struct bio_set *bs)
 	if (bs->front_pad)
 		p -= bs->front_pad;
 
+	if (bs == fs_bio_set && bio_cache_put(p))
+		return;
+
 	mempool_free(p, bs->bio_pool);
 }
 EXPORT_SYMBOL(bio_free);
@@ -282,9 +366,12 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, int nr_iovecs, struct bio_set *bs)
 	unsigned long idx = BIO_POOL_NONE;
 	struct bio_vec *bvl = NULL;
 	struct bio *bio;
-	void *p;
+	void *p = NULL;
 
-	p = mempool_alloc(bs->bio_pool, gfp_mask);
+	if (bs == fs_bio_set)
+		p = bio_cache_get();
+	if (!p)
+		p = mempool_alloc(bs->bio_pool, gfp_mask);
 	if (unlikely(!p))
 		return NULL;
 	bio = p + bs->front_pad;
@@ -1657,7 +1744,8 @@ EXPORT_SYMBOL(bioset_create);
  *
  * Associate @bio with %current if it hasn't been associated yet.  Block
  * layer will treat @bio as if it were issued by %current no matter which
- * task actually issues it.
+ * task actually issues it.  A blkcg @bio was already associated with
+ * through bio_associate_blkcg() is kept.
  *
  * This function takes an extra reference of @task's io_context and blkcg
  * which will be put when @bio is released.  The caller must own @bio,
@@ -1681,6 +1769,8 @@ int bio_associate_current(struct bio *bio)
 	bio->bi_ioc = ioc;
 
 	/* associate blkcg if exists */
+	if (bio->bi_css)
+		return 0;
 	rcu_read_lock();
 	css = task_subsys_state(current, blkio_subsys_id);
 	if (css && css_tryget(css))
@@ -1690,6 +1780,29 @@ int bio_associate_current(struct bio *bio)
 	return 0;
 }
 
+/**
+ * bio_associate_blkcg - associate a bio with a blkcg
+ * @bio: target bio
+ * @css: blkio css to associate @bio with
+ *
+ * Associate @bio with @css if it hasn't been associated with a blkcg yet,
+ * so that block layer charges it to @css rather than to the issuing task.
+ * Used for writeback, which is issued on behalf of whoever dirtied the
+ * pages.  Takes a reference of @css which is put when @bio is released.
+ * The caller must keep @css from being freed, e.g. by rcu_read_lock().
+ */
+int bio_associate_blkcg(struct bio *bio, struct cgroup_subsys_state *css)
+{
+	if (bio->bi_css)
+		return -EBUSY;
+
+	if (!css_tryget(css))
+		return -ENODEV;
+
+	bio->bi_css = css;
+	return 0;
+}
+
 /**
  * bio_disassociate_task - undo bio_associate_current()
  * @bio: target bio
@@ -1750,6 +1863,8 @@ static int __init init_bio(void)
 	if (!bio_split_pool)
 		panic("bio: can't create split pool\n");
 
+	register_hotcpu_notifier(&bio_cache_cpu_notifier);
+
 	return 0;
 }
 subsys_initcall(init_bio);
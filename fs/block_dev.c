@@ -57,17 +57,20 @@ static void bdev_inode_switch_bdi(struct inode *inode,
 			struct backing_dev_info *dst)
 {
 	struct backing_dev_info *old = inode->i_data.backing_dev_info;
+	struct bdi_writeback *old_wb, *dst_wb;
 
 	if (unlikely(dst == old))		/* deadlock avoidance */
 		return;
-	bdi_lock_two(&old->wb, &dst->wb);
+	old_wb = bdi_inode_wb(old, inode);
+	dst_wb = bdi_inode_wb(dst, inode);
+	bdi_lock_two(old_wb, dst_wb);
 	spin_lock(&inode->i_lock);
 	inode->i_data.backing_dev_info = dst;
 	if (inode->i_state & I_DIRTY)
-		list_move(&inode->i_wb_list, &dst->wb.b_dirty);
+		list_move(&inode->i_wb_list, &dst_wb->b_dirty);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&old->wb.list_lock);
-	spin_unlock(&dst->wb.list_lock);
+	spin_unlock(&old_wb->list_lock);
+	spin_unlock(&dst_wb->list_lock);
 }
 
 sector_t blkdev_max_block(struct block_device *bdev)
@@ -88,7 +91,7 @@ void kill_bdev(struct block_device *bdev)
 {
 	struct address_space *mapping = bdev->bd_inode->i_mapping;
 
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	invalidate_bh_lrus();
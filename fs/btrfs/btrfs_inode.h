@@ -55,6 +55,9 @@ struct btrfs_inode {
 	/* the extent_tree has caches of all the extent mappings to disk */
 	struct extent_map_tree extent_tree;
 
+	/* leaf the last lookup of our items ended in, see btrfs_leaf_hint */
+	struct btrfs_leaf_hint leaf_hint;
+
 	/* the io_tree does range state (DIRTY, LOCKED etc) */
 	struct extent_io_tree io_tree;
 
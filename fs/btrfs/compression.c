@@ -32,6 +32,7 @@
 #include <linux/writeback.h>
 #include <linux/bit_spinlock.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 #include "compat.h"
 #include "ctree.h"
 #include "disk-io.h"
@@ -472,7 +473,7 @@ static noinline int add_ra_bio_pages(struct inode *inode,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, pg_index);
 		rcu_read_unlock();
-		if (page) {
+		if (page && !radix_tree_exceptional_entry(page)) {
 			misses++;
 			if (misses > 4)
 				break;
@@ -730,6 +731,47 @@ static int comp_num_workspace[BTRFS_COMPRESS_TYPES];
 static atomic_t comp_alloc_workspace[BTRFS_COMPRESS_TYPES];
 static wait_queue_head_t comp_workspace_wait[BTRFS_COMPRESS_TYPES];
 
+/*
+ * Each cpu also caches one idle workspace of each type, so that
+ * compressing on a cpu that has done so before takes no shared lock.
+ * The slots are only ever accessed with xchg()/cmpxchg(): a task that
+ * migrates between taking and returning a workspace simply leaves it in
+ * another cpu's slot, and waiters steal from any slot.
+ */
+static DEFINE_PER_CPU(struct list_head *[BTRFS_COMPRESS_TYPES],
+		      comp_cpu_workspace);
+
+static struct list_head *get_cpu_workspace(int idx)
+{
+	struct list_head *workspace;
+
+	workspace = xchg(&get_cpu_var(comp_cpu_workspace)[idx], NULL);
+	put_cpu_var(comp_cpu_workspace);
+	return workspace;
+}
+
+static int put_cpu_workspace(int idx, struct list_head *workspace)
+{
+	struct list_head *old;
+
+	old = cmpxchg(&get_cpu_var(comp_cpu_workspace)[idx], NULL, workspace);
+	put_cpu_var(comp_cpu_workspace);
+	return old == NULL;
+}
+
+static struct list_head *steal_cpu_workspace(int idx)
+{
+	struct list_head *workspace;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		workspace = xchg(&per_cpu(comp_cpu_workspace, cpu)[idx], NULL);
+		if (workspace)
+			return workspace;
+	}
+	return NULL;
+}
+
 struct btrfs_compress_op *btrfs_compress_op[] = {
 	&btrfs_zlib_compress,
 	&btrfs_lzo_compress,
@@ -762,6 +804,10 @@ static struct list_head *find_workspace(int type)
 	atomic_t *alloc_workspace		= &comp_alloc_workspace[idx];
 	wait_queue_head_t *workspace_wait	= &comp_workspace_wait[idx];
 	int *num_workspace			= &comp_num_workspace[idx];
+
+	workspace = get_cpu_workspace(idx);
+	if (workspace)
+		return workspace;
 again:
 	spin_lock(workspace_lock);
 	if (!list_empty(idle_workspace)) {
@@ -777,8 +823,14 @@ again:
 
 		spin_unlock(workspace_lock);
 		prepare_to_wait(workspace_wait, &wait, TASK_UNINTERRUPTIBLE);
-		if (atomic_read(alloc_workspace) > cpus && !*num_workspace)
+		if (atomic_read(alloc_workspace) > cpus && !*num_workspace) {
+			workspace = steal_cpu_workspace(idx);
+			if (workspace) {
+				finish_wait(workspace_wait, &wait);
+				return workspace;
+			}
 			schedule();
+		}
 		finish_wait(workspace_wait, &wait);
 		goto again;
 	}
@@ -806,6 +858,9 @@ static void free_workspace(int type, struct list_head *workspace)
 	wait_queue_head_t *workspace_wait	= &comp_workspace_wait[idx];
 	int *num_workspace			= &comp_num_workspace[idx];
 
+	if (put_cpu_workspace(idx, workspace))
+		goto wake;
+
 	spin_lock(workspace_lock);
 	if (*num_workspace < num_online_cpus()) {
 		list_add_tail(workspace, idle_workspace);
@@ -832,6 +887,10 @@ static void free_workspaces(void)
 	int i;
 
 	for (i = 0; i < BTRFS_COMPRESS_TYPES; i++) {
+		while ((workspace = steal_cpu_workspace(i))) {
+			btrfs_compress_op[i]->free_workspace(workspace);
+			atomic_dec(&comp_alloc_workspace[i]);
+		}
 		while (!list_empty(&comp_idle_workspace[i])) {
 			workspace = comp_idle_workspace[i].next;
 			list_del(workspace);
@@ -2409,6 +2409,76 @@ done:
 	return ret;
 }
 
+/*
+ * try to satisfy a read-only search from the leaf in p->leaf_hint without
+ * walking down from the root.  This only works if the leaf is still cached,
+ * no keys have moved between leaves since the hint was recorded, and the
+ * key falls between the first and last key in the leaf; that leaf is then
+ * exactly where a full search would end.
+ *
+ * Returns like btrfs_search_slot with only the leaf in the path, or -EAGAIN
+ * if the caller has to do the full search.
+ */
+static int search_leaf_hint(struct btrfs_root *root, struct btrfs_key *key,
+			    struct btrfs_path *p)
+{
+	struct btrfs_leaf_hint *hint = p->leaf_hint;
+	struct extent_buffer *b;
+	struct btrfs_key first;
+	struct btrfs_key last;
+	u64 bytenr;
+	u32 nritems;
+	int seq;
+	int slot;
+	int ret;
+
+	spin_lock(&hint->lock);
+	bytenr = hint->bytenr;
+	seq = hint->seq;
+	spin_unlock(&hint->lock);
+
+	if (!bytenr || seq != atomic_read(&root->leaf_seq))
+		return -EAGAIN;
+
+	b = btrfs_find_tree_block(root, bytenr, btrfs_level_size(root, 0));
+	if (!b)
+		return -EAGAIN;
+	if (!btrfs_buffer_uptodate(b, 0, 1))
+		goto out;
+
+	btrfs_tree_read_lock(b);
+
+	/*
+	 * anybody moving keys in or out of this leaf bumps leaf_seq while
+	 * holding its lock, so if it still matches the leaf is unchanged
+	 */
+	smp_rmb();
+	if (seq != atomic_read(&root->leaf_seq) ||
+	    btrfs_header_bytenr(b) != bytenr || btrfs_header_level(b) != 0)
+		goto out_unlock;
+
+	nritems = btrfs_header_nritems(b);
+	if (!nritems)
+		goto out_unlock;
+	btrfs_item_key_to_cpu(b, &first, 0);
+	btrfs_item_key_to_cpu(b, &last, nritems - 1);
+	if (btrfs_comp_cpu_keys(key, &first) < 0 ||
+	    btrfs_comp_cpu_keys(key, &last) > 0)
+		goto out_unlock;
+
+	ret = bin_search(b, key, 0, &slot);
+	p->nodes[0] = b;
+	p->locks[0] = BTRFS_READ_LOCK;
+	p->slots[0] = slot;
+	return ret;
+
+out_unlock:
+	btrfs_tree_read_unlock(b);
+out:
+	free_extent_buffer(b);
+	return -EAGAIN;
+}
+
 /*
  * look for key in the tree.  path is filled in with nodes along the way
  * if key is found, we return zero and you can find the item in the leaf
@@ -2437,6 +2507,8 @@ int btrfs_search_slot(struct btrfs_trans_handle *trans, struct btrfs_root
 	int write_lock_level = 0;
 	u8 lowest_level = 0;
 	int min_write_lock_level;
+	int use_hint = 0;
+	int hint_seq = 0;
 
 	lowest_level = p->lowest_level;
 	WARN_ON(lowest_level && ins_len > 0);
@@ -2466,6 +2538,16 @@ int btrfs_search_slot(struct btrfs_trans_handle *trans, struct btrfs_root
 
 	min_write_lock_level = write_lock_level;
 
+	if (p->leaf_hint && !cow && !lowest_level && !p->keep_locks &&
+	    !p->skip_locking && !p->search_commit_root) {
+		ret = search_leaf_hint(root, key, p);
+		if (ret >= 0)
+			goto done;
+		hint_seq = atomic_read(&root->leaf_seq);
+		smp_rmb();
+		use_hint = 1;
+	}
+
 again:
 	/*
 	 * we try very hard to do read locks on the root
@@ -2667,6 +2749,20 @@ cow_done:
 	}
 	ret = 1;
 done:
+	/*
+	 * remember the leaf we ended in if nothing moved keys between leaves
+	 * while we were walking down to it
+	 */
+	if (use_hint && ret >= 0 && p->nodes[0] && p->locks[0]) {
+		smp_rmb();
+		if (atomic_read(&root->leaf_seq) == hint_seq) {
+			spin_lock(&p->leaf_hint->lock);
+			p->leaf_hint->bytenr = p->nodes[0]->start;
+			p->leaf_hint->seq = hint_seq;
+			spin_unlock(&p->leaf_hint->lock);
+		}
+	}
+
 	/*
 	 * we don't really know what they plan on doing with the path
 	 * from here on, so for now just mark it as blocking
@@ -3323,6 +3419,9 @@ static noinline int __push_leaf_right(struct btrfs_trans_handle *trans,
 
 	btrfs_init_map_token(&token);
 
+	/* items move from left to right, both are locked */
+	btrfs_leaf_layout_changed(root);
+
 	if (empty)
 		nr = 0;
 	else
@@ -3535,6 +3634,9 @@ static noinline int __push_leaf_left(struct btrfs_trans_handle *trans,
 
 	btrfs_init_map_token(&token);
 
+	/* items move from right to left, both are locked */
+	btrfs_leaf_layout_changed(root);
+
 	if (empty)
 		nr = min(right_nritems, max_slot);
 	else
@@ -3749,6 +3851,9 @@ static noinline void copy_for_split(struct btrfs_trans_handle *trans,
 
 	btrfs_init_map_token(&token);
 
+	/* the upper half of l moves to right */
+	btrfs_leaf_layout_changed(root);
+
 	nritems = nritems - mid;
 	btrfs_set_header_nritems(right, nritems);
 	data_copy_size = btrfs_item_end_nr(l, mid) - leaf_data_end(root, l);
@@ -561,8 +561,30 @@ struct btrfs_path {
 	unsigned int skip_locking:1;
 	unsigned int leave_spinning:1;
 	unsigned int search_commit_root:1;
+
+	/* read-only searches may start from this leaf, see below */
+	struct btrfs_leaf_hint *leaf_hint;
 };
 
+/*
+ * Remembers the leaf a read-only search for an inode's items last ended in,
+ * so the next search for a key inside that leaf can skip the walk from the
+ * root.  The hint is only trusted while root->leaf_seq is unchanged: every
+ * operation that changes which leaf holds a key bumps it.
+ */
+struct btrfs_leaf_hint {
+	spinlock_t lock;
+	u64 bytenr;
+	int seq;
+};
+
+static inline void btrfs_init_leaf_hint(struct btrfs_leaf_hint *hint)
+{
+	spin_lock_init(&hint->lock);
+	hint->bytenr = 0;
+	hint->seq = 0;
+}
+
 /*
  * items in the extent btree are used to record the objectid of the
  * owner of the block and the number of references
@@ -1262,6 +1284,7 @@ struct btrfs_fs_info {
 	atomic_t nr_async_bios;
 	atomic_t async_delalloc_pages;
 	atomic_t open_ioctl_trans;
+	atomic_t async_delayed_refs;	/* a delayed ref worker is queued */
 
 	/*
 	 * this is used by the balancing code to wait for all the pending
@@ -1319,6 +1342,7 @@ struct btrfs_fs_info {
 	 */
 	struct btrfs_workers fixup_workers;
 	struct btrfs_workers delayed_workers;
+	struct btrfs_workers delayed_ref_workers;
 	struct task_struct *transaction_kthread;
 	struct task_struct *cleaner_kthread;
 	int thread_pool_size;
@@ -1481,6 +1505,8 @@ struct btrfs_root {
 	wait_queue_head_t log_commit_wait[2];
 	atomic_t log_writers;
 	atomic_t log_commit[2];
+	/* bumped whenever keys move between leaves, see btrfs_leaf_hint */
+	atomic_t leaf_seq;
 	unsigned long log_transid;
 	unsigned long last_log_commit;
 	unsigned long log_batch;
@@ -1553,6 +1579,17 @@ struct btrfs_root {
 	spinlock_t root_times_lock;
 };
 
+/*
+ * Must be called with the affected leaves locked, or after the tree pointers
+ * have been switched when the leaves are not locked, so that a search which
+ * saw the old layout can't record a hint with the new sequence.
+ */
+static inline void btrfs_leaf_layout_changed(struct btrfs_root *root)
+{
+	smp_mb__before_atomic_inc();
+	atomic_inc(&root->leaf_seq);
+}
+
 struct btrfs_ioctl_defrag_range_args {
 	/* start of the defrag operation */
 	__u64 start;
@@ -1726,6 +1763,7 @@ struct btrfs_ioctl_defrag_range_args {
 #define BTRFS_MOUNT_CHECK_INTEGRITY	(1 << 20)
 #define BTRFS_MOUNT_CHECK_INTEGRITY_INCLUDING_EXTENT_DATA (1 << 21)
 #define BTRFS_MOUNT_PANIC_ON_FATAL_ERROR	(1 << 22)
+#define BTRFS_MOUNT_READ_QDEPTH		(1 << 23)
 
 #define btrfs_clear_opt(o, opt)		((o) &= ~BTRFS_MOUNT_##opt)
 #define btrfs_set_opt(o, opt)		((o) |= BTRFS_MOUNT_##opt)
@@ -2777,6 +2815,8 @@ static inline u64 btrfs_calc_trunc_metadata_size(struct btrfs_root *root,
 void btrfs_put_block_group(struct btrfs_block_group_cache *cache);
 int btrfs_run_delayed_refs(struct btrfs_trans_handle *trans,
 			   struct btrfs_root *root, unsigned long count);
+void btrfs_balance_delayed_refs(struct btrfs_trans_handle *trans,
+				struct btrfs_root *root, unsigned long updates);
 int btrfs_lookup_extent(struct btrfs_root *root, u64 start, u64 len);
 int btrfs_lookup_extent_info(struct btrfs_trans_handle *trans,
 			     struct btrfs_root *root, u64 bytenr,
@@ -3303,6 +3343,9 @@ extern const struct dentry_operations btrfs_dentry_operations;
 
 /* ioctl.c */
 long btrfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+ssize_t btrfs_copy_file_range(struct file *file_in, loff_t pos_in,
+			      struct file *file_out, loff_t pos_out,
+			      size_t len, unsigned int flags);
 void btrfs_update_iflags(struct inode *inode);
 void btrfs_inherit_iflags(struct inode *inode, struct inode *dir);
 int btrfs_defrag_file(struct inode *inode, struct file *file,
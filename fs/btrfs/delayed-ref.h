@@ -139,8 +139,28 @@ struct btrfs_delayed_ref_root {
 	int flushing;
 
 	u64 run_delayed_start;
+
+	/*
+	 * backlog accounting for this transaction: heads run by the
+	 * background worker, and end_transaction calls that had to run
+	 * refs themselves because the backlog was too big
+	 */
+	atomic_t num_heads_run_async;
+	atomic_t num_throttled;
 };
 
+/*
+ * once this many heads are ready to run, ending a transaction handle kicks
+ * the background delayed ref worker
+ */
+#define BTRFS_DELAYED_REFS_BACKGROUND	64
+
+/*
+ * past this many ready heads the producers run refs themselves in
+ * btrfs_end_transaction(), which bounds the backlog left for the commit
+ */
+#define BTRFS_DELAYED_REFS_THROTTLE	1024
+
 static inline void btrfs_put_delayed_ref(struct btrfs_delayed_ref_node *ref)
 {
 	WARN_ON(atomic_read(&ref->refs) == 0);
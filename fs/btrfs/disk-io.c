@@ -1168,6 +1168,7 @@ static void __setup_root(u32 nodesize, u32 leafsize, u32 sectorsize,
 	atomic_set(&root->log_commit[0], 0);
 	atomic_set(&root->log_commit[1], 0);
 	atomic_set(&root->log_writers, 0);
+	atomic_set(&root->leaf_seq, 0);
 	atomic_set(&root->orphan_inodes, 0);
 	root->log_batch = 0;
 	root->log_transid = 0;
@@ -2022,6 +2023,7 @@ int open_ctree(struct super_block *sb,
 	btrfs_init_block_rsv(&fs_info->delayed_block_rsv);
 	atomic_set(&fs_info->nr_async_submits, 0);
 	atomic_set(&fs_info->async_delalloc_pages, 0);
+	atomic_set(&fs_info->async_delayed_refs, 0);
 	atomic_set(&fs_info->async_submit_draining, 0);
 	atomic_set(&fs_info->nr_async_bios, 0);
 	atomic_set(&fs_info->defrag_running, 0);
@@ -2308,6 +2310,8 @@ int open_ctree(struct super_block *sb,
 	btrfs_init_workers(&fs_info->delayed_workers, "delayed-meta",
 			   fs_info->thread_pool_size,
 			   &fs_info->generic_worker);
+	btrfs_init_workers(&fs_info->delayed_ref_workers, "delayed-refs",
+			   1, &fs_info->generic_worker);
 	btrfs_init_workers(&fs_info->readahead_workers, "readahead",
 			   fs_info->thread_pool_size,
 			   &fs_info->generic_worker);
@@ -2338,6 +2342,7 @@ int open_ctree(struct super_block *sb,
 	ret |= btrfs_start_workers(&fs_info->endio_write_workers);
 	ret |= btrfs_start_workers(&fs_info->endio_freespace_worker);
 	ret |= btrfs_start_workers(&fs_info->delayed_workers);
+	ret |= btrfs_start_workers(&fs_info->delayed_ref_workers);
 	ret |= btrfs_start_workers(&fs_info->caching_workers);
 	ret |= btrfs_start_workers(&fs_info->readahead_workers);
 	if (ret) {
@@ -2654,6 +2659,7 @@ fail_sb_buffer:
 	btrfs_stop_workers(&fs_info->endio_freespace_worker);
 	btrfs_stop_workers(&fs_info->submit_workers);
 	btrfs_stop_workers(&fs_info->delayed_workers);
+	btrfs_stop_workers(&fs_info->delayed_ref_workers);
 	btrfs_stop_workers(&fs_info->caching_workers);
 fail_alloc:
 fail_iput:
@@ -3185,6 +3191,10 @@ int close_ctree(struct btrfs_root *root)
 	wait_event(fs_info->transaction_wait,
 		   (atomic_read(&fs_info->defrag_running) == 0));
 
+	/* and for the delayed ref worker, it can't be queued any more */
+	wait_event(fs_info->transaction_wait,
+		   (atomic_read(&fs_info->async_delayed_refs) == 0));
+
 	/* clear out the rbtree of defraggable inodes */
 	btrfs_run_defrag_inodes(fs_info);
 
@@ -3248,6 +3258,7 @@ int close_ctree(struct btrfs_root *root)
 	btrfs_stop_workers(&fs_info->endio_freespace_worker);
 	btrfs_stop_workers(&fs_info->submit_workers);
 	btrfs_stop_workers(&fs_info->delayed_workers);
+	btrfs_stop_workers(&fs_info->delayed_ref_workers);
 	btrfs_stop_workers(&fs_info->caching_workers);
 	btrfs_stop_workers(&fs_info->readahead_workers);
 
@@ -3636,9 +3647,13 @@ static int btrfs_destroy_marked_extents(struct btrfs_root *root,
 			if (PageDirty(page)) {
 				clear_page_dirty_for_io(page);
 				spin_lock_irq(&page->mapping->tree_lock);
+				spin_lock(mapping_tag_lock(page->mapping,
+							   page_index(page)));
 				radix_tree_tag_clear(&page->mapping->page_tree,
 							page_index(page),
 							PAGECACHE_TAG_DIRTY);
+				spin_unlock(mapping_tag_lock(page->mapping,
+							     page_index(page)));
 				spin_unlock_irq(&page->mapping->tree_lock);
 			}
 
@@ -2589,6 +2589,127 @@ out:
 	return 0;
 }
 
+struct async_delayed_refs {
+	struct btrfs_root *root;
+	u64 transid;
+	struct btrfs_work work;
+};
+
+static void delayed_ref_async_start(struct btrfs_work *work)
+{
+	struct async_delayed_refs *async;
+	struct btrfs_fs_info *fs_info;
+	struct btrfs_transaction *cur_trans;
+	struct btrfs_trans_handle *trans;
+	struct btrfs_delayed_ref_root *delayed_refs;
+	unsigned long count;
+	int ret;
+
+	async = container_of(work, struct async_delayed_refs, work);
+	fs_info = async->root->fs_info;
+
+	/*
+	 * don't bother if the transaction we were queued for has started
+	 * committing or is gone, the commit runs whatever is left.  This
+	 * also keeps us from starting a new transaction just to find it
+	 * empty.
+	 */
+	spin_lock(&fs_info->trans_lock);
+	cur_trans = fs_info->running_transaction;
+	if (!cur_trans || cur_trans->transid != async->transid ||
+	    cur_trans->blocked || cur_trans->delayed_refs.flushing) {
+		spin_unlock(&fs_info->trans_lock);
+		goto done;
+	}
+	spin_unlock(&fs_info->trans_lock);
+
+	trans = btrfs_join_transaction(async->root);
+	if (IS_ERR(trans))
+		goto done;
+	if (trans->transid != async->transid)
+		goto end;
+
+	/* run enough heads to get back under the background threshold */
+	delayed_refs = &trans->transaction->delayed_refs;
+	count = delayed_refs->num_heads_ready;
+	if (count > BTRFS_DELAYED_REFS_BACKGROUND / 2)
+		count -= BTRFS_DELAYED_REFS_BACKGROUND / 2;
+	ret = btrfs_run_delayed_refs(trans, async->root, count);
+	if (!ret)
+		atomic_add(count, &delayed_refs->num_heads_run_async);
+end:
+	trans->delayed_ref_updates = 0;
+	btrfs_end_transaction(trans, async->root);
+done:
+	kfree(async);
+	atomic_set(&fs_info->async_delayed_refs, 0);
+	smp_mb();
+	if (waitqueue_active(&fs_info->transaction_wait))
+		wake_up(&fs_info->transaction_wait);
+}
+
+/*
+ * queue the background delayed ref worker for the given transaction unless
+ * it is already queued.  Only one runs at a time, the refs are processed
+ * head by head under the delayed ref lock so more workers would just
+ * contend with each other.
+ */
+static void btrfs_async_run_delayed_refs(struct btrfs_root *root, u64 transid)
+{
+	struct btrfs_fs_info *fs_info = root->fs_info;
+	struct async_delayed_refs *async;
+
+	if (atomic_read(&fs_info->async_delayed_refs) ||
+	    atomic_cmpxchg(&fs_info->async_delayed_refs, 0, 1))
+		return;
+
+	/* pairs with the barrier after close_ctree() sets ->closing */
+	async = NULL;
+	if (!fs_info->closing)
+		async = kmalloc(sizeof(*async), GFP_NOFS);
+	if (!async) {
+		atomic_set(&fs_info->async_delayed_refs, 0);
+		smp_mb();
+		if (waitqueue_active(&fs_info->transaction_wait))
+			wake_up(&fs_info->transaction_wait);
+		return;
+	}
+
+	async->root = fs_info->extent_root;
+	async->transid = transid;
+	async->work.func = delayed_ref_async_start;
+	async->work.flags = 0;
+
+	btrfs_queue_worker(&fs_info->delayed_ref_workers, &async->work);
+}
+
+/*
+ * called when a transaction handle that queued @updates delayed refs is
+ * ended.  Rather than letting the refs pile up until the transaction commit
+ * runs them all at once, hand them to the background worker once enough
+ * heads are ready.  If the worker can't keep up and the backlog grows past
+ * BTRFS_DELAYED_REFS_THROTTLE, the producer is throttled by running its
+ * share of refs before it gets to go on.
+ */
+void btrfs_balance_delayed_refs(struct btrfs_trans_handle *trans,
+				struct btrfs_root *root, unsigned long updates)
+{
+	struct btrfs_delayed_ref_root *delayed_refs;
+	unsigned long ready;
+
+	delayed_refs = &trans->transaction->delayed_refs;
+	ready = delayed_refs->num_heads_ready;
+	if (ready < BTRFS_DELAYED_REFS_BACKGROUND)
+		return;
+
+	btrfs_async_run_delayed_refs(root, trans->transid);
+
+	if (ready >= BTRFS_DELAYED_REFS_THROTTLE && !delayed_refs->flushing) {
+		atomic_inc(&delayed_refs->num_throttled);
+		btrfs_run_delayed_refs(trans, root, updates * 2);
+	}
+}
+
 int btrfs_set_disk_extent_flags(struct btrfs_trans_handle *trans,
 				struct btrfs_root *root,
 				u64 bytenr, u64 num_bytes, u64 flags,
@@ -5322,6 +5443,9 @@ void btrfs_free_tree_block(struct btrfs_trans_handle *trans,
 	struct btrfs_block_group_cache *cache = NULL;
 	int ret;
 
+	/* the block is leaving the tree, don't let searches start from it */
+	btrfs_leaf_layout_changed(root);
+
 	if (root->root_key.objectid != BTRFS_TREE_LOG_OBJECTID) {
 		ret = btrfs_add_delayed_tree_ref(root->fs_info, trans,
 					buf->start, buf->len,
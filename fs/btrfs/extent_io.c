@@ -4397,9 +4397,15 @@ void clear_extent_buffer_dirty(struct extent_buffer *eb)
 		clear_page_dirty_for_io(page);
 		spin_lock_irq(&page->mapping->tree_lock);
 		if (!PageDirty(page)) {
+			spinlock_t *tag_lock;
+
+			tag_lock = mapping_tag_lock(page->mapping,
+						    page_index(page));
+			spin_lock(tag_lock);
 			radix_tree_tag_clear(&page->mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
+			spin_unlock(tag_lock);
 		}
 		spin_unlock_irq(&page->mapping->tree_lock);
 		ClearPageError(page);
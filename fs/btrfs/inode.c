@@ -5227,6 +5227,7 @@ again:
 		 * readahead
 		 */
 		path->reada = 1;
+		path->leaf_hint = &BTRFS_I(inode)->leaf_hint;
 	}
 
 	ret = btrfs_lookup_file_extent(trans, root, path,
@@ -6974,6 +6975,7 @@ struct inode *btrfs_alloc_inode(struct super_block *sb)
 	ei->force_compress = BTRFS_COMPRESS_NONE;
 
 	ei->delayed_node = NULL;
+	btrfs_init_leaf_hint(&ei->leaf_hint);
 
 	inode = &ei->vfs_inode;
 	extent_map_tree_init(&ei->extent_tree);
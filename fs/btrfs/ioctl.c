@@ -2336,12 +2336,11 @@ out:
 	return ret;
 }
 
-static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
+static noinline long btrfs_clone_files(struct file *file, struct file *src_file,
 				       u64 off, u64 olen, u64 destoff)
 {
 	struct inode *inode = fdentry(file)->d_inode;
 	struct btrfs_root *root = BTRFS_I(inode)->root;
-	struct file *src_file;
 	struct inode *src;
 	struct btrfs_trans_handle *trans;
 	struct btrfs_path *path;
@@ -2376,48 +2375,42 @@ static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
 	if (ret)
 		return ret;
 
-	src_file = fget(srcfd);
-	if (!src_file) {
-		ret = -EBADF;
-		goto out_drop_write;
-	}
-
 	ret = -EXDEV;
 	if (src_file->f_path.mnt != file->f_path.mnt)
-		goto out_fput;
+		goto out_drop_write;
 
 	src = src_file->f_dentry->d_inode;
 
 	ret = -EINVAL;
 	if (src == inode)
-		goto out_fput;
+		goto out_drop_write;
 
 	/* the src must be open for reading */
 	if (!(src_file->f_mode & FMODE_READ))
-		goto out_fput;
+		goto out_drop_write;
 
 	/* don't make the dst file partly checksummed */
 	if ((BTRFS_I(src)->flags & BTRFS_INODE_NODATASUM) !=
 	    (BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM))
-		goto out_fput;
+		goto out_drop_write;
 
 	ret = -EISDIR;
 	if (S_ISDIR(src->i_mode) || S_ISDIR(inode->i_mode))
-		goto out_fput;
+		goto out_drop_write;
 
 	ret = -EXDEV;
 	if (src->i_sb != inode->i_sb)
-		goto out_fput;
+		goto out_drop_write;
 
 	ret = -ENOMEM;
 	buf = vmalloc(btrfs_level_size(root, 0));
 	if (!buf)
-		goto out_fput;
+		goto out_drop_write;
 
 	path = btrfs_alloc_path();
 	if (!path) {
 		vfree(buf);
-		goto out_fput;
+		goto out_drop_write;
 	}
 	path->reada = 2;
 
@@ -2723,13 +2716,59 @@ out_unlock:
 	mutex_unlock(&inode->i_mutex);
 	vfree(buf);
 	btrfs_free_path(path);
-out_fput:
-	fput(src_file);
 out_drop_write:
 	mnt_drop_write_file(file);
 	return ret;
 }
 
+static noinline long btrfs_ioctl_clone(struct file *file, unsigned long srcfd,
+				       u64 off, u64 olen, u64 destoff)
+{
+	struct file *src_file;
+	long ret;
+
+	src_file = fget(srcfd);
+	if (!src_file)
+		return -EBADF;
+	ret = btrfs_clone_files(file, src_file, off, olen, destoff);
+	fput(src_file);
+	return ret;
+}
+
+/*
+ * ->copy_file_range(): clone the range when it can be, and leave
+ * everything else to the generic page cache copy.
+ */
+ssize_t btrfs_copy_file_range(struct file *file_in, loff_t pos_in,
+			      struct file *file_out, loff_t pos_out,
+			      size_t len, unsigned int flags)
+{
+	struct inode *src = fdentry(file_in)->d_inode;
+	struct inode *dst = fdentry(file_out)->d_inode;
+	u64 bs = BTRFS_I(src)->root->fs_info->sb->s_blocksize;
+	loff_t isize = i_size_read(src);
+	long ret;
+
+	if (pos_in >= isize)
+		return 0;
+	if (len > isize - pos_in)
+		len = isize - pos_in;
+
+	/*
+	 * clones work on whole blocks, except for the tail at eof, and only
+	 * between files btrfs_clone_files() would accept
+	 */
+	if (src == dst || file_in->f_path.mnt != file_out->f_path.mnt ||
+	    (BTRFS_I(src)->flags & BTRFS_INODE_NODATASUM) !=
+	    (BTRFS_I(dst)->flags & BTRFS_INODE_NODATASUM) ||
+	    !IS_ALIGNED(pos_in, bs) || !IS_ALIGNED(pos_out, bs) ||
+	    (!IS_ALIGNED(len, bs) && pos_in + len != isize))
+		return -EOPNOTSUPP;
+
+	ret = btrfs_clone_files(file_out, file_in, pos_in, len, pos_out);
+	return ret < 0 ? ret : len;
+}
+
 static long btrfs_ioctl_clone_range(struct file *file, void __user *argp)
 {
 	struct btrfs_ioctl_clone_range_args args;
@@ -1805,6 +1805,9 @@ again:
 					      path->slots[level], old_ptr_gen);
 		btrfs_mark_buffer_dirty(path->nodes[level]);
 
+		/* the subtree below parent was swapped without locking it */
+		btrfs_leaf_layout_changed(dest);
+
 		ret = btrfs_inc_extent_ref(trans, src, old_bytenr, blocksize,
 					path->nodes[level]->start,
 					src->root_key.objectid, level - 1, 0,
@@ -2585,6 +2588,7 @@ static int do_relocation(struct btrfs_trans_handle *trans,
 			btrfs_set_node_ptr_generation(upper->eb, slot,
 						      trans->transid);
 			btrfs_mark_buffer_dirty(upper->eb);
+			btrfs_leaf_layout_changed(root);
 
 			ret = btrfs_inc_extent_ref(trans, root,
 						node->eb->start, blocksize,
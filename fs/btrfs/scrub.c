@@ -44,8 +44,8 @@
 struct scrub_block;
 struct scrub_dev;
 
-#define SCRUB_PAGES_PER_BIO	16	/* 64k per bio */
-#define SCRUB_BIOS_PER_DEV	16	/* 1 MB per device in flight */
+#define SCRUB_PAGES_PER_BIO	32	/* 128k per bio */
+#define SCRUB_BIOS_PER_DEV	64	/* 8 MB per device in flight */
 #define SCRUB_MAX_PAGES_PER_BLOCK	16	/* 64k per node/leaf/sector */
 
 struct scrub_page {
@@ -1644,6 +1644,8 @@ static void scrub_bio_end_io_worker(struct btrfs_work *work)
 {
 	struct scrub_bio *sbio = container_of(work, struct scrub_bio, work);
 	struct scrub_dev *sdev = sbio->sdev;
+	struct scrub_page *pagev[SCRUB_PAGES_PER_BIO];
+	int page_count = sbio->page_count;
 	int i;
 
 	BUG_ON(sbio->page_count > SCRUB_PAGES_PER_BIO);
@@ -1656,15 +1658,13 @@ static void scrub_bio_end_io_worker(struct btrfs_work *work)
 		}
 	}
 
-	/* now complete the scrub_block items that have all pages completed */
-	for (i = 0; i < sbio->page_count; i++) {
-		struct scrub_page *spage = sbio->pagev[i];
-		struct scrub_block *sblock = spage->sblock;
-
-		if (atomic_dec_and_test(&sblock->outstanding_pages))
-			scrub_block_complete(sblock);
-		scrub_block_put(sblock);
-	}
+	/*
+	 * The pages hold references to their blocks, the bio isn't needed
+	 * for checksumming.  Give it back before verifying so the next read
+	 * can be submitted while we are busy here; in_flight still covers
+	 * us until the blocks are done.
+	 */
+	memcpy(pagev, sbio->pagev, page_count * sizeof(pagev[0]));
 
 	if (sbio->err) {
 		/* what is this good for??? */
@@ -1687,6 +1687,17 @@ static void scrub_bio_end_io_worker(struct btrfs_work *work)
 	sbio->next_free = sdev->first_free;
 	sdev->first_free = sbio->index;
 	spin_unlock(&sdev->list_lock);
+	wake_up(&sdev->list_wait);
+
+	/* now complete the scrub_block items that have all pages completed */
+	for (i = 0; i < page_count; i++) {
+		struct scrub_block *sblock = pagev[i]->sblock;
+
+		if (atomic_dec_and_test(&sblock->outstanding_pages))
+			scrub_block_complete(sblock);
+		scrub_block_put(sblock);
+	}
+
 	atomic_dec(&sdev->in_flight);
 	wake_up(&sdev->list_wait);
 }
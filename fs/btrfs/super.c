@@ -305,7 +305,7 @@ enum {
 	Opt_enospc_debug, Opt_subvolrootid, Opt_defrag, Opt_inode_cache,
 	Opt_no_space_cache, Opt_recovery, Opt_skip_balance,
 	Opt_check_integrity, Opt_check_integrity_including_extent_data,
-	Opt_check_integrity_print_mask, Opt_fatal_errors,
+	Opt_check_integrity_print_mask, Opt_fatal_errors, Opt_read_policy,
 	Opt_err,
 };
 
@@ -346,6 +346,7 @@ static match_table_t tokens = {
 	{Opt_check_integrity_including_extent_data, "check_int_data"},
 	{Opt_check_integrity_print_mask, "check_int_print_mask=%d"},
 	{Opt_fatal_errors, "fatal_errors=%s"},
+	{Opt_read_policy, "read_policy=%s"},
 	{Opt_err, NULL},
 };
 
@@ -596,6 +597,19 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 				goto out;
 			}
 			break;
+		case Opt_read_policy:
+			if (strcmp(args[0].from, "qdepth") == 0) {
+				if (!btrfs_test_opt(root, READ_QDEPTH))
+					printk(KERN_INFO "btrfs: balancing "
+					       "mirror reads by queue depth\n");
+				btrfs_set_opt(info->mount_opt, READ_QDEPTH);
+			} else if (strcmp(args[0].from, "pid") == 0) {
+				btrfs_clear_opt(info->mount_opt, READ_QDEPTH);
+			} else {
+				ret = -EINVAL;
+				goto out;
+			}
+			break;
 		case Opt_err:
 			printk(KERN_INFO "btrfs: unrecognized mount option "
 			       "'%s'\n", p);
@@ -926,6 +940,8 @@ static int btrfs_show_options(struct seq_file *seq, struct dentry *dentry)
 		seq_puts(seq, ",skip_balance");
 	if (btrfs_test_opt(root, PANIC_ON_FATAL_ERROR))
 		seq_puts(seq, ",fatal_errors=panic");
+	if (btrfs_test_opt(root, READ_QDEPTH))
+		seq_puts(seq, ",read_policy=qdepth");
 	return 0;
 }
 
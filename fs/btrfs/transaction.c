@@ -126,6 +126,8 @@ loop:
 	cur_trans->delayed_refs.num_heads = 0;
 	cur_trans->delayed_refs.flushing = 0;
 	cur_trans->delayed_refs.run_delayed_start = 0;
+	atomic_set(&cur_trans->delayed_refs.num_heads_run_async, 0);
+	atomic_set(&cur_trans->delayed_refs.num_throttled, 0);
 
 	/*
 	 * although the tree mod log is per file system and not per transaction,
@@ -510,7 +512,6 @@ static int __btrfs_end_transaction(struct btrfs_trans_handle *trans,
 {
 	struct btrfs_transaction *cur_trans = trans->transaction;
 	struct btrfs_fs_info *info = root->fs_info;
-	int count = 0;
 	int err = 0;
 
 	if (--trans->use_count) {
@@ -536,17 +537,11 @@ static int __btrfs_end_transaction(struct btrfs_trans_handle *trans,
 		trans->qgroup_reserved = 0;
 	}
 
-	while (count < 2) {
+	if (trans->delayed_ref_updates) {
 		unsigned long cur = trans->delayed_ref_updates;
+
 		trans->delayed_ref_updates = 0;
-		if (cur &&
-		    trans->transaction->delayed_refs.num_heads_ready > 64) {
-			trans->delayed_ref_updates = 0;
-			btrfs_run_delayed_refs(trans, root, cur);
-		} else {
-			break;
-		}
-		count++;
+		btrfs_balance_delayed_refs(trans, root, cur);
 	}
 	btrfs_trans_release_metadata(trans, root);
 	trans->block_rsv = NULL;
@@ -1330,6 +1325,8 @@ int btrfs_commit_transaction(struct btrfs_trans_handle *trans,
 	if (cur_trans->aborted)
 		goto cleanup_transaction;
 
+	trace_btrfs_delayed_ref_backlog(root, &cur_trans->delayed_refs);
+
 	/* make a pass through all the delayed refs we have so far
 	 * any runnings procs may add more while we are here
 	 */
@@ -3734,6 +3734,47 @@ static int find_live_mirror(struct map_lookup *map, int first, int num,
 	return optimal;
 }
 
+/*
+ * a mirror that just finished reading the blocks right before this one gets
+ * this much of a head start, so sequential readers stay on one disk unless
+ * it is clearly busier than the others
+ */
+#define BTRFS_READ_SEQ_BONUS	8
+
+/*
+ * pick the mirror with the fewest reads in flight.  dev_offset is the offset
+ * of the block from the start of the stripe on each device.
+ */
+static int find_least_busy_mirror(struct map_lookup *map, int first, int num,
+				  u64 dev_offset, int optimal)
+{
+	struct btrfs_device *dev;
+	int best = -1;
+	int best_load = INT_MAX;
+	int load;
+	int i;
+
+	for (i = first; i < first + num; i++) {
+		dev = map->stripes[i].dev;
+		if (!dev->bdev)
+			continue;
+
+		load = atomic_read(&dev->reads_in_flight);
+		if (ACCESS_ONCE(dev->last_read_end) ==
+		    map->stripes[i].physical + dev_offset)
+			load -= BTRFS_READ_SEQ_BONUS;
+
+		/* on a tie, spread readers the same way the pid policy does */
+		if (load < best_load || (load == best_load && i == optimal)) {
+			best = i;
+			best_load = load;
+		}
+	}
+	if (best < 0)
+		return optimal;
+	return best;
+}
+
 static int __btrfs_map_block(struct btrfs_mapping_tree *map_tree, int rw,
 			     u64 logical, u64 *length,
 			     struct btrfs_bio **bbio_ret,
@@ -3754,6 +3795,10 @@ static int __btrfs_map_block(struct btrfs_mapping_tree *map_tree, int rw,
 	int num_stripes;
 	int max_errors = 0;
 	struct btrfs_bio *bbio = NULL;
+	struct btrfs_fs_info *fs_info = container_of(map_tree,
+						     struct btrfs_fs_info,
+						     mapping_tree);
+	int read_qdepth = fs_info->mount_opt & BTRFS_MOUNT_READ_QDEPTH;
 
 	read_lock(&em_tree->lock);
 	em = lookup_extent_mapping(em_tree, logical, *length);
@@ -3817,7 +3862,12 @@ static int __btrfs_map_block(struct btrfs_mapping_tree *map_tree, int rw,
 			num_stripes = map->num_stripes;
 		else if (mirror_num)
 			stripe_index = mirror_num - 1;
-		else {
+		else if (read_qdepth) {
+			stripe_index = find_least_busy_mirror(map, 0,
+					    map->num_stripes, offset,
+					    current->pid % map->num_stripes);
+			mirror_num = stripe_index + 1;
+		} else {
 			stripe_index = find_live_mirror(map, 0,
 					    map->num_stripes,
 					    current->pid % map->num_stripes);
@@ -3847,7 +3897,15 @@ static int __btrfs_map_block(struct btrfs_mapping_tree *map_tree, int rw,
 					    map->num_stripes);
 		else if (mirror_num)
 			stripe_index += mirror_num - 1;
-		else {
+		else if (read_qdepth) {
+			int old_stripe_index = stripe_index;
+			stripe_index = find_least_busy_mirror(map, stripe_index,
+					      map->sub_stripes,
+					      stripe_nr * map->stripe_len +
+					      stripe_offset, stripe_index +
+					      current->pid % map->sub_stripes);
+			mirror_num = stripe_index - old_stripe_index + 1;
+		} else {
 			int old_stripe_index = stripe_index;
 			stripe_index = find_live_mirror(map, stripe_index,
 					      map->sub_stripes, stripe_index +
@@ -4072,6 +4130,15 @@ static void btrfs_end_bio(struct bio *bio, int err)
 	struct btrfs_bio *bbio = extract_bbio_from_bio_private(bio->bi_private);
 	int is_orig_bio = 0;
 
+	if (!(bbio->rw & REQ_WRITE)) {
+		struct btrfs_device *dev;
+
+		dev = bbio->stripes[extract_stripe_index_from_bio_private(
+				bio->bi_private)].dev;
+		if (dev)
+			atomic_dec(&dev->reads_in_flight);
+	}
+
 	if (err) {
 		atomic_inc(&bbio->error);
 		if (err == -EIO || err == -EREMOTEIO) {
@@ -4227,6 +4294,7 @@ int btrfs_map_bio(struct btrfs_root *root, int rw, struct bio *bio,
 	bbio->orig_bio = first_bio;
 	bbio->private = first_bio->bi_private;
 	bbio->end_io = first_bio->bi_end_io;
+	bbio->rw = rw;
 	atomic_set(&bbio->stripes_pending, bbio->num_stripes);
 
 	while (dev_nr < total_devs) {
@@ -4242,6 +4310,11 @@ int btrfs_map_bio(struct btrfs_root *root, int rw, struct bio *bio,
 		bio->bi_end_io = btrfs_end_bio;
 		bio->bi_sector = bbio->stripes[dev_nr].physical >> 9;
 		dev = bbio->stripes[dev_nr].dev;
+		if (dev && !(rw & REQ_WRITE)) {
+			atomic_inc(&dev->reads_in_flight);
+			dev->last_read_end = bbio->stripes[dev_nr].physical +
+					     length;
+		}
 		if (dev && dev->bdev && (rw != WRITE || dev->writeable)) {
 #ifdef DEBUG
 			struct rcu_string *name;
@@ -102,6 +102,13 @@ struct btrfs_device {
 	struct radix_tree_root reada_zones;
 	struct radix_tree_root reada_extents;
 
+	/*
+	 * read balancing state, see find_least_busy_mirror().  last_read_end
+	 * is only a hint and is updated without locking.
+	 */
+	atomic_t reads_in_flight;
+	u64 last_read_end;
+
 	/* for sending down flush barriers */
 	struct bio *flush_bio;
 	struct completion flush_wait;
@@ -169,6 +176,7 @@ struct btrfs_bio {
 	int max_errors;
 	int num_stripes;
 	int mirror_num;
+	int rw;
 	struct btrfs_bio_stripe stripes[];
 };
 
@@ -42,6 +42,7 @@ ssize_t __btrfs_getxattr(struct inode *inode, const char *name,
 	path = btrfs_alloc_path();
 	if (!path)
 		return -ENOMEM;
+	path->leaf_hint = &BTRFS_I(inode)->leaf_hint;
 
 	/* lookup the xattr by name */
 	di = btrfs_lookup_xattr(NULL, root, path, btrfs_ino(inode), name,
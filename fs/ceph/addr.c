@@ -112,8 +112,10 @@ static int ceph_set_page_dirty(struct page *page)
 	if (page->mapping) {	/* Race with truncate? */
 		WARN_ON_ONCE(!PageUptodate(page));
 		account_page_dirtied(page, page->mapping);
+		spin_lock(mapping_tag_lock(mapping, page_index(page)));
 		radix_tree_tag_set(&mapping->page_tree,
 				page_index(page), PAGECACHE_TAG_DIRTY);
+		spin_unlock(mapping_tag_lock(mapping, page_index(page)));
 
 		/*
 		 * Reference snap context in page->private.  Also set
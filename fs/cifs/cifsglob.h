@@ -64,6 +64,11 @@
  */
 #define CIFS_MAX_REQ 32767
 
+/*
+ * Maximum number of requests we chain together in one compounded frame.
+ */
+#define MAX_COMPOUND 3
+
 #define RFC1001_NAME_LEN 15
 #define RFC1001_NAME_LEN_WITH_NULL (RFC1001_NAME_LEN + 1)
 
@@ -204,6 +209,8 @@ struct smb_version_operations {
 	void (*print_stats)(struct seq_file *m, struct cifs_tcon *);
 	/* verify the message */
 	int (*check_message)(char *, unsigned int);
+	/* offset of the next response chained in the same frame, or 0 */
+	unsigned int (*next_header)(char *);
 	bool (*is_oplock_break)(char *, struct TCP_Server_Info *);
 	/* process transaction2 response */
 	bool (*check_trans2)(struct mid_q_entry *, struct TCP_Server_Info *,
@@ -443,6 +450,7 @@ struct TCP_Server_Info {
 	char	*smallbuf;	/* pointer to current "small" buffer */
 	char	*bigbuf;	/* pointer to current "big" buffer */
 	unsigned int total_read; /* total amount of data read in this pass */
+	char	*chained_buf;	/* next response chained in the same frame */
 #ifdef CONFIG_CIFS_FSCACHE
 	struct fscache_cookie   *fscache; /* client index cache cookie */
 #endif
@@ -85,6 +85,10 @@ extern int cifs_check_receive(struct mid_q_entry *mid,
 extern int SendReceive2(const unsigned int /* xid */ , struct cifs_ses *,
 			struct kvec *, int /* nvec to send */,
 			int * /* type of buf returned */ , const int flags);
+extern int SendReceiveCompound(const unsigned int xid, struct cifs_ses *ses,
+			       const int num_rqst, struct kvec **rqst_iov,
+			       const int *rqst_nvec, struct kvec *resp_iov,
+			       int *resp_buf_type, const int flags);
 extern int SendReceiveBlockingLock(const unsigned int xid,
 			struct cifs_tcon *ptcon,
 			struct smb_hdr *in_buf ,
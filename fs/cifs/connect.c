@@ -773,6 +773,100 @@ static void clean_demultiplex_info(struct TCP_Server_Info *server)
 				GFP_KERNEL);
 }
 
+/*
+ * A server may answer a compounded request with one frame holding all of
+ * the responses, chained through the next header offset. Cut the frame
+ * after the first response and move the rest into a buffer of its own,
+ * with a fresh RFC1002 length, so that each response can be checked and
+ * matched to its mid as if it had come in separately.
+ */
+static void
+split_chained_rsp(struct TCP_Server_Info *server, char *buf)
+{
+	unsigned int next, rest;
+	char *next_buf;
+
+	if (!server->ops->next_header)
+		return;
+
+	next = server->ops->next_header(buf);
+	if (!next)
+		return;
+
+	/* a bogus offset is left for check_message to complain about */
+	if (next < HEADER_SIZE(server) - 4 || next + 4 > server->total_read)
+		return;
+	rest = server->total_read - 4 - next;
+	if (rest < HEADER_SIZE(server) - 4)
+		return;
+
+	if (rest + 4 > MAX_CIFS_SMALL_BUFFER_SIZE)
+		next_buf = (char *)cifs_buf_get();
+	else
+		next_buf = (char *)cifs_small_buf_get();
+	if (!next_buf) {
+		cERROR(1, "No memory for chained SMB response");
+		return;
+	}
+
+	memcpy(next_buf + 4, buf + 4 + next, rest);
+	*(__be32 *)next_buf = cpu_to_be32(rest);
+	*(__be32 *)buf = cpu_to_be32(next);
+	server->total_read = next + 4;
+	server->chained_buf = next_buf;
+}
+
+/*
+ * Make the response split off by split_chained_rsp the current one.
+ */
+static char *
+next_chained_rsp(struct TCP_Server_Info *server)
+{
+	char *buf = server->chained_buf;
+
+	server->chained_buf = NULL;
+	server->total_read = get_rfc1002_length(buf) + 4;
+	if (server->total_read > MAX_CIFS_SMALL_BUFFER_SIZE) {
+		cifs_buf_release(server->bigbuf);
+		server->bigbuf = buf;
+		server->large_buf = true;
+	} else {
+		if (server->smallbuf)
+			cifs_small_buf_release(server->smallbuf);
+		server->smallbuf = buf;
+		server->large_buf = false;
+	}
+	return buf;
+}
+
+static int
+check_and_handle_rsp(struct TCP_Server_Info *server, struct mid_q_entry *mid,
+		     char *buf)
+{
+	int length;
+
+	split_chained_rsp(server, buf);
+
+	/*
+	 * We know that we received enough to get to the MID as we
+	 * checked the pdu_length earlier. Now check to see
+	 * if the rest of the header is OK.
+	 *
+	 * 48 bytes is enough to display the header and a little bit
+	 * into the payload for debugging purposes.
+	 */
+	length = server->ops->check_message(buf, server->total_read);
+	if (length != 0)
+		cifs_dump_mem("Bad SMB: ", buf,
+			min_t(unsigned int, server->total_read, 48));
+
+	if (!mid)
+		return length;
+
+	handle_mid(mid, server, buf, length);
+	return 0;
+}
+
 static int
 standard_receive3(struct TCP_Server_Info *server, struct mid_q_entry *mid)
 {
@@ -805,25 +899,7 @@ standard_receive3(struct TCP_Server_Info *server, struct mid_q_entry *mid)
 
 	dump_smb(buf, server->total_read);
 
-	/*
-	 * We know that we received enough to get to the MID as we
-	 * checked the pdu_length earlier. Now check to see
-	 * if the rest of the header is OK. We borrow the length
-	 * var for the rest of the loop to avoid a new stack var.
-	 *
-	 * 48 bytes is enough to display the header and a little bit
-	 * into the payload for debugging purposes.
-	 */
-	length = server->ops->check_message(buf, server->total_read);
-	if (length != 0)
-		cifs_dump_mem("Bad SMB: ", buf,
-			min_t(unsigned int, server->total_read, 48));
-
-	if (!mid)
-		return length;
-
-	handle_mid(mid, server, buf, length);
-	return 0;
+	return check_and_handle_rsp(server, mid, buf);
 }
 
 static int
@@ -896,7 +972,7 @@ cifs_demultiplex_thread(void *p)
 
 		if (length < 0)
 			continue;
-
+next_rsp:
 		if (server->large_buf)
 			buf = server->bigbuf;
 
@@ -917,6 +993,13 @@ cifs_demultiplex_thread(void *p)
 #endif /* CIFS_DEBUG2 */
 
 		}
+
+		if (server->chained_buf) {
+			buf = next_chained_rsp(server);
+			mid_entry = server->ops->find_mid(server, buf);
+			check_and_handle_rsp(server, mid_entry, buf);
+			goto next_rsp;
+		}
 	} /* end while !EXITING */
 
 	/* buffer usually freed in free_mid - need to free it here on exit */
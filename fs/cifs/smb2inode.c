@@ -52,6 +52,22 @@ smb2_open_op_close(const unsigned int xid, struct cifs_tcon *tcon,
 	if (!utf16_path)
 		return -ENOMEM;
 
+	/* save two round trips by sending open, op and close together */
+	switch (command) {
+	case SMB2_OP_DELETE:
+	case SMB2_OP_MKDIR:
+	case SMB2_OP_QUERY_INFO:
+		rc = SMB2_open_query_close(xid, tcon, utf16_path,
+				desired_access, create_disposition,
+				file_attributes, create_options,
+				command == SMB2_OP_QUERY_INFO ? data : NULL);
+		if (rc != -EBUSY) {
+			kfree(utf16_path);
+			return rc;
+		}
+		break;
+	}
+
 	rc = SMB2_open(xid, tcon, utf16_path, &persistent_fid, &volatile_fid,
 		       desired_access, create_disposition, file_attributes,
 		       create_options);
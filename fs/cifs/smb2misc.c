@@ -165,6 +165,11 @@ smb2_check_message(char *buf, unsigned int length)
 		/* server can return one byte more */
 		if (clc_len == 4 + len + 1)
 			return 0;
+		/* responses chained in a compound are padded to 8 bytes */
+		if ((hdr->NextCommand ||
+		     (hdr->Flags & SMB2_FLAGS_RELATED_OPERATIONS)) &&
+		    clc_len < 4 + len && 4 + len - clc_len < 8)
+			return 0;
 		return 1;
 	}
 	return 0;
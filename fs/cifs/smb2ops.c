@@ -96,6 +96,14 @@ smb2_get_credits(struct mid_q_entry *mid)
 	return le16_to_cpu(((struct smb2_hdr *)mid->resp_buf)->CreditRequest);
 }
 
+static unsigned int
+smb2_next_header(char *buf)
+{
+	struct smb2_hdr *hdr = (struct smb2_hdr *)buf;
+
+	return le32_to_cpu(hdr->NextCommand);
+}
+
 static __u64
 smb2_get_next_mid(struct TCP_Server_Info *server)
 {
@@ -303,6 +311,7 @@ struct smb_version_operations smb21_operations = {
 	.get_next_mid = smb2_get_next_mid,
 	.find_mid = smb2_find_mid,
 	.check_message = smb2_check_message,
+	.next_header = smb2_next_header,
 	.dump_detail = smb2_dump_detail,
 	.clear_stats = smb2_clear_stats,
 	.print_stats = smb2_print_stats,
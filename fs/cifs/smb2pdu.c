@@ -830,27 +830,18 @@ SMB2_tdis(const unsigned int xid, struct cifs_tcon *tcon)
 	return rc;
 }
 
-int
-SMB2_open(const unsigned int xid, struct cifs_tcon *tcon, __le16 *path,
-	  u64 *persistent_fid, u64 *volatile_fid, __u32 desired_access,
-	  __u32 create_disposition, __u32 file_attributes, __u32 create_options)
+/*
+ * Build a create request in iov[0] and, unless the root of the share is
+ * opened, the path in iov[1]. Returns the number of iovecs used.
+ */
+static int
+SMB2_open_init(struct cifs_tcon *tcon, struct kvec *iov, __le16 *path,
+	       __u32 desired_access, __u32 create_disposition,
+	       __u32 file_attributes, __u32 create_options)
 {
 	struct smb2_create_req *req;
-	struct smb2_create_rsp *rsp;
-	struct TCP_Server_Info *server;
-	struct cifs_ses *ses = tcon->ses;
-	struct kvec iov[2];
-	int resp_buftype;
 	int uni_path_len;
-	int rc = 0;
-	int num_iovecs = 2;
-
-	cFYI(1, "create/open");
-
-	if (ses && (ses->server))
-		server = ses->server;
-	else
-		return -EIO;
+	int rc;
 
 	rc = small_smb2_init(SMB2_CREATE, tcon, (void **) &req);
 	if (rc)
@@ -887,11 +878,39 @@ SMB2_open(const unsigned int xid, struct cifs_tcon *tcon, __le16 *path,
 		 * smb2_buf_len.
 		 */
 		inc_rfc1001_len(req, uni_path_len - 1);
-	} else {
-		num_iovecs = 1;
-		req->NameLength = 0;
+		return 2;
 	}
 
+	req->NameLength = 0;
+	return 1;
+}
+
+int
+SMB2_open(const unsigned int xid, struct cifs_tcon *tcon, __le16 *path,
+	  u64 *persistent_fid, u64 *volatile_fid, __u32 desired_access,
+	  __u32 create_disposition, __u32 file_attributes, __u32 create_options)
+{
+	struct smb2_create_rsp *rsp;
+	struct TCP_Server_Info *server;
+	struct cifs_ses *ses = tcon->ses;
+	struct kvec iov[2];
+	int resp_buftype;
+	int rc = 0;
+	int num_iovecs;
+
+	cFYI(1, "create/open");
+
+	if (ses && (ses->server))
+		server = ses->server;
+	else
+		return -EIO;
+
+	num_iovecs = SMB2_open_init(tcon, iov, path, desired_access,
+				    create_disposition, file_attributes,
+				    create_options);
+	if (num_iovecs < 0)
+		return num_iovecs;
+
 	rc = SendReceive2(xid, ses, iov, num_iovecs, &resp_buftype, 0);
 	rsp = (struct smb2_create_rsp *)iov[0].iov_base;
 
@@ -911,11 +930,30 @@ creat_exit:
 	return rc;
 }
 
+static int
+SMB2_close_init(struct cifs_tcon *tcon, struct kvec *iov,
+		u64 persistent_fid, u64 volatile_fid)
+{
+	struct smb2_close_req *req;
+	int rc;
+
+	rc = small_smb2_init(SMB2_CLOSE, tcon, (void **) &req);
+	if (rc)
+		return rc;
+
+	req->PersistentFileId = persistent_fid;
+	req->VolatileFileId = volatile_fid;
+
+	iov[0].iov_base = (char *)req;
+	/* 4 for rfc1002 length field */
+	iov[0].iov_len = get_rfc1002_length(req) + 4;
+	return 0;
+}
+
 int
 SMB2_close(const unsigned int xid, struct cifs_tcon *tcon,
 	   u64 persistent_fid, u64 volatile_fid)
 {
-	struct smb2_close_req *req;
 	struct smb2_close_rsp *rsp;
 	struct TCP_Server_Info *server;
 	struct cifs_ses *ses = tcon->ses;
@@ -930,17 +968,10 @@ SMB2_close(const unsigned int xid, struct cifs_tcon *tcon,
 	else
 		return -EIO;
 
-	rc = small_smb2_init(SMB2_CLOSE, tcon, (void **) &req);
+	rc = SMB2_close_init(tcon, iov, persistent_fid, volatile_fid);
 	if (rc)
 		return rc;
 
-	req->PersistentFileId = persistent_fid;
-	req->VolatileFileId = volatile_fid;
-
-	iov[0].iov_base = (char *)req;
-	/* 4 for rfc1002 length field */
-	iov[0].iov_len = get_rfc1002_length(req) + 4;
-
 	rc = SendReceive2(xid, ses, iov, 1, &resp_buftype, 0);
 	rsp = (struct smb2_close_rsp *)iov[0].iov_base;
 
@@ -1019,12 +1050,38 @@ validate_and_copy_buf(unsigned int offset, unsigned int buffer_length,
 	return 0;
 }
 
+static int
+SMB2_query_info_init(struct cifs_tcon *tcon, struct kvec *iov,
+		     u64 persistent_fid, u64 volatile_fid)
+{
+	struct smb2_query_info_req *req;
+	int rc;
+
+	rc = small_smb2_init(SMB2_QUERY_INFO, tcon, (void **) &req);
+	if (rc)
+		return rc;
+
+	req->InfoType = SMB2_O_INFO_FILE;
+	req->FileInfoClass = FILE_ALL_INFORMATION;
+	req->PersistentFileId = persistent_fid;
+	req->VolatileFileId = volatile_fid;
+	/* 4 for rfc1002 length field and 1 for Buffer */
+	req->InputBufferOffset =
+		cpu_to_le16(sizeof(struct smb2_query_info_req) - 1 - 4);
+	req->OutputBufferLength =
+		cpu_to_le32(sizeof(struct smb2_file_all_info) + MAX_NAME * 2);
+
+	iov[0].iov_base = (char *)req;
+	/* 4 for rfc1002 length field */
+	iov[0].iov_len = get_rfc1002_length(req) + 4;
+	return 0;
+}
+
 int
 SMB2_query_info(const unsigned int xid, struct cifs_tcon *tcon,
 		u64 persistent_fid, u64 volatile_fid,
 		struct smb2_file_all_info *data)
 {
-	struct smb2_query_info_req *req;
 	struct smb2_query_info_rsp *rsp = NULL;
 	struct kvec iov[2];
 	int rc = 0;
@@ -1039,24 +1096,10 @@ SMB2_query_info(const unsigned int xid, struct cifs_tcon *tcon,
 	else
 		return -EIO;
 
-	rc = small_smb2_init(SMB2_QUERY_INFO, tcon, (void **) &req);
+	rc = SMB2_query_info_init(tcon, iov, persistent_fid, volatile_fid);
 	if (rc)
 		return rc;
 
-	req->InfoType = SMB2_O_INFO_FILE;
-	req->FileInfoClass = FILE_ALL_INFORMATION;
-	req->PersistentFileId = persistent_fid;
-	req->VolatileFileId = volatile_fid;
-	/* 4 for rfc1002 length field and 1 for Buffer */
-	req->InputBufferOffset =
-		cpu_to_le16(sizeof(struct smb2_query_info_req) - 1 - 4);
-	req->OutputBufferLength =
-		cpu_to_le32(sizeof(struct smb2_file_all_info) + MAX_NAME * 2);
-
-	iov[0].iov_base = (char *)req;
-	/* 4 for rfc1002 length field */
-	iov[0].iov_len = get_rfc1002_length(req) + 4;
-
 	rc = SendReceive2(xid, ses, iov, 1, &resp_buftype, 0);
 	if (rc) {
 		cifs_stats_fail_inc(tcon, SMB2_QUERY_INFO_HE);
@@ -1075,6 +1118,125 @@ qinf_exit:
 	return rc;
 }
 
+static char smb2_padding[7];
+
+/*
+ * Chain request rqst to the one before it in a compound: pad the previous
+ * request to 8 bytes and point its NextCommand at this one. Requests after
+ * the first operate on the file opened by the first one, so they are
+ * marked as related and carry the "use the previous handle" file id.
+ */
+static unsigned int
+smb2_chain_rqst(struct kvec *prev_iov, int *prev_nvec, unsigned int prev_len,
+		struct kvec *iov)
+{
+	struct smb2_hdr *prev = (struct smb2_hdr *)prev_iov[0].iov_base;
+	struct smb2_hdr *hdr = (struct smb2_hdr *)iov[0].iov_base;
+	unsigned int pad = ALIGN(prev_len, 8) - prev_len;
+
+	if (pad) {
+		prev_iov[*prev_nvec].iov_base = smb2_padding;
+		prev_iov[*prev_nvec].iov_len = pad;
+		(*prev_nvec)++;
+	}
+	prev->NextCommand = cpu_to_le32(prev_len + pad);
+	hdr->Flags |= SMB2_FLAGS_RELATED_OPERATIONS;
+	return pad;
+}
+
+/*
+ * Open path, optionally query FILE_ALL_INFORMATION into data, and close it
+ * again in a single round trip by compounding the requests. Returns -EBUSY
+ * without having sent anything if the server has not granted us enough
+ * credits for the whole chain; the caller then issues the requests one by
+ * one.
+ */
+int
+SMB2_open_query_close(const unsigned int xid, struct cifs_tcon *tcon,
+		      __le16 *path, __u32 desired_access,
+		      __u32 create_disposition, __u32 file_attributes,
+		      __u32 create_options, struct smb2_file_all_info *data)
+{
+	struct cifs_ses *ses = tcon->ses;
+	struct kvec open_iov[3], qi_iov[2], close_iov[1];
+	struct kvec *rqst_iov[MAX_COMPOUND];
+	int rqst_nvec[MAX_COMPOUND];
+	struct kvec resp_iov[MAX_COMPOUND];
+	int resp_buftype[MAX_COMPOUND];
+	struct smb2_query_info_rsp *qi_rsp;
+	unsigned int len, total_len;
+	int num_rqst = 0;
+	int i, rc;
+
+	cFYI(1, "compound open/query/close");
+
+	if (!ses || !ses->server)
+		return -EIO;
+
+	rc = SMB2_open_init(tcon, open_iov, path, desired_access,
+			    create_disposition, file_attributes,
+			    create_options);
+	if (rc < 0)
+		return rc;
+	rqst_iov[num_rqst] = open_iov;
+	rqst_nvec[num_rqst++] = rc;
+	len = get_rfc1002_length(open_iov[0].iov_base);
+	total_len = len;
+
+	if (data) {
+		rc = SMB2_query_info_init(tcon, qi_iov, -1, -1);
+		if (rc)
+			goto free_rqst;
+		total_len += smb2_chain_rqst(open_iov, &rqst_nvec[0], len,
+					     qi_iov);
+		rqst_iov[num_rqst] = qi_iov;
+		rqst_nvec[num_rqst++] = 1;
+		len = get_rfc1002_length(qi_iov[0].iov_base);
+		total_len += len;
+	}
+
+	rc = SMB2_close_init(tcon, close_iov, -1, -1);
+	if (rc)
+		goto free_rqst;
+	total_len += smb2_chain_rqst(rqst_iov[num_rqst - 1],
+				     &rqst_nvec[num_rqst - 1], len, close_iov);
+	rqst_iov[num_rqst] = close_iov;
+	rqst_nvec[num_rqst++] = 1;
+	total_len += get_rfc1002_length(close_iov[0].iov_base);
+
+	/* the RFC1002 length of the first request covers the whole chain */
+	((struct smb2_hdr *)open_iov[0].iov_base)->smb2_buf_length =
+							cpu_to_be32(total_len);
+
+	rc = SendReceiveCompound(xid, ses, num_rqst, rqst_iov, rqst_nvec,
+				 resp_iov, resp_buftype, 0);
+
+	for (i = 0; i < num_rqst; i++) {
+		struct smb2_hdr *hdr = resp_iov[i].iov_base;
+
+		if (hdr && hdr->Status)
+			cifs_stats_fail_inc(tcon, le16_to_cpu(hdr->Command));
+	}
+
+	if (!rc && data) {
+		qi_rsp = (struct smb2_query_info_rsp *)resp_iov[1].iov_base;
+		rc = validate_and_copy_buf(
+				le16_to_cpu(qi_rsp->OutputBufferOffset),
+				le32_to_cpu(qi_rsp->OutputBufferLength),
+				&qi_rsp->hdr, sizeof(struct smb2_file_all_info),
+				(char *)data);
+	}
+
+	for (i = 0; i < num_rqst; i++)
+		free_rsp_buf(resp_buftype[i], resp_iov[i].iov_base);
+	return rc;
+
+free_rqst:
+	for (i = 0; i < num_rqst; i++)
+		cifs_small_buf_release(rqst_iov[i][0].iov_base);
+	return rc;
+}
+
 /*
  * This is a no-op for now. We're not really interested in the reply, but
  * rather in the fact that the server sent one and that server->lstrp
@@ -81,6 +81,12 @@ extern int SMB2_close(const unsigned int xid, struct cifs_tcon *tcon,
 extern int SMB2_query_info(const unsigned int xid, struct cifs_tcon *tcon,
 			   u64 persistent_file_id, u64 volatile_file_id,
 			   struct smb2_file_all_info *data);
+extern int SMB2_open_query_close(const unsigned int xid,
+				 struct cifs_tcon *tcon, __le16 *path,
+				 __u32 desired_access,
+				 __u32 create_disposition,
+				 __u32 file_attributes, __u32 create_options,
+				 struct smb2_file_all_info *data);
 extern int SMB2_echo(struct TCP_Server_Info *server);
 
 #endif			/* _SMB2PROTO_H */
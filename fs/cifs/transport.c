@@ -662,6 +662,227 @@ out:
 	return rc;
 }
 
+/*
+ * Grab credits for a whole chain at once, without waiting. A chain that
+ * asks for more credits than the server has granted us right now could
+ * otherwise sit on a partial allocation forever, so the caller is told to
+ * fall back to sending its requests one at a time instead.
+ */
+static int
+get_compound_credits(struct TCP_Server_Info *server, const int optype,
+		     const int num)
+{
+	int *credits = server->ops->get_credits_field(server, optype);
+	int rc = -EBUSY;
+
+	spin_lock(&server->req_lock);
+	if (server->tcpStatus == CifsExiting) {
+		rc = -ENOENT;
+	} else if (*credits >= num) {
+		*credits -= num;
+		server->in_flight += num;
+		rc = 0;
+	}
+	spin_unlock(&server->req_lock);
+	return rc;
+}
+
+/*
+ * Forget about a mid of a chain whose caller is not going to look at the
+ * response: the demultiplex thread frees it if it is still on the wire.
+ */
+static void
+drop_compound_mid(struct TCP_Server_Info *server, struct mid_q_entry *mid,
+		  const int optype)
+{
+	unsigned int credits = 1;
+
+	spin_lock(&GlobalMid_Lock);
+	if (mid->mid_state == MID_REQUEST_SUBMITTED) {
+		mid->callback = DeleteMidQEntry;
+		spin_unlock(&GlobalMid_Lock);
+		add_credits(server, 1, optype);
+		return;
+	}
+	spin_unlock(&GlobalMid_Lock);
+
+	if (cifs_sync_mid_result(mid, server) == 0) {
+		if (mid->resp_buf)
+			credits = server->ops->get_credits(mid);
+		delete_mid(mid);
+	}
+	add_credits(server, credits, optype);
+}
+
+/*
+ * Send several requests in a single frame and wait for all of the
+ * responses. rqst_iov[i] describes request i laid out as for SendReceive2,
+ * RFC1002 length field first; the caller has already chained the requests
+ * together (for SMB2 through NextCommand) and set the length field of the
+ * first one to cover the whole frame. Every request gets its own mid, so
+ * the responses are matched whether the server chains them or not.
+ *
+ * The request buffers (rqst_iov[i][0]) are released as with SendReceive2.
+ * On return resp_iov[i] and resp_buf_type[i] describe whatever responses
+ * were received and must be freed by the caller even on error. -EBUSY
+ * means nothing was sent because not enough credits were available.
+ */
+int
+SendReceiveCompound(const unsigned int xid, struct cifs_ses *ses,
+		    const int num_rqst, struct kvec **rqst_iov,
+		    const int *rqst_nvec, struct kvec *resp_iov,
+		    int *resp_buf_type, const int flags)
+{
+	struct TCP_Server_Info *server;
+	struct mid_q_entry *midQ[MAX_COMPOUND];
+	struct kvec *iov;
+	int optype = flags & CIFS_OP_MASK;
+	int i, j, n_vec = 0;
+	int rc, err;
+
+	for (i = 0; i < num_rqst; i++) {
+		resp_buf_type[i] = CIFS_NO_BUFFER;
+		resp_iov[i].iov_base = NULL;
+		resp_iov[i].iov_len = 0;
+		n_vec += rqst_nvec[i];
+	}
+
+	if (num_rqst > MAX_COMPOUND || (flags & CIFS_TIMEOUT_MASK)) {
+		rc = -EINVAL;
+		goto out_free_rqst;
+	}
+
+	if ((ses == NULL) || (ses->server == NULL)) {
+		cERROR(1, "Null session");
+		rc = -EIO;
+		goto out_free_rqst;
+	}
+	server = ses->server;
+
+	/* only the first request carries the RFC1002 length on the wire */
+	iov = kmalloc(n_vec * sizeof(struct kvec), GFP_NOFS);
+	if (!iov) {
+		rc = -ENOMEM;
+		goto out_free_rqst;
+	}
+	for (i = 0, n_vec = 0; i < num_rqst; i++) {
+		memcpy(&iov[n_vec], rqst_iov[i],
+		       rqst_nvec[i] * sizeof(struct kvec));
+		if (i) {
+			iov[n_vec].iov_base += 4;
+			iov[n_vec].iov_len -= 4;
+		}
+		n_vec += rqst_nvec[i];
+	}
+
+	rc = get_compound_credits(server, optype, num_rqst);
+	if (rc)
+		goto out_free_iov;
+
+	mutex_lock(&server->srv_mutex);
+
+	for (i = 0; i < num_rqst; i++) {
+		rc = server->ops->setup_request(ses, rqst_iov[i],
+						rqst_nvec[i], &midQ[i]);
+		if (rc) {
+			mutex_unlock(&server->srv_mutex);
+			for (j = 0; j < i; j++)
+				delete_mid(midQ[j]);
+			for (j = 0; j < num_rqst; j++)
+				add_credits(server, 1, optype);
+			goto out_free_iov;
+		}
+		midQ[i]->mid_state = MID_REQUEST_SUBMITTED;
+	}
+
+	cifs_in_send_inc(server);
+	rc = smb_sendv(server, iov, n_vec);
+	cifs_in_send_dec(server);
+	for (i = 0; i < num_rqst; i++)
+		cifs_save_when_sent(midQ[i]);
+
+	mutex_unlock(&server->srv_mutex);
+
+	kfree(iov);
+	for (i = 0; i < num_rqst; i++)
+		cifs_small_buf_release(rqst_iov[i][0].iov_base);
+
+	if (rc < 0) {
+		for (i = 0; i < num_rqst; i++) {
+			delete_mid(midQ[i]);
+			add_credits(server, 1, optype);
+		}
+		return rc;
+	}
+
+	for (i = 0; i < num_rqst; i++) {
+		unsigned int credits;
+		char *buf;
+
+		err = wait_for_response(server, midQ[i]);
+		if (err != 0) {
+			rc = err;
+			break;
+		}
+
+		err = cifs_sync_mid_result(midQ[i], server);
+		if (err != 0) {
+			add_credits(server, 1, optype);
+			rc = err;
+			i++;
+			break;
+		}
+
+		if (!midQ[i]->resp_buf ||
+		    midQ[i]->mid_state != MID_RESPONSE_RECEIVED) {
+			cFYI(1, "Bad MID state?");
+			delete_mid(midQ[i]);
+			add_credits(server, 1, optype);
+			rc = -EIO;
+			i++;
+			break;
+		}
+
+		buf = (char *)midQ[i]->resp_buf;
+		resp_iov[i].iov_base = buf;
+		resp_iov[i].iov_len = get_rfc1002_length(buf) + 4;
+		if (midQ[i]->large_buf)
+			resp_buf_type[i] = CIFS_LARGE_BUFFER;
+		else
+			resp_buf_type[i] = CIFS_SMALL_BUFFER;
+
+		credits = server->ops->get_credits(midQ[i]);
+
+		/*
+		 * Keep going on errors: later requests in the chain usually
+		 * fail along with this one, and their responses still have
+		 * to be collected. Report the first error.
+		 */
+		err = server->ops->check_receive(midQ[i], server,
+						 flags & CIFS_LOG_ERROR);
+		if (err && !rc)
+			rc = err;
+
+		/* mark it so buf will not be freed by delete_mid */
+		midQ[i]->resp_buf = NULL;
+		delete_mid(midQ[i]);
+		add_credits(server, credits, optype);
+	}
+
+	/* interrupted or failed: forget about the rest of the chain */
+	for (; i < num_rqst; i++)
+		drop_compound_mid(server, midQ[i], optype);
+
+	return rc;
+
+out_free_iov:
+	kfree(iov);
+out_free_rqst:
+	for (i = 0; i < num_rqst; i++)
+		cifs_small_buf_release(rqst_iov[i][0].iov_base);
+	return rc;
+}
+
 int
 SendReceive(const unsigned int xid, struct cifs_ses *ses,
 	    struct smb_hdr *in_buf, struct smb_hdr *out_buf,
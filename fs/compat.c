@@ -1126,9 +1126,9 @@ out:
 	return ret;
 }
 
-static size_t compat_readv(struct file *file,
-			   const struct compat_iovec __user *vec,
-			   unsigned long vlen, loff_t *pos)
+size_t compat_readv(struct file *file,
+		    const struct compat_iovec __user *vec,
+		    unsigned long vlen, loff_t *pos)
 {
 	ssize_t ret = -EBADF;
 
@@ -1195,9 +1195,9 @@ compat_sys_preadv(unsigned long fd, const struct compat_iovec __user *vec,
 	return compat_sys_preadv64(fd, vec, vlen, pos);
 }
 
-static size_t compat_writev(struct file *file,
-			    const struct compat_iovec __user *vec,
-			    unsigned long vlen, loff_t *pos)
+size_t compat_writev(struct file *file,
+		     const struct compat_iovec __user *vec,
+		     unsigned long vlen, loff_t *pos)
 {
 	ssize_t ret = -EBADF;
 
@@ -37,6 +37,8 @@
 #include <linux/rculist_bl.h>
 #include <linux/prefetch.h>
 #include <linux/ratelimit.h>
+#include <linux/percpu_counter.h>
+#include <linux/list_lru.h>
 #include "internal.h"
 #include "mount.h"
 
@@ -48,8 +50,12 @@
  *   - the dcache hash table
  * s_anon bl list spinlock protects:
  *   - the s_anon list (see __d_drop)
- * dcache_lru_lock protects:
- *   - the dcache lru lists and counters
+ * the per-node lock of sb->s_dentry_lru protects:
+ *   - that node's list of the per-sb dcache lru
+ * dcache_shrink_lock protects:
+ *   - the private lists of dentries being shrunk (DCACHE_SHRINK_LIST)
+ * in_lookup_bucket->lock protects:
+ *   - the dentries being looked up in parallel (DCACHE_PAR_LOOKUP)
  * d_lock protects:
  *   - d_flags
  *   - d_name
@@ -61,9 +67,14 @@
  *   - d_alias, d_inode
  *
  * Ordering:
+ * in_lookup_bucket->lock
+ *   dcache_hash_bucket lock
+ *   dentry->d_lock
+ *
  * dentry->d_inode->i_lock
  *   dentry->d_lock
- *     dcache_lru_lock
+ *     s_dentry_lru node lock
+ *       dcache_shrink_lock
  *     dcache_hash_bucket lock
  *     s_anon lock
  *
@@ -81,7 +92,7 @@
 int sysctl_vfs_cache_pressure __read_mostly = 100;
 EXPORT_SYMBOL_GPL(sysctl_vfs_cache_pressure);
 
-static __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lru_lock);
+static __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_shrink_lock);
 __cacheline_aligned_in_smp DEFINE_SEQLOCK(rename_lock);
 
 EXPORT_SYMBOL(rename_lock);
@@ -118,6 +129,24 @@ struct dentry_stat_t dentry_stat = {
 };
 
 static DEFINE_PER_CPU(unsigned int, nr_dentry);
+static DEFINE_PER_CPU(unsigned int, nr_dentry_unused);
+
+/* Negative dentries on the LRU, read cheaply against the limit below */
+static struct percpu_counter nr_dentry_negative;
+
+/*
+ * Limit on the negative dentries kept on the LRU, in thousandths of the
+ * memory, and in dentries. Zero disables it.
+ */
+int sysctl_negative_dentry_limit __read_mostly;
+static long negative_dentry_max __read_mostly;
+
+static inline bool negative_dentry_over_limit(void)
+{
+	long max = ACCESS_ONCE(negative_dentry_max);
+
+	return max && percpu_counter_read_positive(&nr_dentry_negative) > max;
+}
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 static int get_nr_dentry(void)
@@ -129,12 +158,35 @@ static int get_nr_dentry(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static int get_nr_dentry_unused(void)
+{
+	int i;
+	int sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_unused, i);
+	return sum < 0 ? 0 : sum;
+}
+
 int proc_nr_dentry(ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
+	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = percpu_counter_sum_positive(&nr_dentry_negative);
 	return proc_dointvec(table, write, buffer, lenp, ppos);
 }
+
+int proc_negative_dentry_limit(ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+
+	if (!ret && write)
+		negative_dentry_max = totalram_pages / 1000 *
+			sysctl_negative_dentry_limit *
+			(PAGE_SIZE / sizeof(struct dentry));
+	return ret;
+}
 #endif
 
 /*
@@ -291,6 +343,8 @@ static void dentry_unlink_inode(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	dentry->d_inode = NULL;
+	if (!list_empty(&dentry->d_lru))
+		percpu_counter_inc(&nr_dentry_negative);
 	hlist_del_init(&dentry->d_alias);
 	dentry_rcuwalk_barrier(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -304,37 +358,45 @@ static void dentry_unlink_inode(struct dentry * dentry)
 }
 
 /*
- * dentry_lru_(add|del|prune|move_tail) must be called with d_lock held.
+ * dentry_lru_(add|del|prune|move_list) must be called with d_lock held.
+ *
+ * A dentry on the LRU sits either on the sb->s_dentry_lru list_lru, or,
+ * with DCACHE_SHRINK_LIST set, on the private list of a shrinker. Moving
+ * it from one to the other takes both d_lock and the locks of both lists.
  */
 static void dentry_lru_add(struct dentry *dentry)
 {
-	if (list_empty(&dentry->d_lru)) {
-		spin_lock(&dcache_lru_lock);
-		list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-		dentry->d_sb->s_nr_dentry_unused++;
-		dentry_stat.nr_unused++;
-		spin_unlock(&dcache_lru_lock);
+	if (list_empty(&dentry->d_lru) &&
+	    list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru)) {
+		this_cpu_inc(nr_dentry_unused);
+		if (!dentry->d_inode)
+			percpu_counter_inc(&nr_dentry_negative);
 	}
 }
 
 static void __dentry_lru_del(struct dentry *dentry)
 {
-	list_del_init(&dentry->d_lru);
-	dentry->d_flags &= ~DCACHE_SHRINK_LIST;
-	dentry->d_sb->s_nr_dentry_unused--;
-	dentry_stat.nr_unused--;
+	if (dentry->d_flags & DCACHE_SHRINK_LIST) {
+		spin_lock(&dcache_shrink_lock);
+		list_del_init(&dentry->d_lru);
+		spin_unlock(&dcache_shrink_lock);
+		dentry->d_flags &= ~DCACHE_SHRINK_LIST;
+	} else
+		list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru);
+	this_cpu_dec(nr_dentry_unused);
+	if (!dentry->d_inode)
+		percpu_counter_dec(&nr_dentry_negative);
 }
 
 /*
- * Remove a dentry with references from the LRU.
+ * Remove a dentry with references from the LRU. A dentry being looked up
+ * in parallel uses d_lru for the in-lookup hash instead, see
+ * d_alloc_parallel().
  */
 static void dentry_lru_del(struct dentry *dentry)
 {
-	if (!list_empty(&dentry->d_lru)) {
-		spin_lock(&dcache_lru_lock);
+	if (!list_empty(&dentry->d_lru) && !d_in_lookup(dentry))
 		__dentry_lru_del(dentry);
-		spin_unlock(&dcache_lru_lock);
-	}
 }
 
 /*
@@ -348,23 +410,30 @@ static void dentry_lru_prune(struct dentry *dentry)
 		if (dentry->d_flags & DCACHE_OP_PRUNE)
 			dentry->d_op->d_prune(dentry);
 
-		spin_lock(&dcache_lru_lock);
 		__dentry_lru_del(dentry);
-		spin_unlock(&dcache_lru_lock);
 	}
 }
 
+/*
+ * Move a dentry that is not on a shrink list yet onto the shrink list
+ * @list.
+ */
 static void dentry_lru_move_list(struct dentry *dentry, struct list_head *list)
 {
-	spin_lock(&dcache_lru_lock);
 	if (list_empty(&dentry->d_lru)) {
+		spin_lock(&dcache_shrink_lock);
 		list_add_tail(&dentry->d_lru, list);
-		dentry->d_sb->s_nr_dentry_unused++;
-		dentry_stat.nr_unused++;
+		spin_unlock(&dcache_shrink_lock);
+		this_cpu_inc(nr_dentry_unused);
+		if (!dentry->d_inode)
+			percpu_counter_inc(&nr_dentry_negative);
 	} else {
-		list_move_tail(&dentry->d_lru, list);
+		list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru);
+		spin_lock(&dcache_shrink_lock);
+		list_add_tail(&dentry->d_lru, list);
+		spin_unlock(&dcache_shrink_lock);
 	}
-	spin_unlock(&dcache_lru_lock);
+	dentry->d_flags |= DCACHE_SHRINK_LIST;
 }
 
 /**
@@ -565,6 +634,13 @@ repeat:
  	if (d_unhashed(dentry))
 		goto kill_it;
 
+	/*
+	 * Past the limit, negative dentries are not cached any more, so
+	 * that they can't push out the page cache and useful dentries.
+	 */
+	if (!dentry->d_inode && negative_dentry_over_limit())
+		goto kill_it;
+
 	/*
 	 * If this dentry needs lookup, don't set the referenced flag so that it
 	 * is more likely to be cleaned up by the dcache shrinker in case of
@@ -849,6 +925,48 @@ static void shrink_dentry_list(struct list_head *list)
 	rcu_read_unlock();
 }
 
+/*
+ * Move a dentry isolated from the LRU onto the shrink list @dispose.
+ * Called with d_lock and the LRU node lock held.
+ */
+static void dentry_lru_isolate_move(struct dentry *dentry,
+				    struct list_head *dispose)
+{
+	spin_lock(&dcache_shrink_lock);
+	list_move_tail(&dentry->d_lru, dispose);
+	spin_unlock(&dcache_shrink_lock);
+	dentry->d_flags |= DCACHE_SHRINK_LIST;
+}
+
+static enum lru_status
+dentry_lru_isolate(struct list_head *item, spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *dispose = arg;
+	struct dentry *dentry = container_of(item, struct dentry, d_lru);
+
+	/*
+	 * we are inverting the lru lock/dentry->d_lock here,
+	 * so use a trylock. If we fail to get the lock, just skip
+	 * it
+	 */
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	/*
+	 * Negative dentries get no second trip around the LRU: they
+	 * are cheap to recreate, and would pile up otherwise.
+	 */
+	if ((dentry->d_flags & DCACHE_REFERENCED) && dentry->d_inode) {
+		dentry->d_flags &= ~DCACHE_REFERENCED;
+		spin_unlock(&dentry->d_lock);
+		return LRU_ROTATE;
+	}
+
+	dentry_lru_isolate_move(dentry, dispose);
+	spin_unlock(&dentry->d_lock);
+	return LRU_REMOVED;
+}
+
 /**
  * prune_dcache_sb - shrink the dcache
  * @sb: superblock
@@ -856,48 +974,37 @@ static void shrink_dentry_list(struct list_head *list)
  *
  * Attempt to shrink the superblock dcache LRU by @count entries. This is
  * done when we need more memory an called from the superblock shrinker
- * function.
+ * function. The scan is spread over the per-node LRUs in proportion to
+ * their sizes.
  *
  * This function may fail to free any resources if all the dentries are in
  * use.
  */
 void prune_dcache_sb(struct super_block *sb, int count)
 {
-	struct dentry *dentry;
-	LIST_HEAD(referenced);
-	LIST_HEAD(tmp);
+	LIST_HEAD(dispose);
 
-relock:
-	spin_lock(&dcache_lru_lock);
-	while (!list_empty(&sb->s_dentry_lru)) {
-		dentry = list_entry(sb->s_dentry_lru.prev,
-				struct dentry, d_lru);
-		BUG_ON(dentry->d_sb != sb);
-
-		if (!spin_trylock(&dentry->d_lock)) {
-			spin_unlock(&dcache_lru_lock);
-			cpu_relax();
-			goto relock;
-		}
+	list_lru_walk(&sb->s_dentry_lru, dentry_lru_isolate, &dispose, count);
+	shrink_dentry_list(&dispose);
+}
 
-		if (dentry->d_flags & DCACHE_REFERENCED) {
-			dentry->d_flags &= ~DCACHE_REFERENCED;
-			list_move(&dentry->d_lru, &referenced);
-			spin_unlock(&dentry->d_lock);
-		} else {
-			list_move_tail(&dentry->d_lru, &tmp);
-			dentry->d_flags |= DCACHE_SHRINK_LIST;
-			spin_unlock(&dentry->d_lock);
-			if (!--count)
-				break;
-		}
-		cond_resched_lock(&dcache_lru_lock);
-	}
-	if (!list_empty(&referenced))
-		list_splice(&referenced, &sb->s_dentry_lru);
-	spin_unlock(&dcache_lru_lock);
+static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
+						 spinlock_t *lru_lock, void *arg)
+{
+	struct list_head *dispose = arg;
+	struct dentry *dentry = container_of(item, struct dentry, d_lru);
 
-	shrink_dentry_list(&tmp);
+	/*
+	 * we are inverting the lru lock/dentry->d_lock here,
+	 * so use a trylock. If we fail to get the lock, just skip
+	 * it
+	 */
+	if (!spin_trylock(&dentry->d_lock))
+		return LRU_SKIP;
+
+	dentry_lru_isolate_move(dentry, dispose);
+	spin_unlock(&dentry->d_lock);
+	return LRU_REMOVED;
 }
 
 /**
@@ -909,16 +1016,14 @@ relock:
  */
 void shrink_dcache_sb(struct super_block *sb)
 {
-	LIST_HEAD(tmp);
+	do {
+		LIST_HEAD(dispose);
 
-	spin_lock(&dcache_lru_lock);
-	while (!list_empty(&sb->s_dentry_lru)) {
-		list_splice_init(&sb->s_dentry_lru, &tmp);
-		spin_unlock(&dcache_lru_lock);
-		shrink_dentry_list(&tmp);
-		spin_lock(&dcache_lru_lock);
-	}
-	spin_unlock(&dcache_lru_lock);
+		list_lru_walk(&sb->s_dentry_lru, dentry_lru_isolate_shrink,
+			      &dispose, 1024);
+		shrink_dentry_list(&dispose);
+		cond_resched();
+	} while (list_lru_count(&sb->s_dentry_lru) > 0);
 }
 EXPORT_SYMBOL(shrink_dcache_sb);
 
@@ -1188,7 +1293,6 @@ resume:
 			dentry_lru_del(dentry);
 		} else if (!(dentry->d_flags & DCACHE_SHRINK_LIST)) {
 			dentry_lru_move_list(dentry, dispose);
-			dentry->d_flags |= DCACHE_SHRINK_LIST;
 			found++;
 		}
 		/*
@@ -1403,6 +1507,8 @@ static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 		if (unlikely(IS_AUTOMOUNT(inode)))
 			dentry->d_flags |= DCACHE_NEED_AUTOMOUNT;
 		hlist_add_head(&dentry->d_alias, &inode->i_dentry);
+		if (!dentry->d_inode && !list_empty(&dentry->d_lru))
+			percpu_counter_dec(&nr_dentry_negative);
 	}
 	dentry->d_inode = inode;
 	dentry_rcuwalk_barrier(dentry);
@@ -2019,6 +2125,123 @@ next:
  	return found;
 }
 
+/*
+ * Dentries that a lookup without the parent's i_mutex is in progress for
+ * are kept, unhashed and linked through d_lru, in a small hash of their
+ * own. A lookup that finds one there waits for it to finish instead of
+ * calling ->lookup() a second time for the same name.
+ */
+#define IN_LOOKUP_SHIFT	8
+
+static struct in_lookup_bucket {
+	spinlock_t		lock;
+	struct list_head	list;
+	wait_queue_head_t	wait;
+} in_lookup_hashtable[1 << IN_LOOKUP_SHIFT] ____cacheline_aligned_in_smp;
+
+static inline struct in_lookup_bucket *in_lookup_hash(struct dentry *parent,
+						      unsigned int hash)
+{
+	hash += (unsigned long)parent / L1_CACHE_BYTES;
+	return in_lookup_hashtable + hash_32(hash, IN_LOOKUP_SHIFT);
+}
+
+/* Called with d_lock held */
+static bool d_same_name(struct dentry *dentry, struct dentry *parent,
+			struct qstr *name)
+{
+	if (dentry->d_name.hash != name->hash || dentry->d_parent != parent)
+		return false;
+	if (parent->d_flags & DCACHE_OP_COMPARE)
+		return !parent->d_op->d_compare(parent, parent->d_inode,
+						dentry, dentry->d_inode,
+						dentry->d_name.len,
+						dentry->d_name.name, name);
+	return dentry->d_name.len == name->len &&
+	       !dentry_cmp(dentry, name->name, name->len);
+}
+
+/**
+ * d_alloc_parallel - find or start the lookup of a name
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find, hashed
+ *
+ * Returns the dentry for @name in @parent if it is in the dcache, waiting
+ * for a lookup of the same name that is already in progress to finish
+ * first. Otherwise returns a new, unhashed dentry with d_in_lookup() true:
+ * the caller then has to call ->lookup() on it and d_lookup_done() after.
+ *
+ * This is what lets filesystems flagged FS_PARALLEL_LOOKUP look names up
+ * without holding the parent's i_mutex.
+ */
+struct dentry *d_alloc_parallel(struct dentry *parent, struct qstr *name)
+{
+	struct in_lookup_bucket *b = in_lookup_hash(parent, name->hash);
+	struct dentry *new, *dentry;
+
+	new = d_alloc(parent, name);
+	if (unlikely(!new))
+		return ERR_PTR(-ENOMEM);
+retry:
+	spin_lock(&b->lock);
+	list_for_each_entry(dentry, &b->list, d_lru) {
+		spin_lock(&dentry->d_lock);
+		if (!d_same_name(dentry, parent, name)) {
+			spin_unlock(&dentry->d_lock);
+			continue;
+		}
+		dentry->d_count++;
+		spin_unlock(&dentry->d_lock);
+		spin_unlock(&b->lock);
+
+		wait_event(b->wait, !d_in_lookup(dentry));
+		dput(dentry);
+		goto retry;
+	}
+
+	/*
+	 * A lookup that finished before we took the bucket lock has hashed
+	 * its dentry by now, so this cannot miss it.
+	 */
+	dentry = d_lookup(parent, name);
+	if (dentry) {
+		spin_unlock(&b->lock);
+		dput(new);
+		return dentry;
+	}
+
+	spin_lock(&new->d_lock);
+	new->d_flags |= DCACHE_PAR_LOOKUP;
+	list_add(&new->d_lru, &b->list);
+	spin_unlock(&new->d_lock);
+	spin_unlock(&b->lock);
+	return new;
+}
+EXPORT_SYMBOL(d_alloc_parallel);
+
+/**
+ * d_lookup_done - finish the lookup started by d_alloc_parallel()
+ * @dentry: the dentry returned by d_alloc_parallel()
+ *
+ * Must be called after ->lookup() returned, whether it hashed @dentry,
+ * used another dentry, or failed, and before @dentry is put.
+ */
+void d_lookup_done(struct dentry *dentry)
+{
+	struct in_lookup_bucket *b = in_lookup_hash(dentry->d_parent,
+						    dentry->d_name.hash);
+
+	spin_lock(&b->lock);
+	spin_lock(&dentry->d_lock);
+	BUG_ON(!d_in_lookup(dentry));
+	dentry->d_flags &= ~DCACHE_PAR_LOOKUP;
+	list_del_init(&dentry->d_lru);
+	spin_unlock(&dentry->d_lock);
+	spin_unlock(&b->lock);
+	wake_up_all(&b->wait);
+}
+EXPORT_SYMBOL(d_lookup_done);
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -3116,6 +3339,15 @@ static void __init dcache_init(void)
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
 
+	if (percpu_counter_init(&nr_dentry_negative, 0))
+		panic("Failed to allocate the negative dentry counter\n");
+
+	for (loop = 0; loop < (1U << IN_LOOKUP_SHIFT); loop++) {
+		spin_lock_init(&in_lookup_hashtable[loop].lock);
+		INIT_LIST_HEAD(&in_lookup_hashtable[loop].list);
+		init_waitqueue_head(&in_lookup_hashtable[loop].wait);
+	}
+
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
 		return;
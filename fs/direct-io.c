@@ -126,10 +126,12 @@ struct dio {
 	spinlock_t bio_lock;		/* protects BIO fields below */
 	int page_errors;		/* errno from get_user_pages() */
 	int is_async;			/* is IO async ? */
+	int kernel_pages;		/* iovec maps pinned kernel pages */
 	int io_error;			/* IO error in completion path */
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct request_queue *poll_queue; /* spin here instead of sleeping */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -153,6 +155,27 @@ static inline unsigned dio_pages_present(struct dio_submit *sdio)
 	return sdio->tail - sdio->head;
 }
 
+/*
+ * A caller that marked its kiocb with kiocbSetKernelPages(), like the
+ * loop driver, passes kernel mappings of pages it has pinned already.
+ */
+static int dio_get_kernel_pages(unsigned long start, int nr_pages,
+				struct page **pages)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		void *addr = (void *)(start + i * PAGE_SIZE);
+
+		if (is_vmalloc_addr(addr))
+			pages[i] = vmalloc_to_page(addr);
+		else
+			pages[i] = kmap_to_page(addr);
+		page_cache_get(pages[i]);
+	}
+	return nr_pages;
+}
+
 /*
  * Go grab and pin some userspace pages.   Typically we'll get 64 at a time.
  */
@@ -162,11 +185,15 @@ static inline int dio_refill_pages(struct dio *dio, struct dio_submit *sdio)
 	int nr_pages;
 
 	nr_pages = min(sdio->total_pages - sdio->curr_page, DIO_PAGES);
-	ret = get_user_pages_fast(
-		sdio->curr_user_address,		/* Where from? */
-		nr_pages,			/* How many pages? */
-		dio->rw == READ,		/* Write to memory? */
-		&dio->pages[0]);		/* Put results here */
+	if (dio->kernel_pages)
+		ret = dio_get_kernel_pages(sdio->curr_user_address,
+					   nr_pages, &dio->pages[0]);
+	else
+		ret = get_user_pages_fast(
+			sdio->curr_user_address,	/* Where from? */
+			nr_pages,			/* How many pages? */
+			dio->rw == READ,		/* Write to memory? */
+			&dio->pages[0]);		/* Put results here */
 
 	if (ret < 0 && sdio->blocks_available && (dio->rw & WRITE)) {
 		struct page *page = ZERO_PAGE(0);
@@ -376,7 +403,7 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	dio->refcount++;
 	spin_unlock_irqrestore(&dio->bio_lock, flags);
 
-	if (dio->is_async && dio->rw == READ)
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages)
 		bio_set_pages_dirty(bio);
 
 	if (sdio->submit_io)
@@ -409,6 +436,7 @@ static struct bio *dio_await_one(struct dio *dio)
 {
 	unsigned long flags;
 	struct bio *bio = NULL;
+	u64 poll_start = 0;
 
 	spin_lock_irqsave(&dio->bio_lock, flags);
 
@@ -422,7 +450,9 @@ static struct bio *dio_await_one(struct dio *dio)
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
+		if (!dio->poll_queue ||
+		    !blk_poll(dio->poll_queue, &poll_start))
+			io_schedule();
 		/* wake up sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
@@ -447,13 +477,15 @@ static int dio_bio_complete(struct dio *dio, struct bio *bio)
 	if (!uptodate)
 		dio->io_error = -EIO;
 
-	if (dio->is_async && dio->rw == READ) {
+	if (dio->is_async && dio->rw == READ && !dio->kernel_pages) {
 		bio_check_pages_dirty(bio);	/* transfers ownership */
 	} else {
 		for (page_no = 0; page_no < bio->bi_vcnt; page_no++) {
 			struct page *page = bvec[page_no].bv_page;
 
-			if (dio->rw == READ && !PageCompound(page))
+			/* Kernel pages are the caller's to dirty, or lock */
+			if (dio->rw == READ && !PageCompound(page) &&
+			    !dio->kernel_pages)
 				set_page_dirty_lock(page);
 			page_cache_release(page);
 		}
@@ -1143,6 +1175,14 @@ do_blockdev_direct_IO(int rw, struct kiocb *iocb, struct inode *inode,
 	 */
 	dio->is_async = !is_sync_kiocb(iocb) && !((rw & WRITE) &&
 		(end > i_size_read(inode)));
+	dio->kernel_pages = kiocbIsKernelPages(iocb);
+
+	/*
+	 * Someone is waiting for synchronous I/O right now, let them spin
+	 * on the device if the queue has polling enabled.
+	 */
+	if (is_sync_kiocb(iocb) && bdev && blk_queue_poll(bdev_get_queue(bdev)))
+		dio->poll_queue = bdev_get_queue(bdev);
 
 	retval = 0;
 
@@ -34,6 +34,8 @@
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
 #include <linux/device.h>
+#include <linux/llist.h>
+#include <linux/hrtimer.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/mman.h>
@@ -48,11 +50,14 @@
  * 3) ep->lock (spinlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * The poll callback, that might be triggered from a wake_up() that
+ * in turn might be called from IRQ context, takes none of them: it
+ * pushes the item on the lockless ep->rdllhead and wakes up ep->wq,
+ * whose own lock serializes the waiters in ep_poll(). Items are
+ * moved from ep->rdllhead onto ep->rdllist with both "ep->mtx" and
+ * "ep->lock" held, and ep->lock (a spinlock) protects ep->rdllist
+ * against the event checks of ep_poll(), which run without "ep->mtx".
+ * During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -88,14 +93,19 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Events that may be combined with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLERR | POLLHUP | \
+				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
-#define EP_UNACTIVE_PTR ((void *) -1L)
+/* Longest time a batched wakeup can be held back, in microseconds */
+#define EP_MAX_BATCH_USECS USEC_PER_SEC
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
@@ -134,11 +144,11 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
-	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
-	 */
-	struct epitem *next;
+	/* Lockless list node used to queue this item on "struct eventpoll"->rdllhead */
+	struct llist_node rdllnode;
+
+	/* EPI_QUEUED is set while the item is on "struct eventpoll"->rdllhead */
+	unsigned long state;
 
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
@@ -192,11 +202,20 @@ struct eventpoll {
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transferring ready events to userspace w/out
-	 * holding ->lock.
+	 * Lockless list the poll callback queues ready items on. They are
+	 * moved onto rdllist by ep_drain_rdllhead().
 	 */
-	struct epitem *ovflist;
+	struct llist_head rdllhead;
+
+	/*
+	 * Wakeup batching: when batch_events is non zero, the wakeups of
+	 * the poll callback are held back until batch_events items have
+	 * been queued, or batch_usecs after the first of them.
+	 */
+	unsigned int batch_events;
+	unsigned int batch_usecs;
+	atomic_t batch_pending;
+	struct hrtimer batch_timer;
 
 	/* wakeup_source used when ep_scan_ready_list is running */
 	struct wakeup_source *ws;
@@ -211,6 +230,9 @@ struct eventpoll {
 	struct list_head visited_list_link;
 };
 
+/* Bits in "struct epitem"->state */
+#define EPI_QUEUED	0
+
 /* Wait structure used by the poll hooks */
 struct eppoll_entry {
 	/* List header used to link this structure to the "struct epitem" */
@@ -366,7 +388,7 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) || !llist_empty(&ep->rdllhead);
 }
 
 /**
@@ -503,6 +525,63 @@ static void ep_poll_safewake(wait_queue_head_t *wq)
 	put_cpu();
 }
 
+static void ep_batch_wake(struct eventpoll *ep)
+{
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&ep->poll_wait);
+}
+
+static enum hrtimer_restart ep_batch_timer_fn(struct hrtimer *timer)
+{
+	struct eventpoll *ep = container_of(timer, struct eventpoll,
+					    batch_timer);
+
+	atomic_set(&ep->batch_pending, 0);
+	ep_batch_wake(ep);
+
+	return HRTIMER_NORESTART;
+}
+
+/**
+ * ep_batch_defer - Accounts a newly queued item against the wakeup batch.
+ *
+ * @ep: Pointer to the eventpoll context.
+ *
+ * Returns: Returns true if the wakeup for this item has to be held back,
+ *          either for more items to be queued, or for the batch timer,
+ *          which this function arms for the first item of a batch.
+ */
+static bool ep_batch_defer(struct eventpoll *ep)
+{
+	unsigned int batch_events = ACCESS_ONCE(ep->batch_events);
+	int pending;
+
+	if (!batch_events)
+		return false;
+
+	pending = atomic_inc_return(&ep->batch_pending);
+	if (pending >= batch_events) {
+		/*
+		 * Cancel before resetting the count: an item counted after
+		 * the reset then arms a timer that no one cancels under it.
+		 */
+		hrtimer_try_to_cancel(&ep->batch_timer);
+		atomic_set(&ep->batch_pending, 0);
+		return false;
+	}
+
+	if (pending == 1) {
+		smp_rmb();
+		hrtimer_start(&ep->batch_timer,
+			      ns_to_ktime((u64)ep->batch_usecs * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+
+	return true;
+}
+
 static void ep_remove_wait_queue(struct eppoll_entry *pwq)
 {
 	wait_queue_head_t *whead;
@@ -534,6 +613,45 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
 	}
 }
 
+/**
+ * ep_drain_rdllhead - Moves the items queued by the poll callback onto the
+ *                     ready list, in the order they were queued.
+ *
+ * @ep: Pointer to the epoll private data structure.
+ *
+ * Must be called with "mtx" and "ep->lock" held. Items that are already
+ * linked, either on the ready list or on the private list of a running
+ * ep_scan_ready_list(), are left where they are.
+ */
+static void ep_drain_rdllhead(struct eventpoll *ep)
+{
+	struct llist_node *node, *next, *first = NULL;
+	struct epitem *epi;
+
+	/* llist_del_all() returns the newest item first: reverse the chain */
+	node = llist_del_all(&ep->rdllhead);
+	while (node) {
+		next = node->next;
+		node->next = first;
+		first = node;
+		node = next;
+	}
+
+	for (node = first; node; node = next) {
+		next = node->next;
+		epi = llist_entry(node, struct epitem, rdllnode);
+
+		/* From here on the poll callback may queue the item again */
+		smp_mb__before_clear_bit();
+		clear_bit(EPI_QUEUED, &epi->state);
+
+		if (!ep_is_linked(&epi->rdllink)) {
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+			__pm_stay_awake(epi->ws);
+		}
+	}
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -554,7 +672,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 {
 	int error, pwake = 0;
 	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -565,15 +682,14 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. The poll callback never queues directly on
+	 * ep->rdllist, and ep->rdllhead is only drained with "mtx"
+	 * held, so the "sproc" callback is able to re-queue items on
+	 * ep->rdllist in a lockless way.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_drain_rdllhead(ep);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
 	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/*
@@ -583,35 +699,25 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 	spin_lock_irqsave(&ep->lock, flags);
 	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
+	 * ep->ws covers the items the poll callback queued on ep->rdllhead,
+	 * so it has to be relaxed before they are drained, each of them
+	 * then being covered by its own epi->ws.
 	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			__pm_stay_awake(epi->ws);
-		}
-	}
+	__pm_relax(ep->ws);
+
 	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
+	 * During the time we spent inside the "sproc" callback, some
+	 * other events might have been queued by the poll callback.
+	 * We re-insert them inside the main ready-list here. Those that
+	 * the "txlist" still contains are skipped by the drain, and the
+	 * list_splice() below takes care of them.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_drain_rdllhead(ep);
 
 	/*
 	 * Quickly re-inject items left on "txlist".
 	 */
 	list_splice(&txlist, &ep->rdllist);
-	__pm_relax(ep->ws);
 
 	if (!list_empty(&ep->rdllist)) {
 		/*
@@ -619,7 +725,7 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 		 * the ->poll() wait list (delayed after we release the lock).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -644,12 +750,9 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	struct file *file = epi->ffd.file;
 
 	/*
-	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * Removes poll wait queue hooks. Once this is done, the poll callback
+	 * can no longer queue the item on ep->rdllhead: it runs holding the
+	 * wait queue head lock, which unregistering the wait queue takes.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -662,6 +765,8 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 	rb_erase(&epi->rbn, &ep->rbr);
 
 	spin_lock_irqsave(&ep->lock, flags);
+	/* The item may still sit on ep->rdllhead */
+	ep_drain_rdllhead(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -716,6 +821,7 @@ static void ep_free(struct eventpoll *ep)
 	}
 
 	mutex_unlock(&epmutex);
+	hrtimer_cancel(&ep->batch_timer);
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
@@ -783,10 +889,51 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	return pollflags != -1 ? pollflags : 0;
 }
 
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct eventpoll *ep = file->private_data;
+	void __user *uarg = (void __user *) arg;
+	struct epoll_batch batch;
+
+	switch (cmd) {
+	case EPIOCSBATCH:
+		if (copy_from_user(&batch, uarg, sizeof(batch)))
+			return -EFAULT;
+		if (batch.min_events > 1 &&
+		    (!batch.max_usecs || batch.max_usecs > EP_MAX_BATCH_USECS))
+			return -EINVAL;
+
+		mutex_lock(&ep->mtx);
+		ep->batch_usecs = batch.max_usecs;
+		/* ep_batch_defer() reads batch_usecs once it sees batch_events */
+		smp_wmb();
+		ep->batch_events = batch.min_events > 1 ? batch.min_events : 0;
+		mutex_unlock(&ep->mtx);
+
+		/* Deliver the wakeups held back under the previous setting */
+		hrtimer_cancel(&ep->batch_timer);
+		atomic_set(&ep->batch_pending, 0);
+		ep_batch_wake(ep);
+		return 0;
+	case EPIOCGBATCH:
+		mutex_lock(&ep->mtx);
+		batch.min_events = ep->batch_events;
+		batch.max_usecs = ep->batch_events ? ep->batch_usecs : 0;
+		mutex_unlock(&ep->mtx);
+
+		return copy_to_user(uarg, &batch, sizeof(batch)) ? -EFAULT : 0;
+	}
+
+	return -ENOTTY;
+}
+
 /* File callbacks that implement the eventpoll file behaviour */
 static const struct file_operations eventpoll_fops = {
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+	.compat_ioctl	= ep_eventpoll_ioctl,
 	.llseek		= noop_llseek,
 };
 
@@ -846,8 +993,10 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
+	init_llist_head(&ep->rdllhead);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	hrtimer_init(&ep->batch_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ep->batch_timer.function = ep_batch_timer_fn;
 	ep->user = user;
 
 	*pep = ep;
@@ -895,24 +1044,18 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
+	int pwake = 0, ewake = 0;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
 	if ((unsigned long)key & POLLFREE) {
-		ep_pwq_from_wait(wait)->whead = NULL;
 		/*
-		 * whead = NULL above can race with ep_remove_wait_queue()
-		 * which can do another remove_wait_queue() after us, so we
-		 * can't use __remove_wait_queue(). whead->lock is held by
-		 * the caller.
+		 * whead->lock is held by the caller. The whead pointer itself
+		 * is only cleared once we are done with the item, see below.
 		 */
 		list_del_init(&wait->task_list);
 	}
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -920,7 +1063,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -929,53 +1072,64 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are transferring events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happen during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Queue the item on ep->rdllhead, unless it is queued there already.
+	 * No lock is needed for that, the item is moved to the ready list
+	 * later on, by whoever collects the events. Activate ep->ws before
+	 * the item becomes visible, epi->ws is only activated at that time.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-			if (epi->ws) {
-				/*
-				 * Activate ep->ws since epi->ws may get
-				 * deactivated at any time.
-				 */
-				__pm_stay_awake(ep->ws);
-			}
+	if (!test_and_set_bit(EPI_QUEUED, &epi->state)) {
+		if (epi->ws)
+			__pm_stay_awake(ep->ws);
+		llist_add(&epi->rdllnode, &ep->rdllhead);
 
+		if (ep_batch_defer(ep)) {
+			ewake = waitqueue_active(&ep->wq);
+			goto out;
 		}
-		goto out_unlock;
-	}
-
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		__pm_stay_awake(epi->ws);
+	} else if (ACCESS_ONCE(ep->batch_events)) {
+		/* The batch this item belongs to will do the wakeup */
+		ewake = waitqueue_active(&ep->wq);
+		goto out;
 	}
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. llist_add() implies a full barrier, ordering the queueing
+	 * of the item against the checks for waiters.
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+	if (waitqueue_active(&ep->wq)) {
+		ewake = 1;
+		wake_up(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
+out:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
-	return 1;
+	if ((unsigned long)key & POLLFREE) {
+		/*
+		 * Once whead is cleared ep_remove_wait_queue() no longer
+		 * takes whead->lock, and nothing keeps the item alive: make
+		 * sure every access to it is done by then.
+		 */
+		smp_mb();
+		ACCESS_ONCE(ep_pwq_from_wait(wait)->whead) = NULL;
+	}
+
+	/*
+	 * An EPOLLEXCLUSIVE item only counts as an exclusive wakeup if it
+	 * had a waiter to wake, so that the wakeup can go on to another
+	 * epoll set waiting on the same queue otherwise.
+	 */
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -992,7 +1146,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1165,7 +1322,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
 	epi->nwait = 0;
-	epi->next = EP_UNACTIVE_PTR;
+	epi->state = 0;
 	if (epi->event.events & EPOLLWAKEUP) {
 		error = ep_create_wakeup_source(epi);
 		if (error)
@@ -1223,7 +1380,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -1251,11 +1408,11 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and queued the item on ep->rdllhead. Draining
+	 * it is fine, since ep_insert() is called with "mtx" held.
 	 */
 	spin_lock_irqsave(&ep->lock, flags);
+	ep_drain_rdllhead(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
@@ -1313,7 +1470,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
+				wake_up(&ep->wq);
 			if (waitqueue_active(&ep->poll_wait))
 				pwake++;
 		}
@@ -1393,7 +1550,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback only queues on ep->rdllhead.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 				__pm_stay_awake(epi->ws);
@@ -1464,12 +1621,16 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		 * caller specified a non blocking operation.
 		 */
 		timed_out = 1;
-		spin_lock_irqsave(&ep->lock, flags);
+		spin_lock_irqsave(&ep->wq.lock, flags);
 		goto check_events;
 	}
 
 fetch_events:
-	spin_lock_irqsave(&ep->lock, flags);
+	/*
+	 * The poll callback does not take "ep->lock", it wakes up ep->wq,
+	 * so the wait queue lock is what serializes against it here.
+	 */
+	spin_lock_irqsave(&ep->wq.lock, flags);
 
 	if (!ep_events_available(ep)) {
 		/*
@@ -1494,11 +1655,11 @@ fetch_events:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
+			spin_unlock_irqrestore(&ep->wq.lock, flags);
 			if (!schedule_hrtimeout_range(to, slack, HRTIMER_MODE_ABS))
 				timed_out = 1;
 
-			spin_lock_irqsave(&ep->lock, flags);
+			spin_lock_irqsave(&ep->wq.lock, flags);
 		}
 		__remove_wait_queue(&ep->wq, &wait);
 
@@ -1508,7 +1669,7 @@ check_events:
 	/* Is it worth to try to dig for events ? */
 	eavail = ep_events_available(ep);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
+	spin_unlock_irqrestore(&ep->wq.lock, flags);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1713,6 +1874,18 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if ((epds.events & EPOLLWAKEUP) && !capable(CAP_BLOCK_SUSPEND))
 		epds.events &= ~EPOLLWAKEUP;
 
+	/*
+	 * EPOLLEXCLUSIVE can only be set when the item is added, and not
+	 * on epoll files, whose wakeups go through ep_poll_safewake(). Nor
+	 * does it make sense together with EPOLLONESHOT.
+	 */
+	error = -EINVAL;
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD || is_file_epoll(tfile) ||
+		    (epds.events & ~EPOLLEXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * We have to check that the file structure underneath the file descriptor
 	 * the user passed to us _is_ an eventpoll file. And also we do not permit
@@ -1782,6 +1955,9 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
+			/* The wait queue entries cannot be made non-exclusive */
+			if (epi->event.events & EPOLLEXCLUSIVE)
+				break;
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
 		} else
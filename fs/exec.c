@@ -55,6 +55,7 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/oom.h>
 #include <linux/compat.h>
+#include <linux/rseq.h>
 
 #include <asm/uaccess.h>
 #include <asm/mmu_context.h>
@@ -1557,6 +1558,7 @@ static int do_execve_common(const char *filename,
 	/* execve succeeded */
 	current->fs->in_exec = 0;
 	current->in_execve = 0;
+	rseq_execve(current);
 	acct_update_integrals(current);
 	free_bprm(bprm);
 	if (displaced)
@@ -0,0 +1,498 @@
+/*
+ *  linux/fs/ext4/extent_status.c
+ *
+ * Keep an rbtree per inode of the extents we know the status of, so that
+ * block lookups, delayed allocation accounting, fiemap and
+ * SEEK_DATA/SEEK_HOLE do not have to walk the on-disk extent tree or scan
+ * the page cache.
+ *
+ * Written and unwritten extents are only a cache of the extent tree: they
+ * are filled in by lookups, dropped whenever the mapping of a range
+ * changes and may be reclaimed by the shrinker at any time.  Delayed
+ * extents are the only record of which blocks have been reserved but not
+ * yet allocated, so they stay until the blocks are allocated or the range
+ * is truncated, and are never reclaimed.
+ *
+ * The tree is protected by i_es_lock.  Extents never overlap and
+ * adjacent extents of the same status are merged.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/list_lru.h>
+#include "ext4.h"
+#include "extent_status.h"
+
+static struct kmem_cache *ext4_es_cachep;
+
+int __init ext4_init_es(void)
+{
+	ext4_es_cachep = KMEM_CACHE(extent_status, SLAB_RECLAIM_ACCOUNT);
+	if (ext4_es_cachep == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void ext4_exit_es(void)
+{
+	if (ext4_es_cachep)
+		kmem_cache_destroy(ext4_es_cachep);
+}
+
+void ext4_es_init_tree(struct ext4_es_tree *tree)
+{
+	tree->root = RB_ROOT;
+	tree->cache_es = NULL;
+}
+
+static inline ext4_lblk_t ext4_es_end(struct extent_status *es)
+{
+	BUG_ON(es->es_lblk + es->es_len < es->es_lblk);
+	return es->es_lblk + es->es_len - 1;
+}
+
+static inline struct extent_status *ext4_es_next(struct extent_status *es)
+{
+	struct rb_node *node = rb_next(&es->rb_node);
+
+	return node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+}
+
+/*
+ * Return the extent covering @lblk, or the first one after it if @lblk
+ * is not covered, or NULL if there is neither.
+ */
+static struct extent_status *__es_tree_search(struct rb_root *root,
+					      ext4_lblk_t lblk)
+{
+	struct rb_node *node = root->rb_node;
+	struct extent_status *es = NULL;
+
+	while (node) {
+		es = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es->es_lblk)
+			node = node->rb_left;
+		else if (lblk > ext4_es_end(es))
+			node = node->rb_right;
+		else
+			return es;
+	}
+
+	if (es && lblk > ext4_es_end(es))
+		es = ext4_es_next(es);
+	return es;
+}
+
+/*
+ * Only written and unwritten extents count towards the shrinker; an inode
+ * sits on the lru of its superblock while it has any of them.
+ */
+static struct extent_status *
+ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
+		     ext4_fsblk_t pblk)
+{
+	struct extent_status *es;
+
+	es = kmem_cache_alloc(ext4_es_cachep, GFP_ATOMIC | __GFP_NOWARN);
+	if (es == NULL)
+		return NULL;
+	es->es_lblk = lblk;
+	es->es_len = len;
+	es->es_pblk = pblk;
+
+	if (!ext4_es_is_delayed(es)) {
+		EXT4_I(inode)->i_es_lru_nr++;
+		percpu_counter_inc(&EXT4_SB(inode->i_sb)->s_extent_cache_cnt);
+	}
+	return es;
+}
+
+static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
+{
+	if (!ext4_es_is_delayed(es)) {
+		BUG_ON(EXT4_I(inode)->i_es_lru_nr == 0);
+		EXT4_I(inode)->i_es_lru_nr--;
+		percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_extent_cache_cnt);
+	}
+	kmem_cache_free(ext4_es_cachep, es);
+}
+
+/* Can @es2 be appended to @es1? */
+static int ext4_es_can_merge(struct extent_status *es1,
+			     struct extent_status *es2)
+{
+	if (ext4_es_status(es1) != ext4_es_status(es2))
+		return 0;
+	if ((__u64) es1->es_len + es2->es_len > EXT_MAX_BLOCKS)
+		return 0;
+	if (es1->es_lblk + es1->es_len != es2->es_lblk)
+		return 0;
+	if (!ext4_es_is_delayed(es1) &&
+	    ext4_es_pblock(es1) + es1->es_len != ext4_es_pblock(es2))
+		return 0;
+	return 1;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_left(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es1;
+	struct rb_node *node;
+
+	node = rb_prev(&es->rb_node);
+	if (!node)
+		return es;
+
+	es1 = rb_entry(node, struct extent_status, rb_node);
+	if (ext4_es_can_merge(es1, es)) {
+		es1->es_len += es->es_len;
+		rb_erase(&es->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es);
+		es = es1;
+	}
+	return es;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_right(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es1;
+
+	es1 = ext4_es_next(es);
+	if (es1 && ext4_es_can_merge(es, es1)) {
+		es->es_len += es1->es_len;
+		rb_erase(&es1->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es1);
+	}
+	return es;
+}
+
+/*
+ * Insert @newes, whose range must not overlap anything in the tree.  The
+ * neighbours of the new range are both on the search path, so merging
+ * only has to look at the nodes we pass on the way down.
+ */
+static int __es_insert_extent(struct inode *inode, struct extent_status *newes)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct rb_node **p = &tree->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct extent_status *es;
+
+	while (*p) {
+		parent = *p;
+		es = rb_entry(parent, struct extent_status, rb_node);
+
+		if (newes->es_lblk < es->es_lblk) {
+			if (ext4_es_can_merge(newes, es)) {
+				es->es_lblk = newes->es_lblk;
+				es->es_len += newes->es_len;
+				es->es_pblk = newes->es_pblk;
+				es = ext4_es_try_to_merge_left(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_left;
+		} else if (newes->es_lblk > ext4_es_end(es)) {
+			if (ext4_es_can_merge(es, newes)) {
+				es->es_len += newes->es_len;
+				es = ext4_es_try_to_merge_right(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_right;
+		} else {
+			BUG();
+			return -EINVAL;
+		}
+	}
+
+	es = ext4_es_alloc_extent(inode, newes->es_lblk, newes->es_len,
+				  newes->es_pblk);
+	if (!es)
+		return -ENOMEM;
+	rb_link_node(&es->rb_node, parent, p);
+	rb_insert_color(&es->rb_node, &tree->root);
+
+out:
+	tree->cache_es = es;
+	return 0;
+}
+
+/*
+ * Drop [lblk, end] from the tree, trimming or splitting the extents at
+ * either edge.  If a split cannot allocate the second half it is simply
+ * lost: forgetting a cached mapping is always safe, and forgetting a
+ * delayed range only makes us report less delalloc than there is.
+ */
+static void __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			       ext4_lblk_t end)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es, *next;
+	struct extent_status newes;
+	ext4_lblk_t len1, len2;
+	ext4_fsblk_t block;
+
+	es = __es_tree_search(&tree->root, lblk);
+	if (!es || es->es_lblk > end)
+		return;
+
+	tree->cache_es = NULL;
+
+	len1 = lblk > es->es_lblk ? lblk - es->es_lblk : 0;
+	len2 = ext4_es_end(es) > end ? ext4_es_end(es) - end : 0;
+
+	if (len2) {
+		newes.es_lblk = end + 1;
+		newes.es_len = len2;
+		newes.es_pblk = es->es_pblk;
+		if (!ext4_es_is_delayed(es)) {
+			block = ext4_es_pblock(es) + end + 1 - es->es_lblk;
+			ext4_es_store_pblock(&newes, block);
+		}
+		if (len1) {
+			es->es_len = len1;
+			__es_insert_extent(inode, &newes);
+		} else {
+			es->es_lblk = newes.es_lblk;
+			es->es_len = newes.es_len;
+			es->es_pblk = newes.es_pblk;
+		}
+		return;
+	}
+
+	if (len1) {
+		es->es_len = len1;
+		es = ext4_es_next(es);
+	}
+
+	while (es && ext4_es_end(es) <= end) {
+		next = ext4_es_next(es);
+		rb_erase(&es->rb_node, &tree->root);
+		ext4_es_free_extent(inode, es);
+		es = next;
+	}
+
+	if (es && es->es_lblk <= end) {
+		len2 = ext4_es_end(es) - end;
+		if (!ext4_es_is_delayed(es)) {
+			block = ext4_es_pblock(es) + end + 1 - es->es_lblk;
+			ext4_es_store_pblock(es, block);
+		}
+		es->es_lblk = end + 1;
+		es->es_len = len2;
+	}
+}
+
+/*
+ * Put the inode on the lru once it has something the shrinker can free.
+ * Called with i_es_lock held for writing, which is what serialises the
+ * lru against ext4_es_lru_isolate().
+ */
+static void ext4_es_lru_add(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	if (ei->i_es_lru_nr && list_empty(&ei->i_es_lru))
+		list_lru_add(&EXT4_SB(inode->i_sb)->s_es_lru, &ei->i_es_lru);
+}
+
+/*
+ * ext4_es_insert_extent() records that [lblk, lblk + len) has @status and,
+ * unless it is delayed, is mapped from @pblk.  Whatever the tree knew
+ * about the range before is replaced.
+ */
+int ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
+			  ext4_lblk_t len, ext4_fsblk_t pblk,
+			  unsigned long long status)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status newes;
+	ext4_lblk_t end = lblk + len - 1;
+	int err;
+
+	if (len == 0)
+		return 0;
+	BUG_ON(end < lblk);
+
+	newes.es_lblk = lblk;
+	newes.es_len = len;
+	newes.es_pblk = status & EXTENT_STATUS_FLAGS;
+	if (!(status & EXTENT_STATUS_DELAYED))
+		ext4_es_store_pblock(&newes, pblk);
+
+	write_lock(&ei->i_es_lock);
+	__es_remove_extent(inode, lblk, end);
+	err = __es_insert_extent(inode, &newes);
+	ext4_es_lru_add(inode);
+	write_unlock(&ei->i_es_lock);
+
+	return err;
+}
+
+/*
+ * ext4_es_remove_extent() forgets everything about [lblk, lblk + len).
+ * It has to be called whenever the mapping of the range changes.
+ */
+void ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			   ext4_lblk_t len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t end;
+
+	if (len == 0)
+		return;
+	end = lblk + len - 1;
+	if (end < lblk)
+		end = EXT_MAX_BLOCKS - 1;
+
+	write_lock(&ei->i_es_lock);
+	__es_remove_extent(inode, lblk, end);
+	write_unlock(&ei->i_es_lock);
+}
+
+/*
+ * ext4_es_lookup_extent() copies the extent covering @lblk into @es.
+ * Returns 1 if there is one and 0 otherwise.
+ */
+int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
+			  struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es1;
+	int found = 0;
+
+	read_lock(&ei->i_es_lock);
+	es1 = tree->cache_es;
+	if (!es1 || !in_range(lblk, es1->es_lblk, es1->es_len))
+		es1 = __es_tree_search(&tree->root, lblk);
+	if (es1 && in_range(lblk, es1->es_lblk, es1->es_len)) {
+		es->es_lblk = es1->es_lblk;
+		es->es_len = es1->es_len;
+		es->es_pblk = es1->es_pblk;
+		found = 1;
+	}
+	read_unlock(&ei->i_es_lock);
+
+	return found;
+}
+
+/*
+ * ext4_es_find_delayed_extent() copies into @es the first delayed extent
+ * which covers or follows @lblk.  es->es_len is 0 if there is none.
+ */
+void ext4_es_find_delayed_extent(struct inode *inode, ext4_lblk_t lblk,
+				 struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status *es1;
+
+	es->es_lblk = es->es_len = 0;
+	es->es_pblk = 0;
+
+	read_lock(&ei->i_es_lock);
+	es1 = __es_tree_search(&ei->i_es_tree.root, lblk);
+	while (es1 && !ext4_es_is_delayed(es1))
+		es1 = ext4_es_next(es1);
+	if (es1) {
+		es->es_lblk = es1->es_lblk;
+		es->es_len = es1->es_len;
+		es->es_pblk = es1->es_pblk;
+	}
+	read_unlock(&ei->i_es_lock);
+}
+
+/* Called when the inode is evicted, frees the whole tree. */
+void ext4_es_clear_inode(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+
+	write_lock(&ei->i_es_lock);
+	__es_remove_extent(inode, 0, EXT_MAX_BLOCKS - 1);
+	if (!list_empty(&ei->i_es_lru))
+		list_lru_del(&EXT4_SB(inode->i_sb)->s_es_lru, &ei->i_es_lru);
+	write_unlock(&ei->i_es_lock);
+}
+
+/*
+ * Free up to *nr_to_scan written and unwritten extents of the inode,
+ * oldest block range first.  Called with i_es_lock held for writing.
+ */
+static void __es_try_to_reclaim_extents(struct inode *inode, int *nr_to_scan)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es, *next;
+	struct rb_node *node;
+
+	tree->cache_es = NULL;
+	node = rb_first(&tree->root);
+	es = node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+	while (es && *nr_to_scan > 0) {
+		next = ext4_es_next(es);
+		if (!ext4_es_is_delayed(es)) {
+			rb_erase(&es->rb_node, &tree->root);
+			ext4_es_free_extent(inode, es);
+			(*nr_to_scan)--;
+		}
+		es = next;
+	}
+}
+
+/*
+ * Runs under the lru lock, which eviction needs to take the inode off the
+ * lru, so the inode cannot go away under us.  The lock order elsewhere is
+ * i_es_lock then the lru lock, hence the trylock.
+ */
+static enum lru_status ext4_es_lru_isolate(struct list_head *item,
+					   spinlock_t *lock, void *arg)
+{
+	struct ext4_inode_info *ei;
+	int *nr_to_scan = arg;
+	enum lru_status ret;
+
+	if (*nr_to_scan <= 0)
+		return LRU_SKIP;
+
+	ei = list_entry(item, struct ext4_inode_info, i_es_lru);
+	if (!write_trylock(&ei->i_es_lock))
+		return LRU_SKIP;
+
+	__es_try_to_reclaim_extents(&ei->vfs_inode, nr_to_scan);
+	if (ei->i_es_lru_nr == 0) {
+		list_del_init(item);
+		ret = LRU_REMOVED;
+	} else {
+		ret = LRU_ROTATE;
+	}
+	write_unlock(&ei->i_es_lock);
+	return ret;
+}
+
+static int ext4_es_shrink(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct ext4_sb_info *sbi = container_of(shrink, struct ext4_sb_info,
+						s_es_shrinker);
+	int nr_to_scan = sc->nr_to_scan;
+
+	if (nr_to_scan)
+		list_lru_walk(&sbi->s_es_lru, ext4_es_lru_isolate, &nr_to_scan,
+			      list_lru_count(&sbi->s_es_lru));
+
+	return percpu_counter_read_positive(&sbi->s_extent_cache_cnt);
+}
+
+void ext4_es_register_shrinker(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	sbi->s_es_shrinker.shrink = ext4_es_shrink;
+	sbi->s_es_shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sbi->s_es_shrinker);
+}
+
+void ext4_es_unregister_shrinker(struct super_block *sb)
+{
+	unregister_shrinker(&EXT4_SB(sb)->s_es_shrinker);
+}
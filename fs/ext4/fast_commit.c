@@ -0,0 +1,390 @@
+/*
+ * linux/fs/ext4/fast_commit.c
+ *
+ * Fast commits of fsynced inodes.
+ *
+ * A full jbd2 commit writes every metadata block the running transaction
+ * touched, plus a commit block, and waits for two cache flushes.  For an
+ * fsync of a file whose only changes are to its inode and its data that
+ * is a lot of IO: instead, the raw inode is logged as a record in a small
+ * area jbd2 sets aside at the end of the journal, with a single write.
+ * The transaction itself is committed later, as usual.
+ *
+ * On recovery, jbd2 replays the log and then hands the area to
+ * ext4_fc_replay(), which applies the records of the transaction that
+ * was running at the time of the crash.  A record holds the whole raw
+ * inode, so only inodes whose extent tree fits in the inode can be fast
+ * committed; replay marks the blocks it maps in use in the bitmaps.
+ *
+ * Anything else the transaction did to the filesystem is lost on a crash
+ * along with it, so operations whose effect a fast committed inode could
+ * depend on make the transaction, or the inode, ineligible: fsync then
+ * falls back to a full commit.
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd2.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/crc16.h>
+#include <linux/quotaops.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "ext4_extents.h"
+
+void ext4_fc_init(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	mutex_init(&sbi->s_fc_lock);
+	sbi->s_fc_valid = 0;
+	sbi->s_fc_bh = NULL;
+	/* the last transaction before the first one of this mount */
+	if (sbi->s_journal)
+		sbi->s_fc_ineligible_tid =
+			sbi->s_journal->j_transaction_sequence - 1;
+}
+
+void ext4_fc_release(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	brelse(sbi->s_fc_bh);
+	sbi->s_fc_bh = NULL;
+}
+
+/*
+ * Nothing changed in the transaction of @handle can be fast committed,
+ * typically because blocks were freed and replay could hand them out
+ * twice.
+ */
+void ext4_fc_mark_ineligible(handle_t *handle, struct super_block *sb)
+{
+	if (!ext4_handle_valid(handle))
+		return;
+	EXT4_SB(sb)->s_fc_ineligible_tid = handle->h_transaction->t_tid;
+}
+
+/*
+ * @inode can't be fast committed in the transaction of @handle, because
+ * it was changed in a way a record of its raw inode does not capture.
+ */
+void ext4_fc_mark_inode_ineligible(handle_t *handle, struct inode *inode)
+{
+	if (!ext4_handle_valid(handle))
+		return;
+	EXT4_I(inode)->i_fc_ineligible_tid = handle->h_transaction->t_tid;
+}
+
+static __le16 ext4_fc_csum(struct super_block *sb, struct ext4_fc_record *rec)
+{
+	struct ext4_fc_record hdr = *rec;
+	__u16 crc;
+
+	hdr.fc_checksum = 0;
+	crc = crc16(~0, EXT4_SB(sb)->s_es->s_uuid,
+		    sizeof(EXT4_SB(sb)->s_es->s_uuid));
+	crc = crc16(crc, (__u8 *)&hdr, sizeof(hdr));
+	crc = crc16(crc, (__u8 *)(rec + 1), le16_to_cpu(rec->fc_inode_size));
+	return cpu_to_le16(crc);
+}
+
+static int ext4_fc_eligible(struct inode *inode, tid_t commit_tid)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	if (tid_geq(sbi->s_fc_ineligible_tid, commit_tid) ||
+	    tid_geq(EXT4_I(inode)->i_fc_ineligible_tid, commit_tid))
+		return 0;
+	if (ext_depth(inode) != 0)
+		return 0;
+	return list_empty(&EXT4_I(inode)->i_orphan);
+}
+
+/* Is @tid the running transaction?  Called with updates locked or not. */
+static int ext4_fc_tid_running(journal_t *journal, tid_t tid)
+{
+	int ret;
+
+	read_lock(&journal->j_state_lock);
+	ret = journal->j_running_transaction &&
+	      journal->j_running_transaction->t_tid == tid;
+	read_unlock(&journal->j_state_lock);
+	return ret;
+}
+
+/*
+ * Append a record of @inode to the area, starting a new block if the
+ * current one is full.  Called with s_fc_lock held and updates locked,
+ * so that the raw inode is not changing under us.
+ */
+static int ext4_fc_add_record(struct inode *inode, tid_t tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned int isize = EXT4_INODE_SIZE(sb);
+	unsigned int len = sizeof(struct ext4_fc_record) + isize;
+	struct ext4_fc_record *rec;
+	struct ext4_iloc iloc;
+	int err;
+
+	if (sbi->s_fc_bh && sbi->s_fc_off + len > sb->s_blocksize) {
+		brelse(sbi->s_fc_bh);
+		sbi->s_fc_bh = NULL;
+		sbi->s_fc_blk++;
+	}
+	if (!sbi->s_fc_bh) {
+		err = jbd2_fc_get_buf(sbi->s_journal, sbi->s_fc_blk,
+				      &sbi->s_fc_bh);
+		if (err)
+			return err;
+		lock_buffer(sbi->s_fc_bh);
+		memset(sbi->s_fc_bh->b_data, 0, sb->s_blocksize);
+		set_buffer_uptodate(sbi->s_fc_bh);
+		unlock_buffer(sbi->s_fc_bh);
+		sbi->s_fc_off = 0;
+	}
+
+	err = ext4_get_inode_loc(inode, &iloc);
+	if (err)
+		return err;
+	rec = (struct ext4_fc_record *)(sbi->s_fc_bh->b_data + sbi->s_fc_off);
+	rec->fc_magic = cpu_to_le32(EXT4_FC_MAGIC);
+	rec->fc_tid = cpu_to_le32(tid);
+	rec->fc_ino = cpu_to_le32(inode->i_ino);
+	rec->fc_inode_size = cpu_to_le16(isize);
+	memcpy(rec + 1, ext4_raw_inode(&iloc), isize);
+	rec->fc_checksum = ext4_fc_csum(sb, rec);
+	brelse(iloc.bh);
+
+	sbi->s_fc_off += len;
+	sbi->s_fc_tid = tid;
+	sbi->s_fc_valid = 1;
+	return 0;
+}
+
+static int ext4_fc_write_block(struct super_block *sb)
+{
+	journal_t *journal = EXT4_SB(sb)->s_journal;
+	struct buffer_head *bh = EXT4_SB(sb)->s_fc_bh;
+	int op = WRITE_SYNC;
+
+	/* the data the inode maps must be stable before the record is */
+	if (journal->j_flags & JBD2_BARRIER) {
+		if (journal->j_fs_dev != journal->j_dev)
+			blkdev_issue_flush(journal->j_fs_dev, GFP_NOFS, NULL);
+		op = WRITE_FLUSH_FUA;
+	}
+
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = end_buffer_write_sync;
+	get_bh(bh);
+	submit_bh(op, bh);
+	wait_on_buffer(bh);
+	return buffer_uptodate(bh) ? 0 : -EIO;
+}
+
+/**
+ * ext4_fc_commit() - make an fsync of @inode durable without a commit
+ * @inode: inode being synced, with i_mutex held and its data written
+ * @commit_tid: transaction fsync would otherwise have to wait for
+ *
+ * Returns 0 if @inode was fast committed, or nonzero if the caller has to
+ * commit @commit_tid the usual way.
+ */
+int ext4_fc_commit(struct inode *inode, tid_t commit_tid)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	journal_t *journal = sbi->s_journal;
+	int err;
+
+	if (!test_opt(sb, JOURNAL_FAST_COMMIT) ||
+	    !JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		return 1;
+	if (!S_ISREG(inode->i_mode) ||
+	    !ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS) ||
+	    sb_any_quota_loaded(sb) ||
+	    EXT4_HAS_RO_COMPAT_FEATURE(sb, EXT4_FEATURE_RO_COMPAT_BIGALLOC))
+		return 1;
+	if (!ext4_fc_eligible(inode, commit_tid) ||
+	    !ext4_fc_tid_running(journal, commit_tid))
+		return 1;
+
+	mutex_lock(&sbi->s_fc_lock);
+	if (sbi->s_fc_valid && sbi->s_fc_tid != commit_tid) {
+		/* the records still in the area must not be needed anymore */
+		err = jbd2_log_wait_commit(journal, sbi->s_fc_tid);
+		if (err)
+			goto out;
+		brelse(sbi->s_fc_bh);
+		sbi->s_fc_bh = NULL;
+		sbi->s_fc_blk = 0;
+		sbi->s_fc_valid = 0;
+	}
+	jbd2_fc_begin(journal);
+
+	err = 1;
+	jbd2_journal_lock_updates(journal);
+	if (ext4_fc_tid_running(journal, commit_tid) &&
+	    ext4_fc_eligible(inode, commit_tid))
+		err = ext4_fc_add_record(inode, commit_tid);
+	jbd2_journal_unlock_updates(journal);
+	if (err)
+		goto out;
+
+	/*
+	 * Blocks allocated by writeback are submitted before its handle is
+	 * stopped, so anything the record maps is under IO by now.
+	 */
+	err = filemap_fdatawait(inode->i_mapping);
+	if (!err)
+		err = ext4_fc_write_block(sb);
+out:
+	mutex_unlock(&sbi->s_fc_lock);
+	return err;
+}
+
+/* Mark @len blocks from @pblk in use, if they were not already */
+static int ext4_fc_replay_blocks(struct super_block *sb, ext4_fsblk_t pblk,
+				 unsigned int len)
+{
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bitmap_bh, *gdp_bh;
+	ext4_group_t group;
+	ext4_grpblk_t off;
+	unsigned int i, n, newly;
+
+	while (len) {
+		ext4_get_group_no_and_offset(sb, pblk, &group, &off);
+		n = min_t(unsigned int, len, EXT4_BLOCKS_PER_GROUP(sb) - off);
+		gdp = ext4_get_group_desc(sb, group, &gdp_bh);
+		if (!gdp)
+			return -EIO;
+		bitmap_bh = ext4_read_block_bitmap(sb, group);
+		if (!bitmap_bh)
+			return -EIO;
+
+		ext4_lock_group(sb, group);
+		newly = 0;
+		for (i = 0; i < n; i++)
+			if (!ext4_test_and_set_bit(off + i, bitmap_bh->b_data))
+				newly++;
+		if (newly) {
+			if (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) {
+				gdp->bg_flags &=
+					cpu_to_le16(~EXT4_BG_BLOCK_UNINIT);
+				ext4_free_group_clusters_set(sb, gdp,
+					ext4_free_clusters_after_init(sb,
+								group, gdp));
+			}
+			ext4_free_group_clusters_set(sb, gdp,
+				ext4_free_group_clusters(sb, gdp) - newly);
+			ext4_block_bitmap_csum_set(sb, group, gdp, bitmap_bh,
+						   EXT4_BLOCKS_PER_GROUP(sb) / 8);
+			ext4_group_desc_csum_set(sb, group, gdp);
+		}
+		ext4_unlock_group(sb, group);
+
+		if (newly) {
+			mark_buffer_dirty(bitmap_bh);
+			mark_buffer_dirty(gdp_bh);
+		}
+		brelse(bitmap_bh);
+		pblk += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int ext4_fc_replay_inode(struct super_block *sb, unsigned long ino,
+				struct ext4_inode *raw_inode)
+{
+	struct ext4_extent_header *eh;
+	struct ext4_extent *ex;
+	struct ext4_group_desc *gdp;
+	struct buffer_head *bh;
+	unsigned long offset;
+	ext4_group_t group;
+	ext4_fsblk_t block, pblk;
+	unsigned int len;
+	int i, err;
+
+	group = (ino - 1) / EXT4_INODES_PER_GROUP(sb);
+	offset = ((ino - 1) % EXT4_INODES_PER_GROUP(sb)) * EXT4_INODE_SIZE(sb);
+	gdp = ext4_get_group_desc(sb, group, NULL);
+	if (!gdp)
+		return -EIO;
+	block = ext4_inode_table(sb, gdp) + offset / sb->s_blocksize;
+	bh = sb_bread(sb, block);
+	if (!bh)
+		return -EIO;
+	memcpy(bh->b_data + offset % sb->s_blocksize, raw_inode,
+	       EXT4_INODE_SIZE(sb));
+	mark_buffer_dirty(bh);
+	brelse(bh);
+
+	eh = (struct ext4_extent_header *)raw_inode->i_block;
+	if (eh->eh_magic != EXT4_EXT_MAGIC || eh->eh_depth != 0 ||
+	    le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max))
+		return -EIO;
+	ex = EXT_FIRST_EXTENT(eh);
+	for (i = 0; i < le16_to_cpu(eh->eh_entries); i++, ex++) {
+		pblk = ext4_ext_pblock(ex);
+		len = ext4_ext_get_actual_len(ex);
+		if (pblk < le32_to_cpu(EXT4_SB(sb)->s_es->s_first_data_block) ||
+		    pblk + len > ext4_blocks_count(EXT4_SB(sb)->s_es))
+			return -EIO;
+		err = ext4_fc_replay_blocks(sb, pblk, len);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/**
+ * ext4_fc_replay() - jbd2 fast commit replay callback
+ * @journal: journal being recovered
+ * @bh: block of the fast commit area
+ * @tid: transaction the records have to belong to
+ *
+ * Applies the records in @bh.  Replaying twice is harmless, so a crash
+ * during recovery just means doing it again.
+ */
+int ext4_fc_replay(journal_t *journal, struct buffer_head *bh, tid_t tid)
+{
+	struct super_block *sb = journal->j_private;
+	struct ext4_fc_record *rec;
+	unsigned int off = 0, isize, nr = 0;
+	unsigned long ino;
+	int err;
+
+	while (off + sizeof(*rec) <= bh->b_size) {
+		rec = (struct ext4_fc_record *)(bh->b_data + off);
+		if (rec->fc_magic != cpu_to_le32(EXT4_FC_MAGIC))
+			break;
+		ino = le32_to_cpu(rec->fc_ino);
+		isize = le16_to_cpu(rec->fc_inode_size);
+		/* a stale or torn record ends the area */
+		if (le32_to_cpu(rec->fc_tid) != tid ||
+		    isize != EXT4_INODE_SIZE(sb) ||
+		    off + sizeof(*rec) + isize > bh->b_size ||
+		    ino < EXT4_FIRST_INO(sb) ||
+		    ino > le32_to_cpu(EXT4_SB(sb)->s_es->s_inodes_count) ||
+		    rec->fc_checksum != ext4_fc_csum(sb, rec))
+			return 1;
+		err = ext4_fc_replay_inode(sb, ino,
+					   (struct ext4_inode *)(rec + 1));
+		if (err) {
+			ext4_msg(sb, KERN_ERR, "failed to replay fast commit "
+				 "of inode %lu: %d", ino, err);
+			return err;
+		}
+		nr++;
+		off += sizeof(*rec) + isize;
+	}
+	return nr ? 0 : 1;
+}
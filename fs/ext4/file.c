@@ -204,6 +204,45 @@ ext4_file_write(struct kiocb *iocb, const struct iovec *iov,
 	return ret;
 }
 
+#ifdef CONFIG_EXT4_FS_XIP
+/*
+ * xip_file_write() only updates i_size; carry an extending write over to
+ * the on-disk size as well.
+ */
+static ssize_t
+ext4_xip_file_write(struct file *filp, const char __user *buf, size_t len,
+		    loff_t *ppos)
+{
+	struct inode *inode = filp->f_mapping->host;
+	handle_t *handle;
+	ssize_t ret;
+	int err;
+
+	ret = xip_file_write(filp, buf, len, ppos);
+	if (ret <= 0)
+		return ret;
+
+	mutex_lock(&inode->i_mutex);
+	if (i_size_read(inode) > EXT4_I(inode)->i_disksize) {
+		handle = ext4_journal_start(inode, 1);
+		if (IS_ERR(handle)) {
+			ret = PTR_ERR(handle);
+			goto out;
+		}
+		ext4_update_i_disksize(inode, i_size_read(inode));
+		err = ext4_mark_inode_dirty(handle, inode);
+		if (IS_SYNC(inode) || (filp->f_flags & O_SYNC))
+			ext4_handle_sync(handle);
+		ext4_journal_stop(handle);
+		if (err)
+			ret = err;
+	}
+out:
+	mutex_unlock(&inode->i_mutex);
+	return ret;
+}
+#endif
+
 static const struct vm_operations_struct ext4_file_vm_ops = {
 	.fault		= filemap_fault,
 	.page_mkwrite   = ext4_page_mkwrite,
@@ -285,6 +324,94 @@ static int ext4_file_open(struct inode * inode, struct file * filp)
 	return dquot_file_open(inode, filp);
 }
 
+/*
+ * Find the first block in [lblk, end) which holds data, or which is a
+ * hole if @data is 0.  Blocks are data if they are mapped in the extent
+ * tree, written or not, or waiting for delayed allocation.  Each extent
+ * and each hole is looked at once, so this costs one lookup per extent
+ * rather than one per block.  Returns @end if there is no such block.
+ */
+static int ext4_seek_block(struct inode *inode, ext4_lblk_t lblk,
+			   ext4_lblk_t end, int data, ext4_lblk_t *found)
+{
+	struct ext4_map_blocks map;
+	struct extent_status es;
+	int ret;
+
+	while (lblk < end) {
+		map.m_lblk = lblk;
+		map.m_len = end - lblk;
+		ret = ext4_map_blocks(NULL, inode, &map, 0);
+		if (ret < 0)
+			return ret;
+		if (ret > 0) {
+			if (data)
+				break;
+			lblk += map.m_len;
+			continue;
+		}
+
+		/* a hole in the extent tree, unless it is delayed */
+		ext4_es_find_delayed_extent(inode, lblk, &es);
+		if (es.es_len && es.es_lblk <= lblk) {
+			if (data)
+				break;
+			lblk = es.es_lblk + es.es_len;
+			continue;
+		}
+		if (!data)
+			break;
+		if (es.es_len && es.es_lblk < lblk + map.m_len)
+			lblk = es.es_lblk;
+		else
+			lblk += map.m_len;
+	}
+
+	*found = min(lblk, end);
+	return 0;
+}
+
+/*
+ * SEEK_DATA and SEEK_HOLE for extent-mapped files.  i_mutex keeps the
+ * size and the delayed extents stable while we look.
+ */
+static loff_t ext4_seek_data_hole(struct file *file, loff_t offset,
+				  int origin, loff_t maxbytes)
+{
+	struct inode *inode = file->f_mapping->host;
+	unsigned int blkbits = inode->i_blkbits;
+	ext4_lblk_t end, found;
+	loff_t isize;
+	int ret;
+
+	mutex_lock(&inode->i_mutex);
+	isize = i_size_read(inode);
+	if (offset < 0 || offset >= isize) {
+		mutex_unlock(&inode->i_mutex);
+		return -ENXIO;
+	}
+
+	end = (isize + (1 << blkbits) - 1) >> blkbits;
+	ret = ext4_seek_block(inode, offset >> blkbits, end,
+			      origin == SEEK_DATA, &found);
+	mutex_unlock(&inode->i_mutex);
+	if (ret)
+		return ret;
+
+	if (found == end) {
+		/* past the last data there is the virtual hole at EOF */
+		if (origin == SEEK_DATA)
+			return -ENXIO;
+		offset = isize;
+	} else {
+		offset = max_t(loff_t, offset, (loff_t) found << blkbits);
+		offset = min(offset, isize);
+	}
+
+	return generic_file_llseek_size(file, offset, SEEK_SET,
+					maxbytes, isize);
+}
+
 /*
  * ext4_llseek() handles both block-mapped and extent-mapped maxbytes values
  * by calling generic_file_llseek_size() with the appropriate maxbytes
@@ -300,6 +427,10 @@ loff_t ext4_llseek(struct file *file, loff_t offset, int origin)
 	else
 		maxbytes = inode->i_sb->s_maxbytes;
 
+	if ((origin == SEEK_DATA || origin == SEEK_HOLE) &&
+	    ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+		return ext4_seek_data_hole(file, offset, origin, maxbytes);
+
 	return generic_file_llseek_size(file, offset, origin,
 					maxbytes, i_size_read(inode));
 }
@@ -323,6 +454,23 @@ const struct file_operations ext4_file_operations = {
 	.fallocate	= ext4_fallocate,
 };
 
+#ifdef CONFIG_EXT4_FS_XIP
+const struct file_operations ext4_xip_file_operations = {
+	.llseek		= ext4_llseek,
+	.read		= xip_file_read,
+	.write		= ext4_xip_file_write,
+	.unlocked_ioctl = ext4_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= ext4_compat_ioctl,
+#endif
+	.mmap		= xip_file_mmap,
+	.open		= ext4_file_open,
+	.release	= ext4_release_file,
+	.fsync		= ext4_sync_file,
+	.fallocate	= ext4_fallocate,
+};
+#endif
+
 const struct inode_operations ext4_file_inode_operations = {
 	.setattr	= ext4_setattr,
 	.getattr	= ext4_getattr,
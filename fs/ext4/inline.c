@@ -0,0 +1,290 @@
+/*
+ * linux/fs/ext4/inline.c
+ *
+ * Inline data: small regular files kept in the inode.
+ *
+ * On a filesystem with the inline_data feature, a new regular file may
+ * keep its contents in i_block, the 60 bytes that otherwise hold the
+ * extent tree root or the block map, instead of in a data block of its
+ * own.  A file written in small pieces never needs a data block, and
+ * reading it back costs no I/O beyond the inode table block.
+ *
+ * Such an inode has EXT4_INODE_INLINE_DATA set and EXT4_INODE_EXTENTS
+ * clear.  Its page cache page is filled from i_block by ->readpage and,
+ * as the inode itself is what gets journalled and written back, is never
+ * dirtied: ->write_end copies the new data into i_block instead.
+ *
+ * Newly created files start out with EXT4_STATE_MAY_INLINE_DATA.  The
+ * first write which fits goes inline; anything that allocates blocks
+ * first drops the state.  A write, truncate or mmap that needs more than
+ * i_block can hold converts the file to a normal one by writing the data
+ * back through the regular ->write_begin/->write_end path.
+ *
+ * The inline state only ever changes with page 0 locked, so holding that
+ * page lock keeps it stable for ->readpage and ->write_begin/->write_end.
+ */
+
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include "ext4_jbd2.h"
+#include "ext4.h"
+#include "ext4_extents.h"
+
+/*
+ * Fill page with the file contents from i_block.  Must be called with the
+ * page locked.
+ */
+static void ext4_fill_inline_page(struct inode *inode, struct page *page)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	size_t len = 0;
+	void *kaddr;
+
+	kaddr = kmap_atomic(page);
+	down_read(&ei->i_data_sem);
+	if (page->index == 0 && ext4_has_inline_data(inode)) {
+		len = min_t(size_t, i_size_read(inode),
+			    EXT4_MIN_INLINE_DATA_SIZE);
+		memcpy(kaddr, ei->i_data, len);
+	}
+	up_read(&ei->i_data_sem);
+	memset(kaddr + len, 0, PAGE_CACHE_SIZE - len);
+	kunmap_atomic(kaddr);
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+}
+
+int ext4_readpage_inline(struct inode *inode, struct page *page)
+{
+	ext4_fill_inline_page(inode, page);
+	unlock_page(page);
+	return 0;
+}
+
+/*
+ * Called first thing from ->write_begin.  Returns 1 with a journal handle
+ * started and page 0 locked in *pagep if the write is to go to i_block,
+ * 0 if it is to take the normal path (having converted the inline data if
+ * there was any), or a negative error.
+ */
+int ext4_try_to_write_inline_data(struct address_space *mapping,
+				  struct inode *inode, loff_t pos,
+				  unsigned len, unsigned flags,
+				  struct page **pagep)
+{
+	handle_t *handle;
+	struct page *page;
+
+	if (!ext4_may_write_inline(inode))
+		return 0;
+
+	if (pos + len > EXT4_MIN_INLINE_DATA_SIZE ||
+	    inode->i_size > EXT4_MIN_INLINE_DATA_SIZE)
+		return ext4_convert_inline_data(inode);
+
+	handle = ext4_journal_start(inode, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	flags |= AOP_FLAG_NOFS;
+	page = grab_cache_page_write_begin(mapping, 0, flags);
+	if (!page) {
+		ext4_journal_stop(handle);
+		return -ENOMEM;
+	}
+
+	/* ext4_page_mkwrite() may have converted the file meanwhile */
+	if (!ext4_may_write_inline(inode)) {
+		unlock_page(page);
+		page_cache_release(page);
+		ext4_journal_stop(handle);
+		return 0;
+	}
+
+	if (!PageUptodate(page))
+		ext4_fill_inline_page(inode, page);
+
+	*pagep = page;
+	return 1;
+}
+
+/*
+ * ->write_end for a write set up by ext4_try_to_write_inline_data(): copy
+ * the new data from the page into i_block and log the inode.
+ */
+int ext4_write_inline_data_end(struct inode *inode, loff_t pos, unsigned len,
+			       unsigned copied, struct page *page)
+{
+	handle_t *handle = ext4_journal_current_handle();
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	int ret = 0, ret2;
+	void *kaddr;
+
+	if (copied) {
+		down_write(&ei->i_data_sem);
+		if (!ext4_has_inline_data(inode)) {
+			/* first data: drop the empty extent tree root */
+			memset(ei->i_data, 0, sizeof(ei->i_data));
+			ext4_clear_inode_flag(inode, EXT4_INODE_EXTENTS);
+			ext4_set_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+			ext4_clear_inode_state(inode,
+					       EXT4_STATE_MAY_INLINE_DATA);
+		}
+		kaddr = kmap_atomic(page);
+		memcpy((void *)ei->i_data + pos, kaddr + pos, copied);
+		kunmap_atomic(kaddr);
+		if (pos + copied > inode->i_size) {
+			i_size_write(inode, pos + copied);
+			ei->i_disksize = pos + copied;
+		}
+		up_write(&ei->i_data_sem);
+	}
+	unlock_page(page);
+	page_cache_release(page);
+
+	if (copied) {
+		ret = ext4_mark_inode_dirty(handle, inode);
+		ext4_update_inode_fsync_trans(handle, inode, 1);
+	}
+
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+
+	return ret ? ret : copied;
+}
+
+/*
+ * Move the inline data, if any, out of i_block and into a data block, and
+ * stop new data from going inline.  Called with i_mutex held, or from
+ * ext4_page_mkwrite() with mmap_sem held.
+ *
+ * The data is written back through ->write_begin/->write_end, nested in
+ * the handle which clears the inline flag so that both happen in the same
+ * transaction.
+ */
+int ext4_convert_inline_data(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct page *page, *wpage;
+	handle_t *handle;
+	void *fsdata;
+	loff_t size = 0;
+	int ret, ret2;
+
+	if (!ext4_may_write_inline(inode))
+		return 0;
+
+	handle = ext4_journal_start(inode,
+				    ext4_writepage_trans_blocks(inode) + 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	page = find_or_create_page(mapping, 0,
+				   mapping_gfp_mask(mapping) & ~__GFP_FS);
+	if (!page) {
+		ext4_journal_stop(handle);
+		return -ENOMEM;
+	}
+
+	if (ext4_has_inline_data(inode) && !PageUptodate(page))
+		ext4_fill_inline_page(inode, page);
+
+	down_write(&ei->i_data_sem);
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+	if (ext4_has_inline_data(inode)) {
+		size = inode->i_size;
+		memset(ei->i_data, 0, sizeof(ei->i_data));
+		ext4_clear_inode_flag(inode, EXT4_INODE_INLINE_DATA);
+		if (EXT4_HAS_INCOMPAT_FEATURE(inode->i_sb,
+					      EXT4_FEATURE_INCOMPAT_EXTENTS)) {
+			ext4_set_inode_flag(inode, EXT4_INODE_EXTENTS);
+			ext4_ext_tree_init(handle, inode);
+		}
+	}
+	up_write(&ei->i_data_sem);
+	unlock_page(page);
+
+	ret = ext4_mark_inode_dirty(handle, inode);
+	if (!ret && size) {
+		ret = mapping->a_ops->write_begin(NULL, mapping, 0, size,
+						  AOP_FLAG_NOFS, &wpage,
+						  &fsdata);
+		if (!ret) {
+			ret = mapping->a_ops->write_end(NULL, mapping, 0, size,
+							size, wpage, fsdata);
+			if (ret >= 0)
+				ret = 0;
+		}
+	}
+	page_cache_release(page);
+
+	ret2 = ext4_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	return ret;
+}
+
+/*
+ * ext4_truncate() for an inode with inline data: the page cache has been
+ * truncated already, clear what is past the new size in i_block too.
+ */
+void ext4_inline_data_truncate(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	handle_t *handle;
+	loff_t size;
+
+	handle = ext4_journal_start(inode, 3);
+	if (IS_ERR(handle)) {
+		ext4_std_error(inode->i_sb, PTR_ERR(handle));
+		return;
+	}
+
+	down_write(&ei->i_data_sem);
+	size = inode->i_size;
+	if (size < EXT4_MIN_INLINE_DATA_SIZE)
+		memset((void *)ei->i_data + size, 0,
+		       EXT4_MIN_INLINE_DATA_SIZE - size);
+	ei->i_disksize = size;
+	up_write(&ei->i_data_sem);
+
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_inode_dirty(handle, inode);
+
+	/* The inode was put on the orphan list by ext4_setattr() */
+	if (inode->i_nlink)
+		ext4_orphan_del(handle, inode);
+
+	ext4_journal_stop(handle);
+}
+
+/* Report the inline data as a single extent located inside the inode */
+int ext4_inline_data_fiemap(struct inode *inode,
+			    struct fiemap_extent_info *fieinfo)
+{
+	struct ext4_iloc iloc;
+	__u64 physical;
+	int error;
+
+	if (!inode->i_size)
+		return 0;
+
+	error = ext4_get_inode_loc(inode, &iloc);
+	if (error)
+		return error;
+
+	physical = (__u64)iloc.bh->b_blocknr << inode->i_sb->s_blocksize_bits;
+	physical += iloc.offset + offsetof(struct ext4_inode, i_block);
+	brelse(iloc.bh);
+
+	error = fiemap_fill_next_extent(fieinfo, 0, physical, inode->i_size,
+					FIEMAP_EXTENT_DATA_INLINE |
+					FIEMAP_EXTENT_NOT_ALIGNED |
+					FIEMAP_EXTENT_LAST);
+	return error < 0 ? error : 0;
+}
@@ -42,6 +42,7 @@
 #include "xattr.h"
 #include "acl.h"
 #include "truncate.h"
+#include "xip.h"
 
 #include <trace/events/ext4.h>
 
@@ -551,12 +552,29 @@ static void set_buffers_da_mapped(struct inode *inode,
 int ext4_map_blocks(handle_t *handle, struct inode *inode,
 		    struct ext4_map_blocks *map, int flags)
 {
+	struct extent_status es;
 	int retval;
 
 	map->m_flags = 0;
 	ext_debug("ext4_map_blocks(): inode %lu, flag %d, max_blocks %u,"
 		  "logical block %lu\n", inode->i_ino, flags, map->m_len,
 		  (unsigned long) map->m_lblk);
+
+	/* Lookup the extent status tree first */
+	if (ext4_es_lookup_extent(inode, map->m_lblk, &es) &&
+	    !ext4_es_is_delayed(&es)) {
+		retval = es.es_lblk + es.es_len - map->m_lblk;
+		if (retval > map->m_len)
+			retval = map->m_len;
+		map->m_len = retval;
+		map->m_pblk = ext4_es_pblock(&es) + map->m_lblk - es.es_lblk;
+		if (ext4_es_is_written(&es))
+			map->m_flags |= EXT4_MAP_MAPPED;
+		else
+			map->m_flags |= EXT4_MAP_UNWRITTEN;
+		goto found;
+	}
+
 	/*
 	 * Try to see if we can get the block without requesting a new
 	 * file system block.
@@ -570,9 +588,21 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 		retval = ext4_ind_map_blocks(handle, inode, map, flags &
 					     EXT4_GET_BLOCKS_KEEP_SIZE);
 	}
+	/*
+	 * Only cache what we found while holding i_data_sem, so that it
+	 * cannot race with a change of the mapping.
+	 */
+	if (retval > 0 && !(flags & EXT4_GET_BLOCKS_NO_LOCK) &&
+	    map->m_flags & (EXT4_MAP_MAPPED | EXT4_MAP_UNWRITTEN))
+		ext4_es_insert_extent(inode, map->m_lblk, map->m_len,
+				      map->m_pblk,
+				      (map->m_flags & EXT4_MAP_UNWRITTEN) ?
+				      EXTENT_STATUS_UNWRITTEN :
+				      EXTENT_STATUS_WRITTEN);
 	if (!(flags & EXT4_GET_BLOCKS_NO_LOCK))
 		up_read((&EXT4_I(inode)->i_data_sem));
 
+found:
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		int ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -613,6 +643,9 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 	 */
 	down_write((&EXT4_I(inode)->i_data_sem));
 
+	/* A file with blocks can not take inline data any more */
+	ext4_clear_inode_state(inode, EXT4_STATE_MAY_INLINE_DATA);
+
 	/*
 	 * if the caller is from delayed allocation writeout path
 	 * we have already reserved fs blocks for allocation
@@ -660,6 +693,14 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 			set_buffers_da_mapped(inode, map);
 	}
 
+	/*
+	 * The flags returned by a create call do not reliably tell what is
+	 * on disk now (fallocate and PRE_IO leave the extent unwritten but
+	 * return it mapped), so just forget the range.  This also drops the
+	 * delayed extents which have now been allocated.
+	 */
+	ext4_es_remove_extent(inode, map->m_lblk, map->m_len);
+
 	up_write((&EXT4_I(inode)->i_data_sem));
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		int ret = check_block_validity(inode, map);
@@ -891,6 +932,12 @@ static int ext4_write_begin(struct file *file, struct address_space *mapping,
 	unsigned from, to;
 
 	trace_ext4_write_begin(inode, pos, len, flags);
+
+	ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+					    flags, pagep);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	/*
 	 * Reserve one block more for addition to orphan list in case
 	 * we allocate blocks but write fails for some reason
@@ -1035,6 +1082,10 @@ static int ext4_ordered_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_ordered_write_end(inode, pos, len, copied);
+	if (ext4_may_write_inline(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	ret = ext4_jbd2_file_inode(handle, inode);
 
 	if (ret == 0) {
@@ -1083,6 +1134,10 @@ static int ext4_writeback_write_end(struct file *file,
 	int ret = 0, ret2;
 
 	trace_ext4_writeback_write_end(inode, pos, len, copied);
+	if (ext4_may_write_inline(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	ret2 = ext4_generic_write_end(file, mapping, pos, len, copied,
 							page, fsdata);
 	copied = ret2;
@@ -1127,6 +1182,10 @@ static int ext4_journalled_write_end(struct file *file,
 	loff_t new_i_size;
 
 	trace_ext4_journalled_write_end(inode, pos, len, copied);
+	if (ext4_may_write_inline(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	from = pos & (PAGE_CACHE_SIZE - 1);
 	to = from + len;
 
@@ -1299,6 +1358,8 @@ static void ext4_da_page_release_reservation(struct page *page,
 	struct inode *inode = page->mapping->host;
 	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	int num_clusters;
+	unsigned int first;
+	ext4_fsblk_t lblk;
 
 	head = page_buffers(page);
 	bh = head;
@@ -1313,15 +1374,24 @@ static void ext4_da_page_release_reservation(struct page *page,
 		curr_off = next_off;
 	} while ((bh = bh->b_this_page) != head);
 
+	/* The released blocks are no longer delayed */
+	if (to_release) {
+		first = (offset + (1 << inode->i_blkbits) - 1) >>
+			inode->i_blkbits;
+		lblk = (page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits)) +
+			first;
+		ext4_es_remove_extent(inode, lblk,
+			(PAGE_CACHE_SIZE >> inode->i_blkbits) - first);
+	}
+
 	/* If we have released all the blocks belonging to a cluster, then we
 	 * need to release the reserved space for that cluster. */
 	num_clusters = EXT4_NUM_B2C(sbi, to_release);
 	while (num_clusters > 0) {
-		ext4_fsblk_t lblk;
 		lblk = (page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits)) +
 			((num_clusters - 1) << sbi->s_cluster_bits);
 		if (sbi->s_cluster_ratio == 1 ||
-		    !ext4_find_delalloc_cluster(inode, lblk, 1))
+		    !ext4_find_delalloc_cluster(inode, lblk))
 			ext4_da_release_space(inode, 1);
 
 		num_clusters--;
@@ -1498,9 +1568,15 @@ static void ext4_da_block_invalidatepages(struct mpage_da_data *mpd)
 	struct pagevec pvec;
 	struct inode *inode = mpd->inode;
 	struct address_space *mapping = inode->i_mapping;
+	ext4_lblk_t start, last;
 
 	index = mpd->first_page;
 	end   = mpd->next_page - 1;
+
+	start = index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
+	last = ((end + 1) << (PAGE_CACHE_SHIFT - inode->i_blkbits)) - 1;
+	ext4_es_remove_extent(inode, start, last - start + 1);
+
 	while (index <= end) {
 		nr_pages = pagevec_lookup(&pvec, mapping, index, PAGEVEC_SIZE);
 		if (nr_pages == 0)
@@ -1798,6 +1874,14 @@ static int ext4_da_map_blocks(struct inode *inode, sector_t iblock,
 	else
 		retval = ext4_ind_map_blocks(NULL, inode, map, 0);
 
+	if (retval > 0 &&
+	    map->m_flags & (EXT4_MAP_MAPPED | EXT4_MAP_UNWRITTEN))
+		ext4_es_insert_extent(inode, map->m_lblk, map->m_len,
+				      map->m_pblk,
+				      (map->m_flags & EXT4_MAP_UNWRITTEN) ?
+				      EXTENT_STATUS_UNWRITTEN :
+				      EXTENT_STATUS_WRITTEN);
+
 	if (retval == 0) {
 		/*
 		 * XXX: __block_prepare_write() unmaps passed block,
@@ -1812,6 +1896,14 @@ static int ext4_da_map_blocks(struct inode *inode, sector_t iblock,
 				goto out_unlock;
 		}
 
+		retval = ext4_es_insert_extent(inode, map->m_lblk, map->m_len,
+					       ~0, EXTENT_STATUS_DELAYED);
+		if (retval) {
+			if (!(map->m_flags & EXT4_MAP_FROM_CLUSTER))
+				ext4_da_release_space(inode, 1);
+			goto out_unlock;
+		}
+
 		/* Clear EXT4_MAP_FROM_CLUSTER flag since its purpose is served
 		 * and it should not appear on the bh->b_state.
 		 */
@@ -2493,6 +2585,11 @@ static int ext4_da_write_begin(struct file *file, struct address_space *mapping,
 
 	index = pos >> PAGE_CACHE_SHIFT;
 
+	ret = ext4_try_to_write_inline_data(mapping, inode, pos, len,
+					    flags, pagep);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	if (ext4_nonda_switch(inode->i_sb)) {
 		*fsdata = (void *)FALL_BACK_TO_NONDELALLOC;
 		return ext4_write_begin(file, mapping, pos,
@@ -2579,6 +2676,10 @@ static int ext4_da_write_end(struct file *file,
 	unsigned long start, end;
 	int write_mode = (int)(unsigned long)fsdata;
 
+	if (ext4_may_write_inline(inode))
+		return ext4_write_inline_data_end(inode, pos, len, copied,
+						  page);
+
 	if (write_mode == FALL_BACK_TO_NONDELALLOC) {
 		switch (ext4_inode_journal_mode(inode)) {
 		case EXT4_INODE_ORDERED_DATA_MODE:
@@ -2719,6 +2820,10 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* inline data has no block of its own */
+	if (ext4_has_inline_data(inode))
+		return 0;
+
 	if (mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) &&
 			test_opt(inode->i_sb, DELALLOC)) {
 		/*
@@ -2764,7 +2869,11 @@ static sector_t ext4_bmap(struct address_space *mapping, sector_t block)
 
 static int ext4_readpage(struct file *file, struct page *page)
 {
+	struct inode *inode = page->mapping->host;
+
 	trace_ext4_readpage(page);
+	if (ext4_has_inline_data(inode))
+		return ext4_readpage_inline(inode, page);
 	return mpage_readpage(page, ext4_get_block);
 }
 
@@ -2772,6 +2881,9 @@ static int
 ext4_readpages(struct file *file, struct address_space *mapping,
 		struct list_head *pages, unsigned nr_pages)
 {
+	/* leave inline data to ->readpage */
+	if (ext4_has_inline_data(mapping->host))
+		return 0;
 	return mpage_readpages(mapping, pages, nr_pages, ext4_get_block);
 }
 
@@ -3146,9 +3258,10 @@ static ssize_t ext4_direct_IO(int rw, struct kiocb *iocb,
 	ssize_t ret;
 
 	/*
-	 * If we are doing data journalling we don't support O_DIRECT
+	 * If we are doing data journalling, or the data is inline, we
+	 * don't support O_DIRECT
 	 */
-	if (ext4_should_journal_data(inode))
+	if (ext4_should_journal_data(inode) || ext4_has_inline_data(inode))
 		return 0;
 
 	trace_ext4_direct_IO_enter(inode, offset, iov_length(iov, nr_segs), rw);
@@ -3241,8 +3354,21 @@ static const struct address_space_operations ext4_da_aops = {
 	.error_remove_page	= generic_error_remove_page,
 };
 
+#ifdef CONFIG_EXT4_FS_XIP
+static const struct address_space_operations ext4_xip_aops = {
+	.bmap			= ext4_bmap,
+	.get_xip_mem		= ext4_get_xip_mem,
+};
+#endif
+
 void ext4_set_aops(struct inode *inode)
 {
+#ifdef CONFIG_EXT4_FS_XIP
+	if (ext4_use_xip(inode)) {
+		inode->i_mapping->a_ops = &ext4_xip_aops;
+		return;
+	}
+#endif
 	switch (ext4_inode_journal_mode(inode)) {
 	case EXT4_INODE_ORDERED_DATA_MODE:
 		if (test_opt(inode->i_sb, DELALLOC))
@@ -3281,6 +3407,9 @@ int ext4_discard_partial_page_buffers(handle_t *handle,
 	struct page *page;
 	int err = 0;
 
+	if (mapping_is_xip(mapping))
+		return ext4_xip_zero_range(mapping, from, length);
+
 	page = find_or_create_page(mapping, from >> PAGE_CACHE_SHIFT,
 				   mapping_gfp_mask(mapping) & ~__GFP_FS);
 	if (!page)
@@ -3548,7 +3677,9 @@ void ext4_truncate(struct inode *inode)
 	if (inode->i_size == 0 && !test_opt(inode->i_sb, NO_AUTO_DA_ALLOC))
 		ext4_set_inode_state(inode, EXT4_STATE_DA_ALLOC_CLOSE);
 
-	if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
+	if (ext4_has_inline_data(inode))
+		ext4_inline_data_truncate(inode);
+	else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))
 		ext4_ext_truncate(inode);
 	else
 		ext4_ind_truncate(inode);
@@ -3907,6 +4038,8 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 		read_unlock(&journal->j_state_lock);
 		ei->i_sync_tid = tid;
 		ei->i_datasync_tid = tid;
+		/* nor do we know it was never made ineligible */
+		ei->i_fc_ineligible_tid = tid;
 	}
 
 	if (EXT4_INODE_SIZE(inode->i_sb) > EXT4_GOOD_OLD_INODE_SIZE) {
@@ -3942,6 +4075,14 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 				 ei->i_file_acl);
 		ret = -EIO;
 		goto bad_inode;
+	} else if (ext4_has_inline_data(inode)) {
+		if (!S_ISREG(inode->i_mode) ||
+		    !EXT4_HAS_INCOMPAT_FEATURE(sb,
+					EXT4_FEATURE_INCOMPAT_INLINEDATA) ||
+		    inode->i_size > EXT4_MIN_INLINE_DATA_SIZE) {
+			EXT4_ERROR_INODE(inode, "bad inline data");
+			ret = -EIO;
+		}
 	} else if (ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS)) {
 		if (S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 		    (S_ISLNK(inode->i_mode) &&
@@ -3959,7 +4100,10 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 
 	if (S_ISREG(inode->i_mode)) {
 		inode->i_op = &ext4_file_inode_operations;
-		inode->i_fop = &ext4_file_operations;
+		if (ext4_use_xip(inode))
+			inode->i_fop = &ext4_xip_file_operations;
+		else
+			inode->i_fop = &ext4_file_operations;
 		ext4_set_aops(inode);
 	} else if (S_ISDIR(inode->i_mode)) {
 		inode->i_op = &ext4_dir_inode_operations;
@@ -4300,6 +4444,13 @@ int ext4_setattr(struct dentry *dentry, struct iattr *attr)
 	if (attr->ia_valid & ATTR_SIZE) {
 		inode_dio_wait(inode);
 
+		/* Data that no longer fits in the inode goes to a block */
+		if (attr->ia_size > EXT4_MIN_INLINE_DATA_SIZE) {
+			error = ext4_convert_inline_data(inode);
+			if (error)
+				goto err_out;
+		}
+
 		if (!(ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS))) {
 			struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 
@@ -4780,6 +4931,14 @@ int ext4_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 	int retries = 0;
 
 	sb_start_pagefault(inode->i_sb);
+
+	/* Writes through a shared mapping need a real block */
+	if (ext4_may_write_inline(inode)) {
+		ret = ext4_convert_inline_data(inode);
+		if (ret)
+			goto out_ret;
+	}
+
 	/* Delalloc case is easy... */
 	if (test_opt(inode->i_sb, DELALLOC) &&
 	    !ext4_should_journal_data(inode) &&
@@ -360,6 +360,7 @@ static void ext4_mb_generate_from_freelist(struct super_block *sb, void *bitmap,
 						ext4_group_t group);
 static void ext4_free_data_callback(struct super_block *sb,
 				struct ext4_journal_cb_entry *jce, int rc);
+static void ext4_discarded_work(struct work_struct *work);
 
 static inline void *mb_correct_addr_and_bit(int *bit, void *addr)
 {
@@ -684,23 +685,40 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list so
+ * that cr 0 can find a big enough group without walking all of them.
+ * Called with the group lock held.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
 	int i;
-	int bits;
 
 	grp->bb_largest_free_order = -1; /* uninit */
 
-	bits = sb->s_blocksize_bits + 1;
-	for (i = bits; i >= 0; i--) {
+	for (i = MB_NUM_ORDERS(sb) - 1; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
 			grp->bb_largest_free_order = i;
 			break;
 		}
 	}
+
+	if (old == grp->bb_largest_free_order)
+		return;
+	if (old >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	if (grp->bb_largest_free_order >= 0) {
+		i = grp->bb_largest_free_order;
+		write_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[i]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
 }
 
 static noinline_for_stack
@@ -1852,19 +1870,114 @@ void ext4_mb_scan_aligned(struct ext4_allocation_context *ac,
 	}
 }
 
+/*
+ * Start reading the block bitmaps of up to @nr groups from @group on, so
+ * that their buddies can be built without waiting on one read at a time.
+ * Groups already initialized, without free clusters, or BLOCK_UNINIT
+ * (whose bitmap is computed, not read) are skipped, and each group is only
+ * ever prefetched once.  The reads are submitted under a plug so adjacent
+ * bitmaps get merged.  *@cnt, if given, is bumped for every read started.
+ * Returns the group after the last one looked at.
+ */
+ext4_group_t ext4_mb_prefetch(struct super_block *sb, ext4_group_t group,
+			      unsigned int nr, int *cnt)
+{
+	ext4_group_t ngroups = ext4_get_groups_count(sb);
+	struct buffer_head *bh;
+	struct blk_plug plug;
+
+	blk_start_plug(&plug);
+	while (nr-- > 0) {
+		struct ext4_group_desc *gdp = ext4_get_group_desc(sb, group,
+								  NULL);
+		struct ext4_group_info *grp = ext4_get_group_info(sb, group);
+
+		if (gdp && grp && EXT4_MB_GRP_NEED_INIT(grp) &&
+		    grp->bb_free > 0 &&
+		    !(gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT)) &&
+		    !EXT4_MB_GRP_TEST_AND_SET_READ(grp)) {
+			bh = ext4_read_block_bitmap_nowait(sb, group);
+			if (bh) {
+				if (!buffer_uptodate(bh)) {
+					atomic_inc(&EXT4_SB(sb)->s_mb_prefetched);
+					if (cnt)
+						(*cnt)++;
+				}
+				brelse(bh);
+			}
+		}
+		if (++group >= ngroups)
+			group = 0;
+	}
+	blk_finish_plug(&plug);
+	return group;
+}
+
+/*
+ * Build the buddies of the @nr groups before @group that
+ * ext4_mb_prefetch() started reading, waiting for their bitmaps.  This
+ * puts them on the largest free order lists where cr 0 can find them.
+ */
+void ext4_mb_prefetch_fini(struct super_block *sb, ext4_group_t group,
+			   unsigned int nr)
+{
+	while (nr-- > 0) {
+		struct ext4_group_desc *gdp;
+		struct ext4_group_info *grp;
+
+		if (!group)
+			group = ext4_get_groups_count(sb);
+		group--;
+		gdp = ext4_get_group_desc(sb, group, NULL);
+		grp = ext4_get_group_info(sb, group);
+
+		if (gdp && grp && EXT4_MB_GRP_NEED_INIT(grp) &&
+		    grp->bb_free > 0 &&
+		    !(gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))) {
+			if (ext4_mb_init_group(sb, group))
+				break;
+		}
+	}
+}
+
 /* This is now called BEFORE we load the buddy bitmap. */
 static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 				ext4_group_t group, int cr)
 {
 	unsigned free, fragments;
-	int flex_size = ext4_flex_bg_size(EXT4_SB(ac->ac_sb));
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	int flex_size = ext4_flex_bg_size(sbi);
 	struct ext4_group_info *grp = ext4_get_group_info(ac->ac_sb, group);
 
 	BUG_ON(cr < 0 || cr >= 4);
 
 	/* We only do this if the grp has never been initialized */
 	if (unlikely(EXT4_MB_GRP_NEED_INIT(grp))) {
-		int ret = ext4_mb_init_group(ac->ac_sb, group);
+		struct ext4_group_desc *gdp =
+			ext4_get_group_desc(ac->ac_sb, group, NULL);
+		int ret;
+
+		/*
+		 * bb_free is already set from the descriptor, so groups
+		 * that are too full can be skipped without any I/O.
+		 */
+		if (grp->bb_free == 0)
+			return 0;
+		if (cr <= 2 && grp->bb_free < ac->ac_g_ex.fe_len)
+			return 0;
+		/*
+		 * cr 0 and 1 look for a good chunk almost for free; reading
+		 * a bitmap just for that makes no sense, the prefetcher will
+		 * bring the group in.  The first group of a flex group is
+		 * still loaded since metadata allocations want to land
+		 * there, and BLOCK_UNINIT groups need no read at all.
+		 */
+		if (cr < 2 && (!sbi->s_log_groups_per_flex ||
+			       (group & ((1 << sbi->s_log_groups_per_flex) - 1))) &&
+		    !(gdp && (gdp->bg_flags & cpu_to_le16(EXT4_BG_BLOCK_UNINIT))))
+			return 0;
+
+		ret = ext4_mb_init_group(ac->ac_sb, group);
 		if (ret)
 			return 0;
 	}
@@ -1907,10 +2020,91 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Pick the group for cr 0 from the largest free order lists: the first
+ * group whose largest free extent is at least 2^ac_2order, instead of
+ * walking all groups from the goal.  Only groups with a buddy are on the
+ * lists.  Returns 1 and sets *@group if one was found.
+ */
+static int ext4_mb_choose_group_cr0(struct ext4_allocation_context *ac,
+				    ext4_group_t ngroups, ext4_group_t *group)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
+	struct ext4_group_info *iter;
+	int i, found = 0;
+
+	for (i = ac->ac_2order; i < MB_NUM_ORDERS(ac->ac_sb) && !found; i++) {
+		if (list_empty(&sbi->s_mb_largest_free_orders[i]))
+			continue;
+		read_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_for_each_entry(iter, &sbi->s_mb_largest_free_orders[i],
+				    bb_largest_free_order_node) {
+			if (sbi->s_mb_stats)
+				atomic64_inc(&sbi->s_bal_cX_groups_considered[0]);
+			if (iter->bb_group < ngroups &&
+			    !EXT4_MB_GRP_NEED_INIT(iter) &&
+			    ext4_mb_good_group(ac, iter->bb_group, 0)) {
+				*group = iter->bb_group;
+				found = 1;
+				break;
+			}
+		}
+		read_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+	return found;
+}
+
+/*
+ * Load the buddy of @group and scan it at criterion @cr, if the group
+ * still looks good once it is locked.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	/* This now checks without needing the buddy page */
+	if (!ext4_mb_good_group(ac, group, cr))
+		return 0;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr))
+		goto out_unlock;
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+out_unlock:
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
 	ext4_group_t ngroups, group, i;
+	ext4_group_t prefetch_grp = 0;
+	unsigned int nr = 0;
+	int prefetch_ios = 0;
 	int cr;
 	int err = 0;
 	struct ext4_sb_info *sbi;
@@ -1972,51 +2166,74 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (cr == 0 && sbi->s_mb_optimize_scan) {
+			/*
+			 * The order lists hand out a group that has the
+			 * extent we want; if there is none, or someone took
+			 * it meanwhile, go on to cr 1 rather than walk.
+			 */
+			if (ext4_mb_choose_group_cr0(ac, ngroups, &group)) {
+				err = ext4_mb_scan_group(ac, group, cr);
+				if (err)
+					goto out;
+				if (sbi->s_mb_stats &&
+				    ac->ac_status == AC_STATUS_CONTINUE)
+					atomic_inc(&sbi->s_bal_cr0_bad_suggestions);
+			}
+			goto next_cr;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
 		 */
 		group = ac->ac_g_ex.fe_group;
+		prefetch_grp = group;
 
 		for (i = 0; i < ngroups; group++, i++) {
 			if (group == ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			if (!ext4_mb_good_group(ac, group, cr))
-				continue;
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
-			if (err)
-				goto out;
-
-			ext4_lock_group(sb, group);
-
 			/*
-			 * We need to check again after locking the
-			 * block group
+			 * Batch reads of the block bitmaps to get several
+			 * of them in flight.  Limit prefetching at cr 0 and
+			 * 1, otherwise mballoc can spend a lot of time
+			 * loading groups it then finds imperfect.
 			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
+			if (sbi->s_mb_prefetch && prefetch_grp == group &&
+			    (cr > 1 ||
+			     prefetch_ios < sbi->s_mb_prefetch_limit)) {
+				int curr_ios = prefetch_ios;
+
+				nr = sbi->s_mb_prefetch;
+				if (sbi->s_log_groups_per_flex) {
+					nr = 1 << sbi->s_log_groups_per_flex;
+					nr -= group & (nr - 1);
+					nr = min(nr, sbi->s_mb_prefetch);
+				}
+				prefetch_grp = ext4_mb_prefetch(sb, group, nr,
+								&prefetch_ios);
+				if (prefetch_ios == curr_ios)
+					nr = 0;
 			}
 
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
+			if (sbi->s_mb_stats)
+				atomic64_inc(&sbi->s_bal_cX_groups_considered[cr]);
+			err = ext4_mb_scan_group(ac, group, cr);
+			if (err)
+				goto out;
 
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
+next_cr:
+		if (sbi->s_mb_stats) {
+			if (ac->ac_status == AC_STATUS_FOUND)
+				atomic_inc(&sbi->s_bal_cX_hits[cr]);
+			else if (ac->ac_status == AC_STATUS_CONTINUE)
+				atomic_inc(&sbi->s_bal_cX_failed[cr]);
+		}
 	}
 
 	if (ac->ac_b_ex.fe_len > 0 && ac->ac_status != AC_STATUS_FOUND &&
@@ -2045,6 +2262,9 @@ repeat:
 		}
 	}
 out:
+	/* build the buddies of the last batch of prefetched groups */
+	if (nr)
+		ext4_mb_prefetch_fini(sb, prefetch_grp, nr);
 	return err;
 }
 
@@ -2154,6 +2374,71 @@ static const struct file_operations ext4_mb_seq_groups_fops = {
 	.release	= seq_release,
 };
 
+static int ext4_mb_seq_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	unsigned long long generation_time;
+	unsigned long generated;
+	int i;
+
+	seq_puts(seq, "mballoc:\n");
+	if (!sbi->s_mb_stats) {
+		seq_puts(seq, "\tmb stats collection turned off.\n");
+		seq_puts(seq, "\tTo enable, please write \"1\" to sysfs file mb_stats.\n");
+		return 0;
+	}
+	seq_printf(seq, "\treqs: %u\n", atomic_read(&sbi->s_bal_reqs));
+	seq_printf(seq, "\tsuccess: %u\n", atomic_read(&sbi->s_bal_success));
+	seq_printf(seq, "\tblocks: %u\n", atomic_read(&sbi->s_bal_allocated));
+	seq_printf(seq, "\textents_scanned: %u\n",
+		   atomic_read(&sbi->s_bal_ex_scanned));
+	seq_printf(seq, "\tgoal_hits: %u\n", atomic_read(&sbi->s_bal_goals));
+	seq_printf(seq, "\t2^n_hits: %u\n", atomic_read(&sbi->s_bal_2orders));
+	seq_printf(seq, "\tbreaks: %u\n", atomic_read(&sbi->s_bal_breaks));
+	seq_printf(seq, "\tlost: %u\n", atomic_read(&sbi->s_mb_lost_chunks));
+
+	for (i = 0; i < 4; i++) {
+		seq_printf(seq, "\tcr%d_stats:\n", i);
+		seq_printf(seq, "\t\thits: %u\n",
+			   atomic_read(&sbi->s_bal_cX_hits[i]));
+		seq_printf(seq, "\t\tgroups_considered: %llu\n",
+			   (unsigned long long)
+			   atomic64_read(&sbi->s_bal_cX_groups_considered[i]));
+		seq_printf(seq, "\t\tuseless_loops: %u\n",
+			   atomic_read(&sbi->s_bal_cX_failed[i]));
+		if (i == 0)
+			seq_printf(seq, "\t\tbad_suggestions: %u\n",
+				   atomic_read(&sbi->s_bal_cr0_bad_suggestions));
+	}
+
+	spin_lock(&sbi->s_bal_lock);
+	generated = sbi->s_mb_buddies_generated;
+	generation_time = sbi->s_mb_generation_time;
+	spin_unlock(&sbi->s_bal_lock);
+	seq_printf(seq, "\tbuddies_generated: %lu\n", generated);
+	seq_printf(seq, "\tbuddies_time_used: %llu\n", generation_time);
+	seq_printf(seq, "\tpreallocated: %u\n",
+		   atomic_read(&sbi->s_mb_preallocated));
+	seq_printf(seq, "\tdiscarded: %u\n", atomic_read(&sbi->s_mb_discarded));
+	seq_printf(seq, "\tprefetched_bitmaps: %u\n",
+		   atomic_read(&sbi->s_mb_prefetched));
+	return 0;
+}
+
+static int ext4_mb_seq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_mb_seq_stats_show, PDE(inode)->data);
+}
+
+static const struct file_operations ext4_mb_seq_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_mb_seq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2217,9 +2502,11 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2423,14 +2710,51 @@ int ext4_mb_init(struct super_block *sb)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	sbi->s_mb_largest_free_orders =
+		kmalloc(MB_NUM_ORDERS(sb) * sizeof(struct list_head),
+			GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders) {
+		ret = -ENOMEM;
+		goto out_free_groupinfo_slab;
+	}
+	sbi->s_mb_largest_free_orders_locks =
+		kmalloc(MB_NUM_ORDERS(sb) * sizeof(rwlock_t), GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders_locks) {
+		ret = -ENOMEM;
+		goto out_free_groupinfo_slab;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
+	INIT_LIST_HEAD(&sbi->s_discarded);
+	INIT_WORK(&sbi->s_discarded_work, ext4_discarded_work);
 
 	sbi->s_mb_max_to_scan = MB_DEFAULT_MAX_TO_SCAN;
 	sbi->s_mb_min_to_scan = MB_DEFAULT_MIN_TO_SCAN;
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
+	/*
+	 * The block bitmaps of a flex group sit next to each other on
+	 * disk, so prefetch a few flex groups' worth at a time: the plug
+	 * merges them into large reads.
+	 */
+	if (sbi->s_log_groups_per_flex) {
+		sbi->s_mb_prefetch = min_t(uint, 1 << sbi->s_log_groups_per_flex,
+			BLK_MAX_SEGMENT_SIZE >> (sb->s_blocksize_bits - 9));
+		sbi->s_mb_prefetch *= 8;
+	} else {
+		sbi->s_mb_prefetch = MB_DEFAULT_PREFETCH;
+	}
+	if (sbi->s_mb_prefetch > ext4_get_groups_count(sb))
+		sbi->s_mb_prefetch = ext4_get_groups_count(sb);
+	/* how many reads cr 0 and 1 may start before they stop prefetching */
+	sbi->s_mb_prefetch_limit = sbi->s_mb_prefetch * 4;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2477,9 +2801,12 @@ int ext4_mb_init(struct super_block *sb)
 	if (ret != 0)
 		goto out_free_locality_groups;
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
 				 &ext4_mb_seq_groups_fops, sb);
+		proc_create_data("mb_stats", S_IRUGO, sbi->s_proc,
+				 &ext4_mb_seq_stats_fops, sb);
+	}
 
 	return 0;
 
@@ -2488,6 +2815,10 @@ out_free_locality_groups:
 	sbi->s_locality_groups = NULL;
 out_free_groupinfo_slab:
 	ext4_groupinfo_destroy_slabs();
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
 out:
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
@@ -2523,8 +2854,13 @@ int ext4_mb_release(struct super_block *sb)
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	struct kmem_cache *cachep = get_groupinfo_cache(sb->s_blocksize_bits);
 
-	if (sbi->s_proc)
+	/* the discards themselves were flushed by the caller */
+	flush_work(&sbi->s_discarded_work);
+
+	if (sbi->s_proc) {
+		remove_proc_entry("mb_stats", sbi->s_proc);
 		remove_proc_entry("mb_groups", sbi->s_proc);
+	}
 
 	if (sbi->s_group_info) {
 		for (i = 0; i < ngroups; i++) {
@@ -2544,6 +2880,8 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		ext4_kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	if (sbi->s_buddy_cache)
@@ -2590,26 +2928,13 @@ static inline int ext4_issue_discard(struct super_block *sb,
 	return sb_issue_discard(sb, discard_block, count, GFP_NOFS, 0);
 }
 
-/*
- * This function is called by the jbd2 layer once the commit has finished,
- * so we know we can free the blocks that were released with that commit.
- */
-static void ext4_free_data_callback(struct super_block *sb,
-				    struct ext4_journal_cb_entry *jce,
-				    int rc)
+static void ext4_free_data_release(struct super_block *sb,
+				   struct ext4_free_data *entry)
 {
-	struct ext4_free_data *entry = (struct ext4_free_data *)jce;
 	struct ext4_buddy e4b;
 	struct ext4_group_info *db;
 	int err, count = 0, count2 = 0;
 
-	mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
-		 entry->efd_count, entry->efd_group, entry);
-
-	if (test_opt(sb, DISCARD))
-		ext4_issue_discard(sb, entry->efd_group,
-				   entry->efd_start_cluster, entry->efd_count);
-
 	err = ext4_mb_load_buddy(sb, entry->efd_group, &e4b);
 	/* we expect to find existing buddy because it's pinned */
 	BUG_ON(err != 0);
@@ -2647,6 +2972,77 @@ static void ext4_free_data_callback(struct super_block *sb,
 	mb_debug(1, "freed %u blocks in %u structures\n", count, count2);
 }
 
+/*
+ * Called by the block layer once the discard is done.  The extent goes
+ * back to the buddy from our own work item, the journal callback list
+ * head is free to chain it there.
+ */
+static void ext4_free_data_discarded(void *data, int error)
+{
+	struct ext4_free_data *entry = data;
+	struct ext4_sb_info *sbi = EXT4_SB(entry->efd_sb);
+
+	spin_lock(&sbi->s_md_lock);
+	list_add_tail(&entry->efd_jce.jce_list, &sbi->s_discarded);
+	spin_unlock(&sbi->s_md_lock);
+	schedule_work(&sbi->s_discarded_work);
+}
+
+static void ext4_discarded_work(struct work_struct *work)
+{
+	struct ext4_sb_info *sbi = container_of(work, struct ext4_sb_info,
+						s_discarded_work);
+	struct ext4_free_data *entry;
+	LIST_HEAD(discarded);
+
+	spin_lock(&sbi->s_md_lock);
+	list_splice_init(&sbi->s_discarded, &discarded);
+	spin_unlock(&sbi->s_md_lock);
+
+	while (!list_empty(&discarded)) {
+		entry = list_first_entry(&discarded, struct ext4_free_data,
+					 efd_jce.jce_list);
+		list_del(&entry->efd_jce.jce_list);
+		ext4_free_data_release(sbi->s_sb, entry);
+	}
+}
+
+/*
+ * This function is called by the jbd2 layer once the commit has finished,
+ * so we know we can free the blocks that were released with that commit.
+ * With -o discard the blocks stay pinned until the discard is done, which
+ * happens in the background so that it does not hold up the commit.
+ */
+static void ext4_free_data_callback(struct super_block *sb,
+				    struct ext4_journal_cb_entry *jce,
+				    int rc)
+{
+	struct ext4_free_data *entry = (struct ext4_free_data *)jce;
+
+	mb_debug(1, "gonna free %u blocks in group %u (0x%p):",
+		 entry->efd_count, entry->efd_group, entry);
+
+	if (test_opt(sb, DISCARD)) {
+		ext4_fsblk_t discard_block;
+		int count;
+
+		discard_block = EXT4_C2B(EXT4_SB(sb), entry->efd_start_cluster) +
+				ext4_group_first_block_no(sb, entry->efd_group);
+		count = EXT4_C2B(EXT4_SB(sb), entry->efd_count);
+		trace_ext4_discard_blocks(sb,
+				(unsigned long long) discard_block, count);
+
+		entry->efd_sb = sb;
+		if (!blkdev_queue_discard(sb->s_bdev,
+				discard_block << (sb->s_blocksize_bits - 9),
+				(sector_t)count << (sb->s_blocksize_bits - 9),
+				GFP_NOFS, ext4_free_data_discarded, entry))
+			return;
+	}
+
+	ext4_free_data_release(sb, entry);
+}
+
 #ifdef CONFIG_EXT4_DEBUG
 u8 mb_enable_debug __read_mostly;
 
@@ -4507,6 +4903,8 @@ void ext4_free_blocks(handle_t *handle, struct inode *inode,
 
 	ext4_debug("freeing block %llu\n", block);
 	trace_ext4_free_blocks(inode, block, count, flags);
+	/* replaying a fast commit could hand the blocks out twice */
+	ext4_fc_mark_ineligible(handle, sb);
 
 	if (flags & EXT4_FREE_BLOCKS_FORGET) {
 		struct buffer_head *tbh = bh;
@@ -4732,6 +5130,7 @@ int ext4_group_add_blocks(handle_t *handle, struct super_block *sb,
 
 	if (count == 0)
 		return 0;
+	ext4_fc_mark_ineligible(handle, sb);
 
 	ext4_get_group_no_and_offset(sb, block, &block_group, &bit);
 	/*
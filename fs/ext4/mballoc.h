@@ -94,6 +94,24 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * pick cr 0 groups from the largest free order lists instead of
+ * walking the groups one by one
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * how many block bitmaps to read ahead when scanning uninitialized
+ * groups, if the fs has no flex groups to size it by
+ */
+#define MB_DEFAULT_PREFETCH		32
+
+/*
+ * number of buddy orders: 0 is the bitmap itself, the largest order
+ * is blocksize_bits + 1
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* MUST be the first member */
@@ -113,6 +131,9 @@ struct ext4_free_data {
 
 	/* transaction which freed this extent */
 	tid_t				efd_tid;
+
+	/* for releasing the extent once its discard is done */
+	struct super_block		*efd_sb;
 };
 
 struct ext4_prealloc_space {
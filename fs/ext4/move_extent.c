@@ -18,6 +18,7 @@
 #include <linux/slab.h>
 #include "ext4_jbd2.h"
 #include "ext4.h"
+#include "xip.h"
 
 /**
  * get_ext_path - Find an extent path for designated logical block number.
@@ -666,6 +667,9 @@ mext_replace_branches(handle_t *handle, struct inode *orig_inode,
 	/* Protect extent trees against block allocations via delalloc */
 	double_down_write_data_sem(orig_inode, donor_inode);
 
+	ext4_es_remove_extent(orig_inode, from, count);
+	ext4_es_remove_extent(donor_inode, from, count);
+
 	/* Get the original extent for the block "orig_off" */
 	*err = get_ext_path(orig_inode, orig_off, &orig_path);
 	if (*err)
@@ -817,6 +821,8 @@ move_extent_per_page(struct file *o_filp, struct inode *donor_inode,
 		*err = PTR_ERR(handle);
 		return 0;
 	}
+	ext4_fc_mark_inode_ineligible(handle, orig_inode);
+	ext4_fc_mark_inode_ineligible(handle, donor_inode);
 
 	if (segment_eq(get_fs(), KERNEL_DS))
 		w_flags |= AOP_FLAG_UNINTERRUPTIBLE;
@@ -969,6 +975,15 @@ mext_check_arguments(struct inode *orig_inode,
 		return -EINVAL;
 	}
 
+	/* Ext4 move extent copies data through the page cache */
+	if (mapping_is_xip(orig_inode->i_mapping) ||
+	    mapping_is_xip(donor_inode->i_mapping)) {
+		ext4_debug("ext4 move extent: The argument files should "
+			"not be xip [ino:orig %lu, donor %lu]\n",
+			orig_inode->i_ino, donor_inode->i_ino);
+		return -EINVAL;
+	}
+
 	/* Files should be in the same ext4 FS */
 	if (orig_inode->i_sb != donor_inode->i_sb) {
 		ext4_debug("ext4 move extent: The argument files "
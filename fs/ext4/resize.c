@@ -1323,6 +1323,8 @@ static int ext4_flex_group_add(struct super_block *sb,
 		err = PTR_ERR(handle);
 		goto exit;
 	}
+	/* the new groups are not known to the fast commit replay */
+	ext4_fc_mark_ineligible(handle, sb);
 
 	err = ext4_journal_get_write_access(handle, sbi->s_sbh);
 	if (err)
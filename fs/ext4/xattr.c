@@ -1050,6 +1050,8 @@ ext4_xattr_set_handle(handle_t *handle, struct inode *inode, int name_index,
 	down_write(&EXT4_I(inode)->xattr_sem);
 	no_expand = ext4_test_inode_state(inode, EXT4_STATE_NO_EXPAND);
 	ext4_set_inode_state(inode, EXT4_STATE_NO_EXPAND);
+	/* xattr blocks are not in a fast commit */
+	ext4_fc_mark_inode_ineligible(handle, inode);
 
 	error = ext4_reserve_inode_write(handle, inode, &is.iloc);
 	if (error)
@@ -0,0 +1,158 @@
+/*
+ *  linux/fs/ext4/xip.c
+ *
+ * Execute in place and direct access to memory-backed block devices,
+ * modelled on fs/ext2/xip.c.
+ *
+ * Regular extent-mapped files on a filesystem mounted with -o xip bypass
+ * the page cache: read(), write() and mmap() go through mm/filemap_xip.c,
+ * which asks ext4_get_xip_mem() for the kernel address and pfn backing a
+ * file page, found through the block device's ->direct_access().
+ */
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/genhd.h>
+#include <linux/blkdev.h>
+#include "ext4.h"
+#include "ext4_jbd2.h"
+#include "xip.h"
+
+static int ext4_direct_access(struct inode *inode, ext4_fsblk_t block,
+			      void **kaddr, unsigned long *pfn)
+{
+	struct block_device *bdev = inode->i_sb->s_bdev;
+	const struct block_device_operations *ops = bdev->bd_disk->fops;
+	sector_t sector;
+
+	sector = block << (inode->i_blkbits - 9); /* ext4 block to sector */
+
+	BUG_ON(!ops->direct_access);
+	return ops->direct_access(bdev, sector, kaddr, pfn);
+}
+
+void ext4_xip_verify_sb(struct super_block *sb)
+{
+	if (test_opt2(sb, XIP) && !sb->s_bdev->bd_disk->fops->direct_access) {
+		clear_opt2(sb, XIP);
+		ext4_msg(sb, KERN_WARNING,
+			 "ignoring xip option - not supported by bdev");
+	}
+}
+
+/*
+ * Allocate the block backing page pgoff, or convert it if it was
+ * preallocated. The block is first allocated unwritten and only marked
+ * written once it has been cleared, so that a concurrent lookup without
+ * create sees a hole rather than stale data. Allocation is serialised
+ * per inode so that two writers can not both clear the same block.
+ */
+static int ext4_xip_alloc_block(struct inode *inode, pgoff_t pgoff,
+				ext4_fsblk_t *block)
+{
+	struct ext4_map_blocks map;
+	handle_t *handle;
+	void *kaddr;
+	unsigned long pfn;
+	int retries = 0;
+	int rc;
+
+	mutex_lock(ext4_xip_mutex(inode));
+retry:
+	map.m_lblk = pgoff;
+	map.m_len = 1;
+	rc = ext4_map_blocks(NULL, inode, &map, 0);
+	if (rc > 0 && (map.m_flags & EXT4_MAP_MAPPED))
+		goto out;
+
+	handle = ext4_journal_start(inode, ext4_chunk_trans_blocks(inode, 1));
+	if (IS_ERR(handle)) {
+		rc = PTR_ERR(handle);
+		goto out;
+	}
+	map.m_lblk = pgoff;
+	map.m_len = 1;
+	rc = ext4_map_blocks(handle, inode, &map,
+			     EXT4_GET_BLOCKS_CREATE_UNINIT_EXT);
+	ext4_journal_stop(handle);
+	if (rc == -ENOSPC && ext4_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	if (rc <= 0) {
+		if (!rc)
+			rc = -EIO;
+		goto out;
+	}
+
+	rc = ext4_direct_access(inode, map.m_pblk, &kaddr, &pfn);
+	if (rc)
+		goto out;
+	clear_page(kaddr);
+
+	rc = ext4_convert_unwritten_extents(inode,
+			(loff_t)pgoff << PAGE_CACHE_SHIFT, PAGE_CACHE_SIZE);
+out:
+	mutex_unlock(ext4_xip_mutex(inode));
+	if (rc >= 0) {
+		*block = map.m_pblk;
+		rc = 0;
+	}
+	return rc;
+}
+
+int ext4_get_xip_mem(struct address_space *mapping, pgoff_t pgoff, int create,
+		     void **kmem, unsigned long *pfn)
+{
+	struct inode *inode = mapping->host;
+	struct ext4_map_blocks map;
+	ext4_fsblk_t block;
+	int rc;
+
+	/* xip mounts require blocksize == PAGE_SIZE */
+	map.m_lblk = pgoff;
+	map.m_len = 1;
+	rc = ext4_map_blocks(NULL, inode, &map, 0);
+	if (rc < 0)
+		return rc;
+
+	if (rc > 0 && (map.m_flags & EXT4_MAP_MAPPED)) {
+		block = map.m_pblk;
+	} else if (!create) {
+		/* holes and unwritten extents read as zeroes */
+		return -ENODATA;
+	} else {
+		rc = ext4_xip_alloc_block(inode, pgoff, &block);
+		if (rc)
+			return rc;
+	}
+
+	return ext4_direct_access(inode, block, kmem, pfn);
+}
+
+/*
+ * Zero length bytes at from, which must not cross a block boundary.
+ * Used on truncate and hole punching in place of going through the
+ * page cache.
+ */
+int ext4_xip_zero_range(struct address_space *mapping, loff_t from,
+			loff_t length)
+{
+	unsigned offset = from & (PAGE_CACHE_SIZE - 1);
+	unsigned long pfn;
+	void *kaddr;
+	int rc;
+
+	if (length > PAGE_CACHE_SIZE - offset)
+		length = PAGE_CACHE_SIZE - offset;
+	if (length <= 0)
+		return 0;
+
+	rc = ext4_get_xip_mem(mapping, from >> PAGE_CACHE_SHIFT, 0,
+			      &kaddr, &pfn);
+	if (rc == -ENODATA)
+		return 0;
+	if (rc)
+		return rc;
+
+	memset(kaddr + offset, 0, length);
+	return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ *  linux/fs/ext4/xip.h
+ *
+ * Modelled on fs/ext2/xip.h.
+ */
+
+#ifdef CONFIG_EXT4_FS_XIP
+extern void ext4_xip_verify_sb(struct super_block *);
+extern int ext4_get_xip_mem(struct address_space *, pgoff_t, int,
+			    void **, unsigned long *);
+extern int ext4_xip_zero_range(struct address_space *, loff_t, loff_t);
+
+/*
+ * Only extent-mapped regular files bypass the page cache; block mapped
+ * ones have no unwritten extents to hide freshly allocated blocks with.
+ */
+static inline int ext4_use_xip(struct inode *inode)
+{
+	return test_opt2(inode->i_sb, XIP) && S_ISREG(inode->i_mode) &&
+	       ext4_test_inode_flag(inode, EXT4_INODE_EXTENTS);
+}
+#define mapping_is_xip(map) unlikely(map->a_ops->get_xip_mem)
+#else
+#define mapping_is_xip(map)			0
+#define ext4_xip_verify_sb(sb)			do { } while (0)
+#define ext4_use_xip(inode)			0
+#define ext4_xip_zero_range(map, from, len)	0
+#endif
@@ -21,19 +21,38 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
-#include <linux/kthread.h>
-#include <linux/freezer.h>
 #include <linux/writeback.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/tracepoint.h>
+#include <linux/sysctl.h>
+#include <linux/cgroup.h>
 #include "internal.h"
 
+/*
+ * How long a lazy atime may stay in memory, in seconds
+ */
+unsigned int dirtytime_expire_interval = 12 * 60 * 60;
+
 /*
  * 4MB minimal write chunk size
  */
 #define MIN_WRITEBACK_PAGES	(4096UL >> (PAGE_CACHE_SHIFT - 10))
 
+/*
+ * A work item may be split over all the writeback workers of a bdi, and
+ * the waiter only wants to know when all the pieces are done. @cnt
+ * starts at one for the waiter and counts the pieces still queued.
+ */
+struct wb_completion {
+	atomic_t		cnt;
+};
+
+#define DEFINE_WB_COMPLETION_ONSTACK(cmpl)				\
+	struct wb_completion cmpl = {					\
+		.cnt		= ATOMIC_INIT(1),			\
+	}
+
 /*
  * Passed into wb_writeback(), essentially a subset of writeback_control
  */
@@ -46,10 +65,11 @@ struct wb_writeback_work {
 	unsigned int for_kupdate:1;
 	unsigned int range_cyclic:1;
 	unsigned int for_background:1;
+	unsigned int auto_free:1;	/* free on completion */
 	enum wb_reason reason;		/* why was writeback initiated? */
 
 	struct list_head list;		/* pending work list */
-	struct completion *done;	/* set if the caller waits */
+	struct wb_completion *done;	/* set if the caller waits */
 };
 
 /**
@@ -61,7 +81,13 @@ struct wb_writeback_work {
  */
 int writeback_in_progress(struct backing_dev_info *bdi)
 {
-	return test_bit(BDI_writeback_running, &bdi->state);
+	struct bdi_writeback *wb;
+	unsigned int i;
+
+	bdi_for_each_wb(wb, bdi, i)
+		if (test_bit(WB_writeback_running, &wb->state))
+			return 1;
+	return 0;
 }
 
 static inline struct backing_dev_info *inode_to_bdi(struct inode *inode)
@@ -74,6 +100,11 @@ static inline struct backing_dev_info *inode_to_bdi(struct inode *inode)
 	return sb->s_bdi;
 }
 
+static inline struct bdi_writeback *inode_to_wb(struct inode *inode)
+{
+	return bdi_inode_wb(inode_to_bdi(inode), inode);
+}
+
 static inline struct inode *wb_inode(struct list_head *head)
 {
 	return list_entry(head, struct inode, i_wb_list);
@@ -87,58 +118,138 @@ static inline struct inode *wb_inode(struct list_head *head)
 #define CREATE_TRACE_POINTS
 #include <trace/events/writeback.h>
 
-/* Wakeup flusher thread or forker thread to fork it. Requires bdi->wb_lock. */
-static void bdi_wakeup_flusher(struct backing_dev_info *bdi)
+/*
+ * Run the worker of @wb now, instead of when its timer for periodic
+ * writeback fires. Requires wb->work_lock.
+ */
+static void wb_wakeup(struct bdi_writeback *wb)
 {
-	if (bdi->wb.task) {
-		wake_up_process(bdi->wb.task);
-	} else {
-		/*
-		 * The bdi thread isn't there, wake up the forker thread which
-		 * will create and run it.
-		 */
-		wake_up_process(default_backing_dev_info.wb.task);
+	if (!test_bit(WB_registered, &wb->state))
+		return;
+	__cancel_delayed_work(&wb->dwork);
+	queue_delayed_work(bdi_wq, &wb->dwork, 0);
+}
+
+static void finish_writeback_work(struct bdi_writeback *wb,
+				  struct wb_writeback_work *work)
+{
+	struct wb_completion *done = work->done;
+
+	if (work->auto_free)
+		kfree(work);
+	if (done && atomic_dec_and_test(&done->cnt))
+		wake_up_all(&wb->bdi->wb_waitq);
+}
+
+static void wb_queue_work(struct bdi_writeback *wb,
+			  struct wb_writeback_work *work)
+{
+	trace_writeback_queue(wb->bdi, work);
+
+	spin_lock_bh(&wb->work_lock);
+	if (!test_bit(WB_registered, &wb->state)) {
+		spin_unlock_bh(&wb->work_lock);
+		if (work->auto_free)
+			kfree(work);
+		return;
 	}
+	if (work->done)
+		atomic_inc(&work->done->cnt);
+	list_add_tail(&work->list, &wb->work_list);
+	wb_wakeup(wb);
+	spin_unlock_bh(&wb->work_lock);
+}
+
+/*
+ * Wait for all the pieces of a work item split by bdi_split_work_to_wbs()
+ * that were set up with @done.
+ */
+static void wb_wait_for_completion(struct backing_dev_info *bdi,
+				   struct wb_completion *done)
+{
+	atomic_dec(&done->cnt);		/* put down the initial count */
+	wait_event(bdi->wb_waitq, !atomic_read(&done->cnt));
 }
 
-static void bdi_queue_work(struct backing_dev_info *bdi,
-			   struct wb_writeback_work *work)
+/*
+ * The share of @nr_pages each writeback worker of @bdi gets.
+ */
+static long wb_split_nr_pages(struct backing_dev_info *bdi, long nr_pages)
 {
-	trace_writeback_queue(bdi, work);
-
-	spin_lock_bh(&bdi->wb_lock);
-	list_add_tail(&work->list, &bdi->work_list);
-	if (!bdi->wb.task)
-		trace_writeback_nothread(bdi, work);
-	bdi_wakeup_flusher(bdi);
-	spin_unlock_bh(&bdi->wb_lock);
+	if (nr_pages == LONG_MAX || bdi->nr_wb == 1)
+		return nr_pages;
+	return DIV_ROUND_UP(nr_pages, bdi->nr_wb);
+}
+
+/*
+ * Queue a copy of @base_work on every writeback worker of @bdi, each with
+ * its share of the pages. The caller waits for the copies through
+ * @base_work->done. If a copy cannot be allocated, @base_work itself is
+ * used for that worker and waited for right here.
+ */
+static void bdi_split_work_to_wbs(struct backing_dev_info *bdi,
+				  struct wb_writeback_work *base_work)
+{
+	long nr_pages = wb_split_nr_pages(bdi, base_work->nr_pages);
+	struct bdi_writeback *wb;
+	unsigned int i;
+
+	bdi_for_each_wb(wb, bdi, i) {
+		DEFINE_WB_COMPLETION_ONSTACK(fallback_done);
+		struct wb_writeback_work fallback_work;
+		struct wb_writeback_work *work;
+
+		work = kmalloc(sizeof(*work), GFP_KERNEL);
+		if (work) {
+			*work = *base_work;
+			work->nr_pages = nr_pages;
+			work->auto_free = 1;
+			wb_queue_work(wb, work);
+			continue;
+		}
+
+		fallback_work = *base_work;
+		fallback_work.nr_pages = nr_pages;
+		fallback_work.auto_free = 0;
+		fallback_work.done = &fallback_done;
+		wb_queue_work(wb, &fallback_work);
+		wb_wait_for_completion(bdi, &fallback_done);
+	}
 }
 
 static void
 __bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages,
 		      bool range_cyclic, enum wb_reason reason)
 {
-	struct wb_writeback_work *work;
+	struct bdi_writeback *wb;
+	unsigned int i;
 
-	/*
-	 * This is WB_SYNC_NONE writeback, so if allocation fails just
-	 * wakeup the thread for old dirty data writeback
-	 */
-	work = kzalloc(sizeof(*work), GFP_ATOMIC);
-	if (!work) {
-		if (bdi->wb.task) {
+	nr_pages = wb_split_nr_pages(bdi, nr_pages);
+
+	bdi_for_each_wb(wb, bdi, i) {
+		struct wb_writeback_work *work;
+
+		/*
+		 * This is WB_SYNC_NONE writeback, so if allocation fails just
+		 * wakeup the worker for old dirty data writeback
+		 */
+		work = kzalloc(sizeof(*work), GFP_ATOMIC);
+		if (!work) {
 			trace_writeback_nowork(bdi);
-			wake_up_process(bdi->wb.task);
+			spin_lock_bh(&wb->work_lock);
+			wb_wakeup(wb);
+			spin_unlock_bh(&wb->work_lock);
+			continue;
 		}
-		return;
-	}
 
-	work->sync_mode	= WB_SYNC_NONE;
-	work->nr_pages	= nr_pages;
-	work->range_cyclic = range_cyclic;
-	work->reason	= reason;
+		work->sync_mode	= WB_SYNC_NONE;
+		work->nr_pages	= nr_pages;
+		work->range_cyclic = range_cyclic;
+		work->reason	= reason;
+		work->auto_free	= 1;
 
-	bdi_queue_work(bdi, work);
+		wb_queue_work(wb, work);
+	}
 }
 
 /**
@@ -171,14 +282,19 @@ void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages,
  */
 void bdi_start_background_writeback(struct backing_dev_info *bdi)
 {
+	struct bdi_writeback *wb;
+	unsigned int i;
+
 	/*
-	 * We just wake up the flusher thread. It will perform background
+	 * We just wake up the flusher workers. They will perform background
 	 * writeback as soon as there is no other work to do.
 	 */
 	trace_writeback_wake_background(bdi);
-	spin_lock_bh(&bdi->wb_lock);
-	bdi_wakeup_flusher(bdi);
-	spin_unlock_bh(&bdi->wb_lock);
+	bdi_for_each_wb(wb, bdi, i) {
+		spin_lock_bh(&wb->work_lock);
+		wb_wakeup(wb);
+		spin_unlock_bh(&wb->work_lock);
+	}
 }
 
 /*
@@ -186,11 +302,11 @@ void bdi_start_background_writeback(struct backing_dev_info *bdi)
  */
 void inode_wb_list_del(struct inode *inode)
 {
-	struct backing_dev_info *bdi = inode_to_bdi(inode);
+	struct bdi_writeback *wb = inode_to_wb(inode);
 
-	spin_lock(&bdi->wb.list_lock);
+	spin_lock(&wb->list_lock);
 	list_del_init(&inode->i_wb_list);
-	spin_unlock(&bdi->wb.list_lock);
+	spin_unlock(&wb->list_lock);
 }
 
 /*
@@ -227,14 +343,16 @@ static void requeue_io(struct inode *inode, struct bdi_writeback *wb)
 static void inode_sync_complete(struct inode *inode)
 {
 	inode->i_state &= ~I_SYNC;
+	/* If inode is clean and unused, put it back on the LRU now */
+	inode_add_lru(inode);
 	/* Waiters must see I_SYNC cleared before being woken up */
 	smp_mb();
 	wake_up_bit(&inode->i_state, __I_SYNC);
 }
 
-static bool inode_dirtied_after(struct inode *inode, unsigned long t)
+static bool dirtied_after(unsigned long dirtied, unsigned long t)
 {
-	bool ret = time_after(inode->dirtied_when, t);
+	bool ret = time_after(dirtied, t);
 #ifndef CONFIG_64BIT
 	/*
 	 * For inodes being constantly redirtied, dirtied_when can get stuck.
@@ -242,19 +360,26 @@ static bool inode_dirtied_after(struct inode *inode, unsigned long t)
 	 * This test is necessary to prevent such wrapped-around relative times
 	 * from permanently stopping the whole bdi writeback.
 	 */
-	ret = ret && time_before_eq(inode->dirtied_when, jiffies);
+	ret = ret && time_before_eq(dirtied, jiffies);
 #endif
 	return ret;
 }
 
+#define EXPIRE_DIRTY_ATIME	0x0001
+
 /*
  * Move expired (dirtied after work->older_than_this) dirty inodes from
- * @delaying_queue to @dispatch_queue.
+ * @delaying_queue to @dispatch_queue. With EXPIRE_DIRTY_ATIME the inodes
+ * come from b_dirty_time and expire by their first lazy atime update:
+ * a sync wants all of them, other writeback only those older than
+ * dirtytime_expire_interval.
  */
 static int move_expired_inodes(struct list_head *delaying_queue,
 			       struct list_head *dispatch_queue,
-			       struct wb_writeback_work *work)
+			       int flags, struct wb_writeback_work *work)
 {
+	unsigned long *older_than_this = work->older_than_this;
+	unsigned long expire_time;
 	LIST_HEAD(tmp);
 	struct list_head *pos, *node;
 	struct super_block *sb = NULL;
@@ -262,10 +387,17 @@ static int move_expired_inodes(struct list_head *delaying_queue,
 	int do_sb_sort = 0;
 	int moved = 0;
 
+	if ((flags & EXPIRE_DIRTY_ATIME) && work->sync_mode != WB_SYNC_ALL) {
+		expire_time = jiffies - dirtytime_expire_interval * HZ;
+		older_than_this = &expire_time;
+	}
+
 	while (!list_empty(delaying_queue)) {
 		inode = wb_inode(delaying_queue->prev);
-		if (work->older_than_this &&
-		    inode_dirtied_after(inode, *work->older_than_this))
+		if (older_than_this &&
+		    dirtied_after((flags & EXPIRE_DIRTY_ATIME) ?
+				  inode->dirtied_time_when :
+				  inode->dirtied_when, *older_than_this))
 			break;
 		if (sb && sb != inode->i_sb)
 			do_sb_sort = 1;
@@ -309,7 +441,9 @@ static void queue_io(struct bdi_writeback *wb, struct wb_writeback_work *work)
 	int moved;
 	assert_spin_locked(&wb->list_lock);
 	list_splice_init(&wb->b_more_io, &wb->b_io);
-	moved = move_expired_inodes(&wb->b_dirty, &wb->b_io, work);
+	moved = move_expired_inodes(&wb->b_dirty, &wb->b_io, 0, work);
+	moved += move_expired_inodes(&wb->b_dirty_time, &wb->b_io,
+				     EXPIRE_DIRTY_ATIME, work);
 	trace_writeback_queue_io(wb, work, moved);
 }
 
@@ -426,12 +560,22 @@ static void requeue_inode(struct inode *inode, struct bdi_writeback *wb,
 		 * updates after data IO completion.
 		 */
 		redirty_tail(inode, wb);
+	} else if (inode->i_state & I_DIRTY_TIME) {
+		/* Only a lazy atime left, park it until it expires. */
+		inode->dirtied_when = jiffies;
+		list_move(&inode->i_wb_list, &wb->b_dirty_time);
 	} else {
 		/* The inode is clean. Remove from writeback lists. */
 		list_del_init(&inode->i_wb_list);
 	}
 }
 
+static bool inode_dirtytime_expired(struct inode *inode)
+{
+	return !time_after(inode->dirtied_time_when +
+			   dirtytime_expire_interval * HZ, jiffies);
+}
+
 /*
  * Write out an inode and its dirty pages. Do not update the writeback list
  * linkage. That is left to the caller. The caller is also responsible for
@@ -443,6 +587,7 @@ __writeback_single_inode(struct inode *inode, struct bdi_writeback *wb,
 {
 	struct address_space *mapping = inode->i_mapping;
 	long nr_to_write = wbc->nr_to_write;
+	bool dirty_time = false;
 	unsigned dirty;
 	int ret;
 
@@ -472,7 +617,28 @@ __writeback_single_inode(struct inode *inode, struct bdi_writeback *wb,
 		inode->i_state &= ~I_DIRTY_PAGES;
 	dirty = inode->i_state & I_DIRTY;
 	inode->i_state &= ~(I_DIRTY_SYNC | I_DIRTY_DATASYNC);
+	/*
+	 * A lazy atime goes out on data integrity syncs and once it is old
+	 * enough; otherwise it stays in memory.
+	 */
+	if ((inode->i_state & I_DIRTY_TIME) &&
+	    (wbc->sync_mode == WB_SYNC_ALL || inode_dirtytime_expired(inode)))
+		dirty_time = true;
 	spin_unlock(&inode->i_lock);
+
+	if (dirty_time) {
+		/*
+		 * Let the filesystem pick up the timestamps, e.g. into its
+		 * journal; ->dirty_inode still sees I_DIRTY_TIME set. This
+		 * also clears I_DIRTY_TIME, and the inode is written right
+		 * below.
+		 */
+		mark_inode_dirty_sync(inode);
+		spin_lock(&inode->i_lock);
+		inode->i_state &= ~(I_DIRTY_SYNC | I_DIRTY_DATASYNC);
+		spin_unlock(&inode->i_lock);
+		dirty |= I_DIRTY_SYNC;
+	}
 	/* Don't write the inode if only I_DIRTY_PAGES was set */
 	if (dirty & (I_DIRTY_SYNC | I_DIRTY_DATASYNC)) {
 		int err = write_inode(inode, wbc);
@@ -521,7 +687,7 @@ writeback_single_inode(struct inode *inode, struct bdi_writeback *wb,
 	 * here we make sure inode is on some writeback list and leave it there
 	 * unless we have completely cleaned the inode.
 	 */
-	if (!(inode->i_state & I_DIRTY))
+	if (!(inode->i_state & I_DIRTY_ALL))
 		goto out;
 	inode->i_state |= I_SYNC;
 	spin_unlock(&inode->i_lock);
@@ -534,7 +700,7 @@ writeback_single_inode(struct inode *inode, struct bdi_writeback *wb,
 	 * If inode is clean, remove it from writeback lists. Otherwise don't
 	 * touch it. See comment above for explanation.
 	 */
-	if (!(inode->i_state & I_DIRTY))
+	if (!(inode->i_state & I_DIRTY_ALL))
 		list_del_init(&inode->i_wb_list);
 	spin_unlock(&wb->list_lock);
 	inode_sync_complete(inode);
@@ -679,7 +845,7 @@ static long writeback_sb_inodes(struct super_block *sb,
 		wrote += write_chunk - wbc.nr_to_write;
 		spin_lock(&wb->list_lock);
 		spin_lock(&inode->i_lock);
-		if (!(inode->i_state & I_DIRTY))
+		if (!(inode->i_state & I_DIRTY_ALL))
 			wrote++;
 		requeue_inode(inode, wb, &wbc);
 		inode_sync_complete(inode);
@@ -776,6 +942,8 @@ static bool over_bground_thresh(struct backing_dev_info *bdi)
 static void wb_update_bandwidth(struct bdi_writeback *wb,
 				unsigned long start_time)
 {
+	if (wb != &wb->bdi->wb)
+		return;
 	__bdi_update_bandwidth(wb->bdi, 0, 0, 0, 0, 0, start_time);
 }
 
@@ -821,7 +989,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 * after the other works are all done.
 		 */
 		if ((work->for_background || work->for_kupdate) &&
-		    !list_empty(&wb->bdi->work_list))
+		    !list_empty(&wb->work_list))
 			break;
 
 		/*
@@ -892,18 +1060,17 @@ static long wb_writeback(struct bdi_writeback *wb,
 /*
  * Return the next wb_writeback_work struct that hasn't been processed yet.
  */
-static struct wb_writeback_work *
-get_next_work_item(struct backing_dev_info *bdi)
+static struct wb_writeback_work *get_next_work_item(struct bdi_writeback *wb)
 {
 	struct wb_writeback_work *work = NULL;
 
-	spin_lock_bh(&bdi->wb_lock);
-	if (!list_empty(&bdi->work_list)) {
-		work = list_entry(bdi->work_list.next,
+	spin_lock_bh(&wb->work_lock);
+	if (!list_empty(&wb->work_list)) {
+		work = list_entry(wb->work_list.next,
 				  struct wb_writeback_work, list);
 		list_del_init(&work->list);
 	}
-	spin_unlock_bh(&bdi->wb_lock);
+	spin_unlock_bh(&wb->work_lock);
 	return work;
 }
 
@@ -973,17 +1140,17 @@ static long wb_check_old_data_flush(struct bdi_writeback *wb)
 /*
  * Retrieve work items and do the writeback they describe
  */
-long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
+static long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 {
 	struct backing_dev_info *bdi = wb->bdi;
 	struct wb_writeback_work *work;
 	long wrote = 0;
 
-	set_bit(BDI_writeback_running, &wb->bdi->state);
-	while ((work = get_next_work_item(bdi)) != NULL) {
+	set_bit(WB_writeback_running, &wb->state);
+	while ((work = get_next_work_item(wb)) != NULL) {
 		/*
 		 * Override sync mode, in case we must wait for completion
-		 * because this thread is exiting now.
+		 * because this bdi is going away now.
 		 */
 		if (force_wait)
 			work->sync_mode = WB_SYNC_ALL;
@@ -991,15 +1158,13 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 		trace_writeback_exec(bdi, work);
 
 		wrote += wb_writeback(wb, work);
+		wb->nr_works++;
 
 		/*
 		 * Notify the caller of completion if this is a synchronous
-		 * work item, otherwise just free it.
+		 * work item, and free it if it was allocated for us.
 		 */
-		if (work->done)
-			complete(work->done);
-		else
-			kfree(work);
+		finish_writeback_work(wb, work);
 	}
 
 	/*
@@ -1007,70 +1172,45 @@ long wb_do_writeback(struct bdi_writeback *wb, int force_wait)
 	 */
 	wrote += wb_check_old_data_flush(wb);
 	wrote += wb_check_background_flush(wb);
-	clear_bit(BDI_writeback_running, &wb->bdi->state);
+	clear_bit(WB_writeback_running, &wb->state);
 
+	wb->nr_written += wrote;
 	return wrote;
 }
 
 /*
- * Handle writeback of dirty data for the device backed by this bdi. Also
- * wakes up periodically and does kupdated style flushing.
+ * Handle writeback of dirty data for one worker of the device backed by
+ * this bdi. Runs off bdi_wq whenever work is queued for the worker, and
+ * re-arms itself for kupdated style flushing as long as it has dirty
+ * inodes. An idle worker costs nothing.
  */
-int bdi_writeback_thread(void *data)
+void bdi_writeback_workfn(struct work_struct *work)
 {
-	struct bdi_writeback *wb = data;
+	struct bdi_writeback *wb = container_of(to_delayed_work(work),
+						struct bdi_writeback, dwork);
 	struct backing_dev_info *bdi = wb->bdi;
 	long pages_written;
 
 	current->flags |= PF_SWAPWRITE;
-	set_freezable();
-	wb->last_active = jiffies;
 
 	/*
-	 * Our parent may run at a different priority, just set us to normal
+	 * Keep writing back until the work_list is empty. Once @bdi is
+	 * off bdi_list it is being shut down, and whatever is still queued
+	 * has to be written out and waited for.
 	 */
-	set_user_nice(current, 0);
-
-	trace_writeback_thread_start(bdi);
-
-	while (!kthread_freezable_should_stop(NULL)) {
-		/*
-		 * Remove own delayed wake-up timer, since we are already awake
-		 * and we'll take care of the preriodic write-back.
-		 */
-		del_timer(&wb->wakeup_timer);
-
-		pages_written = wb_do_writeback(wb, 0);
-
+	do {
+		pages_written = wb_do_writeback(wb, list_empty(&bdi->bdi_list));
 		trace_writeback_pages_written(pages_written);
+	} while (!list_empty(&wb->work_list));
 
-		if (pages_written)
-			wb->last_active = jiffies;
-
-		set_current_state(TASK_INTERRUPTIBLE);
-		if (!list_empty(&bdi->work_list) || kthread_should_stop()) {
-			__set_current_state(TASK_RUNNING);
-			continue;
-		}
-
-		if (wb_has_dirty_io(wb) && dirty_writeback_interval)
-			schedule_timeout(msecs_to_jiffies(dirty_writeback_interval * 10));
-		else {
-			/*
-			 * We have nothing to do, so can go sleep without any
-			 * timeout and save power. When a work is queued or
-			 * something is made dirty - we will be woken up.
-			 */
-			schedule();
-		}
-	}
-
-	/* Flush any work that raced with us exiting */
-	if (!list_empty(&bdi->work_list))
-		wb_do_writeback(wb, 1);
+	spin_lock_bh(&wb->work_lock);
+	if (test_bit(WB_registered, &wb->state) &&
+	    wb_has_dirty_io(wb) && dirty_writeback_interval)
+		queue_delayed_work(bdi_wq, &wb->dwork,
+			msecs_to_jiffies(dirty_writeback_interval * 10));
+	spin_unlock_bh(&wb->work_lock);
 
-	trace_writeback_thread_stop(bdi);
-	return 0;
+	current->flags &= ~PF_SWAPWRITE;
 }
 
 
@@ -1096,6 +1236,60 @@ void wakeup_flusher_threads(long nr_pages, enum wb_reason reason)
 	rcu_read_unlock();
 }
 
+/*
+ * Inodes with only a lazy atime sit on b_dirty_time, where the periodic
+ * writeback does not look for them unless something else kicks the
+ * worker. Kick the workers holding such inodes once per
+ * dirtytime_expire_interval so that the atime makes it to the disk even
+ * on an otherwise idle system.
+ */
+static void wakeup_dirtytime_writeback(struct work_struct *w);
+static DECLARE_DELAYED_WORK(dirtytime_work, wakeup_dirtytime_writeback);
+
+static void wakeup_dirtytime_writeback(struct work_struct *w)
+{
+	struct backing_dev_info *bdi;
+	struct bdi_writeback *wb;
+	unsigned int i;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(bdi, &bdi_list, bdi_list) {
+		bdi_for_each_wb(wb, bdi, i) {
+			if (list_empty(&wb->b_dirty_time))
+				continue;
+			spin_lock_bh(&wb->work_lock);
+			wb_wakeup(wb);
+			spin_unlock_bh(&wb->work_lock);
+		}
+	}
+	rcu_read_unlock();
+	if (dirtytime_expire_interval)
+		schedule_delayed_work(&dirtytime_work,
+				      dirtytime_expire_interval * HZ);
+}
+
+static int __init start_dirtytime_writeback(void)
+{
+	if (dirtytime_expire_interval)
+		schedule_delayed_work(&dirtytime_work,
+				      dirtytime_expire_interval * HZ);
+	return 0;
+}
+__initcall(start_dirtytime_writeback);
+
+int dirtytime_interval_handler(struct ctl_table *table, int write,
+			       void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (ret == 0 && write) {
+		cancel_delayed_work(&dirtytime_work);
+		schedule_delayed_work(&dirtytime_work, 0);
+	}
+	return ret;
+}
+
 static noinline void block_dump___mark_inode_dirty(struct inode *inode)
 {
 	if (inode->i_ino || strcmp(inode->i_sb->s_id, "bdev")) {
@@ -1118,6 +1312,55 @@ static noinline void block_dump___mark_inode_dirty(struct inode *inode)
 	}
 }
 
+#ifdef CONFIG_BLK_CGROUP
+/*
+ * The flusher writes back the pages of all cgroups, so the block layer
+ * cannot tell from the issuing task whom buffered writeback is done for.
+ * Record the blkio cgroup of the task which first dirties the pages of a
+ * clean inode instead; submit_bio() charges the write-out of those pages
+ * to it.  The kernel threads doing writeback themselves keep the owner.
+ *
+ * The owner is replaced under i_lock.  Readers look at it under RCU and
+ * have to css_tryget() it, a cgroup is only freed an RCU grace period
+ * after the last reference to it has gone.
+ */
+static void inode_set_blkcg(struct inode *inode)
+{
+	struct cgroup_subsys_state *css, *old;
+
+	if (current->flags & PF_KTHREAD)
+		return;
+
+	rcu_read_lock();
+	css = task_subsys_state(current, blkio_subsys_id);
+	/* the root cgroup is what unowned writeback is charged to anyway */
+	if (!css->cgroup->parent || !css_tryget(css))
+		css = NULL;
+	rcu_read_unlock();
+
+	old = rcu_dereference_protected(inode->i_blkcg_css,
+					lockdep_is_held(&inode->i_lock));
+	rcu_assign_pointer(inode->i_blkcg_css, css);
+	if (old)
+		css_put(old);
+}
+
+void inode_put_blkcg(struct inode *inode)
+{
+	struct cgroup_subsys_state *css;
+
+	css = rcu_dereference_protected(inode->i_blkcg_css, 1);
+	if (css) {
+		RCU_INIT_POINTER(inode->i_blkcg_css, NULL);
+		css_put(css);
+	}
+}
+#else
+static inline void inode_set_blkcg(struct inode *inode)
+{
+}
+#endif
+
 /**
  *	__mark_inode_dirty -	internal function
  *	@inode: inode to mark
@@ -1146,6 +1389,8 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 {
 	struct super_block *sb = inode->i_sb;
 	struct backing_dev_info *bdi = NULL;
+	struct bdi_writeback *wb;
+	int dirtytime;
 
 	/*
 	 * Don't do this for I_DIRTY_PAGES - that doesn't actually
@@ -1154,7 +1399,10 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 	if (flags & (I_DIRTY_SYNC | I_DIRTY_DATASYNC)) {
 		if (sb->s_op->dirty_inode)
 			sb->s_op->dirty_inode(inode, flags);
+		/* the inode write will carry the timestamps as well */
+		flags &= ~I_DIRTY_TIME;
 	}
+	dirtytime = flags & I_DIRTY_TIME;
 
 	/*
 	 * make sure that changes are seen by all cpus before we test i_state
@@ -1163,16 +1411,26 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 	smp_mb();
 
 	/* avoid the locking if we can */
-	if ((inode->i_state & flags) == flags)
+	if ((inode->i_state & flags) == flags ||
+	    (dirtytime && (inode->i_state & (I_DIRTY_SYNC | I_DIRTY_DATASYNC))))
 		return;
 
 	if (unlikely(block_dump))
 		block_dump___mark_inode_dirty(inode);
 
 	spin_lock(&inode->i_lock);
+	if (dirtytime && (inode->i_state & (I_DIRTY_SYNC | I_DIRTY_DATASYNC)))
+		goto out_unlock_inode;
 	if ((inode->i_state & flags) != flags) {
 		const int was_dirty = inode->i_state & I_DIRTY;
 
+		if (flags & (I_DIRTY_SYNC | I_DIRTY_DATASYNC))
+			inode->i_state &= ~I_DIRTY_TIME;
+		if (dirtytime)
+			inode->dirtied_time_when = jiffies;
+		if ((flags & I_DIRTY_PAGES) &&
+		    !(inode->i_state & I_DIRTY_PAGES))
+			inode_set_blkcg(inode);
 		inode->i_state |= flags;
 
 		/*
@@ -1197,33 +1455,37 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		/*
 		 * If the inode was already on b_dirty/b_io/b_more_io, don't
 		 * reposition it (that would break b_dirty time-ordering).
+		 * An inode that only had a lazy atime moves from b_dirty_time
+		 * to b_dirty here.
 		 */
 		if (!was_dirty) {
 			bool wakeup_bdi = false;
 			bdi = inode_to_bdi(inode);
+			wb = bdi_inode_wb(bdi, inode);
 
-			if (bdi_cap_writeback_dirty(bdi)) {
+			/* a lazy atime alone is left to dirtytime_work */
+			if (bdi_cap_writeback_dirty(bdi) && !dirtytime) {
 				WARN(!test_bit(BDI_registered, &bdi->state),
 				     "bdi-%s not registered\n", bdi->name);
 
 				/*
 				 * If this is the first dirty inode for this
-				 * bdi, we have to wake-up the corresponding
-				 * bdi thread to make sure background
-				 * write-back happens later.
+				 * worker, we have to kick it to make sure
+				 * background write-back happens later.
 				 */
-				if (!wb_has_dirty_io(&bdi->wb))
+				if (!wb_has_dirty_io(wb))
 					wakeup_bdi = true;
 			}
 
 			spin_unlock(&inode->i_lock);
-			spin_lock(&bdi->wb.list_lock);
+			spin_lock(&wb->list_lock);
 			inode->dirtied_when = jiffies;
-			list_move(&inode->i_wb_list, &bdi->wb.b_dirty);
-			spin_unlock(&bdi->wb.list_lock);
+			list_move(&inode->i_wb_list, dirtytime ?
+				  &wb->b_dirty_time : &wb->b_dirty);
+			spin_unlock(&wb->list_lock);
 
 			if (wakeup_bdi)
-				bdi_wakeup_thread_delayed(bdi);
+				wb_wakeup_delayed(wb);
 			return;
 		}
 	}
@@ -1300,7 +1562,7 @@ void writeback_inodes_sb_nr(struct super_block *sb,
 			    unsigned long nr,
 			    enum wb_reason reason)
 {
-	DECLARE_COMPLETION_ONSTACK(done);
+	DEFINE_WB_COMPLETION_ONSTACK(done);
 	struct wb_writeback_work work = {
 		.sb			= sb,
 		.sync_mode		= WB_SYNC_NONE,
@@ -1313,8 +1575,8 @@ void writeback_inodes_sb_nr(struct super_block *sb,
 	if (sb->s_bdi == &noop_backing_dev_info)
 		return;
 	WARN_ON(!rwsem_is_locked(&sb->s_umount));
-	bdi_queue_work(sb->s_bdi, &work);
-	wait_for_completion(&done);
+	bdi_split_work_to_wbs(sb->s_bdi, &work);
+	wb_wait_for_completion(sb->s_bdi, &done);
 }
 EXPORT_SYMBOL(writeback_inodes_sb_nr);
 
@@ -1385,7 +1647,7 @@ EXPORT_SYMBOL(writeback_inodes_sb_nr_if_idle);
  */
 void sync_inodes_sb(struct super_block *sb)
 {
-	DECLARE_COMPLETION_ONSTACK(done);
+	DEFINE_WB_COMPLETION_ONSTACK(done);
 	struct wb_writeback_work work = {
 		.sb		= sb,
 		.sync_mode	= WB_SYNC_ALL,
@@ -1400,8 +1662,8 @@ void sync_inodes_sb(struct super_block *sb)
 		return;
 	WARN_ON(!rwsem_is_locked(&sb->s_umount));
 
-	bdi_queue_work(sb->s_bdi, &work);
-	wait_for_completion(&done);
+	bdi_split_work_to_wbs(sb->s_bdi, &work);
+	wb_wait_for_completion(sb->s_bdi, &done);
 
 	wait_sb_inodes(sb);
 }
@@ -1419,7 +1681,7 @@ EXPORT_SYMBOL(sync_inodes_sb);
  */
 int write_inode_now(struct inode *inode, int sync)
 {
-	struct bdi_writeback *wb = &inode_to_bdi(inode)->wb;
+	struct bdi_writeback *wb = inode_to_wb(inode);
 	struct writeback_control wbc = {
 		.nr_to_write = LONG_MAX,
 		.sync_mode = sync ? WB_SYNC_ALL : WB_SYNC_NONE,
@@ -1448,7 +1710,7 @@ EXPORT_SYMBOL(write_inode_now);
  */
 int sync_inode(struct inode *inode, struct writeback_control *wbc)
 {
-	return writeback_single_inode(inode, &inode_to_bdi(inode)->wb, wbc);
+	return writeback_single_inode(inode, inode_to_wb(inode), wbc);
 }
 EXPORT_SYMBOL(sync_inode);
 
@@ -0,0 +1,1099 @@
+/*
+ *  fs/io_uring.c
+ *
+ *  Shared application/kernel submission and completion ring pairs, for
+ *  asynchronous I/O.
+ *
+ *  The application fills io_uring_sqe entries in the submission queue
+ *  (SQ) and publishes them by moving the SQ tail; io_uring_enter() then
+ *  consumes them and moves the SQ head.  Completions are posted to the
+ *  completion queue (CQ) by the kernel, which moves the CQ tail; the
+ *  application reaps them and moves the CQ head.  All rings live in
+ *  kernel pages that the application mmap()s, so entries are never
+ *  copied through system call arguments, and reaping needs no system
+ *  call at all.
+ *
+ *  Requests that can complete without blocking, buffered reads of data
+ *  already in the page cache, run in io_uring_enter() itself.  For other
+ *  buffered reads, page cache readahead is started at submission, and the
+ *  read is handed to a workqueue that finds the pages under I/O.  All
+ *  remaining requests run from the workqueue, in the submitter's mm and
+ *  with its credentials.
+ *
+ *  Files and buffers can be registered with the ring up front: a fixed
+ *  file skips the fget()/fput() per request, and a fixed buffer stays
+ *  pinned for as long as it is registered.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/cred.h>
+#include <linux/workqueue.h>
+#include <linux/anon_inodes.h>
+#include <linux/io_uring.h>
+
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+#define IORING_MAX_BUF_SIZE	(1UL << 30)
+
+/* Longest time io_uring_enter() spins for completions on an IOPOLL ring */
+#define IORING_POLL_BUDGET_NS	(100 * NSEC_PER_USEC)
+
+/* Largest buffered read that is tried inline, in pages */
+#define IORING_INLINE_MAX_PAGES	16
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_mapped_ubuf {
+	u64			ubuf;
+	size_t			len;
+	struct page		**pages;
+	unsigned int		nr_pages;
+};
+
+struct io_ring_ctx {
+	/* submission side, serialized by uring_lock */
+	struct mutex		uring_lock;
+	unsigned int		flags;
+	bool			compat;
+	struct io_uring_sqe	*sq_sqes;
+	unsigned int		cached_sq_head;
+	unsigned int		sq_entries;
+	unsigned int		sq_mask;
+	struct io_sq_ring	*sq_ring;
+
+	/* completion side */
+	spinlock_t		completion_lock ____cacheline_aligned_in_smp;
+	unsigned int		cached_cq_tail;
+	unsigned int		cq_entries;
+	unsigned int		cq_mask;
+	struct io_cq_ring	*cq_ring;
+	wait_queue_head_t	wait;
+
+	/* where and as whom requests run */
+	struct mm_struct	*sqo_mm;
+	const struct cred	*creds;
+	struct workqueue_struct	*sqo_wq;
+
+	/* registered files and buffers, changed with uring_lock held */
+	struct file		**user_files;
+	unsigned int		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned int		nr_user_bufs;
+};
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	bool			fixed_file;
+	struct work_struct	work;
+	struct io_uring_sqe	sqe;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static unsigned int io_cqring_events(struct io_cq_ring *ring)
+{
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	unsigned int tail = ctx->cached_cq_tail;
+	struct io_uring_cqe *cqe;
+
+	/*
+	 * Note: the CQ head is written by the application; the read
+	 * barrier pairs with its release of the entries it consumed.
+	 */
+	smp_rmb();
+	if (tail - ACCESS_ONCE(ring->r.head) == ring->ring_entries) {
+		ring->overflow++;
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = ki_user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	/* the entry must be visible before the tail that covers it */
+	ctx->cached_cq_tail++;
+	smp_wmb();
+	ACCESS_ONCE(ring->r.tail) = ctx->cached_cq_tail;
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+}
+
+static void io_free_req(struct io_kiocb *req)
+{
+	if (req->file && !req->fixed_file)
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+}
+
+static void io_complete_req(struct io_kiocb *req, long res)
+{
+	io_cqring_add_event(req->ctx, req->sqe.user_data, res);
+	io_free_req(req);
+}
+
+static bool io_op_is_read(u8 opcode)
+{
+	return opcode == IORING_OP_READV || opcode == IORING_OP_READ_FIXED;
+}
+
+static bool io_op_is_rw(u8 opcode)
+{
+	return io_op_is_read(opcode) || opcode == IORING_OP_WRITEV ||
+	       opcode == IORING_OP_WRITE_FIXED;
+}
+
+/*
+ * Check that a fixed read or write stays within the registered buffer.
+ */
+static int io_check_fixed_buf(struct io_ring_ctx *ctx,
+			      const struct io_uring_sqe *sqe)
+{
+	struct io_mapped_ubuf *imu;
+	u64 buf_addr = sqe->addr;
+
+	if (unlikely(sqe->buf_index >= ctx->nr_user_bufs))
+		return -EFAULT;
+
+	imu = &ctx->user_bufs[sqe->buf_index];
+	if (buf_addr < imu->ubuf || buf_addr + sqe->len < buf_addr ||
+	    buf_addr + sqe->len > imu->ubuf + imu->len)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int io_prep_req(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file;
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		return ctx->flags & IORING_SETUP_IOPOLL ? -EINVAL : 0;
+	case IORING_OP_FSYNC:
+		if (ctx->flags & IORING_SETUP_IOPOLL)
+			return -EINVAL;
+		if (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)
+			return -EINVAL;
+		break;
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		if (io_check_fixed_buf(ctx, sqe))
+			return -EFAULT;
+		/* fall through */
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+		if ((s64)sqe->off < 0)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files ||
+			     (unsigned int)sqe->fd >= ctx->nr_user_files))
+			return -EBADF;
+		file = ctx->user_files[sqe->fd];
+		req->fixed_file = true;
+	} else {
+		file = fget(sqe->fd);
+		if (!file)
+			return -EBADF;
+	}
+	req->file = file;
+
+	if (io_op_is_rw(sqe->opcode)) {
+		if (!(file->f_mode & FMODE_PREAD))
+			return -ESPIPE;
+		/* only direct I/O completes through polled block queues */
+		if ((ctx->flags & IORING_SETUP_IOPOLL) &&
+		    !(file->f_flags & O_DIRECT))
+			return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+/*
+ * Length of a read, as far as it can be told cheaply in the submitter's
+ * context, or -1.
+ */
+static ssize_t io_read_len(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	void __user *uvec = (void __user *)(unsigned long)sqe->addr;
+	ssize_t len = 0;
+	unsigned int i;
+
+	if (sqe->opcode == IORING_OP_READ_FIXED)
+		return sqe->len;
+
+	if (sqe->len > UIO_FASTIOV)
+		return -1;
+
+	for (i = 0; i < sqe->len; i++) {
+#ifdef CONFIG_COMPAT
+		if (req->ctx->compat) {
+			struct compat_iovec ciov;
+
+			if (copy_from_user(&ciov, uvec + i * sizeof(ciov),
+					   sizeof(ciov)))
+				return -1;
+			len += ciov.iov_len;
+			continue;
+		}
+#endif
+		{
+			struct iovec iov;
+
+			if (copy_from_user(&iov, uvec + i * sizeof(iov),
+					   sizeof(iov)))
+				return -1;
+			if ((ssize_t)iov.iov_len < 0)
+				return -1;
+			len += iov.iov_len;
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Whether the whole range is uptodate in the page cache.  A page may
+ * still be reclaimed before the read gets to it; the read then blocks,
+ * but remains correct.
+ */
+static bool io_range_cached(struct address_space *mapping, loff_t pos,
+			    size_t len)
+{
+	pgoff_t index = pos >> PAGE_CACHE_SHIFT;
+	pgoff_t last = (pos + len - 1) >> PAGE_CACHE_SHIFT;
+
+	if (last - index >= IORING_INLINE_MAX_PAGES)
+		return false;
+
+	for (; index <= last; index++) {
+		struct page *page = find_get_page(mapping, index);
+		bool uptodate = page && PageUptodate(page);
+
+		if (page)
+			page_cache_release(page);
+		if (!uptodate)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * For a buffered read, start readahead of the range, so that a worker
+ * finds it under I/O, and tell whether it can be read right away.
+ */
+static bool io_prep_buffered_read(struct io_kiocb *req)
+{
+	struct file *file = req->file;
+	struct address_space *mapping = file->f_mapping;
+	loff_t pos = req->sqe.off;
+	ssize_t len;
+
+	if (!io_op_is_read(req->sqe.opcode) || (file->f_flags & O_DIRECT) ||
+	    !S_ISREG(file->f_path.dentry->d_inode->i_mode))
+		return false;
+
+	len = io_read_len(req);
+	if (len <= 0)
+		return len == 0;
+
+	if (io_range_cached(mapping, pos, len))
+		return true;
+
+	force_page_cache_readahead(mapping, file, pos >> PAGE_CACHE_SHIFT,
+			((pos + len - 1) >> PAGE_CACHE_SHIFT) -
+			(pos >> PAGE_CACHE_SHIFT) + 1);
+	return false;
+}
+
+static ssize_t io_do_rw(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct file *file = req->file;
+	void __user *buf = (void __user *)(unsigned long)sqe->addr;
+	loff_t pos = sqe->off;
+
+	switch (sqe->opcode) {
+	case IORING_OP_READ_FIXED:
+		return vfs_read(file, buf, sqe->len, &pos);
+	case IORING_OP_WRITE_FIXED:
+		return vfs_write(file, buf, sqe->len, &pos);
+#ifdef CONFIG_COMPAT
+	case IORING_OP_READV:
+		if (req->ctx->compat)
+			return compat_readv(file, compat_ptr(sqe->addr),
+					    sqe->len, &pos);
+		return vfs_readv(file, buf, sqe->len, &pos);
+	case IORING_OP_WRITEV:
+		if (req->ctx->compat)
+			return compat_writev(file, compat_ptr(sqe->addr),
+					     sqe->len, &pos);
+		return vfs_writev(file, buf, sqe->len, &pos);
+#else
+	case IORING_OP_READV:
+		return vfs_readv(file, buf, sqe->len, &pos);
+	case IORING_OP_WRITEV:
+		return vfs_writev(file, buf, sqe->len, &pos);
+#endif
+	}
+	return -EINVAL;
+}
+
+static long io_do_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t end = sqe->off + sqe->len;
+
+	return vfs_fsync_range(req->file, sqe->off,
+			       sqe->len ? end - 1 : LLONG_MAX,
+			       sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct cred *old_cred;
+	mm_segment_t old_fs = get_fs();
+	long ret;
+
+	old_cred = override_creds(ctx->creds);
+
+	if (req->sqe.opcode == IORING_OP_FSYNC) {
+		ret = io_do_fsync(req);
+	} else if (!atomic_inc_not_zero(&ctx->sqo_mm->mm_users)) {
+		/* the submitter has exited, and its buffers with it */
+		ret = -EFAULT;
+	} else {
+		/* kworkers run with KERNEL_DS, user pointers must be checked */
+		set_fs(USER_DS);
+		use_mm(ctx->sqo_mm);
+		ret = io_do_rw(req);
+		unuse_mm(ctx->sqo_mm);
+		set_fs(old_fs);
+		mmput(ctx->sqo_mm);
+	}
+
+	revert_creds(old_cred);
+	io_complete_req(req, ret);
+}
+
+static int io_submit_sqe(struct io_ring_ctx *ctx,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_kiocb *req;
+	int ret;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	/* the application may change the sqe under us: work on a copy */
+	memcpy(&req->sqe, sqe, sizeof(req->sqe));
+	req->ctx = ctx;
+	req->file = NULL;
+	req->fixed_file = false;
+
+	ret = io_prep_req(ctx, req);
+	if (ret) {
+		io_complete_req(req, ret);
+		return 0;
+	}
+
+	if (req->sqe.opcode == IORING_OP_NOP) {
+		io_complete_req(req, 0);
+		return 0;
+	}
+
+	if (io_prep_buffered_read(req)) {
+		io_complete_req(req, io_do_rw(req));
+		return 0;
+	}
+
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	queue_work(ctx->sqo_wq, &req->work);
+	return 0;
+}
+
+static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned int submitted = 0;
+	int ret = 0;
+
+	while (submitted < to_submit) {
+		unsigned int head = ctx->cached_sq_head;
+		unsigned int index;
+
+		/* pairs with the application's release of new entries */
+		smp_rmb();
+		if (head == ACCESS_ONCE(ring->r.tail))
+			break;
+
+		index = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		if (unlikely(index >= ctx->sq_entries)) {
+			ring->dropped++;
+			ctx->cached_sq_head++;
+			continue;
+		}
+
+		ret = io_submit_sqe(ctx, &ctx->sq_sqes[index]);
+		if (ret)
+			break;
+
+		ctx->cached_sq_head++;
+		submitted++;
+	}
+
+	/* the application may reuse the consumed entries from now on */
+	smp_mb();
+	ACCESS_ONCE(ring->r.head) = ctx->cached_sq_head;
+
+	return submitted ? submitted : ret;
+}
+
+/*
+ * Wait until at least @min_events completions are in the CQ ring.  An
+ * IOPOLL ring spins for a while first, the completions of its direct
+ * I/O being polled for by the workers as well.
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned int min_events)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	int ret;
+
+	if (min_events > ctx->cq_entries)
+		min_events = ctx->cq_entries;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (ctx->flags & IORING_SETUP_IOPOLL) {
+		u64 end = local_clock() + IORING_POLL_BUDGET_NS;
+
+		while (io_cqring_events(ring) < min_events) {
+			if (need_resched() || signal_pending(current) ||
+			    local_clock() > end)
+				break;
+			cpu_relax();
+		}
+	}
+
+	ret = wait_event_interruptible(ctx->wait,
+				       io_cqring_events(ring) >= min_events);
+	return ret ? -EINTR : 0;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned int nr_args)
+{
+	__s32 __user *fds = (__s32 __user *)arg;
+	unsigned int i;
+	int ret = 0;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		s32 fd;
+
+		ret = -EFAULT;
+		if (get_user(fd, &fds[i]))
+			break;
+
+		ret = -EBADF;
+		ctx->user_files[i] = fget(fd);
+		if (!ctx->user_files[i])
+			break;
+
+		/* a ring must not hold itself, or another ring, open */
+		ret = -EBADF;
+		if (ctx->user_files[i]->f_op == &io_uring_fops) {
+			fput(ctx->user_files[i]);
+			break;
+		}
+
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+
+	return ret;
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned long nr_pages = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		struct io_mapped_ubuf *imu = &ctx->user_bufs[i];
+
+		for (j = 0; j < imu->nr_pages; j++)
+			put_page(imu->pages[j]);
+		nr_pages += imu->nr_pages;
+		if (is_vmalloc_addr(imu->pages))
+			vfree(imu->pages);
+		else
+			kfree(imu->pages);
+	}
+
+	down_write(&ctx->sqo_mm->mmap_sem);
+	ctx->sqo_mm->pinned_vm -= nr_pages;
+	up_write(&ctx->sqo_mm->mmap_sem);
+
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_sqe_buffer_pin(struct io_mapped_ubuf *imu, struct iovec *iov)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long ubuf = (unsigned long)iov->iov_base;
+	unsigned long start = ubuf >> PAGE_SHIFT;
+	unsigned long end = (ubuf + iov->iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	unsigned long lock_limit;
+	size_t size = (end - start) * sizeof(struct page *);
+	int nr_pages = end - start;
+	int pinned, ret;
+
+	if (!iov->iov_base || !iov->iov_len || iov->iov_len > IORING_MAX_BUF_SIZE)
+		return -EFAULT;
+
+	imu->pages = size > PAGE_SIZE ? vmalloc(size) :
+					kmalloc(size, GFP_KERNEL);
+	if (!imu->pages)
+		return -ENOMEM;
+
+	lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+
+	down_write(&mm->mmap_sem);
+	ret = -ENOMEM;
+	if (mm->pinned_vm + nr_pages > lock_limit && !capable(CAP_IPC_LOCK))
+		goto out;
+
+	pinned = get_user_pages(current, mm, ubuf & PAGE_MASK, nr_pages,
+				1, 0, imu->pages, NULL);
+	ret = pinned < 0 ? pinned : -EFAULT;
+	if (pinned != nr_pages) {
+		while (pinned > 0)
+			put_page(imu->pages[--pinned]);
+		goto out;
+	}
+
+	mm->pinned_vm += nr_pages;
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	imu->nr_pages = nr_pages;
+	ret = 0;
+out:
+	up_write(&mm->mmap_sem);
+	if (ret) {
+		if (is_vmalloc_addr(imu->pages))
+			vfree(imu->pages);
+		else
+			kfree(imu->pages);
+	}
+	return ret;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned int nr_args)
+{
+	unsigned int i;
+	int ret = 0;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		struct iovec iov;
+
+		ret = -EFAULT;
+#ifdef CONFIG_COMPAT
+		if (ctx->compat) {
+			struct compat_iovec __user *ciovs = arg;
+			struct compat_iovec ciov;
+
+			if (copy_from_user(&ciov, &ciovs[i], sizeof(ciov)))
+				break;
+			iov.iov_base = compat_ptr(ciov.iov_base);
+			iov.iov_len = ciov.iov_len;
+		} else
+#endif
+		if (copy_from_user(&iov, (struct iovec __user *)arg + i,
+				   sizeof(iov)))
+			break;
+
+		ret = io_sqe_buffer_pin(&ctx->user_bufs[i], &iov);
+		if (ret)
+			break;
+		ctx->nr_user_bufs++;
+	}
+
+	if (ret)
+		io_sqe_buffer_unregister(ctx);
+
+	return ret;
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_COMP;
+
+	return (void *)__get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long)ptr, get_order(size));
+}
+
+static size_t io_sq_ring_size(unsigned int entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_cq_ring_size(unsigned int entries)
+{
+	return sizeof(struct io_cq_ring) + entries * sizeof(struct io_uring_cqe);
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	/* lets every request in flight complete */
+	if (ctx->sqo_wq)
+		destroy_workqueue(ctx->sqo_wq);
+
+	io_sqe_files_unregister(ctx);
+	if (ctx->user_bufs)
+		io_sqe_buffer_unregister(ctx);
+
+	io_mem_free(ctx->sq_ring, io_sq_ring_size(ctx->sq_entries));
+	io_mem_free(ctx->sq_sqes,
+		    ctx->sq_entries * sizeof(struct io_uring_sqe));
+	io_mem_free(ctx->cq_ring, io_cq_ring_size(ctx->cq_entries));
+
+	mmdrop(ctx->sqo_mm);
+	put_cred(ctx->creds);
+	kfree(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	io_ring_ctx_free(file->private_data);
+	return 0;
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->wait, wait);
+
+	/* see io_ring_submit() and io_cqring_fill_event() */
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx->cq_ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t)vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	size_t ring_sz;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		ring_sz = io_sq_ring_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		ring_sz = ctx->sq_entries * sizeof(struct io_uring_sqe);
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		ring_sz = io_cq_ring_size(ctx->cq_entries);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > PAGE_ALIGN(ring_sz))
+		return -EINVAL;
+
+	/* the mapping holds the file, and so the rings, until it goes */
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(ptr) >> PAGE_SHIFT, sz,
+			       vma->vm_page_prot);
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+SYSCALL_DEFINE4(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int submitted = 0;
+	int ret;
+
+	if (flags & ~IORING_ENTER_GETEVENTS)
+		return -EINVAL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+
+	/* the ring's buffers live in the mm that set it up */
+	ret = -EPERM;
+	if (current->mm != ctx->sqo_mm)
+		goto out_fput;
+
+	ret = 0;
+	if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_ring_submit(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (submitted < 0) {
+			ret = submitted;
+			goto out_fput;
+		}
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS)
+		ret = io_cqring_wait(ctx, min_complete);
+
+	/* report what was submitted, even if the wait was interrupted */
+	if (submitted)
+		ret = submitted;
+
+out_fput:
+	fput(file);
+	return ret;
+}
+
+static int io_allocate_rings(struct io_ring_ctx *ctx,
+			     struct io_uring_params *p)
+{
+	ctx->sq_ring = io_mem_alloc(io_sq_ring_size(p->sq_entries));
+	if (!ctx->sq_ring)
+		return -ENOMEM;
+	ctx->sq_ring->ring_mask = p->sq_entries - 1;
+	ctx->sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = ctx->sq_ring->ring_mask;
+	ctx->sq_entries = ctx->sq_ring->ring_entries;
+
+	ctx->sq_sqes = io_mem_alloc(p->sq_entries * sizeof(struct io_uring_sqe));
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	ctx->cq_ring = io_mem_alloc(io_cq_ring_size(p->cq_entries));
+	if (!ctx->cq_ring)
+		return -ENOMEM;
+	ctx->cq_ring->ring_mask = p->cq_entries - 1;
+	ctx->cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = ctx->cq_ring->ring_mask;
+	ctx->cq_entries = ctx->cq_ring->ring_entries;
+
+	return 0;
+}
+
+static void io_fill_offsets(struct io_uring_params *p)
+{
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+}
+
+static int io_uring_create(unsigned int entries, struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring, as requests completing
+	 * out of order may still be in flight when the SQ ring is reused.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->flags = p->flags;
+	ctx->compat = is_compat_task();
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->completion_lock);
+	init_waitqueue_head(&ctx->wait);
+
+	ctx->sqo_mm = current->mm;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+	ctx->creds = get_current_cred();
+
+	ret = io_allocate_rings(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = -ENOMEM;
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+				      min(ctx->sq_entries - 1,
+					  2 * num_online_cpus()));
+	if (!ctx->sqo_wq)
+		goto err;
+
+	ret = anon_inode_getfd("[io_uring]", &io_uring_fops, ctx,
+			       O_RDWR | O_CLOEXEC);
+	if (ret < 0)
+		goto err;
+
+	io_fill_offsets(p);
+	return ret;
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Set up a ring and return its fd.  The application asks for a number of
+ * submission entries; the actual SQ and CQ ring sizes, and the offsets to
+ * mmap() them with, are returned in the params structure.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	unsigned int i;
+	int ret;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	if (p.flags & ~IORING_SETUP_IOPOLL)
+		return -EINVAL;
+
+	/* requests run in, and buffers come from, the caller's mm */
+	if (!current->mm)
+		return -EINVAL;
+
+	ret = io_uring_create(entries, &p);
+	if (ret < 0)
+		return ret;
+
+	if (copy_to_user(params, &p, sizeof(p))) {
+		sys_close(ret);
+		return -EFAULT;
+	}
+
+	return ret;
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	long ret;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+
+	ret = -EPERM;
+	if (current->mm != ctx->sqo_mm)
+		goto out_fput;
+
+	/*
+	 * No new request can be submitted while uring_lock is held, and
+	 * flushing the workqueue lets those in flight finish with the
+	 * files and buffers about to change.
+	 */
+	mutex_lock(&ctx->uring_lock);
+	flush_workqueue(ctx->sqo_wq);
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		io_sqe_buffer_unregister(ctx);
+		ret = 0;
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		io_sqe_files_unregister(ctx);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
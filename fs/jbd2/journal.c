@@ -96,6 +96,7 @@ EXPORT_SYMBOL(jbd2_inode_cache);
 
 static void __journal_abort_soft (journal_t *journal, int errno);
 static int jbd2_journal_create_slab(size_t slab_size);
+static void jbd2_write_superblock(journal_t *journal, int write_op);
 
 /* Checksumming functions */
 int jbd2_verify_csum_type(journal_t *j, journal_superblock_t *sb)
@@ -748,6 +749,58 @@ int jbd2_journal_bmap(journal_t *journal, unsigned long blocknr,
 	return err;
 }
 
+/**
+ * jbd2_fc_begin() - make sure recovery looks at the fast commit area
+ * @journal: Journal to act on.
+ *
+ * A journal that was flushed empty has s_start == 0 on disk, and recovery
+ * then skips the fast commit area along with the log.  Write the log tail
+ * out before the filesystem relies on a fast commit, as the commit of the
+ * running transaction would.
+ */
+void jbd2_fc_begin(journal_t *journal)
+{
+	if (!(journal->j_flags & JBD2_FLUSHED))
+		return;
+	mutex_lock(&journal->j_checkpoint_mutex);
+	if (journal->j_flags & JBD2_FLUSHED)
+		jbd2_journal_update_sb_log_tail(journal,
+						journal->j_tail_sequence,
+						journal->j_tail,
+						WRITE_FUA);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+}
+EXPORT_SYMBOL(jbd2_fc_begin);
+
+/**
+ * jbd2_fc_get_buf() - get the buffer of a fast commit area block
+ * @journal: Journal to act on.
+ * @idx: index of the block in the fast commit area
+ * @bh_out: where to return the buffer
+ *
+ * The buffer is not read in; the caller fills and writes it.  Returns
+ * -ENOSPC if @idx is past the end of the area.
+ */
+int jbd2_fc_get_buf(journal_t *journal, unsigned long idx,
+		    struct buffer_head **bh_out)
+{
+	unsigned long long pblock;
+	struct buffer_head *bh;
+	int err;
+
+	if (idx >= journal->j_fc_last - journal->j_fc_first)
+		return -ENOSPC;
+	err = jbd2_journal_bmap(journal, journal->j_fc_first + idx, &pblock);
+	if (err)
+		return err;
+	bh = __getblk(journal->j_dev, pblock, journal->j_blocksize);
+	if (!bh)
+		return -ENOMEM;
+	*bh_out = bh;
+	return 0;
+}
+EXPORT_SYMBOL(jbd2_fc_get_buf);
+
 /*
  * We play buffer_head aliasing tricks to write data/metadata blocks to
  * the journal without copying their contents, but for journal
@@ -1206,6 +1259,56 @@ static void journal_fail_superblock (journal_t *journal)
 	journal->j_sb_buffer = NULL;
 }
 
+/*
+ * Number of blocks at the end of the journal set aside for fast commits,
+ * zero without the fast commit feature.
+ */
+static unsigned long jbd2_fc_nr_blocks(journal_t *journal)
+{
+	unsigned long num;
+
+	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
+				       JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		return 0;
+	num = be32_to_cpu(journal->j_superblock->s_num_fc_blks);
+	return num ? num : JBD2_DEFAULT_FAST_COMMIT_BLOCKS;
+}
+
+/*
+ * Move the end of the log to leave room for the fast commit area, or to
+ * take it back.  Only valid while the log is empty, that is right after
+ * jbd2_journal_load(); the superblock is written out at once since
+ * recovery needs to know where the log wraps.
+ */
+static int jbd2_fc_resize_log(journal_t *journal)
+{
+	journal_superblock_t *sb = journal->j_superblock;
+	unsigned long maxlen = be32_to_cpu(sb->s_maxlen);
+	unsigned long last = maxlen - jbd2_fc_nr_blocks(journal);
+
+	if (journal->j_first + JBD2_MIN_JOURNAL_BLOCKS > last + 1)
+		return -ENOSPC;
+
+	write_lock(&journal->j_state_lock);
+	if (journal->j_running_transaction ||
+	    journal->j_committing_transaction ||
+	    journal->j_checkpoint_transactions ||
+	    journal->j_head != journal->j_tail) {
+		write_unlock(&journal->j_state_lock);
+		return -EBUSY;
+	}
+	journal->j_last = last;
+	journal->j_fc_first = last;
+	journal->j_fc_last = maxlen;
+	journal->j_head = journal->j_tail = journal->j_first;
+	journal->j_free = last - journal->j_first;
+	write_unlock(&journal->j_state_lock);
+
+	jbd2_superblock_csum_set(journal, sb);
+	jbd2_write_superblock(journal, WRITE_FUA);
+	return 0;
+}
+
 /*
  * Given a journal_t structure, initialise the various fields for
  * startup of a new journaling session.  We use this both when creating
@@ -1219,7 +1322,7 @@ static int journal_reset(journal_t *journal)
 	unsigned long long first, last;
 
 	first = be32_to_cpu(sb->s_first);
-	last = be32_to_cpu(sb->s_maxlen);
+	last = be32_to_cpu(sb->s_maxlen) - jbd2_fc_nr_blocks(journal);
 	if (first + JBD2_MIN_JOURNAL_BLOCKS > last + 1) {
 		printk(KERN_ERR "JBD2: Journal too short (blocks %llu-%llu).\n",
 		       first, last);
@@ -1229,6 +1332,8 @@ static int journal_reset(journal_t *journal)
 
 	journal->j_first = first;
 	journal->j_last = last;
+	journal->j_fc_first = last;
+	journal->j_fc_last = be32_to_cpu(sb->s_maxlen);
 
 	journal->j_head = first;
 	journal->j_tail = first;
@@ -1518,7 +1623,10 @@ static int load_superblock(journal_t *journal)
 	journal->j_tail_sequence = be32_to_cpu(sb->s_sequence);
 	journal->j_tail = be32_to_cpu(sb->s_start);
 	journal->j_first = be32_to_cpu(sb->s_first);
-	journal->j_last = be32_to_cpu(sb->s_maxlen);
+	/* recovery has to wrap the log where it was wrapped when written */
+	journal->j_fc_last = be32_to_cpu(sb->s_maxlen);
+	journal->j_last = journal->j_fc_last - jbd2_fc_nr_blocks(journal);
+	journal->j_fc_first = journal->j_last;
 	journal->j_errno = be32_to_cpu(sb->s_errno);
 
 	return 0;
@@ -1787,6 +1895,17 @@ int jbd2_journal_set_features (journal_t *journal, unsigned long compat,
 		sb->s_feature_incompat &=
 			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_CSUM_V2);
 
+	/* The fast commit area is carved out of the end of the log */
+	if (INCOMPAT_FEATURE_ON(JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		sb->s_feature_incompat |=
+			cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+		if (jbd2_fc_resize_log(journal)) {
+			sb->s_feature_incompat &=
+				~cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+			return 0;
+		}
+	}
+
 	sb->s_feature_compat    |= cpu_to_be32(compat);
 	sb->s_feature_ro_compat |= cpu_to_be32(ro);
 	sb->s_feature_incompat  |= cpu_to_be32(incompat);
@@ -1817,6 +1936,19 @@ void jbd2_journal_clear_features(journal_t *journal, unsigned long compat,
 
 	sb = journal->j_superblock;
 
+	if ((incompat & JBD2_FEATURE_INCOMPAT_FAST_COMMIT) &&
+	    JBD2_HAS_INCOMPAT_FEATURE(journal,
+				      JBD2_FEATURE_INCOMPAT_FAST_COMMIT)) {
+		sb->s_feature_incompat &=
+			~cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+		/* the log can only grow back while it is empty */
+		if (jbd2_fc_resize_log(journal)) {
+			sb->s_feature_incompat |=
+				cpu_to_be32(JBD2_FEATURE_INCOMPAT_FAST_COMMIT);
+			incompat &= ~JBD2_FEATURE_INCOMPAT_FAST_COMMIT;
+		}
+	}
+
 	sb->s_feature_compat    &= ~cpu_to_be32(compat);
 	sb->s_feature_ro_compat &= ~cpu_to_be32(ro);
 	sb->s_feature_incompat  &= ~cpu_to_be32(incompat);
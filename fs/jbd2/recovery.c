@@ -225,6 +225,32 @@ static int count_tags(journal_t *journal, struct buffer_head *bh)
 	return nr;
 }
 
+/*
+ * Hand the blocks of the fast commit area to the filesystem.  Only the
+ * records of @tid, the transaction that was running at the crash, are
+ * still of interest; the callback returns 1 once it has seen the end of
+ * them.
+ */
+static int fc_do_replay(journal_t *journal, tid_t tid)
+{
+	struct buffer_head *bh;
+	unsigned long blk;
+	int err = 0;
+
+	if (!journal->j_fc_replay_callback)
+		return 0;
+
+	for (blk = journal->j_fc_first; blk < journal->j_fc_last; blk++) {
+		err = jread(&bh, journal, blk);
+		if (err)
+			break;
+		err = journal->j_fc_replay_callback(journal, bh, tid);
+		brelse(bh);
+		if (err)
+			break;
+	}
+	return err < 0 ? err : 0;
+}
 
 /* Make sure we wrap around the log correctly! */
 #define wrap(journal, var)						\
@@ -273,6 +299,9 @@ int jbd2_journal_recover(journal_t *journal)
 		err = do_one_pass(journal, &info, PASS_REVOKE);
 	if (!err)
 		err = do_one_pass(journal, &info, PASS_REPLAY);
+	if (!err && JBD2_HAS_INCOMPAT_FEATURE(journal,
+					JBD2_FEATURE_INCOMPAT_FAST_COMMIT))
+		err = fc_do_replay(journal, info.end_transaction);
 
 	jbd_debug(1, "JBD2: recovery, exit status %d, "
 		  "recovered transactions %u to %u\n",
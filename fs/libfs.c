@@ -52,6 +52,7 @@ static int simple_delete_dentry(const struct dentry *dentry)
 /*
  * Lookup the data. This is trivial - if the dentry didn't already
  * exist, we know it is negative.  Set d_op to delete negative dentries.
+ * Nothing but @dentry is touched, so this is fine for FS_PARALLEL_LOOKUP.
  */
 struct dentry *simple_lookup(struct inode *dir, struct dentry *dentry, unsigned int flags)
 {
@@ -1204,12 +1204,24 @@ static void follow_dotdot(struct nameidata *nd)
 	nd->inode = nd->path.dentry->d_inode;
 }
 
+/*
+ * Filesystems flagged FS_PARALLEL_LOOKUP have their ->lookup() called
+ * without the parent's i_mutex: concurrent lookups of one name are
+ * serialised by d_alloc_parallel() instead. ->atomic_open() is always
+ * called with i_mutex held, so directories that have one don't qualify.
+ */
+static inline bool lookup_is_parallel(struct inode *dir)
+{
+	return (dir->i_sb->s_type->fs_flags & FS_PARALLEL_LOOKUP) &&
+		!dir->i_op->atomic_open;
+}
+
 /*
  * This looks up the name in dcache, possibly revalidates the old dentry and
  * allocates a new one if not found or not valid.  In the need_lookup argument
  * returns whether i_op->lookup is necessary.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless lookup_is_parallel()
  */
 static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
 				    unsigned int flags, bool *need_lookup)
@@ -1236,6 +1248,15 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
 		}
 	}
 
+	if (!dentry && lookup_is_parallel(dir->d_inode)) {
+		/* may hand back what a concurrent lookup just found */
+		dentry = d_alloc_parallel(dir, name);
+		if (!IS_ERR(dentry))
+			*need_lookup = d_in_lookup(dentry) ||
+				       d_need_lookup(dentry);
+		return dentry;
+	}
+
 	if (!dentry) {
 		dentry = d_alloc(dir, name);
 		if (unlikely(!dentry))
@@ -1250,7 +1271,7 @@ static struct dentry *lookup_dcache(struct qstr *name, struct dentry *dir,
  * Call i_op->lookup on the dentry.  The dentry must be negative but may be
  * hashed if it was pouplated with DCACHE_NEED_LOOKUP.
  *
- * dir->d_inode->i_mutex must be held
+ * dir->d_inode->i_mutex must be held, unless lookup_is_parallel()
  */
 static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 				  unsigned int flags)
@@ -1259,11 +1280,15 @@ static struct dentry *lookup_real(struct inode *dir, struct dentry *dentry,
 
 	/* Don't create child dentry for a dead directory. */
 	if (unlikely(IS_DEADDIR(dir))) {
+		if (d_in_lookup(dentry))
+			d_lookup_done(dentry);
 		dput(dentry);
 		return ERR_PTR(-ENOENT);
 	}
 
 	old = dir->i_op->lookup(dir, dentry, flags);
+	if (d_in_lookup(dentry))
+		d_lookup_done(dentry);
 	if (unlikely(old)) {
 		dput(dentry);
 		dentry = old;
@@ -1399,9 +1424,13 @@ static int lookup_slow(struct nameidata *nd, struct qstr *name,
 	parent = nd->path.dentry;
 	BUG_ON(nd->inode != parent->d_inode);
 
-	mutex_lock(&parent->d_inode->i_mutex);
-	dentry = __lookup_hash(name, parent, nd->flags);
-	mutex_unlock(&parent->d_inode->i_mutex);
+	if (lookup_is_parallel(parent->d_inode)) {
+		dentry = __lookup_hash(name, parent, nd->flags);
+	} else {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = __lookup_hash(name, parent, nd->flags);
+		mutex_unlock(&parent->d_inode->i_mutex);
+	}
 	if (IS_ERR(dentry))
 		return PTR_ERR(dentry);
 	path->mnt = nd->path.mnt;
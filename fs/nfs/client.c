@@ -179,6 +179,7 @@ struct nfs_client *nfs_alloc_client(const struct nfs_client_initdata *cl_init)
 	clp->cl_rpcclient = ERR_PTR(-EINVAL);
 
 	clp->cl_proto = cl_init->proto;
+	clp->cl_nconnect = cl_init->nconnect;
 	clp->cl_net = get_net(cl_init->net);
 
 	cred = rpc_lookup_machine_cred("*");
@@ -416,6 +417,9 @@ static struct nfs_client *nfs_match_client(const struct nfs_client_initdata *dat
 
 		if (clp->cl_proto != data->proto)
 			continue;
+		/* Mounts asking for more connections get their own client */
+		if (clp->cl_nconnect != data->nconnect)
+			continue;
 		/* Match nfsv4 minorversion */
 		if (clp->cl_minorversion != data->minorversion)
 			continue;
@@ -587,6 +591,7 @@ int nfs_create_rpc_client(struct nfs_client *clp,
 		.program	= &nfs_program,
 		.version	= clp->rpc_ops->version,
 		.authflavor	= flavor,
+		.nconnect	= clp->cl_nconnect,
 	};
 
 	if (test_bit(NFS_CS_DISCRTRY, &clp->cl_flags))
@@ -749,6 +754,7 @@ static int nfs_init_server(struct nfs_server *server,
 		.addrlen = data->nfs_server.addrlen,
 		.nfs_mod = nfs_mod,
 		.proto = data->nfs_server.protocol,
+		.nconnect = data->nconnect,
 		.net = data->net,
 	};
 	struct rpc_timeout timeparms;
@@ -829,11 +835,20 @@ static void nfs_server_set_fsinfo(struct nfs_server *server,
 {
 	unsigned long max_rpc_payload;
 
-	/* Work out a lot of parameters */
+	/*
+	 * Work out a lot of parameters.  Unless told otherwise, go for the
+	 * largest transfer size the server supports rather than the one it
+	 * prefers: many servers advertise a conservative preference, and
+	 * fewer, larger READs and WRITEs keep fast links busy.
+	 */
 	if (server->rsize == 0)
-		server->rsize = nfs_block_size(fsinfo->rtpref, NULL);
+		server->rsize = nfs_block_size(fsinfo->rtmax >= 512 ?
+					       fsinfo->rtmax : fsinfo->rtpref,
+					       NULL);
 	if (server->wsize == 0)
-		server->wsize = nfs_block_size(fsinfo->wtpref, NULL);
+		server->wsize = nfs_block_size(fsinfo->wtmax >= 512 ?
+					       fsinfo->wtmax : fsinfo->wtpref,
+					       NULL);
 
 	if (fsinfo->rtmax >= 512 && server->rsize > fsinfo->rtmax)
 		server->rsize = nfs_block_size(fsinfo->rtmax, NULL);
@@ -991,6 +1006,8 @@ struct nfs_server *nfs_alloc_server(void)
 	INIT_LIST_HEAD(&server->delegations);
 	INIT_LIST_HEAD(&server->layouts);
 	INIT_LIST_HEAD(&server->state_owners_lru);
+	spin_lock_init(&server->sync_lock);
+	INIT_LIST_HEAD(&server->sync_inodes);
 
 	atomic_set(&server->active, 0);
 
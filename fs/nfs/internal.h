@@ -93,6 +93,7 @@ struct nfs_client_initdata {
 	struct nfs_subversion *nfs_mod;
 	int proto;
 	u32 minorversion;
+	unsigned int nconnect;
 	struct net *net;
 };
 
@@ -113,6 +114,7 @@ struct nfs_parsed_mount_data {
 	char			*client_address;
 	unsigned int		version;
 	unsigned int		minorversion;
+	unsigned int		nconnect;
 	char			*fscache_uniq;
 	bool			need_mount;
 
@@ -414,6 +416,8 @@ extern void nfs_pageio_init_write(struct nfs_pageio_descriptor *pgio,
 			const struct nfs_pgio_completion_ops *compl_ops);
 extern void nfs_pageio_reset_write_mds(struct nfs_pageio_descriptor *pgio);
 extern void nfs_writedata_release(struct nfs_write_data *wdata);
+extern void nfs_del_sync_inode(struct inode *inode);
+extern int nfs_sync_fs(struct super_block *sb, int wait);
 extern void nfs_commit_free(struct nfs_commit_data *p);
 extern int nfs_initiate_write(struct rpc_clnt *clnt,
 			      struct nfs_write_data *data,
@@ -239,6 +239,35 @@ int nfs_congestion_kb;
 #define NFS_CONGESTION_OFF_THRESH	\
 	(NFS_CONGESTION_ON_THRESH - (NFS_CONGESTION_ON_THRESH >> 2))
 
+/*
+ * Remember inodes with WRITEs going out, so that nfs_sync_fs() can find
+ * them without walking all of the superblock's inodes.
+ */
+static void nfs_add_sync_inode(struct inode *inode)
+{
+	struct nfs_inode *nfsi = NFS_I(inode);
+	struct nfs_server *nfss = NFS_SERVER(inode);
+
+	if (!list_empty(&nfsi->sync_list))
+		return;
+	spin_lock(&nfss->sync_lock);
+	if (list_empty(&nfsi->sync_list))
+		list_add_tail(&nfsi->sync_list, &nfss->sync_inodes);
+	spin_unlock(&nfss->sync_lock);
+}
+
+void nfs_del_sync_inode(struct inode *inode)
+{
+	struct nfs_inode *nfsi = NFS_I(inode);
+	struct nfs_server *nfss = NFS_SERVER(inode);
+
+	if (list_empty(&nfsi->sync_list))
+		return;
+	spin_lock(&nfss->sync_lock);
+	list_del_init(&nfsi->sync_list);
+	spin_unlock(&nfss->sync_lock);
+}
+
 static int nfs_set_page_writeback(struct page *page)
 {
 	int ret = test_set_page_writeback(page);
@@ -247,6 +276,7 @@ static int nfs_set_page_writeback(struct page *page)
 		struct inode *inode = page_file_mapping(page)->host;
 		struct nfs_server *nfss = NFS_SERVER(inode);
 
+		nfs_add_sync_inode(inode);
 		if (atomic_long_inc_return(&nfss->writeback) >
 				NFS_CONGESTION_ON_THRESH) {
 			set_bdi_congested(&nfss->backing_dev_info,
@@ -1701,6 +1731,47 @@ int nfs_write_inode(struct inode *inode, struct writeback_control *wbc)
 }
 EXPORT_SYMBOL_GPL(nfs_write_inode);
 
+/*
+ * sync(2) and syncfs(2) call ->sync_fs(sb, 0) once all dirty pages have
+ * been sent, before going through the inodes one at a time with
+ * WB_SYNC_ALL.  That second pass would wait for the WRITEs of an inode,
+ * then send its COMMIT and wait for the reply, then move on to the next
+ * inode.  Instead, wait for the WRITEs here and fire off the COMMITs of
+ * all inodes without waiting for them, so that they are in flight
+ * together; ->write_inode() then mostly finds its COMMIT already done.
+ */
+int nfs_sync_fs(struct super_block *sb, int wait)
+{
+	struct nfs_server *nfss = NFS_SB(sb);
+	struct nfs_inode *nfsi;
+	struct inode *inode;
+	LIST_HEAD(head);
+
+	if (wait)
+		return 0;
+
+	spin_lock(&nfss->sync_lock);
+	list_splice_init(&nfss->sync_inodes, &head);
+	while (!list_empty(&head)) {
+		nfsi = list_first_entry(&head, struct nfs_inode, sync_list);
+		list_del_init(&nfsi->sync_list);
+		inode = igrab(&nfsi->vfs_inode);
+		if (!inode)
+			continue;
+		spin_unlock(&nfss->sync_lock);
+
+		filemap_fdatawait(inode->i_mapping);
+		nfs_commit_inode(inode, 0);
+		iput(inode);
+
+		cond_resched();
+		spin_lock(&nfss->sync_lock);
+	}
+	spin_unlock(&nfss->sync_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(nfs_sync_fs);
+
 /*
  * flush the inode to disk.
  */
@@ -5,68 +5,99 @@
  * This code is heavily inspired by the 44BSD implementation, although
  * it does things a bit differently.
  *
+ * The cache is split by XID into buckets, each with its own lock and
+ * LRU list, so that nfsd threads working on different requests don't
+ * all serialise on one lock.  Each bucket is a small cache of its own:
+ * entries are allocated as the bucket fills up and recycled in LRU
+ * order once it has reached its share of the total size.
+ *
  * Copyright (C) 1995, 1996 Olaf Kirch <okir@monad.swb.de>
  */
 
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/highmem.h>
+#include <linux/log2.h>
+#include <linux/ratelimit.h>
 
 #include "nfsd.h"
 #include "cache.h"
 
-/* Size of reply cache. Common values are:
+/* Minimum size of reply cache. Common values are:
  * 4.3BSD:	128
  * 4.4BSD:	256
  * Solaris2:	1024
  * DEC Unix:	512-4096
  */
 #define CACHESIZE		1024
-#define HASHSIZE		64
+#define MAX_CACHESIZE		(256 * 1024)
+
+/* Entries per hash bucket we aim for; also the length of a lookup. */
+#define TARGET_BUCKET_SIZE	16
+
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+	unsigned int		num;		/* entries in this bucket */
+} ____cacheline_aligned_in_smp;
 
-static struct hlist_head *	cache_hash;
-static struct list_head 	lru_head;
+static struct nfsd_drc_bucket *	drc_hashtbl;
+static unsigned int		drc_hash_shift;
+static struct kmem_cache *	drc_slab;
 static int			cache_disabled = 1;
 
 /*
- * Calculate the hash index from an XID.
+ * Calculate the hash bucket from an XID.
  */
-static inline u32 request_hash(u32 xid)
+static inline struct nfsd_drc_bucket *request_bucket(__be32 xid)
 {
-	u32 h = xid;
-	h ^= (xid >> 24);
-	return h & (HASHSIZE-1);
+	return &drc_hashtbl[hash_32((__force u32)xid, drc_hash_shift)];
 }
 
 static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
 
+/*
+ * Scale the cache with the amount of low memory, roughly the same as
+ * the TCP hash tables do: a few thousand entries on a small server, up
+ * to MAX_CACHESIZE on a large one.
+ */
+static unsigned int nfsd_cache_size_limit(void)
+{
+	unsigned long low_pages = totalram_pages - totalhigh_pages;
+	unsigned long limit;
+
+	limit = (16 * int_sqrt(low_pages)) << (PAGE_SHIFT - 10);
+	return clamp_t(unsigned long, limit, CACHESIZE, MAX_CACHESIZE);
+}
+
 /*
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, it when accessing _prev or _next, the lock of the entry's
+ * bucket must be held.
  */
-static DEFINE_SPINLOCK(cache_lock);
-
 int nfsd_reply_cache_init(void)
 {
-	struct svc_cacherep	*rp;
-	int			i;
-
-	INIT_LIST_HEAD(&lru_head);
-	i = CACHESIZE;
-	while (i) {
-		rp = kmalloc(sizeof(*rp), GFP_KERNEL);
-		if (!rp)
-			goto out_nomem;
-		list_add(&rp->c_lru, &lru_head);
-		rp->c_state = RC_UNUSED;
-		rp->c_type = RC_NOCACHE;
-		INIT_HLIST_NODE(&rp->c_hash);
-		i--;
-	}
+	unsigned int	nbuckets, i;
 
-	cache_hash = kcalloc (HASHSIZE, sizeof(struct hlist_head), GFP_KERNEL);
-	if (!cache_hash)
+	nbuckets = roundup_pow_of_two(nfsd_cache_size_limit() /
+				      TARGET_BUCKET_SIZE);
+	drc_hash_shift = ilog2(nbuckets);
+
+	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
+				     0, 0, NULL);
+	if (!drc_slab)
 		goto out_nomem;
 
+	drc_hashtbl = vzalloc(nbuckets * sizeof(*drc_hashtbl));
+	if (!drc_hashtbl)
+		goto out_nomem;
+	for (i = 0; i < nbuckets; i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
+	}
+
 	cache_disabled = 0;
 	return 0;
 out_nomem:
@@ -78,38 +109,41 @@ out_nomem:
 void nfsd_reply_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
-
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
-			kfree(rp->c_replvec.iov_base);
-		list_del(&rp->c_lru);
-		kfree(rp);
-	}
+	unsigned int		i;
 
 	cache_disabled = 1;
 
-	kfree (cache_hash);
-	cache_hash = NULL;
-}
+	if (drc_hashtbl) {
+		for (i = 0; i < (1U << drc_hash_shift); i++) {
+			struct list_head *head = &drc_hashtbl[i].lru_head;
+
+			while (!list_empty(head)) {
+				rp = list_entry(head->next, struct svc_cacherep,
+						c_lru);
+				if (rp->c_state == RC_DONE &&
+				    rp->c_type == RC_REPLBUFF)
+					kfree(rp->c_replvec.iov_base);
+				list_del(&rp->c_lru);
+				kmem_cache_free(drc_slab, rp);
+			}
+		}
+		vfree(drc_hashtbl);
+		drc_hashtbl = NULL;
+	}
 
-/*
- * Move cache entry to end of LRU list
- */
-static void
-lru_put_end(struct svc_cacherep *rp)
-{
-	list_move_tail(&rp->c_lru, &lru_head);
+	if (drc_slab) {
+		kmem_cache_destroy(drc_slab);
+		drc_slab = NULL;
+	}
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Move cache entry to end of LRU list
  */
 static void
-hash_refile(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, cache_hash + request_hash(rp->c_xid));
+	list_move_tail(&rp->c_lru, &b->lru_head);
 }
 
 /*
@@ -120,9 +154,8 @@ hash_refile(struct svc_cacherep *rp)
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp)
 {
-	struct hlist_node	*hn;
-	struct hlist_head 	*rh;
-	struct svc_cacherep	*rp;
+	struct nfsd_drc_bucket	*b;
+	struct svc_cacherep	*rp, *new = NULL;
 	__be32			xid = rqstp->rq_xid;
 	u32			proto =  rqstp->rq_prot,
 				vers = rqstp->rq_vers,
@@ -137,11 +170,19 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 		return RC_DOIT;
 	}
 
-	spin_lock(&cache_lock);
+	b = request_bucket(xid);
+
+	/*
+	 * Allocate while we can still sleep; a bucket that isn't full
+	 * grows rather than recycle entries.
+	 */
+	if (ACCESS_ONCE(b->num) < TARGET_BUCKET_SIZE)
+		new = kmem_cache_alloc(drc_slab, GFP_KERNEL);
+
+	spin_lock(&b->cache_lock);
 	rtn = RC_DOIT;
 
-	rh = &cache_hash[request_hash(xid)];
-	hlist_for_each_entry(rp, hn, rh, c_hash) {
+	list_for_each_entry(rp, &b->lru_head, c_lru) {
 		if (rp->c_state != RC_UNUSED &&
 		    xid == rp->c_xid && proc == rp->c_proc &&
 		    proto == rp->c_prot && vers == rp->c_vers &&
@@ -153,30 +194,26 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	}
 	nfsdstats.rcmisses++;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	list_for_each_entry(rp, &lru_head, c_lru) {
-		if (rp->c_state != RC_INPROG)
-			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
-			goto out;
+	if (new) {
+		rp = new;
+		new = NULL;
+		rp->c_state = RC_UNUSED;
+		rp->c_type = RC_NOCACHE;
+		list_add_tail(&rp->c_lru, &b->lru_head);
+		b->num++;
+	} else {
+		list_for_each_entry(rp, &b->lru_head, c_lru) {
+			if (rp->c_state != RC_INPROG)
+				break;
 		}
-	}
-	}
 
-	/* All entries on the LRU are in-progress. This should not happen */
-	if (&rp->c_lru == &lru_head) {
-		static int	complaints;
-
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
+		/* All entries in the bucket are in-progress. Don't cache. */
+		if (&rp->c_lru == &b->lru_head) {
+			printk_ratelimited(KERN_WARNING
+				"nfsd: all repcache entries locked!\n");
+			goto out;
 		}
-		goto out;
+		lru_put_end(b, rp);
 	}
 
 	rqstp->rq_cacherep = rp;
@@ -188,8 +225,6 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	rp->c_vers = vers;
 	rp->c_timestamp = jiffies;
 
-	hash_refile(rp);
-
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
 		kfree(rp->c_replvec.iov_base);
@@ -197,14 +232,16 @@ nfsd_cache_lookup(struct svc_rqst *rqstp)
 	}
 	rp->c_type = RC_NOCACHE;
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
+	if (new)
+		kmem_cache_free(drc_slab, new);
 	return rtn;
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
 	rp->c_timestamp = jiffies;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -258,12 +295,15 @@ void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 {
 	struct svc_cacherep *rp;
+	struct nfsd_drc_bucket *b;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
 	int		len;
 
 	if (!(rp = rqstp->rq_cacherep) || cache_disabled)
 		return;
 
+	b = request_bucket(rp->c_xid);
+
 	len = resv->iov_len - ((char*)statp - (char*)resv->iov_base);
 	len >>= 2;
 
@@ -283,22 +323,22 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 		cachv = &rp->c_replvec;
 		cachv->iov_base = kmalloc(len << 2, GFP_KERNEL);
 		if (!cachv->iov_base) {
-			spin_lock(&cache_lock);
+			spin_lock(&b->cache_lock);
 			rp->c_state = RC_UNUSED;
-			spin_unlock(&cache_lock);
+			spin_unlock(&b->cache_lock);
 			return;
 		}
 		cachv->iov_len = len << 2;
 		memcpy(cachv->iov_base, statp, len << 2);
 		break;
 	}
-	spin_lock(&cache_lock);
-	lru_put_end(rp);
+	spin_lock(&b->cache_lock);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
 	rp->c_timestamp = jiffies;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
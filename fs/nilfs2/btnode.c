@@ -257,9 +257,13 @@ void nilfs_btnode_commit_change_key(struct address_space *btnc,
 		mark_buffer_dirty(obh);
 
 		spin_lock_irq(&btnc->tree_lock);
+		spin_lock(mapping_tag_lock(btnc, oldkey));
 		radix_tree_delete(&btnc->page_tree, oldkey);
+		spin_unlock(mapping_tag_lock(btnc, oldkey));
+		spin_lock(mapping_tag_lock(btnc, newkey));
 		radix_tree_tag_set(&btnc->page_tree, newkey,
 				   PAGECACHE_TAG_DIRTY);
+		spin_unlock(mapping_tag_lock(btnc, newkey));
 		spin_unlock_irq(&btnc->tree_lock);
 
 		opage->index = obh->b_blocknr = newkey;
@@ -340,7 +340,9 @@ repeat:
 
 			/* move the page to the destination cache */
 			spin_lock_irq(&smap->tree_lock);
+			spin_lock(mapping_tag_lock(smap, offset));
 			page2 = radix_tree_delete(&smap->page_tree, offset);
+			spin_unlock(mapping_tag_lock(smap, offset));
 			WARN_ON(page2 != page);
 
 			smap->nrpages--;
@@ -355,10 +357,14 @@ repeat:
 			} else {
 				page->mapping = dmap;
 				dmap->nrpages++;
-				if (PageDirty(page))
+				if (PageDirty(page)) {
+					spin_lock(mapping_tag_lock(dmap, offset));
 					radix_tree_tag_set(&dmap->page_tree,
 							   offset,
 							   PAGECACHE_TAG_DIRTY);
+					spin_unlock(mapping_tag_lock(dmap,
+								     offset));
+				}
 			}
 			spin_unlock_irq(&dmap->tree_lock);
 		}
@@ -454,9 +460,14 @@ int __nilfs_clear_page_dirty(struct page *page)
 	if (mapping) {
 		spin_lock_irq(&mapping->tree_lock);
 		if (test_bit(PG_dirty, &page->flags)) {
+			spinlock_t *tag_lock;
+
+			tag_lock = mapping_tag_lock(mapping, page_index(page));
+			spin_lock(tag_lock);
 			radix_tree_tag_clear(&mapping->page_tree,
 					     page_index(page),
 					     PAGECACHE_TAG_DIRTY);
+			spin_unlock(tag_lock);
 			spin_unlock_irq(&mapping->tree_lock);
 			return clear_page_dirty_for_io(page);
 		}
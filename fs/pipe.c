@@ -196,20 +196,45 @@ static void iov_fault_in_pages_read(struct iovec *iov, unsigned long len)
 	}
 }
 
+/*
+ * If nobody else uses this page, and we have a free slot for it, keep it
+ * in the small allocation cache of temporary pages. (Otherwise just
+ * release our reference to it)
+ */
+static void pipe_put_tmp_page(struct pipe_inode_info *pipe, struct page *page)
+{
+	if (page_count(page) == 1) {
+		int i;
+
+		for (i = 0; i < PIPE_TMP_PAGES; i++) {
+			if (!pipe->tmp_page[i]) {
+				pipe->tmp_page[i] = page;
+				return;
+			}
+		}
+	}
+	page_cache_release(page);
+}
+
 static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
-	struct page *page = buf->page;
+	pipe_put_tmp_page(pipe, buf->page);
+}
 
-	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
-	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
-	else
-		page_cache_release(page);
+static struct page *pipe_get_tmp_page(struct pipe_inode_info *pipe)
+{
+	int i;
+
+	for (i = PIPE_TMP_PAGES - 1; i >= 0; i--) {
+		struct page *page = pipe->tmp_page[i];
+
+		if (page) {
+			pipe->tmp_page[i] = NULL;
+			return page;
+		}
+	}
+	return alloc_page(GFP_HIGHUSER);
 }
 
 /**
@@ -476,6 +501,29 @@ redo:
 	return ret;
 }
 
+static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages);
+
+/*
+ * A writer found the pipe full. If that keeps happening, the pipe is
+ * carrying sustained traffic and a bigger ring saves wakeups and context
+ * switches, so double it, up to PIPE_AUTOGROW_BUFFERS and pipe_max_size.
+ * Returns true if there is room now.
+ */
+static bool pipe_autogrow(struct pipe_inode_info *pipe)
+{
+	unsigned int nr_pages = pipe->buffers * 2;
+
+	if (pipe->fixed_size || ++pipe->nr_full < PIPE_DEF_BUFFERS)
+		return false;
+	if (nr_pages > PIPE_AUTOGROW_BUFFERS ||
+	    nr_pages > (pipe_max_size >> PAGE_SHIFT))
+		return false;
+	if (pipe_set_size(pipe, nr_pages) < 0)
+		return false;
+	pipe->nr_full = 0;
+	return true;
+}
+
 static inline int is_packetized(struct file *file)
 {
 	return (file->f_flags & O_DIRECT) != 0;
@@ -563,17 +611,14 @@ redo1:
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			char *src;
 			int error, atomic = 1;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_get_tmp_page(pipe);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -606,6 +651,7 @@ redo2:
 				}
 				if (!ret)
 					ret = error;
+				pipe_put_tmp_page(pipe, page);
 				break;
 			}
 			ret += chars;
@@ -621,13 +667,12 @@ redo2:
 				buf->flags = PIPE_BUF_FLAG_PACKET;
 			}
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			total_len -= chars;
 			if (!total_len)
 				break;
 		}
-		if (bufs < pipe->buffers)
+		if (bufs < pipe->buffers || pipe_autogrow(pipe))
 			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
@@ -950,8 +995,10 @@ void __free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	for (i = 0; i < PIPE_TMP_PAGES; i++) {
+		if (pipe->tmp_page[i])
+			__free_page(pipe->tmp_page[i]);
+	}
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1245,6 +1292,8 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 			goto out;
 		}
 		ret = pipe_set_size(pipe, nr_pages);
+		if (ret >= 0)
+			pipe->fixed_size = true;
 		break;
 		}
 	case F_GETPIPE_SZ:
@@ -260,11 +260,13 @@ static struct file_system_type ramfs_fs_type = {
 	.name		= "ramfs",
 	.mount		= ramfs_mount,
 	.kill_sb	= ramfs_kill_sb,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 static struct file_system_type rootfs_fs_type = {
 	.name		= "rootfs",
 	.mount		= rootfs_mount,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 
 static int __init init_ramfs_fs(void)
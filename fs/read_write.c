@@ -15,6 +15,7 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/splice.h>
+#include <linux/sendfile.h>
 #include "read_write.h"
 
 #include <asm/uaccess.h>
@@ -952,7 +953,8 @@ static ssize_t do_sendfile(int out_fd, int in_fd, loff_t *ppos,
 	if (in_file->f_flags & O_NONBLOCK)
 		fl = SPLICE_F_NONBLOCK;
 #endif
-	retval = do_splice_direct(in_file, ppos, out_file, count, fl);
+	retval = do_splice_direct(in_file, ppos, out_file, &out_file->f_pos,
+				  count, fl);
 
 	if (retval > 0) {
 		add_rchar(current, retval);
@@ -1007,3 +1009,177 @@ SYSCALL_DEFINE4(sendfile64, int, out_fd, int, in_fd, loff_t __user *, offset, si
 
 	return do_sendfile(out_fd, in_fd, NULL, count, 0);
 }
+
+/**
+ * vfs_copy_file_range - copy a range of one file to another, in the kernel
+ * @file_in:	file to copy from
+ * @pos_in:	offset in @file_in
+ * @file_out:	file to copy to
+ * @pos_out:	offset in @file_out
+ * @len:	number of bytes to copy
+ * @flags:	must be zero
+ *
+ * The filesystem of @file_out gets to do the copy first when both files
+ * are on it, e.g. by sharing extents or having the server copy the data;
+ * it returns -EOPNOTSUPP for a range it cannot handle that way. Otherwise
+ * the data is spliced through the page cache, never through user memory.
+ *
+ * Returns the number of bytes copied, which may be short.
+ */
+ssize_t vfs_copy_file_range(struct file *file_in, loff_t pos_in,
+			    struct file *file_out, loff_t pos_out,
+			    size_t len, unsigned int flags)
+{
+	struct inode *inode_in = file_in->f_path.dentry->d_inode;
+	struct inode *inode_out = file_out->f_path.dentry->d_inode;
+	ssize_t ret;
+
+	if (flags)
+		return -EINVAL;
+
+	if (S_ISDIR(inode_in->i_mode) || S_ISDIR(inode_out->i_mode))
+		return -EISDIR;
+	if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+		return -EINVAL;
+
+	if (!(file_in->f_mode & FMODE_READ) ||
+	    !(file_out->f_mode & FMODE_WRITE) ||
+	    (file_out->f_flags & O_APPEND))
+		return -EBADF;
+
+	ret = rw_verify_area(READ, file_in, &pos_in, len);
+	if (ret < 0)
+		return ret;
+	len = ret;
+
+	ret = rw_verify_area(WRITE, file_out, &pos_out, len);
+	if (ret < 0)
+		return ret;
+	len = ret;
+
+	if (!len)
+		return 0;
+
+	ret = -EOPNOTSUPP;
+	if (inode_in->i_sb == inode_out->i_sb &&
+	    file_out->f_op && file_out->f_op->copy_file_range)
+		ret = file_out->f_op->copy_file_range(file_in, pos_in,
+						      file_out, pos_out,
+						      len, flags);
+	if (ret == -EOPNOTSUPP)
+		ret = do_splice_direct(file_in, &pos_in, file_out, &pos_out,
+				       len, 0);
+
+	if (ret > 0) {
+		fsnotify_access(file_in);
+		add_rchar(current, ret);
+		fsnotify_modify(file_out);
+		add_wchar(current, ret);
+	}
+	inc_syscr(current);
+	inc_syscw(current);
+
+	return ret;
+}
+EXPORT_SYMBOL(vfs_copy_file_range);
+
+SYSCALL_DEFINE6(copy_file_range, int, fd_in, loff_t __user *, off_in,
+		int, fd_out, loff_t __user *, off_out,
+		size_t, len, unsigned int, flags)
+{
+	struct file *file_in, *file_out;
+	int fput_needed_in, fput_needed_out;
+	loff_t pos_in, pos_out;
+	ssize_t ret = -EBADF;
+
+	file_in = fget_light(fd_in, &fput_needed_in);
+	if (!file_in)
+		goto out;
+	file_out = fget_light(fd_out, &fput_needed_out);
+	if (!file_out)
+		goto fput_in;
+
+	ret = -EFAULT;
+	if (off_in) {
+		if (copy_from_user(&pos_in, off_in, sizeof(loff_t)))
+			goto fput_out;
+	} else
+		pos_in = file_in->f_pos;
+
+	if (off_out) {
+		if (copy_from_user(&pos_out, off_out, sizeof(loff_t)))
+			goto fput_out;
+	} else
+		pos_out = file_out->f_pos;
+
+	ret = vfs_copy_file_range(file_in, pos_in, file_out, pos_out, len,
+				  flags);
+	if (ret > 0) {
+		pos_in += ret;
+		pos_out += ret;
+
+		if (off_in) {
+			if (copy_to_user(off_in, &pos_in, sizeof(loff_t)))
+				ret = -EFAULT;
+		} else
+			file_in->f_pos = pos_in;
+
+		if (off_out) {
+			if (copy_to_user(off_out, &pos_out, sizeof(loff_t)))
+				ret = -EFAULT;
+		} else
+			file_out->f_pos = pos_out;
+	}
+
+fput_out:
+	fput_light(file_out, fput_needed_out);
+fput_in:
+	fput_light(file_in, fput_needed_in);
+out:
+	return ret;
+}
+
+/*
+ * Send a batch of file ranges to one socket in a single call: servers of
+ * many small static objects otherwise pay a system call per object.
+ * Stops at the first error or short transfer and returns the number of
+ * bytes sent, or the error if nothing was.
+ */
+SYSCALL_DEFINE4(sendfilev, int, out_fd, const struct sendfile_vec __user *, vec,
+		unsigned int, vlen, unsigned int, flags)
+{
+	struct sendfile_vec v;
+	ssize_t ret = 0, total = 0;
+	unsigned int i;
+
+	if (flags || vlen > UIO_MAXIOV)
+		return -EINVAL;
+
+	for (i = 0; i < vlen; i++) {
+		size_t count;
+		loff_t pos;
+
+		if (copy_from_user(&v, vec + i, sizeof(v))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = -EINVAL;
+		if (v.flags || (loff_t)v.offset < 0)
+			break;
+		ret = 0;
+		if (!v.count)
+			continue;
+
+		/* keep the total within what one read or write may return */
+		count = min_t(u64, v.count, MAX_RW_COUNT - total);
+		pos = v.offset;
+		ret = do_sendfile(out_fd, v.in_fd, &pos, count, 0);
+		if (ret <= 0)
+			break;
+		total += ret;
+		if (ret < v.count || fatal_signal_pending(current))
+			break;
+	}
+
+	return total ? total : ret;
+}
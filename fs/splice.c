@@ -1271,15 +1271,99 @@ static int direct_splice_actor(struct pipe_inode_info *pipe,
 {
 	struct file *file = sd->u.file;
 
-	return do_splice_from(pipe, file, &file->f_pos, sd->total_len,
+	return do_splice_from(pipe, file, sd->opos, sd->total_len,
 			      sd->flags);
 }
 
+/*
+ * Largest sendfile() that is tried straight from the page cache first.
+ */
+#define SPLICE_DIRECT_CACHED_MAX	(64 * 1024)
+
+/*
+ * For small transfers to a socket, setting up and draining the internal
+ * pipe costs more than the transfer itself. If the data is all cached and
+ * uptodate, hand the page cache pages straight to ->sendpage(): the
+ * network stack takes its own page references for as long as it needs
+ * them, exactly as it does for pages coming out of the pipe.
+ *
+ * Returns the number of bytes sent, which may be short or zero if a page
+ * is not cached; the caller finishes the transfer the slow way.
+ */
+static long splice_direct_cached(struct file *in, loff_t *ppos,
+				 struct file *out, loff_t *opos, size_t len,
+				 unsigned int flags)
+{
+	struct address_space *mapping = in->f_mapping;
+	loff_t pos = *ppos;
+	loff_t isize = i_size_read(mapping->host);
+	long sent = 0;
+
+	while (len && pos < isize) {
+		unsigned int offset = pos & ~PAGE_CACHE_MASK;
+		size_t this_len = min_t(size_t, len, PAGE_CACHE_SIZE - offset);
+		struct page *page;
+		int more;
+		long ret;
+
+		if (this_len > isize - pos)
+			this_len = isize - pos;
+
+		page = find_get_page(mapping, pos >> PAGE_CACHE_SHIFT);
+		if (!page)
+			break;
+		if (!PageUptodate(page) || page->mapping != mapping) {
+			page_cache_release(page);
+			break;
+		}
+		mark_page_accessed(page);
+
+		more = (flags & SPLICE_F_MORE) ? MSG_MORE : 0;
+		if (this_len < len)
+			more |= MSG_SENDPAGE_NOTLAST;
+		ret = out->f_op->sendpage(out, page, offset, this_len,
+					  opos, more);
+		page_cache_release(page);
+		if (ret <= 0) {
+			if (!sent)
+				sent = ret;
+			break;
+		}
+
+		sent += ret;
+		pos += ret;
+		len -= ret;
+		if (ret < this_len)
+			break;
+	}
+
+	if (sent > 0) {
+		*ppos = pos;
+		file_accessed(in);
+	}
+	return sent;
+}
+
+static bool splice_direct_can_use_cache(struct file *in, struct file *out,
+					size_t len)
+{
+	if (len > SPLICE_DIRECT_CACHED_MAX)
+		return false;
+	/* filesystems with their own ->splice_read may need their locks */
+	if (!in->f_op || in->f_op->splice_read != generic_file_splice_read)
+		return false;
+	if (!S_ISREG(in->f_path.dentry->d_inode->i_mode))
+		return false;
+	return out->f_op && out->f_op->splice_write == generic_splice_sendpage &&
+		out->f_op->sendpage && !(out->f_flags & O_APPEND);
+}
+
 /**
  * do_splice_direct - splices data directly between two files
  * @in:		file to splice from
  * @ppos:	input file offset
  * @out:	file to splice to
+ * @opos:	output file offset
  * @len:	number of bytes to splice
  * @flags:	splice modifier flags
  *
@@ -1291,7 +1375,7 @@ static int direct_splice_actor(struct pipe_inode_info *pipe,
  *
  */
 long do_splice_direct(struct file *in, loff_t *ppos, struct file *out,
-		      size_t len, unsigned int flags)
+		      loff_t *opos, size_t len, unsigned int flags)
 {
 	struct splice_desc sd = {
 		.len		= len,
@@ -1299,13 +1383,24 @@ long do_splice_direct(struct file *in, loff_t *ppos, struct file *out,
 		.flags		= flags,
 		.pos		= *ppos,
 		.u.file		= out,
+		.opos		= opos,
 	};
-	long ret;
+	long ret, sent = 0;
+
+	if (splice_direct_can_use_cache(in, out, len)) {
+		sent = splice_direct_cached(in, ppos, out, opos, len, flags);
+		if (sent < 0 || sent == len)
+			return sent;
+		sd.pos = *ppos;
+		sd.len = sd.total_len = len - sent;
+	}
 
 	ret = splice_direct_to_actor(in, &sd, direct_splice_actor);
 	if (ret > 0)
 		*ppos = sd.pos;
 
+	if (sent)
+		return ret > 0 ? sent + ret : sent;
 	return ret;
 }
 
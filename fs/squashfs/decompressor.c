@@ -22,8 +22,10 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
 #include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
@@ -36,6 +38,29 @@
  * Squashfs, allowing multiple decompressors to be easily supported
  */
 
+/*
+ * Decompressor streams are kept in a per-filesystem pool rather than
+ * behind a single mutex, so that reads of different blocks can be
+ * decompressed in parallel.  The first stream is allocated at mount
+ * time, further streams are allocated on demand up to one per online
+ * CPU.  Once that limit is reached (or allocation fails) readers wait
+ * for a stream to be returned to the pool.
+ */
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_stream_pool {
+	spinlock_t		lock;
+	struct list_head	idle;
+	wait_queue_head_t	wait;
+	int			count;
+	int			max;
+	void			*comp_opts;
+	int			comp_opts_len;
+};
+
 static const struct squashfs_decompressor squashfs_lzma_unsupported_comp_ops = {
 	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
 };
@@ -83,34 +108,166 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+static struct squashfs_stream *alloc_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+	struct squashfs_stream *s;
+
+	s = kmalloc(sizeof(*s), GFP_KERNEL);
+	if (s == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	s->stream = msblk->decompressor->init(msblk, pool->comp_opts,
+		pool->comp_opts_len);
+	if (IS_ERR(s->stream)) {
+		int err = PTR_ERR(s->stream);
+
+		kfree(s);
+		return ERR_PTR(err);
+	}
+
+	return s;
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+	struct squashfs_stream *s;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->idle)) {
+			s = list_first_entry(&pool->idle, struct squashfs_stream,
+				list);
+			list_del(&s->list);
+			spin_unlock(&pool->lock);
+			return s;
+		}
+
+		if (pool->count < pool->max) {
+			pool->count++;
+			spin_unlock(&pool->lock);
+
+			s = alloc_stream(msblk);
+			if (!IS_ERR(s))
+				return s;
+
+			/*
+			 * Out of memory, fall back to waiting for one of the
+			 * existing streams (there is always at least one).
+			 */
+			spin_lock(&pool->lock);
+			pool->count--;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty_careful(&pool->idle));
+	}
+}
+
+
+static void put_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *s)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+
+	spin_lock(&pool->lock);
+	list_add(&s->list, &pool->idle);
+	spin_unlock(&pool->lock);
+
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *s = get_stream(msblk);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, s->stream, buffer, bh, b,
+		offset, length, srclength, pages);
+
+	put_stream(msblk, s);
+
+	return res;
+}
+
+
+int squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *s;
+	int err;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		return -ENOMEM;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	init_waitqueue_head(&pool->wait);
+	pool->max = num_online_cpus();
+	msblk->stream_pool = pool;
 
 	/*
-	 * Read decompressor specific options from file system if present
+	 * Read decompressor specific options from file system if present.
+	 * They are kept for the lifetime of the mount so that further
+	 * streams can be initialised identically.
 	 */
 	if (SQUASHFS_COMP_OPTS(flags)) {
-		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
-		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+		pool->comp_opts = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+		if (pool->comp_opts == NULL) {
+			err = -ENOMEM;
+			goto failed;
+		}
 
-		length = squashfs_read_data(sb, &buffer,
+		pool->comp_opts_len = squashfs_read_data(sb, &pool->comp_opts,
 			sizeof(struct squashfs_super_block), 0, NULL,
 			PAGE_CACHE_SIZE, 1);
 
-		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+		if (pool->comp_opts_len < 0) {
+			err = pool->comp_opts_len;
+			goto failed;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	s = alloc_stream(msblk);
+	if (IS_ERR(s)) {
+		err = PTR_ERR(s);
+		goto failed;
+	}
 
-finished:
-	kfree(buffer);
+	pool->count = 1;
+	list_add(&s->list, &pool->idle);
+
+	return 0;
+
+failed:
+	kfree(pool->comp_opts);
+	kfree(pool);
+	msblk->stream_pool = NULL;
+	return err;
+}
+
+
+void squashfs_decompressor_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream_pool;
+	struct squashfs_stream *s, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(s, next, &pool->idle, list) {
+		msblk->decompressor->free(s->stream);
+		kfree(s);
+	}
 
-	return strm;
+	kfree(pool->comp_opts);
+	kfree(pool);
+	msblk->stream_pool = NULL;
 }
@@ -371,6 +371,106 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache, avoiding the
+ * intermediate read_page cache buffer (and the copy out of it).  This is
+ * only possible if every page covered by the block can be grabbed and none
+ * of them is already uptodate, otherwise -EAGAIN is returned and the caller
+ * falls back to decompressing via the cache.  On success or hard error the
+ * target page is unlocked.
+ */
+static int squashfs_readpage_direct(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = start_index | mask;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int i, n, pages, res;
+	struct page **page;
+	void **pageaddr;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kmalloc(pages * sizeof(*page), GFP_KERNEL);
+	pageaddr = kmalloc(pages * sizeof(*pageaddr), GFP_KERNEL);
+	if (page == NULL || pageaddr == NULL) {
+		res = -EAGAIN;
+		goto out;
+	}
+
+	for (i = 0, n = start_index; n <= end_index; i++, n++) {
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+
+		if (page[i] == NULL) {
+			res = -EAGAIN;
+			goto release_pages;
+		}
+
+		if (page[i] != target_page && PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			res = -EAGAIN;
+			goto release_pages;
+		}
+	}
+
+	for (i = 0; i < pages; i++)
+		pageaddr[i] = kmap(page[i]);
+
+	res = squashfs_read_data(inode->i_sb, pageaddr, block, bsize, NULL,
+		pages << PAGE_CACHE_SHIFT, pages);
+
+	if (res >= 0) {
+		for (i = 0; i < pages; i++) {
+			int avail = clamp_t(int, res - (i << PAGE_CACHE_SHIFT),
+				0, PAGE_CACHE_SIZE);
+
+			memset(pageaddr[i] + avail, 0, PAGE_CACHE_SIZE - avail);
+		}
+	}
+
+	for (i = 0; i < pages; i++) {
+		kunmap(page[i]);
+		if (res < 0) {
+			if (page[i] == target_page)
+				SetPageError(page[i]);
+		} else {
+			flush_dcache_page(page[i]);
+			SetPageUptodate(page[i]);
+		}
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+
+	if (res < 0)
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+
+	goto out;
+
+release_pages:
+	/* Release pages grabbed so far, leaving the target page locked */
+	while (i--) {
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	}
+
+out:
+	kfree(pageaddr);
+	kfree(page);
+	return res < 0 ? res : 0;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -409,6 +509,15 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			/*
+			 * Try decompressing straight into the page cache,
+			 * falling back to the read_page cache if some of the
+			 * block's pages are unavailable.
+			 */
+			int res = squashfs_readpage_direct(page, block, bsize);
+			if (res != -EAGAIN)
+				return 0;
+
 			/*
 			 * Read and decompress datablock.
 			 */
@@ -910,6 +910,10 @@ xfs_vn_update_time(
 
 	trace_xfs_update_time(ip);
 
+	/* keep a lazy atime in the VFS inode, see xfs_fs_dirty_inode() */
+	if (flags == S_ATIME && (inode->i_sb->s_flags & MS_LAZYTIME))
+		return generic_update_time(inode, now, flags);
+
 	tp = xfs_trans_alloc(mp, XFS_TRANS_FSYNC_TS);
 	error = xfs_trans_reserve(tp, 0, XFS_FSYNC_TS_LOG_RES(mp), 0, 0, 0);
 	if (error) {
@@ -1147,7 +1151,7 @@ xfs_setup_inode(
 
 	inode_sb_list_add(inode);
 	/* make the inode look hashed for the writeback code */
-	hlist_add_fake(&inode->i_hash);
+	hlist_bl_add_fake(&inode->i_hash);
 
 	inode->i_mode	= ip->i_d.di_mode;
 	set_nlink(inode, ip->i_d.di_nlink);
@@ -228,29 +228,33 @@ xfs_cil_prepare_item(
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * The items, the accounting and the busy extents of the transaction all go to
+ * the per-cpu part of the CIL of the CPU we are running on; xlog_cil_push()
+ * gathers them into the checkpoint.
  */
 static void
 xlog_cil_insert_items(
 	struct xlog		*log,
 	struct xfs_log_vec	*log_vector,
-	struct xlog_ticket	*ticket)
+	struct xfs_trans	*tp)
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_ticket	*ticket = tp->t_ticket;
+	struct xlog_cil_pcp	*cilpcp;
 	struct xfs_log_vec	*lv;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
+	int			ctx_res = 0;
+	uint32_t		order;
 
 	ASSERT(log_vector);
 
 	/*
 	 * Do all the accounting aggregation and switching of log vectors
 	 * around in a separate loop to the insertion of items into the CIL.
-	 * Then we can do a separate loop to update the CIL within a single
-	 * lock/unlock pair. This reduces the number of round trips on the CIL
-	 * lock from O(nr_logvectors) to O(1) and greatly reduces the overall
-	 * hold time for the transaction commit.
 	 *
 	 * If this is the first time the item is being placed into the CIL in
 	 * this context, pin it so it can't be written to disk until the CIL is
@@ -265,46 +269,74 @@ xlog_cil_insert_items(
 	/* account for space used by new iovec headers  */
 	len += diff_iovecs * sizeof(xlog_op_header_t);
 
-	spin_lock(&cil->xc_cil_lock);
-
-	/* move the items to the tail of the CIL */
-	for (lv = log_vector; lv; lv = lv->lv_next)
-		list_move_tail(&lv->lv_item->li_cil, &cil->xc_cil);
-
-	ctx->nvecs += diff_iovecs;
-
 	/*
 	 * Now transfer enough transaction reservation to the context ticket
-	 * for the checkpoint. The context ticket is special - the unit
-	 * reservation has to grow as well as the current reservation as we
-	 * steal from tickets so we can correctly determine the space used
-	 * during the transaction commit.
+	 * for the checkpoint. The first commit in the checkpoint steals the
+	 * header reservation; everything is added to the context ticket when
+	 * the checkpoint is pushed.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
-		/* first commit in checkpoint, steal the header reservation */
-		ASSERT(ticket->t_curr_res >= ctx->ticket->t_unit_res + len);
-		ctx->ticket->t_curr_res = ctx->ticket->t_unit_res;
-		ticket->t_curr_res -= ctx->ticket->t_unit_res;
+	if (!test_bit(XLOG_CIL_CTX_HAS_RES, &ctx->flags) &&
+	    !test_and_set_bit(XLOG_CIL_CTX_HAS_RES, &ctx->flags)) {
+		ctx_res = ctx->ticket->t_unit_res;
+		ASSERT(ticket->t_curr_res >= ctx_res + len);
 	}
 
-	/* do we need space for more log record headers? */
+	/*
+	 * Items are kept in commit order within a checkpoint by sorting them
+	 * on this when the checkpoint is pushed.
+	 */
+	order = atomic_inc_return(&ctx->order_id);
+
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+
+	/*
+	 * Do we need space for more log record headers? Each CPU only sees
+	 * its own share of the checkpoint, so besides the iclog boundaries
+	 * that share crosses we also take a header the first time this CPU
+	 * adds anything. The sum over all CPUs then never falls short of what
+	 * the whole checkpoint needs.
+	 */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
+	if (len > 0 && (cilpcp->space_used == 0 ||
+			cilpcp->space_used / iclog_space !=
+				(cilpcp->space_used + len) / iclog_space)) {
 		int hdrs;
 
 		hdrs = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		hdrs *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += hdrs;
-		ctx->ticket->t_curr_res += hdrs;
-		ticket->t_curr_res -= hdrs;
-		ASSERT(ticket->t_curr_res >= len);
+		ctx_res += hdrs;
+		ASSERT(ticket->t_curr_res >= ctx_res + len);
+	}
+	ticket->t_curr_res -= ctx_res + len;
+	cilpcp->space_reserved += ctx_res;
+	cilpcp->space_used += len;
+	cilpcp->nvecs += diff_iovecs;
+
+	/* let the background push check see the space in batches */
+	if (cilpcp->space_used - cilpcp->space_folded > XLOG_CIL_PCP_SPACE(log)) {
+		atomic_add(cilpcp->space_used - cilpcp->space_folded,
+			   &ctx->space_used);
+		cilpcp->space_folded = cilpcp->space_used;
 	}
-	ticket->t_curr_res -= len;
-	ctx->space_used += len;
 
-	spin_unlock(&cil->xc_cil_lock);
+	/*
+	 * Items already in this checkpoint stay on whichever per-cpu list
+	 * they were first added to; only their order changes.
+	 */
+	for (lv = log_vector; lv; lv = lv->lv_next) {
+		struct xfs_log_item	*lip = lv->lv_item;
+
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
+	}
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
+
+	put_cpu_ptr(cil->xc_pcp);
 }
 
 static void
@@ -357,6 +389,23 @@ xlog_cil_committed(
 	kmem_free(ctx);
 }
 
+static void xlog_cil_push_work(struct work_struct *work);
+
+/*
+ * Sort the items gathered from the per-cpu lists back into commit order.
+ */
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_log_item	*l1 = container_of(a, struct xfs_log_item, li_cil);
+	struct xfs_log_item	*l2 = container_of(b, struct xfs_log_item, li_cil);
+
+	return l1->li_order_id > l2->li_order_id;
+}
+
 /*
  * Push the Committed Item List to the log. If @push_seq flag is zero, then it
  * is a background flush and so we can chose to ignore it. Otherwise, if the
@@ -390,6 +439,8 @@ xlog_cil_push(
 	struct xfs_log_vec	lvhdr = { NULL };
 	xfs_lsn_t		commit_lsn;
 	xfs_lsn_t		push_seq;
+	LIST_HEAD(items);
+	int			cpu;
 
 	if (!cil)
 		return 0;
@@ -409,7 +460,7 @@ xlog_cil_push(
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (!test_bit(XLOG_CIL_CTX_HAS_RES, &ctx->flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_cil_lock);
 		goto out_skip;
@@ -421,22 +472,44 @@ xlog_cil_push(
 	if (push_seq < cil->xc_ctx->sequence)
 		goto out_skip;
 
+	/*
+	 * Gather the per-cpu parts of the CIL into the context. Transaction
+	 * commits are locked out by the context lock, so nothing can be
+	 * adding to them while we do this. The reservation stolen from the
+	 * committed transactions goes into the checkpoint ticket, whose unit
+	 * reservation has to match what it holds so we can correctly
+	 * determine the space used during the checkpoint commit.
+	 */
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp	*cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		ctx->nvecs += cilpcp->nvecs;
+		ctx->ticket->t_curr_res += cilpcp->space_reserved;
+		list_splice_init(&cilpcp->log_items, &items);
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+		cilpcp->space_used = 0;
+		cilpcp->space_folded = 0;
+		cilpcp->space_reserved = 0;
+		cilpcp->nvecs = 0;
+	}
+	ctx->ticket->t_unit_res = ctx->ticket->t_curr_res;
+
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. The items were gathered from the
+	 * per-cpu lists, so put them back into the order they were last
+	 * committed in first.
 	 */
+	list_sort(NULL, &items, xlog_cil_order_cmp);
 	lv = NULL;
 	num_lv = 0;
 	num_iovecs = 0;
 	len = 0;
-	while (!list_empty(&cil->xc_cil)) {
+	while (!list_empty(&items)) {
 		struct xfs_log_item	*item;
 		int			i;
 
-		item = list_first_entry(&cil->xc_cil,
-					struct xfs_log_item, li_cil);
+		item = list_first_entry(&items, struct xfs_log_item, li_cil);
 		list_del_init(&item->li_cil);
 		if (!ctx->lv_chain)
 			ctx->lv_chain = item->li_lv;
@@ -459,17 +532,11 @@ xlog_cil_push(
 	 */
 	INIT_LIST_HEAD(&new_ctx->committing);
 	INIT_LIST_HEAD(&new_ctx->busy_extents);
+	INIT_WORK(&new_ctx->push_work, xlog_cil_push_work);
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
 	cil->xc_ctx = new_ctx;
 
-	/*
-	 * mirror the new sequence into the cil structure so that we can do
-	 * unlocked checks against the current sequence in log forces without
-	 * risking deferencing a freed context pointer.
-	 */
-	cil->xc_current_sequence = new_ctx->sequence;
-
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
 	 * of a shared context. We can't just go straight to the commit record,
@@ -488,9 +555,16 @@ xlog_cil_push(
 	 * Hence we need to add this context to the committing context list so
 	 * that higher sequences will wait for us to write out a commit record
 	 * before they do.
+	 *
+	 * Mirror the new sequence into the cil structure at the same time so
+	 * that we can do unlocked checks against the current sequence in log
+	 * forces without risking deferencing a freed context pointer, and
+	 * wake log forces waiting for the push of this sequence to start.
 	 */
 	spin_lock(&cil->xc_cil_lock);
 	list_add(&ctx->committing, &cil->xc_committing);
+	cil->xc_current_sequence = new_ctx->sequence;
+	wake_up_all(&cil->xc_commit_wait);
 	spin_unlock(&cil->xc_cil_lock);
 	up_write(&cil->xc_ctx_lock);
 
@@ -571,6 +645,14 @@ restart:
 	return xfs_log_release_iclog(log->l_mp, commit_iclog);
 
 out_skip:
+	/*
+	 * The push is not going to happen, so let this context be queued
+	 * again and don't leave log forces waiting for it.
+	 */
+	clear_bit(XLOG_CIL_CTX_QUEUED, &ctx->flags);
+	spin_lock(&cil->xc_cil_lock);
+	wake_up_all(&cil->xc_commit_wait);
+	spin_unlock(&cil->xc_cil_lock);
 	up_write(&cil->xc_ctx_lock);
 	xfs_log_ticket_put(new_ctx->ticket);
 	kmem_free(new_ctx);
@@ -587,9 +669,31 @@ static void
 xlog_cil_push_work(
 	struct work_struct	*work)
 {
-	struct xfs_cil		*cil = container_of(work, struct xfs_cil,
-							xc_push_work);
-	xlog_cil_push(cil->xc_log);
+	struct xfs_cil_ctx	*ctx = container_of(work, struct xfs_cil_ctx,
+							push_work);
+	xlog_cil_push(ctx->cil->xc_log);
+}
+
+/*
+ * Queue the push of the current context. Each context has its own work item,
+ * so the push of a new context can start while the previous one is still
+ * being written to the log; the commit record ordering in xlog_cil_push()
+ * keeps the checkpoints in sequence.
+ *
+ * Must be called with the context lock held so the current context cannot be
+ * switched out from under us, and with the CIL lock held for xc_push_seq.
+ */
+static void
+xlog_cil_queue_push(
+	struct xlog		*log,
+	xfs_lsn_t		push_seq)
+{
+	struct xfs_cil		*cil = log->l_cilp;
+	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+
+	cil->xc_push_seq = push_seq;
+	if (!test_and_set_bit(XLOG_CIL_CTX_QUEUED, &ctx->flags))
+		queue_work(log->l_mp->m_cil_workqueue, &ctx->push_work);
 }
 
 /*
@@ -609,26 +713,28 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_CTX_HAS_RES, &cil->xc_ctx->flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
 	 * space available yet.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) < XLOG_CIL_SPACE_LIMIT(log))
 		return;
 
 	spin_lock(&cil->xc_cil_lock);
-	if (cil->xc_push_seq < cil->xc_current_sequence) {
-		cil->xc_push_seq = cil->xc_current_sequence;
-		queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
-	}
+	if (cil->xc_push_seq < cil->xc_current_sequence)
+		xlog_cil_queue_push(log, cil->xc_current_sequence);
 	spin_unlock(&cil->xc_cil_lock);
 
 }
 
+/*
+ * Start the push of @push_seq if that is still the current context. The push
+ * runs from the workqueue; the caller waits for it in xlog_cil_force_lsn().
+ */
 static void
-xlog_cil_push_foreground(
+xlog_cil_push_now(
 	struct xlog	*log,
 	xfs_lsn_t	push_seq)
 {
@@ -639,24 +745,18 @@ xlog_cil_push_foreground(
 
 	ASSERT(push_seq && push_seq <= cil->xc_current_sequence);
 
-	/* start on any pending background push to minimise wait time on it */
-	flush_work(&cil->xc_push_work);
-
 	/*
 	 * If the CIL is empty or we've already pushed the sequence then
 	 * there's no work we need to do.
 	 */
+	down_read(&cil->xc_ctx_lock);
 	spin_lock(&cil->xc_cil_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
-		spin_unlock(&cil->xc_cil_lock);
-		return;
-	}
-
-	cil->xc_push_seq = push_seq;
+	if (test_bit(XLOG_CIL_CTX_HAS_RES, &cil->xc_ctx->flags) &&
+	    push_seq == cil->xc_current_sequence &&
+	    push_seq > cil->xc_push_seq)
+		xlog_cil_queue_push(log, push_seq);
 	spin_unlock(&cil->xc_cil_lock);
-
-	/* do the push now */
-	xlog_cil_push(log);
+	up_read(&cil->xc_ctx_lock);
 }
 
 /*
@@ -705,20 +805,12 @@ xfs_log_commit_cil(
 	if (commit_lsn)
 		*commit_lsn = log->l_cilp->xc_ctx->sequence;
 
-	xlog_cil_insert_items(log, log_vector, tp->t_ticket);
+	xlog_cil_insert_items(log, log_vector, tp);
 
 	/* check we didn't blow the reservation */
 	if (tp->t_ticket->t_curr_res < 0)
 		xlog_print_tic_res(log->l_mp, tp->t_ticket);
 
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy)) {
-		spin_lock(&log->l_cilp->xc_cil_lock);
-		list_splice_init(&tp->t_busy,
-					&log->l_cilp->xc_ctx->busy_extents);
-		spin_unlock(&log->l_cilp->xc_cil_lock);
-	}
-
 	tp->t_commit_lsn = *commit_lsn;
 	xfs_log_done(mp, tp->t_ticket, NULL, log_flags);
 	xfs_trans_unreserve_and_mod_sb(tp);
@@ -768,7 +860,7 @@ xlog_cil_force_lsn(
 	 * xlog_cil_push() handles racing pushes for the same sequence,
 	 * so no need to deal with it here.
 	 */
-	xlog_cil_push_foreground(log, sequence);
+	xlog_cil_push_now(log, sequence);
 
 	/*
 	 * See if we can find a previous sequence still committing.
@@ -778,6 +870,18 @@ xlog_cil_force_lsn(
 	 */
 restart:
 	spin_lock(&cil->xc_cil_lock);
+
+	/*
+	 * The push runs asynchronously, so if it has been queued but has not
+	 * yet switched contexts the sequence is not on the committing list
+	 * yet. Wait for the switch, or for the push to find nothing to do.
+	 */
+	if (sequence == cil->xc_current_sequence &&
+	    cil->xc_push_seq >= sequence) {
+		xlog_wait(&cil->xc_commit_wait, &cil->xc_cil_lock);
+		goto restart;
+	}
+
 	list_for_each_entry(ctx, &cil->xc_committing, committing) {
 		if (ctx->sequence > sequence)
 			continue;
@@ -837,6 +941,7 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
@@ -848,8 +953,19 @@ xlog_cil_init(
 		return ENOMEM;
 	}
 
-	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
-	INIT_LIST_HEAD(&cil->xc_cil);
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp) {
+		kmem_free(ctx);
+		kmem_free(cil);
+		return ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp	*cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		INIT_LIST_HEAD(&cilpcp->log_items);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+	}
+
 	INIT_LIST_HEAD(&cil->xc_committing);
 	spin_lock_init(&cil->xc_cil_lock);
 	init_rwsem(&cil->xc_ctx_lock);
@@ -857,6 +973,7 @@ xlog_cil_init(
 
 	INIT_LIST_HEAD(&ctx->committing);
 	INIT_LIST_HEAD(&ctx->busy_extents);
+	INIT_WORK(&ctx->push_work, xlog_cil_push_work);
 	ctx->sequence = 1;
 	ctx->cil = cil;
 	cil->xc_ctx = ctx;
@@ -871,13 +988,25 @@ void
 xlog_cil_destroy(
 	struct xlog	*log)
 {
-	if (log->l_cilp->xc_ctx) {
-		if (log->l_cilp->xc_ctx->ticket)
-			xfs_log_ticket_put(log->l_cilp->xc_ctx->ticket);
-		kmem_free(log->l_cilp->xc_ctx);
+	struct xfs_cil	*cil = log->l_cilp;
+	int		cpu;
+
+	/* pushes run asynchronously, make sure none is left pending */
+	flush_workqueue(log->l_mp->m_cil_workqueue);
+
+	if (cil->xc_ctx) {
+		if (cil->xc_ctx->ticket)
+			xfs_log_ticket_put(cil->xc_ctx->ticket);
+		kmem_free(cil->xc_ctx);
 	}
 
-	ASSERT(list_empty(&log->l_cilp->xc_cil));
-	kmem_free(log->l_cilp);
+	for_each_possible_cpu(cpu) {
+		struct xlog_cil_pcp	*cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		ASSERT(list_empty(&cilpcp->log_items));
+		ASSERT(list_empty(&cilpcp->busy_extents));
+	}
+	free_percpu(cil->xc_pcp);
+	kmem_free(cil);
 }
 
@@ -384,12 +384,37 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		start_lsn;	/* first LSN of chkpt commit */
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
+	unsigned long		flags;		/* XLOG_CIL_CTX_* bits */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* last commit order handed out */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	xfs_log_callback_t	log_cb;		/* completion callback hook. */
 	struct list_head	committing;	/* ctx committing list */
+	struct work_struct	push_work;	/* pushes this context */
+};
+
+#define XLOG_CIL_CTX_HAS_RES	0	/* header reservation was stolen */
+#define XLOG_CIL_CTX_QUEUED	1	/* push_work has been queued */
+
+/*
+ * Per-cpu part of the CIL. A transaction commit only touches the structure of
+ * the CPU it runs on, with preemption disabled, so commits on different CPUs
+ * never share a lock or a cacheline. The push gathers all of them into the
+ * context being pushed while it holds the context lock exclusively.
+ *
+ * space_used is only folded into the context's space_used once it has grown
+ * by XLOG_CIL_PCP_SPACE(log), which is precise enough to decide when to do a
+ * background push.
+ */
+struct xlog_cil_pcp {
+	int			space_used;	/* size of regions from this cpu */
+	int			space_folded;	/* part of it added to the ctx */
+	int			space_reserved;	/* res stolen for the ctx ticket */
+	int			nvecs;		/* number of regions */
+	struct list_head	log_items;	/* items committed on this cpu */
+	struct list_head	busy_extents;	/* their busy extents */
 };
 
 /*
@@ -410,14 +435,13 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
+	struct xlog_cil_pcp __percpu *xc_pcp;
 	spinlock_t		xc_cil_lock;
 	struct xfs_cil_ctx	*xc_ctx;
 	struct rw_semaphore	xc_ctx_lock;
 	struct list_head	xc_committing;
 	wait_queue_head_t	xc_commit_wait;
 	xfs_lsn_t		xc_current_sequence;
-	struct work_struct	xc_push_work;
 	xfs_lsn_t		xc_push_seq;
 };
 
@@ -470,6 +494,8 @@ struct xfs_cil {
  */
 #define XLOG_CIL_SPACE_LIMIT(log)	(log->l_logsize >> 3)
 #define XLOG_CIL_HARD_SPACE_LIMIT(log)	(3 * (log->l_logsize >> 4))
+#define XLOG_CIL_PCP_SPACE(log)	\
+	(XLOG_CIL_SPACE_LIMIT(log) / (num_online_cpus() * 4))
 
 /*
  * ticket grant locks, queues and accounting have their own cachlines
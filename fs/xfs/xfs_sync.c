@@ -418,6 +418,9 @@ xfs_sync_worker(
 	xfs_syncd_queue_sync(mp);
 }
 
+STATIC int xfs_reclaim_inodes_ag(struct xfs_mount *mp, int flags,
+				 int *nr_to_scan, bool *more);
+
 /*
  * Queue a new inode reclaim pass if there are reclaimable inodes and there
  * isn't a reclaim pass already in progress. By default it runs every 5s based
@@ -426,24 +429,35 @@ xfs_sync_worker(
  * aggressive.
  */
 static void
-xfs_syncd_queue_reclaim(
-	struct xfs_mount        *mp)
+__xfs_syncd_queue_reclaim(
+	struct xfs_mount        *mp,
+	unsigned long		delay)
 {
 
 	rcu_read_lock();
-	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_RECLAIM_TAG)) {
-		queue_delayed_work(xfs_syncd_wq, &mp->m_reclaim_work,
-			msecs_to_jiffies(xfs_syncd_centisecs / 6 * 10));
-	}
+	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_RECLAIM_TAG))
+		queue_delayed_work(xfs_syncd_wq, &mp->m_reclaim_work, delay);
 	rcu_read_unlock();
 }
 
+static void
+xfs_syncd_queue_reclaim(
+	struct xfs_mount        *mp)
+{
+	__xfs_syncd_queue_reclaim(mp,
+			msecs_to_jiffies(xfs_syncd_centisecs / 6 * 10));
+}
+
 /*
  * This is a fast pass over the inode cache to try to get reclaim moving on as
  * many inodes as possible in a short period of time. It kicks itself every few
  * seconds, as well as being kicked by the inode cache shrinker when memory
  * goes low. It scans as quickly as possible avoiding locked inodes or those
  * already being flushed, and once done schedules a future pass.
+ *
+ * Each pass only walks XFS_RECLAIM_AG_LIMIT inodes in an AG. If that left
+ * work behind in any AG, come back after a short delay rather than the full
+ * reclaim period so a large backlog is worked down at a bounded rate.
  */
 STATIC void
 xfs_reclaim_worker(
@@ -451,9 +465,14 @@ xfs_reclaim_worker(
 {
 	struct xfs_mount *mp = container_of(to_delayed_work(work),
 					struct xfs_mount, m_reclaim_work);
+	int		nr_to_scan = INT_MAX;
+	bool		more = false;
 
-	xfs_reclaim_inodes(mp, SYNC_TRYLOCK);
-	xfs_syncd_queue_reclaim(mp);
+	xfs_reclaim_inodes_ag(mp, SYNC_TRYLOCK, &nr_to_scan, &more);
+	if (more)
+		__xfs_syncd_queue_reclaim(mp, msecs_to_jiffies(100));
+	else
+		xfs_syncd_queue_reclaim(mp);
 }
 
 /*
@@ -672,6 +691,10 @@ xfs_reclaim_inode_grab(
  *	clean		=> reclaim
  *	dirty, async	=> requeue
  *	dirty, sync	=> flush, wait and reclaim
+ *
+ * Non-blocking reclaim also only trylocks the inode when SYNC_TRYLOCK is set,
+ * and returns EAGAIN for the pinned and dirty inodes it skips so the caller
+ * can push the AIL to clean them for a later pass.
  */
 STATIC int
 xfs_reclaim_inode(
@@ -684,7 +707,10 @@ xfs_reclaim_inode(
 
 restart:
 	error = 0;
-	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	if (!(sync_mode & SYNC_TRYLOCK))
+		xfs_ilock(ip, XFS_ILOCK_EXCL);
+	else if (!xfs_ilock_nowait(ip, XFS_ILOCK_EXCL))
+		goto out_noilock;
 	if (!xfs_iflock_nowait(ip)) {
 		if (!(sync_mode & SYNC_WAIT))
 			goto out;
@@ -781,37 +807,58 @@ reclaim:
 
 out_ifunlock:
 	xfs_ifunlock(ip);
+	/*
+	 * The inode is pinned or dirty. Tell the caller, which will push the
+	 * AIL so the inode is written back asynchronously and can be
+	 * reclaimed by a later pass.
+	 */
+	error = EAGAIN;
 out:
-	xfs_iflags_clear(ip, XFS_IRECLAIM);
 	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+out_noilock:
+	xfs_iflags_clear(ip, XFS_IRECLAIM);
 	/*
-	 * We could return EAGAIN here to make reclaim rescan the inode tree in
-	 * a short while. However, this just burns CPU time scanning the tree
-	 * waiting for IO to complete and xfssyncd never goes back to the idle
-	 * state. Instead, return 0 to let the next scheduled background reclaim
-	 * attempt to reclaim the inode again.
+	 * We don't rescan the inode tree here for inodes we could not reclaim:
+	 * this just burns CPU time scanning the tree waiting for IO to
+	 * complete and xfssyncd never goes back to the idle state. Instead,
+	 * let the next scheduled background reclaim attempt to reclaim the
+	 * inode again.
 	 */
-	return 0;
+	return error;
 }
 
+/*
+ * Non-blocking reclaim walks at most this many inodes in an AG before moving
+ * on to the next one, leaving the reclaim cursor where it stopped. A single
+ * AG with a huge number of reclaimable inodes then cannot monopolise a
+ * reclaim pass, and the background worker reclaims at a bounded rate per AG.
+ */
+#define XFS_RECLAIM_AG_LIMIT	(32 * XFS_LOOKUP_BATCH)
+
 /*
  * Walk the AGs and reclaim the inodes in them. Even if the filesystem is
  * corrupted, we still want to try to reclaim all the inodes. If we don't,
  * then a shut down during filesystem unmount reclaim walk leak all the
  * unreclaimed inodes.
+ *
+ * If @more is not NULL it is set when the walk stopped short of the end of
+ * any AG, i.e. another pass will find more inodes to reclaim.
  */
-int
+STATIC int
 xfs_reclaim_inodes_ag(
 	struct xfs_mount	*mp,
 	int			flags,
-	int			*nr_to_scan)
+	int			*nr_to_scan,
+	bool			*more)
 {
 	struct xfs_perag	*pag;
 	int			error = 0;
 	int			last_error = 0;
 	xfs_agnumber_t		ag;
 	int			trylock = flags & SYNC_TRYLOCK;
+	int			limit = trylock && !(flags & SYNC_WAIT);
 	int			skipped;
+	int			dirty = 0;
 
 restart:
 	ag = 0;
@@ -820,6 +867,7 @@ restart:
 		unsigned long	first_index = 0;
 		int		done = 0;
 		int		nr_found = 0;
+		int		ag_scanned = 0;
 
 		ag = pag->pag_agno + 1;
 
@@ -888,19 +936,27 @@ restart:
 				if (!batch[i])
 					continue;
 				error = xfs_reclaim_inode(batch[i], pag, flags);
+				if (error == EAGAIN) {
+					dirty = 1;
+					continue;
+				}
 				if (error && last_error != EFSCORRUPTED)
 					last_error = error;
 			}
 
 			*nr_to_scan -= XFS_LOOKUP_BATCH;
+			ag_scanned += XFS_LOOKUP_BATCH;
 
 			cond_resched();
 
-		} while (nr_found && !done && *nr_to_scan > 0);
+		} while (nr_found && !done && *nr_to_scan > 0 &&
+			 !(limit && ag_scanned >= XFS_RECLAIM_AG_LIMIT));
 
-		if (trylock && !done)
+		if (trylock && !done) {
 			pag->pag_ici_reclaim_cursor = first_index;
-		else
+			if (more)
+				*more = true;
+		} else
 			pag->pag_ici_reclaim_cursor = 0;
 		mutex_unlock(&pag->pag_ici_reclaim_lock);
 		xfs_perag_put(pag);
@@ -917,6 +973,14 @@ restart:
 		trylock = 0;
 		goto restart;
 	}
+
+	/*
+	 * Non-blocking reclaim skipped pinned or dirty inodes. Get the AIL
+	 * to write them back in the background so that they are clean by the
+	 * time reclaim comes around to them again.
+	 */
+	if (dirty)
+		xfs_ail_push_all(mp->m_ail);
 	return XFS_ERROR(last_error);
 }
 
@@ -927,28 +991,27 @@ xfs_reclaim_inodes(
 {
 	int		nr_to_scan = INT_MAX;
 
-	return xfs_reclaim_inodes_ag(mp, mode, &nr_to_scan);
+	return xfs_reclaim_inodes_ag(mp, mode, &nr_to_scan, NULL);
 }
 
 /*
  * Scan a certain number of inodes for reclaim.
  *
- * When called we make sure that there is a background (fast) inode reclaim in
- * progress, while we will throttle the speed of reclaim via doing synchronous
- * reclaim of inodes. That means if we come across dirty inodes, we wait for
- * them to be cleaned, which we hope will not be very long due to the
- * background walker having already kicked the IO off on those dirty inodes.
+ * This is called from the shrinker, so it must not block: it only reclaims
+ * clean inodes it can lock without waiting and leaves dirty ones to the AIL,
+ * which xfs_reclaim_inodes_ag() pushes when it skips any. We also make sure
+ * there is a background (fast) inode reclaim in progress to pick up the
+ * inodes once they are clean.
  */
 void
 xfs_reclaim_inodes_nr(
 	struct xfs_mount	*mp,
 	int			nr_to_scan)
 {
-	/* kick background reclaimer and push the AIL */
+	/* kick background reclaimer */
 	xfs_syncd_queue_reclaim(mp);
-	xfs_ail_push_all(mp->m_ail);
 
-	xfs_reclaim_inodes_ag(mp, SYNC_TRYLOCK | SYNC_WAIT, &nr_to_scan);
+	xfs_reclaim_inodes_ag(mp, SYNC_TRYLOCK, &nr_to_scan, NULL);
 }
 
 /*
@@ -333,6 +333,7 @@ typedef struct xfs_log_item {
 	struct list_head		li_cil;		/* CIL pointers */
 	struct xfs_log_vec		*li_lv;		/* active log vector */
 	xfs_lsn_t			li_seq;		/* CIL commit seq */
+	uint32_t			li_order_id;	/* CIL commit order */
 } xfs_log_item_t;
 
 #define	XFS_LI_IN_AIL	0x1
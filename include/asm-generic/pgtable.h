@@ -530,6 +530,25 @@ static inline int pmd_trans_unstable(pmd_t *pmd)
 #endif
 }
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot);
+int pmd_clear_huge(pmd_t *pmd);
+int pmd_free_pte_page(pmd_t *pmd, unsigned long addr);
+#else
+static inline int pmd_set_huge(pmd_t *pmd, phys_addr_t addr, pgprot_t prot)
+{
+	return 0;
+}
+static inline int pmd_clear_huge(pmd_t *pmd)
+{
+	return 0;
+}
+static inline int pmd_free_pte_page(pmd_t *pmd, unsigned long addr)
+{
+	return 0;
+}
+#endif /* CONFIG_HAVE_ARCH_HUGE_VMAP */
+
 #endif /* CONFIG_MMU */
 
 #endif /* !__ASSEMBLY__ */
@@ -691,9 +691,27 @@ __SC_COMP(__NR_process_vm_readv, sys_process_vm_readv, \
 #define __NR_process_vm_writev 271
 __SC_COMP(__NR_process_vm_writev, sys_process_vm_writev, \
           compat_sys_process_vm_writev)
+#define __NR_io_uring_setup 272
+__SYSCALL(__NR_io_uring_setup, sys_io_uring_setup)
+#define __NR_io_uring_enter 273
+__SYSCALL(__NR_io_uring_enter, sys_io_uring_enter)
+#define __NR_io_uring_register 274
+__SYSCALL(__NR_io_uring_register, sys_io_uring_register)
+#define __NR_sendfilev 275
+__SYSCALL(__NR_sendfilev, sys_sendfilev)
+#define __NR_copy_file_range 276
+__SYSCALL(__NR_copy_file_range, sys_copy_file_range)
+#define __NR_sched_setattr 277
+__SYSCALL(__NR_sched_setattr, sys_sched_setattr)
+#define __NR_sched_getattr 278
+__SYSCALL(__NR_sched_getattr, sys_sched_getattr)
+#define __NR_rseq 279
+__SYSCALL(__NR_rseq, sys_rseq)
+#define __NR_getrandom 280
+__SYSCALL(__NR_getrandom, sys_getrandom)
 
 #undef __NR_syscalls
-#define __NR_syscalls 272
+#define __NR_syscalls 281
 
 /*
  * All syscalls below here should go away really,
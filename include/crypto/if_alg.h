@@ -42,12 +42,14 @@ struct af_alg_completion {
 struct af_alg_control {
 	struct af_alg_iv *iv;
 	int op;
+	unsigned int aead_assoclen;
 };
 
 struct af_alg_type {
 	void *(*bind)(const char *name, u32 type, u32 mask);
 	void (*release)(void *private);
 	int (*setkey)(void *private, const u8 *key, unsigned int keylen);
+	int (*setauthsize)(void *private, unsigned int authsize);
 	int (*accept)(void *private, struct sock *sk);
 
 	struct proto_ops *ops;
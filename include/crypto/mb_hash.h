@@ -0,0 +1,67 @@
+/*
+ * Multi-buffer hashing
+ *
+ * Some SIMD implementations can hash several independent messages at
+ * once, one per vector lane.  A single request rarely keeps all lanes
+ * busy, so the helpers here collect requests from every user of an
+ * algorithm on a CPU, feed them to the lanes as they become free and
+ * flush partially filled lanes after a short delay.
+ *
+ * Only Merkle-Damgard hashes with 64 byte blocks, 32-bit state words
+ * and a big-endian length and digest (SHA-1, SHA-224, SHA-256) are
+ * supported.  The algorithm is exposed as an asynchronous ahash.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#ifndef _CRYPTO_MB_HASH_H
+#define _CRYPTO_MB_HASH_H
+
+#include <crypto/internal/hash.h>
+
+#define MB_HASH_MAX_LANES	8
+#define MB_HASH_MAX_WORDS	8
+#define MB_HASH_BLOCK_SIZE	64
+
+struct mb_hash_mgr;
+
+struct mb_hash_lanes {
+	/*
+	 * Word w of the state of lane l is digest[w][l], so that a single
+	 * vector load fetches the same word of every lane.
+	 */
+	u32 digest[MB_HASH_MAX_WORDS][MB_HASH_MAX_LANES] __aligned(32);
+	const u8 *data[MB_HASH_MAX_LANES];
+};
+
+struct mb_hash_alg {
+	unsigned int lanes;
+	unsigned int state_words;
+	const u32 *init_state;
+
+	/*
+	 * Hash @blocks blocks from every lane.  Called from process
+	 * context; lanes without work point at another lane's data and
+	 * their result is ignored.  The data pointers are advanced by
+	 * the caller.
+	 */
+	void (*process)(struct mb_hash_lanes *lanes, unsigned int blocks);
+
+	/*
+	 * The caller fills in the digest size and the cra_name,
+	 * cra_driver_name, cra_priority, cra_blocksize and cra_module
+	 * fields, the operations are provided by mb_hash_register().
+	 */
+	struct ahash_alg ahash;
+
+	struct mb_hash_mgr __percpu *mgr;
+};
+
+int mb_hash_register(struct mb_hash_alg *alg);
+void mb_hash_unregister(struct mb_hash_alg *alg);
+
+#endif	/* _CRYPTO_MB_HASH_H */
@@ -15,6 +15,8 @@
 #include <linux/fs.h>
 #include <linux/sched.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/hash.h>
 #include <linux/writeback.h>
 #include <linux/atomic.h>
 #include <linux/sysctl.h>
@@ -27,15 +29,21 @@ struct dentry;
  * Bits in backing_dev_info.state
  */
 enum bdi_state {
-	BDI_pending,		/* On its way to being activated */
 	BDI_wb_alloc,		/* Default embedded wb allocated */
 	BDI_async_congested,	/* The async (write) queue is getting full */
 	BDI_sync_congested,	/* The sync queue is getting full */
 	BDI_registered,		/* bdi_register() was done */
-	BDI_writeback_running,	/* Writeback is in progress */
 	BDI_unused,		/* Available bits start here */
 };
 
+/*
+ * Bits in bdi_writeback.state
+ */
+enum wb_state {
+	WB_registered,		/* work may be queued on this wb */
+	WB_writeback_running,	/* Writeback is in progress */
+};
+
 typedef int (congested_fn)(void *, int);
 
 enum bdi_stat_item {
@@ -48,19 +56,37 @@ enum bdi_stat_item {
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/*
+ * Maximum number of writeback workers per bdi, see bdi->nr_wb.
+ */
+#define BDI_MAX_WB	16
+
+/*
+ * One writeback worker of a bdi. The dirty inodes of the bdi are split
+ * between its workers by inode number, and each worker runs off bdi_wq
+ * on its own, so that a fast device is not limited to what one flusher
+ * can push through writeback_sb_inodes().
+ */
 struct bdi_writeback {
 	struct backing_dev_info *bdi;	/* our parent bdi */
-	unsigned int nr;
+	unsigned int nr;		/* index of this worker in the bdi */
+	unsigned long state;		/* Always use atomic bitops on this */
 
 	unsigned long last_old_flush;	/* last old data flush */
-	unsigned long last_active;	/* last time bdi thread was active */
 
-	struct task_struct *task;	/* writeback thread */
-	struct timer_list wakeup_timer; /* used for delayed bdi thread wakeup */
+	struct delayed_work dwork;	/* work item used for writeback */
 	struct list_head b_dirty;	/* dirty inodes */
 	struct list_head b_io;		/* parked for writeback */
 	struct list_head b_more_io;	/* parked for more writeback */
+	struct list_head b_dirty_time;	/* inodes with only a lazy atime */
 	spinlock_t list_lock;		/* protects the b_* lists */
+
+	spinlock_t work_lock;		/* protects work_list */
+	struct list_head work_list;
+
+	/* statistics, only updated by the worker itself */
+	unsigned long nr_works;		/* work items completed */
+	unsigned long nr_written;	/* pages written back */
 };
 
 struct backing_dev_info {
@@ -97,9 +123,9 @@ struct backing_dev_info {
 	unsigned int max_ratio, max_prop_frac;
 
 	struct bdi_writeback wb;  /* default writeback info for this bdi */
-	spinlock_t wb_lock;	  /* protects work_list */
-
-	struct list_head work_list;
+	struct bdi_writeback *wb_extra; /* workers 1 .. nr_wb - 1 */
+	unsigned int nr_wb;	  /* number of writeback workers */
+	wait_queue_head_t wb_waitq; /* waiters for split writeback works */
 
 	struct device *dev;
 
@@ -108,6 +134,7 @@ struct backing_dev_info {
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
+	struct dentry *debug_workers;
 #endif
 };
 
@@ -122,15 +149,20 @@ int bdi_setup_and_register(struct backing_dev_info *, char *, unsigned int);
 void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages,
 			enum wb_reason reason);
 void bdi_start_background_writeback(struct backing_dev_info *bdi);
-int bdi_writeback_thread(void *data);
+void bdi_writeback_workfn(struct work_struct *work);
 int bdi_has_dirty_io(struct backing_dev_info *bdi);
-void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi);
+void wb_wakeup_delayed(struct bdi_writeback *wb);
 void bdi_lock_two(struct bdi_writeback *wb1, struct bdi_writeback *wb2);
 
 extern spinlock_t bdi_lock;
 extern struct list_head bdi_list;
-extern struct list_head bdi_pending_list;
 
+extern struct workqueue_struct *bdi_wq;
+
+/*
+ * Inodes on b_dirty_time do not count, they are written out by the
+ * periodic dirtytime work and must not keep the worker busy on their own.
+ */
 static inline int wb_has_dirty_io(struct bdi_writeback *wb)
 {
 	return !list_empty(&wb->b_dirty) ||
@@ -138,6 +170,33 @@ static inline int wb_has_dirty_io(struct bdi_writeback *wb)
 	       !list_empty(&wb->b_more_io);
 }
 
+static inline struct bdi_writeback *bdi_wb(struct backing_dev_info *bdi,
+					   unsigned int nr)
+{
+	return nr ? &bdi->wb_extra[nr - 1] : &bdi->wb;
+}
+
+/**
+ * bdi_for_each_wb - iterate over the writeback workers of a bdi
+ * @wb: the struct bdi_writeback * to use as a loop cursor
+ * @bdi: the bdi
+ * @i: an unsigned int to keep the worker index in
+ */
+#define bdi_for_each_wb(wb, bdi, i)					\
+	for ((i) = 0; (i) < (bdi)->nr_wb && ((wb) = bdi_wb(bdi, i), 1); (i)++)
+
+/*
+ * The worker whose lists @inode goes on. bdi->nr_wb is fixed once the
+ * bdi is registered, so this does not change while the inode is dirty.
+ */
+static inline struct bdi_writeback *bdi_inode_wb(struct backing_dev_info *bdi,
+						 struct inode *inode)
+{
+	if (bdi->nr_wb <= 1)
+		return &bdi->wb;
+	return bdi_wb(bdi, hash_long(inode->i_ino, 16) % bdi->nr_wb);
+}
+
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
 {
@@ -329,11 +388,6 @@ static inline bool bdi_cap_swap_backed(struct backing_dev_info *bdi)
 	return bdi->capabilities & BDI_CAP_SWAP_BACKED;
 }
 
-static inline bool bdi_cap_flush_forker(struct backing_dev_info *bdi)
-{
-	return bdi == &default_backing_dev_info;
-}
-
 static inline bool mapping_cap_writeback_dirty(struct address_space *mapping)
 {
 	return bdi_cap_writeback_dirty(mapping->backing_dev_info);
@@ -349,10 +403,4 @@ static inline bool mapping_cap_swap_backed(struct address_space *mapping)
 	return bdi_cap_swap_backed(mapping->backing_dev_info);
 }
 
-static inline int bdi_sched_wait(void *word)
-{
-	schedule();
-	return 0;
-}
-
 #endif		/* _LINUX_BACKING_DEV_H */
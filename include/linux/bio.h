@@ -271,9 +271,13 @@ extern unsigned int bvec_nr_vecs(unsigned short idx);
 
 #ifdef CONFIG_BLK_CGROUP
 int bio_associate_current(struct bio *bio);
+int bio_associate_blkcg(struct bio *bio, struct cgroup_subsys_state *css);
 void bio_disassociate_task(struct bio *bio);
 #else	/* CONFIG_BLK_CGROUP */
 static inline int bio_associate_current(struct bio *bio) { return -ENOENT; }
+static inline int bio_associate_blkcg(struct bio *bio,
+				      struct cgroup_subsys_state *css)
+{ return -ENOENT; }
 static inline void bio_disassociate_task(struct bio *bio) { }
 #endif	/* CONFIG_BLK_CGROUP */
 
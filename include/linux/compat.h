@@ -278,6 +278,11 @@ asmlinkage long compat_sys_keyctl(u32 option,
 			      u32 arg2, u32 arg3, u32 arg4, u32 arg5);
 asmlinkage long compat_sys_ustat(unsigned dev, struct compat_ustat __user *u32);
 
+size_t compat_readv(struct file *file, const struct compat_iovec __user *vec,
+		    unsigned long vlen, loff_t *pos);
+size_t compat_writev(struct file *file, const struct compat_iovec __user *vec,
+		     unsigned long vlen, loff_t *pos);
+
 asmlinkage ssize_t compat_sys_readv(unsigned long fd,
 		const struct compat_iovec __user *vec, unsigned long vlen);
 asmlinkage ssize_t compat_sys_writev(unsigned long fd,
@@ -37,6 +37,8 @@ struct cpuidle_state_usage {
 	unsigned long long	disable;
 	unsigned long long	usage;
 	unsigned long long	time; /* in US */
+	unsigned long long	above; /* woke before a shallower state paid off */
+	unsigned long long	below; /* a deeper state would have paid off */
 };
 
 struct cpuidle_state {
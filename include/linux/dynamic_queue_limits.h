@@ -25,6 +25,11 @@
  *    dql_completed - called at completion time to indicate how many objects
  *      were retired from the queue
  *
+ * Optionally dql samples the sojourn time of objects in the queue, that is
+ * the time between dql_queued and the dql_completed call retiring them, and
+ * keeps a log2 histogram of it.  When a latency target is set the limit is
+ * steered so that the sojourn time stays below the target.
+ *
  * The dql implementation does not implement any locking for the dql data
  * structures, the higher layer should provide this.  dql_queued should
  * be serialized to prevent concurrent execution of the function; this
@@ -37,11 +42,26 @@
 
 #ifdef __KERNEL__
 
+#include <linux/types.h>
+
+/* Number of in flight sojourn time samples, must be a power of two */
+#define DQL_STAMPS		16
+/* Histogram bucket n counts sojourn times in [2^n, 2^(n+1)) usecs */
+#define DQL_HIST_BUCKETS	16
+
+struct dql_stamp {
+	unsigned int	num_queued;		/* num_queued after the sample */
+	u64		time;			/* Time of the sample in ns */
+};
+
 struct dql {
 	/* Fields accessed in enqueue path (dql_queued) */
 	unsigned int	num_queued;		/* Total ever queued */
 	unsigned int	adj_limit;		/* limit + num_completed */
 	unsigned int	last_obj_cnt;		/* Count at last queuing */
+	bool		latency_track;		/* Sample sojourn times */
+	unsigned int	stamp_head;		/* Next sample slot */
+	struct dql_stamp stamps[DQL_STAMPS];
 
 	/* Fields accessed only by completion path (dql_completed) */
 
@@ -55,16 +75,27 @@ struct dql {
 	unsigned int	lowest_slack;		/* Lowest slack found */
 	unsigned long	slack_start_time;	/* Time slacks seen */
 
+	unsigned int	stamp_tail;		/* Oldest pending sample */
+	unsigned int	sojourn;		/* Last sojourn time in usecs */
+	unsigned long	hist[DQL_HIST_BUCKETS];	/* Sojourn time histogram */
+
 	/* Configuration */
 	unsigned int	max_limit;		/* Max limit */
 	unsigned int	min_limit;		/* Minimum limit */
 	unsigned int	slack_hold_time;	/* Time to measure slack */
+	unsigned int	latency_target;		/* Sojourn target in usecs */
 };
 
 /* Set some static maximums */
 #define DQL_MAX_OBJECT (UINT_MAX / 16)
 #define DQL_MAX_LIMIT ((UINT_MAX / 2) - DQL_MAX_OBJECT)
 
+/* Take a sojourn time sample for the objects queued last. */
+void dql_stamp(struct dql *dql);
+
+/* Enable or disable sojourn time sampling. */
+void dql_set_latency_track(struct dql *dql, bool on);
+
 /*
  * Record number of objects queued. Assumes that caller has already checked
  * availability in the queue with dql_avail.
@@ -75,6 +106,9 @@ static inline void dql_queued(struct dql *dql, unsigned int count)
 
 	dql->num_queued += count;
 	dql->last_obj_cnt = count;
+
+	if (unlikely(dql->latency_track))
+		dql_stamp(dql);
 }
 
 /* Returns how many objects can be queued, < 0 indicates over limit. */
@@ -17,6 +17,7 @@
 /* For O_CLOEXEC */
 #include <linux/fcntl.h>
 #include <linux/types.h>
+#include <linux/ioctl.h>
 
 /* Flags for epoll_create1.  */
 #define EPOLL_CLOEXEC O_CLOEXEC
@@ -26,6 +27,13 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Set exclusive wakeup mode for the target file descriptor: when several
+ * epoll sets wait on it with this flag, a wakeup is delivered to one of
+ * them rather than to all. Only valid with EPOLL_CTL_ADD.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /*
  * Request the handling of system wakeup events so as to prevent system suspends
  * from happening while those events are being processed.
@@ -61,6 +69,19 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/*
+ * Wakeup batching for an epoll set: waiters are woken up once min_events
+ * descriptors became ready, or max_usecs after the first of them did.
+ * A min_events of 0 or 1 disables batching.
+ */
+struct epoll_batch {
+	__u32 min_events;
+	__u32 max_usecs;
+};
+
+#define EPIOCSBATCH	_IOW(0x8A, 0x01, struct epoll_batch)
+#define EPIOCGBATCH	_IOR(0x8A, 0x02, struct epoll_batch)
+
 #ifdef __KERNEL__
 
 /* Forward declarations to avoid compiler errors */
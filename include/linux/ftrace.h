@@ -61,6 +61,8 @@ struct ftrace_ops {
 #ifdef CONFIG_DYNAMIC_FTRACE
 	struct ftrace_hash		*notrace_hash;
 	struct ftrace_hash		*filter_hash;
+	unsigned long			trampoline;
+	unsigned long			trampoline_size;
 #endif
 };
 
@@ -227,12 +229,23 @@ extern void unregister_ftrace_function_probe_all(char *glob);
 
 extern int ftrace_text_reserved(void *start, void *end);
 
+/*
+ * FTRACE_FL_* bits live in the top of dyn_ftrace->flags, the rest
+ * is the count of ftrace_ops tracing the record.
+ *
+ * ENABLED  - the call site is patched to call into ftrace
+ * TRAMP_EN - the call site calls the private trampoline of the
+ *            only ftrace_ops tracing it, rather than ftrace_caller
+ */
 enum {
 	FTRACE_FL_ENABLED	= (1 << 30),
+	FTRACE_FL_TRAMP_EN	= (1 << 29),
 };
 
-#define FTRACE_FL_MASK		(0x3UL << 30)
-#define FTRACE_REF_MAX		((1 << 30) - 1)
+#define FTRACE_FL_MASK		(0x7UL << 29)
+#define FTRACE_REF_MAX		((1UL << 29) - 1)
+
+#define ftrace_rec_count(rec)	((rec)->flags & ~FTRACE_FL_MASK)
 
 struct dyn_ftrace {
 	union {
@@ -267,6 +280,7 @@ enum {
 	FTRACE_UPDATE_IGNORE,
 	FTRACE_UPDATE_MAKE_CALL,
 	FTRACE_UPDATE_MAKE_NOP,
+	FTRACE_UPDATE_MODIFY_CALL,
 };
 
 enum {
@@ -296,6 +310,8 @@ int ftrace_update_record(struct dyn_ftrace *rec, int enable);
 int ftrace_test_record(struct dyn_ftrace *rec, int enable);
 void ftrace_run_stop_machine(int command);
 unsigned long ftrace_location(unsigned long ip);
+unsigned long ftrace_get_addr_new(struct dyn_ftrace *rec);
+unsigned long ftrace_get_addr_curr(struct dyn_ftrace *rec);
 
 extern ftrace_func_t ftrace_trace_function;
 
@@ -316,6 +332,7 @@ extern int ftrace_ip_converted(unsigned long ip);
 extern int ftrace_dyn_arch_init(void *data);
 extern void ftrace_replace_code(int enable);
 extern int ftrace_update_ftrace_func(ftrace_func_t func);
+extern void arch_ftrace_update_trampoline(struct ftrace_ops *ops);
 extern void ftrace_caller(void);
 extern void ftrace_call(void);
 extern void mcount_call(void);
@@ -380,6 +397,19 @@ extern int ftrace_make_nop(struct module *mod,
  */
 extern int ftrace_make_call(struct dyn_ftrace *rec, unsigned long addr);
 
+/**
+ * ftrace_modify_call - convert from one addr to another (no nop)
+ * @rec: the mcount call site record
+ * @old_addr: the address expected to be currently called to
+ * @addr: the address to change to
+ *
+ * Only needed by archs that create per ftrace_ops trampolines and
+ * let the generic code do the patching. The same care as for
+ * ftrace_make_call() applies, and the return values are the same.
+ */
+extern int ftrace_modify_call(struct dyn_ftrace *rec, unsigned long old_addr,
+			      unsigned long addr);
+
 /* May be defined in arch */
 extern int ftrace_arch_read_dyn_info(char *buf, int size);
 
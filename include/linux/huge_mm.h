@@ -29,6 +29,8 @@ extern int move_huge_pmd(struct vm_area_struct *vma,
 			 pmd_t *old_pmd, pmd_t *new_pmd);
 extern int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			unsigned long addr, pgprot_t newprot);
+extern int do_set_huge_pmd(struct vm_area_struct *vma, unsigned long haddr,
+			   pmd_t *pmd, struct page *page);
 
 enum transparent_hugepage_flag {
 	TRANSPARENT_HUGEPAGE_FLAG,
@@ -69,6 +71,9 @@ extern bool is_vma_temporary_stack(struct vm_area_struct *vma);
 	   ((__vma)->vm_flags & VM_HUGEPAGE))) &&			\
 	 !((__vma)->vm_flags & VM_NOHUGEPAGE) &&			\
 	 !is_vma_temporary_stack(__vma))
+/* page cache backed mappings which can be mapped with huge pmds */
+#define transparent_hugepage_file(__vma)				\
+	((__vma)->vm_ops && (__vma)->vm_ops->pmd_fault)
 #define transparent_hugepage_defrag(__vma)				\
 	((transparent_hugepage_flags &					\
 	  (1<<TRANSPARENT_HUGEPAGE_DEFRAG_FLAG)) ||			\
@@ -93,6 +98,9 @@ extern int handle_pte_fault(struct mm_struct *mm,
 			    pte_t *pte, pmd_t *pmd, unsigned int flags);
 extern int split_huge_page(struct page *page);
 extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
+extern void split_huge_page_address(struct mm_struct *mm,
+				    unsigned long address);
+extern void split_huge_page_vma(struct vm_area_struct *vma);
 #define split_huge_page_pmd(__mm, __pmd)				\
 	do {								\
 		pmd_t *____pmd = (__pmd);				\
@@ -133,7 +141,7 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops)
+	if (vma->vm_ops ? !vma->vm_ops->pmd_fault : !vma->anon_vma)
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
@@ -168,6 +176,7 @@ static inline struct page *compound_trans_head(struct page *page)
 #define hpage_nr_pages(x) 1
 
 #define transparent_hugepage_enabled(__vma) 0
+#define transparent_hugepage_file(__vma) 0
 
 #define transparent_hugepage_flags 0UL
 static inline int split_huge_page(struct page *page)
@@ -176,6 +185,13 @@ static inline int split_huge_page(struct page *page)
 }
 #define split_huge_page_pmd(__mm, __pmd)	\
 	do { } while (0)
+static inline void split_huge_page_address(struct mm_struct *mm,
+					   unsigned long address)
+{
+}
+static inline void split_huge_page_vma(struct vm_area_struct *vma)
+{
+}
 #define wait_split_huge_page(__anon_vma, __pmd)	\
 	do { } while (0)
 #define compound_trans_head(page) compound_head(page)
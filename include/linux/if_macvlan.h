@@ -52,6 +52,12 @@ struct macvlan_pcpu_stats {
  */
 #define MAX_MACVTAP_QUEUES	(NR_CPUS < 16 ? NR_CPUS : 16)
 
+/*
+ * Buckets of the table remembering, by flow hash, which queue a flow was
+ * last transmitted on, so that its receive traffic goes back to it.
+ */
+#define MACVTAP_FLOW_ENTRIES	256
+
 struct macvlan_dev {
 	struct net_device	*dev;
 	struct list_head	list;
@@ -65,6 +71,7 @@ struct macvlan_dev {
 	int (*forward)(struct net_device *dev, struct sk_buff *skb);
 	struct macvtap_queue	*taps[MAX_MACVTAP_QUEUES];
 	int			numvtaps;
+	u8			tap_flows[MACVTAP_FLOW_ENTRIES];
 	int			minor;
 };
 
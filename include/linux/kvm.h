@@ -163,6 +163,7 @@ struct kvm_pit_config {
 #define KVM_EXIT_OSI              18
 #define KVM_EXIT_PAPR_HCALL	  19
 #define KVM_EXIT_S390_UCONTROL	  20
+#define KVM_EXIT_DIRTY_RING_FULL  21
 
 /* For KVM_EXIT_INTERNAL_ERROR */
 #define KVM_INTERNAL_ERROR_EMULATION 1
@@ -300,13 +301,19 @@ struct kvm_run {
 struct kvm_coalesced_mmio_zone {
 	__u64 addr;
 	__u32 size;
-	__u32 pad;
+	union {
+		__u32 pad;
+		__u32 pio;
+	};
 };
 
 struct kvm_coalesced_mmio {
 	__u64 phys_addr;
 	__u32 len;
-	__u32 pad;
+	union {
+		__u32 pad;
+		__u32 pio;
+	};
 	__u8  data[8];
 };
 
@@ -348,6 +355,22 @@ struct kvm_dirty_log {
 	};
 };
 
+/*
+ * One entry of a vcpu dirty ring, mmap(vcpu_fd, offset=
+ * KVM_DIRTY_LOG_PAGE_OFFSET * PAGE_SIZE).  KVM publishes an entry by
+ * setting KVM_DIRTY_GFN_F_DIRTY; userspace hands it back by setting
+ * KVM_DIRTY_GFN_F_RESET once it has collected the page, and
+ * KVM_RESET_DIRTY_RINGS re-arms dirty tracking for the collected pages.
+ */
+struct kvm_dirty_gfn {
+	__u32 flags;
+	__u32 slot;
+	__u64 offset;	/* in pages, relative to the slot's base_gfn */
+};
+
+#define KVM_DIRTY_GFN_F_DIRTY		(1 << 0)
+#define KVM_DIRTY_GFN_F_RESET		(1 << 1)
+
 /* for KVM_SET_SIGNAL_MASK */
 struct kvm_signal_mask {
 	__u32 len;
@@ -426,7 +449,7 @@ enum {
 struct kvm_ioeventfd {
 	__u64 datamatch;
 	__u64 addr;        /* legal pio/mmio address */
-	__u32 len;         /* 1, 2, 4, or 8 bytes    */
+	__u32 len;         /* 1, 2, 4, or 8 bytes; or 0 to ignore length */
 	__s32 fd;
 	__u32 flags;
 	__u8  pad[36];
@@ -480,6 +503,8 @@ struct kvm_ppc_smmu_info {
 
 #define KVM_S390_SIE_PAGE_OFFSET 1
 
+#define KVM_DIRTY_LOG_PAGE_OFFSET 64
+
 /*
  * ioctls for /dev/kvm fds:
  */
@@ -618,6 +643,9 @@ struct kvm_ppc_smmu_info {
 #define KVM_CAP_PPC_GET_SMMU_INFO 78
 #define KVM_CAP_S390_COW 79
 #define KVM_CAP_PPC_ALLOC_HTAB 80
+#define KVM_CAP_DIRTY_LOG_RING 81
+#define KVM_CAP_COALESCED_PIO 82
+#define KVM_CAP_IOEVENTFD_ANY_LENGTH 83
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -831,6 +859,9 @@ struct kvm_s390_ucas_mapping {
 #define KVM_PPC_GET_SMMU_INFO	  _IOR(KVMIO,  0xa6, struct kvm_ppc_smmu_info)
 /* Available with KVM_CAP_PPC_ALLOC_HTAB */
 #define KVM_PPC_ALLOCATE_HTAB	  _IOWR(KVMIO, 0xa7, __u32)
+/* Available with KVM_CAP_DIRTY_LOG_RING */
+#define KVM_ENABLE_DIRTY_LOG_RING _IO(KVMIO,   0xae)
+#define KVM_RESET_DIRTY_RINGS     _IO(KVMIO,   0xaf)
 
 /*
  * ioctls for vcpu fds
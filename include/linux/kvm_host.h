@@ -69,6 +69,8 @@
 #define KVM_REQ_IMMEDIATE_EXIT    15
 #define KVM_REQ_PMU               16
 #define KVM_REQ_PMI               17
+#define KVM_REQ_SCAN_IOAPIC       18
+#define KVM_REQ_DIRTY_RING_FULL   19
 
 #define KVM_USERSPACE_IRQ_SOURCE_ID	0
 
@@ -113,6 +115,9 @@ struct kvm_async_pf {
 	struct mm_struct *mm;
 	gva_t gva;
 	unsigned long addr;
+	/* neighbouring host pages of the same memslot to fault in too */
+	unsigned long prefetch_start;
+	unsigned long prefetch_nr;
 	struct kvm_arch_async_pf arch;
 	struct page *page;
 	bool done;
@@ -125,6 +130,24 @@ int kvm_setup_async_pf(struct kvm_vcpu *vcpu, gva_t gva, gfn_t gfn,
 int kvm_async_pf_wakeup_all(struct kvm_vcpu *vcpu);
 #endif
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+/*
+ * Ring of dirty gfns shared with userspace.  Only the vcpu itself
+ * advances dirty_index; reset_index is advanced by KVM_RESET_DIRTY_RINGS
+ * with slots_lock held.  Both indexes run freely and are masked with
+ * size - 1 on access.
+ */
+struct kvm_dirty_ring {
+	u32 dirty_index;
+	u32 reset_index;
+	u32 size;
+	u32 soft_limit;
+	struct kvm_dirty_gfn *dirty_gfns;
+};
+
+bool kvm_dirty_ring_check_request(struct kvm_vcpu *vcpu);
+#endif
+
 enum {
 	OUTSIDE_GUEST_MODE,
 	IN_GUEST_MODE,
@@ -160,6 +183,7 @@ struct kvm_vcpu {
 	int fpu_active;
 	int guest_fpu_loaded, guest_xcr0_loaded;
 	wait_queue_head_t wq;
+	unsigned int halt_poll_ns;
 	struct pid *pid;
 	int sigset_active;
 	sigset_t sigset;
@@ -183,6 +207,10 @@ struct kvm_vcpu {
 	} async_pf;
 #endif
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	struct kvm_dirty_ring dirty_ring;
+#endif
+
 	struct kvm_vcpu_arch arch;
 };
 
@@ -294,6 +322,9 @@ struct kvm {
 	spinlock_t ring_lock;
 	struct list_head coalesced_zones;
 #endif
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	u32 dirty_ring_size;	/* per vcpu, in bytes */
+#endif
 
 	struct mutex irq_lock;
 #ifdef CONFIG_HAVE_KVM_IRQCHIP
@@ -476,6 +507,7 @@ void kvm_put_guest_fpu(struct kvm_vcpu *vcpu);
 
 void kvm_flush_remote_tlbs(struct kvm *kvm);
 void kvm_reload_remote_mmus(struct kvm *kvm);
+void kvm_make_scan_ioapic_request(struct kvm *kvm);
 
 long kvm_arch_dev_ioctl(struct file *filp,
 			unsigned int ioctl, unsigned long arg);
@@ -489,6 +521,12 @@ int kvm_get_dirty_log(struct kvm *kvm,
 			struct kvm_dirty_log *log, int *is_dirty);
 int kvm_vm_ioctl_get_dirty_log(struct kvm *kvm,
 				struct kvm_dirty_log *log);
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+void kvm_arch_mmu_enable_log_dirty_pt_masked(struct kvm *kvm,
+					     struct kvm_memory_slot *slot,
+					     gfn_t gfn_offset,
+					     unsigned long mask);
+#endif
 
 int kvm_vm_ioctl_set_memory_region(struct kvm *kvm,
 				   struct
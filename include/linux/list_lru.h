@@ -0,0 +1,109 @@
+/*
+ * Generic LRU lists.
+ *
+ * Items are kept on a list per NUMA node, picked from the node the item's
+ * memory lives on, each with its own lock and count. Adding and removing
+ * items from different nodes therefore never contends, and a walk only
+ * ever holds the lock of the node it is walking.
+ */
+#ifndef _LINUX_LIST_LRU_H
+#define _LINUX_LIST_LRU_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+
+/* list_lru_walk_cb has to always return one of those */
+enum lru_status {
+	LRU_REMOVED,		/* item removed from list */
+	LRU_ROTATE,		/* item referenced, give another pass */
+	LRU_SKIP,		/* item cannot be locked, skip */
+	LRU_RETRY,		/* item not freeable, the lru lock was dropped
+				   and retaken: restart the walk */
+};
+
+struct list_lru_node {
+	spinlock_t		lock;
+	struct list_head	list;
+	/* kept as signed so we can catch imbalance bugs */
+	long			nr_items;
+} ____cacheline_aligned_in_smp;
+
+struct list_lru {
+	struct list_lru_node	*node;
+};
+
+int list_lru_init(struct list_lru *lru);
+void list_lru_destroy(struct list_lru *lru);
+
+/**
+ * list_lru_add: add an element to the lru list's tail
+ * @lru: the lru pointer
+ * @item: the item to be added.
+ *
+ * The item is added to the list of the node its memory belongs to. The
+ * caller must serialise against other add/del calls on the same item,
+ * usually with a lock in the object the item is embedded in.
+ *
+ * Return value: true if the list was updated, false otherwise
+ */
+bool list_lru_add(struct list_lru *lru, struct list_head *item);
+
+/**
+ * list_lru_del: delete an element from the lru list
+ * @lru: the lru pointer
+ * @item: the item to be deleted.
+ *
+ * The same serialisation rules as list_lru_add apply.
+ *
+ * Return value: true if the list was updated, false otherwise
+ */
+bool list_lru_del(struct list_lru *lru, struct list_head *item);
+
+/**
+ * list_lru_count_node: return the number of objects in one node of the lru
+ * @lru: the lru pointer.
+ * @nid: the node id to count from.
+ *
+ * The count is read without the lock and is only a hint.
+ */
+unsigned long list_lru_count_node(struct list_lru *lru, int nid);
+unsigned long list_lru_count(struct list_lru *lru);
+
+typedef enum lru_status
+(*list_lru_walk_cb)(struct list_head *item, spinlock_t *lock, void *cb_arg);
+
+/**
+ * list_lru_walk_node: walk one node of the lru, oldest items first
+ * @lru: the lru pointer.
+ * @nid: the node id to scan from.
+ * @isolate: callback function that is resposible for deciding what to do
+ *  with the item currently being scanned
+ * @cb_arg: opaque type that will be passed to @isolate
+ * @nr_to_walk: how many items to scan, decremented as items are scanned.
+ *
+ * @isolate is called with the node lock held. It must not sleep; if it
+ * has to drop the lock it has to retake it before returning LRU_RETRY.
+ * An item @isolate returns LRU_REMOVED for must have been taken off the
+ * list by the callback itself, typically onto a private dispose list.
+ *
+ * Return value: the number of objects effectively removed from the LRU.
+ */
+unsigned long list_lru_walk_node(struct list_lru *lru, int nid,
+				 list_lru_walk_cb isolate, void *cb_arg,
+				 unsigned long *nr_to_walk);
+
+/**
+ * list_lru_walk: walk the lru, spreading @nr_to_walk over the nodes
+ * @lru: the lru pointer.
+ * @isolate: see list_lru_walk_node
+ * @cb_arg: opaque type that will be passed to @isolate
+ * @nr_to_walk: how many items to scan in total.
+ *
+ * Each node is scanned in proportion to its share of the items, so a
+ * large node is not starved by a walk that stops early.
+ */
+unsigned long list_lru_walk(struct list_lru *lru, list_lru_walk_cb isolate,
+			    void *cb_arg, unsigned long nr_to_walk);
+
+#endif /* _LINUX_LIST_LRU_H */
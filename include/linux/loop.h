@@ -18,6 +18,7 @@
 #include <linux/blkdev.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 /* Possible states of device */
 enum {
@@ -27,6 +28,15 @@ enum {
 };
 
 struct loop_func_table;
+struct loop_device;
+
+/* Bios a device in direct mode keeps in flight, one per worker */
+#define LOOP_DIO_WORKERS	8
+
+struct loop_dio_worker {
+	struct work_struct	work;
+	struct loop_device	*lo;
+};
 
 struct loop_device {
 	int		lo_number;
@@ -62,6 +72,12 @@ struct loop_device {
 	struct task_struct	*lo_thread;
 	wait_queue_head_t	lo_event;
 
+	struct file		*lo_dio_file;	/* O_DIRECT open of the backing file */
+	struct bio_list		lo_dio_list;
+	struct workqueue_struct	*lo_dio_wq;
+	struct loop_dio_worker	lo_dio_workers[LOOP_DIO_WORKERS];
+	unsigned		lo_dio_next;
+
 	struct request_queue	*lo_queue;
 	struct gendisk		*lo_disk;
 };
@@ -75,6 +91,7 @@ enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_AUTOCLEAR	= 4,
 	LO_FLAGS_PARTSCAN	= 8,
+	LO_FLAGS_DIRECT_IO	= 16,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
@@ -159,6 +176,7 @@ int loop_unregister_transfer(int number);
 #define LOOP_GET_STATUS64	0x4C05
 #define LOOP_CHANGE_FD		0x4C06
 #define LOOP_SET_CAPACITY	0x4C07
+#define LOOP_SET_DIRECT_IO	0x4C08
 
 /* /dev/loop-control interface */
 #define LOOP_CTL_ADD		0x4C80
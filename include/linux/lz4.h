@@ -0,0 +1,37 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ * LZ4 Kernel Interface
+ *
+ * LZ4 is a byte-oriented LZ77 compressor without entropy coding, which
+ * makes it about as fast as LZO at compression and considerably faster
+ * at decompression.  The format is the LZ4 block format; frames are not
+ * supported.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(u32))
+
+/* Worst case size of the compressed output of @isize bytes */
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS.  *dst_len is the size
+ * of dst on entry; if the compressed data does not fit, -E2BIG is
+ * returned.  A dst of lz4_compressbound(src_len) bytes always suffices.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing.  *dst_len is the size of dst
+ * on entry and the number of bytes decompressed on return.  Returns 0,
+ * or -EINVAL if src is corrupt or does not fit in dst.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * MCS lock: a queued spinlock where each waiter spins on its own node
+ * instead of on the lock word, so a release only touches the cacheline
+ * of the next waiter.
+ *
+ * The lock itself is just a pointer to the tail of the queue; nodes are
+ * provided by the caller, usually on its stack. Used to serialize the
+ * optimistic spinners of mutexes and rwsems so that only one of them
+ * polls the owner at a time, and as the per-CPU queue node of queued
+ * spinlocks.
+ */
+#ifndef __LINUX_MCS_SPINLOCK_H
+#define __LINUX_MCS_SPINLOCK_H
+
+#include <linux/compiler.h>
+#include <linux/mutex.h>
+#include <asm/processor.h>
+#include <asm/barrier.h>
+#include <asm/cmpxchg.h>
+
+struct mcs_spinlock {
+	struct mcs_spinlock *next;
+	int locked;		/* 1 if lock acquired */
+	int count;		/* nesting count, see kernel/qspinlock.c */
+};
+
+/*
+ * Take the lock, spinning on @node until the previous holder hands it
+ * over. Cannot be interrupted; callers keep the critical section short.
+ */
+static inline
+void mcs_spin_lock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *prev;
+
+	node->locked = 0;
+	node->next = NULL;
+
+	prev = xchg(lock, node);
+	if (likely(prev == NULL)) {
+		/* Lock acquired, no need to set node->locked */
+		return;
+	}
+	ACCESS_ONCE(prev->next) = node;
+
+	/* Wait until the lock holder passes the lock down */
+	while (!ACCESS_ONCE(node->locked))
+		arch_mutex_cpu_relax();
+	smp_rmb();
+}
+
+static inline
+void mcs_spin_unlock(struct mcs_spinlock **lock, struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = ACCESS_ONCE(node->next);
+
+	if (likely(!next)) {
+		/* Release the lock by setting it to NULL */
+		if (likely(cmpxchg(lock, node, NULL) == node))
+			return;
+		/* Wait until the next pointer is set */
+		while (!(next = ACCESS_ONCE(node->next)))
+			arch_mutex_cpu_relax();
+	}
+	/* Pass the lock to the next waiter */
+	smp_mb();
+	ACCESS_ONCE(next->locked) = 1;
+}
+
+#endif /* __LINUX_MCS_SPINLOCK_H */
@@ -182,6 +182,20 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						unsigned long *total_scanned);
 
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx);
+
+/*
+ * Bracket a section in which the current task is stalled on memory
+ * (reclaim, swap-in, refaults, memcg oom), to be accounted as memory
+ * pressure of its memcg.  The start value must be passed to
+ * mem_cgroup_stall_end().
+ */
+static inline u64 mem_cgroup_stall_start(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+	return local_clock();
+}
+void mem_cgroup_stall_end(u64 start);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 void mem_cgroup_split_huge_fixup(struct page *head);
 #endif
@@ -370,6 +384,15 @@ static inline
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 }
+
+static inline u64 mem_cgroup_stall_start(void)
+{
+	return 0;
+}
+
+static inline void mem_cgroup_stall_end(u64 start)
+{
+}
 static inline void mem_cgroup_replace_page_cache(struct page *oldpage,
 				struct page *newpage)
 {
@@ -207,6 +207,11 @@ struct vm_operations_struct {
 	void (*close)(struct vm_area_struct * area);
 	int (*fault)(struct vm_area_struct *vma, struct vm_fault *vmf);
 
+	/* map a whole huge page at a none pmd, or return VM_FAULT_FALLBACK
+	 * to have the address faulted in with ->fault instead */
+	int (*pmd_fault)(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd, unsigned int flags);
+
 	/* notification that a previously read-only page is about to become
 	 * writable, if an error is returned it will cause a SIGBUS */
 	int (*page_mkwrite)(struct vm_area_struct *vma, struct vm_fault *vmf);
@@ -872,6 +877,7 @@ static inline int page_mapped(struct page *page)
 #define VM_FAULT_NOPAGE	0x0100	/* ->fault installed the pte, not return page */
 #define VM_FAULT_LOCKED	0x0200	/* ->fault locked the returned page */
 #define VM_FAULT_RETRY	0x0400	/* ->fault blocked, must retry */
+#define VM_FAULT_FALLBACK 0x0800	/* ->pmd_fault wants small pages instead */
 
 #define VM_FAULT_HWPOISON_LARGE_MASK 0xf000 /* encodes hpage index for large hwpoison */
 
@@ -1033,6 +1039,7 @@ int __set_page_dirty_no_writeback(struct page *page);
 int redirty_page_for_writepage(struct writeback_control *wbc,
 				struct page *page);
 void account_page_dirtied(struct page *page, struct address_space *mapping);
+bool tag_page_dirty(struct page *page, struct address_space *mapping);
 void account_page_writeback(struct page *page);
 int set_page_dirty(struct page *page);
 int set_page_dirty_lock(struct page *page);
@@ -1075,10 +1082,18 @@ extern unsigned long move_page_tables(struct vm_area_struct *vma,
 extern unsigned long do_mremap(unsigned long addr,
 			       unsigned long old_len, unsigned long new_len,
 			       unsigned long flags, unsigned long new_addr);
+extern unsigned long change_protection(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end,
+			pgprot_t newprot, int dirty_accountable, int prot_numa);
 extern int mprotect_fixup(struct vm_area_struct *vma,
 			  struct vm_area_struct **pprev, unsigned long start,
 			  unsigned long end, unsigned long newflags);
 
+#ifdef CONFIG_NUMA_BALANCING
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end);
+#endif
+
 /*
  * doesn't attempt to fault and will return short.
  */
@@ -1240,6 +1255,50 @@ static inline pmd_t *pmd_alloc(struct mm_struct *mm, pud_t *pud, unsigned long a
 #define pte_lockptr(mm, pmd)	({(void)(pmd); &(mm)->page_table_lock;})
 #endif /* USE_SPLIT_PTLOCKS */
 
+#if USE_SPLIT_PTLOCKS && defined(CONFIG_MMU)
+/*
+ * fork shares the pte tables of private anonymous memory between parent
+ * and child, with a reference on the table page held by each mm using it.
+ * Anything changing the entries of a shared table must unshare it first.
+ */
+static inline bool pte_table_shared(pmd_t *pmd)
+{
+	return page_count(pmd_page(*pmd)) > 1;
+}
+
+extern int unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+			     pmd_t *pmd, unsigned long address);
+extern void unshare_pte_table_nofail(struct mm_struct *mm,
+			struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address);
+extern int unshare_pte_table_address(struct vm_area_struct *vma,
+				     unsigned long address);
+#else
+static inline bool pte_table_shared(pmd_t *pmd)
+{
+	return false;
+}
+
+static inline int unshare_pte_table(struct mm_struct *mm,
+			struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address)
+{
+	return 0;
+}
+
+static inline void unshare_pte_table_nofail(struct mm_struct *mm,
+			struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address)
+{
+}
+
+static inline int unshare_pte_table_address(struct vm_area_struct *vma,
+					    unsigned long address)
+{
+	return 0;
+}
+#endif
+
 static inline void pgtable_page_ctor(struct page *page)
 {
 	pte_lock_init(page);
@@ -1454,6 +1513,11 @@ void task_dirty_inc(struct task_struct *tsk);
 int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 			pgoff_t offset, unsigned long nr_to_read);
 
+struct async_readahead;
+void async_readahead(struct async_readahead **rap, struct file *filp,
+		     pgoff_t offset, unsigned long nr_to_read);
+void async_readahead_submit(struct async_readahead *ra);
+
 void page_cache_sync_readahead(struct address_space *mapping,
 			       struct file_ra_state *ra,
 			       struct file *filp,
@@ -1526,6 +1590,15 @@ static inline pgprot_t vm_get_page_prot(unsigned long vm_flags)
 }
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+/* the protection NUMA hinting puts on the ptes of @vma */
+static inline pgprot_t vma_prot_none(struct vm_area_struct *vma)
+{
+	return vm_get_page_prot(vma->vm_flags &
+				~(VM_READ | VM_WRITE | VM_EXEC));
+}
+#endif
+
 struct vm_area_struct *find_extend_vma(struct mm_struct *, unsigned long addr);
 int remap_pfn_range(struct vm_area_struct *, unsigned long addr,
 			unsigned long pfn, unsigned long size, pgprot_t);
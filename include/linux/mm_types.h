@@ -22,6 +22,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct futex_hash_bucket;
 
 #define USE_SPLIT_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
 
@@ -279,6 +280,9 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SWAP
+	atomic_long_t swap_readahead_info; /* last fault, window, hits */
+#endif
 };
 
 struct core_thread {
@@ -403,6 +407,32 @@ struct mm_struct {
 #endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the next time when the PTEs will be marked
+	 * for NUMA hinting faults, numa_scan_offset is where the scan
+	 * continues and numa_scan_seq counts completed passes.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Reclaim cleared ptes of this mm without flushing the TLB yet,
+	 * see flush_tlb_batched_pending().  Protected by the ptl of the
+	 * ptes that were cleared.
+	 */
+	bool tlb_flush_batched;
+#endif
+#ifdef CONFIG_FUTEX
+	/*
+	 * Private futex hash set up with PR_SET_FUTEX_HASH, NULL if the
+	 * private futexes of this mm hash into the global table.
+	 */
+	struct futex_hash_bucket *futex_hash;
+	unsigned int futex_hash_mask;
 #endif
 	struct uprobes_state uprobes_state;
 };
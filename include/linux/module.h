@@ -265,6 +265,9 @@ struct module
 	const unsigned long *gpl_future_crcs;
 	unsigned int num_gpl_future_syms;
 
+	/* All of the above, hashed by name for find_symbol(). */
+	struct module_symhash *symhash;
+
 	/* Exception table */
 	unsigned int num_exentries;
 	struct exception_table_entry *extable;
@@ -0,0 +1,214 @@
+#ifndef _LINUX_MPMC_RING_H
+#define _LINUX_MPMC_RING_H
+/*
+ * Lock-less multi-producer, multi-consumer ring of pointers
+ *
+ * The ring has a power of two number of slots and free running 32-bit
+ * producer and consumer indices, each a head/tail pair on its own
+ * cacheline.  A producer reserves slots by moving prod.head forward with
+ * cmpxchg, fills them, and then publishes them by moving prod.tail once
+ * every producer that reserved before it has published its slots.
+ * Consumers do the same with cons.head and cons.tail.  Producers and
+ * consumers therefore only ever share the slots and the other side's
+ * tail, and a whole batch of pointers costs one cmpxchg.
+ *
+ * The _sp and _sc variants skip the cmpxchg for rings that have only a
+ * single producer or consumer, or whose callers serialise themselves.
+ *
+ * A producer (consumer) waits for producers (consumers) that reserved
+ * before it to publish, so the multi-producer (multi-consumer) side of a
+ * ring must not be used from a context that can interrupt another user
+ * of the same side: pick one of process, softirq or hardirq context, or
+ * disable interrupts around it.  Preemption is disabled internally.
+ *
+ * NULL cannot be queued, mpmc_ring_dequeue() uses it to report an empty
+ * ring.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/preempt.h>
+#include <linux/types.h>
+#include <asm/cmpxchg.h>
+#include <asm/processor.h>
+
+struct mpmc_ring {
+	unsigned int		size;
+	unsigned int		mask;
+	void			**ring;
+
+	struct {
+		unsigned int	head;
+		unsigned int	tail;
+	} prod ____cacheline_aligned_in_smp;
+
+	struct {
+		unsigned int	head;
+		unsigned int	tail;
+	} cons ____cacheline_aligned_in_smp;
+};
+
+int mpmc_ring_init(struct mpmc_ring *r, unsigned int size, gfp_t gfp);
+void mpmc_ring_cleanup(struct mpmc_ring *r, void (*destroy)(void *));
+
+static inline unsigned int __mpmc_ring_enqueue(struct mpmc_ring *r,
+					       void * const *objs,
+					       unsigned int n, bool single)
+{
+	unsigned int head, next, free, i;
+
+	preempt_disable();
+	do {
+		head = ACCESS_ONCE(r->prod.head);
+		/* Read cons.tail after prod.head, see __mpmc_ring_dequeue */
+		smp_rmb();
+		free = r->size - (head - ACCESS_ONCE(r->cons.tail));
+		n = min(n, free);
+		if (!n)
+			goto out;
+		next = head + n;
+		if (single) {
+			r->prod.head = next;
+			/* Order the cons.tail read before filling the slots */
+			smp_mb();
+			break;
+		}
+	} while (cmpxchg(&r->prod.head, head, next) != head);
+
+	for (i = 0; i < n; i++)
+		r->ring[(head + i) & r->mask] = objs[i];
+
+	/* Slots before prod.tail, pairs with smp_rmb() in dequeue */
+	smp_wmb();
+
+	/* Publish in reservation order */
+	while (ACCESS_ONCE(r->prod.tail) != head)
+		cpu_relax();
+	ACCESS_ONCE(r->prod.tail) = next;
+out:
+	preempt_enable();
+	return n;
+}
+
+static inline unsigned int __mpmc_ring_dequeue(struct mpmc_ring *r,
+					       void **objs,
+					       unsigned int n, bool single)
+{
+	unsigned int head, next, avail, i;
+
+	preempt_disable();
+	do {
+		head = ACCESS_ONCE(r->cons.head);
+		/*
+		 * prod.tail only moves forward, read after cons.head it is
+		 * never behind it.
+		 */
+		smp_rmb();
+		avail = ACCESS_ONCE(r->prod.tail) - head;
+		n = min(n, avail);
+		if (!n)
+			goto out;
+		next = head + n;
+		if (single) {
+			r->cons.head = next;
+			break;
+		}
+	} while (cmpxchg(&r->cons.head, head, next) != head);
+
+	/* Slot contents after prod.tail, pairs with smp_wmb() in enqueue */
+	smp_rmb();
+
+	for (i = 0; i < n; i++)
+		objs[i] = r->ring[(head + i) & r->mask];
+
+	/* Done reading the slots before handing them back to producers */
+	smp_mb();
+
+	while (ACCESS_ONCE(r->cons.tail) != head)
+		cpu_relax();
+	ACCESS_ONCE(r->cons.tail) = next;
+out:
+	preempt_enable();
+	return n;
+}
+
+/**
+ * mpmc_ring_enqueue_burst - add up to @n pointers to the ring
+ * @r: the ring
+ * @objs: the pointers to add
+ * @n: number of pointers in @objs
+ *
+ * Returns the number of pointers added, which is less than @n if the
+ * ring filled up.  Safe against concurrent producers.
+ */
+static inline unsigned int mpmc_ring_enqueue_burst(struct mpmc_ring *r,
+						   void * const *objs,
+						   unsigned int n)
+{
+	return __mpmc_ring_enqueue(r, objs, n, false);
+}
+
+/* As mpmc_ring_enqueue_burst(), for a single producer */
+static inline unsigned int mpmc_ring_sp_enqueue_burst(struct mpmc_ring *r,
+						      void * const *objs,
+						      unsigned int n)
+{
+	return __mpmc_ring_enqueue(r, objs, n, true);
+}
+
+/**
+ * mpmc_ring_dequeue_burst - take up to @n pointers off the ring
+ * @r: the ring
+ * @objs: array to store the pointers in
+ * @n: size of @objs
+ *
+ * Returns the number of pointers taken, oldest first.  Safe against
+ * concurrent consumers.
+ */
+static inline unsigned int mpmc_ring_dequeue_burst(struct mpmc_ring *r,
+						   void **objs,
+						   unsigned int n)
+{
+	return __mpmc_ring_dequeue(r, objs, n, false);
+}
+
+/* As mpmc_ring_dequeue_burst(), for a single consumer */
+static inline unsigned int mpmc_ring_sc_dequeue_burst(struct mpmc_ring *r,
+						      void **objs,
+						      unsigned int n)
+{
+	return __mpmc_ring_dequeue(r, objs, n, true);
+}
+
+/* Returns 0 on success or -ENOBUFS if the ring is full */
+static inline int mpmc_ring_enqueue(struct mpmc_ring *r, void *obj)
+{
+	return mpmc_ring_enqueue_burst(r, &obj, 1) ? 0 : -ENOBUFS;
+}
+
+/* Returns the oldest pointer, or NULL if the ring is empty */
+static inline void *mpmc_ring_dequeue(struct mpmc_ring *r)
+{
+	void *obj;
+
+	return mpmc_ring_dequeue_burst(r, &obj, 1) ? obj : NULL;
+}
+
+/* The following are only a snapshot when the ring is in use */
+static inline unsigned int mpmc_ring_count(const struct mpmc_ring *r)
+{
+	return ACCESS_ONCE(r->prod.tail) - ACCESS_ONCE(r->cons.tail);
+}
+
+static inline bool mpmc_ring_empty(const struct mpmc_ring *r)
+{
+	return mpmc_ring_count(r) == 0;
+}
+
+static inline bool mpmc_ring_full(const struct mpmc_ring *r)
+{
+	return mpmc_ring_count(r) == r->size;
+}
+
+#endif /* _LINUX_MPMC_RING_H */
@@ -37,6 +37,14 @@ struct msgbuf {
 	char mtext[1];      /* message text */
 };
 
+/* one message for msgsndv and msgrcvv */
+struct msgvec {
+	struct msgbuf __user *msgp;	/* message buffer */
+	__kernel_size_t msgsz;		/* size of mtext */
+	long msgtyp;			/* msgrcvv: type, as for msgrcv */
+	__kernel_ssize_t msglen;	/* msgrcvv: bytes received */
+};
+
 /* buffer for msgctl calls IPC_INFO, MSG_INFO */
 struct msginfo {
 	int msgpool;
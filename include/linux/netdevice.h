@@ -59,6 +59,8 @@
 struct netpoll_info;
 struct device;
 struct phy_device;
+struct sk_filter;
+struct sock_fprog;
 /* 802.11 specific */
 struct wireless_dev;
 					/* source back-compat hooks */
@@ -350,6 +352,10 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct hlist_node	napi_hash_node;
+	unsigned int		napi_id;
+#endif
 };
 
 enum {
@@ -672,6 +678,9 @@ struct netdev_rx_queue {
 	struct rps_dev_flow_table __rcu	*rps_flow_table;
 	struct kobject			kobj;
 	struct net_device		*dev;
+	/* RFS statistics, updated from the CPU handling the queue */
+	unsigned long			rps_flows_steered;
+	unsigned long			rps_filters_added;
 } ____cacheline_aligned_in_smp;
 #endif /* CONFIG_RPS */
 
@@ -755,6 +764,9 @@ struct netdev_fcoe_hbainfo {
  *	Must return NETDEV_TX_OK , NETDEV_TX_BUSY.
  *        (can also return NETDEV_TX_LOCKED iff NETIF_F_LLTX)
  *	Required can not be NULL.
+ *	When skb->xmit_more is set another packet for the same queue follows
+ *	right away and the driver may skip the doorbell (tail register
+ *	write).  The doorbell must still be rung if the queue gets stopped.
  *
  * u16 (*ndo_select_queue)(struct net_device *dev, struct sk_buff *skb);
  *	Called to decide which queue to when device supports multiple
@@ -820,6 +832,13 @@ struct netdev_fcoe_hbainfo {
  *
  * void (*ndo_poll_controller)(struct net_device *dev);
  *
+ * int (*ndo_busy_poll)(struct napi_struct *napi);
+ *	Busy poll the receive queue of napi from process context, on behalf
+ *	of a socket waiting for data. Must not run concurrently with the
+ *	regular NAPI poll of the same queue. Returns the number of packets
+ *	delivered, 0 if the queue is empty, or LL_FLUSH_BUSY if the queue
+ *	is currently owned by NAPI or LL_FLUSH_FAILED if it is disabled.
+ *
  *	SR-IOV management functions.
  * int (*ndo_set_vf_mac)(struct net_device *dev, int vf, u8* mac);
  * int (*ndo_set_vf_vlan)(struct net_device *dev, int vf, u16 vlan, u8 qos);
@@ -956,6 +975,9 @@ struct net_device_ops {
 						     struct netpoll_info *info,
 						     gfp_t gfp);
 	void			(*ndo_netpoll_cleanup)(struct net_device *dev);
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	int			(*ndo_busy_poll)(struct napi_struct *napi);
 #endif
 	int			(*ndo_set_vf_mac)(struct net_device *dev,
 						  int queue, u8 *mac);
@@ -1081,6 +1103,8 @@ struct net_device {
 	netdev_features_t	wanted_features;
 	/* mask of features inheritable by VLAN devices */
 	netdev_features_t	vlan_features;
+	/* mask of features usable for encapsulated (tunnel) packets */
+	netdev_features_t	hw_enc_features;
 
 	/* Interface index. Unique device identifier	*/
 	int			ifindex;
@@ -1208,6 +1232,9 @@ struct net_device {
 	rx_handler_func_t __rcu	*rx_handler;
 	void __rcu		*rx_handler_data;
 
+	/* filter run by IFF_RX_FILTER drivers before building an skb */
+	struct sk_filter __rcu	*rx_filter;
+
 	struct netdev_queue __rcu *ingress_queue;
 
 /*
@@ -1482,6 +1509,20 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
  */
 void netif_napi_del(struct napi_struct *napi);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+struct napi_struct *napi_by_id(unsigned int napi_id);
+void napi_hash_add(struct napi_struct *napi);
+void napi_hash_del(struct napi_struct *napi);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif
+
 struct napi_gro_cb {
 	/* Virtual address of skb_shinfo(skb)->frags[0].page + offset. */
 	void *frag0;
@@ -1521,7 +1562,8 @@ struct packet_type {
 	int			(*gso_send_check)(struct sk_buff *skb);
 	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
 					       struct sk_buff *skb);
-	int			(*gro_complete)(struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb,
+						int nhoff);
 	bool			(*id_match)(struct packet_type *ptype,
 					    struct sock *sk);
 	void			*af_packet_priv;
@@ -2149,6 +2191,8 @@ extern int		netif_rx_ni(struct sk_buff *skb);
 extern int		netif_receive_skb(struct sk_buff *skb);
 extern gro_result_t	dev_gro_receive(struct napi_struct *napi,
 					struct sk_buff *skb);
+extern struct packet_type *gro_find_receive_by_type(__be16 type);
+extern struct packet_type *gro_find_complete_by_type(__be16 type);
 extern gro_result_t	napi_skb_finish(gro_result_t ret, struct sk_buff *skb);
 extern gro_result_t	napi_gro_receive(struct napi_struct *napi,
 					 struct sk_buff *skb);
@@ -2183,6 +2227,28 @@ extern int		dev_change_net_namespace(struct net_device *,
 						 struct net *, const char *);
 extern int		dev_set_mtu(struct net_device *, int);
 extern void		dev_set_group(struct net_device *, int);
+extern int		dev_set_rx_filter(struct net_device *dev,
+					  struct sock_fprog *fprog);
+extern bool		__netdev_rx_filter_drop(struct net_device *dev,
+						void *data, unsigned int len);
+
+/**
+ *	netdev_rx_filter_drop - run the early receive filter on a raw frame
+ *	@dev: device the frame was received on
+ *	@data: start of the ethernet header
+ *	@len: length of the frame
+ *
+ *	For drivers that set IFF_RX_FILTER.  Called from the NAPI poll
+ *	routine before an skb is built for a single buffer frame, returns
+ *	true if the frame should be recycled instead of passed up.
+ */
+static inline bool netdev_rx_filter_drop(struct net_device *dev,
+					 void *data, unsigned int len)
+{
+	if (likely(!rcu_access_pointer(dev->rx_filter)))
+		return false;
+	return __netdev_rx_filter_drop(dev, data, len);
+}
 extern int		dev_set_mac_address(struct net_device *,
 					    struct sockaddr *);
 extern int		dev_hard_start_xmit(struct sk_buff *skb,
@@ -2620,6 +2686,8 @@ extern int netdev_set_bond_master(struct net_device *dev,
 extern int skb_checksum_help(struct sk_buff *skb);
 extern struct sk_buff *skb_gso_segment(struct sk_buff *skb,
 	netdev_features_t features);
+extern struct sk_buff *skb_mac_gso_segment(struct sk_buff *skb,
+	netdev_features_t features);
 #ifdef CONFIG_BUG
 extern void netdev_rx_csum_fault(struct net_device *dev);
 #else
@@ -2673,6 +2741,8 @@ static inline bool net_gso_ok(netdev_features_t features, int gso_type)
 	BUILD_BUG_ON(SKB_GSO_TCP_ECN != (NETIF_F_TSO_ECN >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_TCPV6   != (NETIF_F_TSO6 >> NETIF_F_GSO_SHIFT));
 	BUILD_BUG_ON(SKB_GSO_FCOE    != (NETIF_F_FSO >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_GRE     != (NETIF_F_GSO_GRE >> NETIF_F_GSO_SHIFT));
+	BUILD_BUG_ON(SKB_GSO_IPIP    != (NETIF_F_GSO_IPIP >> NETIF_F_GSO_SHIFT));
 
 	return (features & feature) == feature;
 }
@@ -181,6 +181,7 @@ struct nfs_inode {
 
 	unsigned long		npages;
 	struct nfs_mds_commit_info commit_info;
+	struct list_head	sync_list;	/* on server->sync_inodes */
 
 	/* Open contexts for shared mmap writes */
 	struct list_head	open_files;
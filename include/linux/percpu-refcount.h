@@ -0,0 +1,176 @@
+#ifndef _LINUX_PERCPU_REFCOUNT_H
+#define _LINUX_PERCPU_REFCOUNT_H
+/*
+ * Percpu reference counts
+ *
+ * A percpu_ref starts out counting in per-cpu counters, so that gets and
+ * puts on the hot path are a this_cpu_inc()/this_cpu_dec() and never
+ * bounce a cacheline between CPUs.  The catch is that nobody can tell
+ * when the count reaches zero.  Hence the owner of the object calls
+ * percpu_ref_kill() once it starts tearing the object down: that drops
+ * the initial reference and, after an RCU-sched grace period, folds the
+ * per-cpu counters into a single atomic_t.  From then on the ref behaves
+ * like an ordinary atomic refcount and ->release() is called when the
+ * last reference goes away.
+ *
+ * percpu_ref_tryget_live() fails once percpu_ref_kill() has been called,
+ * which is what lookups of objects that are going away want.
+ */
+
+#include <linux/atomic.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+
+struct percpu_ref;
+typedef void (percpu_ref_func_t)(struct percpu_ref *);
+
+struct percpu_ref {
+	atomic_t		count;
+	/*
+	 * The low bit of the pointer says whether the ref is dead, i.e.
+	 * counting in @count.
+	 */
+	unsigned long		pcpu_count_ptr;
+	percpu_ref_func_t	*release;
+	struct rcu_head		rcu;
+};
+
+int __must_check percpu_ref_init(struct percpu_ref *ref,
+				 percpu_ref_func_t *release);
+void percpu_ref_exit(struct percpu_ref *ref);
+void percpu_ref_kill(struct percpu_ref *ref);
+
+#define PCPU_REF_DEAD		1
+
+/*
+ * Returns true and the per-cpu counters if @ref is still in per-cpu
+ * mode.  Must be called under rcu_read_lock_sched(), percpu_ref_kill()
+ * waits for a grace period before it reads the counters.
+ */
+static inline bool __pcpu_ref_alive(struct percpu_ref *ref,
+				    unsigned __percpu **pcpu_countp)
+{
+	unsigned long pcpu_ptr = ACCESS_ONCE(ref->pcpu_count_ptr);
+
+	if (unlikely(pcpu_ptr & PCPU_REF_DEAD))
+		return false;
+
+	*pcpu_countp = (unsigned __percpu *)pcpu_ptr;
+	return true;
+}
+
+/**
+ * percpu_ref_get - increment a percpu refcount
+ * @ref: percpu_ref to get
+ *
+ * The caller must already hold a reference, or otherwise know that the
+ * count cannot reach zero under it.
+ */
+static inline void percpu_ref_get(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count;
+
+	rcu_read_lock_sched();
+
+	if (__pcpu_ref_alive(ref, &pcpu_count))
+		this_cpu_inc(*pcpu_count);
+	else
+		atomic_inc(&ref->count);
+
+	rcu_read_unlock_sched();
+}
+
+/**
+ * percpu_ref_tryget - try to increment a percpu refcount
+ * @ref: percpu_ref to try-get
+ *
+ * Returns %true on success, %false if the count already reached zero.
+ * Unlike percpu_ref_tryget_live() this succeeds on a killed ref as long
+ * as references to it remain.
+ */
+static inline bool percpu_ref_tryget(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count;
+	bool ret;
+
+	rcu_read_lock_sched();
+
+	if (__pcpu_ref_alive(ref, &pcpu_count)) {
+		this_cpu_inc(*pcpu_count);
+		ret = true;
+	} else {
+		ret = atomic_inc_not_zero(&ref->count);
+	}
+
+	rcu_read_unlock_sched();
+
+	return ret;
+}
+
+/**
+ * percpu_ref_tryget_live - try to increment a live percpu refcount
+ * @ref: percpu_ref to try-get
+ *
+ * Returns %true on success, %false once percpu_ref_kill() has been called
+ * on @ref.  Both the caller of percpu_ref_kill() and callers of this
+ * must be prepared for a tryget that races with the kill to succeed.
+ */
+static inline bool percpu_ref_tryget_live(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count;
+	bool ret = false;
+
+	rcu_read_lock_sched();
+
+	if (__pcpu_ref_alive(ref, &pcpu_count)) {
+		this_cpu_inc(*pcpu_count);
+		ret = true;
+	}
+
+	rcu_read_unlock_sched();
+
+	return ret;
+}
+
+/**
+ * percpu_ref_put - decrement a percpu refcount
+ * @ref: percpu_ref to put
+ *
+ * Calls @ref->release if the count reaches zero, which can only happen
+ * after percpu_ref_kill().  May be called from any context.
+ */
+static inline void percpu_ref_put(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count;
+
+	rcu_read_lock_sched();
+
+	if (__pcpu_ref_alive(ref, &pcpu_count))
+		this_cpu_dec(*pcpu_count);
+	else if (unlikely(atomic_dec_and_test(&ref->count)))
+		ref->release(ref);
+
+	rcu_read_unlock_sched();
+}
+
+/**
+ * percpu_ref_is_zero - test whether a percpu refcount reached zero
+ * @ref: percpu_ref to test
+ *
+ * Only ever true after percpu_ref_kill() has done its switch to atomic
+ * counting and all references have been put.
+ */
+static inline bool percpu_ref_is_zero(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count;
+	bool ret;
+
+	rcu_read_lock_sched();
+	ret = !__pcpu_ref_alive(ref, &pcpu_count) && !atomic_read(&ref->count);
+	rcu_read_unlock_sched();
+
+	return ret;
+}
+
+#endif /* _LINUX_PERCPU_REFCOUNT_H */
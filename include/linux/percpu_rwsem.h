@@ -0,0 +1,62 @@
+#ifndef _LINUX_PERCPU_RWSEM_H
+#define _LINUX_PERCPU_RWSEM_H
+
+/*
+ * Reader-biased read-write semaphore.
+ *
+ * Readers only bump a per-CPU counter, so taking the lock for read costs
+ * no atomic operation and no shared cacheline. A writer first forces
+ * every reader onto a slow path that goes through an ordinary rwsem,
+ * waits for an RCU-sched grace period so that no reader is still on the
+ * fast path, and then waits for the readers it found to drain. Writing
+ * is therefore very expensive; use it only for state that is read on
+ * hot paths and written almost never.
+ *
+ * Readers must not nest: a nested reader blocks behind a pending writer
+ * that waits for the outer one.
+ */
+
+#include <linux/atomic.h>
+#include <linux/rwsem.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+
+struct percpu_rw_semaphore {
+	unsigned int __percpu	*fast_read_ctr;
+	atomic_t		write_ctr;
+	struct rw_semaphore	rw_sem;
+	atomic_t		slow_read_ctr;
+	wait_queue_head_t	write_waitq;
+};
+
+/*
+ * Statically allocated semaphore, usable before the per-cpu allocator is
+ * up.
+ */
+#define DEFINE_STATIC_PERCPU_RWSEM(name)				\
+static DEFINE_PER_CPU(unsigned int, __percpu_rwsem_frc_##name);	\
+static struct percpu_rw_semaphore name = {				\
+	.fast_read_ctr	= &__percpu_rwsem_frc_##name,			\
+	.write_ctr	= ATOMIC_INIT(0),				\
+	.rw_sem		= __RWSEM_INITIALIZER(name.rw_sem),		\
+	.slow_read_ctr	= ATOMIC_INIT(0),				\
+	.write_waitq	= __WAIT_QUEUE_HEAD_INITIALIZER(name.write_waitq), \
+}
+
+extern void percpu_down_read(struct percpu_rw_semaphore *);
+extern void percpu_up_read(struct percpu_rw_semaphore *);
+
+extern void percpu_down_write(struct percpu_rw_semaphore *);
+extern void percpu_up_write(struct percpu_rw_semaphore *);
+
+extern int __percpu_init_rwsem(struct percpu_rw_semaphore *,
+				const char *, struct lock_class_key *);
+extern void percpu_free_rwsem(struct percpu_rw_semaphore *);
+
+#define percpu_init_rwsem(brw)					\
+({								\
+	static struct lock_class_key rwsem_key;			\
+	__percpu_init_rwsem(brw, #brw, &rwsem_key);		\
+})
+
+#endif /* _LINUX_PERCPU_RWSEM_H */
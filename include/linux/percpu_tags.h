@@ -0,0 +1,65 @@
+#ifndef _LINUX_PERCPU_TAGS_H
+#define _LINUX_PERCPU_TAGS_H
+/*
+ * Scalable allocator for small integer tags, such as the command slots
+ * of a host adapter or the tags of a block queue.
+ *
+ * Freed tags are kept in a small per-cpu cache and handed out again on
+ * the same CPU.  Behind the caches sits a bitmap that is spread over
+ * cachelines, so CPUs searching it do not bounce one word between them.
+ * Tasks that wait for a tag are distributed over several wait queues,
+ * which are woken in turn, a batch at a time.
+ */
+
+#include <linux/cache.h>
+#include <linux/gfp.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+
+#define PERCPU_TAGS_CACHE_SIZE	16
+#define PERCPU_TAGS_WAIT_QUEUES	8
+
+struct percpu_tags_word {
+	unsigned long		word;
+} ____cacheline_aligned_in_smp;
+
+struct percpu_tags_cpu {
+	spinlock_t		lock;
+	unsigned int		nr_free;
+	unsigned int		hint;	/* map word to search first */
+	unsigned int		freelist[PERCPU_TAGS_CACHE_SIZE];
+} ____cacheline_aligned_in_smp;
+
+struct percpu_tags_wait {
+	wait_queue_head_t	wait;
+	atomic_t		wait_cnt;	/* frees left until a wakeup */
+	atomic_t		nr_waiters;
+} ____cacheline_aligned_in_smp;
+
+struct percpu_tags {
+	unsigned int		nr_tags;	/* size of the map */
+	unsigned int		depth;		/* tags handed out are below */
+	unsigned int		shift;		/* log2 of tags per map word */
+	unsigned int		cache_size;	/* per-cpu cache limit */
+	unsigned int		wake_batch;
+
+	struct percpu_tags_word	*map;
+	struct percpu_tags_cpu	*cpu_cache;	/* indexed by CPU */
+
+	atomic_t		wait_index;
+	atomic_t		wake_index;
+	struct percpu_tags_wait	ws[PERCPU_TAGS_WAIT_QUEUES];
+};
+
+int percpu_tags_init(struct percpu_tags *pt, unsigned int nr_tags, gfp_t gfp,
+		     int node);
+void percpu_tags_destroy(struct percpu_tags *pt);
+int percpu_tags_alloc(struct percpu_tags *pt, gfp_t gfp);
+void percpu_tags_free(struct percpu_tags *pt, unsigned int tag);
+int percpu_tags_claim(struct percpu_tags *pt, unsigned int tag);
+void percpu_tags_resize(struct percpu_tags *pt, unsigned int depth);
+unsigned int percpu_tags_nr_busy(struct percpu_tags *pt);
+
+#endif /* _LINUX_PERCPU_TAGS_H */
@@ -2,6 +2,8 @@
 #define _LINUX_PIPE_FS_I_H
 
 #define PIPE_DEF_BUFFERS	16
+#define PIPE_TMP_PAGES		4	/* released pages kept for reuse */
+#define PIPE_AUTOGROW_BUFFERS	64	/* limit of automatic growth */
 
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
@@ -31,7 +33,9 @@ struct pipe_buffer {
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@tmp_page: cached released pages
+ *	@nr_full: times writers found the pipe full since it last grew
+ *	@fixed_size: size was set with F_SETPIPE_SZ, don't grow automatically
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@waiting_writers: number of writers blocked waiting for room
@@ -50,7 +54,9 @@ struct pipe_inode_info {
 	unsigned int waiting_writers;
 	unsigned int r_counter;
 	unsigned int w_counter;
-	struct page *tmp_page;
+	struct page *tmp_page[PIPE_TMP_PAGES];
+	unsigned int nr_full;
+	bool fixed_size;
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct inode *inode;
@@ -122,6 +122,10 @@ void run_posix_cpu_timers(struct task_struct *task);
 void posix_cpu_timers_exit(struct task_struct *task);
 void posix_cpu_timers_exit_group(struct task_struct *task);
 
+#ifdef CONFIG_NO_HZ_FULL
+bool posix_cpu_timers_can_stop_tick(struct task_struct *tsk);
+#endif
+
 void set_process_cpu_timer(struct task_struct *task, unsigned int clock_idx,
 			   cputime_t *newval, cputime_t *oldval);
 
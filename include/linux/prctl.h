@@ -149,4 +149,13 @@
 
 #define PR_GET_TID_ADDRESS	40
 
+/*
+ * Give the private futexes of this process a hash table of their own,
+ * with at least arg2 buckets, instead of the system wide one. Only
+ * allowed once, while the process is still single threaded.
+ * PR_GET_FUTEX_HASH returns the number of buckets, 0 for the global table.
+ */
+#define PR_SET_FUTEX_HASH	41
+#define PR_GET_FUTEX_HASH	42
+
 #endif /* _LINUX_PRCTL_H */
@@ -37,6 +37,10 @@
  * time callers need worry about this is when doing a lookup_slot under
  * RCU.
  *
+ * Pointers to child nodes in the slots of other nodes carry the same bit,
+ * so that a slot above the bottom level can hold either a node or an item
+ * (a multi-order entry, see below).
+ *
  * Indirect pointer in fact is also used to tag the last pointer of a node
  * when it is shrunk, before we rcu free the node. See shrink code for
  * details.
@@ -60,6 +64,59 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 
 #define RADIX_TREE_MAX_TAGS 3
 
+#ifdef __KERNEL__
+#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
+#else
+#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
+#endif
+
+#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
+
+/*
+ * A multi-order entry covers 2^order indices, aligned to its size.  It is
+ * stored in the node whose slots cover 2^shift indices each, with shift the
+ * largest multiple of RADIX_TREE_MAP_SHIFT not above order, and takes up
+ * 2^(order - shift) consecutive slots there.  The first holds the item;
+ * the others hold sibling entries: the offset of the first slot shifted
+ * past the exceptional bit, with the indirect bit set.  Sibling entries
+ * are never handed out by lookups or iterators, and any pointer is larger
+ * than they are.
+ */
+static inline int radix_tree_is_sibling(void *ptr)
+{
+	unsigned long val = (unsigned long)ptr;
+
+	return (val & (RADIX_TREE_INDIRECT_PTR | RADIX_TREE_EXCEPTIONAL_ENTRY))
+			== RADIX_TREE_INDIRECT_PTR &&
+		val < (RADIX_TREE_MAP_SIZE << RADIX_TREE_EXCEPTIONAL_SHIFT);
+}
+
+#define RADIX_TREE_TAG_LONGS	\
+	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/*
+ * The bits of ->count below RADIX_TREE_COUNT_SHIFT are the number of slots
+ * in use, the ones above are left to the tree user.  The page cache keeps
+ * the number of shadow entries among the slots there, see mm/workingset.c.
+ */
+#define RADIX_TREE_COUNT_SHIFT	(RADIX_TREE_MAP_SHIFT + 1)
+#define RADIX_TREE_COUNT_MASK	((1UL << RADIX_TREE_COUNT_SHIFT) - 1)
+
+struct radix_tree_node {
+	unsigned int	height;		/* Height from the bottom */
+	unsigned int	count;
+	union {
+		struct radix_tree_node *parent;	/* Used when ascending tree */
+		struct rcu_head	rcu_head;	/* Used when freeing node */
+	};
+	/* For tree user */
+	struct list_head private_list;
+	void		*private_data;
+	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
+	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
+};
+
 /* root tags are stored in gfp_mask, shifted by __GFP_BITS_SHIFT */
 struct radix_tree_root {
 	unsigned int		height;
@@ -132,6 +189,14 @@ do {									\
  * excluded from concurrency.
  *
  * radix_tree_tagged is able to be called without locking or RCU.
+ *
+ * radix_tree_tag_set_leaf and radix_tree_tag_clear_leaf only ever touch
+ * the tags of the leaf node holding the item, never those of the nodes
+ * above it or of the root.  They take the RCU read lock themselves and
+ * need to be serialized only against the other modifications of that tag
+ * in the same leaf node and against the deletion of the item: a lock that
+ * covers just the index range of the leaf will do, as long as everybody
+ * else changing that tag in the range takes it as well.
  */
 
 /**
@@ -217,8 +282,15 @@ static inline void radix_tree_replace_slot(void **pslot, void *item)
 }
 
 int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+int radix_tree_insert_order(struct radix_tree_root *, unsigned long,
+			unsigned int, void *);
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp);
 void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
 void **radix_tree_lookup_slot(struct radix_tree_root *, unsigned long);
+bool __radix_tree_delete_node(struct radix_tree_root *root,
+			      struct radix_tree_node *node);
+void *radix_tree_delete_item(struct radix_tree_root *, unsigned long, void *);
 void *radix_tree_delete(struct radix_tree_root *, unsigned long);
 unsigned int
 radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
@@ -238,6 +310,10 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 			unsigned long index, unsigned int tag);
 int radix_tree_tag_get(struct radix_tree_root *root,
 			unsigned long index, unsigned int tag);
+bool radix_tree_tag_set_leaf(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag);
+bool radix_tree_tag_clear_leaf(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag);
 unsigned int
 radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
 		unsigned long first_index, unsigned int max_items,
@@ -264,6 +340,7 @@ static inline void radix_tree_preload_end(void)
  * @index:	index of current slot
  * @next_index:	next-to-last index for this chunk
  * @tags:	bit-mask for tag-iterating
+ * @shift:	log2 of the number of indices each slot of the chunk covers
  *
  * This radix tree iterator works in terms of "chunks" of slots.  A chunk is a
  * subinterval of slots contained within one radix tree leaf node.  It is
@@ -271,11 +348,16 @@ static inline void radix_tree_preload_end(void)
  * which holds the chunk's position in the tree and its size.  For tagged
  * iteration radix_tree_iter also holds the slots' bit-mask for one chosen
  * radix tree tag.
+ *
+ * A multi-order entry stored above the leaves makes up a chunk on its own,
+ * which then ends at the end of the entry.  Its @index is the first index
+ * of the entry, even if the iteration started in the middle of it.
  */
 struct radix_tree_iter {
 	unsigned long	index;
 	unsigned long	next_index;
 	unsigned long	tags;
+	unsigned int	shift;
 };
 
 #define RADIX_TREE_ITER_TAG_MASK	0x00FF	/* tag index in lower byte */
@@ -330,7 +412,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 static __always_inline unsigned
 radix_tree_chunk_size(struct radix_tree_iter *iter)
 {
-	return iter->next_index - iter->index;
+	return (iter->next_index - iter->index) >> iter->shift;
 }
 
 /**
@@ -366,8 +448,11 @@ radix_tree_next_slot(void **slot, struct radix_tree_iter *iter, unsigned flags)
 		while (size--) {
 			slot++;
 			iter->index++;
-			if (likely(*slot))
-				return slot;
+			if (likely(*slot)) {
+				if (!radix_tree_is_sibling(*slot))
+					return slot;
+				continue;
+			}
 			if (flags & RADIX_TREE_ITER_CONTIG) {
 				/* forbid switching to the next chunk */
 				iter->next_index = 0;
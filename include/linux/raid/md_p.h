@@ -82,6 +82,7 @@
 				   * read requests will only be sent here in
 				   * dire need
 				   */
+#define	MD_DISK_JOURNAL		18 /* disk is used as the write journal in RAID-5/6 */
 
 typedef struct mdp_device_descriptor_s {
 	__u32 number;		/* 0 Device number in the entire set	      */
@@ -242,7 +243,10 @@ struct mdp_superblock_1 {
 	__le64	data_offset;	/* sector start of data, often 0 */
 	__le64	data_size;	/* sectors in this device that can be used for data */
 	__le64	super_offset;	/* sector start of this superblock */
-	__le64	recovery_offset;/* sectors before this offset (from data_offset) have been recovered */
+	union {
+		__le64	recovery_offset;/* sectors before this offset (from data_offset) have been recovered */
+		__le64	journal_tail;/* journal tail of journal device (from data_offset) */
+	};
 	__le32	dev_number;	/* permanent identifier of this  device - not role in raid */
 	__le32	cnt_corrected_read; /* number of read errors that were corrected by re-writing */
 	__u8	device_uuid[16]; /* user-space setable, ignored by kernel */
@@ -270,7 +274,8 @@ struct mdp_superblock_1 {
 	 * into the 'roles' value.  If a device is spare or faulty, then it doesn't
 	 * have a meaningful role.
 	 */
-	__le16	dev_roles[0];	/* role in array, or 0xffff for a spare, or 0xfffe for faulty */
+	__le16	dev_roles[0];	/* role in array, or 0xffff for a spare, or 0xfffe for faulty,
+				 * or 0xfffd for the journal */
 };
 
 /* feature_map bits */
@@ -289,6 +294,9 @@ struct mdp_superblock_1 {
 					    * backwards anyway.
 					    */
 #define	MD_FEATURE_NEW_OFFSET		64 /* new_offset must be honoured */
+#define	MD_FEATURE_JOURNAL		512 /* a raid4/5/6 write journal
+					     * device is present
+					     */
 #define	MD_FEATURE_ALL			(MD_FEATURE_BITMAP_OFFSET	\
 					|MD_FEATURE_RECOVERY_OFFSET	\
 					|MD_FEATURE_RESHAPE_ACTIVE	\
@@ -296,6 +304,46 @@ struct mdp_superblock_1 {
 					|MD_FEATURE_REPLACEMENT		\
 					|MD_FEATURE_RESHAPE_BACKWARDS	\
 					|MD_FEATURE_NEW_OFFSET		\
+					|MD_FEATURE_JOURNAL		\
 					)
 
+/*
+ * Write journal format.
+ *
+ * The journal device is a ring of 4K blocks starting at its data_offset.
+ * Every write to the journal starts with one meta block that describes
+ * the blocks following it; each payload is one 4K block of a stripe
+ * that is about to be written to the member device 'disk' at sector
+ * 'location' (relative to that device's data_offset).  A meta block is
+ * valid if its checksum matches, its position is where it was read from,
+ * and its seq follows that of the meta block before it.  The superblock
+ * of the journal device records in 'journal_tail' the first meta block
+ * that recovery has to look at.  Checksums are crc32 seeded with the
+ * crc32 of the array uuid, so blocks of an older array do not match.
+ */
+struct r5l_payload {
+	__le16	type;		/* R5LOG_PAYLOAD_* */
+	__le16	disk;		/* raid disk the block belongs to */
+	__le32	checksum;	/* of the 4K data block */
+	__le64	location;	/* sector on 'disk' */
+} __attribute__ ((__packed__));
+
+#define	R5LOG_PAYLOAD_DATA	0
+#define	R5LOG_PAYLOAD_PARITY	1
+
+struct r5l_meta_block {
+	__le32	magic;
+	__le32	checksum;	/* of the whole 4K block, with this field 0 */
+	__u8	version;
+	__u8	__zero_pad;
+	__le16	__zero_pad2;
+	__le32	meta_size;	/* bytes used in this block */
+	__le64	seq;
+	__le64	position;	/* sector of this block on the journal device */
+	struct r5l_payload payloads[];
+} __attribute__ ((__packed__));
+
+#define	R5LOG_VERSION	0x1
+#define	R5LOG_MAGIC	0x6433c509
+
 #endif 
@@ -33,6 +33,9 @@
 extern void rcu_init(void);
 extern void rcu_note_context_switch(int cpu);
 extern int rcu_needs_cpu(int cpu, unsigned long *delta_jiffies);
+#ifdef CONFIG_NO_HZ_FULL
+extern int rcu_nohz_full_needs_tick(int cpu);
+#endif
 extern void rcu_cpu_stall_reset(void);
 
 /*
@@ -14,6 +14,7 @@
  */
 
 #include <linux/cgroup.h>
+#include <linux/atomic.h>
 
 /*
  * The core object. the cgroup that wishes to account for some
@@ -23,9 +24,10 @@
 
 struct res_counter {
 	/*
-	 * the current resource consumption level
+	 * the current resource consumption level, charged and uncharged
+	 * without taking the lock
 	 */
-	unsigned long long usage;
+	atomic64_t usage;
 	/*
 	 * the maximal value of the usage from the counter creation
 	 */
@@ -43,7 +45,7 @@ struct res_counter {
 	 */
 	unsigned long long failcnt;
 	/*
-	 * the lock to protect all of the above.
+	 * the lock to protect all of the above except usage.
 	 * the routines below consider this to be IRQ-safe
 	 */
 	spinlock_t lock;
@@ -108,15 +110,14 @@ void res_counter_init(struct res_counter *counter, struct res_counter *parent);
  *       units, e.g. numbers, bytes, Kbytes, etc
  *
  * returns 0 on success and <0 if the counter->usage will exceed the
- * counter->limit _locked call expects the counter->lock to be taken
+ * counter->limit.  Racing charges can fail transiently when only one
+ * of them would have pushed the usage over the limit.
  *
  * charge_nofail works the same, except that it charges the resource
  * counter unconditionally, and returns < 0 if the after the current
  * charge we are over limit.
  */
 
-int __must_check res_counter_charge_locked(struct res_counter *counter,
-					   unsigned long val, bool force);
 int __must_check res_counter_charge(struct res_counter *counter,
 		unsigned long val, struct res_counter **limit_fail_at);
 int res_counter_charge_nofail(struct res_counter *counter,
@@ -129,15 +130,19 @@ int res_counter_charge_nofail(struct res_counter *counter,
  * @val: the amount of the resource
  *
  * these calls check for usage underflow and show a warning on the console
- * _locked call expects the counter->lock to be taken
  */
 
-void res_counter_uncharge_locked(struct res_counter *counter, unsigned long val);
 void res_counter_uncharge(struct res_counter *counter, unsigned long val);
 
 void res_counter_uncharge_until(struct res_counter *counter,
 				struct res_counter *top,
 				unsigned long val);
+
+static inline unsigned long long res_counter_usage(struct res_counter *cnt)
+{
+	return atomic64_read(&cnt->usage);
+}
+
 /**
  * res_counter_margin - calculate chargeable space of a counter
  * @cnt: the counter
@@ -147,12 +152,12 @@ void res_counter_uncharge_until(struct res_counter *counter,
  */
 static inline unsigned long long res_counter_margin(struct res_counter *cnt)
 {
-	unsigned long long margin;
+	unsigned long long margin, usage = res_counter_usage(cnt);
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	if (cnt->limit > cnt->usage)
-		margin = cnt->limit - cnt->usage;
+	if (cnt->limit > usage)
+		margin = cnt->limit - usage;
 	else
 		margin = 0;
 	spin_unlock_irqrestore(&cnt->lock, flags);
@@ -169,14 +174,14 @@ static inline unsigned long long res_counter_margin(struct res_counter *cnt)
 static inline unsigned long long
 res_counter_soft_limit_excess(struct res_counter *cnt)
 {
-	unsigned long long excess;
+	unsigned long long excess, usage = res_counter_usage(cnt);
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	if (cnt->usage <= cnt->soft_limit)
+	if (usage <= cnt->soft_limit)
 		excess = 0;
 	else
-		excess = cnt->usage - cnt->soft_limit;
+		excess = usage - cnt->soft_limit;
 	spin_unlock_irqrestore(&cnt->lock, flags);
 	return excess;
 }
@@ -186,7 +191,7 @@ static inline void res_counter_reset_max(struct res_counter *cnt)
 	unsigned long flags;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	cnt->max_usage = cnt->usage;
+	cnt->max_usage = res_counter_usage(cnt);
 	spin_unlock_irqrestore(&cnt->lock, flags);
 }
 
@@ -199,16 +204,27 @@ static inline void res_counter_reset_failcnt(struct res_counter *cnt)
 	spin_unlock_irqrestore(&cnt->lock, flags);
 }
 
+/*
+ * Charges add to the usage before they look at the limit, so checking
+ * the usage again after the new limit is visible catches any charge
+ * that still went by the old one.
+ */
 static inline int res_counter_set_limit(struct res_counter *cnt,
 		unsigned long long limit)
 {
+	unsigned long long old;
 	unsigned long flags;
 	int ret = -EBUSY;
 
 	spin_lock_irqsave(&cnt->lock, flags);
-	if (cnt->usage <= limit) {
+	if (res_counter_usage(cnt) <= limit) {
+		old = cnt->limit;
 		cnt->limit = limit;
-		ret = 0;
+		smp_mb();
+		if (res_counter_usage(cnt) <= limit)
+			ret = 0;
+		else
+			cnt->limit = old;
 	}
 	spin_unlock_irqrestore(&cnt->lock, flags);
 	return ret;
@@ -0,0 +1,134 @@
+/*
+ * Resizable, RCU-protected hash tables.
+ *
+ * The table is an array of singly linked chains whose heads carry a bit
+ * lock in their lowest bit, so writers to different buckets never
+ * contend and the lock costs no memory.  Lookups take no lock at all.
+ * The table grows when it becomes 75% full and, if asked for, shrinks
+ * when it drops below 30%; the resize runs from a work item while
+ * lookups, insertions and removals go on.
+ *
+ * During a resize the new table is hung off the old one as its future
+ * table and entries are moved over one bucket at a time, each entry
+ * being linked into the new table before it is unlinked from the old.
+ * Readers that do not find a key in a table continue with its future
+ * table, so no entry is ever missed.
+ *
+ * Entries embed a struct rhash_head and are described to the table by a
+ * struct rhashtable_params: either a fixed size key inside the object,
+ * hashed with jhash() by default, or object hash and compare callbacks.
+ */
+#ifndef _LINUX_RHASHTABLE_H
+#define _LINUX_RHASHTABLE_H
+
+#include <linux/compiler.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+
+struct rhash_head {
+	struct rhash_head __rcu		*next;
+};
+
+/**
+ * struct bucket_table - Table of hash buckets
+ * @size: Number of buckets, always a power of two
+ * @future_tbl: Table the entries are being moved to, if resizing
+ * @buckets: Chain heads, the lowest bit is the bucket lock
+ */
+struct bucket_table {
+	unsigned int			size;
+	struct bucket_table __rcu	*future_tbl;
+	struct rhash_head __rcu		*buckets[];
+};
+
+typedef u32 (*rht_hashfn_t)(const void *data, u32 len, u32 seed);
+typedef u32 (*rht_obj_hashfn_t)(const void *obj, u32 seed);
+typedef int (*rht_obj_cmpfn_t)(const void *key, const void *obj);
+
+/**
+ * struct rhashtable_params - Hash table construction parameters
+ * @nelem_hint: Expected number of entries, sizes the initial table
+ * @key_len: Length of the key inside the object
+ * @key_offset: Offset of the key in the object
+ * @head_offset: Offset of the struct rhash_head in the object
+ * @min_size: Never shrink below this many buckets
+ * @max_size: Never grow beyond this many buckets
+ * @automatic_shrinking: Shrink the table when it becomes sparse
+ * @hashfn: Function to hash the key, jhash() if NULL
+ * @obj_hashfn: Function to hash a whole object, instead of @key_len
+ * @obj_cmpfn: Function to compare a key to an object, returning zero on
+ *             a match; the key and object are compared with memcmp()
+ *             over @key_len bytes if NULL
+ *
+ * A table either has a fixed size key (@key_len) or hashes whole objects
+ * with @obj_hashfn.  In the latter case the key passed to lookups is
+ * handed to @obj_hashfn and @obj_cmpfn as is and must look like an
+ * object to them.
+ */
+struct rhashtable_params {
+	size_t				nelem_hint;
+	size_t				key_len;
+	size_t				key_offset;
+	size_t				head_offset;
+	unsigned int			min_size;
+	unsigned int			max_size;
+	bool				automatic_shrinking;
+	rht_hashfn_t			hashfn;
+	rht_obj_hashfn_t		obj_hashfn;
+	rht_obj_cmpfn_t			obj_cmpfn;
+};
+
+/**
+ * struct rhashtable - Hash table handle
+ * @tbl: Bucket table
+ * @nelems: Number of entries in the table
+ * @hash_rnd: Seed for the hash functions
+ * @being_destroyed: Set once rhashtable_destroy() has begun, stops resizing
+ * @p: Construction parameters
+ * @run_work: Deferred resize
+ * @mutex: Serialises resizes against each other and rhashtable_destroy()
+ */
+struct rhashtable {
+	struct bucket_table __rcu	*tbl;
+	atomic_t			nelems;
+	u32				hash_rnd;
+	bool				being_destroyed;
+	struct rhashtable_params	p;
+	struct work_struct		run_work;
+	struct mutex			mutex;
+};
+
+static inline void *rht_obj(const struct rhashtable *ht,
+			    const struct rhash_head *he)
+{
+	return (void *)he - ht->p.head_offset;
+}
+
+static inline unsigned int rhashtable_nelems(const struct rhashtable *ht)
+{
+	return atomic_read(&ht->nelems);
+}
+
+int rhashtable_init(struct rhashtable *ht,
+		    const struct rhashtable_params *params);
+
+/*
+ * rhashtable_lookup() must be called under rcu_read_lock(), and the
+ * object returned is only guaranteed to stay around as long as it is
+ * held.  Insertion and removal may be called from any context that
+ * may take a spinlock; the caller serialises inserting and removing
+ * the same object.
+ */
+void *rhashtable_lookup(struct rhashtable *ht, const void *key);
+void rhashtable_insert(struct rhashtable *ht, struct rhash_head *obj);
+int rhashtable_lookup_insert(struct rhashtable *ht, struct rhash_head *obj);
+int rhashtable_remove(struct rhashtable *ht, struct rhash_head *obj);
+
+void rhashtable_free_and_destroy(struct rhashtable *ht,
+				 void (*free_fn)(void *ptr, void *arg),
+				 void *arg);
+void rhashtable_destroy(struct rhashtable *ht);
+
+#endif /* _LINUX_RHASHTABLE_H */
@@ -0,0 +1,181 @@
+/*
+ * Restartable sequences system call interface.
+ *
+ * A thread registers a struct rseq with the kernel, which keeps the number
+ * of the CPU the thread runs on up to date in it. The thread can then
+ * operate on per-CPU data without atomic instructions: it describes its
+ * critical section in a struct rseq_cs and points rseq->rseq_cs at it
+ * before entering. If the thread is preempted, migrated or interrupted by
+ * a signal before reaching the commit instruction (the last one of the
+ * section), the kernel moves its instruction pointer to abort_ip on the
+ * way back to userspace, and the section is retried there.
+ *
+ * The 32-bit word just before abort_ip must hold the signature passed to
+ * rseq() at registration, so that an attacker cannot redirect execution
+ * to an arbitrary address through a forged rseq_cs.
+ */
+#ifndef _LINUX_RSEQ_H
+#define _LINUX_RSEQ_H
+
+#include <linux/types.h>
+
+enum rseq_cpu_id_state {
+	RSEQ_CPU_ID_UNINITIALIZED		= -1,
+	RSEQ_CPU_ID_REGISTRATION_FAILED		= -2,
+};
+
+enum rseq_flags {
+	RSEQ_FLAG_UNREGISTER = (1 << 0),
+};
+
+enum rseq_cs_flags_bit {
+	RSEQ_CS_FLAG_NO_RESTART_ON_PREEMPT_BIT	= 0,
+	RSEQ_CS_FLAG_NO_RESTART_ON_SIGNAL_BIT	= 1,
+	RSEQ_CS_FLAG_NO_RESTART_ON_MIGRATE_BIT	= 2,
+};
+
+enum rseq_cs_flags {
+	RSEQ_CS_FLAG_NO_RESTART_ON_PREEMPT	=
+		(1U << RSEQ_CS_FLAG_NO_RESTART_ON_PREEMPT_BIT),
+	RSEQ_CS_FLAG_NO_RESTART_ON_SIGNAL	=
+		(1U << RSEQ_CS_FLAG_NO_RESTART_ON_SIGNAL_BIT),
+	RSEQ_CS_FLAG_NO_RESTART_ON_MIGRATE	=
+		(1U << RSEQ_CS_FLAG_NO_RESTART_ON_MIGRATE_BIT),
+};
+
+/*
+ * struct rseq_cs describes a critical section: it covers the instructions
+ * in [start_ip, start_ip + post_commit_offset). Only version 0 exists.
+ */
+struct rseq_cs {
+	__u32 version;
+	__u32 flags;		/* RSEQ_CS_FLAG_* */
+	__u64 start_ip;
+	__u64 post_commit_offset;
+	__u64 abort_ip;
+} __attribute__((aligned(4 * sizeof(__u64))));
+
+/*
+ * struct rseq is shared between the kernel and one thread. The kernel
+ * writes cpu_id_start and cpu_id before returning to the thread whenever
+ * it may have moved; the thread writes rseq_cs and flags.
+ */
+struct rseq {
+	/*
+	 * Always a valid CPU number, even before registration; use it as
+	 * the index of the per-CPU data to work on.
+	 */
+	__u32 cpu_id_start;
+	/*
+	 * The current CPU, or RSEQ_CPU_ID_UNINITIALIZED when not registered.
+	 */
+	__u32 cpu_id;
+	/*
+	 * Address of the struct rseq_cs of the critical section the thread
+	 * is in, or 0. The kernel clears it once the thread has left the
+	 * section. 64 bits wide on all architectures.
+	 */
+	__u64 rseq_cs;
+	/*
+	 * RSEQ_CS_FLAG_* that apply to every critical section of the thread.
+	 */
+	__u32 flags;
+} __attribute__((aligned(4 * sizeof(__u64))));
+
+#ifdef __KERNEL__
+
+#include <linux/sched.h>
+#include <linux/preempt.h>
+
+#ifdef CONFIG_RSEQ
+
+/* The events that abort a critical section, matching RSEQ_CS_FLAG_* bits. */
+enum rseq_event_mask_bits {
+	RSEQ_EVENT_PREEMPT_BIT	= RSEQ_CS_FLAG_NO_RESTART_ON_PREEMPT_BIT,
+	RSEQ_EVENT_SIGNAL_BIT	= RSEQ_CS_FLAG_NO_RESTART_ON_SIGNAL_BIT,
+	RSEQ_EVENT_MIGRATE_BIT	= RSEQ_CS_FLAG_NO_RESTART_ON_MIGRATE_BIT,
+};
+
+extern void __rseq_handle_notify_resume(struct pt_regs *regs);
+
+/* Have the thread go through rseq_handle_notify_resume() before it runs. */
+static inline void rseq_set_notify_resume(struct task_struct *t)
+{
+	if (t->rseq)
+		set_tsk_thread_flag(t, TIF_NOTIFY_RESUME);
+}
+
+/* Called from the arch's TIF_NOTIFY_RESUME handling. */
+static inline void rseq_handle_notify_resume(struct pt_regs *regs)
+{
+	if (current->rseq)
+		__rseq_handle_notify_resume(regs);
+}
+
+/* Called before the signal frame is set up, so it saves the abort_ip. */
+static inline void rseq_signal_deliver(struct pt_regs *regs)
+{
+	preempt_disable();
+	__set_bit(RSEQ_EVENT_SIGNAL_BIT, &current->rseq_event_mask);
+	preempt_enable();
+	rseq_handle_notify_resume(regs);
+}
+
+/* @t is switched out; rq->lock held. */
+static inline void rseq_preempt(struct task_struct *t)
+{
+	__set_bit(RSEQ_EVENT_PREEMPT_BIT, &t->rseq_event_mask);
+	rseq_set_notify_resume(t);
+}
+
+/* @t is not running and moves to another CPU; rq->lock held. */
+static inline void rseq_migrate(struct task_struct *t)
+{
+	__set_bit(RSEQ_EVENT_MIGRATE_BIT, &t->rseq_event_mask);
+	rseq_set_notify_resume(t);
+}
+
+/*
+ * A child sharing the mm starts unregistered: its parent's struct rseq is
+ * per-thread. A fork()ed child has its own copy at the same address.
+ */
+static inline void rseq_fork(struct task_struct *t, unsigned long clone_flags)
+{
+	if (clone_flags & CLONE_VM) {
+		t->rseq = NULL;
+		t->rseq_len = 0;
+		t->rseq_sig = 0;
+		t->rseq_event_mask = 0;
+	} else {
+		t->rseq = current->rseq;
+		t->rseq_len = current->rseq_len;
+		t->rseq_sig = current->rseq_sig;
+		t->rseq_event_mask = current->rseq_event_mask;
+	}
+}
+
+static inline void rseq_execve(struct task_struct *t)
+{
+	t->rseq = NULL;
+	t->rseq_len = 0;
+	t->rseq_sig = 0;
+	t->rseq_event_mask = 0;
+}
+
+#else /* CONFIG_RSEQ */
+
+static inline void rseq_set_notify_resume(struct task_struct *t) { }
+static inline void rseq_handle_notify_resume(struct pt_regs *regs) { }
+static inline void rseq_signal_deliver(struct pt_regs *regs) { }
+static inline void rseq_preempt(struct task_struct *t) { }
+static inline void rseq_migrate(struct task_struct *t) { }
+static inline void rseq_fork(struct task_struct *t, unsigned long clone_flags)
+{
+}
+static inline void rseq_execve(struct task_struct *t) { }
+
+#endif /* CONFIG_RSEQ */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_RSEQ_H */
@@ -0,0 +1,21 @@
+/*
+ * Batched sendfile, see sendfilev(2).
+ */
+#ifndef _LINUX_SENDFILE_H
+#define _LINUX_SENDFILE_H
+
+#include <linux/types.h>
+
+/*
+ * One transfer of a sendfilev() batch: @count bytes of @in_fd starting at
+ * @offset, like sendfile64() with an offset. The file position of @in_fd
+ * is neither used nor updated.
+ */
+struct sendfile_vec {
+	__s32	in_fd;
+	__u32	flags;		/* must be zero */
+	__u64	offset;
+	__u64	count;
+};
+
+#endif /* _LINUX_SENDFILE_H */
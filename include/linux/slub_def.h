@@ -43,6 +43,15 @@ enum stat_item {
 	CPU_PARTIAL_DRAIN,	/* Drain cpu partial to node partial */
 	NR_SLUB_STAT_ITEMS };
 
+enum alloc_stat_item {
+	ASTAT_FASTPATH,		/* Allocation from the lockless freelist */
+	ASTAT_SLOWPATH,		/* Allocation through __slab_alloc() */
+	ASTAT_LIST_LOCK_CONTENDED, /* list_lock was held by someone else */
+	NR_ALLOC_STAT_ITEMS };
+
+/* log2 buckets of nanoseconds spent in the allocation slowpath */
+#define SLUB_LAT_BUCKETS	16
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to next available object */
 	unsigned long tid;	/* Globally unique transaction id */
@@ -51,6 +60,10 @@ struct kmem_cache_cpu {
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
+#ifdef CONFIG_SLUB_ALLOC_STATS
+	unsigned long astat[NR_ALLOC_STAT_ITEMS];
+	unsigned long slow_lat[SLUB_LAT_BUCKETS];
+#endif
 };
 
 struct kmem_cache_node {
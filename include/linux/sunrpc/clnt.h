@@ -27,6 +27,12 @@
 
 struct rpc_inode;
 
+/*
+ * Upper bound on the number of transports a client may spread its
+ * requests over (see rpc_create_args.nconnect).
+ */
+#define RPC_MAX_NCONNECT	16
+
 /*
  * The high-level client handle
  */
@@ -36,6 +42,9 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt __rcu *	cl_xprt;	/* transport */
+	struct rpc_xprt *	cl_xprt_extra[RPC_MAX_NCONNECT - 1];
+	unsigned int		cl_nr_xprt_extra; /* additional transports */
+	atomic_t		cl_xprt_next;	/* round-robin cursor */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -115,6 +124,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* number of transports */
 };
 
 /* Values for "flags" field */
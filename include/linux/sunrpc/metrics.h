@@ -19,7 +19,12 @@
  *
  *  The counters are maintained in a single array per RPC client, indexed
  *  by procedure number.  There is no need to maintain separate counter
- *  arrays per-CPU because these counters are always modified behind locks.
+ *  arrays per-CPU because these counters are always modified behind locks:
+ *  each procedure's counters have their own lock, as requests of one
+ *  client may complete on several transports at once.
+ *
+ *  Besides the totals, the round trip and execution times of each
+ *  procedure are sorted into log2 histograms of microseconds.
  */
 
 #ifndef _LINUX_SUNRPC_METRICS_H
@@ -27,10 +32,19 @@
 
 #include <linux/seq_file.h>
 #include <linux/ktime.h>
+#include <linux/spinlock.h>
+
+#define RPC_IOSTATS_VERS	"1.1"
 
-#define RPC_IOSTATS_VERS	"1.0"
+/*
+ * Bucket 0 is below 1us, bucket n covers [2^(n-1), 2^n) us, the last one
+ * takes everything from about half a second up.
+ */
+#define RPC_IOSTATS_HIST_BUCKETS	20
 
 struct rpc_iostats {
+	spinlock_t		om_lock;
+
 	/*
 	 * These counters give an idea about how many request
 	 * transmissions are required, on average, to complete that
@@ -62,6 +76,9 @@ struct rpc_iostats {
 	ktime_t			om_queue,	/* queued for xmit */
 				om_rtt,		/* RPC RTT */
 				om_execute;	/* RPC execution */
+
+	unsigned int		om_rtt_hist[RPC_IOSTATS_HIST_BUCKETS],
+				om_execute_hist[RPC_IOSTATS_HIST_BUCKETS];
 } ____cacheline_aligned;
 
 struct rpc_task;
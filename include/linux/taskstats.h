@@ -200,11 +200,24 @@ enum {
 	TASKSTATS_CMD_ATTR_TGID,
 	TASKSTATS_CMD_ATTR_REGISTER_CPUMASK,
 	TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK,
+	TASKSTATS_CMD_ATTR_FIELDS,	/* u32 mask of TASKSTATS_FIELD_* */
 	__TASKSTATS_CMD_ATTR_MAX,
 };
 
 #define TASKSTATS_CMD_ATTR_MAX (__TASKSTATS_CMD_ATTR_MAX - 1)
 
+/*
+ * Groups of struct taskstats fields to fill in a TASKSTATS_CMD_GET dump
+ * (NLM_F_DUMP) of all tasks in the caller's pid namespace. The dump
+ * fills every group unless TASKSTATS_CMD_ATTR_FIELDS says otherwise;
+ * fields of unselected groups are left zero.
+ */
+#define TASKSTATS_FIELD_DELAY	0x1	/* delay accounting */
+#define TASKSTATS_FIELD_BASIC	0x2	/* basic accounting, context switches */
+#define TASKSTATS_FIELD_XACCT	0x4	/* extended accounting: memory and io */
+#define TASKSTATS_FIELD_ALL	(TASKSTATS_FIELD_DELAY | TASKSTATS_FIELD_BASIC | \
+				 TASKSTATS_FIELD_XACCT)
+
 /* NETLINK_GENERIC related info */
 
 #define TASKSTATS_GENL_NAME	"TASKSTATS"
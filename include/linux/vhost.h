@@ -35,7 +35,9 @@ struct vhost_vring_addr {
 	/* Whether log address is valid. If set enables logging. */
 #define VHOST_VRING_F_LOG 0
 
-	/* Start of array of descriptors (virtually contiguous) */
+	/* Start of array of descriptors (virtually contiguous).  With a
+	 * packed ring, used and avail point to the device and driver event
+	 * areas, and the log covers the descriptor ring. */
 	__u64 desc_user_addr;
 	/* Used structure address. Must be 32 bit aligned */
 	__u64 used_user_addr;
@@ -98,7 +100,8 @@ struct vhost_memory {
 #define VHOST_SET_VRING_NUM _IOW(VHOST_VIRTIO, 0x10, struct vhost_vring_state)
 /* Set addresses for the ring. */
 #define VHOST_SET_VRING_ADDR _IOW(VHOST_VIRTIO, 0x11, struct vhost_vring_addr)
-/* Base value where queue looks for available descriptors */
+/* Base value where queue looks for available descriptors.  With a packed
+ * ring, bit 15 of num holds the wrap counter that goes with the offset. */
 #define VHOST_SET_VRING_BASE _IOW(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
 /* Get accessor: reads index, writes value in num */
 #define VHOST_GET_VRING_BASE _IOWR(VHOST_VIRTIO, 0x12, struct vhost_vring_state)
@@ -121,6 +124,13 @@ struct vhost_memory {
  * device.  This can be used to stop the ring (e.g. for migration). */
 #define VHOST_NET_SET_BACKEND _IOW(VHOST_VIRTIO, 0x30, struct vhost_vring_file)
 
+/* VHOST_BLK specific defines */
+
+/* Attach the virtio blk ring to an open block device, which requests are
+ * then submitted to directly.  Pass fd -1 to detach; this waits for the
+ * requests in flight to complete. */
+#define VHOST_BLK_SET_BACKEND _IOW(VHOST_VIRTIO, 0x50, struct vhost_vring_file)
+
 /* Feature bits */
 /* Log all write descriptors. Can be changed while device is active. */
 #define VHOST_F_LOG_ALL 26
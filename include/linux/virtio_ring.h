@@ -58,6 +58,24 @@
  * at the end of the used ring. Guest should ignore the used->flags field. */
 #define VIRTIO_RING_F_EVENT_IDX		29
 
+/* The ring uses the packed layout: a single descriptor ring that both sides
+ * write, with availability and use signalled by flags in the descriptors. */
+#define VIRTIO_RING_F_PACKED		31
+
+/* Packed ring: the Guest sets AVAIL to its wrap counter and USED to the
+ * inverse when it makes a descriptor available, the Host sets both to its
+ * wrap counter when it writes back a used descriptor. */
+#define VRING_PACKED_DESC_F_AVAIL	(1 << 7)
+#define VRING_PACKED_DESC_F_USED	(1 << 15)
+
+/* Packed ring event suppression flags. */
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	0x1
+/* Only signal when the ring reaches the position in off_wrap. */
+#define VRING_PACKED_EVENT_FLAG_DESC	0x2
+/* The top bit of off_wrap holds the wrap counter for that position. */
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vring_desc {
 	/* Address (guest-physical). */
@@ -100,6 +118,38 @@ struct vring {
 	struct vring_used *used;
 };
 
+/* Packed ring descriptors: 16 bytes.  A chain occupies consecutive entries;
+ * the id of the last one is what the Host writes back when it is used. */
+struct vring_packed_desc {
+	/* Address (guest-physical). */
+	__u64 addr;
+	/* Length. */
+	__u32 len;
+	/* Buffer id. */
+	__u16 id;
+	/* VRING_DESC_F_* and VRING_PACKED_DESC_F_* flags. */
+	__u16 flags;
+};
+
+struct vring_packed_desc_event {
+	/* Descriptor ring offset and wrap counter. */
+	__u16 off_wrap;
+	/* VRING_PACKED_EVENT_FLAG_* */
+	__u16 flags;
+};
+
+struct vring_packed {
+	unsigned int num;
+
+	struct vring_packed_desc *desc;
+
+	/* Written by the Guest: when to interrupt it. */
+	struct vring_packed_desc_event *driver;
+
+	/* Written by the Host: when to kick it. */
+	struct vring_packed_desc_event *device;
+};
+
 /* The standard layout for the ring is a continuous chunk of memory which looks
  * like this.  We assume num is a power of 2.
  *
@@ -146,6 +196,42 @@ static inline unsigned vring_size(unsigned int num, unsigned long align)
 		+ sizeof(__u16) * 3 + sizeof(struct vring_used_elem) * num;
 }
 
+/* The packed layout fits in the memory the transports size for a split ring
+ * of the same length:
+ *
+ * struct vring_packed
+ * {
+ *	// The descriptor ring (16 bytes each)
+ *	struct vring_packed_desc desc[num];
+ *
+ *	// Event suppression written by the Guest.
+ *	struct vring_packed_desc_event driver;
+ *
+ *	// Padding to the next align boundary.
+ *	char pad[];
+ *
+ *	// Event suppression written by the Host.
+ *	struct vring_packed_desc_event device;
+ * };
+ */
+static inline void vring_packed_init(struct vring_packed *vr, unsigned int num,
+				     void *p, unsigned long align)
+{
+	vr->num = num;
+	vr->desc = p;
+	vr->driver = p + num*sizeof(struct vring_packed_desc);
+	vr->device = (void *)(((unsigned long)(vr->driver + 1)
+		+ align-1) & ~(align - 1));
+}
+
+static inline unsigned vring_packed_size(unsigned int num, unsigned long align)
+{
+	return ((sizeof(struct vring_packed_desc) * num
+		 + sizeof(struct vring_packed_desc_event) + align - 1)
+		& ~(align - 1))
+		+ sizeof(struct vring_packed_desc_event);
+}
+
 /* The following is used with USED_EVENT_IDX and AVAIL_EVENT_IDX */
 /* Assuming a given event_idx value from the other size, if
  * we have just incremented index from old to new_idx,
@@ -165,7 +251,8 @@ static inline int vring_need_event(__u16 event_idx, __u16 new_idx, __u16 old)
 struct virtio_device;
 struct virtqueue;
 
-struct virtqueue *vring_new_virtqueue(unsigned int num,
+struct virtqueue *vring_new_virtqueue(unsigned int index,
+				      unsigned int num,
 				      unsigned int vring_align,
 				      struct virtio_device *vdev,
 				      bool weak_barriers,
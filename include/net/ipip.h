@@ -45,11 +45,76 @@ struct ip_tunnel_prl_entry {
 	struct rcu_head			rcu_head;
 };
 
+/**
+ *	iptunnel_handle_offloads - prepare an skb for encapsulation
+ *	@skb: packet about to get the outer headers
+ *	@csum_help: resolve a pending checksum here, because the tunnel
+ *		header carries a checksum over the payload
+ *	@gso_type_mask: SKB_GSO_* bit of the tunnel type
+ *
+ *	Records the inner headers, so that GSO and devices listing the
+ *	offload in hw_enc_features can find them, and tags GSO packets with
+ *	the tunnel type. Returns the skb or an ERR_PTR() after freeing it.
+ */
+static inline struct sk_buff *iptunnel_handle_offloads(struct sk_buff *skb,
+						       bool csum_help,
+						       int gso_type_mask)
+{
+	int err;
+
+	if (likely(!skb->encapsulation)) {
+		skb_reset_inner_headers(skb);
+		skb->encapsulation = 1;
+	}
+
+	if (skb_is_gso(skb)) {
+		err = skb_unclone(skb, GFP_ATOMIC);
+		if (unlikely(err))
+			goto error;
+		skb_shinfo(skb)->gso_type |= gso_type_mask;
+		return skb;
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL && csum_help) {
+		err = skb_checksum_help(skb);
+		if (unlikely(err))
+			goto error;
+	} else if (skb->ip_summed != CHECKSUM_PARTIAL)
+		skb->ip_summed = CHECKSUM_NONE;
+
+	return skb;
+
+error:
+	kfree_skb(skb);
+	return ERR_PTR(err);
+}
+
+/**
+ *	iptunnel_pull_offloads - drop the offload state of the outer headers
+ *	@skb: packet whose outer headers were just removed
+ *
+ *	A packet merged by GRO through the tunnel is still tagged with the
+ *	tunnel GSO type. Clear it so that the inner packet is segmented as
+ *	plain TCP if it gets forwarded.
+ */
+static inline int iptunnel_pull_offloads(struct sk_buff *skb)
+{
+	if (skb_is_gso(skb)) {
+		int err = skb_unclone(skb, GFP_ATOMIC);
+
+		if (unlikely(err))
+			return err;
+		skb_shinfo(skb)->gso_type &= ~(SKB_GSO_GRE | SKB_GSO_IPIP);
+	}
+
+	skb->encapsulation = 0;
+	return 0;
+}
+
 #define __IPTUNNEL_XMIT(stats1, stats2) do {				\
 	int err;							\
 	int pkt_len = skb->len - skb_transport_offset(skb);		\
 									\
-	skb->ip_summed = CHECKSUM_NONE;					\
 	ip_select_ident(iph, &rt->dst, NULL);				\
 									\
 	err = ip_local_out(skb);					\
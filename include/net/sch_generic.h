@@ -25,6 +25,7 @@ enum qdisc_state_t {
 	__QDISC_STATE_SCHED,
 	__QDISC_STATE_DEACTIVATED,
 	__QDISC_STATE_THROTTLED,
+	__QDISC_STATE_RUNNING,		/* TCQ_F_NOLOCK qdiscs only */
 };
 
 /*
@@ -50,6 +51,7 @@ struct Qdisc {
 #define TCQ_F_INGRESS		2
 #define TCQ_F_CAN_BYPASS	4
 #define TCQ_F_MQROOT		8
+#define TCQ_F_NOLOCK		0x10 /* enqueue/dequeue without qdisc lock */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	const struct Qdisc_ops	*ops;
@@ -72,6 +74,7 @@ struct Qdisc {
 	struct Qdisc		*next_sched;
 
 	struct sk_buff		*gso_skb;
+	struct sk_buff_head	requeue;	/* bulk dequeue leftovers */
 	/*
 	 * For performance sake on SMP, we put highly modified fields at the end
 	 */
@@ -87,19 +90,33 @@ struct Qdisc {
 
 static inline bool qdisc_is_running(const struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		return test_bit(__QDISC_STATE_RUNNING, &qdisc->state);
 	return (qdisc->__state & __QDISC___STATE_RUNNING) ? true : false;
 }
 
+/*
+ * A TCQ_F_NOLOCK qdisc is enqueued to from many CPUs in parallel, the
+ * running bit elects the single CPU that dequeues from it.
+ */
 static inline bool qdisc_run_begin(struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		return !test_and_set_bit(__QDISC_STATE_RUNNING, &qdisc->state);
 	if (qdisc_is_running(qdisc))
 		return false;
 	qdisc->__state |= __QDISC___STATE_RUNNING;
 	return true;
 }
 
+extern void __qdisc_run_end_nolock(struct Qdisc *qdisc);
+
 static inline void qdisc_run_end(struct Qdisc *qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		__qdisc_run_end_nolock(qdisc);
+		return;
+	}
 	qdisc->__state &= ~__QDISC___STATE_RUNNING;
 }
 
@@ -306,6 +323,7 @@ static inline void sch_tree_unlock(const struct Qdisc *q)
 extern struct Qdisc noop_qdisc;
 extern struct Qdisc_ops noop_qdisc_ops;
 extern struct Qdisc_ops pfifo_fast_ops;
+extern struct Qdisc_ops pfifo_lockless_ops;
 extern struct Qdisc_ops mq_qdisc_ops;
 
 struct Qdisc_class_common {
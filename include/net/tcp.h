@@ -214,6 +214,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 
 /* Bit Flags for sysctl_tcp_fastopen */
 #define	TFO_CLIENT_ENABLE	1
+#define	TFO_SERVER_ENABLE	2
 #define	TFO_CLIENT_NO_COOKIE	4	/* Data in SYN w/o cookie option */
 
 extern struct inet_timewait_death_row tcp_death_row;
@@ -458,7 +459,8 @@ extern int tcp_v4_connect(struct sock *sk, struct sockaddr *uaddr,
 extern int tcp_connect(struct sock *sk);
 extern struct sk_buff * tcp_make_synack(struct sock *sk, struct dst_entry *dst,
 					struct request_sock *req,
-					struct request_values *rvp);
+					struct request_values *rvp,
+					struct tcp_fastopen_cookie *foc);
 extern int tcp_disconnect(struct sock *sk, int flags);
 
 void tcp_connect_init(struct sock *sk);
@@ -527,6 +529,7 @@ extern void tcp_send_delayed_ack(struct sock *sk);
 extern void tcp_cwnd_application_limited(struct sock *sk);
 extern void tcp_resume_early_retransmit(struct sock *sk);
 extern void tcp_rearm_rto(struct sock *sk);
+extern void tcp_init_buffer_space(struct sock *sk);
 
 /* tcp_timer.c */
 extern void tcp_init_xmit_timers(struct sock *);
@@ -672,11 +675,20 @@ void tcp_send_window_probe(struct sock *sk);
  */
 struct tcp_skb_cb {
 	union {
-		struct inet_skb_parm	h4;
+		union {
+			struct inet_skb_parm	h4;
 #if IS_ENABLED(CONFIG_IPV6)
-		struct inet6_skb_parm	h6;
+			struct inet6_skb_parm	h6;
 #endif
-	} header;	/* For incoming frames		*/
+		} header;	/* For incoming frames		*/
+		struct {
+			/* Delivery rate sampling state, see tcp_rate.c */
+			__u32 delivered;	/* tp->delivered at send */
+			__u32 delivered_us;	/* tp->delivered_us at send */
+			__u32 first_tx_us;	/* tp->first_tx_us at send */
+			__u32 sent_us;		/* when this skb was sent */
+		} tx;		/* For frames in the write queue */
+	};
 	__u32		seq;		/* Starting sequence number	*/
 	__u32		end_seq;	/* SEQ + FIN + SYN + datalen	*/
 	__u32		when;		/* used to compute rtt's	*/
@@ -748,6 +760,21 @@ enum tcp_ca_event {
 #define TCP_CONG_NON_RESTRICTED 0x1
 #define TCP_CONG_RTT_STAMP	0x2
 
+/* A delivery rate sample, generated on each ACK by tcp_rate_gen().
+ * delivered and interval_us are -1 when no valid sample was taken.
+ */
+struct rate_sample {
+	u32	prior_us;	/* starting timestamp for interval */
+	u32	prior_delivered; /* tp->delivered at "prior_us" */
+	s32	delivered;	/* number of packets delivered over interval */
+	long	interval_us;	/* time for tp->delivered to incr "delivered" */
+	long	rtt_us;		/* RTT of last (S)ACKed packet (or -1) */
+	int	losses;		/* number of packets marked lost upon ACK */
+	u32	acked_sacked;	/* number of packets newly (S)ACKed upon ACK */
+	u32	prior_in_flight; /* in flight before this ACK */
+	bool	is_retrans;	/* is sample from retransmission? */
+};
+
 struct tcp_congestion_ops {
 	struct list_head	list;
 	unsigned long flags;
@@ -773,6 +800,10 @@ struct tcp_congestion_ops {
 	void (*pkts_acked)(struct sock *sk, u32 num_acked, s32 rtt_us);
 	/* get info for inet_diag (optional) */
 	void (*get_info)(struct sock *sk, u32 ext, struct sk_buff *skb);
+	/* set cwnd and pacing rate from a delivery rate sample, called
+	 * on every ACK; cong_avoid may then be omitted (optional)
+	 */
+	void (*cong_control)(struct sock *sk, const struct rate_sample *rs);
 
 	char 		name[TCP_CA_NAME_MAX];
 	struct module 	*owner;
@@ -792,6 +823,41 @@ extern int tcp_set_congestion_control(struct sock *sk, const char *name);
 extern void tcp_slow_start(struct tcp_sock *tp);
 extern void tcp_cong_avoid_ai(struct tcp_sock *tp, u32 w);
 
+/*
+ * Interface for adding upper layer protocols over TCP
+ */
+#define TCP_ULP_NAME_MAX	16
+
+struct tcp_ulp_ops {
+	struct list_head	list;
+
+	/* take over the established socket (required) */
+	int (*init)(struct sock *sk);
+	/* cleanup private data (optional) */
+	void (*release)(struct sock *sk);
+
+	char		name[TCP_ULP_NAME_MAX];
+	struct module	*owner;
+};
+
+extern int tcp_register_ulp(struct tcp_ulp_ops *type);
+extern void tcp_unregister_ulp(struct tcp_ulp_ops *type);
+extern int tcp_set_ulp(struct sock *sk, const char *name);
+extern void tcp_cleanup_ulp(struct sock *sk);
+
+/* From tcp_rate.c */
+extern void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb);
+extern void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+				   struct rate_sample *rs);
+extern void tcp_rate_gen(struct sock *sk, u32 delivered, u32 lost,
+			 struct rate_sample *rs);
+
+/* Microsecond clock used for delivery rate sampling; wraps every 71 min */
+static inline u32 tcp_clock_us(void)
+{
+	return (u32)ktime_to_us(ktime_get());
+}
+
 extern struct tcp_congestion_ops tcp_init_congestion_ops;
 extern u32 tcp_reno_ssthresh(struct sock *sk);
 extern void tcp_reno_cong_avoid(struct sock *sk, u32 ack, u32 in_flight);
@@ -1094,6 +1160,8 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
+	tcp_rsk(req)->listener = NULL;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1307,6 +1375,25 @@ struct tcp_fastopen_request {
 
 void tcp_free_fastopen_req(struct tcp_sock *tp);
 
+#define TCP_FASTOPEN_KEY_LENGTH 16
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* Fastopen key context */
+struct tcp_fastopen_context {
+	struct crypto_cipher		*tfm;
+	__u8				key[TCP_FASTOPEN_KEY_LENGTH];
+	struct rcu_head			rcu;
+};
+
+extern struct tcp_fastopen_context __rcu *tcp_fastopen_ctx;
+int tcp_fastopen_reset_cipher(void *key, unsigned int len);
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc);
+
+static inline bool fastopen_cookie_present(struct tcp_fastopen_cookie *foc)
+{
+	return foc->len != -1;
+}
+
 /* write queue abstraction */
 static inline void tcp_write_queue_purge(struct sock *sk)
 {
@@ -1530,7 +1617,7 @@ extern struct sk_buff **tcp_gro_receive(struct sk_buff **head,
 extern struct sk_buff **tcp4_gro_receive(struct sk_buff **head,
 					 struct sk_buff *skb);
 extern int tcp_gro_complete(struct sk_buff *skb);
-extern int tcp4_gro_complete(struct sk_buff *skb);
+extern int tcp4_gro_complete(struct sk_buff *skb, int thoff);
 
 #ifdef CONFIG_PROC_FS
 extern int tcp4_proc_init(void);
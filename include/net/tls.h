@@ -0,0 +1,97 @@
+/*
+ * tls: Kernel TLS record layer on TCP sockets
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#ifndef _NET_TLS_H
+#define _NET_TLS_H
+
+#include <linux/completion.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/tls.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include <net/inet_connection_sock.h>
+#include <net/sock.h>
+
+#define TLS_HEADER_SIZE			5
+#define TLS_AAD_SPACE_SIZE		13
+#define TLS_RECORD_TYPE_DATA		0x17
+
+#define TLS_MAX_PAYLOAD_SIZE		((size_t)1 << 14)
+#define TLS_OVERHEAD_SIZE		(TLS_HEADER_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_IV_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_TAG_SIZE)
+#define TLS_MAX_RECORD_SIZE		(TLS_MAX_PAYLOAD_SIZE + TLS_OVERHEAD_SIZE)
+#define TLS_RECORD_PAGES		DIV_ROUND_UP(TLS_MAX_RECORD_SIZE, \
+						     PAGE_SIZE)
+
+/* Fragments of plaintext collected into one record */
+#define TLS_MAX_PLAIN_ENTS		32
+
+struct crypto_aead;
+struct aead_request;
+
+struct tls_context {
+	struct tls12_crypto_info_aes_gcm_128 crypto_send;
+
+	struct crypto_aead *aead_send;
+	struct aead_request *aead_req;
+	struct completion async_wait;
+	int async_err;
+
+	/* salt followed by the explicit nonce of the next record */
+	u8 iv[TLS_CIPHER_AES_GCM_128_SALT_SIZE +
+	      TLS_CIPHER_AES_GCM_128_IV_SIZE];
+	u8 rec_seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE];
+	u8 aad[TLS_AAD_SPACE_SIZE];
+	struct scatterlist sg_aad;
+
+	/*
+	 * The record being built: pages copied from sendmsg or referenced
+	 * by sendpage, not yet encrypted.
+	 */
+	struct scatterlist sg_plain[TLS_MAX_PLAIN_ENTS];
+	unsigned int plain_ents;
+	unsigned int plain_size;
+	bool plain_merge;
+
+	/* An encrypted record not yet completely handed over to TCP */
+	struct page *rec_pages[TLS_RECORD_PAGES];
+	struct scatterlist sg_rec[TLS_RECORD_PAGES];
+	unsigned int rec_len;
+	unsigned int rec_sent;
+
+	/* Sticky error after a record could not be encrypted */
+	int tx_err;
+
+	/* Serialises the writers, TCP is called without the socket lock */
+	struct mutex tx_lock;
+	struct work_struct tx_work;
+	struct sock *sk;
+
+	struct proto *sk_proto;
+	void (*sk_write_space)(struct sock *sk);
+};
+
+static inline struct tls_context *tls_get_ctx(const struct sock *sk)
+{
+	return inet_csk(sk)->icsk_ulp_data;
+}
+
+int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx);
+void tls_sw_close(struct sock *sk, struct tls_context *ctx);
+void tls_sw_tx_work(struct work_struct *work);
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
+		   size_t size);
+int tls_sw_sendpage(struct sock *sk, struct page *page, int offset,
+		    size_t size, int flags);
+
+#endif	/* _NET_TLS_H */
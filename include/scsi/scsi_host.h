@@ -587,11 +587,11 @@ struct Scsi_Host {
 	struct blk_queue_tag	*bqt;
 
 	/*
-	 * The following two fields are protected with host_lock;
-	 * however, eh routines can safely access during eh processing
-	 * without acquiring the lock.
+	 * host_failed is protected with host_lock; however, eh routines
+	 * can safely access it during eh processing without acquiring
+	 * the lock.
 	 */
-	unsigned int host_busy;		   /* commands actually active on low-level */
+	atomic_t host_busy;		   /* commands actually active on low-level */
 	unsigned int host_failed;	   /* commands that failed. */
 	unsigned int host_eh_scheduled;    /* EH scheduled without command */
     
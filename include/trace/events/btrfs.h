@@ -17,6 +17,7 @@ struct btrfs_delayed_ref_node;
 struct btrfs_delayed_tree_ref;
 struct btrfs_delayed_data_ref;
 struct btrfs_delayed_ref_head;
+struct btrfs_delayed_ref_root;
 struct btrfs_block_group_cache;
 struct btrfs_free_cluster;
 struct map_lookup;
@@ -550,6 +551,40 @@ TRACE_EVENT(btrfs_delayed_ref_head,
 		{ BTRFS_BLOCK_GROUP_DUP, 	"DUP"	},	\
 		{ BTRFS_BLOCK_GROUP_RAID10, 	"RAID10"})
 
+TRACE_EVENT(btrfs_delayed_ref_backlog,
+
+	TP_PROTO(struct btrfs_root *root,
+		 struct btrfs_delayed_ref_root *delayed_refs),
+
+	TP_ARGS(root, delayed_refs),
+
+	TP_STRUCT__entry(
+		__field(	u64,  generation		)
+		__field(	unsigned long,  num_heads	)
+		__field(	unsigned long,  num_heads_ready	)
+		__field(	unsigned long,  num_entries	)
+		__field(	int,  num_heads_run_async	)
+		__field(	int,  num_throttled		)
+	),
+
+	TP_fast_assign(
+		__entry->generation	= root->fs_info->generation;
+		__entry->num_heads	= delayed_refs->num_heads;
+		__entry->num_heads_ready = delayed_refs->num_heads_ready;
+		__entry->num_entries	= delayed_refs->num_entries;
+		__entry->num_heads_run_async =
+			atomic_read(&delayed_refs->num_heads_run_async);
+		__entry->num_throttled	= atomic_read(&delayed_refs->num_throttled);
+	),
+
+	TP_printk("gen = %llu, heads = %lu, ready = %lu, entries = %lu, "
+		  "run_async = %d, throttled = %d",
+		  (unsigned long long)__entry->generation,
+		  __entry->num_heads, __entry->num_heads_ready,
+		  __entry->num_entries, __entry->num_heads_run_async,
+		  __entry->num_throttled)
+);
+
 DECLARE_EVENT_CLASS(btrfs__chunk,
 
 	TP_PROTO(struct btrfs_root *root, struct map_lookup *map,
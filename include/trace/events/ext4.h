@@ -1805,16 +1805,15 @@ TRACE_EVENT(ext4_ext_in_cache,
 
 TRACE_EVENT(ext4_find_delalloc_range,
 	TP_PROTO(struct inode *inode, ext4_lblk_t from, ext4_lblk_t to,
-		int reverse, int found, ext4_lblk_t found_blk),
+		int found, ext4_lblk_t found_blk),
 
-	TP_ARGS(inode, from, to, reverse, found, found_blk),
+	TP_ARGS(inode, from, to, found, found_blk),
 
 	TP_STRUCT__entry(
 		__field(	ino_t,		ino		)
 		__field(	dev_t,		dev		)
 		__field(	ext4_lblk_t,	from		)
 		__field(	ext4_lblk_t,	to		)
-		__field(	int,		reverse		)
 		__field(	int,		found		)
 		__field(	ext4_lblk_t,	found_blk	)
 	),
@@ -1824,17 +1823,16 @@ TRACE_EVENT(ext4_find_delalloc_range,
 		__entry->dev		= inode->i_sb->s_dev;
 		__entry->from		= from;
 		__entry->to		= to;
-		__entry->reverse	= reverse;
 		__entry->found		= found;
 		__entry->found_blk	= found_blk;
 	),
 
-	TP_printk("dev %d,%d ino %lu from %u to %u reverse %d found %d "
+	TP_printk("dev %d,%d ino %lu from %u to %u found %d "
 		  "(blk = %u)",
 		  MAJOR(__entry->dev), MINOR(__entry->dev),
 		  (unsigned long) __entry->ino,
 		  (unsigned) __entry->from, (unsigned) __entry->to,
-		  __entry->reverse, __entry->found,
+		  __entry->found,
 		  (unsigned) __entry->found_blk)
 );
 
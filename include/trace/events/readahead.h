@@ -0,0 +1,64 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+/*
+ * One event per readahead decision.  @hit tells a readahead marker hit,
+ * i.e. a read that readahead saw coming, from a cache miss; summed up per
+ * dev and ino, they give the hit/miss ratio of a file.
+ */
+TRACE_EVENT(mm_readahead,
+
+	TP_PROTO(struct address_space *mapping, pgoff_t offset,
+		 unsigned long req_size, bool hit, const char *pattern,
+		 struct file_ra_state *ra),
+
+	TP_ARGS(mapping, offset, req_size, hit, pattern, ra),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(pgoff_t, offset)
+		__field(unsigned long, req_size)
+		__field(bool, hit)
+		__string(pattern, pattern)
+		__field(pgoff_t, start)
+		__field(unsigned int, size)
+		__field(unsigned int, async_size)
+	),
+
+	TP_fast_assign(
+		__entry->dev = mapping->host->i_sb->s_dev;
+		__entry->ino = mapping->host->i_ino;
+		__entry->offset = offset;
+		__entry->req_size = req_size;
+		__entry->hit = hit;
+		__assign_str(pattern, pattern);
+		__entry->start = ra->start;
+		__entry->size = ra->size;
+		__entry->async_size = ra->async_size;
+	),
+
+	TP_printk("dev=%d:%d ino=%lx offset=%lu req_size=%lu %s pattern=%s "
+		  "start=%lu size=%u async_size=%u",
+		MAJOR(__entry->dev), MINOR(__entry->dev),
+		(unsigned long)__entry->ino,
+		(unsigned long)__entry->offset,
+		__entry->req_size,
+		__entry->hit ? "hit" : "miss",
+		__get_str(pattern),
+		(unsigned long)__entry->start,
+		__entry->size,
+		__entry->async_size)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
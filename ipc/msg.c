@@ -37,6 +37,7 @@
 #include <linux/rwsem.h>
 #include <linux/nsproxy.h>
 #include <linux/ipc_namespace.h>
+#include <linux/uio.h>
 
 #include <asm/current.h>
 #include <asm/uaccess.h>
@@ -235,7 +236,8 @@ static inline void ss_del(struct msg_sender *mss)
 		list_del(&mss->list);
 }
 
-static void ss_wakeup(struct list_head *h, int kill)
+static void ss_wakeup(struct list_head *h, int kill,
+		      struct wake_q_head *wake_q)
 {
 	struct list_head *tmp;
 
@@ -247,11 +249,12 @@ static void ss_wakeup(struct list_head *h, int kill)
 		tmp = tmp->next;
 		if (kill)
 			mss->list.next = NULL;
-		wake_up_process(mss->tsk);
+		wake_q_add(wake_q, mss->tsk);
 	}
 }
 
-static void expunge_all(struct msg_queue *msq, int res)
+static void expunge_all(struct msg_queue *msq, int res,
+			struct wake_q_head *wake_q)
 {
 	struct list_head *tmp;
 
@@ -261,9 +264,12 @@ static void expunge_all(struct msg_queue *msq, int res)
 
 		msr = list_entry(tmp, struct msg_receiver, r_list);
 		tmp = tmp->next;
-		msr->r_msg = NULL;
-		wake_up_process(msr->r_tsk);
-		smp_mb();
+		/*
+		 * The receiver may return as soon as it sees r_msg change,
+		 * so it must be on the wake_q (which pins the task) first;
+		 * wake_q_add() implies a full barrier.
+		 */
+		wake_q_add(wake_q, msr->r_tsk);
 		msr->r_msg = ERR_PTR(res);
 	}
 }
@@ -280,11 +286,13 @@ static void freeque(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 {
 	struct list_head *tmp;
 	struct msg_queue *msq = container_of(ipcp, struct msg_queue, q_perm);
+	WAKE_Q(wake_q);
 
-	expunge_all(msq, -EIDRM);
-	ss_wakeup(&msq->q_senders, 1);
+	expunge_all(msq, -EIDRM, &wake_q);
+	ss_wakeup(&msq->q_senders, 1, &wake_q);
 	msg_rmid(ns, msq);
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 
 	tmp = msq->q_messages.next;
 	while (tmp != &msq->q_messages) {
@@ -414,6 +422,7 @@ static int msgctl_down(struct ipc_namespace *ns, int msqid, int cmd,
 	struct kern_ipc_perm *ipcp;
 	struct msqid64_ds uninitialized_var(msqid64);
 	struct msg_queue *msq;
+	WAKE_Q(wake_q);
 	int err;
 
 	if (cmd == IPC_SET) {
@@ -450,17 +459,18 @@ static int msgctl_down(struct ipc_namespace *ns, int msqid, int cmd,
 		/* sleeping receivers might be excluded by
 		 * stricter permissions.
 		 */
-		expunge_all(msq, -EAGAIN);
+		expunge_all(msq, -EAGAIN, &wake_q);
 		/* sleeping senders might be able to send
 		 * due to a larger queue size.
 		 */
-		ss_wakeup(&msq->q_senders, 0);
+		ss_wakeup(&msq->q_senders, 0, &wake_q);
 		break;
 	default:
 		err = -EINVAL;
 	}
 out_unlock:
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 out_up:
 	up_write(&msg_ids(ns).rw_mutex);
 	return err;
@@ -597,7 +607,8 @@ static int testmsg(struct msg_msg *msg, long type, int mode)
 	return 0;
 }
 
-static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg)
+static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg,
+				 struct wake_q_head *wake_q)
 {
 	struct list_head *tmp;
 
@@ -613,16 +624,12 @@ static inline int pipelined_send(struct msg_queue *msq, struct msg_msg *msg)
 
 			list_del(&msr->r_list);
 			if (msr->r_maxsize < msg->m_ts) {
-				msr->r_msg = NULL;
-				wake_up_process(msr->r_tsk);
-				smp_mb();
+				wake_q_add(wake_q, msr->r_tsk);
 				msr->r_msg = ERR_PTR(-E2BIG);
 			} else {
-				msr->r_msg = NULL;
 				msq->q_lrpid = task_pid_vnr(msr->r_tsk);
 				msq->q_rtime = get_seconds();
-				wake_up_process(msr->r_tsk);
-				smp_mb();
+				wake_q_add(wake_q, msr->r_tsk);
 				msr->r_msg = msg;
 
 				return 1;
@@ -639,6 +646,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	struct msg_msg *msg;
 	int err;
 	struct ipc_namespace *ns;
+	WAKE_Q(wake_q);
 
 	ns = current->nsproxy->ipc_ns;
 
@@ -703,7 +711,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 	msq->q_lspid = task_tgid_vnr(current);
 	msq->q_stime = get_seconds();
 
-	if (!pipelined_send(msq, msg)) {
+	if (!pipelined_send(msq, msg, &wake_q)) {
 		/* no one is waiting for this message, enqueue it */
 		list_add_tail(&msg->m_list, &msq->q_messages);
 		msq->q_cbytes += msgsz;
@@ -717,6 +725,7 @@ long do_msgsnd(int msqid, long mtype, void __user *mtext,
 
 out_unlock_free:
 	msg_unlock(msq);
+	wake_up_q(&wake_q);
 out_free:
 	if (msg != NULL)
 		free_msg(msg);
@@ -759,6 +768,7 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 	struct msg_msg *msg;
 	int mode;
 	struct ipc_namespace *ns;
+	WAKE_Q(wake_q);
 
 	if (msqid < 0 || (long) msgsz < 0)
 		return -EINVAL;
@@ -815,8 +825,9 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 			msq->q_cbytes -= msg->m_ts;
 			atomic_sub(msg->m_ts, &ns->msg_bytes);
 			atomic_dec(&ns->msg_hdrs);
-			ss_wakeup(&msq->q_senders, 0);
+			ss_wakeup(&msq->q_senders, 0, &wake_q);
 			msg_unlock(msq);
+			wake_up_q(&wake_q);
 			break;
 		}
 		/* No message waiting. Wait for a message */
@@ -851,20 +862,12 @@ long do_msgrcv(int msqid, long *pmtype, void __user *mtext,
 		rcu_read_lock();
 
 		/* Lockless receive, part 2:
-		 * Wait until pipelined_send or expunge_all are outside of
-		 * wake_up_process(). There is a race with exit(), see
-		 * ipc/mqueue.c for the details.
-		 */
-		msg = (struct msg_msg*)msr_d.r_msg;
-		while (msg == NULL) {
-			cpu_relax();
-			msg = (struct msg_msg *)msr_d.r_msg;
-		}
-
-		/* Lockless receive, part 3:
 		 * If there is a message or an error then accept it without
-		 * locking.
+		 * locking. pipelined_send and expunge_all queue us for the
+		 * wakeup (which pins the task) before they store r_msg, so
+		 * once r_msg changed nothing touches msr_d any more.
 		 */
+		msg = (struct msg_msg *)ACCESS_ONCE(msr_d.r_msg);
 		if (msg != ERR_PTR(-EAGAIN)) {
 			rcu_read_unlock();
 			break;
@@ -919,6 +922,69 @@ out:
 	return err;
 }
 
+/*
+ * msgsndv and msgrcvv transfer up to vlen messages in one system call.
+ * Like sendmmsg, they stop at the first error and return the number of
+ * messages transferred, or the error if there were none.
+ */
+SYSCALL_DEFINE4(msgsndv, int, msqid, struct msgvec __user *, vec,
+		unsigned int, vlen, int, msgflg)
+{
+	struct msgvec mv;
+	unsigned int i;
+	long err = 0, mtype;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	for (i = 0; i < vlen; i++) {
+		err = -EFAULT;
+		if (copy_from_user(&mv, vec + i, sizeof(mv)))
+			break;
+		if (get_user(mtype, &mv.msgp->mtype))
+			break;
+		err = do_msgsnd(msqid, mtype, mv.msgp->mtext, mv.msgsz, msgflg);
+		if (err)
+			break;
+	}
+
+	return i ? i : err;
+}
+
+/*
+ * Only the first message is waited for according to msgflg; once one
+ * was received, msgrcvv returns as soon as the queue holds no more
+ * matching messages.
+ */
+SYSCALL_DEFINE4(msgrcvv, int, msqid, struct msgvec __user *, vec,
+		unsigned int, vlen, int, msgflg)
+{
+	struct msgvec mv;
+	unsigned int i;
+	long err = 0, mtype;
+
+	if (vlen > UIO_MAXIOV)
+		vlen = UIO_MAXIOV;
+
+	for (i = 0; i < vlen; i++) {
+		err = -EFAULT;
+		if (copy_from_user(&mv, vec + i, sizeof(mv)))
+			break;
+		err = do_msgrcv(msqid, &mtype, mv.msgp->mtext, mv.msgsz,
+				mv.msgtyp, msgflg);
+		if (err < 0)
+			break;
+		if (put_user(mtype, &mv.msgp->mtype) ||
+		    put_user(err, &vec[i].msglen)) {
+			err = -EFAULT;
+			break;
+		}
+		msgflg |= IPC_NOWAIT;
+	}
+
+	return i ? i : err;
+}
+
 #ifdef CONFIG_PROC_FS
 static int sysvipc_msg_proc_show(struct seq_file *s, void *it)
 {
@@ -27,6 +27,7 @@
  */
 
 #include <linux/cgroup.h>
+#include <linux/cpu.h>
 #include <linux/cred.h>
 #include <linux/ctype.h>
 #include <linux/errno.h>
@@ -38,6 +39,7 @@
 #include <linux/mutex.h>
 #include <linux/mount.h>
 #include <linux/pagemap.h>
+#include <linux/percpu_rwsem.h>
 #include <linux/proc_fs.h>
 #include <linux/rcupdate.h>
 #include <linux/sched.h>
@@ -2035,12 +2037,90 @@ int cgroup_attach_task_all(struct task_struct *from, struct task_struct *tsk)
 }
 EXPORT_SYMBOL_GPL(cgroup_attach_task_all);
 
+/*
+ * Forks and exits of threads are far more common than cgroup migrations,
+ * so instead of a rwsem per thread group every thread group shares one
+ * percpu rwsem: threadgroup_change_begin/end() costs a per-cpu counter
+ * update and threadgroup_lock() is the expensive side.
+ */
+DEFINE_STATIC_PERCPU_RWSEM(cgroup_threadgroup_rwsem);
+
+/**
+ * threadgroup_change_begin - mark the beginning of changes to a threadgroup
+ * @tsk: task causing the changes
+ *
+ * fork and exit paths call this to exclude threadgroup_lock() while a new
+ * thread is added to the group or an existing one sets PF_EXITING.
+ */
+void threadgroup_change_begin(struct task_struct *tsk)
+{
+	percpu_down_read(&cgroup_threadgroup_rwsem);
+}
+
+/**
+ * threadgroup_change_end - mark the end of changes to a threadgroup
+ * @tsk: task causing the changes
+ *
+ * See threadgroup_change_begin().
+ */
+void threadgroup_change_end(struct task_struct *tsk)
+{
+	percpu_up_read(&cgroup_threadgroup_rwsem);
+}
+
+/**
+ * threadgroup_lock - lock threadgroup
+ * @tsk: member task of the threadgroup to lock
+ *
+ * Lock the threadgroup @tsk belongs to.  No new task is allowed to enter
+ * and member tasks aren't allowed to exit (as indicated by PF_EXITING) or
+ * perform exec.  This is useful for cases where the threadgroup needs to
+ * stay stable across blockable operations.
+ *
+ * fork and exit paths explicitly call threadgroup_change_{begin|end}() for
+ * synchronization.  While held, no new task will be added to threadgroup
+ * and no existing live task will have its PF_EXITING set.  The lock is
+ * shared by all threadgroups, so this also holds up forks and exits of
+ * unrelated ones.
+ *
+ * During exec, a task goes and puts its thread group through unusual
+ * changes.  After de-threading, exclusive access is assumed to resources
+ * which are usually shared by tasks in the same group - e.g. sighand may
+ * be replaced with a new one.  Also, the exec'ing task takes over group
+ * leader role including its pid.  Exclude these changes while locked by
+ * grabbing cred_guard_mutex which is used to synchronize exec path.
+ *
+ * Taking the lock waits for an RCU grace period, which needs
+ * get_online_cpus(); callers must already hold it.
+ */
+void threadgroup_lock(struct task_struct *tsk)
+{
+	/*
+	 * exec uses exit for de-threading nesting the threadgroup rwsem
+	 * inside cred_guard_mutex. Grab cred_guard_mutex first.
+	 */
+	mutex_lock(&tsk->signal->cred_guard_mutex);
+	percpu_down_write(&cgroup_threadgroup_rwsem);
+}
+
+/**
+ * threadgroup_unlock - unlock threadgroup
+ * @tsk: member task of the threadgroup to unlock
+ *
+ * Reverse threadgroup_lock().
+ */
+void threadgroup_unlock(struct task_struct *tsk)
+{
+	percpu_up_write(&cgroup_threadgroup_rwsem);
+	mutex_unlock(&tsk->signal->cred_guard_mutex);
+}
+
 /**
  * cgroup_attach_proc - attach all threads in a threadgroup to a cgroup
  * @cgrp: the cgroup to attach to
  * @leader: the threadgroup leader task_struct of the group to be attached
  *
- * Call holding cgroup_mutex and the group_rwsem of the leader. Will take
+ * Call holding cgroup_mutex and the threadgroup lock of the leader. Will take
  * task_lock of each thread in leader's threadgroup individually in turn.
  */
 static int cgroup_attach_proc(struct cgroup *cgrp, struct task_struct *leader)
@@ -2059,7 +2139,7 @@ static int cgroup_attach_proc(struct cgroup *cgrp, struct task_struct *leader)
 	 * step 0: in order to do expensive, possibly blocking operations for
 	 * every thread, we cannot iterate the thread group list, since it needs
 	 * rcu or tasklist locked. instead, build an array of all threads in the
-	 * group - group_rwsem prevents new threads from appearing, and if
+	 * group - threadgroup_lock() prevents new threads from appearing, and if
 	 * threads exit, this will just be an over-estimate.
 	 */
 	group_size = get_nr_threads(leader);
@@ -2198,8 +2278,12 @@ static int attach_task_by_pid(struct cgroup *cgrp, u64 pid, bool threadgroup)
 	const struct cred *cred = current_cred(), *tcred;
 	int ret;
 
-	if (!cgroup_lock_live_group(cgrp))
+	/* threadgroup_lock() needs it, and it nests outside cgroup_mutex */
+	get_online_cpus();
+	if (!cgroup_lock_live_group(cgrp)) {
+		put_online_cpus();
 		return -ENODEV;
+	}
 
 retry_find_task:
 	rcu_read_lock();
@@ -2264,6 +2348,7 @@ retry_find_task:
 	put_task_struct(tsk);
 out_unlock_cgroup:
 	cgroup_unlock();
+	put_online_cpus();
 	return ret;
 }
 
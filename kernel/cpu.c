@@ -17,6 +17,7 @@
 #include <linux/kthread.h>
 #include <linux/stop_machine.h>
 #include <linux/mutex.h>
+#include <linux/percpu_rwsem.h>
 #include <linux/gfp.h>
 #include <linux/suspend.h>
 
@@ -49,84 +50,63 @@ static int cpu_hotplug_disabled;
 
 #ifdef CONFIG_HOTPLUG_CPU
 
-static struct {
-	struct task_struct *active_writer;
-	struct mutex lock; /* Synchronizes accesses to refcount, */
-	/*
-	 * Also blocks the new readers during
-	 * an ongoing cpu hotplug operation.
-	 */
-	int refcount;
-} cpu_hotplug = {
-	.active_writer = NULL,
-	.lock = __MUTEX_INITIALIZER(cpu_hotplug.lock),
-	.refcount = 0,
-};
+/*
+ * Readers of the online cpu maps far outnumber hotplug operations, so
+ * readers only touch a per-cpu counter and the hotplug writer pays for
+ * it with two RCU-sched grace periods.
+ */
+static struct task_struct *cpu_hotplug_writer;
+DEFINE_STATIC_PERCPU_RWSEM(cpu_hotplug_rwsem);
 
+/*
+ * get_online_cpus() nests, which a percpu rwsem does not allow: a
+ * pending writer would block the inner reader while waiting for the
+ * outer one. Only the outermost call takes the semaphore, the nesting
+ * depth is kept in current->cpuhp_ref.
+ */
 void get_online_cpus(void)
 {
 	might_sleep();
-	if (cpu_hotplug.active_writer == current)
+	if (cpu_hotplug_writer == current)
 		return;
-	mutex_lock(&cpu_hotplug.lock);
-	cpu_hotplug.refcount++;
-	mutex_unlock(&cpu_hotplug.lock);
-
+	if (current->cpuhp_ref++)
+		return;
+	percpu_down_read(&cpu_hotplug_rwsem);
 }
 EXPORT_SYMBOL_GPL(get_online_cpus);
 
 void put_online_cpus(void)
 {
-	if (cpu_hotplug.active_writer == current)
+	if (cpu_hotplug_writer == current)
 		return;
-	mutex_lock(&cpu_hotplug.lock);
-	if (!--cpu_hotplug.refcount && unlikely(cpu_hotplug.active_writer))
-		wake_up_process(cpu_hotplug.active_writer);
-	mutex_unlock(&cpu_hotplug.lock);
-
+	if (WARN_ON_ONCE(!current->cpuhp_ref))
+		return;
+	if (--current->cpuhp_ref)
+		return;
+	percpu_up_read(&cpu_hotplug_rwsem);
 }
 EXPORT_SYMBOL_GPL(put_online_cpus);
 
 /*
- * This ensures that the hotplug operation can begin only when the
- * refcount goes to zero.
- *
- * Note that during a cpu-hotplug operation, the new readers, if any,
- * will be blocked by the cpu_hotplug.lock
+ * This ensures that the hotplug operation can begin only when all
+ * readers have left, and keeps new readers out until it is done.
  *
  * Since cpu_hotplug_begin() is always called after invoking
  * cpu_maps_update_begin(), we can be sure that only one writer is active.
  *
- * Note that theoretically, there is a possibility of a livelock:
- * - Refcount goes to zero, last reader wakes up the sleeping
- *   writer.
- * - Last reader unlocks the cpu_hotplug.lock.
- * - A new reader arrives at this moment, bumps up the refcount.
- * - The writer acquires the cpu_hotplug.lock finds the refcount
- *   non zero and goes to sleep again.
- *
- * However, this is very difficult to achieve in practice since
- * get_online_cpus() not an api which is called all that often.
- *
+ * The writer is marked before taking the semaphore: the grace period
+ * it waits for calls get_online_cpus() itself.
  */
 static void cpu_hotplug_begin(void)
 {
-	cpu_hotplug.active_writer = current;
-
-	for (;;) {
-		mutex_lock(&cpu_hotplug.lock);
-		if (likely(!cpu_hotplug.refcount))
-			break;
-		__set_current_state(TASK_UNINTERRUPTIBLE);
-		mutex_unlock(&cpu_hotplug.lock);
-		schedule();
-	}
+	cpu_hotplug_writer = current;
+	percpu_down_write(&cpu_hotplug_rwsem);
 }
 
 static void cpu_hotplug_done(void)
 {
-	cpu_hotplug.active_writer = NULL;
-	mutex_unlock(&cpu_hotplug.lock);
+	percpu_up_write(&cpu_hotplug_rwsem);
+	cpu_hotplug_writer = NULL;
 }
 
 #else /* #if CONFIG_HOTPLUG_CPU */
@@ -335,6 +315,66 @@ out:
 EXPORT_SYMBOL(cpu_down);
 #endif /*CONFIG_HOTPLUG_CPU*/
 
+/*
+ * Time spent in the steps of _cpu_up(), summed over all CPUs brought up
+ * since the last cpu_up_report_timing(): the CPU_UP_PREPARE notifiers,
+ * the arch code kicking the CPU until it is online, and the CPU_ONLINE
+ * notifiers. Only successful bringups are counted. Protected by
+ * cpu_add_remove_lock.
+ */
+enum {
+	CPU_UP_STEP_PREPARE,
+	CPU_UP_STEP_BRINGUP,
+	CPU_UP_STEP_ONLINE,
+	CPU_UP_NR_STEPS,
+};
+
+static const char * const cpu_up_step_names[CPU_UP_NR_STEPS] = {
+	"prepare", "bringup", "online",
+};
+
+static u64 cpu_up_step_ns[CPU_UP_NR_STEPS];
+static unsigned int cpu_up_nr_timed;
+
+static void __cpuinit cpu_up_account(unsigned int cpu,
+				     u64 ts[CPU_UP_NR_STEPS + 1])
+{
+	int i;
+
+	for (i = 0; i < CPU_UP_NR_STEPS; i++)
+		cpu_up_step_ns[i] += ts[i + 1] - ts[i];
+	cpu_up_nr_timed++;
+
+	pr_debug("CPU%u up: prepare %lluus bringup %lluus online %lluus\n",
+		 cpu, div_u64(ts[1] - ts[0], NSEC_PER_USEC),
+		 div_u64(ts[2] - ts[1], NSEC_PER_USEC),
+		 div_u64(ts[3] - ts[2], NSEC_PER_USEC));
+}
+
+/**
+ * cpu_up_report_timing - print where the time bringing up CPUs went
+ *
+ * Prints the per-step totals accumulated since the previous call and
+ * resets them. Called by smp_init() once the boot CPUs are up.
+ */
+void cpu_up_report_timing(void)
+{
+	int i;
+
+	cpu_maps_update_begin();
+	if (cpu_up_nr_timed) {
+		printk(KERN_INFO "CPU bringup of %u CPUs:", cpu_up_nr_timed);
+		for (i = 0; i < CPU_UP_NR_STEPS; i++) {
+			printk(KERN_CONT " %s %llums", cpu_up_step_names[i],
+			       div_u64(cpu_up_step_ns[i], NSEC_PER_MSEC));
+			cpu_up_step_ns[i] = 0;
+		}
+		printk(KERN_CONT "\n");
+		cpu_up_nr_timed = 0;
+	}
+	cpu_maps_update_done();
+}
+
 /* Requires cpu_add_remove_lock to be held */
 static int __cpuinit _cpu_up(unsigned int cpu, int tasks_frozen)
 {
@@ -342,6 +382,7 @@ static int __cpuinit _cpu_up(unsigned int cpu, int tasks_frozen)
 	void *hcpu = (void *)(long)cpu;
 	unsigned long mod = tasks_frozen ? CPU_TASKS_FROZEN : 0;
 	struct task_struct *idle;
+	u64 ts[CPU_UP_NR_STEPS + 1];
 
 	if (cpu_online(cpu) || !cpu_present(cpu))
 		return -EINVAL;
@@ -354,6 +395,7 @@ static int __cpuinit _cpu_up(unsigned int cpu, int tasks_frozen)
 		goto out;
 	}
 
+	ts[CPU_UP_STEP_PREPARE] = local_clock();
 	ret = __cpu_notify(CPU_UP_PREPARE | mod, hcpu, -1, &nr_calls);
 	if (ret) {
 		nr_calls--;
@@ -363,13 +405,17 @@ static int __cpuinit _cpu_up(unsigned int cpu, int tasks_frozen)
 	}
 
 	/* Arch-specific enabling code. */
+	ts[CPU_UP_STEP_BRINGUP] = local_clock();
 	ret = __cpu_up(cpu, idle);
 	if (ret != 0)
 		goto out_notify;
 	BUG_ON(!cpu_online(cpu));
 
 	/* Now call notifier in preparation. */
+	ts[CPU_UP_STEP_ONLINE] = local_clock();
 	cpu_notify(CPU_ONLINE | mod, hcpu);
+	ts[CPU_UP_NR_STEPS] = local_clock();
+	cpu_up_account(cpu, ts);
 
 out_notify:
 	if (ret != 0)
@@ -2,6 +2,7 @@
 #define _KERNEL_EVENTS_INTERNAL_H
 
 #include <linux/hardirq.h>
+#include <linux/uaccess.h>
 
 /* Buffer handling */
 
@@ -16,6 +17,7 @@ struct ring_buffer {
 #endif
 	int				nr_pages;	/* nr of data pages  */
 	int				writable;	/* are we writable   */
+	int				paused;		/* output paused     */
 
 	atomic_t			poll;		/* POLL_ for wakeups */
 
@@ -34,6 +36,11 @@ struct ring_buffer {
 	void				*data_pages[0];
 };
 
+static inline bool is_write_backward(struct perf_event *event)
+{
+	return !!event->attr.write_backward;
+}
+
 extern void rb_free(struct ring_buffer *rb);
 extern struct ring_buffer *
 rb_alloc(int nr_pages, long watermark, int cpu, int flags);
@@ -100,6 +107,41 @@ __output_copy(struct perf_output_handle *handle,
 	} while (len);
 }
 
+/*
+ * Copy from userspace without sleeping: stops at the first fault and
+ * returns the number of bytes that could not be copied.
+ */
+static inline unsigned int
+__output_copy_user(struct perf_output_handle *handle,
+		   const void __user *buf, unsigned int len)
+{
+	do {
+		unsigned long size = min_t(unsigned long, handle->size, len);
+		unsigned long written;
+
+		written = size - __copy_from_user_inatomic(handle->addr,
+							   buf, size);
+
+		len -= written;
+		handle->addr += written;
+		buf += written;
+		handle->size -= written;
+		if (!handle->size) {
+			struct ring_buffer *rb = handle->rb;
+
+			handle->page++;
+			handle->page &= rb->nr_pages - 1;
+			handle->addr = rb->data_pages[handle->page];
+			handle->size = PAGE_SIZE << page_order(rb);
+		}
+
+		if (written != size)
+			break;
+	} while (len);
+
+	return len;
+}
+
 /* Callchain handling */
 extern struct perf_callchain_entry *
 perf_callchain(struct perf_event *event, struct pt_regs *regs);
@@ -102,7 +102,7 @@ int perf_output_begin(struct perf_output_handle *handle,
 {
 	struct ring_buffer *rb;
 	unsigned long tail, offset, head;
-	int have_lost;
+	int have_lost, backward;
 	struct perf_sample_data sample_data;
 	struct {
 		struct perf_event_header header;
@@ -127,6 +127,14 @@ int perf_output_begin(struct perf_output_handle *handle,
 	if (!rb->nr_pages)
 		goto out;
 
+	/* a paused buffer is being read, don't overwrite it */
+	if (unlikely(rb->paused)) {
+		local_inc(&rb->lost);
+		goto out;
+	}
+
+	backward = is_write_backward(event);
+
 	have_lost = local_read(&rb->lost);
 	if (have_lost) {
 		lost_event.header.size = sizeof(lost_event);
@@ -146,11 +154,23 @@ int perf_output_begin(struct perf_output_handle *handle,
 		tail = ACCESS_ONCE(rb->user_page->data_tail);
 		smp_rmb();
 		offset = head = local_read(&rb->head);
-		head += size;
+		if (backward)
+			head -= size;
+		else
+			head += size;
 		if (unlikely(!perf_output_space(rb, tail, offset, head)))
 			goto fail;
 	} while (local_cmpxchg(&rb->head, offset, head) != offset);
 
+	/*
+	 * A backward record starts at the new head; the wakeup accounting
+	 * wants the number of bytes written, which -head is for it.
+	 */
+	if (backward) {
+		offset = head;
+		head = -head;
+	}
+
 	if (head - local_read(&rb->wakeup) > rb->watermark)
 		local_add(rb->watermark, &rb->wakeup);
 
@@ -188,6 +208,25 @@ void perf_output_copy(struct perf_output_handle *handle,
 	__output_copy(handle, buf, len);
 }
 
+void perf_output_skip(struct perf_output_handle *handle, unsigned int len)
+{
+	while (len) {
+		unsigned long size = min_t(unsigned long, handle->size, len);
+
+		len -= size;
+		handle->addr += size;
+		handle->size -= size;
+		if (!handle->size) {
+			struct ring_buffer *rb = handle->rb;
+
+			handle->page++;
+			handle->page &= rb->nr_pages - 1;
+			handle->addr = rb->data_pages[handle->page];
+			handle->size = PAGE_SIZE << page_order(rb);
+		}
+	}
+}
+
 void perf_output_end(struct perf_output_handle *handle)
 {
 	perf_output_put_handle(handle);
@@ -60,6 +60,10 @@
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
 #include <linux/ptrace.h>
+#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/prctl.h>
 
 #include <asm/futex.h>
 
@@ -67,8 +71,6 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
-
 /*
  * Futex flags used to encode options to functions and preserve them across
  * restarts.
@@ -148,17 +150,40 @@ struct futex_hash_bucket {
 	struct plist_head chain;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global hash table, sized at boot to 256 buckets per possible CPU
+ * and spread over the NUMA nodes by alloc_large_system_hash() (hashdist).
+ */
+static unsigned long __read_mostly futex_hashsize;
+static struct futex_hash_bucket *futex_queues __read_mostly;
+
+/*
+ * Upper bound for PR_SET_FUTEX_HASH, in buckets.
+ */
+#define FUTEX_PRIVATE_HASH_MAX	(1UL << 16)
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
+ *
+ * PROCESS_PRIVATE keys of an mm that set up its own table with
+ * PR_SET_FUTEX_HASH hash into that table. The table is only installed
+ * while the mm has a single user and stays until the mm goes away, and
+ * private keys are only ever built from current->mm, so all users of
+ * the key agree on the table without further synchronization.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))) {
+		struct mm_struct *mm = key->private.mm;
+
+		if (mm->futex_hash)
+			return &mm->futex_hash[hash & mm->futex_hash_mask];
+	}
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -834,18 +859,21 @@ static void __unqueue_futex(struct futex_q *q)
 
 /*
  * The hash bucket lock must be held when this is called.
- * Afterwards, the futex_q must not be accessed.
+ * Afterwards, the futex_q must not be accessed. Callers must ensure
+ * to later call wake_up_q() for the actual wakeups to occur, after
+ * dropping the hash bucket lock, so the woken task does not spin
+ * straight into it.
  */
-static void wake_futex(struct futex_q *q)
+static void mark_wake_futex(struct wake_q_head *wake_q, struct futex_q *q)
 {
 	struct task_struct *p = q->task;
 
 	/*
-	 * We set q->lock_ptr = NULL _before_ we wake up the task. If
-	 * a non-futex wake up happens on another CPU then the task
-	 * might exit and p would dereference a non-existing task
-	 * struct. Prevent this by holding a reference on p across the
-	 * wake up.
+	 * We set q->lock_ptr = NULL _before_ we queue the task for
+	 * wakeup. If a non-futex wake up happens on another CPU then the
+	 * task might exit and p would dereference a non-existing task
+	 * struct. Prevent this by holding a reference on p until
+	 * wake_q_add() has taken its own.
 	 */
 	get_task_struct(p);
 
@@ -859,7 +887,7 @@ static void wake_futex(struct futex_q *q)
 	smp_wmb();
 	q->lock_ptr = NULL;
 
-	wake_up_state(p, TASK_NORMAL);
+	wake_q_add(wake_q, p);
 	put_task_struct(p);
 }
 
@@ -978,6 +1006,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	struct plist_head *head;
 	union futex_key key = FUTEX_KEY_INIT;
 	int ret;
+	WAKE_Q(wake_q);
 
 	if (!bitset)
 		return -EINVAL;
@@ -1001,13 +1030,14 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 			if (!(this->bitset & bitset))
 				continue;
 
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			if (++ret >= nr_wake)
 				break;
 		}
 	}
 
 	spin_unlock(&hb->lock);
+	wake_up_q(&wake_q);
 	put_futex_key(&key);
 out:
 	return ret;
@@ -1026,6 +1056,7 @@ futex_wake_op(u32 __user *uaddr1, unsigned int flags, u32 __user *uaddr2,
 	struct plist_head *head;
 	struct futex_q *this, *next;
 	int ret, op_ret;
+	WAKE_Q(wake_q);
 
 retry:
 	ret = get_futex_key(uaddr1, flags & FLAGS_SHARED, &key1, VERIFY_READ);
@@ -1075,7 +1106,7 @@ retry_private:
 
 	plist_for_each_entry_safe(this, next, head, list) {
 		if (match_futex (&this->key, &key1)) {
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			if (++ret >= nr_wake)
 				break;
 		}
@@ -1087,7 +1118,7 @@ retry_private:
 		op_ret = 0;
 		plist_for_each_entry_safe(this, next, head, list) {
 			if (match_futex (&this->key, &key2)) {
-				wake_futex(this);
+				mark_wake_futex(&wake_q, this);
 				if (++op_ret >= nr_wake2)
 					break;
 			}
@@ -1096,6 +1127,7 @@ retry_private:
 	}
 
 	double_unlock_hb(hb1, hb2);
+	wake_up_q(&wake_q);
 out_put_keys:
 	put_futex_key(&key2);
 out_put_key1:
@@ -1253,6 +1285,7 @@ static int futex_requeue(u32 __user *uaddr1, unsigned int flags,
 	struct plist_head *head1;
 	struct futex_q *this, *next;
 	u32 curval2;
+	WAKE_Q(wake_q);
 
 	if (requeue_pi) {
 		/*
@@ -1397,7 +1430,7 @@ retry_private:
 		 * woken by futex_unlock_pi().
 		 */
 		if (++task_count <= nr_wake && !requeue_pi) {
-			wake_futex(this);
+			mark_wake_futex(&wake_q, this);
 			continue;
 		}
 
@@ -1436,6 +1469,7 @@ retry_private:
 
 out_unlock:
 	double_unlock_hb(hb1, hb2);
+	wake_up_q(&wake_q);
 
 	/*
 	 * drop_futex_key_refs() must be called outside the spinlocks. During
@@ -2710,10 +2744,98 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+static void futex_hash_init_buckets(struct futex_hash_bucket *hb,
+				    unsigned long nr)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr; i++) {
+		plist_head_init(&hb[i].chain);
+		spin_lock_init(&hb[i].lock);
+	}
+}
+
+static int futex_hash_set(unsigned long nr_buckets)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_hash_bucket *hb;
+	size_t size;
+
+	if (!mm)
+		return -EINVAL;
+	if (nr_buckets < 2 || nr_buckets > FUTEX_PRIVATE_HASH_MAX)
+		return -EINVAL;
+	nr_buckets = roundup_pow_of_two(nr_buckets);
+
+	/*
+	 * Once another task shares the mm, its private futexes may be
+	 * queued on the global table; they would be lost by switching.
+	 */
+	if (mm->futex_hash || atomic_read(&mm->mm_users) != 1)
+		return -EBUSY;
+
+	size = nr_buckets * sizeof(*hb);
+	if (size <= PAGE_SIZE)
+		hb = kmalloc(size, GFP_KERNEL);
+	else
+		hb = vmalloc(size);
+	if (!hb)
+		return -ENOMEM;
+	futex_hash_init_buckets(hb, nr_buckets);
+
+	mm->futex_hash_mask = nr_buckets - 1;
+	mm->futex_hash = hb;
+	return 0;
+}
+
+/**
+ * futex_hash_prctl() - PR_SET_FUTEX_HASH and PR_GET_FUTEX_HASH
+ * @option:	the prctl option
+ * @nr_buckets:	requested table size, rounded up to a power of two
+ *
+ * A process with many threads may want its private futexes kept apart
+ * from the rest of the system, so that it neither suffers from nor
+ * causes hash bucket lock contention with unrelated processes. The
+ * table is not inherited over fork().
+ */
+int futex_hash_prctl(int option, unsigned long nr_buckets)
+{
+	struct mm_struct *mm = current->mm;
+
+	switch (option) {
+	case PR_SET_FUTEX_HASH:
+		return futex_hash_set(nr_buckets);
+	case PR_GET_FUTEX_HASH:
+		if (nr_buckets)
+			return -EINVAL;
+		if (!mm || !mm->futex_hash)
+			return 0;
+		return mm->futex_hash_mask + 1;
+	}
+	return -EINVAL;
+}
+
+/*
+ * Called when the last user of @mm is gone; nobody can build a private
+ * key for it any more.
+ */
+void futex_hash_free(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *hb = mm->futex_hash;
+
+	if (!hb)
+		return;
+	mm->futex_hash = NULL;
+	if (is_vmalloc_addr(hb))
+		vfree(hb);
+	else
+		kfree(hb);
+}
+
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2728,10 +2850,19 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	futex_hashsize = 16;
+#else
+	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL,
+					       futex_hashsize, futex_hashsize);
+	futex_hashsize = 1UL << futex_shift;
+
+	futex_hash_init_buckets(futex_queues, futex_hashsize);
 
 	return 0;
 }
@@ -1300,84 +1300,85 @@ valid:
 	return ap;
 }
 
-/* Return error if the kprobe is being re-registered */
-static inline int check_kprobe_rereg(struct kprobe *p)
-{
-	int ret = 0;
-
-	mutex_lock(&kprobe_mutex);
-	if (__get_valid_kprobe(p))
-		ret = -EINVAL;
-	mutex_unlock(&kprobe_mutex);
-
-	return ret;
-}
-
-int __kprobes register_kprobe(struct kprobe *p)
+/*
+ * Check that the probe address can be probed, and pin the module it
+ * is in while it is being patched. Must be called with jump_label_lock
+ * held, since jump_label_text_reserved() needs it.
+ */
+static int __kprobes check_kprobe_address_safe(struct kprobe *p,
+					       struct module **probed_mod)
 {
 	int ret = 0;
-	struct kprobe *old_p;
-	struct module *probed_mod;
-	kprobe_opcode_t *addr;
-
-	addr = kprobe_addr(p);
-	if (IS_ERR(addr))
-		return PTR_ERR(addr);
-	p->addr = addr;
-
-	ret = check_kprobe_rereg(p);
-	if (ret)
-		return ret;
 
-	jump_label_lock();
 	preempt_disable();
+
+	/* Ensure it is not in reserved area nor out of text */
 	if (!kernel_text_address((unsigned long) p->addr) ||
 	    in_kprobes_functions((unsigned long) p->addr) ||
 	    ftrace_text_reserved(p->addr, p->addr) ||
 	    jump_label_text_reserved(p->addr, p->addr)) {
 		ret = -EINVAL;
-		goto cannot_probe;
+		goto out;
 	}
 
-	/* User can pass only KPROBE_FLAG_DISABLED to register_kprobe */
-	p->flags &= KPROBE_FLAG_DISABLED;
-
-	/*
-	 * Check if are we probing a module.
-	 */
-	probed_mod = __module_text_address((unsigned long) p->addr);
-	if (probed_mod) {
-		/* Return -ENOENT if fail. */
-		ret = -ENOENT;
+	/* Check if are we probing a module */
+	*probed_mod = __module_text_address((unsigned long) p->addr);
+	if (*probed_mod) {
 		/*
 		 * We must hold a refcount of the probed module while updating
 		 * its code to prohibit unexpected unloading.
 		 */
-		if (unlikely(!try_module_get(probed_mod)))
-			goto cannot_probe;
+		if (unlikely(!try_module_get(*probed_mod))) {
+			ret = -ENOENT;
+			goto out;
+		}
 
 		/*
 		 * If the module freed .init.text, we couldn't insert
 		 * kprobes in there.
 		 */
-		if (within_module_init((unsigned long)p->addr, probed_mod) &&
-		    probed_mod->state != MODULE_STATE_COMING) {
-			module_put(probed_mod);
-			goto cannot_probe;
+		if (within_module_init((unsigned long)p->addr, *probed_mod) &&
+		    (*probed_mod)->state != MODULE_STATE_COMING) {
+			module_put(*probed_mod);
+			*probed_mod = NULL;
+			ret = -ENOENT;
 		}
-		/* ret will be updated by following code */
 	}
+out:
 	preempt_enable();
-	jump_label_unlock();
 
-	p->nmissed = 0;
-	INIT_LIST_HEAD(&p->list);
-	mutex_lock(&kprobe_mutex);
+	return ret;
+}
 
-	jump_label_lock(); /* needed to call jump_label_text_reserved() */
+/*
+ * Register one kprobe. Caller must hold kprobe_mutex, jump_label_lock,
+ * the online cpus and text_mutex, in that order, so that a batch of
+ * probes can be inserted under a single locking round.
+ */
+static int __kprobes __register_kprobe(struct kprobe *p)
+{
+	int ret;
+	struct kprobe *old_p;
+	struct module *probed_mod = NULL;
+	kprobe_opcode_t *addr;
 
-	get_online_cpus();	/* For avoiding text_mutex deadlock. */
-	mutex_lock(&text_mutex);
+	addr = kprobe_addr(p);
+	if (IS_ERR(addr))
+		return PTR_ERR(addr);
+	p->addr = addr;
+
+	/* Return error if the kprobe is being re-registered */
+	if (__get_valid_kprobe(p))
+		return -EINVAL;
+
+	ret = check_kprobe_address_safe(p, &probed_mod);
+	if (ret)
+		return ret;
+
+	/* User can pass only KPROBE_FLAG_DISABLED to register_kprobe */
+	p->flags &= KPROBE_FLAG_DISABLED;
+	p->nmissed = 0;
+	INIT_LIST_HEAD(&p->list);
 
 	old_p = get_kprobe(p->addr);
 	if (old_p) {
@@ -1401,20 +1402,15 @@ int __kprobes register_kprobe(struct kprobe *p)
 	try_to_optimize_kprobe(p);
 
 out:
-	mutex_unlock(&text_mutex);
-	put_online_cpus();
-	jump_label_unlock();
-	mutex_unlock(&kprobe_mutex);
-
 	if (probed_mod)
 		module_put(probed_mod);
 
 	return ret;
+}
 
-cannot_probe:
-	preempt_enable();
-	jump_label_unlock();
-	return ret;
+int __kprobes register_kprobe(struct kprobe *p)
+{
+	return register_kprobes(&p, 1);
 }
 EXPORT_SYMBOL_GPL(register_kprobe);
 
@@ -1535,20 +1531,38 @@ static void __kprobes __unregister_kprobe_bottom(struct kprobe *p)
 	/* Otherwise, do nothing. */
 }
 
+/*
+ * All the probes of a batch are inserted under one round of locking.
+ * Arming is a breakpoint write per probe, and the jump optimization of
+ * the whole batch is left to the optimizer, which patches them in one
+ * go after a single quiescence wait.
+ */
 int __kprobes register_kprobes(struct kprobe **kps, int num)
 {
 	int i, ret = 0;
 
 	if (num <= 0)
 		return -EINVAL;
+
+	mutex_lock(&kprobe_mutex);
+	jump_label_lock(); /* needed to call jump_label_text_reserved() */
+	get_online_cpus();	/* For avoiding text_mutex deadlock. */
+	mutex_lock(&text_mutex);
+
 	for (i = 0; i < num; i++) {
-		ret = register_kprobe(kps[i]);
-		if (ret < 0) {
-			if (i > 0)
-				unregister_kprobes(kps, i);
+		ret = __register_kprobe(kps[i]);
+		if (ret < 0)
 			break;
-		}
 	}
+
+	mutex_unlock(&text_mutex);
+	put_online_cpus();
+	jump_label_unlock();
+	mutex_unlock(&kprobe_mutex);
+
+	if (ret < 0 && i > 0)
+		unregister_kprobes(kps, i);
+
 	return ret;
 }
 EXPORT_SYMBOL_GPL(register_kprobes);
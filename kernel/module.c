@@ -58,6 +58,8 @@
 #include <linux/jump_label.h>
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
+#include <linux/hash.h>
+#include <linux/dcache.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/module.h>
@@ -248,65 +250,173 @@ static bool each_symbol_in_section(const struct symsearch *arr,
 	return false;
 }
 
-/* Returns true as soon as fn returns true, otherwise false. */
-bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
-				    struct module *owner,
-				    void *data),
-			 void *data)
+static const struct symsearch kernel_symsearch[] = {
+	{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	  NOT_GPL_ONLY, false },
+	{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
+	  __start___kcrctab_gpl,
+	  GPL_ONLY, false },
+	{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
+	  __start___kcrctab_gpl_future,
+	  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+	{ __start___ksymtab_unused, __stop___ksymtab_unused,
+	  __start___kcrctab_unused,
+	  NOT_GPL_ONLY, true },
+	{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
+	  __start___kcrctab_unused_gpl,
+	  GPL_ONLY, true },
+#endif
+};
+
+#define MODULE_SYMSEARCH	ARRAY_SIZE(kernel_symsearch)
+
+/* The export tables of mod, laid out as the kernel's own above. */
+static void module_symsearch(struct module *mod, struct symsearch *arr)
 {
-	struct module *mod;
-	static const struct symsearch arr[] = {
-		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
+	const struct symsearch syms[] = {
+		{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
 		  NOT_GPL_ONLY, false },
-		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
-		  __start___kcrctab_gpl,
+		{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
+		  mod->gpl_crcs,
 		  GPL_ONLY, false },
-		{ __start___ksymtab_gpl_future, __stop___ksymtab_gpl_future,
-		  __start___kcrctab_gpl_future,
+		{ mod->gpl_future_syms,
+		  mod->gpl_future_syms + mod->num_gpl_future_syms,
+		  mod->gpl_future_crcs,
 		  WILL_BE_GPL_ONLY, false },
 #ifdef CONFIG_UNUSED_SYMBOLS
-		{ __start___ksymtab_unused, __stop___ksymtab_unused,
-		  __start___kcrctab_unused,
+		{ mod->unused_syms,
+		  mod->unused_syms + mod->num_unused_syms,
+		  mod->unused_crcs,
 		  NOT_GPL_ONLY, true },
-		{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
-		  __start___kcrctab_unused_gpl,
+		{ mod->unused_gpl_syms,
+		  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
+		  mod->unused_gpl_crcs,
 		  GPL_ONLY, true },
 #endif
 	};
 
-	if (each_symbol_in_section(arr, ARRAY_SIZE(arr), NULL, fn, data))
+	BUILD_BUG_ON(ARRAY_SIZE(syms) != MODULE_SYMSEARCH);
+	memcpy(arr, syms, sizeof(syms));
+}
+
+/* Returns true as soon as fn returns true, otherwise false. */
+bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
+				    struct module *owner,
+				    void *data),
+			 void *data)
+{
+	struct module *mod;
+
+	if (each_symbol_in_section(kernel_symsearch, MODULE_SYMSEARCH,
+				   NULL, fn, data))
 		return true;
 
 	list_for_each_entry_rcu(mod, &modules, list) {
-		struct symsearch arr[] = {
-			{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
-			  NOT_GPL_ONLY, false },
-			{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
-			  mod->gpl_crcs,
-			  GPL_ONLY, false },
-			{ mod->gpl_future_syms,
-			  mod->gpl_future_syms + mod->num_gpl_future_syms,
-			  mod->gpl_future_crcs,
-			  WILL_BE_GPL_ONLY, false },
-#ifdef CONFIG_UNUSED_SYMBOLS
-			{ mod->unused_syms,
-			  mod->unused_syms + mod->num_unused_syms,
-			  mod->unused_crcs,
-			  NOT_GPL_ONLY, true },
-			{ mod->unused_gpl_syms,
-			  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
-			  mod->unused_gpl_crcs,
-			  GPL_ONLY, true },
-#endif
-		};
+		struct symsearch arr[MODULE_SYMSEARCH];
 
-		if (each_symbol_in_section(arr, ARRAY_SIZE(arr), mod, fn, data))
+		module_symsearch(mod, arr);
+		if (each_symbol_in_section(arr, MODULE_SYMSEARCH, mod, fn, data))
 			return true;
 	}
 	return false;
 }
 EXPORT_SYMBOL_GPL(each_symbol_section);
 
+/*
+ * The exports of loaded modules are hashed by name, so that resolving a
+ * symbol does not search the tables of every module in turn; the kernel's
+ * own tables are sorted and searched directly.  Entries are added and
+ * removed together with the module's list entry, and walked under
+ * rcu_read_lock_sched() or module_mutex like the list.
+ */
+#define MODULE_SYMHASH_BITS	10
+
+static struct hlist_head module_symhash_table[1 << MODULE_SYMHASH_BITS];
+
+struct module_symhash_entry {
+	struct hlist_node node;
+	const struct kernel_symbol *sym;
+	const struct symsearch *syms;
+	struct module *owner;
+};
+
+struct module_symhash {
+	struct symsearch syms[MODULE_SYMSEARCH];
+	unsigned int num;
+	struct module_symhash_entry entries[0];
+};
+
+static inline struct hlist_head *module_symhash_head(const char *name)
+{
+	unsigned int hash = full_name_hash((const unsigned char *)name,
+					   strlen(name));
+
+	return &module_symhash_table[hash_32(hash, MODULE_SYMHASH_BITS)];
+}
+
+/* Build mod->symhash, ready to be linked in once mod is on the list. */
+static int module_symhash_init(struct module *mod)
+{
+	struct symsearch arr[MODULE_SYMSEARCH];
+	struct module_symhash *symhash;
+	const struct kernel_symbol *sym;
+	unsigned int i, num = 0;
+
+	module_symsearch(mod, arr);
+	for (i = 0; i < MODULE_SYMSEARCH; i++)
+		num += arr[i].stop - arr[i].start;
+	if (!num)
+		return 0;
+
+	symhash = kmalloc(sizeof(*symhash) + num * sizeof(symhash->entries[0]),
+			  GFP_KERNEL);
+	if (!symhash)
+		return -ENOMEM;
+
+	memcpy(symhash->syms, arr, sizeof(arr));
+	symhash->num = 0;
+	for (i = 0; i < MODULE_SYMSEARCH; i++) {
+		for (sym = arr[i].start; sym < arr[i].stop; sym++) {
+			struct module_symhash_entry *e;
+
+			e = &symhash->entries[symhash->num++];
+			e->sym = sym;
+			e->syms = &symhash->syms[i];
+			e->owner = mod;
+		}
+	}
+	mod->symhash = symhash;
+	return 0;
+}
+
+/* Called under module_mutex. */
+static void module_symhash_link(struct module *mod)
+{
+	struct module_symhash *symhash = mod->symhash;
+	unsigned int i;
+
+	if (!symhash)
+		return;
+	for (i = 0; i < symhash->num; i++) {
+		struct module_symhash_entry *e = &symhash->entries[i];
+
+		hlist_add_head_rcu(&e->node, module_symhash_head(e->sym->name));
+	}
+}
+
+/* Called under module_mutex; free only after synchronize_sched(). */
+static void module_symhash_unlink(struct module *mod)
+{
+	struct module_symhash *symhash = mod->symhash;
+	unsigned int i;
+
+	if (!symhash)
+		return;
+	for (i = 0; i < symhash->num; i++)
+		hlist_del_rcu(&symhash->entries[i].node);
+}
+
 struct find_symbol_arg {
 	/* Input */
 	const char *name;
@@ -382,6 +492,20 @@ static bool find_symbol_in_section(const struct symsearch *syms,
 	return false;
 }
 
+static bool find_symbol_in_modules(struct find_symbol_arg *fsa)
+{
+	struct module_symhash_entry *e;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(e, node, module_symhash_head(fsa->name),
+				 node) {
+		if (strcmp(e->sym->name, fsa->name) == 0)
+			return check_symbol(e->syms, e->owner,
+					    e->sym - e->syms->start, fsa);
+	}
+	return false;
+}
+
 /* Find a symbol and return it, along with, (optional) crc and
  * (optional) module which owns it.  Needs preempt disabled or module_mutex. */
 const struct kernel_symbol *find_symbol(const char *name,
@@ -396,7 +520,9 @@ const struct kernel_symbol *find_symbol(const char *name,
 	fsa.gplok = gplok;
 	fsa.warn = warn;
 
-	if (each_symbol_section(find_symbol_in_section, &fsa)) {
+	if (each_symbol_in_section(kernel_symsearch, MODULE_SYMSEARCH, NULL,
+				   find_symbol_in_section, &fsa) ||
+	    find_symbol_in_modules(&fsa)) {
 		if (owner)
 			*owner = fsa.owner;
 		if (crc)
@@ -1671,6 +1797,7 @@ static int __unlink_module(void *_mod)
 {
 	struct module *mod = _mod;
 	list_del(&mod->list);
+	module_symhash_unlink(mod);
 	module_bug_cleanup(mod);
 	return 0;
 }
@@ -1822,6 +1949,7 @@ static void free_module(struct module *mod)
 	unset_module_init_ro_nx(mod);
 	module_free(mod, mod->module_init);
 	kfree(mod->args);
+	kfree(mod->symhash);
 	percpu_modfree(mod);
 
 	/* Free lock-classes: */
@@ -2924,6 +3052,10 @@ static struct module *load_module(void __user *umod,
 		goto free_arch_cleanup;
 	}
 
+	err = module_symhash_init(mod);
+	if (err < 0)
+		goto free_args;
+
 	/* Mark state as coming so strong_try_module_get() ignores us. */
 	mod->state = MODULE_STATE_COMING;
 
@@ -2950,6 +3082,7 @@ static struct module *load_module(void __user *umod,
 
 	module_bug_finalize(info.hdr, info.sechdrs, mod);
 	list_add_rcu(&mod->list, &modules);
+	module_symhash_link(mod);
 	mutex_unlock(&module_mutex);
 
 	/* Module is ready to execute: parsing args may do that. */
@@ -2974,6 +3107,7 @@ static struct module *load_module(void __user *umod,
 	mutex_lock(&module_mutex);
 	/* Unlink carefully: kallsyms could be walking list. */
 	list_del_rcu(&mod->list);
+	module_symhash_unlink(mod);
 	module_bug_cleanup(mod);
 
  ddebug:
@@ -2981,6 +3115,8 @@ static struct module *load_module(void __user *umod,
  unlock:
 	mutex_unlock(&module_mutex);
 	synchronize_sched();
+	kfree(mod->symhash);
+ free_args:
 	kfree(mod->args);
  free_arch_cleanup:
 	module_arch_cleanup(mod);
@@ -3039,6 +3175,7 @@ SYSCALL_DEFINE3(init_module, void __user *, umod,
 
 	do_mod_ctors(mod);
 	/* Start the module */
+	current->flags &= ~PF_USED_ASYNC;
 	if (mod->init != NULL)
 		ret = do_one_initcall(mod->init);
 	if (ret < 0) {
@@ -3068,8 +3205,14 @@ SYSCALL_DEFINE3(init_module, void __user *, umod,
 	blocking_notifier_call_chain(&module_notify_list,
 				     MODULE_STATE_LIVE, mod);
 
-	/* We need to finish all async code before the module init sequence is done */
-	async_synchronize_full();
+	/*
+	 * We need to finish all async code before the module init sequence
+	 * is done, since it may still be running __init code.  Modules that
+	 * did not schedule any don't wait on everyone else's, so that
+	 * parallel loads do not serialise on each other's async probing.
+	 */
+	if (current->flags & PF_USED_ASYNC)
+		async_synchronize_full();
 
 	mutex_lock(&module_mutex);
 	/* Drop initial reference. */
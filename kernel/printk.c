@@ -42,6 +42,7 @@
 #include <linux/notifier.h>
 #include <linux/rculist.h>
 #include <linux/poll.h>
+#include <linux/kthread.h>
 
 #include <asm/uaccess.h>
 
@@ -126,6 +127,9 @@ EXPORT_SYMBOL(console_set_on_cmdline);
 /* Flag: console code may call schedule() */
 static int console_may_schedule;
 
+/* Thread doing the console output on behalf of printk() */
+static struct task_struct *printk_kthread;
+
 /*
  * The printk log buffer consists of a chain of concatenated variable
  * length records. Every record starts with a record header, containing
@@ -1247,6 +1251,11 @@ module_param(ignore_loglevel, bool, S_IRUGO | S_IWUSR);
 MODULE_PARM_DESC(ignore_loglevel, "ignore loglevel setting, to"
 	"print all kernel messages to the console.");
 
+static bool __read_mostly printk_synchronous;
+module_param_named(synchronous, printk_synchronous, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(synchronous, "print to the console from printk() itself "
+	"rather than from the printk kernel thread.");
+
 /*
  * Call the console drivers, asking them to write out
  * log_buf[start] to log_buf[end - 1].
@@ -1361,6 +1370,20 @@ static int console_trylock_for_printk(unsigned int cpu)
 	return retval;
 }
 
+static void wake_up_printk_kthread(void);
+
+/*
+ * Should this message be printed to the console by printk_kthread rather
+ * than by the caller?  Printing happens directly in emergencies (oops,
+ * panic, KERN_EMERG messages), while booting and shutting down, and if
+ * asked to with printk.synchronous.
+ */
+static inline bool printk_offload(int level)
+{
+	return printk_kthread && !printk_synchronous && !oops_in_progress &&
+		system_state == SYSTEM_RUNNING && level > 0;
+}
+
 int printk_delay_msec __read_mostly;
 
 static inline void printk_delay(void)
@@ -1479,13 +1502,20 @@ static size_t cont_print_text(char *text, size_t size)
 	return textlen;
 }
 
+/*
+ * Messages are formatted into a per-CPU buffer with interrupts disabled,
+ * so that logbuf_lock only needs to be held to copy them into the log.
+ * printk_formatting catches printk recursing from within vscnprintf().
+ */
+static DEFINE_PER_CPU(char [LOG_LINE_MAX], printk_textbuf);
+static DEFINE_PER_CPU(int, printk_formatting);
+
 asmlinkage int vprintk_emit(int facility, int level,
 			    const char *dict, size_t dictlen,
 			    const char *fmt, va_list args)
 {
 	static int recursion_bug;
-	static char textbuf[LOG_LINE_MAX];
-	char *text = textbuf;
+	char *text;
 	size_t text_len;
 	enum log_flags lflags = 0;
 	unsigned long flags;
@@ -1502,7 +1532,8 @@ asmlinkage int vprintk_emit(int facility, int level,
 	/*
 	 * Ouch, printk recursed into itself!
 	 */
-	if (unlikely(logbuf_cpu == this_cpu)) {
+	if (unlikely(logbuf_cpu == this_cpu ||
+		     __this_cpu_read(printk_formatting))) {
 		/*
 		 * If a crash is occurring during printk() on this CPU,
 		 * then try to get the crash message out but make sure
@@ -1518,25 +1549,15 @@ asmlinkage int vprintk_emit(int facility, int level,
 	}
 
 	lockdep_off();
-	raw_spin_lock(&logbuf_lock);
-	logbuf_cpu = this_cpu;
-
-	if (recursion_bug) {
-		static const char recursion_msg[] =
-			"BUG: recent printk recursion!";
-
-		recursion_bug = 0;
-		printed_len += strlen(recursion_msg);
-		/* emit KERN_CRIT message */
-		log_store(0, 2, LOG_PREFIX|LOG_NEWLINE, 0,
-			  NULL, 0, recursion_msg, printed_len);
-	}
 
 	/*
 	 * The printf needs to come first; we need the syslog
 	 * prefix which might be passed-in as a parameter.
 	 */
-	text_len = vscnprintf(text, sizeof(textbuf), fmt, args);
+	__this_cpu_write(printk_formatting, 1);
+	text = __get_cpu_var(printk_textbuf);
+	text_len = vscnprintf(text, LOG_LINE_MAX, fmt, args);
+	__this_cpu_write(printk_formatting, 0);
 
 	/* mark and strip a trailing newline */
 	if (text_len && text[text_len-1] == '\n') {
@@ -1570,6 +1591,20 @@ asmlinkage int vprintk_emit(int facility, int level,
 	if (dict)
 		lflags |= LOG_PREFIX|LOG_NEWLINE;
 
+	raw_spin_lock(&logbuf_lock);
+	logbuf_cpu = this_cpu;
+
+	if (recursion_bug) {
+		static const char recursion_msg[] =
+			"BUG: recent printk recursion!";
+
+		recursion_bug = 0;
+		printed_len += strlen(recursion_msg);
+		/* emit KERN_CRIT message */
+		log_store(0, 2, LOG_PREFIX|LOG_NEWLINE, 0,
+			  NULL, 0, recursion_msg, printed_len);
+	}
+
 	if (!(lflags & LOG_NEWLINE)) {
 		/*
 		 * Flush the conflicting buffer. An earlier newline was missing,
@@ -1603,16 +1638,24 @@ asmlinkage int vprintk_emit(int facility, int level,
 	}
 	printed_len += text_len;
 
-	/*
-	 * Try to acquire and then immediately release the console semaphore.
-	 * The release will print out buffers and wake up /dev/kmsg and syslog()
-	 * users.
-	 *
-	 * The console_trylock_for_printk() function will release 'logbuf_lock'
-	 * regardless of whether it actually gets the console semaphore or not.
-	 */
-	if (console_trylock_for_printk(this_cpu))
-		console_unlock();
+	if (printk_offload(level)) {
+		/* Leave the console output to printk_kthread */
+		logbuf_cpu = UINT_MAX;
+		raw_spin_unlock(&logbuf_lock);
+		wake_up_printk_kthread();
+	} else {
+		/*
+		 * Try to acquire and then immediately release the console
+		 * semaphore. The release will print out buffers and wake up
+		 * /dev/kmsg and syslog() users.
+		 *
+		 * The console_trylock_for_printk() function will release
+		 * 'logbuf_lock' regardless of whether it actually gets the
+		 * console semaphore or not.
+		 */
+		if (console_trylock_for_printk(this_cpu))
+			console_unlock();
+	}
 
 	lockdep_on();
 out_restore_irqs:
@@ -1952,6 +1995,7 @@ int is_console_locked(void)
 
 #define PRINTK_PENDING_WAKEUP	0x01
 #define PRINTK_PENDING_SCHED	0x02
+#define PRINTK_PENDING_OUTPUT	0x04
 
 static DEFINE_PER_CPU(int, printk_pending);
 static DEFINE_PER_CPU(char [PRINTK_BUF_SIZE], printk_sched_buf);
@@ -1966,6 +2010,8 @@ void printk_tick(void)
 		}
 		if (pending & PRINTK_PENDING_WAKEUP)
 			wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_OUTPUT)
+			wake_up_process(printk_kthread);
 	}
 }
 
@@ -1982,6 +2028,15 @@ void wake_up_klogd(void)
 		this_cpu_or(printk_pending, PRINTK_PENDING_WAKEUP);
 }
 
+/*
+ * printk() may be called with scheduler locks held, so like the klogd
+ * wakeup, waking printk_kthread is deferred to the next tick.
+ */
+static void wake_up_printk_kthread(void)
+{
+	this_cpu_or(printk_pending, PRINTK_PENDING_OUTPUT);
+}
+
 static void console_cont_flush(char *text, size_t size)
 {
 	unsigned long flags;
@@ -2031,6 +2086,7 @@ void console_unlock(void)
 	static u64 seen_seq;
 	unsigned long flags;
 	bool wake_klogd = false;
+	bool yield = false;
 	bool retry;
 
 	if (console_suspended) {
@@ -2094,6 +2150,16 @@ skip:
 		call_console_drivers(level, text, len);
 		start_critical_timings();
 		local_irq_restore(flags);
+
+		/*
+		 * printk_kthread must not monopolize the CPU while messages
+		 * keep coming in, it will be back for the rest.
+		 */
+		if (current == printk_kthread && need_resched()) {
+			yield = true;
+			raw_spin_lock_irqsave(&logbuf_lock, flags);
+			break;
+		}
 	}
 	console_locked = 0;
 
@@ -2115,7 +2181,7 @@ skip:
 	retry = console_seq != log_next_seq;
 	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
 
-	if (retry && console_trylock())
+	if (retry && !yield && console_trylock())
 		goto again;
 
 	if (wake_klogd)
@@ -2123,6 +2189,40 @@ skip:
 }
 EXPORT_SYMBOL(console_unlock);
 
+static bool console_output_pending(void)
+{
+	unsigned long flags;
+	bool pending;
+
+	raw_spin_lock_irqsave(&logbuf_lock, flags);
+	pending = !console_suspended && console_seq != log_next_seq;
+	raw_spin_unlock_irqrestore(&logbuf_lock, flags);
+
+	return pending;
+}
+
+/*
+ * Unless printk_offload() says otherwise, printk() only stores messages
+ * in the log buffer and leaves printing them to this thread.  A burst of
+ * messages to a slow console then no longer stalls whichever tasks happen
+ * to call printk() meanwhile.
+ */
+static int printk_kthread_func(void *data)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!console_output_pending())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		console_lock();
+		console_unlock();
+		cond_resched();
+	}
+
+	return 0;
+}
+
 /**
  * console_conditional_schedule - yield the CPU if required
  *
@@ -2438,6 +2538,13 @@ static int __init printk_late_init(void)
 		}
 	}
 	hotcpu_notifier(console_cpu_notify, 0);
+
+	if (IS_ENABLED(CONFIG_PRINTK)) {
+		struct task_struct *p = kthread_run(printk_kthread_func, NULL,
+						    "printk");
+		if (!IS_ERR(p))
+			printk_kthread = p;
+	}
 	return 0;
 }
 late_initcall(printk_late_init);
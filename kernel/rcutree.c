@@ -52,6 +52,7 @@
 #include <linux/prefetch.h>
 #include <linux/delay.h>
 #include <linux/stop_machine.h>
+#include <linux/tick.h>
 
 #include "rcutree.h"
 #include <trace/events/rcu.h>
@@ -62,7 +63,7 @@
 
 static struct lock_class_key rcu_node_class[RCU_NUM_LVLS];
 
-#define RCU_STATE_INITIALIZER(sname, cr) { \
+#define RCU_STATE_INITIALIZER(sname, sabbr, cr) { \
 	.level = { &sname##_state.node[0] }, \
 	.call = cr, \
 	.fqs_state = RCU_GP_IDLE, \
@@ -74,13 +75,14 @@ static struct lock_class_key rcu_node_class[RCU_NUM_LVLS];
 	.barrier_mutex = __MUTEX_INITIALIZER(sname##_state.barrier_mutex), \
 	.fqslock = __RAW_SPIN_LOCK_UNLOCKED(&sname##_state.fqslock), \
 	.name = #sname, \
+	.abbr = sabbr, \
 }
 
 struct rcu_state rcu_sched_state =
-	RCU_STATE_INITIALIZER(rcu_sched, call_rcu_sched);
+	RCU_STATE_INITIALIZER(rcu_sched, 's', call_rcu_sched);
 DEFINE_PER_CPU(struct rcu_data, rcu_sched_data);
 
-struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh, call_rcu_bh);
+struct rcu_state rcu_bh_state = RCU_STATE_INITIALIZER(rcu_bh, 'b', call_rcu_bh);
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data);
 
 static struct rcu_state *rcu_state;
@@ -658,6 +660,38 @@ int rcu_is_cpu_rrupt_from_idle(void)
 	return __get_cpu_var(rcu_dynticks).dynticks_nesting <= 1;
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+static void rcu_kick_nohz_cpu(int cpu)
+{
+	if (tick_nohz_full_cpu(cpu) && cpu_online(cpu))
+		smp_send_reschedule(cpu);
+}
+
+/*
+ * Does the specified full dynticks CPU need its tick for RCU? That is
+ * the case as long as it has callbacks queued, has not yet noticed the
+ * current grace period or still owes it a quiescent state.
+ */
+int rcu_nohz_full_needs_tick(int cpu)
+{
+	struct rcu_state *rsp;
+	struct rcu_data *rdp;
+
+	for_each_rcu_flavor(rsp) {
+		rdp = per_cpu_ptr(rsp->rda, cpu);
+		if (rdp->nxtlist)
+			return 1;
+		if (rdp->gpnum != ACCESS_ONCE(rdp->mynode->gpnum))
+			return 1;
+		if (rdp->qs_pending && !rdp->passed_quiesce)
+			return 1;
+	}
+	return 0;
+}
+#else
+static inline void rcu_kick_nohz_cpu(int cpu) { }
+#endif
+
 /*
  * Snapshot the specified CPU's dynticks counter so that we can later
  * credit them with an implicit quiescent state.  Return 1 if this CPU
@@ -697,6 +731,13 @@ static int rcu_implicit_dynticks_qs(struct rcu_data *rdp)
 		return 1;
 	}
 
+	/*
+	 * A busy full dynticks CPU runs with its tick stopped and won't
+	 * report a quiescent state by itself: kick it so that it restarts
+	 * the tick until it has done so.
+	 */
+	rcu_kick_nohz_cpu(rdp->cpu);
+
 	/* Go check for the CPU being offline. */
 	return rcu_implicit_offline_qs(rdp);
 }
@@ -1533,6 +1574,16 @@ static void rcu_cleanup_dead_cpu(int cpu, struct rcu_state *rsp)
 
 #endif /* #else #ifdef CONFIG_HOTPLUG_CPU */
 
+/* Account a batch of @count RCU callbacks invoked on behalf of @rdp. */
+static void rcu_account_cb_batch(struct rcu_data *rdp, long count)
+{
+	if (!count)
+		return;
+	rdp->n_cb_batches++;
+	if (count > rdp->max_cb_batch)
+		rdp->max_cb_batch = count;
+}
+
 /*
  * Invoke any RCU callbacks that have made it to the end of their grace
  * period.  Thottle as specified by rdp->blimit.
@@ -1569,8 +1620,14 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 			rdp->nxttail[i] = &rdp->nxtlist;
 	local_irq_restore(flags);
 
-	/* Invoke callbacks. */
+	/* No-CBs CPUs leave callback invocation to their rcuo kthread. */
 	count = count_lazy = 0;
+	if (is_nocb_cpu(rdp->cpu)) {
+		count = rcu_nocb_enqueue(rdp, list, tail, &count_lazy);
+		list = NULL;
+	}
+
+	/* Invoke callbacks. */
 	while (list) {
 		next = list->next;
 		prefetch(next);
@@ -1603,7 +1660,10 @@ static void rcu_do_batch(struct rcu_state *rsp, struct rcu_data *rdp)
 	smp_mb(); /* List handling before counting for rcu_barrier(). */
 	rdp->qlen_lazy -= count_lazy;
 	ACCESS_ONCE(rdp->qlen) -= count;
-	rdp->n_cbs_invoked += count;
+	if (!is_nocb_cpu(rdp->cpu)) {
+		rdp->n_cbs_invoked += count;
+		rcu_account_cb_batch(rdp, count);
+	}
 
 	/* Reinstate batch limit if we have worked down the excess. */
 	if (rdp->blimit == LONG_MAX && rdp->qlen <= qlowmark)
@@ -1958,6 +2018,9 @@ __call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *rcu),
 
 	/* Go handle any RCU core processing required. */
 	__call_rcu_core(rsp, rdp, head, flags);
+
+	/* A full dynticks CPU needs its tick back to process the callback. */
+	tick_nohz_full_kick();
 	local_irq_restore(flags);
 }
 
@@ -2406,9 +2469,12 @@ static void _rcu_barrier(struct rcu_state *rsp)
 			_rcu_barrier_trace(rsp, "Offline", cpu,
 					   rsp->n_barrier_done);
 			preempt_enable();
-			while (cpu_is_offline(cpu) && ACCESS_ONCE(rdp->qlen))
+			while (cpu_is_offline(cpu) &&
+			       (ACCESS_ONCE(rdp->qlen) ||
+				rcu_nocb_cpu_pending(rdp)))
 				schedule_timeout_interruptible(1);
-		} else if (ACCESS_ONCE(rdp->qlen)) {
+		} else if (ACCESS_ONCE(rdp->qlen) ||
+			   rcu_nocb_cpu_pending(rdp)) {
 			_rcu_barrier_trace(rsp, "OnlineQ", cpu,
 					   rsp->n_barrier_done);
 			smp_call_function_single(cpu, rcu_barrier_func, rsp, 1);
@@ -2499,6 +2565,7 @@ rcu_boot_init_percpu_data(int cpu, struct rcu_state *rsp)
 	WARN_ON_ONCE(atomic_read(&rdp->dynticks->dynticks) != 1);
 	rdp->cpu = cpu;
 	rdp->rsp = rsp;
+	rcu_boot_init_nocb_percpu_data(rdp);
 	raw_spin_unlock_irqrestore(&rnp->lock, flags);
 }
 
@@ -74,12 +74,13 @@ static void __init rcu_bootup_announce_oddness(void)
 		printk(KERN_INFO "\tExperimental boot-time adjustment of leaf fanout to %d.\n", rcu_fanout_leaf);
 	if (nr_cpu_ids != NR_CPUS)
 		printk(KERN_INFO "\tRCU restricting CPUs from NR_CPUS=%d to nr_cpu_ids=%d.\n", NR_CPUS, nr_cpu_ids);
+	rcu_init_nocb_mask();
 }
 
 #ifdef CONFIG_TREE_PREEMPT_RCU
 
 struct rcu_state rcu_preempt_state =
-	RCU_STATE_INITIALIZER(rcu_preempt, call_rcu);
+	RCU_STATE_INITIALIZER(rcu_preempt, 'p', call_rcu);
 DEFINE_PER_CPU(struct rcu_data, rcu_preempt_data);
 static struct rcu_state *rcu_state = &rcu_preempt_state;
 
@@ -2227,3 +2228,203 @@ static void increment_cpu_stall_ticks(void)
 }
 
 #endif /* #else #ifdef CONFIG_RCU_CPU_STALL_INFO */
+
+#ifdef CONFIG_RCU_NOCB_CPU
+
+/*
+ * Offload callback invocation from the boot-selected no-CBs CPUs.
+ *
+ * Grace-period processing still happens on the CPU that queued the
+ * callbacks, but once they are ready rcu_do_batch() hands them over to
+ * a per-CPU "rcuo" kthread instead of invoking them from softirq.  The
+ * kthreads are named rcuo<flavor>/<cpu> and may be affined to
+ * housekeeping CPUs, keeping long callback batches (dentry and inode
+ * freeing for example) away from isolated or real-time workloads.
+ */
+
+static cpumask_var_t rcu_nocb_mask; /* CPUs to have callbacks offloaded. */
+static bool have_rcu_nocb_mask;	    /* Was rcu_nocb_mask allocated? */
+
+/* Parse the boot-time rcu_nocbs CPU list from the kernel parameters. */
+static int __init rcu_nocb_setup(char *str)
+{
+	alloc_bootmem_cpumask_var(&rcu_nocb_mask);
+	have_rcu_nocb_mask = true;
+	cpulist_parse(str, rcu_nocb_mask);
+	return 1;
+}
+__setup("rcu_nocbs=", rcu_nocb_setup);
+
+/*
+ * Settle the set of no-CBs CPUs at rcu_init() time: full dynticks CPUs
+ * are always part of it.
+ */
+static void __init rcu_init_nocb_mask(void)
+{
+	char buf[64];
+
+#ifdef CONFIG_NO_HZ_FULL
+	if (tick_nohz_full_running) {
+		if (!have_rcu_nocb_mask) {
+			if (!zalloc_cpumask_var(&rcu_nocb_mask, GFP_NOWAIT))
+				return;
+			have_rcu_nocb_mask = true;
+		}
+		cpumask_or(rcu_nocb_mask, rcu_nocb_mask, tick_nohz_full_mask);
+	}
+#endif /* #ifdef CONFIG_NO_HZ_FULL */
+	if (!have_rcu_nocb_mask)
+		return;
+	cpumask_and(rcu_nocb_mask, rcu_nocb_mask, cpu_possible_mask);
+	cpulist_scnprintf(buf, sizeof(buf), rcu_nocb_mask);
+	printk(KERN_INFO "\tOffload RCU callbacks from CPUs: %s.\n", buf);
+}
+
+/* Is the specified CPU a no-CBs CPU? */
+static bool is_nocb_cpu(int cpu)
+{
+	if (have_rcu_nocb_mask)
+		return cpumask_test_cpu(cpu, rcu_nocb_mask);
+	return false;
+}
+
+/*
+ * Append the list of ready callbacks from @list to @tail to the
+ * specified CPU's rcuo kthread queue, waking the kthread if the queue
+ * was empty.  Returns the number of callbacks handed over, the number
+ * of lazy ones being added to *@lazy.  Called from rcu_do_batch() on
+ * the CPU owning @rdp, so there is a single enqueuer.
+ */
+static int rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail, int *lazy)
+{
+	struct rcu_head **old_tail;
+	struct rcu_head *rhp;
+	int count = 0;
+
+	for (rhp = list; rhp; rhp = rhp->next) {
+		if (__is_kfree_rcu_offset((unsigned long)rhp->func))
+			(*lazy)++;
+		count++;
+	}
+	atomic_long_add(count, &rdp->nocb_q_count);
+	old_tail = xchg(&rdp->nocb_tail, tail);
+	ACCESS_ONCE(*old_tail) = list;
+	if (old_tail == &rdp->nocb_head)
+		wake_up(&rdp->nocb_wq);
+	return count;
+}
+
+/* Does the specified CPU have handed-over callbacks not yet invoked? */
+static bool rcu_nocb_cpu_pending(struct rcu_data *rdp)
+{
+	return atomic_long_read(&rdp->nocb_q_count) != 0;
+}
+
+/*
+ * Per-rcu_data kthread, invoking the callbacks its CPU handed over.
+ */
+static int rcu_nocb_kthread(void *arg)
+{
+	int c, cl;
+	struct rcu_head *list;
+	struct rcu_head *next;
+	struct rcu_head **tail;
+	struct rcu_data *rdp = arg;
+
+	for (;;) {
+		wait_event_interruptible(rdp->nocb_wq,
+					 ACCESS_ONCE(rdp->nocb_head));
+		list = ACCESS_ONCE(rdp->nocb_head);
+		if (!list)
+			continue;
+
+		/* Take the whole queue, leaving an empty one behind. */
+		ACCESS_ONCE(rdp->nocb_head) = NULL;
+		tail = xchg(&rdp->nocb_tail, &rdp->nocb_head);
+
+		trace_rcu_batch_start(rdp->rsp->name, 0,
+				      atomic_long_read(&rdp->nocb_q_count), -1);
+		c = cl = 0;
+		while (list) {
+			next = list->next;
+			/* Wait for enqueuing to complete, if needed. */
+			while (next == NULL && &list->next != tail) {
+				schedule_timeout_interruptible(1);
+				next = ACCESS_ONCE(list->next);
+			}
+			debug_rcu_head_unqueue(list);
+			local_bh_disable();
+			if (__rcu_reclaim(rdp->rsp->name, list))
+				cl++;
+			c++;
+			local_bh_enable();
+			list = next;
+			cond_resched();
+		}
+		trace_rcu_batch_end(rdp->rsp->name, c, !!list, 0, 0, 1);
+		smp_mb__before_atomic_dec(); /* Invoke before rcu_barrier() count. */
+		atomic_long_sub(c, &rdp->nocb_q_count);
+		rdp->n_nocbs_invoked += c;
+		rcu_account_cb_batch(rdp, c);
+	}
+	return 0;
+}
+
+/* Initialize per-rcu_data variables for no-CBs CPUs. */
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+	rdp->nocb_tail = &rdp->nocb_head;
+	init_waitqueue_head(&rdp->nocb_wq);
+}
+
+/* Create a kthread for each RCU flavor for each no-CBs CPU. */
+static int __init rcu_spawn_nocb_kthreads(void)
+{
+	int cpu;
+	struct rcu_data *rdp;
+	struct rcu_state *rsp;
+	struct task_struct *t;
+
+	if (!have_rcu_nocb_mask)
+		return 0;
+	for_each_rcu_flavor(rsp) {
+		for_each_cpu(cpu, rcu_nocb_mask) {
+			rdp = per_cpu_ptr(rsp->rda, cpu);
+			t = kthread_run(rcu_nocb_kthread, rdp,
+					"rcuo%c/%d", rsp->abbr, cpu);
+			BUG_ON(IS_ERR(t));
+			ACCESS_ONCE(rdp->nocb_kthread) = t;
+		}
+	}
+	return 0;
+}
+early_initcall(rcu_spawn_nocb_kthreads);
+
+#else /* #ifdef CONFIG_RCU_NOCB_CPU */
+
+static void __init rcu_init_nocb_mask(void)
+{
+}
+
+static bool is_nocb_cpu(int cpu)
+{
+	return false;
+}
+
+static int rcu_nocb_enqueue(struct rcu_data *rdp, struct rcu_head *list,
+			    struct rcu_head **tail, int *lazy)
+{
+	return 0;
+}
+
+static bool rcu_nocb_cpu_pending(struct rcu_data *rdp)
+{
+	return false;
+}
+
+static void __init rcu_boot_init_nocb_percpu_data(struct rcu_data *rdp)
+{
+}
+
+#endif /* #else #ifdef CONFIG_RCU_NOCB_CPU */
@@ -22,54 +22,81 @@ void res_counter_init(struct res_counter *counter, struct res_counter *parent)
 	counter->parent = parent;
 }
 
-int res_counter_charge_locked(struct res_counter *counter, unsigned long val,
-			      bool force)
+/*
+ * limit and max_usage are only written under counter->lock.  That is
+ * enough for reading them locklessly where a 64 bit load is atomic.
+ */
+static inline unsigned long long
+res_counter_peek(struct res_counter *counter, unsigned long long *val)
 {
-	int ret = 0;
-
-	if (counter->usage + val > counter->limit) {
-		counter->failcnt++;
-		ret = -ENOMEM;
-		if (!force)
-			return ret;
-	}
+#if BITS_PER_LONG == 32
+	unsigned long long ret;
+	unsigned long flags;
 
-	counter->usage += val;
-	if (counter->usage > counter->max_usage)
-		counter->max_usage = counter->usage;
+	spin_lock_irqsave(&counter->lock, flags);
+	ret = *val;
+	spin_unlock_irqrestore(&counter->lock, flags);
 	return ret;
+#else
+	return ACCESS_ONCE(*val);
+#endif
+}
+
+static void res_counter_fail(struct res_counter *counter)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&counter->lock, flags);
+	counter->failcnt++;
+	spin_unlock_irqrestore(&counter->lock, flags);
+}
+
+static void res_counter_update_max(struct res_counter *counter,
+				   unsigned long long usage)
+{
+	unsigned long flags;
+
+	if (usage <= res_counter_peek(counter, &counter->max_usage))
+		return;
+
+	spin_lock_irqsave(&counter->lock, flags);
+	if (usage > counter->max_usage)
+		counter->max_usage = usage;
+	spin_unlock_irqrestore(&counter->lock, flags);
 }
 
+/*
+ * The usage is added first and checked against the limit afterwards, so
+ * two racing charges may both see the other one and both fail although
+ * one of them would have fit.  That is fine, the callers reclaim and
+ * retry anyway.  A charge never succeeds with the usage above the limit.
+ */
 static int __res_counter_charge(struct res_counter *counter, unsigned long val,
 				struct res_counter **limit_fail_at, bool force)
 {
-	int ret, r;
-	unsigned long flags;
-	struct res_counter *c, *u;
+	int ret = 0;
+	struct res_counter *c;
 
-	r = ret = 0;
 	*limit_fail_at = NULL;
-	local_irq_save(flags);
 	for (c = counter; c != NULL; c = c->parent) {
-		spin_lock(&c->lock);
-		r = res_counter_charge_locked(c, val, force);
-		spin_unlock(&c->lock);
-		if (r < 0 && !ret) {
-			ret = r;
-			*limit_fail_at = c;
-			if (!force)
+		unsigned long long usage = atomic64_add_return(val, &c->usage);
+
+		if (usage > res_counter_peek(c, &c->limit)) {
+			res_counter_fail(c);
+			if (!ret) {
+				ret = -ENOMEM;
+				*limit_fail_at = c;
+			}
+			if (!force) {
+				atomic64_sub(val, &c->usage);
 				break;
+			}
 		}
+		res_counter_update_max(c, usage);
 	}
 
-	if (ret < 0 && !force) {
-		for (u = counter; u != c; u = u->parent) {
-			spin_lock(&u->lock);
-			res_counter_uncharge_locked(u, val);
-			spin_unlock(&u->lock);
-		}
-	}
-	local_irq_restore(flags);
+	if (ret < 0 && !force)
+		res_counter_uncharge_until(counter, c, val);
 
 	return ret;
 }
@@ -86,28 +113,18 @@ int res_counter_charge_nofail(struct res_counter *counter, unsigned long val,
 	return __res_counter_charge(counter, val, limit_fail_at, true);
 }
 
-void res_counter_uncharge_locked(struct res_counter *counter, unsigned long val)
-{
-	if (WARN_ON(counter->usage < val))
-		val = counter->usage;
-
-	counter->usage -= val;
-}
-
 void res_counter_uncharge_until(struct res_counter *counter,
 				struct res_counter *top,
 				unsigned long val)
 {
-	unsigned long flags;
 	struct res_counter *c;
 
-	local_irq_save(flags);
 	for (c = counter; c != top; c = c->parent) {
-		spin_lock(&c->lock);
-		res_counter_uncharge_locked(c, val);
-		spin_unlock(&c->lock);
+		long long usage = atomic64_sub_return(val, &c->usage);
+
+		if (WARN_ON(usage < 0))
+			atomic64_sub(usage, &c->usage);
 	}
-	local_irq_restore(flags);
 }
 
 void res_counter_uncharge(struct res_counter *counter, unsigned long val)
@@ -119,8 +136,6 @@ static inline unsigned long long *
 res_counter_member(struct res_counter *counter, int member)
 {
 	switch (member) {
-	case RES_USAGE:
-		return &counter->usage;
 	case RES_MAX_USAGE:
 		return &counter->max_usage;
 	case RES_LIMIT:
@@ -135,41 +150,35 @@ res_counter_member(struct res_counter *counter, int member)
 	return NULL;
 }
 
+static unsigned long long
+res_counter_get(struct res_counter *counter, int member)
+{
+	if (member == RES_USAGE)
+		return res_counter_usage(counter);
+	return res_counter_peek(counter, res_counter_member(counter, member));
+}
+
 ssize_t res_counter_read(struct res_counter *counter, int member,
 		const char __user *userbuf, size_t nbytes, loff_t *pos,
 		int (*read_strategy)(unsigned long long val, char *st_buf))
 {
-	unsigned long long *val;
+	unsigned long long val;
 	char buf[64], *s;
 
 	s = buf;
-	val = res_counter_member(counter, member);
+	val = res_counter_get(counter, member);
 	if (read_strategy)
-		s += read_strategy(*val, s);
+		s += read_strategy(val, s);
 	else
-		s += sprintf(s, "%llu\n", *val);
+		s += sprintf(s, "%llu\n", val);
 	return simple_read_from_buffer((void __user *)userbuf, nbytes,
 			pos, buf, s - buf);
 }
 
-#if BITS_PER_LONG == 32
 u64 res_counter_read_u64(struct res_counter *counter, int member)
 {
-	unsigned long flags;
-	u64 ret;
-
-	spin_lock_irqsave(&counter->lock, flags);
-	ret = *res_counter_member(counter, member);
-	spin_unlock_irqrestore(&counter->lock, flags);
-
-	return ret;
-}
-#else
-u64 res_counter_read_u64(struct res_counter *counter, int member)
-{
-	return *res_counter_member(counter, member);
+	return res_counter_get(counter, member);
 }
-#endif
 
 int res_counter_memparse_write_strategy(const char *buf,
 					unsigned long long *res)
@@ -0,0 +1,240 @@
+/*
+ * Restartable sequences, see include/linux/rseq.h for the ABI.
+ *
+ * Every time a registered thread may have been moved away from its
+ * critical section (preemption, migration, signal delivery) the scheduler
+ * or the signal code records the event and sets TIF_NOTIFY_RESUME. On the
+ * way back to userspace the thread then:
+ *
+ *  1. fetches rseq->rseq_cs and, if the interrupted instruction pointer is
+ *     inside the section it describes and one of the recorded events is
+ *     not masked by the section's flags, clears rseq->rseq_cs and moves the
+ *     instruction pointer to abort_ip;
+ *  2. stores the current CPU in rseq->cpu_id_start and rseq->cpu_id.
+ *
+ * Any fault or malformed rseq_cs kills the thread with SIGSEGV; userspace
+ * cannot be left running a critical section the kernel failed to check.
+ */
+
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/syscalls.h>
+#include <linux/rseq.h>
+#include <linux/types.h>
+#include <linux/ratelimit.h>
+#include <asm/ptrace.h>
+
+static int rseq_update_cpu_id(struct task_struct *t)
+{
+	u32 cpu_id = raw_smp_processor_id();
+
+	if (__put_user(cpu_id, &t->rseq->cpu_id_start))
+		return -EFAULT;
+	if (__put_user(cpu_id, &t->rseq->cpu_id))
+		return -EFAULT;
+	return 0;
+}
+
+static int rseq_reset_rseq_cpu_id(struct task_struct *t)
+{
+	u32 cpu_id_start = 0, cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+
+	/* cpu_id_start must stay a valid index for userspace */
+	if (put_user(cpu_id_start, &t->rseq->cpu_id_start))
+		return -EFAULT;
+	if (put_user(cpu_id, &t->rseq->cpu_id))
+		return -EFAULT;
+	return 0;
+}
+
+static int rseq_get_rseq_cs(struct task_struct *t, struct rseq_cs *rseq_cs)
+{
+	struct rseq_cs __user *urseq_cs;
+	u32 __user *usig;
+	u64 ptr;
+	u32 sig;
+
+	/* no 64-bit __get_user() on every 32-bit arch */
+	if (__copy_from_user(&ptr, &t->rseq->rseq_cs, sizeof(ptr)))
+		return -EFAULT;
+	if (!ptr) {
+		memset(rseq_cs, 0, sizeof(*rseq_cs));
+		return 0;
+	}
+	if (ptr >= TASK_SIZE)
+		return -EINVAL;
+	urseq_cs = (struct rseq_cs __user *)(unsigned long)ptr;
+	if (copy_from_user(rseq_cs, urseq_cs, sizeof(*rseq_cs)))
+		return -EFAULT;
+
+	if (rseq_cs->version > 0)
+		return -EINVAL;
+	if (rseq_cs->start_ip >= TASK_SIZE ||
+	    rseq_cs->start_ip + rseq_cs->post_commit_offset >= TASK_SIZE ||
+	    rseq_cs->abort_ip >= TASK_SIZE)
+		return -EINVAL;
+	/* check for overflow */
+	if (rseq_cs->start_ip + rseq_cs->post_commit_offset < rseq_cs->start_ip)
+		return -EINVAL;
+	/* the abort handler must not be inside the critical section */
+	if (rseq_cs->abort_ip - rseq_cs->start_ip < rseq_cs->post_commit_offset)
+		return -EINVAL;
+
+	usig = (u32 __user *)(unsigned long)(rseq_cs->abort_ip - sizeof(u32));
+	if (get_user(sig, usig))
+		return -EFAULT;
+	if (current->rseq_sig != sig) {
+		printk_ratelimited(KERN_WARNING
+			"Possible attack attempt. Unexpected rseq signature 0x%x, expecting 0x%x (pid=%d, addr=%p).\n",
+			sig, current->rseq_sig, current->pid, usig);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* returns 1 if the events recorded since the last check abort the section */
+static int rseq_need_restart(struct task_struct *t, u32 cs_flags)
+{
+	unsigned long event_mask;
+	u32 flags;
+
+	if (__get_user(flags, &t->rseq->flags))
+		return -EFAULT;
+	flags |= cs_flags;
+
+	/* the event mask is also written from preemption and migration */
+	preempt_disable();
+	event_mask = t->rseq_event_mask;
+	t->rseq_event_mask = 0;
+	preempt_enable();
+
+	return !!(event_mask & ~flags);
+}
+
+static int clear_rseq_cs(struct task_struct *t)
+{
+	u64 zero = 0;
+
+	/*
+	 * The thread left the critical section or is about to be aborted:
+	 * forget it, so that later returns to userspace need not look it up.
+	 */
+	if (__copy_to_user(&t->rseq->rseq_cs, &zero, sizeof(zero)))
+		return -EFAULT;
+	return 0;
+}
+
+/* unsigned arithmetic also catches ip < start_ip */
+static bool in_rseq_cs(unsigned long ip, struct rseq_cs *rseq_cs)
+{
+	return ip - rseq_cs->start_ip < rseq_cs->post_commit_offset;
+}
+
+static int rseq_ip_fixup(struct pt_regs *regs)
+{
+	unsigned long ip = instruction_pointer(regs);
+	struct task_struct *t = current;
+	struct rseq_cs rseq_cs;
+	int ret;
+
+	ret = rseq_get_rseq_cs(t, &rseq_cs);
+	if (ret)
+		return ret;
+
+	/*
+	 * Outside of the critical section the events do not matter; drop
+	 * them along with the stale rseq_cs pointer.
+	 */
+	if (!in_rseq_cs(ip, &rseq_cs)) {
+		t->rseq_event_mask = 0;
+		return clear_rseq_cs(t);
+	}
+
+	ret = rseq_need_restart(t, rseq_cs.flags);
+	if (ret <= 0)
+		return ret;
+	ret = clear_rseq_cs(t);
+	if (ret)
+		return ret;
+	instruction_pointer_set(regs, (unsigned long)rseq_cs.abort_ip);
+	return 0;
+}
+
+void __rseq_handle_notify_resume(struct pt_regs *regs)
+{
+	struct task_struct *t = current;
+
+	if (unlikely(t->flags & PF_EXITING))
+		return;
+	if (unlikely(!access_ok(VERIFY_WRITE, t->rseq, sizeof(*t->rseq))))
+		goto error;
+	if (unlikely(rseq_ip_fixup(regs)))
+		goto error;
+	if (unlikely(rseq_update_cpu_id(t)))
+		goto error;
+	return;
+
+error:
+	force_sig(SIGSEGV, t);
+}
+
+/*
+ * sys_rseq - register or unregister the calling thread's struct rseq
+ * @rseq: the struct rseq, aligned to its size
+ * @rseq_len: sizeof(struct rseq)
+ * @flags: 0 to register, RSEQ_FLAG_UNREGISTER to unregister
+ * @sig: signature expected in front of every abort_ip
+ *
+ * A thread can have only one struct rseq; registering the same one again
+ * returns -EBUSY. Unregistering requires the same @rseq, @rseq_len and
+ * @sig as the registration.
+ */
+SYSCALL_DEFINE4(rseq, struct rseq __user *, rseq, u32, rseq_len,
+		int, flags, u32, sig)
+{
+	int ret;
+
+	if (flags & RSEQ_FLAG_UNREGISTER) {
+		if (flags & ~RSEQ_FLAG_UNREGISTER)
+			return -EINVAL;
+		if (current->rseq != rseq || !current->rseq)
+			return -EINVAL;
+		if (rseq_len != current->rseq_len)
+			return -EINVAL;
+		if (current->rseq_sig != sig)
+			return -EPERM;
+		ret = rseq_reset_rseq_cpu_id(current);
+		if (ret)
+			return ret;
+		current->rseq = NULL;
+		current->rseq_len = 0;
+		current->rseq_sig = 0;
+		return 0;
+	}
+
+	if (unlikely(flags))
+		return -EINVAL;
+
+	if (current->rseq) {
+		/* already registered: tell a second user apart from a bug */
+		if (current->rseq != rseq || rseq_len != current->rseq_len)
+			return -EINVAL;
+		if (current->rseq_sig != sig)
+			return -EPERM;
+		return -EBUSY;
+	}
+
+	if (!IS_ALIGNED((unsigned long)rseq, __alignof__(*rseq)) ||
+	    rseq_len != sizeof(*rseq))
+		return -EINVAL;
+	if (!access_ok(VERIFY_WRITE, rseq, rseq_len))
+		return -EFAULT;
+
+	current->rseq = rseq;
+	current->rseq_len = rseq_len;
+	current->rseq_sig = sig;
+	/* fill in cpu_id before the thread gets back to userspace */
+	rseq_set_notify_resume(current);
+
+	return 0;
+}
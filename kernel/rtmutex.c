@@ -98,11 +98,22 @@ static inline void mark_rt_mutex_waiters(struct rt_mutex *lock)
  */
 int rt_mutex_getprio(struct task_struct *task)
 {
+	int prio;
+
 	if (likely(!task_has_pi_waiters(task)))
 		return task->normal_prio;
 
-	return min(task_top_pi_waiter(task)->pi_list_entry.prio,
+	prio = min(task_top_pi_waiter(task)->pi_list_entry.prio,
 		   task->normal_prio);
+
+	/*
+	 * Only SCHED_DEADLINE tasks have the parameters to run as such,
+	 * a lock owner boosted by one runs at the top RT priority.
+	 */
+	if (dl_prio(prio) && !dl_prio(task->normal_prio))
+		prio = MAX_DL_PRIO;
+
+	return prio;
 }
 
 /*
@@ -453,11 +464,14 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 /*
  * Wake up the next waiter on the lock.
  *
- * Remove the top waiter from the current tasks waiter list and wake it up.
+ * Remove the top waiter from the current tasks waiter list and queue it
+ * on @wake_q. The caller issues the wakeup after dropping
+ * lock->wait_lock, so the woken task does not immediately contend on it.
  *
  * Called with lock->wait_lock held.
  */
-static void wakeup_next_waiter(struct rt_mutex *lock)
+static void wakeup_next_waiter(struct rt_mutex *lock,
+			       struct wake_q_head *wake_q)
 {
 	struct rt_mutex_waiter *waiter;
 	unsigned long flags;
@@ -478,7 +492,7 @@ static void wakeup_next_waiter(struct rt_mutex *lock)
 
 	raw_spin_unlock_irqrestore(&current->pi_lock, flags);
 
-	wake_up_process(waiter->task);
+	wake_q_add(wake_q, waiter->task);
 }
 
 /*
@@ -700,6 +714,8 @@ rt_mutex_slowtrylock(struct rt_mutex *lock)
 static void __sched
 rt_mutex_slowunlock(struct rt_mutex *lock)
 {
+	WAKE_Q(wake_q);
+
 	raw_spin_lock(&lock->wait_lock);
 
 	debug_rt_mutex_unlock(lock);
@@ -712,10 +728,13 @@ rt_mutex_slowunlock(struct rt_mutex *lock)
 		return;
 	}
 
-	wakeup_next_waiter(lock);
+	wakeup_next_waiter(lock, &wake_q);
 
 	raw_spin_unlock(&lock->wait_lock);
 
+	/* Still boosted, so the wakeup preempts nobody it should not: */
+	wake_up_q(&wake_q);
+
 	/* Undo pi boosting if necessary: */
 	rt_mutex_adjust_prio(current);
 }
@@ -0,0 +1,515 @@
+/*
+ * Deadline Scheduling Class (mapped to the SCHED_DEADLINE policy)
+ *
+ * Earliest Deadline First (EDF) plus Constant Bandwidth Server (CBS):
+ * every task owns a reservation of dl_runtime every dl_period and is
+ * scheduled by the absolute deadline of its current instance. A task
+ * trying to run for more than its runtime is throttled until its next
+ * instance, so it cannot eat into the reservations of the others; a
+ * task using less than its reservation meets all its deadlines as long
+ * as the admission test in sched_setattr() passed.
+ *
+ * On SMP the tasks are partitioned: each is bound to one cpu, admitted
+ * against that cpu's bandwidth and never migrated.
+ */
+
+#include "sched.h"
+
+static inline struct task_struct *dl_task_of(struct sched_dl_entity *dl_se)
+{
+	return container_of(dl_se, struct task_struct, dl);
+}
+
+static inline struct rq *rq_of_dl_rq(struct dl_rq *dl_rq)
+{
+	return container_of(dl_rq, struct rq, dl);
+}
+
+static inline struct dl_rq *dl_rq_of_se(struct sched_dl_entity *dl_se)
+{
+	return &task_rq(dl_task_of(dl_se))->dl;
+}
+
+static inline int on_dl_rq(struct sched_dl_entity *dl_se)
+{
+	return !RB_EMPTY_NODE(&dl_se->rb_node);
+}
+
+static inline int is_leftmost(struct task_struct *p, struct dl_rq *dl_rq)
+{
+	return dl_rq->rb_leftmost == &p->dl.rb_node;
+}
+
+void init_dl_bw(struct dl_bw *dl_b)
+{
+	raw_spin_lock_init(&dl_b->lock);
+	/*
+	 * -deadline tasks get the share of each cpu RT throttling leaves
+	 * to real-time tasks.
+	 */
+	if (global_rt_runtime() == RUNTIME_INF)
+		dl_b->bw = -1;
+	else
+		dl_b->bw = to_ratio(global_rt_period(), global_rt_runtime());
+	dl_b->total_bw = 0;
+}
+
+void init_dl_rq(struct dl_rq *dl_rq)
+{
+	dl_rq->rb_root = RB_ROOT;
+	init_dl_bw(&dl_rq->dl_bw);
+}
+
+/*
+ * A new instance starts now: full runtime, deadline relative to now.
+ */
+static void setup_new_dl_entity(struct sched_dl_entity *dl_se)
+{
+	struct rq *rq = rq_of_dl_rq(dl_rq_of_se(dl_se));
+
+	dl_se->deadline = rq->clock + dl_se->dl_deadline;
+	dl_se->runtime = dl_se->dl_runtime;
+	dl_se->dl_new = 0;
+}
+
+/*
+ * The runtime of the current instance is exhausted: move on to the
+ * next instances until there is runtime to use again.
+ */
+static void replenish_dl_entity(struct sched_dl_entity *dl_se)
+{
+	struct rq *rq = rq_of_dl_rq(dl_rq_of_se(dl_se));
+
+	/*
+	 * Loop rather than compute, the overrun is normally smaller than
+	 * one instance.
+	 */
+	while (dl_se->runtime <= 0) {
+		dl_se->deadline += dl_se->dl_period;
+		dl_se->runtime += dl_se->dl_runtime;
+	}
+
+	/*
+	 * The deadline should now be in the future. If it is not, the task
+	 * lagged behind by more than its overrun (e.g. it sat on a cpu
+	 * hogged by higher classes), so restart it from scratch.
+	 */
+	if (dl_time_before(dl_se->deadline, rq->clock)) {
+		static bool lag_once;
+
+		if (!lag_once) {
+			lag_once = true;
+			printk_sched("sched: DL replenish lagged too much\n");
+		}
+		dl_se->deadline = rq->clock + dl_se->dl_deadline;
+		dl_se->runtime = dl_se->dl_runtime;
+	}
+}
+
+/*
+ * CBS wakeup rule: the task may keep its current deadline and runtime
+ * only if using that runtime before that deadline does not exceed its
+ * bandwidth, i.e. if
+ *
+ *   runtime / (deadline - t) <= dl_runtime / dl_period
+ *
+ * Both sides are scaled down to microseconds so the products cannot
+ * overflow.
+ */
+static bool dl_entity_overflow(struct sched_dl_entity *dl_se, u64 t)
+{
+	u64 left, right;
+
+	left = (dl_se->dl_period >> DL_SCALE) * (dl_se->runtime >> DL_SCALE);
+	right = ((dl_se->deadline - t) >> DL_SCALE) *
+		(dl_se->dl_runtime >> DL_SCALE);
+
+	return dl_time_before(right, left);
+}
+
+/*
+ * The task is woken up (or enqueued with new parameters): start a new
+ * instance if its current one cannot be resumed.
+ */
+static void update_dl_entity(struct sched_dl_entity *dl_se)
+{
+	struct rq *rq = rq_of_dl_rq(dl_rq_of_se(dl_se));
+
+	if (dl_se->dl_new) {
+		setup_new_dl_entity(dl_se);
+		return;
+	}
+
+	if (dl_time_before(dl_se->deadline, rq->clock) ||
+	    dl_entity_overflow(dl_se, rq->clock)) {
+		dl_se->deadline = rq->clock + dl_se->dl_deadline;
+		dl_se->runtime = dl_se->dl_runtime;
+	}
+}
+
+/*
+ * Arm the bandwidth timer of a throttled entity at its deadline, the
+ * time its next instance starts. Returns 0 if that time already passed
+ * and the entity can be replenished right away.
+ */
+static int start_dl_timer(struct sched_dl_entity *dl_se)
+{
+	struct rq *rq = rq_of_dl_rq(dl_rq_of_se(dl_se));
+	ktime_t now, act;
+	s64 delta;
+
+	/*
+	 * The deadline is in rq->clock time, the timer runs on
+	 * CLOCK_MONOTONIC: translate with the current offset.
+	 */
+	now = hrtimer_cb_get_time(&dl_se->dl_timer);
+	delta = ktime_to_ns(now) - rq->clock;
+	act = ktime_add_ns(ns_to_ktime(dl_se->deadline), delta);
+
+	if (ktime_us_delta(act, now) < 0)
+		return 0;
+
+	/* We hold the rq lock, so no softirq wakeup from here */
+	__hrtimer_start_range_ns(&dl_se->dl_timer, act, 0, HRTIMER_MODE_ABS, 0);
+
+	return hrtimer_active(&dl_se->dl_timer);
+}
+
+static void enqueue_task_dl(struct rq *rq, struct task_struct *p, int flags);
+
+/*
+ * The bandwidth timer of a throttled task: its next instance begins,
+ * put it back on its runqueue with a replenished runtime.
+ */
+static enum hrtimer_restart dl_task_timer(struct hrtimer *timer)
+{
+	struct sched_dl_entity *dl_se = container_of(timer,
+						     struct sched_dl_entity,
+						     dl_timer);
+	struct task_struct *p = dl_task_of(dl_se);
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+
+	/*
+	 * The task may have left SCHED_DEADLINE, or been given new
+	 * parameters, since the timer was armed.
+	 */
+	if (!dl_task(p) || dl_se->dl_new || !dl_se->dl_throttled)
+		goto unlock;
+
+	dl_se->dl_throttled = 0;
+	if (p->on_rq) {
+		update_rq_clock(rq);
+		enqueue_task_dl(rq, p, ENQUEUE_REPLENISH);
+		check_preempt_curr(rq, p, 0);
+	}
+unlock:
+	task_rq_unlock(rq, p, &flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void init_dl_task_timer(struct sched_dl_entity *dl_se)
+{
+	struct hrtimer *timer = &dl_se->dl_timer;
+
+	hrtimer_init(timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	timer->function = dl_task_timer;
+}
+
+static void __enqueue_dl_entity(struct sched_dl_entity *dl_se)
+{
+	struct dl_rq *dl_rq = dl_rq_of_se(dl_se);
+	struct rb_node **link = &dl_rq->rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct sched_dl_entity *entry;
+	int leftmost = 1;
+
+	BUG_ON(on_dl_rq(dl_se));
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct sched_dl_entity, rb_node);
+		if (dl_time_before(dl_se->deadline, entry->deadline))
+			link = &parent->rb_left;
+		else {
+			link = &parent->rb_right;
+			leftmost = 0;
+		}
+	}
+
+	if (leftmost)
+		dl_rq->rb_leftmost = &dl_se->rb_node;
+
+	rb_link_node(&dl_se->rb_node, parent, link);
+	rb_insert_color(&dl_se->rb_node, &dl_rq->rb_root);
+
+	dl_rq->dl_nr_running++;
+}
+
+static void __dequeue_dl_entity(struct sched_dl_entity *dl_se)
+{
+	struct dl_rq *dl_rq = dl_rq_of_se(dl_se);
+
+	if (dl_rq->rb_leftmost == &dl_se->rb_node)
+		dl_rq->rb_leftmost = rb_next(&dl_se->rb_node);
+
+	rb_erase(&dl_se->rb_node, &dl_rq->rb_root);
+	RB_CLEAR_NODE(&dl_se->rb_node);
+
+	dl_rq->dl_nr_running--;
+}
+
+static void enqueue_dl_entity(struct sched_dl_entity *dl_se, int flags)
+{
+	/*
+	 * A wakeup or new parameters may need a new instance, the expiry
+	 * of the bandwidth timer needs a replenishment; anything else
+	 * (migration, requeue) keeps the current instance.
+	 */
+	if (dl_se->dl_new || flags & ENQUEUE_WAKEUP)
+		update_dl_entity(dl_se);
+	else if (flags & ENQUEUE_REPLENISH)
+		replenish_dl_entity(dl_se);
+
+	__enqueue_dl_entity(dl_se);
+}
+
+/*
+ * Only the tasks on the rbtree are counted in rq->nr_running: a
+ * throttled task stays p->on_rq but is off the tree until its
+ * replenishment.
+ */
+static void enqueue_task_dl(struct rq *rq, struct task_struct *p, int flags)
+{
+	if (p->dl.dl_throttled && !(flags & ENQUEUE_REPLENISH))
+		return;
+
+	enqueue_dl_entity(&p->dl, flags);
+	inc_nr_running(rq);
+}
+
+static void __dequeue_task_dl(struct rq *rq, struct task_struct *p)
+{
+	__dequeue_dl_entity(&p->dl);
+	dec_nr_running(rq);
+}
+
+/*
+ * Charge the running task for the time it ran and throttle it once its
+ * runtime is exhausted.
+ */
+static void update_curr_dl(struct rq *rq)
+{
+	struct task_struct *curr = rq->curr;
+	struct sched_dl_entity *dl_se = &curr->dl;
+	u64 delta_exec;
+
+	if (curr->sched_class != &dl_sched_class || !on_dl_rq(dl_se))
+		return;
+
+	delta_exec = rq->clock_task - curr->se.exec_start;
+	if (unlikely((s64)delta_exec < 0))
+		delta_exec = 0;
+
+	schedstat_set(curr->se.statistics.exec_max,
+		      max(curr->se.statistics.exec_max, delta_exec));
+
+	curr->se.sum_exec_runtime += delta_exec;
+	account_group_exec_runtime(curr, delta_exec);
+
+	curr->se.exec_start = rq->clock_task;
+	cpuacct_charge(curr, delta_exec);
+
+	sched_rt_avg_update(rq, delta_exec);
+
+	dl_se->runtime -= delta_exec;
+	if (dl_se->runtime > 0)
+		return;
+
+	__dequeue_task_dl(rq, curr);
+	if (likely(start_dl_timer(dl_se)))
+		dl_se->dl_throttled = 1;
+	else
+		enqueue_task_dl(rq, curr, ENQUEUE_REPLENISH);
+
+	if (!is_leftmost(curr, &rq->dl))
+		resched_task(curr);
+}
+
+static void dequeue_task_dl(struct rq *rq, struct task_struct *p, int flags)
+{
+	update_curr_dl(rq);
+
+	/* Throttled, it is not on the tree (any more) */
+	if (!on_dl_rq(&p->dl))
+		return;
+
+	__dequeue_task_dl(rq, p);
+}
+
+/*
+ * Yielding gives up what is left of the current instance: the task
+ * sleeps until its bandwidth timer starts the next one.
+ */
+static void yield_task_dl(struct rq *rq)
+{
+	struct task_struct *p = rq->curr;
+
+	if (p->dl.runtime > 0)
+		p->dl.runtime = 0;
+	update_rq_clock(rq);
+	update_curr_dl(rq);
+}
+
+static void check_preempt_curr_dl(struct rq *rq, struct task_struct *p,
+				  int flags)
+{
+	if (dl_entity_preempt(&p->dl, &rq->curr->dl))
+		resched_task(rq->curr);
+}
+
+#ifdef CONFIG_SCHED_HRTICK
+static void start_hrtick_dl(struct rq *rq, struct task_struct *p)
+{
+	if (p->dl.runtime > 0)
+		hrtick_start(rq, p->dl.runtime);
+}
+#else
+static inline void start_hrtick_dl(struct rq *rq, struct task_struct *p)
+{
+}
+#endif
+
+static struct task_struct *pick_next_task_dl(struct rq *rq)
+{
+	struct dl_rq *dl_rq = &rq->dl;
+	struct sched_dl_entity *dl_se;
+	struct task_struct *p;
+
+	if (!dl_rq->dl_nr_running)
+		return NULL;
+
+	dl_se = rb_entry(dl_rq->rb_leftmost, struct sched_dl_entity, rb_node);
+	p = dl_task_of(dl_se);
+	p->se.exec_start = rq->clock_task;
+
+	if (hrtick_enabled(rq))
+		start_hrtick_dl(rq, p);
+
+	return p;
+}
+
+static void put_prev_task_dl(struct rq *rq, struct task_struct *p)
+{
+	update_curr_dl(rq);
+}
+
+static void task_tick_dl(struct rq *rq, struct task_struct *p, int queued)
+{
+	update_curr_dl(rq);
+
+	if (hrtick_enabled(rq) && queued && is_leftmost(p, &rq->dl))
+		start_hrtick_dl(rq, p);
+}
+
+static void task_dead_dl(struct task_struct *p)
+{
+	dl_bw_release(p);
+
+	hrtimer_cancel(&p->dl.dl_timer);
+}
+
+static void set_curr_task_dl(struct rq *rq)
+{
+	struct task_struct *p = rq->curr;
+
+	p->se.exec_start = rq->clock_task;
+}
+
+#ifdef CONFIG_SMP
+/*
+ * A -deadline task is bound to the cpu its bandwidth is charged to, see
+ * dl_bw_of(), and stays there.
+ */
+static int
+select_task_rq_dl(struct task_struct *p, int sd_flag, int flags)
+{
+	return p->dl.dl_bw_cpu;
+}
+
+/*
+ * The task is moved anyway when its cpu goes offline: its bandwidth
+ * follows it, even if that overcommits the new cpu.
+ */
+static void migrate_task_rq_dl(struct task_struct *p, int next_cpu)
+{
+	if (task_has_dl_policy(p) && p->dl.dl_bw_cpu != next_cpu)
+		dl_bw_move(p, next_cpu);
+}
+#endif /* CONFIG_SMP */
+
+static void switched_from_dl(struct rq *rq, struct task_struct *p)
+{
+	/* dl_task_timer() ignores a task which is no longer -deadline */
+	hrtimer_try_to_cancel(&p->dl.dl_timer);
+	p->dl.dl_throttled = 0;
+}
+
+static void switched_to_dl(struct rq *rq, struct task_struct *p)
+{
+	if (p->on_rq && rq->curr != p)
+		check_preempt_curr(rq, p, 0);
+}
+
+/*
+ * The parameters of the task changed (sched_setattr()), which may move
+ * its deadline either way.
+ */
+static void prio_changed_dl(struct rq *rq, struct task_struct *p,
+			    int oldprio)
+{
+	if (!p->on_rq)
+		return;
+
+	if (task_current(rq, p)) {
+		if (!is_leftmost(p, &rq->dl))
+			resched_task(p);
+	} else
+		check_preempt_curr(rq, p, 0);
+}
+
+static unsigned int
+get_rr_interval_dl(struct rq *rq, struct task_struct *task)
+{
+	return 0;
+}
+
+const struct sched_class dl_sched_class = {
+	.next			= &rt_sched_class,
+	.enqueue_task		= enqueue_task_dl,
+	.dequeue_task		= dequeue_task_dl,
+	.yield_task		= yield_task_dl,
+
+	.check_preempt_curr	= check_preempt_curr_dl,
+
+	.pick_next_task		= pick_next_task_dl,
+	.put_prev_task		= put_prev_task_dl,
+
+#ifdef CONFIG_SMP
+	.select_task_rq		= select_task_rq_dl,
+	.migrate_task_rq	= migrate_task_rq_dl,
+#endif
+
+	.set_curr_task		= set_curr_task_dl,
+	.task_tick		= task_tick_dl,
+	.task_dead		= task_dead_dl,
+
+	.get_rr_interval	= get_rr_interval_dl,
+
+	.prio_changed		= prio_changed_dl,
+	.switched_from		= switched_from_dl,
+	.switched_to		= switched_to_dl,
+};
@@ -3,6 +3,7 @@
 #include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/stop_machine.h>
+#include <linux/tick.h>
 
 #include "cpupri.h"
 
@@ -55,6 +56,68 @@ static inline int task_has_rt_policy(struct task_struct *p)
 	return rt_policy(p->policy);
 }
 
+static inline int fair_policy(int policy)
+{
+	return policy == SCHED_NORMAL || policy == SCHED_BATCH;
+}
+
+static inline int dl_policy(int policy)
+{
+	return policy == SCHED_DEADLINE;
+}
+
+static inline int task_has_dl_policy(struct task_struct *p)
+{
+	return dl_policy(p->policy);
+}
+
+/*
+ * SCHED_DEADLINE computations that multiply two times drop DL_SCALE bits
+ * (~1us) of each first to stay within u64.
+ */
+#define DL_SCALE		10
+
+static inline bool dl_time_before(u64 a, u64 b)
+{
+	return (s64)(a - b) < 0;
+}
+
+/*
+ * Tells if entity @a should preempt entity @b.
+ */
+static inline bool
+dl_entity_preempt(struct sched_dl_entity *a, struct sched_dl_entity *b)
+{
+	return dl_time_before(a->deadline, b->deadline);
+}
+
+/*
+ * SCHED_DEADLINE admission control: @bw is the bandwidth (1 << 20 fixed
+ * point, -1 for unlimited) -deadline tasks may use on a cpu, @total_bw
+ * the sum of the bandwidths of the tasks admitted to it so far.
+ */
+struct dl_bw {
+	raw_spinlock_t lock;
+	u64 bw, total_bw;
+};
+
+static inline void __dl_clear(struct dl_bw *dl_b, u64 tsk_bw)
+{
+	dl_b->total_bw -= tsk_bw;
+}
+
+static inline void __dl_add(struct dl_bw *dl_b, u64 tsk_bw)
+{
+	dl_b->total_bw += tsk_bw;
+}
+
+static inline bool
+__dl_overflow(struct dl_bw *dl_b, u64 old_bw, u64 new_bw)
+{
+	return dl_b->bw != -1 &&
+	       dl_b->bw < dl_b->total_bw - old_bw + new_bw;
+}
+
 /*
  * This is the priority-queue data structure of the RT scheduling class:
  */
@@ -73,6 +136,25 @@ struct rt_bandwidth {
 
 extern struct mutex sched_domains_mutex;
 
+enum sched_lat_type {
+	SCHED_LAT_WAIT,		/* runnable on the runqueue until running */
+	SCHED_LAT_PREEMPT,	/* resched request until switched out */
+	NR_SCHED_LAT,
+};
+
+#ifdef CONFIG_SCHEDSTATS
+/*
+ * log2 histograms of scheduling latencies. Bucket 0 counts latencies
+ * below 1us (2^10 ns), bucket n those in [2^(n-1), 2^n) us, and the
+ * last bucket everything longer.
+ */
+#define SCHED_HIST_BUCKETS	24
+
+struct sched_lat_hist {
+	u64 buckets[NR_SCHED_LAT][SCHED_HIST_BUCKETS];
+};
+#endif
+
 #ifdef CONFIG_CGROUP_SCHED
 
 #include <linux/cgroup.h>
@@ -82,21 +164,25 @@ struct rt_rq;
 
 extern struct list_head task_groups;
 
+/* power-of-two millisecond buckets, see cfs_throttle_hist_bucket() */
+#define CFS_THROTTLE_HIST_BUCKETS	12
+
 struct cfs_bandwidth {
 #ifdef CONFIG_CFS_BANDWIDTH
 	raw_spinlock_t lock;
 	ktime_t period;
-	u64 quota, runtime;
+	u64 quota, runtime, burst;
+	u64 runtime_snap;
 	s64 hierarchal_quota;
-	u64 runtime_expires;
 
 	int idle, timer_active;
 	struct hrtimer period_timer, slack_timer;
 	struct list_head throttled_cfs_rq;
 
 	/* statistics */
-	int nr_periods, nr_throttled;
-	u64 throttled_time;
+	int nr_periods, nr_throttled, nr_bursts;
+	u64 throttled_time, burst_time;
+	u64 throttled_hist[CFS_THROTTLE_HIST_BUCKETS];
 #endif
 };
 
@@ -111,7 +197,10 @@ struct task_group {
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
 
-	atomic_t load_weight;
+#ifdef CONFIG_SMP
+	atomic64_t load_avg;
+	atomic_t runnable_avg;
+#endif
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -133,6 +222,11 @@ struct task_group {
 #endif
 
 	struct cfs_bandwidth cfs_bandwidth;
+
+#ifdef CONFIG_SCHEDSTATS
+	/* per-cpu latency histograms, NULL for the root group */
+	struct sched_lat_hist __percpu *lat_hist;
+#endif
 };
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -222,6 +316,21 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	/*
+	 * CFS load tracking.
+	 *
+	 * Load is tracked per sched_entity as a geometrically decaying
+	 * runnable average and aggregated up: runnable_load_avg is the sum
+	 * of the contributions of the queued entities, blocked_load_avg
+	 * that of the entities which went to sleep here, decayed in step
+	 * with decay_counter so that it can be taken back on wakeup.
+	 */
+	unsigned long runnable_load_avg, blocked_load_avg;
+	atomic64_t decay_counter, removed_load;
+	u64 last_decay;
+#endif /* CONFIG_SMP */
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -242,29 +351,24 @@ struct cfs_rq {
 	 *   h_load = weight * f(tg)
 	 *
 	 * Where f(tg) is the recursive weight fraction assigned to
-	 * this group.
+	 * this group.  It is computed on demand for the path from the root
+	 * down to a cfs_rq, h_load_next links that path, and cached for a
+	 * jiffy.
 	 */
 	unsigned long h_load;
+	u64 last_h_load_update;
+	struct sched_entity *h_load_next;
 
-	/*
-	 * Maintaining per-cpu shares distribution for group scheduling
-	 *
-	 * load_stamp is the last time we updated the load average
-	 * load_last is the last time we updated the load average and saw load
-	 * load_unacc_exec_time is currently unaccounted execution time
-	 */
-	u64 load_avg;
-	u64 load_period;
-	u64 load_stamp, load_last, load_unacc_exec_time;
-
-	unsigned long load_contribution;
+	/* this cfs_rq's current share of tg->load_avg and tg->runnable_avg */
+	unsigned long tg_load_contrib;
+	u32 tg_runnable_contrib;
 #endif /* CONFIG_SMP */
 #ifdef CONFIG_CFS_BANDWIDTH
 	int runtime_enabled;
-	u64 runtime_expires;
 	s64 runtime_remaining;
 
 	u64 throttled_timestamp;
+	u64 throttled_clock_task, throttled_clock_task_time;
 	int throttled, throttle_count;
 	struct list_head throttled_list;
 #endif /* CONFIG_CFS_BANDWIDTH */
@@ -309,6 +413,17 @@ struct rt_rq {
 #endif
 };
 
+/* Deadline class' related fields in a runqueue */
+struct dl_rq {
+	/* runqueue is an rbtree, ordered by deadline */
+	struct rb_root rb_root;
+	struct rb_node *rb_leftmost;
+
+	unsigned long dl_nr_running;
+
+	struct dl_bw dl_bw;
+};
+
 #ifdef CONFIG_SMP
 
 /*
@@ -370,13 +485,11 @@ struct rq {
 
 	struct cfs_rq cfs;
 	struct rt_rq rt;
+	struct dl_rq dl;
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	/* list of leaf cfs_rq on this cpu: */
 	struct list_head leaf_cfs_rq_list;
-#ifdef CONFIG_SMP
-	unsigned long h_load_throttle;
-#endif /* CONFIG_SMP */
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -462,6 +575,10 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int ttwu_count;
 	unsigned int ttwu_local;
+
+	/* latency histograms, and when curr was first asked to resched */
+	struct sched_lat_hist rq_lat_hist;
+	u64 resched_stamp;
 #endif
 
 #ifdef CONFIG_SMP
@@ -486,6 +603,43 @@ DECLARE_PER_CPU(struct rq, runqueues);
 #define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
 #define raw_rq()		(&__raw_get_cpu_var(runqueues))
 
+/*
+ * The admission control of SCHED_DEADLINE is done per cpu: there is no
+ * push or pull of -deadline tasks, so each is bound to a single cpu and
+ * its bandwidth charged there, to p->dl.dl_bw_cpu.
+ */
+static inline struct dl_bw *dl_bw_of(int i)
+{
+	return &cpu_rq(i)->dl.dl_bw;
+}
+
+/* Give the bandwidth of @p back to the cpu it was charged to */
+static inline void dl_bw_release(struct task_struct *p)
+{
+	struct dl_bw *dl_b = dl_bw_of(p->dl.dl_bw_cpu);
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&dl_b->lock, flags);
+	__dl_clear(dl_b, p->dl.dl_bw);
+	raw_spin_unlock_irqrestore(&dl_b->lock, flags);
+}
+
+/*
+ * Charge the bandwidth of @p to @cpu instead, whether or not it fits
+ * there: used when the task is forced off its cpu.
+ */
+static inline void dl_bw_move(struct task_struct *p, int cpu)
+{
+	struct dl_bw *dl_b = dl_bw_of(cpu);
+	unsigned long flags;
+
+	dl_bw_release(p);
+	raw_spin_lock_irqsave(&dl_b->lock, flags);
+	__dl_add(dl_b, p->dl.dl_bw);
+	raw_spin_unlock_irqrestore(&dl_b->lock, flags);
+	p->dl.dl_bw_cpu = cpu;
+}
+
 #ifdef CONFIG_SMP
 
 #define rcu_dereference_check_sched_domain(p) \
@@ -532,6 +686,14 @@ DECLARE_PER_CPU(int, sd_llc_id);
 
 extern int group_balance_cpu(struct sched_group *sg);
 
+extern void update_idle_core(struct rq *rq);
+extern void clear_idle_core(struct rq *rq);
+
+#else /* CONFIG_SMP */
+
+static inline void update_idle_core(struct rq *rq) { }
+static inline void clear_idle_core(struct rq *rq) { }
+
 #endif /* CONFIG_SMP */
 
 #include "stats.h"
@@ -847,6 +1009,7 @@ enum cpuacct_stat_index {
    for (class = sched_class_highest; class; class = class->next)
 
 extern const struct sched_class stop_sched_class;
+extern const struct sched_class dl_sched_class;
 extern const struct sched_class rt_sched_class;
 extern const struct sched_class fair_sched_class;
 extern const struct sched_class idle_sched_class;
@@ -857,6 +1020,10 @@ extern const struct sched_class idle_sched_class;
 extern void trigger_load_balance(struct rq *rq, int cpu);
 extern void idle_balance(int this_cpu, struct rq *this_rq);
 
+#ifdef CONFIG_NUMA_BALANCING
+extern int migrate_task_to(struct task_struct *p, int cpu);
+#endif
+
 #else	/* CONFIG_SMP */
 
 static inline void idle_balance(int cpu, struct rq *rq)
@@ -873,6 +1040,11 @@ extern int update_runtime(struct notifier_block *nfb, unsigned long action, void
 extern void init_sched_rt_class(void);
 extern void init_sched_fair_class(void);
 
+extern void init_dl_rq(struct dl_rq *dl_rq);
+extern void init_dl_bw(struct dl_bw *dl_b);
+extern void init_dl_task_timer(struct sched_dl_entity *dl_se);
+extern unsigned long to_ratio(u64 period, u64 runtime);
+
 extern void resched_task(struct task_struct *p);
 extern void resched_cpu(int cpu);
 
@@ -920,6 +1092,16 @@ static inline void cpuacct_charge(struct task_struct *tsk, u64 cputime) {}
 static inline void inc_nr_running(struct rq *rq)
 {
 	rq->nr_running++;
+
+#ifdef CONFIG_NO_HZ_FULL
+	if (rq->nr_running == 2) {
+		if (tick_nohz_full_cpu(rq->cpu)) {
+			/* Order rq->nr_running write against the IPI */
+			smp_wmb();
+			smp_send_reschedule(rq->cpu);
+		}
+	}
+#endif
 }
 
 static inline void dec_nr_running(struct rq *rq)
@@ -929,6 +1111,17 @@ static inline void dec_nr_running(struct rq *rq)
 
 extern void update_rq_clock(struct rq *rq);
 
+extern struct rq *task_rq_lock(struct task_struct *p, unsigned long *flags);
+
+static inline void
+task_rq_unlock(struct rq *rq, struct task_struct *p, unsigned long *flags)
+	__releases(rq->lock)
+	__releases(p->pi_lock)
+{
+	raw_spin_unlock(&rq->lock);
+	raw_spin_unlock_irqrestore(&p->pi_lock, *flags);
+}
+
 extern void activate_task(struct rq *rq, struct task_struct *p, int flags);
 extern void deactivate_task(struct rq *rq, struct task_struct *p, int flags);
 
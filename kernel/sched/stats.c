@@ -10,7 +10,36 @@
  * bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 17
+
+/*
+ * Account one latency sample of @p. The per-cpu histograms of @p's task
+ * group and its ancestors are updated as well, except for the root group
+ * which is what the runqueue histograms already are.
+ *
+ * Expects runqueue lock to be held, and to run on the cpu of @rq.
+ */
+void sched_lat_account(struct rq *rq, struct task_struct *p,
+		       enum sched_lat_type type, u64 delta)
+{
+	unsigned int bucket = min_t(unsigned int, fls64(delta >> 10),
+				    SCHED_HIST_BUCKETS - 1);
+#ifdef CONFIG_CGROUP_SCHED
+	struct task_group *tg;
+#endif
+
+	rq->rq_lat_hist.buckets[type][bucket]++;
+
+#ifdef CONFIG_CGROUP_SCHED
+	for (tg = task_group(p); tg->lat_hist; tg = tg->parent)
+		__this_cpu_inc(tg->lat_hist->buckets[type][bucket]);
+#endif
+}
+
+static const char * const sched_lat_names[NR_SCHED_LAT] = {
+	[SCHED_LAT_WAIT]	= "wait_hist",
+	[SCHED_LAT_PREEMPT]	= "preempt_hist",
+};
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
@@ -25,6 +54,7 @@ static int show_schedstat(struct seq_file *seq, void *v)
 	seq_printf(seq, "timestamp %lu\n", jiffies);
 	for_each_online_cpu(cpu) {
 		struct rq *rq = cpu_rq(cpu);
+		int type, i;
 #ifdef CONFIG_SMP
 		struct sched_domain *sd;
 		int dcount = 0;
@@ -41,6 +71,15 @@ static int show_schedstat(struct seq_file *seq, void *v)
 
 		seq_printf(seq, "\n");
 
+		/* latency histograms, see SCHED_HIST_BUCKETS */
+		for (type = 0; type < NR_SCHED_LAT; type++) {
+			seq_printf(seq, "%s", sched_lat_names[type]);
+			for (i = 0; i < SCHED_HIST_BUCKETS; i++)
+				seq_printf(seq, " %llu",
+					   rq->rq_lat_hist.buckets[type][i]);
+			seq_printf(seq, "\n");
+		}
+
 #ifdef CONFIG_SMP
 		/* domain-specific stats */
 		rcu_read_lock();
@@ -63,12 +102,13 @@ static int show_schedstat(struct seq_file *seq, void *v)
 				    sd->lb_nobusyg[itype]);
 			}
 			seq_printf(seq,
-				   " %u %u %u %u %u %u %u %u %u %u %u %u\n",
+				   " %u %u %u %u %u %u %u %u %u %u %u %u %u %u\n",
 			    sd->alb_count, sd->alb_failed, sd->alb_pushed,
 			    sd->sbe_count, sd->sbe_balanced, sd->sbe_pushed,
 			    sd->sbf_count, sd->sbf_balanced, sd->sbf_pushed,
 			    sd->ttwu_wake_remote, sd->ttwu_move_affine,
-			    sd->ttwu_move_balance);
+			    sd->ttwu_move_balance,
+			    sd->sis_core_hit, sd->sis_core_miss);
 		}
 		rcu_read_unlock();
 #endif
@@ -29,6 +29,37 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 	if (rq)
 		rq->rq_sched_info.run_delay += delta;
 }
+
+extern void sched_lat_account(struct rq *rq, struct task_struct *p,
+			      enum sched_lat_type type, u64 delta);
+
+/*
+ * Expects runqueue lock to be held. Only the first request is stamped,
+ * preemption latency is measured from there.
+ */
+static inline void sched_lat_resched(struct rq *rq)
+{
+	if (!rq->resched_stamp)
+		rq->resched_stamp = rq->clock;
+}
+
+/*
+ * Called from __schedule() with a fresh rq->clock once the next task has
+ * been picked. Only a task that stays runnable was preempted; for one
+ * that blocks the request is moot.
+ */
+static inline void
+sched_lat_switch(struct rq *rq, struct task_struct *prev,
+		 struct task_struct *next)
+{
+	if (!rq->resched_stamp)
+		return;
+
+	if (prev != next && prev->on_rq && prev != rq->idle)
+		sched_lat_account(rq, prev, SCHED_LAT_PREEMPT,
+				  rq->clock - rq->resched_stamp);
+	rq->resched_stamp = 0;
+}
 # define schedstat_inc(rq, field)	do { (rq)->field++; } while (0)
 # define schedstat_add(rq, field, amt)	do { (rq)->field += (amt); } while (0)
 # define schedstat_set(var, val)	do { var = (val); } while (0)
@@ -42,6 +73,15 @@ rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 static inline void
 rq_sched_info_depart(struct rq *rq, unsigned long long delta)
 {}
+static inline void sched_lat_account(struct rq *rq, struct task_struct *p,
+				     enum sched_lat_type type, u64 delta)
+{}
+static inline void sched_lat_resched(struct rq *rq)
+{}
+static inline void
+sched_lat_switch(struct rq *rq, struct task_struct *prev,
+		 struct task_struct *next)
+{}
 # define schedstat_inc(rq, field)	do { } while (0)
 # define schedstat_add(rq, field, amt)	do { } while (0)
 # define schedstat_set(var, val)	do { } while (0)
@@ -89,6 +129,7 @@ static void sched_info_arrive(struct task_struct *t)
 	t->sched_info.pcount++;
 
 	rq_sched_info_arrive(task_rq(t), delta);
+	sched_lat_account(task_rq(t), t, SCHED_LAT_WAIT, delta);
 }
 
 /*
@@ -663,6 +663,7 @@ void __init smp_init(void)
 
 	/* Any cleanup work */
 	printk(KERN_INFO "Brought up %ld CPUs\n", (long)num_online_cpus());
+	cpu_up_report_timing();
 	smp_cpus_done(setup_max_cpus);
 }
 
@@ -36,6 +36,7 @@
 #include <linux/personality.h>
 #include <linux/ptrace.h>
 #include <linux/fs_struct.h>
+#include <linux/futex.h>
 #include <linux/file.h>
 #include <linux/mount.h>
 #include <linux/gfp.h>
@@ -2160,6 +2161,12 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 			if (arg2 || arg3 || arg4 || arg5)
 				return -EINVAL;
 			return current->no_new_privs ? 1 : 0;
+		case PR_SET_FUTEX_HASH:
+		case PR_GET_FUTEX_HASH:
+			if (arg3 || arg4 || arg5)
+				return -EINVAL;
+			error = futex_hash_prctl(option, arg2);
+			break;
 		default:
 			error = -EINVAL;
 			break;
@@ -78,6 +78,8 @@ cond_syscall(sys_msgsnd);
 cond_syscall(compat_sys_msgsnd);
 cond_syscall(sys_msgrcv);
 cond_syscall(compat_sys_msgrcv);
+cond_syscall(sys_msgsndv);
+cond_syscall(sys_msgrcvv);
 cond_syscall(sys_msgctl);
 cond_syscall(compat_sys_msgctl);
 cond_syscall(sys_shmget);
@@ -206,3 +208,11 @@ cond_syscall(compat_sys_open_by_handle_at);
 
 /* compare kernel pointers */
 cond_syscall(sys_kcmp);
+
+/* io_uring */
+cond_syscall(sys_io_uring_setup);
+cond_syscall(sys_io_uring_enter);
+cond_syscall(sys_io_uring_register);
+
+/* restartable sequences */
+cond_syscall(sys_rseq);
@@ -27,6 +27,7 @@
 #include <linux/cgroup.h>
 #include <linux/fs.h>
 #include <linux/file.h>
+#include <linux/pid_namespace.h>
 #include <net/genetlink.h>
 #include <linux/atomic.h>
 
@@ -51,7 +52,8 @@ static const struct nla_policy taskstats_cmd_get_policy[TASKSTATS_CMD_ATTR_MAX+1
 	[TASKSTATS_CMD_ATTR_PID]  = { .type = NLA_U32 },
 	[TASKSTATS_CMD_ATTR_TGID] = { .type = NLA_U32 },
 	[TASKSTATS_CMD_ATTR_REGISTER_CPUMASK] = { .type = NLA_STRING },
-	[TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK] = { .type = NLA_STRING },};
+	[TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK] = { .type = NLA_STRING },
+	[TASKSTATS_CMD_ATTR_FIELDS] = { .type = NLA_U32 },};
 
 static const struct nla_policy cgroupstats_cmd_get_policy[CGROUPSTATS_CMD_ATTR_MAX+1] = {
 	[CGROUPSTATS_CMD_ATTR_FD] = { .type = NLA_U32 },
@@ -174,7 +176,8 @@ static void send_cpu_listeners(struct sk_buff *skb,
 	up_write(&listeners->sem);
 }
 
-static void fill_stats(struct task_struct *tsk, struct taskstats *stats)
+static void fill_stats_fields(struct task_struct *tsk, struct taskstats *stats,
+			      u32 fields)
 {
 	memset(stats, 0, sizeof(*stats));
 	/*
@@ -184,16 +187,25 @@ static void fill_stats(struct task_struct *tsk, struct taskstats *stats)
 	 *	per-task-foo(stats, tsk);
 	 */
 
-	delayacct_add_tsk(stats, tsk);
+	if (fields & TASKSTATS_FIELD_DELAY)
+		delayacct_add_tsk(stats, tsk);
 
 	/* fill in basic acct fields */
 	stats->version = TASKSTATS_VERSION;
-	stats->nvcsw = tsk->nvcsw;
-	stats->nivcsw = tsk->nivcsw;
-	bacct_add_tsk(stats, tsk);
+	if (fields & TASKSTATS_FIELD_BASIC) {
+		stats->nvcsw = tsk->nvcsw;
+		stats->nivcsw = tsk->nivcsw;
+		bacct_add_tsk(stats, tsk);
+	}
 
 	/* fill in extended acct fields */
-	xacct_add_tsk(stats, tsk);
+	if (fields & TASKSTATS_FIELD_XACCT)
+		xacct_add_tsk(stats, tsk);
+}
+
+static void fill_stats(struct task_struct *tsk, struct taskstats *stats)
+{
+	fill_stats_fields(tsk, stats, TASKSTATS_FIELD_ALL);
 }
 
 static int fill_stats_for_pid(pid_t pid, struct taskstats *stats)
@@ -573,6 +585,68 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * Dump the stats of every task in the caller's pid namespace, one
+ * TASKSTATS_CMD_NEW message per task, in pid order. cb->args[0] holds
+ * the pid to resume from when the skb fills up.
+ */
+static int taskstats_user_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct pid_namespace *ns = task_active_pid_ns(current);
+	struct nlattr *attrs[TASKSTATS_CMD_ATTR_MAX + 1];
+	u32 fields = TASKSTATS_FIELD_ALL;
+	int nr = cb->args[0];
+	int rc;
+
+	rc = nlmsg_parse(cb->nlh, GENL_HDRLEN + family.hdrsize, attrs,
+			 TASKSTATS_CMD_ATTR_MAX, taskstats_cmd_get_policy);
+	if (rc < 0)
+		return rc;
+	if (attrs[TASKSTATS_CMD_ATTR_FIELDS])
+		fields = nla_get_u32(attrs[TASKSTATS_CMD_ATTR_FIELDS]);
+
+	for (;; nr++) {
+		struct task_struct *tsk;
+		struct taskstats *stats;
+		struct pid *pid;
+		void *hdr;
+
+		rcu_read_lock();
+		pid = find_ge_pid(nr, ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr_ns(pid, ns);
+		tsk = pid_task(pid, PIDTYPE_PID);
+		if (tsk)
+			get_task_struct(tsk);
+		rcu_read_unlock();
+		if (!tsk)
+			continue;
+
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				  cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				  TASKSTATS_CMD_NEW);
+		if (!hdr) {
+			put_task_struct(tsk);
+			break;
+		}
+		stats = mk_reply(skb, TASKSTATS_TYPE_PID, nr);
+		if (!stats) {
+			genlmsg_cancel(skb, hdr);
+			put_task_struct(tsk);
+			break;
+		}
+		fill_stats_fields(tsk, stats, fields);
+		put_task_struct(tsk);
+		genlmsg_end(skb, hdr);
+	}
+
+	cb->args[0] = nr;
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -659,6 +733,7 @@ err:
 static struct genl_ops taskstats_ops = {
 	.cmd		= TASKSTATS_CMD_GET,
 	.doit		= taskstats_user_cmd,
+	.dumpit		= taskstats_user_dump,
 	.policy		= taskstats_cmd_get_policy,
 	.flags		= GENL_ADMIN_PERM,
 };
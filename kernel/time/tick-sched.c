@@ -15,8 +15,11 @@
 #include <linux/err.h>
 #include <linux/hrtimer.h>
 #include <linux/interrupt.h>
+#include <linux/irq_work.h>
 #include <linux/kernel_stat.h>
 #include <linux/percpu.h>
+#include <linux/perf_event.h>
+#include <linux/posix-timers.h>
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/module.h>
@@ -271,6 +274,32 @@ u64 get_cpu_iowait_time_us(int cpu, u64 *last_update_time)
 }
 EXPORT_SYMBOL_GPL(get_cpu_iowait_time_us);
 
+static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
+{
+	hrtimer_cancel(&ts->sched_timer);
+	hrtimer_set_expires(&ts->sched_timer, ts->last_tick);
+
+	while (1) {
+		/* Forward the time to expire in the future */
+		hrtimer_forward(&ts->sched_timer, now, tick_period);
+
+		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
+			hrtimer_start_expires(&ts->sched_timer,
+					      HRTIMER_MODE_ABS_PINNED);
+			/* Check, if the timer was already in the past */
+			if (hrtimer_active(&ts->sched_timer))
+				break;
+		} else {
+			if (!tick_program_event(
+				hrtimer_get_expires(&ts->sched_timer), 0))
+				break;
+		}
+		/* Reread time and update jiffies */
+		now = ktime_get();
+		tick_do_update_jiffies64(now);
+	}
+}
+
 static ktime_t tick_nohz_stop_sched_tick(struct tick_sched *ts,
 					 ktime_t now, int cpu)
 {
@@ -301,6 +330,16 @@ static ktime_t tick_nohz_stop_sched_tick(struct tick_sched *ts,
 			delta_jiffies = rcu_delta_jiffies;
 		}
 	}
+	/*
+	 * A busy full dynticks CPU still needs a residual 1Hz tick: the
+	 * scheduler updates its clock, the current task's runtime and
+	 * the load averages from there.
+	 */
+	if (!ts->inidle && delta_jiffies > HZ) {
+		next_jiffies = last_jiffies + HZ;
+		delta_jiffies = HZ;
+	}
+
 	/*
 	 * Do not stop the tick, if we are only one off
 	 * or if the cpu is required for rcu
@@ -372,8 +411,10 @@ static ktime_t tick_nohz_stop_sched_tick(struct tick_sched *ts,
 		 * the scheduler tick in nohz_restart_sched_tick.
 		 */
 		if (!ts->tick_stopped) {
-			select_nohz_load_balancer(1);
-			calc_load_enter_idle();
+			if (ts->inidle) {
+				select_nohz_load_balancer(1);
+				calc_load_enter_idle();
+			}
 
 			ts->last_tick = hrtimer_get_expires(&ts->sched_timer);
 			ts->tick_stopped = 1;
@@ -413,6 +454,204 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_NO_HZ_FULL
+cpumask_var_t tick_nohz_full_mask;
+bool tick_nohz_full_running;
+
+/*
+ * Parse the nohz_full= boot option: the listed CPUs stop their tick
+ * while they run a single task. The boot CPU keeps the timekeeping
+ * duty and is therefore never part of the set.
+ */
+static int __init tick_nohz_full_setup(char *str)
+{
+	int cpu;
+
+	alloc_bootmem_cpumask_var(&tick_nohz_full_mask);
+	if (cpulist_parse(str, tick_nohz_full_mask) < 0) {
+		pr_warning("NOHZ: Incorrect nohz_full cpumask\n");
+		return 1;
+	}
+
+	cpu = smp_processor_id();
+	if (cpumask_test_cpu(cpu, tick_nohz_full_mask)) {
+		pr_warning("NOHZ: Clearing %d from nohz_full range for timekeeping\n",
+			   cpu);
+		cpumask_clear_cpu(cpu, tick_nohz_full_mask);
+	}
+	tick_nohz_full_running = true;
+
+	return 1;
+}
+__setup("nohz_full=", tick_nohz_full_setup);
+
+static bool can_stop_full_tick(void)
+{
+	WARN_ON_ONCE(!irqs_disabled());
+
+	/* More than one task runnable needs the tick for preemption */
+	if (!sched_can_stop_tick())
+		return false;
+
+	/* Posix cpu timers are checked and fired from the tick */
+	if (!posix_cpu_timers_can_stop_tick(current))
+		return false;
+
+	/* Perf multiplexes its events from the tick */
+	if (!perf_event_can_stop_tick())
+		return false;
+
+#ifdef CONFIG_HAVE_UNSTABLE_SCHED_CLOCK
+	/* sched_clock_tick() resyncs an unstable sched_clock */
+	if (!sched_clock_stable)
+		return false;
+#endif
+
+	/* RCU callbacks to run or a quiescent state to report */
+	if (rcu_nohz_full_needs_tick(smp_processor_id()))
+		return false;
+
+	return true;
+}
+
+static void tick_nohz_full_stop_tick(struct tick_sched *ts)
+{
+	int cpu = smp_processor_id();
+
+	if (!tick_nohz_full_cpu(cpu) || is_idle_task(current))
+		return;
+
+	if (!ts->tick_stopped && ts->nohz_mode == NOHZ_MODE_INACTIVE)
+		return;
+
+	if (!can_stop_full_tick())
+		return;
+
+	tick_nohz_stop_sched_tick(ts, ktime_get(), cpu);
+}
+
+/*
+ * Re-evaluate the need for the tick on a busy full dynticks CPU and
+ * restart it if something showed up that relies on it. Must be called
+ * with interrupts disabled.
+ */
+void tick_nohz_full_check(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+	ktime_t now;
+
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		return;
+
+	if (!ts->tick_stopped || ts->inidle || can_stop_full_tick())
+		return;
+
+	now = ktime_get();
+	tick_do_update_jiffies64(now);
+	touch_softlockup_watchdog();
+	ts->tick_stopped = 0;
+	tick_nohz_restart(ts, now);
+}
+
+static void nohz_full_kick_work_func(struct irq_work *work)
+{
+	tick_nohz_full_check();
+}
+
+static DEFINE_PER_CPU(struct irq_work, nohz_full_kick_work) = {
+	.func = nohz_full_kick_work_func,
+};
+
+/*
+ * Kick the current CPU if it's full dynticks in order to force it to
+ * re-evaluate its dependency on the tick and restart it if necessary.
+ */
+void tick_nohz_full_kick(void)
+{
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		return;
+
+	if (__get_cpu_var(tick_cpu_sched).tick_stopped)
+		irq_work_queue(&__get_cpu_var(nohz_full_kick_work));
+}
+
+static void nohz_full_kick_ipi(void *info)
+{
+	tick_nohz_full_check();
+}
+
+/*
+ * Kick all full dynticks CPUs in order to force these to re-evaluate
+ * their dependency on the tick and restart it if necessary. Must be
+ * called from process context with interrupts enabled.
+ */
+void tick_nohz_full_kick_all(void)
+{
+	if (!tick_nohz_full_running)
+		return;
+
+	preempt_disable();
+	smp_call_function_many(tick_nohz_full_mask,
+			       nohz_full_kick_ipi, NULL, false);
+	tick_nohz_full_kick();
+	preempt_enable();
+}
+
+/*
+ * Called after a context switch: the incoming task may need the tick
+ * for its own posix cpu timers.
+ */
+void tick_nohz_task_switch(void)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	if (!tick_nohz_full_cpu(smp_processor_id()))
+		goto out;
+
+	if (__get_cpu_var(tick_cpu_sched).tick_stopped && !can_stop_full_tick())
+		tick_nohz_full_kick();
+out:
+	local_irq_restore(flags);
+}
+
+/*
+ * The tick of a busy full dynticks CPU may have been stopped for many
+ * jiffies while update_process_times() only accounts the current one.
+ * Charge the missing ticks to the current task, in the mode the tick
+ * found it in.
+ */
+static void tick_nohz_full_account_ticks(struct tick_sched *ts, int cpu,
+					 int user)
+{
+#ifndef CONFIG_VIRT_CPU_ACCOUNTING
+	unsigned long ticks = jiffies - ts->full_jiffies;
+	cputime_t delta;
+
+	ts->full_jiffies = jiffies;
+
+	if (!tick_nohz_full_cpu(cpu) || ts->inidle || is_idle_task(current))
+		return;
+
+	/* We might be one off. Do not randomly account a huge number of ticks! */
+	if (ticks <= 1 || ticks >= LONG_MAX)
+		return;
+
+	delta = jiffies_to_cputime(ticks - 1);
+	if (user)
+		account_user_time(current, delta, cputime_to_scaled(delta));
+	else
+		account_system_time(current, HARDIRQ_OFFSET, delta,
+				    cputime_to_scaled(delta));
+#endif
+}
+#else
+static inline void tick_nohz_full_stop_tick(struct tick_sched *ts) { }
+static inline void tick_nohz_full_account_ticks(struct tick_sched *ts,
+						int cpu, int user) { }
+#endif /* CONFIG_NO_HZ_FULL */
+
 static bool can_stop_idle_tick(int cpu, struct tick_sched *ts)
 {
 	/*
@@ -433,6 +672,21 @@ static bool can_stop_idle_tick(int cpu, struct tick_sched *ts)
 	if (need_resched())
 		return false;
 
+	if (tick_nohz_full_enabled()) {
+		/*
+		 * Keep the tick alive to guarantee timekeeping progression
+		 * while there are full dynticks CPUs around.
+		 */
+		if (tick_do_timer_cpu == cpu)
+			return false;
+		/*
+		 * Boot safety: make sure the timekeeping duty has been
+		 * assigned before entering dyntick-idle mode.
+		 */
+		if (tick_do_timer_cpu == TICK_DO_TIMER_NONE)
+			return false;
+	}
+
 	if (unlikely(local_softirq_pending() && cpu_online(cpu))) {
 		static int ratelimit;
 
@@ -505,6 +759,16 @@ void tick_nohz_idle_enter(void)
 	 * update of the idle time accounting in tick_nohz_start_idle().
 	 */
 	ts->inidle = 1;
+	/*
+	 * A full dynticks CPU may get here with its tick already stopped
+	 * while it was busy. Do the idle bookkeeping the first stop in
+	 * tick_nohz_stop_sched_tick() would otherwise have done.
+	 */
+	if (ts->tick_stopped) {
+		select_nohz_load_balancer(1);
+		calc_load_enter_idle();
+		ts->idle_jiffies = jiffies;
+	}
 	__tick_nohz_idle_enter(ts);
 
 	local_irq_enable();
@@ -517,15 +781,17 @@ void tick_nohz_idle_enter(void)
  * a reschedule, it may still add, modify or delete a timer, enqueue
  * an RCU callback, etc...
  * So we need to re-calculate and reprogram the next tick event.
+ *
+ * On a busy full dynticks CPU this is where the tick gets stopped.
  */
 void tick_nohz_irq_exit(void)
 {
 	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
 
-	if (!ts->inidle)
-		return;
-
-	__tick_nohz_idle_enter(ts);
+	if (ts->inidle)
+		__tick_nohz_idle_enter(ts);
+	else
+		tick_nohz_full_stop_tick(ts);
 }
 
 /**
@@ -540,32 +806,6 @@ ktime_t tick_nohz_get_sleep_length(void)
 	return ts->sleep_length;
 }
 
-static void tick_nohz_restart(struct tick_sched *ts, ktime_t now)
-{
-	hrtimer_cancel(&ts->sched_timer);
-	hrtimer_set_expires(&ts->sched_timer, ts->last_tick);
-
-	while (1) {
-		/* Forward the time to expire in the future */
-		hrtimer_forward(&ts->sched_timer, now, tick_period);
-
-		if (ts->nohz_mode == NOHZ_MODE_HIGHRES) {
-			hrtimer_start_expires(&ts->sched_timer,
-					      HRTIMER_MODE_ABS_PINNED);
-			/* Check, if the timer was already in the past */
-			if (hrtimer_active(&ts->sched_timer))
-				break;
-		} else {
-			if (!tick_program_event(
-				hrtimer_get_expires(&ts->sched_timer), 0))
-				break;
-		}
-		/* Reread time and update jiffies */
-		now = ktime_get();
-		tick_do_update_jiffies64(now);
-	}
-}
-
 static void tick_nohz_restart_sched_tick(struct tick_sched *ts, ktime_t now)
 {
 	/* Update jiffies first */
@@ -598,6 +838,7 @@ static void tick_nohz_account_idle_ticks(struct tick_sched *ts)
 	 */
 	if (ticks && ticks < LONG_MAX)
 		account_idle_ticks(ticks);
+	ts->full_jiffies = jiffies;
 #endif
 }
 
@@ -659,7 +900,8 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 
 	/* Check, if the jiffies need an update */
@@ -676,9 +918,11 @@ static void tick_nohz_handler(struct clock_event_device *dev)
 	 */
 	if (ts->tick_stopped) {
 		touch_softlockup_watchdog();
-		ts->idle_jiffies++;
+		if (ts->inidle)
+			ts->idle_jiffies++;
 	}
 
+	tick_nohz_full_account_ticks(ts, cpu, user_mode(regs));
 	update_process_times(user_mode(regs));
 	profile_tick(CPU_PROFILING);
 
@@ -775,6 +1019,8 @@ static inline void tick_check_nohz(int cpu)
 
 static inline void tick_nohz_switch_to_nohz(void) { }
 static inline void tick_check_nohz(int cpu) { }
+static inline void tick_nohz_full_account_ticks(struct tick_sched *ts,
+						int cpu, int user) { }
 
 #endif /* NO_HZ */
 
@@ -811,7 +1057,8 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 	 * this duty, then the jiffies update is still serialized by
 	 * xtime_lock.
 	 */
-	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE))
+	if (unlikely(tick_do_timer_cpu == TICK_DO_TIMER_NONE) &&
+	    !tick_nohz_full_cpu(cpu))
 		tick_do_timer_cpu = cpu;
 #endif
 
@@ -837,6 +1084,7 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 			if (idle_cpu(cpu))
 				ts->idle_jiffies++;
 		}
+		tick_nohz_full_account_ticks(ts, cpu, user_mode(regs));
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
 	}
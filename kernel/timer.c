@@ -55,34 +55,91 @@ u64 jiffies_64 __cacheline_aligned_in_smp = INITIAL_JIFFIES;
 EXPORT_SYMBOL(jiffies_64);
 
 /*
- * per-CPU timer vector definitions:
+ * The timer wheel has LVL_DEPTH levels of LVL_SIZE buckets each. Level 0
+ * has a granularity of one jiffy, each further level is LVL_CLK_DIV times
+ * coarser than the one below it:
+ *
+ * HZ 1000, LVL_DEPTH 9
+ * Level Offset  Granularity            Range
+ *  0      0         1 ms                0 ms -         62 ms
+ *  1     64         8 ms               63 ms -        503 ms
+ *  2    128        64 ms              504 ms -       4031 ms (~4s)
+ *  3    192       512 ms             4032 ms -      32255 ms (~32s)
+ *  4    256      4096 ms (~4s)      32256 ms -     258047 ms (~4m)
+ *  5    320     32768 ms (~32s)    258048 ms -    2064383 ms (~34m)
+ *  6    384    262144 ms (~4m)    2064384 ms -   16515071 ms (~4h)
+ *  7    448   2097152 ms (~34m)  16515072 ms -  132120575 ms (~1d)
+ *  8    512  16777216 ms (~4h)  132120576 ms - 1056964607 ms (~12d)
+ *
+ * A timer is queued once, in the level whose range covers its timeout,
+ * and its expiry is rounded up to that level's granularity. Timers are
+ * never moved between levels, so there is no cascading: enqueue, removal
+ * and expiry are all O(1), at the cost of firing up to 1/8th of the
+ * timeout late. That suits the bulk of the timers in the system, which
+ * are timeouts (networking, I/O, watchdogs) that get cancelled or
+ * re-armed long before they would expire.
+ *
+ * Each level's buckets are advanced by base clock bits of their own, so
+ * a level is only looked at when all bits of the levels below it are
+ * zero. The pending_map bitmap has a bit per non-empty bucket and lets
+ * the next expiry be found without walking any timer list.
  */
-#define TVN_BITS (CONFIG_BASE_SMALL ? 4 : 6)
-#define TVR_BITS (CONFIG_BASE_SMALL ? 6 : 8)
-#define TVN_SIZE (1 << TVN_BITS)
-#define TVR_SIZE (1 << TVR_BITS)
-#define TVN_MASK (TVN_SIZE - 1)
-#define TVR_MASK (TVR_SIZE - 1)
-
-struct tvec {
-	struct list_head vec[TVN_SIZE];
-};
+#define LVL_CLK_SHIFT	3
+#define LVL_CLK_DIV	(1UL << LVL_CLK_SHIFT)
+#define LVL_CLK_MASK	(LVL_CLK_DIV - 1)
+#define LVL_SHIFT(n)	((n) * LVL_CLK_SHIFT)
+#define LVL_GRAN(n)	(1UL << LVL_SHIFT(n))
+
+/*
+ * The first timeout that goes to level n. One bucket less than the full
+ * level range, so the rounded up expiry never wraps into the bucket that
+ * is about to be collected.
+ */
+#define LVL_START(n)	((LVL_SIZE - 1) << (((n) - 1) * LVL_CLK_SHIFT))
+
+#define LVL_BITS	6
+#define LVL_SIZE	(1UL << LVL_BITS)
+#define LVL_MASK	(LVL_SIZE - 1)
+#define LVL_OFFS(n)	((n) * LVL_SIZE)
 
-struct tvec_root {
-	struct list_head vec[TVR_SIZE];
+/* With HZ <= 100 eight levels already cover more than a year */
+#if HZ > 100
+# define LVL_DEPTH	9
+#else
+# define LVL_DEPTH	8
+#endif
+
+/* Timeouts beyond the last level are clamped to its capacity */
+#define WHEEL_TIMEOUT_CUTOFF	(LVL_START(LVL_DEPTH))
+#define WHEEL_TIMEOUT_MAX	(WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
+
+#define WHEEL_SIZE	(LVL_SIZE * LVL_DEPTH)
+
+struct tvec_wheel {
+	unsigned long clk;
+	DECLARE_BITMAP(pending_map, WHEEL_SIZE);
+	struct list_head vectors[WHEEL_SIZE];
 };
 
+/*
+ * Deferrable timers get a wheel of their own when NO_HZ is enabled, so
+ * that finding the next event for an idle CPU never has to step over
+ * them: it is a bitmap search in the standard wheel only. The deferrable
+ * wheel catches up whenever the CPU runs its timers again.
+ */
+#define WHEEL_STD	0
+#ifdef CONFIG_NO_HZ
+# define WHEEL_DEF	1
+# define NR_WHEELS	2
+#else
+# define WHEEL_DEF	WHEEL_STD
+# define NR_WHEELS	1
+#endif
+
 struct tvec_base {
 	spinlock_t lock;
 	struct timer_list *running_timer;
-	unsigned long timer_jiffies;
-	unsigned long next_timer;
-	unsigned long active_timers;
-	struct tvec_root tv1;
-	struct tvec tv2;
-	struct tvec tv3;
-	struct tvec tv4;
-	struct tvec tv5;
+	struct tvec_wheel wheels[NR_WHEELS];
 } ____cacheline_aligned;
 
 struct tvec_base boot_tvec_bases;
@@ -112,6 +169,13 @@ timer_set_base(struct timer_list *timer, struct tvec_base *new_base)
 				      tbase_get_deferrable(timer->base));
 }
 
+static inline struct tvec_wheel *
+timer_wheel(struct tvec_base *base, struct timer_list *timer)
+{
+	return &base->wheels[tbase_get_deferrable(timer->base) ?
+			     WHEEL_DEF : WHEEL_STD];
+}
+
 static unsigned long round_jiffies_common(unsigned long j, int cpu,
 		bool force_up)
 {
@@ -331,60 +395,133 @@ void set_timer_slack(struct timer_list *timer, int slack_hz)
 }
 EXPORT_SYMBOL_GPL(set_timer_slack);
 
-static void
-__internal_add_timer(struct tvec_base *base, struct timer_list *timer)
-{
-	unsigned long expires = timer->expires;
-	unsigned long idx = expires - base->timer_jiffies;
-	struct list_head *vec;
-
-	if (idx < TVR_SIZE) {
-		int i = expires & TVR_MASK;
-		vec = base->tv1.vec + i;
-	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
-		int i = (expires >> TVR_BITS) & TVN_MASK;
-		vec = base->tv2.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		vec = base->tv3.vec + i;
-	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
-		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv4.vec + i;
-	} else if ((signed long) idx < 0) {
+/*
+ * Bucket for an expiry on level @lvl. The expiry is rounded up to the
+ * level granularity so that the timer never fires early.
+ */
+static inline unsigned int calc_index(unsigned long expires, unsigned int lvl)
+{
+	expires = (expires + LVL_GRAN(lvl) - 1) >> LVL_SHIFT(lvl);
+	return LVL_OFFS(lvl) + (expires & LVL_MASK);
+}
+
+static unsigned int calc_wheel_index(unsigned long expires, unsigned long clk)
+{
+	unsigned long delta = expires - clk;
+	unsigned int lvl;
+
+	if ((long) delta < 0) {
 		/*
 		 * Can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		vec = base->tv1.vec + (base->timer_jiffies & TVR_MASK);
-	} else {
-		int i;
-		/* If the timeout is larger than 0xffffffff on 64-bit
-		 * architectures then we use the maximum timeout:
-		 */
-		if (idx > 0xffffffffUL) {
-			idx = 0xffffffffUL;
-			expires = idx + base->timer_jiffies;
+		return clk & LVL_MASK;
+	}
+
+	for (lvl = 0; lvl < LVL_DEPTH - 1; lvl++) {
+		if (delta < LVL_START(lvl + 1))
+			return calc_index(expires, lvl);
+	}
+
+	/*
+	 * Larger timeouts than the wheel can hold expire at the capacity
+	 * limit of the last level.
+	 */
+	if (delta >= WHEEL_TIMEOUT_CUTOFF)
+		expires = clk + WHEEL_TIMEOUT_MAX;
+
+	return calc_index(expires, LVL_DEPTH - 1);
+}
+
+/*
+ * Distance from @clk to the next pending bucket of the level starting at
+ * @offset, or -1 if the level is empty.
+ */
+static int next_pending_bucket(struct tvec_wheel *wheel, unsigned int offset,
+			       unsigned int clk)
+{
+	unsigned int pos, start = offset + clk;
+	unsigned int end = offset + LVL_SIZE;
+
+	pos = find_next_bit(wheel->pending_map, end, start);
+	if (pos < end)
+		return pos - start;
+
+	pos = find_next_bit(wheel->pending_map, start, offset);
+	return pos < start ? pos + LVL_SIZE - start : -1;
+}
+
+/*
+ * Find the expiry of the first pending bucket: a bitmap search per level,
+ * no timer list is walked. Called with the base lock held.
+ */
+static unsigned long __next_timer_interrupt(struct tvec_wheel *wheel)
+{
+	unsigned long clk, next, adj;
+	unsigned int lvl, offset = 0;
+
+	next = wheel->clk + NEXT_TIMER_MAX_DELTA;
+	clk = wheel->clk;
+	for (lvl = 0; lvl < LVL_DEPTH; lvl++, offset += LVL_SIZE) {
+		int pos = next_pending_bucket(wheel, offset, clk & LVL_MASK);
+
+		if (pos >= 0) {
+			unsigned long tmp = clk + (unsigned long) pos;
+
+			tmp <<= LVL_SHIFT(lvl);
+			if (time_before(tmp, next))
+				next = tmp;
 		}
-		i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		vec = base->tv5.vec + i;
+		/*
+		 * Clock of the next level. If the lower bits of this level's
+		 * clock are not zero, the current bucket of the next level
+		 * has already been collected and the first one that can
+		 * still expire is the one after it.
+		 */
+		adj = clk & LVL_CLK_MASK ? 1 : 0;
+		clk >>= LVL_CLK_SHIFT;
+		clk += adj;
 	}
+	return next;
+}
+
+/*
+ * After the CPU has been idle the wheel clock lags behind jiffies. New
+ * timers would then be queued relative to a stale clock and end up on a
+ * coarser level than their timeout warrants, so move the clock forward
+ * first - but never past a pending bucket.
+ */
+static void forward_timer_wheel(struct tvec_wheel *wheel)
+{
+	unsigned long jnow = jiffies;
+	unsigned long next;
+
+	if ((long)(jnow - wheel->clk) < 2)
+		return;
+
+	next = __next_timer_interrupt(wheel);
+	wheel->clk = time_after(next, jnow) ? jnow : next;
+}
+
+static void
+__internal_add_timer(struct tvec_wheel *wheel, struct timer_list *timer)
+{
+	unsigned int idx = calc_wheel_index(timer->expires, wheel->clk);
+
 	/*
 	 * Timers are FIFO:
 	 */
-	list_add_tail(&timer->entry, vec);
+	list_add_tail(&timer->entry, wheel->vectors + idx);
+	__set_bit(idx, wheel->pending_map);
+	timer->idx = idx;
 }
 
 static void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 {
-	__internal_add_timer(base, timer);
-	/*
-	 * Update base->active_timers and base->next_timer
-	 */
-	if (!tbase_get_deferrable(timer->base)) {
-		if (time_before(timer->expires, base->next_timer))
-			base->next_timer = timer->expires;
-		base->active_timers++;
-	}
+	struct tvec_wheel *wheel = timer_wheel(base, timer);
+
+	forward_timer_wheel(wheel);
+	__internal_add_timer(wheel, timer);
 }
 
 #ifdef CONFIG_TIMER_STATS
@@ -681,26 +818,22 @@ static inline void detach_timer(struct timer_list *timer, bool clear_pending)
 	entry->prev = LIST_POISON2;
 }
 
-static inline void
-detach_expired_timer(struct timer_list *timer, struct tvec_base *base)
-{
-	detach_timer(timer, true);
-	if (!tbase_get_deferrable(timer->base))
-		timer->base->active_timers--;
-}
-
 static int detach_if_pending(struct timer_list *timer, struct tvec_base *base,
 			     bool clear_pending)
 {
+	struct tvec_wheel *wheel;
+
 	if (!timer_pending(timer))
 		return 0;
 
 	detach_timer(timer, clear_pending);
-	if (!tbase_get_deferrable(timer->base)) {
-		timer->base->active_timers--;
-		if (timer->expires == base->next_timer)
-			base->next_timer = base->timer_jiffies;
-	}
+	/*
+	 * The timer may sit on the private list of __run_timers() rather
+	 * than in its bucket, in which case the bucket state is left alone.
+	 */
+	wheel = timer_wheel(base, timer);
+	if (list_empty(wheel->vectors + timer->idx))
+		__clear_bit(timer->idx, wheel->pending_map);
 	return 1;
 }
 
@@ -710,7 +843,7 @@ static int detach_if_pending(struct timer_list *timer, struct tvec_base *base,
  * locked, and the base itself is locked too.
  *
  * So __run_timers/migrate_timers can safely modify all timers which could
- * be found on ->tvX lists.
+ * be found in the wheel buckets.
  *
  * When the timer's base is locked, and the timer removed from list, it is
  * possible to set timer->base = NULL and drop the lock: the timer remains
@@ -749,6 +882,21 @@ __mod_timer(struct timer_list *timer, unsigned long expires,
 
 	base = lock_timer_base(timer, &flags);
 
+	/*
+	 * Re-arming a pending timer to an expiry that lands in the same
+	 * bucket only has to update the expiry. Networking re-arms its
+	 * timeouts for nearly every packet, so this is the common case.
+	 */
+	if (timer_pending(timer)) {
+		struct tvec_wheel *wheel = timer_wheel(base, timer);
+
+		if (calc_wheel_index(expires, wheel->clk) == timer->idx) {
+			timer->expires = expires;
+			ret = 1;
+			goto out_unlock;
+		}
+	}
+
 	ret = detach_if_pending(timer, base, false);
 	if (!ret && pending_only)
 		goto out_unlock;
@@ -1084,27 +1232,6 @@ int del_timer_sync(struct timer_list *timer)
 EXPORT_SYMBOL(del_timer_sync);
 #endif
 
-static int cascade(struct tvec_base *base, struct tvec *tv, int index)
-{
-	/* cascade all the timers from tv up one level */
-	struct timer_list *timer, *tmp;
-	struct list_head tv_list;
-
-	list_replace_init(tv->vec + index, &tv_list);
-
-	/*
-	 * We are removing _all_ timers from the list, so we
-	 * don't have to detach them individually.
-	 */
-	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
-		BUG_ON(tbase_get_base(timer->base) != base);
-		/* No accounting, while moving them */
-		__internal_add_timer(base, timer);
-	}
-
-	return index;
-}
-
 static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 			  unsigned long data)
 {
@@ -1148,133 +1275,94 @@ static void call_timer_fn(struct timer_list *timer, void (*fn)(unsigned long),
 	}
 }
 
-#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
+/*
+ * Move the buckets that are due at wheel->clk onto @heads: the level 0
+ * bucket always, each higher level only when the clock bits of all the
+ * levels below it are zero.
+ */
+static int collect_expired_timers(struct tvec_wheel *wheel,
+				  struct list_head *heads)
+{
+	unsigned long clk = wheel->clk;
+	unsigned int idx;
+	int i, levels = 0;
+
+	for (i = 0; i < LVL_DEPTH; i++) {
+		idx = (clk & LVL_MASK) + i * LVL_SIZE;
+
+		if (__test_and_clear_bit(idx, wheel->pending_map))
+			list_replace_init(wheel->vectors + idx, heads + levels++);
+
+		/* Is it time to look at the next level? */
+		if (clk & LVL_CLK_MASK)
+			break;
+		/* Shift clock for the next level granularity */
+		clk >>= LVL_CLK_SHIFT;
+	}
+	return levels;
+}
+
+static void expire_timers(struct tvec_base *base, struct list_head *head)
+{
+	struct timer_list *timer;
+
+	while (!list_empty(head)) {
+		void (*fn)(unsigned long);
+		unsigned long data;
+
+		timer = list_first_entry(head, struct timer_list, entry);
+		fn = timer->function;
+		data = timer->data;
+
+		timer_stats_account_timer(timer);
+
+		base->running_timer = timer;
+		detach_timer(timer, true);
+
+		spin_unlock_irq(&base->lock);
+		call_timer_fn(timer, fn, data);
+		spin_lock_irq(&base->lock);
+	}
+}
+
+static void __run_wheel(struct tvec_base *base, struct tvec_wheel *wheel)
+{
+	struct list_head heads[LVL_DEPTH];
+	int levels;
+
+	while (time_after_eq(jiffies, wheel->clk)) {
+		/*
+		 * After a long idle period skip straight to the next
+		 * pending bucket instead of stepping through every jiffy.
+		 */
+		forward_timer_wheel(wheel);
+
+		levels = collect_expired_timers(wheel, heads);
+		wheel->clk++;
+
+		while (levels--)
+			expire_timers(base, heads + levels);
+	}
+}
 
 /**
  * __run_timers - run all expired timers (if any) on this CPU.
  * @base: the timer vector to be processed.
  *
- * This function cascades all vectors and executes all expired timer
- * vectors.
+ * This function executes all expired timer vectors.
  */
 static inline void __run_timers(struct tvec_base *base)
 {
-	struct timer_list *timer;
+	int i;
 
 	spin_lock_irq(&base->lock);
-	while (time_after_eq(jiffies, base->timer_jiffies)) {
-		struct list_head work_list;
-		struct list_head *head = &work_list;
-		int index = base->timer_jiffies & TVR_MASK;
-
-		/*
-		 * Cascade timers:
-		 */
-		if (!index &&
-			(!cascade(base, &base->tv2, INDEX(0))) &&
-				(!cascade(base, &base->tv3, INDEX(1))) &&
-					!cascade(base, &base->tv4, INDEX(2)))
-			cascade(base, &base->tv5, INDEX(3));
-		++base->timer_jiffies;
-		list_replace_init(base->tv1.vec + index, &work_list);
-		while (!list_empty(head)) {
-			void (*fn)(unsigned long);
-			unsigned long data;
-
-			timer = list_first_entry(head, struct timer_list,entry);
-			fn = timer->function;
-			data = timer->data;
-
-			timer_stats_account_timer(timer);
-
-			base->running_timer = timer;
-			detach_expired_timer(timer, base);
-
-			spin_unlock_irq(&base->lock);
-			call_timer_fn(timer, fn, data);
-			spin_lock_irq(&base->lock);
-		}
-	}
+	for (i = 0; i < NR_WHEELS; i++)
+		__run_wheel(base, &base->wheels[i]);
 	base->running_timer = NULL;
 	spin_unlock_irq(&base->lock);
 }
 
 #ifdef CONFIG_NO_HZ
-/*
- * Find out when the next timer event is due to happen. This
- * is used on S/390 to stop all activity when a CPU is idle.
- * This function needs to be called with interrupts disabled.
- */
-static unsigned long __next_timer_interrupt(struct tvec_base *base)
-{
-	unsigned long timer_jiffies = base->timer_jiffies;
-	unsigned long expires = timer_jiffies + NEXT_TIMER_MAX_DELTA;
-	int index, slot, array, found = 0;
-	struct timer_list *nte;
-	struct tvec *varray[4];
-
-	/* Look for timer events in tv1. */
-	index = slot = timer_jiffies & TVR_MASK;
-	do {
-		list_for_each_entry(nte, base->tv1.vec + slot, entry) {
-			if (tbase_get_deferrable(nte->base))
-				continue;
-
-			found = 1;
-			expires = nte->expires;
-			/* Look at the cascade bucket(s)? */
-			if (!index || slot < index)
-				goto cascade;
-			return expires;
-		}
-		slot = (slot + 1) & TVR_MASK;
-	} while (slot != index);
-
-cascade:
-	/* Calculate the next cascade event */
-	if (index)
-		timer_jiffies += TVR_SIZE - index;
-	timer_jiffies >>= TVR_BITS;
-
-	/* Check tv2-tv5. */
-	varray[0] = &base->tv2;
-	varray[1] = &base->tv3;
-	varray[2] = &base->tv4;
-	varray[3] = &base->tv5;
-
-	for (array = 0; array < 4; array++) {
-		struct tvec *varp = varray[array];
-
-		index = slot = timer_jiffies & TVN_MASK;
-		do {
-			list_for_each_entry(nte, varp->vec + slot, entry) {
-				if (tbase_get_deferrable(nte->base))
-					continue;
-
-				found = 1;
-				if (time_before(nte->expires, expires))
-					expires = nte->expires;
-			}
-			/*
-			 * Do we still search for the first timer or are
-			 * we looking up the cascade buckets ?
-			 */
-			if (found) {
-				/* Look at the cascade bucket(s)? */
-				if (!index || slot < index)
-					break;
-				return expires;
-			}
-			slot = (slot + 1) & TVN_MASK;
-		} while (slot != index);
-
-		if (index)
-			timer_jiffies += TVN_SIZE - index;
-		timer_jiffies >>= TVN_BITS;
-	}
-	return expires;
-}
-
 /*
  * Check, if the next hrtimer event is before the next timer wheel
  * event:
@@ -1336,11 +1424,7 @@ unsigned long get_next_timer_interrupt(unsigned long now)
 		return expires;
 
 	spin_lock(&base->lock);
-	if (base->active_timers) {
-		if (time_before_eq(base->next_timer, base->timer_jiffies))
-			base->next_timer = __next_timer_interrupt(base);
-		expires = base->next_timer;
-	}
+	expires = __next_timer_interrupt(&base->wheels[WHEEL_STD]);
 	spin_unlock(&base->lock);
 
 	if (time_before_eq(expires, now))
@@ -1381,7 +1465,8 @@ static void run_timer_softirq(struct softirq_action *h)
 
 	hrtimer_run_pending();
 
-	if (time_after_eq(jiffies, base->timer_jiffies))
+	if (time_after_eq(jiffies, base->wheels[WHEEL_STD].clk) ||
+	    time_after_eq(jiffies, base->wheels[WHEEL_DEF].clk))
 		__run_timers(base);
 }
 
@@ -1656,7 +1741,7 @@ SYSCALL_DEFINE1(sysinfo, struct sysinfo __user *, info)
 
 static int __cpuinit init_timers_cpu(int cpu)
 {
-	int j;
+	int i, j;
 	struct tvec_base *base;
 	static char __cpuinitdata tvec_base_done[NR_CPUS];
 
@@ -1697,18 +1782,14 @@ static int __cpuinit init_timers_cpu(int cpu)
 
 	spin_lock_init(&base->lock);
 
-	for (j = 0; j < TVN_SIZE; j++) {
-		INIT_LIST_HEAD(base->tv5.vec + j);
-		INIT_LIST_HEAD(base->tv4.vec + j);
-		INIT_LIST_HEAD(base->tv3.vec + j);
-		INIT_LIST_HEAD(base->tv2.vec + j);
-	}
-	for (j = 0; j < TVR_SIZE; j++)
-		INIT_LIST_HEAD(base->tv1.vec + j);
+	for (i = 0; i < NR_WHEELS; i++) {
+		struct tvec_wheel *wheel = &base->wheels[i];
 
-	base->timer_jiffies = jiffies;
-	base->next_timer = base->timer_jiffies;
-	base->active_timers = 0;
+		for (j = 0; j < WHEEL_SIZE; j++)
+			INIT_LIST_HEAD(wheel->vectors + j);
+		bitmap_zero(wheel->pending_map, WHEEL_SIZE);
+		wheel->clk = jiffies;
+	}
 	return 0;
 }
 
@@ -1730,7 +1811,7 @@ static void __cpuinit migrate_timers(int cpu)
 {
 	struct tvec_base *old_base;
 	struct tvec_base *new_base;
-	int i;
+	int i, j;
 
 	BUG_ON(cpu_online(cpu));
 	old_base = per_cpu(tvec_bases, cpu);
@@ -1744,13 +1825,10 @@ static void __cpuinit migrate_timers(int cpu)
 
 	BUG_ON(old_base->running_timer);
 
-	for (i = 0; i < TVR_SIZE; i++)
-		migrate_timer_list(new_base, old_base->tv1.vec + i);
-	for (i = 0; i < TVN_SIZE; i++) {
-		migrate_timer_list(new_base, old_base->tv2.vec + i);
-		migrate_timer_list(new_base, old_base->tv3.vec + i);
-		migrate_timer_list(new_base, old_base->tv4.vec + i);
-		migrate_timer_list(new_base, old_base->tv5.vec + i);
+	for (i = 0; i < NR_WHEELS; i++) {
+		for (j = 0; j < WHEEL_SIZE; j++)
+			migrate_timer_list(new_base,
+					   old_base->wheels[i].vectors + j);
 	}
 
 	spin_unlock(&old_base->lock);
@@ -100,6 +100,8 @@ ftrace_func_t ftrace_pid_function __read_mostly = ftrace_stub;
 static struct ftrace_ops global_ops;
 static struct ftrace_ops control_ops;
 
+static void ftrace_update_trampoline(struct ftrace_ops *ops);
+
 static void
 ftrace_ops_list_func(unsigned long ip, unsigned long parent_ip);
 
@@ -228,6 +230,9 @@ static void update_ftrace_function(void)
 
 	update_global_ops();
 
+	/* A trampoline of global_ops calls global_ops.func directly */
+	ftrace_update_trampoline(&global_ops);
+
 	/*
 	 * If we are at the end of the list and this ops is
 	 * not dynamic, then have the mcount trampoline call
@@ -1523,10 +1528,10 @@ static void __ftrace_hash_rec_update(struct ftrace_ops *ops,
 
 		if (inc) {
 			rec->flags++;
-			if (FTRACE_WARN_ON((rec->flags & ~FTRACE_FL_MASK) == FTRACE_REF_MAX))
+			if (FTRACE_WARN_ON(ftrace_rec_count(rec) == FTRACE_REF_MAX))
 				return;
 		} else {
-			if (FTRACE_WARN_ON((rec->flags & ~FTRACE_FL_MASK) == 0))
+			if (FTRACE_WARN_ON(ftrace_rec_count(rec) == 0))
 				return;
 			rec->flags--;
 		}
@@ -1598,6 +1603,56 @@ void ftrace_bug(int failed, unsigned long ip)
 	}
 }
 
+/*
+ * Find the ftrace_ops with its own trampoline that traces @rec, if any.
+ * Only meaningful when that ops is the sole user of the record.
+ */
+static struct ftrace_ops *ftrace_find_tramp_ops(struct dyn_ftrace *rec)
+{
+	struct ftrace_ops *op;
+
+	for (op = ftrace_ops_list; op != &ftrace_list_end; op = op->next) {
+		if (op->trampoline && (op->flags & FTRACE_OPS_FL_ENABLED) &&
+		    ftrace_ops_test(op, rec->ip))
+			return op;
+	}
+
+	return NULL;
+}
+
+/**
+ * ftrace_get_addr_new - find the address the record should call
+ * @rec: the record to check
+ *
+ * A record traced by a single ftrace_ops that has a trampoline
+ * calls that trampoline, everything else goes through ftrace_caller.
+ */
+unsigned long ftrace_get_addr_new(struct dyn_ftrace *rec)
+{
+	struct ftrace_ops *ops;
+
+	if (ftrace_rec_count(rec) == 1) {
+		ops = ftrace_find_tramp_ops(rec);
+		if (ops)
+			return ops->trampoline;
+	}
+
+	return (unsigned long)FTRACE_ADDR;
+}
+
+/**
+ * ftrace_get_addr_curr - find the address the record calls now
+ * @rec: the record to check
+ *
+ * The ftrace_ops that set up a trampoline call may already be gone
+ * from the records' point of view, so archs that use trampolines
+ * must find out from the call site itself.
+ */
+unsigned long __weak ftrace_get_addr_curr(struct dyn_ftrace *rec)
+{
+	return (unsigned long)FTRACE_ADDR;
+}
+
 static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 {
 	unsigned long flag = 0UL;
@@ -1606,28 +1661,40 @@ static int ftrace_check_record(struct dyn_ftrace *rec, int enable, int update)
 	 * If we are updating calls:
 	 *
 	 *   If the record has a ref count, then we need to enable it
-	 *   because someone is using it.
+	 *   because someone is using it. If that someone is alone and
+	 *   has a trampoline, the record should call the trampoline.
 	 *
 	 *   Otherwise we make sure its disabled.
 	 *
 	 * If we are disabling calls, then disable all records that
 	 * are enabled.
 	 */
-	if (enable && (rec->flags & ~FTRACE_FL_MASK))
+	if (enable && ftrace_rec_count(rec)) {
 		flag = FTRACE_FL_ENABLED;
+		if (ftrace_rec_count(rec) == 1 && ftrace_find_tramp_ops(rec))
+			flag |= FTRACE_FL_TRAMP_EN;
+	}
 
 	/* If the state of this record hasn't changed, then do nothing */
-	if ((rec->flags & FTRACE_FL_ENABLED) == flag)
+	if ((rec->flags & (FTRACE_FL_ENABLED | FTRACE_FL_TRAMP_EN)) == flag)
 		return FTRACE_UPDATE_IGNORE;
 
 	if (flag) {
-		if (update)
-			rec->flags |= FTRACE_FL_ENABLED;
-		return FTRACE_UPDATE_MAKE_CALL;
+		int ret = FTRACE_UPDATE_MAKE_CALL;
+
+		/* Already calling, only the destination changes */
+		if (rec->flags & FTRACE_FL_ENABLED)
+			ret = FTRACE_UPDATE_MODIFY_CALL;
+
+		if (update) {
+			rec->flags &= ~FTRACE_FL_TRAMP_EN;
+			rec->flags |= flag;
+		}
+		return ret;
 	}
 
 	if (update)
-		rec->flags &= ~FTRACE_FL_ENABLED;
+		rec->flags &= ~(FTRACE_FL_ENABLED | FTRACE_FL_TRAMP_EN);
 
 	return FTRACE_UPDATE_MAKE_NOP;
 }
@@ -1659,13 +1726,21 @@ int ftrace_test_record(struct dyn_ftrace *rec, int enable)
 	return ftrace_check_record(rec, enable, 0);
 }
 
+int __weak ftrace_modify_call(struct dyn_ftrace *rec, unsigned long old_addr,
+			      unsigned long addr)
+{
+	return -EINVAL;
+}
+
 static int
 __ftrace_replace_code(struct dyn_ftrace *rec, int enable)
 {
+	unsigned long ftrace_old_addr;
 	unsigned long ftrace_addr;
 	int ret;
 
-	ftrace_addr = (unsigned long)FTRACE_ADDR;
+	ftrace_addr = ftrace_get_addr_new(rec);
+	ftrace_old_addr = ftrace_get_addr_curr(rec);
 
 	ret = ftrace_update_record(rec, enable);
 
@@ -1677,7 +1752,10 @@ __ftrace_replace_code(struct dyn_ftrace *rec, int enable)
 		return ftrace_make_call(rec, ftrace_addr);
 
 	case FTRACE_UPDATE_MAKE_NOP:
-		return ftrace_make_nop(NULL, rec, ftrace_addr);
+		return ftrace_make_nop(NULL, rec, ftrace_old_addr);
+
+	case FTRACE_UPDATE_MODIFY_CALL:
+		return ftrace_modify_call(rec, ftrace_old_addr, ftrace_addr);
 	}
 
 	return -1; /* unknow ftrace bug */
@@ -1860,6 +1938,33 @@ void __weak arch_ftrace_update_code(int command)
 	ftrace_run_stop_machine(command);
 }
 
+/**
+ * arch_ftrace_update_trampoline, create or update an ops trampoline
+ * @ops: The ftrace_ops that is being enabled or has a new func
+ *
+ * Archs that can copy ftrace_caller into a private trampoline that
+ * calls @ops->func directly set @ops->trampoline, and keep it calling
+ * @ops->func when that changes. Records traced by @ops alone then
+ * skip the ftrace_ops_list_func() iteration.
+ */
+void __weak arch_ftrace_update_trampoline(struct ftrace_ops *ops)
+{
+}
+
+static void ftrace_update_trampoline(struct ftrace_ops *ops)
+{
+	/*
+	 * Dynamic ops may be freed right after they are unregistered,
+	 * and control ops must be called through control_ops: both go
+	 * through ftrace_caller and the list function.
+	 */
+	if (!(ops->flags & FTRACE_OPS_FL_ENABLED) ||
+	    ops->flags & (FTRACE_OPS_FL_DYNAMIC | FTRACE_OPS_FL_CONTROL))
+		return;
+
+	arch_ftrace_update_trampoline(ops);
+}
+
 static void ftrace_run_update_code(int command)
 {
 	int ret;
@@ -1935,6 +2040,7 @@ static int ftrace_startup(struct ftrace_ops *ops, int command)
 	}
 
 	ops->flags |= FTRACE_OPS_FL_ENABLED;
+	ftrace_update_trampoline(ops);
 	if (hash_enable)
 		ftrace_hash_rec_enable(ops, 1);
 
@@ -2339,7 +2445,7 @@ t_next(struct seq_file *m, void *v, loff_t *pos)
 		     !ftrace_lookup_ip(ops->notrace_hash, rec->ip)) ||
 
 		    ((iter->flags & FTRACE_ITER_ENABLED) &&
-		     !(rec->flags & ~FTRACE_FL_MASK))) {
+		     !ftrace_rec_count(rec))) {
 
 			rec = NULL;
 			goto retry;
@@ -2441,8 +2547,9 @@ static int t_show(struct seq_file *m, void *v)
 
 	seq_printf(m, "%ps", (void *)rec->ip);
 	if (iter->flags & FTRACE_ITER_ENABLED)
-		seq_printf(m, " (%ld)",
-			   rec->flags & ~FTRACE_FL_MASK);
+		seq_printf(m, " (%ld)%s",
+			   ftrace_rec_count(rec),
+			   rec->flags & FTRACE_FL_TRAMP_EN ? " tramp" : "");
 	seq_printf(m, "\n");
 
 	return 0;
@@ -3914,6 +4021,8 @@ static struct ftrace_ops global_ops = {
 	.func			= ftrace_stub,
 };
 
+static void ftrace_update_trampoline(struct ftrace_ops *ops) { }
+
 static int __init ftrace_nodyn_init(void)
 {
 	ftrace_enabled = 1;
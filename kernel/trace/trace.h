@@ -817,6 +817,23 @@ extern int filter_assign_type(const char *type);
 struct list_head *
 trace_get_fields(struct ftrace_event_call *event_call);
 
+extern struct ftrace_event_field *
+trace_find_event_field(struct ftrace_event_call *call, char *name);
+
+#ifdef CONFIG_HIST_TRIGGERS
+extern const struct file_operations ftrace_event_hist_fops;
+extern int event_hist_update(struct ftrace_event_call *call, void *rec);
+extern void event_hist_destroy(struct ftrace_event_call *call);
+extern int ftrace_event_hist_enable_disable(struct ftrace_event_call *call,
+					    int enable);
+#else
+static inline int event_hist_update(struct ftrace_event_call *call, void *rec)
+{
+	return 0;
+}
+static inline void event_hist_destroy(struct ftrace_event_call *call) { }
+#endif
+
 static inline int
 filter_check_discard(struct ftrace_event_call *call, void *rec,
 		     struct ring_buffer *buffer,
@@ -828,6 +845,13 @@ filter_check_discard(struct ftrace_event_call *call, void *rec,
 		return 1;
 	}
 
+	/* drop the record if only the histogram wanted it */
+	if (unlikely(call->flags & TRACE_EVENT_FL_HIST) &&
+	    event_hist_update(call, rec)) {
+		ring_buffer_discard_commit(buffer, event);
+		return 1;
+	}
+
 	return 0;
 }
 
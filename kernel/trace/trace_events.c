@@ -215,7 +215,10 @@ static int ftrace_event_enable_disable(struct ftrace_event_call *call,
 				tracing_stop_cmdline_record();
 				call->flags &= ~TRACE_EVENT_FL_RECORDED_CMD;
 			}
-			call->class->reg(call, TRACE_REG_UNREGISTER, NULL);
+			/* a histogram keeps the tracepoint registered */
+			if (!(call->flags & TRACE_EVENT_FL_HIST))
+				call->class->reg(call, TRACE_REG_UNREGISTER,
+						 NULL);
 		}
 		break;
 	case 1:
@@ -224,7 +227,9 @@ static int ftrace_event_enable_disable(struct ftrace_event_call *call,
 				tracing_start_cmdline_record();
 				call->flags |= TRACE_EVENT_FL_RECORDED_CMD;
 			}
-			ret = call->class->reg(call, TRACE_REG_REGISTER, NULL);
+			if (!(call->flags & TRACE_EVENT_FL_HIST))
+				ret = call->class->reg(call, TRACE_REG_REGISTER,
+						       NULL);
 			if (ret) {
 				tracing_stop_cmdline_record();
 				pr_info("event trace: Could not enable event "
@@ -239,6 +244,32 @@ static int ftrace_event_enable_disable(struct ftrace_event_call *call,
 	return ret;
 }
 
+#ifdef CONFIG_HIST_TRIGGERS
+/*
+ * A histogram needs the tracepoint registered whether or not the event
+ * is enabled for the trace buffer. Called with event_mutex held.
+ */
+int ftrace_event_hist_enable_disable(struct ftrace_event_call *call,
+				     int enable)
+{
+	int ret = 0;
+
+	if (enable) {
+		if (!(call->flags & (TRACE_EVENT_FL_ENABLED |
+				     TRACE_EVENT_FL_HIST)))
+			ret = call->class->reg(call, TRACE_REG_REGISTER, NULL);
+		if (!ret)
+			call->flags |= TRACE_EVENT_FL_HIST;
+	} else if (call->flags & TRACE_EVENT_FL_HIST) {
+		call->flags &= ~TRACE_EVENT_FL_HIST;
+		if (!(call->flags & TRACE_EVENT_FL_ENABLED))
+			call->class->reg(call, TRACE_REG_UNREGISTER, NULL);
+	}
+
+	return ret;
+}
+#endif
+
 static void ftrace_clear_events(void)
 {
 	struct ftrace_event_call *call;
@@ -1196,6 +1227,12 @@ event_create_dir(struct ftrace_event_call *call, struct dentry *d_events,
 	trace_create_file("format", 0444, call->dir, call,
 			  format);
 
+#ifdef CONFIG_HIST_TRIGGERS
+	if (call->class->reg && !(call->flags & TRACE_EVENT_FL_IGNORE_ENABLE))
+		trace_create_file("hist", 0644, call->dir, call,
+				  &ftrace_event_hist_fops);
+#endif
+
 	return 0;
 }
 
@@ -1273,6 +1310,7 @@ static void remove_subsystem_dir(const char *name)
 static void __trace_remove_event_call(struct ftrace_event_call *call)
 {
 	ftrace_event_enable_disable(call, 0);
+	event_hist_destroy(call);
 	if (call->event.funcs)
 		__unregister_ftrace_event(&call->event);
 	debugfs_remove_recursive(call->dir);
@@ -0,0 +1,729 @@
+/*
+ * trace_events_hist - in-kernel histograms of trace events
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Writing "keys=<field>[,...][:vals=<field>[,...]][:size=<entries>]" to
+ * an event's hist file attaches a hash table to the event. Every record
+ * that passes the event filter is looked up by its key fields and its
+ * hit count and value fields are added to the entry; nothing has to go
+ * through the trace buffer to userspace. If the event itself is not
+ * enabled, the record is discarded once it has been accounted.
+ *
+ * The table is preallocated and updated without locks, so it can be
+ * used from any context a tracepoint fires in, NMIs included. Slots are
+ * claimed with cmpxchg() on the key hash and the sums are atomic64_t.
+ * When all entries are in use, records with new keys are counted as
+ * dropped.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/stacktrace.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+
+#include "trace.h"
+
+#define HIST_KEYS_MAX		3
+#define HIST_VALS_MAX		3
+#define HIST_KEY_SIZE_MAX	256
+
+#define HIST_STACKTRACE_DEPTH	16
+#define HIST_STACKTRACE_SIZE	(HIST_STACKTRACE_DEPTH * sizeof(unsigned long))
+/* event_hist_update(), filter_current_check_discard() and the probe */
+#define HIST_STACKTRACE_SKIP	3
+
+#define HIST_MAP_BITS_DEFAULT	11
+#define HIST_MAP_BITS_MIN	7
+#define HIST_MAP_BITS_MAX	17
+
+enum {
+	HIST_FIELD_HEX		= 1 << 0,
+	HIST_FIELD_SYM		= 1 << 1,
+	HIST_FIELD_STRING	= 1 << 2,
+	HIST_FIELD_STACKTRACE	= 1 << 3,
+};
+
+struct hist_field {
+	struct ftrace_event_field	*field;	/* NULL for the stacktrace */
+	unsigned int			flags;
+	unsigned int			size;	/* in the key */
+	unsigned int			offset;	/* in the key */
+};
+
+struct hist_elt {
+	void			*key;
+	/* sums[0] is the hit count, then one per value field */
+	atomic64_t		sums[HIST_VALS_MAX + 1];
+};
+
+/* hash == 0 is a free slot; elt is set once the key has been copied */
+struct hist_map_entry {
+	u32			hash;
+	struct hist_elt		*elt;
+};
+
+struct event_hist {
+	unsigned int		n_keys;
+	unsigned int		n_vals;
+	struct hist_field	keys[HIST_KEYS_MAX];
+	struct hist_field	vals[HIST_VALS_MAX];
+	unsigned int		key_size;
+	unsigned int		map_bits;
+	bool			paused;
+
+	/* twice as many slots as entries keeps the probe sequences short */
+	struct hist_map_entry	*map;
+	struct hist_elt		*elts;
+	void			*keys_buf;
+	atomic_t		next_elt;
+	atomic64_t		drops;
+};
+
+static inline unsigned int hist_n_elts(struct event_hist *hist)
+{
+	return 1U << hist->map_bits;
+}
+
+static inline unsigned int hist_n_slots(struct event_hist *hist)
+{
+	return 2U << hist->map_bits;
+}
+
+static u64 hist_field_value(struct hist_field *hf, void *rec)
+{
+	struct ftrace_event_field *field = hf->field;
+	void *addr = rec + field->offset;
+
+	switch (field->size) {
+	case 1:
+		return field->is_signed ? (u64)*(s8 *)addr : *(u8 *)addr;
+	case 2:
+		return field->is_signed ? (u64)*(s16 *)addr : *(u16 *)addr;
+	case 4:
+		return field->is_signed ? (u64)*(s32 *)addr : *(u32 *)addr;
+	default:
+		return *(u64 *)addr;
+	}
+}
+
+static struct hist_elt *hist_map_insert(struct event_hist *hist, void *key)
+{
+	unsigned int n_slots = hist_n_slots(hist);
+	struct hist_map_entry *entry;
+	struct hist_elt *elt;
+	unsigned int idx, i = 0;
+	u32 hash, cur;
+	int n;
+
+	hash = jhash(key, hist->key_size, 0);
+	if (!hash)
+		hash = 1;
+	idx = hash & (n_slots - 1);
+
+	while (i < n_slots) {
+		entry = &hist->map[idx];
+		cur = ACCESS_ONCE(entry->hash);
+
+		if (cur == hash) {
+			elt = ACCESS_ONCE(entry->elt);
+			/* being inserted right now: drop rather than wait */
+			if (!elt)
+				break;
+			smp_read_barrier_depends();
+			if (!memcmp(elt->key, key, hist->key_size))
+				return elt;
+		} else if (!cur) {
+			/* don't claim slots that can't get an entry */
+			if (atomic_read(&hist->next_elt) >= hist_n_elts(hist))
+				break;
+			if (cmpxchg(&entry->hash, 0, hash) != 0)
+				continue;	/* lost the race, look again */
+
+			n = atomic_inc_return(&hist->next_elt) - 1;
+			if (n >= hist_n_elts(hist))
+				break;
+
+			elt = &hist->elts[n];
+			memcpy(elt->key, key, hist->key_size);
+			/* publish the key before the entry */
+			smp_wmb();
+			entry->elt = elt;
+			return elt;
+		}
+
+		idx = (idx + 1) & (n_slots - 1);
+		i++;
+	}
+
+	atomic64_inc(&hist->drops);
+	return NULL;
+}
+
+/*
+ * Account @rec in the histogram of @call. Called from the event's probe
+ * with preemption disabled. Returns 1 if the record was only wanted for
+ * the histogram and should be discarded from the trace buffer.
+ */
+int event_hist_update(struct ftrace_event_call *call, void *rec)
+{
+	u64 key[HIST_KEY_SIZE_MAX / sizeof(u64)];
+	struct event_hist *hist;
+	struct hist_field *hf;
+	struct hist_elt *elt;
+	unsigned int i;
+	u64 val;
+
+	hist = rcu_dereference_sched(call->hist);
+	if (!hist || hist->paused)
+		goto out;
+
+	memset(key, 0, hist->key_size);
+
+	for (i = 0; i < hist->n_keys; i++) {
+		hf = &hist->keys[i];
+
+		if (hf->flags & HIST_FIELD_STACKTRACE) {
+			struct stack_trace trace = {
+				.max_entries	= HIST_STACKTRACE_DEPTH,
+				.entries	= (void *)key + hf->offset,
+				.skip		= HIST_STACKTRACE_SKIP,
+			};
+
+			save_stack_trace(&trace);
+		} else if (hf->flags & HIST_FIELD_STRING) {
+			strncpy((void *)key + hf->offset,
+				rec + hf->field->offset, hf->size);
+		} else {
+			val = hist_field_value(hf, rec);
+			memcpy((void *)key + hf->offset, &val, sizeof(val));
+		}
+	}
+
+	elt = hist_map_insert(hist, key);
+	if (!elt)
+		goto out;
+
+	atomic64_inc(&elt->sums[0]);
+	for (i = 0; i < hist->n_vals; i++)
+		atomic64_add(hist_field_value(&hist->vals[i], rec),
+			     &elt->sums[i + 1]);
+out:
+	return !(call->flags & TRACE_EVENT_FL_ENABLED);
+}
+
+static void event_hist_free(struct event_hist *hist)
+{
+	vfree(hist->map);
+	vfree(hist->elts);
+	vfree(hist->keys_buf);
+	kfree(hist);
+}
+
+static int hist_alloc_map(struct event_hist *hist)
+{
+	unsigned int i;
+
+	hist->map = vzalloc(hist_n_slots(hist) * sizeof(*hist->map));
+	hist->elts = vzalloc(hist_n_elts(hist) * sizeof(*hist->elts));
+	hist->keys_buf = vzalloc(hist_n_elts(hist) * hist->key_size);
+	if (!hist->map || !hist->elts || !hist->keys_buf)
+		return -ENOMEM;
+
+	for (i = 0; i < hist_n_elts(hist); i++)
+		hist->elts[i].key = hist->keys_buf + i * hist->key_size;
+
+	atomic_set(&hist->next_elt, 0);
+	atomic64_set(&hist->drops, 0);
+
+	return 0;
+}
+
+/* name[.hex|.sym], or stacktrace for a key */
+static int hist_parse_field(struct ftrace_event_call *call,
+			    struct hist_field *hf, char *str, bool key)
+{
+	struct ftrace_event_field *field;
+	char *mod;
+
+	mod = strchr(str, '.');
+	if (mod) {
+		*mod++ = '\0';
+		if (!strcmp(mod, "hex"))
+			hf->flags |= HIST_FIELD_HEX;
+		else if (!strcmp(mod, "sym"))
+			hf->flags |= HIST_FIELD_SYM;
+		else
+			return -EINVAL;
+	}
+
+	if (key && !strcmp(str, "stacktrace")) {
+		if (hf->flags)
+			return -EINVAL;
+		hf->flags = HIST_FIELD_STACKTRACE;
+		hf->size = HIST_STACKTRACE_SIZE;
+		return 0;
+	}
+
+	field = trace_find_event_field(call, str);
+	if (!field)
+		return -EINVAL;
+	hf->field = field;
+
+	if (field->filter_type == FILTER_STATIC_STRING) {
+		if (!key || hf->flags)
+			return -EINVAL;
+		hf->flags = HIST_FIELD_STRING;
+		hf->size = field->size;
+		return 0;
+	}
+
+	if (field->filter_type != FILTER_OTHER ||
+	    !is_power_of_2(field->size) || field->size > sizeof(u64))
+		return -EINVAL;
+	hf->size = sizeof(u64);
+
+	return 0;
+}
+
+static int hist_parse_keys(struct ftrace_event_call *call,
+			   struct event_hist *hist, char *str)
+{
+	struct hist_field *hf;
+	char *name;
+	int ret;
+
+	while ((name = strsep(&str, ",")) != NULL) {
+		if (hist->n_keys == HIST_KEYS_MAX)
+			return -EINVAL;
+		hf = &hist->keys[hist->n_keys++];
+
+		ret = hist_parse_field(call, hf, name, true);
+		if (ret)
+			return ret;
+
+		hf->offset = ALIGN(hist->key_size, sizeof(u64));
+		hist->key_size = hf->offset + hf->size;
+		if (hist->key_size > HIST_KEY_SIZE_MAX)
+			return -EINVAL;
+	}
+	hist->key_size = ALIGN(hist->key_size, sizeof(u64));
+
+	return 0;
+}
+
+static int hist_parse_vals(struct ftrace_event_call *call,
+			   struct event_hist *hist, char *str)
+{
+	char *name;
+	int ret;
+
+	while ((name = strsep(&str, ",")) != NULL) {
+		/* always there */
+		if (!strcmp(name, "hitcount"))
+			continue;
+		if (hist->n_vals == HIST_VALS_MAX)
+			return -EINVAL;
+
+		ret = hist_parse_field(call, &hist->vals[hist->n_vals++],
+				       name, false);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static struct event_hist *
+event_hist_parse(struct ftrace_event_call *call, char *str)
+{
+	struct event_hist *hist;
+	unsigned long size;
+	char *param;
+	int ret = 0;
+
+	hist = kzalloc(sizeof(*hist), GFP_KERNEL);
+	if (!hist)
+		return ERR_PTR(-ENOMEM);
+	hist->map_bits = HIST_MAP_BITS_DEFAULT;
+
+	if (!strncmp(str, "hist:", 5))
+		str += 5;
+
+	while ((param = strsep(&str, ":")) != NULL) {
+		if (!*param)
+			continue;
+
+		if (!strncmp(param, "keys=", 5)) {
+			if (hist->n_keys)
+				ret = -EINVAL;
+			else
+				ret = hist_parse_keys(call, hist, param + 5);
+		} else if (!strncmp(param, "vals=", 5)) {
+			ret = hist_parse_vals(call, hist, param + 5);
+		} else if (!strncmp(param, "size=", 5)) {
+			ret = kstrtoul(param + 5, 0, &size);
+			if (!ret && (size < (1UL << HIST_MAP_BITS_MIN) ||
+				     size > (1UL << HIST_MAP_BITS_MAX)))
+				ret = -EINVAL;
+			if (!ret)
+				hist->map_bits = order_base_2(size);
+		} else
+			ret = -EINVAL;
+
+		if (ret)
+			goto fail;
+	}
+
+	ret = -EINVAL;
+	if (!hist->n_keys)
+		goto fail;
+
+	ret = hist_alloc_map(hist);
+	if (ret)
+		goto fail;
+
+	return hist;
+
+fail:
+	event_hist_free(hist);
+	return ERR_PTR(ret);
+}
+
+/* A fresh table with the same keys and values, for "clear". */
+static struct event_hist *event_hist_dup(struct event_hist *old)
+{
+	struct event_hist *hist;
+	int ret;
+
+	hist = kmemdup(old, sizeof(*old), GFP_KERNEL);
+	if (!hist)
+		return ERR_PTR(-ENOMEM);
+	hist->map = NULL;
+	hist->elts = NULL;
+	hist->keys_buf = NULL;
+
+	ret = hist_alloc_map(hist);
+	if (ret) {
+		event_hist_free(hist);
+		return ERR_PTR(ret);
+	}
+
+	return hist;
+}
+
+/*
+ * Install @hist (or nothing) as the histogram of @call and free the old
+ * one. Called with event_mutex held.
+ */
+static int event_hist_set(struct ftrace_event_call *call,
+			  struct event_hist *hist)
+{
+	struct event_hist *old = call->hist;
+	int ret;
+
+	rcu_assign_pointer(call->hist, hist);
+
+	if (hist && !old) {
+		ret = ftrace_event_hist_enable_disable(call, 1);
+		if (ret) {
+			rcu_assign_pointer(call->hist, NULL);
+			synchronize_sched();
+			event_hist_free(hist);
+			return ret;
+		}
+	} else if (!hist && old)
+		ftrace_event_hist_enable_disable(call, 0);
+
+	if (old) {
+		/* wait for the probes still updating the old table */
+		synchronize_sched();
+		event_hist_free(old);
+	}
+
+	return 0;
+}
+
+/* Called with event_mutex held, when the event goes away. */
+void event_hist_destroy(struct ftrace_event_call *call)
+{
+	if (call->hist)
+		event_hist_set(call, NULL);
+}
+
+static void hist_print_field_name(struct seq_file *m, struct hist_field *hf)
+{
+	if (hf->flags & HIST_FIELD_STACKTRACE) {
+		seq_puts(m, "stacktrace");
+		return;
+	}
+
+	seq_puts(m, hf->field->name);
+	if (hf->flags & HIST_FIELD_HEX)
+		seq_puts(m, ".hex");
+	else if (hf->flags & HIST_FIELD_SYM)
+		seq_puts(m, ".sym");
+}
+
+static void hist_print_spec(struct seq_file *m, struct event_hist *hist)
+{
+	unsigned int i;
+
+	seq_puts(m, "hist:keys=");
+	for (i = 0; i < hist->n_keys; i++) {
+		if (i)
+			seq_putc(m, ',');
+		hist_print_field_name(m, &hist->keys[i]);
+	}
+
+	seq_puts(m, ":vals=hitcount");
+	for (i = 0; i < hist->n_vals; i++) {
+		seq_putc(m, ',');
+		hist_print_field_name(m, &hist->vals[i]);
+	}
+
+	seq_printf(m, ":size=%u", hist_n_elts(hist));
+}
+
+static void hist_print_value(struct seq_file *m, struct hist_field *hf,
+			     u64 val)
+{
+	if (hf->flags & HIST_FIELD_SYM)
+		seq_printf(m, "[%016llx] %-45pS", val, (void *)(long)val);
+	else if (hf->flags & HIST_FIELD_HEX)
+		seq_printf(m, "%16llx", val);
+	else if (hf->field->is_signed)
+		seq_printf(m, "%10lld", (s64)val);
+	else
+		seq_printf(m, "%10llu", val);
+}
+
+static void hist_print_key(struct seq_file *m, struct event_hist *hist,
+			   void *key)
+{
+	struct hist_field *hf;
+	unsigned long *stack;
+	unsigned int i, j;
+	u64 val;
+
+	seq_puts(m, "{ ");
+	for (i = 0; i < hist->n_keys; i++) {
+		hf = &hist->keys[i];
+		if (i)
+			seq_puts(m, ", ");
+		hist_print_field_name(m, hf);
+		seq_puts(m, ": ");
+
+		if (hf->flags & HIST_FIELD_STACKTRACE) {
+			stack = key + hf->offset;
+			seq_putc(m, '\n');
+			for (j = 0; j < HIST_STACKTRACE_DEPTH; j++) {
+				if (!stack[j] || stack[j] == ULONG_MAX)
+					break;
+				seq_printf(m, "%9s%pS\n", "", (void *)stack[j]);
+			}
+		} else if (hf->flags & HIST_FIELD_STRING) {
+			seq_printf(m, "%-16.*s", hf->size,
+				   (char *)key + hf->offset);
+		} else {
+			memcpy(&val, key + hf->offset, sizeof(val));
+			hist_print_value(m, hf, val);
+		}
+	}
+	seq_puts(m, " }");
+}
+
+static int hist_elt_cmp(const void *a, const void *b)
+{
+	const struct hist_elt *elt_a = *(const struct hist_elt **)a;
+	const struct hist_elt *elt_b = *(const struct hist_elt **)b;
+	u64 hits_a = atomic64_read(&elt_a->sums[0]);
+	u64 hits_b = atomic64_read(&elt_b->sums[0]);
+
+	if (hits_a == hits_b)
+		return 0;
+	return hits_a < hits_b ? -1 : 1;
+}
+
+static void hist_show_entries(struct seq_file *m, struct event_hist *hist)
+{
+	struct hist_elt **sorted, *elt;
+	unsigned int i, j, n, nr = 0;
+	u64 hits = 0;
+
+	n = min_t(unsigned int, atomic_read(&hist->next_elt),
+		  hist_n_elts(hist));
+	sorted = vmalloc(max(n, 1U) * sizeof(*sorted));
+	if (!sorted) {
+		seq_puts(m, "# out of memory\n");
+		return;
+	}
+
+	/* only published entries, their keys are complete */
+	for (i = 0; i < hist_n_slots(hist) && nr < n; i++) {
+		elt = ACCESS_ONCE(hist->map[i].elt);
+		if (!elt)
+			continue;
+		smp_read_barrier_depends();
+		sorted[nr++] = elt;
+	}
+
+	sort(sorted, nr, sizeof(*sorted), hist_elt_cmp, NULL);
+
+	for (i = 0; i < nr; i++) {
+		elt = sorted[i];
+		hits += atomic64_read(&elt->sums[0]);
+
+		hist_print_key(m, hist, elt->key);
+		seq_printf(m, " hitcount: %10llu",
+			   (u64)atomic64_read(&elt->sums[0]));
+		for (j = 0; j < hist->n_vals; j++) {
+			seq_puts(m, "  ");
+			hist_print_field_name(m, &hist->vals[j]);
+			seq_puts(m, ": ");
+			hist_print_value(m, &hist->vals[j],
+					 atomic64_read(&elt->sums[j + 1]));
+		}
+		seq_putc(m, '\n');
+	}
+
+	seq_printf(m, "\nTotals:\n    Hits: %llu\n    Entries: %u\n"
+		   "    Dropped: %llu\n", hits, nr,
+		   (u64)atomic64_read(&hist->drops));
+
+	vfree(sorted);
+}
+
+static int event_hist_show(struct seq_file *m, void *v)
+{
+	struct ftrace_event_call *call = m->private;
+	struct event_hist *hist;
+
+	mutex_lock(&event_mutex);
+	hist = call->hist;
+	if (!hist) {
+		seq_puts(m, "# no histogram, write "
+			 "keys=<field>[,...][:vals=<field>[,...]][:size=<entries>]"
+			 " to create one\n");
+		goto out;
+	}
+
+	seq_puts(m, "# event histogram\n#\n# trigger info: ");
+	hist_print_spec(m, hist);
+	seq_printf(m, " [%s]\n#\n\n", hist->paused ? "paused" : "active");
+
+	hist_show_entries(m, hist);
+out:
+	mutex_unlock(&event_mutex);
+
+	return 0;
+}
+
+static int event_hist_open(struct inode *inode, struct file *file)
+{
+	struct ftrace_event_call *call = inode->i_private;
+	int ret;
+
+	/* the event of a module must stay while its histogram is open */
+	if (!try_module_get(call->mod))
+		return -ENODEV;
+
+	ret = single_open(file, event_hist_show, call);
+	if (ret)
+		module_put(call->mod);
+
+	return ret;
+}
+
+static int event_hist_release(struct inode *inode, struct file *file)
+{
+	struct ftrace_event_call *call = inode->i_private;
+
+	single_release(inode, file);
+	module_put(call->mod);
+
+	return 0;
+}
+
+/*
+ * Besides a key specification, accepts:
+ *   "!" or nothing - remove the histogram
+ *   "pause", "cont" - stop and restart the accounting
+ *   "clear"         - start over with an empty table
+ */
+static ssize_t event_hist_write(struct file *file, const char __user *ubuf,
+				size_t cnt, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ftrace_event_call *call = m->private;
+	struct event_hist *hist;
+	char *buf, *str;
+	int ret = 0;
+
+	if (cnt >= PAGE_SIZE)
+		return -EINVAL;
+
+	buf = kmalloc(cnt + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (copy_from_user(buf, ubuf, cnt)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[cnt] = '\0';
+	str = strstrip(buf);
+
+	mutex_lock(&event_mutex);
+	if (!*str || *str == '!') {
+		ret = event_hist_set(call, NULL);
+	} else if (!strcmp(str, "pause") || !strcmp(str, "cont")) {
+		if (call->hist)
+			call->hist->paused = *str == 'p';
+		else
+			ret = -ENOENT;
+	} else {
+		if (!strcmp(str, "clear"))
+			hist = call->hist ? event_hist_dup(call->hist) :
+					    ERR_PTR(-ENOENT);
+		else
+			hist = event_hist_parse(call, str);
+
+		if (IS_ERR(hist))
+			ret = PTR_ERR(hist);
+		else
+			ret = event_hist_set(call, hist);
+	}
+	mutex_unlock(&event_mutex);
+
+	kfree(buf);
+
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+const struct file_operations ftrace_event_hist_fops = {
+	.open		= event_hist_open,
+	.read		= seq_read,
+	.write		= event_hist_write,
+	.llseek		= seq_lseek,
+	.release	= event_hist_release,
+};
@@ -41,6 +41,8 @@
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
 #include <linux/idr.h>
+#include <linux/moduleparam.h>
+#include <linux/nodemask.h>
 
 #include "workqueue_sched.h"
 
@@ -291,6 +293,27 @@ EXPORT_SYMBOL_GPL(system_nrt_freezable_wq);
 	for (i = 0; i < BUSY_WORKER_HASH_SIZE; i++)			\
 		hlist_for_each_entry(worker, pos, &gcwq->busy_hash[i], hentry)
 
+/*
+ * Unbound workqueues get one gcwq per NUMA node so that their works
+ * are queued and executed on the node they were issued from, unless
+ * disabled with workqueue.disable_numa.  Ordered workqueues always use
+ * the gcwq of the first node.  Both are fixed at boot.
+ */
+static bool wq_disable_numa;
+module_param_named(disable_numa, wq_disable_numa, bool, 0444);
+
+static bool wq_numa_enabled __read_mostly;
+static int wq_dfl_node __read_mostly;
+
+static bool wq_unbound_per_node(struct workqueue_struct *wq)
+{
+	return wq_numa_enabled && !(wq->flags & WQ_ORDERED);
+}
+
+/*
+ * @sw selects what to walk: 1 for the CPUs in @mask, 2 for the unbound
+ * gcwq of the first node and 4 for the unbound gcwqs of the other nodes.
+ */
 static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				  unsigned int sw)
 {
@@ -301,39 +324,52 @@ static inline int __next_gcwq_cpu(int cpu, const struct cpumask *mask,
 				return cpu;
 		}
 		if (sw & 2)
-			return WORK_CPU_UNBOUND;
+			return WORK_CPU_UNBOUND + wq_dfl_node;
+	} else if (sw & 4) {
+		int node = next_node(cpu - WORK_CPU_UNBOUND, node_possible_map);
+
+		if (node < MAX_NUMNODES)
+			return WORK_CPU_UNBOUND + node;
 	}
 	return WORK_CPU_NONE;
 }
 
+static inline unsigned int __gcwq_sw(void)
+{
+	return wq_numa_enabled ? 7 : 3;
+}
+
 static inline int __next_wq_cpu(int cpu, const struct cpumask *mask,
 				struct workqueue_struct *wq)
 {
-	return __next_gcwq_cpu(cpu, mask, !(wq->flags & WQ_UNBOUND) ? 1 : 2);
+	if (!(wq->flags & WQ_UNBOUND))
+		return __next_gcwq_cpu(cpu, mask, 1);
+	return __next_gcwq_cpu(cpu, mask, wq_unbound_per_node(wq) ? 6 : 2);
 }
 
 /*
  * CPU iterators
  *
- * An extra gcwq is defined for an invalid cpu number
- * (WORK_CPU_UNBOUND) to host workqueues which are not bound to any
- * specific CPU.  The following iterators are similar to
- * for_each_*_cpu() iterators but also considers the unbound gcwq.
+ * Extra gcwqs are defined for invalid cpu numbers starting at
+ * WORK_CPU_UNBOUND, one per possible NUMA node, to host workqueues
+ * which are not bound to any specific CPU.  The following iterators are
+ * similar to for_each_*_cpu() iterators but also consider the unbound
+ * gcwqs.
  *
- * for_each_gcwq_cpu()		: possible CPUs + WORK_CPU_UNBOUND
- * for_each_online_gcwq_cpu()	: online CPUs + WORK_CPU_UNBOUND
+ * for_each_gcwq_cpu()		: possible CPUs + unbound gcwqs
+ * for_each_online_gcwq_cpu()	: online CPUs + unbound gcwqs
  * for_each_cwq_cpu()		: possible CPUs for bound workqueues,
- *				  WORK_CPU_UNBOUND for unbound workqueues
+ *				  the unbound gcwqs used by unbound ones
  */
 #define for_each_gcwq_cpu(cpu)						\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, 3);		\
+	for ((cpu) = __next_gcwq_cpu(-1, cpu_possible_mask, __gcwq_sw()); \
 	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, 3))
+	     (cpu) = __next_gcwq_cpu((cpu), cpu_possible_mask, __gcwq_sw()))
 
 #define for_each_online_gcwq_cpu(cpu)					\
-	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, 3);		\
+	for ((cpu) = __next_gcwq_cpu(-1, cpu_online_mask, __gcwq_sw());	\
 	     (cpu) < WORK_CPU_NONE;					\
-	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, 3))
+	     (cpu) = __next_gcwq_cpu((cpu), cpu_online_mask, __gcwq_sw()))
 
 #define for_each_cwq_cpu(cpu, wq)					\
 	for ((cpu) = __next_wq_cpu(-1, cpu_possible_mask, (wq));	\
@@ -470,11 +506,11 @@ static DEFINE_PER_CPU(struct global_cwq, global_cwq);
 static DEFINE_PER_CPU_SHARED_ALIGNED(atomic_t, pool_nr_running[NR_WORKER_POOLS]);
 
 /*
- * Global cpu workqueue and nr_running counter for unbound gcwq.  The
- * gcwq is always online, has GCWQ_DISASSOCIATED set, and all its
- * workers have WORKER_UNBOUND set.
+ * Global cpu workqueues, allocated on their node, and nr_running counter
+ * for unbound gcwqs.  The gcwqs are always online, have
+ * GCWQ_DISASSOCIATED set, and all their workers have WORKER_UNBOUND set.
  */
-static struct global_cwq unbound_global_cwq;
+static struct global_cwq *unbound_global_cwq[MAX_NUMNODES] __read_mostly;
 static atomic_t unbound_pool_nr_running[NR_WORKER_POOLS] = {
 	[0 ... NR_WORKER_POOLS - 1]	= ATOMIC_INIT(0),	/* always 0 */
 };
@@ -488,10 +524,10 @@ static int worker_pool_pri(struct worker_pool *pool)
 
 static struct global_cwq *get_gcwq(unsigned int cpu)
 {
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(global_cwq, cpu);
 	else
-		return &unbound_global_cwq;
+		return unbound_global_cwq[cpu - WORK_CPU_UNBOUND];
 }
 
 static atomic_t *get_pool_nr_running(struct worker_pool *pool)
@@ -499,23 +535,64 @@ static atomic_t *get_pool_nr_running(struct worker_pool *pool)
 	int cpu = pool->gcwq->cpu;
 	int idx = worker_pool_pri(pool);
 
-	if (cpu != WORK_CPU_UNBOUND)
+	if (cpu < WORK_CPU_UNBOUND)
 		return &per_cpu(pool_nr_running, cpu)[idx];
 	else
 		return &unbound_pool_nr_running[idx];
 }
 
+/*
+ * The cwqs of an unbound workqueue are laid out in an array indexed by
+ * node, each aligned according to WORK_STRUCT_FLAG_BITS.
+ */
+static size_t unbound_cwq_stride(void)
+{
+	const size_t align = max_t(size_t, 1 << WORK_STRUCT_FLAG_BITS,
+				   __alignof__(unsigned long long));
+
+	return ALIGN(sizeof(struct cpu_workqueue_struct), align);
+}
+
+static int nr_unbound_cwqs(struct workqueue_struct *wq)
+{
+	return wq_unbound_per_node(wq) ? nr_node_ids : 1;
+}
+
 static struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
 					    struct workqueue_struct *wq)
 {
 	if (!(wq->flags & WQ_UNBOUND)) {
 		if (likely(cpu < nr_cpu_ids))
 			return per_cpu_ptr(wq->cpu_wq.pcpu, cpu);
-	} else if (likely(cpu == WORK_CPU_UNBOUND))
-		return wq->cpu_wq.single;
+	} else if (likely(cpu >= WORK_CPU_UNBOUND && cpu < WORK_CPU_NONE)) {
+		int node = cpu - WORK_CPU_UNBOUND;
+
+		if (!wq_unbound_per_node(wq))
+			return node == wq_dfl_node ? wq->cpu_wq.single : NULL;
+		return (void *)wq->cpu_wq.single + node * unbound_cwq_stride();
+	}
 	return NULL;
 }
 
+/*
+ * Return the ID of the unbound gcwq @wq queues works issued on @cpu to.
+ * @cpu may be WORK_CPU_UNBOUND for the local CPU.
+ */
+static unsigned int unbound_gcwq_cpu(struct workqueue_struct *wq,
+				     unsigned int cpu)
+{
+	int node = wq_dfl_node;
+
+	if (wq_unbound_per_node(wq)) {
+		if (cpu >= nr_cpu_ids)
+			cpu = raw_smp_processor_id();
+		node = cpu_to_node(cpu);
+		if (unlikely(node == NUMA_NO_NODE))
+			node = wq_dfl_node;
+	}
+	return WORK_CPU_UNBOUND + node;
+}
+
 static unsigned int work_color_to_flags(int color)
 {
 	return color << WORK_STRUCT_COLOR_SHIFT;
@@ -594,7 +671,7 @@ static struct global_cwq *get_work_gcwq(struct work_struct *work)
 	if (cpu == WORK_CPU_NONE)
 		return NULL;
 
-	BUG_ON(cpu >= nr_cpu_ids && cpu != WORK_CPU_UNBOUND);
+	BUG_ON(cpu >= nr_cpu_ids && cpu < WORK_CPU_UNBOUND);
 	return get_gcwq(cpu);
 }
 
@@ -977,7 +1054,7 @@ static bool is_chained_work(struct workqueue_struct *wq)
 static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
-	struct global_cwq *gcwq;
+	struct global_cwq *gcwq, *last_gcwq;
 	struct cpu_workqueue_struct *cwq;
 	struct list_head *worklist;
 	unsigned int work_flags;
@@ -992,39 +1069,38 @@ static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 
 	/* determine gcwq to use */
 	if (!(wq->flags & WQ_UNBOUND)) {
-		struct global_cwq *last_gcwq;
-
 		if (unlikely(cpu == WORK_CPU_UNBOUND))
 			cpu = raw_smp_processor_id();
-
-		/*
-		 * It's multi cpu.  If @wq is non-reentrant and @work
-		 * was previously on a different cpu, it might still
-		 * be running there, in which case the work needs to
-		 * be queued on that cpu to guarantee non-reentrance.
-		 */
 		gcwq = get_gcwq(cpu);
-		if (wq->flags & WQ_NON_REENTRANT &&
-		    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
-			struct worker *worker;
+	} else {
+		gcwq = get_gcwq(unbound_gcwq_cpu(wq, cpu));
+	}
 
-			spin_lock_irqsave(&last_gcwq->lock, flags);
+	/*
+	 * It's multi cpu.  If @wq is non-reentrant and @work was
+	 * previously on a different gcwq, it might still be running
+	 * there, in which case the work needs to be queued on that gcwq
+	 * to guarantee non-reentrance.  Unbound workqueues used to share
+	 * a single gcwq and thus were always non-reentrant; keep it that
+	 * way now that there is one per node.
+	 */
+	if (wq->flags & (WQ_NON_REENTRANT | WQ_UNBOUND) &&
+	    (last_gcwq = get_work_gcwq(work)) && last_gcwq != gcwq) {
+		struct worker *worker;
 
-			worker = find_worker_executing_work(last_gcwq, work);
+		spin_lock_irqsave(&last_gcwq->lock, flags);
 
-			if (worker && worker->current_cwq->wq == wq)
-				gcwq = last_gcwq;
-			else {
-				/* meh... not running there, queue here */
-				spin_unlock_irqrestore(&last_gcwq->lock, flags);
-				spin_lock_irqsave(&gcwq->lock, flags);
-			}
-		} else
+		worker = find_worker_executing_work(last_gcwq, work);
+
+		if (worker && worker->current_cwq->wq == wq)
+			gcwq = last_gcwq;
+		else {
+			/* meh... not running there, queue here */
+			spin_unlock_irqrestore(&last_gcwq->lock, flags);
 			spin_lock_irqsave(&gcwq->lock, flags);
-	} else {
-		gcwq = get_gcwq(WORK_CPU_UNBOUND);
+		}
+	} else
 		spin_lock_irqsave(&gcwq->lock, flags);
-	}
 
 	/* gcwq determined, get cwq and queue */
 	cwq = get_cwq(gcwq->cpu, wq);
@@ -1140,6 +1216,7 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work = &dwork->work;
 
 	if (!test_and_set_bit(WORK_STRUCT_PENDING_BIT, work_data_bits(work))) {
+		struct global_cwq *gcwq = get_work_gcwq(work);
 		unsigned int lcpu;
 
 		BUG_ON(timer_pending(timer));
@@ -1152,15 +1229,12 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 		 * Note that the work's gcwq is preserved to allow
 		 * reentrance detection for delayed works.
 		 */
-		if (!(wq->flags & WQ_UNBOUND)) {
-			struct global_cwq *gcwq = get_work_gcwq(work);
-
-			if (gcwq && gcwq->cpu != WORK_CPU_UNBOUND)
-				lcpu = gcwq->cpu;
-			else
-				lcpu = raw_smp_processor_id();
-		} else
-			lcpu = WORK_CPU_UNBOUND;
+		if (gcwq && get_cwq(gcwq->cpu, wq))
+			lcpu = gcwq->cpu;
+		else if (!(wq->flags & WQ_UNBOUND))
+			lcpu = raw_smp_processor_id();
+		else
+			lcpu = unbound_gcwq_cpu(wq, WORK_CPU_UNBOUND);
 
 		set_work_cwq(work, get_cwq(lcpu, wq), 0);
 
@@ -1466,6 +1540,20 @@ static struct worker *alloc_worker(void)
 	return worker;
 }
 
+/*
+ * The node the workers of unbound @gcwq should stay on, NUMA_NO_NODE if
+ * it isn't an unbound gcwq, serves all nodes or its node is offline.
+ */
+static int unbound_gcwq_node(struct global_cwq *gcwq)
+{
+	int node = gcwq->cpu - WORK_CPU_UNBOUND;
+
+	if (gcwq->cpu < WORK_CPU_UNBOUND || !wq_numa_enabled ||
+	    !node_online(node))
+		return NUMA_NO_NODE;
+	return node;
+}
+
 /**
  * create_worker - create a new workqueue worker
  * @pool: pool the new worker will belong to
@@ -1503,13 +1591,15 @@ static struct worker *create_worker(struct worker_pool *pool)
 	worker->pool = pool;
 	worker->id = id;
 
-	if (gcwq->cpu != WORK_CPU_UNBOUND)
+	if (gcwq->cpu < WORK_CPU_UNBOUND)
 		worker->task = kthread_create_on_node(worker_thread,
 					worker, cpu_to_node(gcwq->cpu),
 					"kworker/%u:%d%s", gcwq->cpu, id, pri);
 	else
-		worker->task = kthread_create(worker_thread, worker,
-					      "kworker/u:%d%s", id, pri);
+		worker->task = kthread_create_on_node(worker_thread,
+					worker, unbound_gcwq_node(gcwq),
+					"kworker/u%u:%d%s",
+					gcwq->cpu - WORK_CPU_UNBOUND, id, pri);
 	if (IS_ERR(worker->task))
 		goto fail;
 
@@ -1528,6 +1618,14 @@ static struct worker *create_worker(struct worker_pool *pool)
 	if (!(gcwq->flags & GCWQ_DISASSOCIATED)) {
 		kthread_bind(worker->task, gcwq->cpu);
 	} else {
+		/*
+		 * Keep the workers of a per-node unbound gcwq on their
+		 * node.  Best effort: if none of the node's CPUs is
+		 * online, the worker may run anywhere.
+		 */
+		if (unbound_gcwq_node(gcwq) != NUMA_NO_NODE)
+			set_cpus_allowed_ptr(worker->task,
+				cpumask_of_node(unbound_gcwq_node(gcwq)));
 		worker->task->flags |= PF_THREAD_BOUND;
 		worker->flags |= WORKER_UNBOUND;
 	}
@@ -1634,8 +1732,11 @@ static bool send_mayday(struct work_struct *work)
 
 	/* mayday mayday mayday */
 	cpu = cwq->pool->gcwq->cpu;
-	/* WORK_CPU_UNBOUND can't be set in cpumask, use cpu 0 instead */
-	if (cpu == WORK_CPU_UNBOUND)
+	/*
+	 * Unbound gcwqs can't be set in cpumask, use cpu 0 instead and
+	 * let the rescuer check all of them.
+	 */
+	if (cpu >= WORK_CPU_UNBOUND)
 		cpu = 0;
 	if (!mayday_test_and_set_cpu(cpu, wq->mayday_mask))
 		wake_up_process(wq->rescuer->task);
@@ -2150,6 +2251,43 @@ sleep:
 	goto woke_up;
 }
 
+/*
+ * Process all works issued via @cwq's workqueue which are pending on
+ * @cwq's pool.  Called from the rescuer without any lock held.
+ */
+static void rescue_cwq(struct worker *rescuer, struct cpu_workqueue_struct *cwq)
+{
+	struct list_head *scheduled = &rescuer->scheduled;
+	struct worker_pool *pool = cwq->pool;
+	struct global_cwq *gcwq = pool->gcwq;
+	struct work_struct *work, *n;
+
+	/* migrate to the target cpu if possible */
+	rescuer->pool = pool;
+	worker_maybe_bind_and_lock(rescuer);
+
+	/*
+	 * Slurp in all works issued via this workqueue and
+	 * process'em.
+	 */
+	BUG_ON(!list_empty(&rescuer->scheduled));
+	list_for_each_entry_safe(work, n, &pool->worklist, entry)
+		if (get_work_cwq(work) == cwq)
+			move_linked_works(work, scheduled, &n);
+
+	process_scheduled_works(rescuer);
+
+	/*
+	 * Leave this gcwq.  If keep_working() is %true, notify a
+	 * regular worker; otherwise, we end up with 0 concurrency
+	 * and stalling the execution.
+	 */
+	if (keep_working(pool))
+		wake_up_worker(pool);
+
+	spin_unlock_irq(&gcwq->lock);
+}
+
 /**
  * rescuer_thread - the rescuer thread function
  * @__wq: the associated workqueue
@@ -2173,9 +2311,8 @@ static int rescuer_thread(void *__wq)
 {
 	struct workqueue_struct *wq = __wq;
 	struct worker *rescuer = wq->rescuer;
-	struct list_head *scheduled = &rescuer->scheduled;
 	bool is_unbound = wq->flags & WQ_UNBOUND;
-	unsigned int cpu;
+	unsigned int cpu, tcpu;
 
 	set_user_nice(current, RESCUER_NICE_LEVEL);
 repeat:
@@ -2186,42 +2323,18 @@ repeat:
 
 	/*
 	 * See whether any cpu is asking for help.  Unbounded
-	 * workqueues use cpu 0 in mayday_mask for CPU_UNBOUND.
+	 * workqueues use cpu 0 in mayday_mask for all their unbound
+	 * gcwqs.
 	 */
 	for_each_mayday_cpu(cpu, wq->mayday_mask) {
-		unsigned int tcpu = is_unbound ? WORK_CPU_UNBOUND : cpu;
-		struct cpu_workqueue_struct *cwq = get_cwq(tcpu, wq);
-		struct worker_pool *pool = cwq->pool;
-		struct global_cwq *gcwq = pool->gcwq;
-		struct work_struct *work, *n;
-
 		__set_current_state(TASK_RUNNING);
 		mayday_clear_cpu(cpu, wq->mayday_mask);
 
-		/* migrate to the target cpu if possible */
-		rescuer->pool = pool;
-		worker_maybe_bind_and_lock(rescuer);
-
-		/*
-		 * Slurp in all works issued via this workqueue and
-		 * process'em.
-		 */
-		BUG_ON(!list_empty(&rescuer->scheduled));
-		list_for_each_entry_safe(work, n, &pool->worklist, entry)
-			if (get_work_cwq(work) == cwq)
-				move_linked_works(work, scheduled, &n);
-
-		process_scheduled_works(rescuer);
-
-		/*
-		 * Leave this gcwq.  If keep_working() is %true, notify a
-		 * regular worker; otherwise, we end up with 0 concurrency
-		 * and stalling the execution.
-		 */
-		if (keep_working(pool))
-			wake_up_worker(pool);
-
-		spin_unlock_irq(&gcwq->lock);
+		if (!is_unbound)
+			rescue_cwq(rescuer, get_cwq(cpu, wq));
+		else
+			for_each_cwq_cpu(tcpu, wq)
+				rescue_cwq(rescuer, get_cwq(tcpu, wq));
 	}
 
 	schedule();
@@ -3050,17 +3163,18 @@ static int alloc_cwqs(struct workqueue_struct *wq)
 	if (!(wq->flags & WQ_UNBOUND))
 		wq->cpu_wq.pcpu = __alloc_percpu(size, align);
 	else {
+		const size_t total = nr_unbound_cwqs(wq) * unbound_cwq_stride();
 		void *ptr;
 
 		/*
-		 * Allocate enough room to align cwq and put an extra
+		 * Allocate enough room to align cwqs and put an extra
 		 * pointer at the end pointing back to the originally
 		 * allocated pointer which will be used for free.
 		 */
-		ptr = kzalloc(size + align + sizeof(void *), GFP_KERNEL);
+		ptr = kzalloc(total + align + sizeof(void *), GFP_KERNEL);
 		if (ptr) {
 			wq->cpu_wq.single = PTR_ALIGN(ptr, align);
-			*(void **)(wq->cpu_wq.single + 1) = ptr;
+			*(void **)((void *)wq->cpu_wq.single + total) = ptr;
 		}
 	}
 
@@ -3074,8 +3188,9 @@ static void free_cwqs(struct workqueue_struct *wq)
 	if (!(wq->flags & WQ_UNBOUND))
 		free_percpu(wq->cpu_wq.pcpu);
 	else if (wq->cpu_wq.single) {
-		/* the pointer to free is stored right after the cwq */
-		kfree(*(void **)(wq->cpu_wq.single + 1));
+		/* the pointer to free is stored right after the cwqs */
+		kfree(*(void **)((void *)wq->cpu_wq.single +
+				 nr_unbound_cwqs(wq) * unbound_cwq_stride()));
 	}
 }
 
@@ -3123,6 +3238,13 @@ struct workqueue_struct *__alloc_workqueue_key(const char *fmt,
 	if (flags & WQ_MEM_RECLAIM)
 		flags |= WQ_RESCUER;
 
+	/*
+	 * An unbound workqueue with max_active 1 executes its works in
+	 * queueing order, which only holds if they all go to one gcwq.
+	 */
+	if ((flags & WQ_UNBOUND) && max_active == 1)
+		flags |= WQ_ORDERED;
+
 	max_active = max_active ?: WQ_DFL_ACTIVE;
 	max_active = wq_clamp_max_active(max_active, flags, wq->name);
 
@@ -3256,6 +3378,10 @@ void workqueue_set_max_active(struct workqueue_struct *wq, int max_active)
 {
 	unsigned int cpu;
 
+	/* ordered workqueues stay at 1, see __alloc_workqueue_key() */
+	if (WARN_ON(wq->flags & WQ_ORDERED))
+		return;
+
 	max_active = wq_clamp_max_active(max_active, wq->flags, wq->name);
 
 	spin_lock(&workqueue_lock);
@@ -3292,7 +3418,11 @@ EXPORT_SYMBOL_GPL(workqueue_set_max_active);
  */
 bool workqueue_congested(unsigned int cpu, struct workqueue_struct *wq)
 {
-	struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+	struct cpu_workqueue_struct *cwq;
+
+	if (wq->flags & WQ_UNBOUND)
+		cpu = unbound_gcwq_cpu(wq, cpu);
+	cwq = get_cwq(cpu, wq);
 
 	return !list_empty(&cwq->delayed_works);
 }
@@ -3690,11 +3820,24 @@ out_unlock:
 static int __init init_workqueues(void)
 {
 	unsigned int cpu;
-	int i;
+	int i, node;
 
 	cpu_notifier(workqueue_cpu_up_callback, CPU_PRI_WORKQUEUE_UP);
 	cpu_notifier(workqueue_cpu_down_callback, CPU_PRI_WORKQUEUE_DOWN);
 
+	wq_dfl_node = first_node(node_possible_map);
+	wq_numa_enabled = !wq_disable_numa && num_possible_nodes() > 1;
+
+	/* allocate unbound gcwqs, on their own node if it has memory */
+	for_each_gcwq_cpu(cpu) {
+		if (cpu < WORK_CPU_UNBOUND)
+			continue;
+		node = cpu - WORK_CPU_UNBOUND;
+		unbound_global_cwq[node] = kzalloc_node(sizeof(struct global_cwq),
+				GFP_KERNEL, node_online(node) ? node : NUMA_NO_NODE);
+		BUG_ON(!unbound_global_cwq[node]);
+	}
+
 	/* initialize gcwqs */
 	for_each_gcwq_cpu(cpu) {
 		struct global_cwq *gcwq = get_gcwq(cpu);
@@ -3731,7 +3874,7 @@ static int __init init_workqueues(void)
 		struct global_cwq *gcwq = get_gcwq(cpu);
 		struct worker_pool *pool;
 
-		if (cpu != WORK_CPU_UNBOUND)
+		if (cpu < WORK_CPU_UNBOUND)
 			gcwq->flags &= ~GCWQ_DISASSOCIATED;
 
 		for_each_worker_pool(pool, gcwq) {
@@ -0,0 +1,60 @@
+/*
+ * ChaCha20 block function, as described by D. J. Bernstein in
+ * "ChaCha, a variant of Salsa20" and RFC 7539.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/bug.h>
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/bitops.h>
+#include <asm/unaligned.h>
+#include <crypto/chacha20.h>
+
+#define QUARTERROUND(a, b, c, d) do {			\
+	a += b; d = rol32(d ^ a, 16);			\
+	c += d; b = rol32(b ^ c, 12);			\
+	a += b; d = rol32(d ^ a, 8);			\
+	c += d; b = rol32(b ^ c, 7);			\
+} while (0)
+
+/**
+ * chacha20_block - generate one block of key stream
+ * @state: 16 word input state: constants, key, block counter and nonce
+ * @stream: 64 byte output buffer
+ *
+ * The 32-bit block counter in state[12] is incremented; the caller
+ * deals with it wrapping around.
+ */
+void chacha20_block(u32 *state, void *stream)
+{
+	u32 x[16];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		x[i] = state[i];
+
+	for (i = 0; i < 20; i += 2) {
+		/* column round */
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+
+		/* diagonal round */
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		put_unaligned_le32(x[i] + state[i], stream + i * sizeof(u32));
+
+	state[12]++;
+}
+EXPORT_SYMBOL(chacha20_block);
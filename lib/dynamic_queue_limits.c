@@ -8,16 +8,78 @@
 #include <linux/ctype.h>
 #include <linux/kernel.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/log2.h>
 #include <linux/dynamic_queue_limits.h>
 
 #define POSDIFF(A, B) ((int)((A) - (B)) > 0 ? (A) - (B) : 0)
 #define AFTER_EQ(A, B) ((int)((A) - (B)) >= 0)
 
+/*
+ * Sojourn time samples live in a small ring, the enqueue path produces them
+ * and the completion path consumes them.  When the ring is full no sample is
+ * taken, so at most DQL_STAMPS queuing operations in flight are timed.
+ */
+void dql_stamp(struct dql *dql)
+{
+	unsigned int head = dql->stamp_head;
+	struct dql_stamp *stamp;
+
+	if (head - ACCESS_ONCE(dql->stamp_tail) >= DQL_STAMPS)
+		return;
+
+	stamp = &dql->stamps[head & (DQL_STAMPS - 1)];
+	stamp->num_queued = dql->num_queued;
+	stamp->time = ktime_to_ns(ktime_get());
+
+	/* Publish the sample before the completion path can see it */
+	smp_wmb();
+	dql->stamp_head = head + 1;
+}
+EXPORT_SYMBOL(dql_stamp);
+
+/* Retire the samples covered by completed, returns the largest sojourn */
+static unsigned int dql_sojourn(struct dql *dql, unsigned int completed)
+{
+	unsigned int head = ACCESS_ONCE(dql->stamp_head);
+	unsigned int tail = dql->stamp_tail;
+	unsigned int sojourn, max_sojourn = 0;
+	struct dql_stamp *stamp;
+	u64 now = 0;
+
+	smp_rmb();
+	while (tail != head) {
+		stamp = &dql->stamps[tail & (DQL_STAMPS - 1)];
+		if (!AFTER_EQ(completed, stamp->num_queued))
+			break;
+
+		if (!now)
+			now = ktime_to_ns(ktime_get());
+		sojourn = (unsigned int)min_t(u64, div_u64(now - stamp->time,
+							   NSEC_PER_USEC),
+					      UINT_MAX);
+		dql->hist[min_t(unsigned int,
+				sojourn ? ilog2(sojourn) : 0,
+				DQL_HIST_BUCKETS - 1)]++;
+		max_sojourn = max(max_sojourn, sojourn);
+		tail++;
+	}
+
+	if (tail != dql->stamp_tail) {
+		dql->sojourn = max_sojourn;
+		/* Slots are free once the samples have been read */
+		smp_mb();
+		dql->stamp_tail = tail;
+	}
+	return max_sojourn;
+}
+
 /* Records completed count and recalculates the queue limit */
 void dql_completed(struct dql *dql, unsigned int count)
 {
 	unsigned int inprogress, prev_inprogress, limit;
 	unsigned int ovlimit, completed, num_queued;
+	unsigned int sojourn = 0;
 	bool all_prev_completed;
 
 	num_queued = ACCESS_ONCE(dql->num_queued);
@@ -32,7 +94,19 @@ void dql_completed(struct dql *dql, unsigned int count)
 	prev_inprogress = dql->prev_num_queued - dql->num_completed;
 	all_prev_completed = AFTER_EQ(completed, dql->prev_num_queued);
 
-	if ((ovlimit && !inprogress) ||
+	if (dql->latency_track)
+		sojourn = dql_sojourn(dql, completed);
+
+	if (dql->latency_target && sojourn > dql->latency_target) {
+		/*
+		 * Objects spent more time in the queue than the latency target
+		 * allows, shrink the limit by an eighth whatever the starvation
+		 * state.  The target takes precedence over throughput.
+		 */
+		limit = POSDIFF(limit, limit >> 3);
+		dql->slack_start_time = jiffies;
+		dql->lowest_slack = UINT_MAX;
+	} else if ((ovlimit && !inprogress) ||
 	    (dql->prev_ovlimit && all_prev_completed)) {
 		/*
 		 * Queue considered starved if:
@@ -124,14 +198,32 @@ void dql_reset(struct dql *dql)
 	dql->prev_ovlimit = 0;
 	dql->lowest_slack = UINT_MAX;
 	dql->slack_start_time = jiffies;
+	dql->stamp_head = 0;
+	dql->stamp_tail = 0;
+	dql->sojourn = 0;
 }
 EXPORT_SYMBOL(dql_reset);
 
+void dql_set_latency_track(struct dql *dql, bool on)
+{
+	/*
+	 * Samples taken before a reset refer to stale num_queued values,
+	 * drop them by restarting the ring when tracking is turned on.
+	 */
+	if (on && !dql->latency_track)
+		dql->stamp_tail = dql->stamp_head;
+	dql->latency_track = on;
+}
+EXPORT_SYMBOL(dql_set_latency_track);
+
 int dql_init(struct dql *dql, unsigned hold_time)
 {
 	dql->max_limit = DQL_MAX_LIMIT;
 	dql->min_limit = 0;
 	dql->slack_hold_time = hold_time;
+	dql->latency_target = 0;
+	dql->latency_track = false;
+	memset(dql->hist, 0, sizeof(dql->hist));
 	dql_reset(dql);
 	return 0;
 }
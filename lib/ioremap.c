@@ -10,9 +10,23 @@
 #include <linux/sched.h>
 #include <linux/io.h>
 #include <linux/export.h>
+#include <linux/init.h>
 #include <asm/cacheflush.h>
 #include <asm/pgtable.h>
 
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+static int ioremap_pmd_capable __read_mostly = 1;
+
+static int __init set_nohugeiomap(char *str)
+{
+	ioremap_pmd_capable = 0;
+	return 0;
+}
+early_param("nohugeiomap", set_nohugeiomap);
+#else
+#define ioremap_pmd_capable	0
+#endif
+
 static int ioremap_pte_range(pmd_t *pmd, unsigned long addr,
 		unsigned long end, phys_addr_t phys_addr, pgprot_t prot)
 {
@@ -43,6 +57,15 @@ static inline int ioremap_pmd_range(pud_t *pud, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+
+		/* a whole, physically aligned pmd: try one large page */
+		if (ioremap_pmd_capable &&
+		    next - addr == PMD_SIZE &&
+		    IS_ALIGNED(phys_addr + addr, PMD_SIZE) &&
+		    pmd_free_pte_page(pmd, addr) &&
+		    pmd_set_huge(pmd, phys_addr + addr, prot))
+			continue;
+
 		if (ioremap_pte_range(pmd, addr, next, phys_addr + addr, prot))
 			return -ENOMEM;
 	} while (pmd++, addr = next, addr != end);
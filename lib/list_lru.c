@@ -0,0 +1,164 @@
+/*
+ * Generic LRU lists, one list per NUMA node.
+ *
+ * See include/linux/list_lru.h for the interface.
+ */
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/list_lru.h>
+
+static inline struct list_lru_node *
+list_lru_item_node(struct list_lru *lru, struct list_head *item)
+{
+	return &lru->node[page_to_nid(virt_to_page(item))];
+}
+
+bool list_lru_add(struct list_lru *lru, struct list_head *item)
+{
+	struct list_lru_node *nlru = list_lru_item_node(lru, item);
+
+	spin_lock(&nlru->lock);
+	WARN_ON_ONCE(nlru->nr_items < 0);
+	if (list_empty(item)) {
+		list_add_tail(item, &nlru->list);
+		nlru->nr_items++;
+		spin_unlock(&nlru->lock);
+		return true;
+	}
+	spin_unlock(&nlru->lock);
+	return false;
+}
+EXPORT_SYMBOL_GPL(list_lru_add);
+
+bool list_lru_del(struct list_lru *lru, struct list_head *item)
+{
+	struct list_lru_node *nlru = list_lru_item_node(lru, item);
+
+	spin_lock(&nlru->lock);
+	if (!list_empty(item)) {
+		list_del_init(item);
+		nlru->nr_items--;
+		WARN_ON_ONCE(nlru->nr_items < 0);
+		spin_unlock(&nlru->lock);
+		return true;
+	}
+	spin_unlock(&nlru->lock);
+	return false;
+}
+EXPORT_SYMBOL_GPL(list_lru_del);
+
+unsigned long list_lru_count_node(struct list_lru *lru, int nid)
+{
+	long count = ACCESS_ONCE(lru->node[nid].nr_items);
+
+	return count > 0 ? count : 0;
+}
+EXPORT_SYMBOL_GPL(list_lru_count_node);
+
+unsigned long list_lru_count(struct list_lru *lru)
+{
+	unsigned long count = 0;
+	int nid;
+
+	for_each_node(nid)
+		count += list_lru_count_node(lru, nid);
+	return count;
+}
+EXPORT_SYMBOL_GPL(list_lru_count);
+
+unsigned long list_lru_walk_node(struct list_lru *lru, int nid,
+				 list_lru_walk_cb isolate, void *cb_arg,
+				 unsigned long *nr_to_walk)
+{
+	struct list_lru_node *nlru = &lru->node[nid];
+	struct list_head *item, *n;
+	unsigned long isolated = 0;
+
+	spin_lock(&nlru->lock);
+restart:
+	list_for_each_safe(item, n, &nlru->list) {
+		enum lru_status ret;
+
+		/*
+		 * decrement nr_to_walk first so that we don't livelock if we
+		 * get stuck on large numbers of LRU_RETRY items
+		 */
+		if (!*nr_to_walk)
+			break;
+		--*nr_to_walk;
+
+		ret = isolate(item, &nlru->lock, cb_arg);
+		switch (ret) {
+		case LRU_REMOVED:
+			nlru->nr_items--;
+			WARN_ON_ONCE(nlru->nr_items < 0);
+			isolated++;
+			break;
+		case LRU_ROTATE:
+			list_move_tail(item, &nlru->list);
+			break;
+		case LRU_SKIP:
+			break;
+		case LRU_RETRY:
+			/* the lock was dropped, so our cursor may be stale */
+			goto restart;
+		default:
+			BUG();
+		}
+	}
+	spin_unlock(&nlru->lock);
+	return isolated;
+}
+EXPORT_SYMBOL_GPL(list_lru_walk_node);
+
+unsigned long list_lru_walk(struct list_lru *lru, list_lru_walk_cb isolate,
+			    void *cb_arg, unsigned long nr_to_walk)
+{
+	unsigned long total = list_lru_count(lru);
+	unsigned long isolated = 0;
+	int nid;
+
+	if (!total)
+		return 0;
+
+	for_each_node(nid) {
+		unsigned long nr = list_lru_count_node(lru, nid);
+
+		if (!nr)
+			continue;
+		if (nr_to_walk < total)
+			nr = div64_u64((u64)nr_to_walk * nr + total - 1, total);
+		else
+			nr = nr_to_walk;
+		isolated += list_lru_walk_node(lru, nid, isolate, cb_arg, &nr);
+	}
+	return isolated;
+}
+EXPORT_SYMBOL_GPL(list_lru_walk);
+
+int list_lru_init(struct list_lru *lru)
+{
+	int i;
+
+	lru->node = kcalloc(nr_node_ids, sizeof(*lru->node), GFP_KERNEL);
+	if (!lru->node)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_node_ids; i++) {
+		spin_lock_init(&lru->node[i].lock);
+		INIT_LIST_HEAD(&lru->node[i].list);
+		lru->node[i].nr_items = 0;
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(list_lru_init);
+
+void list_lru_destroy(struct list_lru *lru)
+{
+	kfree(lru->node);
+	lru->node = NULL;
+}
+EXPORT_SYMBOL_GPL(list_lru_destroy);
@@ -0,0 +1,187 @@
+/*
+ * LZ4 Compressor
+ *
+ * A single-pass greedy compressor: positions are hashed by their first
+ * four bytes into a table of previous positions, and the search skips
+ * ahead faster the longer it goes without finding a match, so that
+ * incompressible data goes through quickly.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/* Search step grows by one every 1 << SKIP_TRIGGER failed attempts */
+#define SKIP_TRIGGER	6
+
+static inline u32 lz4_hash(const u8 *p)
+{
+	return (LZ4_READ32(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Number of equal leading bytes in memory order, given their XOR */
+static inline unsigned int lz4_nb_common_bytes(unsigned long diff)
+{
+#ifdef __LITTLE_ENDIAN
+	return __ffs(diff) >> 3;
+#else
+	return (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+}
+
+static inline const u8 *lz4_match_end(const u8 *ip, const u8 *ref,
+				      const u8 *limit)
+{
+	while (ip + sizeof(unsigned long) <= limit) {
+		unsigned long diff = get_unaligned((const unsigned long *)ref) ^
+				     get_unaligned((const unsigned long *)ip);
+
+		if (diff)
+			return ip + lz4_nb_common_bytes(diff);
+		ip += sizeof(unsigned long);
+		ref += sizeof(unsigned long);
+	}
+
+	while (ip < limit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+
+	return ip;
+}
+
+/* Number of extension bytes needed for a run of len with a nibble of mask */
+static inline size_t lz4_length_bytes(size_t len, unsigned int mask)
+{
+	return len < mask ? 0 : (len - mask) / 255 + 1;
+}
+
+static inline u8 *lz4_put_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const u8 * const iend = src + src_len;
+	const u8 * const mflimit = iend - MFLIMIT;
+	const u8 * const matchlimit = iend - LASTLITERALS;
+	u8 * const oend = dst + *dst_len;
+	const u8 *ip = src, *anchor = src, *ref;
+	u32 *table = wrkmem;
+	u8 *op = dst, *token;
+	size_t len;
+	u32 h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	table[lz4_hash(ip)] = 0;
+	ip++;
+
+	for (;;) {
+		unsigned int attempts = 1 << SKIP_TRIGGER;
+		unsigned int step = 1;
+
+		/* Find a match */
+		for (;;) {
+			if (unlikely(ip > mflimit))
+				goto last_literals;
+			h = lz4_hash(ip);
+			ref = src + table[h];
+			table[h] = ip - src;
+			if (ip - ref <= MAX_DISTANCE &&
+			    LZ4_READ32(ref) == LZ4_READ32(ip))
+				break;
+			ip += step;
+			step = attempts++ >> SKIP_TRIGGER;
+		}
+
+		/* Extend it backwards into the pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run */
+		len = ip - anchor;
+		token = op++;
+		if (unlikely(op + lz4_length_bytes(len, RUN_MASK) + len + 2 > oend))
+			return -E2BIG;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else {
+			*token = len << ML_BITS;
+		}
+		memcpy(op, anchor, len);
+		op += len;
+
+next_match:
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		anchor = ip + MINMATCH;
+		ip = lz4_match_end(anchor, ref + MINMATCH, matchlimit);
+		len = ip - anchor;
+		if (unlikely(op + lz4_length_bytes(len, ML_MASK) > oend))
+			return -E2BIG;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token += len;
+		}
+
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+
+		table[lz4_hash(ip - 2)] = ip - 2 - src;
+
+		/* Try for another match right away, without literals */
+		h = lz4_hash(ip);
+		ref = src + table[h];
+		table[h] = ip - src;
+		if (ip - ref <= MAX_DISTANCE &&
+		    LZ4_READ32(ref) == LZ4_READ32(ip)) {
+			token = op++;
+			*token = 0;
+			goto next_match;
+		}
+
+		ip++;
+	}
+
+last_literals:
+	len = iend - anchor;
+	if (unlikely(op + 1 + lz4_length_bytes(len, RUN_MASK) + len > oend))
+		return -E2BIG;
+	if (len >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else {
+		*op++ = len << ML_BITS;
+	}
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
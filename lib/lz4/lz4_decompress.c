@@ -0,0 +1,105 @@
+/*
+ * LZ4 Decompressor
+ *
+ * Every length is checked against both the input and the output before
+ * it is used, so corrupt or malicious input cannot make it read or
+ * write out of bounds.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/* Returns false if the extension bytes run past iend */
+static inline bool lz4_get_length(const u8 **ipp, const u8 *iend,
+				  size_t *len)
+{
+	const u8 *ip = *ipp;
+	unsigned int s;
+
+	do {
+		if (unlikely(ip >= iend))
+			return false;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return true;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const u8 * const iend = src + src_len;
+	u8 * const oend = dst + *dst_len;
+	const u8 *ip = src, *ref;
+	u8 *op = dst, *cpy;
+	unsigned int token;
+	size_t len, offset;
+
+	for (;;) {
+		if (unlikely(ip >= iend))
+			return -EINVAL;
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && !lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		if (unlikely(len > iend - ip || len > oend - op))
+			return -EINVAL;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The block ends after the last literals */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (unlikely(iend - ip < 2))
+			return -EINVAL;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > op - dst))
+			return -EINVAL;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && !lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		len += MINMATCH;
+		if (unlikely(len > oend - op))
+			return -EINVAL;
+
+		cpy = op + len;
+		if (offset >= sizeof(u64) && oend - cpy >= sizeof(u64)) {
+			/* May write up to 7 bytes past cpy, which is fine */
+			do {
+				put_unaligned(get_unaligned((const u64 *)ref),
+					      (u64 *)op);
+				op += sizeof(u64);
+				ref += sizeof(u64);
+			} while (op < cpy);
+			op = cpy;
+		} else {
+			/* Overlapping copy, byte by byte to repeat patterns */
+			while (op < cpy)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,35 @@
+/*
+ * lz4defs.h -- definitions shared by the LZ4 compressor and decompressor
+ *
+ * Sequences are a token byte, whose high nibble is the literal run length
+ * and low nibble the match length minus MINMATCH, optional length
+ * extension bytes for the literal run, the literals, a little-endian
+ * 16-bit match offset and optional extension bytes for the match length.
+ * A nibble of 15 is followed by extension bytes, each adding up to 255,
+ * the last one being less than 255.  The block ends with a sequence that
+ * has literals only.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <asm/unaligned.h>
+
+#define MINMATCH	4
+
+/* The last match must start at least MFLIMIT bytes before the end */
+#define MFLIMIT		12
+/* and the last LASTLITERALS bytes are always literals */
+#define LASTLITERALS	5
+
+#define MAX_DISTANCE	0xffff
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define LZ4_HASH_LOG	12
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
@@ -0,0 +1,53 @@
+/*
+ * Lock-less multi-producer, multi-consumer ring of pointers.
+ *
+ * See include/linux/mpmc_ring.h for the interface.
+ */
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/mpmc_ring.h>
+
+/**
+ * mpmc_ring_init - allocate the slots of a ring
+ * @r: the ring
+ * @size: number of slots, rounded up to a power of two
+ * @gfp: allocation flags
+ */
+int mpmc_ring_init(struct mpmc_ring *r, unsigned int size, gfp_t gfp)
+{
+	if (!size || size > (1U << 31))
+		return -EINVAL;
+
+	size = roundup_pow_of_two(size);
+	r->ring = kcalloc(size, sizeof(void *), gfp);
+	if (!r->ring)
+		return -ENOMEM;
+
+	r->size = size;
+	r->mask = size - 1;
+	r->prod.head = r->prod.tail = 0;
+	r->cons.head = r->cons.tail = 0;
+
+	return 0;
+}
+EXPORT_SYMBOL(mpmc_ring_init);
+
+/**
+ * mpmc_ring_cleanup - free the slots of a ring
+ * @r: the ring, no longer in use
+ * @destroy: called for each pointer still in the ring, may be NULL
+ */
+void mpmc_ring_cleanup(struct mpmc_ring *r, void (*destroy)(void *))
+{
+	void *obj;
+
+	if (destroy)
+		while ((obj = mpmc_ring_dequeue(r)))
+			destroy(obj);
+
+	kfree(r->ring);
+	r->ring = NULL;
+}
+EXPORT_SYMBOL(mpmc_ring_cleanup);
@@ -0,0 +1,110 @@
+/*
+ * Percpu reference counts.
+ *
+ * See include/linux/percpu-refcount.h for the interface.
+ *
+ * While a ref is in per-cpu mode @ref->count holds PCPU_COUNT_BIAS plus
+ * whatever gets and puts raced with percpu_ref_kill() and went to the
+ * atomic_t before the switch was complete.  The bias keeps those from
+ * taking @ref->count to zero; it is only taken out once the per-cpu
+ * counters have been added in.  Each per-cpu counter on its own may
+ * well wrap, only their sum is meaningful.
+ */
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/percpu-refcount.h>
+
+#define PCPU_COUNT_BIAS		(1U << 31)
+
+static unsigned __percpu *pcpu_count_ptr(struct percpu_ref *ref)
+{
+	return (unsigned __percpu *)(ref->pcpu_count_ptr & ~PCPU_REF_DEAD);
+}
+
+/**
+ * percpu_ref_init - initialize a percpu refcount
+ * @ref: percpu_ref to initialize
+ * @release: function called when the count reaches zero
+ *
+ * Sets the count to one, in per-cpu mode.  Returns 0 on success or
+ * -ENOMEM if the per-cpu counters cannot be allocated.
+ */
+int percpu_ref_init(struct percpu_ref *ref, percpu_ref_func_t *release)
+{
+	unsigned __percpu *pcpu_count;
+
+	atomic_set(&ref->count, 1 + PCPU_COUNT_BIAS);
+
+	pcpu_count = alloc_percpu(unsigned);
+	if (!pcpu_count)
+		return -ENOMEM;
+
+	ref->pcpu_count_ptr = (unsigned long)pcpu_count;
+	ref->release = release;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(percpu_ref_init);
+
+/**
+ * percpu_ref_exit - free the per-cpu counters of a percpu refcount
+ * @ref: percpu_ref to exit
+ *
+ * For a ref that never got killed, typically on the error path after
+ * percpu_ref_init(), or one that reached zero.
+ */
+void percpu_ref_exit(struct percpu_ref *ref)
+{
+	unsigned __percpu *pcpu_count = pcpu_count_ptr(ref);
+
+	if (pcpu_count) {
+		free_percpu(pcpu_count);
+		ref->pcpu_count_ptr = PCPU_REF_DEAD;
+	}
+}
+EXPORT_SYMBOL_GPL(percpu_ref_exit);
+
+static void percpu_ref_kill_rcu(struct rcu_head *rcu)
+{
+	struct percpu_ref *ref = container_of(rcu, struct percpu_ref, rcu);
+	unsigned __percpu *pcpu_count = pcpu_count_ptr(ref);
+	unsigned count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += *per_cpu_ptr(pcpu_count, cpu);
+
+	/*
+	 * Add the sum of all counters at once: one CPU's counter alone can
+	 * be far off, gets may have happened on one CPU and the matching
+	 * puts on another.  Dropping the bias in the same go saves an
+	 * atomic op and is just as good.
+	 */
+	atomic_add((int)count - PCPU_COUNT_BIAS, &ref->count);
+
+	WARN_ONCE(atomic_read(&ref->count) <= 0, "percpu ref (%pf) <= 0 (%i)",
+		  ref->release, atomic_read(&ref->count));
+
+	/* the count is exact now, drop the initial reference */
+	percpu_ref_put(ref);
+}
+
+/**
+ * percpu_ref_kill - drop the initial reference of a percpu refcount
+ * @ref: percpu_ref to kill
+ *
+ * Switches @ref to atomic counting and drops the reference taken by
+ * percpu_ref_init().  percpu_ref_tryget_live() fails from here on, while
+ * holders of references may still get and put them.  The switch takes
+ * an RCU-sched grace period, ->release() may be called from the RCU
+ * callback and so from softirq context.  Must be called only once.
+ */
+void percpu_ref_kill(struct percpu_ref *ref)
+{
+	WARN_ONCE(ref->pcpu_count_ptr & PCPU_REF_DEAD,
+		  "percpu_ref_kill() called more than once on %pf!\n",
+		  ref->release);
+
+	ref->pcpu_count_ptr |= PCPU_REF_DEAD;
+	call_rcu_sched(&ref->rcu, percpu_ref_kill_rcu);
+}
+EXPORT_SYMBOL_GPL(percpu_ref_kill);
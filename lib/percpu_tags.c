@@ -0,0 +1,390 @@
+/*
+ * Scalable tag allocator
+ *
+ * Tags freed on a CPU go into that CPU's cache first and are reused from
+ * there, which keeps the common allocate/free cycle on one CPU's
+ * cacheline.  Tags that do not fit in the cache go back to a bitmap.  The
+ * bitmap is spread over at least four cachelines where the tag space
+ * allows it, and every CPU starts searching it at the word where it last
+ * found or freed a tag, so concurrent searches mostly touch different
+ * lines.  Once the bitmap is empty an allocation takes a tag from another
+ * CPU's cache.
+ *
+ * A task that has to sleep for a tag picks one of several wait queues in
+ * turn.  Frees count down the wait queue that is next in line and wake a
+ * batch of its waiters when the count runs out, so a burst of frees does
+ * not wake every waiter at once to fight over a handful of tags.  A queue
+ * with fewer waiters than the batch is woken as soon as the frees cover
+ * all of them, so they are not left asleep if no more frees follow.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/sched.h>
+#include <linux/percpu_tags.h>
+
+static inline unsigned long *percpu_tags_word(struct percpu_tags *pt,
+					      unsigned int tag)
+{
+	return &pt->map[tag >> pt->shift].word;
+}
+
+static inline unsigned int percpu_tags_bit(struct percpu_tags *pt,
+					   unsigned int tag)
+{
+	return tag & ((1U << pt->shift) - 1);
+}
+
+/*
+ * Find and set a free bit below the current depth, starting at the word
+ * in *hint and wrapping around once.
+ */
+static int percpu_tags_get_bit(struct percpu_tags *pt, unsigned int *hint)
+{
+	unsigned int depth = ACCESS_ONCE(pt->depth);
+	unsigned int bits_per_word = 1U << pt->shift;
+	unsigned int nr_words = DIV_ROUND_UP(depth, bits_per_word);
+	unsigned int index = *hint;
+	unsigned int i;
+
+	if (index >= nr_words)
+		index = 0;
+
+	for (i = 0; i < nr_words; i++) {
+		unsigned long *word = &pt->map[index].word;
+		unsigned int base = index << pt->shift;
+		unsigned int bits = min(bits_per_word, depth - base);
+		unsigned int bit;
+
+		bit = find_first_zero_bit(word, bits);
+		while (bit < bits) {
+			if (!test_and_set_bit_lock(bit, word)) {
+				*hint = index;
+				return base + bit;
+			}
+			bit = find_next_zero_bit(word, bits, bit + 1);
+		}
+
+		if (++index >= nr_words)
+			index = 0;
+	}
+
+	return -ENOSPC;
+}
+
+/*
+ * Take a tag out of a CPU cache, dropping any that were cached before
+ * the depth was reduced.  Called with the cache lock held.
+ */
+static int percpu_tags_cache_get(struct percpu_tags *pt,
+				 struct percpu_tags_cpu *tc)
+{
+	while (tc->nr_free) {
+		unsigned int tag = tc->freelist[--tc->nr_free];
+
+		if (tag < pt->depth)
+			return tag;
+		clear_bit_unlock(percpu_tags_bit(pt, tag),
+				 percpu_tags_word(pt, tag));
+	}
+
+	return -ENOSPC;
+}
+
+static int percpu_tags_steal(struct percpu_tags *pt)
+{
+	unsigned long flags;
+	int cpu, tag = -ENOSPC;
+
+	for_each_possible_cpu(cpu) {
+		struct percpu_tags_cpu *tc = &pt->cpu_cache[cpu];
+
+		if (!ACCESS_ONCE(tc->nr_free))
+			continue;
+
+		spin_lock_irqsave(&tc->lock, flags);
+		tag = percpu_tags_cache_get(pt, tc);
+		spin_unlock_irqrestore(&tc->lock, flags);
+		if (tag >= 0)
+			break;
+	}
+
+	return tag;
+}
+
+static int __percpu_tags_alloc(struct percpu_tags *pt)
+{
+	struct percpu_tags_cpu *tc;
+	unsigned long flags;
+	int tag;
+
+	local_irq_save(flags);
+	tc = &pt->cpu_cache[smp_processor_id()];
+
+	spin_lock(&tc->lock);
+	tag = percpu_tags_cache_get(pt, tc);
+	spin_unlock(&tc->lock);
+
+	if (tag < 0)
+		tag = percpu_tags_get_bit(pt, &tc->hint);
+	local_irq_restore(flags);
+
+	if (tag < 0 && pt->cache_size)
+		tag = percpu_tags_steal(pt);
+
+	return tag;
+}
+
+/**
+ * percpu_tags_alloc - allocate a tag
+ * @pt:		tag pool
+ * @gfp:	sleep until a tag is free if this contains %__GFP_WAIT
+ *
+ * Returns a tag below the current depth of the pool, or -ENOSPC if none
+ * is free and @gfp does not allow sleeping.
+ */
+int percpu_tags_alloc(struct percpu_tags *pt, gfp_t gfp)
+{
+	struct percpu_tags_wait *ws;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	tag = __percpu_tags_alloc(pt);
+	if (tag >= 0 || !(gfp & __GFP_WAIT))
+		return tag;
+
+	ws = &pt->ws[atomic_inc_return(&pt->wait_index) &
+		     (PERCPU_TAGS_WAIT_QUEUES - 1)];
+	atomic_inc(&ws->nr_waiters);
+	for (;;) {
+		prepare_to_wait_exclusive(&ws->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		tag = __percpu_tags_alloc(pt);
+		if (tag >= 0)
+			break;
+		io_schedule();
+	}
+	finish_wait(&ws->wait, &wait);
+	atomic_dec(&ws->nr_waiters);
+
+	return tag;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_alloc);
+
+static struct percpu_tags_wait *percpu_tags_wake_ptr(struct percpu_tags *pt)
+{
+	unsigned int index = atomic_read(&pt->wake_index);
+	int i;
+
+	for (i = 0; i < PERCPU_TAGS_WAIT_QUEUES; i++) {
+		struct percpu_tags_wait *ws;
+
+		index &= PERCPU_TAGS_WAIT_QUEUES - 1;
+		ws = &pt->ws[index];
+		if (waitqueue_active(&ws->wait)) {
+			atomic_set(&pt->wake_index, index);
+			return ws;
+		}
+		index++;
+	}
+
+	return NULL;
+}
+
+static void percpu_tags_wake(struct percpu_tags *pt)
+{
+	struct percpu_tags_wait *ws;
+	int wait_cnt;
+
+	/* pairs with the waiter queueing itself before it retries */
+	smp_mb();
+
+	ws = percpu_tags_wake_ptr(pt);
+	if (!ws)
+		return;
+
+	wait_cnt = atomic_dec_return(&ws->wait_cnt);
+	if (wait_cnt <= 0 ||
+	    (int)pt->wake_batch - wait_cnt >= atomic_read(&ws->nr_waiters)) {
+		atomic_set(&ws->wait_cnt, pt->wake_batch);
+		atomic_inc(&pt->wake_index);
+		wake_up_nr(&ws->wait, pt->wake_batch);
+	}
+}
+
+/**
+ * percpu_tags_free - release a tag
+ * @pt:		tag pool the tag was allocated from
+ * @tag:	tag to free
+ */
+void percpu_tags_free(struct percpu_tags *pt, unsigned int tag)
+{
+	struct percpu_tags_cpu *tc;
+	unsigned long flags;
+	bool cached = false;
+
+	BUG_ON(tag >= pt->nr_tags);
+
+	local_irq_save(flags);
+	tc = &pt->cpu_cache[smp_processor_id()];
+
+	spin_lock(&tc->lock);
+	if (tc->nr_free < pt->cache_size && tag < pt->depth) {
+		tc->freelist[tc->nr_free++] = tag;
+		cached = true;
+	}
+	spin_unlock(&tc->lock);
+
+	/* start the next search on this CPU at the cache hot word */
+	if (!cached)
+		tc->hint = tag >> pt->shift;
+	local_irq_restore(flags);
+
+	if (!cached)
+		clear_bit_unlock(percpu_tags_bit(pt, tag),
+				 percpu_tags_word(pt, tag));
+
+	percpu_tags_wake(pt);
+}
+EXPORT_SYMBOL_GPL(percpu_tags_free);
+
+/**
+ * percpu_tags_claim - mark a specific tag as allocated
+ * @pt:		tag pool
+ * @tag:	tag to take
+ *
+ * For carrying tags that are in flight over from another pool, @pt must
+ * not have freed anything yet.  Returns -EBUSY if @tag is already in use.
+ */
+int percpu_tags_claim(struct percpu_tags *pt, unsigned int tag)
+{
+	BUG_ON(tag >= pt->nr_tags);
+
+	if (test_and_set_bit_lock(percpu_tags_bit(pt, tag),
+				  percpu_tags_word(pt, tag)))
+		return -EBUSY;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_claim);
+
+/**
+ * percpu_tags_resize - change the number of tags handed out
+ * @pt:		tag pool
+ * @depth:	new depth, at most the size the pool was created with
+ *
+ * Tags at or above the new depth that are in flight stay valid and may
+ * be freed as usual, they are just not allocated again.
+ */
+void percpu_tags_resize(struct percpu_tags *pt, unsigned int depth)
+{
+	depth = min(depth, pt->nr_tags);
+
+	/*
+	 * A waiter only sleeps once all of the depth is in flight, so
+	 * make sure those frees can make every wait queue reach its batch.
+	 */
+	pt->wake_batch = clamp_t(unsigned int,
+				 depth / PERCPU_TAGS_WAIT_QUEUES, 1, 8);
+	pt->depth = depth;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_resize);
+
+/**
+ * percpu_tags_nr_busy - count the tags in flight
+ * @pt:		tag pool
+ *
+ * The result is only a snapshot unless allocation and freeing have been
+ * stopped.
+ */
+unsigned int percpu_tags_nr_busy(struct percpu_tags *pt)
+{
+	unsigned int nr_words = DIV_ROUND_UP(pt->nr_tags, 1U << pt->shift);
+	unsigned int busy = 0, i;
+	int cpu;
+
+	for (i = 0; i < nr_words; i++)
+		busy += hweight_long(pt->map[i].word);
+	for_each_possible_cpu(cpu)
+		busy -= ACCESS_ONCE(pt->cpu_cache[cpu].nr_free);
+
+	return busy;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_nr_busy);
+
+/**
+ * percpu_tags_init - set up a tag pool
+ * @pt:		tag pool
+ * @nr_tags:	number of tags, numbered from 0
+ * @gfp:	allocation mask for the pool's memory
+ * @node:	NUMA node to allocate the bitmap on
+ */
+int percpu_tags_init(struct percpu_tags *pt, unsigned int nr_tags, gfp_t gfp,
+		     int node)
+{
+	unsigned int shift, nr_words;
+	int cpu, i;
+
+	if (!nr_tags)
+		return -EINVAL;
+
+	memset(pt, 0, sizeof(*pt));
+
+	shift = ilog2(BITS_PER_LONG);
+	while (shift && (4U << shift) > nr_tags)
+		shift--;
+	nr_words = DIV_ROUND_UP(nr_tags, 1U << shift);
+
+	pt->map = kzalloc_node(nr_words * sizeof(*pt->map), gfp, node);
+	if (!pt->map)
+		return -ENOMEM;
+
+	pt->cpu_cache = kzalloc(nr_cpu_ids * sizeof(*pt->cpu_cache), gfp);
+	if (!pt->cpu_cache) {
+		kfree(pt->map);
+		pt->map = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct percpu_tags_cpu *tc = &pt->cpu_cache[cpu];
+
+		spin_lock_init(&tc->lock);
+		tc->hint = cpu % nr_words;
+	}
+
+	pt->nr_tags = nr_tags;
+	pt->shift = shift;
+
+	/*
+	 * Don't let the caches hide a large part of a small pool, taking
+	 * tags from another CPU's cache is the slow path.
+	 */
+	pt->cache_size = min_t(unsigned int, PERCPU_TAGS_CACHE_SIZE,
+			       nr_tags / (4 * num_possible_cpus()));
+
+	percpu_tags_resize(pt, nr_tags);
+
+	for (i = 0; i < PERCPU_TAGS_WAIT_QUEUES; i++) {
+		init_waitqueue_head(&pt->ws[i].wait);
+		atomic_set(&pt->ws[i].wait_cnt, pt->wake_batch);
+		atomic_set(&pt->ws[i].nr_waiters, 0);
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_init);
+
+/**
+ * percpu_tags_destroy - free a tag pool
+ * @pt:		tag pool, may be one that was never initialised if zeroed
+ */
+void percpu_tags_destroy(struct percpu_tags *pt)
+{
+	kfree(pt->cpu_cache);
+	pt->cpu_cache = NULL;
+	kfree(pt->map);
+	pt->map = NULL;
+}
+EXPORT_SYMBOL_GPL(percpu_tags_destroy);
@@ -33,30 +33,6 @@
 #include <linux/bitops.h>
 #include <linux/rcupdate.h>
 
-
-#ifdef __KERNEL__
-#define RADIX_TREE_MAP_SHIFT	(CONFIG_BASE_SMALL ? 4 : 6)
-#else
-#define RADIX_TREE_MAP_SHIFT	3	/* For more stressful testing */
-#endif
-
-#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
-#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
-
-#define RADIX_TREE_TAG_LONGS	\
-	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
-
-struct radix_tree_node {
-	unsigned int	height;		/* Height from the bottom */
-	unsigned int	count;
-	union {
-		struct radix_tree_node *parent;	/* Used when ascending tree */
-		struct rcu_head	rcu_head;	/* Used when freeing node */
-	};
-	void __rcu	*slots[RADIX_TREE_MAP_SIZE];
-	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
-};
-
 #define RADIX_TREE_INDEX_BITS  (8 /* CHAR_BIT */ * sizeof(unsigned long))
 #define RADIX_TREE_MAX_PATH (DIV_ROUND_UP(RADIX_TREE_INDEX_BITS, \
 					  RADIX_TREE_MAP_SHIFT))
@@ -104,6 +80,51 @@ static inline void *indirect_to_ptr(void *ptr)
 	return (void *)((unsigned long)ptr & ~RADIX_TREE_INDIRECT_PTR);
 }
 
+static inline void *offset_to_sibling(unsigned int offset)
+{
+	return (void *)(((unsigned long)offset << RADIX_TREE_EXCEPTIONAL_SHIFT) |
+			RADIX_TREE_INDIRECT_PTR);
+}
+
+static inline unsigned int sibling_to_offset(void *sibling)
+{
+	return (unsigned long)sibling >> RADIX_TREE_EXCEPTIONAL_SHIFT;
+}
+
+/*
+ * Look up the slot for @index in @node, whose slots cover 2^@shift indices
+ * each.  Returns the offset of the slot holding the entry, which is before
+ * the one @index falls into if that holds a sibling entry, and stores the
+ * entry itself in *@entryp.
+ */
+static inline unsigned int radix_tree_descend(struct radix_tree_node *node,
+		void **entryp, unsigned long index, unsigned int shift)
+{
+	unsigned int offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+	void *entry = rcu_dereference_raw(node->slots[offset]);
+
+	if (radix_tree_is_sibling(entry)) {
+		offset = sibling_to_offset(entry);
+		entry = rcu_dereference_raw(node->slots[offset]);
+	}
+
+	*entryp = entry;
+	return offset;
+}
+
+/* Number of slots taken up by the entry at @offset in @node */
+static inline unsigned int entry_slots(struct radix_tree_node *node,
+				       unsigned int offset)
+{
+	void *sibling = offset_to_sibling(offset);
+	unsigned int n = 1;
+
+	while (offset + n < RADIX_TREE_MAP_SIZE &&
+	       node->slots[offset + n] == sibling)
+		n++;
+	return n;
+}
+
 static inline gfp_t root_gfp_mask(struct radix_tree_root *root)
 {
 	return root->gfp_mask & __GFP_BITS_MASK;
@@ -161,6 +182,25 @@ static inline int any_tag_set(struct radix_tree_node *node, unsigned int tag)
 	return 0;
 }
 
+/*
+ * Returns 1 if any slot in the node other than @offset has this tag set.
+ * Otherwise returns 0.
+ */
+static inline int any_other_tag_set(struct radix_tree_node *node,
+				    unsigned int tag, int offset)
+{
+	int idx;
+	for (idx = 0; idx < RADIX_TREE_TAG_LONGS; idx++) {
+		unsigned long tags = node->tags[tag][idx];
+
+		if (idx == offset / BITS_PER_LONG)
+			tags &= ~(1UL << (offset % BITS_PER_LONG));
+		if (tags)
+			return 1;
+	}
+	return 0;
+}
+
 /**
  * radix_tree_find_next_bit - find the next set bit in a memory region
  *
@@ -300,9 +340,10 @@ static inline unsigned long radix_tree_maxindex(unsigned int height)
 }
 
 /*
- *	Extend a radix tree so it can store key @index.
+ *	Extend a radix tree so it can store an entry of @order at key @index.
  */
-static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+static int radix_tree_extend(struct radix_tree_root *root, unsigned long index,
+			     unsigned int order)
 {
 	struct radix_tree_node *node;
 	struct radix_tree_node *slot;
@@ -311,7 +352,8 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 
 	/* Figure out what the height should be.  */
 	height = root->height + 1;
-	while (index > radix_tree_maxindex(height))
+	while (index > radix_tree_maxindex(height) ||
+	       order >= height * RADIX_TREE_MAP_SHIFT)
 		height++;
 
 	if (root->rnode == NULL) {
@@ -336,10 +378,9 @@ static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
 		node->count = 1;
 		node->parent = NULL;
 		slot = root->rnode;
-		if (newheight > 1) {
-			slot = indirect_to_ptr(slot);
-			slot->parent = node;
-		}
+		if (newheight > 1)
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent =
+									node;
 		node->slots[0] = slot;
 		node = ptr_to_indirect(node);
 		rcu_assign_pointer(root->rnode, node);
@@ -350,26 +391,34 @@ out:
 }
 
 /**
- *	radix_tree_insert    -    insert into a radix tree
+ *	radix_tree_insert_order    -    insert a multi-order entry
  *	@root:		radix tree root
- *	@index:		index key
+ *	@index:		first index covered, aligned to 2^@order
+ *	@order:		log2 of the number of indices covered
  *	@item:		item to insert
  *
- *	Insert an item into the radix tree at position @index.
+ *	Insert an item covering the indices @index to @index + 2^@order - 1
+ *	into the radix tree.  Lookups of any index in that range find the
+ *	item, tags apply to the entry as a whole and deleting any index in
+ *	the range removes the entry.  Returns -EEXIST if any index in the
+ *	range is in use.
  */
-int radix_tree_insert(struct radix_tree_root *root,
-			unsigned long index, void *item)
+int radix_tree_insert_order(struct radix_tree_root *root,
+			unsigned long index, unsigned int order, void *item)
 {
 	struct radix_tree_node *node = NULL, *slot;
-	unsigned int height, shift;
+	unsigned int height, shift, n, i;
 	int offset;
 	int error;
 
 	BUG_ON(radix_tree_is_indirect_ptr(item));
+	BUG_ON(order >= BITS_PER_LONG || index & ((1UL << order) - 1));
 
 	/* Make sure the tree is high enough.  */
-	if (index > radix_tree_maxindex(root->height)) {
-		error = radix_tree_extend(root, index);
+	if (index + ((1UL << order) - 1) > radix_tree_maxindex(root->height) ||
+	    (order && order >= root->height * RADIX_TREE_MAP_SHIFT)) {
+		error = radix_tree_extend(root, index + ((1UL << order) - 1),
+					  order);
 		if (error)
 			return error;
 	}
@@ -377,10 +426,10 @@ int radix_tree_insert(struct radix_tree_root *root,
 	slot = indirect_to_ptr(root->rnode);
 
 	height = root->height;
-	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	shift = height * RADIX_TREE_MAP_SHIFT;
 
 	offset = 0;			/* uninitialised var warning */
-	while (height > 0) {
+	while (shift > order) {
 		if (slot == NULL) {
 			/* Have to add a child node.  */
 			if (!(slot = radix_tree_node_alloc(root)))
@@ -388,47 +437,86 @@ int radix_tree_insert(struct radix_tree_root *root,
 			slot->height = height;
 			slot->parent = node;
 			if (node) {
-				rcu_assign_pointer(node->slots[offset], slot);
+				rcu_assign_pointer(node->slots[offset],
+						   ptr_to_indirect(slot));
 				node->count++;
 			} else
 				rcu_assign_pointer(root->rnode, ptr_to_indirect(slot));
-		}
+		} else if (node && !radix_tree_is_indirect_ptr(node->slots[offset]))
+			return -EEXIST;	/* a larger entry covers the range */
 
 		/* Go a level down */
+		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		node = slot;
 		slot = node->slots[offset];
-		shift -= RADIX_TREE_MAP_SHIFT;
+		if (shift > order && radix_tree_is_sibling(slot))
+			return -EEXIST;
+		slot = indirect_to_ptr(slot);
 		height--;
 	}
 
-	if (slot != NULL)
-		return -EEXIST;
-
-	if (node) {
-		node->count++;
-		rcu_assign_pointer(node->slots[offset], item);
-		BUG_ON(tag_get(node, 0, offset));
-		BUG_ON(tag_get(node, 1, offset));
-	} else {
+	if (!node) {
+		if (slot != NULL)
+			return -EEXIST;
 		rcu_assign_pointer(root->rnode, item);
 		BUG_ON(root_tag_get(root, 0));
 		BUG_ON(root_tag_get(root, 1));
+		return 0;
 	}
 
+	n = 1 << (order - shift);
+	for (i = 0; i < n; i++)
+		if (node->slots[offset + i] != NULL)
+			return -EEXIST;
+
+	/* Siblings first, so that they never point to an empty slot */
+	for (i = 1; i < n; i++)
+		node->slots[offset + i] = offset_to_sibling(offset);
+	node->count += n;
+	rcu_assign_pointer(node->slots[offset], item);
+	BUG_ON(tag_get(node, 0, offset));
+	BUG_ON(tag_get(node, 1, offset));
+
 	return 0;
 }
+EXPORT_SYMBOL(radix_tree_insert_order);
+
+/**
+ *	radix_tree_insert    -    insert into a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@item:		item to insert
+ *
+ *	Insert an item into the radix tree at position @index.
+ */
+int radix_tree_insert(struct radix_tree_root *root,
+			unsigned long index, void *item)
+{
+	return radix_tree_insert_order(root, index, 0, item);
+}
 EXPORT_SYMBOL(radix_tree_insert);
 
-/*
- * is_slot == 1 : search for the slot.
- * is_slot == 0 : search for the node.
+/**
+ *	__radix_tree_lookup	-	lookup an item in a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *	@nodep:		returns node
+ *	@slotp:		returns slot
+ *
+ *	Lookup and return the item at position @index in the radix
+ *	tree @root.
+ *
+ *	Until there is more than one item in the tree, no nodes are
+ *	allocated and @root->rnode is used as a direct slot instead of
+ *	pointing to a node, in which case *@nodep will be NULL.
  */
-static void *radix_tree_lookup_element(struct radix_tree_root *root,
-				unsigned long index, int is_slot)
+void *__radix_tree_lookup(struct radix_tree_root *root, unsigned long index,
+			  struct radix_tree_node **nodep, void ***slotp)
 {
-	unsigned int height, shift;
-	struct radix_tree_node *node, **slot;
+	unsigned int height, shift, offset;
+	struct radix_tree_node *node, *parent;
+	void *entry;
 
 	node = rcu_dereference_raw(root->rnode);
 	if (node == NULL)
@@ -437,28 +525,36 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
 	if (!radix_tree_is_indirect_ptr(node)) {
 		if (index > 0)
 			return NULL;
-		return is_slot ? (void *)&root->rnode : node;
+		if (nodep)
+			*nodep = NULL;
+		if (slotp)
+			*slotp = (void **)&root->rnode;
+		return node;
 	}
-	node = indirect_to_ptr(node);
+	parent = indirect_to_ptr(node);
 
-	height = node->height;
+	height = parent->height;
 	if (index > radix_tree_maxindex(height))
 		return NULL;
 
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
 
-	do {
-		slot = (struct radix_tree_node **)
-			(node->slots + ((index>>shift) & RADIX_TREE_MAP_MASK));
-		node = rcu_dereference_raw(*slot);
-		if (node == NULL)
+	for ( ; ; ) {
+		offset = radix_tree_descend(parent, &entry, index, shift);
+		if (entry == NULL)
 			return NULL;
-
+		/* Stop at the bottom or at a multi-order entry */
+		if (!shift || !radix_tree_is_indirect_ptr(entry))
+			break;
+		parent = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
-		height--;
-	} while (height > 0);
+	}
 
-	return is_slot ? (void *)slot : indirect_to_ptr(node);
+	if (nodep)
+		*nodep = parent;
+	if (slotp)
+		*slotp = parent->slots + offset;
+	return entry;
 }
 
 /**
@@ -476,7 +572,11 @@ static void *radix_tree_lookup_element(struct radix_tree_root *root,
  */
 void **radix_tree_lookup_slot(struct radix_tree_root *root, unsigned long index)
 {
-	return (void **)radix_tree_lookup_element(root, index, 1);
+	void **slot;
+
+	if (!__radix_tree_lookup(root, index, NULL, &slot))
+		return NULL;
+	return slot;
 }
 EXPORT_SYMBOL(radix_tree_lookup_slot);
 
@@ -494,7 +594,7 @@ EXPORT_SYMBOL(radix_tree_lookup_slot);
  */
 void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
 {
-	return radix_tree_lookup_element(root, index, 0);
+	return indirect_to_ptr(__radix_tree_lookup(root, index, NULL, NULL));
 }
 EXPORT_SYMBOL(radix_tree_lookup);
 
@@ -516,6 +616,7 @@ void *radix_tree_tag_set(struct radix_tree_root *root,
 {
 	unsigned int height, shift;
 	struct radix_tree_node *slot;
+	void *entry;
 
 	height = root->height;
 	BUG_ON(index > radix_tree_maxindex(height));
@@ -526,11 +627,13 @@ void *radix_tree_tag_set(struct radix_tree_root *root,
 	while (height > 0) {
 		int offset;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		offset = radix_tree_descend(slot, &entry, index, shift);
 		if (!tag_get(slot, tag, offset))
 			tag_set(slot, tag, offset);
-		slot = slot->slots[offset];
-		BUG_ON(slot == NULL);
+		BUG_ON(entry == NULL);
+		slot = indirect_to_ptr(entry);
+		if (!radix_tree_is_indirect_ptr(entry))
+			break;
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
@@ -564,24 +667,27 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 	struct radix_tree_node *slot = NULL;
 	unsigned int height, shift;
 	int uninitialized_var(offset);
+	void *entry;
 
 	height = root->height;
 	if (index > radix_tree_maxindex(height))
 		goto out;
 
 	shift = height * RADIX_TREE_MAP_SHIFT;
-	slot = indirect_to_ptr(root->rnode);
+	entry = root->rnode;
 
 	while (shift) {
-		if (slot == NULL)
+		if (entry == NULL)
 			goto out;
+		if (node && !radix_tree_is_indirect_ptr(entry))
+			break;		/* multi-order entry */
 
 		shift -= RADIX_TREE_MAP_SHIFT;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
-		slot = slot->slots[offset];
+		node = indirect_to_ptr(entry);
+		offset = radix_tree_descend(node, &entry, index, shift);
 	}
 
+	slot = indirect_to_ptr(entry);
 	if (slot == NULL)
 		goto out;
 
@@ -592,8 +698,8 @@ void *radix_tree_tag_clear(struct radix_tree_root *root,
 		if (any_tag_set(node, tag))
 			goto out;
 
-		index >>= RADIX_TREE_MAP_SHIFT;
-		offset = index & RADIX_TREE_MAP_MASK;
+		shift += RADIX_TREE_MAP_SHIFT;
+		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		node = node->parent;
 	}
 
@@ -626,6 +732,7 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 {
 	unsigned int height, shift;
 	struct radix_tree_node *node;
+	void *entry;
 
 	/* check the root's tag bit */
 	if (!root_tag_get(root, tag))
@@ -651,18 +758,123 @@ int radix_tree_tag_get(struct radix_tree_root *root,
 		if (node == NULL)
 			return 0;
 
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		offset = radix_tree_descend(node, &entry, index, shift);
 		if (!tag_get(node, tag, offset))
 			return 0;
-		if (height == 1)
+		if (height == 1 || !radix_tree_is_indirect_ptr(entry))
 			return 1;
-		node = rcu_dereference_raw(node->slots[offset]);
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		height--;
 	}
 }
 EXPORT_SYMBOL(radix_tree_tag_get);
 
+/*
+ * Find the node holding the item at @index and its offset in there, called
+ * under the RCU read lock.  That is a leaf node unless the item is a
+ * multi-order entry.  Returns NULL if the item is not present or is stored
+ * directly in the root.
+ */
+static struct radix_tree_node *radix_tree_lookup_leaf(
+		struct radix_tree_root *root, unsigned long index, int *offsetp)
+{
+	unsigned int height, shift;
+	struct radix_tree_node *node;
+	void *entry;
+	int offset;
+
+	node = rcu_dereference_raw(root->rnode);
+	if (!radix_tree_is_indirect_ptr(node))
+		return NULL;
+	node = indirect_to_ptr(node);
+
+	height = node->height;
+	if (index > radix_tree_maxindex(height))
+		return NULL;
+
+	shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+
+	for ( ; ; ) {
+		offset = radix_tree_descend(node, &entry, index, shift);
+		if (entry == NULL)
+			return NULL;
+		if (height == 1 || !radix_tree_is_indirect_ptr(entry))
+			break;
+		node = indirect_to_ptr(entry);
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	*offsetp = offset;
+	return node;
+}
+
+/**
+ * radix_tree_tag_set_leaf - set a tag without touching the upper levels
+ * @root:		radix tree root
+ * @index:		index key
+ * @tag: 		tag index (< RADIX_TREE_MAX_TAGS)
+ *
+ * Set the search tag corresponding to @index, provided that another item
+ * in the same leaf node already carries it and the rest of the path is
+ * tagged already.  See the locking rules in radix-tree.h.
+ *
+ * Returns %true if the tag is set, %false if the caller has to fall back
+ * to radix_tree_tag_set().
+ */
+bool radix_tree_tag_set_leaf(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag)
+{
+	struct radix_tree_node *node;
+	bool ret = false;
+	int offset;
+
+	rcu_read_lock();
+	node = radix_tree_lookup_leaf(root, index, &offset);
+	if (node && (tag_get(node, tag, offset) || any_tag_set(node, tag))) {
+		tag_set(node, tag, offset);
+		ret = true;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(radix_tree_tag_set_leaf);
+
+/**
+ * radix_tree_tag_clear_leaf - clear a tag without touching the upper levels
+ * @root:		radix tree root
+ * @index:		index key
+ * @tag: 		tag index (< RADIX_TREE_MAX_TAGS)
+ *
+ * Clear the search tag corresponding to @index, provided that another
+ * item in the same leaf node keeps carrying it, so the upper levels stay
+ * as they are.  See the locking rules in radix-tree.h.
+ *
+ * Returns %true if the tag is clear, %false if the caller has to fall
+ * back to radix_tree_tag_clear().  Nothing is changed in that case.
+ */
+bool radix_tree_tag_clear_leaf(struct radix_tree_root *root,
+			unsigned long index, unsigned int tag)
+{
+	struct radix_tree_node *node;
+	bool ret = false;
+	int offset;
+
+	rcu_read_lock();
+	node = radix_tree_lookup_leaf(root, index, &offset);
+	if (node && (!tag_get(node, tag, offset) ||
+		     any_other_tag_set(node, tag, offset))) {
+		tag_clear(node, tag, offset);
+		ret = true;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(radix_tree_tag_clear_leaf);
+
 /**
  * radix_tree_next_chunk - find next chunk of slots for iteration
  *
@@ -677,6 +889,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 	unsigned shift, tag = flags & RADIX_TREE_ITER_TAG_MASK;
 	struct radix_tree_node *rnode, *node;
 	unsigned long index, offset;
+	void *entry;
 
 	if ((flags & RADIX_TREE_ITER_TAGGED) && !root_tag_get(root, tag))
 		return NULL;
@@ -702,6 +915,7 @@ void **radix_tree_next_chunk(struct radix_tree_root *root,
 		iter->index = 0;
 		iter->next_index = 1;
 		iter->tags = 1;
+		iter->shift = 0;
 		return (void **)&root->rnode;
 	} else
 		return NULL;
@@ -716,6 +930,14 @@ restart:
 
 	node = rnode;
 	while (1) {
+		/* Start at the beginning of a multi-order entry */
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (radix_tree_is_sibling(entry)) {
+			offset = sibling_to_offset(entry);
+			index &= ~((RADIX_TREE_MAP_SIZE << shift) - 1);
+			index += offset << shift;
+		}
+
 		if ((flags & RADIX_TREE_ITER_TAGGED) ?
 				!test_bit(offset, node->tags[tag]) :
 				!node->slots[offset]) {
@@ -746,9 +968,19 @@ restart:
 		if (!shift)
 			break;
 
-		node = rcu_dereference_raw(node->slots[offset]);
-		if (node == NULL)
+		entry = rcu_dereference_raw(node->slots[offset]);
+		if (entry == NULL || radix_tree_is_sibling(entry))
 			goto restart;
+		if (!radix_tree_is_indirect_ptr(entry)) {
+			/* A multi-order entry makes up a chunk of its own */
+			iter->index = index & ~((1UL << shift) - 1);
+			iter->next_index = iter->index +
+				((unsigned long)entry_slots(node, offset) << shift);
+			iter->tags = 1;
+			iter->shift = shift;
+			return node->slots + offset;
+		}
+		node = indirect_to_ptr(entry);
 		shift -= RADIX_TREE_MAP_SHIFT;
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 	}
@@ -756,6 +988,7 @@ restart:
 	/* Update the iterator state */
 	iter->index = index;
 	iter->next_index = (index | RADIX_TREE_MAP_MASK) + 1;
+	iter->shift = 0;
 
 	/* Construct iter->tags bit-mask from node->tags[tag] array */
 	if (flags & RADIX_TREE_ITER_TAGGED) {
@@ -838,27 +1071,38 @@ unsigned long radix_tree_range_tag_if_tagged(struct radix_tree_root *root,
 
 	for (;;) {
 		unsigned long upindex;
+		void *entry;
 		int offset;
 
 		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		if (!slot->slots[offset])
+		entry = slot->slots[offset];
+		if (radix_tree_is_sibling(entry)) {
+			offset = sibling_to_offset(entry);
+			entry = slot->slots[offset];
+		}
+		if (!entry)
 			goto next;
 		if (!tag_get(slot, iftag, offset))
 			goto next;
-		if (shift) {
+		if (radix_tree_is_indirect_ptr(entry)) {
 			/* Go down one level */
 			shift -= RADIX_TREE_MAP_SHIFT;
 			node = slot;
-			slot = slot->slots[offset];
+			slot = indirect_to_ptr(entry);
 			continue;
 		}
 
-		/* tag the leaf */
+		/* tag the leaf, or the whole of a multi-order entry */
 		tagged++;
 		tag_set(slot, settag, offset);
 
+		/* skip to the last slot of the entry, passing its siblings */
+		index &= ~((RADIX_TREE_MAP_SIZE << shift) - 1);
+		index += (unsigned long)(offset +
+				entry_slots(slot, offset) - 1) << shift;
+
 		/* walk back up the path tagging interior nodes */
-		upindex = index;
+		upindex = index >> shift;
 		while (node) {
 			upindex >>= RADIX_TREE_MAP_SHIFT;
 			offset = upindex & RADIX_TREE_MAP_MASK;
@@ -895,6 +1139,12 @@ next:
 			 */
 			slot = slot->parent;
 			shift += RADIX_TREE_MAP_SHIFT;
+			/*
+			 * A multi-order entry may be tagged in this node
+			 * without going down again, keep the path above it.
+			 */
+			if (node)
+				node = slot->parent;
 		}
 	}
 	/*
@@ -1151,6 +1401,7 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 {
 	unsigned int shift, height;
 	unsigned long i;
+	void *entry;
 
 	height = slot->height;
 	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
@@ -1158,7 +1409,15 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 	for ( ; height > 1; height--) {
 		i = (index >> shift) & RADIX_TREE_MAP_MASK;
 		for (;;) {
-			if (slot->slots[i] != NULL)
+			entry = rcu_dereference_raw(slot->slots[i]);
+			if (entry == item) {
+				/* A multi-order entry */
+				*found_index = index & ~((1UL << shift) - 1);
+				index = 0;
+				goto out;
+			}
+			if (radix_tree_is_indirect_ptr(entry) &&
+			    !radix_tree_is_sibling(entry))
 				break;
 			index &= ~((1UL << shift) - 1);
 			index += 1UL << shift;
@@ -1170,9 +1429,7 @@ static unsigned long __locate(struct radix_tree_node *slot, void *item,
 		}
 
 		shift -= RADIX_TREE_MAP_SHIFT;
-		slot = rcu_dereference_raw(slot->slots[i]);
-		if (slot == NULL)
-			goto out;
+		slot = indirect_to_ptr(entry);
 	}
 
 	/* Bottom level: check items */
@@ -1242,7 +1499,7 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 	/* try to shrink tree height */
 	while (root->height > 0) {
 		struct radix_tree_node *to_free = root->rnode;
-		struct radix_tree_node *slot;
+		void *slot;
 
 		BUG_ON(!radix_tree_is_indirect_ptr(to_free));
 		to_free = indirect_to_ptr(to_free);
@@ -1265,8 +1522,11 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 		 */
 		slot = to_free->slots[0];
 		if (root->height > 1) {
-			slot->parent = NULL;
-			slot = ptr_to_indirect(slot);
+			/* A multi-order entry cannot move up to the root */
+			if (!radix_tree_is_indirect_ptr(slot))
+				break;
+			((struct radix_tree_node *)indirect_to_ptr(slot))->parent =
+									NULL;
 		}
 		root->rnode = slot;
 		root->height--;
@@ -1298,21 +1558,77 @@ static inline void radix_tree_shrink(struct radix_tree_root *root)
 }
 
 /**
- *	radix_tree_delete    -    delete an item from a radix tree
+ *	__radix_tree_delete_node    -    try to free node after clearing a slot
+ *	@root:		radix tree root
+ *	@node:		node whose slots were cleared
+ *
+ *	After clearing slots in @node of the radix tree rooted at @root,
+ *	and taking them off @node->count, call this function to free the
+ *	node if it is empty, along with any ancestors that become empty,
+ *	and to shrink the tree.
+ *
+ *	Returns %true if @node was freed, %false otherwise.
+ */
+bool __radix_tree_delete_node(struct radix_tree_root *root,
+			      struct radix_tree_node *node)
+{
+	bool deleted = false;
+
+	do {
+		struct radix_tree_node *parent;
+		unsigned int offset;
+
+		if (node->count) {
+			if (node == indirect_to_ptr(root->rnode)) {
+				radix_tree_shrink(root);
+				if (node != indirect_to_ptr(root->rnode))
+					deleted = true;
+			}
+			return deleted;
+		}
+
+		parent = node->parent;
+		if (parent) {
+			for (offset = 0; offset < RADIX_TREE_MAP_SIZE; offset++)
+				if (parent->slots[offset] == ptr_to_indirect(node))
+					break;
+			BUG_ON(offset == RADIX_TREE_MAP_SIZE);
+			parent->slots[offset] = NULL;
+			parent->count--;
+		} else {
+			root_tag_clear_all(root);
+			root->height = 0;
+			root->rnode = NULL;
+		}
+
+		radix_tree_node_free(node);
+		deleted = true;
+
+		node = parent;
+	} while (node);
+
+	return deleted;
+}
+
+/**
+ *	radix_tree_delete_item    -    delete an item from a radix tree
  *	@root:		radix tree root
  *	@index:		index key
+ *	@item:		expected item
  *
- *	Remove the item at @index from the radix tree rooted at @root.
+ *	Remove @item at @index from the radix tree rooted at @root.
  *
- *	Returns the address of the deleted item, or NULL if it was not present.
+ *	Returns the address of the deleted item, or NULL if it was not present
+ *	or the entry at the given @index was not @item.
  */
-void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+void *radix_tree_delete_item(struct radix_tree_root *root,
+			     unsigned long index, void *item)
 {
 	struct radix_tree_node *node = NULL;
-	struct radix_tree_node *slot = NULL;
 	struct radix_tree_node *to_free;
+	void *slot = NULL;
 	unsigned int height, shift;
-	int tag;
+	int tag, i, n;
 	int uninitialized_var(offset);
 
 	height = root->height;
@@ -1321,25 +1637,28 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 
 	slot = root->rnode;
 	if (height == 0) {
+		if (item && slot != item) {
+			slot = NULL;
+			goto out;
+		}
 		root_tag_clear_all(root);
 		root->rnode = NULL;
 		goto out;
 	}
-	slot = indirect_to_ptr(slot);
 	shift = height * RADIX_TREE_MAP_SHIFT;
 
 	do {
+		shift -= RADIX_TREE_MAP_SHIFT;
+		node = indirect_to_ptr(slot);
+		offset = radix_tree_descend(node, &slot, index, shift);
 		if (slot == NULL)
 			goto out;
+	} while (radix_tree_is_indirect_ptr(slot));
 
-		shift -= RADIX_TREE_MAP_SHIFT;
-		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-		node = slot;
-		slot = slot->slots[offset];
-	} while (shift);
-
-	if (slot == NULL)
+	if (item && slot != item) {
+		slot = NULL;
 		goto out;
+	}
 
 	/*
 	 * Clear all tags associated with the item to be deleted.
@@ -1350,11 +1669,17 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 			radix_tree_tag_clear(root, index, tag);
 	}
 
+	/* A multi-order entry goes away along with its siblings */
+	n = entry_slots(node, offset);
+	for (i = 1; i < n; i++)
+		node->slots[offset + i] = NULL;
+
 	to_free = NULL;
 	/* Now free the nodes we do not need anymore */
 	while (node) {
 		node->slots[offset] = NULL;
-		node->count--;
+		node->count -= n;
+		n = 1;
 		/*
 		 * Queue the node for deferred freeing after the
 		 * last reference to it disappears (set NULL, above).
@@ -1371,8 +1696,8 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 		/* Node with zero slots in use so free it */
 		to_free = node;
 
-		index >>= RADIX_TREE_MAP_SHIFT;
-		offset = index & RADIX_TREE_MAP_MASK;
+		shift += RADIX_TREE_MAP_SHIFT;
+		offset = (index >> shift) & RADIX_TREE_MAP_MASK;
 		node = node->parent;
 	}
 
@@ -1385,6 +1710,21 @@ void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
 out:
 	return slot;
 }
+EXPORT_SYMBOL(radix_tree_delete_item);
+
+/**
+ *	radix_tree_delete    -    delete an item from a radix tree
+ *	@root:		radix tree root
+ *	@index:		index key
+ *
+ *	Remove the item at @index from the radix tree rooted at @root.
+ *
+ *	Returns the address of the deleted item, or NULL if it was not present.
+ */
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+	return radix_tree_delete_item(root, index, NULL);
+}
 EXPORT_SYMBOL(radix_tree_delete);
 
 /**
@@ -1399,9 +1739,12 @@ int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag)
 EXPORT_SYMBOL(radix_tree_tagged);
 
 static void
-radix_tree_node_ctor(void *node)
+radix_tree_node_ctor(void *arg)
 {
-	memset(node, 0, sizeof(struct radix_tree_node));
+	struct radix_tree_node *node = arg;
+
+	memset(node, 0, sizeof(*node));
+	INIT_LIST_HEAD(&node->private_list);
 }
 
 static __init unsigned long __maxindex(unsigned int height)
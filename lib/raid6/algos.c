@@ -45,11 +45,20 @@ const struct raid6_calls * const raid6_algos[] = {
 	&raid6_sse1x2,
 	&raid6_sse2x1,
 	&raid6_sse2x2,
+#ifdef CONFIG_AS_AVX2
+	&raid6_avx2x1,
+	&raid6_avx2x2,
+#endif
 #endif
 #if defined(__x86_64__) && !defined(__arch_um__)
 	&raid6_sse2x1,
 	&raid6_sse2x2,
 	&raid6_sse2x4,
+#ifdef CONFIG_AS_AVX2
+	&raid6_avx2x1,
+	&raid6_avx2x2,
+	&raid6_avx2x4,
+#endif
 #endif
 #ifdef CONFIG_ALTIVEC
 	&raid6_altivec1,
@@ -71,6 +80,9 @@ void (*raid6_datap_recov)(int, size_t, int, void **);
 EXPORT_SYMBOL_GPL(raid6_datap_recov);
 
 const struct raid6_recov_calls *const raid6_recov_algos[] = {
+#ifdef CONFIG_AS_AVX2
+	&raid6_recov_avx2,
+#endif
 #if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__)
 	&raid6_recov_ssse3,
 #endif
@@ -86,15 +98,45 @@ const struct raid6_recov_calls *const raid6_recov_algos[] = {
 #define time_before(x, y) ((x) < (y))
 #endif
 
-static inline const struct raid6_recov_calls *raid6_choose_recov(void)
+/*
+ * Time the two-data-disk reconstruction of every usable recovery
+ * routine; it includes a gen_syndrome pass, so this must run after
+ * raid6_choose_gen().  The first two data pointers must be writable,
+ * they receive the reconstructed data.  On a tie the higher priority
+ * routine wins.
+ */
+static inline const struct raid6_recov_calls *raid6_choose_recov(
+	void *(*const dptrs)[(65536/PAGE_SIZE)+2], const int disks)
 {
+	unsigned long perf, bestperf, j0, j1;
 	const struct raid6_recov_calls *const *algo;
 	const struct raid6_recov_calls *best;
 
-	for (best = NULL, algo = raid6_recov_algos; *algo; algo++)
-		if (!best || (*algo)->priority > best->priority)
-			if (!(*algo)->valid || (*algo)->valid())
-				best = *algo;
+	for (bestperf = 0, best = NULL, algo = raid6_recov_algos; *algo; algo++) {
+		if ((*algo)->valid && !(*algo)->valid())
+			continue;
+
+		perf = 0;
+
+		preempt_disable();
+		j0 = jiffies;
+		while ((j1 = jiffies) == j0)
+			cpu_relax();
+		while (time_before(jiffies,
+				    j1 + (1<<RAID6_TIME_JIFFIES_LG2))) {
+			(*algo)->data2(disks, PAGE_SIZE, 0, 1, *dptrs);
+			perf++;
+		}
+		preempt_enable();
+
+		if (perf > bestperf ||
+		    (perf == bestperf && (*algo)->priority > best->priority)) {
+			bestperf = perf;
+			best = *algo;
+		}
+		printk("raid6: %-8s recovery %5ld MB/s\n", (*algo)->name,
+		       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+	}
 
 	if (best) {
 		raid6_2data_recov = best->data2;
@@ -169,8 +211,12 @@ int __init raid6_select_algo(void)
 	for (i = 0; i < disks-2; i++)
 		dptrs[i] = ((char *)raid6_gfmul) + PAGE_SIZE*i;
 
-	/* Normal code - use a 2-page allocation to avoid D$ conflict */
-	syndromes = (void *) __get_free_pages(GFP_KERNEL, 1);
+	/*
+	 * Normal code - use a multi-page allocation to avoid D$ conflict.
+	 * The first two pages hold P and Q, the other two stand in for
+	 * the failed data disks while timing the recovery routines.
+	 */
+	syndromes = (void *) __get_free_pages(GFP_KERNEL, 2);
 
 	if (!syndromes) {
 		printk("raid6: Yikes!  No memory available.\n");
@@ -184,9 +230,11 @@ int __init raid6_select_algo(void)
 	gen_best = raid6_choose_gen(&dptrs, disks);
 
 	/* select raid recover functions */
-	rec_best = raid6_choose_recov();
+	dptrs[0] = syndromes + 2*PAGE_SIZE;
+	dptrs[1] = syndromes + 3*PAGE_SIZE;
+	rec_best = raid6_choose_recov(&dptrs, disks);
 
-	free_pages((unsigned long)syndromes, 1);
+	free_pages((unsigned long)syndromes, 2);
 
 	return gen_best && rec_best ? 0 : -EINVAL;
 }
@@ -0,0 +1,297 @@
+/*
+ * AVX2 port of recov_ssse3.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#ifdef CONFIG_AS_AVX2
+
+#include <linux/raid/pq.h>
+#include "x86.h"
+
+static int raid6_has_avx2(void)
+{
+	return boot_cpu_has(X86_FEATURE_AVX2) &&
+		boot_cpu_has(X86_FEATURE_AVX);
+}
+
+/*
+ * vpshufb looks up within each 128-bit lane, so the 16-byte nibble
+ * tables are broadcast to both halves of the ymm register.
+ */
+static void raid6_2data_recov_avx2(int disks, size_t bytes, int faila,
+		int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+	static const u8 x0f = 0x0f;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila] ^
+		raid6_gfexp[failb]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("vpbroadcastb %0,%%ymm7" : : "m" (x0f));
+
+#ifdef CONFIG_X86_64
+	asm volatile("vbroadcasti128 %0,%%ymm10" : : "m" (qmul[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm11" : : "m" (qmul[16]));
+	asm volatile("vbroadcasti128 %0,%%ymm14" : : "m" (pbmul[0]));
+	asm volatile("vbroadcasti128 %0,%%ymm15" : : "m" (pbmul[16]));
+#endif
+
+	/* Now do it... */
+	while (bytes) {
+#ifdef CONFIG_X86_64
+		/* ymm10, ymm11, ymm14, ymm15 */
+
+		asm volatile("vmovdqa %0,%%ymm1" : : "m" (q[0]));
+		asm volatile("vmovdqa %0,%%ymm9" : : "m" (q[32]));
+		asm volatile("vmovdqa %0,%%ymm0" : : "m" (p[0]));
+		asm volatile("vmovdqa %0,%%ymm8" : : "m" (p[32]));
+		asm volatile("vpxor   %0,%%ymm1,%%ymm1" : : "m" (dq[0]));
+		asm volatile("vpxor   %0,%%ymm9,%%ymm9" : : "m" (dq[32]));
+		asm volatile("vpxor   %0,%%ymm0,%%ymm0" : : "m" (dp[0]));
+		asm volatile("vpxor   %0,%%ymm8,%%ymm8" : : "m" (dp[32]));
+
+		/* ymm0/8 = px */
+
+		asm volatile("vpsraw  $4,%ymm1,%ymm3");
+		asm volatile("vpsraw  $4,%ymm9,%ymm12");
+		asm volatile("vpand   %ymm7,%ymm1,%ymm1");
+		asm volatile("vpand   %ymm7,%ymm9,%ymm9");
+		asm volatile("vpand   %ymm7,%ymm3,%ymm3");
+		asm volatile("vpand   %ymm7,%ymm12,%ymm12");
+		asm volatile("vpshufb %ymm1,%ymm10,%ymm4");
+		asm volatile("vpshufb %ymm9,%ymm10,%ymm13");
+		asm volatile("vpshufb %ymm3,%ymm11,%ymm5");
+		asm volatile("vpshufb %ymm12,%ymm11,%ymm6");
+		asm volatile("vpxor   %ymm4,%ymm5,%ymm5");
+		asm volatile("vpxor   %ymm13,%ymm6,%ymm6");
+
+		/* ymm5/6 = qx */
+
+		asm volatile("vpsraw  $4,%ymm0,%ymm3");
+		asm volatile("vpsraw  $4,%ymm8,%ymm12");
+		asm volatile("vpand   %ymm7,%ymm0,%ymm1");
+		asm volatile("vpand   %ymm7,%ymm8,%ymm9");
+		asm volatile("vpand   %ymm7,%ymm3,%ymm3");
+		asm volatile("vpand   %ymm7,%ymm12,%ymm12");
+		asm volatile("vpshufb %ymm1,%ymm14,%ymm4");
+		asm volatile("vpshufb %ymm9,%ymm14,%ymm13");
+		asm volatile("vpshufb %ymm3,%ymm15,%ymm2");
+		asm volatile("vpshufb %ymm12,%ymm15,%ymm3");
+		asm volatile("vpxor   %ymm4,%ymm2,%ymm2");
+		asm volatile("vpxor   %ymm13,%ymm3,%ymm3");
+
+		/* ymm2/3 = pbmul[px] */
+		asm volatile("vpxor   %ymm5,%ymm2,%ymm2");
+		asm volatile("vpxor   %ymm6,%ymm3,%ymm3");
+		/* ymm2/3 = db = DQ */
+		asm volatile("vmovdqa %%ymm2,%0" : "=m" (dq[0]));
+		asm volatile("vmovdqa %%ymm3,%0" : "=m" (dq[32]));
+
+		asm volatile("vpxor   %ymm2,%ymm0,%ymm0");
+		asm volatile("vpxor   %ymm3,%ymm8,%ymm8");
+		asm volatile("vmovdqa %%ymm0,%0" : "=m" (dp[0]));
+		asm volatile("vmovdqa %%ymm8,%0" : "=m" (dp[32]));
+
+		bytes -= 64;
+		p += 64;
+		q += 64;
+		dp += 64;
+		dq += 64;
+#else
+		asm volatile("vmovdqa %0,%%ymm1" : : "m" (*q));
+		asm volatile("vmovdqa %0,%%ymm0" : : "m" (*p));
+		asm volatile("vpxor   %0,%%ymm1,%%ymm1" : : "m" (*dq));
+		asm volatile("vpxor   %0,%%ymm0,%%ymm0" : : "m" (*dp));
+
+		/* 1 = dq ^ q
+		 * 0 = dp ^ p
+		 */
+		asm volatile("vbroadcasti128 %0,%%ymm4" : : "m" (qmul[0]));
+		asm volatile("vbroadcasti128 %0,%%ymm5" : : "m" (qmul[16]));
+
+		asm volatile("vpsraw  $4,%ymm1,%ymm3");
+		asm volatile("vpand   %ymm7,%ymm1,%ymm1");
+		asm volatile("vpand   %ymm7,%ymm3,%ymm3");
+		asm volatile("vpshufb %ymm1,%ymm4,%ymm4");
+		asm volatile("vpshufb %ymm3,%ymm5,%ymm5");
+		asm volatile("vpxor   %ymm4,%ymm5,%ymm5");
+
+		/* ymm5 = qx, ymm0 = px */
+
+		asm volatile("vbroadcasti128 %0,%%ymm4" : : "m" (pbmul[0]));
+		asm volatile("vbroadcasti128 %0,%%ymm1" : : "m" (pbmul[16]));
+		asm volatile("vpsraw  $4,%ymm0,%ymm2");
+		asm volatile("vpand   %ymm7,%ymm0,%ymm3");
+		asm volatile("vpand   %ymm7,%ymm2,%ymm2");
+		asm volatile("vpshufb %ymm3,%ymm4,%ymm4");
+		asm volatile("vpshufb %ymm2,%ymm1,%ymm1");
+		asm volatile("vpxor   %ymm4,%ymm1,%ymm1");
+
+		/* ymm1 = pbmul[px] */
+		asm volatile("vpxor   %ymm5,%ymm1,%ymm1");
+		/* ymm1 = db = DQ */
+		asm volatile("vmovdqa %%ymm1,%0" : "=m" (*dq));
+
+		asm volatile("vpxor   %ymm1,%ymm0,%ymm0");
+		asm volatile("vmovdqa %%ymm0,%0" : "=m" (*dp));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dp += 32;
+		dq += 32;
+#endif
+	}
+
+	asm volatile("vzeroupper");
+	kernel_fpu_end();
+}
+
+static void raid6_datap_recov_avx2(int disks, size_t bytes, int faila,
+		void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+	static const u8 x0f = 0x0f;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("vpbroadcastb %0, %%ymm7" : : "m" (x0f));
+	asm volatile("vbroadcasti128 %0, %%ymm4" : : "m" (qmul[0]));
+	asm volatile("vbroadcasti128 %0, %%ymm5" : : "m" (qmul[16]));
+
+	while (bytes) {
+#ifdef CONFIG_X86_64
+		asm volatile("vmovdqa %0, %%ymm3" : : "m" (dq[0]));
+		asm volatile("vmovdqa %0, %%ymm8" : : "m" (dq[32]));
+		asm volatile("vpxor %0, %%ymm3, %%ymm3" : : "m" (q[0]));
+		asm volatile("vpxor %0, %%ymm8, %%ymm8" : : "m" (q[32]));
+
+		/* ymm3 = q[0] ^ dq[0], ymm8 = q[32] ^ dq[32] */
+
+		asm volatile("vpsraw $4, %ymm3, %ymm6");
+		asm volatile("vpsraw $4, %ymm8, %ymm9");
+		asm volatile("vpand %ymm7, %ymm3, %ymm3");
+		asm volatile("vpand %ymm7, %ymm8, %ymm8");
+		asm volatile("vpand %ymm7, %ymm6, %ymm6");
+		asm volatile("vpand %ymm7, %ymm9, %ymm9");
+		asm volatile("vpshufb %ymm3, %ymm4, %ymm0");
+		asm volatile("vpshufb %ymm8, %ymm4, %ymm10");
+		asm volatile("vpshufb %ymm6, %ymm5, %ymm1");
+		asm volatile("vpshufb %ymm9, %ymm5, %ymm11");
+		asm volatile("vpxor %ymm0, %ymm1, %ymm1");
+		asm volatile("vpxor %ymm10, %ymm11, %ymm11");
+
+		/* ymm1 = qmul[q[0] ^ dq[0]], ymm11 = qmul[q[32] ^ dq[32]] */
+
+		asm volatile("vpxor %0, %%ymm1, %%ymm2" : : "m" (p[0]));
+		asm volatile("vpxor %0, %%ymm11, %%ymm12" : : "m" (p[32]));
+
+		/* ymm2 = p[0] ^ qmul[q[0] ^ dq[0]] */
+		/* ymm12 = p[32] ^ qmul[q[32] ^ dq[32]] */
+
+		asm volatile("vmovdqa %%ymm1, %0" : "=m" (dq[0]));
+		asm volatile("vmovdqa %%ymm11, %0" : "=m" (dq[32]));
+
+		asm volatile("vmovdqa %%ymm2, %0" : "=m" (p[0]));
+		asm volatile("vmovdqa %%ymm12, %0" : "=m" (p[32]));
+
+		bytes -= 64;
+		p += 64;
+		q += 64;
+		dq += 64;
+#else
+		asm volatile("vmovdqa %0, %%ymm3" : : "m" (dq[0]));
+		asm volatile("vpxor %0, %%ymm3, %%ymm3" : : "m" (q[0]));
+
+		/* ymm3 = *q ^ *dq */
+
+		asm volatile("vpsraw $4, %ymm3, %ymm6");
+		asm volatile("vpand %ymm7, %ymm3, %ymm3");
+		asm volatile("vpand %ymm7, %ymm6, %ymm6");
+		asm volatile("vpshufb %ymm3, %ymm4, %ymm0");
+		asm volatile("vpshufb %ymm6, %ymm5, %ymm1");
+		asm volatile("vpxor %ymm0, %ymm1, %ymm1");
+
+		/* ymm1 = qmul[*q ^ *dq] */
+
+		asm volatile("vpxor %0, %%ymm1, %%ymm2" : : "m" (p[0]));
+
+		/* ymm2 = *p ^ qmul[*q ^ *dq] */
+
+		asm volatile("vmovdqa %%ymm1, %0" : "=m" (dq[0]));
+		asm volatile("vmovdqa %%ymm2, %0" : "=m" (p[0]));
+
+		bytes -= 32;
+		p += 32;
+		q += 32;
+		dq += 32;
+#endif
+	}
+
+	asm volatile("vzeroupper");
+	kernel_fpu_end();
+}
+
+const struct raid6_recov_calls raid6_recov_avx2 = {
+	.data2 = raid6_2data_recov_avx2,
+	.datap = raid6_datap_recov_avx2,
+	.valid = raid6_has_avx2,
+#ifdef CONFIG_X86_64
+	.name = "avx2x2",
+#else
+	.name = "avx2x1",
+#endif
+	.priority = 2,
+};
+
+#endif /* CONFIG_AS_AVX2 */
@@ -0,0 +1,548 @@
+/*
+ * Resizable, RCU-protected hash tables.
+ *
+ * See include/linux/rhashtable.h for the interface and the description
+ * of how lookups survive a resize.
+ */
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/bit_spinlock.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/rhashtable.h>
+
+#define HASH_DEFAULT_SIZE	16U
+#define HASH_MIN_SIZE		4U
+#define HASH_MAX_SIZE		(1U << 30)
+
+/* Same scheme as hlist_bl: on UP without spinlock debugging there is no bit */
+#if defined(CONFIG_SMP) || defined(CONFIG_DEBUG_SPINLOCK)
+#define RHT_LOCK_MASK	1UL
+#else
+#define RHT_LOCK_MASK	0UL
+#endif
+
+#define rht_dereference(p, ht) \
+	rcu_dereference_protected(p, lockdep_is_held(&(ht)->mutex))
+
+static inline struct rhash_head *rht_ptr(const struct rhash_head *p)
+{
+	return (struct rhash_head *)((unsigned long)p & ~RHT_LOCK_MASK);
+}
+
+static inline void rht_lock(struct bucket_table *tbl, unsigned int hash)
+{
+	bit_spin_lock(0, (unsigned long *)&tbl->buckets[hash]);
+}
+
+static inline void rht_unlock(struct bucket_table *tbl, unsigned int hash)
+{
+	bit_spin_unlock(0, (unsigned long *)&tbl->buckets[hash]);
+}
+
+/* First entry of a bucket, for lockless readers */
+static inline struct rhash_head *rht_first_rcu(struct bucket_table *tbl,
+					       unsigned int hash)
+{
+	return rht_ptr(rcu_dereference(tbl->buckets[hash]));
+}
+
+/* First entry of a bucket whose lock is held */
+static inline struct rhash_head *rht_first_locked(struct bucket_table *tbl,
+						  unsigned int hash)
+{
+	return rht_ptr(rcu_dereference_protected(tbl->buckets[hash], 1));
+}
+
+/* Set the first entry of a bucket whose lock is held */
+static inline void rht_assign_locked(struct bucket_table *tbl,
+				     unsigned int hash, struct rhash_head *he)
+{
+	rcu_assign_pointer(tbl->buckets[hash],
+		(struct rhash_head *)((unsigned long)he | RHT_LOCK_MASK));
+}
+
+static unsigned int rht_key_hash(const struct rhashtable *ht,
+				 const struct bucket_table *tbl,
+				 const void *key)
+{
+	u32 hash;
+
+	if (ht->p.key_len)
+		hash = ht->p.hashfn(key, ht->p.key_len, ht->hash_rnd);
+	else
+		hash = ht->p.obj_hashfn(key, ht->hash_rnd);
+
+	return hash & (tbl->size - 1);
+}
+
+static inline const void *rht_key(const struct rhashtable *ht,
+				  const struct rhash_head *he)
+{
+	const void *obj = rht_obj(ht, he);
+
+	return ht->p.key_len ? obj + ht->p.key_offset : obj;
+}
+
+static inline unsigned int rht_head_hash(const struct rhashtable *ht,
+					 const struct bucket_table *tbl,
+					 const struct rhash_head *he)
+{
+	return rht_key_hash(ht, tbl, rht_key(ht, he));
+}
+
+static inline bool rht_key_match(const struct rhashtable *ht,
+				 const void *key,
+				 const struct rhash_head *he)
+{
+	const void *obj = rht_obj(ht, he);
+
+	if (ht->p.obj_cmpfn)
+		return !ht->p.obj_cmpfn(key, obj);
+
+	return !memcmp(obj + ht->p.key_offset, key, ht->p.key_len);
+}
+
+static bool rht_grow_above_75(const struct rhashtable *ht,
+			      const struct bucket_table *tbl)
+{
+	return atomic_read(&ht->nelems) > tbl->size / 4 * 3 &&
+	       tbl->size < ht->p.max_size;
+}
+
+static bool rht_shrink_below_30(const struct rhashtable *ht,
+				const struct bucket_table *tbl)
+{
+	return ht->p.automatic_shrinking &&
+	       atomic_read(&ht->nelems) < tbl->size * 3 / 10 &&
+	       tbl->size > ht->p.min_size;
+}
+
+static struct bucket_table *bucket_table_alloc(unsigned int nbuckets)
+{
+	struct bucket_table *tbl = NULL;
+	size_t size;
+
+	size = sizeof(*tbl) + nbuckets * sizeof(tbl->buckets[0]);
+	if (size <= (PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER))
+		tbl = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!tbl)
+		tbl = vzalloc(size);
+	if (!tbl)
+		return NULL;
+
+	tbl->size = nbuckets;
+
+	return tbl;
+}
+
+static void bucket_table_free(struct bucket_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+/*
+ * Move all the entries of one bucket of @old_tbl to @new_tbl.  The last
+ * entry of the chain is moved first: it is linked into the new table
+ * before it is unlinked from the old one, so a reader walking the old
+ * chain either still finds it there or finds it in the new table
+ * afterwards.  A reader sitting on it is led into the new chain, which
+ * only costs it a few extra compares since no old entries follow.
+ */
+static void rhashtable_rehash_bucket(struct rhashtable *ht,
+				     struct bucket_table *old_tbl,
+				     struct bucket_table *new_tbl,
+				     unsigned int old_hash)
+{
+	struct rhash_head __rcu **pprev;
+	struct rhash_head *he, *next;
+	unsigned int new_hash;
+
+	rht_lock(old_tbl, old_hash);
+
+	while ((he = rht_first_locked(old_tbl, old_hash))) {
+		pprev = NULL;
+		while ((next = rcu_dereference_protected(he->next, 1))) {
+			pprev = &he->next;
+			he = next;
+		}
+
+		new_hash = rht_head_hash(ht, new_tbl, he);
+
+		rht_lock(new_tbl, new_hash);
+		rcu_assign_pointer(he->next,
+				   rht_first_locked(new_tbl, new_hash));
+		rht_assign_locked(new_tbl, new_hash, he);
+		rht_unlock(new_tbl, new_hash);
+
+		if (pprev)
+			RCU_INIT_POINTER(*pprev, NULL);
+		else
+			rht_assign_locked(old_tbl, old_hash, NULL);
+	}
+
+	rht_unlock(old_tbl, old_hash);
+}
+
+static int rhashtable_rehash(struct rhashtable *ht, unsigned int size)
+{
+	struct bucket_table *old_tbl = rht_dereference(ht->tbl, ht);
+	struct bucket_table *new_tbl;
+	unsigned int i;
+
+	new_tbl = bucket_table_alloc(size);
+	if (!new_tbl)
+		return -ENOMEM;
+
+	/*
+	 * From here on inserters go to the new table.  They check for it
+	 * under the bucket lock, which we take below after publishing it.
+	 */
+	rcu_assign_pointer(old_tbl->future_tbl, new_tbl);
+
+	for (i = 0; i < old_tbl->size; i++) {
+		rhashtable_rehash_bucket(ht, old_tbl, new_tbl, i);
+		cond_resched();
+	}
+
+	rcu_assign_pointer(ht->tbl, new_tbl);
+
+	/* Wait for readers that may still follow old_tbl->future_tbl */
+	synchronize_rcu();
+	bucket_table_free(old_tbl);
+
+	return 0;
+}
+
+static void rht_deferred_worker(struct work_struct *work)
+{
+	struct rhashtable *ht = container_of(work, struct rhashtable, run_work);
+	struct bucket_table *tbl;
+
+	mutex_lock(&ht->mutex);
+	if (ht->being_destroyed)
+		goto unlock;
+
+	tbl = rht_dereference(ht->tbl, ht);
+	if (rht_grow_above_75(ht, tbl))
+		rhashtable_rehash(ht, tbl->size * 2);
+	else if (rht_shrink_below_30(ht, tbl))
+		rhashtable_rehash(ht, tbl->size / 2);
+unlock:
+	mutex_unlock(&ht->mutex);
+}
+
+/* Must be called under rcu_read_lock(), walks @tbl and its future tables */
+static struct rhash_head *__rhashtable_lookup(struct rhashtable *ht,
+					      struct bucket_table *tbl,
+					      const void *key)
+{
+	struct rhash_head *he;
+	unsigned int hash;
+
+	do {
+		hash = rht_key_hash(ht, tbl, key);
+		for (he = rht_first_rcu(tbl, hash); he;
+		     he = rcu_dereference(he->next)) {
+			if (rht_key_match(ht, key, he))
+				return he;
+		}
+
+		/* Entries missing from this chain were moved before */
+		smp_rmb();
+		tbl = rcu_dereference(tbl->future_tbl);
+	} while (tbl);
+
+	return NULL;
+}
+
+/**
+ * rhashtable_lookup - search the hash table
+ * @ht: hash table
+ * @key: pointer to the key, or an object-like key for tables hashing
+ *	 whole objects
+ *
+ * Must be called under rcu_read_lock().  Returns the first matching
+ * object or NULL.
+ */
+void *rhashtable_lookup(struct rhashtable *ht, const void *key)
+{
+	struct rhash_head *he;
+
+	he = __rhashtable_lookup(ht, rcu_dereference(ht->tbl), key);
+
+	return he ? rht_obj(ht, he) : NULL;
+}
+EXPORT_SYMBOL_GPL(rhashtable_lookup);
+
+/*
+ * Lock the bucket @obj goes to in the newest table.  Seeing no future
+ * table under the bucket lock means this bucket has not been moved yet
+ * and will only be moved after the lock is dropped.
+ */
+static struct bucket_table *rht_lock_insert_bucket(struct rhashtable *ht,
+						   struct bucket_table *tbl,
+						   struct rhash_head *obj,
+						   unsigned int *hash)
+{
+	struct bucket_table *new_tbl;
+
+	for (;;) {
+		*hash = rht_head_hash(ht, tbl, obj);
+		rht_lock(tbl, *hash);
+
+		new_tbl = rcu_dereference(tbl->future_tbl);
+		if (!new_tbl)
+			return tbl;
+
+		rht_unlock(tbl, *hash);
+		tbl = new_tbl;
+	}
+}
+
+static int __rhashtable_insert(struct rhashtable *ht, struct rhash_head *obj,
+			       bool unique)
+{
+	struct bucket_table *first, *tbl;
+	unsigned int hash;
+	bool grow;
+
+	rcu_read_lock();
+	first = rcu_dereference(ht->tbl);
+	tbl = rht_lock_insert_bucket(ht, first, obj, &hash);
+
+	/*
+	 * A duplicate may still sit in an older table, but it can't move
+	 * into our bucket while we hold its lock.
+	 */
+	if (unique && __rhashtable_lookup(ht, first, rht_key(ht, obj))) {
+		rht_unlock(tbl, hash);
+		rcu_read_unlock();
+		return -EEXIST;
+	}
+
+	RCU_INIT_POINTER(obj->next, rht_first_locked(tbl, hash));
+	rht_assign_locked(tbl, hash, obj);
+	rht_unlock(tbl, hash);
+
+	atomic_inc(&ht->nelems);
+	grow = rht_grow_above_75(ht, tbl);
+	rcu_read_unlock();
+
+	if (grow)
+		schedule_work(&ht->run_work);
+
+	return 0;
+}
+
+/**
+ * rhashtable_insert - insert an object into the hash table
+ * @ht: hash table
+ * @obj: pointer to the hash head inside the object
+ *
+ * Keys need not be unique; lookups return one of the matching objects.
+ * May schedule a deferred grow of the table.
+ */
+void rhashtable_insert(struct rhashtable *ht, struct rhash_head *obj)
+{
+	__rhashtable_insert(ht, obj, false);
+}
+EXPORT_SYMBOL_GPL(rhashtable_insert);
+
+/**
+ * rhashtable_lookup_insert - insert an object unless its key is present
+ * @ht: hash table
+ * @obj: pointer to the hash head inside the object
+ *
+ * Returns zero if the object was inserted, -EEXIST if an object with the
+ * same key was already in the table.
+ */
+int rhashtable_lookup_insert(struct rhashtable *ht, struct rhash_head *obj)
+{
+	return __rhashtable_insert(ht, obj, true);
+}
+EXPORT_SYMBOL_GPL(rhashtable_lookup_insert);
+
+/**
+ * rhashtable_remove - remove an object from the hash table
+ * @ht: hash table
+ * @obj: pointer to the hash head inside the object
+ *
+ * Concurrent readers may still see the object until an RCU grace period
+ * has elapsed, it must not be freed before then.  Returns -ENOENT if the
+ * object was not found.
+ */
+int rhashtable_remove(struct rhashtable *ht, struct rhash_head *obj)
+{
+	struct rhash_head __rcu **pprev;
+	struct bucket_table *tbl;
+	struct rhash_head *he;
+	unsigned int hash;
+	bool found = false, shrink = false;
+
+	rcu_read_lock();
+	tbl = rcu_dereference(ht->tbl);
+	while (tbl && !found) {
+		hash = rht_head_hash(ht, tbl, obj);
+		rht_lock(tbl, hash);
+
+		pprev = NULL;
+		for (he = rht_first_locked(tbl, hash); he;
+		     he = rcu_dereference_protected(he->next, 1)) {
+			if (he != obj) {
+				pprev = &he->next;
+				continue;
+			}
+
+			he = rcu_dereference_protected(obj->next, 1);
+			if (pprev)
+				rcu_assign_pointer(*pprev, he);
+			else
+				rht_assign_locked(tbl, hash, he);
+			found = true;
+			break;
+		}
+
+		rht_unlock(tbl, hash);
+		if (found) {
+			atomic_dec(&ht->nelems);
+			shrink = rht_shrink_below_30(ht, tbl);
+		} else {
+			tbl = rcu_dereference(tbl->future_tbl);
+		}
+	}
+	rcu_read_unlock();
+
+	if (!found)
+		return -ENOENT;
+
+	if (shrink)
+		schedule_work(&ht->run_work);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rhashtable_remove);
+
+/**
+ * rhashtable_init - initialize a new hash table
+ * @ht: hash table to be initialized
+ * @params: configuration parameters
+ *
+ * Tables with a fixed size key need @params->key_len and
+ * @params->key_offset; @params->hashfn defaults to jhash().  Tables
+ * without one must provide both @params->obj_hashfn and
+ * @params->obj_cmpfn instead.
+ *
+ * Example:
+ *
+ *	struct test_obj {
+ *		int			key;
+ *		void *			my_member;
+ *		struct rhash_head	node;
+ *	};
+ *
+ *	struct rhashtable_params params = {
+ *		.head_offset = offsetof(struct test_obj, node),
+ *		.key_offset = offsetof(struct test_obj, key),
+ *		.key_len = sizeof(int),
+ *	};
+ */
+int rhashtable_init(struct rhashtable *ht,
+		    const struct rhashtable_params *params)
+{
+	struct bucket_table *tbl;
+	unsigned int size;
+
+	if (params->key_len && params->obj_hashfn)
+		return -EINVAL;
+	if (!params->key_len && (!params->obj_hashfn || !params->obj_cmpfn))
+		return -EINVAL;
+
+	memset(ht, 0, sizeof(*ht));
+	ht->p = *params;
+
+	if (!ht->p.hashfn)
+		ht->p.hashfn = jhash;
+
+	ht->p.min_size = max_t(unsigned int,
+			       roundup_pow_of_two(ht->p.min_size ?: 1),
+			       HASH_MIN_SIZE);
+	if (ht->p.max_size)
+		ht->p.max_size = rounddown_pow_of_two(min(ht->p.max_size,
+							  HASH_MAX_SIZE));
+	else
+		ht->p.max_size = HASH_MAX_SIZE;
+	ht->p.max_size = max(ht->p.max_size, ht->p.min_size);
+
+	size = HASH_DEFAULT_SIZE;
+	if (ht->p.nelem_hint)
+		size = roundup_pow_of_two(min_t(size_t, ht->p.nelem_hint * 4 / 3,
+						HASH_MAX_SIZE));
+	size = clamp(size, ht->p.min_size, ht->p.max_size);
+
+	tbl = bucket_table_alloc(size);
+	if (!tbl)
+		return -ENOMEM;
+
+	get_random_bytes(&ht->hash_rnd, sizeof(ht->hash_rnd));
+	atomic_set(&ht->nelems, 0);
+	mutex_init(&ht->mutex);
+	INIT_WORK(&ht->run_work, rht_deferred_worker);
+	RCU_INIT_POINTER(ht->tbl, tbl);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rhashtable_init);
+
+/**
+ * rhashtable_free_and_destroy - free the objects and destroy the table
+ * @ht: the hash table to destroy
+ * @free_fn: callback to release the resources of an object, or NULL
+ * @arg: pointer passed to @free_fn
+ *
+ * Stops any resize and frees the bucket table.  The caller must make
+ * sure nothing else accesses the table any more.
+ */
+void rhashtable_free_and_destroy(struct rhashtable *ht,
+				 void (*free_fn)(void *ptr, void *arg),
+				 void *arg)
+{
+	struct bucket_table *tbl;
+	struct rhash_head *he, *next;
+	unsigned int i;
+
+	mutex_lock(&ht->mutex);
+	ht->being_destroyed = true;
+	mutex_unlock(&ht->mutex);
+
+	cancel_work_sync(&ht->run_work);
+
+	mutex_lock(&ht->mutex);
+	tbl = rht_dereference(ht->tbl, ht);
+	if (free_fn) {
+		for (i = 0; i < tbl->size; i++) {
+			he = rht_ptr(rht_dereference(tbl->buckets[i], ht));
+			for (; he; he = next) {
+				next = rht_dereference(he->next, ht);
+				free_fn(rht_obj(ht, he), arg);
+			}
+		}
+	}
+	bucket_table_free(tbl);
+	mutex_unlock(&ht->mutex);
+}
+EXPORT_SYMBOL_GPL(rhashtable_free_and_destroy);
+
+void rhashtable_destroy(struct rhashtable *ht)
+{
+	rhashtable_free_and_destroy(ht, NULL, NULL);
+}
+EXPORT_SYMBOL_GPL(rhashtable_destroy);
@@ -1,8 +1,6 @@
 
 #include <linux/wait.h>
 #include <linux/backing-dev.h>
-#include <linux/kthread.h>
-#include <linux/freezer.h>
 #include <linux/fs.h>
 #include <linux/pagemap.h>
 #include <linux/mm.h>
@@ -10,6 +8,7 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/slab.h>
 #include <trace/events/writeback.h>
 
 static atomic_long_t bdi_seq = ATOMIC_LONG_INIT(0);
@@ -31,13 +30,14 @@ EXPORT_SYMBOL_GPL(noop_backing_dev_info);
 static struct class *bdi_class;
 
 /*
- * bdi_lock protects updates to bdi_list and bdi_pending_list, as well as
- * reader side protection for bdi_pending_list. bdi_list has RCU reader side
+ * bdi_lock protects updates to bdi_list. bdi_list has RCU reader side
  * locking.
  */
 DEFINE_SPINLOCK(bdi_lock);
 LIST_HEAD(bdi_list);
-LIST_HEAD(bdi_pending_list);
+
+/* bdi_wq serves all asynchronous writeback tasks */
+struct workqueue_struct *bdi_wq;
 
 void bdi_lock_two(struct bdi_writeback *wb1, struct bdi_writeback *wb2)
 {
@@ -61,25 +61,38 @@ static void bdi_debug_init(void)
 	bdi_debug_root = debugfs_create_dir("bdi", NULL);
 }
 
-static int bdi_debug_stats_show(struct seq_file *m, void *v)
+static void wb_count_inodes(struct bdi_writeback *wb, unsigned long *nr_dirty,
+			    unsigned long *nr_io, unsigned long *nr_more_io,
+			    unsigned long *nr_dirty_time)
 {
-	struct backing_dev_info *bdi = m->private;
-	struct bdi_writeback *wb = &bdi->wb;
-	unsigned long background_thresh;
-	unsigned long dirty_thresh;
-	unsigned long bdi_thresh;
-	unsigned long nr_dirty, nr_io, nr_more_io;
 	struct inode *inode;
 
-	nr_dirty = nr_io = nr_more_io = 0;
 	spin_lock(&wb->list_lock);
 	list_for_each_entry(inode, &wb->b_dirty, i_wb_list)
-		nr_dirty++;
+		(*nr_dirty)++;
 	list_for_each_entry(inode, &wb->b_io, i_wb_list)
-		nr_io++;
+		(*nr_io)++;
 	list_for_each_entry(inode, &wb->b_more_io, i_wb_list)
-		nr_more_io++;
+		(*nr_more_io)++;
+	list_for_each_entry(inode, &wb->b_dirty_time, i_wb_list)
+		(*nr_dirty_time)++;
 	spin_unlock(&wb->list_lock);
+}
+
+static int bdi_debug_stats_show(struct seq_file *m, void *v)
+{
+	struct backing_dev_info *bdi = m->private;
+	struct bdi_writeback *wb;
+	unsigned long background_thresh;
+	unsigned long dirty_thresh;
+	unsigned long bdi_thresh;
+	unsigned long nr_dirty, nr_io, nr_more_io, nr_dirty_time;
+	unsigned int i;
+
+	nr_dirty = nr_io = nr_more_io = nr_dirty_time = 0;
+	bdi_for_each_wb(wb, bdi, i)
+		wb_count_inodes(wb, &nr_dirty, &nr_io, &nr_more_io,
+				&nr_dirty_time);
 
 	global_dirty_limits(&background_thresh, &dirty_thresh);
 	bdi_thresh = bdi_dirty_limit(bdi, dirty_thresh);
@@ -97,6 +110,7 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   "b_dirty:            %10lu\n"
 		   "b_io:               %10lu\n"
 		   "b_more_io:          %10lu\n"
+		   "b_dirty_time:       %10lu\n"
 		   "bdi_list:           %10u\n"
 		   "state:              %10lx\n",
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITEBACK)),
@@ -110,6 +124,7 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 		   nr_dirty,
 		   nr_io,
 		   nr_more_io,
+		   nr_dirty_time,
 		   !list_empty(&bdi->bdi_list), bdi->state);
 #undef K
 
@@ -128,15 +143,59 @@ static const struct file_operations bdi_debug_stats_fops = {
 	.release	= single_release,
 };
 
+/*
+ * One line per writeback worker: the inodes on its lists, the work items
+ * it completed and the pages it wrote back.
+ */
+static int bdi_debug_workers_show(struct seq_file *m, void *v)
+{
+	struct backing_dev_info *bdi = m->private;
+	struct bdi_writeback *wb;
+	unsigned int i;
+
+	seq_printf(m, "%-6s %10s %10s %10s %12s %10s %14s %6s\n", "worker",
+		   "b_dirty", "b_io", "b_more_io", "b_dirty_time", "works",
+		   "written_kB", "state");
+	bdi_for_each_wb(wb, bdi, i) {
+		unsigned long nr_dirty = 0, nr_io = 0, nr_more_io = 0;
+		unsigned long nr_dirty_time = 0;
+
+		wb_count_inodes(wb, &nr_dirty, &nr_io, &nr_more_io,
+				&nr_dirty_time);
+		seq_printf(m, "%-6u %10lu %10lu %10lu %12lu %10lu %14lu %6lx\n",
+			   wb->nr, nr_dirty, nr_io, nr_more_io, nr_dirty_time,
+			   ACCESS_ONCE(wb->nr_works),
+			   ACCESS_ONCE(wb->nr_written) << (PAGE_SHIFT - 10),
+			   wb->state);
+	}
+	return 0;
+}
+
+static int bdi_debug_workers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bdi_debug_workers_show, inode->i_private);
+}
+
+static const struct file_operations bdi_debug_workers_fops = {
+	.open		= bdi_debug_workers_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static void bdi_debug_register(struct backing_dev_info *bdi, const char *name)
 {
 	bdi->debug_dir = debugfs_create_dir(name, bdi_debug_root);
 	bdi->debug_stats = debugfs_create_file("stats", 0444, bdi->debug_dir,
 					       bdi, &bdi_debug_stats_fops);
+	bdi->debug_workers = debugfs_create_file("workers", 0444,
+						 bdi->debug_dir, bdi,
+						 &bdi_debug_workers_fops);
 }
 
 static void bdi_debug_unregister(struct backing_dev_info *bdi)
 {
+	debugfs_remove(bdi->debug_workers);
 	debugfs_remove(bdi->debug_stats);
 	debugfs_remove(bdi->debug_dir);
 }
@@ -219,12 +278,15 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+BDI_SHOW(writeback_workers, bdi->nr_wb)
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RO(writeback_workers),
 	__ATTR_NULL,
 };
 
@@ -244,6 +306,11 @@ static int __init default_bdi_init(void)
 {
 	int err;
 
+	bdi_wq = alloc_workqueue("writeback", WQ_MEM_RECLAIM | WQ_FREEZABLE |
+					      WQ_UNBOUND, 0);
+	if (!bdi_wq)
+		return -ENOMEM;
+
 	err = bdi_init(&default_backing_dev_info);
 	if (!err)
 		bdi_register(&default_backing_dev_info, NULL, "default");
@@ -255,227 +322,95 @@ subsys_initcall(default_bdi_init);
 
 int bdi_has_dirty_io(struct backing_dev_info *bdi)
 {
-	return wb_has_dirty_io(&bdi->wb);
-}
-
-static void wakeup_timer_fn(unsigned long data)
-{
-	struct backing_dev_info *bdi = (struct backing_dev_info *)data;
+	struct bdi_writeback *wb;
+	unsigned int i;
 
-	spin_lock_bh(&bdi->wb_lock);
-	if (bdi->wb.task) {
-		trace_writeback_wake_thread(bdi);
-		wake_up_process(bdi->wb.task);
-	} else if (bdi->dev) {
-		/*
-		 * When bdi tasks are inactive for long time, they are killed.
-		 * In this case we have to wake-up the forker thread which
-		 * should create and run the bdi thread.
-		 */
-		trace_writeback_wake_forker_thread(bdi);
-		wake_up_process(default_backing_dev_info.wb.task);
-	}
-	spin_unlock_bh(&bdi->wb_lock);
+	bdi_for_each_wb(wb, bdi, i)
+		if (wb_has_dirty_io(wb))
+			return 1;
+	return 0;
 }
 
 /*
- * This function is used when the first inode for this bdi is marked dirty. It
- * wakes-up the corresponding bdi thread which should then take care of the
+ * This function is used when the first inode for this wb is marked dirty. It
+ * kicks the corresponding worker which should then take care of the
  * periodic background write-out of dirty inodes. Since the write-out would
  * starts only 'dirty_writeback_interval' centisecs from now anyway, we just
- * set up a timer which wakes the bdi thread up later.
+ * queue the work with that delay.
  *
- * Note, we wouldn't bother setting up the timer, but this function is on the
+ * Note, we wouldn't bother delaying the work, but this function is on the
  * fast-path (used by '__mark_inode_dirty()'), so we save few context switches
  * by delaying the wake-up.
  */
-void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi)
+void wb_wakeup_delayed(struct bdi_writeback *wb)
 {
 	unsigned long timeout;
 
 	timeout = msecs_to_jiffies(dirty_writeback_interval * 10);
-	mod_timer(&bdi->wb.wakeup_timer, jiffies + timeout);
+	spin_lock_bh(&wb->work_lock);
+	if (test_bit(WB_registered, &wb->state))
+		queue_delayed_work(bdi_wq, &wb->dwork, timeout);
+	spin_unlock_bh(&wb->work_lock);
 }
 
 /*
- * Calculate the longest interval (jiffies) bdi threads are allowed to be
- * inactive.
+ * Remove bdi from bdi_list, and ensure that it is no longer visible
  */
-static unsigned long bdi_longest_inactive(void)
+static void bdi_remove_from_list(struct backing_dev_info *bdi)
 {
-	unsigned long interval;
-
-	interval = msecs_to_jiffies(dirty_writeback_interval * 10);
-	return max(5UL * 60 * HZ, interval);
-}
+	spin_lock_bh(&bdi_lock);
+	list_del_rcu(&bdi->bdi_list);
+	spin_unlock_bh(&bdi_lock);
 
-/*
- * Clear pending bit and wakeup anybody waiting for flusher thread creation or
- * shutdown
- */
-static void bdi_clear_pending(struct backing_dev_info *bdi)
-{
-	clear_bit(BDI_pending, &bdi->state);
-	smp_mb__after_clear_bit();
-	wake_up_bit(&bdi->state, BDI_pending);
+	synchronize_rcu_expedited();
 }
 
-static int bdi_forker_thread(void *ptr)
+static void bdi_wb_init(struct bdi_writeback *wb, struct backing_dev_info *bdi,
+			unsigned int nr)
 {
-	struct bdi_writeback *me = ptr;
-
-	current->flags |= PF_SWAPWRITE;
-	set_freezable();
-
-	/*
-	 * Our parent may run at a different priority, just set us to normal
-	 */
-	set_user_nice(current, 0);
-
-	for (;;) {
-		struct task_struct *task = NULL;
-		struct backing_dev_info *bdi;
-		enum {
-			NO_ACTION,   /* Nothing to do */
-			FORK_THREAD, /* Fork bdi thread */
-			KILL_THREAD, /* Kill inactive bdi thread */
-		} action = NO_ACTION;
-
-		/*
-		 * Temporary measure, we want to make sure we don't see
-		 * dirty data on the default backing_dev_info
-		 */
-		if (wb_has_dirty_io(me) || !list_empty(&me->bdi->work_list)) {
-			del_timer(&me->wakeup_timer);
-			wb_do_writeback(me, 0);
-		}
-
-		spin_lock_bh(&bdi_lock);
-		/*
-		 * In the following loop we are going to check whether we have
-		 * some work to do without any synchronization with tasks
-		 * waking us up to do work for them. Set the task state here
-		 * so that we don't miss wakeups after verifying conditions.
-		 */
-		set_current_state(TASK_INTERRUPTIBLE);
-
-		list_for_each_entry(bdi, &bdi_list, bdi_list) {
-			bool have_dirty_io;
-
-			if (!bdi_cap_writeback_dirty(bdi) ||
-			     bdi_cap_flush_forker(bdi))
-				continue;
-
-			WARN(!test_bit(BDI_registered, &bdi->state),
-			     "bdi %p/%s is not registered!\n", bdi, bdi->name);
-
-			have_dirty_io = !list_empty(&bdi->work_list) ||
-					wb_has_dirty_io(&bdi->wb);
-
-			/*
-			 * If the bdi has work to do, but the thread does not
-			 * exist - create it.
-			 */
-			if (!bdi->wb.task && have_dirty_io) {
-				/*
-				 * Set the pending bit - if someone will try to
-				 * unregister this bdi - it'll wait on this bit.
-				 */
-				set_bit(BDI_pending, &bdi->state);
-				action = FORK_THREAD;
-				break;
-			}
-
-			spin_lock(&bdi->wb_lock);
-
-			/*
-			 * If there is no work to do and the bdi thread was
-			 * inactive long enough - kill it. The wb_lock is taken
-			 * to make sure no-one adds more work to this bdi and
-			 * wakes the bdi thread up.
-			 */
-			if (bdi->wb.task && !have_dirty_io &&
-			    time_after(jiffies, bdi->wb.last_active +
-						bdi_longest_inactive())) {
-				task = bdi->wb.task;
-				bdi->wb.task = NULL;
-				spin_unlock(&bdi->wb_lock);
-				set_bit(BDI_pending, &bdi->state);
-				action = KILL_THREAD;
-				break;
-			}
-			spin_unlock(&bdi->wb_lock);
-		}
-		spin_unlock_bh(&bdi_lock);
-
-		/* Keep working if default bdi still has things to do */
-		if (!list_empty(&me->bdi->work_list))
-			__set_current_state(TASK_RUNNING);
-
-		switch (action) {
-		case FORK_THREAD:
-			__set_current_state(TASK_RUNNING);
-			task = kthread_create(bdi_writeback_thread, &bdi->wb,
-					      "flush-%s", dev_name(bdi->dev));
-			if (IS_ERR(task)) {
-				/*
-				 * If thread creation fails, force writeout of
-				 * the bdi from the thread. Hopefully 1024 is
-				 * large enough for efficient IO.
-				 */
-				writeback_inodes_wb(&bdi->wb, 1024,
-						    WB_REASON_FORKER_THREAD);
-			} else {
-				/*
-				 * The spinlock makes sure we do not lose
-				 * wake-ups when racing with 'bdi_queue_work()'.
-				 * And as soon as the bdi thread is visible, we
-				 * can start it.
-				 */
-				spin_lock_bh(&bdi->wb_lock);
-				bdi->wb.task = task;
-				spin_unlock_bh(&bdi->wb_lock);
-				wake_up_process(task);
-			}
-			bdi_clear_pending(bdi);
-			break;
-
-		case KILL_THREAD:
-			__set_current_state(TASK_RUNNING);
-			kthread_stop(task);
-			bdi_clear_pending(bdi);
-			break;
-
-		case NO_ACTION:
-			if (!wb_has_dirty_io(me) || !dirty_writeback_interval)
-				/*
-				 * There are no dirty data. The only thing we
-				 * should now care about is checking for
-				 * inactive bdi threads and killing them. Thus,
-				 * let's sleep for longer time, save energy and
-				 * be friendly for battery-driven devices.
-				 */
-				schedule_timeout(bdi_longest_inactive());
-			else
-				schedule_timeout(msecs_to_jiffies(dirty_writeback_interval * 10));
-			try_to_freeze();
-			break;
-		}
-	}
+	memset(wb, 0, sizeof(*wb));
 
-	return 0;
+	wb->bdi = bdi;
+	wb->nr = nr;
+	wb->last_old_flush = jiffies;
+	INIT_LIST_HEAD(&wb->b_dirty);
+	INIT_LIST_HEAD(&wb->b_io);
+	INIT_LIST_HEAD(&wb->b_more_io);
+	INIT_LIST_HEAD(&wb->b_dirty_time);
+	spin_lock_init(&wb->list_lock);
+	spin_lock_init(&wb->work_lock);
+	INIT_LIST_HEAD(&wb->work_list);
+	INIT_DELAYED_WORK(&wb->dwork, bdi_writeback_workfn);
 }
 
 /*
- * Remove bdi from bdi_list, and ensure that it is no longer visible
+ * Set up the writeback workers beyond the embedded bdi->wb that the
+ * driver asked for by setting bdi->nr_wb between bdi_init() and
+ * bdi_register(). If they cannot be allocated the bdi just makes do
+ * with one worker. The number does not change after this, as it
+ * decides which worker's lists each dirty inode is on.
  */
-static void bdi_remove_from_list(struct backing_dev_info *bdi)
+static void bdi_wb_alloc_extra(struct backing_dev_info *bdi)
 {
-	spin_lock_bh(&bdi_lock);
-	list_del_rcu(&bdi->bdi_list);
-	spin_unlock_bh(&bdi_lock);
+	unsigned int i, nr_wb = clamp_t(unsigned int, bdi->nr_wb,
+					1, BDI_MAX_WB);
 
-	synchronize_rcu_expedited();
+	/* re-registered, keep the workers inodes may still be queued on */
+	if (bdi->wb_extra)
+		return;
+
+	bdi->nr_wb = 1;
+	if (nr_wb == 1)
+		return;
+
+	bdi->wb_extra = kcalloc(nr_wb - 1, sizeof(*bdi->wb_extra),
+				GFP_KERNEL);
+	if (!bdi->wb_extra)
+		return;
+
+	for (i = 1; i < nr_wb; i++)
+		bdi_wb_init(&bdi->wb_extra[i - 1], bdi, i);
+	bdi->nr_wb = nr_wb;
 }
 
 int bdi_register(struct backing_dev_info *bdi, struct device *parent,
@@ -483,6 +418,8 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 {
 	va_list args;
 	struct device *dev;
+	struct bdi_writeback *wb;
+	unsigned int i;
 
 	if (bdi->dev)	/* The driver needs to use separate queues per device */
 		return 0;
@@ -495,20 +432,7 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 
 	bdi->dev = dev;
 
-	/*
-	 * Just start the forker thread for our default backing_dev_info,
-	 * and add other bdi's to the list. They will get a thread created
-	 * on-demand when they need it.
-	 */
-	if (bdi_cap_flush_forker(bdi)) {
-		struct bdi_writeback *wb = &bdi->wb;
-
-		wb->task = kthread_run(bdi_forker_thread, wb, "bdi-%s",
-						dev_name(dev));
-		if (IS_ERR(wb->task))
-			return PTR_ERR(wb->task);
-	}
-
+	bdi_wb_alloc_extra(bdi);
 	bdi_debug_register(bdi, dev_name(dev));
 	set_bit(BDI_registered, &bdi->state);
 
@@ -516,6 +440,13 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 	list_add_tail_rcu(&bdi->bdi_list, &bdi_list);
 	spin_unlock_bh(&bdi_lock);
 
+	/*
+	 * The workers only run once there is work for them, so an idle
+	 * bdi costs nothing but its bdi_writeback structures.
+	 */
+	bdi_for_each_wb(wb, bdi, i)
+		set_bit(WB_registered, &wb->state);
+
 	trace_writeback_bdi_register(bdi);
 	return 0;
 }
@@ -528,37 +459,35 @@ int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev)
 EXPORT_SYMBOL(bdi_register_dev);
 
 /*
- * Remove bdi from the global list and shutdown any threads we have running
+ * Remove bdi from the global list and shut down its writeback workers
  */
 static void bdi_wb_shutdown(struct backing_dev_info *bdi)
 {
-	struct task_struct *task;
-
-	if (!bdi_cap_writeback_dirty(bdi))
-		return;
+	struct bdi_writeback *wb;
+	unsigned int i;
 
 	/*
 	 * Make sure nobody finds us on the bdi_list anymore
 	 */
 	bdi_remove_from_list(bdi);
 
-	/*
-	 * If setup is pending, wait for that to complete first
-	 */
-	wait_on_bit(&bdi->state, BDI_pending, bdi_sched_wait,
-			TASK_UNINTERRUPTIBLE);
+	bdi_for_each_wb(wb, bdi, i) {
+		/* Make sure nobody queues further work */
+		spin_lock_bh(&wb->work_lock);
+		clear_bit(WB_registered, &wb->state);
+		spin_unlock_bh(&wb->work_lock);
 
-	/*
-	 * Finally, kill the kernel thread. We don't need to be RCU
-	 * safe anymore, since the bdi is gone from visibility.
-	 */
-	spin_lock_bh(&bdi->wb_lock);
-	task = bdi->wb.task;
-	bdi->wb.task = NULL;
-	spin_unlock_bh(&bdi->wb_lock);
-
-	if (task)
-		kthread_stop(task);
+		/*
+		 * Drain the work_list and shut down the delayed_work. @bdi
+		 * is off bdi_list now, which tells bdi_writeback_workfn()
+		 * that the queued work has to be completed no matter what,
+		 * and it won't re-arm itself with WB_registered clear.
+		 */
+		__cancel_delayed_work(&wb->dwork);
+		queue_delayed_work(bdi_wq, &wb->dwork, 0);
+		flush_delayed_work(&wb->dwork);
+		WARN_ON(!list_empty(&wb->work_list));
+	}
 }
 
 /*
@@ -584,34 +513,17 @@ void bdi_unregister(struct backing_dev_info *bdi)
 		bdi_set_min_ratio(bdi, 0);
 		trace_writeback_bdi_unregister(bdi);
 		bdi_prune_sb(bdi);
-		del_timer_sync(&bdi->wb.wakeup_timer);
 
-		if (!bdi_cap_flush_forker(bdi))
-			bdi_wb_shutdown(bdi);
+		bdi_wb_shutdown(bdi);
 		bdi_debug_unregister(bdi);
 
-		spin_lock_bh(&bdi->wb_lock);
 		bdi->dev = NULL;
-		spin_unlock_bh(&bdi->wb_lock);
 
 		device_unregister(dev);
 	}
 }
 EXPORT_SYMBOL(bdi_unregister);
 
-static void bdi_wb_init(struct bdi_writeback *wb, struct backing_dev_info *bdi)
-{
-	memset(wb, 0, sizeof(*wb));
-
-	wb->bdi = bdi;
-	wb->last_old_flush = jiffies;
-	INIT_LIST_HEAD(&wb->b_dirty);
-	INIT_LIST_HEAD(&wb->b_io);
-	INIT_LIST_HEAD(&wb->b_more_io);
-	spin_lock_init(&wb->list_lock);
-	setup_timer(&wb->wakeup_timer, wakeup_timer_fn, (unsigned long)bdi);
-}
-
 /*
  * Initial write bandwidth: 100 MB/s
  */
@@ -626,11 +538,12 @@ int bdi_init(struct backing_dev_info *bdi)
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = FPROP_FRAC_BASE;
-	spin_lock_init(&bdi->wb_lock);
 	INIT_LIST_HEAD(&bdi->bdi_list);
-	INIT_LIST_HEAD(&bdi->work_list);
+	init_waitqueue_head(&bdi->wb_waitq);
 
-	bdi_wb_init(&bdi->wb, bdi);
+	bdi_wb_init(&bdi->wb, bdi, 0);
+	bdi->wb_extra = NULL;
+	bdi->nr_wb = 1;
 
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++) {
 		err = percpu_counter_init(&bdi->bdi_stat[i], 0);
@@ -662,32 +575,39 @@ EXPORT_SYMBOL(bdi_init);
 
 void bdi_destroy(struct backing_dev_info *bdi)
 {
-	int i;
+	struct bdi_writeback *wb;
+	unsigned int i;
 
 	/*
 	 * Splice our entries to the default_backing_dev_info, if this
 	 * bdi disappears
 	 */
-	if (bdi_has_dirty_io(bdi)) {
+	bdi_for_each_wb(wb, bdi, i) {
 		struct bdi_writeback *dst = &default_backing_dev_info.wb;
 
-		bdi_lock_two(&bdi->wb, dst);
-		list_splice(&bdi->wb.b_dirty, &dst->b_dirty);
-		list_splice(&bdi->wb.b_io, &dst->b_io);
-		list_splice(&bdi->wb.b_more_io, &dst->b_more_io);
-		spin_unlock(&bdi->wb.list_lock);
+		if (!wb_has_dirty_io(wb) && list_empty(&wb->b_dirty_time))
+			continue;
+
+		bdi_lock_two(wb, dst);
+		list_splice(&wb->b_dirty, &dst->b_dirty);
+		list_splice(&wb->b_io, &dst->b_io);
+		list_splice(&wb->b_more_io, &dst->b_more_io);
+		list_splice(&wb->b_dirty_time, &dst->b_dirty_time);
+		spin_unlock(&wb->list_lock);
 		spin_unlock(&dst->list_lock);
 	}
 
 	bdi_unregister(bdi);
 
 	/*
-	 * If bdi_unregister() had already been called earlier, the
-	 * wakeup_timer could still be armed because bdi_prune_sb()
-	 * can race with the bdi_wakeup_thread_delayed() calls from
-	 * __mark_inode_dirty().
+	 * bdi_unregister() drained the workers and nothing can queue them
+	 * anymore, make sure none of them is still around before freeing.
 	 */
-	del_timer_sync(&bdi->wb.wakeup_timer);
+	bdi_for_each_wb(wb, bdi, i)
+		cancel_delayed_work_sync(&wb->dwork);
+	kfree(bdi->wb_extra);
+	bdi->wb_extra = NULL;
+	bdi->nr_wb = 1;
 
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
 		percpu_counter_destroy(&bdi->bdi_stat[i]);
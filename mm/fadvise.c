@@ -17,6 +17,7 @@
 #include <linux/fadvise.h>
 #include <linux/writeback.h>
 #include <linux/syscalls.h>
+#include <linux/swap.h>
 
 #include <asm/unistd.h>
 
@@ -33,6 +34,7 @@ SYSCALL_DEFINE(fadvise64_64)(int fd, loff_t offset, loff_t len, int advice)
 	pgoff_t start_index;
 	pgoff_t end_index;
 	unsigned long nrpages;
+	struct async_readahead *ra;
 	int ret = 0;
 
 	if (!file)
@@ -103,11 +105,12 @@ SYSCALL_DEFINE(fadvise64_64)(int fd, loff_t offset, loff_t len, int advice)
 			nrpages = ~0UL;
 
 		/*
-		 * Ignore return value because fadvise() shall return
-		 * success even if filesystem can't retrieve a hint,
+		 * There is no return value to wait for, fadvise() shall
+		 * return success even if filesystem can't retrieve a hint.
 		 */
-		force_page_cache_readahead(mapping, file, start_index,
-					   nrpages);
+		ra = NULL;
+		async_readahead(&ra, file, start_index, nrpages);
+		async_readahead_submit(ra);
 		break;
 	case POSIX_FADV_NOREUSE:
 		break;
@@ -120,9 +123,18 @@ SYSCALL_DEFINE(fadvise64_64)(int fd, loff_t offset, loff_t len, int advice)
 		start_index = (offset+(PAGE_CACHE_SIZE-1)) >> PAGE_CACHE_SHIFT;
 		end_index = (endbyte >> PAGE_CACHE_SHIFT);
 
-		if (end_index >= start_index)
+		if (end_index >= start_index) {
+			/*
+			 * Pages still sitting in a pagevec have an extra
+			 * reference and would be skipped.  Those of this CPU
+			 * are the likely ones, the caller has just been at
+			 * them: drain only these and don't interrupt every
+			 * other CPU for it.
+			 */
+			lru_add_drain();
 			invalidate_mapping_pages(mapping, start_index,
 						end_index);
+		}
 		break;
 	default:
 		ret = -EINVAL;
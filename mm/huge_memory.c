@@ -17,6 +17,8 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/file.h>
+#include <linux/shmem_fs.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -312,11 +314,18 @@ static struct kobj_attribute debug_cow_attr =
 	__ATTR(debug_cow, 0644, debug_cow_show, debug_cow_store);
 #endif /* CONFIG_DEBUG_VM */
 
+#ifdef CONFIG_SHMEM
+extern struct kobj_attribute shmem_enabled_attr;
+#endif
+
 static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
 #ifdef CONFIG_DEBUG_VM
 	&debug_cow_attr.attr,
+#endif
+#ifdef CONFIG_SHMEM
+	&shmem_enabled_attr.attr,
 #endif
 	NULL,
 };
@@ -750,6 +759,55 @@ out:
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Map HPAGE_PMD_NR physically contiguous page cache pages, starting with
+ * @page, at the none pmd covering @haddr.  The pages are not a compound
+ * page: each of them is referenced and rmapped on its own, as if mapped
+ * by a pte, so that truncation and reclaim keep seeing small pages.  The
+ * caller holds the pages locked.
+ *
+ * tmpfs has nothing to write back to, so the pages are dirtied here once
+ * and the dirty bit of the pmd never matters.
+ */
+int do_set_huge_pmd(struct vm_area_struct *vma, unsigned long haddr,
+		    pmd_t *pmd, struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	VM_BUG_ON(haddr & ~HPAGE_PMD_MASK);
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return -EAGAIN;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		get_page(page + i);
+		set_page_dirty(page + i);
+		page_add_file_rmap(page + i);
+	}
+	entry = mk_pmd(page, vma->vm_page_prot);
+	entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	update_mmu_cache(vma, haddr, entry);
+	spin_unlock(&mm->page_table_lock);
+
+	return 0;
+}
+
 int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
 		  struct vm_area_struct *vma)
@@ -783,6 +841,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* shared page cache, the child faults it in again */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -1010,7 +1074,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(PageAnon(page) && !PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -1025,6 +1089,11 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
 	}
 	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	if (!PageAnon(page)) {
+		if (flags & FOLL_GET)
+			get_page(page);
+		goto out;
+	}
 	VM_BUG_ON(!PageCompound(page));
 	if (flags & FOLL_GET)
 		get_page_foll(page);
@@ -1045,6 +1114,19 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		page = pmd_page(*pmd);
 		pmd_clear(pmd);
 		tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+		if (!PageAnon(page)) {
+			int i;
+
+			tlb->mm->nr_ptes--;
+			spin_unlock(&tlb->mm->page_table_lock);
+			for (i = 0; i < HPAGE_PMD_NR; i++) {
+				page_remove_rmap(page + i);
+				tlb_remove_page(tlb, page + i);
+			}
+			add_mm_counter(tlb->mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+			pte_free(tlb->mm, pgtable);
+			return 1;
+		}
 		page_remove_rmap(page);
 		VM_BUG_ON(page_mapcount(page) < 0);
 		add_mm_counter(tlb->mm, MM_ANONPAGES, -HPAGE_PMD_NR);
@@ -1497,12 +1579,18 @@ out:
 int hugepage_madvise(struct vm_area_struct *vma,
 		     unsigned long *vm_flags, int advice)
 {
+	unsigned long no_thp = VM_NO_THP;
+
+	/* page cache that can be mapped huge is shared by definition */
+	if (transparent_hugepage_file(vma))
+		no_thp &= ~(VM_SHARED | VM_MAYSHARE);
+
 	switch (advice) {
 	case MADV_HUGEPAGE:
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_HUGEPAGE | no_thp))
 			return -EINVAL;
 		*vm_flags &= ~VM_NOHUGEPAGE;
 		*vm_flags |= VM_HUGEPAGE;
@@ -1511,14 +1599,17 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		 * register it here without waiting a page fault that
 		 * may not happen any time soon.
 		 */
-		if (unlikely(khugepaged_enter_vma_merge(vma)))
+		if (transparent_hugepage_file(vma)) {
+			if (unlikely(khugepaged_enter_file(vma)))
+				return -ENOMEM;
+		} else if (unlikely(khugepaged_enter_vma_merge(vma)))
 			return -ENOMEM;
 		break;
 	case MADV_NOHUGEPAGE:
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_NOHUGEPAGE | no_thp))
 			return -EINVAL;
 		*vm_flags &= ~VM_HUGEPAGE;
 		*vm_flags |= VM_NOHUGEPAGE;
@@ -1646,6 +1737,11 @@ int __khugepaged_enter(struct mm_struct *mm)
 int khugepaged_enter_vma_merge(struct vm_area_struct *vma)
 {
 	unsigned long hstart, hend;
+	if (transparent_hugepage_file(vma)) {
+		if (shmem_huge_enabled(vma))
+			return khugepaged_enter_file(vma);
+		return 0;
+	}
 	if (!vma->anon_vma)
 		/*
 		 * Not yet faulted in so we will register later in the
@@ -1931,6 +2027,9 @@ static void collapse_huge_page(struct mm_struct *mm,
 	/* pmd can't go away or become huge under us */
 	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
+	/* the pte table is freed below, it must not be shared with a fork */
+	if (pte_table_shared(pmd))
+		goto out;
 
 	anon_vma_lock(vma->anon_vma);
 
@@ -2104,6 +2203,105 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
+static bool hugepage_vma_check(struct vm_area_struct *vma)
+{
+	if (transparent_hugepage_file(vma)) {
+		/* file offsets must line up with huge pmds */
+		if (((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff) &
+		    (HPAGE_PMD_NR - 1))
+			return false;
+		return shmem_huge_enabled(vma);
+	}
+	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	    (vma->vm_flags & VM_NOHUGEPAGE))
+		return false;
+	if (!vma->anon_vma || vma->vm_ops)
+		return false;
+	if (is_vma_temporary_stack(vma))
+		return false;
+	/*
+	 * If is_pfn_mapping() is true is_learn_pfn_mapping() must be
+	 * true too, verify it here.
+	 */
+	VM_BUG_ON(is_linear_pfn_mapping(vma) || vma->vm_flags & VM_NO_THP);
+	return true;
+}
+
+/*
+ * Huge tmpfs is collapsed in the page cache, where all mappings share
+ * it, and the page table of this mm is then taken out of the way so the
+ * range can be mapped with a pmd.  Other mms get theirs replaced when
+ * khugepaged gets to them.  Returns 1 if the mmap_sem was released.
+ */
+static int khugepaged_scan_file(struct mm_struct *mm,
+				struct vm_area_struct *vma,
+				unsigned long address)
+{
+	struct file *file;
+	pgoff_t pgoff;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, _pmd;
+	int ret;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return 0;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return 0;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return 0;
+
+	file = vma->vm_file;
+	pgoff = linear_page_index(vma, address);
+	get_file(file);
+	up_read(&mm->mmap_sem);
+
+	ret = shmem_collapse_huge(file->f_mapping, pgoff);
+	if (ret < 0)
+		goto out;
+	if (ret)
+		khugepaged_pages_collapsed++;
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out_up_write;
+	vma = find_vma(mm, address);
+	if (!vma || vma->vm_start > address ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    vma->vm_file != file || !hugepage_vma_check(vma))
+		goto out_up_write;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_up_write;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_up_write;
+	pmd = pmd_offset(pud, address);
+	/* pmd can't go away or become huge under us */
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out_up_write;
+
+	zap_page_range(vma, address, HPAGE_PMD_SIZE, NULL);
+	spin_lock(&mm->page_table_lock);
+	_pmd = pmdp_clear_flush_notify(vma, address, pmd);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+	pte_free(mm, pmd_pgtable(_pmd));
+
+	vma->vm_ops->pmd_fault(vma, address, pmd, 0);
+out_up_write:
+	up_write(&mm->mmap_sem);
+out:
+	fput(file);
+	return 1;
+}
+
 static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 					    struct page **hpage)
 	__releases(&khugepaged_mm_lock)
@@ -2144,23 +2342,11 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			break;
 		}
 
-		if ((!(vma->vm_flags & VM_HUGEPAGE) &&
-		     !khugepaged_always()) ||
-		    (vma->vm_flags & VM_NOHUGEPAGE)) {
+		if (!hugepage_vma_check(vma)) {
 		skip:
 			progress++;
 			continue;
 		}
-		if (!vma->anon_vma || vma->vm_ops)
-			goto skip;
-		if (is_vma_temporary_stack(vma))
-			goto skip;
-		/*
-		 * If is_pfn_mapping() is true is_learn_pfn_mapping()
-		 * must be true too, verify it here.
-		 */
-		VM_BUG_ON(is_linear_pfn_mapping(vma) ||
-			  vma->vm_flags & VM_NO_THP);
 
 		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
 		hend = vma->vm_end & HPAGE_PMD_MASK;
@@ -2181,9 +2367,13 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			VM_BUG_ON(khugepaged_scan.address < hstart ||
 				  khugepaged_scan.address + HPAGE_PMD_SIZE >
 				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			if (vma->vm_ops)
+				ret = khugepaged_scan_file(mm, vma,
+						khugepaged_scan.address);
+			else
+				ret = khugepaged_scan_pmd(mm, vma,
+						khugepaged_scan.address,
+						hpage);
 			/* move to next address */
 			khugepaged_scan.address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
@@ -2376,6 +2566,32 @@ static int khugepaged(void *none)
 	return 0;
 }
 
+/*
+ * A page cache pmd is not split into ptes: the pages are still in the
+ * page cache, so they are simply unmapped and the deposited page table
+ * takes the place of the pmd, to be filled by ->fault as they are
+ * touched again.  Called with the page_table_lock held, drops it.
+ */
+static void __split_huge_file_pmd(struct mm_struct *mm, pmd_t *pmd,
+				  struct page *page)
+	__releases(&mm->page_table_lock)
+{
+	pgtable_t pgtable;
+	int i;
+
+	pmd_clear(pmd);
+	flush_tlb_mm(mm);
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, pmd, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_remove_rmap(page + i);
+		put_page(page + i);
+	}
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+}
+
 void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 {
 	struct page *page;
@@ -2387,6 +2603,10 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON(!page_count(page));
+	if (!PageAnon(page)) {
+		__split_huge_file_pmd(mm, pmd, page);
+		return;
+	}
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
 
@@ -2396,15 +2616,12 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
-static void split_huge_page_address(struct mm_struct *mm,
-				    unsigned long address)
+void split_huge_page_address(struct mm_struct *mm, unsigned long address)
 {
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
 
-	VM_BUG_ON(!(address & ~HPAGE_PMD_MASK));
-
 	pgd = pgd_offset(mm, address);
 	if (!pgd_present(*pgd))
 		return;
@@ -2418,11 +2635,28 @@ static void split_huge_page_address(struct mm_struct *mm,
 		return;
 	/*
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
-	 * materialize from under us.
+	 * materialize from under us.  Page cache rmap walks call this
+	 * under i_mmap_mutex instead, which keeps the page tables around
+	 * while a new huge pmd showing up doesn't matter to them.
 	 */
 	split_huge_page_pmd(mm, pmd);
 }
 
+/*
+ * Break up all huge pmds of a page cache vma.  Anonymous vmas are left
+ * alone.  Caller holds the mmap_sem write mode.
+ */
+void split_huge_page_vma(struct vm_area_struct *vma)
+{
+	unsigned long addr;
+
+	if (!transparent_hugepage_file(vma))
+		return;
+	for (addr = vma->vm_start & HPAGE_PMD_MASK; addr < vma->vm_end;
+	     addr += HPAGE_PMD_SIZE)
+		split_huge_page_address(vma->vm_mm, addr);
+}
+
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 			     unsigned long start,
 			     unsigned long end,
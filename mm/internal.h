@@ -356,3 +356,35 @@ extern unsigned long vm_mmap_pgoff(struct file *, unsigned long,
         unsigned long, unsigned long);
 
 extern void set_pageblock_order(void);
+
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+void try_to_unmap_flush(void);
+void try_to_unmap_flush_dirty(void);
+void flush_tlb_batched_pending(struct mm_struct *mm);
+#else
+static inline void try_to_unmap_flush(void)
+{
+}
+static inline void try_to_unmap_flush_dirty(void)
+{
+}
+static inline void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT
+/*
+ * True if the struct page of @pfn is left to the deferred initialisation
+ * and not set up yet.  Boot code only, see page_alloc_init_late().
+ */
+static inline bool early_page_uninitialised(unsigned long pfn)
+{
+	return pfn >= NODE_DATA(early_pfn_to_nid(pfn))->first_deferred_pfn;
+}
+#else
+static inline bool early_page_uninitialised(unsigned long pfn)
+{
+	return false;
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT */
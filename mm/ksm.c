@@ -86,12 +86,18 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @pages_scanned: pages scanned in this mm during its current or last pass
+ * @pages_merged: how many of those were left merged into a ksm page
+ * @skip: number of full scans still to pass this mm over
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	unsigned long pages_scanned;
+	unsigned long pages_merged;
+	unsigned int skip;
 };
 
 /**
@@ -189,6 +195,17 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/*
+ * Full scans to pass over an mm none of whose pages merged, fewer the
+ * better it merged.  Bounded so that the unstable tree age of rmap_items
+ * in a passed over mm stays well within SEQNR_MASK.
+ */
+#define KSM_MAX_SKIP	16
+static unsigned int ksm_skip_low_yield;
+
+/* Cache lines of a page to checksum, spread over it; 0 for all of it */
+static unsigned int ksm_checksum_sample;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -555,10 +572,11 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * root_unstable_tree was already reset to RB_ROOT.
 		 * But be careful when an mm is exiting: do the rb_erase
 		 * if this rmap_item was inserted by this scan, rather
-		 * than left over from before.
+		 * than left over from before (from the last scan, or an
+		 * earlier one if the mm has been passed over since).
 		 */
 		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
-		BUG_ON(age > 1);
+		BUG_ON(age > KSM_MAX_SKIP + 1);
 		if (!age)
 			rb_erase(&rmap_item->node, &root_unstable_tree);
 
@@ -673,11 +691,30 @@ error:
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The checksum only tells pages that change between scans from those that
+ * don't, before they are put in the unstable tree: merging always compares
+ * the full pages.  So it may sample the page instead of reading all of it,
+ * at the risk of letting a few more volatile pages into the unstable tree.
+ */
 static u32 calc_checksum(struct page *page)
 {
+	unsigned int nr = ksm_checksum_sample;
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+
+	if (!nr || nr >= PAGE_SIZE / L1_CACHE_BYTES) {
+		checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	} else {
+		unsigned long stride = PAGE_SIZE / L1_CACHE_BYTES / nr *
+				       L1_CACHE_BYTES;
+		unsigned int i;
+
+		checksum = 17;
+		for (i = 0; i < nr; i++)
+			checksum = jhash2(addr + i * stride,
+					  L1_CACHE_BYTES / 4, checksum);
+	}
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -715,6 +752,8 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 		goto out;
 
 	BUG_ON(PageTransCompound(page));
+	if (unshare_pte_table_address(vma, addr))
+		goto out;
 	ptep = page_check_address(page, mm, addr, &ptl, 0);
 	if (!ptep)
 		goto out;
@@ -1276,6 +1315,34 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
+/*
+ * Whether to pass over this mm in the current full scan.  It gets scanned
+ * again when its skips are used up, or when it needs cleaning up.
+ */
+static bool ksm_skip_mm(struct mm_slot *slot)
+{
+	if (!slot->skip || ksm_test_exit(slot->mm))
+		return false;
+	slot->skip--;
+	return true;
+}
+
+/*
+ * At the end of a pass over an mm, weigh how often it is passed over by
+ * how few of its pages merged: the fewer, the less its scanning pays off.
+ */
+static void ksm_update_skip(struct mm_slot *slot)
+{
+	unsigned long unmerged = slot->pages_scanned - slot->pages_merged;
+
+	slot->skip = 0;
+	if (slot->pages_scanned)
+		slot->skip = ksm_skip_low_yield * unmerged /
+			     slot->pages_scanned;
+	slot->pages_scanned = 0;
+	slot->pages_merged = 0;
+}
+
 static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 {
 	struct mm_struct *mm;
@@ -1315,6 +1382,18 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 next_mm:
 		ksm_scan.address = 0;
 		ksm_scan.rmap_list = &slot->rmap_list;
+
+		if (ksm_skip_mm(slot)) {
+			spin_lock(&ksm_mmlist_lock);
+			slot = list_entry(slot->mm_list.next,
+					  struct mm_slot, mm_list);
+			ksm_scan.mm_slot = slot;
+			spin_unlock(&ksm_mmlist_lock);
+			if (slot != &ksm_mm_head)
+				goto next_mm;
+			ksm_scan.seqnr++;
+			return NULL;
+		}
 	}
 
 	mm = slot->mm;
@@ -1371,6 +1450,7 @@ next_mm:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
 	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	ksm_update_skip(slot);
 
 	spin_lock(&ksm_mmlist_lock);
 	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
@@ -1424,6 +1504,11 @@ static void ksm_do_scan(unsigned int scan_npages)
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+
+		/* the cursor is still on the mm of this rmap_item */
+		ksm_scan.mm_slot->pages_scanned++;
+		if (in_stable_tree(rmap_item))
+			ksm_scan.mm_slot->pages_merged++;
 	}
 }
 
@@ -1876,6 +1961,52 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t skip_low_yield_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_skip_low_yield);
+}
+
+static ssize_t skip_low_yield_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long skip;
+
+	err = strict_strtoul(buf, 10, &skip);
+	if (err || skip > KSM_MAX_SKIP)
+		return -EINVAL;
+
+	ksm_skip_low_yield = skip;
+
+	return count;
+}
+KSM_ATTR(skip_low_yield);
+
+static ssize_t checksum_sample_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_checksum_sample);
+}
+
+static ssize_t checksum_sample_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr;
+
+	err = strict_strtoul(buf, 10, &nr);
+	if (err || nr > PAGE_SIZE / L1_CACHE_BYTES)
+		return -EINVAL;
+
+	ksm_checksum_sample = nr;
+
+	return count;
+}
+KSM_ATTR(checksum_sample);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1974,6 +2105,8 @@ KSM_ATTR_RO(full_scans);
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&skip_low_yield_attr.attr,
+	&checksum_sample_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
@@ -132,7 +132,8 @@ out:
  */
 static long madvise_willneed(struct vm_area_struct * vma,
 			     struct vm_area_struct ** prev,
-			     unsigned long start, unsigned long end)
+			     unsigned long start, unsigned long end,
+			     struct async_readahead **ra)
 {
 	struct file *file = vma->vm_file;
 
@@ -150,7 +151,7 @@ static long madvise_willneed(struct vm_area_struct * vma,
 		end = vma->vm_end;
 	end = ((end - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
 
-	force_page_cache_readahead(file->f_mapping, file, start, end - start);
+	async_readahead(ra, file, start, end - start);
 	return 0;
 }
 
@@ -274,13 +275,14 @@ static int madvise_hwpoison(int bhv, unsigned long start, unsigned long end)
 
 static long
 madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
-		unsigned long start, unsigned long end, int behavior)
+		unsigned long start, unsigned long end, int behavior,
+		struct async_readahead **ra)
 {
 	switch (behavior) {
 	case MADV_REMOVE:
 		return madvise_remove(vma, prev, start, end);
 	case MADV_WILLNEED:
-		return madvise_willneed(vma, prev, start, end);
+		return madvise_willneed(vma, prev, start, end, ra);
 	case MADV_DONTNEED:
 		return madvise_dontneed(vma, prev, start, end);
 	default:
@@ -363,6 +365,7 @@ SYSCALL_DEFINE3(madvise, unsigned long, start, size_t, len_in, int, behavior)
 {
 	unsigned long end, tmp;
 	struct vm_area_struct * vma, *prev;
+	struct async_readahead *ra = NULL;
 	int unmapped_error = 0;
 	int error = -EINVAL;
 	int write;
@@ -426,7 +429,7 @@ SYSCALL_DEFINE3(madvise, unsigned long, start, size_t, len_in, int, behavior)
 			tmp = end;
 
 		/* Here vma->vm_start <= start < tmp <= (end|vma->vm_end). */
-		error = madvise_vma(vma, &prev, start, tmp, behavior);
+		error = madvise_vma(vma, &prev, start, tmp, behavior, &ra);
 		if (error)
 			goto out;
 		start = tmp;
@@ -446,5 +449,8 @@ out:
 	else
 		up_read(&current->mm->mmap_sem);
 
+	/* the prefetch goes on in the background */
+	async_readahead_submit(ra);
+
 	return error;
 }
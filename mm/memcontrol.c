@@ -39,6 +39,7 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/shmem_fs.h>
 #include <linux/spinlock.h>
 #include <linux/eventfd.h>
 #include <linux/sort.h>
@@ -103,6 +104,7 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_PGPGOUT,	/* # of pages paged out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+	MEM_CGROUP_EVENTS_STALL,	/* usecs stalled on memory */
 	MEM_CGROUP_EVENTS_NSTATS,
 };
 
@@ -111,6 +113,7 @@ static const char * const mem_cgroup_events_names[] = {
 	"pgpgout",
 	"pgfault",
 	"pgmajfault",
+	"stall_us",
 };
 
 /*
@@ -223,6 +226,9 @@ struct mem_cgroup_eventfd_list {
 static void mem_cgroup_threshold(struct mem_cgroup *memcg);
 static void mem_cgroup_oom_notify(struct mem_cgroup *memcg);
 
+/* avg10, avg60, avg300 */
+#define MEMCG_PRESSURE_NR_AVGS	3
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -304,6 +310,12 @@ struct mem_cgroup {
 	/* For oom notifier event fd */
 	struct list_head oom_notify;
 
+	/* memory pressure, see mem_cgroup_pressure_update() */
+	unsigned long	pressure_stall;
+	unsigned long	pressure_avg[MEMCG_PRESSURE_NR_AVGS];
+	/* For memory pressure notifier event fd */
+	struct list_head pressure_notify;
+
 	/*
 	 * Should we move charges of a task when a task is moved into this
 	 * mem_cgroup ? And what type of charges should we move ?
@@ -1048,6 +1060,24 @@ out:
 }
 EXPORT_SYMBOL(mem_cgroup_count_vm_event);
 
+void mem_cgroup_stall_end(u64 start)
+{
+	struct mm_struct *mm = current->mm;
+	struct mem_cgroup *memcg;
+	unsigned long delta;
+
+	if (!start || !mm)
+		return;
+	delta = div_u64(local_clock() - start, NSEC_PER_USEC);
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (likely(memcg))
+		this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_STALL],
+			     delta);
+	rcu_read_unlock();
+}
+
 /**
  * mem_cgroup_zone_lruvec - get the lru list vector for a zone and memcg
  * @zone: zone of the wanted lruvec
@@ -1912,8 +1942,11 @@ static bool mem_cgroup_handle_oom(struct mem_cgroup *memcg, gfp_t mask,
 		finish_wait(&memcg_oom_waitq, &owait.wait);
 		mem_cgroup_out_of_memory(memcg, mask, order);
 	} else {
+		u64 stall = mem_cgroup_stall_start();
+
 		schedule();
 		finish_wait(&memcg_oom_waitq, &owait.wait);
+		mem_cgroup_stall_end(stall);
 	}
 	spin_lock(&memcg_oom_lock);
 	if (locked)
@@ -2054,6 +2087,26 @@ static bool consume_stock(struct mem_cgroup *memcg)
 	return ret;
 }
 
+/*
+ * Keep a page that is uncharged from the memcg this cpu is caching for
+ * the next charge instead of going to the res_counters.  The stock does
+ * not grow beyond CHARGE_BATCH this way, which bounds how far the usage
+ * can be ahead of what is really in use.
+ */
+static bool uncharge_to_stock(struct mem_cgroup *memcg)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (memcg == stock->cached && stock->nr_pages < CHARGE_BATCH) {
+		stock->nr_pages++;
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
 /*
  * Returns stocks cached in percpu to res_counter and reset cached information.
  */
@@ -2956,11 +3009,19 @@ static void mem_cgroup_do_uncharge(struct mem_cgroup *memcg,
 	 * because we want to do uncharge as soon as possible.
 	 */
 
-	if (!batch->do_batch || test_thread_flag(TIF_MEMDIE))
+	if (test_thread_flag(TIF_MEMDIE) || nr_pages > 1)
 		goto direct_uncharge;
 
-	if (nr_pages > 1)
+	/*
+	 * The stock holds memsw charges as well, so it can only take the
+	 * page if both counters would be uncharged.
+	 */
+	if (!batch->do_batch) {
+		if ((uncharge_memsw || !do_swap_account) &&
+		    uncharge_to_stock(memcg))
+			return;
 		goto direct_uncharge;
+	}
 
 	/*
 	 * In typical case, batch->memcg == mem. This means we can
@@ -4561,6 +4622,186 @@ static void mem_cgroup_oom_unregister_event(struct cgroup *cgrp,
 	spin_unlock(&memcg_oom_lock);
 }
 
+/*
+ * Memory pressure: the time tasks of a memcg spend stalled in reclaim,
+ * swap-in and memcg oom, accumulated in MEM_CGROUP_EVENTS_STALL, is
+ * turned into decaying averages of the share of wall time lost, like
+ * the load average.  Listeners registered on memory.pressure with a
+ * percentage are notified when the 10s average rises to it.
+ */
+#define MEMCG_PRESSURE_PERIOD	(2 * HZ)
+/* 300s worth of periods, beyond that all averages have decayed */
+#define MEMCG_PRESSURE_MAX_PERIODS	150
+
+/* 1/exp(2s/10s), 1/exp(2s/60s), 1/exp(2s/300s) as fixed-point */
+static const unsigned long memcg_pressure_exp[MEMCG_PRESSURE_NR_AVGS] = {
+	1677, 1981, 2034,
+};
+
+struct mem_cgroup_pressure_event {
+	struct list_head list;
+	struct eventfd_ctx *eventfd;
+	unsigned long threshold;	/* fixed-point percentage */
+	bool signalled;
+};
+
+static DEFINE_SPINLOCK(memcg_pressure_lock);
+static struct delayed_work memcg_pressure_work;
+static unsigned long memcg_pressure_stamp;
+
+static void mem_cgroup_pressure_notify(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_pressure_event *ev;
+
+	spin_lock(&memcg_pressure_lock);
+	list_for_each_entry(ev, &memcg->pressure_notify, list) {
+		bool over = memcg->pressure_avg[0] >= ev->threshold;
+
+		if (over && !ev->signalled)
+			eventfd_signal(ev->eventfd, 1);
+		ev->signalled = over;
+	}
+	spin_unlock(&memcg_pressure_lock);
+}
+
+static void mem_cgroup_pressure_update(struct mem_cgroup *memcg,
+				       unsigned long periods,
+				       unsigned int elapsed_us)
+{
+	struct mem_cgroup *iter;
+	unsigned long stall = 0, delta, sample;
+	int i;
+
+	for_each_mem_cgroup_tree(iter, memcg)
+		stall += mem_cgroup_read_events(iter, MEM_CGROUP_EVENTS_STALL);
+	delta = stall - memcg->pressure_stall;
+	memcg->pressure_stall = stall;
+	/* a removed child takes its stall time with it */
+	if ((long)delta < 0)
+		delta = 0;
+	/* concurrently stalled tasks add up, cap at all of the time */
+	if (delta > elapsed_us)
+		delta = elapsed_us;
+
+	sample = div_u64((u64)delta * 100 * FIXED_1, elapsed_us);
+	for (i = 0; i < MEMCG_PRESSURE_NR_AVGS; i++) {
+		unsigned long n;
+
+		for (n = 0; n < periods; n++) {
+			CALC_LOAD(memcg->pressure_avg[i],
+				  memcg_pressure_exp[i], sample);
+		}
+	}
+
+	if (!list_empty(&memcg->pressure_notify))
+		mem_cgroup_pressure_notify(memcg);
+}
+
+static void mem_cgroup_pressure_fn(struct work_struct *work)
+{
+	unsigned long elapsed = jiffies - memcg_pressure_stamp;
+	unsigned long periods;
+	struct mem_cgroup *iter;
+
+	if (!elapsed)
+		goto out;
+	memcg_pressure_stamp += elapsed;
+
+	periods = elapsed / MEMCG_PRESSURE_PERIOD;
+	periods = clamp(periods, 1UL, (unsigned long)MEMCG_PRESSURE_MAX_PERIODS);
+	elapsed = min(elapsed, MEMCG_PRESSURE_MAX_PERIODS *
+			       (unsigned long)MEMCG_PRESSURE_PERIOD);
+
+	for_each_mem_cgroup(iter)
+		mem_cgroup_pressure_update(iter, periods,
+					   jiffies_to_usecs(elapsed));
+out:
+	schedule_delayed_work(&memcg_pressure_work, MEMCG_PRESSURE_PERIOD);
+}
+
+static int __init mem_cgroup_pressure_init(void)
+{
+	if (mem_cgroup_disabled())
+		return 0;
+	memcg_pressure_stamp = jiffies;
+	INIT_DELAYED_WORK_DEFERRABLE(&memcg_pressure_work,
+				     mem_cgroup_pressure_fn);
+	schedule_delayed_work(&memcg_pressure_work, MEMCG_PRESSURE_PERIOD);
+	return 0;
+}
+__initcall(mem_cgroup_pressure_init);
+
+static int mem_cgroup_pressure_read(struct cgroup *cgrp, struct cftype *cft,
+				    struct seq_file *m)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	static const char * const names[MEMCG_PRESSURE_NR_AVGS] = {
+		"avg10", "avg60", "avg300",
+	};
+	struct mem_cgroup *iter;
+	unsigned long stall = 0;
+	int i;
+
+	for (i = 0; i < MEMCG_PRESSURE_NR_AVGS; i++) {
+		/* round to hundredths of a percent */
+		unsigned long avg = memcg->pressure_avg[i] + FIXED_1/200;
+
+		seq_printf(m, "%s=%lu.%02lu ", names[i], avg >> FSHIFT,
+			   ((avg & (FIXED_1 - 1)) * 100) >> FSHIFT);
+	}
+	for_each_mem_cgroup_tree(iter, memcg)
+		stall += mem_cgroup_read_events(iter, MEM_CGROUP_EVENTS_STALL);
+	seq_printf(m, "total=%lu\n", stall);
+	return 0;
+}
+
+static int mem_cgroup_pressure_register_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd, const char *args)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *event;
+	unsigned long pct;
+	int ret;
+
+	ret = kstrtoul(args, 10, &pct);
+	if (ret)
+		return ret;
+	if (!pct || pct > 100)
+		return -EINVAL;
+
+	event = kmalloc(sizeof(*event), GFP_KERNEL);
+	if (!event)
+		return -ENOMEM;
+
+	event->eventfd = eventfd;
+	event->threshold = pct * FIXED_1;
+	event->signalled = false;
+
+	spin_lock(&memcg_pressure_lock);
+	list_add(&event->list, &memcg->pressure_notify);
+	spin_unlock(&memcg_pressure_lock);
+
+	return 0;
+}
+
+static void mem_cgroup_pressure_unregister_event(struct cgroup *cgrp,
+	struct cftype *cft, struct eventfd_ctx *eventfd)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct mem_cgroup_pressure_event *ev, *tmp;
+
+	spin_lock(&memcg_pressure_lock);
+
+	list_for_each_entry_safe(ev, tmp, &memcg->pressure_notify, list) {
+		if (ev->eventfd == eventfd) {
+			list_del(&ev->list);
+			kfree(ev);
+		}
+	}
+
+	spin_unlock(&memcg_pressure_lock);
+}
+
 static int mem_cgroup_oom_control_read(struct cgroup *cgrp,
 	struct cftype *cft,  struct cgroup_map_cb *cb)
 {
@@ -4685,6 +4926,12 @@ static struct cftype mem_cgroup_files[] = {
 		.unregister_event = mem_cgroup_oom_unregister_event,
 		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
 	},
+	{
+		.name = "pressure",
+		.read_seq_string = mem_cgroup_pressure_read,
+		.register_event = mem_cgroup_pressure_register_event,
+		.unregister_event = mem_cgroup_pressure_unregister_event,
+	},
 #ifdef CONFIG_NUMA
 	{
 		.name = "numa_stat",
@@ -4976,6 +5223,7 @@ mem_cgroup_create(struct cgroup *cont)
 	}
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
+	INIT_LIST_HEAD(&memcg->pressure_notify);
 
 	if (parent)
 		memcg->swappiness = mem_cgroup_swappiness(parent);
@@ -5165,16 +5413,20 @@ static struct page *mc_handle_file_pte(struct vm_area_struct *vma,
 		pgoff = pte_to_pgoff(ptent);
 
 	/* page is moved even if it's not RSS of this task(page-faulted). */
-	page = find_get_page(mapping, pgoff);
-
 #ifdef CONFIG_SWAP
 	/* shmem/tmpfs may report page out on swap: account for that too. */
-	if (radix_tree_exceptional_entry(page)) {
-		swp_entry_t swap = radix_to_swp_entry(page);
-		if (do_swap_account)
-			*entry = swap;
-		page = find_get_page(&swapper_space, swap.val);
-	}
+	if (shmem_mapping(mapping)) {
+		page = find_get_entry(mapping, pgoff);
+		if (radix_tree_exceptional_entry(page)) {
+			swp_entry_t swap = radix_to_swp_entry(page);
+			if (do_swap_account)
+				*entry = swap;
+			page = find_get_page(&swapper_space, swap.val);
+		}
+	} else
+		page = find_get_page(mapping, pgoff);
+#else
+	page = find_get_page(mapping, pgoff);
 #endif
 	return page;
 }
@@ -5235,6 +5487,9 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 	enum mc_target_type ret = MC_TARGET_NONE;
 
 	page = pmd_page(pmd);
+	/* huge page cache is charged and moved page by page */
+	if (!PageAnon(page))
+		return ret;
 	VM_BUG_ON(!page || !PageHead(page));
 	if (!move_anon())
 		return ret;
@@ -51,12 +51,14 @@
 #include <linux/delayacct.h>
 #include <linux/init.h>
 #include <linux/writeback.h>
+#include <linux/backing-dev.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/migrate.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -977,6 +979,207 @@ again:
 	return 0;
 }
 
+#if USE_SPLIT_PTLOCKS
+/*
+ * Copying the page tables of anonymous memory dominates fork of a large
+ * process.  Instead, a pte table lying wholly inside a private anonymous
+ * vma is write protected and installed in the child as it is, with a
+ * reference on the table page for each mm using it, much as hugetlb
+ * shares pmd pages.  Whichever mm first needs to change an entry in it,
+ * on a fault or to unmap, mprotect or move the range, takes a private
+ * copy with unshare_pte_table() first.
+ *
+ * While a table is shared, rmap sees each of its pages mapped once but
+ * every mm using it counts them in its rss.  Table references are taken
+ * and dropped under the split pte lock, which lives in the table page
+ * and so is common to all its users.
+ */
+static inline bool pte_table_shareable(struct vm_area_struct *vma)
+{
+	if (vma->vm_file || !vma->anon_vma)
+		return false;
+	return !(vma->vm_flags & (VM_SHARED | VM_HUGETLB | VM_NONLINEAR |
+				  VM_PFNMAP | VM_MIXEDMAP | VM_INSERTPAGE |
+				  VM_MERGEABLE));
+}
+
+static int share_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			   pmd_t *dst_pmd, pmd_t *src_pmd,
+			   struct vm_area_struct *vma, unsigned long addr)
+{
+	unsigned long end = addr + PMD_SIZE;
+	pte_t *orig_pte, *pte;
+	pgtable_t table;
+	spinlock_t *ptl;
+	int anon = 0;
+
+	orig_pte = pte = pte_offset_map_lock(src_mm, src_pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		if (pte_none(*pte))
+			continue;
+		/* swap and migration entries are left to copy_pte_range */
+		if (!pte_present(*pte))
+			break;
+		/* copy_pte_range would write protect it all the same */
+		if (is_cow_mapping(vma->vm_flags) && pte_write(*pte))
+			ptep_set_wrprotect(src_mm, addr, pte);
+		if (vm_normal_page(vma, addr, *pte))
+			anon++;
+	}
+	if (addr == end) {
+		table = pmd_pgtable(*src_pmd);
+		get_page(pmd_page(*src_pmd));
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	if (addr != end)
+		return -EAGAIN;
+
+	spin_lock(&dst_mm->page_table_lock);
+	dst_mm->nr_ptes++;
+	pmd_populate(dst_mm, dst_pmd, table);
+	spin_unlock(&dst_mm->page_table_lock);
+	add_mm_counter(dst_mm, MM_ANONPAGES, anon);
+	return 0;
+}
+
+/*
+ * Replace the pte table installed at pmd, if it is shared with another mm,
+ * by a private one: a copy, or an empty table when the caller is about to
+ * zap the whole range anyway.  The pmd itself never goes away under a
+ * concurrent fault holding mmap_sem for read.  Called with mmap_sem or the
+ * anon_vma lock held.
+ */
+static int __unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+			       pmd_t *pmd, unsigned long address, bool copy)
+{
+	unsigned long start = address & PMD_MASK;
+	pte_t *src_pte, *dst_pte;
+	pgtable_t new;
+	spinlock_t *ptl;
+	pmd_t orig_pmd;
+	bool replaced = false;
+	int anon = 0;
+	int i;
+
+	new = pte_alloc_one(mm, start);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	orig_pmd = *pmd;
+	if (!pmd_present(orig_pmd) || pmd_trans_huge(orig_pmd))
+		goto out;
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (page_count(pmd_page(orig_pmd)) > 1) {
+		pmd_populate(mm, pmd, new);
+		src_pte = pte_offset_map(&orig_pmd, start);
+		dst_pte = pte_offset_map(pmd, start);
+		for (i = 0; i < PTRS_PER_PTE; i++) {
+			unsigned long addr = start + i * PAGE_SIZE;
+			pte_t pte = src_pte[i];
+			struct page *page;
+
+			if (pte_none(pte))
+				continue;
+			page = vm_normal_page(vma, addr, pte);
+			if (!copy) {
+				if (page)
+					anon++;
+				continue;
+			}
+			if (page) {
+				get_page(page);
+				page_dup_rmap(page);
+			}
+			set_pte_at(mm, addr, dst_pte + i, pte);
+		}
+		pte_unmap(dst_pte);
+		pte_unmap(src_pte);
+		put_page(pmd_page(orig_pmd));
+		replaced = true;
+	}
+	spin_unlock(ptl);
+out:
+	spin_unlock(&mm->page_table_lock);
+
+	if (replaced) {
+		add_mm_counter(mm, MM_ANONPAGES, -anon);
+		flush_tlb_range(vma, start, start + PMD_SIZE);
+	} else
+		pte_free(mm, new);
+	return 0;
+}
+
+int unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+		      pmd_t *pmd, unsigned long address)
+{
+	return __unshare_pte_table(mm, vma, pmd, address, true);
+}
+
+/*
+ * For callers that can not back out half way, such as mprotect.
+ */
+void unshare_pte_table_nofail(struct mm_struct *mm, struct vm_area_struct *vma,
+			      pmd_t *pmd, unsigned long address)
+{
+	while (unshare_pte_table(mm, vma, pmd, address))
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+}
+
+/* As unshare_pte_table(), when the caller has not looked up the pmd. */
+int unshare_pte_table_address(struct vm_area_struct *vma, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(vma->vm_mm, address);
+	if (!pgd_present(*pgd))
+		return 0;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return 0;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd) ||
+	    !pte_table_shared(pmd))
+		return 0;
+	return unshare_pte_table(vma->vm_mm, vma, pmd, address);
+}
+
+/*
+ * Unmapping a shared pte table leaves its entries to the other mms still
+ * using it: this mm only needs an empty table of its own to zap.
+ */
+static void unshare_pte_table_zap(struct mm_struct *mm,
+				  struct vm_area_struct *vma,
+				  pmd_t *pmd, unsigned long addr, bool whole)
+{
+	while (__unshare_pte_table(mm, vma, pmd, addr, !whole))
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+}
+#else
+static inline bool pte_table_shareable(struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline int share_pte_range(struct mm_struct *dst_mm,
+				  struct mm_struct *src_mm,
+				  pmd_t *dst_pmd, pmd_t *src_pmd,
+				  struct vm_area_struct *vma, unsigned long addr)
+{
+	return -EAGAIN;
+}
+
+static inline void unshare_pte_table_zap(struct mm_struct *mm,
+					 struct vm_area_struct *vma,
+					 pmd_t *pmd, unsigned long addr,
+					 bool whole)
+{
+}
+#endif /* USE_SPLIT_PTLOCKS */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -1003,6 +1206,10 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (next - addr == PMD_SIZE && pte_table_shareable(vma) &&
+		    !share_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
+				     vma, addr))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -1110,6 +1317,7 @@ again:
 	init_rss_vec(rss);
 	start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	pte = start_pte;
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -1235,7 +1443,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
 #ifdef CONFIG_DEBUG_VM
-				if (!rwsem_is_locked(&tlb->mm->mmap_sem)) {
+				/* page cache is unmapped under i_mmap_mutex */
+				if (!vma->vm_ops &&
+				    !rwsem_is_locked(&tlb->mm->mmap_sem)) {
 					pr_err("%s: mmap_sem is unlocked! addr=0x%lx end=0x%lx vma->vm_start=0x%lx vma->vm_end=0x%lx\n",
 						__func__, addr, end,
 						vma->vm_start,
@@ -1257,6 +1467,9 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		 */
 		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			goto next;
+		if (unlikely(pte_table_shared(pmd)))
+			unshare_pte_table_zap(tlb->mm, vma, pmd, addr,
+					      next - addr == PMD_SIZE);
 		next = zap_pte_range(tlb, vma, pmd, addr, next, details);
 next:
 		cond_resched();
@@ -1511,7 +1724,10 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto out;
 	}
 	if (pmd_trans_huge(*pmd)) {
-		if (flags & FOLL_SPLIT) {
+		/* huge page cache is mlocked through the small pages */
+		if ((flags & FOLL_SPLIT) ||
+		    ((flags & FOLL_MLOCK) && (vma->vm_flags & VM_LOCKED) &&
+		     vma->vm_ops)) {
 			split_huge_page_pmd(mm, pmd);
 			goto split_fallthrough;
 		}
@@ -2908,6 +3124,7 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct mem_cgroup *ptr;
 	int exclusive = 0;
 	int ret = 0;
+	u64 stall;
 
 	if (!pte_unmap_same(mm, pmd, page_table, orig_pte))
 		goto out;
@@ -2925,10 +3142,11 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	stall = mem_cgroup_stall_start();
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		page = swapin_vma_readahead(entry,
+					GFP_HIGHUSER_MOVABLE, vma, address, pmd);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -2938,6 +3156,7 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 			if (likely(pte_same(*page_table, orig_pte)))
 				ret = VM_FAULT_OOM;
 			delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+			mem_cgroup_stall_end(stall);
 			goto unlock;
 		}
 
@@ -2952,12 +3171,14 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		 */
 		ret = VM_FAULT_HWPOISON;
 		delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+		mem_cgroup_stall_end(stall);
 		goto out_release;
 	}
 
 	locked = lock_page_or_retry(page, mm, flags);
 
 	delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
+	mem_cgroup_stall_end(stall);
 	if (!locked) {
 		ret |= VM_FAULT_RETRY;
 		goto out_release;
@@ -3431,6 +3652,68 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
  * but allow concurrent faults), and pte mapped but not yet locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
  */
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A pte that change_prot_numa() made inaccessible in a vma that does
+ * allow access.  Faults on those are NUMA hinting faults.
+ */
+static inline bool pte_numa(struct vm_area_struct *vma, pte_t pte)
+{
+	if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return false;
+	return pte_same(pte, pte_modify(pte, vma_prot_none(vma)));
+}
+
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			unsigned long addr, pte_t *ptep, pmd_t *pmd, pte_t pte)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	int page_nid, target_nid;
+	int migrated = 0;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, pte))) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	/*
+	 * Make the page accessible again first: the access is going to
+	 * be retried whether or not the page moves.
+	 */
+	pte = pte_modify(pte, vma->vm_page_prot);
+	set_pte_at(mm, addr, ptep, pte);
+	update_mmu_cache(vma, addr, ptep);
+
+	page = vm_normal_page(vma, addr, pte);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	count_vm_numa_event(NUMA_HINT_FAULTS);
+	page_nid = page_to_nid(page);
+	if (page_nid == numa_node_id())
+		count_vm_numa_event(NUMA_HINT_FAULTS_LOCAL);
+
+	get_page(page);
+	pte_unmap_unlock(ptep, ptl);
+
+	target_nid = mpol_misplaced(page, vma, addr);
+	if (target_nid != -1) {
+		migrated = migrate_misplaced_page(page, target_nid);
+		if (migrated)
+			page_nid = target_nid;
+	}
+	put_page(page);
+
+	task_numa_fault(page_nid, 1, migrated);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 int handle_pte_fault(struct mm_struct *mm,
 		     struct vm_area_struct *vma, unsigned long address,
 		     pte_t *pte, pmd_t *pmd, unsigned int flags)
@@ -3439,6 +3722,10 @@ int handle_pte_fault(struct mm_struct *mm,
 	spinlock_t *ptl;
 
 	entry = *pte;
+#ifdef CONFIG_NUMA_BALANCING
+	if (pte_present(entry) && pte_numa(vma, entry))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+#endif
 	if (!pte_present(entry)) {
 		if (pte_none(entry)) {
 			if (vma->vm_ops) {
@@ -3514,10 +3801,17 @@ retry:
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
-		if (!vma->vm_ops)
+	if (pmd_none(*pmd) && !vma->vm_ops) {
+		if (transparent_hugepage_enabled(vma))
 			return do_huge_pmd_anonymous_page(mm, vma, address,
 							  pmd, flags);
+	} else if (pmd_none(*pmd)) {
+		if (transparent_hugepage_file(vma)) {
+			int ret = vma->vm_ops->pmd_fault(vma, address, pmd,
+							 flags);
+			if (!(ret & VM_FAULT_FALLBACK))
+				return ret;
+		}
 	} else {
 		pmd_t orig_pmd = *pmd;
 		int ret;
@@ -3527,6 +3821,14 @@ retry:
 			if (flags & FAULT_FLAG_WRITE &&
 			    !pmd_write(orig_pmd) &&
 			    !pmd_trans_splitting(orig_pmd)) {
+				/*
+				 * Page cache is never copied here, leave
+				 * the write to ->fault and ->page_mkwrite.
+				 */
+				if (vma->vm_ops) {
+					split_huge_page_pmd(mm, pmd);
+					goto retry;
+				}
 				ret = do_huge_pmd_wp_page(mm, vma, address, pmd,
 							  orig_pmd);
 				/*
@@ -3552,6 +3854,10 @@ retry:
 	/* if an huge pmd materialized from under us just retry later */
 	if (unlikely(pmd_trans_huge(*pmd)))
 		return 0;
+	/* a pte table still shared since fork is copied on first fault */
+	if (unlikely(pte_table_shared(pmd)) &&
+	    unshare_pte_table(mm, vma, pmd, address))
+		return VM_FAULT_OOM;
 	/*
 	 * A regular pmd is established and it can't morph into a huge pmd
 	 * from under us anymore at this point because we hold the mmap_sem
@@ -1538,6 +1538,60 @@ struct mempolicy *get_vma_policy(struct task_struct *task,
 	return pol;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Make the present ptes in [addr, end) inaccessible, so that the next
+ * access faults and tells which node the page is used from.  Returns
+ * the number of ptes updated.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long addr, unsigned long end)
+{
+	unsigned long nr_updated;
+
+	nr_updated = change_protection(vma, addr, end, vma_prot_none(vma),
+				       0, 1);
+	if (nr_updated)
+		count_vm_numa_events(NUMA_PTE_UPDATES, nr_updated);
+
+	return nr_updated;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
+/**
+ * mpol_misplaced - check whether current page node is valid in policy
+ *
+ * @page   - page to be checked
+ * @vma    - vm area where page mapped
+ * @addr   - virtual address where page mapped
+ *
+ * Lookup current policy node id for vma,addr and "compare to" page's
+ * node id.  Only the default, local preference is acted upon: a page the
+ * task asked to have placed somewhere with an explicit policy stays put.
+ *
+ * Returns:
+ *	-1	- not misplaced, page is in the right node
+ *	node	- node id where the page should be
+ *
+ * Called from fault path where we know the vma and faulting address.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol;
+	int curnid = page_to_nid(page);
+	int thisnid = numa_node_id();
+	int ret = -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	if (pol->mode == MPOL_PREFERRED && (pol->flags & MPOL_F_LOCAL) &&
+	    curnid != thisnid)
+		ret = thisnid;
+	mpol_cond_put(pol);
+
+	return ret;
+}
+
 /*
  * Return a nodemask representing a mempolicy for filtering nodes for
  * page allocation
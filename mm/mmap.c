@@ -242,6 +242,8 @@ static struct vm_area_struct *remove_vma(struct vm_area_struct *vma)
 }
 
 static unsigned long do_brk(unsigned long addr, unsigned long len);
+static int __do_munmap(struct mm_struct *mm, unsigned long start, size_t len,
+		       bool downgrade);
 
 SYSCALL_DEFINE1(brk, unsigned long, brk)
 {
@@ -286,8 +288,21 @@ SYSCALL_DEFINE1(brk, unsigned long, brk)
 
 	/* Always allow shrinking brk. */
 	if (brk <= mm->brk) {
-		if (!do_munmap(mm, newbrk, oldbrk-newbrk))
-			goto set_brk;
+		unsigned long origbrk = mm->brk;
+		int ret;
+
+		/*
+		 * mm->brk wants the write lock, so update it before the
+		 * unmap may downgrade mmap_sem, and put it back on failure.
+		 */
+		mm->brk = brk;
+		ret = __do_munmap(mm, newbrk, oldbrk-newbrk, true);
+		if (ret < 0)
+			mm->brk = origbrk;
+		else if (ret == 1) {
+			up_read(&mm->mmap_sem);
+			return brk;
+		}
 		goto out;
 	}
 
@@ -1873,11 +1888,12 @@ find_extend_vma(struct mm_struct * mm, unsigned long addr)
 
 /*
  * Ok - we have the memory areas we should free on the vma list,
- * so release them, and do the vma updates.
+ * so take them out of the mm's accounting.
  *
- * Called with the mm semaphore held.
+ * Called with the mm semaphore held for writing.
  */
-static void remove_vma_list(struct mm_struct *mm, struct vm_area_struct *vma)
+static void unaccount_vma_list(struct mm_struct *mm,
+			       struct vm_area_struct *vma)
 {
 	unsigned long nr_accounted = 0;
 
@@ -1889,12 +1905,48 @@ static void remove_vma_list(struct mm_struct *mm, struct vm_area_struct *vma)
 		if (vma->vm_flags & VM_ACCOUNT)
 			nr_accounted += nrpages;
 		vm_stat_account(mm, vma->vm_flags, vma->vm_file, -nrpages);
-		vma = remove_vma(vma);
+		vma = vma->vm_next;
 	} while (vma);
 	vm_unacct_memory(nr_accounted);
+}
+
+/*
+ * Release the detached memory areas.
+ *
+ * Called with the mm semaphore held, for reading is enough.
+ */
+static void remove_vma_list(struct mm_struct *mm, struct vm_area_struct *vma)
+{
+	do {
+		vma = remove_vma(vma);
+	} while (vma);
 	validate_mm(mm);
 }
 
+/*
+ * Once the vmas are off the tree, nobody can find them any more and the
+ * unmapping itself can go on with the mm semaphore downgraded to read,
+ * letting page faults elsewhere in the mm proceed.  Not if a neighbouring
+ * stack could grow into the hole under the read lock, though, or if the
+ * exe_file references, which insist on the write lock, are involved.
+ */
+static bool can_downgrade_munmap(struct mm_struct *mm,
+		struct vm_area_struct *vma, struct vm_area_struct *prev)
+{
+	struct vm_area_struct *next = prev ? prev->vm_next : mm->mmap;
+
+	if (next && (next->vm_flags & VM_GROWSDOWN))
+		return false;
+	if (prev && (prev->vm_flags & VM_GROWSUP))
+		return false;
+
+	for (; vma; vma = vma->vm_next)
+		if (vma->vm_flags & VM_EXECUTABLE)
+			return false;
+
+	return true;
+}
+
 /*
  * Get rid of page table information in the indicated region.
  *
@@ -2042,8 +2094,13 @@ int split_vma(struct mm_struct *mm, struct vm_area_struct *vma,
  * what needs doing, and the areas themselves, which do the
  * work.  This now handles partial unmappings.
  * Jeremy Fitzhardinge <jeremy@goop.org>
+ *
+ * With @downgrade, the mm semaphore may be downgraded to read for the
+ * second part.  Returns 1 if that happened, and the caller has to
+ * up_read() instead of up_write().
  */
-int do_munmap(struct mm_struct *mm, unsigned long start, size_t len)
+static int __do_munmap(struct mm_struct *mm, unsigned long start, size_t len,
+		       bool downgrade)
 {
 	unsigned long end;
 	struct vm_area_struct *vma, *prev, *last;
@@ -2117,12 +2174,24 @@ int do_munmap(struct mm_struct *mm, unsigned long start, size_t len)
 	 * Remove the vma's, and unmap the actual pages
 	 */
 	detach_vmas_to_be_unmapped(mm, vma, prev, end);
+	unaccount_vma_list(mm, vma);
+
+	if (downgrade && can_downgrade_munmap(mm, vma, prev))
+		downgrade_write(&mm->mmap_sem);
+	else
+		downgrade = false;
+
 	unmap_region(mm, vma, prev, start, end);
 
 	/* Fix up all other VM information */
 	remove_vma_list(mm, vma);
 
-	return 0;
+	return downgrade ? 1 : 0;
+}
+
+int do_munmap(struct mm_struct *mm, unsigned long start, size_t len)
+{
+	return __do_munmap(mm, start, len, false);
 }
 
 int vm_munmap(unsigned long start, size_t len)
@@ -2131,7 +2200,11 @@ int vm_munmap(unsigned long start, size_t len)
 	struct mm_struct *mm = current->mm;
 
 	down_write(&mm->mmap_sem);
-	ret = do_munmap(mm, start, len);
+	ret = __do_munmap(mm, start, len, true);
+	if (ret == 1) {
+		up_read(&mm->mmap_sem);
+		return 0;
+	}
 	up_write(&mm->mmap_sem);
 	return ret;
 }
@@ -75,11 +75,26 @@ void __init free_bootmem_late(unsigned long addr, unsigned long size)
 	end = PFN_DOWN(addr + size);
 
 	for (; cursor < end; cursor++) {
-		__free_pages_bootmem(pfn_to_page(cursor), 0);
+		/* the deferred struct page init frees it with the rest */
+		if (early_page_uninitialised(cursor))
+			memblock_free(PFN_PHYS(cursor), PAGE_SIZE);
+		else
+			__free_pages_bootmem(pfn_to_page(cursor), 0);
 		totalram_pages++;
 	}
 }
 
+/*
+ * Pages whose struct page is not initialised yet are left to
+ * deferred_init_memmap(), which frees them when it gets there.
+ */
+static void __init __free_pages_boot_pfn(unsigned long pfn, int order)
+{
+	if (early_page_uninitialised(pfn))
+		return;
+	__free_pages_bootmem(pfn_to_page(pfn), order);
+}
+
 static void __init __free_pages_memory(unsigned long start, unsigned long end)
 {
 	unsigned long i, start_aligned, end_aligned;
@@ -90,19 +105,19 @@ static void __init __free_pages_memory(unsigned long start, unsigned long end)
 
 	if (end_aligned <= start_aligned) {
 		for (i = start; i < end; i++)
-			__free_pages_bootmem(pfn_to_page(i), 0);
+			__free_pages_boot_pfn(i, 0);
 
 		return;
 	}
 
 	for (i = start; i < start_aligned; i++)
-		__free_pages_bootmem(pfn_to_page(i), 0);
+		__free_pages_boot_pfn(i, 0);
 
 	for (i = start_aligned; i < end_aligned; i += BITS_PER_LONG)
-		__free_pages_bootmem(pfn_to_page(i), order);
+		__free_pages_boot_pfn(i, order);
 
 	for (i = end_aligned; i < end; i++)
-		__free_pages_bootmem(pfn_to_page(i), 0);
+		__free_pages_boot_pfn(i, 0);
 }
 
 static unsigned long __init __free_memory_core(phys_addr_t start,
@@ -1179,6 +1179,54 @@ static long bdi_min_pause(struct backing_dev_info *bdi,
 	return pages >= DIRTY_POLL_THRESH ? 1 + t / 2 : t;
 }
 
+/*
+ * The write limit, in pages per second, of the blkio cgroup of the current
+ * task on the device behind @mapping, or 0 if it has none.  Writeback of
+ * the pages the task dirties is charged to that cgroup by submit_bio().
+ */
+static unsigned long cgroup_dirty_ratelimit(struct address_space *mapping)
+{
+	struct inode *inode = mapping->host;
+	struct block_device *bdev = inode->i_sb->s_bdev;
+
+	if (!bdev || !S_ISREG(inode->i_mode) ||
+	    (current->flags & PF_KTHREAD))
+		return 0;
+
+	return blk_throtl_dirty_ratelimit(bdev_get_queue(bdev));
+}
+
+/*
+ * Below the freerun ceiling the bdi does not throttle anybody.  A task
+ * whose writeback is limited by its cgroup could then dirty pages much
+ * faster than they can be written and fill up the global dirty limit,
+ * which everybody else is throttled against, with its pages alone.  Keep
+ * it at its cgroup's write rate instead.
+ */
+static void cgroup_dirty_pause(unsigned long ratelimit,
+			       unsigned long pages_dirtied)
+{
+	unsigned long now = jiffies;
+	long period = HZ * pages_dirtied / ratelimit;
+	long pause = period;
+
+	if (current->dirty_paused_when)
+		pause -= now - current->dirty_paused_when;
+
+	if (pause <= 0) {
+		if (pause < -HZ)
+			current->dirty_paused_when = now;
+		else
+			current->dirty_paused_when += period;
+		return;
+	}
+
+	pause = min_t(long, pause, MAX_PAUSE);
+	__set_current_state(TASK_KILLABLE);
+	io_schedule_timeout(pause);
+	current->dirty_paused_when = now + pause;
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -1207,6 +1255,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 	unsigned long dirty_ratelimit;
 	unsigned long pos_ratio;
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long cg_ratelimit = cgroup_dirty_ratelimit(mapping);
 	unsigned long start_time = jiffies;
 
 	for (;;) {
@@ -1232,10 +1281,18 @@ static void balance_dirty_pages(struct address_space *mapping,
 		freerun = dirty_freerun_ceiling(dirty_thresh,
 						background_thresh);
 		if (nr_dirty <= freerun) {
-			current->dirty_paused_when = now;
+			if (cg_ratelimit)
+				cgroup_dirty_pause(cg_ratelimit, pages_dirtied);
+			else
+				current->dirty_paused_when = now;
 			current->nr_dirtied = 0;
 			current->nr_dirtied_pause =
 				dirty_poll_interval(nr_dirty, dirty_thresh);
+			if (cg_ratelimit)
+				current->nr_dirtied_pause =
+					min_t(unsigned long,
+					      current->nr_dirtied_pause,
+					      cg_ratelimit * MAX_PAUSE / HZ + 1);
 			break;
 		}
 
@@ -1292,6 +1349,9 @@ static void balance_dirty_pages(struct address_space *mapping,
 					       bdi_thresh, bdi_dirty);
 		task_ratelimit = ((u64)dirty_ratelimit * pos_ratio) >>
 							RATELIMIT_CALC_SHIFT;
+		/* never faster than the cgroup's writeback may go */
+		if (cg_ratelimit && task_ratelimit > cg_ratelimit)
+			task_ratelimit = cg_ratelimit;
 		max_pause = bdi_max_pause(bdi, bdi_dirty);
 		min_pause = bdi_min_pause(bdi, max_pause,
 					  task_ratelimit, dirty_ratelimit,
@@ -1983,6 +2043,69 @@ void account_page_writeback(struct page *page)
 }
 EXPORT_SYMBOL(account_page_writeback);
 
+/*
+ * Take the tag lock covering @page in @mapping, interrupts are disabled.
+ * The index of a swap cache page goes away with the page leaving the swap
+ * cache, so make sure it is still the one we locked for.
+ */
+static spinlock_t *lock_page_tag(struct address_space *mapping,
+				 struct page *page, pgoff_t *indexp)
+{
+	spinlock_t *tag_lock;
+	pgoff_t index;
+
+	for (;;) {
+		index = page_index(page);
+		tag_lock = mapping_tag_lock(mapping, index);
+		spin_lock(tag_lock);
+		if (likely(page_index(page) == index))
+			break;
+		spin_unlock(tag_lock);
+	}
+
+	*indexp = index;
+	return tag_lock;
+}
+
+/*
+ * Tag a newly dirtied page in its radix tree and account for it, unless
+ * it was truncated in the meantime.  Returns false in that case.
+ *
+ * The tag lock keeps truncation away, and suffices for tagging as long as
+ * the page is not the first dirty one in its radix tree leaf: only then
+ * do the upper levels of the tree need tagging, under the tree_lock.
+ */
+bool tag_page_dirty(struct page *page, struct address_space *mapping)
+{
+	struct address_space *mapping2;
+	spinlock_t *tag_lock;
+	pgoff_t index;
+
+	local_irq_disable();
+	tag_lock = lock_page_tag(mapping, page, &index);
+	mapping2 = page_mapping(page);
+	if (mapping2 && !radix_tree_tag_set_leaf(&mapping->page_tree, index,
+						 PAGECACHE_TAG_DIRTY)) {
+		spin_unlock(tag_lock);
+		spin_lock(&mapping->tree_lock);
+		tag_lock = lock_page_tag(mapping, page, &index);
+		mapping2 = page_mapping(page);
+		if (mapping2)
+			radix_tree_tag_set(&mapping->page_tree, index,
+					   PAGECACHE_TAG_DIRTY);
+		spin_unlock(&mapping->tree_lock);
+	}
+	if (mapping2) { /* Race with truncate? */
+		BUG_ON(mapping2 != mapping);
+		account_page_dirtied(page, mapping);
+	}
+	spin_unlock(tag_lock);
+	local_irq_enable();
+
+	return mapping2 != NULL;
+}
+EXPORT_SYMBOL(tag_page_dirty);
+
 /*
  * For address_spaces which do not use buffers.  Just tag the page as dirty in
  * its radix tree.
@@ -1996,27 +2119,18 @@ EXPORT_SYMBOL(account_page_writeback);
  * mapping is pinned by the vma's ->vm_file reference.
  *
  * We take care to handle the case where the page was truncated from the
- * mapping by re-checking page_mapping() inside tree_lock.
+ * mapping by re-checking page_mapping() inside the tag lock.
  */
 int __set_page_dirty_nobuffers(struct page *page)
 {
 	if (!TestSetPageDirty(page)) {
 		struct address_space *mapping = page_mapping(page);
-		struct address_space *mapping2;
 
 		if (!mapping)
 			return 1;
 
-		spin_lock_irq(&mapping->tree_lock);
-		mapping2 = page_mapping(page);
-		if (mapping2) { /* Race with truncate? */
-			BUG_ON(mapping2 != mapping);
+		if (tag_page_dirty(page, mapping))
 			WARN_ON_ONCE(!PagePrivate(page) && !PageUptodate(page));
-			account_page_dirtied(page, mapping);
-			radix_tree_tag_set(&mapping->page_tree,
-				page_index(page), PAGECACHE_TAG_DIRTY);
-		}
-		spin_unlock_irq(&mapping->tree_lock);
 		if (mapping->host) {
 			/* !PageAnon && !swapper_space */
 			__mark_inode_dirty(mapping->host, I_DIRTY_PAGES);
@@ -2198,20 +2312,35 @@ int test_clear_page_writeback(struct page *page)
 
 	if (mapping) {
 		struct backing_dev_info *bdi = mapping->backing_dev_info;
+		spinlock_t *tag_lock;
 		unsigned long flags;
+		pgoff_t index;
 
-		spin_lock_irqsave(&mapping->tree_lock, flags);
+		/*
+		 * The tag goes first: once the tag lock is dropped to take
+		 * the tree_lock, the page may already be under writeback
+		 * again if PG_writeback was cleared.  A page that is not
+		 * under writeback carries no writeback tag either.
+		 */
+		local_irq_save(flags);
+		tag_lock = lock_page_tag(mapping, page, &index);
+		if (!radix_tree_tag_clear_leaf(&mapping->page_tree, index,
+					       PAGECACHE_TAG_WRITEBACK)) {
+			/* the last one in its leaf, the tree needs updating */
+			spin_unlock(tag_lock);
+			spin_lock(&mapping->tree_lock);
+			tag_lock = lock_page_tag(mapping, page, &index);
+			radix_tree_tag_clear(&mapping->page_tree, index,
+					     PAGECACHE_TAG_WRITEBACK);
+			spin_unlock(&mapping->tree_lock);
+		}
 		ret = TestClearPageWriteback(page);
-		if (ret) {
-			radix_tree_tag_clear(&mapping->page_tree,
-						page_index(page),
-						PAGECACHE_TAG_WRITEBACK);
-			if (bdi_cap_account_writeback(bdi)) {
-				__dec_bdi_stat(bdi, BDI_WRITEBACK);
-				__bdi_writeout_inc(bdi);
-			}
+		if (ret && bdi_cap_account_writeback(bdi)) {
+			__dec_bdi_stat(bdi, BDI_WRITEBACK);
+			__bdi_writeout_inc(bdi);
 		}
-		spin_unlock_irqrestore(&mapping->tree_lock, flags);
+		spin_unlock(tag_lock);
+		local_irq_restore(flags);
 	} else {
 		ret = TestClearPageWriteback(page);
 	}
@@ -2229,23 +2358,25 @@ int test_set_page_writeback(struct page *page)
 
 	if (mapping) {
 		struct backing_dev_info *bdi = mapping->backing_dev_info;
+		spinlock_t *tag_lock;
 		unsigned long flags;
+		pgoff_t index;
 
 		spin_lock_irqsave(&mapping->tree_lock, flags);
+		tag_lock = lock_page_tag(mapping, page, &index);
 		ret = TestSetPageWriteback(page);
 		if (!ret) {
-			radix_tree_tag_set(&mapping->page_tree,
-						page_index(page),
+			radix_tree_tag_set(&mapping->page_tree, index,
 						PAGECACHE_TAG_WRITEBACK);
 			if (bdi_cap_account_writeback(bdi))
 				__inc_bdi_stat(bdi, BDI_WRITEBACK);
 		}
 		if (!PageDirty(page))
-			radix_tree_tag_clear(&mapping->page_tree,
-						page_index(page),
+			radix_tree_tag_clear(&mapping->page_tree, index,
 						PAGECACHE_TAG_DIRTY);
-		radix_tree_tag_clear(&mapping->page_tree,
-				     page_index(page),
+		spin_unlock(tag_lock);
+		/* the towrite tag is only ever touched under tree_lock */
+		radix_tree_tag_clear(&mapping->page_tree, index,
 				     PAGECACHE_TAG_TOWRITE);
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
 	} else {
@@ -19,6 +19,12 @@
 #include <linux/pagemap.h>
 #include <linux/syscalls.h>
 #include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/mmu_context.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
 
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
@@ -179,7 +185,7 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
 		page = page_cache_alloc_readahead(mapping);
@@ -237,6 +243,142 @@ int force_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	return ret;
 }
 
+/*
+ * Asynchronous readahead, for madvise(MADV_WILLNEED) and
+ * fadvise(POSIX_FADV_WILLNEED): the ranges are collected in a batch and
+ * read from a worker under one plug, while the caller goes on.  The
+ * worker borrows the caller's mm so that the page cache gets charged
+ * where it would have been for a synchronous readahead.  Too many
+ * batches in flight, or none to be had, and the caller reads itself.
+ */
+#define ASYNC_RA_RANGES		16
+#define ASYNC_RA_MAX_PENDING	64
+
+struct async_readahead {
+	struct work_struct work;
+	struct mm_struct *mm;
+	int nr;
+	struct {
+		struct file *filp;
+		pgoff_t offset;
+		unsigned long nr_to_read;
+	} range[ASYNC_RA_RANGES];
+};
+
+static atomic_t async_ra_pending = ATOMIC_INIT(0);
+
+static void async_readahead_work(struct work_struct *work)
+{
+	struct async_readahead *ra;
+	struct blk_plug plug;
+	int i;
+
+	ra = container_of(work, struct async_readahead, work);
+
+	use_mm(ra->mm);
+	blk_start_plug(&plug);
+	for (i = 0; i < ra->nr; i++) {
+		struct file *filp = ra->range[i].filp;
+
+		force_page_cache_readahead(filp->f_mapping, filp,
+					   ra->range[i].offset,
+					   ra->range[i].nr_to_read);
+		fput(filp);
+	}
+	blk_finish_plug(&plug);
+	unuse_mm(ra->mm);
+
+	mmput(ra->mm);
+	kfree(ra);
+	atomic_dec(&async_ra_pending);
+}
+
+static struct async_readahead *async_readahead_alloc(void)
+{
+	struct async_readahead *ra;
+
+	if (!current->mm)
+		return NULL;
+	if (atomic_inc_return(&async_ra_pending) > ASYNC_RA_MAX_PENDING)
+		goto fail;
+
+	ra = kmalloc(sizeof(*ra), GFP_KERNEL | __GFP_NOWARN);
+	if (!ra)
+		goto fail;
+
+	INIT_WORK(&ra->work, async_readahead_work);
+	atomic_inc(&current->mm->mm_users);
+	ra->mm = current->mm;
+	ra->nr = 0;
+	return ra;
+fail:
+	atomic_dec(&async_ra_pending);
+	return NULL;
+}
+
+/**
+ * async_readahead - queue readahead of a file range
+ * @rap: the batch to add the range to, started if NULL
+ * @filp: file to read
+ * @offset: first page index
+ * @nr_to_read: number of pages
+ *
+ * The batch is read once it is handed to async_readahead_submit(), or
+ * when it fills up.  If no batch can be started, the range is read right
+ * away instead.
+ */
+void async_readahead(struct async_readahead **rap, struct file *filp,
+		     pgoff_t offset, unsigned long nr_to_read)
+{
+	struct address_space *mapping = filp->f_mapping;
+	struct async_readahead *ra = *rap;
+
+	if (unlikely(!mapping->a_ops->readpage && !mapping->a_ops->readpages))
+		return;
+
+	if (ra) {
+		int last = ra->nr - 1;
+
+		/* neighbouring vmas of one file continue the range */
+		if (ra->range[last].filp == filp &&
+		    ra->range[last].offset + ra->range[last].nr_to_read ==
+		    offset) {
+			ra->range[last].nr_to_read += nr_to_read;
+			return;
+		}
+		if (ra->nr == ASYNC_RA_RANGES) {
+			async_readahead_submit(ra);
+			*rap = ra = NULL;
+		}
+	}
+
+	if (!ra) {
+		ra = async_readahead_alloc();
+		if (!ra) {
+			force_page_cache_readahead(mapping, filp, offset,
+						   nr_to_read);
+			return;
+		}
+		*rap = ra;
+	}
+
+	get_file(filp);
+	ra->range[ra->nr].filp = filp;
+	ra->range[ra->nr].offset = offset;
+	ra->range[ra->nr].nr_to_read = nr_to_read;
+	ra->nr++;
+}
+
+/**
+ * async_readahead_submit - start reading a batch of ranges
+ * @ra: the batch filled by async_readahead(), may be NULL
+ */
+void async_readahead_submit(struct async_readahead *ra)
+{
+	if (ra)
+		queue_work(system_unbound_wq, &ra->work);
+}
+
 /*
  * Given a desired number of PAGE_CACHE_SIZE readahead pages, return a
  * sensible upper limit.
@@ -351,7 +493,7 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
@@ -391,6 +533,78 @@ static int try_context_readahead(struct address_space *mapping,
 	return 1;
 }
 
+/*
+ * Interleaved streams: several readers of one file each read sequentially,
+ * but at their own offsets, and keep thrashing the one readahead window of
+ * the file.  So besides the window in @ra, a few more streams are kept:
+ * when a read continues one of them, it is swapped in to become current,
+ * and when a new stream starts, the current one is pushed into the table in
+ * place of the least recently used.  Each stream ramps up on its own.
+ */
+static bool ra_stream_continues(struct file_ra_stream *s, pgoff_t offset)
+{
+	if (!s->size)
+		return false;
+	if (offset == s->start + s->size - s->async_size ||
+	    offset == s->start + s->size)
+		return true;
+	/* sequential cache miss */
+	return s->prev_pos >= 0 &&
+	       offset - (s->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL;
+}
+
+static void ra_get_stream(struct file_ra_state *ra, struct file_ra_stream *s)
+{
+	s->start = ra->start;
+	s->size = ra->size;
+	s->async_size = ra->async_size;
+	s->prev_pos = ra->prev_pos;
+}
+
+static void ra_set_stream(struct file_ra_state *ra, struct file_ra_stream *s)
+{
+	ra->start = s->start;
+	ra->size = s->size;
+	ra->async_size = s->async_size;
+	ra->prev_pos = s->prev_pos;
+}
+
+/*
+ * Remember @s, the state of a stream that stopped being current.
+ */
+static void ra_push_stream(struct file_ra_state *ra, struct file_ra_stream *s)
+{
+	if (!s->size)
+		return;
+	memmove(&ra->streams[1], &ra->streams[0],
+		(RA_STREAMS - 1) * sizeof(ra->streams[0]));
+	ra->streams[0] = *s;
+}
+
+/*
+ * Make the remembered stream continued by @offset current, if there is one.
+ */
+static bool ra_switch_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct file_ra_stream cur, next;
+	int i;
+
+	for (i = 0; i < RA_STREAMS; i++) {
+		if (!ra_stream_continues(&ra->streams[i], offset))
+			continue;
+
+		next = ra->streams[i];
+		memmove(&ra->streams[1], &ra->streams[0],
+			i * sizeof(ra->streams[0]));
+		ra_get_stream(ra, &cur);
+		ra->streams[0] = cur;
+		ra_set_stream(ra, &next);
+		return true;
+	}
+
+	return false;
+}
+
 /*
  * A minimal readahead algorithm for trivial sequential/random reads.
  */
@@ -401,6 +615,12 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	const char *pattern = "initial";
+	struct file_ra_stream cur;
+	bool new_stream = true;
+
+	/* the current stream, in case a new one replaces it */
+	ra_get_stream(ra, &cur);
 
 	/*
 	 * start of file
@@ -408,12 +628,25 @@ ondemand_readahead(struct address_space *mapping,
 	if (!offset)
 		goto initial_readahead;
 
+	/*
+	 * Not the current stream, but maybe one of the others.  Once it
+	 * is swapped in, it gets treated like the current one.
+	 */
+	if (!ra_stream_continues(&cur, offset) &&
+	    ra_switch_stream(ra, offset)) {
+		pattern = "stream";
+		new_stream = false;
+	}
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		if (new_stream)
+			pattern = "sequential";
+		new_stream = false;
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
@@ -426,16 +659,17 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the pagecache for async_size, which normally equals to
 	 * readahead size. Ramp it up and use it as the new readahead size.
 	 */
-	if (hit_readahead_marker) {
+	if (hit_readahead_marker && new_stream) {
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset + 1, max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
 			return 0;
 
+		pattern = "marker";
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -453,20 +687,26 @@ ondemand_readahead(struct address_space *mapping,
 	/*
 	 * sequential cache miss
 	 */
-	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
+	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL) {
+		new_stream = false;
 		goto initial_readahead;
+	}
 
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = "context";
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
 	 * Read as is, and do not pollute the readahead state.
 	 */
+	trace_mm_readahead(mapping, offset, req_size, hit_readahead_marker,
+			   "random", ra);
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
@@ -485,6 +725,12 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	/* a new stream took over, keep the old one around */
+	if (new_stream)
+		ra_push_stream(ra, &cur);
+
+	trace_mm_readahead(mapping, offset, req_size, hit_readahead_marker,
+			   pattern, ra);
 	return ra_submit(ra, mapping, filp);
 }
 
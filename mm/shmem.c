@@ -64,6 +64,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/khugepaged.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -105,6 +106,12 @@ enum sgp_type {
 	SGP_FALLOC,	/* like SGP_WRITE, but make existing page Uptodate */
 };
 
+/* When to allocate huge pages, the tmpfs huge= mount option */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_ALWAYS	1	/* whenever a huge page range is empty */
+#define SHMEM_HUGE_WITHIN_SIZE	2	/* only if the range is below i_size */
+#define SHMEM_HUGE_ADVISE	3	/* only in MADV_HUGEPAGE mappings */
+
 #ifdef CONFIG_TMPFS
 static unsigned long shmem_default_max_blocks(void)
 {
@@ -159,10 +166,11 @@ static inline void shmem_unacct_size(unsigned long flags, loff_t size)
  * shmem_getpage reports shmem_acct_block failure as -ENOSPC not -ENOMEM,
  * so that a failure on a sparse tmpfs mapping will give SIGBUS not OOM.
  */
-static inline int shmem_acct_block(unsigned long flags)
+static inline int shmem_acct_block(unsigned long flags, long pages)
 {
 	return (flags & VM_NORESERVE) ?
-		security_vm_enough_memory_mm(current->mm, VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+		security_vm_enough_memory_mm(current->mm,
+					pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
@@ -417,6 +425,11 @@ static void shmem_deswap_pagevec(struct pagevec *pvec)
 	pvec->nr = j;
 }
 
+bool shmem_mapping(struct address_space *mapping)
+{
+	return mapping->backing_dev_info == &shmem_backing_dev_info;
+}
+
 /*
  * SysV IPC SHM_UNLOCK restore Unevictable pages to their evictable lists.
  */
@@ -980,6 +993,234 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge page in tmpfs is a naturally aligned run of HPAGE_PMD_NR pages
+ * which are physically contiguous too, but otherwise ordinary page cache
+ * pages: they are allocated as one high order page and then split, so
+ * that swap, truncation and migration keep working on small pages.  Such
+ * a run can be mapped with a single pmd, see shmem_pmd_fault().
+ */
+#ifdef CONFIG_NUMA
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	/* Bias interleave by inode number to distribute better across nodes */
+	pvma.vm_pgoff = index + info->vfs_inode.i_ino;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, index);
+
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0, numa_node_id());
+}
+#else
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
+
+static inline gfp_t shmem_huge_gfp(gfp_t gfp)
+{
+	return (gfp | __GFP_NORETRY | __GFP_NOWARN | __GFP_ZERO) & ~__GFP_COMP;
+}
+
+/*
+ * Should the huge page range around @index be allocated in one go?
+ * @vma is NULL for read(), write() and friends.
+ */
+static bool shmem_huge_index(struct inode *inode, pgoff_t index,
+			     struct vm_area_struct *vma)
+{
+	loff_t end;
+
+	if (vma && (vma->vm_flags & VM_NOHUGEPAGE))
+		return false;
+
+	switch (SHMEM_SB(inode->i_sb)->huge) {
+	case SHMEM_HUGE_ALWAYS:
+		return true;
+	case SHMEM_HUGE_WITHIN_SIZE:
+		end = (loff_t)round_up(index + 1, HPAGE_PMD_NR) <<
+			PAGE_CACHE_SHIFT;
+		return end <= i_size_read(inode);
+	case SHMEM_HUGE_ADVISE:
+		return vma && (vma->vm_flags & VM_HUGEPAGE);
+	default:
+		return false;
+	}
+}
+
+/*
+ * Fill the empty huge page range around @index with a contiguous run of
+ * zeroed pages.  Returns 0 on success, after which the caller looks the
+ * page up again, or an error if it should go on with a single page.
+ */
+static int shmem_alloc_huge(struct inode *inode, pgoff_t index, gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	pgoff_t hindex = round_down(index, HPAGE_PMD_NR);
+	struct radix_tree_iter iter;
+	struct page *page;
+	void **slot;
+	int i, nr, error;
+
+	if (hindex + HPAGE_PMD_NR - 1 > (MAX_LFS_FILESIZE >> PAGE_CACHE_SHIFT))
+		return -EFBIG;
+
+	/* nothing at all, not even swap, may be there */
+	error = 0;
+	rcu_read_lock();
+	radix_tree_for_each_slot(slot, &mapping->page_tree, &iter, hindex) {
+		if (iter.index < hindex + HPAGE_PMD_NR)
+			error = -EEXIST;
+		break;
+	}
+	rcu_read_unlock();
+	if (error)
+		return error;
+
+	if (shmem_acct_block(info->flags, HPAGE_PMD_NR))
+		return -ENOSPC;
+	if (sbinfo->max_blocks) {
+		if (percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0) {
+			error = -ENOSPC;
+			goto unacct;
+		}
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	page = shmem_alloc_hugepage(shmem_huge_gfp(gfp), info, hindex);
+	if (!page) {
+		error = -ENOMEM;
+		goto decused;
+	}
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		SetPageSwapBacked(page + i);
+		__set_page_locked(page + i);
+		SetPageUptodate(page + i);
+	}
+	for (nr = 0; nr < HPAGE_PMD_NR; nr++) {
+		error = mem_cgroup_cache_charge(page + nr, current->mm,
+						gfp & GFP_RECLAIM_MASK);
+		if (error)
+			break;
+		error = radix_tree_preload(gfp & GFP_RECLAIM_MASK);
+		if (!error) {
+			error = shmem_add_to_page_cache(page + nr, mapping,
+						hindex + nr, gfp, NULL);
+			radix_tree_preload_end();
+		}
+		if (error) {
+			mem_cgroup_uncharge_cache_page(page + nr);
+			break;
+		}
+	}
+
+	if (!error) {
+		for (i = 0; i < HPAGE_PMD_NR; i++)
+			lru_cache_add_anon(page + i);
+
+		spin_lock(&info->lock);
+		info->alloced += HPAGE_PMD_NR;
+		inode->i_blocks += HPAGE_PMD_NR * BLOCKS_PER_PAGE;
+		shmem_recalc_inode(inode);
+		spin_unlock(&info->lock);
+		count_vm_event(THP_FILE_ALLOC);
+	} else {
+		for (i = 0; i < nr; i++)
+			delete_from_page_cache(page + i);
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+	if (!error)
+		return 0;
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -HPAGE_PMD_NR);
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+	return error;
+}
+
+static const char *shmem_huge_names[] = {
+	[SHMEM_HUGE_NEVER]	= "never",
+	[SHMEM_HUGE_ALWAYS]	= "always",
+	[SHMEM_HUGE_WITHIN_SIZE] = "within_size",
+	[SHMEM_HUGE_ADVISE]	= "advise",
+};
+
+static int __maybe_unused shmem_parse_huge(const char *str)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(shmem_huge_names); i++)
+		if (sysfs_streq(str, shmem_huge_names[i]))
+			return i;
+	return -EINVAL;
+}
+
+#ifdef CONFIG_SYSFS
+/*
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled is the huge= option
+ * of the internal mount, used by SysV shm and shared anonymous mappings.
+ */
+static ssize_t shmem_enabled_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	int huge = SHMEM_SB(shm_mnt->mnt_sb)->huge;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(shmem_huge_names); i++)
+		len += sprintf(buf + len, i == huge ? "%s[%s]" : "%s%s",
+			       i ? " " : "", shmem_huge_names[i]);
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static ssize_t shmem_enabled_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	int huge = shmem_parse_huge(buf);
+
+	if (huge < 0)
+		return -EINVAL;
+	if (huge != SHMEM_HUGE_NEVER && !has_transparent_hugepage())
+		return -EINVAL;
+	SHMEM_SB(shm_mnt->mnt_sb)->huge = huge;
+	return count;
+}
+
+struct kobj_attribute shmem_enabled_attr =
+	__ATTR(shmem_enabled, 0644, shmem_enabled_show, shmem_enabled_store);
+#endif /* CONFIG_SYSFS */
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+static inline bool shmem_huge_index(struct inode *inode, pgoff_t index,
+				    struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline int shmem_alloc_huge(struct inode *inode, pgoff_t index,
+				   gfp_t gfp)
+{
+	return -EINVAL;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 /*
  * When a page is moved from swapcache to shmem filecache (either by the
  * usual swapin of shmem_getpage_gfp(), or by the less common swapoff of
@@ -1086,7 +1327,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 		return -EFBIG;
 repeat:
 	swap.val = 0;
-	page = find_lock_page(mapping, index);
+	page = find_lock_entry(mapping, index);
 	if (radix_tree_exceptional_entry(page)) {
 		swap = radix_to_swp_entry(page);
 		page = NULL;
@@ -1120,7 +1361,7 @@ repeat:
 
 	if (swap.val) {
 		/* Look it up and read it in.. */
-		page = lookup_swap_cache(swap);
+		page = lookup_swap_cache(swap, NULL, 0);
 		if (!page) {
 			/* here we actually do the io */
 			if (fault_type)
@@ -1172,7 +1413,11 @@ repeat:
 		swap_free(swap);
 
 	} else {
-		if (shmem_acct_block(info->flags)) {
+		if (shmem_huge_index(inode, index, NULL) && sgp != SGP_FALLOC &&
+		    !shmem_alloc_huge(inode, index, gfp))
+			goto repeat;
+
+		if (shmem_acct_block(info->flags, 1)) {
 			error = -ENOSPC;
 			goto failed;
 		}
@@ -1303,6 +1548,209 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Huge pmds are only used for shared mappings: a private mapping would
+ * need its own copy of the range on the first write anyway.  Nonlinear
+ * and mlocked vmas stick to ptes as well.
+ */
+bool shmem_huge_enabled(struct vm_area_struct *vma)
+{
+	struct address_space *mapping;
+
+	if (!vma->vm_file ||
+	    (vma->vm_flags & (VM_SHARED | VM_NONLINEAR | VM_LOCKED)) !=
+	    VM_SHARED || (vma->vm_flags & VM_NOHUGEPAGE))
+		return false;
+	mapping = vma->vm_file->f_mapping;
+	if (mapping->a_ops != &shmem_aops)
+		return false;
+	return SHMEM_SB(mapping->host->i_sb)->huge != SHMEM_HUGE_NEVER;
+}
+
+static void shmem_unlock_huge(struct page *page, int nr)
+{
+	while (nr--) {
+		unlock_page(page + nr);
+		page_cache_release(page + nr);
+	}
+}
+
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	struct inode *inode = mapping->host;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *head, *page;
+	pgoff_t index;
+	int nr, error;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end ||
+	    !shmem_huge_enabled(vma))
+		return VM_FAULT_FALLBACK;
+	index = linear_page_index(vma, haddr);
+	if ((index & (HPAGE_PMD_NR - 1)) ||
+	    !shmem_huge_index(inode, index, vma))
+		return VM_FAULT_FALLBACK;
+	/* a pmd must not map anything beyond the end of the file */
+	if ((loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT >
+	    i_size_read(inode))
+		return VM_FAULT_FALLBACK;
+
+	head = find_lock_entry(mapping, index);
+	if (!head) {
+		if (shmem_alloc_huge(inode, index, mapping_gfp_mask(mapping)))
+			return VM_FAULT_FALLBACK;
+		head = find_lock_entry(mapping, index);
+	}
+	if (!head || radix_tree_exceptional_entry(head))
+		return VM_FAULT_FALLBACK;
+	if ((page_to_pfn(head) & (HPAGE_PMD_NR - 1)) || !PageUptodate(head)) {
+		shmem_unlock_huge(head, 1);
+		return VM_FAULT_FALLBACK;
+	}
+
+	/* the whole run must still be in place, in order */
+	for (nr = 1; nr < HPAGE_PMD_NR; nr++) {
+		page = find_lock_entry(mapping, index + nr);
+		if (page != head + nr) {
+			if (page && !radix_tree_exceptional_entry(page)) {
+				unlock_page(page);
+				page_cache_release(page);
+			}
+			break;
+		}
+		if (!PageUptodate(page)) {
+			nr++;
+			break;
+		}
+	}
+	if (nr < HPAGE_PMD_NR ||
+	    (loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT >
+	    i_size_read(inode)) {
+		shmem_unlock_huge(head, nr);
+		return VM_FAULT_FALLBACK;
+	}
+
+	error = do_set_huge_pmd(vma, haddr, pmd, head);
+	shmem_unlock_huge(head, HPAGE_PMD_NR);
+
+	if (error == -ENOMEM)
+		return VM_FAULT_OOM;
+	if (!error)
+		count_vm_event(THP_FILE_MAPPED);
+	/* -EAGAIN: the pmd was populated meanwhile, just retry */
+	return 0;
+}
+
+/**
+ * shmem_collapse_huge - replace a huge page range with a contiguous run
+ * @mapping:	tmpfs or shmem mapping
+ * @index:	first page of the range, aligned to HPAGE_PMD_NR
+ *
+ * For khugepaged: a fully populated range is copied to a new run of
+ * contiguous pages, one page at a time, so giving up halfway leaves
+ * nothing inconsistent behind.  The range gets unmapped everywhere and is
+ * refaulted, with a pmd where possible.  Returns 1 if the range has been
+ * collapsed, 0 if it was contiguous already, or a negative error.
+ */
+int shmem_collapse_huge(struct address_space *mapping, pgoff_t index)
+{
+	struct inode *inode = mapping->host;
+	struct page **pages, *new;
+	int i, nr, locked, done = 0;
+	int ret;
+
+	if (mapping->a_ops != &shmem_aops || (index & (HPAGE_PMD_NR - 1)))
+		return -EINVAL;
+	if ((loff_t)(index + HPAGE_PMD_NR) << PAGE_CACHE_SHIFT >
+	    i_size_read(inode))
+		return -EINVAL;
+
+	pages = kmalloc(HPAGE_PMD_NR * sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	nr = find_get_pages_contig(mapping, index, HPAGE_PMD_NR, pages);
+	ret = -EAGAIN;
+	if (nr < HPAGE_PMD_NR)
+		goto out;
+	for (i = 1; i < HPAGE_PMD_NR; i++)
+		if (pages[i] != pages[0] + i)
+			break;
+	ret = 0;
+	if (i == HPAGE_PMD_NR &&
+	    !(page_to_pfn(pages[0]) & (HPAGE_PMD_NR - 1)))
+		goto out;
+
+	new = shmem_alloc_hugepage(shmem_huge_gfp(mapping_gfp_mask(mapping)),
+				   SHMEM_I(inode), index);
+	ret = -ENOMEM;
+	if (!new)
+		goto out;
+	split_page(new, HPAGE_PMD_ORDER);
+	count_vm_event(THP_FILE_ALLOC);
+
+	ret = -EAGAIN;
+	for (locked = 0; locked < HPAGE_PMD_NR; locked++) {
+		struct page *page = pages[locked];
+
+		lock_page(page);
+		if (page->mapping != mapping ||
+		    page->index != index + locked ||
+		    !PageUptodate(page) || PageWriteback(page) ||
+		    PageMlocked(page)) {
+			unlock_page(page);
+			goto out_unlock;
+		}
+	}
+
+	unmap_mapping_range(mapping, (loff_t)index << PAGE_CACHE_SHIFT,
+			    HPAGE_PMD_SIZE, 0);
+	lru_add_drain();
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		/* the page cache and us, not even gup may hold a reference */
+		if (page_mapped(pages[i]) || page_count(pages[i]) != 2)
+			goto out_unlock;
+	}
+
+	ret = 1;
+	for (; done < HPAGE_PMD_NR; done++) {
+		struct page *page = pages[done];
+		struct page *newpage = new + done;
+
+		copy_highpage(newpage, page);
+		SetPageSwapBacked(newpage);
+		SetPageUptodate(newpage);
+		__set_page_locked(newpage);
+		if (replace_page_cache_page(page, newpage, GFP_KERNEL)) {
+			__clear_page_locked(newpage);
+			ret = -ENOMEM;
+			break;
+		}
+		set_page_dirty(newpage);
+		lru_cache_add_anon(newpage);
+		unlock_page(newpage);
+		page_cache_release(newpage);
+		unlock_page(page);
+		page_cache_release(page);
+	}
+
+	/* whatever is left of either run is let go */
+out_unlock:
+	for (i = done; i < locked; i++)
+		unlock_page(pages[i]);
+	for (i = done; i < HPAGE_PMD_NR; i++)
+		page_cache_release(new + i);
+out:
+	for (i = done; i < nr; i++)
+		page_cache_release(pages[i]);
+	kfree(pages);
+	return ret;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -1351,9 +1799,60 @@ static int shmem_mmap(struct file *file, struct vm_area_struct *vma)
 	file_accessed(file);
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+	if (shmem_huge_enabled(vma))
+		return khugepaged_enter_file(vma);
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Place mappings of huge enabled tmpfs so that file offsets and virtual
+ * addresses line up on huge page boundaries, or no pmd could ever map
+ * them.  This asks for a larger area and picks the right spot inside.
+ */
+static unsigned long shmem_get_unmapped_area(struct file *file,
+		unsigned long uaddr, unsigned long len,
+		unsigned long pgoff, unsigned long flags)
+{
+	unsigned long (*get_area)(struct file *, unsigned long,
+				  unsigned long, unsigned long, unsigned long);
+	unsigned long addr, offset, inflated_len;
+	unsigned long inflated_addr, inflated_offset;
+
+	get_area = current->mm->get_unmapped_area;
+	addr = get_area(file, uaddr, len, pgoff, flags);
+
+	if (IS_ERR_VALUE(addr) || (flags & MAP_FIXED) || uaddr == addr)
+		return addr;
+	if (len < HPAGE_PMD_SIZE || addr & ~PAGE_MASK ||
+	    addr > TASK_SIZE - len)
+		return addr;
+	if (SHMEM_SB(file->f_mapping->host->i_sb)->huge == SHMEM_HUGE_NEVER)
+		return addr;
+
+	offset = (pgoff << PAGE_SHIFT) & (HPAGE_PMD_SIZE - 1);
+	if (offset && offset + len < 2 * HPAGE_PMD_SIZE)
+		return addr;
+	if ((addr & (HPAGE_PMD_SIZE - 1)) == offset)
+		return addr;
+
+	inflated_len = len + HPAGE_PMD_SIZE - PAGE_SIZE;
+	if (inflated_len > TASK_SIZE || inflated_len < len)
+		return addr;
+	inflated_addr = get_area(NULL, 0, inflated_len, 0, flags);
+	if (IS_ERR_VALUE(inflated_addr) || inflated_addr & ~PAGE_MASK)
+		return addr;
+
+	inflated_offset = inflated_addr & (HPAGE_PMD_SIZE - 1);
+	inflated_addr += offset - inflated_offset;
+	if (inflated_offset > offset)
+		inflated_addr += HPAGE_PMD_SIZE;
+	if (inflated_addr > TASK_SIZE - len)
+		return addr;
+	return inflated_addr;
+}
+#endif
+
 static struct inode *shmem_get_inode(struct super_block *sb, const struct inode *dir,
 				     umode_t mode, dev_t dev, unsigned long flags)
 {
@@ -2501,6 +3000,17 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+
+			if (huge < 0)
+				goto bad_val;
+			if (huge != SHMEM_HUGE_NEVER &&
+			    !has_transparent_hugepage())
+				goto bad_val;
+			sbinfo->huge = huge;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2546,6 +3056,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2572,6 +3083,10 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 		seq_printf(seq, ",gid=%u",
 				from_kgid_munged(&init_user_ns, sbinfo->gid));
 	shmem_show_mpol(seq, sbinfo->mpol);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=%s", shmem_huge_names[sbinfo->huge]);
+#endif
 	return 0;
 }
 #endif /* CONFIG_TMPFS */
@@ -2711,6 +3226,9 @@ static const struct address_space_operations shmem_aops = {
 
 static const struct file_operations shmem_file_operations = {
 	.mmap		= shmem_mmap,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.get_unmapped_area = shmem_get_unmapped_area,
+#endif
 #ifdef CONFIG_TMPFS
 	.llseek		= generic_file_llseek,
 	.read		= do_sync_read,
@@ -2784,6 +3302,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2801,6 +3322,7 @@ static struct file_system_type shmem_fs_type = {
 	.name		= "tmpfs",
 	.mount		= shmem_mount,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 
 int __init shmem_init(void)
@@ -2858,6 +3380,7 @@ static struct file_system_type shmem_fs_type = {
 	.name		= "tmpfs",
 	.mount		= ramfs_mount,
 	.kill_sb	= kill_litter_super,
+	.fs_flags	= FS_PARALLEL_LOOKUP,
 };
 
 int __init shmem_init(void)
@@ -2880,6 +3403,11 @@ int shmem_lock(struct file *file, int lock, struct user_struct *user)
 	return 0;
 }
 
+bool shmem_mapping(struct address_space *mapping)
+{
+	return false;
+}
+
 void shmem_unlock_mapping(struct address_space *mapping)
 {
 }
@@ -2982,6 +3510,8 @@ int shmem_zero_setup(struct vm_area_struct *vma)
 	vma->vm_file = file;
 	vma->vm_ops = &shmem_vm_ops;
 	vma->vm_flags |= VM_CAN_NONLINEAR;
+	if (shmem_huge_enabled(vma))
+		return khugepaged_enter_file(vma);
 	return 0;
 }
 
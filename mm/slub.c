@@ -225,6 +225,28 @@ static inline void stat(const struct kmem_cache *s, enum stat_item si)
 #endif
 }
 
+/*
+ * Unlike stat() this may be called with preemption enabled, the fastpath
+ * count is taken right after the lockless cmpxchg.
+ */
+static inline void alloc_stat(const struct kmem_cache *s,
+			      enum alloc_stat_item si)
+{
+#ifdef CONFIG_SLUB_ALLOC_STATS
+	this_cpu_inc(s->cpu_slab->astat[si]);
+#endif
+}
+
+static inline void lock_node(struct kmem_cache *s, struct kmem_cache_node *n)
+{
+#ifdef CONFIG_SLUB_ALLOC_STATS
+	if (spin_trylock(&n->list_lock))
+		return;
+	alloc_stat(s, ASTAT_LIST_LOCK_CONTENDED);
+#endif
+	spin_lock(&n->list_lock);
+}
+
 /********************************************************************
  * 			Core slab cache functions
  *******************************************************************/
@@ -1543,7 +1565,7 @@ static void *get_partial_node(struct kmem_cache *s,
 	if (!n || !n->nr_partial)
 		return NULL;
 
-	spin_lock(&n->list_lock);
+	lock_node(s, n);
 	list_for_each_entry_safe(page, page2, &n->partial, lru) {
 		void *t = acquire_slab(s, n, page, object == NULL);
 		int available;
@@ -1806,7 +1828,7 @@ redo:
 			 * that acquire_slab() will see a slab page that
 			 * is frozen
 			 */
-			spin_lock(&n->list_lock);
+			lock_node(s, n);
 		}
 	} else {
 		m = M_FULL;
@@ -1817,7 +1839,7 @@ redo:
 			 * slabs from diagnostic functions will not see
 			 * any frozen slabs.
 			 */
-			spin_lock(&n->list_lock);
+			lock_node(s, n);
 		}
 	}
 
@@ -1884,7 +1906,7 @@ static void unfreeze_partials(struct kmem_cache *s)
 				spin_unlock(&n->list_lock);
 
 			n = n2;
-			spin_lock(&n->list_lock);
+			lock_node(s, n);
 		}
 
 		do {
@@ -2295,6 +2317,29 @@ new_slab:
 	return freelist;
 }
 
+#ifdef CONFIG_SLUB_ALLOC_STATS
+/*
+ * Bucket 0 is below 128ns, bucket n covers [2^(n+6), 2^(n+7)) ns, the last
+ * one takes everything above.
+ */
+static void *slab_alloc_timed(struct kmem_cache *s, gfp_t gfpflags, int node,
+			      unsigned long addr, struct kmem_cache_cpu *c)
+{
+	u64 start = local_clock();
+	void *object = __slab_alloc(s, gfpflags, node, addr, c);
+	u64 delta = local_clock() - start;
+	int i = 0;
+
+	if (delta >> 7)
+		i = min_t(int, ilog2(delta) - 6, SLUB_LAT_BUCKETS - 1);
+	this_cpu_inc(s->cpu_slab->slow_lat[i]);
+	alloc_stat(s, ASTAT_SLOWPATH);
+	return object;
+}
+#else
+#define slab_alloc_timed __slab_alloc
+#endif
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -2338,7 +2383,7 @@ redo:
 	object = c->freelist;
 	page = c->page;
 	if (unlikely(!object || !node_match(page, node)))
-		object = __slab_alloc(s, gfpflags, node, addr, c);
+		object = slab_alloc_timed(s, gfpflags, node, addr, c);
 
 	else {
 		void *next_object = get_freepointer_safe(s, object);
@@ -2365,6 +2410,7 @@ redo:
 		}
 		prefetch_freepointer(s, next_object);
 		stat(s, ALLOC_FASTPATH);
+		alloc_stat(s, ASTAT_FASTPATH);
 	}
 
 	if (unlikely(gfpflags & __GFP_ZERO) && object)
@@ -2483,7 +2529,8 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 				 * Otherwise the list_lock will synchronize with
 				 * other processors updating the list of slabs.
 				 */
-				spin_lock_irqsave(&n->list_lock, flags);
+				local_irq_save(flags);
+				lock_node(s, n);
 
 			}
 		}
@@ -5090,6 +5137,97 @@ STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
 STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
+#ifdef CONFIG_SLUB_ALLOC_STATS
+static int show_alloc_stat(struct kmem_cache *s, char *buf,
+			   enum alloc_stat_item si)
+{
+	unsigned long sum = 0;
+	int cpu;
+	int len;
+
+	for_each_online_cpu(cpu)
+		sum += per_cpu_ptr(s->cpu_slab, cpu)->astat[si];
+
+	len = sprintf(buf, "%lu", sum);
+
+#ifdef CONFIG_SMP
+	for_each_online_cpu(cpu) {
+		unsigned long x = per_cpu_ptr(s->cpu_slab, cpu)->astat[si];
+
+		if (x && len < PAGE_SIZE - 30)
+			len += sprintf(buf + len, " C%d=%lu", cpu, x);
+	}
+#endif
+	return len + sprintf(buf + len, "\n");
+}
+
+static void clear_alloc_stat(struct kmem_cache *s, enum alloc_stat_item si)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		per_cpu_ptr(s->cpu_slab, cpu)->astat[si] = 0;
+}
+
+#define ALLOC_STAT_ATTR(si, text)				\
+static ssize_t text##_show(struct kmem_cache *s, char *buf)	\
+{								\
+	return show_alloc_stat(s, buf, si);			\
+}								\
+static ssize_t text##_store(struct kmem_cache *s,		\
+				const char *buf, size_t length)	\
+{								\
+	if (buf[0] != '0')					\
+		return -EINVAL;					\
+	clear_alloc_stat(s, si);				\
+	return length;						\
+}								\
+SLAB_ATTR(text);						\
+
+ALLOC_STAT_ATTR(ASTAT_FASTPATH, alloc_fast_hits);
+ALLOC_STAT_ATTR(ASTAT_SLOWPATH, alloc_slow_entries);
+ALLOC_STAT_ATTR(ASTAT_LIST_LOCK_CONTENDED, list_lock_contended);
+
+/*
+ * One line per bucket: the lower bound in nanoseconds and the number of
+ * slowpath allocations that took at least that long.
+ */
+static ssize_t alloc_slow_latency_show(struct kmem_cache *s, char *buf)
+{
+	int len = 0;
+	int i;
+
+	for (i = 0; i < SLUB_LAT_BUCKETS; i++) {
+		unsigned long sum = 0;
+		int cpu;
+
+		for_each_online_cpu(cpu)
+			sum += per_cpu_ptr(s->cpu_slab, cpu)->slow_lat[i];
+
+		len += sprintf(buf + len, "%lu %lu\n",
+			       i ? 1UL << (i + 6) : 0UL, sum);
+	}
+	return len;
+}
+
+static ssize_t alloc_slow_latency_store(struct kmem_cache *s,
+				const char *buf, size_t length)
+{
+	int cpu;
+
+	if (buf[0] != '0')
+		return -EINVAL;
+
+	for_each_online_cpu(cpu) {
+		struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+
+		memset(c->slow_lat, 0, sizeof(c->slow_lat));
+	}
+	return length;
+}
+SLAB_ATTR(alloc_slow_latency);
+#endif
+
 static struct attribute *slab_attrs[] = {
 	&slab_size_attr.attr,
 	&object_size_attr.attr,
@@ -5156,6 +5294,12 @@ static struct attribute *slab_attrs[] = {
 	&cpu_partial_node_attr.attr,
 	&cpu_partial_drain_attr.attr,
 #endif
+#ifdef CONFIG_SLUB_ALLOC_STATS
+	&alloc_fast_hits_attr.attr,
+	&alloc_slow_entries_attr.attr,
+	&list_lock_contended_attr.attr,
+	&alloc_slow_latency_attr.attr,
+#endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
 #endif
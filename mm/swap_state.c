@@ -18,6 +18,8 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/swapfile.h>
+#include <linux/pfn.h>
 
 #include <asm/pgtable.h>
 
@@ -39,6 +41,8 @@ static struct backing_dev_info swap_backing_dev_info = {
 struct address_space swapper_space = {
 	.page_tree	= RADIX_TREE_INIT(GFP_ATOMIC|__GFP_NOWARN),
 	.tree_lock	= __SPIN_LOCK_UNLOCKED(swapper_space.tree_lock),
+	.tag_lock	= { [0 ... PAGECACHE_TAG_LOCKS - 1] =
+			    __SPIN_LOCK_UNLOCKED(swapper_space.tag_lock) },
 	.a_ops		= &swap_aops,
 	.i_mmap_nonlinear = LIST_HEAD_INIT(swapper_space.i_mmap_nonlinear),
 	.backing_dev_info = &swap_backing_dev_info,
@@ -122,13 +126,18 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp_mask)
  */
 void __delete_from_swap_cache(struct page *page)
 {
+	spinlock_t *tag_lock;
+
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(!PageSwapCache(page));
 	VM_BUG_ON(PageWriteback(page));
 
+	tag_lock = mapping_tag_lock(&swapper_space, page_private(page));
+	spin_lock(tag_lock);
 	radix_tree_delete(&swapper_space.page_tree, page_private(page));
 	set_page_private(page, 0);
 	ClearPageSwapCache(page);
+	spin_unlock(tag_lock);
 	total_swapcache_pages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	INC_CACHE_INFO(del_total);
@@ -253,37 +262,102 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
 	}
 }
 
+/*
+ * VMA based swap readahead.  The swap slots next to a faulting one were
+ * often written out together with it from some other process, but the
+ * neighbouring virtual addresses of the faulting vma are the ones likely
+ * to fault next.  So on solid state swap, where reading scattered slots
+ * costs no seeks, the readahead window is taken from the page table.
+ *
+ * vma->swap_readahead_info keeps the address of the last fault in the vma,
+ * the readahead window used for it, and how many pages read ahead have
+ * been hit since.  Pages read ahead carry PG_readahead until they're hit.
+ */
+int swap_vma_readahead __read_mostly = 1;
+
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Upper bound of the window, however large page-cluster is */
+#define SWAP_RA_ORDER_CEILING	5
+
+static bool swap_use_vma_readahead(swp_entry_t entry)
+{
+	return swap_vma_readahead &&
+	       (swap_info[swp_type(entry)]->flags & SWP_SOLIDSTATE);
+}
+
+static void swap_ra_hit(struct vm_area_struct *vma, unsigned long addr)
+{
+	unsigned long ra_val = atomic_long_read(&vma->swap_readahead_info);
+	unsigned long hits = SWAP_RA_HITS(ra_val);
+
+	if (hits < SWAP_RA_HITS_MAX)
+		hits++;
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(addr, SWAP_RA_WIN(ra_val), hits));
+}
+
 /*
  * Lookup a swap entry in the swap cache. A found page will be returned
  * unlocked and with its refcount incremented - we rely on the kernel
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
+ *
+ * @vma and @addr, if given, are the faulting user address, to credit
+ * the vma's swap readahead with a hit on a page it read ahead.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page * lookup_swap_cache(swp_entry_t entry,
+				struct vm_area_struct *vma, unsigned long addr)
 {
 	struct page *page;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
 
+		/* PG_readahead is PG_reclaim, which writeback uses */
+		if (!PageWriteback(page) && TestClearPageReadahead(page)) {
+			count_vm_event(SWAP_RA_HIT);
+			if (vma)
+				swap_ra_hit(vma, addr);
+		}
+	}
+
 	INC_CACHE_INFO(find_total);
 	return page;
 }
 
-/* 
+/*
  * Locate a page of swap in physical memory, reserving swap cache space
  * and reading the disk if it is not already cached.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
+ *
+ * *@new_page_allocated tells whether the page returned is being read in
+ * for this call, rather than found in the swap cache.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
 
+	*new_page_allocated = false;
+
 	do {
 		/*
 		 * First check the swap cache.  Since this is normally
@@ -334,6 +408,7 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			 */
 			lru_cache_add_anon(new_page);
 			swap_readpage(new_page);
+			*new_page_allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -351,6 +426,15 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool page_was_allocated;
+
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr,
+				       &page_was_allocated);
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -399,3 +483,142 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
+
+/*
+ * Size the readahead window for a fault at @pfn, following one at
+ * @prev_pfn that used a window of @prev_win pages and had @hits hits.
+ */
+static unsigned int swap_ra_nr_pages(unsigned long prev_pfn,
+				     unsigned long pfn, unsigned int hits,
+				     unsigned int max_pages,
+				     unsigned int prev_win)
+{
+	unsigned int pages, last_ra;
+
+	/*
+	 * Without hits, only read ahead when the fault continues the
+	 * previous one: that looks like the start of a sequential access.
+	 */
+	pages = hits + 2;
+	if (pages == 2) {
+		if (pfn != prev_pfn + 1 && pfn != prev_pfn - 1)
+			pages = 1;
+	} else {
+		unsigned int roundup = 4;
+
+		while (roundup < pages)
+			roundup <<= 1;
+		pages = roundup;
+	}
+
+	if (pages > max_pages)
+		pages = max_pages;
+
+	/* Don't shrink readahead too fast */
+	last_ra = prev_win / 2;
+	if (pages < last_ra)
+		pages = last_ra;
+
+	return pages;
+}
+
+/**
+ * swapin_vma_readahead - swap in pages of neighbouring virtual addresses
+ * @fentry: swap entry of the faulting pte
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma the fault is in
+ * @faddr: faulting address
+ * @pmd: pmd the faulting pte is in
+ *
+ * Returns the struct page for @fentry and @faddr, after queueing swapin.
+ *
+ * Reads ahead the swap entries found in the ptes around @faddr, within
+ * @vma and the page table the fault is in.  The window follows the
+ * direction of the faults in @vma, and sizes itself by how many of the
+ * pages read ahead for them were hit.  Falls back to swapin_readahead()
+ * where that is disabled or the swap device is rotational.
+ *
+ * Caller must hold down_read on the vma->vm_mm, and must not hold the
+ * pte lock.
+ */
+struct page *swapin_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long faddr,
+			pmd_t *pmd)
+{
+	swp_entry_t entries[1 << SWAP_RA_ORDER_CEILING];
+	unsigned long addrs[1 << SWAP_RA_ORDER_CEILING];
+	unsigned long ra_val, fpfn, prev_pfn, start, end, pfn, left;
+	unsigned int max_win, win, nr = 0, i;
+	struct blk_plug plug;
+	pte_t *pte;
+
+	if (!swap_use_vma_readahead(fentry))
+		return swapin_readahead(fentry, gfp_mask, vma, faddr);
+
+	max_win = 1 << min(page_cluster, SWAP_RA_ORDER_CEILING);
+
+	faddr &= PAGE_MASK;
+	fpfn = PFN_DOWN(faddr);
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	prev_pfn = PFN_DOWN(SWAP_RA_ADDR(ra_val));
+	win = swap_ra_nr_pages(prev_pfn, fpfn, SWAP_RA_HITS(ra_val),
+			       max_win, SWAP_RA_WIN(ra_val));
+	atomic_long_set(&vma->swap_readahead_info,
+			SWAP_RA_VAL(faddr, win, 0));
+
+	if (win == 1)
+		goto skip;
+
+	/* Forwards, backwards, or around the fault if no direction yet */
+	if (fpfn == prev_pfn + 1)
+		left = 0;
+	else if (fpfn == prev_pfn - 1)
+		left = win - 1;
+	else
+		left = (win - 1) / 2;
+
+	start = max3(fpfn - min(left, fpfn), PFN_DOWN(vma->vm_start),
+		     PFN_DOWN(faddr & PMD_MASK));
+	end = min3(fpfn - min(left, fpfn) + win, PFN_DOWN(vma->vm_end),
+		   PFN_DOWN((faddr & PMD_MASK) + PMD_SIZE));
+
+	/* Copy the entries: the page table may go once it is unmapped */
+	pte = pte_offset_map(pmd, start << PAGE_SHIFT);
+	for (pfn = start; pfn < end; pfn++) {
+		pte_t pteval = pte[pfn - start];
+		swp_entry_t entry;
+
+		if (pfn == fpfn || pte_none(pteval) || pte_present(pteval) ||
+		    pte_file(pteval))
+			continue;
+		entry = pte_to_swp_entry(pteval);
+		if (non_swap_entry(entry) ||
+		    swp_type(entry) != swp_type(fentry))
+			continue;
+		entries[nr] = entry;
+		addrs[nr] = pfn << PAGE_SHIFT;
+		nr++;
+	}
+	pte_unmap(pte);
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		struct page *page;
+		bool page_allocated;
+
+		page = __read_swap_cache_async(entries[i], gfp_mask, vma,
+					       addrs[i], &page_allocated);
+		if (!page)
+			continue;
+		if (page_allocated) {
+			SetPageReadahead(page);
+			count_vm_event(SWAP_RA);
+		}
+		page_cache_release(page);
+	}
+	blk_finish_plug(&plug);
+
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
+	return read_swap_cache_async(fentry, gfp_mask, vma, faddr);
+}
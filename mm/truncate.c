@@ -183,6 +183,64 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+static void clear_shadow_entry(struct address_space *mapping,
+			       pgoff_t index, void *entry)
+{
+	struct radix_tree_node *node;
+	void **slot;
+
+	if (__radix_tree_lookup(&mapping->page_tree, index,
+				&node, &slot) != entry)
+		return;
+	/* The node must be off the shadow node list before it is freed */
+	if (node) {
+		workingset_node_shadows_dec(node);
+		if (!workingset_node_shadows(node) &&
+		    !list_empty(&node->private_list))
+			list_lru_del(&workingset_shadow_nodes,
+				     &node->private_list);
+	}
+	radix_tree_delete_item(&mapping->page_tree, index, entry);
+	mapping->nrshadows--;
+}
+
+/*
+ * Drop the shadow entries of evicted pages in [start, end].  The lookup
+ * returns pages as well, so this is only worth it once the pages are gone.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	void *entries[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	unsigned int i, nr;
+
+	while (index <= end && mapping->nrshadows) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		for (i = 0; i < nr; i++)
+			entries[i] = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+		for (i = 0; i < nr; i++) {
+			if (indices[i] > end)
+				break;
+			if (!radix_tree_exceptional_entry(entries[i]))
+				continue;
+			clear_shadow_entry(mapping, indices[i], entries[i]);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		if (i < nr || !nr)
+			break;
+		index = indices[nr - 1] + 1;
+		if (!index)
+			break;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages_range - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -214,7 +272,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_invalidate_inode(mapping);
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -292,6 +350,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	truncate_shadow_entries(mapping, start, end);
 	cleancache_invalidate_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -400,7 +459,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
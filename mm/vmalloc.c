@@ -52,6 +52,8 @@ static void vunmap_pmd_range(pud_t *pud, unsigned long addr, unsigned long end)
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_clear_huge(pmd))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		vunmap_pte_range(pmd, addr, next);
@@ -113,8 +115,37 @@ static int vmap_pte_range(pmd_t *pmd, unsigned long addr,
 	return 0;
 }
 
-static int vmap_pmd_range(pud_t *pud, unsigned long addr,
+/*
+ * Map a whole pmd with one large page, if the pages that go there are
+ * physically contiguous and aligned.  Returns 1 if it did.
+ */
+static int vmap_try_huge_pmd(pmd_t *pmd, unsigned long addr,
 		unsigned long end, pgprot_t prot, struct page **pages, int *nr)
+{
+	unsigned long pfn;
+	int i;
+
+	if (end - addr != PMD_SIZE)
+		return 0;
+
+	pfn = page_to_pfn(pages[*nr]);
+	if (!IS_ALIGNED(pfn, PTRS_PER_PTE))
+		return 0;
+	for (i = 1; i < PTRS_PER_PTE; i++)
+		if (page_to_pfn(pages[*nr + i]) != pfn + i)
+			return 0;
+
+	if (!pmd_free_pte_page(pmd, addr) ||
+	    !pmd_set_huge(pmd, (phys_addr_t)pfn << PAGE_SHIFT, prot))
+		return 0;
+
+	*nr += PTRS_PER_PTE;
+	return 1;
+}
+
+static int vmap_pmd_range(pud_t *pud, unsigned long addr,
+		unsigned long end, pgprot_t prot, struct page **pages, int *nr,
+		bool huge)
 {
 	pmd_t *pmd;
 	unsigned long next;
@@ -124,6 +155,8 @@ static int vmap_pmd_range(pud_t *pud, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		if (huge && vmap_try_huge_pmd(pmd, addr, next, prot, pages, nr))
+			continue;
 		if (vmap_pte_range(pmd, addr, next, prot, pages, nr))
 			return -ENOMEM;
 	} while (pmd++, addr = next, addr != end);
@@ -131,7 +164,8 @@ static int vmap_pmd_range(pud_t *pud, unsigned long addr,
 }
 
 static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
-		unsigned long end, pgprot_t prot, struct page **pages, int *nr)
+		unsigned long end, pgprot_t prot, struct page **pages, int *nr,
+		bool huge)
 {
 	pud_t *pud;
 	unsigned long next;
@@ -141,7 +175,7 @@ static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
 		return -ENOMEM;
 	do {
 		next = pud_addr_end(addr, end);
-		if (vmap_pmd_range(pud, addr, next, prot, pages, nr))
+		if (vmap_pmd_range(pud, addr, next, prot, pages, nr, huge))
 			return -ENOMEM;
 	} while (pud++, addr = next, addr != end);
 	return 0;
@@ -152,9 +186,14 @@ static int vmap_pud_range(pgd_t *pgd, unsigned long addr,
  * will have pfns corresponding to the "pages" array.
  *
  * Ie. pte at addr+N*PAGE_SIZE shall point to pfn corresponding to pages[N]
+ *
+ * With @huge, a pmd worth of pages that are physically contiguous and
+ * aligned gets mapped with a single large page instead, where the arch
+ * supports it.  The range must then never be unmapped piecemeal.
  */
-static int vmap_page_range_noflush(unsigned long start, unsigned long end,
-				   pgprot_t prot, struct page **pages)
+static int __vmap_page_range_noflush(unsigned long start, unsigned long end,
+				     pgprot_t prot, struct page **pages,
+				     bool huge)
 {
 	pgd_t *pgd;
 	unsigned long next;
@@ -166,7 +205,7 @@ static int vmap_page_range_noflush(unsigned long start, unsigned long end,
 	pgd = pgd_offset_k(addr);
 	do {
 		next = pgd_addr_end(addr, end);
-		err = vmap_pud_range(pgd, addr, next, prot, pages, &nr);
+		err = vmap_pud_range(pgd, addr, next, prot, pages, &nr, huge);
 		if (err)
 			return err;
 	} while (pgd++, addr = next, addr != end);
@@ -174,6 +213,12 @@ static int vmap_page_range_noflush(unsigned long start, unsigned long end,
 	return nr;
 }
 
+static int vmap_page_range_noflush(unsigned long start, unsigned long end,
+				   pgprot_t prot, struct page **pages)
+{
+	return __vmap_page_range_noflush(start, end, prot, pages, false);
+}
+
 static int vmap_page_range(unsigned long start, unsigned long end,
 			   pgprot_t prot, struct page **pages)
 {
@@ -218,6 +263,11 @@ struct page *vmalloc_to_page(const void *vmalloc_addr)
 		pud_t *pud = pud_offset(pgd, addr);
 		if (!pud_none(*pud)) {
 			pmd_t *pmd = pmd_offset(pud, addr);
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+			if (pmd_large(*pmd))
+				return pmd_page(*pmd) +
+					((addr & ~PMD_MASK) >> PAGE_SHIFT);
+#endif
 			if (!pmd_none(*pmd)) {
 				pte_t *ptep, pte;
 
@@ -1273,7 +1323,9 @@ int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
 	unsigned long end = addr + area->size - PAGE_SIZE;
 	int err;
 
-	err = vmap_page_range(addr, end, prot, *pages);
+	err = __vmap_page_range_noflush(addr, end, prot, *pages,
+					area->flags & VM_HUGE_PMD);
+	flush_cache_vmap(addr, end);
 	if (err > 0) {
 		*pages += err;
 		err = 0;
@@ -1585,12 +1637,70 @@ EXPORT_SYMBOL(vmap);
 static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    gfp_t gfp_mask, pgprot_t prot,
 			    int node, const void *caller);
+#ifdef CONFIG_HAVE_ARCH_HUGE_VMAP
+static int vmap_allow_huge __read_mostly = 1;
+
+static int __init set_nohugevmalloc(char *str)
+{
+	vmap_allow_huge = 0;
+	return 0;
+}
+early_param("nohugevmalloc", set_nohugevmalloc);
+
+#define VMAP_PMD_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#else
+#define vmap_allow_huge	0
+#define VMAP_PMD_ORDER	0
+#endif
+
+/*
+ * Allocate the pages backing pages[i] onwards.  For a VM_HUGE_PMD area,
+ * whose start is pmd aligned, a whole pmd is tried as one high order
+ * page first, split so that every page in the array stands on its own.
+ */
+static unsigned int vmalloc_alloc_pages(struct vm_struct *area,
+					unsigned int i, gfp_t gfp_mask,
+					int node)
+{
+	struct page *page = NULL;
+	unsigned int order = 0, j;
+
+	if ((area->flags & VM_HUGE_PMD) &&
+	    IS_ALIGNED(i, 1 << VMAP_PMD_ORDER) &&
+	    area->nr_pages - i >= 1 << VMAP_PMD_ORDER) {
+		order = VMAP_PMD_ORDER;
+		if (node < 0)
+			page = alloc_pages(gfp_mask | __GFP_NORETRY, order);
+		else
+			page = alloc_pages_node(node, gfp_mask | __GFP_NORETRY,
+						order);
+		if (page)
+			split_page(page, order);
+		else
+			order = 0;
+	}
+
+	if (!page) {
+		if (node < 0)
+			page = alloc_page(gfp_mask);
+		else
+			page = alloc_pages_node(node, gfp_mask, 0);
+		if (unlikely(!page))
+			return 0;
+	}
+
+	for (j = 0; j < 1 << order; j++)
+		area->pages[i + j] = page + j;
+
+	return 1 << order;
+}
+
 static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 				 pgprot_t prot, int node, const void *caller)
 {
 	const int order = 0;
 	struct page **pages;
-	unsigned int nr_pages, array_size, i;
+	unsigned int nr_pages, array_size, i, nr;
 	gfp_t nested_gfp = (gfp_mask & GFP_RECLAIM_MASK) | __GFP_ZERO;
 
 	nr_pages = (area->size - PAGE_SIZE) >> PAGE_SHIFT;
@@ -1613,21 +1723,14 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		return NULL;
 	}
 
-	for (i = 0; i < area->nr_pages; i++) {
-		struct page *page;
-		gfp_t tmp_mask = gfp_mask | __GFP_NOWARN;
-
-		if (node < 0)
-			page = alloc_page(tmp_mask);
-		else
-			page = alloc_pages_node(node, tmp_mask, order);
-
-		if (unlikely(!page)) {
+	for (i = 0; i < area->nr_pages; i += nr) {
+		nr = vmalloc_alloc_pages(area, i, gfp_mask | __GFP_NOWARN,
+					 node);
+		if (unlikely(!nr)) {
 			/* Successfully allocated i pages, free them in __vunmap() */
 			area->nr_pages = i;
 			goto fail;
 		}
-		area->pages[i] = page;
 	}
 
 	if (map_vm_area(area, prot, &pages))
@@ -1664,12 +1767,24 @@ void *__vmalloc_node_range(unsigned long size, unsigned long align,
 	struct vm_struct *area;
 	void *addr;
 	unsigned long real_size = size;
+	unsigned long flags = VM_ALLOC | VM_UNLIST;
 
 	size = PAGE_ALIGN(size);
 	if (!size || (size >> PAGE_SHIFT) > totalram_pages)
 		goto fail;
 
-	area = __get_vm_area_node(size, align, VM_ALLOC | VM_UNLIST,
+	/*
+	 * Big enough to cover at least one whole pmd: align the area so
+	 * that its pmds can be mapped with large pages, saving TLB entries
+	 * on large tables.  Memory that cannot be had in pmd sized chunks
+	 * is still mapped with ptes.
+	 */
+	if (vmap_allow_huge && size >= PMD_SIZE) {
+		flags |= VM_HUGE_PMD;
+		align = max_t(unsigned long, align, PMD_SIZE);
+	}
+
+	area = __get_vm_area_node(size, align, flags,
 				  start, end, node, gfp_mask, caller);
 	if (!area)
 		goto fail;
@@ -0,0 +1,225 @@
+/*
+ * Workingset detection
+ *
+ * Whether a page cache page is worth keeping is only known once it has
+ * been evicted and is needed again.  To see this, reclaim leaves a shadow
+ * entry in the page's radix tree slot in place of the page, recording the
+ * zone's inactive age at the time of eviction.  The inactive age counts
+ * every page leaving the inactive file list, by eviction or activation.
+ *
+ * When the page is faulted back in, the difference between the current
+ * inactive age and the one found in the shadow entry - the refault
+ * distance - is the number of pages that left the inactive list after
+ * this one.  Had the inactive list been that much longer, the page would
+ * still be resident.  The inactive list can only grow at the cost of the
+ * active list, so if the refault distance is not bigger than the active
+ * list, the page is given a place on the active list right away and
+ * competes with the pages there, instead of being thrown out again by
+ * the next stream of use-once pages.
+ *
+ * Shadow entries are dropped when the file is truncated and when the
+ * inode is evicted.  A file that stays around while it is streamed
+ * through the cache, however, would fill its radix tree with them, and
+ * pin the nodes holding them indefinitely.  Those nodes go on a list
+ * once they hold nothing but shadow entries, and a shrinker frees them
+ * once there are more than the file LRU pages could make use of.
+ */
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/list_lru.h>
+#include <linux/radix-tree.h>
+
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	/*
+	 * The counter is truncated to fit the shadow entry, compare it
+	 * modulo the same width so that wrapping does no harm.
+	 */
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @page->mapping->page_tree in
+ * place of the evicted @page, for workingset_refault().
+ */
+void *workingset_eviction(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Radix tree nodes that hold nothing but shadow entries, see
+ * page_cache_tree_delete().  The list lock nests inside the IRQ-safe
+ * mapping->tree_lock, so it must only be taken with IRQs disabled.
+ */
+struct list_lru workingset_shadow_nodes;
+
+static unsigned long count_shadow_nodes(void)
+{
+	unsigned long shadow_nodes;
+	unsigned long max_nodes;
+	unsigned long pages;
+
+	shadow_nodes = list_lru_count(&workingset_shadow_nodes);
+
+	/*
+	 * A shadow entry is only good for an activation while its refault
+	 * distance is below the size of the active file list, so there is
+	 * no point in having more of them than there are file LRU pages.
+	 * Assuming the nodes to be an eighth full, that is one node for
+	 * every RADIX_TREE_MAP_SIZE / 8 pages.
+	 */
+	pages = global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_FILE);
+	max_nodes = pages >> (RADIX_TREE_MAP_SHIFT - 3);
+
+	if (shadow_nodes <= max_nodes)
+		return 0;
+	return shadow_nodes - max_nodes;
+}
+
+static enum lru_status shadow_lru_isolate(struct list_head *item,
+					  spinlock_t *lru_lock, void *arg)
+{
+	struct address_space *mapping;
+	struct radix_tree_node *node;
+	unsigned int i;
+
+	/*
+	 * The mapping cannot go away while the node is on the list:
+	 * inode eviction truncates the shadow entries, which takes the
+	 * node off the list under the lru lock we are holding.  That is
+	 * the reverse lock order, though, so only try the tree_lock.
+	 */
+	node = container_of(item, struct radix_tree_node, private_list);
+	mapping = node->private_data;
+
+	if (!spin_trylock(&mapping->tree_lock))
+		return LRU_SKIP;
+
+	list_del_init(item);
+
+	/* Pages may have been added since, the node is no use to us then */
+	if (workingset_node_pages(node)) {
+		spin_unlock(&mapping->tree_lock);
+		return LRU_REMOVED;
+	}
+
+	for (i = 0; i < RADIX_TREE_MAP_SIZE; i++) {
+		if (!node->slots[i])
+			continue;
+		BUG_ON(!radix_tree_exceptional_entry(node->slots[i]));
+		node->slots[i] = NULL;
+		BUG_ON(!workingset_node_shadows(node));
+		workingset_node_shadows_dec(node);
+		node->count--;
+		mapping->nrshadows--;
+	}
+	BUG_ON(node->count);
+	inc_zone_state(page_zone(virt_to_page(node)), WORKINGSET_NODERECLAIM);
+	if (!__radix_tree_delete_node(&mapping->page_tree, node))
+		BUG();
+
+	spin_unlock(&mapping->tree_lock);
+	return LRU_REMOVED;
+}
+
+static int shadow_lru_shrink(struct shrinker *shrink,
+			     struct shrink_control *sc)
+{
+	unsigned long nr_to_scan = sc->nr_to_scan;
+
+	if (nr_to_scan) {
+		/* list_lru lock nests inside IRQ-safe mapping->tree_lock */
+		local_irq_disable();
+		list_lru_walk(&workingset_shadow_nodes, shadow_lru_isolate,
+			      NULL, nr_to_scan);
+		local_irq_enable();
+	}
+	return min_t(unsigned long, count_shadow_nodes(), INT_MAX);
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shadow_lru_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	int ret;
+
+	ret = list_lru_init(&workingset_shadow_nodes);
+	if (ret)
+		return ret;
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+core_initcall(workingset_init);
@@ -56,6 +56,15 @@
  *	PG_private: identifies the first component page
  *	PG_private2: identifies the last component page
  *
+ * The handle returned by zs_malloc() doesn't encode the location of the
+ * object but points to a word that does, and the first word of every
+ * allocated object points back at its handle.  This lets zs_compact()
+ * move objects out of sparsely used zspages into fuller ones of the same
+ * size class and free the pages left empty.  While an object is mapped
+ * its handle is pinned and compaction leaves it where it is.
+ *
+ * Objects of the largest size class take a page each.  They carry no
+ * header, the handle is kept in page->private instead.
  */
 
 #ifdef CONFIG_ZSMALLOC_DEBUG
@@ -75,9 +84,176 @@
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
+#include <linux/bit_spinlock.h>
+#include <linux/shrinker.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/zsmalloc.h>
+
+/*
+ * This must be power of 2 and greater than of equal to sizeof(link_free).
+ * These two conditions ensure that any 'struct link_free' itself doesn't
+ * span more than 1 page which avoids complex case of mapping 2 pages simply
+ * to restore link_free pointer values.
+ */
+#define ZS_ALIGN		8
+
+/*
+ * A single 'zspage' is composed of up to 2^N discontiguous 0-order (single)
+ * pages. ZS_MAX_ZSPAGE_ORDER defines upper limit on N.
+ */
+#define ZS_MAX_ZSPAGE_ORDER 2
+#define ZS_MAX_PAGES_PER_ZSPAGE (_AC(1, UL) << ZS_MAX_ZSPAGE_ORDER)
+
+/* header in front of every object, pointing back at its handle */
+#define ZS_HANDLE_SIZE (sizeof(unsigned long))
+
+/*
+ * Object location (<PFN>, <obj_idx>) is encoded as
+ * as single unsigned long value.
+ *
+ * Note that object index <obj_idx> is relative to system
+ * page <PFN> it is stored in, so for each sub-page belonging
+ * to a zspage, obj_idx starts with 0.
+ *
+ * This is made more complicated by various memory models and PAE.
+ */
+
+#ifndef MAX_PHYSMEM_BITS
+#ifdef CONFIG_HIGHMEM64G
+#define MAX_PHYSMEM_BITS 36
+#else /* !CONFIG_HIGHMEM64G */
+/*
+ * If this definition of MAX_PHYSMEM_BITS is used, OBJ_INDEX_BITS will just
+ * be PAGE_SHIFT - OBJ_TAG_BITS
+ */
+#define MAX_PHYSMEM_BITS BITS_PER_LONG
+#endif
+#endif
+#define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
+
+/*
+ * The lowest bit of an object's first word tells an allocated object,
+ * whose header holds its handle, from a free one on the freelist.  Object
+ * locations are shifted to keep that bit clear.  A handle is pinned with
+ * the same bit of the word it points to.
+ */
+#define OBJ_ALLOCATED_TAG	1
+#define OBJ_TAG_BITS		1
+#define HANDLE_PIN_BIT		0
+
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
+#define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
+
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+/* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
+#define ZS_MIN_ALLOC_SIZE \
+	MAX(32, (ZS_MAX_PAGES_PER_ZSPAGE << PAGE_SHIFT >> OBJ_INDEX_BITS))
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * On systems with 4K page size, this gives 255 size classes! There is a
+ * trader-off here:
+ *  - Large number of size classes is potentially wasteful as free page are
+ *    spread across these classes
+ *  - Small number of size classes causes large internal fragmentation
+ *  - Probably its better to use specific size classes (empirically
+ *    determined). NOTE: all those class sizes must be set as multiple of
+ *    ZS_ALIGN to make sure link_free itself never has to span 2 pages.
+ *
+ *  ZS_MIN_ALLOC_SIZE and ZS_SIZE_CLASS_DELTA must be multiple of ZS_ALIGN
+ *  (reason above)
+ */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * We do not maintain any list for completely empty or full pages
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+	ZS_FULL
+};
+
+/*
+ * We assign a page to ZS_ALMOST_EMPTY fullness group when:
+ *	n <= N / f, where
+ * n = number of allocated objects
+ * N = total number of objects zspage can store
+ * f = 1/fullness_threshold_frac
+ *
+ * Similarly, we assign zspage to:
+ *	ZS_ALMOST_FULL	when n > N / f
+ *	ZS_EMPTY	when n == 0
+ *	ZS_FULL		when n == N
+ *
+ * (see: fix_fullness_group())
+ */
+static const int fullness_threshold_frac = 4;
+
+struct mapping_area {
+	char *vm_buf; /* copy buffer for objects that span pages */
+	char *vm_addr; /* address of kmap_atomic()'ed pages */
+	enum zs_mapmode vm_mm; /* mapping mode */
+};
+
+struct size_class {
+	/*
+	 * Size of objects stored in this class. Must be multiple
+	 * of ZS_ALIGN.
+	 */
+	int size;
+	unsigned int index;
+
+	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
+	int pages_per_zspage;
+	/* Number of objects a zspage holds */
+	int objs_per_zspage;
+	/* one object per page, without header */
+	bool huge;
+
+	spinlock_t lock;
+
+	/* stats */
+	u64 pages_allocated;
+	unsigned long objs_allocated;
+	unsigned long objs_used;
+	unsigned long zspages[_ZS_NR_FULLNESS_GROUPS];
+
+	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
+};
+
+/*
+ * Placed within free objects to form a singly linked list.
+ * For every zspage, first_page->freelist gives head of this list.
+ * Allocated objects keep their handle here instead.
+ *
+ * This must be power of 2 and less than or equal to ZS_ALIGN
+ */
+struct link_free {
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of the object, with OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
 
-#include "zsmalloc.h"
-#include "zsmalloc_int.h"
+	gfp_t flags;	/* allocation flags used when growing pool */
+	const char *name;
+
+	atomic_long_t pages_compacted;
+	struct shrinker shrinker;
+	struct dentry *stat_dentry;
+};
 
 /*
  * A zspage's class index and fullness group
@@ -91,6 +267,47 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+static struct kmem_cache *zs_handle_cachep;
+
+static unsigned long alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+					       pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void free_handle(unsigned long handle)
+{
+	kmem_cache_free(zs_handle_cachep, (void *)handle);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
+
+/* Set the location of a handle that isn't visible yet, or is pinned */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long pin = *(unsigned long *)handle & (1UL << HANDLE_PIN_BIT);
+
+	*(unsigned long *)handle = obj | pin;
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
 static int is_first_page(struct page *page)
 {
 	return PagePrivate(page);
@@ -131,7 +348,7 @@ static int get_size_class_index(int size)
 		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
 				ZS_SIZE_CLASS_DELTA);
 
-	return idx;
+	return min_t(int, idx, ZS_SIZE_CLASSES - 1);
 }
 
 static enum fullness_group get_fullness_group(struct page *page)
@@ -170,6 +387,7 @@ static void insert_zspage(struct page *page, struct size_class *class,
 		list_add_tail(&page->lru, &(*head)->lru);
 
 	*head = page;
+	class->zspages[fullness]++;
 }
 
 static void remove_zspage(struct page *page, struct size_class *class,
@@ -191,6 +409,7 @@ static void remove_zspage(struct page *page, struct size_class *class,
 					struct page, lru);
 
 	list_del_init(&page->lru);
+	class->zspages[fullness]--;
 }
 
 static enum fullness_group fix_fullness_group(struct zs_pool *pool,
@@ -278,28 +497,29 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single object location */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
 
-	return (void *)handle;
+	return obj << OBJ_TAG_BITS;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(unsigned long handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given object location */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	*page = pfn_to_page(handle >> OBJ_INDEX_BITS);
-	*obj_idx = handle & OBJ_INDEX_MASK;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -376,7 +596,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -387,7 +607,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -441,9 +661,9 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->pages_per_zspage * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; /* Success */
 
@@ -470,6 +690,65 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+/*
+ * Take the first free object of a zspage for @handle.  Called with the
+ * class lock held.
+ */
+static unsigned long obj_malloc(struct size_class *class,
+				struct page *first_page, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+	void *vaddr;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	vaddr = kmap_atomic(m_page);
+	link = (struct link_free *)(vaddr + m_offset);
+	first_page->freelist = (void *)link->next;
+	if (!class->huge)
+		link->handle = handle | OBJ_ALLOCATED_TAG;
+	else
+		set_page_private(first_page, handle);
+	kunmap_atomic(vaddr);
+
+	first_page->inuse++;
+	class->objs_used++;
+
+	return obj;
+}
+
+/*
+ * Put an object back on its zspage's freelist.  Called with the class
+ * lock held, the caller fixes the fullness group.
+ */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+	void *vaddr;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	vaddr = kmap_atomic(f_page);
+	link = (struct link_free *)(vaddr + f_offset);
+	link->next = (unsigned long)first_page->freelist;
+	if (class->huge)
+		set_page_private(first_page, 0);
+	kunmap_atomic(vaddr);
+
+	first_page->freelist = (void *)obj;
+	first_page->inuse--;
+	class->objs_used--;
+}
+
 static void zs_copy_map_object(char *buf, struct page *firstpage,
 				int off, int size)
 {
@@ -552,6 +831,304 @@ static struct notifier_block zs_cpu_nb = {
 	.notifier_call = zs_cpu_notifier
 };
 
+/*
+ * Compaction
+ */
+
+/* Copy a whole object, header included, to a newly allocated place */
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	int written = 0;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	for (;;) {
+		void *s_addr, *d_addr;
+		int size;
+
+		size = min3(class->size - written, (int)(PAGE_SIZE - s_off),
+			    (int)(PAGE_SIZE - d_off));
+
+		s_addr = kmap_atomic(s_page);
+		d_addr = kmap_atomic(d_page);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		kunmap_atomic(d_addr);
+		kunmap_atomic(s_addr);
+
+		written += size;
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		if (s_off == PAGE_SIZE) {
+			s_page = get_next_page(s_page);
+			s_off = 0;
+		}
+		d_off += size;
+		if (d_off == PAGE_SIZE) {
+			d_page = get_next_page(d_page);
+			d_off = 0;
+		}
+	}
+}
+
+/*
+ * Move the allocated objects of an isolated zspage into other zspages of
+ * the class, until it is empty, there is no room left or an object is
+ * pinned.  Called with the class lock held.
+ */
+static int zs_migrate_zspage(struct zs_pool *pool, struct size_class *class,
+				struct page *src_page)
+{
+	struct page *page = src_page;
+	int nr_objs = 0;
+
+	while (page && src_page->inuse) {
+		unsigned long off = is_first_page(page) ? 0 : page->index;
+		unsigned long obj_idx;
+
+		for (obj_idx = 0; off < PAGE_SIZE &&
+		     nr_objs < class->objs_per_zspage && src_page->inuse;
+		     obj_idx++, off += class->size, nr_objs++) {
+			unsigned long used_obj, free_obj, head, handle;
+			struct page *dst_page;
+			void *vaddr;
+
+			vaddr = kmap_atomic(page);
+			head = ((struct link_free *)(vaddr + off))->handle;
+			kunmap_atomic(vaddr);
+			if (!(head & OBJ_ALLOCATED_TAG))
+				continue;
+
+			handle = head & ~OBJ_ALLOCATED_TAG;
+			if (!trypin_tag(handle))
+				return -EBUSY;
+
+			dst_page = find_get_zspage(class);
+			if (!dst_page) {
+				unpin_tag(handle);
+				return -ENOSPC;
+			}
+
+			used_obj = location_to_obj(page, obj_idx);
+			free_obj = obj_malloc(class, dst_page, handle);
+			zs_object_copy(free_obj, used_obj, class);
+			record_obj(handle, free_obj);
+			unpin_tag(handle);
+			obj_free(class, used_obj);
+			fix_fullness_group(pool, dst_page);
+		}
+		page = get_next_page(page);
+	}
+
+	return 0;
+}
+
+/* Number of pages compaction could free in this class */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	if (class->huge)
+		return 0;
+
+	obj_wasted = class->objs_allocated - class->objs_used;
+	return obj_wasted / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct page *src_page;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class) &&
+	       (src_page = class->fullness_list[ZS_ALMOST_EMPTY])) {
+		enum fullness_group fg;
+		int ret;
+
+		remove_zspage(src_page, class, ZS_ALMOST_EMPTY);
+		ret = zs_migrate_zspage(pool, class, src_page);
+
+		fg = get_fullness_group(src_page);
+		if (fg == ZS_EMPTY) {
+			class->pages_allocated -= class->pages_per_zspage;
+			class->objs_allocated -= class->objs_per_zspage;
+			spin_unlock(&class->lock);
+			free_zspage(src_page);
+			freed += class->pages_per_zspage;
+			spin_lock(&class->lock);
+		} else {
+			insert_zspage(src_page, class, fg);
+			set_zspage_mapping(src_page, class->index, fg);
+		}
+
+		if (ret)
+			break;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - free pages by packing objects into fewer zspages
+ * @pool: pool to compact
+ *
+ * Objects that are mapped at the time are not moved.  May sleep.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += __zs_compact(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
+
+/*
+ * Pools compact themselves under memory pressure.
+ */
+static int zs_shrinker(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool, shrinker);
+	unsigned long pages = 0;
+	int i;
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		pages += zs_can_compact(&pool->size_class[i]);
+
+	return min_t(unsigned long, pages, INT_MAX);
+}
+
+/*
+ * Statistics in debugfs, one file per pool
+ */
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zs_stat_root;
+
+static void zs_stat_init(void)
+{
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+}
+
+static void zs_stat_exit(void)
+{
+	debugfs_remove_recursive(zs_stat_root);
+}
+
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	struct zs_pool *pool = s->private;
+	unsigned long total_objs = 0, total_used = 0, total_pages = 0;
+	int i;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s\n",
+		   "class", "size", "almost_full", "almost_empty",
+		   "obj_allocated", "obj_used", "pages_used",
+		   "pages_per_zspage");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long almost_full, almost_empty, objs, used, pages;
+
+		spin_lock(&class->lock);
+		almost_full = class->zspages[ZS_ALMOST_FULL];
+		almost_empty = class->zspages[ZS_ALMOST_EMPTY];
+		objs = class->objs_allocated;
+		used = class->objs_used;
+		pages = class->pages_allocated;
+		spin_unlock(&class->lock);
+
+		if (!objs)
+			continue;
+
+		seq_printf(s, " %5u %5u %11lu %12lu %13lu %10lu %10lu %16d\n",
+			   i, class->size, almost_full, almost_empty, objs,
+			   used, pages, class->pages_per_zspage);
+
+		total_objs += objs;
+		total_used += used;
+		total_pages += pages;
+	}
+
+	seq_printf(s, " %5s %5s %11s %12s %13lu %10lu %10lu\n",
+		   "Total", "", "", "", total_objs, total_used, total_pages);
+	seq_printf(s, "pages_compacted %lu\n",
+		   atomic_long_read(&pool->pages_compacted));
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.open		= zs_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	if (zs_stat_root)
+		pool->stat_dentry = debugfs_create_file(pool->name, S_IRUGO,
+							zs_stat_root, pool,
+							&zs_stats_fops);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove(pool->stat_dentry);
+}
+#else
+static void zs_stat_init(void)
+{
+}
+
+static void zs_stat_exit(void)
+{
+}
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+}
+#endif
+
 static void zs_exit(void)
 {
 	int cpu;
@@ -559,12 +1136,20 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+	zs_stat_exit();
+	kmem_cache_destroy(zs_handle_cachep);
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					     0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+	zs_stat_init();
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -577,6 +1162,13 @@ fail:
 	return notifier_to_errno(ret);
 }
 
+/**
+ * zs_create_pool - create a pool of compressed objects
+ * @name: name of the pool, for its statistics file
+ * @flags: allocation flags used when growing the pool
+ *
+ * Returns the new pool, or NULL.
+ */
 struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 {
 	int i, ovhd_size;
@@ -603,11 +1195,19 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->pages_per_zspage = get_pages_per_zspage(size);
-
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / size;
+		class->huge = (size == ZS_MAX_ALLOC_SIZE);
 	}
 
 	pool->flags = flags;
 	pool->name = name;
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	pool->shrinker.shrink = zs_shrinker;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+	zs_pool_stat_create(pool);
 
 	return pool;
 }
@@ -617,6 +1217,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	zs_pool_stat_destroy(pool);
+	unregister_shrinker(&pool->shrinker);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -644,20 +1247,19 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  */
 unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 {
-	unsigned long obj;
-	struct link_free *link;
-	int class_idx;
+	unsigned long handle, obj;
 	struct size_class *class;
-
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	struct page *first_page;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
-	class_idx = get_size_class_index(size);
-	class = &pool->size_class[class_idx];
-	BUG_ON(class_idx != class->index);
+	handle = alloc_handle(pool);
+	if (!handle)
+		return 0;
+
+	/* extra space for the header ends up in the huge class */
+	class = &pool->size_class[get_size_class_index(size + ZS_HANDLE_SIZE)];
 
 	spin_lock(&class->lock);
 	first_page = find_get_zspage(class);
@@ -665,70 +1267,58 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			free_handle(handle);
 			return 0;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->pages_per_zspage;
+		class->objs_allocated += class->objs_per_zspage;
 	}
 
-	obj = (unsigned long)first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(class, first_page, handle);
+	record_obj(handle, obj);
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, unsigned long obj)
+void zs_free(struct zs_pool *pool, unsigned long handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
-
+	unsigned long obj, f_objidx;
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* keep compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = (void *)obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
-
-	if (fullness == ZS_EMPTY)
+	if (fullness == ZS_EMPTY) {
 		class->pages_allocated -= class->pages_per_zspage;
-
+		class->objs_allocated -= class->objs_per_zspage;
+	}
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
 
+	free_handle(handle);
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
 }
@@ -744,7 +1334,7 @@ EXPORT_SYMBOL_GPL(zs_free);
  * zs_unmap_object.
  *
  * Only one object can be mapped per cpu at a time. There is no protection
- * against nested mappings.
+ * against nested mappings.  A mapped object is not moved by compaction.
  *
  * This function returns with preemption and page faults disabled.
 */
@@ -752,47 +1342,58 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 			enum zs_mapmode mm)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
+	char *ret;
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
 
 	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
 	if (off + class->size <= PAGE_SIZE) {
 		/* this object is contained entirely within a page */
 		area->vm_addr = kmap_atomic(page);
-		return area->vm_addr + off;
+		ret = area->vm_addr + off;
+	} else {
+		/* disable page faults to match kmap_atomic() return conditions */
+		pagefault_disable();
+
+		if (mm != ZS_MM_WO)
+			zs_copy_map_object(area->vm_buf, page, off,
+					   class->size);
+		area->vm_addr = NULL;
+		ret = area->vm_buf;
 	}
 
-	/* disable page faults to match kmap_atomic() return conditions */
-	pagefault_disable();
-
-	if (mm != ZS_MM_WO)
-		zs_copy_map_object(area->vm_buf, page, off, class->size);
-	area->vm_addr = NULL;
-	return area->vm_buf;
+	if (!class->huge)
+		ret += ZS_HANDLE_SIZE;
+	return ret;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
 void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
 
+	BUG_ON(!handle);
+
 	area = &__get_cpu_var(zs_map_area);
 	/* single-page object fastpath */
 	if (area->vm_addr) {
@@ -804,13 +1405,15 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 	if (area->vm_mm == ZS_MM_RO)
 		goto pfenable;
 
-	BUG_ON(!handle);
-
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
 
+	/* a write-only mapping never saw the header */
+	if (!class->huge)
+		*(unsigned long *)area->vm_buf = handle | OBJ_ALLOCATED_TAG;
 	zs_copy_unmap_object(area->vm_buf, page, off, class->size);
 
 pfenable:
@@ -818,6 +1421,7 @@ pfenable:
 	pagefault_enable();
 out:
 	put_cpu_var(zs_map_area);
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -0,0 +1,434 @@
+/*
+ * zswap - compressed cache for swap pages
+ *
+ * A frontswap backend that keeps pages on their way to swap in memory,
+ * compressed with LZO and packed by zsmalloc.  The pool grows up to a
+ * share of RAM set with
+ * max_pool_percent.  A page comes back from the pool on swapin without
+ * any I/O, and is freed when its swap slot is.
+ *
+ * Once the pool is full, new pages go straight to the swap device and a
+ * worker takes the least recently stored pages out of the pool: each is
+ * decompressed into the swap cache and written to the swap device like
+ * any other swap page, until the pool is back below its high mark.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/frontswap.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
+#include <linux/zsmalloc.h>
+#include <linux/debugfs.h>
+
+static bool zswap_enabled;
+module_param_named(enabled, zswap_enabled, bool, 0);
+
+/* share of RAM the compressed pool may take */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* pages that don't compress below this share of a page are not stored */
+static unsigned int zswap_max_compression_ratio = 80;
+module_param_named(max_compression_ratio, zswap_max_compression_ratio,
+		   uint, 0644);
+
+/* writeback stops once the pool is below this share of its limit */
+#define ZSWAP_WRITEBACK_PERCENT	90
+/* give up on a writeback run after this many pages failed in a row */
+#define ZSWAP_WRITEBACK_RETRIES	32
+
+struct zswap_entry {
+	struct rb_node		rbnode;
+	struct list_head	lru;		/* on zswap_lru, newest first */
+	unsigned int		type;
+	pgoff_t			offset;
+	unsigned int		length;
+	unsigned long		handle;		/* in zswap_pool */
+};
+
+struct zswap_pcpu {
+	u8			*dst;
+	void			*wrkmem;
+};
+
+static DEFINE_PER_CPU(struct zswap_pcpu, zswap_pcpu);
+
+static struct zs_pool *zswap_pool;
+static struct kmem_cache *zswap_entry_cache;
+
+/*
+ * zswap_lock protects the trees, the LRU and the pool size.
+ */
+static DEFINE_SPINLOCK(zswap_lock);
+static struct rb_root zswap_trees[MAX_SWAPFILES];
+static LIST_HEAD(zswap_lru);
+
+static void zswap_writeback_fn(struct work_struct *work);
+static DECLARE_WORK(zswap_writeback_work, zswap_writeback_fn);
+
+/*
+ * statistics, not protected against increment races
+ */
+static u64 zswap_pool_bytes;
+static u64 zswap_stored_pages;
+static u64 zswap_pool_limit_hit;
+static u64 zswap_written_back_pages;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_reject_alloc_fail;
+
+static unsigned long zswap_max_pool_pages(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100;
+}
+
+static unsigned long zswap_pool_pages(void)
+{
+	return zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT;
+}
+
+/*
+ * Trees, called with zswap_lock held
+ */
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+
+	while (node) {
+		struct zswap_entry *entry;
+
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (offset < entry->offset)
+			node = node->rb_left;
+		else if (offset > entry->offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Insert @entry, returning the entry it displaced for the same offset.
+ */
+static struct zswap_entry *zswap_rb_insert(struct rb_root *root,
+					   struct zswap_entry *entry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+
+	while (*link) {
+		struct zswap_entry *this;
+
+		parent = *link;
+		this = rb_entry(parent, struct zswap_entry, rbnode);
+		if (entry->offset < this->offset) {
+			link = &parent->rb_left;
+		} else if (entry->offset > this->offset) {
+			link = &parent->rb_right;
+		} else {
+			rb_replace_node(&this->rbnode, &entry->rbnode, root);
+			return this;
+		}
+	}
+
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return NULL;
+}
+
+/*
+ * Unlink an entry that is no longer in its tree.
+ */
+static void zswap_entry_free(struct zswap_entry *entry)
+{
+	list_del(&entry->lru);
+	zs_free(zswap_pool, entry->handle);
+	zswap_pool_bytes = zs_get_total_size_bytes(zswap_pool);
+	zswap_stored_pages--;
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/*
+ * Writeback
+ */
+static int zswap_writeback_entry(unsigned type, pgoff_t offset)
+{
+	swp_entry_t swpentry = swp_entry(type, offset);
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct page *page;
+	int ret = -EAGAIN;
+
+	/* this comes back to zswap_frontswap_load() for the data */
+	page = read_swap_cache_async(swpentry, GFP_KERNEL, NULL, 0);
+	if (!page)
+		return -ENOMEM;
+
+	lock_page(page);
+	if (PageSwapCache(page) && page_private(page) == swpentry.val &&
+	    PageUptodate(page) && !PageWriteback(page)) {
+		/*
+		 * The swap cache has the data now, drop the compressed copy
+		 * so that it is written to the device instead.
+		 */
+		__frontswap_invalidate_page(type, offset);
+		SetPageReclaim(page);
+		ret = __swap_writepage(page, &wbc);
+		if (!ret)
+			zswap_written_back_pages++;
+	} else {
+		unlock_page(page);
+	}
+	page_cache_release(page);
+
+	return ret;
+}
+
+static void zswap_writeback_fn(struct work_struct *work)
+{
+	unsigned long target;
+	int failed = 0;
+
+	target = zswap_max_pool_pages() * ZSWAP_WRITEBACK_PERCENT / 100;
+	while (zswap_pool_pages() > target &&
+	       failed < ZSWAP_WRITEBACK_RETRIES) {
+		struct zswap_entry *entry;
+		unsigned type;
+		pgoff_t offset;
+
+		spin_lock(&zswap_lock);
+		if (list_empty(&zswap_lru)) {
+			spin_unlock(&zswap_lock);
+			break;
+		}
+		entry = list_entry(zswap_lru.prev, struct zswap_entry, lru);
+		/* to the front, in case it can't be written now */
+		list_move(&entry->lru, &zswap_lru);
+		type = entry->type;
+		offset = entry->offset;
+		spin_unlock(&zswap_lock);
+
+		if (zswap_writeback_entry(type, offset))
+			failed++;
+		else
+			failed = 0;
+		cond_resched();
+	}
+}
+
+/*
+ * frontswap hooks
+ */
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				 struct page *page)
+{
+	struct zswap_entry *entry, *dup;
+	struct zswap_pcpu *pcpu;
+	unsigned long handle;
+	size_t dlen;
+	u8 *src, *dst;
+	int ret;
+
+	if (zswap_pool_pages() >= zswap_max_pool_pages()) {
+		zswap_pool_limit_hit++;
+		schedule_work(&zswap_writeback_work);
+		return -ENOMEM;
+	}
+
+	pcpu = &get_cpu_var(zswap_pcpu);
+	src = kmap_atomic(page);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, pcpu->dst, &dlen, pcpu->wrkmem);
+	kunmap_atomic(src);
+
+	if (ret != LZO_E_OK ||
+	    dlen * 100 > PAGE_SIZE * zswap_max_compression_ratio) {
+		put_cpu_var(zswap_pcpu);
+		zswap_reject_compress_poor++;
+		return -EINVAL;
+	}
+
+	entry = kmem_cache_alloc(zswap_entry_cache, GFP_NOWAIT | __GFP_NOWARN);
+	handle = zs_malloc(zswap_pool, dlen);
+	if (!entry || !handle) {
+		put_cpu_var(zswap_pcpu);
+		if (entry)
+			kmem_cache_free(zswap_entry_cache, entry);
+		zswap_reject_alloc_fail++;
+		return -ENOMEM;
+	}
+	dst = zs_map_object(zswap_pool, handle, ZS_MM_WO);
+	memcpy(dst, pcpu->dst, dlen);
+	zs_unmap_object(zswap_pool, handle);
+	put_cpu_var(zswap_pcpu);
+
+	entry->type = type;
+	entry->offset = offset;
+	entry->length = dlen;
+	entry->handle = handle;
+
+	spin_lock(&zswap_lock);
+	dup = zswap_rb_insert(&zswap_trees[type], entry);
+	if (dup)
+		zswap_entry_free(dup);
+	list_add(&entry->lru, &zswap_lru);
+	zswap_pool_bytes = zs_get_total_size_bytes(zswap_pool);
+	zswap_stored_pages++;
+	spin_unlock(&zswap_lock);
+
+	return 0;
+}
+
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_rb_search(&zswap_trees[type], offset);
+	if (!entry) {
+		spin_unlock(&zswap_lock);
+		return -1;
+	}
+
+	src = zs_map_object(zswap_pool, entry->handle, ZS_MM_RO);
+	dst = kmap_atomic(page);
+	ret = lzo1x_decompress_safe(src, entry->length, dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	spin_unlock(&zswap_lock);
+
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+	return 0;
+}
+
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_entry *entry;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_rb_search(&zswap_trees[type], offset);
+	if (entry) {
+		rb_erase(&entry->rbnode, &zswap_trees[type]);
+		zswap_entry_free(entry);
+	}
+	spin_unlock(&zswap_lock);
+}
+
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct rb_node *node;
+
+	spin_lock(&zswap_lock);
+	while ((node = rb_first(&zswap_trees[type]))) {
+		rb_erase(node, &zswap_trees[type]);
+		zswap_entry_free(rb_entry(node, struct zswap_entry, rbnode));
+	}
+	spin_unlock(&zswap_lock);
+}
+
+static void zswap_frontswap_init(unsigned type)
+{
+	zswap_frontswap_invalidate_area(type);
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.store = zswap_frontswap_store,
+	.load = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int __init zswap_debugfs_init(void)
+{
+	struct dentry *root;
+
+	root = debugfs_create_dir("zswap", NULL);
+	if (!root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_bytes", S_IRUGO, root, &zswap_pool_bytes);
+	debugfs_create_u64("stored_pages", S_IRUGO, root, &zswap_stored_pages);
+	debugfs_create_u64("pool_limit_hit", S_IRUGO, root,
+			   &zswap_pool_limit_hit);
+	debugfs_create_u64("written_back_pages", S_IRUGO, root,
+			   &zswap_written_back_pages);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO, root,
+			   &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO, root,
+			   &zswap_reject_alloc_fail);
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+static int __init zswap_init(void)
+{
+	struct frontswap_ops old_ops;
+	int cpu;
+
+	if (!zswap_enabled)
+		return 0;
+
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache)
+		return -ENOMEM;
+	zswap_pool = zs_create_pool("zswap",
+				    GFP_NOWAIT | __GFP_NOWARN | __GFP_HIGHMEM);
+	if (!zswap_pool)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zswap_pcpu *pcpu = &per_cpu(zswap_pcpu, cpu);
+
+		pcpu->dst = kmalloc_node(lzo1x_worst_compress(PAGE_SIZE),
+					 GFP_KERNEL, cpu_to_node(cpu));
+		pcpu->wrkmem = kmalloc_node(LZO1X_MEM_COMPRESS, GFP_KERNEL,
+					    cpu_to_node(cpu));
+		if (!pcpu->dst || !pcpu->wrkmem)
+			goto fail;
+	}
+
+	old_ops = frontswap_register_ops(&zswap_frontswap_ops);
+	if (old_ops.init)
+		pr_warn("zswap: frontswap backend replaced\n");
+
+	zswap_debugfs_init();
+	pr_info("zswap: using lzo, pool limited to %u%% of RAM\n",
+		zswap_max_pool_percent);
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		struct zswap_pcpu *pcpu = &per_cpu(zswap_pcpu, cpu);
+
+		kfree(pcpu->dst);
+		kfree(pcpu->wrkmem);
+	}
+	if (zswap_pool)
+		zs_destroy_pool(zswap_pool);
+	kmem_cache_destroy(zswap_entry_cache);
+	pr_err("zswap: can't allocate compression buffers\n");
+	return -ENOMEM;
+}
+/* must be up before swapon */
+late_initcall(zswap_init);
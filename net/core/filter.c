@@ -39,6 +39,7 @@
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
 #include <linux/seccomp.h>
+#include <linux/rtnetlink.h>
 
 /* No hurry in this branch
  *
@@ -668,6 +669,76 @@ void sk_unattached_filter_destroy(struct sk_filter *fp)
 }
 EXPORT_SYMBOL_GPL(sk_unattached_filter_destroy);
 
+/**
+ *	dev_set_rx_filter - set the early receive filter of a device
+ *	@dev: device
+ *	@fprog: the filter program, an empty program detaches the filter
+ *
+ * The filter is run by drivers advertising IFF_RX_FILTER on frames still
+ * sitting in their receive buffers, see netdev_rx_filter_drop().  Frames
+ * for which it returns 0 are dropped before an skb is built for them.
+ * Must be called with RTNL held.
+ */
+int dev_set_rx_filter(struct net_device *dev, struct sock_fprog *fprog)
+{
+	struct sk_filter *fp = NULL, *old_fp;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (!(dev->priv_flags & IFF_RX_FILTER))
+		return -EOPNOTSUPP;
+
+	if (fprog->len) {
+		err = sk_unattached_filter_create(&fp, fprog);
+		if (err)
+			return err;
+	}
+
+	old_fp = rtnl_dereference(dev->rx_filter);
+	rcu_assign_pointer(dev->rx_filter, fp);
+	if (old_fp)
+		sk_unattached_filter_destroy(old_fp);
+	return 0;
+}
+EXPORT_SYMBOL(dev_set_rx_filter);
+
+bool __netdev_rx_filter_drop(struct net_device *dev, void *data,
+			     unsigned int len)
+{
+	struct sk_filter *fp;
+	struct sk_buff skb;
+	bool drop = false;
+
+	if (unlikely(len < ETH_HLEN))
+		return false;
+
+	rcu_read_lock();
+	fp = rcu_dereference(dev->rx_filter);
+	if (fp) {
+		/*
+		 * Just enough of an skb for the interpreter and the JITs to
+		 * see the frame the way a packet socket would.  Nothing past
+		 * the linear data is ever looked at since data_len is 0.
+		 */
+		memset(&skb, 0, sizeof(skb));
+		skb.dev = dev;
+		skb.head = data;
+		skb.data = data;
+		skb.len = len;
+		skb_set_tail_pointer(&skb, len);
+		skb_reset_mac_header(&skb);
+		skb_set_network_header(&skb, ETH_HLEN);
+		skb.protocol = ((struct ethhdr *)data)->h_proto;
+
+		drop = !SK_RUN_FILTER(fp, &skb);
+	}
+	rcu_read_unlock();
+
+	return drop;
+}
+EXPORT_SYMBOL(__netdev_rx_filter_drop);
+
 /**
  *	sk_attach_filter - attach a socket filter
  *	@fprog: the filter program
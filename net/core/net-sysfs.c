@@ -642,9 +642,29 @@ static ssize_t store_rps_dev_flow_table_cnt(struct netdev_rx_queue *queue,
 	return len;
 }
 
+static ssize_t show_rps_flows_steered(struct netdev_rx_queue *queue,
+				      struct rx_queue_attribute *attr,
+				      char *buf)
+{
+	return sprintf(buf, "%lu\n", queue->rps_flows_steered);
+}
+
+static ssize_t show_rps_filters_added(struct netdev_rx_queue *queue,
+				      struct rx_queue_attribute *attr,
+				      char *buf)
+{
+	return sprintf(buf, "%lu\n", queue->rps_filters_added);
+}
+
 static struct rx_queue_attribute rps_cpus_attribute =
 	__ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_map, store_rps_map);
 
+static struct rx_queue_attribute rps_flows_steered_attribute =
+	__ATTR(rps_flows_steered, S_IRUGO, show_rps_flows_steered, NULL);
+
+static struct rx_queue_attribute rps_filters_added_attribute =
+	__ATTR(rps_filters_added, S_IRUGO, show_rps_filters_added, NULL);
+
 
 static struct rx_queue_attribute rps_dev_flow_table_cnt_attribute =
 	__ATTR(rps_flow_cnt, S_IRUGO | S_IWUSR,
@@ -653,6 +673,8 @@ static struct rx_queue_attribute rps_dev_flow_table_cnt_attribute =
 static struct attribute *rx_queue_default_attrs[] = {
 	&rps_cpus_attribute.attr,
 	&rps_dev_flow_table_cnt_attribute.attr,
+	&rps_flows_steered_attribute.attr,
+	&rps_filters_added_attribute.attr,
 	NULL
 };
 
@@ -864,6 +886,96 @@ static ssize_t bql_show_inflight(struct netdev_queue *queue,
 static struct netdev_queue_attribute bql_inflight_attribute =
 	__ATTR(inflight, S_IRUGO, bql_show_inflight, NULL);
 
+static ssize_t bql_show_latency_stats(struct netdev_queue *queue,
+				      struct netdev_queue_attribute *attr,
+				      char *buf)
+{
+	return sprintf(buf, "%u\n", queue->dql.latency_track);
+}
+
+static ssize_t bql_set_latency_stats(struct netdev_queue *queue,
+				     struct netdev_queue_attribute *attr,
+				     const char *buf, size_t len)
+{
+	struct dql *dql = &queue->dql;
+	bool value;
+	int err;
+
+	err = strtobool(buf, &value);
+	if (err < 0)
+		return err;
+
+	/* The latency target needs the sojourn time samples */
+	if (!value && dql->latency_target)
+		return -EBUSY;
+
+	dql_set_latency_track(dql, value);
+
+	return len;
+}
+
+static struct netdev_queue_attribute bql_latency_stats_attribute =
+	__ATTR(latency_stats, S_IRUGO | S_IWUSR, bql_show_latency_stats,
+	    bql_set_latency_stats);
+
+static ssize_t bql_show_latency_target(struct netdev_queue *queue,
+				       struct netdev_queue_attribute *attr,
+				       char *buf)
+{
+	return sprintf(buf, "%u\n", queue->dql.latency_target);
+}
+
+static ssize_t bql_set_latency_target(struct netdev_queue *queue,
+				      struct netdev_queue_attribute *attr,
+				      const char *buf, size_t len)
+{
+	struct dql *dql = &queue->dql;
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 10, &value);
+	if (err < 0)
+		return err;
+
+	if (value)
+		dql_set_latency_track(dql, true);
+	dql->latency_target = value;
+
+	return len;
+}
+
+static struct netdev_queue_attribute bql_latency_target_attribute =
+	__ATTR(latency_target, S_IRUGO | S_IWUSR, bql_show_latency_target,
+	    bql_set_latency_target);
+
+static ssize_t bql_show_sojourn(struct netdev_queue *queue,
+				struct netdev_queue_attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%u\n", queue->dql.sojourn);
+}
+
+static struct netdev_queue_attribute bql_sojourn_attribute =
+	__ATTR(sojourn, S_IRUGO, bql_show_sojourn, NULL);
+
+static ssize_t bql_show_latency_hist(struct netdev_queue *queue,
+				     struct netdev_queue_attribute *attr,
+				     char *buf)
+{
+	struct dql *dql = &queue->dql;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < DQL_HIST_BUCKETS; i++)
+		len += sprintf(buf + len, "%lu%c", dql->hist[i],
+			       i == DQL_HIST_BUCKETS - 1 ? '\n' : ' ');
+
+	return len;
+}
+
+static struct netdev_queue_attribute bql_latency_hist_attribute =
+	__ATTR(latency_hist, S_IRUGO, bql_show_latency_hist, NULL);
+
 #define BQL_ATTR(NAME, FIELD)						\
 static ssize_t bql_show_ ## NAME(struct netdev_queue *queue,		\
 				 struct netdev_queue_attribute *attr,	\
@@ -893,6 +1005,10 @@ static struct attribute *dql_attrs[] = {
 	&bql_limit_min_attribute.attr,
 	&bql_hold_time_attribute.attr,
 	&bql_inflight_attribute.attr,
+	&bql_latency_stats_attribute.attr,
+	&bql_latency_target_attribute.attr,
+	&bql_sojourn_attribute.attr,
+	&bql_latency_hist_attribute.attr,
 	NULL
 };
 
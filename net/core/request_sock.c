@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/tcp.h>
 
 #include <net/request_sock.h>
 
@@ -130,3 +131,31 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 		kfree(lopt);
 }
 
+
+/*
+ * Called when a TCP Fast Open child leaves SYN_RECV, either because the
+ * 3WHS completed or because the child died.  The request sock that
+ * created the child is no longer needed for SYN-ACK retransmits and no
+ * longer counts against the listener's pending TFO limit.
+ *
+ * The req is still linked on the accept queue until the child has been
+ * accept()ed (req->sk != NULL); in that case the accept path frees it.
+ */
+void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req)
+{
+	struct sock *lsk = tcp_rsk(req)->listener;
+	struct fastopen_queue *fastopenq =
+	    inet_csk(lsk)->icsk_accept_queue.fastopenq;
+	bool free_req;
+
+	tcp_sk(sk)->fastopen_rsk = NULL;
+	spin_lock_bh(&fastopenq->lock);
+	fastopenq->qlen--;
+	tcp_rsk(req)->listener = NULL;
+	free_req = req->sk == NULL;
+	spin_unlock_bh(&fastopenq->lock);
+
+	sock_put(lsk);
+	if (free_req)
+		reqsk_free(req);
+}
@@ -1124,6 +1124,8 @@ const struct nla_policy ifla_policy[IFLA_MAX+1] = {
 	[IFLA_PROMISCUITY]	= { .type = NLA_U32 },
 	[IFLA_NUM_TX_QUEUES]	= { .type = NLA_U32 },
 	[IFLA_NUM_RX_QUEUES]	= { .type = NLA_U32 },
+	[IFLA_RX_FILTER]	= { .type = NLA_BINARY,
+				    .len = sizeof(struct sock_filter) * BPF_MAXINSNS },
 };
 EXPORT_SYMBOL(ifla_policy);
 
@@ -1396,6 +1398,22 @@ static int do_setlink(struct net_device *dev, struct ifinfomsg *ifm,
 		modified = 1;
 	}
 
+	if (tb[IFLA_RX_FILTER]) {
+		struct sock_fprog fprog;
+		int len = nla_len(tb[IFLA_RX_FILTER]);
+
+		err = -EINVAL;
+		if (len % sizeof(struct sock_filter))
+			goto errout;
+		fprog.len = len / sizeof(struct sock_filter);
+		fprog.filter = (struct sock_filter __user *)
+				nla_data(tb[IFLA_RX_FILTER]);
+		err = dev_set_rx_filter(dev, &fprog);
+		if (err < 0)
+			goto errout;
+		modified = 1;
+	}
+
 	/*
 	 * Interface selected by interface index but interface
 	 * name provided implies that a name change has been
@@ -96,14 +96,23 @@ typedef unsigned int t_key;
 #define IS_TNODE(n) (!(n->parent & T_LEAF))
 #define IS_LEAF(n) (n->parent & T_LEAF)
 
+/*
+ * slen is the longest suffix (KEYLENGTH - plen) of any prefix stored in
+ * the subtree below a node, i.e. it tells how short the shortest prefix
+ * there is. Lookups use it to skip subtrees that can not hold a prefix
+ * short enough to match once they are backtracking. It must be at the
+ * same offset in all node types.
+ */
 struct rt_trie_node {
 	unsigned long parent;
 	t_key key;
+	unsigned char slen;
 };
 
 struct leaf {
 	unsigned long parent;
 	t_key key;
+	unsigned char slen;
 	struct hlist_head list;
 	struct rcu_head rcu;
 };
@@ -119,6 +128,7 @@ struct leaf_info {
 struct tnode {
 	unsigned long parent;
 	t_key key;
+	unsigned char slen;
 	unsigned char pos;		/* 2log(KEYLENGTH) bits needed */
 	unsigned char bits;		/* 2log(KEYLENGTH) bits needed */
 	unsigned int full_children;	/* KEYLENGTH bits needed */
@@ -139,6 +149,7 @@ struct trie_use_stats {
 	unsigned int semantic_match_miss;
 	unsigned int null_node_hit;
 	unsigned int resize_node_skipped;
+	unsigned int suffix_skipped;
 };
 #endif
 
@@ -441,6 +452,7 @@ static struct leaf *leaf_new(void)
 	struct leaf *l = kmem_cache_alloc(trie_leaf_kmem, GFP_KERNEL);
 	if (l) {
 		l->parent = T_LEAF;
+		l->slen = 0;
 		INIT_HLIST_HEAD(&l->list);
 	}
 	return l;
@@ -464,6 +476,7 @@ static struct tnode *tnode_new(t_key key, int pos, int bits)
 
 	if (tn) {
 		tn->parent = T_TNODE;
+		tn->slen = 0;
 		tn->pos = pos;
 		tn->bits = bits;
 		tn->key = key;
@@ -530,6 +543,73 @@ static void tnode_put_child_reorg(struct tnode *tn, int i, struct rt_trie_node *
 	rcu_assign_pointer(tn->child[i], n);
 }
 
+static void leaf_update_suffix(struct leaf *l)
+{
+	struct leaf_info *li;
+	struct hlist_node *node;
+	unsigned char slen = 0;
+
+	hlist_for_each_entry(li, node, &l->list, hlist)
+		slen = max_t(unsigned char, slen, KEYLENGTH - li->plen);
+
+	l->slen = slen;
+}
+
+/* Recompute the suffix length of a tnode from its children */
+static void tnode_update_suffix(struct tnode *tn)
+{
+	unsigned char slen = 0;
+	int i;
+
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		struct rt_trie_node *n = rtnl_dereference(tn->child[i]);
+
+		if (n && n->slen > slen) {
+			slen = n->slen;
+			if (slen == KEYLENGTH)
+				break;
+		}
+	}
+
+	tn->slen = slen;
+}
+
+/*
+ * A prefix with suffix length slen was added below tn. The ancestors
+ * are raised bottom up, so a reader never sees a subtree hint smaller
+ * than what is actually stored there.
+ */
+static void node_push_suffix(struct tnode *tn, unsigned char slen)
+{
+	while (tn && tn->slen < slen) {
+		tn->slen = slen;
+		tn = node_parent((struct rt_trie_node *)tn);
+	}
+}
+
+/*
+ * A prefix or node with suffix length slen was removed below tn. Only
+ * nodes for which it was the longest one need to be recomputed.
+ */
+static void node_pull_suffix(struct tnode *tn, unsigned char slen)
+{
+	while (tn && tn->slen == slen) {
+		tnode_update_suffix(tn);
+		if (tn->slen == slen)
+			break;
+		tn = node_parent((struct rt_trie_node *)tn);
+	}
+}
+
+static void leaf_pull_suffix(struct leaf *l)
+{
+	unsigned char slen = l->slen;
+
+	leaf_update_suffix(l);
+	if (l->slen < slen)
+		node_pull_suffix(node_parent((struct rt_trie_node *)l), slen);
+}
+
 #define MAX_WORK 10
 static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 {
@@ -830,11 +910,14 @@ static struct tnode *inflate(struct trie *t, struct tnode *tn)
 			put_child(left, j, rtnl_dereference(inode->child[j]));
 			put_child(right, j, rtnl_dereference(inode->child[j + size]));
 		}
+		tnode_update_suffix(left);
+		tnode_update_suffix(right);
 		put_child(tn, 2*i, resize(t, left));
 		put_child(tn, 2*i+1, resize(t, right));
 
 		tnode_free_safe(inode);
 	}
+	tn->slen = oldtnode->slen;
 	tnode_free_safe(oldtnode);
 	return tn;
 nomem:
@@ -905,8 +988,10 @@ static struct tnode *halve(struct trie *t, struct tnode *tn)
 		put_child(tn, i/2, NULL);
 		put_child(newBinNode, 0, left);
 		put_child(newBinNode, 1, right);
+		newBinNode->slen = max(left->slen, right->slen);
 		put_child(tn, i/2, resize(t, newBinNode));
 	}
+	tn->slen = oldtnode->slen;
 	tnode_free_safe(oldtnode);
 	return tn;
 nomem:
@@ -1100,6 +1185,10 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 		fa_head = &li->falh;
 		insert_leaf_info(&l->list, li);
+		if (l->slen < KEYLENGTH - plen) {
+			l->slen = KEYLENGTH - plen;
+			node_push_suffix(tp, l->slen);
+		}
 		goto done;
 	}
 	l = leaf_new();
@@ -1117,6 +1206,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 	fa_head = &li->falh;
 	insert_leaf_info(&l->list, li);
+	l->slen = KEYLENGTH - plen;
 
 	if (t->trie && n == NULL) {
 		/* Case 2: n is NULL, and will just insert a new leaf */
@@ -1156,6 +1246,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		missbit = tkey_extract_bits(key, newpos, 1);
 		put_child(tn, missbit, (struct rt_trie_node *)l);
 		put_child(tn, 1-missbit, n);
+		tn->slen = n ? max(n->slen, l->slen) : l->slen;
 
 		if (tp) {
 			cindex = tkey_extract_bits(key, tp->pos, tp->bits);
@@ -1170,6 +1261,8 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		pr_warn("fib_trie tp=%p pos=%d, bits=%d, key=%0x plen=%d\n",
 			tp, tp->pos, tp->bits, key, plen);
 
+	node_push_suffix(tp, l->slen);
+
 	/* Rebalance the trie */
 
 	trie_rebalance(t, tp);
@@ -1465,6 +1558,14 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 			goto backtrace;
 		}
 
+		/* Only prefixes up to current_prefix_length can match */
+		if (n->slen < KEYLENGTH - current_prefix_length) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+			t->stats.suffix_skipped++;
+#endif
+			goto backtrace;
+		}
+
 		if (IS_LEAF(n)) {
 			ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
 			if (ret > 0)
@@ -1474,6 +1575,11 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 
 		cn = (struct tnode *)n;
 
+		/* Start fetching our slot in the child array, the checks
+		 * below only need the header of cn.
+		 */
+		prefetch(&cn->child[tkey_extract_bits(key, cn->pos, cn->bits)]);
+
 		/*
 		 * It's a tnode, and we can do some extra checks here if we
 		 * like, to avoid descending into a dead-end branch.
@@ -1557,6 +1663,13 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 
 			if (current_prefix_length >= cn->pos)
 				current_prefix_length = mp;
+
+			if (cn->slen < KEYLENGTH - current_prefix_length) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+				t->stats.suffix_skipped++;
+#endif
+				goto backtrace;
+			}
 		}
 
 		pn = (struct tnode *)n; /* Descend */
@@ -1579,9 +1692,12 @@ backtrace:
 		/*
 		 * Either we do the actual chop off according or if we have
 		 * chopped off all bits in this tnode walk up to our parent.
+		 * There is no point in trying the remaining children if
+		 * no prefix below pn is short enough.
 		 */
 
-		if (chopped_off <= pn->bits) {
+		if (chopped_off <= pn->bits &&
+		    pn->slen >= KEYLENGTH - current_prefix_length) {
 			cindex &= ~(1 << (chopped_off-1));
 		} else {
 			struct tnode *parent = node_parent_rcu((struct rt_trie_node *) pn);
@@ -1619,6 +1735,7 @@ static void trie_leaf_remove(struct trie *t, struct leaf *l)
 	if (tp) {
 		t_key cindex = tkey_extract_bits(l->key, tp->pos, tp->bits);
 		put_child(tp, cindex, NULL);
+		node_pull_suffix(tp, l->slen);
 		trie_rebalance(t, tp);
 	} else
 		RCU_INIT_POINTER(t->trie, NULL);
@@ -1706,6 +1823,8 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (hlist_empty(&l->list))
 		trie_leaf_remove(t, l);
+	else
+		leaf_pull_suffix(l);
 
 	if (fa->fa_state & FA_S_ACCESSED)
 		rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
@@ -1748,6 +1867,10 @@ static int trie_flush_leaf(struct leaf *l)
 			free_leaf_info(li);
 		}
 	}
+
+	/* an emptied leaf is removed by the caller */
+	if (!hlist_empty(lih))
+		leaf_pull_suffix(l);
 	return found;
 }
 
@@ -2169,6 +2292,8 @@ static void trie_show_usage(struct seq_file *seq,
 	seq_printf(seq, "semantic match miss = %u\n",
 		   stats->semantic_match_miss);
 	seq_printf(seq, "null node hit= %u\n", stats->null_node_hit);
+	seq_printf(seq, "suffix length skipped = %u\n",
+		   stats->suffix_skipped);
 	seq_printf(seq, "skipped node resize = %u\n\n",
 		   stats->resize_node_skipped);
 }
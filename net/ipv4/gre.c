@@ -18,8 +18,11 @@
 #include <linux/skbuff.h>
 #include <linux/in.h>
 #include <linux/ip.h>
+#include <linux/if_ether.h>
 #include <linux/netdevice.h>
+#include <linux/if_tunnel.h>
 #include <linux/spinlock.h>
+#include <net/checksum.h>
 #include <net/protocol.h>
 #include <net/gre.h>
 
@@ -112,10 +115,234 @@ static void gre_err(struct sk_buff *skb, u32 info)
 	rcu_read_unlock();
 }
 
+static int gre_gso_send_check(struct sk_buff *skb)
+{
+	if (!skb->encapsulation)
+		return -EINVAL;
+	return 0;
+}
+
+/* Segment a TCP packet carried in GRE: the inner packet is segmented as
+ * usual and the outer headers, which skb_segment() copies in front of
+ * every segment, are fixed up here (GRE checksum) and in
+ * inet_gso_segment() (outer IP header).
+ */
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
+				       netdev_features_t features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	int ghl = GRE_HEADER_SECTION;
+	struct gre_base_hdr *greh;
+	int mac_len = skb->mac_len;
+	__be16 protocol = skb->protocol;
+	__be16 inner_protocol;
+	__be16 flags;
+	int tnl_hlen;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_TCPV6 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!skb->encapsulation ||
+		     !pskb_may_pull(skb, sizeof(*greh))))
+		goto out;
+
+	greh = (struct gre_base_hdr *)skb_transport_header(skb);
+	flags = greh->flags;
+	inner_protocol = greh->protocol;
+
+	/* A sequence number can not be replicated into the segments */
+	if (flags & (GRE_VERSION | GRE_ROUTING | GRE_SEQ))
+		goto out;
+	if (flags & GRE_KEY)
+		ghl += GRE_HEADER_SECTION;
+	if (flags & GRE_CSUM) {
+		ghl += GRE_HEADER_SECTION;
+		/* The GRE checksum covers the inner packet, so the inner
+		 * checksums have to be final before it is computed.
+		 */
+		features &= ~(NETIF_F_ALL_CSUM | NETIF_F_SG);
+	}
+
+	if (unlikely(!pskb_may_pull(skb, ghl)))
+		goto out;
+
+	/* Set up the inner packet */
+	__skb_pull(skb, ghl);
+	tnl_hlen = skb->data - skb_mac_header(skb);
+	skb_reset_mac_header(skb);
+	skb->mac_len = skb_inner_network_offset(skb);
+	skb_set_network_header(skb, skb->mac_len);
+	if (inner_protocol == htons(ETH_P_TEB)) {
+		if (unlikely(skb->mac_len < ETH_HLEN))
+			goto unwind;
+		skb->protocol = eth_hdr(skb)->h_proto;
+	} else {
+		skb->protocol = inner_protocol;
+	}
+	skb->encapsulation = 0;
+
+	segs = skb_mac_gso_segment(skb, features);
+	if (IS_ERR_OR_NULL(segs))
+		goto unwind;
+
+	skb = segs;
+	do {
+		skb_reset_inner_headers(skb);
+		skb->encapsulation = 1;
+
+		__skb_push(skb, ghl);
+		if (flags & GRE_CSUM) {
+			__be32 *pcsum;
+
+			greh = (struct gre_base_hdr *)skb->data;
+			pcsum = (__be32 *)(greh + 1);
+			*pcsum = 0;
+			*(__sum16 *)pcsum = csum_fold(skb_checksum(skb, 0,
+								   skb->len, 0));
+		}
+		__skb_push(skb, tnl_hlen - ghl);
+
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, mac_len);
+		skb->mac_len = mac_len;
+		skb->protocol = protocol;
+	} while ((skb = skb->next));
+out:
+	return segs;
+
+unwind:
+	/* give the caller back the skb as it came in */
+	skb->encapsulation = 1;
+	skb->protocol = protocol;
+	skb->mac_len = mac_len;
+	skb_set_mac_header(skb, -tnl_hlen);
+	skb_set_network_header(skb, mac_len - tnl_hlen);
+	__skb_push(skb, ghl);
+	skb_reset_transport_header(skb);
+	return segs;
+}
+
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	const struct gre_base_hdr *greh;
+	struct packet_type *ptype;
+	unsigned int hlen, off;
+	unsigned int grehlen;
+	struct sk_buff *p;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*greh);
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	/* Only version 0 with an optional key is merged. Checksums and
+	 * sequence numbers differ per packet, and the latter could not be
+	 * recreated by GSO if the merged packet gets forwarded.
+	 */
+	if (greh->flags & ~GRE_KEY)
+		goto out;
+
+	grehlen = sizeof(*greh);
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(greh->protocol);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		const struct gre_base_hdr *greh2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		greh2 = (struct gre_base_hdr *)(p->data + off);
+
+		if (greh->flags != greh2->flags ||
+		    greh->protocol != greh2->protocol ||
+		    ((greh->flags & GRE_KEY) &&
+		     *(__be32 *)(greh + 1) != *(__be32 *)(greh2 + 1))) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+	}
+
+	skb_gro_pull(skb, grehlen);
+
+	/* The inner handlers validate CHECKSUM_COMPLETE over what follows
+	 * the GRE header.
+	 */
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct gre_base_hdr *greh = (struct gre_base_hdr *)(skb->data + nhoff);
+	struct packet_type *ptype;
+	unsigned int grehlen = sizeof(*greh);
+	int err = -ENOENT;
+
+	/* Tag the packet, GSO has to rebuild the GRE headers if it ends
+	 * up being forwarded.
+	 */
+	skb->encapsulation = 1;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(greh->protocol);
+	if (ptype)
+		err = ptype->gro_complete(skb, nhoff + grehlen);
+	rcu_read_unlock();
+
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
-	.handler     = gre_rcv,
-	.err_handler = gre_err,
-	.netns_ok    = 1,
+	.handler        = gre_rcv,
+	.err_handler    = gre_err,
+	.gso_send_check = gre_gso_send_check,
+	.gso_segment    = gre_gso_segment,
+	.gro_receive    = gre_gro_receive,
+	.gro_complete   = gre_gro_complete,
+	.netns_ok       = 1,
 };
 
 static int __init gre_init(void)
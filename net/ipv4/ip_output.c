@@ -475,6 +475,16 @@ int ip_fragment(struct sk_buff *skb, int (*output)(struct sk_buff *))
 		return -EMSGSIZE;
 	}
 
+	/* Tunnels keep the checksum offload of the inner packet, which does
+	 * not survive being split into fragments.
+	 */
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		err = skb_checksum_help(skb);
+		if (err)
+			goto fail;
+		iph = ip_hdr(skb);
+	}
+
 	/*
 	 *	Setup starting values.
 	 */
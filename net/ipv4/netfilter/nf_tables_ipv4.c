@@ -0,0 +1,150 @@
+/*
+ * nf_tables IPv4 address family support.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ip.h>
+#include <linux/netfilter_ipv4.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/net_namespace.h>
+#include <net/ip.h>
+
+static unsigned int nft_ipv4_hook(unsigned int hooknum,
+				  struct sk_buff *skb,
+				  const struct net_device *in,
+				  const struct net_device *out,
+				  int (*okfn)(struct sk_buff *))
+{
+	const struct net *net = dev_net(in ? in : out);
+	const struct nft_af_info *afi = net->nft.ipv4;
+	struct nft_pktinfo pkt;
+
+	if (afi == NULL)
+		return NF_ACCEPT;
+
+	if (hooknum == NF_INET_LOCAL_OUT &&
+	    (skb->len < sizeof(struct iphdr) ||
+	     ip_hdrlen(skb) < sizeof(struct iphdr)))
+		/* root is playing with raw sockets. */
+		return NF_ACCEPT;
+
+	pkt.skb	    = skb;
+	pkt.in	    = in;
+	pkt.out	    = out;
+	pkt.hooknum = hooknum;
+	pkt.thoff   = ip_hdrlen(skb);
+	/* The transport header is only available in the first fragment */
+	pkt.tprot   = ip_hdr(skb)->frag_off & htons(IP_OFFSET) ?
+		      0 : ip_hdr(skb)->protocol;
+
+	return nft_do_hook(afi, &pkt);
+}
+
+static struct nf_hook_ops nft_ipv4_ops[] __read_mostly = {
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_PRE_ROUTING,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_LOCAL_IN,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_FORWARD,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_LOCAL_OUT,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+	{
+		.hook		= nft_ipv4_hook,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_POST_ROUTING,
+		.priority	= NF_IP_PRI_FILTER,
+	},
+};
+
+static struct nft_af_info nft_af_ipv4 __read_mostly = {
+	.family		= NFPROTO_IPV4,
+	.nhooks		= NF_INET_NUMHOOKS,
+	.owner		= THIS_MODULE,
+};
+
+static int __net_init nf_tables_ipv4_init_net(struct net *net)
+{
+	struct nft_af_info *afi;
+	int err;
+
+	afi = kmemdup(&nft_af_ipv4, sizeof(*afi), GFP_KERNEL);
+	if (afi == NULL)
+		return -ENOMEM;
+
+	err = nft_register_afinfo(net, afi);
+	if (err < 0) {
+		kfree(afi);
+		return err;
+	}
+	net->nft.ipv4 = afi;
+	return 0;
+}
+
+static void __net_exit nf_tables_ipv4_exit_net(struct net *net)
+{
+	struct nft_af_info *afi = net->nft.ipv4;
+
+	net->nft.ipv4 = NULL;
+	nft_unregister_afinfo(net, afi);
+	synchronize_net();
+	kfree(afi);
+}
+
+static struct pernet_operations nf_tables_ipv4_net_ops = {
+	.init	= nf_tables_ipv4_init_net,
+	.exit	= nf_tables_ipv4_exit_net,
+};
+
+static int __init nf_tables_ipv4_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&nf_tables_ipv4_net_ops);
+	if (err < 0)
+		return err;
+
+	err = nf_register_hooks(nft_ipv4_ops, ARRAY_SIZE(nft_ipv4_ops));
+	if (err < 0)
+		unregister_pernet_subsys(&nf_tables_ipv4_net_ops);
+	return err;
+}
+
+static void __exit nf_tables_ipv4_exit(void)
+{
+	nf_unregister_hooks(nft_ipv4_ops, ARRAY_SIZE(nft_ipv4_ops));
+	unregister_pernet_subsys(&nf_tables_ipv4_net_ops);
+}
+
+module_init(nf_tables_ipv4_init);
+module_exit(nf_tables_ipv4_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_FAMILY(AF_INET);
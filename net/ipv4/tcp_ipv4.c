@@ -73,6 +73,7 @@
 #include <net/timewait_sock.h>
 #include <net/xfrm.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 #include <net/secure_seq.h>
 #include <net/tcp_memcontrol.h>
 
@@ -653,7 +654,8 @@ static void tcp_v4_send_reset(struct sock *sk, struct sk_buff *skb)
 		 * no RST generated if md5 hash doesn't match.
 		 */
 		sk1 = __inet_lookup_listener(dev_net(skb_dst(skb)->dev),
-					     &tcp_hashinfo, ip_hdr(skb)->daddr,
+					     &tcp_hashinfo, ip_hdr(skb)->saddr,
+					     th->source, ip_hdr(skb)->daddr,
 					     ntohs(th->source), inet_iif(skb));
 		/* don't send rst if it can't find key */
 		if (!sk1)
@@ -828,7 +830,8 @@ static int tcp_v4_send_synack(struct sock *sk, struct dst_entry *dst,
 			      struct request_sock *req,
 			      struct request_values *rvp,
 			      u16 queue_mapping,
-			      bool nocache)
+			      bool nocache,
+			      struct tcp_fastopen_cookie *foc)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
 	struct flowi4 fl4;
@@ -839,7 +842,7 @@ static int tcp_v4_send_synack(struct sock *sk, struct dst_entry *dst,
 	if (!dst && (dst = inet_csk_route_req(sk, &fl4, req)) == NULL)
 		return -1;
 
-	skb = tcp_make_synack(sk, dst, req, rvp);
+	skb = tcp_make_synack(sk, dst, req, rvp, foc);
 
 	if (skb) {
 		__tcp_v4_send_check(skb, ireq->loc_addr, ireq->rmt_addr);
@@ -858,7 +861,7 @@ static int tcp_v4_rtx_synack(struct sock *sk, struct request_sock *req,
 			      struct request_values *rvp)
 {
 	TCP_INC_STATS_BH(sock_net(sk), TCP_MIB_RETRANSSEGS);
-	return tcp_v4_send_synack(sk, NULL, req, rvp, 0, false);
+	return tcp_v4_send_synack(sk, NULL, req, rvp, 0, false, NULL);
 }
 
 /*
@@ -1272,10 +1275,176 @@ static const struct tcp_request_sock_ops tcp_request_sock_ipv4_ops = {
 };
 #endif
 
-int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+/*
+ * Returns true if the SYN carried a valid Fast Open cookie, so its data
+ * can be accepted right away, and the listener has room for another
+ * pending Fast Open child.  If the client asked for a cookie or sent a
+ * bad one, a fresh cookie is left in @valid_foc for the SYN-ACK.
+ */
+static bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			       struct request_sock *req,
+			       struct tcp_fastopen_cookie *foc,
+			       struct tcp_fastopen_cookie *valid_foc)
+{
+	struct fastopen_queue *fastopenq;
+
+	if (likely(!fastopen_cookie_present(foc)))
+		return false;
+
+	/* A FO option is present; bump the counter. */
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	/* Make sure the listener has enabled fastopen, and we don't
+	 * exceed the max # of pending TFO requests allowed before trying
+	 * to validate the cookie, to avoid burning CPU cycles needlessly.
+	 */
+	fastopenq = inet_csk(sk)->icsk_accept_queue.fastopenq;
+	if ((sysctl_tcp_fastopen & TFO_SERVER_ENABLE) == 0 ||
+	    fastopenq == NULL || fastopenq->max_qlen == 0)
+		return false;
+
+	if (fastopenq->qlen >= fastopenq->max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return false;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, valid_foc);
+
+	if (foc->len == 0) {
+		/* Client requesting a cookie */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		return false;
+	}
+	if (foc->len != TCP_FASTOPEN_COOKIE_SIZE ||
+	    valid_foc->len != TCP_FASTOPEN_COOKIE_SIZE ||
+	    memcmp(foc->val, valid_foc->val, TCP_FASTOPEN_COOKIE_SIZE) != 0) {
+		/* Stale or forged: drop the data, hand out a valid cookie */
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return false;
+	}
+
+	/* The client already holds this cookie, don't echo it back */
+	valid_foc->len = -1;
+
+	/* Acknowledge the data received from the peer. */
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	return true;
+}
+
+/*
+ * The SYN carried a valid Fast Open cookie: create the child socket now,
+ * queue the data from the SYN on it and hand it to accept() before the
+ * 3WHS completes.  @req is not put in the SYN table; it stays attached
+ * to the child (tp->fastopen_rsk), which retransmits the SYN-ACK from
+ * its own timer until the final ACK arrives.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst,
+				    struct request_values *rvp)
+{
+	const struct inet_request_sock *ireq = inet_rsk(req);
+	struct fastopen_queue *fastopenq =
+	    inet_csk(sk)->icsk_accept_queue.fastopenq;
+	struct ip_options_rcu *opt = ireq->opt;
+	struct sk_buff *skb_synack;
+	struct tcp_sock *tp;
+	struct sock *child;
+	struct flowi4 fl4;
+
+	if (!dst && (dst = inet_csk_route_req(sk, &fl4, req)) == NULL)
+		return -1;
+
+	/* The SYN-ACK is built first: it picks the receive window that
+	 * the child inherits from @req.
+	 */
+	skb_synack = tcp_make_synack(sk, dst, req, rvp, NULL);
+	if (!skb_synack)
+		return -1;
+	__tcp_v4_send_check(skb_synack, ireq->loc_addr, ireq->rmt_addr);
+	skb_set_queue_mapping(skb_synack, skb_get_queue_mapping(skb));
+
+	req->retrans = 0;
+	req->sk = NULL;
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, NULL);
+	if (child == NULL) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		kfree_skb(skb_synack);
+		return -1;
+	}
+
+	/* The child now owns @opt.  A lost SYN-ACK is retransmitted by
+	 * the child's timer, so the send error can be ignored here.
+	 */
+	ip_build_and_send_pkt(skb_synack, sk, ireq->loc_addr,
+			      ireq->rmt_addr, opt);
+	tcp_rsk(req)->snt_synack = tcp_time_stamp;
+
+	spin_lock(&fastopenq->lock);
+	fastopenq->qlen++;
+	spin_unlock(&fastopenq->lock);
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* An accepted child may outlive the listener; hold it so that
+	 * reqsk_fastopen_remove() can still reach the fastopen queue.
+	 */
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never
+	 * scaled. So correct it appropriately.
+	 */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	/* Add the child socket directly into the accept queue */
+	inet_csk_reqsk_queue_add(sk, req, child);
+
+	/* Now do what tcp_rcv_state_process() would do on the final ACK */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	/* Queue the data carried in the SYN.  The caller frees @skb, so
+	 * take our own reference to it first.  The SYN flag is left set
+	 * so tcp_recvmsg() skips the SYN's sequence number.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+	}
+	tp->rcv_nxt = tp->rcv_wup = TCP_SKB_CB(skb)->end_seq;
+
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+}
+
+/*
+ * @nolock is set when called from tcp_v4_syn_cookie_nolock(), without the
+ * listener lock.  The caller already decided to answer with a syncookie, so
+ * nothing here may touch the SYN queue.
+ */
+static int __tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb,
+				 bool nolock)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	const u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1285,11 +1454,17 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	__be32 daddr = ip_hdr(skb)->daddr;
 	__u32 isn = TCP_SKB_CB(skb)->when;
 	bool want_cookie = false;
+	bool do_fastopen = false;
 
 	/* Never answer to SYNs send to broadcast or multicast */
 	if (skb_rtable(skb)->rt_flags & (RTCF_BROADCAST | RTCF_MULTICAST))
 		goto drop;
 
+	if (nolock) {
+		want_cookie = true;
+		goto alloc;
+	}
+
 	/* TW buckets are converted to open requests without
 	 * limitations, they conserve resources and peer is
 	 * evidently real one.
@@ -1308,6 +1483,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	if (sk_acceptq_is_full(sk) && inet_csk_reqsk_queue_young(sk) > 1)
 		goto drop;
 
+alloc:
 	req = inet_reqsk_alloc(&tcp_request_sock_ops);
 	if (!req)
 		goto drop;
@@ -1319,10 +1495,11 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, NULL);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0,
+			  want_cookie ? NULL : &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
-	    tmp_opt.saw_tstamp &&
+	    tmp_opt.saw_tstamp && !nolock &&
 	    !tp->rx_opt.cookie_out_never &&
 	    (sysctl_tcp_cookie_size > 0 ||
 	     (tp->cookie_values != NULL &&
@@ -1419,10 +1596,23 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_rsk(req)->snt_isn = isn;
 	tcp_rsk(req)->snt_synack = tcp_time_stamp;
 
+	if (!want_cookie)
+		do_fastopen = tcp_fastopen_check(sk, skb, req, &foc,
+						 &valid_foc);
+
+	if (do_fastopen) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst,
+					     (struct request_values *)&tmp_ext))
+			goto drop_and_free;
+		return 0;
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext,
 			       skb_get_queue_mapping(skb),
-			       want_cookie) ||
+			       want_cookie,
+			       fastopen_cookie_present(&valid_foc) ?
+			       &valid_foc : NULL) ||
 	    want_cookie)
 		goto drop_and_free;
 
@@ -1436,8 +1626,69 @@ drop_and_free:
 drop:
 	return 0;
 }
+
+int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
+{
+	return __tcp_v4_conn_request(sk, skb, false);
+}
 EXPORT_SYMBOL(tcp_v4_conn_request);
 
+/*
+ * While the SYN queue of a listener is full, new SYNs are answered with a
+ * syncookie and nothing is queued on the listener.  Do that without taking
+ * the listener lock, so that a SYN flood is spread over all CPUs instead of
+ * having them spin on one socket.  syn_wait_lock keeps the SYN queue stable
+ * while we look at it; it is only written when requests are added or
+ * removed.
+ *
+ * Returns true if the SYN was consumed.
+ */
+static bool tcp_v4_syn_cookie_nolock(struct sock *sk, struct sk_buff *skb)
+{
+#ifdef CONFIG_SYN_COOKIES
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	const struct tcphdr *th = tcp_hdr(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	struct request_sock **prev;
+	bool cookie = false, drop = false;
+
+	if (!sysctl_tcp_syncookies ||
+	    !th->syn || th->ack || th->rst || th->fin ||
+	    TCP_SKB_CB(skb)->when)
+		return false;
+
+	read_lock(&queue->syn_wait_lock);
+	if (queue->listen_opt && reqsk_queue_is_full(queue) &&
+	    /* retransmitted SYNs of queued requests need tcp_check_req() */
+	    !inet_csk_search_req(sk, &prev, th->source,
+				 iph->saddr, iph->daddr)) {
+		cookie = tcp_syn_flood_action(sk, skb, "TCP");
+		drop = sk_acceptq_is_full(sk) &&
+		       reqsk_queue_len_young(queue) > 1;
+	}
+	read_unlock(&queue->syn_wait_lock);
+
+	if (!cookie)
+		return false;
+
+	/* let the locked path account for bad checksums */
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb))
+		return false;
+
+#ifdef CONFIG_TCP_MD5SIG
+	if (tcp_v4_inbound_md5_hash(sk, skb))
+		drop = true;
+#endif
+	if (!drop)
+		__tcp_v4_conn_request(sk, skb, true);
+
+	kfree_skb(skb);
+	return true;
+#else
+	return false;
+#endif
+}
+
 
 /*
  * The three way handshake has completed - we got a valid synack -
@@ -1782,8 +2033,14 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
+	if (sk->sk_state == TCP_LISTEN && tcp_v4_syn_cookie_nolock(sk, skb)) {
+		sock_put(sk);
+		return 0;
+	}
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1846,6 +2103,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1936,6 +2194,8 @@ void tcp_v4_destroy_sock(struct sock *sk)
 
 	tcp_cleanup_congestion_control(sk);
 
+	tcp_cleanup_ulp(sk);
+
 	/* Cleanup up the write buffer. */
 	tcp_write_queue_purge(sk);
 
@@ -1981,6 +2241,10 @@ void tcp_v4_destroy_sock(struct sock *sk)
 	/* If socket is aborted during connect operation */
 	tcp_free_fastopen_req(tp);
 
+	/* Fast Open child closed before the 3WHS completed */
+	if (tp->fastopen_rsk != NULL)
+		reqsk_fastopen_remove(sk, tp->fastopen_rsk);
+
 	sk_sockets_allocated_dec(sk);
 	sock_release_memcg(sk);
 }
@@ -2592,14 +2856,13 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 	return tcp_gro_receive(head, skb);
 }
 
-int tcp4_gro_complete(struct sk_buff *skb)
+int tcp4_gro_complete(struct sk_buff *skb, int thoff)
 {
 	const struct iphdr *iph = ip_hdr(skb);
 	struct tcphdr *th = tcp_hdr(skb);
 
-	th->check = ~tcp_v4_check(skb->len - skb_transport_offset(skb),
-				  iph->saddr, iph->daddr, 0);
-	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+	th->check = ~tcp_v4_check(skb->len - thoff, iph->saddr, iph->daddr, 0);
+	skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV4;
 
 	return tcp_gro_complete(skb);
 }
@@ -0,0 +1,123 @@
+/*
+ * TCP delivery rate sampling
+ *
+ * The rate of delivery is estimated on each ACK as the number of packets
+ * (S)ACKed over the time it took for them to be delivered. Each skb
+ * records, at transmit time, how many packets had been delivered so far
+ * and when; when it is (S)ACKed, the most recently sent of the newly
+ * delivered skbs yields the sample:
+ *
+ *    send_rate = #pkts_delivered / (last_snd_time - first_snd_time)
+ *    ack_rate  = #pkts_delivered / (last_ack_time - first_ack_time)
+ *    bw = min(send_rate, ack_rate)
+ *
+ * Taking the slower of the two filters out ACK compression on the return
+ * path as well as bursts on the forward path. Congestion control modules
+ * get the samples through the cong_control hook.
+ */
+
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <net/tcp.h>
+
+/* Snapshot the current delivery information in the skb, to generate
+ * a rate sample later when the skb is (s)acked in tcp_rate_skb_delivered().
+ */
+void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+	u32 now = tcp_clock_us();
+
+	/* In general we need to start delivery rate samples from the
+	 * time we received the most recent ACK, to ensure we include
+	 * the full time the network needs to deliver all in-flight
+	 * packets. If there are no packets in flight yet, then we
+	 * know that any ACKs after now indicate that the network was
+	 * able to deliver those packets completely in the sampling
+	 * interval between now and the next ACK.
+	 */
+	if (!tp->packets_out) {
+		tp->first_tx_us = now;
+		tp->delivered_us = now;
+	}
+
+	scb->tx.sent_us		= now;
+	scb->tx.first_tx_us	= tp->first_tx_us;
+	scb->tx.delivered_us	= tp->delivered_us;
+	scb->tx.delivered	= tp->delivered;
+}
+
+/* When an skb is sacked or acked, we fill in the rate sample with the (prior)
+ * delivery information when the skb was last transmitted.
+ *
+ * If an ACK (s)acks multiple skbs (e.g., stretched-acks), this function is
+ * called multiple times. We favor the information from the most recently
+ * sent skb, i.e., the skb with the highest prior_delivered count.
+ */
+void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+			    struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+	if (!scb->tx.delivered_us)
+		return;
+
+	if (!rs->prior_delivered ||
+	    after(scb->tx.delivered, rs->prior_delivered)) {
+		rs->prior_delivered	= scb->tx.delivered;
+		rs->prior_us		= scb->tx.delivered_us;
+		rs->is_retrans		= scb->sacked & TCPCB_RETRANS;
+
+		/* Find the duration of the "send phase" of this window: */
+		rs->interval_us = (s32)(scb->tx.sent_us - scb->tx.first_tx_us);
+
+		/* Record send time of most recently ACKed packet: */
+		tp->first_tx_us = scb->tx.sent_us;
+	}
+	/* Mark off the skb delivered once it's sacked to avoid being
+	 * used again when it's cumulatively acked. For acked packets
+	 * we don't need to reset since it'll be freed soon.
+	 */
+	if (scb->sacked & TCPCB_SACKED_ACKED)
+		scb->tx.delivered_us = 0;
+}
+
+/* Update the connection delivery information and generate a rate sample. */
+void tcp_rate_gen(struct sock *sk, u32 delivered, u32 lost,
+		  struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 now = tcp_clock_us();
+	long snd_us, ack_us;
+
+	if (delivered)
+		tp->delivered_us = now;
+
+	rs->acked_sacked = delivered;	/* freshly ACKed or SACKed */
+	rs->losses = lost;		/* freshly marked lost */
+
+	/* Return an invalid sample if no timing information is available. */
+	if (!rs->prior_us) {
+		rs->delivered = -1;
+		rs->interval_us = -1;
+		return;
+	}
+	rs->delivered = tp->delivered - rs->prior_delivered;
+
+	/* Model sending data and receiving ACKs as separate pipeline phases
+	 * for a window. Usually the ACK phase is longer, but with ACK
+	 * compression the send phase can be longer. To be safe we use the
+	 * longer phase.
+	 */
+	snd_us = rs->interval_us;			/* send phase */
+	ack_us = (s32)(now - rs->prior_us);		/* ack phase */
+	rs->interval_us = max(snd_us, ack_us);
+
+	/* An interval of zero or less can't be turned into a rate. */
+	if (unlikely(rs->interval_us <= 0)) {
+		rs->delivered = -1;
+		rs->interval_us = -1;
+	}
+}
@@ -145,9 +145,105 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+static int ipip_gso_send_check(struct sk_buff *skb)
+{
+	if (!skb->encapsulation)
+		return -EINVAL;
+	return 0;
+}
+
+static struct sk_buff *ipip_gso_segment(struct sk_buff *skb,
+					netdev_features_t features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	int mac_len = skb->mac_len;
+	__be16 protocol = skb->protocol;
+	int tnl_hlen;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_IPIP)))
+		goto out;
+
+	if (unlikely(!skb->encapsulation))
+		goto out;
+
+	/* The inner IP header directly follows the outer one */
+	tnl_hlen = skb->data - skb_mac_header(skb);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb->mac_len = 0;
+	skb->protocol = htons(ETH_P_IP);
+	skb->encapsulation = 0;
+
+	segs = skb_mac_gso_segment(skb, features);
+	if (IS_ERR_OR_NULL(segs)) {
+		skb->encapsulation = 1;
+		skb->protocol = protocol;
+		skb->mac_len = mac_len;
+		skb_set_mac_header(skb, -tnl_hlen);
+		skb_set_network_header(skb, mac_len - tnl_hlen);
+		goto out;
+	}
+
+	skb = segs;
+	do {
+		skb_reset_inner_headers(skb);
+		skb->encapsulation = 1;
+
+		__skb_push(skb, tnl_hlen);
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, mac_len);
+		skb->mac_len = mac_len;
+		skb->protocol = protocol;
+	} while ((skb = skb->next));
+out:
+	return segs;
+}
+
+static struct sk_buff **ipip_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(htons(ETH_P_IP));
+	if (ptype)
+		pp = ptype->gro_receive(head, skb);
+	else
+		NAPI_GRO_CB(skb)->flush = 1;
+	rcu_read_unlock();
+
+	return pp;
+}
+
+static int ipip_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	skb->encapsulation = 1;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_IPIP;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(htons(ETH_P_IP));
+	if (ptype)
+		err = ptype->gro_complete(skb, nhoff);
+	rcu_read_unlock();
+
+	return err;
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gso_send_check	=	ipip_gso_send_check,
+	.gso_segment	=	ipip_gso_segment,
+	.gro_receive	=	ipip_gro_receive,
+	.gro_complete	=	ipip_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
@@ -871,6 +871,7 @@ static netdev_tx_t ipip6_tunnel_xmit(struct sk_buff *skb,
 		iph->ttl	=	iph6->hop_limit;
 
 	nf_reset(skb);
+	skb->ip_summed = CHECKSUM_NONE;
 	tstats = this_cpu_ptr(dev->tstats);
 	__IPTUNNEL_XMIT(tstats, &dev->stats);
 	return NETDEV_TX_OK;
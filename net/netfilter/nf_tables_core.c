@@ -0,0 +1,197 @@
+/*
+ * nf_tables rule evaluation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables_core.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/net_namespace.h>
+
+struct nft_jumpstack {
+	const struct nft_chain	*chain;
+	const struct nft_rule	*rule;
+};
+
+/**
+ *	nft_do_chain - evaluate a base chain and the chains it jumps to
+ *
+ *	@chain: base chain
+ *	@pkt: packet information
+ *
+ *	Must be called under rcu_read_lock(). Returns the netfilter verdict.
+ */
+unsigned int nft_do_chain(const struct nft_chain *chain,
+			  const struct nft_pktinfo *pkt)
+{
+	const struct nft_chain *basechain = chain;
+	const struct nft_rule *rule;
+	const struct nft_expr *expr, *last;
+	struct nft_data data[NFT_REG_MAX + 1];
+	struct nft_jumpstack jumpstack[NFT_JUMP_STACK_SIZE];
+	unsigned int stackptr = 0;
+	struct net *net = dev_net(pkt->in ? pkt->in : pkt->out);
+	/*
+	 * Cache the generation cursor, a transaction commit may flip it
+	 * while the packet traverses the ruleset.
+	 */
+	unsigned int gencursor = ACCESS_ONCE(net->nft.gencursor);
+
+do_chain:
+	rule = list_entry(&chain->rules, struct nft_rule, list);
+next_rule:
+	data[NFT_REG_VERDICT].verdict = NFT_CONTINUE;
+	list_for_each_entry_continue_rcu(rule, &chain->rules, list) {
+
+		/* This rule is not active in the current generation, skip. */
+		if (unlikely(rule->genmask & (1 << gencursor)))
+			continue;
+
+		nft_rule_for_each_expr(expr, last, rule) {
+			expr->ops->eval(expr, data, pkt);
+			if (data[NFT_REG_VERDICT].verdict != NFT_CONTINUE)
+				break;
+		}
+
+		switch (data[NFT_REG_VERDICT].verdict) {
+		case NFT_BREAK:
+			data[NFT_REG_VERDICT].verdict = NFT_CONTINUE;
+			/* fall through */
+		case NFT_CONTINUE:
+			continue;
+		}
+		break;
+	}
+
+	switch (data[NFT_REG_VERDICT].verdict) {
+	case NF_ACCEPT:
+	case NF_DROP:
+		return data[NFT_REG_VERDICT].verdict;
+	case NFT_JUMP:
+		if (unlikely(stackptr >= NFT_JUMP_STACK_SIZE)) {
+			net_warn_ratelimited("nf_tables: jump stack overflow in chain %s\n",
+					     chain->name);
+			return NF_DROP;
+		}
+		jumpstack[stackptr].chain = chain;
+		jumpstack[stackptr].rule  = rule;
+		stackptr++;
+		/* fall through */
+	case NFT_GOTO:
+		chain = data[NFT_REG_VERDICT].chain;
+		goto do_chain;
+	case NFT_RETURN:
+	case NFT_CONTINUE:
+		break;
+	default:
+		WARN_ON(1);
+	}
+
+	if (stackptr > 0) {
+		stackptr--;
+		chain = jumpstack[stackptr].chain;
+		rule  = jumpstack[stackptr].rule;
+		goto next_rule;
+	}
+
+	return nft_base_chain(basechain)->policy;
+}
+EXPORT_SYMBOL_GPL(nft_do_chain);
+
+/**
+ *	nft_do_hook - evaluate the base chains attached to a hook
+ *
+ *	@afi: address family info
+ *	@pkt: packet information
+ *
+ *	Base chains are evaluated in ascending priority order until one of
+ *	them returns a verdict other than NF_ACCEPT.
+ */
+unsigned int nft_do_hook(const struct nft_af_info *afi,
+			 const struct nft_pktinfo *pkt)
+{
+	const struct nft_base_chain *basechain;
+	unsigned int verdict = NF_ACCEPT;
+
+	list_for_each_entry_rcu(basechain, &afi->hooks[pkt->hooknum],
+				hook_list) {
+		verdict = nft_do_chain(&basechain->chain, pkt);
+		if (verdict != NF_ACCEPT)
+			break;
+	}
+	return verdict;
+}
+EXPORT_SYMBOL_GPL(nft_do_hook);
+
+int __init nf_tables_core_module_init(void)
+{
+	int err;
+
+	err = nft_immediate_module_init();
+	if (err < 0)
+		goto err1;
+
+	err = nft_cmp_module_init();
+	if (err < 0)
+		goto err2;
+
+	err = nft_lookup_module_init();
+	if (err < 0)
+		goto err3;
+
+	err = nft_bitwise_module_init();
+	if (err < 0)
+		goto err4;
+
+	err = nft_payload_module_init();
+	if (err < 0)
+		goto err5;
+
+	err = nft_hash_module_init();
+	if (err < 0)
+		goto err6;
+
+	err = nft_rbtree_module_init();
+	if (err < 0)
+		goto err7;
+
+	return 0;
+
+err7:
+	nft_hash_module_exit();
+err6:
+	nft_payload_module_exit();
+err5:
+	nft_bitwise_module_exit();
+err4:
+	nft_lookup_module_exit();
+err3:
+	nft_cmp_module_exit();
+err2:
+	nft_immediate_module_exit();
+err1:
+	return err;
+}
+
+void nf_tables_core_module_exit(void)
+{
+	nft_rbtree_module_exit();
+	nft_hash_module_exit();
+	nft_payload_module_exit();
+	nft_bitwise_module_exit();
+	nft_lookup_module_exit();
+	nft_cmp_module_exit();
+	nft_immediate_module_exit();
+}
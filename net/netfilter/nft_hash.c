@@ -0,0 +1,325 @@
+/*
+ * nf_tables hash set: exact match lookups in O(1).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables_core.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_HASH_MIN_SIZE	16
+#define NFT_HASH_MAX_SIZE	(1U << 20)
+
+/* Updates are serialized by the nfnetlink mutex */
+#define nft_dereference(p)	rcu_dereference_protected(p, 1)
+
+struct nft_hash_table {
+	unsigned int			size;
+	struct hlist_head		buckets[];
+};
+
+struct nft_hash {
+	struct nft_hash_table __rcu	*tbl;
+	unsigned int			nelems;
+};
+
+struct nft_hash_elem {
+	struct hlist_node		node;
+	struct rcu_head			rcu;
+	struct nft_data			data;
+	u32				key[];
+};
+
+static u32 nft_hash_rnd __read_mostly;
+
+static unsigned int nft_hash_data(const void *key, unsigned int size,
+				  unsigned int len)
+{
+	return jhash(key, len, nft_hash_rnd) & (size - 1);
+}
+
+static bool nft_hash_lookup(const struct nft_set *set, const void *key,
+			    struct nft_data *data)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	const struct nft_hash_table *tbl = rcu_dereference(priv->tbl);
+	const struct nft_hash_elem *he;
+	struct hlist_node *pos;
+	unsigned int h;
+
+	h = nft_hash_data(key, tbl->size, set->klen);
+	hlist_for_each_entry_rcu(he, pos, &tbl->buckets[h], node) {
+		if (memcmp(he->key, key, set->klen))
+			continue;
+		if (data != NULL)
+			nft_data_copy(data, &he->data);
+		return true;
+	}
+	return false;
+}
+
+static struct nft_hash_table *nft_hash_tbl_alloc(unsigned int size)
+{
+	struct nft_hash_table *tbl;
+	size_t sz;
+
+	sz = sizeof(*tbl) + size * sizeof(tbl->buckets[0]);
+	tbl = kzalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+	if (tbl == NULL)
+		tbl = vzalloc(sz);
+	if (tbl == NULL)
+		return NULL;
+	tbl->size = size;
+	return tbl;
+}
+
+static void nft_hash_tbl_free(struct nft_hash_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+static void nft_hash_tbl_flush(struct nft_hash_table *tbl)
+{
+	struct nft_hash_elem *he;
+	struct hlist_node *pos, *next;
+	unsigned int i;
+
+	for (i = 0; i < tbl->size; i++) {
+		hlist_for_each_entry_safe(he, pos, next, &tbl->buckets[i], node)
+			kfree(he);
+	}
+}
+
+static unsigned int nft_hash_elem_size(const struct nft_set *set)
+{
+	return sizeof(struct nft_hash_elem) + set->klen;
+}
+
+/*
+ * Double the number of buckets. Lookups may walk the old table until the
+ * grace period has passed, so the elements are copied instead of being
+ * relinked. A failure is not fatal, the table just stays more loaded.
+ */
+static void nft_hash_tbl_grow(const struct nft_set *set, struct nft_hash *priv)
+{
+	struct nft_hash_table *tbl = nft_dereference(priv->tbl), *ntbl;
+	struct nft_hash_elem *he, *nhe;
+	struct hlist_node *pos;
+	unsigned int i, h;
+
+	if (tbl->size >= NFT_HASH_MAX_SIZE)
+		return;
+
+	ntbl = nft_hash_tbl_alloc(tbl->size * 2);
+	if (ntbl == NULL)
+		return;
+
+	for (i = 0; i < tbl->size; i++) {
+		hlist_for_each_entry(he, pos, &tbl->buckets[i], node) {
+			nhe = kmemdup(he, nft_hash_elem_size(set), GFP_KERNEL);
+			if (nhe == NULL)
+				goto err;
+			h = nft_hash_data(nhe->key, ntbl->size, set->klen);
+			hlist_add_head(&nhe->node, &ntbl->buckets[h]);
+		}
+	}
+
+	rcu_assign_pointer(priv->tbl, ntbl);
+	synchronize_rcu();
+
+	nft_hash_tbl_flush(tbl);
+	nft_hash_tbl_free(tbl);
+	return;
+
+err:
+	nft_hash_tbl_flush(ntbl);
+	nft_hash_tbl_free(ntbl);
+}
+
+static struct nft_hash_elem *nft_hash_find(const struct nft_set *set,
+					   const void *key)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl = nft_dereference(priv->tbl);
+	struct nft_hash_elem *he;
+	struct hlist_node *pos;
+	unsigned int h;
+
+	h = nft_hash_data(key, tbl->size, set->klen);
+	hlist_for_each_entry(he, pos, &tbl->buckets[h], node) {
+		if (!memcmp(he->key, key, set->klen))
+			return he;
+	}
+	return NULL;
+}
+
+static int nft_hash_insert(const struct nft_set *set,
+			   const struct nft_set_elem *elem)
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl;
+	struct nft_hash_elem *he;
+	unsigned int h;
+
+	if (elem->flags != 0)
+		return -EINVAL;
+
+	if (nft_hash_find(set, elem->key) != NULL)
+		return -EEXIST;
+
+	he = kzalloc(nft_hash_elem_size(set), GFP_KERNEL);
+	if (he == NULL)
+		return -ENOMEM;
+
+	memcpy(he->key, elem->key, set->klen);
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(&he->data, &elem->data);
+
+	tbl = nft_dereference(priv->tbl);
+	h = nft_hash_data(he->key, tbl->size, set->klen);
+	hlist_add_head_rcu(&he->node, &tbl->buckets[h]);
+
+	/* Keep the average chain length at one element or less */
+	if (++priv->nelems > tbl->size)
+		nft_hash_tbl_grow(set, priv);
+	return 0;
+}
+
+static void nft_hash_remove(const struct nft_set *set,
+			    const struct nft_set_elem *elem)
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_elem *he;
+
+	he = nft_hash_find(set, elem->key);
+	if (he == NULL)
+		return;
+
+	hlist_del_rcu(&he->node);
+	kfree_rcu(he, rcu);
+	priv->nelems--;
+}
+
+static int nft_hash_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	const struct nft_hash_elem *he;
+
+	he = nft_hash_find(set, elem->key);
+	if (he == NULL)
+		return -ENOENT;
+
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(&elem->data, &he->data);
+	elem->flags = 0;
+	return 0;
+}
+
+static void nft_hash_walk(const struct nft_ctx *ctx, const struct nft_set *set,
+			  struct nft_set_iter *iter)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	const struct nft_hash_table *tbl;
+	const struct nft_hash_elem *he;
+	struct nft_set_elem elem;
+	struct hlist_node *pos;
+	unsigned int i;
+
+	rcu_read_lock();
+	tbl = rcu_dereference(priv->tbl);
+	for (i = 0; i < tbl->size; i++) {
+		hlist_for_each_entry_rcu(he, pos, &tbl->buckets[i], node) {
+			if (iter->count < iter->skip)
+				goto cont;
+
+			memcpy(elem.key, he->key, set->klen);
+			if (set->flags & NFT_SET_MAP)
+				nft_data_copy(&elem.data, &he->data);
+			elem.flags = 0;
+
+			iter->err = iter->fn(ctx, set, iter, &elem);
+			if (iter->err < 0)
+				goto out;
+cont:
+			iter->count++;
+		}
+	}
+out:
+	rcu_read_unlock();
+}
+
+static unsigned int nft_hash_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_hash);
+}
+
+static int nft_hash_init(const struct nft_set *set,
+			 const struct nlattr * const tb[])
+{
+	struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl;
+	unsigned int size;
+
+	/* Size the table from the expected number of elements */
+	size = NFT_HASH_MIN_SIZE;
+	if (set->size > size)
+		size = roundup_pow_of_two(min(set->size, NFT_HASH_MAX_SIZE));
+
+	tbl = nft_hash_tbl_alloc(size);
+	if (tbl == NULL)
+		return -ENOMEM;
+
+	RCU_INIT_POINTER(priv->tbl, tbl);
+	priv->nelems = 0;
+	return 0;
+}
+
+static void nft_hash_destroy(const struct nft_set *set)
+{
+	const struct nft_hash *priv = nft_set_priv(set);
+	struct nft_hash_table *tbl = nft_dereference(priv->tbl);
+
+	nft_hash_tbl_flush(tbl);
+	nft_hash_tbl_free(tbl);
+}
+
+static struct nft_set_ops nft_hash_ops __read_mostly = {
+	.privsize	= nft_hash_privsize,
+	.init		= nft_hash_init,
+	.destroy	= nft_hash_destroy,
+	.get		= nft_hash_get,
+	.insert		= nft_hash_insert,
+	.remove		= nft_hash_remove,
+	.lookup		= nft_hash_lookup,
+	.walk		= nft_hash_walk,
+	.features	= NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+int __init nft_hash_module_init(void)
+{
+	get_random_bytes(&nft_hash_rnd, sizeof(nft_hash_rnd));
+	return nft_register_set(&nft_hash_ops);
+}
+
+void nft_hash_module_exit(void)
+{
+	nft_unregister_set(&nft_hash_ops);
+}
@@ -0,0 +1,155 @@
+/*
+ * nf_tables ipset expression: match packets against an ipset.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Existing ipsets can be used from nf_tables rules the same way xt_set
+ * uses them from iptables, the set is referenced by name and kept alive
+ * as long as the rule exists.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <net/netfilter/nf_tables.h>
+
+struct nft_ipset {
+	ip_set_id_t		index;
+	struct ip_set_adt_opt	opt;
+	bool			inv;
+};
+
+static void nft_ipset_eval(const struct nft_expr *expr,
+			   struct nft_data data[NFT_REG_MAX + 1],
+			   const struct nft_pktinfo *pkt)
+{
+	const struct nft_ipset *priv = nft_expr_priv(expr);
+	struct xt_action_param par = {
+		.in		= pkt->in,
+		.out		= pkt->out,
+		.hooknum	= pkt->hooknum,
+		.family		= priv->opt.family,
+		.thoff		= pkt->thoff,
+	};
+	bool match;
+
+	match = ip_set_test(priv->index, pkt->skb, &par, &priv->opt) > 0;
+	if (match == priv->inv)
+		data[NFT_REG_VERDICT].verdict = NFT_BREAK;
+}
+
+static const struct nla_policy nft_ipset_policy[NFTA_IPSET_MAX + 1] = {
+	[NFTA_IPSET_NAME]	= { .type = NLA_STRING,
+				    .len = IPSET_MAXNAMELEN - 1 },
+	[NFTA_IPSET_DIM]	= { .type = NLA_U32 },
+	[NFTA_IPSET_DIR]	= { .type = NLA_U32 },
+	[NFTA_IPSET_FLAGS]	= { .type = NLA_U32 },
+};
+
+#define NFT_IPSET_DIR_MASK	(((1 << IPSET_DIM_MAX) - 1) << IPSET_DIM_ONE)
+
+static int nft_ipset_init(const struct nft_ctx *ctx,
+			  const struct nft_expr *expr,
+			  const struct nlattr * const tb[])
+{
+	struct nft_ipset *priv = nft_expr_priv(expr);
+	char name[IPSET_MAXNAMELEN];
+	struct ip_set *set;
+	ip_set_id_t index;
+	u32 dim, dir, flags;
+
+	if (tb[NFTA_IPSET_NAME] == NULL ||
+	    tb[NFTA_IPSET_DIM] == NULL)
+		return -EINVAL;
+
+	dim = ntohl(nla_get_be32(tb[NFTA_IPSET_DIM]));
+	if (dim == IPSET_DIM_ZERO || dim > IPSET_DIM_MAX)
+		return -ERANGE;
+
+	dir = 0;
+	if (tb[NFTA_IPSET_DIR] != NULL) {
+		dir = ntohl(nla_get_be32(tb[NFTA_IPSET_DIR]));
+		if (dir & ~NFT_IPSET_DIR_MASK)
+			return -EINVAL;
+	}
+
+	flags = 0;
+	if (tb[NFTA_IPSET_FLAGS] != NULL) {
+		flags = ntohl(nla_get_be32(tb[NFTA_IPSET_FLAGS]));
+		if (flags & ~NFT_IPSET_INV)
+			return -EINVAL;
+	}
+
+	nla_strlcpy(name, tb[NFTA_IPSET_NAME], sizeof(name));
+	index = ip_set_get_byname(name, &set);
+	if (index == IPSET_INVALID_ID)
+		return -ENOENT;
+
+	priv->index		= index;
+	priv->opt.family	= ctx->afi->family;
+	priv->opt.dim		= dim;
+	priv->opt.flags		= dir;
+	priv->opt.cmdflags	= 0;
+	priv->opt.timeout	= UINT_MAX;
+	priv->inv		= flags & NFT_IPSET_INV;
+	return 0;
+}
+
+static void nft_ipset_destroy(const struct nft_expr *expr)
+{
+	const struct nft_ipset *priv = nft_expr_priv(expr);
+
+	ip_set_put_byindex(priv->index);
+}
+
+static int nft_ipset_dump(struct sk_buff *skb, const struct nft_expr *expr)
+{
+	const struct nft_ipset *priv = nft_expr_priv(expr);
+
+	if (nla_put_string(skb, NFTA_IPSET_NAME,
+			   ip_set_name_byindex(priv->index)) ||
+	    nla_put_be32(skb, NFTA_IPSET_DIM, htonl(priv->opt.dim)) ||
+	    nla_put_be32(skb, NFTA_IPSET_DIR, htonl(priv->opt.flags)) ||
+	    nla_put_be32(skb, NFTA_IPSET_FLAGS,
+			 htonl(priv->inv ? NFT_IPSET_INV : 0)))
+		goto nla_put_failure;
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
+static struct nft_expr_ops nft_ipset_ops __read_mostly = {
+	.name		= "ipset",
+	.size		= NFT_EXPR_SIZE(sizeof(struct nft_ipset)),
+	.owner		= THIS_MODULE,
+	.eval		= nft_ipset_eval,
+	.init		= nft_ipset_init,
+	.destroy	= nft_ipset_destroy,
+	.dump		= nft_ipset_dump,
+	.policy		= nft_ipset_policy,
+	.maxattr	= NFTA_IPSET_MAX,
+};
+
+static int __init nft_ipset_module_init(void)
+{
+	return nft_register_expr(&nft_ipset_ops);
+}
+
+static void __exit nft_ipset_module_exit(void)
+{
+	nft_unregister_expr(&nft_ipset_ops);
+}
+
+module_init(nft_ipset_module_init);
+module_exit(nft_ipset_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_EXPR("ipset");
@@ -0,0 +1,269 @@
+/*
+ * nf_tables rbtree set: interval matching.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * An interval is stored as two elements, the start of the interval and
+ * an element flagged NFT_SET_ELEM_INTERVAL_END following its last key.
+ * A lookup finds the greatest element less than or equal to the key and
+ * matches unless that element ends an interval.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables_core.h>
+#include <net/netfilter/nf_tables.h>
+
+struct nft_rbtree {
+	rwlock_t		lock;
+	struct rb_root		root;
+};
+
+struct nft_rbtree_elem {
+	struct rb_node		node;
+	u16			flags;
+	struct nft_data		data;
+	u32			key[];
+};
+
+/*
+ * Order by key, an interval end sorts before an interval start with the
+ * same key so adjacent intervals may share their boundary.
+ */
+static int nft_rbtree_cmp(const struct nft_set *set,
+			  const struct nft_rbtree_elem *rbe,
+			  const void *key, u32 flags)
+{
+	int d;
+
+	d = memcmp(rbe->key, key, set->klen);
+	if (d != 0)
+		return d;
+
+	return (flags & NFT_SET_ELEM_INTERVAL_END) -
+	       (rbe->flags & NFT_SET_ELEM_INTERVAL_END);
+}
+
+static bool nft_rbtree_lookup(const struct nft_set *set, const void *key,
+			      struct nft_data *data)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+	const struct nft_rbtree_elem *rbe, *interval = NULL;
+	const struct rb_node *parent;
+	int d;
+
+	read_lock(&priv->lock);
+	parent = priv->root.rb_node;
+	while (parent != NULL) {
+		rbe = rb_entry(parent, struct nft_rbtree_elem, node);
+
+		d = memcmp(rbe->key, key, set->klen);
+		if (d > 0) {
+			parent = parent->rb_left;
+			continue;
+		}
+
+		interval = rbe;
+		/* An exact match on an interval start is final */
+		if (d == 0 && !(rbe->flags & NFT_SET_ELEM_INTERVAL_END))
+			break;
+		parent = parent->rb_right;
+	}
+
+	if (interval == NULL ||
+	    interval->flags & NFT_SET_ELEM_INTERVAL_END) {
+		read_unlock(&priv->lock);
+		return false;
+	}
+
+	if (data != NULL)
+		nft_data_copy(data, &interval->data);
+	read_unlock(&priv->lock);
+	return true;
+}
+
+static struct nft_rbtree_elem *nft_rbtree_find(const struct nft_set *set,
+					       const struct nft_set_elem *elem)
+{
+	const struct nft_rbtree *priv = nft_set_priv(set);
+	struct nft_rbtree_elem *rbe;
+	struct rb_node *parent = priv->root.rb_node;
+	int d;
+
+	while (parent != NULL) {
+		rbe = rb_entry(parent, struct nft_rbtree_elem, node);
+
+		d = nft_rbtree_cmp(set, rbe, elem->key, elem->flags);
+		if (d > 0)
+			parent = parent->rb_left;
+		else if (d < 0)
+			parent = parent->rb_right;
+		else
+			return rbe;
+	}
+	return NULL;
+}
+
+static int nft_rbtree_insert(const struct nft_set *set,
+			     const struct nft_set_elem *elem)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+	struct nft_rbtree_elem *rbe, *new;
+	struct rb_node *parent, **p;
+	int d;
+
+	new = kzalloc(sizeof(*new) + set->klen, GFP_KERNEL);
+	if (new == NULL)
+		return -ENOMEM;
+
+	memcpy(new->key, elem->key, set->klen);
+	new->flags = elem->flags;
+	if (set->flags & NFT_SET_MAP &&
+	    !(elem->flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(&new->data, &elem->data);
+
+	write_lock_bh(&priv->lock);
+	parent = NULL;
+	p = &priv->root.rb_node;
+	while (*p != NULL) {
+		parent = *p;
+		rbe = rb_entry(parent, struct nft_rbtree_elem, node);
+
+		d = nft_rbtree_cmp(set, rbe, new->key, new->flags);
+		if (d > 0)
+			p = &parent->rb_left;
+		else if (d < 0)
+			p = &parent->rb_right;
+		else {
+			write_unlock_bh(&priv->lock);
+			kfree(new);
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &priv->root);
+	write_unlock_bh(&priv->lock);
+	return 0;
+}
+
+static void nft_rbtree_remove(const struct nft_set *set,
+			      const struct nft_set_elem *elem)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+	struct nft_rbtree_elem *rbe;
+
+	rbe = nft_rbtree_find(set, elem);
+	if (rbe == NULL)
+		return;
+
+	write_lock_bh(&priv->lock);
+	rb_erase(&rbe->node, &priv->root);
+	write_unlock_bh(&priv->lock);
+	kfree(rbe);
+}
+
+static int nft_rbtree_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	const struct nft_rbtree_elem *rbe;
+
+	rbe = nft_rbtree_find(set, elem);
+	if (rbe == NULL)
+		return -ENOENT;
+
+	if (set->flags & NFT_SET_MAP &&
+	    !(rbe->flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(&elem->data, &rbe->data);
+	elem->flags = rbe->flags;
+	return 0;
+}
+
+static void nft_rbtree_walk(const struct nft_ctx *ctx,
+			    const struct nft_set *set,
+			    struct nft_set_iter *iter)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+	const struct nft_rbtree_elem *rbe;
+	struct nft_set_elem elem;
+	struct rb_node *node;
+
+	read_lock_bh(&priv->lock);
+	for (node = rb_first(&priv->root); node != NULL; node = rb_next(node)) {
+		if (iter->count < iter->skip)
+			goto cont;
+
+		rbe = rb_entry(node, struct nft_rbtree_elem, node);
+		memcpy(elem.key, rbe->key, set->klen);
+		if (set->flags & NFT_SET_MAP &&
+		    !(rbe->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_copy(&elem.data, &rbe->data);
+		elem.flags = rbe->flags;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0)
+			break;
+cont:
+		iter->count++;
+	}
+	read_unlock_bh(&priv->lock);
+}
+
+static unsigned int nft_rbtree_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_rbtree);
+}
+
+static int nft_rbtree_init(const struct nft_set *set,
+			   const struct nlattr * const nla[])
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+
+	rwlock_init(&priv->lock);
+	priv->root = RB_ROOT;
+	return 0;
+}
+
+static void nft_rbtree_destroy(const struct nft_set *set)
+{
+	struct nft_rbtree *priv = nft_set_priv(set);
+	struct nft_rbtree_elem *rbe;
+	struct rb_node *node;
+
+	while ((node = priv->root.rb_node) != NULL) {
+		rb_erase(node, &priv->root);
+		rbe = rb_entry(node, struct nft_rbtree_elem, node);
+		kfree(rbe);
+	}
+}
+
+static struct nft_set_ops nft_rbtree_ops __read_mostly = {
+	.privsize	= nft_rbtree_privsize,
+	.init		= nft_rbtree_init,
+	.destroy	= nft_rbtree_destroy,
+	.get		= nft_rbtree_get,
+	.insert		= nft_rbtree_insert,
+	.remove		= nft_rbtree_remove,
+	.lookup		= nft_rbtree_lookup,
+	.walk		= nft_rbtree_walk,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+int __init nft_rbtree_module_init(void)
+{
+	return nft_register_set(&nft_rbtree_ops);
+}
+
+void nft_rbtree_module_exit(void)
+{
+	nft_unregister_set(&nft_rbtree_ops);
+}
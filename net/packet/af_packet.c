@@ -88,6 +88,7 @@
 #include <linux/virtio_net.h>
 #include <linux/errqueue.h>
 #include <linux/net_tstamp.h>
+#include <linux/reciprocal_div.h>
 
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
@@ -307,8 +308,10 @@ struct packet_fanout {
 	u16			id;
 	u8			type;
 	u8			defrag;
+	u8			rollover;
 	atomic_t		rr_cur;
 	struct list_head	list;
+	struct sk_filter __rcu	*bpf_prog;
 	struct sock		*arr[PACKET_FANOUT_MAX];
 	spinlock_t		lock;
 	atomic_t		sk_ref;
@@ -1178,16 +1181,16 @@ static int fanout_rr_next(struct packet_fanout *f, unsigned int num)
 	return x;
 }
 
-static struct sock *fanout_demux_hash(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+static unsigned int fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb,
+				      unsigned int num)
 {
-	u32 idx, hash = skb->rxhash;
-
-	idx = ((u64)hash * num) >> 32;
-
-	return f->arr[idx];
+	return ((u64)skb->rxhash * num) >> 32;
 }
 
-static struct sock *fanout_demux_lb(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+static unsigned int fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb,
+				    unsigned int num)
 {
 	int cur, old;
 
@@ -1195,14 +1198,93 @@ static struct sock *fanout_demux_lb(struct packet_fanout *f, struct sk_buff *skb
 	while ((old = atomic_cmpxchg(&f->rr_cur, cur,
 				     fanout_rr_next(f, num))) != cur)
 		cur = old;
-	return f->arr[cur];
+	return cur;
+}
+
+static unsigned int fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb,
+				     unsigned int num)
+{
+	return smp_processor_id() % num;
+}
+
+static unsigned int fanout_demux_rnd(struct packet_fanout *f,
+				     struct sk_buff *skb,
+				     unsigned int num)
+{
+	return reciprocal_divide(net_random(), num);
+}
+
+static unsigned int fanout_demux_qm(struct packet_fanout *f,
+				    struct sk_buff *skb,
+				    unsigned int num)
+{
+	return skb_get_rx_queue(skb) % num;
+}
+
+/*
+ * The classic BPF program sees the packet from the link layer header on,
+ * its return value modulo the number of members selects the socket.
+ */
+static unsigned int fanout_demux_bpf(struct packet_fanout *f,
+				     struct sk_buff *skb,
+				     unsigned int num)
+{
+	struct sk_filter *prog;
+	unsigned int offset, ret = 0;
+
+	prog = rcu_dereference(f->bpf_prog);
+	if (prog) {
+		offset = skb->data - skb_mac_header(skb);
+		__skb_push(skb, offset);
+		ret = SK_RUN_FILTER(prog, skb) % num;
+		__skb_pull(skb, offset);
+	}
+
+	return ret;
+}
+
+/* Whether the socket can take skb without dropping it, only a hint */
+static bool packet_rcv_has_room(struct packet_sock *po, struct sk_buff *skb)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct sock *sk = &po->sk;
+
+	if (!rb->pg_vec)
+		return atomic_read(&sk->sk_rmem_alloc) + skb->truesize <=
+		       sk->sk_rcvbuf;
+
+	if (po->tp_version == TPACKET_V3)
+		return prb_lookup_block(po, rb, rb->prb_bdqc.kactive_blk_num,
+					TP_STATUS_KERNEL) != NULL;
+
+	return packet_lookup_frame(po, rb, rb->head, TP_STATUS_KERNEL) != NULL;
 }
 
-static struct sock *fanout_demux_cpu(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+/*
+ * Pick the first member after idx with room in its receive ring, so that
+ * a busy capture thread does not drop while others have space.  Stays on
+ * idx if all are full.
+ */
+static unsigned int fanout_demux_rollover(struct packet_fanout *f,
+					  struct sk_buff *skb,
+					  unsigned int idx, bool try_self,
+					  unsigned int num)
 {
-	unsigned int cpu = smp_processor_id();
+	unsigned int i, j;
+
+	if (try_self && packet_rcv_has_room(pkt_sk(f->arr[idx]), skb))
+		return idx;
+
+	for (i = 1; i < num; i++) {
+		j = idx + i;
+		if (j >= num)
+			j -= num;
+		if (packet_rcv_has_room(pkt_sk(f->arr[j]), skb))
+			return j;
+	}
 
-	return f->arr[cpu % num];
+	return idx;
 }
 
 static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
@@ -1211,7 +1293,7 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	struct packet_fanout *f = pt->af_packet_priv;
 	unsigned int num = f->num_members;
 	struct packet_sock *po;
-	struct sock *sk;
+	unsigned int idx;
 
 	if (!net_eq(dev_net(dev), read_pnet(&f->net)) ||
 	    !num) {
@@ -1228,17 +1310,32 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 				return 0;
 		}
 		skb_get_rxhash(skb);
-		sk = fanout_demux_hash(f, skb, num);
+		idx = fanout_demux_hash(f, skb, num);
 		break;
 	case PACKET_FANOUT_LB:
-		sk = fanout_demux_lb(f, skb, num);
+		idx = fanout_demux_lb(f, skb, num);
 		break;
 	case PACKET_FANOUT_CPU:
-		sk = fanout_demux_cpu(f, skb, num);
+		idx = fanout_demux_cpu(f, skb, num);
+		break;
+	case PACKET_FANOUT_RND:
+		idx = fanout_demux_rnd(f, skb, num);
+		break;
+	case PACKET_FANOUT_QM:
+		idx = fanout_demux_qm(f, skb, num);
+		break;
+	case PACKET_FANOUT_CBPF:
+		idx = fanout_demux_bpf(f, skb, num);
+		break;
+	case PACKET_FANOUT_ROLLOVER:
+		idx = fanout_demux_rollover(f, skb, 0, true, num);
 		break;
 	}
 
-	po = pkt_sk(sk);
+	if (f->rollover && f->type != PACKET_FANOUT_ROLLOVER)
+		idx = fanout_demux_rollover(f, skb, idx, true, num);
+
+	po = pkt_sk(f->arr[idx]);
 
 	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
 }
@@ -1287,12 +1384,17 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	struct packet_fanout *f, *match;
 	u8 type = type_flags & 0xff;
 	u8 defrag = (type_flags & PACKET_FANOUT_FLAG_DEFRAG) ? 1 : 0;
+	u8 rollover = (type_flags & PACKET_FANOUT_FLAG_ROLLOVER) ? 1 : 0;
 	int err;
 
 	switch (type) {
 	case PACKET_FANOUT_HASH:
 	case PACKET_FANOUT_LB:
 	case PACKET_FANOUT_CPU:
+	case PACKET_FANOUT_ROLLOVER:
+	case PACKET_FANOUT_RND:
+	case PACKET_FANOUT_QM:
+	case PACKET_FANOUT_CBPF:
 		break;
 	default:
 		return -EINVAL;
@@ -1314,7 +1416,8 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		}
 	}
 	err = -EINVAL;
-	if (match && match->defrag != defrag)
+	if (match && (match->defrag != defrag ||
+		      match->rollover != rollover))
 		goto out;
 	if (!match) {
 		err = -ENOMEM;
@@ -1325,6 +1428,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		match->id = id;
 		match->type = type;
 		match->defrag = defrag;
+		match->rollover = rollover;
 		atomic_set(&match->rr_cur, 0);
 		INIT_LIST_HEAD(&match->list);
 		spin_lock_init(&match->lock);
@@ -1370,11 +1474,61 @@ static void fanout_release(struct sock *sk)
 	if (atomic_dec_and_test(&f->sk_ref)) {
 		list_del(&f->list);
 		dev_remove_pack(&f->prot_hook);
+		if (f->bpf_prog)
+			sk_unattached_filter_destroy(
+				rcu_dereference_protected(f->bpf_prog, 1));
 		kfree(f);
 	}
 	mutex_unlock(&fanout_mutex);
 }
 
+static int fanout_set_data(struct packet_sock *po, char __user *data,
+			   unsigned int len)
+{
+	struct sk_filter *new, *old;
+	struct sock_filter *insns;
+	struct sock_fprog fprog;
+	unsigned int fsize;
+	int err;
+
+	if (!po->fanout || po->fanout->type != PACKET_FANOUT_CBPF)
+		return -EINVAL;
+	if (len != sizeof(fprog))
+		return -EINVAL;
+	if (copy_from_user(&fprog, data, len))
+		return -EFAULT;
+
+	fsize = sizeof(struct sock_filter) * fprog.len;
+	if (!fprog.len || fprog.len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	insns = kmalloc(fsize, GFP_KERNEL);
+	if (!insns)
+		return -ENOMEM;
+	if (copy_from_user(insns, fprog.filter, fsize)) {
+		kfree(insns);
+		return -EFAULT;
+	}
+
+	fprog.filter = insns;
+	err = sk_unattached_filter_create(&new, &fprog);
+	kfree(insns);
+	if (err)
+		return err;
+
+	mutex_lock(&fanout_mutex);
+	old = rcu_dereference_protected(po->fanout->bpf_prog,
+					lockdep_is_held(&fanout_mutex));
+	rcu_assign_pointer(po->fanout->bpf_prog, new);
+	mutex_unlock(&fanout_mutex);
+
+	if (old) {
+		synchronize_net();
+		sk_unattached_filter_destroy(old);
+	}
+	return 0;
+}
+
 static const struct proto_ops packet_ops;
 
 static const struct proto_ops packet_ops_spkt;
@@ -3216,6 +3370,13 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 
 		return fanout_add(sk, val & 0xffff, val >> 16);
 	}
+	case PACKET_FANOUT_DATA:
+	{
+		if (!po->fanout)
+			return -EINVAL;
+
+		return fanout_set_data(po, optval, optlen);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -3304,7 +3465,11 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	case PACKET_FANOUT:
 		val = (po->fanout ?
 		       ((u32)po->fanout->id |
-			((u32)po->fanout->type << 16)) :
+			((u32)po->fanout->type << 16) |
+			(po->fanout->defrag ?
+			 (u32)PACKET_FANOUT_FLAG_DEFRAG << 16 : 0) |
+			(po->fanout->rollover ?
+			 (u32)PACKET_FANOUT_FLAG_ROLLOVER << 16 : 0)) :
 		       0);
 		break;
 	default:
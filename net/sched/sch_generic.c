@@ -25,6 +25,7 @@
 #include <linux/rcupdate.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/log2.h>
 #include <net/pkt_sched.h>
 #include <net/dst.h>
 
@@ -50,18 +51,39 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 	return 0;
 }
 
+/*
+ * Put back packets of a bulk dequeue that were not handed to the driver.
+ * They are sent before anything still in the qdisc, in order.
+ */
+static inline void dev_requeue_skb_list(struct sk_buff_head *list,
+					struct Qdisc *q)
+{
+	if (skb_queue_empty(list))
+		return;
+
+	q->q.qlen += skb_queue_len(list);
+	skb_queue_splice_init(list, &q->requeue);
+	__netif_schedule(q);
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
 
-	if (unlikely(skb)) {
+	if (unlikely(skb || !skb_queue_empty(&q->requeue))) {
 		struct net_device *dev = qdisc_dev(q);
 		struct netdev_queue *txq;
 
+		if (!skb)
+			skb = skb_peek(&q->requeue);
+
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 		if (!netif_xmit_frozen_or_stopped(txq)) {
-			q->gso_skb = NULL;
+			if (skb == q->gso_skb)
+				q->gso_skb = NULL;
+			else
+				__skb_unlink(skb, &q->requeue);
 			q->q.qlen--;
 		} else
 			skb = NULL;
@@ -72,6 +94,56 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 	return skb;
 }
 
+/* Maximum number of packets handed to the driver under one tx lock */
+#define QDISC_BULK_MAX	8
+
+/*
+ * Dequeue more packets for the same TX queue as @skb, as long as BQL lets
+ * the queue take them.  Knowing that more packets follow, the driver can
+ * defer the doorbell (skb->xmit_more) until the last one.
+ *
+ * Returns false when there is nothing to bulk, @list is left empty then.
+ */
+static bool try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb,
+				 struct net_device *dev,
+				 struct netdev_queue *txq,
+				 struct sk_buff_head *list)
+{
+#ifdef CONFIG_BQL
+	int budget = dql_avail(&txq->dql) - skb->len;
+	struct sk_buff *nskb;
+
+	/* LLTX drivers may fail on their own lock with packets in flight */
+	if (budget <= 0 || (dev->features & NETIF_F_LLTX) ||
+	    !skb_queue_empty(&q->requeue) || q->gso_skb)
+		return false;
+
+	__skb_queue_head_init(list);
+	__skb_queue_tail(list, skb);
+	while (budget > 0 && skb_queue_len(list) < QDISC_BULK_MAX) {
+		nskb = q->dequeue(q);
+		if (!nskb)
+			break;
+
+		if (skb_get_queue_mapping(nskb) != skb_get_queue_mapping(skb)) {
+			/* Sent on its own by the next qdisc_restart() */
+			__skb_queue_tail(&q->requeue, nskb);
+			q->q.qlen++;
+			break;
+		}
+
+		budget -= nskb->len;
+		__skb_queue_tail(list, nskb);
+	}
+
+	if (skb_queue_len(list) > 1)
+		return true;
+
+	__skb_unlink(skb, list);
+#endif
+	return false;
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -116,8 +188,11 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 {
 	int ret = NETDEV_TX_BUSY;
 
-	/* And release qdisc */
-	spin_unlock(root_lock);
+	/* And release qdisc, TCQ_F_NOLOCK qdiscs have no lock to release */
+	if (root_lock)
+		spin_unlock(root_lock);
+
+	skb->xmit_more = 0;
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
 	if (!netif_xmit_frozen_or_stopped(txq))
@@ -125,7 +200,8 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 
 	HARD_TX_UNLOCK(dev, txq);
 
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
 	if (dev_xmit_complete(ret)) {
 		/* Driver sent out skb successfully or skb was consumed */
@@ -148,6 +224,62 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	return ret;
 }
 
+/*
+ * Transmit a bulk of skbs for @txq under a single tx lock, all but the last
+ * one flagged with skb->xmit_more.  Same return convention and requeue
+ * handling as sch_direct_xmit(), packets not handed to the driver are
+ * requeued.
+ */
+static int sch_direct_xmit_bulk(struct sk_buff_head *list, struct Qdisc *q,
+				struct net_device *dev,
+				struct netdev_queue *txq,
+				spinlock_t *root_lock)
+{
+	int ret = NETDEV_TX_BUSY;
+	struct sk_buff *skb;
+
+	if (root_lock)
+		spin_unlock(root_lock);
+
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		if (netif_xmit_frozen_or_stopped(txq)) {
+			/*
+			 * The driver stopped the queue, it rang the doorbell
+			 * for what it accepted so far.
+			 */
+			ret = NETDEV_TX_BUSY;
+			break;
+		}
+
+		skb->xmit_more = !skb_queue_empty(list);
+		ret = dev_hard_start_xmit(skb, dev, txq);
+		if (!dev_xmit_complete(ret))
+			break;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+
+	if (root_lock)
+		spin_lock(root_lock);
+
+	if (skb) {
+		/* Driver returned NETDEV_TX_BUSY or queue got stopped */
+		if (unlikely(ret != NETDEV_TX_BUSY))
+			net_warn_ratelimited("BUG %s code %d qlen %d\n",
+					     dev->name, ret, q->q.qlen);
+
+		dev_requeue_skb_list(list, q);
+		ret = dev_requeue_skb(skb, q);
+	} else {
+		ret = qdisc_qlen(q);
+	}
+
+	if (ret && netif_xmit_frozen_or_stopped(txq))
+		ret = 0;
+
+	return ret;
+}
+
 /*
  * NOTE: Called under qdisc_lock(q) with locally disabled BH.
  *
@@ -173,16 +305,20 @@ static inline int qdisc_restart(struct Qdisc *q)
 	struct net_device *dev;
 	spinlock_t *root_lock;
 	struct sk_buff *skb;
+	struct sk_buff_head list;
 
 	/* Dequeue packet */
 	skb = dequeue_skb(q);
 	if (unlikely(!skb))
 		return 0;
 	WARN_ON_ONCE(skb_dst_is_noref(skb));
-	root_lock = qdisc_lock(q);
+	root_lock = (q->flags & TCQ_F_NOLOCK) ? NULL : qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
+	if (try_bulk_dequeue_skb(q, skb, dev, txq, &list))
+		return sch_direct_xmit_bulk(&list, q, dev, txq, root_lock);
+
 	return sch_direct_xmit(skb, q, dev, txq, root_lock);
 }
 
@@ -205,6 +341,20 @@ void __qdisc_run(struct Qdisc *q)
 	qdisc_run_end(q);
 }
 
+void __qdisc_run_end_nolock(struct Qdisc *q)
+{
+	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+	smp_mb__after_clear_bit();
+
+	/*
+	 * A sender that enqueued while we were about to stop saw the qdisc
+	 * running and left the packet to us, make sure it is not stranded.
+	 */
+	if (unlikely(q->ops->peek(q)))
+		__netif_schedule(q);
+}
+EXPORT_SYMBOL(__qdisc_run_end_nolock);
+
 unsigned long dev_trans_start(struct net_device *dev)
 {
 	unsigned long val, res = dev->trans_start;
@@ -545,6 +695,215 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 };
 EXPORT_SYMBOL(pfifo_fast_ops);
 
+/*
+ * pfifo_lockless: the three bands of pfifo_fast, each one a bounded
+ * multi-producer ring.  Senders enqueue in parallel without the qdisc lock
+ * (TCQ_F_NOLOCK), the CPU owning __QDISC_STATE_RUNNING is the only one to
+ * dequeue.
+ *
+ * Every slot carries a sequence number: a slot at position pos is free for
+ * producers when seq == pos, and holds a packet for the consumer when
+ * seq == pos + 1.  Producers claim positions with cmpxchg on tail.
+ */
+struct pfifo_ring_slot {
+	unsigned int		seq;
+	struct sk_buff		*skb;
+};
+
+struct pfifo_ring {
+	struct pfifo_ring_slot	*slots;
+	unsigned int		mask;
+	unsigned int		head ____cacheline_aligned_in_smp;
+	unsigned int		tail ____cacheline_aligned_in_smp;
+};
+
+struct pfifo_lockless_priv {
+	struct pfifo_ring	ring[PFIFO_FAST_BANDS];
+	atomic_t		drops;
+};
+
+static bool pfifo_ring_produce(struct pfifo_ring *r, struct sk_buff *skb)
+{
+	struct pfifo_ring_slot *slot;
+	unsigned int pos = ACCESS_ONCE(r->tail);
+	int diff;
+
+	for (;;) {
+		slot = &r->slots[pos & r->mask];
+		diff = (int)(ACCESS_ONCE(slot->seq) - pos);
+		if (diff == 0) {
+			if (cmpxchg(&r->tail, pos, pos + 1) == pos)
+				break;
+		} else if (diff < 0) {
+			/* The consumer did not release this slot yet: full */
+			return false;
+		}
+		pos = ACCESS_ONCE(r->tail);
+	}
+
+	slot->skb = skb;
+	smp_wmb();
+	slot->seq = pos + 1;
+	return true;
+}
+
+static struct sk_buff *pfifo_ring_peek(const struct pfifo_ring *r)
+{
+	const struct pfifo_ring_slot *slot = &r->slots[r->head & r->mask];
+
+	if (ACCESS_ONCE(slot->seq) != r->head + 1)
+		return NULL;
+	smp_rmb();
+	return slot->skb;
+}
+
+static struct sk_buff *pfifo_ring_consume(struct pfifo_ring *r)
+{
+	struct pfifo_ring_slot *slot = &r->slots[r->head & r->mask];
+	struct sk_buff *skb;
+
+	skb = pfifo_ring_peek(r);
+	if (!skb)
+		return NULL;
+
+	/* The skb pointer must be read before producers may reuse the slot */
+	smp_mb();
+	slot->seq = r->head + r->mask + 1;
+	r->head++;
+	return skb;
+}
+
+/* Only stable in the dequeue path, an estimate anywhere else */
+static unsigned int pfifo_lockless_qlen(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	unsigned int band, qlen = skb_queue_len(&qdisc->requeue);
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		qlen += ACCESS_ONCE(priv->ring[band].tail) -
+			priv->ring[band].head;
+
+	return qlen + (qdisc->gso_skb ? 1 : 0);
+}
+
+static int pfifo_lockless_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+
+	if (likely(pfifo_ring_produce(&priv->ring[band], skb)))
+		return NET_XMIT_SUCCESS;
+
+	atomic_inc(&priv->drops);
+	kfree_skb(skb);
+	return NET_XMIT_DROP;
+}
+
+static struct sk_buff *pfifo_lockless_dequeue(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_ring_consume(&priv->ring[band]);
+
+	/* q.qlen and qstats are only written by the dequeuing CPU */
+	qdisc->q.qlen = pfifo_lockless_qlen(qdisc);
+	qdisc->qstats.drops = atomic_read(&priv->drops);
+	if (skb)
+		qdisc_bstats_update(qdisc, skb);
+
+	return skb;
+}
+
+static struct sk_buff *pfifo_lockless_peek(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb = NULL;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+		skb = pfifo_ring_peek(&priv->ring[band]);
+
+	return skb;
+}
+
+static void pfifo_lockless_reset(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		if (!priv->ring[band].slots)
+			continue;
+		while ((skb = pfifo_ring_consume(&priv->ring[band])) != NULL)
+			kfree_skb(skb);
+	}
+
+	qdisc->qstats.backlog = 0;
+	qdisc->q.qlen = 0;
+}
+
+static int pfifo_lockless_dump(struct Qdisc *qdisc, struct sk_buff *skb)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+
+	qdisc->q.qlen = pfifo_lockless_qlen(qdisc);
+	qdisc->qstats.drops = atomic_read(&priv->drops);
+	return pfifo_fast_dump(qdisc, skb);
+}
+
+static void pfifo_lockless_destroy(struct Qdisc *qdisc)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		kfree(priv->ring[band].slots);
+}
+
+static int pfifo_lockless_init(struct Qdisc *qdisc, struct nlattr *opt)
+{
+	struct pfifo_lockless_priv *priv = qdisc_priv(qdisc);
+	unsigned int i, size;
+	int band;
+
+	size = roundup_pow_of_two(max_t(unsigned long,
+					qdisc_dev(qdisc)->tx_queue_len, 1));
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_ring *r = &priv->ring[band];
+
+		r->slots = kmalloc_node(size * sizeof(*r->slots), GFP_KERNEL,
+				netdev_queue_numa_node_read(qdisc->dev_queue));
+		if (!r->slots)
+			return -ENOMEM;
+		for (i = 0; i < size; i++)
+			r->slots[i].seq = i;
+		r->mask = size - 1;
+	}
+	atomic_set(&priv->drops, 0);
+
+	qdisc->flags |= TCQ_F_NOLOCK;
+	return 0;
+}
+
+struct Qdisc_ops pfifo_lockless_ops __read_mostly = {
+	.id		=	"pfifo_lockless",
+	.priv_size	=	sizeof(struct pfifo_lockless_priv),
+	.enqueue	=	pfifo_lockless_enqueue,
+	.dequeue	=	pfifo_lockless_dequeue,
+	.peek		=	pfifo_lockless_peek,
+	.init		=	pfifo_lockless_init,
+	.reset		=	pfifo_lockless_reset,
+	.destroy	=	pfifo_lockless_destroy,
+	.dump		=	pfifo_lockless_dump,
+	.owner		=	THIS_MODULE,
+};
+EXPORT_SYMBOL(pfifo_lockless_ops);
+
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 			  struct Qdisc_ops *ops)
 {
@@ -571,6 +930,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	}
 	INIT_LIST_HEAD(&sch->list);
 	skb_queue_head_init(&sch->q);
+	__skb_queue_head_init(&sch->requeue);
 	spin_lock_init(&sch->busylock);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
@@ -609,6 +969,14 @@ void qdisc_reset(struct Qdisc *qdisc)
 {
 	const struct Qdisc_ops *ops = qdisc->ops;
 
+	/*
+	 * The qdisc lock does not keep the dequeuing CPU of a TCQ_F_NOLOCK
+	 * qdisc away, leave the queues to it if it runs, qdisc_destroy()
+	 * purges them anyway.
+	 */
+	if ((qdisc->flags & TCQ_F_NOLOCK) && !qdisc_run_begin(qdisc))
+		return;
+
 	if (ops->reset)
 		ops->reset(qdisc);
 
@@ -617,6 +985,13 @@ void qdisc_reset(struct Qdisc *qdisc)
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
+	if (!skb_queue_empty(&qdisc->requeue)) {
+		__skb_queue_purge(&qdisc->requeue);
+		qdisc->q.qlen = 0;
+	}
+
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		clear_bit(__QDISC_STATE_RUNNING, &qdisc->state);
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -650,6 +1025,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	dev_put(qdisc_dev(qdisc));
 
 	kfree_skb(qdisc->gso_skb);
+	__skb_queue_purge(&qdisc->requeue);
 	/*
 	 * gen_estimator est_timer() might access qdisc->q.lock,
 	 * wait a RCU grace period before freeing qdisc.
@@ -399,6 +399,7 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 {
 	struct rpc_xprt *xprt;
 	struct rpc_clnt *clnt;
+	unsigned int i;
 	struct xprt_create xprtargs = {
 		.net = args->net,
 		.ident = args->protocol,
@@ -462,6 +463,22 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (IS_ERR(clnt))
 		return clnt;
 
+	/*
+	 * Additional connections to the same server.  Tasks get spread
+	 * over all of them by rpc_task_set_client().
+	 */
+	for (i = 1; i < min_t(unsigned int, args->nconnect, RPC_MAX_NCONNECT); i++) {
+		xprt = xprt_create_transport(&xprtargs);
+		if (IS_ERR(xprt)) {
+			rpc_shutdown_client(clnt);
+			return (struct rpc_clnt *)xprt;
+		}
+		xprt->resvport = 1;
+		if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
+			xprt->resvport = 0;
+		clnt->cl_xprt_extra[clnt->cl_nr_xprt_extra++] = xprt;
+	}
+
 	if (!(args->flags & RPC_CLNT_CREATE_NOPING)) {
 		int err = rpc_ping(clnt);
 		if (err != 0) {
@@ -495,6 +512,7 @@ rpc_clone_client(struct rpc_clnt *clnt)
 {
 	struct rpc_clnt *new;
 	struct rpc_xprt *xprt;
+	unsigned int i;
 	int err = -ENOMEM;
 
 	new = kmemdup(clnt, sizeof(*new), GFP_KERNEL);
@@ -520,6 +538,8 @@ rpc_clone_client(struct rpc_clnt *clnt)
 	if (xprt == NULL)
 		goto out_no_transport;
 	rcu_assign_pointer(new->cl_xprt, xprt);
+	for (i = 0; i < new->cl_nr_xprt_extra; i++)
+		xprt_get(new->cl_xprt_extra[i]);
 	atomic_set(&new->cl_count, 1);
 	err = rpc_setup_pipedir(new, clnt->cl_program->pipe_dir_name);
 	if (err != 0)
@@ -532,6 +552,8 @@ rpc_clone_client(struct rpc_clnt *clnt)
 	rpciod_up();
 	return new;
 out_no_path:
+	for (i = 0; i < new->cl_nr_xprt_extra; i++)
+		xprt_put(new->cl_xprt_extra[i]);
 	xprt_put(xprt);
 out_no_transport:
 	kfree(new->cl_principal);
@@ -602,6 +624,8 @@ EXPORT_SYMBOL_GPL(rpc_shutdown_client);
 static void
 rpc_free_client(struct rpc_clnt *clnt)
 {
+	unsigned int i;
+
 	dprintk_rcu("RPC:       destroying %s client for %s\n",
 			clnt->cl_protname,
 			rcu_dereference(clnt->cl_xprt)->servername);
@@ -612,6 +636,8 @@ rpc_free_client(struct rpc_clnt *clnt)
 	rpc_free_iostats(clnt->cl_metrics);
 	kfree(clnt->cl_principal);
 	clnt->cl_metrics = NULL;
+	for (i = 0; i < clnt->cl_nr_xprt_extra; i++)
+		xprt_put(clnt->cl_xprt_extra[i]);
 	xprt_put(rcu_dereference_raw(clnt->cl_xprt));
 	rpciod_down();
 	kfree(clnt);
@@ -703,11 +729,31 @@ void rpc_task_release_client(struct rpc_task *task)
 		list_del(&task->tk_task);
 		spin_unlock(&clnt->cl_lock);
 		task->tk_client = NULL;
+		task->tk_xprt = NULL;
 
 		rpc_release_client(clnt);
 	}
 }
 
+/*
+ * Pick the transport for a task.  With more than one connection to the
+ * server, tasks go round-robin over all of them.  Swap-out is set up on
+ * the first transport only, so swapper tasks always stay there.
+ */
+static void rpc_task_set_xprt(struct rpc_task *task, struct rpc_clnt *clnt)
+{
+	unsigned int n = clnt->cl_nr_xprt_extra;
+
+	if (n != 0 && !RPC_IS_SWAPPER(task)) {
+		n = (unsigned int)atomic_inc_return(&clnt->cl_xprt_next) % (n + 1);
+		if (n != 0) {
+			task->tk_xprt = clnt->cl_xprt_extra[n - 1];
+			return;
+		}
+	}
+	task->tk_xprt = rcu_dereference_raw(clnt->cl_xprt);
+}
+
 static
 void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 {
@@ -726,6 +772,7 @@ void rpc_task_set_client(struct rpc_task *task, struct rpc_clnt *clnt)
 				task->tk_flags |= RPC_TASK_SWAPPER;
 			rcu_read_unlock();
 		}
+		rpc_task_set_xprt(task, clnt);
 		/* Add to the client's list of all tasks */
 		spin_lock(&clnt->cl_lock);
 		list_add_tail(&task->tk_task, &clnt->cl_tasks);
@@ -1169,10 +1216,14 @@ EXPORT_SYMBOL_GPL(rpc_max_payload);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
+	unsigned int i;
+
 	if (clnt->cl_autobind) {
 		rcu_read_lock();
 		xprt_clear_bound(rcu_dereference(clnt->cl_xprt));
 		rcu_read_unlock();
+		for (i = 0; i < clnt->cl_nr_xprt_extra; i++)
+			xprt_clear_bound(clnt->cl_xprt_extra[i]);
 	}
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
@@ -19,6 +19,7 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/log2.h>
 #include <linux/sunrpc/clnt.h>
 #include <linux/sunrpc/svcsock.h>
 #include <linux/sunrpc/metrics.h>
@@ -116,7 +117,15 @@ EXPORT_SYMBOL_GPL(svc_seq_show);
  */
 struct rpc_iostats *rpc_alloc_iostats(struct rpc_clnt *clnt)
 {
-	return kcalloc(clnt->cl_maxproc, sizeof(struct rpc_iostats), GFP_KERNEL);
+	struct rpc_iostats *stats;
+	unsigned int i;
+
+	stats = kcalloc(clnt->cl_maxproc, sizeof(struct rpc_iostats), GFP_KERNEL);
+	if (stats) {
+		for (i = 0; i < clnt->cl_maxproc; i++)
+			spin_lock_init(&stats[i].om_lock);
+	}
+	return stats;
 }
 EXPORT_SYMBOL_GPL(rpc_alloc_iostats);
 
@@ -131,12 +140,21 @@ void rpc_free_iostats(struct rpc_iostats *stats)
 }
 EXPORT_SYMBOL_GPL(rpc_free_iostats);
 
+static unsigned int rpc_iostats_bucket(ktime_t t)
+{
+	s64 usecs = ktime_to_us(t);
+
+	if (usecs <= 0)
+		return 0;
+	return min_t(unsigned int, ilog2((u64)usecs) + 1,
+		     RPC_IOSTATS_HIST_BUCKETS - 1);
+}
+
 /**
  * rpc_count_iostats - tally up per-task stats
  * @task: completed rpc_task
  * @stats: array of stat structures
  *
- * Relies on the caller for serialization.
  */
 void rpc_count_iostats(const struct rpc_task *task, struct rpc_iostats *stats)
 {
@@ -149,6 +167,8 @@ void rpc_count_iostats(const struct rpc_task *task, struct rpc_iostats *stats)
 
 	op_metrics = &stats[task->tk_msg.rpc_proc->p_statidx];
 
+	spin_lock_bh(&op_metrics->om_lock);
+
 	op_metrics->om_ops++;
 	op_metrics->om_ntrans += req->rq_ntrans;
 	op_metrics->om_timeouts += task->tk_timeouts;
@@ -160,9 +180,13 @@ void rpc_count_iostats(const struct rpc_task *task, struct rpc_iostats *stats)
 	op_metrics->om_queue = ktime_add(op_metrics->om_queue, delta);
 
 	op_metrics->om_rtt = ktime_add(op_metrics->om_rtt, req->rq_rtt);
+	op_metrics->om_rtt_hist[rpc_iostats_bucket(req->rq_rtt)]++;
 
 	delta = ktime_sub(ktime_get(), task->tk_start);
 	op_metrics->om_execute = ktime_add(op_metrics->om_execute, delta);
+	op_metrics->om_execute_hist[rpc_iostats_bucket(delta)]++;
+
+	spin_unlock_bh(&op_metrics->om_lock);
 }
 EXPORT_SYMBOL_GPL(rpc_count_iostats);
 
@@ -177,11 +201,22 @@ static void _print_name(struct seq_file *seq, unsigned int op,
 		seq_printf(seq, "\t%12u: ", op);
 }
 
+static void _print_hist(struct seq_file *seq, const char *name,
+			const unsigned int *hist)
+{
+	int i;
+
+	seq_printf(seq, "%s", name);
+	for (i = 0; i < RPC_IOSTATS_HIST_BUCKETS; i++)
+		seq_printf(seq, " %u", hist[i]);
+	seq_putc(seq, '\n');
+}
+
 void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 {
 	struct rpc_iostats *stats = clnt->cl_metrics;
 	struct rpc_xprt *xprt;
-	unsigned int op, maxproc = clnt->cl_maxproc;
+	unsigned int i, op, maxproc = clnt->cl_maxproc;
 
 	if (!stats)
 		return;
@@ -195,6 +230,10 @@ void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 	if (xprt)
 		xprt->ops->print_stats(xprt, seq);
 	rcu_read_unlock();
+	for (i = 0; i < clnt->cl_nr_xprt_extra; i++) {
+		xprt = clnt->cl_xprt_extra[i];
+		xprt->ops->print_stats(xprt, seq);
+	}
 
 	seq_printf(seq, "\tper-op statistics\n");
 	for (op = 0; op < maxproc; op++) {
@@ -210,6 +249,18 @@ void rpc_print_iostats(struct seq_file *seq, struct rpc_clnt *clnt)
 				ktime_to_ms(metrics->om_rtt),
 				ktime_to_ms(metrics->om_execute));
 	}
+
+	seq_printf(seq, "\tper-op latency histograms (log2 usecs)\n");
+	for (op = 0; op < maxproc; op++) {
+		struct rpc_iostats *metrics = &stats[op];
+
+		if (!metrics->om_ops)
+			continue;
+		_print_name(seq, op, clnt->cl_procinfo);
+		_print_hist(seq, "rtt", metrics->om_rtt_hist);
+		_print_name(seq, op, clnt->cl_procinfo);
+		_print_hist(seq, "execute", metrics->om_execute_hist);
+	}
 }
 EXPORT_SYMBOL_GPL(rpc_print_iostats);
 
@@ -38,6 +38,10 @@ static LIST_HEAD(svc_xprt_class_list);
 /* SMP locking strategy:
  *
  *	svc_pool->sp_lock protects most of the fields of that pool.
+ *	sp_all_threads is also walked under RCU, to find idle threads
+ *	without taking sp_lock.  A thread is idle while RQ_BUSY is clear
+ *	in its rq_flags; svc_rqst->rq_lock serialises setting RQ_BUSY with
+ *	handing the thread a transport in rq_xprt.
  *	svc_serv->sv_lock protects sv_tempsocks, sv_permsocks, sv_tmpcnt.
  *	when both need to be taken (rare), svc_serv->sv_lock is first.
  *	BKL protects svc_serv->sv_nrthread.
@@ -281,25 +285,6 @@ char *svc_print_addr(struct svc_rqst *rqstp, char *buf, size_t len)
 }
 EXPORT_SYMBOL_GPL(svc_print_addr);
 
-/*
- * Queue up an idle server thread.  Must have pool->sp_lock held.
- * Note: this is really a stack rather than a queue, so that we only
- * use as many different threads as we need, and the rest don't pollute
- * the cache.
- */
-static void svc_thread_enqueue(struct svc_pool *pool, struct svc_rqst *rqstp)
-{
-	list_add(&rqstp->rq_list, &pool->sp_threads);
-}
-
-/*
- * Dequeue an nfsd thread.  Must have pool->sp_lock held.
- */
-static void svc_thread_dequeue(struct svc_pool *pool, struct svc_rqst *rqstp)
-{
-	list_del(&rqstp->rq_list);
-}
-
 static bool svc_xprt_has_something_to_do(struct svc_xprt *xprt)
 {
 	if (xprt->xpt_flags & ((1<<XPT_CONN)|(1<<XPT_CLOSE)))
@@ -313,30 +298,20 @@ static bool svc_xprt_has_something_to_do(struct svc_xprt *xprt)
  * Queue up a transport with data pending. If there are idle nfsd
  * processes, wake 'em up.
  *
+ * Idle threads are found by walking the pool's thread list under RCU,
+ * so handing a transport to a waiting thread takes no pool-wide lock.
+ * Only when all threads are busy does the transport go on sp_sockets.
  */
 void svc_xprt_enqueue(struct svc_xprt *xprt)
 {
 	struct svc_pool *pool;
 	struct svc_rqst	*rqstp;
+	bool queued = false;
 	int cpu;
 
 	if (!svc_xprt_has_something_to_do(xprt))
 		return;
 
-	cpu = get_cpu();
-	pool = svc_pool_for_cpu(xprt->xpt_server, cpu);
-	put_cpu();
-
-	spin_lock_bh(&pool->sp_lock);
-
-	if (!list_empty(&pool->sp_threads) &&
-	    !list_empty(&pool->sp_sockets))
-		printk(KERN_ERR
-		       "svc_xprt_enqueue: "
-		       "threads and transports both waiting??\n");
-
-	pool->sp_stats.packets++;
-
 	/* Mark transport as busy. It will remain in this state until
 	 * the provider calls svc_xprt_received. We update XPT_BUSY
 	 * atomically because it also guards against trying to enqueue
@@ -345,32 +320,58 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 	if (test_and_set_bit(XPT_BUSY, &xprt->xpt_flags)) {
 		/* Don't enqueue transport while already enqueued */
 		dprintk("svc: transport %p busy, not enqueued\n", xprt);
-		goto out_unlock;
+		return;
 	}
 
-	if (!list_empty(&pool->sp_threads)) {
-		rqstp = list_entry(pool->sp_threads.next,
-				   struct svc_rqst,
-				   rq_list);
-		dprintk("svc: transport %p served by daemon %p\n",
-			xprt, rqstp);
-		svc_thread_dequeue(pool, rqstp);
-		if (rqstp->rq_xprt)
-			printk(KERN_ERR
-				"svc_xprt_enqueue: server %p, rq_xprt=%p!\n",
-				rqstp, rqstp->rq_xprt);
-		rqstp->rq_xprt = xprt;
-		svc_xprt_get(xprt);
-		pool->sp_stats.threads_woken++;
+	cpu = get_cpu();
+	pool = svc_pool_for_cpu(xprt->xpt_server, cpu);
+	put_cpu();
+
+	atomic_long_inc(&pool->sp_stats.packets);
+
+redo_search:
+	rcu_read_lock();
+	list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
+		if (test_bit(RQ_BUSY, &rqstp->rq_flags))
+			continue;
+		/*
+		 * Once on sp_sockets the transport belongs to whichever
+		 * thread dequeues it, just make sure someone is awake.
+		 */
+		if (!queued) {
+			spin_lock_bh(&rqstp->rq_lock);
+			if (test_and_set_bit(RQ_BUSY, &rqstp->rq_flags)) {
+				spin_unlock_bh(&rqstp->rq_lock);
+				continue;
+			}
+			dprintk("svc: transport %p served by daemon %p\n",
+				xprt, rqstp);
+			rqstp->rq_xprt = xprt;
+			svc_xprt_get(xprt);
+			spin_unlock_bh(&rqstp->rq_lock);
+		}
+		atomic_long_inc(&pool->sp_stats.threads_woken);
 		wake_up(&rqstp->rq_wait);
-	} else {
+		rcu_read_unlock();
+		return;
+	}
+	rcu_read_unlock();
+
+	/*
+	 * No idle thread.  Queue the transport, then look again in case
+	 * a thread went idle meanwhile; svc_recv() checks sp_sockets
+	 * after clearing RQ_BUSY, so one of the two sees the other.
+	 */
+	if (!queued) {
 		dprintk("svc: transport %p put into queue\n", xprt);
+		spin_lock_bh(&pool->sp_lock);
 		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
 		pool->sp_stats.sockets_queued++;
+		spin_unlock_bh(&pool->sp_lock);
+		queued = true;
+		smp_mb();
+		goto redo_search;
 	}
-
-out_unlock:
-	spin_unlock_bh(&pool->sp_lock);
 }
 EXPORT_SYMBOL_GPL(svc_xprt_enqueue);
 
@@ -483,19 +484,15 @@ void svc_wake_up(struct svc_serv *serv)
 	for (i = 0; i < serv->sv_nrpools; i++) {
 		pool = &serv->sv_pools[i];
 
-		spin_lock_bh(&pool->sp_lock);
-		if (!list_empty(&pool->sp_threads)) {
-			rqstp = list_entry(pool->sp_threads.next,
-					   struct svc_rqst,
-					   rq_list);
+		rcu_read_lock();
+		list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
+			if (test_bit(RQ_BUSY, &rqstp->rq_flags))
+				continue;
 			dprintk("svc: daemon %p woken up.\n", rqstp);
-			/*
-			svc_thread_dequeue(pool, rqstp);
-			rqstp->rq_xprt = NULL;
-			 */
 			wake_up(&rqstp->rq_wait);
+			break;
 		}
-		spin_unlock_bh(&pool->sp_lock);
+		rcu_read_unlock();
 	}
 }
 EXPORT_SYMBOL_GPL(svc_wake_up);
@@ -634,6 +631,7 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 
 	spin_lock_bh(&pool->sp_lock);
 	xprt = svc_xprt_dequeue(pool);
+	spin_unlock_bh(&pool->sp_lock);
 	if (xprt) {
 		rqstp->rq_xprt = xprt;
 		svc_xprt_get(xprt);
@@ -644,14 +642,20 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 		 */
 		rqstp->rq_chandle.thread_wait = 1*HZ;
 	} else {
-		/* No data pending. Go to sleep */
-		svc_thread_enqueue(pool, rqstp);
-
 		/*
-		 * We have to be able to interrupt this wait
-		 * to bring down the daemons ...
+		 * No data pending. Go to sleep.  We have to be able to
+		 * interrupt this wait to bring down the daemons ...
 		 */
 		set_current_state(TASK_INTERRUPTIBLE);
+		add_wait_queue(&rqstp->rq_wait, &wait);
+
+		/*
+		 * From here on svc_xprt_enqueue() may hand us a transport.
+		 * It queues transports before looking for idle threads, we
+		 * clear RQ_BUSY before looking at the queue.
+		 */
+		clear_bit(RQ_BUSY, &rqstp->rq_flags);
+		smp_mb__after_clear_bit();
 
 		/*
 		 * checking kthread_should_stop() here allows us to avoid
@@ -660,28 +664,23 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 		 * we can exit here without sleeping. If not, then it
 		 * it'll be woken up quickly during the schedule_timeout
 		 */
-		if (kthread_should_stop()) {
-			set_current_state(TASK_RUNNING);
-			spin_unlock_bh(&pool->sp_lock);
-			return -EINTR;
-		}
-
-		add_wait_queue(&rqstp->rq_wait, &wait);
-		spin_unlock_bh(&pool->sp_lock);
-
-		time_left = schedule_timeout(timeout);
+		time_left = 1;
+		if (list_empty(&pool->sp_sockets) && !kthread_should_stop())
+			time_left = schedule_timeout(timeout);
+		else
+			__set_current_state(TASK_RUNNING);
 
 		try_to_freeze();
 
-		spin_lock_bh(&pool->sp_lock);
+		spin_lock_bh(&rqstp->rq_lock);
+		set_bit(RQ_BUSY, &rqstp->rq_flags);
+		spin_unlock_bh(&rqstp->rq_lock);
 		remove_wait_queue(&rqstp->rq_wait, &wait);
 		if (!time_left)
-			pool->sp_stats.threads_timedout++;
+			atomic_long_inc(&pool->sp_stats.threads_timedout);
 
 		xprt = rqstp->rq_xprt;
 		if (!xprt) {
-			svc_thread_dequeue(pool, rqstp);
-			spin_unlock_bh(&pool->sp_lock);
 			dprintk("svc: server %p, no data yet\n", rqstp);
 			if (signalled() || kthread_should_stop())
 				return -EINTR;
@@ -689,7 +688,6 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 				return -EAGAIN;
 		}
 	}
-	spin_unlock_bh(&pool->sp_lock);
 
 	len = 0;
 	if (test_bit(XPT_CLOSE, &xprt->xpt_flags)) {
@@ -1250,10 +1248,10 @@ static int svc_pool_stats_show(struct seq_file *m, void *p)
 
 	seq_printf(m, "%u %lu %lu %lu %lu\n",
 		pool->sp_id,
-		pool->sp_stats.packets,
+		atomic_long_read(&pool->sp_stats.packets),
 		pool->sp_stats.sockets_queued,
-		pool->sp_stats.threads_woken,
-		pool->sp_stats.threads_timedout);
+		atomic_long_read(&pool->sp_stats.threads_woken),
+		atomic_long_read(&pool->sp_stats.threads_timedout));
 
 	return 0;
 }
@@ -0,0 +1,305 @@
+/*
+ * tls: Kernel TLS record layer on TCP sockets
+ *
+ * The "tls" upper layer protocol replaces the socket operations of an
+ * established TCP connection.  Until keys are installed only the socket
+ * options are intercepted; after TLS_TX the data written to the socket
+ * is framed into records and encrypted, see tls_sw.c.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <net/tcp.h>
+#include <net/tls.h>
+
+enum {
+	TLSV4,
+	TLSV6,
+	TLS_NUM_PROTS,
+};
+
+enum {
+	TLS_BASE_TX,
+	TLS_SW_TX,
+	TLS_NUM_CONFIG,
+};
+
+static struct proto tls_prots[TLS_NUM_PROTS][TLS_NUM_CONFIG];
+static const struct proto *saved_tcpv6_prot;
+static DEFINE_MUTEX(tcpv6_prot_mutex);
+
+static inline int tls_ip_ver(const struct sock *sk)
+{
+	return sk->sk_family == AF_INET6 ? TLSV6 : TLSV4;
+}
+
+static void tls_write_space(struct sock *sk)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	/* Finish a record that did not fit into the send buffer earlier */
+	if (ctx->rec_len)
+		schedule_work(&ctx->tx_work);
+
+	ctx->sk_write_space(sk);
+}
+
+static void tls_close(struct sock *sk, long timeout)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	void (*sk_proto_close)(struct sock *sk, long timeout);
+
+	if (ctx->aead_send)
+		tls_sw_close(sk, ctx);
+
+	lock_sock(sk);
+	sk->sk_prot = ctx->sk_proto;
+	inet_csk(sk)->icsk_ulp_data = NULL;
+	release_sock(sk);
+
+	sk_proto_close = ctx->sk_proto->close;
+	kfree(ctx);
+
+	sk_proto_close(sk, timeout);
+}
+
+static int do_tls_getsockopt_tx(struct sock *sk, char __user *optval,
+				int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls12_crypto_info_aes_gcm_128 info;
+	int len;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+
+	if (len < sizeof(struct tls_crypto_info))
+		return -EINVAL;
+
+	if (!ctx->aead_send)
+		return -EBUSY;
+
+	/* The key is never handed back */
+	mutex_lock(&ctx->tx_lock);
+	info = ctx->crypto_send;
+	memcpy(info.iv, ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	memcpy(info.rec_seq, ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	mutex_unlock(&ctx->tx_lock);
+
+	if (len != sizeof(struct tls_crypto_info)) {
+		if (len < sizeof(info))
+			return -EINVAL;
+		len = sizeof(info);
+	}
+
+	if (put_user(len, optlen))
+		return -EFAULT;
+	if (copy_to_user(optval, &info, len))
+		return -EFAULT;
+
+	return 0;
+}
+
+static int do_tls_setsockopt_tx(struct sock *sk, char __user *optval,
+				unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls12_crypto_info_aes_gcm_128 info;
+	int err;
+
+	if (!optval || optlen < sizeof(struct tls_crypto_info))
+		return -EINVAL;
+
+	if (copy_from_user(&info, optval, sizeof(struct tls_crypto_info)))
+		return -EFAULT;
+
+	if (info.info.version != TLS_1_2_VERSION ||
+	    info.info.cipher_type != TLS_CIPHER_AES_GCM_128)
+		return -EOPNOTSUPP;
+
+	if (optlen != sizeof(info))
+		return -EINVAL;
+
+	if (copy_from_user(&info, optval, sizeof(info))) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	lock_sock(sk);
+
+	err = -EBUSY;
+	if (ctx->aead_send)
+		goto unlock;
+
+	ctx->crypto_send = info;
+	err = tls_set_sw_offload(sk, ctx);
+	if (err) {
+		memset(&ctx->crypto_send, 0, sizeof(ctx->crypto_send));
+		goto unlock;
+	}
+
+	ctx->sk_write_space = sk->sk_write_space;
+	sk->sk_write_space = tls_write_space;
+	sk->sk_prot = &tls_prots[tls_ip_ver(sk)][TLS_SW_TX];
+
+unlock:
+	release_sock(sk);
+out:
+	memset(&info, 0, sizeof(info));
+
+	return err;
+}
+
+static int do_tls_setsockopt(struct sock *sk, int optname,
+			     char __user *optval, unsigned int optlen)
+{
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_setsockopt_tx(sk, optval, optlen);
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static int do_tls_getsockopt(struct sock *sk, int optname,
+			     char __user *optval, int __user *optlen)
+{
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_getsockopt_tx(sk, optval, optlen);
+	default:
+		return -ENOPROTOOPT;
+	}
+}
+
+static int tls_setsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->setsockopt(sk, level, optname, optval,
+						 optlen);
+
+	return do_tls_setsockopt(sk, optname, optval, optlen);
+}
+
+static int tls_getsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->getsockopt(sk, level, optname, optval,
+						 optlen);
+
+	return do_tls_getsockopt(sk, optname, optval, optlen);
+}
+
+#ifdef CONFIG_COMPAT
+/* The option structures have the same layout for compat tasks */
+static int compat_tls_setsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, unsigned int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->compat_setsockopt(sk, level, optname,
+							optval, optlen);
+
+	return do_tls_setsockopt(sk, optname, optval, optlen);
+}
+
+static int compat_tls_getsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->compat_getsockopt(sk, level, optname,
+							optval, optlen);
+
+	return do_tls_getsockopt(sk, optname, optval, optlen);
+}
+#endif
+
+static void tls_build_protos(struct proto prot[TLS_NUM_CONFIG],
+			     const struct proto *base)
+{
+	prot[TLS_BASE_TX] = *base;
+	prot[TLS_BASE_TX].setsockopt	= tls_setsockopt;
+	prot[TLS_BASE_TX].getsockopt	= tls_getsockopt;
+#ifdef CONFIG_COMPAT
+	prot[TLS_BASE_TX].compat_setsockopt = compat_tls_setsockopt;
+	prot[TLS_BASE_TX].compat_getsockopt = compat_tls_getsockopt;
+#endif
+	prot[TLS_BASE_TX].close		= tls_close;
+
+	prot[TLS_SW_TX] = prot[TLS_BASE_TX];
+	prot[TLS_SW_TX].sendmsg		= tls_sw_sendmsg;
+	prot[TLS_SW_TX].sendpage	= tls_sw_sendpage;
+}
+
+static int tls_init(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	int ip_ver = tls_ip_ver(sk);
+	struct tls_context *ctx;
+
+	/* tcpv6_prot lives in the ipv6 module, copy it on first use */
+	if (ip_ver == TLSV6) {
+		mutex_lock(&tcpv6_prot_mutex);
+		if (sk->sk_prot != saved_tcpv6_prot) {
+			tls_build_protos(tls_prots[TLSV6], sk->sk_prot);
+			saved_tcpv6_prot = sk->sk_prot;
+		}
+		mutex_unlock(&tcpv6_prot_mutex);
+	}
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	mutex_init(&ctx->tx_lock);
+	INIT_WORK(&ctx->tx_work, tls_sw_tx_work);
+	ctx->sk = sk;
+	ctx->sk_proto = sk->sk_prot;
+
+	icsk->icsk_ulp_data = ctx;
+	sk->sk_prot = &tls_prots[ip_ver][TLS_BASE_TX];
+
+	return 0;
+}
+
+static struct tcp_ulp_ops tcp_tls_ulp_ops = {
+	.name		= "tls",
+	.owner		= THIS_MODULE,
+	.init		= tls_init,
+};
+
+static int __init tls_register(void)
+{
+	tls_build_protos(tls_prots[TLSV4], &tcp_prot);
+
+	return tcp_register_ulp(&tcp_tls_ulp_ops);
+}
+
+static void __exit tls_unregister(void)
+{
+	tcp_unregister_ulp(&tcp_tls_ulp_ops);
+}
+
+module_init(tls_register);
+module_exit(tls_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Transport Layer Security Support");
+MODULE_ALIAS("tcp-ulp-tls");
@@ -0,0 +1,474 @@
+/*
+ * tls: software record encryption for the transmit direction
+ *
+ * Data written to the socket is collected into a record of at most 16kB
+ * of plaintext.  sendmsg copies the user data into pages of its own,
+ * sendpage (and so sendfile and splice) only takes a reference on the
+ * page.  When the record is full or the caller has no more data, it is
+ * encrypted with AES-GCM into freshly allocated pages which are then
+ * passed on to TCP with sendpage, without a further copy.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <crypto/aead.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/netdevice.h>
+#include <linux/uaccess.h>
+#include <net/tls.h>
+
+static void tls_encrypt_done(struct crypto_async_request *req, int err)
+{
+	struct tls_context *ctx = req->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	ctx->async_err = err;
+	complete(&ctx->async_wait);
+}
+
+int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx)
+{
+	struct tls12_crypto_info_aes_gcm_128 *info = &ctx->crypto_send;
+	struct crypto_aead *aead;
+	struct aead_request *req;
+	int err;
+
+	aead = crypto_alloc_aead("gcm(aes)", 0, 0);
+	if (IS_ERR(aead))
+		return PTR_ERR(aead);
+
+	err = crypto_aead_setkey(aead, info->key,
+				 TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	if (err)
+		goto free_aead;
+
+	err = crypto_aead_setauthsize(aead, TLS_CIPHER_AES_GCM_128_TAG_SIZE);
+	if (err)
+		goto free_aead;
+
+	err = -ENOMEM;
+	req = aead_request_alloc(aead, GFP_KERNEL);
+	if (!req)
+		goto free_aead;
+
+	init_completion(&ctx->async_wait);
+	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				  tls_encrypt_done, ctx);
+
+	memcpy(ctx->iv, info->salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, info->iv,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	memcpy(ctx->rec_seq, info->rec_seq,
+	       TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	memset(info->key, 0, sizeof(info->key));
+
+	sg_init_one(&ctx->sg_aad, ctx->aad, TLS_AAD_SPACE_SIZE);
+	sg_init_table(ctx->sg_plain, TLS_MAX_PLAIN_ENTS);
+
+	ctx->aead_req = req;
+	ctx->aead_send = aead;
+
+	return 0;
+
+free_aead:
+	crypto_free_aead(aead);
+	return err;
+}
+
+/* Increment a big-endian counter */
+static void tls_inc_be(u8 *ctr, int len)
+{
+	while (len-- && !++ctr[len])
+		;
+}
+
+static void tls_free_plain(struct tls_context *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->plain_ents; i++)
+		put_page(sg_page(ctx->sg_plain + i));
+
+	sg_init_table(ctx->sg_plain, TLS_MAX_PLAIN_ENTS);
+	ctx->plain_ents = 0;
+	ctx->plain_size = 0;
+	ctx->plain_merge = false;
+}
+
+static void tls_free_record(struct tls_context *ctx, unsigned int npages)
+{
+	unsigned int i;
+
+	for (i = 0; i < npages; i++)
+		put_page(ctx->rec_pages[i]);
+
+	ctx->rec_len = 0;
+	ctx->rec_sent = 0;
+}
+
+static bool tls_record_full(struct tls_context *ctx)
+{
+	return ctx->plain_size >= TLS_MAX_PAYLOAD_SIZE ||
+	       (!ctx->plain_merge && ctx->plain_ents >= TLS_MAX_PLAIN_ENTS);
+}
+
+/* Encrypt the plaintext collected so far into a new record. */
+static int tls_close_record(struct sock *sk, struct tls_context *ctx)
+{
+	unsigned int len = ctx->plain_size;
+	unsigned int rec_len = len + TLS_OVERHEAD_SIZE;
+	unsigned int npages = DIV_ROUND_UP(rec_len, PAGE_SIZE);
+	unsigned int payload = len + TLS_CIPHER_AES_GCM_128_IV_SIZE +
+			       TLS_CIPHER_AES_GCM_128_TAG_SIZE;
+	unsigned int off, i;
+	u8 *hdr;
+	int err;
+
+	for (i = 0; i < npages; i++) {
+		ctx->rec_pages[i] = alloc_page(GFP_KERNEL);
+		if (!ctx->rec_pages[i]) {
+			tls_free_record(ctx, i);
+			return -ENOMEM;
+		}
+	}
+
+	hdr = page_address(ctx->rec_pages[0]);
+	hdr[0] = TLS_RECORD_TYPE_DATA;
+	hdr[1] = TLS_1_2_VERSION_MAJOR;
+	hdr[2] = TLS_1_2_VERSION_MINOR;
+	hdr[3] = payload >> 8;
+	hdr[4] = payload & 0xff;
+	memcpy(hdr + TLS_HEADER_SIZE, ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+	       TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	memcpy(ctx->aad, ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	ctx->aad[8] = TLS_RECORD_TYPE_DATA;
+	ctx->aad[9] = TLS_1_2_VERSION_MAJOR;
+	ctx->aad[10] = TLS_1_2_VERSION_MINOR;
+	ctx->aad[11] = len >> 8;
+	ctx->aad[12] = len & 0xff;
+
+	/* Ciphertext and tag follow the header and the explicit nonce */
+	sg_init_table(ctx->sg_rec, npages);
+	off = TLS_HEADER_SIZE + TLS_CIPHER_AES_GCM_128_IV_SIZE;
+	for (i = 0; i < npages; i++) {
+		unsigned int plen = min_t(unsigned int, PAGE_SIZE,
+					  rec_len - i * PAGE_SIZE);
+
+		sg_set_page(ctx->sg_rec + i, ctx->rec_pages[i], plen - off,
+			    off);
+		off = 0;
+	}
+
+	sg_mark_end(ctx->sg_plain + ctx->plain_ents - 1);
+
+	aead_request_set_assoc(ctx->aead_req, &ctx->sg_aad,
+			       TLS_AAD_SPACE_SIZE);
+	aead_request_set_crypt(ctx->aead_req, ctx->sg_plain, ctx->sg_rec,
+			       len, ctx->iv);
+
+	err = crypto_aead_encrypt(ctx->aead_req);
+	if (err == -EINPROGRESS || err == -EBUSY) {
+		wait_for_completion(&ctx->async_wait);
+		INIT_COMPLETION(ctx->async_wait);
+		err = ctx->async_err;
+	}
+
+	/*
+	 * Data already reported as sent is lost, the stream cannot be
+	 * continued after this.
+	 */
+	tls_free_plain(ctx);
+	if (err) {
+		tls_free_record(ctx, npages);
+		ctx->tx_err = err;
+		return err;
+	}
+
+	tls_inc_be(ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	tls_inc_be(ctx->iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE,
+		   TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	ctx->rec_len = rec_len;
+	ctx->rec_sent = 0;
+
+	return 0;
+}
+
+static int tls_send_page(struct sock *sk, struct tls_context *ctx,
+			 struct page *page, int offset, size_t size, int flags)
+{
+	struct msghdr msg = { .msg_flags = flags };
+	mm_segment_t oldfs;
+	struct kvec iov;
+	int ret;
+
+	if ((sk->sk_route_caps & NETIF_F_SG) &&
+	    (sk->sk_route_caps & NETIF_F_ALL_CSUM))
+		return ctx->sk_proto->sendpage(sk, page, offset, size, flags);
+
+	/*
+	 * tcp_sendpage would fall back to sock_no_sendpage, which comes
+	 * back through our own sendmsg.  TCP copies the data anyway.
+	 */
+	iov.iov_base = page_address(page) + offset;
+	iov.iov_len = size;
+	msg.msg_iov = (struct iovec *)&iov;
+	msg.msg_iovlen = 1;
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	ret = ctx->sk_proto->sendmsg(NULL, sk, &msg, size);
+	set_fs(oldfs);
+
+	return ret;
+}
+
+/* Hand the rest of the encrypted record over to TCP. */
+static int tls_push_record(struct sock *sk, struct tls_context *ctx,
+			   int flags)
+{
+	while (ctx->rec_sent < ctx->rec_len) {
+		unsigned int off = ctx->rec_sent;
+		unsigned int poff = off % PAGE_SIZE;
+		size_t size = min_t(size_t, PAGE_SIZE - poff,
+				    ctx->rec_len - off);
+		int sendflags = flags;
+		int ret;
+
+		if (off + size < ctx->rec_len)
+			sendflags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
+
+		ret = tls_send_page(sk, ctx, ctx->rec_pages[off / PAGE_SIZE],
+				    poff, size, sendflags);
+		if (ret <= 0)
+			return ret ?: -EAGAIN;
+
+		ctx->rec_sent += ret;
+	}
+
+	tls_free_record(ctx, DIV_ROUND_UP(ctx->rec_len, PAGE_SIZE));
+
+	return 0;
+}
+
+/*
+ * Send the pending record, then, if @close, encrypt and send the
+ * plaintext collected so far.
+ */
+static int tls_push(struct sock *sk, struct tls_context *ctx, int flags,
+		    bool close)
+{
+	int err;
+
+	if (ctx->rec_len) {
+		err = tls_push_record(sk, ctx, flags | (close &&
+							ctx->plain_size ?
+							MSG_MORE : 0));
+		if (err)
+			return err;
+	}
+
+	if (!close || !ctx->plain_size)
+		return 0;
+
+	err = tls_close_record(sk, ctx);
+	if (err)
+		return err;
+
+	return tls_push_record(sk, ctx, flags);
+}
+
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
+		   size_t size)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	int flags = msg->msg_flags & (MSG_DONTWAIT | MSG_NOSIGNAL);
+	bool more = msg->msg_flags & MSG_MORE;
+	long copied = 0;
+	int err;
+
+	if (msg->msg_flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&ctx->tx_lock);
+
+	err = ctx->tx_err;
+	if (err)
+		goto out;
+
+	if (ctx->rec_len) {
+		err = tls_push_record(sk, ctx, flags);
+		if (err)
+			goto out;
+	}
+
+	while (size) {
+		struct scatterlist *sg;
+		size_t copy;
+
+		if (tls_record_full(ctx)) {
+			err = tls_push(sk, ctx, flags | MSG_MORE, true);
+			if (err)
+				break;
+		}
+
+		copy = min_t(size_t, size,
+			     TLS_MAX_PAYLOAD_SIZE - ctx->plain_size);
+
+		if (ctx->plain_merge) {
+			sg = ctx->sg_plain + ctx->plain_ents - 1;
+			copy = min_t(size_t, copy,
+				     PAGE_SIZE - sg->offset - sg->length);
+
+			err = memcpy_fromiovec(page_address(sg_page(sg)) +
+					       sg->offset + sg->length,
+					       msg->msg_iov, copy);
+			if (err)
+				break;
+
+			sg->length += copy;
+		} else {
+			struct page *page = alloc_page(GFP_KERNEL);
+
+			err = -ENOMEM;
+			if (!page)
+				break;
+
+			copy = min_t(size_t, copy, PAGE_SIZE);
+			err = memcpy_fromiovec(page_address(page),
+					       msg->msg_iov, copy);
+			if (err) {
+				__free_page(page);
+				break;
+			}
+
+			sg = ctx->sg_plain + ctx->plain_ents++;
+			sg_set_page(sg, page, copy, 0);
+		}
+
+		ctx->plain_merge = sg->offset + sg->length < PAGE_SIZE;
+		ctx->plain_size += copy;
+		copied += copy;
+		size -= copy;
+	}
+
+	if (!more) {
+		int ret = tls_push(sk, ctx, flags, true);
+
+		if (!err)
+			err = ret;
+	}
+
+out:
+	mutex_unlock(&ctx->tx_lock);
+
+	return copied ?: err;
+}
+
+int tls_sw_sendpage(struct sock *sk, struct page *page, int offset,
+		    size_t size, int flags)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	int sendflags = flags & (MSG_DONTWAIT | MSG_NOSIGNAL);
+	bool more = flags & (MSG_MORE | MSG_SENDPAGE_NOTLAST);
+	long copied = 0;
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&ctx->tx_lock);
+
+	err = ctx->tx_err;
+	if (err)
+		goto out;
+
+	if (ctx->rec_len) {
+		err = tls_push_record(sk, ctx, sendflags);
+		if (err)
+			goto out;
+	}
+
+	while (size) {
+		size_t copy;
+
+		if (tls_record_full(ctx)) {
+			err = tls_push(sk, ctx, sendflags | MSG_MORE, true);
+			if (err)
+				break;
+		}
+
+		copy = min_t(size_t, size,
+			     TLS_MAX_PAYLOAD_SIZE - ctx->plain_size);
+
+		get_page(page);
+		sg_set_page(ctx->sg_plain + ctx->plain_ents++, page, copy,
+			    offset);
+		ctx->plain_merge = false;
+		ctx->plain_size += copy;
+
+		offset += copy;
+		copied += copy;
+		size -= copy;
+	}
+
+	if (!more) {
+		int ret = tls_push(sk, ctx, sendflags, true);
+
+		if (!err)
+			err = ret;
+	}
+
+out:
+	mutex_unlock(&ctx->tx_lock);
+
+	return copied ?: err;
+}
+
+void tls_sw_tx_work(struct work_struct *work)
+{
+	struct tls_context *ctx = container_of(work, struct tls_context,
+					       tx_work);
+
+	mutex_lock(&ctx->tx_lock);
+	if (ctx->rec_len)
+		tls_push_record(ctx->sk, ctx, MSG_DONTWAIT);
+	mutex_unlock(&ctx->tx_lock);
+}
+
+/*
+ * Flush what has been written before the socket goes away, waiting for
+ * send buffer space up to the socket's send timeout, and release the
+ * transmit state.
+ */
+void tls_sw_close(struct sock *sk, struct tls_context *ctx)
+{
+	mutex_lock(&ctx->tx_lock);
+
+	if (!ctx->tx_err)
+		tls_push(sk, ctx, 0, true);
+
+	lock_sock(sk);
+	sk->sk_write_space = ctx->sk_write_space;
+	release_sock(sk);
+
+	mutex_unlock(&ctx->tx_lock);
+
+	cancel_work_sync(&ctx->tx_work);
+
+	tls_free_plain(ctx);
+	if (ctx->rec_len)
+		tls_free_record(ctx, DIV_ROUND_UP(ctx->rec_len, PAGE_SIZE));
+
+	aead_request_free(ctx->aead_req);
+	crypto_free_aead(ctx->aead_send);
+	ctx->aead_send = NULL;
+}
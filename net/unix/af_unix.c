@@ -1603,6 +1603,74 @@ out:
 }
 
 
+/*
+ * Small stream writes get an skb of at least this size, so that further
+ * small writes can be appended to it while the reader has not caught up.
+ */
+#define UNIX_STREAM_SMALL_SKB	SKB_WITH_OVERHEAD(2048)
+
+/*
+ * Append a small write to the last skb in the peer's receive queue, if it
+ * has room and carries the same credentials and no fds, instead of
+ * allocating and queueing an skb for it.  Holding the peer's readlock keeps
+ * readers from consuming the skb while the data is copied in, and the data
+ * is only committed if the skb is still the tail of the queue by then.
+ * Returns false if the write has to be sent the normal way.
+ */
+static bool unix_stream_append(struct socket *sock, struct sock *other,
+			       struct scm_cookie *scm, struct msghdr *msg,
+			       int len)
+{
+	struct unix_sock *otheru = unix_sk(other);
+	struct pid *pid = scm->pid;
+	const struct cred *cred = scm->cred;
+	struct sk_buff *skb;
+	bool appended = false;
+
+	if (scm->fp || len > UNIX_STREAM_SMALL_SKB)
+		return false;
+	if (!mutex_trylock(&otheru->readlock))
+		return false;
+
+	unix_state_lock(other);
+	/* the credentials maybe_add_creds() would attach */
+	if (!cred && (test_bit(SOCK_PASSCRED, &sock->flags) ||
+		      !other->sk_socket ||
+		      test_bit(SOCK_PASSCRED, &other->sk_socket->flags))) {
+		pid = task_tgid(current);
+		cred = current_cred();
+	}
+	skb = skb_peek_tail(&other->sk_receive_queue);
+	if (skb && !UNIXCB(skb).fp && UNIXCB(skb).pid == pid &&
+	    UNIXCB(skb).cred == cred && !skb_is_nonlinear(skb) &&
+	    skb_tailroom(skb) >= len)
+		skb_get(skb);
+	else
+		skb = NULL;
+	unix_state_unlock(other);
+	if (!skb)
+		goto out;
+
+	if (memcpy_fromiovecend(skb_tail_pointer(skb), msg->msg_iov, 0, len))
+		goto out_free;
+
+	unix_state_lock(other);
+	if (!sock_flag(other, SOCK_DEAD) &&
+	    !(other->sk_shutdown & RCV_SHUTDOWN) &&
+	    skb_peek_tail(&other->sk_receive_queue) == skb) {
+		skb_put(skb, len);
+		appended = true;
+	}
+	unix_state_unlock(other);
+out_free:
+	kfree_skb(skb);
+out:
+	mutex_unlock(&otheru->readlock);
+	if (appended)
+		other->sk_data_ready(other, len);
+	return appended;
+}
+
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
 {
@@ -1640,7 +1708,14 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	if (sk->sk_shutdown & SEND_SHUTDOWN)
 		goto pipe_err;
 
+	if (unix_stream_append(sock, other, siocb->scm, msg, len)) {
+		sent = len;
+		goto out;
+	}
+
 	while (sent < len) {
+		int alloc_size;
+
 		/*
 		 *	Optimisation for the fact that under 0.01% of X
 		 *	messages typically need breaking up.
@@ -1655,12 +1730,17 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		if (size > SKB_MAX_ALLOC)
 			size = SKB_MAX_ALLOC;
 
+		/* Leave room for appending small writes, see above */
+		alloc_size = size;
+		if (len < UNIX_STREAM_SMALL_SKB && !siocb->scm->fp)
+			alloc_size = UNIX_STREAM_SMALL_SKB;
+
 		/*
 		 *	Grab a buffer
 		 */
 
-		skb = sock_alloc_send_skb(sk, size, msg->msg_flags&MSG_DONTWAIT,
-					  &err);
+		skb = sock_alloc_send_skb(sk, alloc_size,
+					  msg->msg_flags&MSG_DONTWAIT, &err);
 
 		if (skb == NULL)
 			goto out_err;
@@ -1705,6 +1785,7 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		sent += size;
 	}
 
+out:
 	scm_destroy(siocb->scm);
 	siocb->scm = NULL;
 
@@ -5,6 +5,14 @@ extern int bench_sched_messaging(int argc, const char **argv, const char *prefix
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
 extern int bench_mem_memset(int argc, const char **argv, const char *prefix);
+extern int bench_mem_pagefault(int argc, const char **argv, const char *prefix);
+extern int bench_mem_mmap(int argc, const char **argv, const char *prefix);
+extern int bench_futex_hash(int argc, const char **argv, const char *prefix);
+extern int bench_futex_wake(int argc, const char **argv, const char *prefix);
+extern int bench_futex_requeue(int argc, const char **argv, const char *prefix);
+extern int bench_epoll_wait(int argc, const char **argv, const char *prefix);
+extern int bench_epoll_ctl(int argc, const char **argv, const char *prefix);
+extern int bench_numa(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -15,4 +23,13 @@ extern int bench_mem_memset(int argc, const char **argv, const char *prefix);
 
 extern int bench_format;
 
+/*
+ * Helpers for the multi-threaded suites that support --scale: they run
+ * once per thread count, 1, 2, 4, ... up to and including the requested
+ * maximum, and print one line of the scaling curve per run.
+ */
+extern unsigned int bench_next_scale(unsigned int nr, unsigned int max);
+extern void bench_print_scale_header(void);
+extern void bench_print_scale(unsigned int nr, double ops, double base);
+
 #endif
@@ -0,0 +1,329 @@
+/*
+ * epoll-ctl.c
+ *
+ * ctl: Stress concurrent epoll_ctl() calls on the same or separate
+ *      epoll instances
+ *
+ * Each thread owns --nfds eventfds and keeps adding, modifying and
+ * removing them from an epoll instance, either one shared by all threads
+ * or, with --multiq, a private one. The operation is picked at random
+ * among the ones that are valid for the current state of the fd, so the
+ * interest list rbtree keeps changing shape under ep->mtx.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+enum {
+	OP_EPOLL_ADD,
+	OP_EPOLL_MOD,
+	OP_EPOLL_DEL,
+	EPOLL_NR_OPS,
+};
+
+static const char * const op_names[EPOLL_NR_OPS] = {
+	[OP_EPOLL_ADD] = "ADD",
+	[OP_EPOLL_MOD] = "MOD",
+	[OP_EPOLL_DEL] = "DEL",
+};
+
+static unsigned int nthreads;
+static unsigned int nfds = 64;
+static unsigned int runtime = 8;
+static bool multiq;
+static bool scale;
+static bool silent;
+
+static volatile int done;
+static int shared_epollfd;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int tid;
+	int epollfd;
+	int *fdmap;
+	bool *added;
+	pthread_t thread;
+	unsigned long ops[EPOLL_NR_OPS];
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of CPUs)"),
+	OPT_UINTEGER('f', "nfds", &nfds,
+		     "Specify amount of file descriptors per thread"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('m', "multiq", &multiq,
+		    "Use an epoll instance per thread instead of a shared one"),
+	OPT_BOOLEAN('S', "scale", &scale,
+		    "Run with 1, 2, 4, ... threads up to --threads"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_ctl_usage[] = {
+	"perf bench epoll ctl <options>",
+	NULL
+};
+
+static void do_epoll_op(struct worker *w, unsigned int i, int op)
+{
+	struct epoll_event ev;
+	int fd = w->fdmap[i];
+
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	switch (op) {
+	case OP_EPOLL_ADD:
+		if (epoll_ctl(w->epollfd, EPOLL_CTL_ADD, fd, &ev))
+			die("epoll_ctl(ADD)");
+		w->added[i] = true;
+		break;
+	case OP_EPOLL_MOD:
+		ev.events = EPOLLOUT;
+		if (epoll_ctl(w->epollfd, EPOLL_CTL_MOD, fd, &ev))
+			die("epoll_ctl(MOD)");
+		break;
+	case OP_EPOLL_DEL:
+		if (epoll_ctl(w->epollfd, EPOLL_CTL_DEL, fd, NULL))
+			die("epoll_ctl(DEL)");
+		w->added[i] = false;
+		break;
+	default:
+		return;
+	}
+
+	w->ops[op]++;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int seed = w->tid;
+	unsigned int i;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		for (i = 0; i < nfds; i++) {
+			int op;
+
+			/* fds not in the set can only be added */
+			if (!w->added[i])
+				op = OP_EPOLL_ADD;
+			else
+				op = OP_EPOLL_MOD + rand_r(&seed) % 2;
+
+			do_epoll_op(w, i, op);
+		}
+	} while (!done);
+
+	/* leave the shared instance as we found it */
+	for (i = 0; i < nfds; i++) {
+		if (w->added[i])
+			do_epoll_op(w, i, OP_EPOLL_DEL);
+	}
+
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static void setup_worker(struct worker *w)
+{
+	unsigned int i;
+
+	w->fdmap = calloc(nfds, sizeof(int));
+	w->added = calloc(nfds, sizeof(bool));
+	if (!w->fdmap || !w->added)
+		die("calloc");
+
+	if (multiq) {
+		w->epollfd = epoll_create(nfds);
+		if (w->epollfd < 0)
+			die("epoll_create");
+	} else
+		w->epollfd = shared_epollfd;
+
+	for (i = 0; i < nfds; i++) {
+		w->fdmap[i] = eventfd(0, EFD_NONBLOCK);
+		if (w->fdmap[i] < 0)
+			die("eventfd");
+	}
+}
+
+static void cleanup_worker(struct worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < nfds; i++)
+		close(w->fdmap[i]);
+	if (multiq)
+		close(w->epollfd);
+	free(w->fdmap);
+	free(w->added);
+}
+
+static double run_once(unsigned int nr)
+{
+	struct worker *worker;
+	struct timeval start, end, runtime_tv;
+	struct stats op_stats[EPOLL_NR_OPS];
+	unsigned long total = 0;
+	unsigned int i, j;
+	double secs;
+
+	worker = calloc(nr, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	if (!multiq) {
+		shared_epollfd = epoll_create(nr * nfds);
+		if (shared_epollfd < 0)
+			die("epoll_create");
+	}
+
+	memset(op_stats, 0, sizeof(op_stats));
+	done = 0;
+	threads_starting = nr;
+
+	for (i = 0; i < nr; i++) {
+		worker[i].tid = i;
+		setup_worker(&worker[i]);
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(runtime);
+	while (!done)
+		pause();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime_tv);
+	secs = runtime_tv.tv_sec + runtime_tv.tv_usec / 1e6;
+
+	for (i = 0; i < nr; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+
+		for (j = 0; j < EPOLL_NR_OPS; j++) {
+			update_stats(&op_stats[j], worker[i].ops[j] / secs);
+			total += worker[i].ops[j];
+		}
+
+		if (!silent && !scale && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[thread %2d] fdmap: %d ... %d [ add: %ld ops; mod: %ld ops; del: %ld ops ]\n",
+			       worker[i].tid, worker[i].fdmap[0],
+			       worker[i].fdmap[nfds - 1],
+			       worker[i].ops[OP_EPOLL_ADD],
+			       worker[i].ops[OP_EPOLL_MOD],
+			       worker[i].ops[OP_EPOLL_DEL]);
+		cleanup_worker(&worker[i]);
+	}
+
+	if (!multiq)
+		close(shared_epollfd);
+
+	if (!scale) {
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("\n");
+		for (j = 0; j < EPOLL_NR_OPS; j++) {
+			double avg = avg_stats(&op_stats[j]);
+
+			if (bench_format == BENCH_FORMAT_DEFAULT)
+				printf("Averaged %ld %s operations/sec (+- %.2f%%), total secs = %.3f\n",
+				       (long)avg, op_names[j],
+				       rel_stddev_stats(stddev_stats(&op_stats[j]), avg),
+				       secs);
+			else
+				printf("%s %ld\n", op_names[j], (long)avg);
+		}
+	}
+
+	free(worker);
+	return total / secs;
+}
+
+int bench_epoll_ctl(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	unsigned int nr;
+	double base = 0.0;
+
+	argc = parse_options(argc, argv, options, bench_epoll_ctl_usage, 0);
+	if (argc) {
+		usage_with_options(bench_epoll_ctl_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfds)
+		nfds = 1;
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: %d threads doing epoll_ctl ops on %d fds each, "
+		       "%s epoll instance, for %d secs.\n\n",
+		       getpid(), nthreads, nfds,
+		       multiq ? "per-thread" : "shared", runtime);
+
+	if (!scale) {
+		run_once(nthreads);
+		goto out;
+	}
+
+	bench_print_scale_header();
+	for (nr = 1; nr <= nthreads; nr = bench_next_scale(nr, nthreads)) {
+		double ops = run_once(nr);
+
+		if (!base)
+			base = ops;
+		bench_print_scale(nr, ops, base);
+	}
+out:
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * epoll-wait.c
+ *
+ * wait: Stress concurrent epoll_wait()ers on the same or separate
+ *       epoll instances
+ *
+ * A number of waiter threads sit in epoll_wait() on a set of eventfds
+ * that are kept busy by writer threads. Each waiter owns --nfds of the
+ * eventfds, all of them registered edge-triggered on one epoll instance
+ * shared by every waiter, or, with --multiq, on a per-waiter instance.
+ * We report how many events per second the waiters manage to consume,
+ * i.e. how well ep->lock and the ready list scale.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define EPOLL_WAIT_TIMEOUT_MS	100
+
+static unsigned int nthreads;
+static unsigned int nwriters = 1;
+static unsigned int nfds = 64;
+static unsigned int runtime = 8;
+static bool multiq;
+static bool scale;
+static bool silent;
+
+static volatile int done;
+static int shared_epollfd;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int tid;
+	int epollfd;
+	int *fdmap;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+struct writer {
+	struct worker *workers;
+	unsigned int first, nr;
+	pthread_t thread;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of waiter threads (default: number of CPUs)"),
+	OPT_UINTEGER('w', "writers", &nwriters,
+		     "Specify amount of writer threads"),
+	OPT_UINTEGER('f', "nfds", &nfds,
+		     "Specify amount of file descriptors per waiter"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('m', "multiq", &multiq,
+		    "Use an epoll instance per waiter instead of a shared one"),
+	OPT_BOOLEAN('S', "scale", &scale,
+		    "Run with 1, 2, 4, ... waiters up to --threads"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_epoll_wait_usage[] = {
+	"perf bench epoll wait <options>",
+	NULL
+};
+
+static void thread_ready(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *waiterfn(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event ev;
+	unsigned long ops = 0;
+	u64 val;
+
+	thread_ready();
+
+	while (!done) {
+		int ret = epoll_wait(w->epollfd, &ev, 1,
+				     EPOLL_WAIT_TIMEOUT_MS);
+
+		if (ret < 0 && errno != EINTR)
+			die("epoll_wait");
+		if (ret <= 0)
+			continue;
+
+		/* consume the event so the next write makes a new edge */
+		if (read(ev.data.fd, &val, sizeof(val)) == sizeof(val))
+			ops++;
+	}
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void *writerfn(void *arg)
+{
+	struct writer *wr = arg;
+	u64 val = 1;
+	unsigned int i, j;
+	int __used ret;
+
+	thread_ready();
+
+	while (!done) {
+		for (i = wr->first; i < wr->first + wr->nr; i++)
+			for (j = 0; j < nfds; j++)
+				ret = write(wr->workers[i].fdmap[j], &val,
+					    sizeof(val));
+	}
+
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static void setup_worker(struct worker *w)
+{
+	struct epoll_event ev;
+	unsigned int i;
+
+	w->fdmap = calloc(nfds, sizeof(int));
+	if (!w->fdmap)
+		die("calloc");
+
+	if (multiq) {
+		w->epollfd = epoll_create(nfds);
+		if (w->epollfd < 0)
+			die("epoll_create");
+	} else
+		w->epollfd = shared_epollfd;
+
+	for (i = 0; i < nfds; i++) {
+		w->fdmap[i] = eventfd(0, EFD_NONBLOCK);
+		if (w->fdmap[i] < 0)
+			die("eventfd");
+
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.fd = w->fdmap[i];
+		if (epoll_ctl(w->epollfd, EPOLL_CTL_ADD, w->fdmap[i], &ev))
+			die("epoll_ctl");
+	}
+}
+
+static void cleanup_worker(struct worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < nfds; i++)
+		close(w->fdmap[i]);
+	if (multiq)
+		close(w->epollfd);
+	free(w->fdmap);
+}
+
+static double run_once(unsigned int nr)
+{
+	struct worker *worker;
+	struct writer *writer;
+	struct timeval start, end, runtime_tv;
+	struct stats throughput_stats;
+	unsigned int i, nwr = min(nwriters, nr);
+	unsigned long total = 0;
+	double secs, avg;
+
+	worker = calloc(nr, sizeof(*worker));
+	writer = calloc(nwr, sizeof(*writer));
+	if (!worker || !writer)
+		die("calloc");
+
+	if (!multiq) {
+		shared_epollfd = epoll_create(nr * nfds);
+		if (shared_epollfd < 0)
+			die("epoll_create");
+	}
+
+	memset(&throughput_stats, 0, sizeof(throughput_stats));
+	done = 0;
+	threads_starting = nr + nwr;
+
+	for (i = 0; i < nr; i++) {
+		worker[i].tid = i;
+		setup_worker(&worker[i]);
+		if (pthread_create(&worker[i].thread, NULL, waiterfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	/* split the waiters evenly among the writers */
+	for (i = 0; i < nwr; i++) {
+		writer[i].workers = worker;
+		writer[i].first = i * nr / nwr;
+		writer[i].nr = (i + 1) * nr / nwr - writer[i].first;
+		if (pthread_create(&writer[i].thread, NULL, writerfn,
+				   &writer[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(runtime);
+	while (!done)
+		pause();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime_tv);
+	secs = runtime_tv.tv_sec + runtime_tv.tv_usec / 1e6;
+
+	for (i = 0; i < nwr; i++) {
+		if (pthread_join(writer[i].thread, NULL))
+			die("pthread_join");
+	}
+
+	for (i = 0; i < nr; i++) {
+		unsigned long t;
+
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+
+		t = worker[i].ops / secs;
+		update_stats(&throughput_stats, t);
+		total += worker[i].ops;
+
+		if (!silent && !scale && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[thread %2d] fdmap: %d ... %d [ %ld events/sec ]\n",
+			       worker[i].tid, worker[i].fdmap[0],
+			       worker[i].fdmap[nfds - 1], t);
+		cleanup_worker(&worker[i]);
+	}
+
+	if (!multiq)
+		close(shared_epollfd);
+
+	avg = avg_stats(&throughput_stats);
+	if (!scale) {
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("\nAveraged %ld events/sec (+- %.2f%%), total secs = %.3f\n",
+			       (long)avg,
+			       rel_stddev_stats(stddev_stats(&throughput_stats), avg),
+			       secs);
+		else
+			printf("%ld\n", (long)avg);
+	}
+
+	free(writer);
+	free(worker);
+	return total / secs;
+}
+
+int bench_epoll_wait(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned int nr;
+	double base = 0.0;
+
+	argc = parse_options(argc, argv, options, bench_epoll_wait_usage, 0);
+	if (argc) {
+		usage_with_options(bench_epoll_wait_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nwriters)
+		nwriters = 1;
+	if (!nfds)
+		nfds = 1;
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: %d waiters, %d writers, %d fds per waiter, "
+		       "%s epoll instance, for %d secs.\n\n",
+		       getpid(), nthreads, nwriters, nfds,
+		       multiq ? "per-waiter" : "shared", runtime);
+
+	if (!scale) {
+		run_once(nthreads);
+		goto out;
+	}
+
+	bench_print_scale_header();
+	for (nr = 1; nr <= nthreads; nr = bench_next_scale(nr, nthreads)) {
+		double ops = run_once(nr);
+
+		if (!base)
+			base = ops;
+		bench_print_scale(nr, ops, base);
+	}
+out:
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * futex-hash.c
+ *
+ * hash: Stress the futex hash table
+ *
+ * Each thread operates on its own set of futexes, so there is no
+ * contention on the futex words themselves: what is measured is the cost
+ * of FUTEX_WAIT hashing the key and taking the hash bucket lock. The
+ * futex value never matches, so the syscall always returns -EWOULDBLOCK
+ * without sleeping.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nfutexes = 1024;
+static unsigned int runtime = 10;
+static bool scale;
+static bool silent;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int tid;
+	u_int32_t *futex;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of CPUs)"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify amount of futexes per thread"),
+	OPT_BOOLEAN('S', "scale", &scale,
+		    "Run with 1, 2, 4, ... threads up to --threads"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i;
+	unsigned long ops = 0;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		for (i = 0; i < nfutexes; i++, ops++) {
+			/*
+			 * We want the futex calls to fail in order to
+			 * stress the hashing of uaddr and not measure
+			 * other steps, such as internal waitqueue
+			 * handling, thus enlarging the critical region
+			 * protected by hb->lock.
+			 */
+			ret = futex_wait(&w->futex[i], 1234, NULL);
+			if (!silent && (!ret || errno != EAGAIN))
+				pr_warning("futex-hash: unexpected futex_wait() result\n");
+		}
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static double run_once(unsigned int nr)
+{
+	struct worker *worker;
+	struct timeval start, end, runtime_tv;
+	struct stats throughput_stats;
+	unsigned long total = 0;
+	double secs, avg;
+	unsigned int i;
+
+	worker = calloc(nr, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	memset(&throughput_stats, 0, sizeof(throughput_stats));
+	done = 0;
+	threads_starting = nr;
+
+	for (i = 0; i < nr; i++) {
+		worker[i].tid = i;
+		worker[i].futex = calloc(nfutexes, sizeof(*worker[i].futex));
+		if (!worker[i].futex)
+			die("calloc");
+
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(runtime);
+	while (!done)
+		pause();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime_tv);
+	secs = runtime_tv.tv_sec + runtime_tv.tv_usec / 1e6;
+
+	for (i = 0; i < nr; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+	}
+
+	for (i = 0; i < nr; i++) {
+		unsigned long t = worker[i].ops / secs;
+
+		update_stats(&throughput_stats, t);
+		total += worker[i].ops;
+
+		if (!silent && !scale && bench_format == BENCH_FORMAT_DEFAULT) {
+			if (nfutexes == 1)
+				printf("[thread %2d] futex: %p [ %ld ops/sec ]\n",
+				       worker[i].tid, &worker[i].futex[0], t);
+			else
+				printf("[thread %2d] futexes: %p ... %p [ %ld ops/sec ]\n",
+				       worker[i].tid, &worker[i].futex[0],
+				       &worker[i].futex[nfutexes - 1], t);
+		}
+		free(worker[i].futex);
+	}
+
+	avg = avg_stats(&throughput_stats);
+	if (!scale) {
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("\nAveraged %ld operations/sec (+- %.2f%%), total secs = %.3f\n",
+			       (long)avg,
+			       rel_stddev_stats(stddev_stats(&throughput_stats), avg),
+			       secs);
+		else
+			printf("%ld\n", (long)avg);
+	}
+
+	free(worker);
+	return total / secs;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	unsigned int nr;
+	double base = 0.0;
+
+	argc = parse_options(argc, argv, options, bench_futex_hash_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_hash_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfutexes)
+		nfutexes = 1;
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: %d threads, each operating on %d [private] futexes for %d secs.\n\n",
+		       getpid(), nthreads, nfutexes, runtime);
+
+	if (!scale) {
+		run_once(nthreads);
+		goto out;
+	}
+
+	bench_print_scale_header();
+	for (nr = 1; nr <= nthreads; nr = bench_next_scale(nr, nthreads)) {
+		double ops = run_once(nr);
+
+		if (!base)
+			base = ops;
+		bench_print_scale(nr, ops, base);
+	}
+out:
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	return 0;
+}
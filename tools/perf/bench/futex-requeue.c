@@ -0,0 +1,204 @@
+/*
+ * futex-requeue.c
+ *
+ * requeue: Measure how long it takes to requeue a crowd of waiters
+ *
+ * A number of threads block on futex1, then the main thread moves them
+ * over to futex2 with FUTEX_CMP_REQUEUE, --nrequeue at a time, without
+ * waking any of them. This is what condition variable broadcasts do to
+ * avoid the thundering herd, and it keeps two hash bucket locks busy.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static u_int32_t futex1 = 0, futex2 = 0;
+
+/*
+ * How many tasks to requeue at a time.
+ * Default to 1 in order to make the kernel work more.
+ */
+static unsigned int nrequeue = 1;
+static unsigned int nthreads;
+static unsigned int nrepeat = 10;
+static bool silent;
+
+static pthread_t *worker;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of CPUs)"),
+	OPT_UINTEGER('q', "nrequeue", &nrequeue,
+		     "Specify amount of threads to requeue at once"),
+	OPT_UINTEGER('r', "repeat", &nrepeat,
+		     "Specify amount of times to repeat the run"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_futex_requeue_usage[] = {
+	"perf bench futex requeue <options>",
+	NULL
+};
+
+static void *workerfn(void *arg __used)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	/*
+	 * We may have been requeued to futex2 and woken from there, which
+	 * also returns 0; only retry on interruption.
+	 */
+	while (futex_wait(&futex1, 0, NULL) && errno == EINTR)
+		;
+
+	return NULL;
+}
+
+static void block_threads(void)
+{
+	unsigned int i;
+
+	threads_starting = nthreads;
+
+	/* create and block all threads */
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&worker[i], NULL, workerfn, NULL))
+			die("pthread_create");
+	}
+}
+
+static void print_summary(struct stats *requeuetime_stats)
+{
+	double requeuetime_avg = avg_stats(requeuetime_stats);
+	double requeuetime_stddev = stddev_stats(requeuetime_stats);
+
+	if (bench_format == BENCH_FORMAT_SIMPLE) {
+		printf("%.4f\n", requeuetime_avg / 1e3);
+		return;
+	}
+
+	printf("Requeued %d of %d threads in %.4f ms (+-%.2f%%)\n",
+	       nthreads, nthreads, requeuetime_avg / 1e3,
+	       rel_stddev_stats(requeuetime_stddev, requeuetime_avg));
+}
+
+int bench_futex_requeue(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval start, end, runtime;
+	struct stats requeuetime_stats;
+	unsigned int i, j;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_requeue_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_requeue_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nrequeue)
+		nrequeue = 1;
+	if (nrequeue > nthreads)
+		nrequeue = nthreads;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: Requeuing %d threads (from [private] %p to %p), "
+		       "%d at a time.\n\n",
+		       getpid(), nthreads, &futex1, &futex2, nrequeue);
+
+	memset(&requeuetime_stats, 0, sizeof(requeuetime_stats));
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	for (j = 0; j < nrepeat; j++) {
+		unsigned int nrequeued = 0, nwoken = 0;
+
+		block_threads();
+
+		/* make sure all threads are already blocked */
+		pthread_mutex_lock(&thread_lock);
+		while (threads_starting)
+			pthread_cond_wait(&thread_parent, &thread_lock);
+		pthread_cond_broadcast(&thread_worker);
+		pthread_mutex_unlock(&thread_lock);
+
+		usleep(100000);
+
+		/* Ok, all threads are patiently blocked, start requeueing */
+		gettimeofday(&start, NULL);
+		while (nrequeued < nthreads) {
+			/*
+			 * Do not wakeup any tasks blocked on futex1,
+			 * allowing us to really measure requeue
+			 * overhead.
+			 */
+			int ret = futex_cmp_requeue(&futex1, 0, &futex2, 0,
+						    nrequeue);
+
+			if (ret > 0)
+				nrequeued += ret;
+		}
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &runtime);
+
+		update_stats(&requeuetime_stats, runtime.tv_sec * 1000000 +
+			     runtime.tv_usec);
+
+		if (!silent && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[Run %d]: Requeued %d of %d threads in %.4f ms\n",
+			       j + 1, nrequeued, nthreads,
+			       (runtime.tv_sec * 1000000 + runtime.tv_usec) / 1e3);
+
+		/* everybody should be blocked on futex2, wake'em up */
+		while (nwoken < nthreads) {
+			int ret = futex_wake(&futex2, nthreads);
+
+			if (ret > 0)
+				nwoken += ret;
+		}
+
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(worker[i], NULL))
+				die("pthread_join");
+		}
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	print_summary(&requeuetime_stats);
+
+	free(worker);
+	return 0;
+}
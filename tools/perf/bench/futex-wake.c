@@ -0,0 +1,195 @@
+/*
+ * futex-wake.c
+ *
+ * wake: Measure how long it takes to wake up a crowd of waiters
+ *
+ * A number of threads block on a single futex, then the main thread wakes
+ * them all up with FUTEX_WAKE, --nwakes at a time, and we report how long
+ * that took. This stresses the futex hash bucket walk and the wakeup path
+ * while the bucket lock is contended by the waiters coming back.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/* all threads will block on the same futex */
+static u_int32_t futex1 = 0;
+
+/*
+ * How many wakeups to do at a time.
+ * Default to 1 in order to make the kernel work more.
+ */
+static unsigned int nwakes = 1;
+static unsigned int nthreads;
+static unsigned int nrepeat = 10;
+static bool silent;
+
+static pthread_t *worker;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of CPUs)"),
+	OPT_UINTEGER('w', "nwakes", &nwakes,
+		     "Specify amount of threads to wake at once"),
+	OPT_UINTEGER('r', "repeat", &nrepeat,
+		     "Specify amount of times to repeat the run"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display data/details"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static void *workerfn(void *arg __used)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	/* retry if we return before being woken up, eg. -EINTR */
+	while (futex_wait(&futex1, 0, NULL) && errno != EAGAIN)
+		;
+
+	return NULL;
+}
+
+static void block_threads(void)
+{
+	unsigned int i;
+
+	threads_starting = nthreads;
+
+	/* create and block all threads */
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&worker[i], NULL, workerfn, NULL))
+			die("pthread_create");
+	}
+}
+
+/*
+ * The waiters only block once they have all been released from the
+ * condvar, and there is no way to tell when the last one made it into
+ * the kernel, so give them a moment to settle before measuring.
+ */
+static void wait_for_blocked(void)
+{
+	usleep(100000);
+}
+
+static void print_summary(struct stats *waketime_stats)
+{
+	double waketime_avg = avg_stats(waketime_stats);
+	double waketime_stddev = stddev_stats(waketime_stats);
+
+	if (bench_format == BENCH_FORMAT_SIMPLE) {
+		printf("%.4f\n", waketime_avg / 1e3);
+		return;
+	}
+
+	printf("Wokeup %d of %d threads in %.4f ms (+-%.2f%%)\n",
+	       nthreads, nthreads, waketime_avg / 1e3,
+	       rel_stddev_stats(waketime_stddev, waketime_avg));
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, end, runtime;
+	struct stats waketime_stats;
+	unsigned int i, j;
+
+	argc = parse_options(argc, argv, options, bench_futex_wake_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_wake_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nwakes)
+		nwakes = 1;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: blocking on %d threads (at [private] futex %p), "
+		       "waking up %d at a time.\n\n",
+		       getpid(), nthreads, &futex1, nwakes);
+
+	memset(&waketime_stats, 0, sizeof(waketime_stats));
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	for (j = 0; j < nrepeat; j++) {
+		unsigned int nwoken = 0;
+
+		block_threads();
+
+		/* make sure all threads are already blocked */
+		pthread_mutex_lock(&thread_lock);
+		while (threads_starting)
+			pthread_cond_wait(&thread_parent, &thread_lock);
+		pthread_cond_broadcast(&thread_worker);
+		pthread_mutex_unlock(&thread_lock);
+
+		wait_for_blocked();
+
+		/* Ok, all threads are patiently blocked, start waking folks up */
+		gettimeofday(&start, NULL);
+		while (nwoken != nthreads) {
+			int ret = futex_wake(&futex1, nwakes);
+
+			if (ret > 0)
+				nwoken += ret;
+		}
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &runtime);
+
+		update_stats(&waketime_stats, runtime.tv_sec * 1000000 +
+			     runtime.tv_usec);
+
+		if (!silent && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[Run %d]: Wokeup %d of %d threads in %.4f ms\n",
+			       j + 1, nwoken, nthreads,
+			       (runtime.tv_sec * 1000000 + runtime.tv_usec) / 1e3);
+
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(worker[i], NULL))
+				die("pthread_join");
+		}
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	print_summary(&waketime_stats);
+
+	free(worker);
+	return 0;
+}
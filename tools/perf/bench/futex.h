@@ -0,0 +1,60 @@
+/*
+ * Glibc does not provide futex wrappers, these thin ones are shared by
+ * the futex benchmarks. All futexes used there are process private.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <linux/futex.h>
+
+#ifndef FUTEX_PRIVATE_FLAG
+#define FUTEX_PRIVATE_FLAG	128
+#endif
+
+#define FUTEX_CMD(op)	((op) | FUTEX_PRIVATE_FLAG)
+
+static inline int
+futex_syscall(u_int32_t *uaddr, int op, u_int32_t val,
+	      struct timespec *timeout, u_int32_t *uaddr2, int val3)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_CMD(op), val, timeout,
+		       uaddr2, val3);
+}
+
+/**
+ * futex_wait() - block on uaddr with optional timeout
+ * @timeout:	relative timeout
+ */
+static inline int
+futex_wait(u_int32_t *uaddr, u_int32_t val, struct timespec *timeout)
+{
+	return futex_syscall(uaddr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/**
+ * futex_wake() - wake one or more tasks blocked on uaddr
+ * @nr_wake:	wake up to this many tasks
+ */
+static inline int
+futex_wake(u_int32_t *uaddr, int nr_wake)
+{
+	return futex_syscall(uaddr, FUTEX_WAKE, nr_wake, NULL, NULL, 0);
+}
+
+/**
+ * futex_cmp_requeue() - requeue tasks from uaddr to uaddr2
+ * @nr_wake:	wake up to this many tasks
+ * @nr_requeue:	requeue up to this many tasks
+ */
+static inline int
+futex_cmp_requeue(u_int32_t *uaddr, u_int32_t val, u_int32_t *uaddr2,
+		  int nr_wake, int nr_requeue)
+{
+	return syscall(__NR_futex, uaddr, FUTEX_CMD(FUTEX_CMP_REQUEUE),
+		       nr_wake, (long)nr_requeue, uaddr2, val);
+}
+
+#endif /* _FUTEX_H */
@@ -8,5 +8,7 @@
 
 #undef MEMCPY_FN
 
+extern unsigned long memcpy_nt_threshold;
+
 #endif
 
@@ -1,5 +1,5 @@
 
-MEMCPY_FN(__memcpy,
+MEMCPY_FN(memcpy_orig,
 	"x86-64-unrolled",
 	"unrolled memcpy() in arch/x86/lib/memcpy_64.S")
 
@@ -10,3 +10,11 @@ MEMCPY_FN(memcpy_c,
 MEMCPY_FN(memcpy_c_e,
 	"x86-64-movsb",
 	"movsb-based memcpy() in arch/x86/lib/memcpy_64.S")
+
+MEMCPY_FN(memcpy_erms,
+	"x86-64-erms",
+	"size class dispatching memcpy() in arch/x86/lib/memcpy_64.S")
+
+MEMCPY_FN(memcpy_nt,
+	"x86-64-nt",
+	"non-temporal memcpy() in arch/x86/lib/memcpy_64.S")
@@ -34,7 +34,7 @@ static const struct option options[] = {
 		    "Specify length of memory to copy. "
 		    "Available units: B, KB, MB, GB and TB (upper and lower)"),
 	OPT_STRING('r', "routine", &routine, "default",
-		    "Specify routine to copy"),
+		    "Specify routine to copy, or \"all\" to compare them"),
 	OPT_INTEGER('i', "iterations", &iterations,
 		    "repeat memcpy() invocation this number of times"),
 	OPT_BOOLEAN('c', "cycle", &use_cycle,
@@ -176,48 +176,14 @@ static double do_memcpy_gettimeofday(memcpy_t fn, size_t len, bool prefault)
 			printf(" %14lf GB/Sec", x / K / K / K); \
 	} while (0)
 
-int bench_mem_memcpy(int argc, const char **argv,
-		     const char *prefix __used)
+static int bench_routine(int i, size_t len)
 {
-	int i;
-	size_t len;
 	double result_bps[2];
 	u64 result_cycle[2];
 
-	argc = parse_options(argc, argv, options,
-			     bench_mem_memcpy_usage, 0);
-
-	if (use_cycle)
-		init_cycle();
-
-	len = (size_t)perf_atoll((char *)length_str);
-
 	result_cycle[0] = result_cycle[1] = 0ULL;
 	result_bps[0] = result_bps[1] = 0.0;
 
-	if ((s64)len <= 0) {
-		fprintf(stderr, "Invalid length:%s\n", length_str);
-		return 1;
-	}
-
-	/* same to without specifying either of prefault and no-prefault */
-	if (only_prefault && no_prefault)
-		only_prefault = no_prefault = false;
-
-	for (i = 0; routines[i].name; i++) {
-		if (!strcmp(routines[i].name, routine))
-			break;
-	}
-	if (!routines[i].name) {
-		printf("Unknown routine:%s\n", routine);
-		printf("Available routines...\n");
-		for (i = 0; routines[i].name; i++) {
-			printf("\t%s ... %s\n",
-			       routines[i].name, routines[i].desc);
-		}
-		return 1;
-	}
-
 	if (bench_format == BENCH_FORMAT_DEFAULT)
 		printf("# Copying %s Bytes ...\n\n", length_str);
 
@@ -301,3 +267,65 @@ int bench_mem_memcpy(int argc, const char **argv,
 
 	return 0;
 }
+
+int bench_mem_memcpy(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	int i;
+	size_t len;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_memcpy_usage, 0);
+
+	if (use_cycle)
+		init_cycle();
+
+#ifdef ARCH_X86_64
+	/* The kernel sets this from the cache size at boot as well */
+	if (sysconf(_SC_LEVEL3_CACHE_SIZE) > 0)
+		memcpy_nt_threshold = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	else if (sysconf(_SC_LEVEL2_CACHE_SIZE) > 0)
+		memcpy_nt_threshold = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+	len = (size_t)perf_atoll((char *)length_str);
+
+	if ((s64)len <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+
+	/* same to without specifying either of prefault and no-prefault */
+	if (only_prefault && no_prefault)
+		only_prefault = no_prefault = false;
+
+	if (!strcmp(routine, "all")) {
+		for (i = 0; routines[i].name; i++) {
+			if (bench_format == BENCH_FORMAT_DEFAULT)
+				printf("Routine %s (%s)\n",
+				       routines[i].name, routines[i].desc);
+			else
+				printf("%s ", routines[i].name);
+			bench_routine(i, len);
+			if (bench_format == BENCH_FORMAT_DEFAULT)
+				printf("\n");
+		}
+		return 0;
+	}
+
+	for (i = 0; routines[i].name; i++) {
+		if (!strcmp(routines[i].name, routine))
+			break;
+	}
+	if (!routines[i].name) {
+		printf("Unknown routine:%s\n", routine);
+		printf("Available routines...\n");
+		for (i = 0; routines[i].name; i++) {
+			printf("\t%s ... %s\n",
+			       routines[i].name, routines[i].desc);
+		}
+		return 1;
+	}
+
+	return bench_routine(i, len);
+}
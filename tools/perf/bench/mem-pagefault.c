@@ -0,0 +1,287 @@
+/*
+ * mem-pagefault.c
+ *
+ * pagefault: Fault in anonymous memory from many threads
+ * mmap:      mmap()/munmap() cycles from many threads
+ *
+ * Both suites run threads of a single process, so they share one mm:
+ * 'pagefault' has every thread repeatedly drop (MADV_DONTNEED) and touch
+ * again its own private region, which exercises the fault path under
+ * mmap_sem held for read and the page table locks; 'mmap' has every
+ * thread map, touch and unmap a fresh region, which takes mmap_sem for
+ * write and contends with everybody else.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static const char *length_str = "4MB";
+static unsigned int nthreads;
+static unsigned int runtime = 5;
+static bool scale;
+static bool silent;
+
+static size_t length;
+static size_t page_size;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int tid;
+	pthread_t thread;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "4MB",
+		   "Specify length of memory per thread. "
+		   "Available units: B, KB, MB, GB and TB (upper and lower)"),
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of CPUs)"),
+	OPT_UINTEGER('r', "runtime", &runtime,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('S', "scale", &scale,
+		    "Run with 1, 2, 4, ... threads up to --threads"),
+	OPT_BOOLEAN('s', "silent", &silent,
+		    "Silent mode: do not display per-thread data"),
+	OPT_END()
+};
+
+static const char * const bench_mem_pagefault_usage[] = {
+	"perf bench mem pagefault <options>",
+	NULL
+};
+
+static const char * const bench_mem_mmap_usage[] = {
+	"perf bench mem mmap <options>",
+	NULL
+};
+
+static void thread_ready(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *map_region(void)
+{
+	void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		die("mmap");
+	return p;
+}
+
+/* write each page once, one page fault per page */
+static unsigned long touch_region(char *p)
+{
+	size_t off;
+
+	for (off = 0; off < length; off += page_size)
+		p[off] = 1;
+
+	return length / page_size;
+}
+
+/* ops are page faults */
+static void *pagefault_workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+	char *p = map_region();
+
+	thread_ready();
+
+	do {
+		ops += touch_region(p);
+		if (madvise(p, length, MADV_DONTNEED))
+			die("madvise");
+	} while (!done);
+
+	munmap(p, length);
+	w->ops = ops;
+	return NULL;
+}
+
+/* ops are mmap + fault in + munmap cycles */
+static void *mmap_workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long ops = 0;
+
+	thread_ready();
+
+	do {
+		char *p = map_region();
+
+		touch_region(p);
+		if (munmap(p, length))
+			die("munmap");
+		ops++;
+	} while (!done);
+
+	w->ops = ops;
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static double run_once(unsigned int nr, void *(*fn)(void *),
+		       const char *unit)
+{
+	struct worker *worker;
+	struct timeval start, end, runtime_tv;
+	struct stats throughput_stats;
+	unsigned long total = 0;
+	unsigned int i;
+	double secs, avg;
+
+	worker = calloc(nr, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	memset(&throughput_stats, 0, sizeof(throughput_stats));
+	done = 0;
+	threads_starting = nr;
+
+	for (i = 0; i < nr; i++) {
+		worker[i].tid = i;
+		if (pthread_create(&worker[i].thread, NULL, fn, &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(runtime);
+	while (!done)
+		pause();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &runtime_tv);
+	secs = runtime_tv.tv_sec + runtime_tv.tv_usec / 1e6;
+
+	for (i = 0; i < nr; i++) {
+		unsigned long t;
+
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+
+		t = worker[i].ops / secs;
+		update_stats(&throughput_stats, t);
+		total += worker[i].ops;
+
+		if (!silent && !scale && bench_format == BENCH_FORMAT_DEFAULT)
+			printf("[thread %2d] %ld %s/sec\n", worker[i].tid,
+			       t, unit);
+	}
+
+	avg = avg_stats(&throughput_stats);
+	if (!scale) {
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("\nAveraged %ld %s/sec per thread (+- %.2f%%), total secs = %.3f\n",
+			       (long)avg, unit,
+			       rel_stddev_stats(stddev_stats(&throughput_stats), avg),
+			       secs);
+		else
+			printf("%ld\n", (long)avg);
+	}
+
+	free(worker);
+	return total / secs;
+}
+
+static int bench_mem_threads(int argc, const char **argv,
+			     const char * const *usage,
+			     void *(*fn)(void *), const char *unit)
+{
+	unsigned int nr;
+	double base = 0.0;
+
+	argc = parse_options(argc, argv, options, usage, 0);
+	if (argc) {
+		usage_with_options(usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0 || length < page_size) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("Run summary [PID %d]: %d threads, %s each, for %d secs.\n\n",
+		       getpid(), nthreads, length_str, runtime);
+
+	if (!scale) {
+		run_once(nthreads, fn, unit);
+		goto out;
+	}
+
+	bench_print_scale_header();
+	for (nr = 1; nr <= nthreads; nr = bench_next_scale(nr, nthreads)) {
+		double ops = run_once(nr, fn, unit);
+
+		if (!base)
+			base = ops;
+		bench_print_scale(nr, ops, base);
+	}
+out:
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	return 0;
+}
+
+int bench_mem_pagefault(int argc, const char **argv,
+			const char *prefix __used)
+{
+	return bench_mem_threads(argc, argv, bench_mem_pagefault_usage,
+				 pagefault_workerfn, "faults");
+}
+
+int bench_mem_mmap(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	return bench_mem_threads(argc, argv, bench_mem_mmap_usage,
+				 mmap_workerfn, "mmaps");
+}
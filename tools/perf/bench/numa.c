@@ -0,0 +1,318 @@
+/*
+ * numa.c
+ *
+ * mem: Memory bandwidth per CPU node / memory node placement
+ *
+ * For every pair of (CPU node, memory node) we bind --threads threads to
+ * the CPUs of the first node, bind their buffers to the second node with
+ * mbind(MPOL_BIND), and measure how fast they can stream through them.
+ * The result is a matrix whose diagonal is the local bandwidth and whose
+ * other cells show the cost of remote placement, under load from as many
+ * threads as requested.
+ *
+ * The node topology comes from sysfs, so this does not need libnuma.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/cpumap.h"
+#include "../util/sysfs.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND		2
+#endif
+#ifndef MPOL_MF_STRICT
+#define MPOL_MF_STRICT		(1 << 0)
+#endif
+
+#define MAX_NR_NODES		64
+
+static const char *length_str = "64MB";
+static unsigned int nthreads = 1;
+static unsigned int iterations = 5;
+static bool do_write;
+
+static size_t length;
+
+static int nr_nodes;
+static int node_ids[MAX_NR_NODES];
+static struct cpu_map *node_cpus[MAX_NR_NODES];
+
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct worker {
+	int cpu;
+	int mem_node;
+	char *buf;
+	pthread_t thread;
+	double secs;
+};
+
+static const struct option options[] = {
+	OPT_STRING('l', "length", &length_str, "64MB",
+		   "Specify length of memory per thread. "
+		   "Available units: B, KB, MB, GB and TB (upper and lower)"),
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads per CPU node (0: one per CPU)"),
+	OPT_UINTEGER('i', "iterations", &iterations,
+		     "Specify how many times each buffer is streamed through"),
+	OPT_BOOLEAN('w', "write", &do_write,
+		    "Measure write instead of read bandwidth"),
+	OPT_END()
+};
+
+static const char * const bench_numa_usage[] = {
+	"perf bench numa mem <options>",
+	NULL
+};
+
+/* Find the nodes that have CPUs, from /sys/devices/system/node/node* */
+static int read_nodes(void)
+{
+	const char *sysfs = sysfs_find_mountpoint();
+	char path[PATH_MAX], buf[BUFSIZ];
+	int node;
+
+	if (!sysfs)
+		return -1;
+
+	nr_nodes = 0;
+	for (node = 0; node < MAX_NR_NODES; node++) {
+		FILE *fp;
+		size_t n;
+
+		snprintf(path, sizeof(path),
+			 "%s/devices/system/node/node%d/cpulist", sysfs, node);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+
+		n = fread(buf, 1, sizeof(buf) - 1, fp);
+		fclose(fp);
+		buf[n] = '\0';
+		if (n && buf[n - 1] == '\n')
+			buf[--n] = '\0';
+
+		/* memory only node: can be a target, but not a source */
+		node_ids[nr_nodes] = node;
+		node_cpus[nr_nodes] = n ? cpu_map__new(buf) : NULL;
+		nr_nodes++;
+	}
+
+	return nr_nodes ? 0 : -1;
+}
+
+static int bind_to_cpu(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	return sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+static char *alloc_on_node(int node)
+{
+	unsigned long nodemask = 1UL << node;
+	char *p;
+
+	p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	if (syscall(__NR_mbind, p, length, MPOL_BIND, &nodemask,
+		    sizeof(nodemask) * 8, MPOL_MF_STRICT)) {
+		munmap(p, length);
+		return NULL;
+	}
+
+	return p;
+}
+
+static u64 stream(char *buf)
+{
+	u64 *p = (u64 *)buf, *end = (u64 *)(buf + length);
+	u64 sum = 0;
+
+	if (do_write) {
+		memset(buf, 0x5a, length);
+		return 0;
+	}
+
+	for (; p < end; p += 4)
+		sum += p[0] + p[1] + p[2] + p[3];
+
+	return sum;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	struct timeval start, end, diff;
+	volatile u64 sum __used = 0;
+	unsigned int i;
+
+	if (bind_to_cpu(w->cpu))
+		die("sched_setaffinity");
+
+	/* fault everything in, on the bound node, before measuring */
+	memset(w->buf, 0, length);
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++)
+		sum += stream(w->buf);
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+
+	w->secs = diff.tv_sec + diff.tv_usec / 1e6;
+	return NULL;
+}
+
+/* Returns the aggregate bandwidth in GB/s, or a negative value */
+static double run_cell(int cpu_node, int mem_node)
+{
+	struct cpu_map *cpus = node_cpus[cpu_node];
+	struct worker *worker;
+	unsigned int i, nr = nthreads ? nthreads : (unsigned int)cpus->nr;
+	double gbs = 0.0;
+
+	worker = calloc(nr, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	threads_starting = nr;
+	for (i = 0; i < nr; i++) {
+		worker[i].cpu = cpus->map[i % cpus->nr];
+		worker[i].mem_node = node_ids[mem_node];
+		worker[i].buf = alloc_on_node(node_ids[mem_node]);
+		if (!worker[i].buf) {
+			pr_err("Can't allocate %s Bytes on node %d: %s\n",
+			       length_str, node_ids[mem_node],
+			       strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	for (i = 0; i < nr; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+		if (worker[i].secs)
+			gbs += (double)length * iterations / worker[i].secs / 1e9;
+		munmap(worker[i].buf, length);
+	}
+
+	free(worker);
+	return gbs;
+}
+
+int bench_numa(int argc, const char **argv, const char *prefix __used)
+{
+	int c, m;
+
+	argc = parse_options(argc, argv, options, bench_numa_usage, 0);
+	if (argc) {
+		usage_with_options(bench_numa_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	length = (size_t)perf_atoll((char *)length_str);
+	if ((s64)length <= 0) {
+		fprintf(stderr, "Invalid length:%s\n", length_str);
+		return 1;
+	}
+	/* stream() reads 4 u64s at a time */
+	length &= ~(size_t)(4 * sizeof(u64) - 1);
+	if (!iterations)
+		iterations = 1;
+
+	if (read_nodes()) {
+		fprintf(stderr, "Can't read the NUMA topology from sysfs\n");
+		return 1;
+	}
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT) {
+		printf("# %d nodes, %s per thread, ", nr_nodes, length_str);
+		if (nthreads)
+			printf("%d threads per node, ", nthreads);
+		else
+			printf("one thread per CPU, ");
+		printf("%s bandwidth in GB/s\n\n", do_write ? "write" : "read");
+
+		printf("%10s", "cpu\\mem");
+		for (m = 0; m < nr_nodes; m++) {
+			char name[16];
+
+			snprintf(name, sizeof(name), "node%d", node_ids[m]);
+			printf("  %8s", name);
+		}
+		printf("\n");
+	}
+
+	for (c = 0; c < nr_nodes; c++) {
+		if (!node_cpus[c])
+			continue;
+
+		if (bench_format == BENCH_FORMAT_DEFAULT) {
+			char name[16];
+
+			snprintf(name, sizeof(name), "node%d", node_ids[c]);
+			printf("%10s", name);
+		}
+		for (m = 0; m < nr_nodes; m++) {
+			double gbs = run_cell(c, m);
+
+			if (bench_format == BENCH_FORMAT_DEFAULT)
+				printf("  %8.2f", gbs);
+			else
+				printf("%d %d %.2f\n", node_ids[c],
+				       node_ids[m], gbs);
+			fflush(stdout);
+		}
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("\n");
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	for (c = 0; c < nr_nodes; c++)
+		if (node_cpus[c])
+			cpu_map__delete(node_cpus[c]);
+	return 0;
+}
@@ -13,6 +13,9 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  futex ... futex hashing, wakeup and requeue
+ *  epoll ... epoll event waiting and interest list updates
+ *  numa  ... NUMA memory placement and bandwidth
  *
  */
 
@@ -55,6 +58,51 @@ static struct bench_suite mem_suites[] = {
 	{ "memset",
 	  "Simple memory set in various ways",
 	  bench_mem_memset },
+	{ "pagefault",
+	  "Fault in anonymous memory from many threads",
+	  bench_mem_pagefault },
+	{ "mmap",
+	  "mmap()/munmap() cycles from many threads",
+	  bench_mem_mmap },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite futex_suites[] = {
+	{ "hash",
+	  "Benchmark for futex hash table",
+	  bench_futex_hash },
+	{ "wake",
+	  "Benchmark for futex wake calls",
+	  bench_futex_wake },
+	{ "requeue",
+	  "Benchmark for futex requeue calls",
+	  bench_futex_requeue },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite epoll_suites[] = {
+	{ "wait",
+	  "Benchmark epoll concurrent epoll_wait()s",
+	  bench_epoll_wait },
+	{ "ctl",
+	  "Benchmark epoll concurrent epoll_ctl()s",
+	  bench_epoll_ctl },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite numa_suites[] = {
+	{ "mem",
+	  "Memory bandwidth per CPU node / memory node placement",
+	  bench_numa },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -74,6 +122,15 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "futex",
+	  "futex stressing benchmarks",
+	  futex_suites },
+	{ "epoll",
+	  "epoll stressing benchmarks",
+	  epoll_suites },
+	{ "numa",
+	  "NUMA scheduling and memory placement",
+	  numa_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "all benchmark subsystem",
 	  NULL },
@@ -129,6 +186,29 @@ static void print_usage(void)
 	printf("\n");
 }
 
+unsigned int bench_next_scale(unsigned int nr, unsigned int max)
+{
+	if (nr == max)
+		return max + 1;
+	return nr * 2 > max ? max : nr * 2;
+}
+
+void bench_print_scale_header(void)
+{
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %8s %16s %16s %10s\n", "threads", "ops/sec",
+		       "ops/sec/thread", "speedup");
+}
+
+void bench_print_scale(unsigned int nr, double ops, double base)
+{
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("  %8u %16.0f %16.0f %9.2fx\n", nr, ops, ops / nr,
+		       base ? ops / base : 0.0);
+	else
+		printf("%u %.0f\n", nr, ops);
+}
+
 static int bench_str2int(const char *str)
 {
 	if (!str)
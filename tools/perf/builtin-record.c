@@ -121,9 +121,55 @@ static void perf_record__mmap_read(struct perf_record *rec,
 	perf_mmap__write_tail(md, old);
 }
 
+/*
+ * With --overwrite the kernel writes the buffer backward: data_head is the
+ * start of the newest record and the older ones follow it, up to a record
+ * that was never written (size 0, the pages start zeroed) or that no longer
+ * fits in the buffer because the newer ones overwrote its tail.
+ */
+static void perf_record__mmap_read_backward(struct perf_record *rec,
+					    struct perf_mmap *md)
+{
+	unsigned int head = perf_mmap__read_head(md);
+	unsigned int start = head, end = head;
+	unsigned char *data = md->base + rec->page_size;
+	struct perf_event_header *header;
+	unsigned long size;
+	void *buf;
+
+	for (;;) {
+		header = (struct perf_event_header *)&data[end & md->mask];
+		if (!header->size ||
+		    end - start + header->size > (unsigned int)md->mask + 1)
+			break;
+		end += header->size;
+	}
+
+	if (start == end)
+		return;
+
+	rec->samples++;
+
+	size = end - start;
+
+	if ((start & md->mask) + size != (end & md->mask)) {
+		buf = &data[start & md->mask];
+		size = md->mask + 1 - (start & md->mask);
+		start += size;
+
+		write_output(rec, buf, size);
+	}
+
+	buf = &data[start & md->mask];
+	size = end - start;
+
+	write_output(rec, buf, size);
+}
+
 static volatile int done = 0;
 static volatile int signr = -1;
 static volatile int child_finished = 0;
+static volatile int snapshot_pending = 0;
 
 static void sig_handler(int sig)
 {
@@ -134,6 +180,11 @@ static void sig_handler(int sig)
 	signr = sig;
 }
 
+static void snapshot_sig_handler(int sig __used)
+{
+	snapshot_pending = 1;
+}
+
 static void perf_record__sig_exit(int exit_status __used, void *arg)
 {
 	struct perf_record *rec = arg;
@@ -291,7 +342,7 @@ try_again:
 		exit(-1);
 	}
 
-	if (perf_evlist__mmap(evlist, opts->mmap_pages, false) < 0) {
+	if (perf_evlist__mmap(evlist, opts->mmap_pages, opts->overwrite) < 0) {
 		if (errno == EPERM)
 			die("Permission error mapping pages.\n"
 			    "Consider increasing "
@@ -400,6 +451,29 @@ static void perf_record__mmap_read_all(struct perf_record *rec)
 		write_output(rec, &finished_round_event, sizeof(finished_round_event));
 }
 
+/*
+ * Dump the current content of the overwritten buffers. The writers are
+ * paused meanwhile, what they miss is accounted as PERF_RECORD_LOST.
+ */
+static void perf_record__mmap_snapshot_all(struct perf_record *rec)
+{
+	struct perf_mmap *md;
+	int i;
+
+	for (i = 0; i < rec->evlist->nr_mmaps; i++) {
+		md = &rec->evlist->mmap[i];
+		if (!md->base)
+			continue;
+
+		ioctl(md->fd, PERF_EVENT_IOC_PAUSE_OUTPUT, 1);
+		perf_record__mmap_read_backward(rec, md);
+		ioctl(md->fd, PERF_EVENT_IOC_PAUSE_OUTPUT, 0);
+	}
+
+	if (perf_header__has_feat(&rec->session->header, HEADER_TRACING_DATA))
+		write_output(rec, &finished_round_event, sizeof(finished_round_event));
+}
+
 static int __cmd_record(struct perf_record *rec, int argc, const char **argv)
 {
 	struct stat st;
@@ -422,6 +496,8 @@ static int __cmd_record(struct perf_record *rec, int argc, const char **argv)
 	signal(SIGCHLD, sig_handler);
 	signal(SIGINT, sig_handler);
 	signal(SIGUSR1, sig_handler);
+	if (opts->overwrite)
+		signal(SIGUSR2, snapshot_sig_handler);
 
 	if (!output_name) {
 		if (!fstat(STDOUT_FILENO, &st) && S_ISFIFO(st.st_mode))
@@ -614,6 +690,21 @@ static int __cmd_record(struct perf_record *rec, int argc, const char **argv)
 	for (;;) {
 		int hits = rec->samples;
 
+		if (opts->overwrite) {
+			/* flight recorder: only dump on SIGUSR2 and at exit */
+			if (snapshot_pending || done) {
+				snapshot_pending = 0;
+				perf_record__mmap_snapshot_all(rec);
+			}
+			if (done) {
+				perf_evlist__disable(evsel_list);
+				break;
+			}
+			poll(evsel_list->pollfd, evsel_list->nr_fds, -1);
+			waking++;
+			continue;
+		}
+
 		perf_record__mmap_read_all(rec);
 
 		if (hits == rec->samples) {
@@ -666,6 +757,7 @@ static const struct branch_mode branch_modes[] = {
 	BRANCH_OPT("any_call", PERF_SAMPLE_BRANCH_ANY_CALL),
 	BRANCH_OPT("any_ret", PERF_SAMPLE_BRANCH_ANY_RETURN),
 	BRANCH_OPT("ind_call", PERF_SAMPLE_BRANCH_IND_CALL),
+	BRANCH_OPT("call_stack", PERF_SAMPLE_BRANCH_CALL_STACK),
 	BRANCH_END
 };
 
@@ -732,6 +824,120 @@ error:
 	return ret;
 }
 
+#ifndef NO_LIBUNWIND_SUPPORT
+static unsigned long default_stack_dump_size = 8192;
+
+static int get_stack_size(char *str, unsigned long *_size)
+{
+	char *endptr;
+	unsigned long size;
+	unsigned long max_size = round_down(USHRT_MAX, sizeof(u64));
+
+	size = strtoul(str, &endptr, 0);
+
+	do {
+		if (*endptr)
+			break;
+
+		size = round_up(size, sizeof(u64));
+		if (!size || size > max_size)
+			break;
+
+		*_size = size;
+		return 0;
+
+	} while (0);
+
+	pr_err("callchain: Incorrect stack dump size (max %ld): %s\n",
+	       max_size, str);
+	return -1;
+}
+#endif /* !NO_LIBUNWIND_SUPPORT */
+
+static int
+parse_callchain_opt(const struct option *opt __used, const char *arg,
+		    int unset)
+{
+	struct perf_record *rec = (struct perf_record *)opt->value;
+	char *tok, *name, *saveptr = NULL;
+	char *buf;
+	int ret = -1;
+
+	/* --no-call-graph */
+	if (unset)
+		return 0;
+
+	/* We specified default option if none is provided. */
+	BUG_ON(!arg);
+
+	/* We need buffer that we know we can write to. */
+	buf = malloc(strlen(arg) + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	strcpy(buf, arg);
+
+	tok = strtok_r((char *)buf, ",", &saveptr);
+	name = tok ? : (char *)buf;
+
+	do {
+		/* Framepointer style */
+		if (!strncmp(name, "fp", sizeof("fp"))) {
+			if (!strtok_r(NULL, ",", &saveptr)) {
+				rec->opts.call_graph = CALLCHAIN_FP;
+				ret = 0;
+			} else
+				pr_err("callchain: No more arguments "
+				       "needed for -g fp\n");
+			break;
+
+#ifndef NO_LIBUNWIND_SUPPORT
+		/* Dwarf style */
+		} else if (!strncmp(name, "dwarf", sizeof("dwarf"))) {
+			unsigned long size = default_stack_dump_size;
+
+			ret = 0;
+			rec->opts.call_graph = CALLCHAIN_DWARF;
+			rec->opts.stack_dump_size = size;
+
+			tok = strtok_r(NULL, ",", &saveptr);
+			if (tok) {
+				ret = get_stack_size(tok, &size);
+				rec->opts.stack_dump_size = size;
+			}
+
+			if (!ret)
+				pr_debug("callchain: stack dump size %d\n",
+					 rec->opts.stack_dump_size);
+			break;
+#endif /* !NO_LIBUNWIND_SUPPORT */
+
+		/* Hardware LBR call stack */
+		} else if (!strncmp(name, "lbr", sizeof("lbr"))) {
+			if (!strtok_r(NULL, ",", &saveptr)) {
+				rec->opts.call_graph = CALLCHAIN_LBR;
+				ret = 0;
+			} else
+				pr_err("callchain: No more arguments "
+				       "needed for -g lbr\n");
+			break;
+
+		} else {
+			pr_err("callchain: Unknown -g option "
+			       "value: %s\n", arg);
+			break;
+		}
+
+	} while (0);
+
+	free(buf);
+
+	if (!ret)
+		pr_debug("callchain: type %d\n", rec->opts.call_graph);
+
+	return ret;
+}
+
 static const char * const record_usage[] = {
 	"perf record [<options>] [<command>]",
 	"perf record [<options>] -- <command> [<options>]",
@@ -769,6 +975,14 @@ static struct perf_record record = {
  * perf_evlist__prepare_workload, etc instead of fork+exec'in 'perf record',
  * using pipes, etc.
  */
+#ifndef NO_LIBUNWIND_SUPPORT
+static const char callchain_help[] = "do call-graph (stack chain/backtrace) "
+				     "recording: [fp] dwarf lbr";
+#else
+static const char callchain_help[] = "do call-graph (stack chain/backtrace) "
+				     "recording: [fp] lbr";
+#endif
+
 const struct option record_options[] = {
 	OPT_CALLBACK('e', "event", &record.evlist, "event",
 		     "event selector. use 'perf list' to list available events",
@@ -801,10 +1015,13 @@ const struct option record_options[] = {
 	OPT_UINTEGER('F', "freq", &record.opts.user_freq, "profile at this frequency"),
 	OPT_UINTEGER('m', "mmap-pages", &record.opts.mmap_pages,
 		     "number of mmap data pages"),
+	OPT_BOOLEAN(0, "overwrite", &record.opts.overwrite,
+		    "keep only the latest records, write them out on SIGUSR2 and at exit"),
 	OPT_BOOLEAN(0, "group", &record.opts.group,
 		    "put the counters into a counter group"),
-	OPT_BOOLEAN('g', "call-graph", &record.opts.call_graph,
-		    "do call-graph (stack chain/backtrace) recording"),
+	OPT_CALLBACK_DEFAULT('g', "call-graph", &record, "mode[,dump_size]",
+			     callchain_help, &parse_callchain_opt,
+			     "fp"),
 	OPT_INCR('v', "verbose", &verbose,
 		    "be more verbose (show counter open errors, etc)"),
 	OPT_BOOLEAN('q', "quiet", &quiet, "don't print any message"),
@@ -865,6 +1082,12 @@ int cmd_record(int argc, const char **argv, const char *prefix __used)
 		rec->write_mode = WRITE_FORCE;
 	}
 
+	if (rec->opts.call_graph == CALLCHAIN_LBR && rec->opts.branch_stack) {
+		ui__error("The LBR can't record both a call stack and "
+			  "branches: -g lbr and -b/-j are exclusive\n");
+		usage_with_options(record_usage, record_options);
+	}
+
 	if (nr_cgroups && !rec->opts.target.system_wide) {
 		ui__error("cgroup monitoring only available in"
 			  " system-wide mode\n");
@@ -124,6 +124,8 @@ static unsigned long		nr_lost_chunks;
 static unsigned long		nr_lost_events;
 
 #define TASK_STATE_TO_CHAR_STR "RSDTtZX"
+/* Or'ed into prev_state of sched_switch when the task was preempted */
+#define TASK_STATE_MAX		512
 
 enum thread_state {
 	THREAD_SLEEPING = 0,
@@ -736,7 +738,8 @@ struct trace_sched_handler {
 			     struct event_format *,
 			     int cpu,
 			     u64 timestamp,
-			     struct thread *thread);
+			     struct thread *thread,
+			     struct perf_sample *sample);
 
 	void (*runtime_event)(struct trace_runtime_event *,
 			      struct machine *,
@@ -800,7 +803,8 @@ replay_switch_event(struct trace_switch_event *switch_event,
 		    struct event_format *event,
 		    int cpu,
 		    u64 timestamp,
-		    struct thread *thread __used)
+		    struct thread *thread __used,
+		    struct perf_sample *sample __used)
 {
 	struct task_desc *prev, __used *next;
 	u64 timestamp0;
@@ -1034,7 +1038,8 @@ latency_switch_event(struct trace_switch_event *switch_event,
 		     struct event_format *event __used,
 		     int cpu,
 		     u64 timestamp,
-		     struct thread *thread __used)
+		     struct thread *thread __used,
+		     struct perf_sample *sample __used)
 {
 	struct work_atoms *out_events, *in_events;
 	struct thread *sched_out, *sched_in;
@@ -1406,7 +1411,8 @@ map_switch_event(struct trace_switch_event *switch_event,
 		 struct event_format *event __used,
 		 int this_cpu,
 		 u64 timestamp,
-		 struct thread *thread __used)
+		 struct thread *thread __used,
+		 struct perf_sample *sample __used)
 {
 	struct thread *sched_out __used, *sched_in;
 	int new_shortname;
@@ -1479,6 +1485,514 @@ map_switch_event(struct trace_switch_event *switch_event,
 	}
 }
 
+/*
+ * timehist: a line per context switch, and per task, per blocking
+ * kernel stack and per wakeup source summaries. Only aggregates are
+ * kept, so the data file is streamed through whatever its size.
+ */
+struct offcpu_stack {
+	struct rb_node		node;
+	u64			total;
+	u64			max;
+	u64			count;
+	int			nr;
+	u64			ips[0];
+};
+
+struct wakeup_source {
+	struct rb_node		node;
+	const char		*comm;
+	u64			total;
+	u64			count;
+};
+
+struct thread_runtime {
+	struct list_head	list;
+	struct thread		*thread;
+
+	u64			last_in;	/* switched in */
+	u64			last_out;	/* switched out */
+	u64			ready_at;	/* runnable, waiting for a cpu */
+	u64			dt_wait;	/* off-CPU before last switch in */
+	u64			dt_delay;	/* runqueue delay of last switch in */
+	struct offcpu_stack	*stack;		/* where it last blocked */
+
+	u64			nr_switches;
+	u64			total_run;
+	u64			total_sleep;
+	u64			total_delay;
+	u64			max_delay;
+	u64			max_delay_at;
+};
+
+static bool			timehist_summary_only;
+static bool			timehist_with_summary;
+static bool			timehist_off_cpu;
+static int			timehist_max_stack = 5;
+static bool			timehist_header_done;
+
+static LIST_HEAD(timehist_tasks);
+static struct rb_root		offcpu_stacks;
+static struct rb_root		wakeup_sources;
+
+/* Scheduler and tracing frames every blocked stack starts with */
+static const char *offcpu_skip_syms[] = {
+	"__schedule",
+	"schedule",
+	"preempt_schedule",
+	"preempt_schedule_irq",
+};
+
+static bool offcpu_skip_frame(struct symbol *sym)
+{
+	unsigned int i;
+
+	if (!prefixcmp(sym->name, "perf_trace_"))
+		return true;
+
+	for (i = 0; i < ARRAY_SIZE(offcpu_skip_syms); i++)
+		if (!strcmp(sym->name, offcpu_skip_syms[i]))
+			return true;
+
+	return false;
+}
+
+static struct thread_runtime *thread__runtime(struct thread *thread)
+{
+	struct thread_runtime *r = thread->priv;
+
+	if (r)
+		return r;
+
+	r = zalloc(sizeof(*r));
+	if (r == NULL)
+		die("No memory");
+
+	r->thread = thread;
+	thread->priv = r;
+	list_add_tail(&r->list, &timehist_tasks);
+
+	return r;
+}
+
+/*
+ * Find or add the kernel stack the task blocked in: the kernel part of
+ * the sched_switch callchain, less the scheduler frames on top of it.
+ */
+static struct offcpu_stack *offcpu_stack__findnew(struct machine *machine,
+						  struct ip_callchain *chain)
+{
+	struct rb_node **p = &offcpu_stacks.rb_node;
+	struct rb_node *parent = NULL;
+	struct offcpu_stack *stack;
+	u64 ips[PERF_MAX_STACK_DEPTH];
+	bool skipping = true;
+	int nr = 0;
+	u64 i;
+
+	if (chain == NULL)
+		return NULL;
+
+	for (i = 0; i < chain->nr && nr < timehist_max_stack; i++) {
+		u64 ip = chain->ips[i];
+		struct symbol *sym;
+
+		if (ip == PERF_CONTEXT_KERNEL)
+			continue;
+		if (ip >= PERF_CONTEXT_MAX)
+			break;
+
+		if (skipping) {
+			sym = machine__find_kernel_function(machine, ip,
+							    NULL, NULL);
+			if (sym && offcpu_skip_frame(sym))
+				continue;
+			skipping = false;
+		}
+		ips[nr++] = ip;
+	}
+
+	if (!nr)
+		return NULL;
+
+	while (*p) {
+		int cmp;
+
+		parent = *p;
+		stack = rb_entry(parent, struct offcpu_stack, node);
+
+		cmp = stack->nr - nr;
+		if (!cmp)
+			cmp = memcmp(stack->ips, ips, nr * sizeof(u64));
+		if (cmp > 0)
+			p = &(*p)->rb_left;
+		else if (cmp < 0)
+			p = &(*p)->rb_right;
+		else
+			return stack;
+	}
+
+	stack = zalloc(sizeof(*stack) + nr * sizeof(u64));
+	if (stack == NULL)
+		die("No memory");
+
+	stack->nr = nr;
+	memcpy(stack->ips, ips, nr * sizeof(u64));
+
+	rb_link_node(&stack->node, parent, p);
+	rb_insert_color(&stack->node, &offcpu_stacks);
+
+	return stack;
+}
+
+static struct wakeup_source *wakeup_source__findnew(const char *comm)
+{
+	struct rb_node **p = &wakeup_sources.rb_node;
+	struct rb_node *parent = NULL;
+	struct wakeup_source *ws;
+
+	while (*p) {
+		int cmp;
+
+		parent = *p;
+		ws = rb_entry(parent, struct wakeup_source, node);
+
+		cmp = strcmp(ws->comm, comm);
+		if (cmp > 0)
+			p = &(*p)->rb_left;
+		else if (cmp < 0)
+			p = &(*p)->rb_right;
+		else
+			return ws;
+	}
+
+	ws = zalloc(sizeof(*ws));
+	if (ws == NULL)
+		die("No memory");
+
+	ws->comm = strdup(comm);
+	if (ws->comm == NULL)
+		die("No memory");
+
+	rb_link_node(&ws->node, parent, p);
+	rb_insert_color(&ws->node, &wakeup_sources);
+
+	return ws;
+}
+
+/* The task stopped sleeping: charge the time to its stack and waker */
+static void timehist_end_sleep(struct thread_runtime *r, u64 timestamp,
+			       const char *waker)
+{
+	u64 dt = timestamp - r->last_out;
+
+	r->total_sleep += dt;
+
+	if (r->stack) {
+		r->stack->total += dt;
+		r->stack->count++;
+		if (dt > r->stack->max)
+			r->stack->max = dt;
+		r->stack = NULL;
+	}
+
+	if (timehist_off_cpu) {
+		struct wakeup_source *ws;
+
+		ws = wakeup_source__findnew(waker ?: "<unknown>");
+		ws->total += dt;
+		ws->count++;
+	}
+}
+
+static void timehist_print_header(void)
+{
+	printf("%15s %6s  %-22s  %9s  %9s  %9s\n",
+	       "time", "cpu", "task name[pid]",
+	       "wait time", "sch delay", "run time");
+	printf("%15s %6s  %-22s  %9s  %9s  %9s\n",
+	       "", "", "", "(msec)", "(msec)", "(msec)");
+	printf("%.15s %.6s  %.22s  %.9s  %.9s  %.9s\n",
+	       graph_dotted_line, graph_dotted_line, graph_dotted_line,
+	       graph_dotted_line, graph_dotted_line, graph_dotted_line);
+}
+
+static void timehist_print_switch(struct thread_runtime *r, int cpu,
+				  u64 timestamp, u64 dt_run)
+{
+	char name[64];
+
+	if (!timehist_header_done) {
+		timehist_print_header();
+		timehist_header_done = true;
+	}
+
+	snprintf(name, sizeof(name), "%s[%d]",
+		 r->thread->comm ?: "<unknown>", r->thread->pid);
+
+	printf("%15.6f [%04d]  %-22s  %9.3f  %9.3f  %9.3f\n",
+	       (double)timestamp / 1e9, cpu, name,
+	       (double)r->dt_wait / 1e6, (double)r->dt_delay / 1e6,
+	       (double)dt_run / 1e6);
+}
+
+static void
+timehist_switch_event(struct trace_switch_event *switch_event,
+		      struct machine *machine,
+		      struct event_format *event __used,
+		      int cpu,
+		      u64 timestamp,
+		      struct thread *thread __used,
+		      struct perf_sample *sample)
+{
+	struct thread *sched_out, *sched_in;
+	struct thread_runtime *r;
+
+	/* The idle tasks of all cpus share pid 0: leave them out */
+	if (switch_event->prev_pid) {
+		u64 dt_run = 0;
+
+		sched_out = machine__findnew_thread(machine,
+						    switch_event->prev_pid);
+		r = thread__runtime(sched_out);
+
+		if (r->last_in) {
+			dt_run = timestamp - r->last_in;
+			r->total_run += dt_run;
+			r->nr_switches++;
+
+			if (!timehist_summary_only)
+				timehist_print_switch(r, cpu, timestamp,
+						      dt_run);
+		}
+
+		r->last_in = 0;
+		r->last_out = timestamp;
+		if (!(switch_event->prev_state & ~(u64)TASK_STATE_MAX)) {
+			/* Preempted: straight back on the runqueue */
+			r->ready_at = timestamp;
+			r->stack = NULL;
+		} else {
+			r->ready_at = 0;
+			r->stack = offcpu_stack__findnew(machine,
+							 sample->callchain);
+		}
+	}
+
+	if (switch_event->next_pid) {
+		sched_in = machine__findnew_thread(machine,
+						   switch_event->next_pid);
+		r = thread__runtime(sched_in);
+
+		r->dt_wait = r->dt_delay = 0;
+		if (r->last_out) {
+			/* Blocked, but its wakeup was not seen */
+			if (!r->ready_at)
+				timehist_end_sleep(r, timestamp, NULL);
+			r->dt_wait = timestamp - r->last_out;
+		}
+		if (r->ready_at) {
+			r->dt_delay = timestamp - r->ready_at;
+			r->total_delay += r->dt_delay;
+			if (r->dt_delay > r->max_delay) {
+				r->max_delay = r->dt_delay;
+				r->max_delay_at = timestamp;
+			}
+		}
+
+		r->last_in = timestamp;
+		r->last_out = r->ready_at = 0;
+	}
+}
+
+static void
+timehist_wakeup_event(struct trace_wakeup_event *wakeup_event,
+		      struct machine *machine,
+		      struct event_format *event __used,
+		      int cpu __used,
+		      u64 timestamp,
+		      struct thread *thread)
+{
+	struct thread_runtime *r;
+
+	if (!wakeup_event->success || !wakeup_event->pid)
+		return;
+
+	r = thread__runtime(machine__findnew_thread(machine,
+						    wakeup_event->pid));
+
+	/* Already runnable, or running: nothing to end */
+	if (r->ready_at || r->last_in)
+		return;
+
+	if (r->last_out)
+		timehist_end_sleep(r, timestamp,
+				   thread->pid ? thread->comm : "<idle/irq>");
+
+	r->ready_at = timestamp;
+}
+
+static struct trace_sched_handler timehist_ops  = {
+	.wakeup_event		= timehist_wakeup_event,
+	.switch_event		= timehist_switch_event,
+};
+
+static int thread_runtime_cmp(const void *a, const void *b)
+{
+	const struct thread_runtime *l = *(struct thread_runtime **)a;
+	const struct thread_runtime *r = *(struct thread_runtime **)b;
+
+	if (l->total_run != r->total_run)
+		return l->total_run < r->total_run ? 1 : -1;
+
+	return l->thread->pid - r->thread->pid;
+}
+
+static void timehist_print_tasks(void)
+{
+	struct thread_runtime **tasks, *r;
+	unsigned long nr = 0, i;
+	u64 total_run = 0;
+
+	list_for_each_entry(r, &timehist_tasks, list)
+		nr++;
+
+	if (!nr)
+		return;
+
+	tasks = calloc(nr, sizeof(*tasks));
+	if (tasks == NULL)
+		die("No memory");
+
+	i = 0;
+	list_for_each_entry(r, &timehist_tasks, list)
+		tasks[i++] = r;
+
+	qsort(tasks, nr, sizeof(*tasks), thread_runtime_cmp);
+
+	printf("\nRuntime summary\n");
+	printf("%-22s  %8s  %11s  %11s  %11s  %11s  %11s  %15s\n",
+	       "task name[pid]", "switches", "run (ms)", "sleep (ms)",
+	       "delay (ms)", "avg delay", "max delay", "max delay at");
+	printf("%.22s  %.8s  %.11s  %.11s  %.11s  %.11s  %.11s  %.15s\n",
+	       graph_dotted_line, graph_dotted_line, graph_dotted_line,
+	       graph_dotted_line, graph_dotted_line, graph_dotted_line,
+	       graph_dotted_line, graph_dotted_line);
+
+	for (i = 0; i < nr; i++) {
+		char name[64];
+		double avg = 0;
+
+		r = tasks[i];
+		if (!r->nr_switches)
+			continue;
+
+		total_run += r->total_run;
+		avg = (double)r->total_delay / r->nr_switches;
+
+		snprintf(name, sizeof(name), "%s[%d]",
+			 r->thread->comm ?: "<unknown>", r->thread->pid);
+
+		printf("%-22s  %8" PRIu64 "  %11.3f  %11.3f  %11.3f  %11.3f  %11.3f  %15.6f\n",
+		       name, r->nr_switches,
+		       (double)r->total_run / 1e6,
+		       (double)r->total_sleep / 1e6,
+		       (double)r->total_delay / 1e6,
+		       avg / 1e6, (double)r->max_delay / 1e6,
+		       (double)r->max_delay_at / 1e9);
+	}
+
+	printf("\n  Total run time (ms): %.3f\n", (double)total_run / 1e6);
+
+	free(tasks);
+}
+
+static int offcpu_stack_cmp(const void *a, const void *b)
+{
+	const struct offcpu_stack *l = *(struct offcpu_stack **)a;
+	const struct offcpu_stack *r = *(struct offcpu_stack **)b;
+
+	if (l->total == r->total)
+		return 0;
+	return l->total < r->total ? 1 : -1;
+}
+
+static void timehist_print_stacks(struct machine *machine)
+{
+	struct offcpu_stack **stacks;
+	struct rb_node *nd;
+	unsigned long nr = 0, i;
+	int j;
+
+	for (nd = rb_first(&offcpu_stacks); nd; nd = rb_next(nd))
+		nr++;
+
+	printf("\nOff-CPU time by kernel stack\n");
+	if (!nr) {
+		printf("  no callchains, record with: perf sched record -g\n");
+		return;
+	}
+
+	stacks = calloc(nr, sizeof(*stacks));
+	if (stacks == NULL)
+		die("No memory");
+
+	i = 0;
+	for (nd = rb_first(&offcpu_stacks); nd; nd = rb_next(nd))
+		stacks[i++] = rb_entry(nd, struct offcpu_stack, node);
+
+	qsort(stacks, nr, sizeof(*stacks), offcpu_stack_cmp);
+
+	printf("%11s  %8s  %11s  %11s\n",
+	       "total (ms)", "count", "avg (ms)", "max (ms)");
+	printf("%.11s  %.8s  %.11s  %.11s\n", graph_dotted_line,
+	       graph_dotted_line, graph_dotted_line, graph_dotted_line);
+
+	for (i = 0; i < nr; i++) {
+		struct offcpu_stack *stack = stacks[i];
+
+		if (!stack->count)
+			continue;
+
+		printf("%11.3f  %8" PRIu64 "  %11.3f  %11.3f\n",
+		       (double)stack->total / 1e6, stack->count,
+		       (double)stack->total / stack->count / 1e6,
+		       (double)stack->max / 1e6);
+
+		for (j = 0; j < stack->nr; j++) {
+			struct symbol *sym;
+
+			sym = machine__find_kernel_function(machine,
+							    stack->ips[j],
+							    NULL, NULL);
+			if (sym)
+				printf("%16s%s\n", "", sym->name);
+			else
+				printf("%16s%#" PRIx64 "\n", "", stack->ips[j]);
+		}
+	}
+
+	free(stacks);
+}
+
+static void timehist_print_wakeup_sources(void)
+{
+	struct rb_node *nd;
+
+	printf("\nSleep time by wakeup source\n");
+	printf("%-22s  %8s  %11s\n", "waker", "wakeups", "sleep (ms)");
+	printf("%.22s  %.8s  %.11s\n", graph_dotted_line, graph_dotted_line,
+	       graph_dotted_line);
+
+	for (nd = rb_first(&wakeup_sources); nd; nd = rb_next(nd)) {
+		struct wakeup_source *ws;
+
+		ws = rb_entry(nd, struct wakeup_source, node);
+		printf("%-22s  %8" PRIu64 "  %11.3f\n", ws->comm, ws->count,
+		       (double)ws->total / 1e6);
+	}
+}
+
 static void
 process_sched_switch_event(struct perf_tool *tool __used,
 			   struct event_format *event,
@@ -1510,7 +2024,8 @@ process_sched_switch_event(struct perf_tool *tool __used,
 	}
 	if (trace_handler->switch_event)
 		trace_handler->switch_event(&switch_event, machine, event,
-					    this_cpu, sample->time, thread);
+					    this_cpu, sample->time, thread,
+					    sample);
 
 	curr_pid[this_cpu] = switch_event.next_pid;
 }
@@ -1632,6 +2147,7 @@ static struct perf_sched perf_sched = {
 	.tool = {
 		.sample		 = perf_sched__process_tracepoint_sample,
 		.comm		 = perf_event__process_comm,
+		.mmap		 = perf_event__process_mmap,
 		.lost		 = perf_event__process_lost,
 		.fork		 = perf_event__process_task,
 		.ordered_samples = true,
@@ -1760,6 +2276,32 @@ static void __cmd_map(void)
 	print_bad_events();
 }
 
+static void __cmd_timehist(void)
+{
+	struct perf_session *session;
+
+	if (timehist_max_stack > PERF_MAX_STACK_DEPTH)
+		timehist_max_stack = PERF_MAX_STACK_DEPTH;
+	if (timehist_off_cpu && !timehist_with_summary)
+		timehist_summary_only = true;
+
+	setup_pager();
+	read_events(false, &session);
+
+	if (timehist_summary_only || timehist_with_summary)
+		timehist_print_tasks();
+
+	if (timehist_off_cpu) {
+		timehist_print_stacks(&session->host_machine);
+		timehist_print_wakeup_sources();
+	}
+
+	print_bad_events();
+	printf("\n");
+
+	perf_session__delete(session);
+}
+
 static void __cmd_replay(void)
 {
 	unsigned long i;
@@ -1794,7 +2336,7 @@ static void __cmd_replay(void)
 
 
 static const char * const sched_usage[] = {
-	"perf sched [<options>] {record|latency|map|replay|script}",
+	"perf sched [<options>] {record|latency|map|replay|script|timehist}",
 	NULL
 };
 
@@ -1840,6 +2382,27 @@ static const struct option replay_options[] = {
 	OPT_END()
 };
 
+static const char * const timehist_usage[] = {
+	"perf sched timehist [<options>]",
+	NULL
+};
+
+static const struct option timehist_options[] = {
+	OPT_BOOLEAN('s', "summary", &timehist_summary_only,
+		    "show only the per task summary, not each switch"),
+	OPT_BOOLEAN('S', "with-summary", &timehist_with_summary,
+		    "show each switch and the per task summary"),
+	OPT_BOOLEAN(0, "off-cpu", &timehist_off_cpu,
+		    "sum sleep time per kernel stack and per wakeup source"),
+	OPT_INTEGER(0, "max-stack", &timehist_max_stack,
+		    "kernel frames to keep per off-CPU stack"),
+	OPT_INCR('v', "verbose", &verbose,
+		    "be more verbose (show symbol address, etc)"),
+	OPT_BOOLEAN('D', "dump-raw-trace", &dump_trace,
+		    "dump raw trace in ASCII"),
+	OPT_END()
+};
+
 static void setup_sorting(void)
 {
 	char *tmp, *tok, *str = strdup(sort_order);
@@ -1934,6 +2497,16 @@ int cmd_sched(int argc, const char **argv, const char *prefix __used)
 				usage_with_options(replay_usage, replay_options);
 		}
 		__cmd_replay();
+	} else if (!strcmp(argv[0], "timehist")) {
+		trace_handler = &timehist_ops;
+		if (argc) {
+			argc = parse_options(argc, argv, timehist_options,
+					     timehist_usage, 0);
+			if (argc)
+				usage_with_options(timehist_usage,
+						   timehist_options);
+		}
+		__cmd_timehist();
 	} else {
 		usage_with_options(sched_usage, sched_options);
 	}
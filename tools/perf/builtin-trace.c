@@ -0,0 +1,800 @@
+/*
+ * builtin-trace.c
+ *
+ * strace-like syscall tracer built on the raw_syscalls tracepoints: the
+ * traced tasks are not stopped at every syscall as with ptrace, the
+ * kernel just records the entry and exit events, filtered by syscall in
+ * the kernel when asked to. It can also process a perf.data file that
+ * has the raw_syscalls events recorded.
+ */
+#include "builtin.h"
+#include "perf.h"
+
+#include "util/cache.h"
+#include "util/cpumap.h"
+#include "util/debug.h"
+#include "util/debugfs.h"
+#include "util/evlist.h"
+#include "util/evsel.h"
+#include "util/parse-options.h"
+#include "util/session.h"
+#include "util/thread.h"
+#include "util/thread_map.h"
+#include "util/tool.h"
+#include "util/trace-event.h"
+#include "util/util.h"
+
+#include "syscall-names.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+#define SYSCALL_MAX_ARGS	6
+
+struct syscall {
+	const char		*name;
+	/* syscalls:sys_enter_<name>, for the names and types of the args */
+	struct event_format	*tp_format;
+	bool			tp_format_read;
+	bool			hidden;
+
+	/* latency summary */
+	u64			nr_calls;
+	u64			nr_failed;
+	u64			total_ns;
+	u64			min_ns;
+	u64			max_ns;
+};
+
+/* the syscall a thread is in, until its sys_exit shows up */
+struct thread_trace {
+	u64			entry_time;
+	long			nr;
+	unsigned long		args[SYSCALL_MAX_ARGS];
+	bool			entry_pending;
+};
+
+struct trace {
+	struct perf_tool	tool;
+	struct perf_record_opts	opts;
+	struct machine		host;
+	/* formats of the syscalls:* events, and of raw_syscalls:* live */
+	struct pevent		*formats;
+	/* formats of the raw_syscalls:* events being processed */
+	struct pevent		*pevent;
+	struct syscall		*syscalls;
+	int			nr_syscalls;
+	const char		*input_name;
+	const char		*expr;
+	bool			not_ev_expr;
+	bool			summary_only;
+	bool			summary;
+	double			duration_filter;
+	u64			base_time;
+	u64			nr_events;
+};
+
+static volatile int done;
+
+static void sig_handler(int sig __used)
+{
+	done = 1;
+}
+
+static struct syscall *trace__syscall(struct trace *trace, long nr)
+{
+	struct syscall *table;
+	int i;
+
+	if (nr < 0 || nr > 4095)
+		return NULL;
+
+	if (nr >= trace->nr_syscalls) {
+		table = realloc(trace->syscalls, (nr + 1) * sizeof(*table));
+		if (table == NULL)
+			return NULL;
+		memset(table + trace->nr_syscalls, 0,
+		       (nr + 1 - trace->nr_syscalls) * sizeof(*table));
+		for (i = trace->nr_syscalls; i <= nr; i++)
+			table[i].min_ns = ULLONG_MAX;
+		trace->syscalls = table;
+		trace->nr_syscalls = nr + 1;
+	}
+
+	table = &trace->syscalls[nr];
+	if (table->name == NULL && nr < (long)ARRAY_SIZE(syscall_names))
+		table->name = syscall_names[nr];
+
+	return table;
+}
+
+static struct event_format *trace__read_format(struct trace *trace,
+					       const char *sys,
+					       const char *name)
+{
+	char path[PATH_MAX], *buf = NULL;
+	size_t size = 0, alloc = 0;
+	struct event_format *format = NULL;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s/%s/format",
+		 tracing_events_path, sys, name);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	do {
+		if (size == alloc) {
+			char *nbuf;
+
+			alloc += BUFSIZ;
+			nbuf = realloc(buf, alloc);
+			if (nbuf == NULL)
+				goto out;
+			buf = nbuf;
+		}
+		n = read(fd, buf + size, alloc - size);
+		if (n < 0)
+			goto out;
+		size += n;
+	} while (n > 0);
+
+	if (pevent_parse_event(trace->formats, buf, size, sys) == 0)
+		format = pevent_find_event_by_name(trace->formats, sys, name);
+out:
+	free(buf);
+	close(fd);
+	return format;
+}
+
+static struct thread_trace *thread__trace(struct thread *thread)
+{
+	if (thread->priv == NULL)
+		thread->priv = zalloc(sizeof(struct thread_trace));
+
+	return thread->priv;
+}
+
+static size_t syscall__fprintf_args(struct trace *trace, struct syscall *sc,
+				    unsigned long *args, FILE *fp)
+{
+	struct format_field *field;
+	size_t printed = 0;
+	int i = 0;
+
+	if (!sc->tp_format_read) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "sys_enter_%s", sc->name);
+		sc->tp_format = trace__read_format(trace, "syscalls", name);
+		sc->tp_format_read = true;
+	}
+
+	if (sc->tp_format == NULL) {
+		for (i = 0; i < SYSCALL_MAX_ARGS; i++)
+			printed += fprintf(fp, "%sarg%d: %#lx",
+					   i ? ", " : "", i, args[i]);
+		return printed;
+	}
+
+	/* the first field is the syscall number */
+	for (field = sc->tp_format->format.fields->next;
+	     field && i < SYSCALL_MAX_ARGS; field = field->next, i++) {
+		printed += fprintf(fp, "%s%s: ", i ? ", " : "", field->name);
+		if (strchr(field->type, '*') ||
+		    !strncmp(field->type, "unsigned", 8))
+			printed += fprintf(fp, "%#lx", args[i]);
+		else
+			printed += fprintf(fp, "%ld", (long)args[i]);
+	}
+
+	return printed;
+}
+
+static size_t trace__fprintf_entry_head(struct trace *trace,
+					struct thread *thread,
+					u64 duration, u64 tstamp, FILE *fp)
+{
+	size_t printed;
+
+	printed = fprintf(fp, "%10.3f ", (tstamp - trace->base_time) / 1e6);
+	if (duration)
+		printed += fprintf(fp, "(%6.3f ms): ", duration / 1e6);
+	else
+		printed += fprintf(fp, "(         ): ");
+
+	return printed + fprintf(fp, "%s/%d ", thread->comm, thread->pid);
+}
+
+static bool trace__filter_duration(struct trace *trace, u64 duration)
+{
+	return duration < trace->duration_filter * 1e6;
+}
+
+static struct event_format *trace__sample_format(struct trace *trace,
+						 struct perf_sample *sample)
+{
+	int type = trace_parse_common_type(trace->pevent, sample->raw_data);
+
+	return pevent_find_event(trace->pevent, type);
+}
+
+static int trace__sys_enter(struct trace *trace, struct event_format *format,
+			    struct thread *thread, struct perf_sample *sample)
+{
+	struct thread_trace *ttrace = thread__trace(thread);
+	struct format_field *field;
+	struct syscall *sc;
+	void *args;
+	long nr;
+	int i, size;
+
+	if (ttrace == NULL)
+		return -1;
+
+	nr = (long)raw_field_value(format, "id", sample->raw_data);
+	sc = trace__syscall(trace, nr);
+	if (sc == NULL || sc->hidden)
+		return 0;
+
+	/* exit, execve: no sys_exit comes for the previous one */
+	if (ttrace->entry_pending && !trace->summary_only &&
+	    !trace->duration_filter) {
+		struct syscall *prev = trace__syscall(trace, ttrace->nr);
+
+		trace__fprintf_entry_head(trace, thread, 0,
+					  ttrace->entry_time, stdout);
+		if (prev && prev->name)
+			printf("%s(", prev->name);
+		else
+			printf("syscall_%ld(", ttrace->nr);
+		if (prev)
+			syscall__fprintf_args(trace, prev, ttrace->args, stdout);
+		printf(") ...\n");
+	}
+
+	field = pevent_find_field(format, "args");
+	args = raw_field_ptr(format, "args", sample->raw_data);
+	if (field == NULL || args == NULL)
+		return -1;
+
+	size = field->size / SYSCALL_MAX_ARGS;
+	for (i = 0; i < SYSCALL_MAX_ARGS; i++) {
+		if (size == sizeof(u32))
+			ttrace->args[i] = ((u32 *)args)[i];
+		else
+			ttrace->args[i] = ((u64 *)args)[i];
+	}
+
+	ttrace->nr = nr;
+	ttrace->entry_time = sample->time;
+	ttrace->entry_pending = true;
+
+	return 0;
+}
+
+static int trace__sys_exit(struct trace *trace, struct event_format *format,
+			   struct thread *thread, struct perf_sample *sample)
+{
+	struct thread_trace *ttrace = thread__trace(thread);
+	struct syscall *sc;
+	u64 duration = 0;
+	long nr, ret;
+
+	if (ttrace == NULL)
+		return -1;
+
+	nr = (long)raw_field_value(format, "id", sample->raw_data);
+	ret = (long)raw_field_value(format, "ret", sample->raw_data);
+	sc = trace__syscall(trace, nr);
+	if (sc == NULL || sc->hidden)
+		return 0;
+
+	if (ttrace->entry_pending && ttrace->nr == nr) {
+		duration = sample->time - ttrace->entry_time;
+
+		sc->nr_calls++;
+		sc->total_ns += duration;
+		if (duration < sc->min_ns)
+			sc->min_ns = duration;
+		if (duration > sc->max_ns)
+			sc->max_ns = duration;
+		if (ret < 0 && ret > -4096)
+			sc->nr_failed++;
+	}
+
+	if (trace->summary_only || trace__filter_duration(trace, duration))
+		goto out;
+
+	trace__fprintf_entry_head(trace, thread, duration,
+				  duration ? ttrace->entry_time : sample->time,
+				  stdout);
+
+	if (!duration)
+		printf(" ... [continued]: ");
+	if (sc->name)
+		printf("%s(", sc->name);
+	else
+		printf("syscall_%ld(", nr);
+	if (duration)
+		syscall__fprintf_args(trace, sc, ttrace->args, stdout);
+
+	if (ret < 0 && ret > -4096)
+		printf(") = -1 %s\n", strerror(-ret));
+	else if (ret >= 0 && ret < 4096)
+		printf(") = %ld\n", ret);
+	else
+		printf(") = %#lx\n", ret);
+out:
+	ttrace->entry_pending = false;
+	return 0;
+}
+
+static int trace__process_sample(struct trace *trace, struct perf_sample *sample,
+				 struct machine *machine)
+{
+	struct event_format *format;
+	struct thread *thread;
+
+	if (sample->raw_data == NULL)
+		return 0;
+
+	format = trace__sample_format(trace, sample);
+	if (format == NULL)
+		return 0;
+
+	thread = machine__findnew_thread(machine, sample->tid);
+	if (thread == NULL)
+		return -1;
+
+	if (!trace->base_time)
+		trace->base_time = sample->time;
+	trace->nr_events++;
+
+	if (!strcmp(format->name, "sys_enter"))
+		return trace__sys_enter(trace, format, thread, sample);
+	if (!strcmp(format->name, "sys_exit"))
+		return trace__sys_exit(trace, format, thread, sample);
+
+	return 0;
+}
+
+static int syscall_cmp(const void *a, const void *b)
+{
+	const struct syscall *sa = *(const struct syscall **)a;
+	const struct syscall *sb = *(const struct syscall **)b;
+
+	if (sa->total_ns == sb->total_ns)
+		return 0;
+	return sa->total_ns > sb->total_ns ? -1 : 1;
+}
+
+static void trace__fprintf_summary(struct trace *trace, FILE *fp)
+{
+	struct syscall **sorted;
+	int i, nr = 0;
+
+	sorted = zalloc(trace->nr_syscalls * sizeof(*sorted) + 1);
+	if (sorted == NULL)
+		return;
+
+	for (i = 0; i < trace->nr_syscalls; i++)
+		if (trace->syscalls[i].nr_calls)
+			sorted[nr++] = &trace->syscalls[i];
+
+	qsort(sorted, nr, sizeof(*sorted), syscall_cmp);
+
+	fprintf(fp, "\n %-20s %8s %10s %9s %9s %9s %8s\n",
+		"syscall", "calls", "total", "min", "avg", "max", "errors");
+	fprintf(fp, " %-20s %8s %10s %9s %9s %9s %8s\n",
+		"", "", "(msec)", "(msec)", "(msec)", "(msec)", "");
+	fprintf(fp, " %-20s %8s %10s %9s %9s %9s %8s\n",
+		"--------------------", "--------", "----------",
+		"---------", "---------", "---------", "--------");
+
+	for (i = 0; i < nr; i++) {
+		struct syscall *sc = sorted[i];
+		char name[32];
+
+		if (sc->name == NULL) {
+			snprintf(name, sizeof(name), "syscall_%ld",
+				 (long)(sc - trace->syscalls));
+		}
+		fprintf(fp, " %-20s %8" PRIu64 " %10.3f %9.3f %9.3f %9.3f %8" PRIu64 "\n",
+			sc->name ?: name, sc->nr_calls, sc->total_ns / 1e6,
+			sc->min_ns / 1e6, sc->total_ns / 1e6 / sc->nr_calls,
+			sc->max_ns / 1e6, sc->nr_failed);
+	}
+
+	free(sorted);
+}
+
+/*
+ * Turn the -e list into an in-kernel filter on the syscall id, so that
+ * the other syscalls don't even make it to the ring buffer, and hide
+ * them from the summary.
+ */
+static char *trace__id_filter(struct trace *trace)
+{
+	char *filter = NULL, *list, *name, *tmp = NULL;
+	size_t len = 0;
+	long nr;
+	FILE *fp;
+	int n = 0;
+
+	list = strdup(trace->expr);
+	if (list == NULL)
+		return NULL;
+
+	fp = open_memstream(&filter, &len);
+	if (fp == NULL)
+		goto out;
+
+	for (nr = 0; nr < (long)ARRAY_SIZE(syscall_names); nr++) {
+		struct syscall *sc = trace__syscall(trace, nr);
+
+		if (sc != NULL)
+			sc->hidden = !trace->not_ev_expr;
+	}
+
+	for (name = strtok_r(list, ",", &tmp); name;
+	     name = strtok_r(NULL, ",", &tmp)) {
+		for (nr = 0; nr < (long)ARRAY_SIZE(syscall_names); nr++) {
+			if (syscall_names[nr] &&
+			    !strcmp(syscall_names[nr], name))
+				break;
+		}
+		if (nr == (long)ARRAY_SIZE(syscall_names) ||
+		    trace__syscall(trace, nr) == NULL) {
+			pr_err("Unknown syscall: %s\n", name);
+			fclose(fp);
+			free(filter);
+			filter = NULL;
+			goto out;
+		}
+		trace->syscalls[nr].hidden = trace->not_ev_expr;
+		fprintf(fp, "%sid %s %ld",
+			n++ ? (trace->not_ev_expr ? " && " : " || ") : "",
+			trace->not_ev_expr ? "!=" : "==", nr);
+	}
+	fclose(fp);
+out:
+	free(list);
+	return filter;
+}
+
+static int trace__set_filters(struct trace *trace, struct perf_evlist *evlist)
+{
+	struct perf_evsel *evsel;
+	char *ids = NULL, *filter;
+	int err;
+
+	if (trace->expr) {
+		ids = trace__id_filter(trace);
+		if (ids == NULL)
+			return -1;
+	}
+
+	/* don't trace ourselves writing the output */
+	if (ids)
+		err = asprintf(&filter, "common_pid != %d && (%s)",
+			       getpid(), ids);
+	else
+		err = asprintf(&filter, "common_pid != %d", getpid());
+	free(ids);
+	if (err < 0)
+		return -1;
+
+	list_for_each_entry(evsel, &evlist->entries, node)
+		evsel->filter = filter;
+
+	err = perf_evlist__set_filters(evlist);
+	if (err)
+		pr_err("Couldn't set the syscall filter: %s\n",
+		       strerror(errno));
+	return err;
+}
+
+static int trace__process_event(struct perf_tool *tool,
+				union perf_event *event,
+				struct perf_sample *sample,
+				struct machine *machine)
+{
+	switch (event->header.type) {
+	case PERF_RECORD_COMM:
+		return perf_event__process_comm(tool, event, sample, machine);
+	default:
+		return 0;
+	}
+}
+
+static int trace__run(struct trace *trace, int argc, const char **argv)
+{
+	const char *tracepoints[] = {
+		"raw_syscalls:sys_enter",
+		"raw_syscalls:sys_exit",
+	};
+	struct perf_evlist *evlist;
+	struct perf_evsel *evsel;
+	struct perf_sample sample;
+	union perf_event *event;
+	int err = -1, i;
+
+	if (trace__read_format(trace, "raw_syscalls", "sys_enter") == NULL ||
+	    trace__read_format(trace, "raw_syscalls", "sys_exit") == NULL) {
+		pr_err("Couldn't read the raw_syscalls tracepoints, "
+		       "is debugfs mounted?\n");
+		return -1;
+	}
+	trace->pevent = trace->formats;
+
+	evlist = perf_evlist__new(NULL, NULL);
+	if (evlist == NULL)
+		return -ENOMEM;
+
+	if (perf_evlist__add_tracepoints_array(evlist, tracepoints) < 0) {
+		pr_err("Couldn't add the raw_syscalls tracepoints\n");
+		goto out_delete;
+	}
+
+	if (perf_evlist__create_maps(evlist, &trace->opts.target) < 0) {
+		pr_err("Couldn't create the thread/cpu maps\n");
+		goto out_delete;
+	}
+
+	/* inherited counters can't be mmapped per task */
+	if (perf_target__has_task(&trace->opts.target))
+		trace->opts.no_inherit = true;
+
+	perf_evlist__config_attrs(evlist, &trace->opts);
+
+	signal(SIGCHLD, sig_handler);
+	signal(SIGINT, sig_handler);
+
+	if (argc) {
+		err = perf_evlist__prepare_workload(evlist, &trace->opts, argv);
+		if (err < 0) {
+			pr_err("Couldn't run the workload\n");
+			goto out_delete_maps;
+		}
+	}
+
+	err = perf_evlist__open(evlist, false);
+	if (err < 0) {
+		pr_err("Couldn't open the raw_syscalls events: %s\n",
+		       strerror(errno));
+		goto out_delete_maps;
+	}
+
+	err = trace__set_filters(trace, evlist);
+	if (err < 0)
+		goto out_close;
+
+	err = perf_evlist__mmap(evlist, trace->opts.mmap_pages, false);
+	if (err < 0) {
+		pr_err("Couldn't mmap the events: %s\n", strerror(errno));
+		goto out_close;
+	}
+
+	if (perf_target__has_task(&trace->opts.target))
+		perf_event__synthesize_thread_map(&trace->tool, evlist->threads,
+						  trace__process_event,
+						  &trace->host);
+	else if (!argc)
+		perf_event__synthesize_threads(&trace->tool,
+					       trace__process_event,
+					       &trace->host);
+
+	perf_evlist__enable(evlist);
+
+	if (argc)
+		perf_evlist__start_workload(evlist);
+
+	for (;;) {
+		u64 before = trace->nr_events;
+
+		for (i = 0; i < evlist->nr_mmaps; i++) {
+			while ((event = perf_evlist__mmap_read(evlist, i)) != NULL) {
+				if (event->header.type != PERF_RECORD_SAMPLE) {
+					trace__process_event(&trace->tool, event,
+							     NULL, &trace->host);
+					continue;
+				}
+
+				if (perf_evlist__parse_sample(evlist, event,
+							      &sample, false)) {
+					pr_err("Can't parse sample, skipping\n");
+					continue;
+				}
+
+				trace__process_sample(trace, &sample,
+						      &trace->host);
+			}
+		}
+
+		if (trace->nr_events == before) {
+			if (done)
+				break;
+			poll(evlist->pollfd, evlist->nr_fds, -1);
+		}
+
+		if (done)
+			perf_evlist__disable(evlist);
+	}
+
+	if (trace->summary)
+		trace__fprintf_summary(trace, stdout);
+
+	err = 0;
+	perf_evlist__munmap(evlist);
+out_close:
+	list_for_each_entry(evsel, &evlist->entries, node)
+		perf_evsel__close_fd(evsel, evlist->cpus->nr,
+				     evlist->threads->nr);
+out_delete_maps:
+	perf_evlist__delete_maps(evlist);
+out_delete:
+	perf_evlist__delete(evlist);
+	return err;
+}
+
+static int trace__process_sample_event(struct perf_tool *tool,
+				       union perf_event *event __used,
+				       struct perf_sample *sample,
+				       struct perf_evsel *evsel __used,
+				       struct machine *machine)
+{
+	struct trace *trace = container_of(tool, struct trace, tool);
+
+	return trace__process_sample(trace, sample, machine);
+}
+
+static int trace__replay(struct trace *trace)
+{
+	struct perf_session *session;
+	int err = -1;
+
+	trace->tool.sample	    = trace__process_sample_event;
+	trace->tool.comm	    = perf_event__process_comm;
+	trace->tool.ordered_samples = true;
+
+	session = perf_session__new(trace->input_name, O_RDONLY, 0, false,
+				    &trace->tool);
+	if (session == NULL)
+		return -ENOMEM;
+
+	if (!perf_session__has_traces(session, "perf trace -i"))
+		goto out;
+
+	trace->pevent = session->pevent;
+
+	if (trace->expr && trace__id_filter(trace) == NULL)
+		goto out;
+
+	setup_pager();
+
+	err = perf_session__process_events(session, &trace->tool);
+	if (err)
+		pr_err("Failed to process events, error %d\n", err);
+	else if (trace->summary)
+		trace__fprintf_summary(trace, stdout);
+out:
+	perf_session__delete(session);
+	return err;
+}
+
+static int trace__set_duration(const struct option *opt, const char *str,
+			       int unset __used)
+{
+	double *duration = (double *)opt->value;
+	char *end;
+
+	*duration = strtod(str, &end);
+	return *end || *duration < 0 ? -1 : 0;
+}
+
+static int trace__parse_events_option(const struct option *opt,
+				      const char *str, int unset __used)
+{
+	struct trace *trace = (struct trace *)opt->value;
+
+	if (*str == '!') {
+		trace->not_ev_expr = true;
+		str++;
+	}
+	trace->expr = str;
+	return 0;
+}
+
+static const char * const trace_usage[] = {
+	"perf trace [<options>] [<command>]",
+	"perf trace [<options>] -- <command> [<options>]",
+	NULL
+};
+
+int cmd_trace(int argc, const char **argv, const char *prefix __used)
+{
+	struct trace trace = {
+		.opts = {
+			.target = {
+				.uid	   = UINT_MAX,
+				.uses_mmap = true,
+			},
+			.user_freq     = UINT_MAX,
+			.user_interval = ULLONG_MAX,
+			.no_delay      = true,
+			.mmap_pages    = 1024,
+		},
+	};
+	const struct option trace_options[] = {
+	OPT_CALLBACK('e', "expr", &trace, "expr",
+		     "list of syscalls to trace, or not to trace with a leading !",
+		     trace__parse_events_option),
+	OPT_STRING('i', "input", &trace.input_name, "file",
+		   "analyze the syscall events of a perf.data file"),
+	OPT_STRING('p', "pid", &trace.opts.target.pid, "pid",
+		   "trace events on existing process id"),
+	OPT_STRING('t', "tid", &trace.opts.target.tid, "tid",
+		   "trace events on existing thread id"),
+	OPT_BOOLEAN('a', "all-cpus", &trace.opts.target.system_wide,
+		    "system-wide collection from all CPUs"),
+	OPT_STRING('C', "cpu", &trace.opts.target.cpu_list, "cpu",
+		   "list of cpus to monitor"),
+	OPT_STRING('u', "uid", &trace.opts.target.uid_str, "user",
+		   "user to trace"),
+	OPT_UINTEGER('m', "mmap-pages", &trace.opts.mmap_pages,
+		     "number of mmap data pages"),
+	OPT_BOOLEAN('s', "summary", &trace.summary_only,
+		    "show only the per-syscall latency summary"),
+	OPT_BOOLEAN('S', "with-summary", &trace.summary,
+		    "show the per-syscall latency summary at the end"),
+	OPT_CALLBACK(0, "duration", &trace.duration_filter, "float",
+		     "show only syscalls that take longer than this (ms)",
+		     trace__set_duration),
+	OPT_INCR('v', "verbose", &verbose, "be more verbose"),
+	OPT_END()
+	};
+	int err;
+	char bf[BUFSIZ];
+
+	argc = parse_options(argc, argv, trace_options, trace_usage, 0);
+
+	if (trace.summary_only)
+		trace.summary = true;
+
+	trace.formats = pevent_alloc();
+	if (trace.formats == NULL)
+		return -ENOMEM;
+
+	if (trace.input_name) {
+		err = trace__replay(&trace);
+		goto out;
+	}
+
+	if (!argc && perf_target__none(&trace.opts.target))
+		trace.opts.target.system_wide = true;
+
+	err = perf_target__validate(&trace.opts.target);
+	if (err) {
+		perf_target__strerror(&trace.opts.target, err, bf, sizeof(bf));
+		pr_err("%s", bf);
+		goto out;
+	}
+
+	err = perf_target__parse_uid(&trace.opts.target);
+	if (err) {
+		perf_target__strerror(&trace.opts.target, err, bf, sizeof(bf));
+		pr_err("%s", bf);
+		goto out;
+	}
+
+	machine__init(&trace.host, "", HOST_KERNEL_ID);
+
+	err = trace__run(&trace, argc, argv);
+out:
+	pevent_free(trace.formats);
+	free(trace.syscalls);
+	return err;
+}
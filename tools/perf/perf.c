@@ -319,6 +319,7 @@ static void handle_internal_command(int argc, const char **argv)
 		{ "kvm",	cmd_kvm,	0 },
 		{ "test",	cmd_test,	0 },
 		{ "inject",	cmd_inject,	0 },
+		{ "trace",	cmd_trace,	0 },
 	};
 	unsigned int i;
 	static const char ext[] = STRIP_EXTENSION;
@@ -13,6 +13,12 @@ void get_term_dimensions(struct winsize *ws);
 #ifndef __NR_perf_event_open
 # define __NR_perf_event_open 336
 #endif
+#ifndef __NR_futex
+# define __NR_futex 240
+#endif
+#ifndef __NR_mbind
+# define __NR_mbind 274
+#endif
 #endif
 
 #if defined(__x86_64__)
@@ -23,6 +29,12 @@ void get_term_dimensions(struct winsize *ws);
 #ifndef __NR_perf_event_open
 # define __NR_perf_event_open 298
 #endif
+#ifndef __NR_futex
+# define __NR_futex 202
+#endif
+#ifndef __NR_mbind
+# define __NR_mbind 237
+#endif
 #endif
 
 #ifdef __powerpc__
@@ -114,6 +126,7 @@ struct perf_mmap {
 	void			*base;
 	int			mask;
 	unsigned int		prev;
+	int			fd;
 };
 
 static inline unsigned int perf_mmap__read_head(struct perf_mmap *mm)
@@ -209,9 +222,17 @@ void pthread__unblock_sigwinch(void);
 
 #include "util/target.h"
 
+enum perf_call_graph_mode {
+	CALLCHAIN_NONE,
+	CALLCHAIN_FP,
+	CALLCHAIN_DWARF,
+	CALLCHAIN_LBR,
+	CALLCHAIN_MAX
+};
+
 struct perf_record_opts {
 	struct perf_target target;
-	bool	     call_graph;
+	int	     call_graph;
 	bool	     group;
 	bool	     inherit_stat;
 	bool	     no_delay;
@@ -224,12 +245,14 @@ struct perf_record_opts {
 	bool	     sample_id_all_missing;
 	bool	     exclude_guest_missing;
 	bool	     period;
+	bool	     overwrite;
 	unsigned int freq;
 	unsigned int mmap_pages;
 	unsigned int user_freq;
 	u64          branch_stack;
 	u64	     default_interval;
 	u64	     user_interval;
+	u32	     stack_dump_size;
 };
 
 #endif
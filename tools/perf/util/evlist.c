@@ -468,6 +468,7 @@ static int __perf_evlist__mmap(struct perf_evlist *evlist,
 {
 	evlist->mmap[idx].prev = 0;
 	evlist->mmap[idx].mask = mask;
+	evlist->mmap[idx].fd = fd;
 	evlist->mmap[idx].base = mmap(NULL, evlist->mmap_len, prot,
 				      MAP_SHARED, fd, 0);
 	if (evlist->mmap[idx].base == MAP_FAILED) {
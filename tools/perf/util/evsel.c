@@ -8,6 +8,7 @@
  */
 
 #include <byteswap.h>
+#include <linux/bitops.h>
 #include "asm/bug.h"
 #include "evsel.h"
 #include "evlist.h"
@@ -15,6 +16,7 @@
 #include "cpumap.h"
 #include "thread_map.h"
 #include "target.h"
+#include "perf_regs.h"
 #include "../../../include/linux/hw_breakpoint.h"
 
 #define FD(e, x, y) (*(int *)xyarray__entry(e->fd, x, y))
@@ -367,9 +369,21 @@ void perf_evsel__config(struct perf_evsel *evsel, struct perf_record_opts *opts,
 		attr->mmap_data = track;
 	}
 
-	if (opts->call_graph)
+	if (opts->call_graph) {
 		attr->sample_type	|= PERF_SAMPLE_CALLCHAIN;
 
+		if (opts->call_graph == CALLCHAIN_DWARF) {
+			attr->sample_type |= PERF_SAMPLE_REGS_USER |
+					     PERF_SAMPLE_STACK_USER;
+			attr->sample_regs_user = PERF_REGS_MASK;
+			attr->sample_stack_user = opts->stack_dump_size;
+		} else if (opts->call_graph == CALLCHAIN_LBR) {
+			attr->sample_type |= PERF_SAMPLE_BRANCH_STACK;
+			attr->branch_sample_type = PERF_SAMPLE_BRANCH_USER |
+						   PERF_SAMPLE_BRANCH_CALL_STACK;
+		}
+	}
+
 	if (perf_target__has_cpu(&opts->target))
 		attr->sample_type	|= PERF_SAMPLE_CPU;
 
@@ -391,6 +405,9 @@ void perf_evsel__config(struct perf_evsel *evsel, struct perf_record_opts *opts,
 		attr->watermark = 0;
 		attr->wakeup_events = 1;
 	}
+	if (opts->overwrite)
+		attr->write_backward = 1;
+
 	if (opts->branch_stack) {
 		attr->sample_type	|= PERF_SAMPLE_BRANCH_STACK;
 		attr->branch_sample_type = opts->branch_stack;
@@ -869,6 +886,43 @@ int perf_evsel__parse_sample(struct perf_evsel *evsel, union perf_event *event,
 		sz /= sizeof(u64);
 		array += sz;
 	}
+
+	if (type & PERF_SAMPLE_REGS_USER) {
+		if (sample_overlap(event, array, sizeof(u64)))
+			return -EFAULT;
+
+		/* First u64 tells us if we have any regs in sample. */
+		data->user_regs.abi = *array++;
+
+		if (data->user_regs.abi) {
+			u64 regs_user = evsel->attr.sample_regs_user;
+
+			data->user_regs.regs = (u64 *)array;
+			array += hweight_long(regs_user);
+		}
+	}
+
+	if (type & PERF_SAMPLE_STACK_USER) {
+		u64 size;
+
+		if (sample_overlap(event, array, sizeof(u64)))
+			return -EFAULT;
+
+		size = *array++;
+		data->user_stack.offset = ((char *)(array - 1)
+					  - (char *) event);
+
+		if (!size) {
+			data->user_stack.size = 0;
+		} else {
+			if (sample_overlap(event, array, size + sizeof(u64)))
+				return -EFAULT;
+
+			data->user_stack.data = (char *)array;
+			array += size / sizeof(*array);
+			data->user_stack.size = *array;
+		}
+	}
 	return 0;
 }
 
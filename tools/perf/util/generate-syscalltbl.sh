@@ -0,0 +1,16 @@
+#!/bin/sh
+#
+# Generate the syscall number to name table of perf trace from a kernel
+# syscall table: "<number> <abi> <name> [<entry point>]" per line. The
+# x32 entries of the x86_64 table use their own numbers and are skipped.
+
+echo "/* Automatically generated by util/generate-syscalltbl.sh */
+static const char *syscall_names[] = {"
+
+if test -n "$1"
+then
+	sed -e 's/#.*//' "$1" |
+	awk '$3 != "" && $2 != "x32" { printf "\t[%d] = \"%s\",\n", $1, $3 }'
+fi
+
+echo "};"
@@ -15,6 +15,8 @@
 #include "util.h"
 #include "cpumap.h"
 #include "event-parse.h"
+#include "perf_regs.h"
+#include "unwind.h"
 
 static int perf_session__open(struct perf_session *self, bool force)
 {
@@ -126,11 +128,12 @@ struct perf_session *perf_session__new(const char *filename, int mode,
 
 	memcpy(self->filename, filename, len);
 	/*
-	 * On 64bit we can mmap the data file in one go. No need for tiny mmap
-	 * slices. On 32bit we use 32MB.
+	 * The data file is mapped in windows that are dropped once no queued
+	 * event points into them anymore, so memory use does not grow with
+	 * the file size. 64bit can afford larger windows, on 32bit we use 32MB.
 	 */
 #if BITS_PER_LONG == 64
-	self->mmap_window = ULLONG_MAX;
+	self->mmap_window = 256 * 1024 * 1024ULL;
 #else
 	self->mmap_window = 32 * 1024 * 1024ULL;
 #endif
@@ -288,10 +291,10 @@ struct branch_info *machine__resolve_bstack(struct machine *self,
 	return bi;
 }
 
-int machine__resolve_callchain(struct machine *self,
-			       struct thread *thread,
-			       struct ip_callchain *chain,
-			       struct symbol **parent)
+static int machine__resolve_ips(struct machine *self,
+				struct thread *thread,
+				struct ip_callchain *chain,
+				struct symbol **parent)
 {
 	u8 cpumode = PERF_RECORD_MISC_USER;
 	unsigned int i;
@@ -354,6 +357,97 @@ int machine__resolve_callchain(struct machine *self,
 	return 0;
 }
 
+static int unwind_entry(u64 ip, void *arg)
+{
+	struct ip_callchain *chain = arg;
+
+	if (chain->nr >= PERF_MAX_STACK_DEPTH)
+		return -ENOSPC;
+
+	chain->ips[chain->nr++] = ip;
+	return 0;
+}
+
+static bool perf_evsel__has_dwarf_stack(struct perf_evsel *evsel,
+					struct perf_sample *sample)
+{
+	u64 mask = PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+
+	return (evsel->attr.sample_type & mask) == mask &&
+	       sample->user_regs.regs != NULL;
+}
+
+static bool perf_evsel__has_lbr_stack(struct perf_evsel *evsel,
+				      struct perf_sample *sample)
+{
+	return (evsel->attr.sample_type & PERF_SAMPLE_BRANCH_STACK) &&
+	       (evsel->attr.branch_sample_type &
+		PERF_SAMPLE_BRANCH_CALL_STACK) &&
+	       sample->branch_stack != NULL;
+}
+
+/*
+ * Resolve the callchain of a sample taken with --call-graph=dwarf or
+ * --call-graph=lbr: the kernel part still comes from the frame pointer
+ * chain the kernel recorded, while the user part, which is garbage for
+ * code built without frame pointers, is rebuilt either by unwinding the
+ * dumped user stack or from the LBR call stack.
+ */
+int machine__resolve_callchain(struct machine *self,
+			       struct perf_evsel *evsel,
+			       struct thread *thread,
+			       struct perf_sample *sample,
+			       struct symbol **parent)
+{
+	struct ip_callchain *chain = sample->callchain;
+	u64 buf[PERF_MAX_STACK_DEPTH + 1];
+	struct ip_callchain *full = (struct ip_callchain *)buf;
+	bool dwarf = perf_evsel__has_dwarf_stack(evsel, sample);
+	bool lbr = perf_evsel__has_lbr_stack(evsel, sample);
+	u64 i = 0, user_nr;
+
+	if (!dwarf && !lbr)
+		return machine__resolve_ips(self, thread, chain, parent);
+
+	if (chain && chain->nr > PERF_MAX_STACK_DEPTH) {
+		pr_warning("corrupted callchain. skipping...\n");
+		return 0;
+	}
+
+	full->nr = 0;
+	for (; chain && i < chain->nr; i++) {
+		if (chain->ips[i] == PERF_CONTEXT_USER)
+			break;
+		full->ips[full->nr++] = chain->ips[i];
+	}
+
+	if (full->nr >= PERF_MAX_STACK_DEPTH)
+		return machine__resolve_ips(self, thread, full, parent);
+
+	full->ips[full->nr++] = PERF_CONTEXT_USER;
+	user_nr = full->nr;
+
+	if (dwarf) {
+		unwind__get_entries(unwind_entry, full, self, thread,
+				    evsel->attr.sample_regs_user, sample);
+	} else {
+		struct branch_stack *bs = sample->branch_stack;
+		u64 j;
+
+		/* the interrupted user ip, then the call sites */
+		if (chain && i + 1 < chain->nr)
+			full->ips[full->nr++] = chain->ips[i + 1];
+
+		for (j = 0; j < bs->nr && full->nr < PERF_MAX_STACK_DEPTH; j++)
+			full->ips[full->nr++] = bs->entries[j].from;
+	}
+
+	if (full->nr == user_nr && chain)
+		return machine__resolve_ips(self, thread, chain, parent);
+
+	return machine__resolve_ips(self, thread, full, parent);
+}
+
 static int process_event_synth_tracing_data_stub(union perf_event *event __used,
 						 struct perf_session *session __used)
 {
@@ -579,6 +673,9 @@ void perf_event__attr_swap(struct perf_event_attr *attr)
 	attr->bp_type		= bswap_32(attr->bp_type);
 	attr->bp_addr		= bswap_64(attr->bp_addr);
 	attr->bp_len		= bswap_64(attr->bp_len);
+	attr->branch_sample_type = bswap_64(attr->branch_sample_type);
+	attr->sample_regs_user	= bswap_64(attr->sample_regs_user);
+	attr->sample_stack_user	= bswap_32(attr->sample_stack_user);
 
 	swap_bitfield((u8 *) (&attr->read_format + 1), sizeof(u64));
 }
@@ -626,16 +723,72 @@ static perf_event__swap_op perf_event__swap_ops[] = {
 	[PERF_RECORD_HEADER_MAX]	  = NULL,
 };
 
+/*
+ * A mapped slice of the data file. Queued samples point into it, so it
+ * stays mapped until the session has moved past it and the last of its
+ * samples has been flushed.
+ */
+struct mmap_window {
+	char			*buf;
+	size_t			size;
+	unsigned int		refcnt;
+};
+
+static struct mmap_window *mmap_window__new(int fd, u64 file_offset,
+					    size_t size, int prot, int flags)
+{
+	struct mmap_window *self = malloc(sizeof(*self));
+
+	if (self == NULL)
+		return NULL;
+
+	self->buf = mmap(NULL, size, prot, flags, fd, file_offset);
+	if (self->buf == MAP_FAILED) {
+		free(self);
+		return NULL;
+	}
+
+	/*
+	 * Start reading the whole window in while the events at its head
+	 * are being processed.
+	 */
+	madvise(self->buf, size, MADV_WILLNEED);
+	madvise(self->buf, size, MADV_SEQUENTIAL);
+
+	self->size = size;
+	self->refcnt = 1;
+	return self;
+}
+
+static void mmap_window__put(struct mmap_window *self)
+{
+	if (self && --self->refcnt == 0) {
+		munmap(self->buf, self->size);
+		free(self);
+	}
+}
+
 struct sample_queue {
 	u64			timestamp;
 	u64			file_offset;
 	union perf_event	*event;
+	struct mmap_window	*window;
 	struct list_head	list;
 };
 
 static void perf_session_free_sample_buffers(struct perf_session *session)
 {
 	struct ordered_samples *os = &session->ordered_samples;
+	struct sample_queue *iter;
+
+	/* samples left unflushed by an error still pin their windows */
+	list_for_each_entry(iter, &os->samples, list)
+		mmap_window__put(iter->window);
+	INIT_LIST_HEAD(&os->samples);
+	os->last_sample = NULL;
+
+	mmap_window__put(session->mmap_cur);
+	session->mmap_cur = NULL;
 
 	while (!list_empty(&os->to_free)) {
 		struct sample_queue *sq;
@@ -680,6 +833,7 @@ static void flush_sample_queue(struct perf_session *s,
 						   iter->file_offset);
 
 		os->last_flush = iter->timestamp;
+		mmap_window__put(iter->window);
 		list_del(&iter->list);
 		list_add(&iter->list, &os->sample_cache);
 		if (++idx >= progress_next) {
@@ -831,6 +985,9 @@ static int perf_session_queue_event(struct perf_session *s, union perf_event *ev
 	new->timestamp = timestamp;
 	new->file_offset = file_offset;
 	new->event = event;
+	new->window = s->mmap_cur;
+	if (new->window)
+		new->window->refcnt++;
 
 	__queue_event(new, s);
 
@@ -1285,9 +1442,10 @@ int __perf_session__process_events(struct perf_session *session,
 				   u64 file_size, struct perf_tool *tool)
 {
 	u64 head, page_offset, file_offset, file_pos, progress_next;
-	int err, mmap_prot, mmap_flags, map_idx = 0;
+	int err, mmap_prot, mmap_flags;
 	size_t	page_size, mmap_size;
-	char *buf, *mmaps[8];
+	struct mmap_window *window;
+	char *buf;
 	union perf_event *event;
 	uint32_t size;
 
@@ -1308,8 +1466,6 @@ int __perf_session__process_events(struct perf_session *session,
 	if (mmap_size > file_size)
 		mmap_size = file_size;
 
-	memset(mmaps, 0, sizeof(mmaps));
-
 	mmap_prot  = PROT_READ;
 	mmap_flags = MAP_SHARED;
 
@@ -1318,25 +1474,21 @@ int __perf_session__process_events(struct perf_session *session,
 		mmap_flags = MAP_PRIVATE;
 	}
 remap:
-	buf = mmap(NULL, mmap_size, mmap_prot, mmap_flags, session->fd,
-		   file_offset);
-	if (buf == MAP_FAILED) {
+	window = mmap_window__new(session->fd, file_offset, mmap_size,
+				  mmap_prot, mmap_flags);
+	if (window == NULL) {
 		pr_err("failed to mmap file\n");
 		err = -errno;
 		goto out_err;
 	}
-	mmaps[map_idx] = buf;
-	map_idx = (map_idx + 1) & (ARRAY_SIZE(mmaps) - 1);
+	mmap_window__put(session->mmap_cur);
+	session->mmap_cur = window;
+	buf = window->buf;
 	file_pos = file_offset + head;
 
 more:
 	event = fetch_mmaped_event(session, head, mmap_size, buf);
 	if (!event) {
-		if (mmaps[map_idx]) {
-			munmap(mmaps[map_idx], mmap_size);
-			mmaps[map_idx] = NULL;
-		}
-
 		page_offset = page_size * (head / page_size);
 		file_offset += page_offset;
 		head -= page_offset;
@@ -1498,7 +1650,8 @@ struct perf_evsel *perf_session__find_first_evtype(struct perf_session *session,
 	return NULL;
 }
 
-void perf_event__print_ip(union perf_event *event, struct perf_sample *sample,
+void perf_event__print_ip(union perf_event *event, struct perf_evsel *evsel,
+			  struct perf_sample *sample,
 			  struct machine *machine, int print_sym,
 			  int print_dso, int print_symoffset)
 {
@@ -1514,8 +1667,8 @@ void perf_event__print_ip(union perf_event *event, struct perf_sample *sample,
 
 	if (symbol_conf.use_callchain && sample->callchain) {
 
-		if (machine__resolve_callchain(machine, al.thread,
-						sample->callchain, NULL) != 0) {
+		if (machine__resolve_callchain(machine, evsel, al.thread,
+					       sample, NULL) != 0) {
 			if (verbose)
 				error("Failed to resolve callchain. Skipping\n");
 			return;
@@ -10,6 +10,7 @@
 #include "../../../include/linux/perf_event.h"
 
 struct sample_queue;
+struct mmap_window;
 struct ip_callchain;
 struct thread;
 
@@ -30,6 +31,7 @@ struct perf_session {
 	struct perf_header	header;
 	unsigned long		size;
 	unsigned long		mmap_window;
+	struct mmap_window	*mmap_cur;
 	struct machine		host_machine;
 	struct rb_root		machines;
 	struct perf_evlist	*evlist;
@@ -129,7 +131,8 @@ size_t perf_session__fprintf_nr_events(struct perf_session *session, FILE *fp);
 struct perf_evsel *perf_session__find_first_evtype(struct perf_session *session,
 					    unsigned int type);
 
-void perf_event__print_ip(union perf_event *event, struct perf_sample *sample,
+void perf_event__print_ip(union perf_event *event, struct perf_evsel *evsel,
+			  struct perf_sample *sample,
 			  struct machine *machine, int print_sym,
 			  int print_dso, int print_symoffset);
 
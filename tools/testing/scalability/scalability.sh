@@ -0,0 +1,283 @@
+#!/bin/bash
+#
+# NAME
+#	scalability.sh - measure how kernel workloads scale with the CPU count
+#
+# SYNOPSIS
+#	scalability.sh --help
+#	scalability.sh run [<options>]
+#	scalability.sh compare <old results.csv> <new results.csv>
+#
+# DESCRIPTION
+#	run: run each scalebench workload on 1, 2, 4, ... CPUs up to all of
+#	them, optionally under perf stat and with /proc/lock_stat cleared
+#	before and saved after every run, and write a results.csv with one
+#	line per workload and CPU count to the output directory.
+#
+#	compare: print the change in throughput of every workload and CPU
+#	count between the results.csv files of two kernels.
+#
+#	NOTE: run as root for the dio workload and for lock_stat.
+#
+
+usage()
+{
+	cat >&2 <<EOF
+Usage: $0 run [options]
+       $0 compare <old results.csv> <new results.csv>
+
+OPTIONS for run
+	-o dir
+		where to put results.csv and the raw perf and lock_stat
+		output. Default is ./scalability-\$(uname -r)
+
+	-w "workload ..."
+		the scalebench workloads to run. Default is all of them:
+		$ALL_WORKLOADS
+
+	-c "count ..."
+		the numbers of CPUs to run on. Default is 1, 2, 4, ... and
+		the number of CPUs the script may run on
+
+	-s seconds
+		how long each run takes. Default is 5
+
+	-f dir
+		directory for the create workloads. Default is /tmp
+
+	-D device
+		block device for dio. Default is /dev/ram0, loading brd for it
+		if needed. dio is skipped if there is no device
+
+	-W
+		let dio write to the device, destroying what is on it
+
+	-l
+		save /proc/lock_stat for every run (needs CONFIG_LOCK_STAT),
+		the most contended lock goes into results.csv
+
+	-p
+		count cycles, instructions, context switches, CPU migrations
+		and page faults system wide with perf stat for every run
+
+	-h, --help
+		Display a usage message and exit
+
+EOF
+	exit 1
+}
+
+ALL_WORKLOADS="create create-shared pagefault fork exec tcp pipe unix dio"
+PERF_EVENTS="cycles,instructions,context-switches,cpu-migrations,page-faults"
+CSV_HEADER="kernel,workload,cpus,seconds,ops,ops_per_sec,ops_per_sec_per_cpu,\
+efficiency,cycles,instructions,context_switches,cpu_migrations,page_faults,\
+top_lock,top_lock_contentions"
+
+BENCH="$(dirname "$0")/scalebench"
+
+# 1 2 4 ... and the number of CPUs we may run on
+default_cpu_counts()
+{
+	local nr=$(nproc)
+	local n=1
+
+	while [ $n -lt $nr ]; do
+		echo -n "$n "
+		n=$((n * 2))
+	done
+	echo $nr
+}
+
+# Find a device for dio, loading brd if need be
+setup_dio_device()
+{
+	if [ -n "$DEVICE" ]; then
+		return 0
+	fi
+	if [ ! -b /dev/ram0 ]; then
+		modprobe brd rd_nr=1 rd_size=262144 2>/dev/null
+		udevadm settle 2>/dev/null
+	fi
+	if [ -b /dev/ram0 ]; then
+		DEVICE=/dev/ram0
+		return 0
+	fi
+	return 1
+}
+
+# Print the name and contention count of the most contended lock class
+top_lock()
+{
+	awk 'match($0, /: +[0-9][0-9. ]*$/) {
+		name = substr($0, 1, RSTART - 1)
+		gsub(/^ +/, "", name)
+		gsub(/,/, ";", name)
+		split(substr($0, RSTART + 1), f, " ")
+		print name "," f[2]
+		found = 1
+		exit
+	}
+	END { if (!found) print "," }' "$1"
+}
+
+# Print the perf stat counts of $PERF_EVENTS, comma separated, in order
+perf_counts()
+{
+	awk -F, -v events="$PERF_EVENTS" '
+	{ count[$2] = $1 }
+	END {
+		n = split(events, e, ",")
+		for (i = 1; i <= n; i++)
+			printf "%s%s", (i > 1 ? "," : ""), count[e[i]]
+		printf "\n"
+	}' "$1"
+}
+
+run_one()
+{
+	local workload=$1 cpus=$2
+	local raw="$OUTDIR/$workload.$cpus"
+	local args="-t $cpus -s $SECONDS_PER_RUN"
+	local line perf locks
+
+	case $workload in
+	create*)
+		args="$args -f $CREATE_DIR"
+		;;
+	dio)
+		args="$args -D $DEVICE"
+		if [ -n "$DIO_WRITE" ]; then
+			args="$args -w"
+		fi
+		;;
+	esac
+
+	if [ -n "$LOCK_STAT" ]; then
+		echo 0 > /proc/lock_stat
+	fi
+
+	if [ -n "$PERF" ]; then
+		line=$(perf stat -a -x, -o "$raw.perf" -e $PERF_EVENTS -- \
+			"$BENCH" $args $workload) || return 1
+		perf=$(perf_counts "$raw.perf")
+	else
+		line=$("$BENCH" $args $workload) || return 1
+		perf=",,,,"
+	fi
+
+	if [ -n "$LOCK_STAT" ]; then
+		cat /proc/lock_stat > "$raw.lock_stat"
+		locks=$(top_lock "$raw.lock_stat")
+	else
+		locks=","
+	fi
+
+	# workload,workers,seconds,ops,ops_per_sec,ops_per_sec_per_worker
+	echo "$line" | awk -F, -v kernel="$KERNEL" -v perf="$perf" \
+		-v locks="$locks" -v base="$BASE" '{
+		eff = base > 0 ? sprintf("%.3f", $6 / base) : "1.000"
+		print kernel "," $1 "," $2 "," $3 "," $4 "," $5 "," $6 "," \
+			eff "," perf "," locks
+	}'
+}
+
+do_run()
+{
+	local workload cpus line
+
+	OUTDIR=""
+	WORKLOADS="$ALL_WORKLOADS"
+	CPU_COUNTS=$(default_cpu_counts)
+	SECONDS_PER_RUN=5
+	CREATE_DIR=/tmp
+	DEVICE=""
+	DIO_WRITE=""
+	LOCK_STAT=""
+	PERF=""
+	KERNEL=$(uname -r)
+
+	while getopts "o:w:c:s:f:D:Wlph" opt; do
+		case $opt in
+		o) OUTDIR=$OPTARG ;;
+		w) WORKLOADS=$OPTARG ;;
+		c) CPU_COUNTS=$OPTARG ;;
+		s) SECONDS_PER_RUN=$OPTARG ;;
+		f) CREATE_DIR=$OPTARG ;;
+		D) DEVICE=$OPTARG ;;
+		W) DIO_WRITE=1 ;;
+		l) LOCK_STAT=1 ;;
+		p) PERF=1 ;;
+		*) usage ;;
+		esac
+	done
+	OUTDIR=${OUTDIR:-./scalability-$KERNEL}
+
+	if [ ! -x "$BENCH" ]; then
+		echo "$BENCH not found, run make first" >&2
+		exit 1
+	fi
+	if [ -n "$LOCK_STAT" ] && [ ! -w /proc/lock_stat ]; then
+		echo "/proc/lock_stat is not there or not writable" >&2
+		exit 1
+	fi
+	if [ -n "$PERF" ] && ! command -v perf >/dev/null; then
+		echo "perf not found" >&2
+		exit 1
+	fi
+
+	mkdir -p "$OUTDIR" || exit 1
+	echo "$CSV_HEADER" > "$OUTDIR/results.csv"
+
+	for workload in $WORKLOADS; do
+		if [ $workload = dio ] && ! setup_dio_device; then
+			echo "dio: no device, skipped" >&2
+			continue
+		fi
+
+		# efficiency is relative to the per CPU rate of the first run
+		BASE=0
+		for cpus in $CPU_COUNTS; do
+			line=$(run_one $workload $cpus)
+			if [ -z "$line" ]; then
+				echo "$workload on $cpus CPUs failed" >&2
+				continue
+			fi
+			echo "$line" >> "$OUTDIR/results.csv"
+			echo "$line"
+			if [ $BASE = 0 ]; then
+				BASE=$(echo "$line" | cut -d, -f7)
+			fi
+		done
+	done
+}
+
+do_compare()
+{
+	if [ $# -ne 2 ] || [ ! -r "$1" ] || [ ! -r "$2" ]; then
+		usage
+	fi
+
+	echo "workload,cpus,old_ops_per_sec,new_ops_per_sec,change_percent"
+	awk -F, '
+	FNR == 1 { next }
+	NR == FNR { old[$2 "," $3] = $6; next }
+	($2 "," $3) in old {
+		o = old[$2 "," $3]
+		change = o > 0 ? ($6 - o) * 100 / o : 0
+		printf "%s,%s,%s,%s,%+.1f\n", $2, $3, o, $6, change
+	}' "$1" "$2"
+}
+
+case "$1" in
+run)
+	shift
+	do_run "$@"
+	;;
+compare)
+	shift
+	do_compare "$@"
+	;;
+*)
+	usage
+	;;
+esac
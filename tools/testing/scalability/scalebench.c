@@ -0,0 +1,505 @@
+/*
+ * scalebench.c - run one kernel workload on a number of CPUs at once
+ *
+ * Starts one worker process per CPU, each bound to its own CPU, runs the
+ * given workload in all of them for a fixed time and prints how many
+ * operations were done as a line of comma separated values:
+ *
+ *	workload,workers,seconds,ops,ops_per_sec,ops_per_sec_per_worker
+ *
+ * The workers only touch what they own (their own directory, mapping,
+ * listening socket, pipe, ...), so any loss of per worker throughput as
+ * workers are added is down to sharing inside the kernel.
+ *
+ * scalability.sh runs this at increasing worker counts.
+ *
+ * Licensed under the terms of the GNU GPL License version 2
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CACHELINE	64
+#define MAX_WORKERS	4096
+
+#define PAGEFAULT_SIZE	(16UL << 20)
+
+struct worker_stat {
+	volatile uint64_t ops;
+	volatile int ready;
+	char pad[CACHELINE - sizeof(uint64_t) - sizeof(int)];
+} __attribute__((aligned(CACHELINE)));
+
+struct shared {
+	volatile int go;
+	volatile int stop;
+	char pad[CACHELINE - 2 * sizeof(int)];
+	struct worker_stat stat[MAX_WORKERS];
+};
+
+static struct shared *shared;
+
+static int nr_workers = 1;
+static int duration = 5;
+static const char *dir = "/tmp";
+static const char *device;
+static size_t block_size = 4096;
+static int dio_write;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+"Usage: scalebench [options] <workload>\n"
+"\n"
+"Workloads:\n"
+"	create		create and unlink files, each worker in its own directory\n"
+"	create-shared	create and unlink files, all workers in one directory\n"
+"	pagefault	fault in and unmap anonymous memory, ops are pages\n"
+"	fork		fork a child which exits at once and reap it\n"
+"	exec		fork a child which execs /proc/self/exe and reap it\n"
+"	tcp		connect to and accept from a listener on the loopback\n"
+"	pipe		ping-pong a byte with a child over a pair of pipes\n"
+"	unix		ping-pong a byte with a child over a unix socketpair\n"
+"	dio		O_DIRECT random reads (writes with -w) of -b bytes on -D\n"
+"\n"
+"Options:\n"
+"	-t workers	number of worker processes, one per CPU (default 1)\n"
+"	-s seconds	how long to run (default 5)\n"
+"	-f dir		directory for the create workloads (default /tmp)\n"
+"	-D device	block device or file for dio\n"
+"	-b bytes	I/O size for dio (default 4096)\n"
+"	-w		dio writes instead of reads, this destroys the data\n"
+"	-h		this help\n");
+	exit(2);
+}
+
+/*
+ * The CPU worker @nr is bound to: the nr-th CPU the benchmark is allowed
+ * to run on, so that taskset or cpusets restrict which CPUs get used.
+ */
+static void bind_worker(int nr)
+{
+	cpu_set_t allowed, set;
+	int cpu, n;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		die("sched_getaffinity");
+
+	n = nr % CPU_COUNT(&allowed);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &allowed) && !n--)
+			break;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		die("sched_setaffinity");
+}
+
+static inline int running(void)
+{
+	return !shared->stop;
+}
+
+static void do_create(int nr, int shared_dir)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	char path[PATH_MAX], name[PATH_MAX + 32];
+	unsigned long i = 0;
+	int fd;
+
+	if (shared_dir) {
+		snprintf(path, sizeof(path), "%s/scalebench.%d", dir,
+			 (int)getppid());
+	} else {
+		snprintf(path, sizeof(path), "%s/scalebench.%d.%d", dir,
+			 (int)getppid(), nr);
+	}
+	if (mkdir(path, 0755) && errno != EEXIST)
+		die("mkdir");
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		snprintf(name, sizeof(name), "%s/%d.%lu", path, nr, i++);
+		fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0)
+			die("open");
+		close(fd);
+		if (unlink(name))
+			die("unlink");
+		st->ops++;
+	}
+
+	rmdir(path);
+}
+
+static void do_pagefault(int nr)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long off;
+	char *p;
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		p = mmap(NULL, PAGEFAULT_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap");
+		for (off = 0; off < PAGEFAULT_SIZE && running();
+		     off += page_size) {
+			p[off] = 1;
+			st->ops++;
+		}
+		munmap(p, PAGEFAULT_SIZE);
+	}
+}
+
+static void do_fork(int nr, int exec)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	pid_t pid;
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			if (exec)
+				execl("/proc/self/exe", "scalebench",
+				      "--exec-child", (char *)NULL);
+			_exit(0);
+		}
+		if (waitpid(pid, NULL, 0) < 0)
+			die("waitpid");
+		st->ops++;
+	}
+}
+
+static void do_tcp(int nr)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	struct sockaddr_in addr;
+	struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+	socklen_t len = sizeof(addr);
+	int lfd, cfd, afd;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		die("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(lfd, (struct sockaddr *)&addr, &len) ||
+	    listen(lfd, 128))
+		die("listen");
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		cfd = socket(AF_INET, SOCK_STREAM, 0);
+		if (cfd < 0)
+			die("socket");
+		if (connect(cfd, (struct sockaddr *)&addr, sizeof(addr)))
+			die("connect");
+		afd = accept(lfd, NULL, NULL);
+		if (afd < 0)
+			die("accept");
+		/* don't leave a TIME_WAIT socket behind for every round */
+		setsockopt(cfd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+		close(afd);
+		close(cfd);
+		st->ops++;
+	}
+	close(lfd);
+}
+
+/*
+ * Ping-pong a byte between the worker and a child, which inherits the
+ * worker's CPU, over @rfd/@wfd in the worker and @crfd/@cwfd in the child.
+ */
+static void ping_pong(int nr, int rfd, int wfd, int crfd, int cwfd)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	char c = 0;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		close(rfd);
+		close(wfd);
+		while (read(crfd, &c, 1) == 1)
+			if (write(cwfd, &c, 1) != 1)
+				break;
+		_exit(0);
+	}
+	close(crfd);
+	close(cwfd);
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		if (write(wfd, &c, 1) != 1 || read(rfd, &c, 1) != 1)
+			die("ping-pong");
+		st->ops++;
+	}
+	close(wfd);
+	close(rfd);
+	waitpid(pid, NULL, 0);
+}
+
+static void do_pipe(int nr)
+{
+	int to_child[2], to_parent[2];
+
+	if (pipe(to_child) || pipe(to_parent))
+		die("pipe");
+	ping_pong(nr, to_parent[0], to_child[1], to_child[0], to_parent[1]);
+}
+
+static void do_unix(int nr)
+{
+	int sv[2], sv2[2];
+
+	/* a pair each way, so that ping_pong() can close its ends freely */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, sv2))
+		die("socketpair");
+	ping_pong(nr, sv2[0], sv[0], sv[1], sv2[1]);
+}
+
+static void do_dio(int nr)
+{
+	struct worker_stat *st = &shared->stat[nr];
+	unsigned long nr_blocks, seed = nr * 2654435761UL + getpid();
+	off_t size;
+	void *buf;
+	int fd;
+
+	if (!device) {
+		fprintf(stderr, "dio needs a device, see -D\n");
+		exit(2);
+	}
+	fd = open(device, (dio_write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		die(device);
+	size = lseek(fd, 0, SEEK_END);
+	if (size < (off_t)block_size) {
+		fprintf(stderr, "%s: too small\n", device);
+		exit(1);
+	}
+	nr_blocks = size / block_size;
+	if (posix_memalign(&buf, 4096, block_size))
+		die("posix_memalign");
+	memset(buf, nr, block_size);
+
+	st->ready = 1;
+	while (!shared->go)
+		;
+
+	while (running()) {
+		off_t off;
+		ssize_t ret;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		off = (off_t)((seed >> 16) % nr_blocks) * block_size;
+		if (dio_write)
+			ret = pwrite(fd, buf, block_size, off);
+		else
+			ret = pread(fd, buf, block_size, off);
+		if (ret != (ssize_t)block_size)
+			die("dio");
+		st->ops++;
+	}
+	free(buf);
+	close(fd);
+}
+
+static void run_worker(int nr, const char *workload)
+{
+	bind_worker(nr);
+
+	if (!strcmp(workload, "create"))
+		do_create(nr, 0);
+	else if (!strcmp(workload, "create-shared"))
+		do_create(nr, 1);
+	else if (!strcmp(workload, "pagefault"))
+		do_pagefault(nr);
+	else if (!strcmp(workload, "fork"))
+		do_fork(nr, 0);
+	else if (!strcmp(workload, "exec"))
+		do_fork(nr, 1);
+	else if (!strcmp(workload, "tcp"))
+		do_tcp(nr);
+	else if (!strcmp(workload, "pipe"))
+		do_pipe(nr);
+	else if (!strcmp(workload, "unix"))
+		do_unix(nr);
+	else if (!strcmp(workload, "dio"))
+		do_dio(nr);
+	exit(0);
+}
+
+static int valid_workload(const char *workload)
+{
+	static const char * const workloads[] = {
+		"create", "create-shared", "pagefault", "fork", "exec",
+		"tcp", "pipe", "unix", "dio", NULL
+	};
+	int i;
+
+	for (i = 0; workloads[i]; i++)
+		if (!strcmp(workload, workloads[i]))
+			return 1;
+	return 0;
+}
+
+static uint64_t total_ops(void)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < nr_workers; i++)
+		sum += shared->stat[i].ops;
+	return sum;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	const char *workload;
+	uint64_t start_ops, ops;
+	double start, elapsed;
+	pid_t pids[MAX_WORKERS];
+	int i, c, status, ret = 0;
+
+	/* what the exec workload execs */
+	if (argc == 2 && !strcmp(argv[1], "--exec-child"))
+		return 0;
+
+	while ((c = getopt(argc, argv, "t:s:f:D:b:wh")) != -1) {
+		switch (c) {
+		case 't':
+			nr_workers = atoi(optarg);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'f':
+			dir = optarg;
+			break;
+		case 'D':
+			device = optarg;
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			dio_write = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !valid_workload(argv[optind]))
+		usage();
+	workload = argv[optind];
+
+	if (nr_workers < 1 || nr_workers > MAX_WORKERS || duration < 1 ||
+	    !block_size || block_size % 512)
+		usage();
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+		die("mmap");
+
+	for (i = 0; i < nr_workers; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (!pids[i])
+			run_worker(i, workload);
+	}
+
+	for (i = 0; i < nr_workers; i++)
+		while (!shared->stat[i].ready)
+			usleep(1000);
+
+	/* let things settle for a moment before counting */
+	shared->go = 1;
+	usleep(100000);
+	start_ops = total_ops();
+	start = now();
+
+	sleep(duration);
+
+	ops = total_ops() - start_ops;
+	elapsed = now() - start;
+	shared->stop = 1;
+
+	for (i = 0; i < nr_workers; i++) {
+		if (waitpid(pids[i], &status, 0) < 0)
+			die("waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+	if (ret) {
+		fprintf(stderr, "%s: a worker failed\n", workload);
+		return ret;
+	}
+
+	printf("%s,%d,%.3f,%llu,%.0f,%.0f\n", workload, nr_workers, elapsed,
+	       (unsigned long long)ops, ops / elapsed,
+	       ops / elapsed / nr_workers);
+	return 0;
+}
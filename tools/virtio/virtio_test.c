@@ -23,6 +23,8 @@ struct vq_info {
 	void *ring;
 	/* copy used for control */
 	struct vring vring;
+	struct vring_packed vring_packed;
+	bool packed;
 	struct virtqueue *vq;
 };
 
@@ -63,12 +65,18 @@ void vhost_vq_setup(struct vdev_info *dev, struct vq_info *info)
 		.used_user_addr = (uint64_t)(unsigned long)info->vring.used,
 	};
 	int r;
+	if (info->packed) {
+		addr.desc_user_addr = (unsigned long)info->vring_packed.desc;
+		addr.avail_user_addr = (unsigned long)info->vring_packed.driver;
+		addr.used_user_addr = (unsigned long)info->vring_packed.device;
+	}
 	r = ioctl(dev->control, VHOST_SET_FEATURES, &features);
 	assert(r >= 0);
 	state.num = info->vring.num;
 	r = ioctl(dev->control, VHOST_SET_VRING_NUM, &state);
 	assert(r >= 0);
-	state.num = 0;
+	/* A packed ring starts out with the wrap counter set. */
+	state.num = info->packed ? 1 << 15 : 0;
 	r = ioctl(dev->control, VHOST_SET_VRING_BASE, &state);
 	assert(r >= 0);
 	r = ioctl(dev->control, VHOST_SET_VRING_ADDR, &addr);
@@ -92,7 +100,11 @@ static void vq_info_add(struct vdev_info *dev, int num)
 	assert(r >= 0);
 	memset(info->ring, 0, vring_size(num, 4096));
 	vring_init(&info->vring, num, info->ring, 4096);
-	info->vq = vring_new_virtqueue(info->vring.num, 4096, &dev->vdev,
+	info->packed = dev->vdev.features[0] & (1ULL << VIRTIO_RING_F_PACKED);
+	if (info->packed)
+		vring_packed_init(&info->vring_packed, num, info->ring, 4096);
+	info->vq = vring_new_virtqueue(info->idx,
+				       info->vring.num, 4096, &dev->vdev,
 				       true, info->ring,
 				       vq_notify, vq_callback, "test");
 	assert(info->vq);
@@ -228,6 +240,10 @@ const struct option longopts[] = {
 		.name = "no-delayed-interrupt",
 		.val = 'd',
 	},
+	{
+		.name = "packed",
+		.val = 'P',
+	},
 	{
 	}
 };
@@ -238,6 +254,7 @@ static void help()
 		" [--no-indirect]"
 		" [--no-event-idx]"
 		" [--delayed-interrupt]"
+		" [--packed]"
 		"\n");
 }
 
@@ -269,6 +286,9 @@ int main(int argc, char **argv)
 		case 'D':
 			delayed = true;
 			break;
+		case 'P':
+			features |= 1ULL << VIRTIO_RING_F_PACKED;
+			break;
 		default:
 			assert(0);
 			break;
@@ -43,6 +43,7 @@ struct slabinfo {
 	unsigned long cmpxchg_double_cpu_fail, cmpxchg_double_fail;
 	unsigned long alloc_node_mismatch, deactivate_bypass;
 	unsigned long cpu_partial_alloc, cpu_partial_free;
+	unsigned long alloc_fast_hits, alloc_slow_entries, list_lock_contended;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -79,6 +80,7 @@ int sort_active = 0;
 int set_debug = 0;
 int show_ops = 0;
 int show_activity = 0;
+int show_latency = 0;
 
 /* Debug options */
 int sanity = 0;
@@ -114,6 +116,7 @@ static void usage(void)
 		"-h|--help              Show usage information\n"
 		"-i|--inverted          Inverted list\n"
 		"-l|--slabs             Show slabs\n"
+		"-L|--latency           Show allocation path statistics\n"
 		"-n|--numa              Show NUMA information\n"
 		"-o|--ops		Show kmem_cache_ops\n"
 		"-s|--shrink            Shrink slabs\n"
@@ -396,6 +399,62 @@ static void show_tracking(struct slabinfo *s)
 
 }
 
+/*
+ * Lower bound in ns of the bucket of alloc_slow_latency that holds the
+ * given percentile of the slowpath allocations.
+ */
+static unsigned long latency_percentile(unsigned long *lat,
+		unsigned long *count, int n, unsigned long total, int pct)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sum += count[i];
+		if (sum * 100 >= total * pct)
+			return lat[i];
+	}
+	return n ? lat[n - 1] : 0;
+}
+
+static void slab_latency(struct slabinfo *s)
+{
+	unsigned long lat[32], count[32];
+	unsigned long total = 0;
+	unsigned long allocs;
+	char *p;
+	int n = 0;
+
+	if (strcmp(s->name, "*") == 0)
+		return;
+
+	allocs = s->alloc_fast_hits + s->alloc_slow_entries;
+	if (skip_zero && !allocs)
+		return;
+
+	if (read_slab_obj(s, "alloc_slow_latency")) {
+		p = buffer;
+		while (n < 32 && sscanf(p, "%lu %lu", &lat[n], &count[n]) == 2) {
+			total += count[n++];
+			p = strchr(p, '\n');
+			if (!p)
+				break;
+			p++;
+		}
+	}
+
+	if (!line++)
+		printf("Name                      Fast       Slow %%Fast   Contended"
+			"   p50ns   p99ns\n");
+
+	printf("%-21s %10lu %10lu %5lu %11lu %7lu %7lu\n",
+		s->name, s->alloc_fast_hits, s->alloc_slow_entries,
+		allocs ? s->alloc_fast_hits * 100 / allocs : 0,
+		s->list_lock_contended,
+		total ? latency_percentile(lat, count, n, total, 50) : 0,
+		total ? latency_percentile(lat, count, n, total, 99) : 0);
+}
+
 static void ops(struct slabinfo *s)
 {
 	if (strcmp(s->name, "*") == 0)
@@ -1219,6 +1278,9 @@ static void read_slab_dir(void)
 			slab->cpu_partial_free = get_obj("cpu_partial_free");
 			slab->alloc_node_mismatch = get_obj("alloc_node_mismatch");
 			slab->deactivate_bypass = get_obj("deactivate_bypass");
+			slab->alloc_fast_hits = get_obj("alloc_fast_hits");
+			slab->alloc_slow_entries = get_obj("alloc_slow_entries");
+			slab->list_lock_contended = get_obj("list_lock_contended");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;
@@ -1260,6 +1322,8 @@ static void output_slabs(void)
 			slab_debug(slab);
 		else if (show_ops)
 			ops(slab);
+		else if (show_latency)
+			slab_latency(slab);
 		else if (show_slab)
 			slabcache(slab);
 		else if (show_report)
@@ -1281,6 +1345,7 @@ struct option opts[] = {
 	{ "report", 0, NULL, 'r' },
 	{ "shrink", 0, NULL, 's' },
 	{ "slabs", 0, NULL, 'l' },
+	{ "latency", 0, NULL, 'L' },
 	{ "track", 0, NULL, 't'},
 	{ "validate", 0, NULL, 'v' },
 	{ "zero", 0, NULL, 'z' },
@@ -1296,7 +1361,7 @@ int main(int argc, char *argv[])
 
 	page_size = getpagesize();
 
-	while ((c = getopt_long(argc, argv, "aAd::Defhil1noprstvzTS",
+	while ((c = getopt_long(argc, argv, "aAd::Defhil1LnoprstvzTS",
 						opts, NULL)) != -1)
 		switch (c) {
 		case '1':
@@ -1343,6 +1408,9 @@ int main(int argc, char *argv[])
 		case 'l':
 			show_slab = 1;
 			break;
+		case 'L':
+			show_latency = 1;
+			break;
 		case 't':
 			show_track = 1;
 			break;
@@ -1365,7 +1433,8 @@ int main(int argc, char *argv[])
 	}
 
 	if (!show_slab && !show_alias && !show_track && !show_report
-		&& !validate && !shrink && !set_debug && !show_ops)
+		&& !validate && !shrink && !set_debug && !show_ops
+		&& !show_latency)
 			show_slab = 1;
 
 	if (argc > optind)
@@ -28,6 +28,15 @@
 #include "async_pf.h"
 #include <trace/events/kvm.h>
 
+/*
+ * Guest memory that was swapped out tends to be needed again in runs, so
+ * once the faulting page is in, the pages around it in the same aligned
+ * window of the memslot are faulted in as well.  A later access to one of
+ * them then finds it present instead of starting another async fault and
+ * another serial swap-in.
+ */
+#define ASYNC_PF_PREFETCH_PAGES	16
+
 static struct kmem_cache *async_pf_cache;
 
 int kvm_async_pf_init(void)
@@ -62,6 +71,8 @@ static void async_pf_execute(struct work_struct *work)
 	struct mm_struct *mm = apf->mm;
 	struct kvm_vcpu *vcpu = apf->vcpu;
 	unsigned long addr = apf->addr;
+	unsigned long start = apf->prefetch_start;
+	unsigned long nr = apf->prefetch_nr;
 	gva_t gva = apf->gva;
 
 	might_sleep();
@@ -70,7 +81,6 @@ static void async_pf_execute(struct work_struct *work)
 	down_read(&mm->mmap_sem);
 	get_user_pages(current, mm, addr, 1, 1, 0, &page, NULL);
 	up_read(&mm->mmap_sem);
-	unuse_mm(mm);
 
 	spin_lock(&vcpu->async_pf.lock);
 	list_add_tail(&apf->link, &vcpu->async_pf.done);
@@ -88,6 +98,26 @@ static void async_pf_execute(struct work_struct *work)
 	if (waitqueue_active(&vcpu->wq))
 		wake_up_interruptible(&vcpu->wq);
 
+	/*
+	 * The vcpu can go on now; bring in the rest of the window behind it
+	 * with one call for each side of the faulting page.  Only read
+	 * faults, so nothing is dirtied or unshared that the guest has not
+	 * written to.
+	 */
+	if (nr > 1) {
+		down_read(&mm->mmap_sem);
+		if (addr > start)
+			get_user_pages(current, mm, start,
+				       (addr - start) >> PAGE_SHIFT,
+				       0, 0, NULL, NULL);
+		if (start + (nr << PAGE_SHIFT) > addr + PAGE_SIZE)
+			get_user_pages(current, mm, addr + PAGE_SIZE,
+				       nr - ((addr - start) >> PAGE_SHIFT) - 1,
+				       0, 0, NULL, NULL);
+		up_read(&mm->mmap_sem);
+	}
+	unuse_mm(mm);
+
 	mmdrop(mm);
 	kvm_put_kvm(vcpu->kvm);
 }
@@ -147,7 +177,9 @@ void kvm_check_async_pf_completion(struct kvm_vcpu *vcpu)
 int kvm_setup_async_pf(struct kvm_vcpu *vcpu, gva_t gva, gfn_t gfn,
 		       struct kvm_arch_async_pf *arch)
 {
+	struct kvm_memory_slot *slot;
 	struct kvm_async_pf *work;
+	gfn_t first, last;
 
 	if (vcpu->async_pf.queued >= ASYNC_PF_PER_VCPU)
 		return 0;
@@ -168,6 +200,18 @@ int kvm_setup_async_pf(struct kvm_vcpu *vcpu, gva_t gva, gfn_t gfn,
 	work->gva = gva;
 	work->addr = gfn_to_hva(vcpu->kvm, gfn);
 	work->arch = *arch;
+
+	/* the prefetch window must not leave the memslot */
+	slot = gfn_to_memslot(vcpu->kvm, gfn);
+	if (slot) {
+		first = max(gfn & ~(gfn_t)(ASYNC_PF_PREFETCH_PAGES - 1),
+			    slot->base_gfn);
+		last = min(gfn | (ASYNC_PF_PREFETCH_PAGES - 1),
+			   slot->base_gfn + slot->npages - 1);
+		work->prefetch_start = gfn_to_hva_memslot(slot, first);
+		work->prefetch_nr = last - first + 1;
+	}
+
 	work->mm = current->mm;
 	atomic_inc(&work->mm->mm_count);
 	kvm_get_kvm(work->vcpu->kvm);
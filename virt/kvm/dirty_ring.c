@@ -0,0 +1,184 @@
+/*
+ * kvm per-vcpu dirty ring
+ *
+ * Instead of a bitmap per memslot that userspace has to scan and that
+ * KVM has to write-protect as a whole, each vcpu appends the pages it
+ * dirties to a ring shared with userspace.  Userspace collects the
+ * entries, flags them with KVM_DIRTY_GFN_F_RESET and calls
+ * KVM_RESET_DIRTY_RINGS, which re-arms dirty tracking for exactly the
+ * pages that were collected.  The cost of a round is then proportional
+ * to the number of pages written rather than to the size of the guest.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+
+#include <linux/kvm_host.h>
+#include <linux/kvm.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+
+#include "dirty_ring.h"
+
+static u32 kvm_dirty_ring_used(struct kvm_dirty_ring *ring)
+{
+	return ACCESS_ONCE(ring->dirty_index) - ACCESS_ONCE(ring->reset_index);
+}
+
+static bool kvm_dirty_ring_soft_full(struct kvm_dirty_ring *ring)
+{
+	return kvm_dirty_ring_used(ring) >= ring->soft_limit;
+}
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size)
+{
+	ring->dirty_gfns = vmalloc_user(size);
+	if (!ring->dirty_gfns)
+		return -ENOMEM;
+
+	ring->size = size / sizeof(struct kvm_dirty_gfn);
+	ring->soft_limit = ring->size - KVM_DIRTY_RING_RSVD_ENTRIES;
+	ring->dirty_index = 0;
+	ring->reset_index = 0;
+	return 0;
+}
+
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring)
+{
+	vfree(ring->dirty_gfns);
+	ring->dirty_gfns = NULL;
+}
+
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+				     unsigned long pgoff)
+{
+	if (pgoff >= ring->size * sizeof(struct kvm_dirty_gfn) / PAGE_SIZE)
+		return NULL;
+
+	return vmalloc_to_page((void *)ring->dirty_gfns + pgoff * PAGE_SIZE);
+}
+
+/*
+ * Called by the vcpu that owns the ring.  Returns false if the ring is
+ * completely full; the caller must then log the page some other way.
+ */
+bool kvm_dirty_ring_push(struct kvm_vcpu *vcpu, u32 slot, u64 offset)
+{
+	struct kvm_dirty_ring *ring = &vcpu->dirty_ring;
+	struct kvm_dirty_gfn *entry;
+
+	if (kvm_dirty_ring_used(ring) >= ring->size)
+		return false;
+
+	entry = &ring->dirty_gfns[ring->dirty_index & (ring->size - 1)];
+	entry->slot = slot;
+	entry->offset = offset;
+	/* userspace must see slot and offset before the entry is valid */
+	smp_wmb();
+	entry->flags = KVM_DIRTY_GFN_F_DIRTY;
+	ring->dirty_index++;
+
+	if (kvm_dirty_ring_soft_full(ring))
+		kvm_make_request(KVM_REQ_DIRTY_RING_FULL, vcpu);
+	return true;
+}
+
+/*
+ * Returns true if the vcpu has to exit to userspace to have its ring
+ * harvested.  The request is left pending until userspace has made room,
+ * so a KVM_RUN without an intervening reset exits again at once.
+ */
+bool kvm_dirty_ring_check_request(struct kvm_vcpu *vcpu)
+{
+	if (!kvm_check_request(KVM_REQ_DIRTY_RING_FULL, vcpu))
+		return false;
+
+	if (!kvm_dirty_ring_soft_full(&vcpu->dirty_ring))
+		return false;
+
+	kvm_make_request(KVM_REQ_DIRTY_RING_FULL, vcpu);
+	vcpu->run->exit_reason = KVM_EXIT_DIRTY_RING_FULL;
+	return true;
+}
+
+static void kvm_reset_dirty_gfn(struct kvm *kvm, u32 slot, u64 offset,
+				unsigned long mask)
+{
+	struct kvm_memory_slot *memslot;
+
+	/* slot and offset come from userspace-writable memory */
+	if (slot >= KVM_MEMORY_SLOTS)
+		return;
+
+	memslot = id_to_memslot(kvm->memslots, slot);
+	if (!memslot->dirty_bitmap || offset >= memslot->npages)
+		return;
+
+	if (memslot->npages - offset < BITS_PER_LONG)
+		mask &= (1UL << (memslot->npages - offset)) - 1;
+
+	kvm_arch_mmu_enable_log_dirty_pt_masked(kvm, memslot, offset, mask);
+}
+
+/*
+ * Re-arm dirty tracking for the entries userspace has collected, oldest
+ * first, and hand them back to the vcpu.  Runs of nearby pages in one
+ * slot are batched into a single call of the arch hook.  Returns the
+ * number of entries reset.
+ */
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring)
+{
+	u32 reset_index = ring->reset_index;
+	u32 dirty_index = ACCESS_ONCE(ring->dirty_index);
+	u32 cur_slot = 0, next_slot;
+	u64 cur_offset = 0, next_offset;
+	unsigned long mask = 0;
+	struct kvm_dirty_gfn *entry;
+	int count = 0;
+
+	spin_lock(&kvm->mmu_lock);
+
+	while (reset_index != dirty_index) {
+		entry = &ring->dirty_gfns[reset_index & (ring->size - 1)];
+		if (!(ACCESS_ONCE(entry->flags) & KVM_DIRTY_GFN_F_RESET))
+			break;
+		/* pairs with userspace publishing the reset flag last */
+		smp_rmb();
+		next_slot = ACCESS_ONCE(entry->slot);
+		next_offset = ACCESS_ONCE(entry->offset);
+		entry->flags = 0;
+		reset_index++;
+		count++;
+
+		if (mask && next_slot == cur_slot && next_offset >= cur_offset &&
+		    next_offset - cur_offset < BITS_PER_LONG) {
+			mask |= 1UL << (next_offset - cur_offset);
+			continue;
+		}
+
+		if (mask)
+			kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+		cur_slot = next_slot;
+		cur_offset = next_offset;
+		mask = 1;
+	}
+
+	if (mask)
+		kvm_reset_dirty_gfn(kvm, cur_slot, cur_offset, mask);
+
+	/*
+	 * As in kvm_vm_ioctl_get_dirty_log(), the TLBs must be flushed
+	 * before mmu_lock is dropped.
+	 */
+	if (count)
+		kvm_flush_remote_tlbs(kvm);
+
+	spin_unlock(&kvm->mmu_lock);
+
+	/* the entries are free again only once their flags are cleared */
+	smp_wmb();
+	ACCESS_ONCE(ring->reset_index) = reset_index;
+
+	return count;
+}
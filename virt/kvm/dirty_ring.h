@@ -0,0 +1,36 @@
+/*
+ * kvm per-vcpu dirty ring
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License
+ * as published by the Free Software Foundation.
+ */
+
+#ifndef __KVM_DIRTY_RING_H__
+#define __KVM_DIRTY_RING_H__
+
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+
+#ifndef KVM_CPU_DIRTY_LOG_SIZE
+#define KVM_CPU_DIRTY_LOG_SIZE 0
+#endif
+
+/*
+ * Entries kept free above the soft limit: a vcpu that crossed it can
+ * still log a few pages, plus one full hardware log buffer, on its way
+ * out to userspace.
+ */
+#define KVM_DIRTY_RING_RSVD_ENTRIES	(64 + KVM_CPU_DIRTY_LOG_SIZE)
+#define KVM_DIRTY_RING_MAX_ENTRIES	65536
+
+int kvm_dirty_ring_alloc(struct kvm_dirty_ring *ring, u32 size);
+void kvm_dirty_ring_free(struct kvm_dirty_ring *ring);
+bool kvm_dirty_ring_push(struct kvm_vcpu *vcpu, u32 slot, u64 offset);
+int kvm_dirty_ring_reset(struct kvm *kvm, struct kvm_dirty_ring *ring);
+struct page *kvm_dirty_ring_get_page(struct kvm_dirty_ring *ring,
+				     unsigned long pgoff);
+#else
+#define kvm_dirty_ring_free(R) do{}while(0)
+#endif
+
+#endif
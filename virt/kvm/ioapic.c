@@ -115,6 +115,32 @@ static void update_handled_vectors(struct kvm_ioapic *ioapic)
 	smp_wmb();
 }
 
+/*
+ * With virtualized EOIs the vcpus only exit on EOI of the vectors in
+ * their EOI exit bitmap, which mirrors handled_vectors; have them
+ * reload it after the redirection table changed.
+ */
+static void ioapic_request_eoi_rescan(struct kvm_ioapic *ioapic)
+{
+#ifdef CONFIG_X86
+	if (kvm_x86_ops->vm_has_apicv(ioapic->kvm))
+		kvm_make_scan_ioapic_request(ioapic->kvm);
+#endif
+}
+
+void kvm_ioapic_scan_entry(struct kvm_vcpu *vcpu, u64 *eoi_exit_bitmap)
+{
+	struct kvm_ioapic *ioapic = vcpu->kvm->arch.vioapic;
+
+	if (!ioapic)
+		return;
+
+	spin_lock(&ioapic->lock);
+	memcpy(eoi_exit_bitmap, ioapic->handled_vectors,
+	       sizeof(ioapic->handled_vectors));
+	spin_unlock(&ioapic->lock);
+}
+
 static void ioapic_write_indirect(struct kvm_ioapic *ioapic, u32 val)
 {
 	unsigned index;
@@ -385,6 +411,9 @@ static int ioapic_mmio_write(struct kvm_io_device *this, gpa_t addr, int len,
 		break;
 	}
 	spin_unlock(&ioapic->lock);
+
+	if (addr == IOAPIC_REG_WINDOW)
+		ioapic_request_eoi_rescan(ioapic);
 	return 0;
 }
 
@@ -464,5 +493,6 @@ int kvm_set_ioapic(struct kvm *kvm, struct kvm_ioapic_state *state)
 	memcpy(ioapic, state, sizeof(struct kvm_ioapic_state));
 	update_handled_vectors(ioapic);
 	spin_unlock(&ioapic->lock);
+	ioapic_request_eoi_rescan(ioapic);
 	return 0;
 }
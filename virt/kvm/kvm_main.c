@@ -57,6 +57,7 @@
 
 #include "coalesced_mmio.h"
 #include "async_pf.h"
+#include "dirty_ring.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/kvm.h>
@@ -64,6 +65,22 @@
 MODULE_AUTHOR("Qumranet");
 MODULE_LICENSE("GPL");
 
+#ifndef KVM_HALT_POLL_NS_DEFAULT
+#define KVM_HALT_POLL_NS_DEFAULT 0
+#endif
+
+/* Upper bound on how long a halted vcpu polls before it sleeps, 0 = off */
+static unsigned int halt_poll_ns = KVM_HALT_POLL_NS_DEFAULT;
+module_param(halt_poll_ns, uint, S_IRUGO | S_IWUSR);
+
+/* Multiplier applied to the poll window after a wakeup it would have caught */
+static unsigned int halt_poll_ns_grow = 2;
+module_param(halt_poll_ns_grow, uint, S_IRUGO | S_IWUSR);
+
+/* Divisor applied after a long sleep, 0 = drop straight back to no polling */
+static unsigned int halt_poll_ns_shrink;
+module_param(halt_poll_ns_shrink, uint, S_IRUGO | S_IWUSR);
+
 /*
  * Ordering of locks:
  *
@@ -81,6 +98,8 @@ struct kmem_cache *kvm_vcpu_cache;
 EXPORT_SYMBOL_GPL(kvm_vcpu_cache);
 
 static __read_mostly struct preempt_ops kvm_preempt_ops;
+/* The vcpu loaded on this cpu, if any; see mark_page_dirty_in_slot() */
+static DEFINE_PER_CPU(struct kvm_vcpu *, kvm_running_vcpu);
 
 struct dentry *kvm_debugfs_dir;
 
@@ -151,6 +170,7 @@ void vcpu_load(struct kvm_vcpu *vcpu)
 		put_pid(oldpid);
 	}
 	cpu = get_cpu();
+	__this_cpu_write(kvm_running_vcpu, vcpu);
 	preempt_notifier_register(&vcpu->preempt_notifier);
 	kvm_arch_vcpu_load(vcpu, cpu);
 	put_cpu();
@@ -160,6 +180,7 @@ void vcpu_put(struct kvm_vcpu *vcpu)
 {
 	preempt_disable();
 	kvm_arch_vcpu_put(vcpu);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 	preempt_notifier_unregister(&vcpu->preempt_notifier);
 	preempt_enable();
 	mutex_unlock(&vcpu->mutex);
@@ -216,6 +237,11 @@ void kvm_reload_remote_mmus(struct kvm *kvm)
 	make_all_cpus_request(kvm, KVM_REQ_MMU_RELOAD);
 }
 
+void kvm_make_scan_ioapic_request(struct kvm *kvm)
+{
+	make_all_cpus_request(kvm, KVM_REQ_SCAN_IOAPIC);
+}
+
 int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 {
 	struct page *page;
@@ -226,6 +252,7 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	vcpu->kvm = kvm;
 	vcpu->vcpu_id = id;
 	vcpu->pid = NULL;
+	vcpu->halt_poll_ns = 0;
 	init_waitqueue_head(&vcpu->wq);
 	kvm_async_pf_vcpu_init(vcpu);
 
@@ -252,6 +279,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 {
 	put_pid(vcpu->pid);
 	kvm_arch_vcpu_uninit(vcpu);
+	kvm_dirty_ring_free(&vcpu->dirty_ring);
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -1479,12 +1507,42 @@ int kvm_clear_guest(struct kvm *kvm, gpa_t gpa, unsigned long len)
 }
 EXPORT_SYMBOL_GPL(kvm_clear_guest);
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+/*
+ * Log the page in the ring of the vcpu running on this cpu.  Writes
+ * done without a vcpu of this VM loaded, e.g. from VM ioctls, and
+ * writes that find the ring full go to the dirty bitmap instead, so
+ * userspace has to look at both when it collects the final state.
+ */
+static bool kvm_dirty_ring_log(struct kvm *kvm,
+			       struct kvm_memory_slot *memslot,
+			       unsigned long rel_gfn)
+{
+	struct kvm_vcpu *vcpu = this_cpu_read(kvm_running_vcpu);
+
+	if (!vcpu || vcpu->kvm != kvm || !vcpu->dirty_ring.dirty_gfns)
+		return false;
+
+	return kvm_dirty_ring_push(vcpu, memslot->id, rel_gfn);
+}
+#else
+static inline bool kvm_dirty_ring_log(struct kvm *kvm,
+				      struct kvm_memory_slot *memslot,
+				      unsigned long rel_gfn)
+{
+	return false;
+}
+#endif
+
 void mark_page_dirty_in_slot(struct kvm *kvm, struct kvm_memory_slot *memslot,
 			     gfn_t gfn)
 {
 	if (memslot && memslot->dirty_bitmap) {
 		unsigned long rel_gfn = gfn - memslot->base_gfn;
 
+		if (kvm_dirty_ring_log(kvm, memslot, rel_gfn))
+			return;
+
 		/* TODO: introduce set_bit_le() and use it */
 		test_and_set_bit_le(rel_gfn, memslot->dirty_bitmap);
 	}
@@ -1501,26 +1559,94 @@ void mark_page_dirty(struct kvm *kvm, gfn_t gfn)
 /*
  * The vCPU has executed a HLT instruction with in-kernel mode enabled.
  */
+static void grow_halt_poll_ns(struct kvm_vcpu *vcpu)
+{
+	unsigned int val = vcpu->halt_poll_ns * halt_poll_ns_grow;
+
+	/* start from 10us so that a multiplier can get things going */
+	if (!val && halt_poll_ns_grow)
+		val = 10000;
+	vcpu->halt_poll_ns = min(val, halt_poll_ns);
+}
+
+static void shrink_halt_poll_ns(struct kvm_vcpu *vcpu)
+{
+	if (halt_poll_ns_shrink)
+		vcpu->halt_poll_ns /= halt_poll_ns_shrink;
+	else
+		vcpu->halt_poll_ns = 0;
+}
+
+/* Returns true if the vcpu has something to do and should not block. */
+static bool kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
+{
+	if (kvm_arch_vcpu_runnable(vcpu)) {
+		kvm_make_request(KVM_REQ_UNHALT, vcpu);
+		return true;
+	}
+	if (kvm_cpu_has_pending_timer(vcpu))
+		return true;
+	if (signal_pending(current))
+		return true;
+
+	return false;
+}
+
+/*
+ * The vCPU has executed a HLT instruction with in-kernel mode enabled.
+ *
+ * Wakeups often come within a few microseconds of the halt, sooner than
+ * a trip through the scheduler takes, so first poll for a while.  The
+ * poll window follows how long recent halts lasted: it grows when a
+ * wakeup came shortly after the window closed, and shrinks when the vcpu
+ * slept for longer than halt_poll_ns anyway.
+ */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
+	ktime_t start, cur;
 	DEFINE_WAIT(wait);
+	u64 block_ns;
+
+	start = cur = ktime_get();
+	if (vcpu->halt_poll_ns) {
+		ktime_t stop = ktime_add_ns(start, vcpu->halt_poll_ns);
+
+		++vcpu->stat.halt_attempted_poll;
+		do {
+			if (kvm_vcpu_check_block(vcpu)) {
+				++vcpu->stat.halt_successful_poll;
+				goto out;
+			}
+			cpu_relax();
+			cur = ktime_get();
+		} while (!need_resched() &&
+			 ktime_to_ns(cur) < ktime_to_ns(stop));
+	}
 
 	for (;;) {
 		prepare_to_wait(&vcpu->wq, &wait, TASK_INTERRUPTIBLE);
 
-		if (kvm_arch_vcpu_runnable(vcpu)) {
-			kvm_make_request(KVM_REQ_UNHALT, vcpu);
-			break;
-		}
-		if (kvm_cpu_has_pending_timer(vcpu))
-			break;
-		if (signal_pending(current))
+		if (kvm_vcpu_check_block(vcpu))
 			break;
 
 		schedule();
 	}
 
 	finish_wait(&vcpu->wq, &wait);
+	cur = ktime_get();
+
+out:
+	block_ns = ktime_to_ns(cur) - ktime_to_ns(start);
+
+	if (!halt_poll_ns)
+		vcpu->halt_poll_ns = 0;
+	else if (block_ns > halt_poll_ns) {
+		/* slept for longer than polling could ever cover */
+		if (vcpu->halt_poll_ns)
+			shrink_halt_poll_ns(vcpu);
+	} else if (block_ns > vcpu->halt_poll_ns)
+		/* a somewhat longer window would have caught this wakeup */
+		grow_halt_poll_ns(vcpu);
 }
 
 #ifndef CONFIG_S390
@@ -1631,6 +1757,15 @@ static int kvm_vcpu_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 #ifdef KVM_COALESCED_MMIO_PAGE_OFFSET
 	else if (vmf->pgoff == KVM_COALESCED_MMIO_PAGE_OFFSET)
 		page = virt_to_page(vcpu->kvm->coalesced_mmio_ring);
+#endif
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	else if (vmf->pgoff >= KVM_DIRTY_LOG_PAGE_OFFSET &&
+		 vcpu->dirty_ring.dirty_gfns) {
+		page = kvm_dirty_ring_get_page(&vcpu->dirty_ring,
+				vmf->pgoff - KVM_DIRTY_LOG_PAGE_OFFSET);
+		if (!page)
+			return VM_FAULT_SIGBUS;
+	}
 #endif
 	else
 		return kvm_arch_vcpu_fault(vcpu, vmf);
@@ -1711,6 +1846,16 @@ static int kvm_vm_ioctl_create_vcpu(struct kvm *kvm, u32 id)
 
 	BUG_ON(kvm->vcpus[atomic_read(&kvm->online_vcpus)]);
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	/* under kvm->lock, so KVM_ENABLE_DIRTY_LOG_RING can't slip in */
+	if (kvm->dirty_ring_size) {
+		r = kvm_dirty_ring_alloc(&vcpu->dirty_ring,
+					 kvm->dirty_ring_size);
+		if (r)
+			goto unlock_vcpu_destroy;
+	}
+#endif
+
 	/* Now it's all set up, let userspace reach it */
 	kvm_get_kvm(kvm);
 	r = create_vcpu_fd(vcpu);
@@ -1991,6 +2136,50 @@ out:
 }
 #endif
 
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+static int kvm_vm_ioctl_enable_dirty_log_ring(struct kvm *kvm, u32 size)
+{
+	u32 entries = size / sizeof(struct kvm_dirty_gfn);
+	int r;
+
+	/* a power of two number of whole pages */
+	if (size < PAGE_SIZE || (size & (size - 1)))
+		return -EINVAL;
+
+	if (entries <= KVM_DIRTY_RING_RSVD_ENTRIES ||
+	    entries > KVM_DIRTY_RING_MAX_ENTRIES)
+		return -EINVAL;
+
+	mutex_lock(&kvm->lock);
+	r = -EINVAL;
+	/* the rings are allocated with the vcpus */
+	if (kvm->dirty_ring_size || atomic_read(&kvm->online_vcpus))
+		goto out;
+	kvm->dirty_ring_size = size;
+	r = 0;
+out:
+	mutex_unlock(&kvm->lock);
+	return r;
+}
+
+static int kvm_vm_ioctl_reset_dirty_rings(struct kvm *kvm)
+{
+	struct kvm_vcpu *vcpu;
+	int i, cleared = 0;
+
+	if (!kvm->dirty_ring_size)
+		return -EINVAL;
+
+	/* keeps the memslots stable for kvm_dirty_ring_reset() */
+	mutex_lock(&kvm->slots_lock);
+	kvm_for_each_vcpu(i, vcpu, kvm)
+		cleared += kvm_dirty_ring_reset(kvm, &vcpu->dirty_ring);
+	mutex_unlock(&kvm->slots_lock);
+
+	return cleared;
+}
+#endif
+
 static long kvm_vm_ioctl(struct file *filp,
 			   unsigned int ioctl, unsigned long arg)
 {
@@ -2030,6 +2219,14 @@ static long kvm_vm_ioctl(struct file *filp,
 			goto out;
 		break;
 	}
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_ENABLE_DIRTY_LOG_RING:
+		r = kvm_vm_ioctl_enable_dirty_log_ring(kvm, arg);
+		break;
+	case KVM_RESET_DIRTY_RINGS:
+		r = kvm_vm_ioctl_reset_dirty_rings(kvm);
+		break;
+#endif
 #ifdef KVM_COALESCED_MMIO_PAGE_OFFSET
 	case KVM_REGISTER_COALESCED_MMIO: {
 		struct kvm_coalesced_mmio_zone zone;
@@ -2229,6 +2426,10 @@ static long kvm_dev_ioctl_check_extension_generic(long arg)
 #ifdef KVM_CAP_IRQ_ROUTING
 	case KVM_CAP_IRQ_ROUTING:
 		return KVM_MAX_IRQ_ROUTES;
+#endif
+#ifdef CONFIG_HAVE_KVM_DIRTY_RING
+	case KVM_CAP_DIRTY_LOG_RING:
+		return KVM_DIRTY_RING_MAX_ENTRIES * sizeof(struct kvm_dirty_gfn);
 #endif
 	default:
 		break;
@@ -2440,10 +2641,23 @@ int kvm_io_bus_sort_cmp(const void *p1, const void *p2)
 {
 	const struct kvm_io_range *r1 = p1;
 	const struct kvm_io_range *r2 = p2;
+	gpa_t addr1 = r1->addr;
+	gpa_t addr2 = r2->addr;
 
-	if (r1->addr < r2->addr)
+	if (addr1 < addr2)
 		return -1;
-	if (r1->addr + r1->len > r2->addr + r2->len)
+
+	/*
+	 * A zero-length range matches any access that starts at its
+	 * address, whatever the access size.  Otherwise the access has
+	 * to lie within the range.
+	 */
+	if (r2->len) {
+		addr1 += r1->len;
+		addr2 += r2->len;
+	}
+
+	if (addr1 > addr2)
 		return 1;
 	return 0;
 }
@@ -2711,6 +2925,7 @@ static void kvm_sched_in(struct preempt_notifier *pn, int cpu)
 {
 	struct kvm_vcpu *vcpu = preempt_notifier_to_vcpu(pn);
 
+	__this_cpu_write(kvm_running_vcpu, vcpu);
 	kvm_arch_vcpu_load(vcpu, cpu);
 }
 
@@ -2720,6 +2935,7 @@ static void kvm_sched_out(struct preempt_notifier *pn,
 	struct kvm_vcpu *vcpu = preempt_notifier_to_vcpu(pn);
 
 	kvm_arch_vcpu_put(vcpu);
+	__this_cpu_write(kvm_running_vcpu, NULL);
 }
 
 int kvm_init(void *opaque, unsigned vcpu_size, unsigned vcpu_align,